@@ -0,0 +1,199 @@
+// Packets of the audio streams, raw PCM or Opus frames. Both sides pick the same codec from the
+// settings and the sample rate, so the packets carry no codec information. Streams at a sample
+// rate that Opus does not support stay in PCM. Without the opus feature only PCM is available.
+
+use alvr_common::prelude::*;
+use alvr_session::AudioCodec;
+use cpal::Sample;
+#[cfg(feature = "opus")]
+use opus::{Application, Bitrate, Channels};
+
+// Largest packet of a single Opus frame
+#[cfg(feature = "opus")]
+const MAX_OPUS_PACKET_SIZE: usize = 1275;
+// Longest Opus frame that can be decoded
+#[cfg(feature = "opus")]
+const MAX_OPUS_FRAME_MS: usize = 120;
+// Sizes the redundancy that lets the receiver recover a lost frame from the next packet
+#[cfg(feature = "opus")]
+const OPUS_EXPECTED_LOSS_PERCENT: i32 = 5;
+
+#[cfg(feature = "opus")]
+fn opus_channels(channels_count: usize) -> Channels {
+    if channels_count == 1 {
+        Channels::Mono
+    } else {
+        Channels::Stereo
+    }
+}
+
+// Samples of all channels in an Opus frame, None if the stream is sent in PCM. A build without
+// Opus fails instead of sending PCM: the other side would decode it as Opus.
+fn opus_frame_samples(
+    codec: &AudioCodec,
+    channels_count: usize,
+    sample_rate: u32,
+) -> StrResult<Option<usize>> {
+    match codec {
+        AudioCodec::Opus { frame_ms, .. }
+            if matches!(sample_rate, 8000 | 12000 | 16000 | 24000 | 48000)
+                && (1..=2).contains(&channels_count) =>
+        {
+            if cfg!(feature = "opus") {
+                Ok(Some(
+                    sample_rate as usize * *frame_ms as usize / 1000 * channels_count,
+                ))
+            } else {
+                fmt_e!("Opus is not available in this build, please select the PCM audio codec")
+            }
+        }
+        _ => Ok(None),
+    }
+}
+
+pub enum AudioEncoder {
+    Pcm {
+        packet: Vec<u8>,
+    },
+    #[cfg(feature = "opus")]
+    Opus {
+        encoder: opus::Encoder,
+        frame_samples: usize,
+        packet: Vec<u8>,
+    },
+}
+
+impl AudioEncoder {
+    pub fn new(codec: &AudioCodec, channels_count: usize, sample_rate: u32) -> StrResult<Self> {
+        match (
+            opus_frame_samples(codec, channels_count, sample_rate)?,
+            codec,
+        ) {
+            #[cfg(feature = "opus")]
+            (Some(frame_samples), AudioCodec::Opus { bitrate_kbps, .. }) => {
+                let mut encoder = trace_err!(opus::Encoder::new(
+                    sample_rate,
+                    opus_channels(channels_count),
+                    Application::LowDelay
+                ))?;
+                trace_err!(encoder.set_bitrate(Bitrate::Bits(*bitrate_kbps as i32 * 1000)))?;
+                trace_err!(encoder.set_inband_fec(true))?;
+                trace_err!(encoder.set_packet_loss_perc(OPUS_EXPECTED_LOSS_PERCENT))?;
+
+                Ok(Self::Opus {
+                    encoder,
+                    frame_samples,
+                    packet: vec![0; MAX_OPUS_PACKET_SIZE],
+                })
+            }
+            (None, AudioCodec::Opus { .. }) => {
+                info!("Opus does not support {sample_rate} Hz, audio is sent in PCM");
+                Ok(Self::Pcm { packet: vec![] })
+            }
+            _ => Ok(Self::Pcm { packet: vec![] }),
+        }
+    }
+
+    // Samples of each packet. None sends the samples as they come.
+    pub fn frame_samples(&self) -> Option<usize> {
+        match self {
+            Self::Pcm { .. } => None,
+            #[cfg(feature = "opus")]
+            Self::Opus { frame_samples, .. } => Some(*frame_samples),
+        }
+    }
+
+    // With Opus `samples` must be a whole frame
+    pub fn encode(&mut self, samples: &[i16]) -> StrResult<&[u8]> {
+        match self {
+            Self::Pcm { packet } => {
+                packet.clear();
+                packet.extend(samples.iter().flat_map(|sample| sample.to_ne_bytes()));
+
+                Ok(packet)
+            }
+            #[cfg(feature = "opus")]
+            Self::Opus {
+                encoder, packet, ..
+            } => {
+                let size = trace_err!(encoder.encode(samples, packet))?;
+
+                Ok(&packet[..size])
+            }
+        }
+    }
+}
+
+pub enum AudioDecoder {
+    Pcm,
+    #[cfg(feature = "opus")]
+    Opus {
+        decoder: opus::Decoder,
+        channels_count: usize,
+        frame_samples: usize,
+        samples: Vec<i16>,
+    },
+}
+
+impl AudioDecoder {
+    pub fn new(codec: &AudioCodec, channels_count: usize, sample_rate: u32) -> StrResult<Self> {
+        match opus_frame_samples(codec, channels_count, sample_rate)? {
+            #[cfg(feature = "opus")]
+            Some(frame_samples) => Ok(Self::Opus {
+                decoder: trace_err!(opus::Decoder::new(
+                    sample_rate,
+                    opus_channels(channels_count)
+                ))?,
+                channels_count,
+                frame_samples,
+                samples: vec![0; sample_rate as usize * MAX_OPUS_FRAME_MS / 1000 * channels_count],
+            }),
+            _ => Ok(Self::Pcm),
+        }
+    }
+
+    pub fn is_opus(&self) -> bool {
+        !matches!(self, Self::Pcm)
+    }
+
+    // Replaces the content of `output`. If packets were lost just before this one, Opus first
+    // recovers the last of them from the redundancy of this packet, or conceals it.
+    #[cfg_attr(not(feature = "opus"), allow(unused_variables))]
+    pub fn decode(&mut self, packet: &[u8], after_loss: bool, output: &mut Vec<f32>) -> StrResult {
+        output.clear();
+
+        match self {
+            Self::Pcm => output.extend(
+                packet
+                    .chunks_exact(2)
+                    .map(|c| i16::from_ne_bytes([c[0], c[1]]).to_f32()),
+            ),
+            #[cfg(feature = "opus")]
+            Self::Opus {
+                decoder,
+                channels_count,
+                frame_samples,
+                samples,
+            } => {
+                if after_loss {
+                    let frames =
+                        trace_err!(decoder.decode(packet, &mut samples[..*frame_samples], true))?;
+                    output.extend(
+                        samples[..frames * *channels_count]
+                            .iter()
+                            .map(|sample| sample.to_f32()),
+                    );
+                }
+
+                let frames = trace_err!(decoder.decode(packet, samples, false))?;
+                output.extend(
+                    samples[..frames * *channels_count]
+                        .iter()
+                        .map(|sample| sample.to_f32()),
+                );
+            }
+        }
+
+        Ok(())
+    }
+}
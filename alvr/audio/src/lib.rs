@@ -1,17 +1,22 @@
+mod codec;
+mod ring;
+
+pub use ring::{RingConsumer, RingProducer};
+
 use alvr_common::{lazy_static, prelude::*};
-use alvr_session::{AudioConfig, AudioDeviceId, LinuxAudioBackend};
-use alvr_sockets::{StreamReceiver, StreamSender};
+use alvr_session::{AudioCodec, AudioConfig, AudioDeviceId, LinuxAudioBackend};
+use alvr_sockets::{AudioPacketHeader, StreamReceiver, StreamSender};
+use codec::{AudioDecoder, AudioEncoder};
 use cpal::{
     traits::{DeviceTrait, HostTrait, StreamTrait},
     BufferSize, Device, Sample, SampleFormat, SampleRate, StreamConfig,
 };
-use parking_lot::Mutex;
 use rodio::{OutputStream, Source};
 use serde::Serialize;
 use std::{
-    collections::VecDeque,
-    sync::{mpsc as smpsc, Arc},
+    sync::mpsc as smpsc,
     thread,
+    time::{Instant, SystemTime, UNIX_EPOCH},
 };
 use tokio::sync::mpsc as tmpsc;
 
@@ -40,6 +45,25 @@ use winapi::{
 #[cfg(windows)]
 use wio::com::ComPtr;
 
+// Capacity of the rings between the audio callbacks and the network tasks
+const RING_DURATION_MS: usize = 500;
+// Samples converted at once by the capture callback
+const CAPTURE_CHUNK_SAMPLES: usize = 1024;
+// Longest audio in a PCM packet, which keeps it in one datagram
+const MAX_PCM_PACKET_MS: usize = 10;
+// Seconds of packet arrivals that size the adaptive buffering
+const JITTER_WINDOW_S: usize = 5;
+// Largest change of the playback speed to compensate the clock drift, inaudible
+const MAX_DRIFT_CORRECTION: f32 = 0.005;
+// Latency error that the drift compensation corrects in about this time
+const DRIFT_CORRECTION_S: f32 = 5.;
+// Smoothing of the latency error, which follows the noise of the clock offset
+const DRIFT_SMOOTHING_S: f32 = 1.;
+// Latency error left alone
+const LATENCY_TOLERANCE_S: f32 = 0.002;
+// Averaging of the drift estimate
+const DRIFT_ESTIMATION_S: f32 = 10.;
+
 lazy_static! {
     static ref VIRTUAL_MICROPHONE_PAIRS: Vec<(String, String)> = vec![
         ("CABLE Input".into(), "CABLE Output".into()),
@@ -353,13 +377,116 @@ pub fn get_sample_rate(device: &AudioDevice) -> StrResult<u32> {
     }
 }
 
+fn ring_capacity(channels_count: usize, sample_rate: u32) -> usize {
+    sample_rate as usize * RING_DURATION_MS / 1000 * channels_count
+}
+
+pub fn playback_ring(
+    channels_count: usize,
+    sample_rate: u32,
+) -> (RingProducer<f32>, RingConsumer<f32>) {
+    ring::sample_ring(ring_capacity(channels_count, sample_rate))
+}
+
+pub fn capture_ring(
+    channels_count: usize,
+    sample_rate: u32,
+) -> (RingProducer<i16>, RingConsumer<i16>) {
+    ring::sample_ring(ring_capacity(channels_count, sample_rate))
+}
+
+// Converts the captured samples to the channel count of the stream and pushes them to the ring.
+// They are staged on the stack: the audio callback must not allocate.
+pub fn push_captured_samples(
+    producer: &mut RingProducer<i16>,
+    samples: impl Iterator<Item = i16>,
+    device_channels_count: u16,
+    channels_count: u16,
+) {
+    let mut chunk = [0_i16; CAPTURE_CHUNK_SAMPLES];
+    let mut chunk_len = 0;
+
+    let repeat = if device_channels_count == 1 && channels_count == 2 {
+        2
+    } else {
+        1
+    };
+    for (index, sample) in samples.enumerate() {
+        if device_channels_count == 2 && channels_count == 1 && index % 2 == 1 {
+            continue;
+        }
+
+        for _ in 0..repeat {
+            chunk[chunk_len] = sample;
+            chunk_len += 1;
+
+            if chunk_len == chunk.len() {
+                producer.push(&chunk);
+                chunk_len = 0;
+            }
+        }
+    }
+
+    producer.push(&chunk[..chunk_len]);
+}
+
+// Microseconds since the epoch, the clock of the TimeSync packets
+fn timestamp_us() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map(|duration| duration.as_micros() as u64)
+        .unwrap_or_default()
+}
+
+// Network side of a capture: sends the samples of the ring as they come, or by Opus frames
+pub async fn send_samples_loop(
+    mut consumer: RingConsumer<i16>,
+    channels_count: usize,
+    sample_rate: u32,
+    codec: AudioCodec,
+    mut sender: StreamSender<AudioPacketHeader>,
+) -> StrResult {
+    let mut encoder = AudioEncoder::new(&codec, channels_count, sample_rate)?;
+    let (packet_samples, min_packet_samples) = match encoder.frame_samples() {
+        Some(frame_samples) => (frame_samples, frame_samples),
+        None => (
+            sample_rate as usize * MAX_PCM_PACKET_MS / 1000 * channels_count,
+            1,
+        ),
+    };
+    let mut samples = vec![0; packet_samples];
+
+    loop {
+        consumer.wait(min_packet_samples).await;
+
+        while consumer.len() >= min_packet_samples {
+            let count = consumer.pop(&mut samples);
+
+            // The newest sample of the ring was just captured, the first one of the packet is
+            // older by the duration of the samples that follow it
+            let queued_frames_count = (count + consumer.len()) / channels_count;
+            let header = AudioPacketHeader {
+                capture_time_us: timestamp_us()
+                    - queued_frames_count as u64 * 1_000_000 / sample_rate as u64,
+            };
+
+            let packet = encoder.encode(&samples[..count])?;
+
+            let mut buffer = sender.new_buffer(&header, packet.len())?;
+            buffer.get_mut().extend_from_slice(packet);
+            sender.send_buffer(buffer).await.ok();
+        }
+    }
+}
+
 #[cfg_attr(not(windows), allow(unused_variables))]
 pub async fn record_audio_loop(
     device: AudioDevice,
     channels_count: u16,
     sample_rate: u32,
     mute: bool,
-    mut sender: StreamSender<()>,
+    codec: AudioCodec,
+    sender: StreamSender<AudioPacketHeader>,
 ) -> StrResult {
     let maybe_config_range = trace_err!(device.inner.supported_output_configs())?.next();
     let config = if let Some(config) = maybe_config_range {
@@ -385,12 +512,13 @@ pub async fn record_audio_loop(
         buffer_size: BufferSize::Default,
     };
 
-    // data_sender/receiver is the bridge between tokio and std thread
-    let (data_sender, mut data_receiver) = tmpsc::unbounded_channel::<StrResult<Vec<_>>>();
+    // The samples go from the std thread to tokio through the ring, only errors use the channel
+    let (mut producer, consumer) = capture_ring(channels_count as _, sample_rate);
+    let (error_sender, mut error_receiver) = tmpsc::unbounded_channel::<String>();
     let (_shutdown_notifier, shutdown_receiver) = smpsc::channel::<()>();
 
     let thread_callback = {
-        let data_sender = data_sender.clone();
+        let error_sender = error_sender.clone();
         move || {
             #[cfg(windows)]
             if mute && device.device_type.is_output() {
@@ -400,45 +528,39 @@ pub async fn record_audio_loop(
             let stream = trace_err!(device.inner.build_input_stream_raw(
                 &stream_config,
                 config.sample_format(),
-                {
-                    let data_sender = data_sender.clone();
-                    move |data, _| {
-                        let data = if config.sample_format() == SampleFormat::F32 {
-                            data.bytes()
-                                .chunks_exact(4)
-                                .flat_map(|b| {
-                                    f32::from_ne_bytes([b[0], b[1], b[2], b[3]])
-                                        .to_i16()
-                                        .to_ne_bytes()
-                                        .to_vec()
-                                })
-                                .collect()
-                        } else {
-                            data.bytes().to_vec()
-                        };
-
-                        let data = if config.channels() == 1 && channels_count == 2 {
-                            data.chunks_exact(2)
-                                .flat_map(|c| vec![c[0], c[1], c[0], c[1]])
-                                .collect()
-                        } else if config.channels() == 2 && channels_count == 1 {
-                            data.chunks_exact(4)
-                                .flat_map(|c| vec![c[0], c[1]])
-                                .collect()
-                        } else {
-                            data
-                        };
-
-                        data_sender.send(Ok(data)).ok();
+                move |data, _| {
+                    let device_channels_count = config.channels();
+                    match config.sample_format() {
+                        SampleFormat::F32 => push_captured_samples(
+                            &mut producer,
+                            data.as_slice::<f32>()
+                                .unwrap_or_default()
+                                .iter()
+                                .map(|sample| sample.to_i16()),
+                            device_channels_count,
+                            channels_count,
+                        ),
+                        SampleFormat::I16 => push_captured_samples(
+                            &mut producer,
+                            data.as_slice::<i16>().unwrap_or_default().iter().copied(),
+                            device_channels_count,
+                            channels_count,
+                        ),
+                        SampleFormat::U16 => push_captured_samples(
+                            &mut producer,
+                            data.as_slice::<u16>()
+                                .unwrap_or_default()
+                                .iter()
+                                .map(|sample| sample.to_i16()),
+                            device_channels_count,
+                            channels_count,
+                        ),
                     }
                 },
-                {
-                    let data_sender = data_sender.clone();
-                    move |e| {
-                        data_sender
-                            .send(fmt_e!("Error while recording audio: {e}"))
-                            .ok();
-                    }
+                move |e| {
+                    error_sender
+                        .send(format!("Error while recording audio: {e}"))
+                        .ok();
                 }
             ))?;
 
@@ -451,43 +573,40 @@ pub async fn record_audio_loop(
                 set_mute_windows_device(&device, false).ok();
             }
 
-            Ok(vec![])
+            Ok(())
         }
     };
 
     // use a std thread to store the stream object. The stream object must be destroyed on the same
     // thread of creation.
     thread::spawn(move || {
-        let res = thread_callback();
-        if res.is_err() {
-            data_sender.send(res).ok();
+        if let Err(e) = thread_callback() {
+            error_sender.send(e).ok();
         }
     });
 
-    while let Some(maybe_data) = data_receiver.recv().await {
-        let data = maybe_data?;
-        let mut buffer = sender.new_buffer(&(), data.len())?;
-        buffer.get_mut().extend(data);
-        sender.send_buffer(buffer).await.ok();
+    tokio::select! {
+        res = send_samples_loop(consumer, channels_count as _, sample_rate, codec, sender) => res,
+        Some(e) = error_receiver.recv() => Err(e),
     }
-
-    Ok(())
 }
 
-// Audio callback. This is designed to be as less complex as possible. Still, when needed, this
-// callback can render a fade-out autonomously.
+// Audio callback. This is designed to be as less complex as possible: it only reads the ring and
+// never allocates. A batch is played only if it is complete. When the ring runs dry the batch fades
+// out and the rest of the ring is dropped, the receive loop then refills it starting with a fade-in.
 #[inline]
 pub fn get_next_frame_batch(
-    sample_buffer: &mut VecDeque<f32>,
+    consumer: &mut RingConsumer<f32>,
     channels_count: usize,
-    batch_frames_count: usize,
-) -> Vec<f32> {
-    if sample_buffer.len() / channels_count >= batch_frames_count {
-        let mut batch = sample_buffer
-            .drain(0..batch_frames_count * channels_count)
-            .collect::<Vec<_>>();
-
-        if sample_buffer.len() / channels_count < batch_frames_count {
+    batch: &mut [f32],
+) {
+    let batch_frames_count = batch.len() / channels_count;
+
+    if consumer.len() >= batch.len() {
+        consumer.pop(batch);
+
+        let remaining = consumer.len();
+        if remaining < batch.len() {
             // Render fade-out. It is completely contained in the current batch
             for f in 0..batch_frames_count {
                 let volume = 1. - f as f32 / batch_frames_count as f32;
@@ -495,119 +614,355 @@ pub fn get_next_frame_batch(
                     batch[f * channels_count + c] *= volume;
                 }
             }
-        }
-        // fade-ins and cross-fades are rendered in the receive loop directly inside sample_buffer.
 
-        batch
+            consumer.skip(remaining);
+        }
+        // fade-ins and cross-fades are rendered by the receive loop before pushing the samples
     } else {
-        vec![0.; batch_frames_count * channels_count]
+        batch.fill(0.);
+
+        // Leftovers of a fade-out. The receive loop refills the ring with at least a batch at once,
+        // so these cannot be new samples.
+        consumer.skip(consumer.len());
+    }
+}
+
+fn fade_in(samples: &mut [f32], channels_count: usize, fade_frames_count: usize) {
+    for f in 0..fade_frames_count {
+        let volume = f as f32 / fade_frames_count as f32;
+        for c in 0..channels_count {
+            samples[f * channels_count + c] *= volume;
+        }
+    }
+}
+
+// Spread of the arrival times of the packets relative to the audio they carry, over the last few
+// seconds. Clock drift between the two devices only moves the arrival times slowly, so it does not
+// count as jitter. When the packets are timestamped on a synchronized clock, their transit time
+// is used instead of the arrival schedule.
+struct JitterEstimator {
+    sample_rate: u32,
+    start: Option<Instant>,
+    received_frames_count: u64,
+    timestamped: bool,
+    // Lowest and highest lateness of each second of the window, in seconds
+    buckets: [(f32, f32); JITTER_WINDOW_S],
+    current_second: u64,
+}
+
+impl JitterEstimator {
+    fn new(sample_rate: u32) -> Self {
+        Self {
+            sample_rate,
+            start: None,
+            received_frames_count: 0,
+            timestamped: false,
+            buckets: [(f32::MAX, f32::MIN); JITTER_WINDOW_S],
+            current_second: 0,
+        }
+    }
+
+    // Forgets the past arrivals, after the stream stalled
+    fn reset(&mut self) {
+        *self = Self::new(self.sample_rate);
+    }
+
+    // Lowest and highest lateness of the window
+    fn window(&self) -> (f32, f32) {
+        self.buckets
+            .iter()
+            .fold((f32::MAX, f32::MIN), |(min, max), bucket| {
+                (min.min(bucket.0), max.max(bucket.1))
+            })
+    }
+
+    // Lowest transit time of the window in seconds, for timestamped packets
+    fn min_transit(&self) -> f32 {
+        self.window().0
+    }
+
+    // `transit` is the time since the capture of the packet, if known. Returns the jitter in
+    // frames, None until the window holds a whole second.
+    fn update(&mut self, now: Instant, frames_count: usize, transit: Option<f32>) -> Option<usize> {
+        // Lateness measured both ways cannot be compared
+        if self.timestamped != transit.is_some() {
+            self.reset();
+            self.timestamped = transit.is_some();
+        }
+
+        let start = *self.start.get_or_insert(now);
+        let elapsed = now.saturating_duration_since(start);
+
+        // Positive when the packet arrives later than the audio it carries is due
+        let lateness = transit.unwrap_or_else(|| {
+            elapsed.as_secs_f32() - self.received_frames_count as f32 / self.sample_rate as f32
+        });
+        self.received_frames_count += frames_count as u64;
+
+        let second = elapsed.as_secs();
+        for s in (self.current_second + 1..=second).take(JITTER_WINDOW_S) {
+            self.buckets[s as usize % JITTER_WINDOW_S] = (f32::MAX, f32::MIN);
+        }
+        self.current_second = second;
+
+        let bucket = &mut self.buckets[second as usize % JITTER_WINDOW_S];
+        bucket.0 = bucket.0.min(lateness);
+        bucket.1 = bucket.1.max(lateness);
+
+        if second == 0 {
+            return None;
+        }
+
+        let (min, max) = self.window();
+
+        Some(((max - min) * self.sample_rate as f32) as usize)
+    }
+}
+
+// Holds the latency from the capture of the samples to their playback at a target, against the
+// drift between the clocks of the two audio devices. A late packet finds an emptier buffer, so
+// jitter does not move this latency, only drift does. The samples are stretched or squeezed by at
+// most MAX_DRIFT_CORRECTION to bring it back, with linear interpolation. Correcting the error
+// alone would hold the latency off target by the drift times DRIFT_CORRECTION_S, which eats the
+// buffer at a large drift, so the drift itself is cancelled too.
+struct DriftCompensator {
+    channels_count: usize,
+    sample_rate: u32,
+    // Latency minus its target, smoothed, in seconds
+    error: Option<f32>,
+    // Growth of the latency without correction in seconds per second, learned from how the error
+    // moves under the correction. The device clocks do not change, so it is kept across the resets.
+    drift: f32,
+    // Speed change applied to the previous packet
+    correction: f32,
+    // Position of the next output frame in the input. -1 is the last frame of the previous packet.
+    position: f64,
+    last_frame: Vec<f32>,
+    output: Vec<f32>,
+}
+
+impl DriftCompensator {
+    fn new(channels_count: usize, sample_rate: u32) -> Self {
+        Self {
+            channels_count,
+            sample_rate,
+            error: None,
+            drift: 0.,
+            correction: 0.,
+            position: 0.,
+            last_frame: vec![0.; channels_count],
+            output: vec![],
+        }
+    }
+
+    // The next packet does not follow the last processed one
+    fn reset(&mut self) {
+        self.error = None;
+        self.position = 0.;
+    }
+
+    fn process(&mut self, samples: &[f32], latency_error: f32) -> &[f32] {
+        let channels_count = self.channels_count;
+        let frames_count = samples.len() / channels_count;
+        self.output.clear();
+        if frames_count == 0 {
+            return &self.output;
+        }
+
+        let duration = frames_count as f32 / self.sample_rate as f32;
+        let smoothing = (duration / DRIFT_SMOOTHING_S).min(1.);
+        let error = if let Some(last_error) = self.error {
+            let error = last_error + (latency_error - last_error) * smoothing;
+
+            // The latency grows with the drift and shrinks with the correction
+            let drift = (error - last_error) / duration + self.correction;
+            self.drift += (drift - self.drift) * (duration / DRIFT_ESTIMATION_S).min(1.);
+
+            error
+        } else {
+            latency_error
+        };
+        self.error = Some(error);
+
+        let error_correction = if error.abs() < LATENCY_TOLERANCE_S {
+            0.
+        } else {
+            error / DRIFT_CORRECTION_S
+        };
+        self.correction =
+            (self.drift + error_correction).clamp(-MAX_DRIFT_CORRECTION, MAX_DRIFT_CORRECTION);
+
+        // Input frames per output frame. Playing faster lowers the latency.
+        let step = 1. + self.correction as f64;
+
+        let last_frame = &self.last_frame;
+        let frame = |index: isize| {
+            if index < 0 {
+                last_frame.as_slice()
+            } else {
+                let start = index as usize * channels_count;
+                &samples[start..start + channels_count]
+            }
+        };
+        while self.position < (frames_count - 1) as f64 {
+            let index = self.position.floor();
+            let fraction = (self.position - index) as f32;
+            let (from, to) = (frame(index as isize), frame(index as isize + 1));
+            for c in 0..channels_count {
+                self.output.push(from[c] + (to[c] - from[c]) * fraction);
+            }
+
+            self.position += step;
+        }
+        self.position -= frames_count as f64;
+        self.last_frame
+            .copy_from_slice(&samples[(frames_count - 1) * channels_count..]);
+
+        &self.output
     }
 }
 
 // The receive loop is resposible for ensuring smooth transitions in case of disruptions (buffer
-// underflow, overflow, packet loss). In case the computation takes too much time, the audio
-// callback will gracefully handle an interruption, and the callback timing and sound wave
-// continuity will not be affected.
+// underflow, overflow, packet loss). It is the only writer of the ring, so it only shapes the
+// samples before pushing them: in case the computation takes too much time, the audio callback
+// will gracefully handle an interruption, and the callback timing and sound wave continuity will
+// not be affected.
+// `clock_offset` returns the sender clock minus the receiver clock in us, None while unknown.
+// Without it the buffering follows the arrival schedule and the clock drift is not compensated.
 pub async fn receive_samples_loop(
-    mut receiver: StreamReceiver<()>,
-    sample_buffer: Arc<Mutex<VecDeque<f32>>>,
+    mut receiver: StreamReceiver<AudioPacketHeader>,
+    mut producer: RingProducer<f32>,
     channels_count: usize,
-    batch_frames_count: usize,
-    average_buffer_frames_count: usize,
+    sample_rate: u32,
+    config: AudioConfig,
+    clock_offset: fn() -> Option<i64>,
 ) -> StrResult {
+    // Size of a chunk of frames. It corresponds to the duration if a fade-in/out in frames.
+    let batch_frames_count = sample_rate as usize * config.batch_ms as usize / 1000;
+    // Average buffer size in frames. Adaptive buffering lowers it to the jitter of the link.
+    let max_average_buffer_frames_count =
+        sample_rate as usize * config.average_buffering_ms as usize / 1000;
+
+    let mut decoder = AudioDecoder::new(&config.codec, channels_count, sample_rate)?;
+    let mut jitter_estimator = JitterEstimator::new(sample_rate);
+    let mut drift_compensator = DriftCompensator::new(channels_count, sample_rate);
+
+    let mut new_samples = vec![];
     let mut recovery_sample_buffer = vec![];
+    let mut recovering = true;
     loop {
         let packet = receiver.recv().await?;
-        let new_samples = packet
-            .buffer
-            .chunks_exact(2)
-            .map(|c| i16::from_ne_bytes([c[0], c[1]]).to_f32())
-            .collect::<Vec<_>>();
-
-        let mut sample_buffer_ref = sample_buffer.lock();
+        decoder.decode(&packet.buffer, packet.had_packet_loss, &mut new_samples)?;
+
+        let transit = clock_offset().map(|offset| {
+            let capture_time_us = packet.header.capture_time_us as i64 - offset;
+            (timestamp_us() as i64 - capture_time_us) as f32 / 1e6
+        });
+        let jitter_frames_count =
+            jitter_estimator.update(Instant::now(), new_samples.len() / channels_count, transit);
+
+        let average_buffer_frames_count = match jitter_frames_count {
+            // The buffer must still hold a batch when a packet comes that late
+            Some(jitter_frames_count) if config.adaptive_buffering => {
+                (jitter_frames_count + batch_frames_count).min(max_average_buffer_frames_count)
+            }
+            _ => max_average_buffer_frames_count,
+        }
+        .max(batch_frames_count);
 
         if packet.had_packet_loss {
             info!("Audio packet loss!");
 
-            if sample_buffer_ref.len() / channels_count < batch_frames_count {
-                sample_buffer_ref.clear();
-            } else {
-                // clear remaining samples
-                sample_buffer_ref.drain(batch_frames_count * channels_count..);
+            // Opus conceals the loss, PCM would resume with a click
+            if !decoder.is_opus() && !recovering {
+                let fade_frames_count = batch_frames_count.min(new_samples.len() / channels_count);
+                fade_in(&mut new_samples, channels_count, fade_frames_count);
             }
-
-            recovery_sample_buffer.clear();
         }
 
-        if sample_buffer_ref.len() / channels_count < batch_frames_count {
-            recovery_sample_buffer.extend(sample_buffer_ref.drain(..));
+        if !recovering && producer.len() / channels_count < batch_frames_count {
+            // The audio callback faded out and drops what is left in the ring
+            recovering = true;
+            jitter_estimator.reset();
+            drift_compensator.reset();
         }
 
-        if sample_buffer_ref.len() == 0 || packet.had_packet_loss {
+        if recovering {
             recovery_sample_buffer.extend(&new_samples);
 
             if recovery_sample_buffer.len() / channels_count
                 > average_buffer_frames_count + batch_frames_count
             {
-                // Fade-in
-                for f in 0..batch_frames_count {
-                    let volume = f as f32 / batch_frames_count as f32;
-                    for c in 0..channels_count {
-                        recovery_sample_buffer[f * channels_count + c] *= volume;
-                    }
-                }
-
-                if packet.had_packet_loss
-                    && sample_buffer_ref.len() / channels_count == batch_frames_count
-                {
-                    // Add a fade-out to make a cross-fade.
-                    for f in 0..batch_frames_count {
-                        let volume = 1. - f as f32 / batch_frames_count as f32;
-                        for c in 0..channels_count {
-                            recovery_sample_buffer[f * channels_count + c] +=
-                                sample_buffer_ref[f * channels_count + c] * volume;
-                        }
-                    }
-
-                    sample_buffer_ref.clear();
-                }
+                fade_in(
+                    &mut recovery_sample_buffer,
+                    channels_count,
+                    batch_frames_count,
+                );
+                producer.push(&recovery_sample_buffer);
+                recovery_sample_buffer.clear();
+                recovering = false;
 
-                sample_buffer_ref.extend(recovery_sample_buffer.drain(..));
                 info!("Audio recovered");
             }
-        } else {
-            sample_buffer_ref.extend(&new_samples);
+
+            continue;
         }
 
-        // todo: use smarter policy with EventTiming
-        let buffer_frames_size = sample_buffer_ref.len() / channels_count;
-        if buffer_frames_size > 2 * average_buffer_frames_count + batch_frames_count {
-            info!("Audio buffer overflow! size: {buffer_frames_size}");
+        let buffer_frames_size = producer.len() / channels_count;
+        let new_frames_count = new_samples.len() / channels_count;
+        if buffer_frames_size > 2 * average_buffer_frames_count + batch_frames_count
+            && new_frames_count > 1
+        {
+            // Drop frames of the new samples, at most half of them so that the cut can be
+            // cross-faded within the packet. The following packets continue if needed.
+            let drop_frames_count =
+                (buffer_frames_size - average_buffer_frames_count).min(new_frames_count / 2);
+            let fade_frames_count = batch_frames_count.min(new_frames_count - drop_frames_count);
 
-            let drained_samples = sample_buffer_ref
-                .drain(0..(buffer_frames_size - average_buffer_frames_count) * channels_count)
-                .collect::<Vec<_>>();
+            info!("Audio buffer overflow! size: {buffer_frames_size}");
 
-            // Render a cross-fade.
-            for f in 0..batch_frames_count {
-                let volume = f as f32 / batch_frames_count as f32;
+            for f in 0..fade_frames_count {
+                let volume = f as f32 / fade_frames_count as f32;
                 for c in 0..channels_count {
                     let index = f * channels_count + c;
-                    sample_buffer_ref[index] =
-                        sample_buffer_ref[index] * volume + drained_samples[index] * (1. - volume);
+                    new_samples[index] = new_samples[index] * (1. - volume)
+                        + new_samples[index + drop_frames_count * channels_count] * volume;
                 }
             }
+            new_samples.drain(
+                fade_frames_count * channels_count
+                    ..(fade_frames_count + drop_frames_count) * channels_count,
+            );
+        }
+
+        match transit {
+            Some(transit) if jitter_frames_count.is_some() => {
+                // The new samples play once the buffered ones did. The earliest packets should
+                // find the average buffer and a batch in front of them, so that the latest ones
+                // still find the two batches the audio callback needs to go on. The latency is
+                // left alone within the tolerance, which is kept above that.
+                let latency = transit + buffer_frames_size as f32 / sample_rate as f32;
+                let target_latency = jitter_estimator.min_transit()
+                    + (average_buffer_frames_count + batch_frames_count) as f32
+                        / sample_rate as f32
+                    + LATENCY_TOLERANCE_S;
+
+                producer.push(drift_compensator.process(&new_samples, latency - target_latency));
+            }
+            _ => {
+                drift_compensator.reset();
+                producer.push(&new_samples);
+            }
         }
     }
 }
 
 struct StreamingSource {
-    sample_buffer: Arc<Mutex<VecDeque<f32>>>,
+    consumer: RingConsumer<f32>,
     current_batch: Vec<f32>,
     current_batch_cursor: usize,
     channels_count: usize,
     sample_rate: u32,
-    batch_frames_count: usize,
 }
 
 impl Source for StreamingSource {
@@ -634,17 +989,16 @@ impl Iterator for StreamingSource {
     #[inline]
     fn next(&mut self) -> Option<f32> {
         if self.current_batch_cursor == 0 {
-            self.current_batch = get_next_frame_batch(
-                &mut *self.sample_buffer.lock(),
+            get_next_frame_batch(
+                &mut self.consumer,
                 self.channels_count,
-                self.batch_frames_count,
+                &mut self.current_batch,
             );
         }
 
         let sample = self.current_batch[self.current_batch_cursor];
 
-        self.current_batch_cursor =
-            (self.current_batch_cursor + 1) % (self.batch_frames_count * self.channels_count);
+        self.current_batch_cursor = (self.current_batch_cursor + 1) % self.current_batch.len();
 
         Some(sample)
     }
@@ -655,45 +1009,38 @@ pub async fn play_audio_loop(
     channels_count: u16,
     sample_rate: u32,
     config: AudioConfig,
-    receiver: StreamReceiver<()>,
+    receiver: StreamReceiver<AudioPacketHeader>,
+    clock_offset: fn() -> Option<i64>,
 ) -> StrResult {
-    // Size of a chunk of frames. It corresponds to the duration if a fade-in/out in frames.
     let batch_frames_count = sample_rate as usize * config.batch_ms as usize / 1000;
 
-    // Average buffer size in frames
-    let average_buffer_frames_count =
-        sample_rate as usize * config.average_buffering_ms as usize / 1000;
-
-    let sample_buffer = Arc::new(Mutex::new(VecDeque::new()));
+    let (producer, consumer) = playback_ring(channels_count as _, sample_rate);
 
     // Store the stream in a thread (because !Send)
     let (_shutdown_notifier, shutdown_receiver) = smpsc::channel::<()>();
-    thread::spawn({
-        let sample_buffer = Arc::clone(&sample_buffer);
-        move || -> StrResult {
-            let (_stream, handle) = trace_err!(OutputStream::try_from_device(&device.inner))?;
-
-            let source = StreamingSource {
-                sample_buffer,
-                current_batch: vec![],
-                current_batch_cursor: 0,
-                channels_count: channels_count as _,
-                sample_rate,
-                batch_frames_count,
-            };
-            trace_err!(handle.play_raw(source))?;
+    thread::spawn(move || -> StrResult {
+        let (_stream, handle) = trace_err!(OutputStream::try_from_device(&device.inner))?;
+
+        let source = StreamingSource {
+            consumer,
+            current_batch: vec![0.; batch_frames_count.max(1) * channels_count as usize],
+            current_batch_cursor: 0,
+            channels_count: channels_count as _,
+            sample_rate,
+        };
+        trace_err!(handle.play_raw(source))?;
 
-            shutdown_receiver.recv().ok();
-            Ok(())
-        }
+        shutdown_receiver.recv().ok();
+        Ok(())
     });
 
     receive_samples_loop(
         receiver,
-        sample_buffer,
+        producer,
         channels_count as _,
-        batch_frames_count,
-        average_buffer_frames_count,
+        sample_rate,
+        config,
+        clock_offset,
     )
     .await
 }
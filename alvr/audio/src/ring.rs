@@ -0,0 +1,149 @@
+// Lock-free ring of samples with one producer and one consumer, between the audio callbacks and
+// the network tasks. Pushing and popping never allocate nor lock, so they are safe to call from a
+// realtime audio thread. The consumer can also wait asynchronously for samples.
+
+use std::{
+    cell::UnsafeCell,
+    ptr,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+};
+use tokio::sync::Notify;
+
+struct Ring<T> {
+    buffer: Box<[UnsafeCell<T>]>,
+    // Samples pushed and popped since the creation, the positions in the buffer are modulo its size
+    write_count: AtomicUsize,
+    read_count: AtomicUsize,
+    readable: Notify,
+}
+
+// The producer only writes the free part of the buffer and the consumer only reads the filled one
+unsafe impl<T: Send> Sync for Ring<T> {}
+
+impl<T> Ring<T> {
+    fn len(&self) -> usize {
+        self.write_count
+            .load(Ordering::Acquire)
+            .wrapping_sub(self.read_count.load(Ordering::Acquire))
+    }
+
+    // Copies between `samples` and the ring, starting at `position` and wrapping around the end
+    unsafe fn copy(&self, position: usize, samples: *mut T, count: usize, to_ring: bool) {
+        let capacity = self.buffer.len();
+        let start = position % capacity;
+        let first_count = count.min(capacity - start);
+        let parts = [
+            (start, 0, first_count),
+            (0, first_count, count - first_count),
+        ];
+
+        for (ring_offset, samples_offset, count) in parts {
+            let slot = UnsafeCell::raw_get(self.buffer.as_ptr().add(ring_offset));
+            if to_ring {
+                ptr::copy_nonoverlapping(samples.add(samples_offset), slot, count);
+            } else {
+                ptr::copy_nonoverlapping(slot, samples.add(samples_offset), count);
+            }
+        }
+    }
+}
+
+pub struct RingProducer<T> {
+    ring: Arc<Ring<T>>,
+}
+
+impl<T: Copy> RingProducer<T> {
+    // Returns the count of samples written, the ones that do not fit are dropped
+    pub fn push(&mut self, samples: &[T]) -> usize {
+        let ring = &*self.ring;
+        let write_count = ring.write_count.load(Ordering::Relaxed);
+        let count = samples.len().min(ring.buffer.len() - ring.len());
+        if count == 0 {
+            return 0;
+        }
+
+        unsafe { ring.copy(write_count, samples.as_ptr() as *mut T, count, true) };
+        ring.write_count
+            .store(write_count.wrapping_add(count), Ordering::Release);
+
+        // Does not allocate. It only takes a lock when the consumer is waiting.
+        ring.readable.notify_one();
+
+        count
+    }
+
+    pub fn len(&self) -> usize {
+        self.ring.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+pub struct RingConsumer<T> {
+    ring: Arc<Ring<T>>,
+}
+
+impl<T: Copy> RingConsumer<T> {
+    // Returns the count of samples read
+    pub fn pop(&mut self, samples: &mut [T]) -> usize {
+        let ring = &*self.ring;
+        let read_count = ring.read_count.load(Ordering::Relaxed);
+        let count = samples.len().min(ring.len());
+
+        unsafe { ring.copy(read_count, samples.as_mut_ptr(), count, false) };
+        ring.read_count
+            .store(read_count.wrapping_add(count), Ordering::Release);
+
+        count
+    }
+
+    // Drops up to `count` samples, returns the count dropped
+    pub fn skip(&mut self, count: usize) -> usize {
+        let ring = &*self.ring;
+        let read_count = ring.read_count.load(Ordering::Relaxed);
+        let count = count.min(ring.len());
+        ring.read_count
+            .store(read_count.wrapping_add(count), Ordering::Release);
+
+        count
+    }
+
+    pub fn len(&self) -> usize {
+        self.ring.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    // Waits until at least `count` samples can be popped
+    pub async fn wait(&self, count: usize) {
+        while self.len() < count {
+            // A push between the check and the wait leaves a permit, so it is not missed
+            self.ring.readable.notified().await;
+        }
+    }
+}
+
+pub fn sample_ring<T: Copy + Default>(capacity: usize) -> (RingProducer<T>, RingConsumer<T>) {
+    let ring = Arc::new(Ring {
+        buffer: (0..capacity.max(1))
+            .map(|_| UnsafeCell::new(T::default()))
+            .collect(),
+        write_count: AtomicUsize::new(0),
+        read_count: AtomicUsize::new(0),
+        readable: Notify::new(),
+    });
+
+    (
+        RingProducer {
+            ring: Arc::clone(&ring),
+        },
+        RingConsumer { ring },
+    )
+}
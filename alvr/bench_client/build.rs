@@ -0,0 +1,36 @@
+use std::{env, path::PathBuf};
+
+// The video is reassembled by the FEC decoder of the client, built from its sources
+fn main() {
+    let manifest_dir = PathBuf::from(env::var("CARGO_MANIFEST_DIR").unwrap());
+    let client_cpp_dir = manifest_dir.join("../client/android");
+    let common_cpp_dir = client_cpp_dir.join("ALVR-common");
+    let source_cpp_dir = client_cpp_dir.join("app/src/main/cpp");
+
+    cc::Build::new()
+        .cpp(true)
+        .flag_if_supported("-std=c++20")
+        .flag_if_supported("/std:c++20")
+        .files([
+            source_cpp_dir.join("fec.cpp"),
+            manifest_dir.join("cpp/fec_queue.cpp"),
+        ])
+        .include(&common_cpp_dir)
+        .include(&source_cpp_dir)
+        .define("ALXR_CLIENT", None)
+        .compile("bench_fec");
+
+    cc::Build::new()
+        .files([common_cpp_dir.join("reedsolomon/rs.c")])
+        .compile("bench_fec_rs");
+
+    println!("cargo:rerun-if-changed=cpp");
+    println!(
+        "cargo:rerun-if-changed={}",
+        source_cpp_dir.join("fec.cpp").display()
+    );
+    println!(
+        "cargo:rerun-if-changed={}",
+        source_cpp_dir.join("fec.h").display()
+    );
+}
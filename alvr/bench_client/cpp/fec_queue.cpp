@@ -0,0 +1,53 @@
+// C interface of the FEC decoder of the client (FECQueue, alvr/client/android/app/src/main/cpp/fec.cpp)
+// for the benchmark client, see src/fec.rs.
+
+#include "fec.h"
+
+extern "C" {
+
+FECQueue *bench_fec_queue_new(size_t packetSize) {
+	return new FECQueue(packetSize);
+}
+
+void bench_fec_queue_free(FECQueue *queue) {
+	delete queue;
+}
+
+// Returns true if frames were given up
+bool bench_fec_queue_add_packet(FECQueue *queue, const VideoFrame *header, const uint8_t *payload,
+                                size_t size) {
+	bool fecFailure = false;
+	queue->addVideoPacket(*header, {payload, size}, fecFailure);
+	return fecFailure;
+}
+
+// Fills the oldest frame if it is complete, it stays valid until bench_fec_queue_pop_frame()
+bool bench_fec_queue_reconstruct(FECQueue *queue, uint64_t *videoFrameIndex,
+                                 uint64_t *trackingFrameIndex, const uint8_t **data, int *size) {
+	if (!queue->reconstruct()) {
+		return false;
+	}
+
+	*videoFrameIndex = queue->getVideoFrameIndex();
+	*trackingFrameIndex = queue->getTrackingFrameIndex();
+	*data = reinterpret_cast<const uint8_t *>(queue->getFrameBuffer());
+	*size = queue->getFrameByteSize();
+	return true;
+}
+
+void bench_fec_queue_pop_frame(FECQueue *queue) {
+	queue->popFrame();
+}
+
+// First frame given up by the last failure
+uint64_t bench_fec_queue_lost_frame_index(FECQueue *queue) {
+	uint64_t index = queue->getLostFrameIndex();
+	queue->clearFecFailure();
+	return index;
+}
+
+uint64_t bench_fec_queue_take_recovery_time(FECQueue *queue) {
+	return queue->takeRecoveryTime();
+}
+
+}
@@ -0,0 +1,81 @@
+// Optional decoding of the reassembled frames, by an ffmpeg process reading the elementary stream
+// from its stdin. A frame is written only once it is complete, so what ffmpeg reports is an error
+// of the encoder or a frame referencing a lost one. The writes are done on a thread, the receive
+// loop of the video never waits for the decoder.
+
+use alvr_common::prelude::*;
+use alvr_session::CodecType;
+use std::{
+    io::Write,
+    process::{Child, Command, Stdio},
+    sync::mpsc,
+    thread::{self, JoinHandle},
+};
+
+// Frames queued for the decoder, the next ones are dropped past this
+const MAX_QUEUED_FRAMES: usize = 16;
+
+pub struct Decoder {
+    sender: Option<mpsc::SyncSender<Vec<u8>>>,
+    thread: Option<JoinHandle<()>>,
+    child: Child,
+}
+
+impl Decoder {
+    pub fn new(ffmpeg: &str, codec: &CodecType) -> StrResult<Self> {
+        let format = match codec {
+            CodecType::H264 => "h264",
+            CodecType::HEVC => "hevc",
+            CodecType::AV1 => "obu",
+        };
+
+        let mut child = trace_err!(Command::new(ffmpeg)
+            .args([
+                "-hide_banner",
+                "-loglevel",
+                "error",
+                "-f",
+                format,
+                "-i",
+                "-"
+            ])
+            .args(["-f", "null", "-"])
+            .stdin(Stdio::piped())
+            .spawn())?;
+        let mut stdin = trace_none!(child.stdin.take())?;
+
+        let (sender, receiver) = mpsc::sync_channel::<Vec<u8>>(MAX_QUEUED_FRAMES);
+        let thread = thread::spawn(move || {
+            for frame in receiver {
+                if stdin.write_all(&frame).is_err() {
+                    break;
+                }
+            }
+        });
+
+        Ok(Self {
+            sender: Some(sender),
+            thread: Some(thread),
+            child,
+        })
+    }
+
+    // Returns false if the frame was dropped because the decoder is behind or exited
+    pub fn push(&self, frame: &[u8]) -> bool {
+        match &self.sender {
+            Some(sender) => sender.try_send(frame.to_vec()).is_ok(),
+            None => false,
+        }
+    }
+}
+
+impl Drop for Decoder {
+    fn drop(&mut self) {
+        // Closing stdin lets ffmpeg flush and exit
+        self.sender.take();
+        if let Some(thread) = self.thread.take() {
+            thread.join().ok();
+        }
+        self.child.wait().ok();
+    }
+}
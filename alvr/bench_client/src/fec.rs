@@ -0,0 +1,127 @@
+// The FEC decoder of the client, see cpp/fec_queue.cpp
+
+use alvr_sockets::VideoFrameHeaderPacket;
+use std::{ffi::c_void, slice};
+
+// VideoFrame of alvr/client/android/app/src/main/cpp/bindings.h
+#[repr(C)]
+struct VideoFrame {
+    type_: u32,
+    packet_counter: u32,
+    tracking_frame_index: u64,
+    video_frame_index: u64,
+    sent_time: u64,
+    frame_byte_size: u32,
+    fec_index: u32,
+    fec_percentage: u16,
+    stream_index: u8,
+    content_scale: u8,
+    foveation_center: [i8; 4],
+    slice_index: u8,
+    slice_count: u8,
+}
+
+const ALVR_PACKET_TYPE_VIDEO_FRAME: u32 = 9;
+
+extern "C" {
+    fn bench_fec_queue_new(packet_size: usize) -> *mut c_void;
+    fn bench_fec_queue_free(queue: *mut c_void);
+    fn bench_fec_queue_add_packet(
+        queue: *mut c_void,
+        header: *const VideoFrame,
+        payload: *const u8,
+        size: usize,
+    ) -> bool;
+    fn bench_fec_queue_reconstruct(
+        queue: *mut c_void,
+        video_frame_index: *mut u64,
+        tracking_frame_index: *mut u64,
+        data: *mut *const u8,
+        size: *mut i32,
+    ) -> bool;
+    fn bench_fec_queue_pop_frame(queue: *mut c_void);
+    fn bench_fec_queue_lost_frame_index(queue: *mut c_void) -> u64;
+    fn bench_fec_queue_take_recovery_time(queue: *mut c_void) -> u64;
+}
+
+pub struct Frame<'a> {
+    pub video_frame_index: u64,
+    pub tracking_frame_index: u64,
+    pub data: &'a [u8],
+}
+
+pub struct FecQueue(*mut c_void);
+
+// The queue is only used by the task that owns it
+unsafe impl Send for FecQueue {}
+
+impl FecQueue {
+    pub fn new(packet_size: usize) -> Self {
+        Self(unsafe { bench_fec_queue_new(packet_size) })
+    }
+
+    // Returns the first frame given up if the packet made the queue give up frames
+    pub fn add_packet(&mut self, header: &VideoFrameHeaderPacket, payload: &[u8]) -> Option<u64> {
+        let header = VideoFrame {
+            type_: ALVR_PACKET_TYPE_VIDEO_FRAME,
+            packet_counter: header.packet_counter,
+            tracking_frame_index: header.tracking_frame_index,
+            video_frame_index: header.video_frame_index,
+            sent_time: header.sent_time,
+            frame_byte_size: header.frame_byte_size,
+            fec_index: header.fec_index,
+            fec_percentage: header.fec_percentage,
+            stream_index: header.stream_index,
+            content_scale: header.content_scale,
+            foveation_center: header.foveation_center,
+            slice_index: header.slice_index,
+            slice_count: header.slice_count,
+        };
+
+        unsafe {
+            bench_fec_queue_add_packet(self.0, &header, payload.as_ptr(), payload.len())
+                .then(|| bench_fec_queue_lost_frame_index(self.0))
+        }
+    }
+
+    // Calls `f` with each complete frame, oldest first
+    pub fn pop_frames(&mut self, mut f: impl FnMut(Frame)) {
+        loop {
+            let mut video_frame_index = 0;
+            let mut tracking_frame_index = 0;
+            let mut data = std::ptr::null();
+            let mut size = 0;
+            let complete = unsafe {
+                bench_fec_queue_reconstruct(
+                    self.0,
+                    &mut video_frame_index,
+                    &mut tracking_frame_index,
+                    &mut data,
+                    &mut size,
+                )
+            };
+            if !complete {
+                break;
+            }
+
+            f(Frame {
+                video_frame_index,
+                tracking_frame_index,
+                data: unsafe { slice::from_raw_parts(data, size as usize) },
+            });
+
+            unsafe { bench_fec_queue_pop_frame(self.0) };
+        }
+    }
+
+    // Time spent recovering packets since the last call, in us
+    pub fn take_recovery_time(&mut self) -> u64 {
+        unsafe { bench_fec_queue_take_recovery_time(self.0) }
+    }
+}
+
+impl Drop for FecQueue {
+    fn drop(&mut self) {
+        unsafe { bench_fec_queue_free(self.0) }
+    }
+}
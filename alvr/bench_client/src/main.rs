@@ -0,0 +1,559 @@
+mod decoder;
+mod fec;
+mod motion;
+mod stats;
+
+use alvr_common::{prelude::*, ALVR_NAME, ALVR_VERSION};
+use alvr_session::SessionDesc;
+use alvr_sockets::{
+    spawn_cancelable, ClientConfigPacket, ClientControlPacket, ClientHandshakePacket,
+    HandshakePacket, HeadsetInfoPacket, PeerType, ProtoControlSocket, ServerControlPacket,
+    ServerHandshakePacket, StreamSocketBuilder, TimeSyncPacket, VideoFrameHeaderPacket,
+    CONTROL_PORT, DEFAULT_VIDEO_PACKET_SIZE, FEEDBACK_INTERVAL, INPUT, LOCAL_IP,
+    MAX_HANDSHAKE_PACKET_SIZE_BYTES, TIME_SYNC, VIDEO,
+};
+use decoder::Decoder;
+use fec::FecQueue;
+use futures::future::BoxFuture;
+use motion::Motion;
+use pico_args::Arguments;
+use serde_json as json;
+use stats::Statistics;
+use std::{
+    future,
+    net::Ipv4Addr,
+    path::PathBuf,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+    time::{Duration, Instant, SystemTime, UNIX_EPOCH},
+};
+use tokio::{net::UdpSocket, sync::Mutex as AsyncMutex, time};
+
+const HELP_STR: &str = r#"
+alvr_bench_client
+Headless client for load tests of the server. It connects like a headset, sends scripted tracking,
+reassembles the video with the FEC decoder of the client and reports the latency and loss of each
+frame. Nothing is displayed.
+
+USAGE:
+    alvr_bench_client [OPTIONS]
+
+OPTIONS:
+    --duration <S>          Stop after S seconds and print the summary, 0 runs until Ctrl+C [default: 0]
+    --motion <NAME[:S]>     Tracking script: still, look, turn or walk, over a period of S seconds [default: look:4]
+    --tracking-rate <HZ>    Rate of the tracking packets [default: the frame rate of the stream]
+    --eye-size <WxH>        Recommended eye resolution reported to the server [default: 1832x1920]
+    --fps <HZ>              Refresh rate reported to the server [default: 72]
+    --hostname <NAME>       Name of the client on the server, to tell instances apart [default: bench.client.alvr]
+    --localhost             Announce on the port the server uses for a client on the same machine
+    --csv <PATH>            Write the latency and size of each frame to PATH
+    --decode                Decode the frames with ffmpeg, which prints the decoding errors
+    --ffmpeg <PATH>         ffmpeg executable used by --decode [default: ffmpeg]
+    -h, --help              Print this help
+
+The ports of the client are fixed, run each instance in its own network namespace or on its own
+machine. The server must trust the hostname, or have auto trust of the clients enabled.
+The exit status is 1 if the stream did not start or no frame was received.
+"#;
+
+const CLIENT_HANDSHAKE_RESEND_INTERVAL: Duration = Duration::from_secs(1);
+const NETWORK_KEEPALIVE_INTERVAL: Duration = Duration::from_secs(1);
+const STATISTICS_INTERVAL: Duration = Duration::from_secs(1);
+
+struct Args {
+    duration: Option<Duration>,
+    motion: Motion,
+    tracking_rate: Option<f32>,
+    eye_size: (u32, u32),
+    fps: f32,
+    hostname: String,
+    localhost: bool,
+    csv: Option<PathBuf>,
+    decode: bool,
+    ffmpeg: String,
+}
+
+fn parse_args() -> Result<Option<Args>, String> {
+    let mut args = Arguments::from_env();
+    if args.contains(["-h", "--help"]) {
+        return Ok(None);
+    }
+
+    let to_string = |e: pico_args::Error| e.to_string();
+    let parse_size = |text: &str| -> Result<(u32, u32), String> {
+        text.split_once('x')
+            .and_then(|(width, height)| Some((width.parse().ok()?, height.parse().ok()?)))
+            .ok_or_else(|| format!("invalid eye size: {text}"))
+    };
+
+    let parsed = Args {
+        duration: args
+            .opt_value_from_str::<_, f32>("--duration")
+            .map_err(to_string)?
+            .filter(|&seconds| seconds > 0.)
+            .map(Duration::from_secs_f32),
+        motion: args
+            .opt_value_from_str("--motion")
+            .map_err(to_string)?
+            .unwrap_or(Motion::Look { period: 4. }),
+        tracking_rate: args
+            .opt_value_from_str("--tracking-rate")
+            .map_err(to_string)?,
+        eye_size: args
+            .opt_value_from_fn("--eye-size", parse_size)
+            .map_err(to_string)?
+            .unwrap_or((1832, 1920)),
+        fps: args
+            .opt_value_from_str("--fps")
+            .map_err(to_string)?
+            .unwrap_or(72.),
+        hostname: args
+            .opt_value_from_str("--hostname")
+            .map_err(to_string)?
+            .unwrap_or_else(|| "bench.client.alvr".into()),
+        localhost: args.contains("--localhost"),
+        csv: args.opt_value_from_str("--csv").map_err(to_string)?,
+        decode: args.contains("--decode"),
+        ffmpeg: args
+            .opt_value_from_str("--ffmpeg")
+            .map_err(to_string)?
+            .unwrap_or_else(|| "ffmpeg".into()),
+    };
+
+    let remaining = args.finish();
+    if !remaining.is_empty() {
+        return Err(format!("unexpected arguments: {remaining:?}"));
+    }
+
+    Ok(Some(parsed))
+}
+
+// In us since the epoch, the clock of the TimeSync timestamps
+fn timestamp_us(time: SystemTime) -> u64 {
+    time.duration_since(UNIX_EPOCH)
+        .map_or(0, |duration| duration.as_micros() as u64)
+}
+
+// Broadcasts the handshake until a server answers, the server then connects to the control port.
+// Returns only if the server refused the client.
+async fn announce_client_loop(
+    handshake_packet: ClientHandshakePacket,
+    localhost: bool,
+) -> StrResult<ServerHandshakePacket> {
+    let control_port = if localhost {
+        CONTROL_PORT + 1
+    } else {
+        CONTROL_PORT
+    };
+    let handshake_socket = trace_err!(UdpSocket::bind((LOCAL_IP, control_port)).await)?;
+    trace_err!(handshake_socket.set_broadcast(true))?;
+
+    let client_handshake_packet = trace_err!(bincode::serialize(&HandshakePacket::Client(
+        handshake_packet
+    )))?;
+
+    loop {
+        trace_err!(
+            handshake_socket
+                .send_to(
+                    &client_handshake_packet,
+                    (Ipv4Addr::BROADCAST, CONTROL_PORT)
+                )
+                .await
+        )?;
+
+        let receive_response_loop = async {
+            let mut server_response_buffer = [0; MAX_HANDSHAKE_PACKET_SIZE_BYTES];
+            loop {
+                // The broadcasted client packet is received too and ignored
+                let (packet_size, _) = trace_err!(
+                    handshake_socket
+                        .recv_from(&mut server_response_buffer)
+                        .await
+                )?;
+
+                if let Ok(HandshakePacket::Server(handshake_packet)) =
+                    bincode::deserialize(&server_response_buffer[..packet_size])
+                {
+                    break Ok(handshake_packet);
+                }
+            }
+        };
+
+        tokio::select! {
+            res = receive_response_loop => break res,
+            _ = time::sleep(CLIENT_HANDSHAKE_RESEND_INTERVAL) => (),
+        }
+    }
+}
+
+async fn connection_pipeline(args: &Args, statistics: Arc<Mutex<Statistics>>) -> StrResult {
+    let handshake_packet = ClientHandshakePacket {
+        alvr_name: ALVR_NAME.into(),
+        version: ALVR_VERSION.clone(),
+        device_name: "Bench".into(),
+        hostname: args.hostname.clone(),
+        reserved1: "".into(),
+        reserved2: "".into(),
+    };
+
+    println!("Searching for server...");
+    let (mut proto_socket, server_ip) = tokio::select! {
+        res = announce_client_loop(handshake_packet, args.localhost) => {
+            return fmt_e!("Server response: {:?}", res?);
+        }
+        pair = async {
+            loop {
+                if let Ok(pair) = ProtoControlSocket::connect_to(PeerType::Server).await {
+                    break pair;
+                }
+
+                time::sleep(CLIENT_HANDSHAKE_RESEND_INTERVAL).await;
+            }
+        } => pair
+    };
+
+    let headset_info = HeadsetInfoPacket {
+        recommended_eye_width: args.eye_size.0,
+        recommended_eye_height: args.eye_size.1,
+        available_refresh_rates: vec![args.fps],
+        preferred_refresh_rate: args.fps,
+        // The default packet size, the FEC decoder is built for it
+        path_mtu: 0,
+        resume_token: 0,
+        reserved: "".into(),
+    };
+    trace_err!(proto_socket.send(&(headset_info, server_ip)).await)?;
+    let config_packet = trace_err!(proto_socket.recv::<ClientConfigPacket>().await)?;
+
+    let (control_sender, mut control_receiver) = proto_socket.split();
+    let control_sender = Arc::new(AsyncMutex::new(control_sender));
+
+    let settings = {
+        let mut session_desc = SessionDesc::default();
+        session_desc.merge_from_json(&trace_err!(json::from_str(&config_packet.session_desc))?)?;
+        session_desc.to_settings()
+    };
+
+    let (stream_socket_builder, start_packet) = tokio::join!(
+        StreamSocketBuilder::listen_for_server(
+            settings.connection.stream_port,
+            settings.connection.stream_protocol.clone(),
+            settings.connection.client_send_buffer_bytes,
+            settings.connection.client_recv_buffer_bytes,
+            settings.connection.client_busy_poll_us,
+        ),
+        control_receiver.recv()
+    );
+    match start_packet {
+        Ok(ServerControlPacket::StartStream) => (),
+        Ok(ServerControlPacket::Restarting) => return fmt_e!("Server restarting"),
+        Ok(_) => return fmt_e!("Unexpected packet"),
+        Err(e) => return fmt_e!("Server disconnected. Cause: {e}"),
+    }
+    let stream_socket_builder = stream_socket_builder?;
+
+    control_sender
+        .lock()
+        .await
+        .send(&ClientControlPacket::StreamReady)
+        .await?;
+
+    let stream_socket = tokio::select! {
+        res = stream_socket_builder.accept_from_server(
+            server_ip,
+            config_packet.secondary_server_ip,
+            settings.connection.stream_port,
+            alvr_sockets::video_datagram_size(
+                &settings.connection.stream_protocol,
+                DEFAULT_VIDEO_PACKET_SIZE,
+            ),
+            settings.connection.transport_feedback,
+        ) => res?,
+        _ = time::sleep(Duration::from_secs(5)) => {
+            return fmt_e!("Timeout while setting up streams");
+        }
+    };
+    let stream_socket = Arc::new(stream_socket);
+    println!(
+        "Connected to {server_ip}: {}x{} per eye at {} fps, {:?}",
+        config_packet.eye_resolution_width,
+        config_packet.eye_resolution_height,
+        config_packet.fps,
+        settings.video.codec
+    );
+
+    let start = Instant::now();
+    let rtt_us = Arc::new(AtomicU64::new(0));
+
+    let input_send_loop = {
+        let mut socket_sender = stream_socket.request_stream(INPUT).await?;
+        let motion = args.motion;
+        let tracking_rate = args.tracking_rate.unwrap_or(config_packet.fps);
+        async move {
+            let mut interval = time::interval(Duration::from_secs_f32(1. / tracking_rate));
+            interval.set_missed_tick_behavior(time::MissedTickBehavior::Skip);
+            loop {
+                interval.tick().await;
+
+                // The target timestamp comes back as the tracking frame index of the frames
+                // rendered with this tracking
+                let time = start.elapsed();
+                socket_sender
+                    .send_buffer(socket_sender.new_buffer(&motion.input(time, time), 0)?)
+                    .await
+                    .ok();
+            }
+        }
+    };
+
+    let video_receive_loop = {
+        let mut receiver = stream_socket
+            .subscribe_to_stream::<VideoFrameHeaderPacket>(VIDEO)
+            .await?;
+        let statistics = Arc::clone(&statistics);
+        let control_sender = Arc::clone(&control_sender);
+        let decoder = if args.decode {
+            Some(Decoder::new(&args.ffmpeg, &settings.video.codec)?)
+        } else {
+            None
+        };
+        async move {
+            let mut queue = FecQueue::new(DEFAULT_VIDEO_PACKET_SIZE as usize);
+            loop {
+                let packet = receiver.recv().await?;
+                let header = &packet.header;
+                let receive_time = packet.receive_time.unwrap_or_else(SystemTime::now);
+
+                let lost_frame_index = {
+                    let mut statistics = statistics.lock().unwrap();
+                    statistics.packet(
+                        header.packet_counter,
+                        header.video_frame_index,
+                        timestamp_us(receive_time),
+                    );
+
+                    let lost_frame_index = queue.add_packet(header, &packet.buffer);
+                    if lost_frame_index.is_some() {
+                        statistics.fec_failure();
+                    }
+
+                    let now = start.elapsed();
+                    queue.pop_frames(|frame| {
+                        statistics.frame(
+                            frame.video_frame_index,
+                            frame.tracking_frame_index,
+                            frame.data.len(),
+                            now,
+                        );
+                        if let Some(decoder) = &decoder {
+                            if !decoder.push(frame.data) {
+                                statistics.decoder_drop();
+                            }
+                        }
+                    });
+                    statistics.fec_recovery(queue.take_recovery_time());
+
+                    lost_frame_index
+                };
+
+                // The frames before the lost ones were received, the server can keep referencing
+                // them
+                if let Some(index) = lost_frame_index {
+                    let packet = if index > 0 {
+                        ClientControlPacket::VideoFrameLoss(index - 1)
+                    } else {
+                        ClientControlPacket::VideoErrorReport
+                    };
+                    control_sender.lock().await.send(&packet).await.ok();
+                }
+            }
+        }
+    };
+
+    // The statistics of the client drive the FEC and bitrate controllers of the server like those of
+    // a headset
+    let time_sync_send_loop = {
+        let mut socket_sender = stream_socket.request_stream(TIME_SYNC).await?;
+        let statistics = Arc::clone(&statistics);
+        let rtt_us = Arc::clone(&rtt_us);
+        async move {
+            let mut interval = time::interval(STATISTICS_INTERVAL);
+            interval.tick().await;
+            loop {
+                interval.tick().await;
+
+                let time_sync = {
+                    let mut statistics = statistics.lock().unwrap();
+                    let rtt_us = Some(rtt_us.load(Ordering::Relaxed)).filter(|&rtt| rtt > 0);
+                    let window = statistics.report_window(STATISTICS_INTERVAL, rtt_us);
+                    let arrival = statistics.last_arrival().unwrap_or_default();
+
+                    TimeSyncPacket {
+                        mode: 0,
+                        client_time: timestamp_us(SystemTime::now()),
+                        packets_lost_total: statistics.packets_lost_total(),
+                        packets_lost_in_second: window.packets_lost,
+                        fec_failure: (window.fec_failures > 0) as u32,
+                        fec_failure_in_second: window.fec_failures,
+                        fec_failure_total: statistics.fec_failures_total(),
+                        fec_recovery_time: window.fec_recovery_us as u32,
+                        fps: window.frames as f32 / STATISTICS_INTERVAL.as_secs_f32(),
+                        arrival_frame_index: arrival.video_frame_index,
+                        arrival_first: arrival.first,
+                        arrival_last: arrival.last,
+                        arrival_packets: arrival.packets,
+                        ..Default::default()
+                    }
+                };
+
+                socket_sender
+                    .send_buffer(socket_sender.new_buffer(&time_sync, 0)?)
+                    .await
+                    .ok();
+            }
+        }
+    };
+
+    // The server answers each report with its time, the client time of the report is echoed
+    let time_sync_receive_loop = {
+        let mut receiver = stream_socket
+            .subscribe_to_stream::<TimeSyncPacket>(TIME_SYNC)
+            .await?;
+        async move {
+            loop {
+                let packet = receiver.recv().await?;
+                if packet.header.mode == 1 {
+                    let now = timestamp_us(packet.receive_time.unwrap_or_else(SystemTime::now));
+                    rtt_us.store(
+                        now.saturating_sub(packet.header.client_time),
+                        Ordering::Relaxed,
+                    );
+                }
+            }
+        }
+    };
+
+    let keepalive_sender_loop = {
+        let control_sender = Arc::clone(&control_sender);
+        let stream_socket = Arc::clone(&stream_socket);
+        async move {
+            loop {
+                if let Some(received) = stream_socket.path_reception() {
+                    control_sender
+                        .lock()
+                        .await
+                        .send(&ClientControlPacket::PathReception(received))
+                        .await
+                        .ok();
+                }
+
+                control_sender
+                    .lock()
+                    .await
+                    .send(&ClientControlPacket::KeepAlive)
+                    .await?;
+
+                time::sleep(NETWORK_KEEPALIVE_INTERVAL).await;
+            }
+        }
+    };
+
+    let transport_feedback_loop: BoxFuture<StrResult> = if settings.connection.transport_feedback {
+        let control_sender = Arc::clone(&control_sender);
+        let stream_socket = Arc::clone(&stream_socket);
+        Box::pin(async move {
+            loop {
+                if let Some(feedback) = stream_socket.transport_feedback() {
+                    control_sender
+                        .lock()
+                        .await
+                        .send(&ClientControlPacket::TransportFeedback(feedback))
+                        .await
+                        .ok();
+                }
+
+                time::sleep(FEEDBACK_INTERVAL).await;
+            }
+        })
+    } else {
+        Box::pin(future::pending())
+    };
+
+    let control_loop = async move {
+        loop {
+            match control_receiver.recv().await {
+                Ok(ServerControlPacket::Restarting) => break fmt_e!("Server restarting"),
+                Ok(_) => (),
+                Err(e) => break fmt_e!("Server disconnected. Cause: {e}"),
+            }
+        }
+    };
+
+    let receive_loop = async move { stream_socket.receive_loop().await };
+
+    tokio::select! {
+        res = spawn_cancelable(receive_loop) => res,
+        res = spawn_cancelable(input_send_loop) => res,
+        res = spawn_cancelable(video_receive_loop) => res,
+        res = spawn_cancelable(time_sync_send_loop) => res,
+        res = spawn_cancelable(time_sync_receive_loop) => res,
+        res = spawn_cancelable(transport_feedback_loop) => res,
+
+        res = keepalive_sender_loop => res,
+        res = control_loop => res,
+    }
+}
+
+fn main() {
+    let args = match parse_args() {
+        Ok(Some(args)) => args,
+        Ok(None) => {
+            println!("{HELP_STR}");
+            return;
+        }
+        Err(e) => {
+            eprintln!("{e}\n{HELP_STR}");
+            std::process::exit(2);
+        }
+    };
+
+    let statistics = match Statistics::new(args.csv.as_deref()) {
+        Ok(statistics) => Arc::new(Mutex::new(statistics)),
+        Err(e) => {
+            eprintln!("{e}");
+            std::process::exit(2);
+        }
+    };
+
+    let runtime = tokio::runtime::Runtime::new().unwrap();
+    let start = Instant::now();
+    let res = runtime.block_on(async {
+        let duration = async {
+            match args.duration {
+                Some(duration) => time::sleep(duration).await,
+                None => future::pending().await,
+            }
+        };
+
+        tokio::select! {
+            res = connection_pipeline(&args, Arc::clone(&statistics)) => res,
+            _ = duration => Ok(()),
+            _ = tokio::signal::ctrl_c() => Ok(()),
+        }
+    });
+    // The loops still running hold sockets
+    runtime.shutdown_timeout(Duration::from_secs(1));
+
+    if let Err(e) = &res {
+        println!("{e}");
+    }
+
+    let mut statistics = statistics.lock().unwrap();
+    statistics.print_summary(start.elapsed());
+    if statistics.frames_total() == 0 {
+        std::process::exit(1);
+    }
+}
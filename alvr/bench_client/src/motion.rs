@@ -0,0 +1,110 @@
+// Scripted tracking. The head stands at a fixed height and the controllers are held in front of it,
+// the script moves the head: some load tests want the encoder to see a still image, others the
+// worst case of fast turns.
+
+use alvr_common::{
+    glam::{EulerRot, Quat, Vec3},
+    HEAD_ID, LEFT_HAND_ID, RIGHT_HAND_ID,
+};
+use alvr_sockets::{Input, LegacyInput, MotionData};
+use std::{f32::consts::PI, str::FromStr, time::Duration};
+
+const HEAD_HEIGHT: f32 = 1.6;
+const LEFT_HAND_OFFSET: Vec3 = Vec3::new(-0.2, -0.3, -0.3);
+const RIGHT_HAND_OFFSET: Vec3 = Vec3::new(0.2, -0.3, -0.3);
+
+#[derive(Clone, Copy)]
+pub enum Motion {
+    Still,
+    // Yaw back and forth over +-45 degrees
+    Look { period: f32 },
+    // Full turn around the vertical axis
+    Turn { period: f32 },
+    // Yaw, pitch and a step sideways, out of phase so that no two frames are alike
+    Walk { period: f32 },
+}
+
+impl FromStr for Motion {
+    type Err = String;
+
+    // <name>[:<period in seconds>]
+    fn from_str(text: &str) -> Result<Self, Self::Err> {
+        let (name, period) = match text.split_once(':') {
+            Some((name, period)) => (
+                name,
+                period
+                    .parse::<f32>()
+                    .map_err(|_| format!("invalid motion period: {period}"))?,
+            ),
+            None => (text, 4.),
+        };
+
+        match name {
+            "still" => Ok(Motion::Still),
+            "look" => Ok(Motion::Look { period }),
+            "turn" => Ok(Motion::Turn { period }),
+            "walk" => Ok(Motion::Walk { period }),
+            _ => Err(format!("unknown motion: {name}")),
+        }
+    }
+}
+
+fn motion(orientation: Quat, position: Vec3) -> MotionData {
+    MotionData {
+        orientation,
+        position,
+        linear_velocity: Some(Vec3::ZERO),
+        angular_velocity: Some(Vec3::ZERO),
+    }
+}
+
+impl Motion {
+    fn head_pose(&self, time: f32) -> (Quat, Vec3) {
+        let phase = |period: f32| 2. * PI * time / period;
+        let standing = Vec3::new(0., HEAD_HEIGHT, 0.);
+
+        match *self {
+            Motion::Still => (Quat::IDENTITY, standing),
+            Motion::Look { period } => (
+                Quat::from_rotation_y(phase(period).sin() * PI / 4.),
+                standing,
+            ),
+            Motion::Turn { period } => (Quat::from_rotation_y(phase(period)), standing),
+            Motion::Walk { period } => (
+                Quat::from_euler(
+                    EulerRot::YXZ,
+                    phase(period).sin() * PI / 3.,
+                    phase(period * 1.7).sin() * PI / 8.,
+                    0.,
+                ),
+                standing + Vec3::new(phase(period * 2.3).sin() * 0.5, 0., 0.),
+            ),
+        }
+    }
+
+    // Tracking sampled at `time` since the start of the stream, for the frame displayed at
+    // `target_timestamp`
+    pub fn input(&self, time: Duration, target_timestamp: Duration) -> Input {
+        let (orientation, position) = self.head_pose(time.as_secs_f32());
+
+        Input {
+            legacy: LegacyInput {
+                mounted: 1,
+                ..Default::default()
+            },
+            device_motions: vec![
+                (*HEAD_ID, motion(orientation, position)),
+                (
+                    *LEFT_HAND_ID,
+                    motion(orientation, position + orientation * LEFT_HAND_OFFSET),
+                ),
+                (
+                    *RIGHT_HAND_ID,
+                    motion(orientation, position + orientation * RIGHT_HAND_OFFSET),
+                ),
+            ],
+            target_timestamp,
+            eye_gaze: None,
+        }
+    }
+}
@@ -0,0 +1,253 @@
+// Per frame latency and loss of the stream. The latency of a frame is the time from the sampling of
+// the tracking it was rendered with to its last packet, its tracking frame index being the target
+// timestamp of that tracking. It covers the render, encode and transport on the server, decoding and
+// display are not part of it.
+
+use alvr_common::prelude::*;
+use std::{
+    fs::File,
+    io::{BufWriter, Write},
+    path::Path,
+    time::Duration,
+};
+
+#[derive(Default)]
+struct Window {
+    frames: u64,
+    bytes: u64,
+    latency_sum_us: u64,
+    latency_max_us: u64,
+    packets: u64,
+    packets_lost: u64,
+    frames_lost: u64,
+    fec_failures: u64,
+    fec_recovery_us: u64,
+    decoder_drops: u64,
+}
+
+pub struct WindowReport {
+    pub frames: u64,
+    pub packets_lost: u64,
+    pub fec_failures: u64,
+    pub fec_recovery_us: u64,
+}
+
+// Arrival of the packets of a frame, in us since the epoch like the TimeSync timestamps
+#[derive(Clone, Copy, Default)]
+pub struct FrameArrival {
+    pub video_frame_index: u64,
+    pub first: u64,
+    pub last: u64,
+    pub packets: u32,
+}
+
+#[derive(Default)]
+pub struct Statistics {
+    window: Window,
+
+    next_packet_counter: Option<u32>,
+    next_video_frame_index: Option<u64>,
+    arrival: FrameArrival,
+    last_arrival: Option<FrameArrival>,
+
+    packets_total: u64,
+    packets_lost_total: u64,
+    frames_total: u64,
+    frames_lost_total: u64,
+    fec_failures_total: u64,
+    latencies_us: Vec<u32>,
+
+    csv: Option<BufWriter<File>>,
+}
+
+impl Statistics {
+    pub fn new(csv_path: Option<&Path>) -> StrResult<Self> {
+        let csv = match csv_path {
+            Some(path) => {
+                let mut file = BufWriter::new(trace_err!(File::create(path))?);
+                trace_err!(writeln!(
+                    file,
+                    "video_frame_index,tracking_frame_index,latency_us,bytes"
+                ))?;
+                Some(file)
+            }
+            None => None,
+        };
+
+        Ok(Self {
+            csv,
+            ..Default::default()
+        })
+    }
+
+    // Loss is counted from the gaps in the packet counter of the server, reordered packets count as
+    // lost
+    pub fn packet(&mut self, packet_counter: u32, video_frame_index: u64, now_us: u64) {
+        if let Some(next) = self.next_packet_counter {
+            let lost = packet_counter.wrapping_sub(next);
+            // Below the gap: reordered or duplicated
+            if lost < u32::MAX / 2 {
+                self.window.packets_lost += lost as u64;
+                self.packets_lost_total += lost as u64;
+                self.next_packet_counter = Some(packet_counter.wrapping_add(1));
+            }
+        } else {
+            self.next_packet_counter = Some(packet_counter.wrapping_add(1));
+        }
+        self.window.packets += 1;
+        self.packets_total += 1;
+
+        let arrival = &mut self.arrival;
+        if arrival.packets == 0 || video_frame_index > arrival.video_frame_index {
+            if arrival.packets != 0 {
+                self.last_arrival = Some(*arrival);
+            }
+            *arrival = FrameArrival {
+                video_frame_index,
+                first: now_us,
+                last: now_us,
+                packets: 1,
+            };
+        } else if video_frame_index == arrival.video_frame_index {
+            arrival.last = now_us;
+            arrival.packets += 1;
+        }
+    }
+
+    pub fn frame(
+        &mut self,
+        video_frame_index: u64,
+        tracking_frame_index: u64,
+        bytes: usize,
+        now: Duration,
+    ) {
+        // Frames skipped by the queue were given up
+        if let Some(next) = self.next_video_frame_index {
+            let lost = video_frame_index.saturating_sub(next);
+            self.window.frames_lost += lost;
+            self.frames_lost_total += lost;
+        }
+        self.next_video_frame_index = Some(video_frame_index + 1);
+
+        let latency_us = now
+            .saturating_sub(Duration::from_nanos(tracking_frame_index))
+            .as_micros() as u64;
+
+        self.window.frames += 1;
+        self.window.bytes += bytes as u64;
+        self.window.latency_sum_us += latency_us;
+        self.window.latency_max_us = self.window.latency_max_us.max(latency_us);
+        self.frames_total += 1;
+        self.latencies_us
+            .push(latency_us.min(u32::MAX as u64) as u32);
+
+        if let Some(csv) = &mut self.csv {
+            writeln!(
+                csv,
+                "{video_frame_index},{tracking_frame_index},{latency_us},{bytes}"
+            )
+            .ok();
+        }
+    }
+
+    pub fn fec_failure(&mut self) {
+        self.window.fec_failures += 1;
+        self.fec_failures_total += 1;
+    }
+
+    pub fn fec_recovery(&mut self, recovery_us: u64) {
+        self.window.fec_recovery_us += recovery_us;
+    }
+
+    pub fn decoder_drop(&mut self) {
+        self.window.decoder_drops += 1;
+    }
+
+    pub fn packets_lost_total(&self) -> u64 {
+        self.packets_lost_total
+    }
+
+    pub fn fec_failures_total(&self) -> u64 {
+        self.fec_failures_total
+    }
+
+    pub fn last_arrival(&self) -> Option<FrameArrival> {
+        self.last_arrival
+    }
+
+    // Prints the window of the last `interval` and starts the next one
+    pub fn report_window(&mut self, interval: Duration, rtt_us: Option<u64>) -> WindowReport {
+        let window = std::mem::take(&mut self.window);
+        let seconds = interval.as_secs_f64();
+
+        let mut line = format!(
+            "fps {:.1}  {:.1} Mbps  latency avg {:.1} ms max {:.1} ms  packets lost {}/{}  \
+             frames lost {}  fec failures {}",
+            window.frames as f64 / seconds,
+            window.bytes as f64 * 8. / seconds / 1e6,
+            window.latency_sum_us as f64 / window.frames.max(1) as f64 / 1000.,
+            window.latency_max_us as f64 / 1000.,
+            window.packets_lost,
+            window.packets + window.packets_lost,
+            window.frames_lost,
+            window.fec_failures,
+        );
+        if let Some(rtt_us) = rtt_us {
+            line += &format!("  rtt {:.1} ms", rtt_us as f64 / 1000.);
+        }
+        if window.decoder_drops > 0 {
+            line += &format!("  decoder drops {}", window.decoder_drops);
+        }
+        println!("{line}");
+
+        if let Some(csv) = &mut self.csv {
+            csv.flush().ok();
+        }
+
+        WindowReport {
+            frames: window.frames,
+            packets_lost: window.packets_lost,
+            fec_failures: window.fec_failures,
+            fec_recovery_us: window.fec_recovery_us,
+        }
+    }
+
+    pub fn frames_total(&self) -> u64 {
+        self.frames_total
+    }
+
+    pub fn print_summary(&mut self, duration: Duration) {
+        self.latencies_us.sort_unstable();
+        let percentile = |p: f64| {
+            self.latencies_us
+                .get(((self.latencies_us.len() as f64 - 1.) * p).round() as usize)
+                .map_or(0., |&us| us as f64 / 1000.)
+        };
+
+        println!(
+            "{} frames in {:.1} s, {} lost, {} fec failures",
+            self.frames_total,
+            duration.as_secs_f64(),
+            self.frames_lost_total,
+            self.fec_failures_total
+        );
+        println!(
+            "packets: {} received, {} lost ({:.3}%)",
+            self.packets_total,
+            self.packets_lost_total,
+            self.packets_lost_total as f64 * 100.
+                / (self.packets_total + self.packets_lost_total).max(1) as f64
+        );
+        println!(
+            "latency: p50 {:.1} ms  p90 {:.1} ms  p99 {:.1} ms  max {:.1} ms",
+            percentile(0.5),
+            percentile(0.9),
+            percentile(0.99),
+            percentile(1.)
+        );
+
+        if let Some(csv) = &mut self.csv {
+            csv.flush().ok();
+        }
+    }
+}
@@ -53,17 +53,16 @@ typedef unsigned char gf;
 
 #define SWAP(a,b,t) {t tmp; tmp=a; a=b; b=tmp;}
 
-/*
- * USE_GF_MULC, GF_MULC0(c) and GF_ADDMULC(x) can be used when multiplying
- * many numbers by the same constant. In this case the first
- * call sets the constant, and others perform the multiplications.
- * A value related to the multiplication is held in a local variable
- * declared with USE_GF_MULC . See usage in addmul1().
- */
-#define USE_GF_MULC register gf * __gf_mulc_
-#define GF_MULC0(c) __gf_mulc_ = &gf_mul_table[(c)<<8]
-#define GF_ADDMULC(dst, x) dst ^= __gf_mulc_[x]
-#define GF_MULC(dst, x) dst = __gf_mulc_[x]
+#define DECODE_CACHE_SIZE 8
+#define DECODE_ROWS_BYTES ((DATA_SHARDS_MAX + 7) / 8)
+
+struct _rs_decode_matrix {
+    /* bitmap of the rows of rs->m the matrix was inverted from */
+    unsigned char rows[DECODE_ROWS_BYTES];
+    unsigned int last_use;
+    /* decode rows of the erased data shards, nr_fec_blocks x data_shards */
+    gf* matrix;
+};
 
 #define gf_mul(x,y) gf_mul_table[(x<<8)+y]
 
@@ -92,28 +91,188 @@ static inline gf modnn(int x) {
     return x;
 }
 
-static void addmul(gf *dst1, gf *src1, gf c, int sz) {
-    USE_GF_MULC;
-    if (c != 0) {
-        register gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
+/*
+ * Vectorized GF(2^8) multiply kernels.
+ *
+ * Multiplication by a constant c is linear over GF(2), so c*x can be split
+ * into c*(x & 0x0f) ^ c*(x & 0xf0). Both halves only take 16 values and fit
+ * in a single 16-byte lookup table, which PSHUFB (x86) and TBL (ARM) can
+ * index with one instruction per 16 input bytes.
+ * The kernel is selected once in reed_solomon_init(); the byte-at-a-time
+ * table walk stays as the fallback and is still used for short rows.
+ */
+#define GF_SIMD_MIN_SIZE 16
+
+typedef void (*gf_mul_kernel)(gf *dst, const gf *src, gf c, int sz, int accumulate);
 
-        GF_MULC0(c);
+static void gf_mul_scalar(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    const gf *mulc = &gf_mul_table[c << 8];
+    gf *lim = &dst[sz];
+
+    if (accumulate) {
+        for (; dst < lim; dst++, src++)
+            *dst ^= mulc[*src];
+    } else {
         for (; dst < lim; dst++, src++)
-            GF_ADDMULC(*dst, *src);
+            *dst = mulc[*src];
+    }
+}
+
+static void gf_nibble_tables(gf c, gf *lo, gf *hi) {
+    const gf *mulc = &gf_mul_table[c << 8];
+    int i;
+    for (i = 0; i < 16; i++) {
+        lo[i] = mulc[i];
+        hi[i] = mulc[i << 4];
+    }
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define GF_TARGET(isa)
+#else
+#define GF_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+GF_TARGET("ssse3")
+static void gf_mul_ssse3(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    gf lo[16], hi[16];
+    __m128i tlo, thi, mask, s, p;
+    int i = 0;
+
+    gf_nibble_tables(c, lo, hi);
+    tlo = _mm_loadu_si128((const __m128i *)lo);
+    thi = _mm_loadu_si128((const __m128i *)hi);
+    mask = _mm_set1_epi8(0x0f);
+
+    for (; i + 16 <= sz; i += 16) {
+        s = _mm_loadu_si128((const __m128i *)(src + i));
+        p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+                          _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        if (accumulate)
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *)(dst + i)));
+        _mm_storeu_si128((__m128i *)(dst + i), p);
+    }
+    gf_mul_scalar(dst + i, src + i, c, sz - i, accumulate);
+}
+
+GF_TARGET("avx2")
+static void gf_mul_avx2(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    gf lo[16], hi[16];
+    __m256i tlo, thi, mask, s, p;
+    int i = 0;
+
+    gf_nibble_tables(c, lo, hi);
+    tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    mask = _mm256_set1_epi8(0x0f);
+
+    for (; i + 32 <= sz; i += 32) {
+        s = _mm256_loadu_si256((const __m256i *)(src + i));
+        p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask)),
+                             _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        if (accumulate)
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *)(dst + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), p);
+    }
+    gf_mul_scalar(dst + i, src + i, c, sz - i, accumulate);
+}
+
+static gf_mul_kernel gf_select_kernel(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    int has_ssse3, has_avx2 = 0;
+
+    __cpuid(info, 1);
+    has_ssse3 = (info[2] & (1 << 9)) != 0;
+    /* AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0) */
+    if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    int has_ssse3, has_avx2;
+
+    __builtin_cpu_init();
+    has_ssse3 = __builtin_cpu_supports("ssse3");
+    has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (has_avx2)
+        return gf_mul_avx2;
+    if (has_ssse3)
+        return gf_mul_ssse3;
+    return gf_mul_scalar;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static void gf_mul_neon(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    gf lo[16], hi[16];
+    uint8x16_t mask, s, l, h, p;
+    int i = 0;
+
+    gf_nibble_tables(c, lo, hi);
+    mask = vdupq_n_u8(0x0f);
+#if defined(__aarch64__)
+    uint8x16_t tlo = vld1q_u8(lo);
+    uint8x16_t thi = vld1q_u8(hi);
+#else
+    uint8x8x2_t tlo = {{vld1_u8(lo), vld1_u8(lo + 8)}};
+    uint8x8x2_t thi = {{vld1_u8(hi), vld1_u8(hi + 8)}};
+#endif
+
+    for (; i + 16 <= sz; i += 16) {
+        s = vld1q_u8(src + i);
+        l = vandq_u8(s, mask);
+        h = vshrq_n_u8(s, 4);
+#if defined(__aarch64__)
+        p = veorq_u8(vqtbl1q_u8(tlo, l), vqtbl1q_u8(thi, h));
+#else
+        p = veorq_u8(vcombine_u8(vtbl2_u8(tlo, vget_low_u8(l)), vtbl2_u8(tlo, vget_high_u8(l))),
+                     vcombine_u8(vtbl2_u8(thi, vget_low_u8(h)), vtbl2_u8(thi, vget_high_u8(h))));
+#endif
+        if (accumulate)
+            p = veorq_u8(p, vld1q_u8(dst + i));
+        vst1q_u8(dst + i, p);
+    }
+    gf_mul_scalar(dst + i, src + i, c, sz - i, accumulate);
+}
+
+static gf_mul_kernel gf_select_kernel(void) {
+    /* NEON is mandatory on aarch64 and assumed by every armeabi-v7a target we build for */
+    return gf_mul_neon;
+}
+
+#else
+
+static gf_mul_kernel gf_select_kernel(void) {
+    return gf_mul_scalar;
+}
+
+#endif
+
+static gf_mul_kernel gf_mul_simd = gf_mul_scalar;
+
+static void addmul(gf *dst1, gf *src1, gf c, int sz) {
+    if (c != 0) {
+        if (sz >= GF_SIMD_MIN_SIZE)
+            gf_mul_simd(dst1, src1, c, sz, 1);
+        else
+            gf_mul_scalar(dst1, src1, c, sz, 1);
     }
 }
 
 static void mul(gf *dst1, gf *src1, gf c, int sz) {
-    USE_GF_MULC;
     if (c != 0) {
-        register gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
-        GF_MULC0(c);
-        for (; dst < lim; dst++, src++)
-            GF_MULC(*dst , *src);
+        if (sz >= GF_SIMD_MIN_SIZE)
+            gf_mul_simd(dst1, src1, c, sz, 0);
+        else
+            gf_mul_scalar(dst1, src1, c, sz, 0);
     } else
-        memset(dst1, 0, c);
+        memset(dst1, 0, sz);
 }
 
 /* y = a.dot(b) */
@@ -374,6 +533,7 @@ static inline int code_some_shards(gf* matrixRows, gf** inputs, gf** outputs, in
 void reed_solomon_init(void) {
     generate_gf();
     init_mul_table();
+    gf_mul_simd = gf_select_kernel();
 }
 
 int reed_solomon_new(int data_shards, int parity_shards, reed_solomon* rs) {
@@ -390,6 +550,8 @@ int reed_solomon_new(int data_shards, int parity_shards, reed_solomon* rs) {
         rs->shards = (data_shards + parity_shards);
         rs->m = NULL;
         rs->parity = NULL;
+        rs->decode_cache = NULL;
+        rs->decode_clock = 0;
 
         if (rs->shards > DATA_SHARDS_MAX || data_shards <= 0 || parity_shards <= 0) {
             err = 1;
@@ -468,6 +630,61 @@ void reed_solomon_release(reed_solomon* rs) {
         free(rs->parity);
         rs->parity = NULL;
     }
+    if (NULL != rs->decode_cache) {
+        int i;
+        for (i = 0; i < DECODE_CACHE_SIZE; i++)
+            free(rs->decode_cache[i].matrix);
+        free(rs->decode_cache);
+        rs->decode_cache = NULL;
+    }
+}
+
+/*
+ * A lost packet usually takes the same shard out of several rows of a frame, and bursts
+ * repeat the same patterns over frames, so the inverted matrices are kept for the
+ * last DECODE_CACHE_SIZE patterns of each codec. The key is the set of rows the
+ * matrix was inverted from: the data shards received and the parity shards used.
+ */
+static gf* decode_cache_find(reed_solomon* rs, const unsigned char* rows) {
+    int i;
+
+    if (NULL == rs->decode_cache)
+        return NULL;
+
+    for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+        struct _rs_decode_matrix* entry = &rs->decode_cache[i];
+        if (NULL != entry->matrix && 0 == memcmp(entry->rows, rows, DECODE_ROWS_BYTES)) {
+            entry->last_use = ++rs->decode_clock;
+            return entry->matrix;
+        }
+    }
+    return NULL;
+}
+
+/* replaces the least recently used entry, the matrix is not cached if out of memory */
+static void decode_cache_add(reed_solomon* rs, const unsigned char* rows, const gf* matrix, int size) {
+    struct _rs_decode_matrix* entry;
+    int i;
+
+    if (NULL == rs->decode_cache) {
+        rs->decode_cache = (struct _rs_decode_matrix*)calloc(DECODE_CACHE_SIZE, sizeof(struct _rs_decode_matrix));
+        if (NULL == rs->decode_cache)
+            return;
+    }
+
+    entry = &rs->decode_cache[0];
+    for (i = 1; i < DECODE_CACHE_SIZE; i++) {
+        if (rs->decode_cache[i].last_use < entry->last_use)
+            entry = &rs->decode_cache[i];
+    }
+
+    free(entry->matrix);
+    entry->matrix = (gf*)malloc(size);
+    if (NULL == entry->matrix)
+        return;
+    memcpy(entry->matrix, matrix, size);
+    memcpy(entry->rows, rows, DECODE_ROWS_BYTES);
+    entry->last_use = ++rs->decode_clock;
 }
 
 /**
@@ -485,7 +702,9 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
     gf dataDecodeMatrix[DATA_SHARDS_MAX*DATA_SHARDS_MAX];
     unsigned char* subShards[DATA_SHARDS_MAX];
     unsigned char* outputs[DATA_SHARDS_MAX];
+    unsigned char rows[DECODE_ROWS_BYTES];
     gf* m = rs->m;
+    gf* decodeRows;
     int i, j, c, swap, subMatrixRow, dataShards, nos, nshards;
 
     /* the erased_blocks should always sorted
@@ -513,15 +732,14 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
     nos = 0;
     nshards = 0;
     dataShards = rs->data_shards;
+    memset(rows, 0, sizeof(rows));
     for (i = 0; i < dataShards; i++) {
         if (j < nr_fec_blocks && i == (int) erased_blocks[j])
             j++;
         else {
             /* this row is ok */
-            for (c = 0; c < dataShards; c++)
-                dataDecodeMatrix[subMatrixRow*dataShards + c] = m[i*dataShards + c];
-
             subShards[subMatrixRow] = data_blocks[i];
+            rows[i >> 3] |= 1 << (i & 7);
             subMatrixRow++;
         }
     }
@@ -529,24 +747,40 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
     for (i = 0; i < nr_fec_blocks && subMatrixRow < dataShards; i++) {
         subShards[subMatrixRow] = dec_fec_blocks[i];
         j = dataShards + fec_block_nos[i];
-        for (c = 0; c < dataShards; c++)
-            dataDecodeMatrix[subMatrixRow*dataShards + c] = m[j*dataShards + c];
-
+        rows[j >> 3] |= 1 << (j & 7);
         subMatrixRow++;
     }
 
     if (subMatrixRow < dataShards)
         return -1;
 
-    invert_mat(dataDecodeMatrix, dataShards);
+    for (i = 0; i < nr_fec_blocks; i++)
+        outputs[i] = data_blocks[erased_blocks[i]];
+
+    decodeRows = decode_cache_find(rs, rows);
+    if (NULL == decodeRows) {
+        subMatrixRow = 0;
+        /* rs->shards may count the shards received, not all of them */
+        for (i = 0; i < dataShards + rs->parity_shards; i++) {
+            if (rows[i >> 3] & (1 << (i & 7))) {
+                for (c = 0; c < dataShards; c++)
+                    dataDecodeMatrix[subMatrixRow*dataShards + c] = m[i*dataShards + c];
+                subMatrixRow++;
+            }
+        }
+
+        invert_mat(dataDecodeMatrix, dataShards);
 
-    for (i = 0; i < nr_fec_blocks; i++) {
-        j = erased_blocks[i];
-        outputs[i] = data_blocks[j];
-        memmove(dataDecodeMatrix+i*dataShards, dataDecodeMatrix+j*dataShards, dataShards);
+        for (i = 0; i < nr_fec_blocks; i++) {
+            j = erased_blocks[i];
+            memmove(dataDecodeMatrix+i*dataShards, dataDecodeMatrix+j*dataShards, dataShards);
+        }
+
+        decodeRows = dataDecodeMatrix;
+        decode_cache_add(rs, rows, decodeRows, nr_fec_blocks*dataShards);
     }
 
-    return code_some_shards(dataDecodeMatrix, subShards, outputs, dataShards, nr_fec_blocks, block_size);
+    return code_some_shards(decodeRows, subShards, outputs, dataShards, nr_fec_blocks, block_size);
 }
 
 /**
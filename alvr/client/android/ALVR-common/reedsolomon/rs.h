@@ -8,12 +8,17 @@ extern "C" {
 	/* use small value to save memory */
 #define DATA_SHARDS_MAX 255
 
+	struct _rs_decode_matrix;
+
 	typedef struct _reed_solomon {
 		int data_shards;
 		int parity_shards;
 		int shards;
 		unsigned char* m;
 		unsigned char* parity;
+		/* inverted matrices of the last erasure patterns, allocated by the first decode */
+		struct _rs_decode_matrix* decode_cache;
+		unsigned int decode_clock;
 	} reed_solomon;
 
 	/**
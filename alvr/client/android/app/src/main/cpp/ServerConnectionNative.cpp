@@ -8,17 +8,34 @@
 #include "packet_types.h"
 #include "nal.h"
 #include "latency_collector.h"
+#include <atomic>
 
 class ServerConnectionNative {
 public:
+    // Packets of one video frame, on the client clock
+    struct ArrivalGroup {
+        uint64_t frameIndex = 0;
+        uint64_t first = 0;
+        uint64_t last = 0;
+        uint32_t packets = 0;
+    };
+
     bool m_connected = false;
 
-    int64_t m_timeDiff = 0;
+    // Server clock minus client clock, also read by the audio playback
+    std::atomic<int64_t> m_timeDiff{0};
+    std::atomic<bool> m_timeDiffValid{false};
     uint64_t timeSyncSequence = (uint64_t) -1;
     uint64_t m_lastFrameIndex = 0;
 
     uint32_t m_prevVideoSequence = 0;
+    // The frame being received and the last one a later frame started after, reported to the
+    // server for its congestion control
+    ArrivalGroup m_arrivalCurrent;
+    ArrivalGroup m_arrivalComplete;
     std::shared_ptr<NALParser> m_nalParser;
+    // Set by legacyReserveVideo() for the following legacyCommitVideo()
+    bool m_reservedFecFailure = false;
 
     JNIEnv *m_env;
     jobject m_instance;
@@ -30,7 +47,7 @@ namespace {
 }
 
 void initializeSocket(void *v_env, void *v_instance, void *v_nalClass, unsigned int codec,
-                      bool enableFEC) {
+                      bool enableFEC, bool earlyDecode, unsigned int videoPacketSize) {
     auto *env = (JNIEnv *) v_env;
     auto *instance = (jobject) v_instance;
     auto *nalClass = (jclass) v_nalClass;
@@ -40,12 +57,16 @@ void initializeSocket(void *v_env, void *v_instance, void *v_nalClass, unsigned
 
     g_socket.m_prevVideoSequence = 0;
     g_socket.m_timeDiff = 0;
+    g_socket.m_timeDiffValid = false;
+    g_socket.m_arrivalCurrent = {};
+    g_socket.m_arrivalComplete = {};
 
     jclass clazz = env->GetObjectClass(instance);
     g_socket.mOnDisconnectedMethodID = env->GetMethodID(clazz, "onDisconnected", "()V");
     env->DeleteLocalRef(clazz);
 
-    g_socket.m_nalParser = std::make_shared<NALParser>(env, instance, nalClass, enableFEC);
+    g_socket.m_nalParser = std::make_shared<NALParser>(env, instance, nalClass, enableFEC, earlyDecode,
+                                                       videoPacketSize);
     g_socket.m_nalParser->setCodec(codec);
 
     LatencyCollector::Instance().resetAll();
@@ -67,13 +88,17 @@ void processVideoSequence(uint32_t sequence) {
     g_socket.m_prevVideoSequence = sequence;
 }
 
-void legacyReceive(const unsigned char *packet, unsigned int packetSize) {
-    g_socket.m_connected = true;
-
-    uint32_t type = *(uint32_t *) packet;
-    if (type == ALVR_PACKET_TYPE_VIDEO_FRAME) {
-        auto *header = (VideoFrame *) packet;
+namespace {
+    // Time the network thread spends on a packet, the load of the thread for the clock levels
+    struct NetworkBusyScope {
+        const uint64_t start = getTimestampUs();
+        ~NetworkBusyScope() {
+            LatencyCollector::Instance().networkBusy(getTimestampUs() - start);
+        }
+    };
 
+    // Statistics of a video packet, before its payload is processed
+    void receiveVideoHeader(const VideoFrame *header) {
         if (g_socket.m_lastFrameIndex != header->trackingFrameIndex) {
             LatencyCollector::Instance().receivedFirst(header->trackingFrameIndex);
             if ((int64_t) header->sentTime - g_socket.m_timeDiff > (int64_t) getTimestampUs()) {
@@ -88,16 +113,51 @@ void legacyReceive(const unsigned char *packet, unsigned int packetSize) {
 
         processVideoSequence(header->packetCounter);
 
+        uint64_t now = getTimestampUs();
+        auto &arrival = g_socket.m_arrivalCurrent;
+        if (arrival.packets == 0 || header->videoFrameIndex > arrival.frameIndex) {
+            if (arrival.packets != 0) {
+                g_socket.m_arrivalComplete = arrival;
+            }
+            arrival = {header->videoFrameIndex, now, now, 1};
+        } else if (header->videoFrameIndex == arrival.frameIndex) {
+            arrival.last = now;
+            arrival.packets++;
+        }
+    }
+
+    // Recovery time and failure of the FEC, after the payload of a packet is processed
+    void reportFec(bool fecFailure) {
+        LatencyCollector::Instance().fecRecovery(g_socket.m_nalParser->takeFecRecoveryTime());
+        if (fecFailure) {
+            LatencyCollector::Instance().fecFailure();
+            // The frames before the lost ones were decoded, the server can keep referencing them
+            uint64_t lostFrameIndex = g_socket.m_nalParser->lostFrameIndex();
+            if (lostFrameIndex > 0) {
+                videoFrameLossSend(lostFrameIndex - 1);
+            } else {
+                videoErrorReportSend();
+            }
+        }
+    }
+}
+
+void legacyReceive(const unsigned char *packet, unsigned int packetSize) {
+    NetworkBusyScope busy;
+    g_socket.m_connected = true;
+
+    uint32_t type = *(uint32_t *) packet;
+    if (type == ALVR_PACKET_TYPE_VIDEO_FRAME) {
+        auto *header = (VideoFrame *) packet;
+        receiveVideoHeader(header);
+
         // Following packets of a video frame
         bool fecFailure = false;
         bool ret2 = g_socket.m_nalParser->processPacket(header, packetSize, fecFailure);
         if (ret2) {
             LatencyCollector::Instance().receivedLast(header->trackingFrameIndex);
         }
-        if (fecFailure) {
-            LatencyCollector::Instance().fecFailure();
-            videoErrorReportSend();
-        }
+        reportFec(fecFailure);
     } else if (type == ALVR_PACKET_TYPE_TIME_SYNC) {
         // Time sync packet
         if (packetSize < sizeof(TimeSync)) {
@@ -108,9 +168,11 @@ void legacyReceive(const unsigned char *packet, unsigned int packetSize) {
         if (timeSync->mode == 1) {
             LatencyCollector::Instance().setTotalLatency(timeSync->serverTotalLatency);
             uint64_t RTT = Current - timeSync->clientTime;
-            g_socket.m_timeDiff =
+            int64_t timeDiff =
                     ((int64_t) timeSync->serverTime + (int64_t) RTT / 2) - (int64_t) Current;
-            LOG("TimeSync: server - client = %ld us RTT = %lu us", g_socket.m_timeDiff, RTT);
+            g_socket.m_timeDiff = timeDiff;
+            g_socket.m_timeDiffValid = true;
+            LOG("TimeSync: server - client = %ld us RTT = %lu us", timeDiff, RTT);
 
             TimeSync sendBuf = *timeSync;
             sendBuf.mode = 2;
@@ -123,6 +185,37 @@ void legacyReceive(const unsigned char *packet, unsigned int packetSize) {
     }
 }
 
+void *legacyReserveVideo(const VideoFrame *header, unsigned int *capacity) {
+    NetworkBusyScope busy;
+    g_socket.m_connected = true;
+    receiveVideoHeader(header);
+
+    bool fecFailure = false;
+    size_t payloadCapacity = 0;
+    std::byte *payload = g_socket.m_nalParser->reservePacket(*header, fecFailure, payloadCapacity);
+    if (payload == nullptr) {
+        reportFec(fecFailure);
+        return nullptr;
+    }
+    g_socket.m_reservedFecFailure = fecFailure;
+    *capacity = (unsigned int) payloadCapacity;
+    return payload;
+}
+
+void legacyCommitVideo(const VideoFrame *header, unsigned int payloadSize) {
+    NetworkBusyScope busy;
+    if (g_socket.m_nalParser->commitPacket(*header, (int) payloadSize)) {
+        LatencyCollector::Instance().receivedLast(header->trackingFrameIndex);
+    }
+    reportFec(g_socket.m_reservedFecFailure);
+    g_socket.m_reservedFecFailure = false;
+}
+
+bool getServerTimeDiff(long long *timeDiff) {
+    *timeDiff = g_socket.m_timeDiff;
+    return g_socket.m_timeDiffValid;
+}
+
 void sendTimeSync() {
     LOG("Sending timesync.");
 
@@ -132,24 +225,51 @@ void sendTimeSync() {
     timeSync.clientTime = getTimestampUs();
     timeSync.sequence = ++g_socket.timeSyncSequence;
 
-    timeSync.packetsLostTotal = LatencyCollector::Instance().getPacketsLostTotal();
-    timeSync.packetsLostInSecond = LatencyCollector::Instance().getPacketsLostInSecond();
+    // All numbers come from the same snapshot
+    const auto statistics = LatencyCollector::Instance().getStatistics();
 
-    timeSync.averageTotalLatency = (uint32_t) LatencyCollector::Instance().getLatency(0);
+    timeSync.packetsLostTotal = statistics.packetsLostTotal;
+    timeSync.packetsLostInSecond = statistics.packetsLostInSecond;
 
-    timeSync.averageSendLatency = (uint32_t) LatencyCollector::Instance().getLatency(3);
+    timeSync.averageTotalLatency = (uint32_t) statistics.latency[0];
 
-    timeSync.averageTransportLatency = (uint32_t) LatencyCollector::Instance().getLatency(1);
+    timeSync.averageSendLatency = (uint32_t) statistics.latency[3];
 
-    timeSync.averageDecodeLatency = (uint64_t) LatencyCollector::Instance().getLatency(2);
+    timeSync.averageTransportLatency = (uint32_t) statistics.latency[1];
 
-    timeSync.idleTime = (uint32_t) LatencyCollector::Instance().getLatency(4);
+    timeSync.averageDecodeLatency = statistics.latency[2];
 
-    timeSync.fecFailure = g_socket.m_nalParser->fecFailure() ? 1 : 0;
-    timeSync.fecFailureTotal = LatencyCollector::Instance().getFecFailureTotal();
-    timeSync.fecFailureInSecond = LatencyCollector::Instance().getFecFailureInSecond();
+    timeSync.idleTime = (uint32_t) statistics.latency[4];
 
-    timeSync.fps = LatencyCollector::Instance().getFramesInSecond();
+    timeSync.fecFailure = g_socket.m_nalParser->fecFailure() ? 1 : 0;
+    timeSync.fecFailureTotal = statistics.fecFailureTotal;
+    timeSync.fecFailureInSecond = statistics.fecFailureInSecond;
+    timeSync.fecRecoveryTime = (uint32_t) statistics.fecRecoveryInSecond;
+    timeSync.gpuTimeFfr = (uint32_t) statistics.gpuTimeFfrAverage;
+    timeSync.gpuTimeEyes = (uint32_t) statistics.gpuTimeEyesAverage;
+
+    timeSync.fps = statistics.framesInSecond;
+
+    timeSync.predictionErrorRotation = statistics.predictionErrorRotation;
+    timeSync.predictionErrorPosition = statistics.predictionErrorPosition;
+    timeSync.predictionHorizon = (uint32_t) statistics.predictionHorizon;
+    timeSync.predictionResidual = (int32_t) statistics.predictionResidual;
+
+    auto &frame = statistics.lastSubmittedFrame;
+    timeSync.traceFrameIndex = frame.frameIndex;
+    timeSync.traceTracking = frame.tracking;
+    timeSync.traceReceivedFirst = frame.receivedFirst;
+    timeSync.traceReceivedLast = frame.receivedLast;
+    timeSync.traceDecoderInput = frame.decoderInput;
+    timeSync.traceDecoderOutput = frame.decoderOutput;
+    timeSync.traceRendered = frame.rendered;
+    timeSync.traceSubmit = frame.submit;
+
+    auto &arrival = g_socket.m_arrivalComplete;
+    timeSync.arrivalFrameIndex = arrival.frameIndex;
+    timeSync.arrivalFirst = arrival.first;
+    timeSync.arrivalLast = arrival.last;
+    timeSync.arrivalPackets = arrival.packets;
 
     timeSyncSend(timeSync);
 }
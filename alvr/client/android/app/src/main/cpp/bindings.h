@@ -100,6 +100,42 @@ typedef struct TimeSync {
 
     float fps;
 
+    // Average difference between the pose a frame was rendered with and the latest prediction for
+    // its display time, in degrees and millimeters.
+    float predictionErrorRotation;
+    float predictionErrorPosition;
+
+    // Prediction horizon of the tracking samples, and average of the display time of the frames
+    // minus the time they were predicted for over the last second, in us.
+    uint32_t predictionHorizon;
+    int32_t predictionResidual;
+
+    // Time spent recovering lost shards with FEC over the last second, in us.
+    uint32_t fecRecoveryTime;
+
+    // Average GPU time of the decompression and eye passes of the frames over the last second,
+    // in us. Zero without GPU timer queries.
+    uint32_t gpuTimeFfr;
+    uint32_t gpuTimeEyes;
+
+    // Timestamps of the last submitted frame on the client clock, in us. Zero for the stages the
+    // frame skipped. The server joins them with its own in the frame trace.
+    uint64_t traceFrameIndex;
+    uint64_t traceTracking;
+    uint64_t traceReceivedFirst;
+    uint64_t traceReceivedLast;
+    uint64_t traceDecoderInput;
+    uint64_t traceDecoderOutput;
+    uint64_t traceRendered;
+    uint64_t traceSubmit;
+
+    // Arrival of the last video frame followed by a newer one on the client clock, in us, for the
+    // congestion control of the server. arrivalPackets is 0 if none.
+    uint64_t arrivalFrameIndex;
+    uint64_t arrivalFirst;
+    uint64_t arrivalLast;
+    uint32_t arrivalPackets;
+
     // Following value are filled by server only when mode=3.
     uint64_t trackingRecvFrameIndex;
 
@@ -119,6 +155,19 @@ typedef struct VideoFrame {
     uint32_t frameByteSize;
     uint32_t fecIndex;
     uint16_t fecPercentage;
+    // Eye encoded in the frame in dual stream mode, 0 for the left one, always 0 otherwise
+    uint8_t streamIndex;
+    // Percentage of the width and height of each eye filled by the image, which is drawn in the top
+    // left corner of its half of the frame. 100 unless dynamic resolution lowered it.
+    uint8_t contentScale;
+    // Foveation center shift of the frame: left eye x, y then right eye x, y in 1/127 of the
+    // center shift range. -128 first for the center of the settings.
+    int8_t foveationCenter[4];
+    // Slice of the frame in the packet, each slice is a FEC block of its own. frameByteSize,
+    // fecIndex and fecPercentage are those of the slice. sliceCount is only set in the packets of
+    // the last slice, 0 before it.
+    uint8_t sliceIndex;
+    uint8_t sliceCount;
     // char frameBuffer[];
 } ALXRVideoFrame;
 
@@ -129,6 +178,8 @@ typedef struct VideoFrame {
 #ifndef ALXR_CLIENT
 struct OnCreateResult {
     int streamSurfaceHandle;
+    // Texture of the right eye stream in dual stream mode
+    int secondStreamSurfaceHandle;
     int loadingSurfaceHandle;
 };
 
@@ -164,7 +215,22 @@ struct StreamConfig {
     float foveationCenterShiftY;
     float foveationEdgeRatioX;
     float foveationEdgeRatioY;
+    bool foveationSinglePass;
+    bool foveationDirectLayer;
+    // Upscale the stream to the display resolution with edge adaptive filtering and sharpening
+    bool enableUpscaling;
+    float upscalingSharpness;
+    // Each eye is a separate stream with its own decoder and texture
+    bool dualStream;
+    // The server streams every other display frame, each frame is shown for two refreshes
+    bool halfRate;
+    // Refreshes the decoded frames wait before they are shown, 0 to show the newest one
+    unsigned int presentationDepth;
     bool extraLatencyMode;
+    // Record the FrameEvents of the stream
+    bool frameEvents;
+    // Draw the decoded frames in Vulkan, see VkStreamPass. Needs the image reader.
+    bool vulkanStreamPass;
 };
 
 extern "C" void decoderInput(long long frameIndex);
@@ -173,7 +239,7 @@ extern "C" void decoderOutput(long long frameIndex);
 extern "C" OnCreateResult onCreate(void *env, void *activity, void *assetManager);
 extern "C" void destroyNative(void *env);
 extern "C" void renderNative(long long renderedFrameIndex);
-extern "C" void renderLoadingNative();
+extern "C" void renderLoadingNative(bool messageChanged);
 extern "C" void onTrackingNative(bool clientsidePrediction);
 extern "C" OnResumeResult onResumeNative(void *surface, bool darkMode);
 extern "C" void setStreamConfig(StreamConfig config);
@@ -187,15 +253,36 @@ extern "C" void onBatteryChangedNative(int battery, int plugged);
 extern "C" GuardianData getGuardianData();
 
 extern "C" void
-initializeSocket(void *env, void *instance, void *nalClass, unsigned int codec, bool enableFEC);
+initializeSocket(void *env, void *instance, void *nalClass, unsigned int codec, bool enableFEC,
+                 bool earlyDecode, unsigned int videoPacketSize);
 extern "C" void legacyReceive(const unsigned char *packet, unsigned int packetSize);
+// legacyReceive() of a video packet received in place: the payload is written to the returned
+// buffer of *capacity bytes, then committed. Null drops the packet.
+extern "C" void *legacyReserveVideo(const VideoFrame *header, unsigned int *capacity);
+extern "C" void legacyCommitVideo(const VideoFrame *header, unsigned int payloadSize);
 extern "C" void sendTimeSync();
+// Server clock minus client clock in us, from the last TimeSync. False before the first one.
+extern "C" bool getServerTimeDiff(long long *timeDiff);
 extern "C" unsigned char isConnectedNative();
 extern "C" void closeSocket(void *env);
 
+extern "C" void createDecoder(void *env, void *surface, int codec, bool realtime, bool imageReader,
+                              int stream);
+extern "C" void destroyDecoder();
+// Parameter sets of the stream sent by the server, with their start codes
+extern "C" void decoderSetConfig(int stream, const unsigned char *config, int length);
+// The parameter sets of the last stream do not apply to the next one
+extern "C" void decoderClearConfigs();
+extern "C" long long decoderRender(int stream);
+extern "C" void decoderFrameAvailable(int stream);
+extern "C" long long decoderClearAvailable(int stream);
+extern "C" void decoderSetStopped(bool stopped);
+
 extern "C" void (*inputSend)(TrackingInfo data);
 extern "C" void (*timeSyncSend)(TimeSync data);
 extern "C" void (*videoErrorReportSend)();
+extern "C" void (*videoFrameLossSend)(unsigned long long lastGoodFrameIndex);
+extern "C" void (*setWaitingNextIDR)(bool waiting);
 extern "C" void (*viewsConfigSend)(EyeFov fov[2], float ipd_m);
 extern "C" void (*batterySend)(unsigned long long device_path, float gauge_value, bool is_plugged);
 extern "C" unsigned long long (*pathStringToHash)(const char *path);
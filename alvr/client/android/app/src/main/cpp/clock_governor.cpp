@@ -0,0 +1,58 @@
+#include "clock_governor.h"
+
+#include <algorithm>
+#include "latency_collector.h"
+#include "utils.h"
+
+void ClockGovernor::start(ovrMobile *ovr) {
+    m_CpuLevel = START_LEVEL;
+    m_GpuLevel = START_LEVEL;
+    m_CpuCalmSeconds = 0;
+    m_GpuCalmSeconds = 0;
+    m_Second = LatencyCollector::Instance().getStatistics().second;
+    vrapi_SetClockLevels(ovr, m_CpuLevel, m_GpuLevel);
+}
+
+void ClockGovernor::update(ovrMobile *ovr, float refreshRate) {
+    const auto statistics = LatencyCollector::Instance().getStatistics();
+    if (statistics.second == m_Second || refreshRate <= 0) {
+        return;
+    }
+    m_Second = statistics.second;
+
+    const double frameUs = 1e6 / refreshRate;
+    const double cpuLoad = std::max(statistics.decodeTimeAverage / frameUs,
+                                    statistics.networkBusyInSecond / 1e6);
+    const double gpuLoad = statistics.renderTimeAverage / frameUs;
+
+    const bool cpuChanged = adjust(m_CpuLevel, m_CpuCalmSeconds, cpuLoad);
+    const bool gpuChanged = adjust(m_GpuLevel, m_GpuCalmSeconds, gpuLoad);
+    if (cpuChanged || gpuChanged) {
+        LOGI("Clock levels CPU=%d GPU=%d. Decode=%llu us Render=%llu us Network=%llu us/s",
+             m_CpuLevel, m_GpuLevel, (unsigned long long) statistics.decodeTimeAverage,
+             (unsigned long long) statistics.renderTimeAverage,
+             (unsigned long long) statistics.networkBusyInSecond);
+        vrapi_SetClockLevels(ovr, m_CpuLevel, m_GpuLevel);
+    }
+}
+
+bool ClockGovernor::adjust(int &level, int &calmSeconds, double load) {
+    if (load > RAISE_LOAD) {
+        calmSeconds = 0;
+        if (level < MAX_LEVEL) {
+            level++;
+            return true;
+        }
+        return false;
+    }
+    if (load >= LOWER_LOAD) {
+        calmSeconds = 0;
+        return false;
+    }
+    if (++calmSeconds >= LOWER_AFTER_SECONDS && level > MIN_LEVEL) {
+        calmSeconds = 0;
+        level--;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+#ifndef ALVRCLIENT_CLOCK_GOVERNOR_H
+#define ALVRCLIENT_CLOCK_GOVERNOR_H
+
+#include <stdint.h>
+#include <VrApi.h>
+
+// Sets the CPU and GPU clock levels from the load of the stages measured by LatencyCollector.
+// A level is raised as soon as a stage it runs takes too much of the frame time, and lowered again
+// one step at a time after a few seconds with headroom, so the headset runs at the lowest clocks
+// that keep the deadlines. The CPU level follows the decoder and the network thread, which
+// reassembles and FEC decodes the frames, the GPU level follows the rendering of the frames.
+class ClockGovernor {
+public:
+    // Sets the initial levels, at stream start
+    void start(ovrMobile *ovr);
+    // Called from the render thread after each submitted frame, acts once per second of statistics
+    void update(ovrMobile *ovr, float refreshRate);
+
+private:
+    // Returns whether the level changed
+    static bool adjust(int &level, int &calmSeconds, double load);
+
+    constexpr static const int MIN_LEVEL = 1;
+    constexpr static const int MAX_LEVEL = 4;
+    constexpr static const int START_LEVEL = 2;
+    // Shares of the frame time, or of the second for the network thread
+    constexpr static const double RAISE_LOAD = 0.5;
+    constexpr static const double LOWER_LOAD = 0.25;
+    constexpr static const int LOWER_AFTER_SECONDS = 5;
+
+    int m_CpuLevel = START_LEVEL;
+    int m_GpuLevel = START_LEVEL;
+    int m_CpuCalmSeconds = 0;
+    int m_GpuCalmSeconds = 0;
+    uint64_t m_Second = 0;
+};
+
+#endif //ALVRCLIENT_CLOCK_GOVERNOR_H
@@ -0,0 +1,804 @@
+#include "decoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dlfcn.h>
+#include <poll.h>
+#include <unistd.h>
+#include <media/NdkMediaFormat.h>
+#include <android/hardware_buffer.h>
+#include <android/native_window_jni.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include "bindings.h"
+#include "frame_events.h"
+#include "latency_collector.h"
+#include "packet_types.h"
+#include "utils.h"
+#include "vk_stream_pass.h"
+
+namespace {
+    const char *VIDEO_FORMAT_H264 = "video/avc";
+    const char *VIDEO_FORMAT_H265 = "video/hevc";
+    const char *VIDEO_FORMAT_AV1 = "video/av01";
+
+    const int NAL_TYPE_SPS = 7;
+    const int NAL_TYPE_IDR = 5;
+
+    const int H265_NAL_TYPE_IDR_W_RADL = 19;
+    const int H265_NAL_TYPE_VPS = 32;
+
+    const int AV1_OBU_SEQUENCE_HEADER = 1;
+    const int AV1_OBU_FRAME_HEADER = 3;
+    const int AV1_OBU_FRAME = 6;
+
+    // Same values as MediaCodec.BUFFER_FLAG_CODEC_CONFIG and BUFFER_FLAG_PARTIAL_FRAME,
+    // the NDK constants need API 26.
+    const uint32_t BUFFER_FLAG_CODEC_CONFIG = 2;
+    const uint32_t BUFFER_FLAG_PARTIAL_FRAME = 8;
+
+    std::mutex g_decoderMutex;
+    std::shared_ptr<VideoDecoder> g_decoders[VideoDecoder::MAX_STREAMS];
+    uint32_t g_streamTextures[VideoDecoder::MAX_STREAMS];
+    // Parameter sets of each stream, from the control socket
+    std::vector<std::byte> g_configs[VideoDecoder::MAX_STREAMS];
+    int g_presentationDepth = 0;
+    uint64_t g_frameIntervalUs = 0;
+
+    // The image reader path needs API 26 while the client still starts on API 24, so these are
+    // looked up at runtime.
+    struct ImageReaderApi {
+        media_status_t (*newWithUsage)(int32_t width, int32_t height, int32_t format, uint64_t usage,
+                                       int32_t maxImages, AImageReader **reader);
+        media_status_t (*acquireLatestImageAsync)(AImageReader *reader, AImage **image, int *acquireFenceFd);
+        void (*deleteAsync)(AImage *image, int releaseFenceFd);
+        media_status_t (*getHardwareBuffer)(const AImage *image, AHardwareBuffer **buffer);
+
+        PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC getNativeClientBuffer;
+        PFNEGLCREATEIMAGEKHRPROC createImage;
+        PFNEGLDESTROYIMAGEKHRPROC destroyImage;
+        PFNEGLCREATESYNCKHRPROC createSync;
+        PFNEGLDESTROYSYNCKHRPROC destroySync;
+        PFNEGLWAITSYNCKHRPROC waitSync;
+        PFNEGLDUPNATIVEFENCEFDANDROIDPROC dupNativeFenceFd;
+        PFNGLEGLIMAGETARGETTEXTURE2DOESPROC imageTargetTexture;
+
+        bool loaded = false;
+
+        ImageReaderApi() {
+            void *mediandk = dlopen("libmediandk.so", RTLD_NOW);
+            if (mediandk == nullptr) {
+                return;
+            }
+            newWithUsage = (decltype(newWithUsage)) dlsym(mediandk, "AImageReader_newWithUsage");
+            acquireLatestImageAsync = (decltype(acquireLatestImageAsync)) dlsym(mediandk, "AImageReader_acquireLatestImageAsync");
+            deleteAsync = (decltype(deleteAsync)) dlsym(mediandk, "AImage_deleteAsync");
+            getHardwareBuffer = (decltype(getHardwareBuffer)) dlsym(mediandk, "AImage_getHardwareBuffer");
+
+            getNativeClientBuffer = (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC) eglGetProcAddress("eglGetNativeClientBufferANDROID");
+            createImage = (PFNEGLCREATEIMAGEKHRPROC) eglGetProcAddress("eglCreateImageKHR");
+            destroyImage = (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress("eglDestroyImageKHR");
+            createSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+            destroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+            waitSync = (PFNEGLWAITSYNCKHRPROC) eglGetProcAddress("eglWaitSyncKHR");
+            dupNativeFenceFd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC) eglGetProcAddress("eglDupNativeFenceFDANDROID");
+            imageTargetTexture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC) eglGetProcAddress("glEGLImageTargetTexture2DOES");
+
+            loaded = newWithUsage && acquireLatestImageAsync && deleteAsync && getHardwareBuffer &&
+                     getNativeClientBuffer && createImage && destroyImage && createSync &&
+                     destroySync && waitSync && dupNativeFenceFd && imageTargetTexture;
+        }
+    };
+
+    const ImageReaderApi &imageReaderApi() {
+        static ImageReaderApi api;
+        return api;
+    }
+}
+
+VideoDecoder::VideoDecoder(ANativeWindow *window, int codec, bool realtime, bool imageReader, int stream)
+    : m_window(window), m_codec(codec), m_realtime(realtime), m_stream(stream),
+      m_texture(g_streamTextures[stream]),
+      m_presentationDepth(g_presentationDepth), m_frameIntervalUs(g_frameIntervalUs) {
+    for (auto &frameIndex : m_frameMap) {
+        frameIndex = -1;
+    }
+    if (imageReader && !createImageReader()) {
+        LOGE("Image reader is not available, decoding to the SurfaceTexture.");
+    }
+    setWaitingNextIDR(true);
+}
+
+VideoDecoder::~VideoDecoder() {
+    m_exiting = true;
+    if (m_outputThread.joinable()) {
+        m_outputThread.join();
+    }
+    if (m_decoder != nullptr) {
+        AMediaCodec_stop(m_decoder);
+        AMediaCodec_delete(m_decoder);
+    }
+    if (m_reader != nullptr) {
+        // The texture keeps its storage until the next stream binds a new image.
+        releaseImage(m_eglDisplay, false);
+        AImageReader_delete(m_reader);
+    }
+    ANativeWindow_release(m_window);
+    LOGI("VideoDecoder stopped.");
+}
+
+std::shared_ptr<VideoDecoder> VideoDecoder::get(int stream) {
+    if (stream < 0 || stream >= MAX_STREAMS) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(g_decoderMutex);
+    return g_decoders[stream];
+}
+
+void VideoDecoder::set(int stream, std::shared_ptr<VideoDecoder> decoder) {
+    std::lock_guard<std::mutex> lock(g_decoderMutex);
+    g_decoders[stream] = std::move(decoder);
+}
+
+void VideoDecoder::setStreamTexture(int stream, uint32_t texture) {
+    g_streamTextures[stream] = texture;
+}
+
+void VideoDecoder::setPresentation(int depth, float frameRate) {
+    g_presentationDepth = std::min(std::max(depth, 0), MAX_PRESENTATION_DEPTH);
+    g_frameIntervalUs = frameRate > 0 ? (uint64_t) (1e6 / frameRate) : 0;
+}
+
+void VideoDecoder::setConfig(int stream, const std::byte *config, int length) {
+    std::shared_ptr<VideoDecoder> decoder;
+    {
+        std::lock_guard<std::mutex> lock(g_decoderMutex);
+        g_configs[stream].assign(config, config + length);
+        decoder = g_decoders[stream];
+    }
+    if (decoder) {
+        decoder->configure(config, length);
+    }
+}
+
+void VideoDecoder::clearConfigs() {
+    std::lock_guard<std::mutex> lock(g_decoderMutex);
+    for (auto &config : g_configs) {
+        config.clear();
+    }
+}
+
+bool VideoDecoder::isAv1KeyFrame(const std::byte *buffer, int length) {
+    int offset = 0;
+    while (offset < length) {
+        const int header = static_cast<int>(buffer[offset]);
+        const int type = (header >> 3) & 0xF;
+        if (type == AV1_OBU_SEQUENCE_HEADER) {
+            return true;
+        }
+        // Without obu_has_size_field the rest of the unit cannot be walked
+        if (type == AV1_OBU_FRAME || type == AV1_OBU_FRAME_HEADER || (header & 0x2) == 0) {
+            return false;
+        }
+        // obu_extension_flag
+        offset += (header & 0x4) ? 2 : 1;
+
+        // leb128 obu_size
+        uint64_t size = 0;
+        for (int i = 0; i < 8 && offset < length; i++) {
+            const int byte = static_cast<int>(buffer[offset++]);
+            size |= uint64_t(byte & 0x7F) << (i * 7);
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        if (size > (uint64_t) (length - offset)) {
+            return false;
+        }
+        offset += (int) size;
+    }
+    return false;
+}
+
+VideoDecoder::NalType VideoDecoder::detectNalType(const std::byte *buffer, int length) const {
+    if (m_codec == ALVR_CODEC_AV1) {
+        // The sequence header is sent in band, the codec is created from the first key frame.
+        return isAv1KeyFrame(buffer, length) ? NalType::IDR : NalType::P;
+    }
+    if (length <= 4) {
+        return NalType::P;
+    }
+    int nalType;
+    if (m_codec == ALVR_CODEC_H264) {
+        nalType = static_cast<int>(buffer[4] & std::byte(0x1F));
+    } else {
+        nalType = static_cast<int>((buffer[4] >> 1) & std::byte(0x3F));
+    }
+
+    if ((m_codec == ALVR_CODEC_H264 && nalType == NAL_TYPE_SPS) ||
+        (m_codec == ALVR_CODEC_H265 && nalType == H265_NAL_TYPE_VPS)) {
+        // (VPS + )SPS + PPS
+        return NalType::SPS;
+    } else if ((m_codec == ALVR_CODEC_H264 && nalType == NAL_TYPE_IDR) ||
+               (m_codec == ALVR_CODEC_H265 && nalType == H265_NAL_TYPE_IDR_W_RADL)) {
+        return NalType::IDR;
+    }
+    return NalType::P;
+}
+
+bool VideoDecoder::createCodec(const std::byte *config, int length) {
+    const char *mime = m_codec == ALVR_CODEC_H264 ? VIDEO_FORMAT_H264
+                     : m_codec == ALVR_CODEC_AV1 ? VIDEO_FORMAT_AV1 : VIDEO_FORMAT_H265;
+
+    AMediaFormat *format = AMediaFormat_new();
+    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, mime);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, 512);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, 1024);
+    AMediaFormat_setInt32(format, "vendor.qti-ext-dec-low-latency.enable", 1); //Qualcomm low latency mode
+    AMediaFormat_setInt32(format, "operating-rate", INT16_MAX);
+    AMediaFormat_setInt32(format, "priority", m_realtime ? 0 : 1);
+    if (config != nullptr) {
+        AMediaFormat_setBuffer(format, "csd-0", const_cast<std::byte *>(config), length);
+    }
+
+    AMediaCodec *decoder = AMediaCodec_createDecoderByType(mime);
+    if (decoder == nullptr) {
+        LOGE("Failed to create decoder. Type=%s", mime);
+        AMediaFormat_delete(format);
+        return false;
+    }
+    ANativeWindow *window = m_window;
+    if (m_reader != nullptr) {
+        AImageReader_getWindow(m_reader, &window);
+    }
+    media_status_t status = AMediaCodec_configure(decoder, format, window, nullptr, 0);
+    AMediaFormat_delete(format);
+    if (status == AMEDIA_OK) {
+        status = AMediaCodec_start(decoder);
+    }
+    if (status != AMEDIA_OK) {
+        LOGE("Failed to start decoder. Type=%s status=%d", mime, status);
+        AMediaCodec_delete(decoder);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decoder = decoder;
+    }
+    m_outputThread = std::thread(&VideoDecoder::runOutput, this);
+
+    LOGI("Codec created. Type=%s", mime);
+    return true;
+}
+
+void VideoDecoder::configure(const std::byte *config, int length) {
+    // AV1 has no parameter sets out of band, the sequence header is in the key frames.
+    if (length <= 0 || m_codec == ALVR_CODEC_AV1) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_createMutex);
+    if (!m_created) {
+        LOGI("Configuring the codec ahead of the first keyframe. Size=%d", length);
+        m_created = createCodec(config, length);
+    }
+}
+
+bool VideoDecoder::ensureCodec(NalType type, const std::byte *buffer, int length) {
+    if (m_created) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_createMutex);
+    if (!m_created) {
+        // find an SPS nal to initialize decoder
+        // in fact it will contain all config nals concatenated
+        if (m_codec == ALVR_CODEC_AV1) {
+            m_created = type == NalType::IDR && createCodec(nullptr, 0);
+        } else {
+            m_created = type == NalType::SPS && createCodec(buffer, length);
+        }
+    }
+    return m_created;
+}
+
+void VideoDecoder::push(const std::byte *buffer, int length, uint64_t frameIndex) {
+    const NalType type = detectNalType(buffer, length);
+
+    if (!ensureCodec(type, buffer, length)) {
+        return;
+    }
+
+    const uint64_t presentationTime = getTimestampUs();
+
+    if (type == NalType::SPS) {
+        // (VPS + )SPS + PPS
+        FrameEvents::record(frameIndex, FrameEvent::DECODER_CONFIG, length);
+        m_waitNextIDR = false;
+        queueInput(buffer, length, 0, BUFFER_FLAG_CODEC_CONFIG, frameIndex);
+        return;
+    }
+
+    LatencyCollector::Instance().decoderInput(frameIndex);
+    if (type == NalType::IDR) {
+        FrameEvents::record(frameIndex, FrameEvent::DECODER_IDR, length, presentationTime);
+        setWaitingNextIDR(false);
+    } else if (m_waitNextIDR) {
+        // Ignore P-Frame until next I-Frame
+        FrameEvents::record(frameIndex, FrameEvent::DECODER_SKIP_P);
+        return;
+    } else if (dropForQueueDepth(buffer, length, frameIndex)) {
+        return;
+    } else {
+        FrameEvents::record(frameIndex, FrameEvent::DECODER_P, length, presentationTime);
+    }
+
+    if (!queueInput(buffer, length, presentationTime, 0, frameIndex)) {
+        // The decoder is stalled, the following frames would reference the dropped one.
+        LOGE("No decoder input buffer. Dropping frame and waiting for the next IDR.");
+        m_waitNextIDR = true;
+        setWaitingNextIDR(true);
+        videoErrorReportSend();
+        return;
+    }
+    frameQueued(frameIndex);
+}
+
+void VideoDecoder::pushPartial(const std::byte *buffer, int length, uint64_t frameIndex, bool lastPart) {
+    // Config frames are pushed whole, so the codec exists once a keyframe is streamed.
+    if (!m_created) {
+        return;
+    }
+
+    if (!m_partialOpen || m_partialFrameIndex != frameIndex) {
+        m_partialOpen = true;
+        m_partialFrameIndex = frameIndex;
+        m_partialPresentationTime = getTimestampUs();
+
+        LatencyCollector::Instance().decoderInput(frameIndex);
+        if (detectNalType(buffer, length) == NalType::IDR) {
+            FrameEvents::record(frameIndex, FrameEvent::DECODER_PARTIAL_IDR, m_partialPresentationTime);
+            setWaitingNextIDR(false);
+            m_partialSkipped = false;
+        } else {
+            // Ignore P-Frame until next I-Frame
+            m_partialSkipped = m_waitNextIDR || dropForQueueDepth(buffer, length, frameIndex);
+        }
+    }
+    if (lastPart) {
+        m_partialOpen = false;
+    }
+    if (m_partialSkipped) {
+        return;
+    }
+
+    FrameEvents::record(frameIndex, FrameEvent::DECODER_PARTIAL, length, lastPart);
+    if (!queueInput(buffer, length, m_partialPresentationTime, lastPart ? 0 : BUFFER_FLAG_PARTIAL_FRAME,
+                    frameIndex)) {
+        LOGE("No decoder input buffer. Dropping frame and waiting for the next IDR.");
+        m_partialSkipped = true;
+        m_waitNextIDR = true;
+        setWaitingNextIDR(true);
+        videoErrorReportSend();
+        return;
+    }
+    if (lastPart) {
+        frameQueued(frameIndex);
+    }
+}
+
+bool VideoDecoder::isReference(const std::byte *buffer, int length) const {
+    // refresh_frame_flags of AV1 frame headers is not parsed
+    if (m_codec == ALVR_CODEC_AV1 || length <= 4) {
+        return true;
+    }
+    if (m_codec == ALVR_CODEC_H264) {
+        // nal_ref_idc
+        return (buffer[4] & std::byte(0x60)) != std::byte(0);
+    }
+    // Sub-layer non-reference pictures are the even VCL types below the IRAP ones
+    const int nalType = static_cast<int>((buffer[4] >> 1) & std::byte(0x3F));
+    return nalType >= 16 || nalType % 2 == 1;
+}
+
+bool VideoDecoder::dropForQueueDepth(const std::byte *buffer, int length, uint64_t frameIndex) {
+    size_t depth;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        depth = m_decodingFrames.size();
+    }
+    if (depth >= DECODER_QUEUE_LIMIT) {
+        // The following frames would reference the dropped one, the codec drains meanwhile.
+        LOGE("Decoder is %zu frames behind. Dropping frames until the next IDR.", depth);
+        m_waitNextIDR = true;
+        setWaitingNextIDR(true);
+        videoErrorReportSend();
+        return true;
+    }
+    if (depth >= DECODER_QUEUE_TARGET && !isReference(buffer, length)) {
+        FrameEvents::record(frameIndex, FrameEvent::DECODER_DROP_NON_REFERENCE, depth);
+        return true;
+    }
+    return false;
+}
+
+void VideoDecoder::frameQueued(uint64_t frameIndex) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_decodingFrames.push_back(frameIndex);
+}
+
+bool VideoDecoder::queueInput(const std::byte *buffer, int length, uint64_t presentationTimeUs,
+                              uint32_t flags, uint64_t frameIndex) {
+    if (presentationTimeUs != 0) {
+        m_frameMap[presentationTimeUs & (FRAME_MAP_SIZE - 1)] = (int64_t) frameIndex;
+    }
+
+    // An empty buffer is still queued, it ends a partial frame.
+    do {
+        ssize_t bufferIndex = AMediaCodec_dequeueInputBuffer(m_decoder, INPUT_TIMEOUT_US);
+        if (bufferIndex < 0) {
+            // Insufficient buffer
+            return false;
+        }
+        size_t capacity = 0;
+        uint8_t *inputBuffer = AMediaCodec_getInputBuffer(m_decoder, bufferIndex, &capacity);
+        if (inputBuffer == nullptr) {
+            return false;
+        }
+
+        const size_t copyLength = std::min((size_t) length, capacity);
+        memcpy(inputBuffer, buffer, copyLength);
+
+        AMediaCodec_queueInputBuffer(m_decoder, bufferIndex, 0, copyLength, presentationTimeUs, flags);
+        buffer += copyLength;
+        length -= (int) copyLength;
+
+        if (length > 0) {
+            FrameEvents::record(frameIndex, FrameEvent::DECODER_SPLIT_INPUT, length, copyLength);
+        }
+    } while (length > 0);
+    return true;
+}
+
+void VideoDecoder::runOutput() {
+    while (!m_exiting) {
+        AMediaCodecBufferInfo info;
+        ssize_t index = AMediaCodec_dequeueOutputBuffer(m_decoder, &info, OUTPUT_TIMEOUT_US);
+        if (index >= 0) {
+            pushOutputBuffer((size_t) index, info);
+        } else if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+            LOGI("Decoder output format changed.");
+        }
+    }
+}
+
+void VideoDecoder::pushOutputBuffer(size_t index, const AMediaCodecBufferInfo &info) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopped) {
+        LOGE("Ignore output buffer because queue has been already stopped. index=%zu", index);
+        AMediaCodec_releaseOutputBuffer(m_decoder, index, false);
+        return;
+    }
+    const int64_t foundFrameIndex = m_frameMap[info.presentationTimeUs & (FRAME_MAP_SIZE - 1)].exchange(-1);
+    if (foundFrameIndex < 0) {
+        LOGE("Ignore output buffer because unknown frameIndex. index=%zu", index);
+        AMediaCodec_releaseOutputBuffer(m_decoder, index, false);
+        return;
+    }
+    // Frames are output in decoding order, the earlier ones the codec did not output are gone.
+    while (!m_decodingFrames.empty() && m_decodingFrames.front() <= (uint64_t) foundFrameIndex) {
+        m_decodingFrames.pop_front();
+    }
+
+    // The newest frame supersedes the queued one, or the oldest when the queue is over its depth
+    const size_t queueSize = m_presentationDepth == 0 ? 1 : m_presentationDepth + 1;
+    if (m_outputQueue.size() >= queueSize) {
+        FrameEvents::record(m_outputQueue.front().frameIndex, FrameEvent::DECODER_DROP_SUPERSEDED,
+                            m_outputQueue.size());
+        AMediaCodec_releaseOutputBuffer(m_decoder, m_outputQueue.front().index, false);
+        m_outputQueue.pop_front();
+    }
+    m_outputQueue.push_back({index, (uint64_t) foundFrameIndex, info.presentationTimeUs,
+                             getTimestampUs()});
+    LatencyCollector::Instance().presentationQueued((uint64_t) foundFrameIndex);
+
+    if (m_reader == nullptr) {
+        // With the image reader this is recorded once the image reaches the reader
+        LatencyCollector::Instance().decoderOutput((uint64_t) foundFrameIndex);
+    }
+    FrameEvents::record(foundFrameIndex, FrameEvent::DECODER_OUTPUT, m_outputQueue.size(), index);
+
+    renderLocked();
+}
+
+int64_t VideoDecoder::render() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return renderLocked();
+}
+
+int64_t VideoDecoder::renderLocked() {
+    if (m_stopped || m_state != SurfaceState::Idle || m_outputQueue.empty()) {
+        // A frame on the surface would conflict with the rendering one, it is released once
+        // the current frame is consumed.
+        return -1;
+    }
+    if (!presentationDue()) {
+        // Polled again by clearAvailable()
+        return -1;
+    }
+    const OutputBuffer buffer = m_outputQueue.front();
+    m_outputQueue.pop_front();
+
+    FrameEvents::record(buffer.frameIndex, FrameEvent::DECODER_RELEASE, buffer.index);
+
+    m_state = SurfaceState::Rendering;
+    m_surfaceFrameIndex = buffer.frameIndex;
+    m_surfacePresentationTimeUs = buffer.presentationTimeUs;
+    AMediaCodec_releaseOutputBuffer(m_decoder, buffer.index, true);
+    return (int64_t) buffer.frameIndex;
+}
+
+bool VideoDecoder::presentationDue() const {
+    if (m_presentationDepth == 0 || m_outputQueue.size() > (size_t) m_presentationDepth) {
+        return true;
+    }
+    // Also when the frames stop coming, the queue is not left to refill first
+    const uint64_t waitUs = getTimestampUs() - m_outputQueue.front().decodedUs;
+    return waitUs >= m_presentationDepth * m_frameIntervalUs;
+}
+
+void VideoDecoder::onFrameAvailable() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopped || m_state != SurfaceState::Rendering) {
+        return;
+    }
+    FrameEvents::record(m_surfaceFrameIndex, FrameEvent::SURFACE_AVAILABLE);
+    m_state = SurfaceState::Available;
+}
+
+int64_t VideoDecoder::clearAvailable() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_stopped && m_state == SurfaceState::Idle) {
+        // Frames held back by the presentation depth become due while the surface is free
+        renderLocked();
+        return -1;
+    }
+    if (m_stopped || m_state != SurfaceState::Available) {
+        return -1;
+    }
+    if (m_reader != nullptr && m_presentationDepth == 0 && !m_outputQueue.empty() &&
+        !m_supersededImage) {
+        // A newer frame was decoded since this one reached the reader. It is released on top and
+        // latchImage() takes the latest image, the superseded one is dropped by the reader. Once
+        // per latch, so the reader never holds more than IMAGE_READER_MAX_IMAGES.
+        FrameEvents::record(m_surfaceFrameIndex, FrameEvent::SURFACE_SUPERSEDED);
+        m_supersededImage = true;
+        m_state = SurfaceState::Idle;
+        renderLocked();
+        return -1;
+    }
+    m_supersededImage = false;
+    FrameEvents::record(m_surfaceFrameIndex, FrameEvent::SURFACE_CLEAR);
+    m_state = SurfaceState::Idle;
+    if (m_reader != nullptr && !latchImage()) {
+        // Go on with the next frame, the texture keeps the previous one
+        renderLocked();
+        return -1;
+    }
+    return (int64_t) m_surfaceFrameIndex;
+}
+
+bool VideoDecoder::createImageReader() {
+    const auto &api = imageReaderApi();
+    if (!api.loaded) {
+        return false;
+    }
+    // The codec sets the actual buffer size
+    media_status_t status = api.newWithUsage(512, 1024, AIMAGE_FORMAT_PRIVATE,
+                                             AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE,
+                                             IMAGE_READER_MAX_IMAGES, &m_reader);
+    if (status != AMEDIA_OK) {
+        LOGE("Failed to create image reader. status=%d", status);
+        m_reader = nullptr;
+        return false;
+    }
+    AImageReader_ImageListener listener = {this, &VideoDecoder::onImageAvailable};
+    AImageReader_setImageListener(m_reader, &listener);
+    return true;
+}
+
+void VideoDecoder::onImageAvailable(void *context, AImageReader *) {
+    // Called on a thread of the image reader, in place of the SurfaceTexture listener
+    auto *decoder = static_cast<VideoDecoder *>(context);
+    std::lock_guard<std::mutex> lock(decoder->m_mutex);
+    if (decoder->m_stopped || decoder->m_state != SurfaceState::Rendering) {
+        return;
+    }
+    FrameEvents::record(decoder->m_surfaceFrameIndex, FrameEvent::IMAGE_AVAILABLE);
+    LatencyCollector::Instance().decoderOutput(decoder->m_surfaceFrameIndex);
+    decoder->m_state = SurfaceState::Available;
+}
+
+bool VideoDecoder::latchImage() {
+    const auto &api = imageReaderApi();
+
+    AImage *image = nullptr;
+    int acquireFenceFd = -1;
+    media_status_t status = api.acquireLatestImageAsync(m_reader, &image, &acquireFenceFd);
+    if (status != AMEDIA_OK) {
+        LOGE("Failed to acquire decoder image. status=%d", status);
+        return false;
+    }
+
+    int64_t timestampNs = 0;
+    AImage_getTimestamp(image, &timestampNs);
+    if (timestampNs / 1000 != m_surfacePresentationTimeUs) {
+        FrameEvents::record(m_surfaceFrameIndex, FrameEvent::IMAGE_MISMATCH, timestampNs / 1000,
+                            m_surfacePresentationTimeUs);
+    }
+
+    EGLDisplay display = eglGetCurrentDisplay();
+    AHardwareBuffer *hardwareBuffer = nullptr;
+    bool hasBuffer = api.getHardwareBuffer(image, &hardwareBuffer) == AMEDIA_OK;
+
+    VkStreamPass *streamPass = VkStreamPass::getCurrent();
+    int releaseFenceFd = -1;
+    if (hasBuffer && streamPass != nullptr &&
+        streamPass->SetFrame(m_stream, hardwareBuffer, acquireFenceFd, &releaseFenceFd)) {
+        // The Vulkan stream pass waits for the acquire fence and samples the buffer
+        if (m_eglImage != EGL_NO_IMAGE_KHR) {
+            // The previous image was sampled by GL
+            if (releaseFenceFd >= 0) {
+                close(releaseFenceFd);
+            }
+            releaseImage(display, true);
+        } else {
+            deleteImage(releaseFenceFd);
+        }
+        m_image = image;
+        m_eglDisplay = display;
+        return true;
+    }
+
+    EGLImageKHR eglImage = EGL_NO_IMAGE_KHR;
+    if (hasBuffer) {
+        const EGLint imageAttribs[] = {EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE};
+        eglImage = api.createImage(display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID,
+                                   api.getNativeClientBuffer(hardwareBuffer), imageAttribs);
+    }
+    if (eglImage == EGL_NO_IMAGE_KHR) {
+        LOGE("Failed to import decoder image. error=%d", eglGetError());
+        api.deleteAsync(image, acquireFenceFd);
+        return false;
+    }
+
+    if (acquireFenceFd >= 0) {
+        // The GPU waits for the decoder to finish writing, the rendering thread does not block.
+        const EGLint syncAttribs[] = {EGL_SYNC_NATIVE_FENCE_FD_ANDROID, acquireFenceFd, EGL_NONE};
+        EGLSyncKHR sync = api.createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, syncAttribs);
+        if (sync != EGL_NO_SYNC_KHR) {
+            // EGL owns the fd now
+            api.waitSync(display, sync, 0);
+            api.destroySync(display, sync);
+        } else {
+            pollfd fence = {acquireFenceFd, POLLIN, 0};
+            poll(&fence, 1, FENCE_TIMEOUT_MS);
+            close(acquireFenceFd);
+        }
+    }
+
+    // The previous image is released once the commands sampling it are done
+    releaseImage(display, true);
+
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, m_texture);
+    api.imageTargetTexture(GL_TEXTURE_EXTERNAL_OES, (GLeglImageOES) eglImage);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+    m_image = image;
+    m_eglImage = eglImage;
+    m_eglDisplay = display;
+    return true;
+}
+
+void VideoDecoder::releaseImage(EGLDisplay display, bool fenced) {
+    if (m_image == nullptr) {
+        return;
+    }
+    const auto &api = imageReaderApi();
+
+    int releaseFenceFd = -1;
+    if (fenced) {
+        EGLSyncKHR sync = api.createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, nullptr);
+        if (sync != EGL_NO_SYNC_KHR) {
+            glFlush();
+            releaseFenceFd = api.dupNativeFenceFd(display, sync);
+            api.destroySync(display, sync);
+        }
+        if (releaseFenceFd < 0) {
+            glFinish();
+        }
+    }
+    if (m_eglImage != EGL_NO_IMAGE_KHR) {
+        api.destroyImage(m_eglDisplay, m_eglImage);
+        m_eglImage = EGL_NO_IMAGE_KHR;
+    }
+    deleteImage(releaseFenceFd);
+}
+
+void VideoDecoder::deleteImage(int releaseFenceFd) {
+    if (m_image == nullptr) {
+        if (releaseFenceFd >= 0) {
+            close(releaseFenceFd);
+        }
+        return;
+    }
+    imageReaderApi().deleteAsync(m_image, releaseFenceFd);
+    m_image = nullptr;
+}
+
+void VideoDecoder::setStopped(bool stopped) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopped = stopped;
+    for (const auto &buffer : m_outputQueue) {
+        AMediaCodec_releaseOutputBuffer(m_decoder, buffer.index, false);
+    }
+    m_outputQueue.clear();
+}
+
+void createDecoder(void *v_env, void *surface, int codec, bool realtime, bool imageReader, int stream) {
+    auto *env = (JNIEnv *) v_env;
+    ANativeWindow *window = ANativeWindow_fromSurface(env, (jobject) surface);
+    if (window == nullptr) {
+        LOGE("Failed to get the decoder surface.");
+        return;
+    }
+    auto decoder = std::make_shared<VideoDecoder>(window, codec, realtime, imageReader, stream);
+    VideoDecoder::set(stream, decoder);
+
+    // Set first, so that the parameter sets received from now on reach it
+    std::vector<std::byte> config;
+    {
+        std::lock_guard<std::mutex> lock(g_decoderMutex);
+        config = g_configs[stream];
+    }
+    decoder->configure(config.data(), (int) config.size());
+}
+
+void decoderSetConfig(int stream, const unsigned char *config, int length) {
+    if (stream >= 0 && stream < VideoDecoder::MAX_STREAMS) {
+        VideoDecoder::setConfig(stream, (const std::byte *) config, length);
+    }
+}
+
+void decoderClearConfigs() {
+    VideoDecoder::clearConfigs();
+}
+
+void destroyDecoder() {
+    for (int stream = 0; stream < VideoDecoder::MAX_STREAMS; stream++) {
+        VideoDecoder::set(stream, nullptr);
+    }
+}
+
+long long decoderRender(int stream) {
+    auto decoder = VideoDecoder::get(stream);
+    return decoder ? decoder->render() : -1;
+}
+
+void decoderFrameAvailable(int stream) {
+    if (auto decoder = VideoDecoder::get(stream)) {
+        decoder->onFrameAvailable();
+    }
+}
+
+long long decoderClearAvailable(int stream) {
+    auto decoder = VideoDecoder::get(stream);
+    return decoder ? decoder->clearAvailable() : -1;
+}
+
+void decoderSetStopped(bool stopped) {
+    for (int stream = 0; stream < VideoDecoder::MAX_STREAMS; stream++) {
+        if (auto decoder = VideoDecoder::get(stream)) {
+            decoder->setStopped(stopped);
+        }
+    }
+}
@@ -0,0 +1,174 @@
+#ifndef ALVRCLIENT_DECODER_H
+#define ALVRCLIENT_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkImageReader.h>
+#include <android/native_window.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// MediaCodec decoder driven from native code, the NDK counterpart of DecoderThread.java.
+// NALParser writes the reassembled frames straight into the codec input buffers, so frames
+// do not go through the JNI NAL queue. The output queue follows OutputFrameQueue.java.
+// With imageReader, the codec outputs to an AImageReader instead of window, and clearAvailable()
+// binds the decoded buffer to the stream texture as an EGLImage, without a SurfaceTexture.
+//
+// The decoded frames wait in the output queue until the surface is free, which happens once per
+// rendered frame. With a presentation depth of 0 the newest frame is released and the older ones are
+// dropped. With a depth of N frames are released oldest first once they waited N frame intervals,
+// or when more than N are queued, so frames bunched by the network are shown on consecutive
+// refreshes instead of being dropped or doubled up.
+//
+// The frames in the codec are counted from their input to their output. When decoding falls
+// behind, frames no other frame references are dropped above DECODER_QUEUE_TARGET, and above
+// DECODER_QUEUE_LIMIT every frame is dropped until the IDR requested from the server, so the
+// latency queued in the codec stays bounded.
+class VideoDecoder {
+public:
+    // Takes ownership of window, which is left unused with imageReader.
+    VideoDecoder(ANativeWindow *window, int codec, bool realtime, bool imageReader, int stream);
+    ~VideoDecoder();
+
+    // Creates the codec from the parameter sets the server sent over the control socket, with their
+    // start codes, instead of waiting for the first keyframe. Ignored once the codec exists.
+    void configure(const std::byte *config, int length);
+
+    // Called by NALParser on the receive thread.
+    void push(const std::byte *buffer, int length, uint64_t frameIndex);
+    // Queues complete NAL units of a frame which is still being received, the part with lastPart
+    // ends the frame. It may be empty if the rest of the frame was lost.
+    void pushPartial(const std::byte *buffer, int length, uint64_t frameIndex, bool lastPart);
+
+    // Releases the next decoded frame to the surface, returns its frame index or -1.
+    int64_t render();
+    void onFrameAvailable();
+    // Returns the frame index of the frame on the surface if it was not consumed yet, or -1.
+    // With imageReader it is called on the rendering thread, which binds the frame.
+    int64_t clearAvailable();
+    void setStopped(bool stopped);
+
+    // Decoder shared by NALParser and DecoderThread, null if DecoderThread uses MediaCodec in Java.
+    // Each eye has its own decoder in dual stream mode, stream is then the eye, otherwise 0.
+    static constexpr int MAX_STREAMS = 2;
+    static std::shared_ptr<VideoDecoder> get(int stream = 0);
+    static void set(int stream, std::shared_ptr<VideoDecoder> decoder);
+    // External texture the image reader frames of the stream are bound to
+    static void setStreamTexture(int stream, uint32_t texture);
+    // For the decoders created next, frameRate is the rate of the stream
+    static void setPresentation(int depth, float frameRate);
+    // Parameter sets of the stream, kept for the decoders created next and passed to configure()
+    // of the current one. Called on the control thread.
+    static void setConfig(int stream, const std::byte *config, int length);
+    static void clearConfigs();
+
+    // AV1 temporal units with sized OBUs, a key frame carries the sequence header before its
+    // first frame.
+    static bool isAv1KeyFrame(const std::byte *buffer, int length);
+
+    VideoDecoder(const VideoDecoder&) = delete;
+    VideoDecoder& operator=(const VideoDecoder&) = delete;
+private:
+    enum class NalType {
+        SPS, IDR, P
+    };
+
+    enum class SurfaceState {
+        Idle, Rendering, Available
+    };
+
+    struct OutputBuffer {
+        size_t index;
+        uint64_t frameIndex;
+        int64_t presentationTimeUs;
+        // When the codec output it
+        uint64_t decodedUs;
+    };
+
+    NalType detectNalType(const std::byte *buffer, int length) const;
+    // False for the frames no other frame references, true if it cannot be told
+    bool isReference(const std::byte *buffer, int length) const;
+    // Called before queueing a P-frame, true if it must be dropped for the codec to catch up
+    bool dropForQueueDepth(const std::byte *buffer, int length, uint64_t frameIndex);
+    void frameQueued(uint64_t frameIndex);
+    bool createCodec(const std::byte *config, int length);
+    // Creates the codec from the first config frame if configure() did not, false until then
+    bool ensureCodec(NalType type, const std::byte *buffer, int length);
+    bool queueInput(const std::byte *buffer, int length, uint64_t presentationTimeUs, uint32_t flags,
+                    uint64_t frameIndex);
+    void runOutput();
+    void pushOutputBuffer(size_t index, const AMediaCodecBufferInfo &info);
+    int64_t renderLocked();
+    // Whether the oldest queued frame is due, from the presentation depth
+    bool presentationDue() const;
+    bool createImageReader();
+    static void onImageAvailable(void *context, AImageReader *reader);
+    bool latchImage();
+    void releaseImage(EGLDisplay display, bool fenced);
+    // Gives the image back to the reader once releaseFenceFd signals, takes the fd
+    void deleteImage(int releaseFenceFd);
+
+    // Same size as FrameMap.java
+    static constexpr size_t FRAME_MAP_SIZE = 4096;
+    // Longest wait for an input buffer, frames are dropped after that.
+    static constexpr int64_t INPUT_TIMEOUT_US = 50000;
+    static constexpr int64_t OUTPUT_TIMEOUT_US = 10000;
+    static constexpr int MAX_PRESENTATION_DEPTH = 3;
+    // Frames queued to the codec and not output yet
+    static constexpr size_t DECODER_QUEUE_TARGET = 2;
+    static constexpr size_t DECODER_QUEUE_LIMIT = 4;
+    // One image bound to the texture, one being acquired and one written by the codec
+    static constexpr int32_t IMAGE_READER_MAX_IMAGES = 3;
+    // CPU wait on the acquire fence, only if EGL cannot import it
+    static constexpr int FENCE_TIMEOUT_MS = 100;
+
+    ANativeWindow *m_window;
+    int m_codec;
+    bool m_realtime;
+    int m_stream;
+    uint32_t m_texture;
+    int m_presentationDepth;
+    uint64_t m_frameIntervalUs;
+    // Null when the codec outputs to m_window
+    AImageReader *m_reader = nullptr;
+    // Image bound to m_texture, kept until the next one replaces it. Used by the rendering thread.
+    AImage *m_image = nullptr;
+    EGLImageKHR m_eglImage = EGL_NO_IMAGE_KHR;
+    EGLDisplay m_eglDisplay = EGL_NO_DISPLAY;
+    // An image older than the one on the surface is still in the reader
+    bool m_supersededImage = false;
+    // Created once, by configure() on the control thread or on the first SPS by the receive thread.
+    // m_created is set after m_decoder.
+    AMediaCodec *m_decoder = nullptr;
+    std::mutex m_createMutex;
+    std::atomic<bool> m_created{false};
+    bool m_waitNextIDR = true;
+    // State of the frame being queued with pushPartial()
+    bool m_partialOpen = false;
+    bool m_partialSkipped = false;
+    uint64_t m_partialFrameIndex = 0;
+    uint64_t m_partialPresentationTime = 0;
+    std::atomic<int64_t> m_frameMap[FRAME_MAP_SIZE];
+
+    std::thread m_outputThread;
+    std::atomic<bool> m_exiting{false};
+
+    // Guards the output queue and the surface state
+    std::mutex m_mutex;
+    bool m_stopped = false;
+    std::deque<OutputBuffer> m_outputQueue;
+    // Frame indices of the frames in the codec, in decoding order
+    std::deque<uint64_t> m_decodingFrames;
+    SurfaceState m_state = SurfaceState::Idle;
+    uint64_t m_surfaceFrameIndex = 0;
+    int64_t m_surfacePresentationTimeUs = 0;
+};
+
+#endif //ALVRCLIENT_DECODER_H
@@ -1,9 +1,11 @@
 #include <vector>
+#include <chrono>
 #include <algorithm>
 #include <stdlib.h>
 #include <inttypes.h>
 #include "fec.h"
 #include "packet_types.h"
+#include "frame_events.h"
 #ifndef ALXR_CLIENT
 #include "utils.h"
 #else
@@ -11,231 +13,388 @@
 namespace {
     inline void LOGI(...) {}
     inline void LOGE(...) {}
-    inline void FrameLog(uint64_t /*frameIndex*/, const char*/*format*/, ...) {}
 }
 #endif
 
 std::once_flag FECQueue::reed_solomon_initialized{};
 
-FECQueue::FECQueue()
-: m_currentFrame {
-    .type = ALVR_PACKET_TYPE_VIDEO_FRAME,
-    .packetCounter = 0,
-    .trackingFrameIndex = 0,
-    .videoFrameIndex = UINT64_MAX,
-    .sentTime = 0,
-    .frameByteSize = 0,
-    .fecIndex = 0,
-    .fecPercentage = 0
-  },
-  m_shardPackets(0),
-  m_blockSize(0),
-  m_totalDataShards(0),
-  m_totalParityShards(0),
-  m_totalShards(0),
-  m_firstPacketOfNextFrame(0),
-  m_recovered(true),
-  m_fecFailure(false)
+namespace {
+    // Both shard counts of a frame event in one argument
+    inline std::int64_t shardCounts(std::uint32_t dataShards, std::uint32_t parityShards) {
+        return (std::int64_t) dataShards << 32 | parityShards;
+    }
+}
+
+FECQueue::FECQueue(std::size_t packetSize)
+    : m_packetSize(packetSize)
 {
     std::call_once(reed_solomon_initialized, reed_solomon_init);
 }
 
 // Add packet to queue. packet must point to buffer whose size=ALVR_MAX_PACKET_SIZE.
 void FECQueue::addVideoPacket(const VideoFrame& packet, const FECQueue::VideoPacket& vidFrameBuffer, bool& fecFailure) {
-    if (m_recovered && m_currentFrame.videoFrameIndex == packet.videoFrameIndex) {
+    if (vidFrameBuffer.size() > m_packetSize) {
         return;
     }
-    if (m_currentFrame.videoFrameIndex != packet.videoFrameIndex) {
-        // New frame
-        if (!m_recovered) {
-            FrameLog(m_currentFrame.trackingFrameIndex,
-                     "Previous frame cannot be recovered. videoFrame=%llu shards=%u:%u frameByteSize=%d"
-                     " fecPercentage=%d m_totalShards=%u m_shardPackets=%u m_blockSize=%u",
-                     m_currentFrame.videoFrameIndex,
-                     m_totalDataShards,
-                     m_totalParityShards,
-                     m_currentFrame.frameByteSize, m_currentFrame.fecPercentage, m_totalShards,
-                     m_shardPackets, m_blockSize);
-            for (size_t packet = 0; packet < m_shardPackets; ++packet) {
-                FrameLog(m_currentFrame.trackingFrameIndex,
-                         "packetIndex=%d, shards=%u:%u",
-                         packet, m_receivedDataShards[packet], m_receivedParityShards[packet]);
-            }
-            fecFailure = m_fecFailure = true;
-        }
-        m_currentFrame = packet;
-        m_recovered = false;
-        
-        const uint32_t fecDataPackets = (packet.frameByteSize + ALVR_MAX_VIDEO_BUFFER_SIZE - 1) /
-                                  ALVR_MAX_VIDEO_BUFFER_SIZE;
-        m_shardPackets = CalculateFECShardPackets(m_currentFrame.frameByteSize,
-                                                  m_currentFrame.fecPercentage);
-        m_blockSize = m_shardPackets * ALVR_MAX_VIDEO_BUFFER_SIZE;
-
-        m_totalDataShards = (m_currentFrame.frameByteSize + m_blockSize - 1) / m_blockSize;
-        m_totalParityShards = CalculateParityShards(m_totalDataShards,
-                                                    m_currentFrame.fecPercentage);
-        m_totalShards = m_totalDataShards + m_totalParityShards;
-
-        m_recoveredPacket.clear();
-        m_recoveredPacket.resize(m_shardPackets);
-
-        m_receivedDataShards.clear();
-        m_receivedDataShards.resize(m_shardPackets);
-        m_receivedParityShards.clear();
-        m_receivedParityShards.resize(m_shardPackets);
-
-        m_shards.resize(m_totalShards);
-
-        m_rs = ReedSolomon{ m_totalDataShards, m_totalParityShards };
-        if (!m_rs.isValid()) {
-            return;
-        }
-
-        m_marks.resize(m_shardPackets);
-        for (size_t i = 0; i < m_shardPackets; ++i) {
-            m_marks[i].resize(m_totalShards);
-            memset(&m_marks[i][0], 1, m_totalShards);
-        }
-
-        if (m_frameBuffer.size() < m_totalShards * m_blockSize) {
-            // Only expand buffer for performance reason.
-            m_frameBuffer.resize(m_totalShards * m_blockSize);
-        }
-        memset(&m_frameBuffer[0], 0, m_totalShards * m_blockSize);
+    std::byte *p = reserveVideoPacket(packet, fecFailure);
+    if (p == nullptr) {
+        return;
+    }
+    std::memcpy(p, vidFrameBuffer.data(), vidFrameBuffer.size());
+    commitVideoPacket(packet, vidFrameBuffer.size());
+}
 
-        // Padding packets are not sent, so we can fill bitmap by default.
-        const size_t padding = (m_shardPackets - fecDataPackets % m_shardPackets) % m_shardPackets;
-        for (size_t i = 0; i < padding; ++i) {
-            m_marks[m_shardPackets - i - 1][m_totalDataShards - 1] = 0;
-            ++m_receivedDataShards[m_shardPackets - i - 1];
-        }
+std::byte *FECQueue::reserveVideoPacket(const VideoFrame& packet, bool& fecFailure) {
+    const std::uint64_t videoFrameIndex = packet.videoFrameIndex;
+    if (m_nextFrameIndex == UINT64_MAX || videoFrameIndex + FRAME_INDEX_RESET < m_nextFrameIndex) {
+        abandonFrames(UINT64_MAX);
+        m_nextFrameIndex = videoFrameIndex;
+    }
+    if (videoFrameIndex < m_nextFrameIndex) {
+        // Late packet of a frame which was released or given up.
+        return nullptr;
+    }
+    if (videoFrameIndex >= m_nextFrameIndex + FRAME_WINDOW) {
+        // The oldest frames are out of the window, including those of which no packet arrived.
+        const std::uint64_t nextFrameIndex = videoFrameIndex - FRAME_WINDOW + 1;
+        FrameEvents::record(packet.trackingFrameIndex, FrameEvent::FEC_WINDOW_ABANDONED,
+                            m_nextFrameIndex, nextFrameIndex - 1);
+        abandonFrames(nextFrameIndex);
+        m_lostFrameIndex = m_nextFrameIndex;
+        m_nextFrameIndex = nextFrameIndex;
+        fecFailure = m_fecFailure = true;
+    }
 
-        // Calculate last packet counter of current frame to detect whole frame packet loss.
-        uint32_t startPacket;
-        uint32_t nextStartPacket;
-        if(m_currentFrame.fecIndex / m_shardPackets < m_totalDataShards) {
-            // First seen packet was data packet
-            startPacket = m_currentFrame.packetCounter - m_currentFrame.fecIndex;
-            nextStartPacket = m_currentFrame.packetCounter - m_currentFrame.fecIndex + m_totalShards * m_shardPackets - padding;
-        }else{
-            // was parity packet
-            startPacket = m_currentFrame.packetCounter - (m_currentFrame.fecIndex - padding);
-            uint64_t m_startOfParityPacket = m_currentFrame.packetCounter - (m_currentFrame.fecIndex - m_totalDataShards * m_shardPackets);
-            nextStartPacket = m_startOfParityPacket + m_totalParityShards * m_shardPackets;
-        }
-        if(m_firstPacketOfNextFrame != 0 && m_firstPacketOfNextFrame != startPacket) {
-            // Whole frame packet loss
-            FrameLog(m_currentFrame.trackingFrameIndex,
-                     "Previous frame was completely lost. videoFrame=%llu shards=%u:%u frameByteSize=%d fecPercentage=%d m_totalShards=%u "
-                     "m_shardPackets=%u m_blockSize=%u m_firstPacketOfNextFrame=%u startPacket=%u currentPacket=%u",
-                     m_currentFrame.videoFrameIndex, m_totalDataShards, m_totalParityShards,
-                     m_currentFrame.frameByteSize, m_currentFrame.fecPercentage, m_totalShards,
-                     m_shardPackets, m_blockSize, m_firstPacketOfNextFrame, startPacket, m_currentFrame.packetCounter);
-            for (size_t packet = 0; packet < m_shardPackets; packet++) {
-                FrameLog(m_currentFrame.trackingFrameIndex,
-                         "packetIndex=%d, shards=%u:%u",
-                         packet, m_receivedDataShards[packet], m_receivedParityShards[packet]);
-            }
-            fecFailure = m_fecFailure = true;
-        }
-        m_firstPacketOfNextFrame = nextStartPacket;
+    Frame &frame = frameSlot(videoFrameIndex);
+    if (!frame.inUse) {
+        startFrame(frame, packet);
+    }
+    if (frame.recovered) {
+        return nullptr;
+    }
+    if (packet.sliceCount != 0) {
+        frame.sliceCount = packet.sliceCount;
+    }
+    if (frame.sliceCount != 0 && packet.sliceIndex >= frame.sliceCount) {
+        return nullptr;
+    }
+    if (packet.sliceIndex >= frame.slices.size()) {
+        frame.slices.resize(packet.sliceIndex + 1);
+    }
+    Block &block = frame.slices[packet.sliceIndex];
+    if (!block.inUse) {
+        startBlock(block, packet);
+    }
+    if (block.recovered || block.rs == nullptr) {
+        return nullptr;
+    }
 
-        FrameLog(m_currentFrame.trackingFrameIndex,
-                 "Start new frame. videoFrame=%llu frameByteSize=%d fecPercentage=%d m_totalDataShards=%u m_totalParityShards=%u"
-                 " m_totalShards=%u m_shardPackets=%u m_blockSize=%u",
-                 m_currentFrame.videoFrameIndex, m_currentFrame.frameByteSize, m_currentFrame.fecPercentage, m_totalDataShards,
-                 m_totalParityShards, m_totalShards, m_shardPackets, m_blockSize);
+    const size_t shardIndex = packet.fecIndex / block.shardPackets;
+    const size_t packetIndex = packet.fecIndex % block.shardPackets;
+    if (shardIndex >= block.totalShards) {
+        return nullptr;
     }
-    const size_t shardIndex = packet.fecIndex / m_shardPackets;
-    const size_t packetIndex = packet.fecIndex % m_shardPackets;
-    if (m_marks[packetIndex][shardIndex] == 0) {
+    if (block.marks[packetIndex * block.totalShards + shardIndex] == 0) {
         // Duplicate packet.
         LOGI("Packet duplication. packetCounter=%d fecIndex=%d", packet.packetCounter,
              packet.fecIndex);
-        return;
+        return nullptr;
     }
-    m_marks[packetIndex][shardIndex] = 0;
-    if (shardIndex < m_totalDataShards) {
-        ++m_receivedDataShards[packetIndex];
+    return &block.buffer[packet.fecIndex * m_packetSize];
+}
+
+void FECQueue::commitVideoPacket(const VideoFrame& packet, std::size_t payloadSize) {
+    Block &block = frameSlot(packet.videoFrameIndex).slices[packet.sliceIndex];
+    const size_t shardIndex = packet.fecIndex / block.shardPackets;
+    const size_t packetIndex = packet.fecIndex % block.shardPackets;
+    block.marks[packetIndex * block.totalShards + shardIndex] = 0;
+    if (shardIndex < block.totalDataShards) {
+        ++block.receivedDataShards[packetIndex];
+        while (block.contiguousPackets < block.dataPackets &&
+               block.marks[(block.contiguousPackets % block.shardPackets) * block.totalShards +
+                           block.contiguousPackets / block.shardPackets] == 0) {
+            ++block.contiguousPackets;
+        }
     } else {
-        ++m_receivedParityShards[packetIndex];
+        ++block.receivedParityShards[packetIndex];
     }
 
-    std::byte *p = &m_frameBuffer[packet.fecIndex * ALVR_MAX_VIDEO_BUFFER_SIZE];
-    const std::size_t payloadSize = vidFrameBuffer.size();
-    std::memcpy(p, vidFrameBuffer.data(), payloadSize);
-    if (payloadSize != size_t(ALVR_MAX_VIDEO_BUFFER_SIZE)) {
+    std::byte *p = &block.buffer[packet.fecIndex * m_packetSize];
+    if (payloadSize != m_packetSize) {
         // Fill padding
-        std::memset(p + payloadSize, 0, size_t(ALVR_MAX_VIDEO_BUFFER_SIZE) - payloadSize);
+        std::memset(p + payloadSize, 0, m_packetSize - payloadSize);
+    }
+}
+
+void FECQueue::startFrame(Frame &frame, const VideoFrame &header) {
+    frame.header = header;
+    frame.inUse = true;
+    frame.recovered = false;
+    frame.sliceCount = 0;
+    frame.frameByteSize = 0;
+    for (Block &block : frame.slices) {
+        block.inUse = false;
+        block.recovered = false;
+    }
+
+    FrameEvents::record(header.trackingFrameIndex, FrameEvent::FEC_FRAME_START, header.videoFrameIndex,
+                        header.frameByteSize);
+}
+
+void FECQueue::startBlock(Block &block, const VideoFrame &header) {
+    block.header = header;
+    block.inUse = true;
+    block.recovered = false;
+
+    const uint32_t fecDataPackets = (header.frameByteSize + m_packetSize - 1) / m_packetSize;
+    block.shardPackets = CalculateFECShardPackets(header.frameByteSize, header.fecPercentage,
+                                                  (int) m_packetSize);
+    block.blockSize = block.shardPackets * m_packetSize;
+
+    block.totalDataShards = (header.frameByteSize + block.blockSize - 1) / block.blockSize;
+    block.totalParityShards = CalculateParityShards(block.totalDataShards, header.fecPercentage);
+    block.totalShards = block.totalDataShards + block.totalParityShards;
+    block.dataPackets = fecDataPackets;
+    block.contiguousPackets = 0;
+
+    block.recoveredPacket.clear();
+    block.recoveredPacket.resize(block.shardPackets);
+
+    block.receivedDataShards.clear();
+    block.receivedDataShards.resize(block.shardPackets);
+    block.receivedParityShards.clear();
+    block.receivedParityShards.resize(block.shardPackets);
+
+    // Only expand buffers for performance reason.
+    if (block.marks.size() < block.shardPackets * block.totalShards) {
+        block.marks.resize(block.shardPackets * block.totalShards);
+    }
+    memset(&block.marks[0], 1, block.shardPackets * block.totalShards);
+
+    if (block.buffer.size() < block.totalShards * block.blockSize) {
+        block.buffer.resize(block.totalShards * block.blockSize);
+    }
+
+    // Padding packets are not sent, so we can fill bitmap by default.
+    // Received packets are padded as they arrive and lost data shards are rewritten by
+    // reed_solomon_reconstruct, so only the padding packets have to be cleared.
+    const size_t padding = (block.shardPackets - fecDataPackets % block.shardPackets) % block.shardPackets;
+    for (size_t i = 0; i < padding; ++i) {
+        const size_t packetIndex = block.shardPackets - i - 1;
+        block.marks[packetIndex * block.totalShards + block.totalDataShards - 1] = 0;
+        ++block.receivedDataShards[packetIndex];
+        memset(&block.buffer[((block.totalDataShards - 1) * block.shardPackets + packetIndex) * m_packetSize],
+               0, m_packetSize);
+    }
+
+    // Shard counts only depend on the slice size, so the matrices are built once per count.
+    block.rs = getReedSolomon(block.totalDataShards, block.totalParityShards);
+}
+
+// Releases the frames older than nextFrameIndex, logging the slices which were not complete.
+void FECQueue::abandonFrames(std::uint64_t nextFrameIndex) {
+    for (Frame &frame : m_frames) {
+        if (!frame.inUse || frame.header.videoFrameIndex >= nextFrameIndex) {
+            continue;
+        }
+        if (!frame.recovered) {
+            for (const Block &block : frame.slices) {
+                if (!block.inUse || block.recovered) {
+                    continue;
+                }
+                FrameEvents::record(frame.header.trackingFrameIndex, FrameEvent::FEC_FRAME_LOST,
+                                    frame.header.videoFrameIndex,
+                                    shardCounts(block.totalDataShards, block.totalParityShards));
+                for (size_t packet = 0; packet < block.shardPackets; ++packet) {
+                    FrameEvents::record(frame.header.trackingFrameIndex, FrameEvent::FEC_PACKET_SHARDS, packet,
+                                        shardCounts(block.receivedDataShards[packet],
+                                                    block.receivedParityShards[packet]));
+                }
+            }
+        }
+        frame.inUse = false;
     }
 }
 
 bool FECQueue::reconstruct() {
-    if (m_recovered) {
+    // Newer frames are recovered as their packets arrive but wait for the older ones.
+    for (Frame &frame : m_frames) {
+        if (frame.inUse && !frame.recovered) {
+            frame.recovered = reconstructFrame(frame);
+        }
+    }
+    if (m_nextFrameIndex == UINT64_MAX) {
         return false;
     }
+    const Frame &frame = frameSlot(m_nextFrameIndex);
+    return frame.inUse && frame.recovered;
+}
+
+bool FECQueue::reconstructFrame(Frame &frame) {
+    bool complete = frame.sliceCount != 0 && frame.slices.size() >= frame.sliceCount;
+    for (size_t slice = 0; slice < frame.slices.size(); ++slice) {
+        Block &block = frame.slices[slice];
+        if (block.inUse && !block.recovered && block.rs != nullptr) {
+            block.recovered = reconstructBlock(block);
+        }
+        if (slice < frame.sliceCount && !block.recovered) {
+            complete = false;
+        }
+    }
+    if (!complete) {
+        return false;
+    }
+
+    if (frame.sliceCount == 1) {
+        frame.frameByteSize = (int) frame.slices[0].header.frameByteSize;
+    } else {
+        // The decoder gets whole frames, or the slices it did not get yet as one piece
+        size_t size = 0;
+        for (size_t slice = 0; slice < frame.sliceCount; ++slice) {
+            size += frame.slices[slice].header.frameByteSize;
+        }
+        if (frame.frameBuffer.size() < size) {
+            frame.frameBuffer.resize(size);
+        }
+        size_t offset = 0;
+        for (size_t slice = 0; slice < frame.sliceCount; ++slice) {
+            const Block &block = frame.slices[slice];
+            std::memcpy(&frame.frameBuffer[offset], block.buffer.data(), block.header.frameByteSize);
+            offset += block.header.frameByteSize;
+        }
+        frame.frameByteSize = (int) size;
+    }
+    FrameEvents::record(frame.header.trackingFrameIndex, FrameEvent::FEC_RECOVERED);
+    return true;
+}
 
+bool FECQueue::reconstructBlock(Block &block) {
     bool ret = true;
     // On server side, we encoded all buffer in one call of reed_solomon_encode.
     // But client side, we should split shards for more resilient recovery.
-    for (size_t packet = 0; packet < m_shardPackets; ++packet) {
-        if (m_recoveredPacket[packet]) {
+    for (size_t packet = 0; packet < block.shardPackets; ++packet) {
+        if (block.recoveredPacket[packet]) {
             continue;
         }
-        if (m_receivedDataShards[packet] == m_totalDataShards) {
+        if (block.receivedDataShards[packet] == block.totalDataShards) {
             // We've received a full packet with no need for FEC.
-            //FrameLog(m_currentFrame.frameIndex, "No need for FEC. packetIndex=%d", packet);
-            m_recoveredPacket[packet] = true;
+            block.recoveredPacket[packet] = true;
             continue;
         }
-        m_rs.shards = m_receivedDataShards[packet] +
-                       m_receivedParityShards[packet]; //Don't let RS complain about missing parity packets
+        block.rs->shards = block.receivedDataShards[packet] +
+                           block.receivedParityShards[packet]; //Don't let RS complain about missing parity packets
 
-        if (m_rs.shards < (int) m_totalDataShards) {
+        if (block.rs->shards < (int) block.totalDataShards) {
             // Not enough parity data
             ret = false;
             continue;
         }
 
-        FrameLog(m_currentFrame.trackingFrameIndex,
-                 "Recovering. packetIndex=%d receivedDataShards=%d/%d receivedParityShards=%d/%d",
-                 packet, m_receivedDataShards[packet], m_totalDataShards,
-                 m_receivedParityShards[packet], m_totalParityShards);
+        FrameEvents::record(block.header.trackingFrameIndex, FrameEvent::FEC_RECOVERING, packet,
+                            shardCounts(block.receivedDataShards[packet], block.receivedParityShards[packet]));
 
-        for (size_t i = 0; i < m_totalShards; ++i) {
-            m_shards[i] = &m_frameBuffer[(i * m_shardPackets + packet) * ALVR_MAX_VIDEO_BUFFER_SIZE];
+        m_shards.resize(block.totalShards);
+        for (size_t i = 0; i < block.totalShards; ++i) {
+            m_shards[i] = &block.buffer[(i * block.shardPackets + packet) * m_packetSize];
         }
 
-        int result = reed_solomon_reconstruct(&m_rs, (unsigned char**)&m_shards[0],
-                                              &m_marks[packet][0],
-                                              m_totalShards, ALVR_MAX_VIDEO_BUFFER_SIZE);
-        m_recoveredPacket[packet] = true;
+        const auto recoveryStart = std::chrono::steady_clock::now();
+        int result = reed_solomon_reconstruct(block.rs, (unsigned char**)&m_shards[0],
+                                              &block.marks[packet * block.totalShards],
+                                              block.totalShards, m_packetSize);
+        m_recoveryTime += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - recoveryStart).count();
+        block.recoveredPacket[packet] = true;
         // We should always provide enough parity to recover the missing data successfully.
         // If this fails, something is probably wrong with our FEC state.
         if (result != 0) {
             LOGE("reed_solomon_reconstruct failed.");
             return false;
         }
-        /*
-        for(int i = 0; i < m_totalShards * m_shardPackets; i++) {
-            char *p = &frameBuffer[ALVR_MAX_VIDEO_BUFFER_SIZE * i];
-            LOGI("Reconstructed packets. i=%d shardIndex=%d buffer=[%02X %02X %02X %02X %02X ...]", i, i / m_shardPackets, p[0], p[1], p[2], p[3], p[4]);
-        }*/
-    }
-    if (ret) {
-        m_recovered = true;
-        FrameLog(m_currentFrame.trackingFrameIndex, "Frame was successfully recovered by FEC.");
     }
     return ret;
 }
 
+FECQueue::ReedSolomon *FECQueue::getReedSolomon(const std::size_t dataShards, const std::size_t parityShards) {
+    const auto key = std::make_pair(dataShards, parityShards);
+    auto it = m_rsCache.find(key);
+    if (it == m_rsCache.end()) {
+        it = m_rsCache.try_emplace(key, dataShards, parityShards).first;
+    }
+    if (!it->second.isValid()) {
+        m_rsCache.erase(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
 const std::byte *FECQueue::getFrameBuffer() const {
-    return &m_frameBuffer[0];
+    const Frame &frame = frameSlot(m_nextFrameIndex);
+    return frame.sliceCount == 1 ? frame.slices[0].buffer.data() : frame.frameBuffer.data();
 }
 
 int FECQueue::getFrameByteSize() const {
-    return m_currentFrame.frameByteSize;
+    return frameSlot(m_nextFrameIndex).frameByteSize;
+}
+
+std::uint64_t FECQueue::getTrackingFrameIndex() const {
+    return frameSlot(m_nextFrameIndex).header.trackingFrameIndex;
+}
+
+std::uint8_t FECQueue::getStreamIndex() const {
+    return frameSlot(m_nextFrameIndex).header.streamIndex;
+}
+
+std::uint64_t FECQueue::getVideoFrameIndex() const {
+    return m_nextFrameIndex;
+}
+
+// Block of a slice of the oldest frame, null if none of its packets arrived
+const FECQueue::Block *FECQueue::oldestBlock(std::size_t slice) const {
+    if (m_nextFrameIndex == UINT64_MAX) {
+        return nullptr;
+    }
+    const Frame &frame = frameSlot(m_nextFrameIndex);
+    if (!frame.inUse || slice >= frame.slices.size() || !frame.slices[slice].inUse) {
+        return nullptr;
+    }
+    return &frame.slices[slice];
+}
+
+std::size_t FECQueue::getSliceCount() const {
+    if (m_nextFrameIndex == UINT64_MAX || !frameSlot(m_nextFrameIndex).inUse) {
+        return 0;
+    }
+    return frameSlot(m_nextFrameIndex).sliceCount;
+}
+
+const std::byte *FECQueue::getSliceBuffer(std::size_t slice) const {
+    const Block *block = oldestBlock(slice);
+    return block != nullptr ? block->buffer.data() : nullptr;
+}
+
+int FECQueue::getSliceByteSize(std::size_t slice) const {
+    const Block *block = oldestBlock(slice);
+    return block != nullptr ? (int) block->header.frameByteSize : 0;
+}
+
+bool FECQueue::isSliceComplete(std::size_t slice) const {
+    const Block *block = oldestBlock(slice);
+    return block != nullptr && block->recovered;
+}
+
+int FECQueue::getContiguousByteSize(std::size_t slice) const {
+    const Block *block = oldestBlock(slice);
+    if (block == nullptr) {
+        return 0;
+    }
+    // Data packets are stored in slice order, fecIndex * m_packetSize is their offset.
+    return (int) std::min(block->contiguousPackets * m_packetSize, (size_t) block->header.frameByteSize);
+}
+
+void FECQueue::popFrame() {
+    frameSlot(m_nextFrameIndex).inUse = false;
+    m_nextFrameIndex++;
 }
 
 bool FECQueue::fecFailure() const {
@@ -245,3 +404,13 @@ bool FECQueue::fecFailure() const {
 void FECQueue::clearFecFailure() {
     m_fecFailure = false;
 }
+
+std::uint64_t FECQueue::getLostFrameIndex() const {
+    return m_lostFrameIndex;
+}
+
+std::uint64_t FECQueue::takeRecoveryTime() {
+    const std::uint64_t recoveryTime = m_recoveryTime;
+    m_recoveryTime = 0;
+    return recoveryTime;
+}
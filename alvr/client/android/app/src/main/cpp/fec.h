@@ -7,13 +7,16 @@
 #include <memory>
 #include <span>
 #include <vector>
+#include <map>
+#include <utility>
 #include <mutex>
 #include "packet_types.h"
 #include "reedsolomon/rs.h"
 
 class FECQueue {
 public:
-    FECQueue();
+    // packetSize is the payload size of the video packets negotiated for the session.
+    explicit FECQueue(std::size_t packetSize = ALVR_MAX_VIDEO_BUFFER_SIZE);
 
     using VideoPacket = std::span<const std::uint8_t>;
     void addVideoPacket(const VideoFrame& header, const VideoPacket& packet, bool& fecFailure);
@@ -26,32 +29,52 @@ public:
         }, fecFailure);
     }
 
+    // Two step addVideoPacket() for receiving in place. Returns where the payload of the packet
+    // goes, packetSize() bytes, or null if it is not needed. The packet only counts
+    // as received once commitVideoPacket() is called after the payload was written.
+    std::byte *reserveVideoPacket(const VideoFrame& header, bool& fecFailure);
+    void commitVideoPacket(const VideoFrame& header, std::size_t payloadSize);
+    std::size_t packetSize() const { return m_packetSize; }
+
+    // Recovers the frames in flight. Returns true if the oldest one is complete, it is then
+    // available through getFrameBuffer() until popFrame(). Frames are released in order.
+    // Each slice of a frame is a FEC block of its own, recovered as soon as enough of its packets
+    // arrived. A frame of several slices is put together once they are all recovered.
     bool reconstruct();
     const std::byte *getFrameBuffer() const;
     int getFrameByteSize() const;
+    std::uint64_t getTrackingFrameIndex() const;
+    // Stream of the oldest frame in dual stream mode, valid once one of its packets arrived.
+    std::uint8_t getStreamIndex() const;
+    void popFrame();
+
+    // Oldest frame which was not released, its slices can be read before it is complete.
+    std::uint64_t getVideoFrameIndex() const;
+    // Slices of the oldest frame, 0 until a packet of its last slice arrived.
+    std::size_t getSliceCount() const;
+    // Slice of the oldest frame, valid once one of its packets arrived, its size is 0 before.
+    const std::byte *getSliceBuffer(std::size_t slice) const;
+    int getSliceByteSize(std::size_t slice) const;
+    // The slice was recovered, all of its bytes can be read.
+    bool isSliceComplete(std::size_t slice) const;
+    // Bytes at the start of a slice of the oldest frame which arrived without a gap, 0 if none arrived.
+    int getContiguousByteSize(std::size_t slice) const;
 
     bool fecFailure() const;
     void clearFecFailure();
+    // First frame given up by the last failure, the frames before it were released.
+    std::uint64_t getLostFrameIndex() const;
+    // Time spent in reed_solomon_reconstruct since the last call, in microsec
+    std::uint64_t takeRecoveryTime();
 
     FECQueue(const FECQueue&) = delete;
     FECQueue& operator=(const FECQueue&) = delete;
 private:
-
-    VideoFrame m_currentFrame;
-    size_t m_shardPackets;
-    size_t m_blockSize;
-    size_t m_totalDataShards;
-    size_t m_totalParityShards;
-    size_t m_totalShards;
-    uint32_t m_firstPacketOfNextFrame = 0;
-    std::vector<std::vector<unsigned char>> m_marks;
-    std::vector<std::byte> m_frameBuffer;
-    std::vector<uint32_t> m_receivedDataShards;
-    std::vector<uint32_t> m_receivedParityShards;
-    std::vector<bool> m_recoveredPacket;
-    std::vector<std::byte *> m_shards;
-    bool m_recovered;
-    bool m_fecFailure;
+    // Frames reassembled at once, so packets reordered across frames can still complete them.
+    // A frame is given up when a packet arrives for the frame FRAME_WINDOW after it.
+    static constexpr std::size_t FRAME_WINDOW = 3;
+    // Packets this many frames older than the window mean the server restarted its frame counter.
+    static constexpr std::uint64_t FRAME_INDEX_RESET = 120;
 
     struct ReedSolomon final : reed_solomon {
 
@@ -90,7 +113,65 @@ private:
             return m != nullptr && parity != nullptr;
 		}
 	};
-    ReedSolomon m_rs{};
+
+    // FEC block of one slice of a frame
+    struct Block {
+        VideoFrame header;
+        size_t shardPackets = 0;
+        size_t blockSize = 0;
+        size_t totalDataShards = 0;
+        size_t totalParityShards = 0;
+        size_t totalShards = 0;
+        size_t dataPackets = 0;
+        // Data packets at the start of the slice which were received without a gap
+        size_t contiguousPackets = 0;
+        // Marks of packet i are at [i * totalShards, (i + 1) * totalShards), 1 until the shard is received.
+        std::vector<unsigned char> marks;
+        std::vector<std::byte> buffer;
+        std::vector<uint32_t> receivedDataShards;
+        std::vector<uint32_t> receivedParityShards;
+        std::vector<bool> recoveredPacket;
+        ReedSolomon *rs = nullptr;
+        bool inUse = false;
+        bool recovered = false;
+    };
+
+    struct Frame {
+        // Of the first packet which arrived
+        VideoFrame header;
+        // By slice index, the blocks are kept for the next frames of the slot.
+        std::vector<Block> slices;
+        // 0 until a packet of the last slice arrived
+        size_t sliceCount = 0;
+        // The slices one after the other once they are all recovered, if there are several
+        std::vector<std::byte> frameBuffer;
+        int frameByteSize = 0;
+        bool inUse = false;
+        bool recovered = false;
+    };
+
+    Frame &frameSlot(std::uint64_t videoFrameIndex) { return m_frames[videoFrameIndex % FRAME_WINDOW]; }
+    const Frame &frameSlot(std::uint64_t videoFrameIndex) const { return m_frames[videoFrameIndex % FRAME_WINDOW]; }
+    void startFrame(Frame &frame, const VideoFrame &header);
+    void startBlock(Block &block, const VideoFrame &header);
+    void abandonFrames(std::uint64_t nextFrameIndex);
+    bool reconstructFrame(Frame &frame);
+    bool reconstructBlock(Block &block);
+    const Block *oldestBlock(std::size_t slice) const;
+
+    const std::size_t m_packetSize;
+    Frame m_frames[FRAME_WINDOW];
+    // Oldest frame which was not released, UINT64_MAX before the first packet
+    std::uint64_t m_nextFrameIndex = UINT64_MAX;
+    std::vector<std::byte *> m_shards;
+    bool m_fecFailure = false;
+    std::uint64_t m_lostFrameIndex = 0;
+    std::uint64_t m_recoveryTime = 0;
+
+    // Decoders by (data, parity) shard count, they are shared by the frames in flight.
+    std::map<std::pair<std::size_t, std::size_t>, ReedSolomon> m_rsCache;
+
+    ReedSolomon *getReedSolomon(std::size_t dataShards, std::size_t parityShards);
 
     static std::once_flag reed_solomon_initialized;
 };
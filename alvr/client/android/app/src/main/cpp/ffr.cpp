@@ -1,5 +1,6 @@
 #include "ffr.h"
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 
@@ -9,8 +10,10 @@ using namespace std;
 using namespace gl_render_utils;
 
 namespace {
+    const string FFR_SHADER_VERSION = R"glsl(#version 300 es
+    )glsl";
+
     const string FFR_COMMON_SHADER_FORMAT = R"glsl(
-        #version 300 es
         #extension GL_OES_EGL_image_external_essl3 : enable
         precision highp float;
 
@@ -18,7 +21,6 @@ namespace {
         const uvec2 OPTIMIZED_RESOLUTION = uvec2(%u, %u);
         const vec2 EYE_SIZE_RATIO = vec2(%f, %f);
         const vec2 CENTER_SIZE = vec2(%f, %f);
-        const vec2 CENTER_SHIFT = vec2(%f, %f);
         const vec2 EDGE_RATIO = vec2(%f, %f);
 
         vec2 TextureToEyeUV(vec2 textureUV, bool isRightEye) {
@@ -31,15 +33,21 @@ namespace {
             // left: x / 2; right 1 - (x / 2)
             return vec2(eyeUV.x / 2. + float(isRightEye) * (1. - eyeUV.x), eyeUV.y);
         }
+
+        // Dynamic resolution draws each eye scaled into the top left corner of its half
+        vec2 ScaleFrameUV(vec2 frameUV, float scale) {
+            float eyeStart = frameUV.x < 0.5 ? 0. : 0.5;
+            return vec2(eyeStart + (frameUV.x - eyeStart) * scale, frameUV.y * scale);
+        }
     )glsl";
 
-    const string DECOMPRESS_AXIS_ALIGNED_FRAGMENT_SHADER = R"glsl(
-        uniform samplerExternalOES tex0;
-        in vec2 uv;
-        out vec4 color;
-        void main() {
+    // Maps a UV of the expanded frame to the UV of the compressed decoder frame. centerShifts is
+    // the center shift of the frame, left eye then right eye.
+    const string DECOMPRESS_AXIS_ALIGNED_FUNCTION = R"glsl(
+        vec2 DecompressAxisAlignedUV(vec2 uv, vec4 centerShifts) {
             bool isRightEye = uv.x > 0.5;
             vec2 eyeUV = TextureToEyeUV(uv, isRightEye);
+            vec2 CENTER_SHIFT = isRightEye ? centerShifts.zw : centerShifts.xy;
 
             vec2 alignedUV = eyeUV;
 
@@ -63,7 +71,70 @@ namespace {
 
             vec2 uncompressedUV = underBound*leftEdge+inBound*center+overBound*rightEdge;
 
-            color = texture(tex0, EyeToTextureUV(uncompressedUV * EYE_SIZE_RATIO, isRightEye));
+            return EyeToTextureUV(uncompressedUV * EYE_SIZE_RATIO, isRightEye);
+        }
+    )glsl";
+
+    const string CONTENT_SCALE_BLOCK = R"glsl(
+        layout(std140) uniform ContentScaleBlock {
+            float contentScale;
+            vec4 centerShifts;
+        };
+    )glsl";
+
+    const string DECOMPRESS_AXIS_ALIGNED_FRAGMENT_SHADER = R"glsl(
+        uniform samplerExternalOES tex0;
+        in vec2 uv;
+        out vec4 color;
+        void main() {
+            color = SampleStream(tex0, ScaleFrameUV(DecompressAxisAlignedUV(uv, centerShifts), contentScale));
+        }
+    )glsl";
+
+    // In dual stream mode each eye of the compressed frame is a texture of its own
+    const string DECOMPRESS_AXIS_ALIGNED_DUAL_STREAM_FRAGMENT_SHADER = R"glsl(
+        uniform samplerExternalOES tex0;
+        uniform samplerExternalOES tex1;
+        in vec2 uv;
+        out vec4 color;
+        void main() {
+            vec2 frameUV = DecompressAxisAlignedUV(uv, centerShifts);
+            if (frameUV.x < 0.5) {
+                color = SampleStream(tex0, vec2(frameUV.x * 2., frameUV.y) * contentScale);
+            } else {
+                color = SampleStream(tex1, vec2(frameUV.x * 2. - 1., frameUV.y) * contentScale);
+            }
+        }
+    )glsl";
+
+    // Same interface as FRAGMENT_SHADER in render.cpp. uv is kept in highp for the decompression.
+    const string SINGLE_PASS_FRAGMENT_SHADER = R"glsl(
+        in vec2 uv;
+        in lowp vec4 fragmentColor;
+        out lowp vec4 outColor;
+        uniform samplerExternalOES Texture0;
+        uniform float ContentScale;
+        uniform vec4 FoveationCenter;
+        void main() {
+            outColor = SampleStream(Texture0, ScaleFrameUV(DecompressAxisAlignedUV(uv, FoveationCenter), ContentScale));
+        }
+    )glsl";
+
+    const string SINGLE_PASS_DUAL_STREAM_FRAGMENT_SHADER = R"glsl(
+        in vec2 uv;
+        in lowp vec4 fragmentColor;
+        out lowp vec4 outColor;
+        uniform samplerExternalOES Texture0;
+        uniform samplerExternalOES Texture1;
+        uniform float ContentScale;
+        uniform vec4 FoveationCenter;
+        void main() {
+            vec2 frameUV = DecompressAxisAlignedUV(uv, FoveationCenter);
+            if (frameUV.x < 0.5) {
+                outColor = SampleStream(Texture0, vec2(frameUV.x * 2., frameUV.y) * ContentScale);
+            } else {
+                outColor = SampleStream(Texture1, vec2(frameUV.x * 2. - 1., frameUV.y) * ContentScale);
+            }
         }
     )glsl";
 
@@ -124,34 +195,88 @@ namespace {
 			eyeWidthRatioAligned, eyeHeightRatioAligned,
 			centerSizeXAligned, centerSizeYAligned, centerShiftXAligned, centerShiftYAligned, edgeRatioX, edgeRatioY };
     }
+
+    string FormatCommonShader(FFRData ffrData) {
+        auto fv = CalculateFoveationVars(ffrData);
+        return string_format(FFR_COMMON_SHADER_FORMAT,
+                             fv.targetEyeWidth, fv.targetEyeHeight,
+                             fv.optimizedEyeWidth, fv.optimizedEyeHeight,
+                             fv.eyeWidthRatio, fv.eyeHeightRatio,
+                             fv.centerSizeX, fv.centerSizeY,
+                             fv.edgeRatioX, fv.edgeRatioY);
+    }
+
+    // SampleStream() reading the compressed frame, upscaled when the eye buffers are larger than
+    // the frame before compression
+    string FormatSamplingFunction(FFRData ffrData, UpscaleData upscale, bool dualStream) {
+        auto fv = CalculateFoveationVars(ffrData);
+        auto frameWidth = dualStream ? fv.optimizedEyeWidth : fv.optimizedEyeWidth * 2;
+        return GetStreamSamplingFunction(upscale, "samplerExternalOES", frameWidth,
+                                         fv.optimizedEyeHeight);
+    }
 }
 
 
-FFR::FFR(Texture *inputSurface)
-        : mInputSurface(inputSurface) {
+FFR::FFR(Texture *inputSurface, Texture *secondInputSurface)
+        : mInputSurface(inputSurface), mSecondInputSurface(secondInputSurface) {
 }
 
-void FFR::Initialize(FFRData ffrData) {
-    auto fv = CalculateFoveationVars(ffrData);
-    auto ffrCommonShaderStr = string_format(FFR_COMMON_SHADER_FORMAT,
-                                            fv.targetEyeWidth, fv.targetEyeHeight,
-                                            fv.optimizedEyeWidth, fv.optimizedEyeHeight,
-                                            fv.eyeWidthRatio, fv.eyeHeightRatio,
-                                            fv.centerSizeX, fv.centerSizeY,
-                                            fv.centerShiftX, fv.centerShiftY,
-                                            fv.edgeRatioX, fv.edgeRatioY);
-
-    mExpandedTexture.reset(
-            new Texture(false, ffrData.eyeWidth * 2, ffrData.eyeHeight, GL_RGB8));
-    mExpandedTextureState = make_unique<RenderState>(mExpandedTexture.get());
-
-    auto decompressAxisAlignedShaderStr = ffrCommonShaderStr + DECOMPRESS_AXIS_ALIGNED_FRAGMENT_SHADER;
+void FFR::Initialize(FFRData ffrData, UpscaleData upscale, bool outputTexture) {
+    auto ffrCommonShaderStr = FFR_SHADER_VERSION + FormatCommonShader(ffrData);
+
+    if (outputTexture) {
+        auto eyeWidth = upscale.enabled ? upscale.eyeWidth : ffrData.eyeWidth;
+        auto eyeHeight = upscale.enabled ? upscale.eyeHeight : ffrData.eyeHeight;
+        mExpandedTexture.reset(new Texture(false, eyeWidth * 2, eyeHeight, GL_RGB8));
+        mExpandedTextureState = make_unique<RenderState>(mExpandedTexture.get());
+    }
+
+    vector<const Texture *> inputSurfaces = {mInputSurface};
+    auto decompressAxisAlignedShaderStr =
+            ffrCommonShaderStr + DECOMPRESS_AXIS_ALIGNED_FUNCTION + CONTENT_SCALE_BLOCK +
+            FormatSamplingFunction(ffrData, upscale, mSecondInputSurface != nullptr);
+    if (mSecondInputSurface != nullptr) {
+        inputSurfaces.push_back(mSecondInputSurface);
+        decompressAxisAlignedShaderStr += DECOMPRESS_AXIS_ALIGNED_DUAL_STREAM_FRAGMENT_SHADER;
+    } else {
+        decompressAxisAlignedShaderStr += DECOMPRESS_AXIS_ALIGNED_FRAGMENT_SHADER;
+    }
     mDecompressAxisAlignedPipeline = unique_ptr<RenderPipeline>(
-            new RenderPipeline({mInputSurface}, QUAD_2D_VERTEX_SHADER,
-                               decompressAxisAlignedShaderStr));
+            new RenderPipeline(inputSurfaces, QUAD_2D_VERTEX_SHADER,
+                               decompressAxisAlignedShaderStr, sizeof(float) * 8));
+}
+
+string FFR::GetSinglePassFragmentShader(FFRData ffrData, UpscaleData upscale, bool dualStream) {
+    return FormatCommonShader(ffrData) + DECOMPRESS_AXIS_ALIGNED_FUNCTION +
+           FormatSamplingFunction(ffrData, upscale, dualStream) +
+           (dualStream ? SINGLE_PASS_DUAL_STREAM_FRAGMENT_SHADER : SINGLE_PASS_FRAGMENT_SHADER);
+}
+
+void FFR::Render(float contentScale, const float centerShifts[4]) const {
+    Render(*mExpandedTextureState, contentScale, centerShifts);
 }
 
-void FFR::Render() const {
-    mExpandedTextureState->ClearDepth();
-    mDecompressAxisAlignedPipeline->Render(*mExpandedTextureState);
+void FFR::Render(const RenderState &renderState, float contentScale,
+                 const float centerShifts[4]) const {
+    // ContentScaleBlock, centerShifts is aligned to a vec4 by std140
+    float uniformBlock[8] = {contentScale};
+    copy(centerShifts, centerShifts + 4, uniformBlock + 4);
+    renderState.ClearDepth();
+    mDecompressAxisAlignedPipeline->Render(renderState, uniformBlock);
+}
+
+void FFR::GetStaticFoveationCenter(FFRData ffrData, float centerShifts[4]) {
+    auto fv = CalculateFoveationVars(ffrData);
+    centerShifts[0] = centerShifts[2] = fv.centerShiftX;
+    centerShifts[1] = centerShifts[3] = fv.centerShiftY;
+}
+
+int FFR::GetCompositorFoveationLevel(FFRData ffrData) {
+    if (!ffrData.enabled) {
+        return 0;
+    }
+    // Each level halves the shading rate further from the center: 2x edge compression is low,
+    // 4x medium and 8x high.
+    float edgeRatio = std::min(ffrData.edgeRatioX, ffrData.edgeRatioY);
+    return std::min(std::max((int) floorf(log2f(edgeRatio)), 0), 3);
 }
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "gl_render_utils/render_pipeline.h"
 #include "packet_types.h"
+#include "upscale.h"
 
 struct FFRData {
     bool enabled;
@@ -16,21 +18,48 @@ struct FFRData {
     float centerShiftY;
     float edgeRatioX;
     float edgeRatioY;
+    // Decompress in the eye shader instead of expanding to an intermediate texture
+    bool singlePass;
+    // Expand into the swapchain submitted to the compositor instead of rendering the eyes again
+    bool directLayer;
 };
 
 class FFR {
 public:
-    FFR(gl_render_utils::Texture *inputSurface);
+    // secondInputSurface is the right eye decoder texture in dual stream mode, null otherwise
+    FFR(gl_render_utils::Texture *inputSurface, gl_render_utils::Texture *secondInputSurface);
 
-    void Initialize(FFRData ffrData);
+    // Without outputTexture, Render() must be given the render state to expand into. With
+    // upscaling the frame is expanded at the eye size of upscale.
+    void Initialize(FFRData ffrData, UpscaleData upscale, bool outputTexture = true);
 
-    void Render() const;
+    // contentScale is the dynamic resolution scale of the frame, 1 at full resolution.
+    // centerShifts is the foveation center of the frame, see GetStaticFoveationCenter().
+    void Render(float contentScale, const float centerShifts[4]) const;
+    // Expands both eyes side by side into renderState
+    void Render(const gl_render_utils::RenderState &renderState, float contentScale,
+                const float centerShifts[4]) const;
 
     gl_render_utils::Texture *GetOutputTexture() { return mExpandedTexture.get(); }
 
+    // Fragment shader sampling the decoder texture Texture0 through the decompression math, to be
+    // used in place of the eye shader in single pass mode. It has no #version line. In dual stream
+    // mode the right eye is sampled from Texture1.
+    static std::string GetSinglePassFragmentShader(FFRData ffrData, UpscaleData upscale,
+                                                   bool dualStream);
+
+    // Center shifts of the settings, left eye then right eye, for the frames the server did not
+    // compress around the eye gaze. The single pass shader reads them from FoveationCenter.
+    static void GetStaticFoveationCenter(FFRData ffrData, float centerShifts[4]);
+
+    // VRAPI_FOVEATION_LEVEL matching the compression of the frame edges. The edges of the frame
+    // have less detail than the eye buffers, so they can be shaded at a lower rate.
+    static int GetCompositorFoveationLevel(FFRData ffrData);
+
 private:
 
     gl_render_utils::Texture *mInputSurface;
+    gl_render_utils::Texture *mSecondInputSurface;
     std::unique_ptr<gl_render_utils::Texture> mExpandedTexture;
     std::unique_ptr<gl_render_utils::RenderState> mExpandedTextureState;
     std::unique_ptr<gl_render_utils::RenderPipeline> mDecompressAxisAlignedPipeline;
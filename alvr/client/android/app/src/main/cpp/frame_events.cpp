@@ -0,0 +1,59 @@
+#include "frame_events.h"
+
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "utils.h"
+
+namespace {
+    // Guards the directory and the creation of the mapping
+    std::mutex g_mutex;
+    std::string g_directory;
+    FrameEvents::Header *g_mapping = nullptr;
+
+    FrameEvents::Header *mapRing() {
+        if (g_directory.empty()) {
+            return nullptr;
+        }
+        std::string path = g_directory + "/frame_events.bin";
+        const size_t size = sizeof(FrameEvents::Header) + sizeof(FrameEvents::Record) * FrameEvents::CAPACITY;
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            LOGE("Cannot create the frame event trace %s.", path.c_str());
+            return nullptr;
+        }
+        // Zero filled, so that the records of the new ring have no sequence
+        void *mapping = MAP_FAILED;
+        if (ftruncate(fd, (off_t) size) == 0) {
+            mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            LOGE("Cannot map the frame event trace %s.", path.c_str());
+            return nullptr;
+        }
+
+        auto *header = static_cast<FrameEvents::Header *>(mapping);
+        header->magic = FrameEvents::MAGIC;
+        header->version = FrameEvents::VERSION;
+        header->recordSize = sizeof(FrameEvents::Record);
+        header->capacity = FrameEvents::CAPACITY;
+        LOGI("Recording the frame events to %s.", path.c_str());
+        return header;
+    }
+}
+
+void FrameEvents::setDirectory(const std::string &directory) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_directory = directory;
+}
+
+void FrameEvents::setEnabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (enabled && g_mapping == nullptr) {
+        g_mapping = mapRing();
+    }
+    s_header.store(enabled ? g_mapping : nullptr, std::memory_order_relaxed);
+}
@@ -0,0 +1,111 @@
+#ifndef ALVRCLIENT_FRAME_EVENTS_H
+#define ALVRCLIENT_FRAME_EVENTS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Ids of the records of FrameEvents, stored in the trace: only add to the end. The arguments of
+// each event follow its name.
+enum class FrameEvent : uint32_t {
+    // FECQueue, the frame index is the tracking frame index of the video frames
+    FEC_FRAME_START,            // videoFrameIndex, frameByteSize of the slice of the first packet
+    FEC_WINDOW_ABANDONED,       // first, last abandoned videoFrameIndex
+    FEC_FRAME_LOST,             // videoFrameIndex, data shards << 32 | parity shards, per slice lost
+    FEC_PACKET_SHARDS,          // shard packet, received data shards << 32 | received parity shards
+    FEC_RECOVERING,             // shard packet, received data shards << 32 | received parity shards
+    FEC_RECOVERED,
+    // VideoDecoder
+    DECODER_CONFIG,             // size
+    DECODER_IDR,                // size, presentation time in us
+    DECODER_SKIP_P,             // waiting for the next IDR
+    DECODER_P,                  // size, presentation time in us
+    DECODER_PARTIAL_IDR,        // presentation time in us
+    DECODER_PARTIAL,            // size, last part
+    DECODER_DROP_NON_REFERENCE, // frames in the codec
+    DECODER_SPLIT_INPUT,        // size, bytes copied to the input buffer
+    DECODER_DROP_SUPERSEDED,    // output queue size
+    DECODER_OUTPUT,             // output queue size, codec buffer index
+    DECODER_RELEASE,            // codec buffer index
+    SURFACE_AVAILABLE,
+    SURFACE_SUPERSEDED,
+    SURFACE_CLEAR,
+    IMAGE_AVAILABLE,
+    IMAGE_MISMATCH,             // image timestamp, expected timestamp, in us
+    // Rendering
+    RENDER_FRAME,
+    // LatencyCollector, when the frame is submitted
+    LATENCY,                    // total, decode latency in us
+};
+
+// Per frame trace of the network, decoder and render threads, in place of log messages. Every
+// event is a fixed size binary record written with relaxed atomics into a ring mapped from
+// frame_events.bin, so recording costs a few stores on any thread and the trace outlives the
+// process. Recording is switched at runtime, a disabled event is a single relaxed load.
+//
+// The file is decoded offline: a Header, then Header::capacity Records. A record belongs to the
+// claim of sequence - 1, at the slot of that claim modulo the capacity. A record whose sequence
+// does not match its slot is being written, a crash may leave one behind.
+class FrameEvents {
+public:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t capacity;
+        // Records claimed since the ring was created
+        std::atomic<uint64_t> claimed;
+        uint64_t reserved[5];
+    };
+
+    struct Record {
+        // 0 while the record is written
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> frameIndex;
+        // System clock in us, like the rest of the timestamps of the client
+        std::atomic<uint64_t> timestampUs;
+        std::atomic<int64_t> args[2];
+        std::atomic<uint32_t> event;
+        uint32_t reserved;
+    };
+
+    static constexpr uint32_t MAGIC = 0x45464c41; // "ALFE"
+    static constexpr uint32_t VERSION = 1;
+    // 3 MiB, several seconds of every event of a high rate stream
+    static constexpr uint32_t CAPACITY = 64 * 1024;
+
+    // Directory of the trace file, nothing is recorded until it is set
+    static void setDirectory(const std::string &directory);
+    // The ring is mapped on the first enable, over the trace of the previous process.
+    static void setEnabled(bool enabled);
+
+    static void record(uint64_t frameIndex, FrameEvent event, int64_t arg0 = 0, int64_t arg1 = 0) {
+        Header *header = s_header.load(std::memory_order_relaxed);
+        if (header == nullptr) {
+            return;
+        }
+        uint64_t claim = header->claimed.fetch_add(1, std::memory_order_relaxed);
+        Record &record = reinterpret_cast<Record *>(header + 1)[claim % CAPACITY];
+
+        record.sequence.store(0, std::memory_order_relaxed);
+        record.frameIndex.store(frameIndex, std::memory_order_relaxed);
+        record.timestampUs.store(timestampUs(), std::memory_order_relaxed);
+        record.args[0].store(arg0, std::memory_order_relaxed);
+        record.args[1].store(arg1, std::memory_order_relaxed);
+        record.event.store(static_cast<uint32_t>(event), std::memory_order_relaxed);
+        // Orders the fields before the sequence for a reader of the mapping
+        record.sequence.store(claim + 1, std::memory_order_release);
+    }
+
+private:
+    static uint64_t timestampUs() {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    // The mapping while enabled. It is never unmapped, a thread may still write to it.
+    static inline std::atomic<Header *> s_header{nullptr};
+};
+
+#endif //ALVRCLIENT_FRAME_EVENTS_H
@@ -1,5 +1,7 @@
 #include "render_pipeline.h"
+#include <cstring>
 #include "../utils.h"
+#include "../program_cache.h"
 
 using namespace std;
 
@@ -49,20 +51,31 @@ namespace gl_render_utils {
     RenderPipeline::RenderPipeline(const vector<const Texture *> &inputTextures,
                                    const string &vertexShader, const string &fragmentShader,
                                    size_t uniformBlockSize) {
-        mVertexShader = createShader(GL_VERTEX_SHADER, vertexShader);
-        mFragmentShader = createShader(GL_FRAGMENT_SHADER, fragmentShader);
-
-        mProgram = glCreateProgram();
-        GL(glAttachShader(mProgram, mVertexShader));
-        GL(glAttachShader(mProgram, mFragmentShader));
-
-        GLint linked;
-        GL(glLinkProgram(mProgram));
-        GL(glGetProgramiv(mProgram, GL_LINK_STATUS, &linked));
-        if (!linked) {
-            char errorLog[1000];
-            GL(glGetProgramInfoLog(mProgram, sizeof(errorLog), nullptr, errorLog));
-            LOGE("SHADER LINKING ERROR: %s", errorLog);
+        string cacheKey = vertexShader + fragmentShader;
+        mProgram = ProgramCache::load(cacheKey);
+        if (mProgram != 0) {
+            // The shaders are only needed to link
+            mVertexShader = 0;
+            mFragmentShader = 0;
+        } else {
+            mVertexShader = createShader(GL_VERTEX_SHADER, vertexShader);
+            mFragmentShader = createShader(GL_FRAGMENT_SHADER, fragmentShader);
+
+            mProgram = glCreateProgram();
+            GL(glAttachShader(mProgram, mVertexShader));
+            GL(glAttachShader(mProgram, mFragmentShader));
+
+            GLint linked;
+            ProgramCache::prepare(mProgram);
+            GL(glLinkProgram(mProgram));
+            GL(glGetProgramiv(mProgram, GL_LINK_STATUS, &linked));
+            if (!linked) {
+                char errorLog[1000];
+                GL(glGetProgramInfoLog(mProgram, sizeof(errorLog), nullptr, errorLog));
+                LOGE("SHADER LINKING ERROR: %s", errorLog);
+            } else {
+                ProgramCache::store(cacheKey, mProgram);
+            }
         }
 
         for (size_t i = 0; i < inputTextures.size(); i++) {
@@ -103,7 +116,14 @@ namespace gl_render_utils {
             GL(glUniform1i(mInputTexturesInfo[i].uniformLocation, i));
         }
 
-        if (uniformBlockData != nullptr) {
+        // Rewriting the buffer while the previous frame still reads it can stall the driver. The
+        // stall is only avoided when the block did not change: a block that changes, like a
+        // moving foveation center, is still rewritten every frame.
+        auto *blockBytes = static_cast<const uint8_t *>(uniformBlockData);
+        if (uniformBlockData != nullptr &&
+            (mUniformBlockData.empty() ||
+             memcmp(mUniformBlockData.data(), blockBytes, mUniformBlockSize) != 0)) {
+            mUniformBlockData.assign(blockBytes, blockBytes + mUniformBlockSize);
             GL(glBindBuffer(GL_UNIFORM_BUFFER, mBlockBuffer));
             GL(glBufferSubData(GL_UNIFORM_BUFFER, 0, mUniformBlockSize, uniformBlockData));
         }
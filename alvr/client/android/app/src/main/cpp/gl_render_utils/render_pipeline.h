@@ -60,5 +60,7 @@ namespace gl_render_utils {
 
         GLuint mBlockBuffer = 0;
         size_t mUniformBlockSize;
+        // Content of mBlockBuffer, empty before the first upload
+        mutable std::vector<uint8_t> mUniformBlockData;
     };
 }
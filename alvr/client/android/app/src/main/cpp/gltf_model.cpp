@@ -10,7 +10,21 @@
 #include "utils.h"
 #include "render.h"
 
+GltfModel::~GltfModel() {
+    if (m_loaded.valid()) {
+        m_loaded.wait();
+    }
+    if (m_uploaded) {
+        glDeleteBuffers(m_vbs.size(), m_vbs.data());
+        glDeleteVertexArrays(1, &m_vao);
+    }
+}
+
 void GltfModel::load() {
+    m_loaded = std::async(std::launch::async, [this] { return parse(); });
+}
+
+bool GltfModel::parse() {
     tinygltf::TinyGLTF loader;
     std::string err, warn;
 
@@ -19,12 +33,15 @@ void GltfModel::load() {
     std::vector<unsigned char> buffer;
     if (!loadAsset("loading.gltf", buffer)) {
         LOGE("Error on loading scene gltf file.");
-        return;
+        return false;
     }
     bool ret = loader.LoadASCIIFromString(&m_model, &err, &warn, (char *) &buffer[0], buffer.size(), "");
 
     LOGI("GltfModel loaded. ret=%d scenes=%lu defaultScene=%d err=%s.\nwarn=%s", ret, m_model.scenes.size(), m_model.defaultScene, err.c_str(), warn.c_str());
+    return ret;
+}
 
+void GltfModel::upload() {
     m_vbs.resize(m_model.bufferViews.size());
 
     GL(glGenVertexArrays(1, &m_vao));
@@ -42,11 +59,20 @@ void GltfModel::load() {
     }
 
     GL(glBindVertexArray(0));
+    m_uploaded = true;
 }
 
 void GltfModel::drawScene(int position, int uv,
                           int normal, GLint color, GLint mMatrix, GLint mode) {
-    if(m_model.scenes.size() == 0) {
+    if (m_loaded.valid()) {
+        if (m_loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+        if (m_loaded.get()) {
+            upload();
+        }
+    }
+    if(!m_uploaded || m_model.scenes.size() == 0) {
         return;
     }
     auto &scene = m_model.scenes[m_model.defaultScene];
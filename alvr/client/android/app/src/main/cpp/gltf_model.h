@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <future>
 #include <GLES3/gl3.h>
 #include <VrApi_Types.h>
 
@@ -11,8 +12,11 @@
 
 class GltfModel {
     std::vector<GLuint> m_vbs;
+    // Only touched by the loader thread until m_loaded is ready
     tinygltf::Model m_model;
-    GLuint m_vao;
+    std::future<bool> m_loaded;
+    bool m_uploaded = false;
+    GLuint m_vao = 0;
 
     int m_position;
     int m_uv;
@@ -24,7 +28,13 @@ class GltfModel {
     void drawNodeTree(int node_i, const ovrMatrix4f &transform);
     void drawNode(int node_i, const ovrMatrix4f &transform);
     ovrMatrix4f createNodeTransform(const ovrMatrix4f &baseTransform, const tinygltf::Node &node);
+    bool parse();
+    void upload();
 public:
+    ~GltfModel();
+
+    // Starts parsing the model on a worker thread. The buffers are uploaded by the first
+    // drawScene() after parsing finished, nothing is drawn until then.
     void load();
     void drawScene(int position, int uv, int normal, GLint color, GLint mMatrix, GLint mode);
 };
@@ -0,0 +1,104 @@
+#include "gpu_timer.h"
+
+#include <cstring>
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+
+#include "utils.h"
+
+namespace {
+    PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+}
+
+std::unique_ptr<GpuTimer> GpuTimer::Create() {
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    if (extensions == nullptr || strstr(extensions, "GL_EXT_disjoint_timer_query") == nullptr) {
+        LOGI("GL_EXT_disjoint_timer_query not supported, no GPU time of the render passes.");
+        return nullptr;
+    }
+    glGetQueryObjectui64vEXT = (PFNGLGETQUERYOBJECTUI64VEXTPROC) eglGetProcAddress(
+            "glGetQueryObjectui64vEXT");
+    if (glGetQueryObjectui64vEXT == nullptr) {
+        return nullptr;
+    }
+    return std::unique_ptr<GpuTimer>(new GpuTimer());
+}
+
+GpuTimer::GpuTimer() {
+    for (auto &set : m_Sets) {
+        GL(glGenQueries(PASS_COUNT, set.queries));
+        for (auto &issued : set.issued) {
+            issued = false;
+        }
+    }
+    // Clears the disjoint state of before the first frame
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+}
+
+GpuTimer::~GpuTimer() {
+    if (m_Active) {
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+    }
+    for (auto &set : m_Sets) {
+        glDeleteQueries(PASS_COUNT, set.queries);
+    }
+}
+
+bool GpuTimer::beginFrame(uint64_t timesUs[PASS_COUNT]) {
+    if (m_Active) {
+        end();
+    }
+    m_Current = (m_Current + 1) % QUERY_SETS;
+    QuerySet &set = m_Sets[m_Current];
+
+    // Frames that timed no pass, like the loading ones, have no results
+    bool ready = false;
+    for (auto issued : set.issued) {
+        ready = ready || issued;
+    }
+    for (int pass = 0; ready && pass < PASS_COUNT; pass++) {
+        timesUs[pass] = 0;
+        if (!set.issued[pass]) {
+            continue;
+        }
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(set.queries[pass], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (available == GL_FALSE) {
+            ready = false;
+            break;
+        }
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64vEXT(set.queries[pass], GL_QUERY_RESULT_EXT, &elapsedNs);
+        timesUs[pass] = elapsedNs / 1000;
+    }
+    // The results are undefined if the timer was disjoint since, which also resets the flag
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        ready = false;
+    }
+
+    for (auto &issued : set.issued) {
+        issued = false;
+    }
+    return ready;
+}
+
+void GpuTimer::begin(Pass pass) {
+    if (m_Active) {
+        end();
+    }
+    QuerySet &set = m_Sets[m_Current];
+    GL(glBeginQuery(GL_TIME_ELAPSED_EXT, set.queries[pass]));
+    set.issued[pass] = true;
+    m_Active = true;
+}
+
+void GpuTimer::end() {
+    if (!m_Active) {
+        return;
+    }
+    GL(glEndQuery(GL_TIME_ELAPSED_EXT));
+    m_Active = false;
+}
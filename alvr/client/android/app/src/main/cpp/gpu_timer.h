@@ -0,0 +1,48 @@
+#ifndef ALVRCLIENT_GPU_TIMER_H
+#define ALVRCLIENT_GPU_TIMER_H
+
+#include <stdint.h>
+#include <memory>
+#include <GLES3/gl3.h>
+
+// Measures the GPU time of the render passes of the frames with GL_EXT_disjoint_timer_query.
+// The queries of a frame are read back when their query set comes around again, QUERY_SETS frames
+// later, so the render thread never waits for the GPU. Frames whose results are not ready by then,
+// or during which the GPU timer was disjoint (clock change, context loss), are dropped.
+class GpuTimer {
+public:
+    enum Pass {
+        PASS_FFR,
+        PASS_EYES,
+        PASS_COUNT
+    };
+
+    // Null if the extension is not supported. Needs the GL context current.
+    static std::unique_ptr<GpuTimer> Create();
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    // Starts the queries of a new frame. Returns whether the frame that last used the query set
+    // had results, copied to timesUs. In microsec, 0 for passes it did not run.
+    bool beginFrame(uint64_t timesUs[PASS_COUNT]);
+    // Only one pass can be timed at a time
+    void begin(Pass pass);
+    void end();
+
+private:
+    GpuTimer();
+
+    constexpr static const int QUERY_SETS = 2;
+
+    struct QuerySet {
+        GLuint queries[PASS_COUNT];
+        bool issued[PASS_COUNT];
+    };
+    QuerySet m_Sets[QUERY_SETS];
+    int m_Current = 0;
+    bool m_Active = false;
+};
+
+#endif //ALVRCLIENT_GPU_TIMER_H
@@ -0,0 +1,146 @@
+#include "haptics.h"
+
+#include <algorithm>
+#include <VrApi.h>
+#include "utils.h"
+
+void HapticsScheduler::request(int hand, float durationS, float amplitude) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto &h = m_Hands[hand];
+    h.durationUs = (uint64_t) (durationS * 1000'000);
+    h.amplitude = amplitude;
+    h.fresh = true;
+}
+
+void HapticsScheduler::update(ovrMobile *ovr, double displayTime) {
+    // Held during the VrApi calls, request() only waits for them on the network thread
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    uint64_t currentUs = getTimestampUs();
+    if (currentUs - m_LastDeviceRefreshUs >= DEVICE_REFRESH_US) {
+        refreshDevices(ovr, currentUs);
+    }
+
+    for (auto &h : m_Hands) {
+        bool fresh = h.fresh;
+        if (fresh) {
+            h.endUs = currentUs + h.durationUs;
+            h.sample = static_cast<uint8_t>(255 * std::min(std::max(h.amplitude, 0.0f), 1.0f));
+            h.fresh = false;
+        }
+        if (!h.device.connected) {
+            h.playing = false;
+            continue;
+        }
+
+        if (currentUs >= h.endUs) {
+            // No more haptics is needed.
+            if (h.playing) {
+                stop(ovr, h, displayTime);
+            }
+            continue;
+        }
+
+        if (h.device.buffered) {
+            // Note: HapticSamplesMax=25 HapticSampleDurationMS=2 on Quest
+            if (!fresh && displayTime + REFILL_MARGIN_S < h.queuedUntil) {
+                continue;
+            }
+
+            uint32_t required = static_cast<uint32_t>((h.endUs - currentUs) / (h.device.sampleDurationMs * 1000));
+            ovrHapticBuffer buffer;
+            buffer.BufferTime = displayTime;
+            buffer.HapticBuffer = h.samples.data();
+            buffer.NumSamples = std::max(std::min(h.device.samplesMax, required), 1u);
+            buffer.Terminated = false;
+            std::fill(h.samples.begin(), h.samples.begin() + buffer.NumSamples, h.sample);
+
+            auto result = vrapi_SetHapticVibrationBuffer(ovr, h.device.id, &buffer);
+            if (result != ovrSuccess) {
+                LOGI("vrapi_SetHapticVibrationBuffer: Failed. result=%d", result);
+                // The controller may be gone, look for it again
+                m_LastDeviceRefreshUs = 0;
+                continue;
+            }
+            h.queuedUntil = displayTime + buffer.NumSamples * h.device.sampleDurationMs / 1000.0;
+            h.playing = true;
+        } else if (h.device.simple && fresh) {
+            LOG("Send simple haptic. amplitude=%f", h.sample / 255.0f);
+            vrapi_SetHapticVibrationSimple(ovr, h.device.id, h.sample / 255.0f);
+            h.playing = true;
+        }
+    }
+}
+
+void HapticsScheduler::reset() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    for (auto &h : m_Hands) {
+        h.device = {};
+        h.playing = false;
+        h.endUs = 0;
+    }
+    m_LastDeviceRefreshUs = 0;
+}
+
+void HapticsScheduler::refreshDevices(ovrMobile *ovr, uint64_t currentUs) {
+    m_LastDeviceRefreshUs = currentUs;
+
+    bool connected[2] = {false, false};
+    ovrInputCapabilityHeader curCaps;
+    for (uint32_t deviceIndex = 0;
+         vrapi_EnumerateInputDevices(ovr, deviceIndex, &curCaps) >= 0; deviceIndex++) {
+        if (curCaps.Type != ovrControllerType_TrackedRemote) continue;
+
+        ovrInputTrackedRemoteCapabilities remoteCapabilities;
+        remoteCapabilities.Header = curCaps;
+        if (vrapi_GetInputDeviceCapabilities(ovr, &remoteCapabilities.Header) != ovrSuccess) {
+            continue;
+        }
+
+        int hand = (remoteCapabilities.ControllerCapabilities & ovrControllerCaps_LeftHand) ? 1 : 0;
+        auto &device = m_Hands[hand].device;
+        device.id = curCaps.DeviceID;
+        device.connected = true;
+        device.buffered = (remoteCapabilities.ControllerCapabilities &
+                           ovrControllerCaps_HasBufferedHapticVibration) != 0 &&
+                          remoteCapabilities.HapticSamplesMax > 0 &&
+                          remoteCapabilities.HapticSampleDurationMS > 0;
+        device.simple = (remoteCapabilities.ControllerCapabilities &
+                         ovrControllerCaps_HasSimpleHapticVibration) != 0;
+        device.samplesMax = remoteCapabilities.HapticSamplesMax;
+        device.sampleDurationMs = remoteCapabilities.HapticSampleDurationMS;
+        if (m_Hands[hand].samples.size() < device.samplesMax) {
+            m_Hands[hand].samples.resize(device.samplesMax);
+        }
+        connected[hand] = true;
+    }
+
+    for (int hand = 0; hand < 2; hand++) {
+        if (!connected[hand]) {
+            m_Hands[hand].device.connected = false;
+        }
+    }
+}
+
+void HapticsScheduler::stop(ovrMobile *ovr, Hand &hand, double displayTime) {
+    hand.playing = false;
+    hand.queuedUntil = 0;
+
+    if (hand.device.buffered) {
+        uint8_t hapticBuffer[1] = {0};
+        ovrHapticBuffer buffer;
+        buffer.BufferTime = displayTime;
+        buffer.HapticBuffer = &hapticBuffer[0];
+        buffer.NumSamples = 1;
+        buffer.Terminated = true;
+
+        auto result = vrapi_SetHapticVibrationBuffer(ovr, hand.device.id, &buffer);
+        if (result != ovrSuccess) {
+            LOGI("vrapi_SetHapticVibrationBuffer: Failed. result=%d", result);
+        }
+    } else if (hand.device.simple) {
+        vrapi_SetHapticVibrationSimple(ovr, hand.device.id, 0.0f);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef ALVRCLIENT_HAPTICS_H
+#define ALVRCLIENT_HAPTICS_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include <VrApi_Input.h>
+
+// Plays the haptic requests of the server on the controllers. Updated from the tracking thread so
+// that haptic events take no time from rendering. The capabilities of the controllers are cached
+// and the sample buffer of each hand is allocated once.
+class HapticsScheduler {
+public:
+    // hand 0 is the right hand, 1 the left hand. Called from the network thread.
+    void request(int hand, float durationS, float amplitude);
+
+    // displayTime is the predicted display time of the next frame, the buffered samples start
+    // there. Samples are only queued again when the previous ones are about to run out.
+    void update(ovrMobile *ovr, double displayTime);
+
+    // Forgets the devices, for example when leaving VR mode
+    void reset();
+
+private:
+    struct Device {
+        ovrDeviceID id = 0;
+        bool connected = false;
+        bool buffered = false;
+        bool simple = false;
+        uint32_t samplesMax = 0;
+        uint32_t sampleDurationMs = 0;
+    };
+
+    struct Hand {
+        // Last request
+        uint64_t durationUs = 0;
+        float amplitude = 0;
+        bool fresh = false;
+
+        // Played by update()
+        uint64_t endUs = 0;
+        uint8_t sample = 0;
+        bool playing = false;
+        // Display time the queued samples last until
+        double queuedUntil = 0;
+
+        Device device;
+        std::vector<uint8_t> samples;
+    };
+
+    void refreshDevices(ovrMobile *ovr, uint64_t currentUs);
+    void stop(ovrMobile *ovr, Hand &hand, double displayTime);
+
+    // The capabilities are only enumerated again this often, controllers can reconnect
+    constexpr static const uint64_t DEVICE_REFRESH_US = 1000 * 1000;
+    // Samples are queued again when less than this is left, a few tracking updates
+    constexpr static const double REFILL_MARGIN_S = 0.01;
+
+    std::mutex m_Mutex;
+    Hand m_Hands[2];
+    uint64_t m_LastDeviceRefreshUs = 0;
+};
+
+#endif //ALVRCLIENT_HAPTICS_H
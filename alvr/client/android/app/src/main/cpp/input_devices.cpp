@@ -0,0 +1,129 @@
+#include "input_devices.h"
+
+#include <VrApi.h>
+#include "packet_types.h"
+#include "utils.h"
+
+void InputDeviceRegistry::update(ovrMobile *ovr) {
+    uint64_t currentUs = getTimestampUs();
+    if (!m_Stale && currentUs - m_LastPollUs < DEVICE_POLL_US) {
+        return;
+    }
+    m_LastPollUs = currentUs;
+    bool stale = m_Stale.exchange(false);
+
+    m_Headers.clear();
+    ovrInputCapabilityHeader curCaps;
+    for (uint32_t deviceIndex = 0;
+         vrapi_EnumerateInputDevices(ovr, deviceIndex, &curCaps) >= 0; deviceIndex++) {
+        if (curCaps.Type == ovrControllerType_Hand || curCaps.Type == ovrControllerType_TrackedRemote) {
+            m_Headers.push_back(curCaps);
+        }
+    }
+
+    bool changed = stale || m_Headers.size() != m_Devices.size();
+    for (size_t i = 0; !changed && i < m_Headers.size(); i++) {
+        changed = m_Headers[i].Type != m_Devices[i].header.Type ||
+                  m_Headers[i].DeviceID != m_Devices[i].header.DeviceID;
+    }
+    if (!changed) {
+        return;
+    }
+
+    // Devices whose capabilities cannot be read are left out, so the list differs at the next poll
+    m_Devices.clear();
+    for (auto &header : m_Headers) {
+        LOG("Device: Type=%d ID=%d", header.Type, header.DeviceID);
+        Device device = {};
+        device.header = header;
+        if (header.Type == ovrControllerType_Hand) {
+            device.isHand = true;
+            device.handCapabilities.Header = header;
+            if (vrapi_GetInputDeviceCapabilities(ovr, &device.handCapabilities.Header) != ovrSuccess) {
+                continue;
+            }
+            device.leftHand = (device.handCapabilities.HandCapabilities & ovrHandCaps_LeftHand) != 0;
+        } else {
+            device.remoteCapabilities.Header = header;
+            if (vrapi_GetInputDeviceCapabilities(ovr, &device.remoteCapabilities.Header) != ovrSuccess) {
+                continue;
+            }
+            device.leftHand = (device.remoteCapabilities.ControllerCapabilities & ovrControllerCaps_LeftHand) != 0;
+            LOG("ID=%d Cap Controller=%08X Button=%08X Touch=%08X",
+                header.DeviceID,
+                device.remoteCapabilities.ControllerCapabilities,
+                device.remoteCapabilities.ButtonCapabilities,
+                device.remoteCapabilities.TouchCapabilities);
+            buildButtonMap(device);
+        }
+        device.controller = device.leftHand ? 0 : 1;
+        m_Devices.push_back(device);
+    }
+}
+
+void InputDeviceRegistry::invalidate() {
+    m_Stale = true;
+}
+
+const std::vector<InputDeviceRegistry::Device> &InputDeviceRegistry::devices() const {
+    return m_Devices;
+}
+
+uint64_t InputDeviceRegistry::mapButtons(const Device &device, const ovrInputStateTrackedRemote &state) {
+    uint64_t buttons = 0;
+    for (auto &mapping : device.buttonMap) {
+        if (state.Buttons & mapping.mask) {
+            buttons |= mapping.buttons;
+        }
+    }
+    for (auto &mapping : device.touchMap) {
+        if (state.Touches & mapping.mask) {
+            buttons |= mapping.buttons;
+        }
+    }
+    if (state.TrackpadStatus) {
+        buttons |= device.trackpadButtons;
+    }
+    return buttons;
+}
+
+void InputDeviceRegistry::buildButtonMap(Device &device) {
+    if (device.remoteCapabilities.ControllerCapabilities & ovrControllerCaps_ModelOculusTouch) {
+        // Oculus Quest Touch Cotroller
+        device.buttonMap = {
+                {ovrButton_A, ALVR_BUTTON_FLAG(ALVR_INPUT_A_CLICK)},
+                {ovrButton_B, ALVR_BUTTON_FLAG(ALVR_INPUT_B_CLICK)},
+                {ovrButton_RThumb, ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_CLICK)},
+                {ovrButton_X, ALVR_BUTTON_FLAG(ALVR_INPUT_X_CLICK)},
+                {ovrButton_Y, ALVR_BUTTON_FLAG(ALVR_INPUT_Y_CLICK)},
+                {ovrButton_LThumb, ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_CLICK)},
+                // Menu button on left hand
+                {ovrButton_Enter, ALVR_BUTTON_FLAG(ALVR_INPUT_SYSTEM_CLICK)},
+                {ovrButton_GripTrigger, ALVR_BUTTON_FLAG(ALVR_INPUT_GRIP_CLICK)},
+                {ovrButton_Trigger, ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK)},
+                {ovrButton_Joystick, device.leftHand ? ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_LEFT_CLICK)
+                                                     : ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_RIGHT_CLICK)},
+                // Only on right controller. What's button???
+                {ovrButton_Unknown1, ALVR_BUTTON_FLAG(ALVR_INPUT_BACK_CLICK)},
+        };
+        device.touchMap = {
+                {ovrTouch_A, ALVR_BUTTON_FLAG(ALVR_INPUT_A_TOUCH)},
+                {ovrTouch_B, ALVR_BUTTON_FLAG(ALVR_INPUT_B_TOUCH)},
+                {ovrTouch_X, ALVR_BUTTON_FLAG(ALVR_INPUT_X_TOUCH)},
+                {ovrTouch_Y, ALVR_BUTTON_FLAG(ALVR_INPUT_Y_TOUCH)},
+                {ovrTouch_IndexTrigger, ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH)},
+                {ovrTouch_Joystick, ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_TOUCH)},
+                {ovrTouch_ThumbRest, ALVR_BUTTON_FLAG(ALVR_INPUT_THUMB_REST_TOUCH)},
+        };
+        device.trackpadButtons = 0;
+    } else {
+        // GearVR or Oculus Go Controller
+        device.buttonMap = {
+                {ovrButton_A, ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH) | ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK)},
+                {ovrButton_Enter, ALVR_BUTTON_FLAG(ALVR_INPUT_A_CLICK)},
+                {ovrButton_Back, ALVR_BUTTON_FLAG(ALVR_INPUT_B_TOUCH) | ALVR_BUTTON_FLAG(ALVR_INPUT_B_CLICK)},
+        };
+        device.touchMap.clear();
+        device.trackpadButtons = ALVR_BUTTON_FLAG(ALVR_INPUT_TRACKPAD_TOUCH) | ALVR_BUTTON_FLAG(ALVR_INPUT_A_TOUCH);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef ALVRCLIENT_INPUT_DEVICES_H
+#define ALVRCLIENT_INPUT_DEVICES_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <VrApi_Input.h>
+
+// The controllers and tracked hands of VrApi with their capabilities and button mapping. VrApi
+// has no connection events, the list of devices is enumerated every DEVICE_POLL_US or right away
+// after a device failed, and the capabilities are only queried again when the list changed.
+// Used from the tracking thread, except invalidate().
+class InputDeviceRegistry {
+public:
+    struct ButtonMapping {
+        // ovrButton_* or ovrTouch_* bits
+        uint32_t mask;
+        // ALVR_BUTTON_FLAG bits
+        uint64_t buttons;
+    };
+
+    struct Device {
+        ovrInputCapabilityHeader header;
+        bool isHand;
+        bool leftHand;
+        // Index in TrackingInfo::controller
+        int controller;
+        // Valid for tracked remotes
+        ovrInputTrackedRemoteCapabilities remoteCapabilities;
+        // Valid for hands
+        ovrInputHandCapabilities handCapabilities;
+
+        // Mapping of the model of the controller, precomputed with the capabilities
+        std::vector<ButtonMapping> buttonMap;
+        std::vector<ButtonMapping> touchMap;
+        // Set while the trackpad is touched, GearVR and Oculus Go controllers
+        uint64_t trackpadButtons;
+    };
+
+    void update(ovrMobile *ovr);
+    // A device failed or VR mode was left, the devices are enumerated at the next update
+    void invalidate();
+
+    const std::vector<Device> &devices() const;
+
+    static uint64_t mapButtons(const Device &device, const ovrInputStateTrackedRemote &state);
+
+private:
+    static void buildButtonMap(Device &device);
+
+    constexpr static const uint64_t DEVICE_POLL_US = 250 * 1000;
+
+    std::vector<Device> m_Devices;
+    // Enumerated at each poll, compared with the headers of m_Devices
+    std::vector<ovrInputCapabilityHeader> m_Headers;
+    uint64_t m_LastPollUs = 0;
+    std::atomic<bool> m_Stale{true};
+};
+
+#endif //ALVRCLIENT_INPUT_DEVICES_H
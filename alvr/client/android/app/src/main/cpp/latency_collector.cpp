@@ -1,4 +1,7 @@
 #include "latency_collector.h"
+
+#include <algorithm>
+#include "frame_events.h"
 #ifndef ALXR_CLIENT
     #include "utils.h"
     #include "bindings.h"
@@ -31,7 +34,6 @@ namespace {
         using microsecondsU64 = duration<std::uint64_t, microseconds::period>;
         return duration_cast<microsecondsU64>(ClockType::now().time_since_epoch()).count();
     }
-    inline void FrameLog(...) {}
 }
 #endif
 
@@ -42,12 +44,27 @@ LatencyCollector::LatencyCollector()
 }
 
 LatencyCollector::FrameTimestamp &LatencyCollector::getFrame(uint64_t frameIndex) {
-    std::scoped_lock<std::mutex> lock(m_framesMutex);
-    if (m_Frames.size() > MAX_FRAMES) {
-        m_Frames.erase(m_Frames.cbegin());
+    auto &frame = m_Frames[(frameIndex / FRAME_SLOT_NS) % MAX_FRAMES];
+    uint64_t current = frame.frameIndex.load(std::memory_order_acquire);
+    while (current != frameIndex) {
+        if (current == FRAME_CLAIMING) {
+            // Another thread is resetting the slot, this takes a few stores.
+            current = frame.frameIndex.load(std::memory_order_acquire);
+            continue;
+        }
+        // The slot belongs to an older frame, the newest one takes it over.
+        if (frame.frameIndex.compare_exchange_weak(current, FRAME_CLAIMING, std::memory_order_acq_rel)) {
+            for (auto *timestamp : { &frame.tracking, &frame.predictionHorizon, &frame.estimatedSent,
+                                     &frame.received, &frame.receivedFirst, &frame.receivedLast,
+                                     &frame.decoderInput, &frame.decoderOutput,
+                                     &frame.presentationQueued, &frame.rendered1, &frame.rendered2,
+                                     &frame.submit }) {
+                timestamp->store(0, std::memory_order_relaxed);
+            }
+            frame.frameIndex.store(frameIndex, std::memory_order_release);
+            break;
+        }
     }
-    auto &frame = m_Frames[frameIndex];
-    frame.frameIndex = frameIndex;
     return frame;
 }
 
@@ -56,7 +73,9 @@ void LatencyCollector::setTotalLatency(uint32_t latency) {
         m_ServerTotalLatency.store(latency * 0.05 + m_ServerTotalLatency.load() * 0.95);
 }
 void LatencyCollector::tracking(uint64_t frameIndex) {
-    getFrame(frameIndex).tracking = getTimestampUs();
+    auto &frame = getFrame(frameIndex);
+    frame.tracking = getTimestampUs();
+    frame.predictionHorizon = getTrackingPredictionLatency();
 }
 void LatencyCollector::estimatedSent(uint64_t frameIndex, uint64_t offset) {
     getFrame(frameIndex).estimatedSent = getTimestampUs() + offset;
@@ -76,6 +95,9 @@ void LatencyCollector::decoderInput(uint64_t frameIndex) {
 void LatencyCollector::decoderOutput(uint64_t frameIndex) {
     getFrame(frameIndex).decoderOutput = getTimestampUs();
 }
+void LatencyCollector::presentationQueued(uint64_t frameIndex) {
+    getFrame(frameIndex).presentationQueued = getTimestampUs();
+}
 void LatencyCollector::rendered1(uint64_t frameIndex) {
     getFrame(frameIndex).rendered1 = getTimestampUs();
 }
@@ -84,57 +106,125 @@ void LatencyCollector::rendered2(uint64_t frameIndex) {
 }
 
 void LatencyCollector::submit(uint64_t frameIndex) {
-    FrameTimestamp timestamp = getFrame(frameIndex);
-    timestamp.submit = getTimestampUs();
+    auto &frame = getFrame(frameIndex);
+    const uint64_t submit = getTimestampUs();
+    frame.submit = submit;
 
-    m_Latency[0] = timestamp.submit - timestamp.tracking;
-    if (timestamp.decoderInput >= timestamp.decoderOutput)
-        m_Latency[2] = 0;
+    const uint64_t tracking = frame.tracking;
+    const uint64_t received = frame.received;
+    const uint64_t receivedFirst = frame.receivedFirst;
+    const uint64_t receivedLast = frame.receivedLast;
+    const uint64_t decoderInput = frame.decoderInput;
+    const uint64_t decoderOutput = frame.decoderOutput;
+    const uint64_t presentationQueued = frame.presentationQueued;
+    const uint64_t rendered1 = frame.rendered1;
+    const uint64_t rendered2 = frame.rendered2;
+
+    uint64_t *latency = m_Statistics.latency;
+    latency[0] = submit - tracking;
+    if (decoderInput >= decoderOutput)
+        latency[2] = 0;
     else
-        m_Latency[2] = timestamp.decoderOutput - timestamp.decoderInput;
-    if (timestamp.received) {
-        m_Latency[3] = (timestamp.received - timestamp.tracking) / 2;
-        m_Latency[1] = timestamp.receivedLast - timestamp.receivedFirst + m_Latency[3];
+        latency[2] = decoderOutput - decoderInput;
+    if (received) {
+        latency[3] = (received - tracking) / 2;
+        latency[1] = receivedLast - receivedFirst + latency[3];
     } else {
-        m_Latency[3] = 0;
-        m_Latency[1] = timestamp.receivedLast - timestamp.receivedFirst;
+        latency[3] = 0;
+        latency[1] = receivedLast - receivedFirst;
     }
-    if (timestamp.decoderOutput >= timestamp.rendered2)
-        m_Latency[4] = 0;
+    // Without the native decoder the frames are queued once decoded
+    const uint64_t queued = presentationQueued != 0 ? presentationQueued : decoderOutput;
+    if (queued >= rendered1)
+        latency[4] = 0;
     else
-        m_Latency[4] = timestamp.rendered2 - timestamp.decoderOutput;
+        latency[4] = rendered1 - queued;
 
-    submitNewFrame();
+    auto &lastSubmittedFrame = m_Statistics.lastSubmittedFrame;
+    lastSubmittedFrame.frameIndex = frameIndex;
+    lastSubmittedFrame.tracking = tracking;
+    lastSubmittedFrame.receivedFirst = receivedFirst;
+    lastSubmittedFrame.receivedLast = receivedLast;
+    lastSubmittedFrame.decoderInput = decoderInput;
+    lastSubmittedFrame.decoderOutput = decoderOutput;
+    lastSubmittedFrame.rendered = rendered2;
+    lastSubmittedFrame.submit = submit;
 
-    m_FramesInSecond = 1000000.0 / (timestamp.submit - m_LastSubmit);
-    m_LastSubmit = timestamp.submit;
-#ifndef NDEBUG
-    FrameLog(frameIndex, "totalLatency=%.1f transportLatency=%.1f decodeLatency=%.1f renderLatency1=%.1f renderLatency2=%.1f"
-            , m_Latency[0] / 1000.0, m_Latency[1] / 1000.0, m_Latency[2] / 1000.0
-            , (timestamp.rendered2 - timestamp.decoderOutput) / 1000.0
-            , (timestamp.submit - timestamp.rendered2) / 1000.0);
-#endif
+    checkAndResetSecond();
+
+    if (decoderInput != 0 && decoderOutput >= decoderInput && rendered2 >= rendered1) {
+        m_DecodeTimeSum += decoderOutput - decoderInput;
+        m_RenderTimeSum += rendered2 - rendered1;
+        m_StageTimeCount++;
+    }
+
+    m_Statistics.framesInSecond = 1000000.0 / (submit - m_LastSubmit);
+    m_LastSubmit = submit;
+
+    m_Statistics.packetsLostTotal = m_PacketsLostTotal.load(std::memory_order_relaxed);
+    m_Statistics.fecFailureTotal = m_FecFailureTotal.load(std::memory_order_relaxed);
+    publishStatistics();
+    FrameEvents::record(frameIndex, FrameEvent::LATENCY, latency[0], latency[2]);
 }
 
+void LatencyCollector::publishStatistics() {
+    // Single writer. The buffer being written is the one readers are not pointed to.
+    const uint64_t sequence = m_StatisticsSequence.load(std::memory_order_relaxed);
+    m_StatisticsSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_PublishedStatistics[(sequence / 2 + 1) % 2] = m_Statistics;
+    m_StatisticsSequence.store(sequence + 2, std::memory_order_release);
+}
+
+LatencyCollector::Statistics LatencyCollector::getStatistics() const {
+    Statistics statistics;
+    while (true) {
+        const uint64_t sequence = m_StatisticsSequence.load(std::memory_order_acquire);
+        const uint64_t published = sequence & ~(uint64_t) 1;
+        statistics = m_PublishedStatistics[(published / 2) % 2];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The copied buffer is only written again once the writer starts the publication after
+        // the next one.
+        if (m_StatisticsSequence.load(std::memory_order_relaxed) - published <= 2) {
+            return statistics;
+        }
+    }
+}
+
+// Called on connection, before the render thread submits stream frames.
 void LatencyCollector::resetAll() {
     m_PacketsLostTotal = 0;
-    m_PacketsLostInSecond = 0;
-    m_PacketsLostPrevious = 0;
+    m_PacketsLostSecondStart = 0;
 
     m_FecFailureTotal = 0;
-    m_FecFailureInSecond = 0;
-    m_FecFailurePrevious = 0;
+    m_FecFailureSecondStart = 0;
+
+    m_NetworkBusyTotal = 0;
+    m_NetworkBusySecondStart = 0;
+    m_FecRecoveryTotal = 0;
+    m_FecRecoverySecondStart = 0;
+    m_DecodeTimeSum = 0;
+    m_RenderTimeSum = 0;
+    m_StageTimeCount = 0;
+    m_GpuTimeFfrSum = 0;
+    m_GpuTimeEyesSum = 0;
+    m_GpuTimeCount = 0;
 
-    m_FramesInSecond = 0;
     m_LastSubmit = 0;
 
-    for(int i = 0; i < 5; i++) {
-        m_Latency[i] = 0;
-    }
+    m_PredictionErrorRotationSum = 0;
+    m_PredictionErrorPositionSum = 0;
+    m_PredictionErrorCount = 0;
+    m_HorizonSamples.clear();
+    m_PredictionResidualSum = 0;
+    m_PredictionHorizon.store(0);
 
-    {
-        std::scoped_lock l(m_framesMutex);
-        m_Frames.clear();
+    m_Statistics = {};
+    publishStatistics();
+
+    // The slots are reset when a frame takes them over.
+    for (auto &frame : m_Frames) {
+        frame.frameIndex = 0;
     }
     m_ServerTotalLatency.store(0);
 
@@ -142,11 +232,69 @@ void LatencyCollector::resetAll() {
 }
 
 void LatencyCollector::resetSecond(){
-    m_PacketsLostPrevious = m_PacketsLostInSecond;
-    m_PacketsLostInSecond = 0;
+    // Counts of the second that just ended, from the totals at both of its ends
+    const uint64_t packetsLost = m_PacketsLostTotal.load(std::memory_order_relaxed);
+    m_Statistics.packetsLostInSecond = packetsLost - m_PacketsLostSecondStart;
+    m_PacketsLostSecondStart = packetsLost;
+
+    const uint64_t fecFailure = m_FecFailureTotal.load(std::memory_order_relaxed);
+    m_Statistics.fecFailureInSecond = fecFailure - m_FecFailureSecondStart;
+    m_FecFailureSecondStart = fecFailure;
+
+    const uint64_t networkBusy = m_NetworkBusyTotal.load(std::memory_order_relaxed);
+    m_Statistics.networkBusyInSecond = networkBusy - m_NetworkBusySecondStart;
+    m_NetworkBusySecondStart = networkBusy;
+
+    const uint64_t fecRecovery = m_FecRecoveryTotal.load(std::memory_order_relaxed);
+    m_Statistics.fecRecoveryInSecond = fecRecovery - m_FecRecoverySecondStart;
+    m_FecRecoverySecondStart = fecRecovery;
+
+    if (m_StageTimeCount > 0) {
+        m_Statistics.decodeTimeAverage = m_DecodeTimeSum / m_StageTimeCount;
+        m_Statistics.renderTimeAverage = m_RenderTimeSum / m_StageTimeCount;
+    } else {
+        m_Statistics.decodeTimeAverage = 0;
+        m_Statistics.renderTimeAverage = 0;
+    }
+    m_DecodeTimeSum = 0;
+    m_RenderTimeSum = 0;
+    m_StageTimeCount = 0;
 
-    m_FecFailurePrevious = m_FecFailureInSecond;
-    m_FecFailureInSecond = 0;
+    if (m_GpuTimeCount > 0) {
+        m_Statistics.gpuTimeFfrAverage = m_GpuTimeFfrSum / m_GpuTimeCount;
+        m_Statistics.gpuTimeEyesAverage = m_GpuTimeEyesSum / m_GpuTimeCount;
+    } else {
+        m_Statistics.gpuTimeFfrAverage = 0;
+        m_Statistics.gpuTimeEyesAverage = 0;
+    }
+    m_GpuTimeFfrSum = 0;
+    m_GpuTimeEyesSum = 0;
+    m_GpuTimeCount = 0;
+    m_Statistics.second++;
+
+    if (m_PredictionErrorCount > 0) {
+        m_Statistics.predictionErrorRotation = m_PredictionErrorRotationSum / m_PredictionErrorCount;
+        m_Statistics.predictionErrorPosition = m_PredictionErrorPositionSum / m_PredictionErrorCount;
+    } else {
+        m_Statistics.predictionErrorRotation = 0;
+        m_Statistics.predictionErrorPosition = 0;
+    }
+    m_PredictionErrorRotationSum = 0;
+    m_PredictionErrorPositionSum = 0;
+    m_PredictionErrorCount = 0;
+
+    // The horizon the samples needed is the one they were predicted with plus the residual
+    if (!m_HorizonSamples.empty()) {
+        m_Statistics.predictionResidual = m_PredictionResidualSum / (int64_t) m_HorizonSamples.size();
+        auto median = m_HorizonSamples.begin() + m_HorizonSamples.size() / 2;
+        std::nth_element(m_HorizonSamples.begin(), median, m_HorizonSamples.end());
+        m_PredictionHorizon.store(*median);
+    } else {
+        m_Statistics.predictionResidual = 0;
+    }
+    m_Statistics.predictionHorizon = getTrackingPredictionLatency();
+    m_HorizonSamples.clear();
+    m_PredictionResidualSum = 0;
 }
 
 void LatencyCollector::checkAndResetSecond() {
@@ -158,45 +306,55 @@ void LatencyCollector::checkAndResetSecond() {
 }
 
 void LatencyCollector::packetLoss(int64_t lost) {
-    checkAndResetSecond();
-
-    m_PacketsLostTotal += lost;
-    m_PacketsLostInSecond += lost;
+    m_PacketsLostTotal.fetch_add(lost, std::memory_order_relaxed);
 }
 
 void LatencyCollector::fecFailure() {
-    checkAndResetSecond();
+    m_FecFailureTotal.fetch_add(1, std::memory_order_relaxed);
+}
 
-    m_FecFailureTotal++;
-    m_FecFailureInSecond++;
+void LatencyCollector::networkBusy(uint64_t busyUs) {
+    m_NetworkBusyTotal.fetch_add(busyUs, std::memory_order_relaxed);
 }
 
-void LatencyCollector::submitNewFrame() {
-    checkAndResetSecond();
+void LatencyCollector::fecRecovery(uint64_t recoveryUs) {
+    m_FecRecoveryTotal.fetch_add(recoveryUs, std::memory_order_relaxed);
 }
 
 uint64_t LatencyCollector::getTrackingPredictionLatency() const {
-    const auto predictionLatency = m_ServerTotalLatency.load();
+    uint64_t predictionLatency = m_PredictionHorizon.load();
+    if (predictionLatency == 0) {
+        predictionLatency = m_ServerTotalLatency.load();
+    }
     return predictionLatency > 2e5 ? 2e5 : predictionLatency;
 }
 
-uint64_t LatencyCollector::getLatency(uint32_t i) const {
-    return m_Latency[i];
-}
-uint64_t LatencyCollector::getPacketsLostTotal() const {
-    return m_PacketsLostTotal;
-}
-uint64_t LatencyCollector::getPacketsLostInSecond() const {
-    return m_PacketsLostPrevious;
-}
-uint64_t LatencyCollector::getFecFailureTotal() const {
-    return m_FecFailureTotal;
+void LatencyCollector::predictionError(float rotationDegrees, float positionMillimeters) {
+    checkAndResetSecond();
+
+    m_PredictionErrorRotationSum += rotationDegrees;
+    m_PredictionErrorPositionSum += positionMillimeters;
+    m_PredictionErrorCount++;
 }
-uint64_t LatencyCollector::getFecFailureInSecond() const {
-    return m_FecFailurePrevious;
+
+void LatencyCollector::gpuTime(uint64_t ffrUs, uint64_t eyesUs) {
+    checkAndResetSecond();
+
+    m_GpuTimeFfrSum += ffrUs;
+    m_GpuTimeEyesSum += eyesUs;
+    m_GpuTimeCount++;
 }
-float LatencyCollector::getFramesInSecond() const {
-    return m_FramesInSecond;
+
+void LatencyCollector::displayed(uint64_t frameIndex, uint64_t displayTimeNs) {
+    checkAndResetSecond();
+
+    const uint64_t horizon = getFrame(frameIndex).predictionHorizon;
+    if (horizon == 0 || m_HorizonSamples.size() >= MAX_HORIZON_SAMPLES) {
+        return;
+    }
+    const int64_t residual = ((int64_t) displayTimeNs - (int64_t) frameIndex) / 1000;
+    m_HorizonSamples.push_back(std::max<int64_t>((int64_t) horizon + residual, 0));
+    m_PredictionResidualSum += residual;
 }
 
 LatencyCollector &LatencyCollector::Instance() {
@@ -3,27 +3,72 @@
 
 #include <memory>
 #include <vector>
-#include <map>
 #include <atomic>
-#include <mutex>
 
 class LatencyCollector {
 public:
+    // Timestamps of a submitted frame in microsec, copied for the frame trace of the server.
+    struct SubmittedFrame {
+        uint64_t frameIndex = 0;
+        uint64_t tracking = 0;
+        uint64_t receivedFirst = 0;
+        uint64_t receivedLast = 0;
+        uint64_t decoderInput = 0;
+        uint64_t decoderOutput = 0;
+        uint64_t rendered = 0;
+        uint64_t submit = 0;
+    };
+
+    // Statistics reported to the server in TimeSync packets, published by submit()
+    struct Statistics {
+        uint64_t packetsLostTotal = 0;
+        uint64_t packetsLostInSecond = 0;
+        uint64_t fecFailureTotal = 0;
+        uint64_t fecFailureInSecond = 0;
+        // Total/Transport/Decode/Send/Idle latency of the last submitted frame. Idle is the time
+        // the decoded frame waited to be rendered.
+        uint64_t latency[5] = {};
+        float framesInSecond = 0;
+        // Averages over the last second, in degrees and millimeters
+        float predictionErrorRotation = 0;
+        float predictionErrorPosition = 0;
+        // Prediction horizon of the tracking samples, and average of the display time of the
+        // frames minus the time they were predicted for over the last second, in microsec
+        uint64_t predictionHorizon = 0;
+        int64_t predictionResidual = 0;
+        // Load of the stages over the last second, for the clock levels. Average decode and render
+        // time of the submitted frames, and time the network thread spent on the received packets,
+        // in microsec. second increases with each update.
+        uint64_t second = 0;
+        uint64_t decodeTimeAverage = 0;
+        uint64_t renderTimeAverage = 0;
+        uint64_t networkBusyInSecond = 0;
+        // Time the network thread spent recovering lost shards with FEC over the last second
+        uint64_t fecRecoveryInSecond = 0;
+        // Average GPU time of the decompression and eye passes of the frames over the last
+        // second, in microsec. 0 without GPU timer or for a pass the frames do not run.
+        uint64_t gpuTimeFfrAverage = 0;
+        uint64_t gpuTimeEyesAverage = 0;
+        SubmittedFrame lastSubmittedFrame;
+    };
+
     static LatencyCollector &Instance();
 
+    // Median time from the tracking samples to the display of their frames over the last second,
+    // the estimate of the server until a frame is displayed. In microsec.
     uint64_t getTrackingPredictionLatency() const;
-    uint64_t getLatency(uint32_t i) const;
-    uint64_t getPacketsLostTotal() const;
-    uint64_t getPacketsLostInSecond() const;
-    uint64_t getFecFailureTotal() const;
-    uint64_t getFecFailureInSecond() const;
-    float getFramesInSecond() const;
+    // Consistent copy of the last published statistics, callable from any thread
+    Statistics getStatistics() const;
 
+    // Called from the network thread
     void packetLoss(int64_t lost);
     void fecFailure();
+    void networkBusy(uint64_t busyUs);
+    void fecRecovery(uint64_t recoveryUs);
 
     void setTotalLatency(uint32_t latency);
 
+    // Records the prediction horizon of the sample along with its time
     void tracking(uint64_t frameIndex);
     void estimatedSent(uint64_t frameIndex, uint64_t offset);
     void received(uint64_t frameIndex);
@@ -31,55 +76,89 @@ public:
     void receivedLast(uint64_t frameIndex);
     void decoderInput(uint64_t frameIndex);
     void decoderOutput(uint64_t frameIndex);
+    // Decoded frame entering the presentation queue of the native decoder
+    void presentationQueued(uint64_t frameIndex);
     void rendered1(uint64_t frameIndex);
     void rendered2(uint64_t frameIndex);
     void submit(uint64_t frameIndex);
+    // Difference between the pose a frame was rendered with and the latest one for its display time
+    void predictionError(float rotationDegrees, float positionMillimeters);
+    // Display time of the frame on the clock of its frame index, from the render thread
+    void displayed(uint64_t frameIndex, uint64_t displayTimeNs);
+    // GPU time of the passes of a frame in microsec, from the render thread
+    void gpuTime(uint64_t ffrUs, uint64_t eyesUs);
 
     void resetAll();
 private:
     LatencyCollector();
 
-    void submitNewFrame();
-
     void resetSecond();
     void checkAndResetSecond();
+    void publishStatistics();
 
     static LatencyCollector m_Instance;
 
+    // Fields are written by the network, decoder and render threads without locking.
     struct FrameTimestamp {
-        uint64_t frameIndex;
+        // Frame using this slot, FRAME_CLAIMING while its fields are reset
+        std::atomic<uint64_t> frameIndex { 0 };
 
         // Timestamp in microsec.
-        uint64_t tracking;
-        uint64_t estimatedSent;
-        uint64_t received;
-        uint64_t receivedFirst;
-        uint64_t receivedLast;
-        uint64_t decoderInput;
-        uint64_t decoderOutput;
-        uint64_t rendered1;
-        uint64_t rendered2;
-        uint64_t submit;
+        std::atomic<uint64_t> tracking { 0 };
+        std::atomic<uint64_t> predictionHorizon { 0 };
+        std::atomic<uint64_t> estimatedSent { 0 };
+        std::atomic<uint64_t> received { 0 };
+        std::atomic<uint64_t> receivedFirst { 0 };
+        std::atomic<uint64_t> receivedLast { 0 };
+        std::atomic<uint64_t> decoderInput { 0 };
+        std::atomic<uint64_t> decoderOutput { 0 };
+        std::atomic<uint64_t> presentationQueued { 0 };
+        std::atomic<uint64_t> rendered1 { 0 };
+        std::atomic<uint64_t> rendered2 { 0 };
+        std::atomic<uint64_t> submit { 0 };
     };
     constexpr static const int MAX_FRAMES = 1024;
-    std::map<uint64_t, FrameTimestamp> m_Frames = std::map<uint64_t, FrameTimestamp>();
-    std::mutex m_framesMutex;
-
-    uint64_t m_StatisticsTime;
-    uint64_t m_PacketsLostTotal = 0;
-    uint64_t m_PacketsLostInSecond = 0;
-    uint64_t m_PacketsLostPrevious = 0;
-    uint64_t m_FecFailureTotal = 0;
-    uint64_t m_FecFailureInSecond = 0;
-    uint64_t m_FecFailurePrevious = 0;
+    constexpr static const uint64_t FRAME_CLAIMING = UINT64_MAX;
+    // Frame indices are display timestamps in nanoseconds, and frames are more than a
+    // millisecond apart. Slots are indexed by millisecond, so the ring covers about a second.
+    constexpr static const uint64_t FRAME_SLOT_NS = 1000 * 1000;
+    FrameTimestamp m_Frames[MAX_FRAMES];
+
+    // Counted by the network thread, only ever incremented
+    std::atomic<uint64_t> m_PacketsLostTotal { 0 };
+    std::atomic<uint64_t> m_FecFailureTotal { 0 };
+    std::atomic<uint64_t> m_NetworkBusyTotal { 0 };
+    std::atomic<uint64_t> m_FecRecoveryTotal { 0 };
 
     std::atomic<uint32_t> m_ServerTotalLatency { 0 };
+    std::atomic<uint64_t> m_PredictionHorizon { 0 };
 
-    // Total/Transport/Decode/Idle latency
-    uint64_t m_Latency[5]{ 0,0,0,0,0 };
-
+    // Owned by the render thread, which calls submit() and predictionError()
+    uint64_t m_StatisticsTime;
+    uint64_t m_PacketsLostSecondStart = 0;
+    uint64_t m_FecFailureSecondStart = 0;
+    uint64_t m_NetworkBusySecondStart = 0;
+    uint64_t m_FecRecoverySecondStart = 0;
+    uint64_t m_DecodeTimeSum = 0;
+    uint64_t m_RenderTimeSum = 0;
+    uint64_t m_StageTimeCount = 0;
+    uint64_t m_GpuTimeFfrSum = 0;
+    uint64_t m_GpuTimeEyesSum = 0;
+    uint64_t m_GpuTimeCount = 0;
+    float m_PredictionErrorRotationSum = 0;
+    float m_PredictionErrorPositionSum = 0;
+    uint64_t m_PredictionErrorCount = 0;
+    constexpr static const size_t MAX_HORIZON_SAMPLES = 256;
+    std::vector<uint64_t> m_HorizonSamples;
+    int64_t m_PredictionResidualSum = 0;
     uint64_t m_LastSubmit = 0;
-    float m_FramesInSecond = 0;
+    // Next statistics to publish
+    Statistics m_Statistics;
+
+    // Double buffer of published statistics. m_StatisticsSequence is odd while the buffer it
+    // does not point to is written, readers retry if the one they copied was overwritten.
+    Statistics m_PublishedStatistics[2];
+    std::atomic<uint64_t> m_StatisticsSequence { 0 };
 
     FrameTimestamp & getFrame(uint64_t frameIndex);
 };
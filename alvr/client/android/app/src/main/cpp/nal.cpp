@@ -3,10 +3,12 @@
 ////////////////////////////////////////////////////////////////////
 
 #include <string>
+#include <algorithm>
 #include <stdlib.h>
 #include <android/log.h>
 #include <pthread.h>
 #include "nal.h"
+#include "decoder.h"
 #include "packet_types.h"
 
 static const std::byte NAL_TYPE_SPS = static_cast<const std::byte>(7);
@@ -14,8 +16,9 @@ static const std::byte NAL_TYPE_SPS = static_cast<const std::byte>(7);
 static const std::byte H265_NAL_TYPE_VPS = static_cast<const std::byte>(32);
 
 
-NALParser::NALParser(JNIEnv *env, jobject udpManager, jclass nalClass, bool enableFEC)
-    : m_enableFEC(enableFEC)
+NALParser::NALParser(JNIEnv *env, jobject udpManager, jclass nalClass, bool enableFEC, bool earlyDecode,
+                     size_t packetSize)
+    : m_enableFEC(enableFEC), m_earlyDecode(earlyDecode), m_queue(packetSize)
 {
     LOGE("NALParser initialized %p", this);
 
@@ -43,61 +46,265 @@ void NALParser::setCodec(int codec)
     m_codec = codec;
 }
 
+NALParser::ContentScaleSlot NALParser::s_contentScales[CONTENT_SCALE_HISTORY];
+std::atomic<int> NALParser::s_nextContentScale { 0 };
+
+float NALParser::contentScale(uint64_t trackingFrameIndex)
+{
+    for (auto &slot : s_contentScales) {
+        if (slot.trackingFrameIndex == trackingFrameIndex) {
+            uint8_t percent = slot.contentScale;
+            return percent > 0 && percent < 100 ? percent / 100.f : 1.f;
+        }
+    }
+    return 1.f;
+}
+
+bool NALParser::foveationCenter(uint64_t trackingFrameIndex, float center[4])
+{
+    for (auto &slot : s_contentScales) {
+        if (slot.trackingFrameIndex == trackingFrameIndex) {
+            uint32_t packed = slot.foveationCenter;
+            // -128 first is the center of the settings, the others go up to +-127
+            if ((int8_t) (packed & 0xff) == INT8_MIN) {
+                return false;
+            }
+            for (int i = 0; i < 4; i++) {
+                center[i] = (int8_t) ((packed >> (i * 8)) & 0xff) / 127.f;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void NALParser::recordFrameHeader(const VideoFrame &header)
+{
+    // Every packet of a frame carries the header, and dual stream frames share their index
+    int last = (s_nextContentScale + CONTENT_SCALE_HISTORY - 1) % CONTENT_SCALE_HISTORY;
+    if (s_contentScales[last].trackingFrameIndex == header.trackingFrameIndex) {
+        return;
+    }
+    uint32_t packedCenter = 0;
+    for (int i = 0; i < 4; i++) {
+        packedCenter |= (uint32_t) (uint8_t) header.foveationCenter[i] << (i * 8);
+    }
+    auto &slot = s_contentScales[s_nextContentScale];
+    slot.trackingFrameIndex = 0;
+    slot.contentScale = header.contentScale;
+    slot.foveationCenter = packedCenter;
+    slot.trackingFrameIndex = header.trackingFrameIndex;
+    s_nextContentScale = (s_nextContentScale + 1) % CONTENT_SCALE_HISTORY;
+}
+
 bool NALParser::processPacket(VideoFrame *packet, int packetSize, bool &fecFailure)
 {
-    if (m_enableFEC) {
-        m_queue.addVideoPacket(packet, packetSize, fecFailure);
+    recordFrameHeader(*packet);
+
+    if (!m_enableFEC) {
+        return processFrame(reinterpret_cast<const std::byte *>(packet) + sizeof(VideoFrame),
+                            packetSize - sizeof(VideoFrame), packet->trackingFrameIndex,
+                            packet->streamIndex);
+    }
+
+    m_queue.addVideoPacket(packet, packetSize, fecFailure);
+    return processQueue();
+}
+
+std::byte *NALParser::reservePacket(const VideoFrame &header, bool &fecFailure, size_t &capacity)
+{
+    if (!m_enableFEC) {
+        // Without FEC the whole frame comes in one packet
+        m_packetBuffer.resize(header.frameByteSize);
+        capacity = m_packetBuffer.size();
+        return m_packetBuffer.data();
+    }
+    capacity = m_queue.packetSize();
+    return m_queue.reserveVideoPacket(header, fecFailure);
+}
+
+bool NALParser::commitPacket(const VideoFrame &header, int payloadSize)
+{
+    recordFrameHeader(header);
+
+    if (!m_enableFEC) {
+        return processFrame(m_packetBuffer.data(), payloadSize, header.trackingFrameIndex,
+                            header.streamIndex);
     }
 
-    bool result = m_queue.reconstruct() || !m_enableFEC;
-    if (result)
+    m_queue.commitVideoPacket(header, payloadSize);
+    return processQueue();
+}
+
+bool NALParser::processQueue()
+{
+    // A late packet can complete the oldest frame, releasing the newer ones which waited for it.
+    bool result = false;
+    while (m_queue.reconstruct())
     {
-        const std::byte *frameBuffer;
-        int frameByteSize;
-        if (m_enableFEC) {
-            // Reconstructed
-            frameBuffer = m_queue.getFrameBuffer();
-            frameByteSize = m_queue.getFrameByteSize();
-        } else {
-            frameBuffer = reinterpret_cast<const std::byte *>(packet) + sizeof(VideoFrame);
-            frameByteSize = packetSize - sizeof(VideoFrame);
+        if (m_streamedFrame == m_queue.getVideoFrameIndex() && m_streamedBytes > 0) {
+            // The start of the frame is already in the decoder.
+            if (auto decoder = VideoDecoder::get(m_streamedStreamIndex)) {
+                decoder->pushPartial(&m_queue.getFrameBuffer()[m_streamedBytes],
+                                     m_queue.getFrameByteSize() - m_streamedBytes,
+                                     m_queue.getTrackingFrameIndex(), true);
+            }
+            m_streamedBytes = 0;
+            result = true;
+        } else if (processFrame(m_queue.getFrameBuffer(), m_queue.getFrameByteSize(),
+                                m_queue.getTrackingFrameIndex(), m_queue.getStreamIndex())) {
+            result = true;
         }
+        m_queue.popFrame();
+    }
 
-        std::byte NALType;
-        if (m_codec == ALVR_CODEC_H264)
-            NALType = frameBuffer[4] & std::byte(0x1F);
-        else
-            NALType = (frameBuffer[4] >> 1) & std::byte(0x3F);
+    // Partial frames are split at start codes, AV1 temporal units are pushed whole.
+    if (m_earlyDecode && m_codec != ALVR_CODEC_AV1) {
+        streamFrame();
+    }
+    return result;
+}
 
-        if ((m_codec == ALVR_CODEC_H264 && NALType == NAL_TYPE_SPS) ||
-            (m_codec == ALVR_CODEC_H265 && NALType == H265_NAL_TYPE_VPS))
-        {
-            // This frame contains (VPS + )SPS + PPS + IDR on NVENC H.264 (H.265) stream.
-            // (VPS + )SPS + PPS has short size (8bytes + 28bytes in some environment), so we can assume SPS + PPS is contained in first fragment.
+void NALParser::streamFrame()
+{
+    const uint64_t videoFrameIndex = m_queue.getVideoFrameIndex();
+    if (m_streamedFrame != videoFrameIndex) {
+        if (m_streamedBytes > 0) {
+            // The rest of the frame was lost, end it so the decoder does not wait for it.
+            if (auto decoder = VideoDecoder::get(m_streamedStreamIndex)) {
+                decoder->pushPartial(nullptr, 0, m_streamedTrackingFrameIndex, true);
+            }
+        }
+        m_streamedFrame = videoFrameIndex;
+        m_streamedSlice = 0;
+        m_sliceOffset = 0;
+        m_streamedBytes = 0;
+        m_scannedBytes = 0;
+    }
 
-            int end = findVPSSPS(frameBuffer, frameByteSize);
-            if (end == -1)
-            {
-                // Invalid frame.
-                LOG("Got invalid frame. Too large SPS or PPS?");
-                return false;
+    // Only the native decoder takes partial frames. The FEC recovery is still needed if a packet
+    // is missing, but only the data received in order is queued, so it is never wrong. Each slice
+    // is a FEC block of its own, so the recovered ones go whole and the next one as it arrives.
+    if (m_streamedBytes == 0 && m_queue.getContiguousByteSize(0) < 5) {
+        return;
+    }
+    // The header is known once a packet of the frame arrived
+    m_streamedStreamIndex = m_queue.getStreamIndex();
+    auto decoder = VideoDecoder::get(m_streamedStreamIndex);
+    if (!decoder) {
+        return;
+    }
+    if (m_streamedBytes == 0 && isConfigFrame(m_queue.getSliceBuffer(0))) {
+        // Config NALs are split from the IDR by processFrame() once the frame is complete.
+        return;
+    }
+    m_streamedTrackingFrameIndex = m_queue.getTrackingFrameIndex();
+
+    // Offsets in the frame are those of the slices put one after the other
+    while (true) {
+        const int sliceBytes = m_queue.getSliceByteSize(m_streamedSlice);
+        if (sliceBytes == 0) {
+            return;
+        }
+        const std::byte *sliceBuffer = m_queue.getSliceBuffer(m_streamedSlice);
+        const int streamed = m_streamedBytes - m_sliceOffset;
+        // The last slice ends the frame, which processQueue() does once it is complete.
+        const bool lastSlice = m_streamedSlice + 1 == m_queue.getSliceCount();
+        if (m_queue.isSliceComplete(m_streamedSlice) && !lastSlice) {
+            if (sliceBytes > streamed) {
+                decoder->pushPartial(&sliceBuffer[streamed], sliceBytes - streamed,
+                                     m_streamedTrackingFrameIndex, false);
+            }
+            m_sliceOffset += sliceBytes;
+            m_streamedBytes = m_sliceOffset;
+            m_scannedBytes = m_sliceOffset;
+            m_streamedSlice++;
+            continue;
+        }
+
+        // A NAL unit is complete once the start code of the next one arrived.
+        const int contiguousBytes = m_queue.getContiguousByteSize(m_streamedSlice);
+        int end = streamed;
+        int i = std::max(m_scannedBytes - m_sliceOffset, streamed + 1);
+        for (; i + 2 < contiguousBytes; i++) {
+            if (sliceBuffer[i] == std::byte(0) && sliceBuffer[i + 1] == std::byte(0) &&
+                sliceBuffer[i + 2] == std::byte(1)) {
+                end = sliceBuffer[i - 1] == std::byte(0) ? i - 1 : i;
             }
-            LOGI("Got frame=%d %d, Codec=%d", (std::int32_t) NALType, end, m_codec);
-            push(&frameBuffer[0], end, packet->trackingFrameIndex);
-            push(&frameBuffer[end], frameByteSize - end, packet->trackingFrameIndex);
+        }
+        m_scannedBytes = m_sliceOffset + i;
 
+        if (end > streamed) {
+            decoder->pushPartial(&sliceBuffer[streamed], end - streamed,
+                                 m_streamedTrackingFrameIndex, false);
+            m_streamedBytes = m_sliceOffset + end;
+        }
+        return;
+    }
+}
+
+bool NALParser::isConfigFrame(const std::byte *frameBuffer) const
+{
+    if (m_codec == ALVR_CODEC_H264) {
+        return (frameBuffer[4] & std::byte(0x1F)) == NAL_TYPE_SPS;
+    }
+    return ((frameBuffer[4] >> 1) & std::byte(0x3F)) == H265_NAL_TYPE_VPS;
+}
+
+bool NALParser::processFrame(const std::byte *frameBuffer, int frameByteSize, uint64_t trackingFrameIndex,
+                             uint8_t streamIndex)
+{
+    if (m_codec == ALVR_CODEC_AV1) {
+        // The sequence header stays in the temporal unit, the decoder reads it in band.
+        push(&frameBuffer[0], frameByteSize, trackingFrameIndex, streamIndex);
+        if (VideoDecoder::isAv1KeyFrame(frameBuffer, frameByteSize)) {
             m_queue.clearFecFailure();
-        } else
-        {
-            push(&frameBuffer[0], frameByteSize, packet->trackingFrameIndex);
         }
         return true;
     }
-    return false;
+
+    std::byte NALType;
+    if (m_codec == ALVR_CODEC_H264)
+        NALType = frameBuffer[4] & std::byte(0x1F);
+    else
+        NALType = (frameBuffer[4] >> 1) & std::byte(0x3F);
+
+    if ((m_codec == ALVR_CODEC_H264 && NALType == NAL_TYPE_SPS) ||
+        (m_codec == ALVR_CODEC_H265 && NALType == H265_NAL_TYPE_VPS))
+    {
+        // This frame contains (VPS + )SPS + PPS + IDR on NVENC H.264 (H.265) stream.
+        // (VPS + )SPS + PPS has short size (8bytes + 28bytes in some environment), so we can assume SPS + PPS is contained in first fragment.
+
+        int end = findVPSSPS(frameBuffer, frameByteSize);
+        if (end == -1)
+        {
+            // Invalid frame.
+            LOG("Got invalid frame. Too large SPS or PPS?");
+            return false;
+        }
+        LOGI("Got frame=%d %d, Codec=%d", (std::int32_t) NALType, end, m_codec);
+        push(&frameBuffer[0], end, trackingFrameIndex, streamIndex);
+        push(&frameBuffer[end], frameByteSize - end, trackingFrameIndex, streamIndex);
+
+        m_queue.clearFecFailure();
+    } else
+    {
+        push(&frameBuffer[0], frameByteSize, trackingFrameIndex, streamIndex);
+    }
+    return true;
 }
 
-void NALParser::push(const std::byte *buffer, int length, uint64_t frameIndex)
+void NALParser::push(const std::byte *buffer, int length, uint64_t frameIndex, uint8_t streamIndex)
 {
+    // The native decoder copies the frame straight into a codec input buffer.
+    if (auto decoder = VideoDecoder::get(streamIndex)) {
+        decoder->push(buffer, length, frameIndex);
+        return;
+    }
+    if (streamIndex != 0) {
+        return;
+    }
+
     jobject nal;
     jbyteArray buf;
 
@@ -128,6 +335,16 @@ bool NALParser::fecFailure()
     return m_queue.fecFailure();
 }
 
+uint64_t NALParser::lostFrameIndex() const
+{
+    return m_queue.getLostFrameIndex();
+}
+
+uint64_t NALParser::takeFecRecoveryTime()
+{
+    return m_queue.takeRecoveryTime();
+}
+
 int NALParser::findVPSSPS(const std::byte *frameBuffer, int frameByteSize)
 {
     int zeroes = 0;
@@ -2,6 +2,7 @@
 #define ALVRCLIENT_NAL_H
 
 #include <jni.h>
+#include <atomic>
 #include <list>
 #include "utils.h"
 #include "fec.h"
@@ -9,20 +10,60 @@
 
 class NALParser {
 public:
-    NALParser(JNIEnv *env, jobject udpManager, jclass nalClass, bool enableFEC);
+    NALParser(JNIEnv *env, jobject udpManager, jclass nalClass, bool enableFEC, bool earlyDecode,
+              size_t packetSize);
     ~NALParser();
 
     void setCodec(int codec);
     bool processPacket(VideoFrame *packet, int packetSize, bool &fecFailure);
+    // processPacket() for packets received in place. The payload is written to the capacity
+    // bytes returned by reservePacket(), then commitPacket() processes it. The packet is dropped
+    // if reservePacket() returns null.
+    std::byte *reservePacket(const VideoFrame &header, bool &fecFailure, size_t &capacity);
+    bool commitPacket(const VideoFrame &header, int payloadSize);
 
     bool fecFailure();
+    // First video frame lost by the last FEC failure
+    uint64_t lostFrameIndex() const;
+    // Time spent recovering shards since the last call, in microsec
+    uint64_t takeFecRecoveryTime();
+
+    // Dynamic resolution scale of a recently received frame, in (0, 1]. Called from the render
+    // thread, 1 for frames no longer in the history.
+    static float contentScale(uint64_t trackingFrameIndex);
+    // Center shifts the server compressed a recently received frame around, left eye then right
+    // eye. False for the frames compressed around the center of the settings.
+    static bool foveationCenter(uint64_t trackingFrameIndex, float center[4]);
 private:
-    void push(const std::byte *buffer, int length, uint64_t frameIndex);
+    // The dynamic resolution scale and foveation center of the frame
+    static void recordFrameHeader(const VideoFrame &header);
+
+    bool processFrame(const std::byte *frameBuffer, int frameByteSize, uint64_t trackingFrameIndex,
+                      uint8_t streamIndex);
+    // Pushes the frames completed by the last packet to the decoder
+    bool processQueue();
+    void streamFrame();
+    bool isConfigFrame(const std::byte *frameBuffer) const;
+    // streamIndex selects the decoder in dual stream mode, the Java decoder only takes stream 0.
+    void push(const std::byte *buffer, int length, uint64_t frameIndex, uint8_t streamIndex);
     int findVPSSPS(const std::byte *frameBuffer, int frameByteSize);
 
     bool m_enableFEC;
+    // Queue the complete NAL units of the oldest frame while its tail is still being received.
+    bool m_earlyDecode;
+    uint64_t m_streamedFrame = UINT64_MAX;
+    uint64_t m_streamedTrackingFrameIndex = 0;
+    uint8_t m_streamedStreamIndex = 0;
+    // Slice of m_streamedFrame being streamed and its offset in the frame
+    size_t m_streamedSlice = 0;
+    int m_sliceOffset = 0;
+    // Bytes of m_streamedFrame already in the decoder, and searched for start codes
+    int m_streamedBytes = 0;
+    int m_scannedBytes = 0;
 
     FECQueue m_queue;
+    // Payload of the packet received in place when FEC is disabled
+    std::vector<std::byte> m_packetBuffer;
 
     int m_codec = 1;
 
@@ -35,5 +76,17 @@ private:
 
     jmethodID mObtainNALMethodID;
     jmethodID mPushNALMethodID;
+
+    // Written by the network thread, searched by the render thread. The index of a slot is cleared
+    // while it is rewritten, so a scale never goes to another frame.
+    struct ContentScaleSlot {
+        std::atomic<uint64_t> trackingFrameIndex { 0 };
+        std::atomic<uint8_t> contentScale { 100 };
+        // VideoFrame::foveationCenter, byte i is element i
+        std::atomic<uint32_t> foveationCenter { 0x80 };
+    };
+    static const int CONTENT_SCALE_HISTORY = 32;
+    static ContentScaleSlot s_contentScales[CONTENT_SCALE_HISTORY];
+    static std::atomic<int> s_nextContentScale;
 };
 #endif //ALVRCLIENT_NAL_H
@@ -7,8 +7,10 @@
 #include <VrApi_Helpers.h>
 #include <VrApi_SystemUtils.h>
 #include <VrApi_Input.h>
+#include <algorithm>
 #include <memory>
 #include <chrono>
+#include <cmath>
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
 #include <android/input.h>
@@ -18,16 +20,22 @@
 #include <GLES3/gl3.h>
 #include <GLES2/gl2ext.h>
 #include <string>
-#include <map>
+#include <atomic>
 #include <vector>
 #include "utils.h"
 #include "render.h"
 #include "latency_collector.h"
+#include "haptics.h"
+#include "clock_governor.h"
+#include "input_devices.h"
+#include "nal.h"
+#include "frame_events.h"
+#include "decoder.h"
 #include "packet_types.h"
 #include "asset.h"
+#include "program_cache.h"
 #include <inttypes.h>
 #include <glm/gtx/euler_angles.hpp>
-#include <mutex>
 
 using namespace std;
 using namespace gl_render_utils;
@@ -35,6 +43,8 @@ using namespace gl_render_utils;
 void (*inputSend)(TrackingInfo data);
 void (*timeSyncSend)(TimeSync data);
 void (*videoErrorReportSend)();
+void (*videoFrameLossSend)(unsigned long long lastGoodFrameIndex);
+void (*setWaitingNextIDR)(bool waiting);
 void (*viewsConfigSend)(EyeFov fov[2], float ipd_m);
 void (*batterySend)(unsigned long long device_path, float gauge_value, bool is_plugged);
 unsigned long long (*pathStringToHash)(const char *path);
@@ -47,8 +57,85 @@ uint64_t RIGHT_CONTROLLER_HAPTICS_PATH;
 
 const chrono::duration<float> MENU_BUTTON_LONG_PRESS_DURATION = 5s;
 const uint32_t ovrButton_Unknown1 = 0x01000000;
+// The value should match with the server's PoseHistory::HISTORY_CAPACITY
 const int MAXIMUM_TRACKING_FRAMES = 360;
 
+// Fixed-capacity history of the predicted tracking sent to the server, keyed by target timestamp.
+// push() must only be called from the tracking thread. find() is called from the render thread
+// and never blocks the writer: slots are read seqlock-style, like PoseHistory on the server.
+class TrackingHistory {
+public:
+    void push(uint64_t targetTimestampNs, const ovrTracking2 &tracking) {
+        uint64_t index = m_count.load(std::memory_order_relaxed);
+        Slot &slot = m_slots[index % MAXIMUM_TRACKING_FRAMES];
+        uint64_t sequence = 2 * (index + 1);
+
+        // Mark the slot as being written before touching the tracking.
+        slot.sequence.store(sequence - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.targetTimestampNs = targetTimestampNs;
+        slot.tracking = tracking;
+
+        slot.sequence.store(sequence, std::memory_order_release);
+        m_count.store(index + 1, std::memory_order_release);
+    }
+
+    // Find the tracking sent for targetTimestampNs. If it is not in the history, fall back to the
+    // oldest one stored. Return false if the history is empty.
+    bool find(uint64_t targetTimestampNs, ovrTracking2 &tracking) const {
+        uint64_t count = m_count.load(std::memory_order_acquire);
+        uint64_t oldest = count > MAXIMUM_TRACKING_FRAMES ? count - MAXIMUM_TRACKING_FRAMES : 0;
+
+        // The frame being rendered is usually among the latest poses, search from the newest.
+        for (uint64_t index = count; index-- > oldest;) {
+            uint64_t timestampNs = 0;
+            if (!read(index, [&](const Slot &slot) { timestampNs = slot.targetTimestampNs; }) ||
+                timestampNs != targetTimestampNs) {
+                continue;
+            }
+            if (read(index, [&](const Slot &slot) { tracking = slot.tracking; })) {
+                return true;
+            }
+        }
+
+        // The oldest slot can be overwritten while reading it, move on to the next one then.
+        for (uint64_t index = oldest; index < count; index++) {
+            if (read(index, [&](const Slot &slot) { tracking = slot.tracking; })) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Slot {
+        // 2 * (pose index + 1) once the tracking is stored, odd while it is being written.
+        std::atomic<uint64_t> sequence{0};
+        uint64_t targetTimestampNs = 0;
+        ovrTracking2 tracking{};
+    };
+
+    // Run read() on the stored copy of pose number index and return whether the copy was stable.
+    template<typename F>
+    bool read(uint64_t index, F &&read) const {
+        const Slot &slot = m_slots[index % MAXIMUM_TRACKING_FRAMES];
+        uint64_t sequence = 2 * (index + 1);
+
+        if (slot.sequence.load(std::memory_order_acquire) != sequence) {
+            // Being written or already replaced by a newer pose
+            return false;
+        }
+        read(slot);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    Slot m_slots[MAXIMUM_TRACKING_FRAMES];
+    // Number of poses written so far. Pose number i lives in slot i % MAXIMUM_TRACKING_FRAMES.
+    std::atomic<uint64_t> m_count{0};
+};
+
 class OvrContext {
 public:
     ANativeWindow *window = nullptr;
@@ -57,6 +144,8 @@ public:
     JNIEnv *env{};
 
     unique_ptr<Texture> streamTexture;
+    // Right eye decoder output in dual stream mode
+    unique_ptr<Texture> secondStreamTexture;
     GLuint loadingTexture = 0;
     int suspend = 0;
     std::function<void()> openDashboard;
@@ -65,15 +154,22 @@ public:
 
     vector<float> refreshRatesBuffer;
 
-    uint64_t ovrFrameIndex = 0;
+    // Read by the tracking thread for the haptics
+    std::atomic<uint64_t> ovrFrameIndex{0};
 
     int m_LastHMDRecenterCount = -1;
 
-    std::map<uint64_t, ovrTracking2> trackingFrameMap;
-    std::mutex trackingFrameMutex;
+    TrackingHistory trackingHistory;
 
     bool darkMode;
     ovrRenderer Renderer;
+    // Eye resolution of the display, the stream is upscaled to it
+    int displayEyeWidth = 0;
+    int displayEyeHeight = 0;
+
+    // Last frame of the lobby, submitted again while the scene is unchanged
+    ovrLayerProjection2 loadingLayer;
+    bool loadingLayerValid = false;
 
     uint8_t lastLeftControllerBattery = 0;
     uint8_t lastRightControllerBattery = 0;
@@ -85,17 +181,9 @@ public:
     ovrTracking lastTrackingRot[2];
     ovrTracking lastTrackingPos[2];
 
-    struct HapticsState {
-        uint64_t startUs;
-        uint64_t endUs;
-        float amplitude;
-        float frequency;
-        bool fresh;
-        bool buffered;
-    };
-    // mHapticsState[0]: right hand state
-    // mHapticsState[1]: left hand state
-    HapticsState mHapticsState[2]{};
+    HapticsScheduler haptics;
+    ClockGovernor clockGovernor;
+    InputDeviceRegistry inputDevices;
 
 
     std::chrono::system_clock::time_point mMenuNotPressedLastInstant;
@@ -104,6 +192,34 @@ public:
 
 namespace {
     OvrContext g_ctx;
+
+    // Head motion after which the cached lobby frame is rendered again
+    const float LOADING_ROTATION_THRESHOLD_DEG = 5.0f;
+    const float LOADING_POSITION_THRESHOLD_M = 0.01f;
+
+    // Angle between two orientations, in degrees
+    float rotationDegrees(const ovrQuatf &q0, const ovrQuatf &q1) {
+        float dot = fabsf(q0.x * q1.x + q0.y * q1.y + q0.z * q1.z + q0.w * q1.w);
+        return 2.0f * acosf(fminf(dot, 1.0f)) * 180.0f / (float)M_PI;
+    }
+
+    float distanceMeters(const ovrVector3f &p0, const ovrVector3f &p1) {
+        float dx = p1.x - p0.x, dy = p1.y - p0.y, dz = p1.z - p0.z;
+        return sqrtf(dx * dx + dy * dy + dz * dz);
+    }
+
+    bool headMoved(const ovrPosef &from, const ovrPosef &to) {
+        return rotationDegrees(from.Orientation, to.Orientation) > LOADING_ROTATION_THRESHOLD_DEG ||
+               distanceMeters(from.Position, to.Position) > LOADING_POSITION_THRESHOLD_M;
+    }
+
+    // Fixed foveation of the eye buffer swapchains, 0 (off) to 3 (high)
+    void setFoveationLevel(int level) {
+        if (vrapi_GetSystemPropertyInt(&g_ctx.java, VRAPI_SYS_PROP_FOVEATION_AVAILABLE) ==
+            VRAPI_TRUE) {
+            vrapi_SetPropertyInt(&g_ctx.java, VRAPI_FOVEATION_LEVEL, level);
+        }
+    }
 }
 
 OnCreateResult onCreate(void *v_env, void *v_activity, void *v_assetManager) {
@@ -126,6 +242,38 @@ OnCreateResult onCreate(void *v_env, void *v_activity, void *v_assetManager) {
     env->GetJavaVM(&g_ctx.java.Vm);
     g_ctx.java.ActivityObject = env->NewGlobalRef(activity);
 
+    // Binaries of the GL programs, see ProgramCache
+    jclass activityClass = env->GetObjectClass(activity);
+    auto jGetCacheDir = env->GetMethodID(activityClass, "getCacheDir", "()Ljava/io/File;");
+    jobject cacheDir = env->CallObjectMethod(activity, jGetCacheDir);
+    if (cacheDir != nullptr) {
+        jclass fileClass = env->GetObjectClass(cacheDir);
+        auto jGetAbsolutePath = env->GetMethodID(fileClass, "getAbsolutePath", "()Ljava/lang/String;");
+        auto path = (jstring) env->CallObjectMethod(cacheDir, jGetAbsolutePath);
+        const char *pathChars = env->GetStringUTFChars(path, nullptr);
+        ProgramCache::setDirectory(pathChars);
+        env->ReleaseStringUTFChars(path, pathChars);
+        env->DeleteLocalRef(path);
+        env->DeleteLocalRef(fileClass);
+        env->DeleteLocalRef(cacheDir);
+    }
+    // The frame event trace, where adb can pull it without root
+    auto jGetExternalFilesDir = env->GetMethodID(activityClass, "getExternalFilesDir",
+                                                 "(Ljava/lang/String;)Ljava/io/File;");
+    jobject filesDir = env->CallObjectMethod(activity, jGetExternalFilesDir, nullptr);
+    if (filesDir != nullptr) {
+        jclass fileClass = env->GetObjectClass(filesDir);
+        auto jGetAbsolutePath = env->GetMethodID(fileClass, "getAbsolutePath", "()Ljava/lang/String;");
+        auto path = (jstring) env->CallObjectMethod(filesDir, jGetAbsolutePath);
+        const char *pathChars = env->GetStringUTFChars(path, nullptr);
+        FrameEvents::setDirectory(pathChars);
+        env->ReleaseStringUTFChars(path, pathChars);
+        env->DeleteLocalRef(path);
+        env->DeleteLocalRef(fileClass);
+        env->DeleteLocalRef(filesDir);
+    }
+    env->DeleteLocalRef(activityClass);
+
     jclass clazz = env->FindClass("com/polygraphene/alvr/OvrActivity");
     auto jDashboardCallback = env->GetMethodID(clazz, "openDashboard",
                                                "()V");
@@ -152,10 +300,13 @@ OnCreateResult onCreate(void *v_env, void *v_activity, void *v_assetManager) {
     }
 
     //
-    // Generate texture for SurfaceTexture which is output of MediaCodec.
+    // Generate texture for SurfaceTexture which is output of MediaCodec, or for the image reader.
     //
 
     g_ctx.streamTexture = make_unique<Texture>(true);
+    g_ctx.secondStreamTexture = make_unique<Texture>(true);
+    VideoDecoder::setStreamTexture(0, g_ctx.streamTexture->GetGLTexture());
+    VideoDecoder::setStreamTexture(1, g_ctx.secondStreamTexture->GetGLTexture());
 
     glGenTextures(1, &g_ctx.loadingTexture);
 
@@ -171,15 +322,14 @@ OnCreateResult onCreate(void *v_env, void *v_activity, void *v_assetManager) {
                     GL_CLAMP_TO_EDGE);
 
 
-    memset(g_ctx.mHapticsState, 0, sizeof(g_ctx.mHapticsState));
-
     //ovrPlatformInitializeResult res = ovr_PlatformInitializeAndroid("", activity, env);
     //LOGI("ovrPlatformInitializeResult %s", ovrPlatformInitializeResult_ToString(res));
     //ovrRequest req;
     //req = ovr_User_GetLoggedInUser();
     //LOGI("Logged in user is %" PRIu64 "\n", req);
 
-    return {(int) g_ctx.streamTexture.get()->GetGLTexture(), (int) g_ctx.loadingTexture};
+    return {(int) g_ctx.streamTexture.get()->GetGLTexture(),
+            (int) g_ctx.secondStreamTexture.get()->GetGLTexture(), (int) g_ctx.loadingTexture};
 }
 
 void destroyNative(void *v_env) {
@@ -189,6 +339,9 @@ void destroyNative(void *v_env) {
 
     glDeleteTextures(1, &g_ctx.loadingTexture);
 
+    delete g_ctx.Renderer.loadingScene;
+    g_ctx.Renderer.loadingScene = nullptr;
+
     eglDestroy();
 
     vrapi_Shutdown();
@@ -196,122 +349,22 @@ void destroyNative(void *v_env) {
     env->DeleteGlobalRef(g_ctx.java.ActivityObject);
 }
 
-uint64_t mapButtons(ovrInputTrackedRemoteCapabilities *remoteCapabilities,
-                    ovrInputStateTrackedRemote *remoteInputState) {
-    uint64_t buttons = 0;
-    if (remoteCapabilities->ControllerCapabilities & ovrControllerCaps_ModelOculusTouch) {
-        // Oculus Quest Touch Cotroller
-        if (remoteInputState->Buttons & ovrButton_A) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_A_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_B) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_B_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_RThumb) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_X) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_X_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_Y) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_Y_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_LThumb) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_Enter) {
-            // Menu button on left hand
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_SYSTEM_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_GripTrigger) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_GRIP_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_Trigger) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_Joystick) {
-            if (remoteCapabilities->ControllerCapabilities & ovrControllerCaps_LeftHand) {
-                buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_LEFT_CLICK);
-            } else {
-                buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_RIGHT_CLICK);
-            }
-        }
-        if (remoteInputState->Buttons & ovrButton_Unknown1) {
-            // Only on right controller. What's button???
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_BACK_CLICK);
-        }
-        if (remoteInputState->Touches & ovrTouch_A) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_A_TOUCH);
-        }
-        if (remoteInputState->Touches & ovrTouch_B) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_B_TOUCH);
-        }
-        if (remoteInputState->Touches & ovrTouch_X) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_X_TOUCH);
-        }
-        if (remoteInputState->Touches & ovrTouch_Y) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_Y_TOUCH);
-        }
-        if (remoteInputState->Touches & ovrTouch_IndexTrigger) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH);
-        }
-        if (remoteInputState->Touches & ovrTouch_Joystick) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_TOUCH);
-        }
-        if (remoteInputState->Touches & ovrTouch_ThumbRest) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_THUMB_REST_TOUCH);
-        }
-    } else {
-        // GearVR or Oculus Go Controller
-        if (remoteInputState->Buttons & ovrButton_A) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH);
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_Enter) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_A_CLICK);
-        }
-        if (remoteInputState->Buttons & ovrButton_Back) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_B_TOUCH);
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_B_CLICK);
-        }
-        if (remoteInputState->TrackpadStatus) {
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRACKPAD_TOUCH);
-            buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_A_TOUCH);
-        }
-    }
-    return buttons;
-}
-
-
 void setControllerInfo(TrackingInfo *packet, double displayTime) {
-    ovrInputCapabilityHeader curCaps;
     ovrResult result;
-    int controller = 0;
-
-    for (uint32_t deviceIndex = 0;
-         vrapi_EnumerateInputDevices(g_ctx.Ovr, deviceIndex, &curCaps) >= 0; deviceIndex++) {
-        LOG("Device %d: Type=%d ID=%d", deviceIndex, curCaps.Type, curCaps.DeviceID);
-        if (curCaps.Type == ovrControllerType_Hand) {  //A3
-            ovrInputHandCapabilities handCapabilities;
-            ovrInputStateHand inputStateHand;
-            handCapabilities.Header = curCaps;
 
-            result = vrapi_GetInputDeviceCapabilities(g_ctx.Ovr, &handCapabilities.Header);
-
-            if (result != ovrSuccess) {
-                continue;
-            }
+    g_ctx.inputDevices.update(g_ctx.Ovr);
 
-            if ((handCapabilities.HandCapabilities & ovrHandCaps_LeftHand) != 0) {
-                controller = 0;
-            } else {
-                controller = 1;
-            }
+    for (auto &device : g_ctx.inputDevices.devices()) {
+        int controller = device.controller;
+        if (device.isHand) {  //A3
+            auto &handCapabilities = device.handCapabilities;
+            ovrInputStateHand inputStateHand;
             inputStateHand.Header.ControllerType = handCapabilities.Header.Type;
 
             result = vrapi_GetCurrentInputState(g_ctx.Ovr, handCapabilities.Header.DeviceID,
                                                 &inputStateHand.Header);
             if (result != ovrSuccess) {
+                g_ctx.inputDevices.invalidate();
                 continue;
             }
 
@@ -375,39 +428,22 @@ void setControllerInfo(TrackingInfo *packet, double displayTime) {
                     }
                 }
             }
-        }
-        if (curCaps.Type == ovrControllerType_TrackedRemote) {
-            ovrInputTrackedRemoteCapabilities remoteCapabilities;
+        } else {
+            auto &remoteCapabilities = device.remoteCapabilities;
             ovrInputStateTrackedRemote remoteInputState;
 
-            remoteCapabilities.Header = curCaps;
-            result = vrapi_GetInputDeviceCapabilities(g_ctx.Ovr, &remoteCapabilities.Header);
-            if (result != ovrSuccess) {
-                continue;
-            }
             remoteInputState.Header.ControllerType = remoteCapabilities.Header.Type;
 
             result = vrapi_GetCurrentInputState(g_ctx.Ovr, remoteCapabilities.Header.DeviceID,
                                                 &remoteInputState.Header);
             if (result != ovrSuccess) {
+                g_ctx.inputDevices.invalidate();
                 continue;
             }
 
-            LOG("ID=%d Cap Controller=%08X Button=%08X Touch=%08X",
-                curCaps.DeviceID,
-                remoteCapabilities.ControllerCapabilities,
-                remoteCapabilities.ButtonCapabilities,
-                remoteCapabilities.TouchCapabilities);
-            LOG("ID=%d Sta Button=%08X Touch=%08X Joystick=(%f,%f) IndexValue=%f GripValue=%f",
-                curCaps.DeviceID,
-                remoteInputState.Buttons, remoteInputState.Touches,
-                remoteInputState.JoystickNoDeadZone.x, remoteInputState.JoystickNoDeadZone.y,
-                remoteInputState.IndexTrigger, remoteInputState.GripTrigger);
-
             uint64_t hand_path;
-            if ((remoteCapabilities.ControllerCapabilities & ovrControllerCaps_LeftHand) != 0) {
+            if (device.leftHand) {
                 hand_path = LEFT_HAND_PATH;
-                controller = 0;
 
                 if (remoteInputState.Buttons & ovrButton_Enter) {
                     if (!g_ctx.mMenuLongPressActivated && std::chrono::system_clock::now()
@@ -422,14 +458,13 @@ void setControllerInfo(TrackingInfo *packet, double displayTime) {
                 }
             } else {
                 hand_path = RIGHT_HAND_PATH;
-                controller = 1;
             }
 
             auto &c = packet->controller[controller];
 
             c.enabled = true;
 
-            c.buttons = mapButtons(&remoteCapabilities, &remoteInputState);
+            c.buttons = InputDeviceRegistry::mapButtons(device, remoteInputState);
 
             if ((remoteCapabilities.ControllerCapabilities & ovrControllerCaps_HasJoystick) !=
                 0) {
@@ -496,16 +531,15 @@ void setControllerInfo(TrackingInfo *packet, double displayTime) {
     }
 }
 
-float getIPD() {
-    ovrTracking2 tracking = vrapi_GetPredictedTracking2(g_ctx.Ovr, 0.0);
+// The eye parameters do not depend on the prediction time, they are taken from the tracking of the
+// sample instead of querying it again
+float getIPD(const ovrTracking2 &tracking) {
     float ipd = vrapi_GetInterpupillaryDistance(&tracking);
     return ipd;
 }
 
 // return fov in OpenXR convention
-std::pair<EyeFov, EyeFov> getFov() {
-    ovrTracking2 tracking = vrapi_GetPredictedTracking2(g_ctx.Ovr, 0.0);
-
+std::pair<EyeFov, EyeFov> getFov(const ovrTracking2 &tracking) {
     EyeFov fov[2];
 
     for (int eye = 0; eye < 2; eye++) {
@@ -533,22 +567,13 @@ std::pair<EyeFov, EyeFov> getFov() {
     return {fov[0], fov[1]};
 }
 
-// Called from TrackingThread
+// Called from the tracking thread of the connection, several times per display frame
 void sendTrackingInfo(bool clientsidePrediction) {
     // vrapi_GetTimeInSeconds doesn't match getTimestampUs
     uint64_t targetTimestampNs = vrapi_GetTimeInSeconds() * 1e9 + LatencyCollector::Instance().getTrackingPredictionLatency() * 1000;
     auto tracking = vrapi_GetPredictedTracking2(g_ctx.Ovr, (double)targetTimestampNs / 1e9);
 
-    // sort of hacky, SteamVR will predict the position while the orientation is predicted from the client
-    ovrTracking2 trackingRaw = vrapi_GetPredictedTracking2(g_ctx.Ovr, 0.);
-
-    {
-        std::lock_guard<std::mutex> lock(g_ctx.trackingFrameMutex);
-        g_ctx.trackingFrameMap.insert({ targetTimestampNs, tracking });
-        if (g_ctx.trackingFrameMap.size() > MAXIMUM_TRACKING_FRAMES) {
-            g_ctx.trackingFrameMap.erase(g_ctx.trackingFrameMap.cbegin());
-        }
-    }
+    g_ctx.trackingHistory.push(targetTimestampNs, tracking);
 
     TrackingInfo info = {};
     info.targetTimestampNs = targetTimestampNs;
@@ -566,8 +591,8 @@ void sendTrackingInfo(bool clientsidePrediction) {
 
     inputSend(info);
 
-    float new_ipd = getIPD();
-    auto new_fov = getFov();
+    float new_ipd = getIPD(tracking);
+    auto new_fov = getFov(tracking);
     if (abs(new_ipd - g_ctx.lastIpd) > 0.001 || abs(new_fov.first.left - g_ctx.lastFov.left) > 0.001) {
         EyeFov fov[2] = { new_fov.first, new_fov.second };
         viewsConfigSend(fov, new_ipd);
@@ -612,13 +637,17 @@ OnResumeResult onResumeNative(void *v_surface, bool darkMode) {
     auto eyeWidth = vrapi_GetSystemPropertyInt(&g_ctx.java, VRAPI_SYS_PROP_DISPLAY_PIXELS_WIDE) / 2;
     auto eyeHeight = vrapi_GetSystemPropertyInt(&g_ctx.java,
                                                 VRAPI_SYS_PROP_DISPLAY_PIXELS_HIGH);
+    g_ctx.displayEyeWidth = eyeWidth;
+    g_ctx.displayEyeHeight = eyeHeight;
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wmissing-field-initializers"
-    ovrRenderer_Create(&g_ctx.Renderer, eyeWidth, eyeHeight, g_ctx.streamTexture.get(),
+    ovrRenderer_Create(&g_ctx.Renderer, eyeWidth, eyeHeight, g_ctx.streamTexture.get(), nullptr,
                        g_ctx.loadingTexture, {false});
 #pragma clang diagnostic pop
 
     ovrRenderer_CreateScene(&g_ctx.Renderer, darkMode);
+    g_ctx.loadingLayerValid = false;
+    setFoveationLevel(0);
 
     g_ctx.darkMode = darkMode;
 
@@ -650,18 +679,43 @@ OnResumeResult onResumeNative(void *v_surface, bool darkMode) {
 
 void setStreamConfig(StreamConfig config) {
     g_ctx.streamConfig = config;
+    // Before the decoders are created on connection
+    VideoDecoder::setPresentation((int) config.presentationDepth,
+                                  config.halfRate ? config.refreshRate / 2 : config.refreshRate);
+    FrameEvents::setEnabled(config.frameEvents);
 }
 
 void onStreamStartNative() {
+    FFRData ffrData = {g_ctx.streamConfig.enableFoveation,
+                       g_ctx.streamConfig.eyeWidth, g_ctx.streamConfig.eyeHeight,
+                       g_ctx.streamConfig.foveationCenterSizeX, g_ctx.streamConfig.foveationCenterSizeY,
+                       g_ctx.streamConfig.foveationCenterShiftX, g_ctx.streamConfig.foveationCenterShiftY,
+                       g_ctx.streamConfig.foveationEdgeRatioX, g_ctx.streamConfig.foveationEdgeRatioY,
+                       g_ctx.streamConfig.foveationSinglePass,
+                       g_ctx.streamConfig.foveationDirectLayer};
+
+    // The eye buffers are created at the display resolution when the stream is upscaled to it,
+    // at the stream resolution otherwise. A stream above the display resolution is never
+    // upscaled.
+    UpscaleData upscale = {g_ctx.streamConfig.enableUpscaling &&
+                           (int) g_ctx.streamConfig.eyeWidth < g_ctx.displayEyeWidth &&
+                           (int) g_ctx.streamConfig.eyeHeight < g_ctx.displayEyeHeight,
+                           (uint32_t) g_ctx.displayEyeWidth, (uint32_t) g_ctx.displayEyeHeight,
+                           g_ctx.streamConfig.upscalingSharpness};
+    int eyeWidth = upscale.enabled ? g_ctx.displayEyeWidth : (int) g_ctx.streamConfig.eyeWidth;
+    int eyeHeight = upscale.enabled ? g_ctx.displayEyeHeight : (int) g_ctx.streamConfig.eyeHeight;
+
     ovrRenderer_Destroy(&g_ctx.Renderer);
-    ovrRenderer_Create(&g_ctx.Renderer, g_ctx.streamConfig.eyeWidth, g_ctx.streamConfig.eyeHeight,
-                       g_ctx.streamTexture.get(), g_ctx.loadingTexture,
-                       {g_ctx.streamConfig.enableFoveation,
-                        g_ctx.streamConfig.eyeWidth, g_ctx.streamConfig.eyeHeight,
-                        g_ctx.streamConfig.foveationCenterSizeX, g_ctx.streamConfig.foveationCenterSizeY,
-                        g_ctx.streamConfig.foveationCenterShiftX, g_ctx.streamConfig.foveationCenterShiftY,
-                        g_ctx.streamConfig.foveationEdgeRatioX, g_ctx.streamConfig.foveationEdgeRatioY});
+    ovrRenderer_Create(&g_ctx.Renderer, eyeWidth, eyeHeight, g_ctx.streamTexture.get(),
+                       g_ctx.streamConfig.dualStream ? g_ctx.secondStreamTexture.get() : nullptr,
+                       g_ctx.loadingTexture, ffrData, upscale,
+                       g_ctx.streamConfig.vulkanStreamPass);
     ovrRenderer_CreateScene(&g_ctx.Renderer, g_ctx.darkMode);
+    g_ctx.loadingLayerValid = false;
+
+    // Let the compositor shade the edges of the eye buffers at a lower rate, they only hold the
+    // compressed periphery of the frame anyway.
+    setFoveationLevel(FFR::GetCompositorFoveationLevel(ffrData));
 
     // On Oculus Quest, without ExtraLatencyMode frames passed to vrapi_SubmitFrame2 are sometimes discarded from VrAPI(?).
     // Which introduces stutter animation.
@@ -678,6 +732,8 @@ void onStreamStartNative() {
         LOGE("Failed to set refresh rate requested by the server: %d", result);
     }
 
+    g_ctx.clockGovernor.start(g_ctx.Ovr);
+
     g_ctx.m_LastHMDRecenterCount = -1; // make sure we send guardian data
 
     // reset battery and view config to make sure they get sent
@@ -694,6 +750,8 @@ void onPauseNative() {
     vrapi_LeaveVrMode(g_ctx.Ovr);
 
     g_ctx.Ovr = nullptr;
+    g_ctx.haptics.reset();
+    g_ctx.inputDevices.invalidate();
 
     if (g_ctx.window != nullptr) {
         ANativeWindow_release(g_ctx.window);
@@ -701,127 +759,34 @@ void onPauseNative() {
     g_ctx.window = nullptr;
 }
 
-void finishHapticsBuffer(ovrDeviceID DeviceID) {
-    uint8_t hapticBuffer[1] = {0};
-    ovrHapticBuffer buffer;
-    buffer.BufferTime = vrapi_GetPredictedDisplayTime(g_ctx.Ovr, g_ctx.ovrFrameIndex);
-    buffer.HapticBuffer = &hapticBuffer[0];
-    buffer.NumSamples = 1;
-    buffer.Terminated = true;
-
-    auto result = vrapi_SetHapticVibrationBuffer(g_ctx.Ovr, DeviceID, &buffer);
-    if (result != ovrSuccess) {
-        LOGI("vrapi_SetHapticVibrationBuffer: Failed. result=%d", result);
-    }
-}
+void measurePredictionError(const ovrTracking2 &renderTracking, double displayTime) {
+    const ovrTracking2 latestTracking = vrapi_GetPredictedTracking2(g_ctx.Ovr, displayTime);
 
-void updateHapticsState() {
-    ovrInputCapabilityHeader curCaps;
-    ovrResult result;
+    float rotation = rotationDegrees(renderTracking.HeadPose.Pose.Orientation,
+                                     latestTracking.HeadPose.Pose.Orientation);
+    float position = distanceMeters(renderTracking.HeadPose.Pose.Position,
+                                    latestTracking.HeadPose.Pose.Position) * 1000.0f;
 
-    for (uint32_t deviceIndex = 0;
-         vrapi_EnumerateInputDevices(g_ctx.Ovr, deviceIndex, &curCaps) >= 0; deviceIndex++) {
-        if (curCaps.Type == ovrControllerType_Gamepad) continue;
-        ovrInputTrackedRemoteCapabilities remoteCapabilities;
-
-        remoteCapabilities.Header = curCaps;
-        result = vrapi_GetInputDeviceCapabilities(g_ctx.Ovr, &remoteCapabilities.Header);
-        if (result != ovrSuccess) {
-            continue;
-        }
-
-        int curHandIndex = (remoteCapabilities.ControllerCapabilities & ovrControllerCaps_LeftHand)
-                           ? 1 : 0;
-        auto &s = g_ctx.mHapticsState[curHandIndex];
-
-        uint64_t currentUs = getTimestampUs();
-
-        if (s.fresh) {
-            s.startUs = s.startUs + currentUs;
-            s.endUs = s.startUs + s.endUs;
-            s.fresh = false;
-        }
-
-        if (s.startUs <= 0) {
-            // No requested haptics for this hand.
-            if (s.buffered) {
-                finishHapticsBuffer(curCaps.DeviceID);
-                s.buffered = false;
-            }
-            continue;
-        }
-
-        if (currentUs >= s.endUs) {
-            // No more haptics is needed.
-            s.startUs = 0;
-            if (s.buffered) {
-                finishHapticsBuffer(curCaps.DeviceID);
-                s.buffered = false;
-            }
-            continue;
-        }
-
-        if (remoteCapabilities.ControllerCapabilities &
-            ovrControllerCaps_HasBufferedHapticVibration) {
-            // Note: HapticSamplesMax=25 HapticSampleDurationMS=2 on Quest
-
-            // First, call with buffer.Terminated = false and when haptics is no more needed call with buffer.Terminated = true (to stop haptics?).
-            LOG("Send haptic buffer. HapticSamplesMax=%d HapticSampleDurationMS=%d",
-                remoteCapabilities.HapticSamplesMax, remoteCapabilities.HapticSampleDurationMS);
-
-            auto requiredHapticsBuffer = static_cast<uint32_t >((s.endUs - currentUs) /
-                                                                (remoteCapabilities.HapticSampleDurationMS *
-                                                                1000));
-
-            std::vector<uint8_t> hapticBuffer(remoteCapabilities.HapticSamplesMax);
-            ovrHapticBuffer buffer;
-            buffer.BufferTime = vrapi_GetPredictedDisplayTime(g_ctx.Ovr, g_ctx.ovrFrameIndex);
-            buffer.HapticBuffer = &hapticBuffer[0];
-            buffer.NumSamples = std::min(remoteCapabilities.HapticSamplesMax,
-                                         requiredHapticsBuffer);
-            buffer.Terminated = false;
-
-            for (uint32_t i = 0; i < buffer.NumSamples; i++) {
-                if (s.amplitude > 1.0f)
-                    hapticBuffer[i] = 255;
-                else
-                    hapticBuffer[i] = static_cast<uint8_t>(255 * s.amplitude);
-            }
-
-            result = vrapi_SetHapticVibrationBuffer(g_ctx.Ovr, curCaps.DeviceID, &buffer);
-            if (result != ovrSuccess) {
-                LOGI("vrapi_SetHapticVibrationBuffer: Failed. result=%d", result);
-            }
-            s.buffered = true;
-        } else if (remoteCapabilities.ControllerCapabilities &
-                   ovrControllerCaps_HasSimpleHapticVibration) {
-            LOG("Send simple haptic. amplitude=%f", s.amplitude);
-            vrapi_SetHapticVibrationSimple(g_ctx.Ovr, curCaps.DeviceID, s.amplitude);
-        }
-    }
+    LatencyCollector::Instance().predictionError(rotation, position);
 }
 
 void renderNative(long long targetTimespampNs) {
     g_ctx.ovrFrameIndex++;
+    // The stream frames go to the same swapchains
+    g_ctx.loadingLayerValid = false;
 
     LatencyCollector::Instance().rendered1(targetTimespampNs);
-    FrameLog(targetTimespampNs, "Got frame for render.");
-
-    updateHapticsState();
+    FrameEvents::record(targetTimespampNs, FrameEvent::RENDER_FRAME);
 
     ovrTracking2 tracking;
-    {
-        std::lock_guard<std::mutex> lock(g_ctx.trackingFrameMutex);
+    if (!g_ctx.trackingHistory.find(targetTimespampNs, tracking)) {
+        return;
+    }
 
-        const auto it = g_ctx.trackingFrameMap.find(targetTimespampNs);
-        if (it != g_ctx.trackingFrameMap.end()) {
-            tracking = it->second;
-        } else {
-            if (!g_ctx.trackingFrameMap.empty())
-                tracking = g_ctx.trackingFrameMap.cbegin()->second;
-            else
-                return;
-        }
+    g_ctx.Renderer.contentScale = NALParser::contentScale(targetTimespampNs);
+    if (!NALParser::foveationCenter(targetTimespampNs, g_ctx.Renderer.foveationCenter)) {
+        std::copy(g_ctx.Renderer.staticFoveationCenter, g_ctx.Renderer.staticFoveationCenter + 4,
+                  g_ctx.Renderer.foveationCenter);
     }
 
 // Render eye images and setup the primary layer using ovrTracking2.
@@ -830,14 +795,28 @@ void renderNative(long long targetTimespampNs) {
 
     LatencyCollector::Instance().rendered2(targetTimespampNs);
 
+    // The frame was predicted for its target timestamp, it is displayed at the next vsync this
+    // submission makes. The difference corrects the prediction horizon of the next samples.
+    double displayTime = vrapi_GetPredictedDisplayTime(g_ctx.Ovr, g_ctx.ovrFrameIndex);
+    LatencyCollector::Instance().displayed(targetTimespampNs, (uint64_t)(displayTime * 1e9));
+
+    // The layer keeps the head pose the frame was rendered with, so the VrApi time warp reprojects
+    // it to the head pose at display time. Report how far the prediction sent to the server was.
+    measurePredictionError(tracking, displayTime);
+
     const ovrLayerHeader2 *layers2[] =
             {
                     &worldLayer.Header
             };
 
+    // At half rate the compositor holds the frame for a second refresh and time warps it to the
+    // head orientation of that refresh. The time warp is rotation only, the head translation of
+    // the second refresh is not corrected.
+    int swapInterval = g_ctx.streamConfig.halfRate ? 2 : 1;
+
     ovrSubmitFrameDescription2 frameDesc = {};
     frameDesc.Flags = 0;
-    frameDesc.SwapInterval = 1;
+    frameDesc.SwapInterval = swapInterval;
     frameDesc.FrameIndex = g_ctx.ovrFrameIndex;
     frameDesc.DisplayTime = (double)targetTimespampNs / 1e9;
     frameDesc.LayerCount = 1;
@@ -849,6 +828,8 @@ void renderNative(long long targetTimespampNs) {
     // TimeSync here might be an issue but it seems to work fine
     sendTimeSync();
 
+    g_ctx.clockGovernor.update(g_ctx.Ovr, g_ctx.streamConfig.refreshRate / swapInterval);
+
     if (g_ctx.suspend) {
         LOG("submit enter suspend");
         while (g_ctx.suspend) {
@@ -858,19 +839,25 @@ void renderNative(long long targetTimespampNs) {
     }
 }
 
-void renderLoadingNative() {
+void renderLoadingNative(bool messageChanged) {
     // Show a loading icon.
     g_ctx.ovrFrameIndex++;
 
     double displayTime = vrapi_GetPredictedDisplayTime(g_ctx.Ovr, g_ctx.ovrFrameIndex);
     ovrTracking2 headTracking = vrapi_GetPredictedTracking2(g_ctx.Ovr, displayTime);
 
-    const ovrLayerProjection2 worldLayer = ovrRenderer_RenderFrame(&g_ctx.Renderer, &headTracking,
-                                                                   true);
+    // The lobby is static. Its last frame keeps the head pose it was rendered with, and the VrApi
+    // time warp reprojects it, so it is only rendered again for a new message or once the head
+    // moved far enough for the reprojection to show.
+    if (messageChanged || !g_ctx.loadingLayerValid ||
+        headMoved(g_ctx.loadingLayer.HeadPose.Pose, headTracking.HeadPose.Pose)) {
+        g_ctx.loadingLayer = ovrRenderer_RenderFrame(&g_ctx.Renderer, &headTracking, true);
+        g_ctx.loadingLayerValid = true;
+    }
 
     const ovrLayerHeader2 *layers[] =
             {
-                    &worldLayer.Header
+                    &g_ctx.loadingLayer.Header
             };
 
 
@@ -890,13 +877,7 @@ void onHapticsFeedbackNative(unsigned long long path,
                             float frequency,
                             float amplitude) {
     int curHandIndex = (path == RIGHT_CONTROLLER_HAPTICS_PATH ? 0 : 1);
-    auto &s = g_ctx.mHapticsState[curHandIndex];
-    s.startUs = 0;
-    s.endUs = (uint64_t)(duration_s * 1000'000);
-    s.amplitude = amplitude;
-    s.frequency = frequency;
-    s.fresh = true;
-    s.buffered = false;
+    g_ctx.haptics.request(curHandIndex, duration_s, amplitude);
 }
 
 void onBatteryChangedNative(int battery, int plugged) {
@@ -932,5 +913,6 @@ GuardianData getGuardianData() {
 void onTrackingNative(bool clientsidePrediction) {
     if (g_ctx.Ovr != nullptr) {
         sendTrackingInfo(clientsidePrediction);
+        g_ctx.haptics.update(g_ctx.Ovr, vrapi_GetPredictedDisplayTime(g_ctx.Ovr, g_ctx.ovrFrameIndex));
     }
 }
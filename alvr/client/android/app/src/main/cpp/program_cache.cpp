@@ -0,0 +1,143 @@
+#include "program_cache.h"
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+    const uint32_t FILE_MAGIC = 0x42504c41; // "ALPB"
+    // Larger lengths come from a damaged file
+    const uint32_t MAX_BINARY_LENGTH = 16 * 1024 * 1024;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint64_t hash;
+        uint32_t binaryFormat;
+        uint32_t binaryLength;
+    };
+
+    std::mutex g_directoryMutex;
+    std::string g_directory;
+
+    // FNV-1a, stable across builds unlike std::hash
+    uint64_t hashString(const std::string &string, uint64_t hash = 0xcbf29ce484222325) {
+        for (char c : string) {
+            hash ^= (uint8_t) c;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    uint64_t hashKey(const std::string &key) {
+        uint64_t hash = hashString(key);
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const char *string = (const char *) glGetString(name);
+            hash = hashString(string != nullptr ? string : "", hash);
+        }
+        return hash;
+    }
+
+    // Empty if the cache is disabled or the driver cannot give binaries
+    std::string filePath(uint64_t hash) {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0) {
+            return "";
+        }
+
+        std::lock_guard<std::mutex> lock(g_directoryMutex);
+        if (g_directory.empty()) {
+            return "";
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "/program_%016llx.bin", (unsigned long long) hash);
+        return g_directory + name;
+    }
+}
+
+void ProgramCache::setDirectory(const std::string &directory) {
+    std::lock_guard<std::mutex> lock(g_directoryMutex);
+    g_directory = directory;
+}
+
+GLuint ProgramCache::load(const std::string &key) {
+    uint64_t hash = hashKey(key);
+    std::string path = filePath(hash);
+    if (path.empty()) {
+        return 0;
+    }
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return 0;
+    }
+    FileHeader header = {};
+    std::vector<uint8_t> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+                 && header.magic == FILE_MAGIC && header.hash == hash
+                 && header.binaryLength <= MAX_BINARY_LENGTH;
+    if (valid) {
+        binary.resize(header.binaryLength);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+
+    GLuint program = 0;
+    if (valid) {
+        program = glCreateProgram();
+        glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei) binary.size());
+        // An error is not a GL error here, the program is just not linked
+        while (glGetError() != GL_NO_ERROR) {}
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (linked == GL_FALSE) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    if (program == 0) {
+        LOGI("Program binary %s rejected, building the program.", path.c_str());
+        remove(path.c_str());
+    }
+    return program;
+}
+
+void ProgramCache::prepare(GLuint program) {
+    GL(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+}
+
+void ProgramCache::store(const std::string &key, GLuint program) {
+    uint64_t hash = hashKey(key);
+    std::string path = filePath(hash);
+    if (path.empty()) {
+        return;
+    }
+
+    GLint length = 0;
+    GL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0) {
+        return;
+    }
+    FileHeader header = {FILE_MAGIC, hash, 0, 0};
+    std::vector<uint8_t> binary(length);
+    GLsizei written = 0;
+    GL(glGetProgramBinary(program, length, &written, &header.binaryFormat, binary.data()));
+    header.binaryLength = written;
+
+    // Written aside and renamed, a start that reads the file while it is written sees none
+    std::string partialPath = path + ".partial";
+    FILE *file = fopen(partialPath.c_str(), "wb");
+    if (file == nullptr) {
+        LOGE("Cannot write the program binary %s.", partialPath.c_str());
+        return;
+    }
+    bool complete = fwrite(&header, sizeof(header), 1, file) == 1
+                    && fwrite(binary.data(), 1, written, file) == (size_t) written;
+    complete = fclose(file) == 0 && complete;
+    if (!complete || rename(partialPath.c_str(), path.c_str()) != 0) {
+        LOGE("Cannot write the program binary %s.", path.c_str());
+        remove(partialPath.c_str());
+    }
+}
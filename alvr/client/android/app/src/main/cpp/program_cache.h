@@ -0,0 +1,27 @@
+#ifndef ALVRCLIENT_PROGRAM_CACHE_H
+#define ALVRCLIENT_PROGRAM_CACHE_H
+
+#include <string>
+#include <GLES3/gl3.h>
+
+// Keeps the binaries of the linked GL programs in the cache storage of the app, so that warm
+// starts and resumes load them instead of compiling the shaders again. A binary is found by a
+// hash of everything the program is built from and of the GL vendor, renderer and version
+// strings, so a driver update misses the cache. The driver can still reject a binary, the
+// program is then built from the sources and stored again.
+class ProgramCache {
+public:
+    // Directory of the binaries, nothing is cached until it is set
+    static void setDirectory(const std::string &directory);
+
+    // key is everything the program is built from: the shader sources, the attribute bindings.
+    // Returns a linked program, 0 if there is none or the driver rejected it. Needs the GL context
+    // current.
+    static GLuint load(const std::string &key);
+    // Called before linking a program that will be stored, so that the driver keeps its binary
+    static void prepare(GLuint program);
+    // Stores a program linked after prepare()
+    static void store(const std::string &key, GLuint program);
+};
+
+#endif //ALVRCLIENT_PROGRAM_CACHE_H
@@ -1,10 +1,14 @@
 #include <GLES3/gl3.h>
 #include <GLES2/gl2ext.h>
+#include <algorithm>
+#include <cmath>
 #include <memory>
 
 #include "render.h"
 #include "utils.h"
 #include "gltf_model.h"
+#include "latency_collector.h"
+#include "program_cache.h"
 #include <glm/gtc/type_ptr.hpp>
 
 using namespace gl_render_utils;
@@ -26,6 +30,24 @@ typedef struct {
 
 OpenGLExtensions_t glExtensions;
 
+PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC glFramebufferTextureMultiviewOVR;
+
+static void EglInitExtensions() {
+    const char *allExtensions = (const char *) glGetString(GL_EXTENSIONS);
+    if (allExtensions != nullptr) {
+        glExtensions.multi_view = strstr(allExtensions, "GL_OVR_multiview2") != nullptr;
+        glExtensions.EXT_texture_border_clamp = strstr(allExtensions, "GL_EXT_texture_border_clamp") ||
+                                                strstr(allExtensions, "GL_OES_texture_border_clamp");
+    }
+
+    glFramebufferTextureMultiviewOVR = (PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC) eglGetProcAddress(
+            "glFramebufferTextureMultiviewOVR");
+    if (glFramebufferTextureMultiviewOVR == nullptr) {
+        glExtensions.multi_view = false;
+    }
+    LOGI("Multiview %s.", glExtensions.multi_view ? "supported" : "not supported");
+}
+
 static const char *EglErrorString(const EGLint error) {
     switch (error) {
         case EGL_SUCCESS:
@@ -103,9 +125,34 @@ in lowp vec2 uv;
 in lowp vec4 fragmentColor;
 out lowp vec4 outColor;
 uniform %s Texture0;
+// Dynamic resolution draws each eye scaled into the top left corner of its half
+uniform highp float ContentScale;
+%s
+void main()
+{
+    highp float eyeStart = uv.x < 0.5 ? 0. : 0.5;
+    outColor = SampleStream(Texture0, vec2(eyeStart + (uv.x - eyeStart) * ContentScale, uv.y * ContentScale));
+}
+)glsl";
+
+// FRAGMENT_SHADER for dual stream mode, each eye comes from the texture of its decoder
+static const char FRAGMENT_SHADER_DUAL_STREAM[] = R"glsl(
+#extension GL_OES_EGL_image_external_essl3 : enable
+#extension GL_OES_EGL_image_external : enable
+in lowp vec2 uv;
+in lowp vec4 fragmentColor;
+out lowp vec4 outColor;
+uniform samplerExternalOES Texture0;
+uniform samplerExternalOES Texture1;
+uniform highp float ContentScale;
+%s
 void main()
 {
-    outColor = texture(Texture0, uv);
+    if (uv.x < 0.5) {
+        outColor = SampleStream(Texture0, vec2(uv.x * 2., uv.y) * ContentScale);
+    } else {
+        outColor = SampleStream(Texture1, vec2(uv.x * 2. - 1., uv.y) * ContentScale);
+    }
 }
 )glsl";
 
@@ -295,6 +342,8 @@ void eglInit() {
         egl.Context = EGL_NO_CONTEXT;
         return;
     }
+
+    EglInitExtensions();
 }
 
 void eglDestroy() {
@@ -331,13 +380,52 @@ void eglDestroy() {
 #ifdef OVR_SDK
 
 bool ovrFramebuffer_Create(ovrFramebuffer *frameBuffer, const GLenum colorFormat, const int width,
-                           const int height) {
+                           const int height, bool multiview) {
     const int PREFERRED_SWAPCHAIN_SIZE = 3;
+    frameBuffer->Width = width;
+    frameBuffer->Height = height;
+    frameBuffer->Multiview = multiview;
     frameBuffer->ColorTextureSwapChain = vrapi_CreateTextureSwapChain3(
-            VRAPI_TEXTURE_TYPE_2D, colorFormat, width, height, 1, PREFERRED_SWAPCHAIN_SIZE);
+            multiview ? VRAPI_TEXTURE_TYPE_2D_ARRAY : VRAPI_TEXTURE_TYPE_2D, colorFormat, width,
+            height, 1, PREFERRED_SWAPCHAIN_SIZE);
     frameBuffer->TextureSwapChainLength = vrapi_GetTextureSwapChainLength(
             frameBuffer->ColorTextureSwapChain);
 
+    if (multiview) {
+        GL(glGenTextures(1, &frameBuffer->MultiviewDepthTexture));
+        GL(glBindTexture(GL_TEXTURE_2D_ARRAY, frameBuffer->MultiviewDepthTexture));
+        GL(glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, width, height, 2));
+        GL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+        for (int i = 0; i < frameBuffer->TextureSwapChainLength; i++) {
+            const GLuint colorTexture = vrapi_GetTextureSwapChainHandle(
+                    frameBuffer->ColorTextureSwapChain, i);
+            GL(glBindTexture(GL_TEXTURE_2D_ARRAY, colorTexture));
+            GL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+            GL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+            GL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+            GL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+            GL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+            GLuint multiviewFrameBuffer;
+            GL(glGenFramebuffers(1, &multiviewFrameBuffer));
+            GL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, multiviewFrameBuffer));
+            GL(glFramebufferTextureMultiviewOVR(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                                frameBuffer->MultiviewDepthTexture, 0, 0, 2));
+            GL(glFramebufferTextureMultiviewOVR(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                                colorTexture, 0, 0, 2));
+            GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+            GL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));
+            if (status != GL_FRAMEBUFFER_COMPLETE) {
+                LOGE("Incomplete multiview frame buffer. status=0x%x", status);
+                GL(glDeleteFramebuffers(1, &multiviewFrameBuffer));
+                return false;
+            }
+            frameBuffer->MultiviewFrameBuffers.push_back(multiviewFrameBuffer);
+        }
+        return true;
+    }
+
     for (int i = 0; i < frameBuffer->TextureSwapChainLength; i++) {
         const GLuint glRenderTarget = vrapi_GetTextureSwapChainHandle(
                 frameBuffer->ColorTextureSwapChain, i);
@@ -353,15 +441,29 @@ bool ovrFramebuffer_Create(ovrFramebuffer *frameBuffer, const GLenum colorFormat
 void ovrFramebuffer_Destroy(ovrFramebuffer *frameBuffer) {
     frameBuffer->renderStates.clear();
     frameBuffer->renderTargets.clear();
+    if (!frameBuffer->MultiviewFrameBuffers.empty()) {
+        GL(glDeleteFramebuffers(frameBuffer->MultiviewFrameBuffers.size(),
+                                frameBuffer->MultiviewFrameBuffers.data()));
+        frameBuffer->MultiviewFrameBuffers.clear();
+    }
+    if (frameBuffer->MultiviewDepthTexture != 0) {
+        GL(glDeleteTextures(1, &frameBuffer->MultiviewDepthTexture));
+        frameBuffer->MultiviewDepthTexture = 0;
+    }
     frameBuffer->TextureSwapChainLength = 0;
     frameBuffer->TextureSwapChainIndex = 0;
-    frameBuffer->ColorTextureSwapChain = nullptr;
     vrapi_DestroyTextureSwapChain(frameBuffer->ColorTextureSwapChain);
+    frameBuffer->ColorTextureSwapChain = nullptr;
 }
 
 void ovrFramebuffer_SetCurrent(ovrFramebuffer *frameBuffer) {
-    GL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
-                         frameBuffer->renderStates[frameBuffer->TextureSwapChainIndex]->GetFrameBuffer()));
+    if (frameBuffer->Multiview) {
+        GL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
+                             frameBuffer->MultiviewFrameBuffers[frameBuffer->TextureSwapChainIndex]));
+    } else {
+        GL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
+                             frameBuffer->renderStates[frameBuffer->TextureSwapChainIndex]->GetFrameBuffer()));
+    }
 }
 
 void ovrFramebuffer_SetNone() {
@@ -513,7 +615,9 @@ enum E1test {
     UNIFORM_ALPHA,
     UNIFORM_COLOR,
     UNIFORM_M_MATRIX,
-    UNIFORM_MODE
+    UNIFORM_MODE,
+    UNIFORM_CONTENT_SCALE,
+    UNIFORM_FOVEATION_CENTER
 };
 enum E2test {
     UNIFORM_TYPE_VECTOR4,
@@ -536,63 +640,89 @@ static ovrUniform ProgramUniforms[] =
                 {UNIFORM_COLOR,      UNIFORM_TYPE_VECTOR4,   "Color"},
                 {UNIFORM_M_MATRIX,   UNIFORM_TYPE_MATRIX4X4, "mMatrix"},
                 {UNIFORM_MODE,       UNIFORM_TYPE_INT,       "Mode"},
+                {UNIFORM_CONTENT_SCALE, UNIFORM_TYPE_FLOAT,  "ContentScale"},
+                {UNIFORM_FOVEATION_CENTER, UNIFORM_TYPE_VECTOR4, "FoveationCenter"},
         };
 
 static const char *programVersion = "#version 300 es\n";
 
 bool
-ovrProgram_Create(ovrProgram *program, const char *vertexSource, const char *fragmentSource) {
+ovrProgram_Create(ovrProgram *program, const char *vertexSource, const char *fragmentSource,
+                  bool multiview) {
     GLint r;
 
-    LOGI("Compiling shaders.");
-    GL(program->VertexShader = glCreateShader(GL_VERTEX_SHADER));
-    if (program->VertexShader == 0) {
-        LOGE("glCreateShader error: %d", glGetError());
-        return false;
-    }
+    const char *vertexSources[3] = {programVersion, multiview ? "#define DISABLE_MULTIVIEW 0\n"
+                                                              : "#define DISABLE_MULTIVIEW 1\n",
+                                    vertexSource};
+    const char *fragmentSources[2] = {programVersion, fragmentSource};
 
-    const char *vertexSources[3] = {programVersion, "#define DISABLE_MULTIVIEW 1\n", vertexSource};
-    GL(glShaderSource(program->VertexShader, 3, vertexSources, 0));
-    GL(glCompileShader(program->VertexShader));
-    GL(glGetShaderiv(program->VertexShader, GL_COMPILE_STATUS, &r));
-    if (r == GL_FALSE) {
-        GLchar msg[4096];
-        GL(glGetShaderInfoLog(program->VertexShader, sizeof(msg), 0, msg));
-        LOGE("Error on compiling vertex shader. Message=%s", msg);
-        LOGE("%s\n%s\n", vertexSource, msg);
-        // Ignore compile error. If this error is only a warning, we can proceed to next.
+    std::string cacheKey;
+    for (auto source : vertexSources) {
+        cacheKey += source;
     }
-
-    const char *fragmentSources[2] = {programVersion, fragmentSource};
-    GL(program->FragmentShader = glCreateShader(GL_FRAGMENT_SHADER));
-    GL(glShaderSource(program->FragmentShader, 2, fragmentSources, 0));
-    GL(glCompileShader(program->FragmentShader));
-    GL(glGetShaderiv(program->FragmentShader, GL_COMPILE_STATUS, &r));
-    if (r == GL_FALSE) {
-        GLchar msg[4096];
-        GL(glGetShaderInfoLog(program->FragmentShader, sizeof(msg), 0, msg));
-        LOGE("Error on compiling fragment shader. Message=%s", msg);
-        LOGE("%s\n%s\n", fragmentSource, msg);
-        // Ignore compile error. If this error is only a warning, we can proceed to next.
+    for (auto source : fragmentSources) {
+        cacheKey += source;
+    }
+    for (auto &attribute : ProgramVertexAttributes) {
+        cacheKey += std::to_string(attribute.location) + attribute.name;
     }
 
-    GL(program->Program = glCreateProgram());
-    GL(glAttachShader(program->Program, program->VertexShader));
-    GL(glAttachShader(program->Program, program->FragmentShader));
+    program->VertexShader = 0;
+    program->FragmentShader = 0;
+    program->Program = ProgramCache::load(cacheKey);
+    if (program->Program != 0) {
+        LOGI("Loaded the program binary.");
+    } else {
+        LOGI("Compiling shaders.");
+        GL(program->VertexShader = glCreateShader(GL_VERTEX_SHADER));
+        if (program->VertexShader == 0) {
+            LOGE("glCreateShader error: %d", glGetError());
+            return false;
+        }
 
-    // Bind the vertex attribute locations.
-    for (size_t i = 0; i < sizeof(ProgramVertexAttributes) / sizeof(ProgramVertexAttributes[0]); i++) {
-        GL(glBindAttribLocation(program->Program, ProgramVertexAttributes[i].location,
-                                ProgramVertexAttributes[i].name));
-    }
+        GL(glShaderSource(program->VertexShader, 3, vertexSources, 0));
+        GL(glCompileShader(program->VertexShader));
+        GL(glGetShaderiv(program->VertexShader, GL_COMPILE_STATUS, &r));
+        if (r == GL_FALSE) {
+            GLchar msg[4096];
+            GL(glGetShaderInfoLog(program->VertexShader, sizeof(msg), 0, msg));
+            LOGE("Error on compiling vertex shader. Message=%s", msg);
+            LOGE("%s\n%s\n", vertexSource, msg);
+            // Ignore compile error. If this error is only a warning, we can proceed to next.
+        }
+
+        GL(program->FragmentShader = glCreateShader(GL_FRAGMENT_SHADER));
+        GL(glShaderSource(program->FragmentShader, 2, fragmentSources, 0));
+        GL(glCompileShader(program->FragmentShader));
+        GL(glGetShaderiv(program->FragmentShader, GL_COMPILE_STATUS, &r));
+        if (r == GL_FALSE) {
+            GLchar msg[4096];
+            GL(glGetShaderInfoLog(program->FragmentShader, sizeof(msg), 0, msg));
+            LOGE("Error on compiling fragment shader. Message=%s", msg);
+            LOGE("%s\n%s\n", fragmentSource, msg);
+            // Ignore compile error. If this error is only a warning, we can proceed to next.
+        }
+
+        GL(program->Program = glCreateProgram());
+        GL(glAttachShader(program->Program, program->VertexShader));
+        GL(glAttachShader(program->Program, program->FragmentShader));
+
+        // Bind the vertex attribute locations.
+        for (size_t i = 0; i < sizeof(ProgramVertexAttributes) / sizeof(ProgramVertexAttributes[0]); i++) {
+            GL(glBindAttribLocation(program->Program, ProgramVertexAttributes[i].location,
+                                    ProgramVertexAttributes[i].name));
+        }
 
-    GL(glLinkProgram(program->Program));
-    GL(glGetProgramiv(program->Program, GL_LINK_STATUS, &r));
-    if (r == GL_FALSE) {
-        GLchar msg[4096];
-        GL(glGetProgramInfoLog(program->Program, sizeof(msg), 0, msg));
-        LOGE("Linking program failed: %s\n", msg);
-        return false;
+        ProgramCache::prepare(program->Program);
+        GL(glLinkProgram(program->Program));
+        GL(glGetProgramiv(program->Program, GL_LINK_STATUS, &r));
+        if (r == GL_FALSE) {
+            GLchar msg[4096];
+            GL(glGetProgramInfoLog(program->Program, sizeof(msg), 0, msg));
+            LOGE("Linking program failed: %s\n", msg);
+            return false;
+        }
+        ProgramCache::store(cacheKey, program->Program);
     }
 
     int numBufferBindings = 0;
@@ -652,28 +782,66 @@ void ovrProgram_Destroy(ovrProgram *program) {
 //
 
 void ovrRenderer_Create(ovrRenderer *renderer, int width, int height, Texture *streamTexture,
-                        int LoadingTexture, FFRData ffrData) {
-    renderer->NumBuffers = VRAPI_FRAME_LAYER_EYE_MAX;
-
-    renderer->enableFFR = ffrData.enabled;
+                        Texture *secondStreamTexture, int LoadingTexture, FFRData ffrData,
+                        UpscaleData upscale, bool vulkanStreamPass) {
+    renderer->Multiview = glExtensions.multi_view;
+    renderer->NumBuffers = renderer->Multiview ? 1 : VRAPI_FRAME_LAYER_EYE_MAX;
+
+    renderer->enableFFR = ffrData.enabled && !ffrData.singlePass;
+    renderer->singlePassFFRShader.clear();
+    if (ffrData.enabled && ffrData.singlePass) {
+        renderer->singlePassFFRShader = FFR::GetSinglePassFragmentShader(ffrData, upscale,
+                                                                         secondStreamTexture != nullptr);
+    }
+    // The Vulkan pass only converts and scales the frames, the FFR and upscaling passes stay in GL
+    if (vulkanStreamPass && !ffrData.enabled && !upscale.enabled) {
+        renderer->vkStreamPass = VkStreamPass::Create(ffrData.eyeWidth * 2, ffrData.eyeHeight,
+                                                      secondStreamTexture != nullptr);
+    }
+    VkStreamPass::setCurrent(renderer->vkStreamPass.get());
+    renderer->vkStreamOutput = nullptr;
     if (renderer->enableFFR) {
         renderer->ffrSourceTexture = streamTexture;
-        renderer->ffr = std::make_unique<FFR>(renderer->ffrSourceTexture);
-        renderer->ffr->Initialize(ffrData);
+        renderer->ffr = std::make_unique<FFR>(renderer->ffrSourceTexture, secondStreamTexture);
+        renderer->ffr->Initialize(ffrData, upscale, !ffrData.directLayer);
+        // The decompression pass already upscaled the frame
+        renderer->streamSamplingFunction = GetStreamSamplingFunction({}, "sampler2D", 0, 0);
+    } else if (renderer->vkStreamPass) {
+        // The Vulkan pass already converted, scaled and merged the frames
+        renderer->streamSamplingFunction = GetStreamSamplingFunction({}, "sampler2D", 0, 0);
+    } else if (secondStreamTexture != nullptr) {
+        renderer->streamSamplingFunction = GetStreamSamplingFunction(
+                upscale, "samplerExternalOES", ffrData.eyeWidth, ffrData.eyeHeight);
+    } else {
+        renderer->streamSamplingFunction = GetStreamSamplingFunction(
+                upscale, "samplerExternalOES", ffrData.eyeWidth * 2, ffrData.eyeHeight);
     }
+    renderer->directLayer = renderer->enableFFR && ffrData.directLayer;
 
 #ifdef OVR_SDK
     // Create the frame buffers.
     for (int eye = 0; eye < renderer->NumBuffers; eye++) {
-        ovrFramebuffer_Create(&renderer->FrameBuffer[eye], GL_RGBA8, width, height);
+        ovrFramebuffer_Create(&renderer->FrameBuffer[eye], GL_RGBA8, width, height,
+                              renderer->Multiview);
+    }
+    if (renderer->directLayer) {
+        ovrFramebuffer_Create(&renderer->DirectFrameBuffer, GL_RGBA8, width * 2, height, false);
     }
 #endif
 
     renderer->streamTexture = streamTexture;
+    renderer->secondStreamTexture = secondStreamTexture;
+    renderer->contentScale = 1.f;
+    FFR::GetStaticFoveationCenter(ffrData, renderer->staticFoveationCenter);
+    std::copy(renderer->staticFoveationCenter, renderer->staticFoveationCenter + 4,
+              renderer->foveationCenter);
     renderer->LoadingTexture = LoadingTexture;
     renderer->SceneCreated = false;
-    renderer->loadingScene = new GltfModel();
-    renderer->loadingScene->load();
+    renderer->gpuTimer = GpuTimer::Create();
+    if (renderer->loadingScene == nullptr) {
+        renderer->loadingScene = new GltfModel();
+        renderer->loadingScene->load();
+    }
 }
 
 
@@ -683,13 +851,36 @@ void ovrRenderer_CreateScene(ovrRenderer *renderer, bool darkMode) {
     }
 
     std::string fragment_shader;
-    fragment_shader = string_format(FRAGMENT_SHADER,
-                                    renderer->enableFFR ? "sampler2D" : "samplerExternalOES");
-    ovrProgram_Create(&renderer->Program, VERTEX_SHADER, fragment_shader.c_str());
+    if (!renderer->singlePassFFRShader.empty()) {
+        fragment_shader = renderer->singlePassFFRShader;
+    } else if (!renderer->enableFFR && !renderer->vkStreamPass &&
+               renderer->secondStreamTexture != nullptr) {
+        fragment_shader = string_format(FRAGMENT_SHADER_DUAL_STREAM,
+                                        renderer->streamSamplingFunction.c_str());
+    } else {
+        bool sampler2D = renderer->enableFFR || renderer->vkStreamPass;
+        fragment_shader = string_format(FRAGMENT_SHADER,
+                                        sampler2D ? "sampler2D" : "samplerExternalOES",
+                                        renderer->streamSamplingFunction.c_str());
+    }
+    ovrProgram_Create(&renderer->Program, VERTEX_SHADER, fragment_shader.c_str(),
+                      renderer->Multiview);
+
+    // The panel of the stream pass is drawn with constant uniforms, they are set once here instead
+    // of with every eye.
+    ovrMatrix4f mvpMatrix[2] = {ovrMatrix4f_CreateIdentity(), ovrMatrix4f_CreateIdentity()};
+    GL(glUseProgram(renderer->Program.Program));
+    GL(glUniformMatrix4fv(renderer->Program.UniformLocation[UNIFORM_MVP_MATRIX], 2, true,
+                          (float *) mvpMatrix));
+    GL(glUniform1f(renderer->Program.UniformLocation[UNIFORM_ALPHA], 2.0f));
+    GL(glUseProgram(0));
+    renderer->programContentScale = NAN;
+    std::fill_n(renderer->programFoveationCenter, 4, NAN);
 
     fragment_shader = string_format(FRAGMENT_SHADER_LOADING,
                                     darkMode ? "outColor.rgb = 1.0 - outColor.rgb;" : "");
-    ovrProgram_Create(&renderer->ProgramLoading, VERTEX_SHADER_LOADING, fragment_shader.c_str());
+    ovrProgram_Create(&renderer->ProgramLoading, VERTEX_SHADER_LOADING, fragment_shader.c_str(),
+                      renderer->Multiview);
 
     ovrGeometry_CreatePanel(&renderer->Panel);
     ovrGeometry_CreateVAO(&renderer->Panel);
@@ -711,15 +902,92 @@ void ovrRenderer_Destroy(ovrRenderer *renderer) {
     for (int eye = 0; eye < renderer->NumBuffers; eye++) {
         ovrFramebuffer_Destroy(&renderer->FrameBuffer[eye]);
     }
+    if (renderer->directLayer) {
+        ovrFramebuffer_Destroy(&renderer->DirectFrameBuffer);
+        renderer->directLayer = false;
+    }
 #endif
+    renderer->gpuTimer.reset();
+    VkStreamPass::setCurrent(nullptr);
+    renderer->vkStreamPass.reset();
+    renderer->vkStreamOutput = nullptr;
 }
 
 #ifdef OVR_SDK
 
+namespace {
+    // Reports the GPU time of the passes of an earlier frame, and returns the timer of the passes
+    // of this one. Null for the loading frames.
+    GpuTimer *beginGpuTimer(ovrRenderer *renderer, bool loading) {
+        if (loading || !renderer->gpuTimer) {
+            return nullptr;
+        }
+        uint64_t timesUs[GpuTimer::PASS_COUNT];
+        if (renderer->gpuTimer->beginFrame(timesUs)) {
+            LatencyCollector::Instance().gpuTime(timesUs[GpuTimer::PASS_FFR],
+                                                 timesUs[GpuTimer::PASS_EYES]);
+        }
+        return renderer->gpuTimer.get();
+    }
+
+    ovrLayerProjection2 renderDirectLayer(ovrRenderer *renderer, const ovrTracking2 *tracking,
+                                          GpuTimer *gpuTimer) {
+        ovrFramebuffer *frameBuffer = &renderer->DirectFrameBuffer;
+        if (gpuTimer) {
+            gpuTimer->begin(GpuTimer::PASS_FFR);
+        }
+        renderer->ffr->Render(*frameBuffer->renderStates[frameBuffer->TextureSwapChainIndex],
+                              renderer->contentScale, renderer->foveationCenter);
+        if (gpuTimer) {
+            gpuTimer->end();
+        }
+
+        ovrLayerProjection2 layer = vrapi_DefaultLayerProjection2();
+        layer.HeadPose = tracking->HeadPose;
+        for (int eye = 0; eye < VRAPI_FRAME_LAYER_EYE_MAX; eye++) {
+            layer.Textures[eye].ColorSwapChain = frameBuffer->ColorTextureSwapChain;
+            layer.Textures[eye].SwapChainIndex = frameBuffer->TextureSwapChainIndex;
+
+            // Map each eye to its half of the side by side image. The expanded frame is stored
+            // top-down like the decoder output, while the compositor samples bottom-up.
+            ovrMatrix4f m = ovrMatrix4f_TanAngleMatrixFromProjection(
+                    &tracking->Eye[eye].ProjectionMatrix);
+            for (int i = 0; i < 4; i++) {
+                m.M[0][i] = 0.5f * m.M[0][i] + 0.5f * eye * m.M[2][i];
+                m.M[1][i] = m.M[2][i] - m.M[1][i];
+            }
+            layer.Textures[eye].TexCoordsFromTanAngles = m;
+            layer.Textures[eye].TextureRect = {0.5f * eye, 0.f, 0.5f, 1.f};
+        }
+        layer.Header.Flags |= VRAPI_FRAME_LAYER_FLAG_CHROMATIC_ABERRATION_CORRECTION;
+
+        ovrFramebuffer_SetCurrent(frameBuffer);
+        ovrFramebuffer_Resolve();
+        ovrFramebuffer_Advance(frameBuffer);
+        ovrFramebuffer_SetNone();
+
+        return layer;
+    }
+}
+
 ovrLayerProjection2 ovrRenderer_RenderFrame(ovrRenderer *renderer, const ovrTracking2 *tracking,
                                             bool loading) {
-    if (renderer->enableFFR) {
-        renderer->ffr->Render();
+    GpuTimer *gpuTimer = beginGpuTimer(renderer, loading);
+    if (!loading && renderer->directLayer) {
+        return renderDirectLayer(renderer, tracking, gpuTimer);
+    }
+    if (!loading && renderer->enableFFR) {
+        if (gpuTimer) {
+            gpuTimer->begin(GpuTimer::PASS_FFR);
+        }
+        renderer->ffr->Render(renderer->contentScale, renderer->foveationCenter);
+        if (gpuTimer) {
+            gpuTimer->end();
+        }
+    }
+    if (!loading && renderer->vkStreamPass) {
+        // Submitted to the Vulkan queue, the eye pass waits for it on the GPU
+        renderer->vkStreamOutput = renderer->vkStreamPass->Render(renderer->contentScale);
     }
 
     const ovrTracking2 &updatedTracking = *tracking;
@@ -739,7 +1007,10 @@ ovrLayerProjection2 ovrRenderer_RenderFrame(ovrRenderer *renderer, const ovrTrac
     ovrFramebuffer *frameBuffer = &renderer->FrameBuffer[0];
     ovrFramebuffer_SetCurrent(frameBuffer);
 
-    // Render the eye images.
+    if (gpuTimer) {
+        gpuTimer->begin(GpuTimer::PASS_EYES);
+    }
+    // Render the eye images, both at once in multiview mode.
     for (int eye = 0; eye < renderer->NumBuffers; eye++) {
         // NOTE: In the non-mv case, latency can be further reduced by updating the sensor prediction
         // for each eye (updates orientation, not position)
@@ -758,14 +1029,19 @@ ovrLayerProjection2 ovrRenderer_RenderFrame(ovrRenderer *renderer, const ovrTrac
         mvpMatrix[1] = ovrMatrix4f_Multiply(&tracking->Eye[1].ProjectionMatrix,
                                             &mvpMatrix[1]);
 
-        Recti viewport = {0, 0, (int) frameBuffer->renderTargets[0]->GetWidth(),
-                          (int) frameBuffer->renderTargets[0]->GetHeight()};
+        Recti viewport = {0, 0, frameBuffer->Width, frameBuffer->Height};
 
         renderEye(eye, mvpMatrix, &viewport, renderer, loading);
 
         ovrFramebuffer_Resolve();
         ovrFramebuffer_Advance(frameBuffer);
     }
+    if (gpuTimer) {
+        gpuTimer->end();
+    }
+    if (!loading && renderer->vkStreamPass) {
+        renderer->vkStreamPass->EndFrame();
+    }
 
     ovrFramebuffer_SetNone();
 
@@ -826,22 +1102,38 @@ void renderEye(int eye, ovrMatrix4f mvpMatrix[2], Recti *viewport, ovrRenderer *
     } else {
         GL(glClear(GL_DEPTH_BUFFER_BIT));
 
-        ovrMatrix4f mvpMatrix[2];
-        mvpMatrix[0] = ovrMatrix4f_CreateIdentity();
-        mvpMatrix[1] = ovrMatrix4f_CreateIdentity();
-
         GL(glBindVertexArray(renderer->Panel.VertexArrayObject));
 
-        GL(glUniformMatrix4fv(renderer->Program.UniformLocation[UNIFORM_MVP_MATRIX], 2, true,
-                              (float *) mvpMatrix));
-
-        GL(glUniform1f(renderer->Program.UniformLocation[UNIFORM_ALPHA], 2.0f));
+        // The intermediate FFR texture and the Vulkan output are already scaled back up
+        float contentScale =
+                renderer->enableFFR || renderer->vkStreamPass ? 1.f : renderer->contentScale;
+        if (renderer->Program.UniformLocation[UNIFORM_CONTENT_SCALE] >= 0 &&
+            contentScale != renderer->programContentScale) {
+            GL(glUniform1f(renderer->Program.UniformLocation[UNIFORM_CONTENT_SCALE],
+                           contentScale));
+            renderer->programContentScale = contentScale;
+        }
+        if (renderer->Program.UniformLocation[UNIFORM_FOVEATION_CENTER] >= 0 &&
+            !std::equal(renderer->foveationCenter, renderer->foveationCenter + 4,
+                        renderer->programFoveationCenter)) {
+            GL(glUniform4fv(renderer->Program.UniformLocation[UNIFORM_FOVEATION_CENTER], 1,
+                            renderer->foveationCenter));
+            std::copy_n(renderer->foveationCenter, 4, renderer->programFoveationCenter);
+        }
         GL(glActiveTexture(GL_TEXTURE0));
         if (renderer->enableFFR) {
             GL(glBindTexture(GL_TEXTURE_2D,
                              renderer->ffr->GetOutputTexture()->GetGLTexture()));
+        } else if (renderer->vkStreamPass) {
+            GL(glBindTexture(GL_TEXTURE_2D, renderer->vkStreamOutput != nullptr
+                                            ? renderer->vkStreamOutput->GetGLTexture() : 0));
         } else {
             GL(glBindTexture(GL_TEXTURE_EXTERNAL_OES, renderer->streamTexture->GetGLTexture()));
+            if (renderer->secondStreamTexture != nullptr) {
+                GL(glActiveTexture(GL_TEXTURE1));
+                GL(glBindTexture(GL_TEXTURE_EXTERNAL_OES,
+                                 renderer->secondStreamTexture->GetGLTexture()));
+            }
         }
 
         GL(glDrawElements(GL_TRIANGLES, renderer->Panel.IndexCount, GL_UNSIGNED_SHORT, NULL));
@@ -12,7 +12,10 @@
 #include "gltf_model.h"
 #include "utils.h"
 #include "ffr.h"
+#include "upscale.h"
 #include "vr_gui.h"
+#include "gpu_timer.h"
+#include "vk_stream_pass.h"
 
 
 // Must use EGLSyncKHR because the VrApi still supports OpenGL ES 2.0
@@ -36,15 +39,22 @@ void eglDestroy();
 //
 
 typedef struct {
+    int Width;
+    int Height;
     int TextureSwapChainLength;
     int TextureSwapChainIndex;
     ovrTextureSwapChain *ColorTextureSwapChain;
     std::vector<std::unique_ptr<gl_render_utils::Texture>> renderTargets;
     std::vector<std::unique_ptr<gl_render_utils::RenderState>> renderStates;
+    // Both eyes are the layers of array textures, rendered in a single pass with GL_OVR_multiview2.
+    // renderTargets and renderStates are then empty.
+    bool Multiview;
+    std::vector<GLuint> MultiviewFrameBuffers;
+    GLuint MultiviewDepthTexture;
 } ovrFramebuffer;
 
 bool ovrFramebuffer_Create(ovrFramebuffer *frameBuffer, const GLenum colorFormat, const int width,
-                           const int height);
+                           const int height, bool multiview);
 
 void ovrFramebuffer_Destroy(ovrFramebuffer *frameBuffer);
 
@@ -118,7 +128,8 @@ typedef struct {
 
 
 bool
-ovrProgram_Create(ovrProgram *program, const char *vertexSource, const char *fragmentSource);
+ovrProgram_Create(ovrProgram *program, const char *vertexSource, const char *fragmentSource,
+                  bool multiview);
 
 void ovrProgram_Destroy(ovrProgram *program);
 
@@ -129,22 +140,55 @@ void ovrProgram_Destroy(ovrProgram *program);
 
 typedef struct {
     ovrFramebuffer FrameBuffer[VRAPI_FRAME_LAYER_EYE_MAX];
+    // 1 in multiview mode, both eyes are then drawn at once by renderEye()
     int NumBuffers;
+    bool Multiview;
     bool SceneCreated;
     ovrProgram Program;
     ovrProgram ProgramLoading;
     ovrGeometry Panel;
     gl_render_utils::Texture *streamTexture;
+    // Right eye stream in dual stream mode, null otherwise
+    gl_render_utils::Texture *secondStreamTexture;
     GLuint LoadingTexture;
-    GltfModel *loadingScene;
+    // Kept across ovrRenderer_Create() calls, destroyed with the GL context
+    GltfModel *loadingScene = nullptr;
     std::unique_ptr<FFR> ffr;
     gl_render_utils::Texture *ffrSourceTexture;
+    // Intermediate decompression pass, off in single pass mode
     bool enableFFR;
+    // The decompression pass expands both eyes side by side into DirectFrameBuffer, which is
+    // submitted as is. The eye pass is then only used for the loading scene.
+    bool directLayer;
+    ovrFramebuffer DirectFrameBuffer;
+    // Eye shader doing the decompression, empty unless in single pass mode
+    std::string singlePassFFRShader;
+    // SampleStream() of the eye shader, see GetStreamSamplingFunction()
+    std::string streamSamplingFunction;
+    // Dynamic resolution scale of the frame to render, see NALParser::contentScale()
+    float contentScale;
+    // Foveation center of the frame to render, see NALParser::foveationCenter()
+    float foveationCenter[4];
+    // The center of the settings, for the frames without one
+    float staticFoveationCenter[4];
+    // Values of the per frame uniforms of Program, renderEye() only uploads the changed ones. NaN
+    // until the first upload.
+    float programContentScale;
+    float programFoveationCenter[4];
+    // GPU time of the passes of the stream frames, null if not supported
+    std::unique_ptr<GpuTimer> gpuTimer;
+    // Draws the decoded frames in Vulkan in place of sampling the stream textures, null if off or
+    // not supported
+    std::unique_ptr<VkStreamPass> vkStreamPass;
+    // Output of vkStreamPass for the frame to render, null until the streams have a frame
+    gl_render_utils::Texture *vkStreamOutput;
 } ovrRenderer;
 
 void ovrRenderer_Create(ovrRenderer *renderer, int width, int height,
-                        gl_render_utils::Texture *streamTexture, int LoadingTexture,
-                        FFRData ffrData);
+                        gl_render_utils::Texture *streamTexture,
+                        gl_render_utils::Texture *secondStreamTexture, int LoadingTexture,
+                        FFRData ffrData, UpscaleData upscale = {},
+                        bool vulkanStreamPass = false);
 
 void ovrRenderer_Destroy(ovrRenderer *renderer);
 
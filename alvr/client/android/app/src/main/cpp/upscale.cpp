@@ -0,0 +1,60 @@
+#include "upscale.h"
+
+#include "utils.h"
+
+using namespace std;
+
+namespace {
+    const string SAMPLE_STREAM_FORMAT = R"glsl(
+        lowp vec4 SampleStream(%s tex, highp vec2 uv) {
+            return texture(tex, uv);
+        }
+    )glsl";
+
+    // Bilinear taps of the center and the cross around it. The luma gradient of the cross gives
+    // the direction of the edge, two more taps half a texel along it replace the center in
+    // proportion to the edge contrast. The sharpening lobe is the strongest that keeps every
+    // channel within the range of the cross, as in FSR RCAS, so flat areas and noise are left
+    // alone and edges do not ring.
+    const string SAMPLE_STREAM_UPSCALE_FORMAT = R"glsl(
+        const highp vec2 SOURCE_TEXEL = vec2(%f, %f);
+        const mediump float SHARPNESS = %f;
+        const mediump vec3 LUMA = vec3(0.299, 0.587, 0.114);
+
+        lowp vec4 SampleStream(%s tex, highp vec2 uv) {
+            mediump vec4 center = texture(tex, uv);
+            mediump vec3 c = center.rgb;
+            mediump vec3 n = texture(tex, uv - vec2(0., SOURCE_TEXEL.y)).rgb;
+            mediump vec3 s = texture(tex, uv + vec2(0., SOURCE_TEXEL.y)).rgb;
+            mediump vec3 w = texture(tex, uv - vec2(SOURCE_TEXEL.x, 0.)).rgb;
+            mediump vec3 e = texture(tex, uv + vec2(SOURCE_TEXEL.x, 0.)).rgb;
+
+            mediump vec2 gradient = vec2(dot(e - w, LUMA), dot(s - n, LUMA));
+            mediump float contrast = length(gradient);
+            if (contrast > 1. / 64.) {
+                highp vec2 along = vec2(-gradient.y, gradient.x) / contrast * SOURCE_TEXEL * 0.5;
+                mediump vec3 edge = (texture(tex, uv + along).rgb + texture(tex, uv - along).rgb) * 0.5;
+                c = mix(c, edge, min(contrast * 4., 1.));
+            }
+
+            mediump vec3 lo = min(min(n, s), min(w, e));
+            mediump vec3 hi = max(max(n, s), max(w, e));
+            mediump vec3 hitMin = min(lo, c) / (4. * hi + 1. / 256.);
+            mediump vec3 hitMax = (1. - max(hi, c)) / (4. * lo - 4. - 1. / 256.);
+            mediump vec3 lobe3 = max(-hitMin, hitMax);
+            mediump float lobe = clamp(max(lobe3.r, max(lobe3.g, lobe3.b)), -0.1875, 0.) * SHARPNESS;
+
+            c = (lobe * (n + s + w + e) + c) / (4. * lobe + 1.);
+            return vec4(clamp(c, 0., 1.), center.a);
+        }
+    )glsl";
+}
+
+string GetStreamSamplingFunction(UpscaleData upscale, const char *samplerType,
+                                 uint32_t sourceWidth, uint32_t sourceHeight) {
+    if (!upscale.enabled) {
+        return string_format(SAMPLE_STREAM_FORMAT, samplerType);
+    }
+    return string_format(SAMPLE_STREAM_UPSCALE_FORMAT, 1.f / sourceWidth, 1.f / sourceHeight,
+                         upscale.sharpness, samplerType);
+}
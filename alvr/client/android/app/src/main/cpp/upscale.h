@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Upscaling of the stream to the resolution of the eye buffers, for a server encoding below the
+// display resolution
+struct UpscaleData {
+    bool enabled;
+    // Eye size the stream is upscaled to
+    uint32_t eyeWidth;
+    uint32_t eyeHeight;
+    // 0 is no sharpening, 1 the most
+    float sharpness;
+};
+
+// GLSL function `lowp vec4 SampleStream(<samplerType> tex, highp vec2 uv)` sampling a frame of
+// sourceWidth x sourceHeight texels, to be used in place of texture() by the shaders reading the
+// stream. Edges are interpolated along their direction instead of across it, then a contrast
+// limited sharpening restores the detail lost to the bilinear filter. Without upscaling it is a
+// plain texture() call.
+std::string GetStreamSamplingFunction(UpscaleData upscale, const char *samplerType,
+                                      uint32_t sourceWidth, uint32_t sourceHeight);
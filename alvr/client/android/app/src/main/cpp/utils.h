@@ -31,24 +31,6 @@ extern int gSocketLogLevel;
 
 static const int64_t USECS_IN_SEC = 1000 * 1000;
 
-const bool gEnableFrameLog = false;
-
-inline void FrameLog(uint64_t frameIndex, const char *format, ...)
-{
-    if (!gEnableFrameLog) {
-        return;
-    }
-
-    char buf[10000];
-
-    va_list args;
-    va_start(args, format);
-    vsnprintf(buf, sizeof(buf), format, args);
-    va_end(args);
-
-    __android_log_print(ANDROID_LOG_VERBOSE, "FrameTracking", "[Frame %lu] %s", frameIndex, buf);
-}
-
 //
 // GL Logging
 //
@@ -0,0 +1,1261 @@
+#include "vk_stream_pass.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dlfcn.h>
+#include <poll.h>
+#include <unistd.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include "asset.h"
+#include "utils.h"
+
+namespace {
+#define VK_GLOBAL_FUNCTIONS(X) \
+    X(vkCreateInstance) \
+    X(vkEnumerateInstanceVersion)
+
+#define VK_INSTANCE_FUNCTIONS(X) \
+    X(vkDestroyInstance) \
+    X(vkEnumeratePhysicalDevices) \
+    X(vkGetPhysicalDeviceProperties) \
+    X(vkGetPhysicalDeviceQueueFamilyProperties) \
+    X(vkGetPhysicalDeviceMemoryProperties) \
+    X(vkGetPhysicalDeviceExternalSemaphoreProperties) \
+    X(vkEnumerateDeviceExtensionProperties) \
+    X(vkCreateDevice) \
+    X(vkGetDeviceProcAddr)
+
+#define VK_DEVICE_FUNCTIONS(X) \
+    X(vkDestroyDevice) \
+    X(vkGetDeviceQueue) \
+    X(vkDeviceWaitIdle) \
+    X(vkQueueSubmit) \
+    X(vkCreateCommandPool) \
+    X(vkDestroyCommandPool) \
+    X(vkAllocateCommandBuffers) \
+    X(vkFreeCommandBuffers) \
+    X(vkBeginCommandBuffer) \
+    X(vkEndCommandBuffer) \
+    X(vkCmdPipelineBarrier) \
+    X(vkCmdBeginRenderPass) \
+    X(vkCmdEndRenderPass) \
+    X(vkCmdBindPipeline) \
+    X(vkCmdBindDescriptorSets) \
+    X(vkCmdDraw) \
+    X(vkCreateFence) \
+    X(vkDestroyFence) \
+    X(vkWaitForFences) \
+    X(vkResetFences) \
+    X(vkCreateSemaphore) \
+    X(vkDestroySemaphore) \
+    X(vkImportSemaphoreFdKHR) \
+    X(vkGetSemaphoreFdKHR) \
+    X(vkCreateImage) \
+    X(vkDestroyImage) \
+    X(vkCreateImageView) \
+    X(vkDestroyImageView) \
+    X(vkAllocateMemory) \
+    X(vkFreeMemory) \
+    X(vkBindImageMemory) \
+    X(vkMapMemory) \
+    X(vkUnmapMemory) \
+    X(vkCreateBuffer) \
+    X(vkDestroyBuffer) \
+    X(vkGetBufferMemoryRequirements) \
+    X(vkBindBufferMemory) \
+    X(vkGetAndroidHardwareBufferPropertiesANDROID) \
+    X(vkCreateSamplerYcbcrConversion) \
+    X(vkDestroySamplerYcbcrConversion) \
+    X(vkCreateSampler) \
+    X(vkDestroySampler) \
+    X(vkCreateDescriptorSetLayout) \
+    X(vkDestroyDescriptorSetLayout) \
+    X(vkCreateDescriptorPool) \
+    X(vkDestroyDescriptorPool) \
+    X(vkResetDescriptorPool) \
+    X(vkAllocateDescriptorSets) \
+    X(vkUpdateDescriptorSets) \
+    X(vkCreatePipelineLayout) \
+    X(vkDestroyPipelineLayout) \
+    X(vkCreateShaderModule) \
+    X(vkDestroyShaderModule) \
+    X(vkCreateGraphicsPipelines) \
+    X(vkDestroyPipeline) \
+    X(vkCreateRenderPass) \
+    X(vkDestroyRenderPass) \
+    X(vkCreateFramebuffer) \
+    X(vkDestroyFramebuffer)
+
+#define VK_DECLARE_FUNCTION(name) PFN_##name name = nullptr;
+    PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr = nullptr;
+    VK_GLOBAL_FUNCTIONS(VK_DECLARE_FUNCTION)
+    VK_INSTANCE_FUNCTIONS(VK_DECLARE_FUNCTION)
+    VK_DEVICE_FUNCTIONS(VK_DECLARE_FUNCTION)
+#undef VK_DECLARE_FUNCTION
+
+    const char *DEVICE_EXTENSIONS[] = {
+            VK_ANDROID_EXTERNAL_MEMORY_ANDROID_HARDWARE_BUFFER_EXTENSION_NAME,
+            VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME,
+            VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+    };
+
+    const char *VERTEX_SHADER_ASSET = "shaders/stream_pass.vert.spv";
+    const char *FRAGMENT_SHADER_ASSET = "shaders/stream_pass.frag.spv";
+
+    // CPU wait on a sync fd, only if the GPU cannot wait for it
+    const int FENCE_TIMEOUT_MS = 100;
+
+    // A Y'CbCr conversion may take up to 3 descriptors per sampled image
+    const uint32_t YCBCR_DESCRIPTORS_MAX = 3;
+
+    // The Go flavor still starts on API 21, without libvulkan, and the AHardwareBuffer functions
+    // need API 26, so both are looked up at runtime.
+    bool loadVulkan() {
+        static void *library = dlopen("libvulkan.so", RTLD_NOW | RTLD_LOCAL);
+        if (library == nullptr) {
+            return false;
+        }
+        if (vkGetInstanceProcAddr == nullptr) {
+            vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) dlsym(library, "vkGetInstanceProcAddr");
+        }
+        if (vkGetInstanceProcAddr == nullptr) {
+            return false;
+        }
+#define VK_LOAD_FUNCTION(name) name = (PFN_##name) vkGetInstanceProcAddr(nullptr, #name);
+        VK_GLOBAL_FUNCTIONS(VK_LOAD_FUNCTION)
+#undef VK_LOAD_FUNCTION
+        // vkEnumerateInstanceVersion is only in Vulkan 1.1 loaders
+        return vkCreateInstance != nullptr && vkEnumerateInstanceVersion != nullptr;
+    }
+
+    struct InteropApi {
+        int (*allocate)(const AHardwareBuffer_Desc *desc, AHardwareBuffer **buffer);
+        void (*acquire)(AHardwareBuffer *buffer);
+        void (*release)(AHardwareBuffer *buffer);
+        void (*describe)(const AHardwareBuffer *buffer, AHardwareBuffer_Desc *desc);
+
+        PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC getNativeClientBuffer;
+        PFNEGLCREATEIMAGEKHRPROC createImage;
+        PFNEGLDESTROYIMAGEKHRPROC destroyImage;
+        PFNEGLCREATESYNCKHRPROC createSync;
+        PFNEGLDESTROYSYNCKHRPROC destroySync;
+        PFNEGLWAITSYNCKHRPROC waitSync;
+        PFNEGLDUPNATIVEFENCEFDANDROIDPROC dupNativeFenceFd;
+        PFNGLEGLIMAGETARGETTEXTURE2DOESPROC imageTargetTexture;
+
+        bool loaded = false;
+
+        InteropApi() {
+            void *android = dlopen("libandroid.so", RTLD_NOW);
+            if (android == nullptr) {
+                return;
+            }
+            allocate = (decltype(allocate)) dlsym(android, "AHardwareBuffer_allocate");
+            acquire = (decltype(acquire)) dlsym(android, "AHardwareBuffer_acquire");
+            release = (decltype(release)) dlsym(android, "AHardwareBuffer_release");
+            describe = (decltype(describe)) dlsym(android, "AHardwareBuffer_describe");
+
+            getNativeClientBuffer = (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC) eglGetProcAddress("eglGetNativeClientBufferANDROID");
+            createImage = (PFNEGLCREATEIMAGEKHRPROC) eglGetProcAddress("eglCreateImageKHR");
+            destroyImage = (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress("eglDestroyImageKHR");
+            createSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+            destroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+            waitSync = (PFNEGLWAITSYNCKHRPROC) eglGetProcAddress("eglWaitSyncKHR");
+            dupNativeFenceFd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC) eglGetProcAddress("eglDupNativeFenceFDANDROID");
+            imageTargetTexture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC) eglGetProcAddress("glEGLImageTargetTexture2DOES");
+
+            loaded = allocate && acquire && release && describe && getNativeClientBuffer &&
+                     createImage && destroyImage && createSync && destroySync && waitSync &&
+                     dupNativeFenceFd && imageTargetTexture;
+        }
+    };
+
+    const InteropApi &interopApi() {
+        static InteropApi api;
+        return api;
+    }
+
+    void waitFenceFd(int fd) {
+        pollfd fence = {fd, POLLIN, 0};
+        poll(&fence, 1, FENCE_TIMEOUT_MS);
+        close(fd);
+    }
+
+    VkStreamPass *g_currentPass = nullptr;
+}
+
+std::unique_ptr<VkStreamPass> VkStreamPass::Create(uint32_t width, uint32_t height, bool dualStream) {
+    if (!interopApi().loaded || !loadVulkan()) {
+        LOGI("Vulkan 1.1 or the AHardwareBuffer interop is not available, the stream pass stays in GL.");
+        return nullptr;
+    }
+    std::unique_ptr<VkStreamPass> pass(new VkStreamPass(width, height, dualStream));
+    if (!pass->initialize()) {
+        LOGE("Failed to create the Vulkan stream pass, the stream pass stays in GL.");
+        return nullptr;
+    }
+    return pass;
+}
+
+VkStreamPass::VkStreamPass(uint32_t width, uint32_t height, bool dualStream)
+        : m_width(width), m_height(height), m_dualStream(dualStream) {
+    for (auto &output : m_outputs) {
+        output.glFenceFd = -1;
+    }
+}
+
+VkStreamPass::~VkStreamPass() {
+    if (g_currentPass == this) {
+        g_currentPass = nullptr;
+    }
+    if (m_device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(m_device);
+        clearFrames(false);
+        destroyPipeline();
+        for (auto &output : m_outputs) {
+            destroyOutput(output);
+        }
+        vkDestroyShaderModule(m_device, m_vertexShader, nullptr);
+        vkDestroyShaderModule(m_device, m_fragmentShader, nullptr);
+        vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+        vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+        vkDestroyDevice(m_device, nullptr);
+    }
+    if (m_instance != VK_NULL_HANDLE) {
+        vkDestroyInstance(m_instance, nullptr);
+    }
+}
+
+VkStreamPass *VkStreamPass::getCurrent() {
+    return g_currentPass;
+}
+
+void VkStreamPass::setCurrent(VkStreamPass *pass) {
+    g_currentPass = pass;
+}
+
+bool VkStreamPass::initialize() {
+    uint32_t instanceVersion = 0;
+    vkEnumerateInstanceVersion(&instanceVersion);
+    if (instanceVersion < VK_API_VERSION_1_1) {
+        LOGI("Vulkan instance version %u.%u, 1.1 is needed.", VK_VERSION_MAJOR(instanceVersion),
+             VK_VERSION_MINOR(instanceVersion));
+        return false;
+    }
+
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "ALVR";
+    appInfo.apiVersion = VK_API_VERSION_1_1;
+    VkInstanceCreateInfo instanceInfo = {};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+    if (vkCreateInstance(&instanceInfo, nullptr, &m_instance) != VK_SUCCESS) {
+        m_instance = VK_NULL_HANDLE;
+        return false;
+    }
+    bool loaded = true;
+#define VK_LOAD_FUNCTION(name) \
+    name = (PFN_##name) vkGetInstanceProcAddr(m_instance, #name); \
+    loaded = loaded && name != nullptr;
+    VK_INSTANCE_FUNCTIONS(VK_LOAD_FUNCTION)
+#undef VK_LOAD_FUNCTION
+    if (!loaded) {
+        return false;
+    }
+
+    // The first device with the extensions and a graphics queue, there is a single one on the
+    // standalone headsets
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
+    for (VkPhysicalDevice device : devices) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+        if (properties.apiVersion < VK_API_VERSION_1_1) {
+            continue;
+        }
+
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+        bool hasExtensions = true;
+        for (const char *name : DEVICE_EXTENSIONS) {
+            hasExtensions = hasExtensions &&
+                            std::any_of(extensions.begin(), extensions.end(),
+                                        [&](const VkExtensionProperties &extension) {
+                                            return strcmp(extension.extensionName, name) == 0;
+                                        });
+        }
+        if (!hasExtensions) {
+            continue;
+        }
+
+        VkPhysicalDeviceExternalSemaphoreInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+        semaphoreInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+        VkExternalSemaphoreProperties semaphoreProperties = {};
+        semaphoreProperties.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+        vkGetPhysicalDeviceExternalSemaphoreProperties(device, &semaphoreInfo, &semaphoreProperties);
+        const VkExternalSemaphoreFeatureFlags syncFdFeatures =
+                VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT |
+                VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT;
+        if ((semaphoreProperties.externalSemaphoreFeatures & syncFdFeatures) != syncFdFeatures) {
+            continue;
+        }
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+        for (uint32_t i = 0; i < familyCount; i++) {
+            if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                m_physicalDevice = device;
+                m_queueFamily = i;
+                break;
+            }
+        }
+        if (m_physicalDevice != VK_NULL_HANDLE) {
+            LOGI("Vulkan stream pass on %s.", properties.deviceName);
+            break;
+        }
+    }
+    if (m_physicalDevice == VK_NULL_HANDLE) {
+        LOGI("No Vulkan device with the AHardwareBuffer and sync fd interop.");
+        return false;
+    }
+
+    float queuePriority = 1.f;
+    VkDeviceQueueCreateInfo queueInfo = {};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = m_queueFamily;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &queuePriority;
+    // Needed by the AHardwareBuffer extension, for the decoder formats
+    VkPhysicalDeviceSamplerYcbcrConversionFeatures ycbcrFeatures = {};
+    ycbcrFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SAMPLER_YCBCR_CONVERSION_FEATURES;
+    ycbcrFeatures.samplerYcbcrConversion = VK_TRUE;
+    VkDeviceCreateInfo deviceInfo = {};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = &ycbcrFeatures;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos = &queueInfo;
+    deviceInfo.enabledExtensionCount = sizeof(DEVICE_EXTENSIONS) / sizeof(DEVICE_EXTENSIONS[0]);
+    deviceInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS;
+    if (vkCreateDevice(m_physicalDevice, &deviceInfo, nullptr, &m_device) != VK_SUCCESS) {
+        m_device = VK_NULL_HANDLE;
+        return false;
+    }
+#define VK_LOAD_FUNCTION(name) \
+    name = (PFN_##name) vkGetDeviceProcAddr(m_device, #name); \
+    loaded = loaded && name != nullptr;
+    VK_DEVICE_FUNCTIONS(VK_LOAD_FUNCTION)
+#undef VK_LOAD_FUNCTION
+    if (!loaded) {
+        // The destructor needs the device functions
+        vkDestroyDevice = (PFN_vkDestroyDevice) vkGetDeviceProcAddr(m_device, "vkDestroyDevice");
+        vkDestroyDevice(m_device, nullptr);
+        m_device = VK_NULL_HANDLE;
+        return false;
+    }
+    vkGetDeviceQueue(m_device, m_queueFamily, 0, &m_queue);
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = m_queueFamily;
+    if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+        return false;
+    }
+
+    // The quad covers the whole output, its previous content is not loaded
+    VkAttachmentDescription attachment = {};
+    attachment.format = VK_FORMAT_R8G8B8A8_UNORM;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference colorReference = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    if (vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
+        return false;
+    }
+
+    // Compiled from src/main/shaders by the build
+    std::vector<unsigned char> code;
+    VkShaderModuleCreateInfo shaderInfo = {};
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    if (!loadAsset(VERTEX_SHADER_ASSET, code)) {
+        LOGE("Failed to load %s.", VERTEX_SHADER_ASSET);
+        return false;
+    }
+    shaderInfo.codeSize = code.size();
+    shaderInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+    if (vkCreateShaderModule(m_device, &shaderInfo, nullptr, &m_vertexShader) != VK_SUCCESS) {
+        return false;
+    }
+    if (!loadAsset(FRAGMENT_SHADER_ASSET, code)) {
+        LOGE("Failed to load %s.", FRAGMENT_SHADER_ASSET);
+        return false;
+    }
+    shaderInfo.codeSize = code.size();
+    shaderInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+    if (vkCreateShaderModule(m_device, &shaderInfo, nullptr, &m_fragmentShader) != VK_SUCCESS) {
+        return false;
+    }
+
+    for (auto &output : m_outputs) {
+        if (!createOutput(output)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VkStreamPass::createOutput(Output &output) {
+    const auto &api = interopApi();
+
+    AHardwareBuffer_Desc desc = {};
+    desc.width = m_width;
+    desc.height = m_height;
+    desc.layers = 1;
+    desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+    desc.usage = AHARDWAREBUFFER_USAGE_GPU_COLOR_OUTPUT | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+    if (api.allocate(&desc, &output.buffer) != 0) {
+        output.buffer = nullptr;
+        LOGE("Failed to allocate the stream pass output %ux%u.", m_width, m_height);
+        return false;
+    }
+
+    VkAndroidHardwareBufferPropertiesANDROID bufferProperties = {};
+    bufferProperties.sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_PROPERTIES_ANDROID;
+    if (vkGetAndroidHardwareBufferPropertiesANDROID(m_device, output.buffer, &bufferProperties) !=
+        VK_SUCCESS) {
+        return false;
+    }
+
+    VkExternalMemoryImageCreateInfo externalInfo = {};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_ANDROID_HARDWARE_BUFFER_BIT_ANDROID;
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.pNext = &externalInfo;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent = {m_width, m_height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(m_device, &imageInfo, nullptr, &output.image) != VK_SUCCESS) {
+        output.image = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkImportAndroidHardwareBufferInfoANDROID importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_ANDROID_HARDWARE_BUFFER_INFO_ANDROID;
+    importInfo.buffer = output.buffer;
+    VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.pNext = &importInfo;
+    dedicatedInfo.image = output.image;
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext = &dedicatedInfo;
+    allocateInfo.allocationSize = bufferProperties.allocationSize;
+    if (!findMemoryType(bufferProperties.memoryTypeBits, 0, &allocateInfo.memoryTypeIndex) ||
+        vkAllocateMemory(m_device, &allocateInfo, nullptr, &output.memory) != VK_SUCCESS ||
+        vkBindImageMemory(m_device, output.image, output.memory, 0) != VK_SUCCESS) {
+        return false;
+    }
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = output.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    if (vkCreateImageView(m_device, &viewInfo, nullptr, &output.view) != VK_SUCCESS) {
+        output.view = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = m_renderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &output.view;
+    framebufferInfo.width = m_width;
+    framebufferInfo.height = m_height;
+    framebufferInfo.layers = 1;
+    if (vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &output.framebuffer) !=
+        VK_SUCCESS) {
+        output.framebuffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    // The uniform block of the fragment shader, std140
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = 4 * sizeof(float);
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &output.uniformBuffer) != VK_SUCCESS) {
+        output.uniformBuffer = VK_NULL_HANDLE;
+        return false;
+    }
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(m_device, output.uniformBuffer, &requirements);
+    allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = requirements.size;
+    void *mapped = nullptr;
+    if (!findMemoryType(requirements.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        &allocateInfo.memoryTypeIndex) ||
+        vkAllocateMemory(m_device, &allocateInfo, nullptr, &output.uniformMemory) != VK_SUCCESS ||
+        vkBindBufferMemory(m_device, output.uniformBuffer, output.uniformMemory, 0) != VK_SUCCESS ||
+        vkMapMemory(m_device, output.uniformMemory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+        return false;
+    }
+    output.contentScale = static_cast<float *>(mapped);
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(m_device, &fenceInfo, nullptr, &output.fence) != VK_SUCCESS) {
+        output.fence = VK_NULL_HANDLE;
+        return false;
+    }
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (auto &semaphore : output.acquireSemaphores) {
+        if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+            semaphore = VK_NULL_HANDLE;
+            return false;
+        }
+    }
+    if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &output.glSemaphore) != VK_SUCCESS) {
+        output.glSemaphore = VK_NULL_HANDLE;
+        return false;
+    }
+    VkExportSemaphoreCreateInfo exportInfo = {};
+    exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+    exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+    semaphoreInfo.pNext = &exportInfo;
+    if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &output.readySemaphore) !=
+        VK_SUCCESS) {
+        output.readySemaphore = VK_NULL_HANDLE;
+        return false;
+    }
+    if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &output.releaseSemaphore) !=
+        VK_SUCCESS) {
+        output.releaseSemaphore = VK_NULL_HANDLE;
+        return false;
+    }
+
+    // The GL side samples the same buffer as a 2D texture
+    EGLDisplay display = eglGetCurrentDisplay();
+    const EGLint imageAttribs[] = {EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE};
+    output.eglImage = api.createImage(display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID,
+                                      api.getNativeClientBuffer(output.buffer), imageAttribs);
+    if (output.eglImage == EGL_NO_IMAGE_KHR) {
+        LOGE("Failed to import the stream pass output in GL. error=%d", eglGetError());
+        return false;
+    }
+    output.texture = std::make_unique<gl_render_utils::Texture>(false);
+    GL(glBindTexture(GL_TEXTURE_2D, output.texture->GetGLTexture()));
+    api.imageTargetTexture(GL_TEXTURE_2D, (GLeglImageOES) output.eglImage);
+    GL(glBindTexture(GL_TEXTURE_2D, 0));
+    return true;
+}
+
+void VkStreamPass::destroyOutput(Output &output) {
+    const auto &api = interopApi();
+
+    output.texture.reset();
+    if (output.eglImage != EGL_NO_IMAGE_KHR) {
+        api.destroyImage(eglGetCurrentDisplay(), output.eglImage);
+        output.eglImage = EGL_NO_IMAGE_KHR;
+    }
+    if (output.glFenceFd >= 0) {
+        close(output.glFenceFd);
+        output.glFenceFd = -1;
+    }
+    vkDestroySemaphore(m_device, output.releaseSemaphore, nullptr);
+    vkDestroySemaphore(m_device, output.readySemaphore, nullptr);
+    vkDestroySemaphore(m_device, output.glSemaphore, nullptr);
+    for (auto &semaphore : output.acquireSemaphores) {
+        vkDestroySemaphore(m_device, semaphore, nullptr);
+    }
+    vkDestroyFence(m_device, output.fence, nullptr);
+    if (output.contentScale != nullptr) {
+        vkUnmapMemory(m_device, output.uniformMemory);
+        output.contentScale = nullptr;
+    }
+    vkDestroyBuffer(m_device, output.uniformBuffer, nullptr);
+    vkFreeMemory(m_device, output.uniformMemory, nullptr);
+    vkDestroyFramebuffer(m_device, output.framebuffer, nullptr);
+    vkDestroyImageView(m_device, output.view, nullptr);
+    vkDestroyImage(m_device, output.image, nullptr);
+    vkFreeMemory(m_device, output.memory, nullptr);
+    if (output.buffer != nullptr) {
+        api.release(output.buffer);
+        output.buffer = nullptr;
+    }
+}
+
+bool VkStreamPass::createPipeline(const VkAndroidHardwareBufferFormatPropertiesANDROID &format) {
+    m_externalFormat = format.externalFormat;
+    m_frameFormat = format.format;
+
+    // The decoder formats are opaque, the driver tells how to convert them
+    VkExternalFormatANDROID externalFormat = {};
+    externalFormat.sType = VK_STRUCTURE_TYPE_EXTERNAL_FORMAT_ANDROID;
+    externalFormat.externalFormat = format.externalFormat;
+    VkFilter filter = (format.formatFeatures &
+                       VK_FORMAT_FEATURE_SAMPLED_IMAGE_YCBCR_CONVERSION_LINEAR_FILTER_BIT)
+                      ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+    VkSamplerYcbcrConversionCreateInfo conversionInfo = {};
+    conversionInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO;
+    conversionInfo.pNext = format.externalFormat != 0 ? &externalFormat : nullptr;
+    conversionInfo.format = format.externalFormat != 0 ? VK_FORMAT_UNDEFINED : format.format;
+    conversionInfo.ycbcrModel = format.suggestedYcbcrModel;
+    conversionInfo.ycbcrRange = format.suggestedYcbcrRange;
+    conversionInfo.components = format.samplerYcbcrConversionComponents;
+    conversionInfo.xChromaOffset = format.suggestedXChromaOffset;
+    conversionInfo.yChromaOffset = format.suggestedYChromaOffset;
+    conversionInfo.chromaFilter = filter;
+    if (vkCreateSamplerYcbcrConversion(m_device, &conversionInfo, nullptr, &m_conversion) !=
+        VK_SUCCESS) {
+        m_conversion = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkSamplerYcbcrConversionInfo samplerConversion = {};
+    samplerConversion.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO;
+    samplerConversion.conversion = m_conversion;
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.pNext = &samplerConversion;
+    // Without separate reconstruction filter support, the filters must be the chroma filter
+    samplerInfo.magFilter = filter;
+    samplerInfo.minFilter = filter;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    if (vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler) != VK_SUCCESS) {
+        m_sampler = VK_NULL_HANDLE;
+        return false;
+    }
+
+    // Y'CbCr samplers can only be immutable
+    VkDescriptorSetLayoutBinding bindings[3] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].pImmutableSamplers = &m_sampler;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[2] = bindings[0];
+    bindings[2].binding = 2;
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 3;
+    layoutInfo.pBindings = bindings;
+    if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout) !=
+        VK_SUCCESS) {
+        m_descriptorSetLayout = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkDescriptorPoolSize poolSizes[2] = {
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+             (uint32_t) MAX_COMMAND_BUFFERS * 2 * YCBCR_DESCRIPTORS_MAX},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, (uint32_t) MAX_COMMAND_BUFFERS},
+    };
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = MAX_COMMAND_BUFFERS;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool) != VK_SUCCESS) {
+        m_descriptorPool = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+    if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) !=
+        VK_SUCCESS) {
+        m_pipelineLayout = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkBool32 dualStream = m_dualStream ? VK_TRUE : VK_FALSE;
+    VkSpecializationMapEntry specializationEntry = {0, 0, sizeof(VkBool32)};
+    VkSpecializationInfo specialization = {1, &specializationEntry, sizeof(VkBool32), &dualStream};
+    VkPipelineShaderStageCreateInfo stages[2] = {};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = m_vertexShader;
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = m_fragmentShader;
+    stages[1].pName = "main";
+    stages[1].pSpecializationInfo = &specialization;
+
+    VkPipelineVertexInputStateCreateInfo vertexInput = {};
+    vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+    VkViewport viewport = {0.f, 0.f, (float) m_width, (float) m_height, 0.f, 1.f};
+    VkRect2D scissor = {{0, 0}, {m_width, m_height}};
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+    VkPipelineRasterizationStateCreateInfo rasterization = {};
+    rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterization.cullMode = VK_CULL_MODE_NONE;
+    rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterization.lineWidth = 1.f;
+    VkPipelineMultisampleStateCreateInfo multisample = {};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkPipelineColorBlendAttachmentState blendAttachment = {};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                     VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo colorBlend = {};
+    colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlend.attachmentCount = 1;
+    colorBlend.pAttachments = &blendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = stages;
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterization;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pColorBlendState = &colorBlend;
+    pipelineInfo.layout = m_pipelineLayout;
+    pipelineInfo.renderPass = m_renderPass;
+    if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                  &m_pipeline) != VK_SUCCESS) {
+        m_pipeline = VK_NULL_HANDLE;
+        return false;
+    }
+    return true;
+}
+
+void VkStreamPass::destroyPipeline() {
+    vkDestroyPipeline(m_device, m_pipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+    vkDestroySampler(m_device, m_sampler, nullptr);
+    vkDestroySamplerYcbcrConversion(m_device, m_conversion, nullptr);
+    m_pipeline = VK_NULL_HANDLE;
+    m_pipelineLayout = VK_NULL_HANDLE;
+    m_descriptorPool = VK_NULL_HANDLE;
+    m_descriptorSetLayout = VK_NULL_HANDLE;
+    m_sampler = VK_NULL_HANDLE;
+    m_conversion = VK_NULL_HANDLE;
+    m_externalFormat = 0;
+    m_frameFormat = VK_FORMAT_UNDEFINED;
+}
+
+const VkStreamPass::FrameImport *VkStreamPass::importFrame(AHardwareBuffer *buffer) {
+    const auto &api = interopApi();
+
+    for (const auto &frame : m_frameImports) {
+        if (frame->buffer == buffer) {
+            return frame.get();
+        }
+    }
+
+    VkAndroidHardwareBufferFormatPropertiesANDROID formatProperties = {};
+    formatProperties.sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_FORMAT_PROPERTIES_ANDROID;
+    VkAndroidHardwareBufferPropertiesANDROID bufferProperties = {};
+    bufferProperties.sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_PROPERTIES_ANDROID;
+    bufferProperties.pNext = &formatProperties;
+    if (vkGetAndroidHardwareBufferPropertiesANDROID(m_device, buffer, &bufferProperties) !=
+        VK_SUCCESS) {
+        return nullptr;
+    }
+    if (m_pipeline != VK_NULL_HANDLE && (formatProperties.externalFormat != m_externalFormat ||
+                                         formatProperties.format != m_frameFormat)) {
+        // A new codec, the conversion is baked into the pipeline
+        clearFrames(false);
+        destroyPipeline();
+    }
+    if (m_pipeline == VK_NULL_HANDLE && !createPipeline(formatProperties)) {
+        LOGE("Failed to create the pipeline of the Vulkan stream pass.");
+        destroyPipeline();
+        return nullptr;
+    }
+    if (m_frameImports.size() >= MAX_FRAME_IMPORTS) {
+        clearFrames(true);
+    }
+
+    AHardwareBuffer_Desc desc;
+    api.describe(buffer, &desc);
+
+    auto frame = std::make_unique<FrameImport>();
+    frame->buffer = buffer;
+    frame->memory = VK_NULL_HANDLE;
+    frame->image = VK_NULL_HANDLE;
+    frame->view = VK_NULL_HANDLE;
+
+    VkExternalFormatANDROID externalFormat = {};
+    externalFormat.sType = VK_STRUCTURE_TYPE_EXTERNAL_FORMAT_ANDROID;
+    externalFormat.externalFormat = formatProperties.externalFormat;
+    VkExternalMemoryImageCreateInfo externalInfo = {};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    externalInfo.pNext = &externalFormat;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_ANDROID_HARDWARE_BUFFER_BIT_ANDROID;
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.pNext = &externalInfo;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = formatProperties.externalFormat != 0 ? VK_FORMAT_UNDEFINED
+                                                            : formatProperties.format;
+    imageInfo.extent = {desc.width, desc.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImportAndroidHardwareBufferInfoANDROID importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_ANDROID_HARDWARE_BUFFER_INFO_ANDROID;
+    importInfo.buffer = buffer;
+    VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.pNext = &importInfo;
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext = &dedicatedInfo;
+    allocateInfo.allocationSize = bufferProperties.allocationSize;
+    VkSamplerYcbcrConversionInfo viewConversion = {};
+    viewConversion.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO;
+    viewConversion.conversion = m_conversion;
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.pNext = &viewConversion;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    bool imported = vkCreateImage(m_device, &imageInfo, nullptr, &frame->image) == VK_SUCCESS;
+    if (imported) {
+        dedicatedInfo.image = frame->image;
+        viewInfo.image = frame->image;
+        imported = findMemoryType(bufferProperties.memoryTypeBits, 0,
+                                  &allocateInfo.memoryTypeIndex) &&
+                   vkAllocateMemory(m_device, &allocateInfo, nullptr, &frame->memory) ==
+                   VK_SUCCESS &&
+                   vkBindImageMemory(m_device, frame->image, frame->memory, 0) == VK_SUCCESS &&
+                   vkCreateImageView(m_device, &viewInfo, nullptr, &frame->view) == VK_SUCCESS;
+    }
+    if (!imported) {
+        LOGE("Failed to import a decoder image in Vulkan.");
+        vkDestroyImage(m_device, frame->image, nullptr);
+        vkFreeMemory(m_device, frame->memory, nullptr);
+        return nullptr;
+    }
+
+    // Keeps the buffer, and so the pointer it is found with, until the import is dropped
+    api.acquire(buffer);
+    m_frameImports.push_back(std::move(frame));
+    return m_frameImports.back().get();
+}
+
+void VkStreamPass::clearFrames(bool keepStreams) {
+    const auto &api = interopApi();
+
+    vkDeviceWaitIdle(m_device);
+
+    for (auto &stream : m_streams) {
+        // Nothing samples the frames anymore
+        if (stream.releaseFenceFd >= 0) {
+            close(stream.releaseFenceFd);
+            stream.releaseFenceFd = -1;
+        }
+        if (!keepStreams) {
+            if (stream.acquireFenceFd >= 0) {
+                close(stream.acquireFenceFd);
+                stream.acquireFenceFd = -1;
+            }
+            stream.frame = nullptr;
+        }
+    }
+
+    for (const auto &commandBuffer : m_commandBuffers) {
+        vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer.commandBuffer);
+    }
+    m_commandBuffers.clear();
+    if (m_descriptorPool != VK_NULL_HANDLE) {
+        vkResetDescriptorPool(m_device, m_descriptorPool, 0);
+    }
+
+    auto kept = std::remove_if(m_frameImports.begin(), m_frameImports.end(),
+                               [&](const std::unique_ptr<FrameImport> &frame) {
+                                   for (const auto &stream : m_streams) {
+                                       if (stream.frame == frame.get()) {
+                                           return false;
+                                       }
+                                   }
+                                   vkDestroyImageView(m_device, frame->view, nullptr);
+                                   vkDestroyImage(m_device, frame->image, nullptr);
+                                   vkFreeMemory(m_device, frame->memory, nullptr);
+                                   api.release(frame->buffer);
+                                   return true;
+                               });
+    m_frameImports.erase(kept, m_frameImports.end());
+}
+
+VkCommandBuffer VkStreamPass::getCommandBuffer(int outputIndex) {
+    const FrameImport *frames[MAX_STREAMS] = {m_streams[0].frame,
+                                              m_dualStream ? m_streams[1].frame
+                                                           : m_streams[0].frame};
+    for (const auto &commandBuffer : m_commandBuffers) {
+        if (commandBuffer.output == outputIndex && commandBuffer.frames[0] == frames[0] &&
+            commandBuffer.frames[1] == frames[1]) {
+            return commandBuffer.commandBuffer;
+        }
+    }
+    if (m_commandBuffers.size() >= MAX_COMMAND_BUFFERS) {
+        clearFrames(true);
+    }
+    const Output &output = m_outputs[outputIndex];
+
+    CommandBuffer entry = {outputIndex, {frames[0], frames[1]}, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    VkDescriptorSetAllocateInfo setInfo = {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setInfo.descriptorPool = m_descriptorPool;
+    setInfo.descriptorSetCount = 1;
+    setInfo.pSetLayouts = &m_descriptorSetLayout;
+    if (vkAllocateDescriptorSets(m_device, &setInfo, &entry.descriptorSet) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    VkDescriptorImageInfo imageInfos[MAX_STREAMS] = {
+            {VK_NULL_HANDLE, frames[0]->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            {VK_NULL_HANDLE, frames[1]->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+    };
+    VkDescriptorBufferInfo bufferInfo = {output.uniformBuffer, 0, VK_WHOLE_SIZE};
+    VkWriteDescriptorSet writes[3] = {};
+    for (int i = 0; i < 3; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = entry.descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].pImageInfo = &imageInfos[0];
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[1].pBufferInfo = &bufferInfo;
+    writes[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[2].pImageInfo = &imageInfos[1];
+    vkUpdateDescriptorSets(m_device, 3, writes, 0, nullptr);
+
+    VkCommandBufferAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = m_commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(m_device, &allocateInfo, &entry.commandBuffer) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    VkCommandBuffer cmd = entry.commandBuffer;
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    // The buffers are shared with the codec and GL, they are acquired from the foreign queue
+    // family and released back to it. The acquires are in the stages the semaphores wait in.
+    int frameCount = frames[0] == frames[1] ? 1 : 2;
+    VkImageMemoryBarrier frameBarriers[MAX_STREAMS] = {};
+    for (int i = 0; i < frameCount; i++) {
+        frameBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        frameBarriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        frameBarriers[i].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        frameBarriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        frameBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+        frameBarriers[i].dstQueueFamilyIndex = m_queueFamily;
+        frameBarriers[i].image = frames[i]->image;
+        frameBarriers[i].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+                         frameCount, frameBarriers);
+    VkImageMemoryBarrier outputBarrier = {};
+    outputBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    outputBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    outputBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    outputBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    outputBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+    outputBarrier.dstQueueFamilyIndex = m_queueFamily;
+    outputBarrier.image = output.image;
+    outputBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr,
+                         1, &outputBarrier);
+
+    VkRenderPassBeginInfo renderPassBegin = {};
+    renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBegin.renderPass = m_renderPass;
+    renderPassBegin.framebuffer = output.framebuffer;
+    renderPassBegin.renderArea = {{0, 0}, {m_width, m_height}};
+    vkCmdBeginRenderPass(cmd, &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+                            &entry.descriptorSet, 0, nullptr);
+    vkCmdDraw(cmd, 4, 1, 0, 0);
+    vkCmdEndRenderPass(cmd);
+
+    outputBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    outputBarrier.dstAccessMask = 0;
+    outputBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    outputBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    outputBarrier.srcQueueFamilyIndex = m_queueFamily;
+    outputBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &outputBarrier);
+    for (int i = 0; i < frameCount; i++) {
+        frameBarriers[i].dstAccessMask = 0;
+        frameBarriers[i].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        frameBarriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        frameBarriers[i].srcQueueFamilyIndex = m_queueFamily;
+        frameBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+                         frameCount, frameBarriers);
+
+    if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+        vkFreeCommandBuffers(m_device, m_commandPool, 1, &cmd);
+        return VK_NULL_HANDLE;
+    }
+    m_commandBuffers.push_back(entry);
+    return cmd;
+}
+
+bool VkStreamPass::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties,
+                                  uint32_t *typeIndex) const {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memoryProperties);
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            *typeIndex = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VkStreamPass::importSemaphore(VkSemaphore semaphore, int fd) {
+    VkImportSemaphoreFdInfoKHR importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+    importInfo.semaphore = semaphore;
+    importInfo.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT;
+    importInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+    importInfo.fd = fd;
+    if (vkImportSemaphoreFdKHR(m_device, &importInfo) == VK_SUCCESS) {
+        // Vulkan owns the fd now
+        return true;
+    }
+    waitFenceFd(fd);
+    return false;
+}
+
+bool VkStreamPass::SetFrame(int stream, AHardwareBuffer *buffer, int acquireFenceFd,
+                            int *releaseFenceFd) {
+    if (stream < 0 || stream >= (m_dualStream ? 2 : 1)) {
+        return false;
+    }
+    const FrameImport *frame = importFrame(buffer);
+    if (frame == nullptr) {
+        return false;
+    }
+    Stream &current = m_streams[stream];
+    *releaseFenceFd = current.releaseFenceFd;
+    current.releaseFenceFd = -1;
+    if (current.acquireFenceFd >= 0) {
+        // The previous frame was replaced before it was drawn
+        close(current.acquireFenceFd);
+    }
+    current.frame = frame;
+    current.acquireFenceFd = acquireFenceFd;
+    return true;
+}
+
+gl_render_utils::Texture *VkStreamPass::Render(float contentScale) {
+    const auto &api = interopApi();
+
+    const int streamCount = m_dualStream ? 2 : 1;
+    for (int i = 0; i < streamCount; i++) {
+        if (m_streams[i].frame == nullptr) {
+            return nullptr;
+        }
+    }
+
+    int outputIndex = (m_currentOutput + 1) % OUTPUT_COUNT;
+    Output &output = m_outputs[outputIndex];
+    if (output.submitted) {
+        // Submitted OUTPUT_COUNT frames ago, it is normally done
+        if (vkWaitForFences(m_device, 1, &output.fence, VK_TRUE, OUTPUT_TIMEOUT_NS) != VK_SUCCESS) {
+            LOGE("Vulkan stream pass output still in use, the frame is skipped.");
+            return m_currentOutput >= 0 ? m_outputs[m_currentOutput].texture.get() : nullptr;
+        }
+        vkResetFences(m_device, 1, &output.fence);
+        output.submitted = false;
+    }
+
+    VkCommandBuffer commandBuffer = getCommandBuffer(outputIndex);
+    if (commandBuffer == VK_NULL_HANDLE) {
+        LOGE("Failed to record the Vulkan stream pass.");
+        return nullptr;
+    }
+    // The command buffer is pre-recorded, only the uniform block changes
+    *output.contentScale = contentScale;
+
+    VkSemaphore waitSemaphores[MAX_STREAMS + 1];
+    VkPipelineStageFlags waitStages[MAX_STREAMS + 1];
+    uint32_t waitCount = 0;
+    for (int i = 0; i < streamCount; i++) {
+        Stream &stream = m_streams[i];
+        if (stream.acquireFenceFd >= 0 &&
+            importSemaphore(output.acquireSemaphores[i], stream.acquireFenceFd)) {
+            waitSemaphores[waitCount] = output.acquireSemaphores[i];
+            waitStages[waitCount] = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            waitCount++;
+        }
+        stream.acquireFenceFd = -1;
+    }
+    if (output.glFenceFd >= 0 && importSemaphore(output.glSemaphore, output.glFenceFd)) {
+        waitSemaphores[waitCount] = output.glSemaphore;
+        waitStages[waitCount] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        waitCount++;
+    }
+    output.glFenceFd = -1;
+
+    VkSemaphore signalSemaphores[] = {output.readySemaphore, output.releaseSemaphore};
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = waitCount;
+    submitInfo.pWaitSemaphores = waitSemaphores;
+    submitInfo.pWaitDstStageMask = waitStages;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 2;
+    submitInfo.pSignalSemaphores = signalSemaphores;
+    if (vkQueueSubmit(m_queue, 1, &submitInfo, output.fence) != VK_SUCCESS) {
+        LOGE("Failed to submit the Vulkan stream pass.");
+        return nullptr;
+    }
+    output.submitted = true;
+    m_currentOutput = outputIndex;
+
+    VkSemaphoreGetFdInfoKHR fdInfo = {};
+    fdInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+    fdInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+
+    // The GL commands sampling the output wait on the GPU, the rendering thread does not block
+    int readyFd = -1;
+    fdInfo.semaphore = output.readySemaphore;
+    bool waited = false;
+    if (vkGetSemaphoreFdKHR(m_device, &fdInfo, &readyFd) == VK_SUCCESS && readyFd >= 0) {
+        EGLDisplay display = eglGetCurrentDisplay();
+        const EGLint syncAttribs[] = {EGL_SYNC_NATIVE_FENCE_FD_ANDROID, readyFd, EGL_NONE};
+        EGLSyncKHR sync = api.createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, syncAttribs);
+        if (sync != EGL_NO_SYNC_KHR) {
+            // EGL owns the fd now
+            api.waitSync(display, sync, 0);
+            api.destroySync(display, sync);
+        } else {
+            waitFenceFd(readyFd);
+        }
+        waited = true;
+    }
+
+    // The frames are released to the decoder after the last pass that sampled them
+    int releaseFd = -1;
+    fdInfo.semaphore = output.releaseSemaphore;
+    if (vkGetSemaphoreFdKHR(m_device, &fdInfo, &releaseFd) != VK_SUCCESS) {
+        releaseFd = -1;
+    }
+    if (!waited || releaseFd < 0) {
+        vkWaitForFences(m_device, 1, &output.fence, VK_TRUE, OUTPUT_TIMEOUT_NS);
+    }
+    for (int i = 0; i < streamCount; i++) {
+        Stream &stream = m_streams[i];
+        if (stream.releaseFenceFd >= 0) {
+            close(stream.releaseFenceFd);
+        }
+        stream.releaseFenceFd = (i == 0 || releaseFd < 0) ? releaseFd : dup(releaseFd);
+    }
+
+    return output.texture.get();
+}
+
+void VkStreamPass::EndFrame() {
+    const auto &api = interopApi();
+
+    if (m_currentOutput < 0) {
+        return;
+    }
+    Output &output = m_outputs[m_currentOutput];
+
+    EGLDisplay display = eglGetCurrentDisplay();
+    int fd = -1;
+    EGLSyncKHR sync = api.createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, nullptr);
+    if (sync != EGL_NO_SYNC_KHR) {
+        glFlush();
+        fd = api.dupNativeFenceFd(display, sync);
+        api.destroySync(display, sync);
+    }
+    if (fd < 0) {
+        // The next pass into the output cannot wait on the GPU
+        glFinish();
+    }
+    if (output.glFenceFd >= 0) {
+        // The output was sampled again without being redrawn, the new fence covers both
+        close(output.glFenceFd);
+    }
+    output.glFenceFd = fd;
+}
@@ -0,0 +1,158 @@
+#ifndef ALVRCLIENT_VK_STREAM_PASS_H
+#define ALVRCLIENT_VK_STREAM_PASS_H
+
+#define VK_USE_PLATFORM_ANDROID_KHR
+#define VK_NO_PROTOTYPES
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <android/hardware_buffer.h>
+#include <vulkan/vulkan.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "gl_render_utils/texture.h"
+
+// Stream pass in Vulkan, in place of sampling the decoded frames as GL external textures. The
+// image reader frames of the decoders are imported as AHardwareBuffers and drawn, with their
+// Y'CbCr conversion and the dynamic resolution scale, into an RGBA frame of the same layout. The
+// VrApi swapchains, the loading scene and the GUI stay in GL: the output images are
+// AHardwareBuffers as well, which the GL eye pass samples as a plain 2D texture.
+//
+// Nothing is recorded per frame. There is a command buffer for each output and pair of decoded
+// images, recorded the first time they come together, and only the uniform block with the
+// content scale is written before it is submitted again. The GPU waits on the acquire fence of the
+// codec, GL waits on the Vulkan pass and the next pass into an output waits on the GL commands
+// that sampled it, all with sync fds, so the rendering thread never blocks on the GPU.
+class VkStreamPass {
+public:
+    // Null if Vulkan 1.1 or the AHardwareBuffer and sync fd interop is not available. The output
+    // is width x height, both eyes side by side like the decoded frames. Needs the EGL context
+    // current.
+    static std::unique_ptr<VkStreamPass> Create(uint32_t width, uint32_t height, bool dualStream);
+    ~VkStreamPass();
+
+    VkStreamPass(const VkStreamPass &) = delete;
+    VkStreamPass &operator=(const VkStreamPass &) = delete;
+
+    // The stream pass the decoders hand their images to, null to bind them to the GL stream
+    // textures. Used on the rendering thread.
+    static VkStreamPass *getCurrent();
+    static void setCurrent(VkStreamPass *pass);
+
+    // Replaces the decoded frame of the stream, called by the decoder on the rendering thread. The
+    // pass takes acquireFenceFd, and sets releaseFenceFd to the fence the previous frame can be
+    // released with, -1 if it is not used anymore. False if the buffer cannot be imported, the
+    // fds are then left to the caller.
+    bool SetFrame(int stream, AHardwareBuffer *buffer, int acquireFenceFd, int *releaseFenceFd);
+
+    // Draws the frames into the next output and makes GL wait for it. Returns the output texture,
+    // null until every stream has a frame.
+    gl_render_utils::Texture *Render(float contentScale);
+    // Called once the GL commands sampling the output of Render() are flushed. The next pass into
+    // that output waits for them.
+    void EndFrame();
+
+private:
+    // One for the output sampled by GL, one being drawn and one spare
+    static constexpr int OUTPUT_COUNT = 3;
+    static constexpr int MAX_STREAMS = 2;
+    // Imported decoder images, the image readers cycle through a few buffers. Above it the
+    // imports and command buffers are dropped and imported again.
+    static constexpr size_t MAX_FRAME_IMPORTS = 8;
+    static constexpr size_t MAX_COMMAND_BUFFERS = 32;
+    // Longest CPU wait for an output still in use
+    static constexpr uint64_t OUTPUT_TIMEOUT_NS = 100'000'000;
+
+    struct FrameImport {
+        AHardwareBuffer *buffer;
+        VkDeviceMemory memory;
+        VkImage image;
+        VkImageView view;
+    };
+
+    struct Output {
+        AHardwareBuffer *buffer;
+        VkDeviceMemory memory;
+        VkImage image;
+        VkImageView view;
+        VkFramebuffer framebuffer;
+        VkBuffer uniformBuffer;
+        VkDeviceMemory uniformMemory;
+        float *contentScale;
+        EGLImageKHR eglImage;
+        std::unique_ptr<gl_render_utils::Texture> texture;
+        VkFence fence;
+        bool submitted;
+        // Waited on by the GPU before the stream frames are sampled and the output is written
+        VkSemaphore acquireSemaphores[MAX_STREAMS];
+        VkSemaphore glSemaphore;
+        // Signaled by the pass, exported as sync fds for GL and the release of the frames
+        VkSemaphore readySemaphore;
+        VkSemaphore releaseSemaphore;
+        // Fence of the GL commands that sampled the output, -1 if none
+        int glFenceFd;
+    };
+
+    struct CommandBuffer {
+        int output;
+        const FrameImport *frames[MAX_STREAMS];
+        VkDescriptorSet descriptorSet;
+        VkCommandBuffer commandBuffer;
+    };
+
+    struct Stream {
+        const FrameImport *frame;
+        // Acquire fence of the frame, -1 once it was waited for
+        int acquireFenceFd;
+        // Release fence of the last pass that sampled the frame, -1 if none
+        int releaseFenceFd;
+    };
+
+    VkStreamPass(uint32_t width, uint32_t height, bool dualStream);
+    bool initialize();
+    bool createOutput(Output &output);
+    void destroyOutput(Output &output);
+    bool createPipeline(const VkAndroidHardwareBufferFormatPropertiesANDROID &format);
+    void destroyPipeline();
+    const FrameImport *importFrame(AHardwareBuffer *buffer);
+    // Waits for the GPU and drops the command buffers and the frame imports, but the current
+    // frames of the streams if keepStreams
+    void clearFrames(bool keepStreams);
+    VkCommandBuffer getCommandBuffer(int output);
+    bool findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t *typeIndex) const;
+    // Takes fd, true if the semaphore was imported from it
+    bool importSemaphore(VkSemaphore semaphore, int fd);
+
+    uint32_t m_width;
+    uint32_t m_height;
+    bool m_dualStream;
+
+    VkInstance m_instance = VK_NULL_HANDLE;
+    VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkQueue m_queue = VK_NULL_HANDLE;
+    uint32_t m_queueFamily = 0;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkRenderPass m_renderPass = VK_NULL_HANDLE;
+    VkShaderModule m_vertexShader = VK_NULL_HANDLE;
+    VkShaderModule m_fragmentShader = VK_NULL_HANDLE;
+
+    // Created for the format of the first decoded frame, the sampler is immutable in the layout
+    uint64_t m_externalFormat = 0;
+    VkFormat m_frameFormat = VK_FORMAT_UNDEFINED;
+    VkSamplerYcbcrConversion m_conversion = VK_NULL_HANDLE;
+    VkSampler m_sampler = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+    Output m_outputs[OUTPUT_COUNT] = {};
+    int m_currentOutput = -1;
+    std::vector<std::unique_ptr<FrameImport>> m_frameImports;
+    std::vector<CommandBuffer> m_commandBuffers;
+    Stream m_streams[MAX_STREAMS] = {{nullptr, -1, -1}, {nullptr, -1, -1}};
+};
+
+#endif //ALVRCLIENT_VK_STREAM_PASS_H
@@ -4,6 +4,7 @@ import android.graphics.SurfaceTexture;
 import android.media.MediaCodec;
 import android.media.MediaCodecList;
 import android.media.MediaFormat;
+import android.os.Build;
 import android.os.Handler;
 import android.os.Looper;
 import android.os.Message;
@@ -20,15 +21,25 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
 
     private static final int CODEC_H264 = 0;
     private static final int CODEC_H265 = 1;
+    private static final int CODEC_AV1 = 2;
     private int mCodec = CODEC_H265;
     private int mPriority = 0;
+    // Decode with the NDK MediaCodec, frames are then queued by NALParser without going through Java.
+    private boolean mNativeDecoder = false;
+    // The native decoder outputs to an AImageReader, its frames are bound to the stream textures
+    // from native code and the SurfaceTextures are not updated.
+    private boolean mImageReader = false;
+    // Each eye is decoded by its own native decoder, to mSecondSurface for the right one.
+    private boolean mDualStream = false;
 
     private static final String VIDEO_FORMAT_H264 = "video/avc";
     private static final String VIDEO_FORMAT_H265 = "video/hevc";
+    private static final String VIDEO_FORMAT_AV1 = "video/av01";
     private String mFormat = VIDEO_FORMAT_H265;
 
     private MediaCodec mDecoder = null;
     private final Surface mSurface;
+    private final Surface mSecondSurface;
 
     private boolean mWaitNextIDR = false;
 
@@ -55,10 +66,15 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
     private static final int H265_NAL_TYPE_IDR_W_RADL = 19;
     private static final int H265_NAL_TYPE_VPS = 32;
 
+    private static final int AV1_OBU_SEQUENCE_HEADER = 1;
+    private static final int AV1_OBU_FRAME_HEADER = 3;
+    private static final int AV1_OBU_FRAME = 6;
+
     private final Queue<Integer> mAvailableInputs = new LinkedList<>();
 
-    public DecoderThread(Surface surface, DecoderCallback callback) {
+    public DecoderThread(Surface surface, Surface secondSurface, DecoderCallback callback) {
         mSurface = surface;
+        mSecondSurface = secondSurface;
         mQueue = new OutputFrameQueue();
         mDecoderCallback = callback;
     }
@@ -73,6 +89,7 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
         mHandler.getLooper().quitSafely();
 
         mQueue.stop();
+        setStoppedNativeDecoder(true);
     }
 
     @Override
@@ -82,12 +99,19 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
                 Utils.log(TAG, () -> "MESSAGE_PUSH_NAL");
                 NAL nal = (NAL) msg.obj;
 
+                if (mNativeDecoder) {
+                    // Pushed before the native decoder was created
+                    mNalQueue.recycle(nal);
+                    return true;
+                }
+
                 detectNALType(nal);
 
                 // find an SPS nal to initialize decoder
                 // in fact it will contain all config nals concatenated
+                // AV1 has no config buffer, the sequence header is read from the first key frame
                 if (mDecoder == null) {
-                  if (nal.type != NAL_TYPE_SPS)
+                  if (nal.type != (mCodec == CODEC_AV1 ? NAL_TYPE_IDR : NAL_TYPE_SPS))
                   {
                     mNalQueue.recycle(nal);
                     return true;
@@ -98,7 +122,9 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
                   format.setInteger("vendor.qti-ext-dec-low-latency.enable", 1); //Qualcomm low latency mode
                   format.setInteger(MediaFormat.KEY_OPERATING_RATE, Short.MAX_VALUE);
                   format.setInteger(MediaFormat.KEY_PRIORITY, mPriority);
-                  format.setByteBuffer("csd-0", ByteBuffer.wrap(nal.buf, 0, nal.buf.length));
+                  if (mCodec != CODEC_AV1) {
+                    format.setByteBuffer("csd-0", ByteBuffer.wrap(nal.buf, 0, nal.buf.length));
+                  }
                   MediaCodecList codecs = new MediaCodecList(MediaCodecList.REGULAR_CODECS);
                   String codec = codecs.findDecoderForFormat(format);
                   try {
@@ -149,6 +175,7 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
         } finally {
             Utils.logi(TAG, () -> "Stopping decoder.");
             mQueue.stop();
+            destroyNativeDecoder();
 
             if (mDecoder != null) {
                 try {
@@ -173,6 +200,15 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
         mWaitNextIDR = true;
         setWaitingNextIDR(true);
 
+        if (mNativeDecoder) {
+            // The codec is created on the first SPS, like the Java decoder
+            createNativeDecoder(mSurface, mCodec, mPriority == 0, mImageReader, 0);
+            if (mDualStream) {
+                createNativeDecoder(mSecondSurface, mCodec, mPriority == 0, mImageReader, 1);
+            }
+            mDecoderCallback.onPrepared();
+        }
+
         Looper.loop();
     }
 
@@ -234,25 +270,34 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
         }
     }
 
-    public void onConnect(int codec, boolean realtime) {
+    public void onConnect(int codec, boolean realtime, boolean nativeDecoder, boolean imageReader, boolean dualStream) {
         Utils.logi(TAG, () -> "onConnect()");
         mQueue.reset();
-        notifyCodecChange(codec, realtime);
+        setStoppedNativeDecoder(false);
+        // AImageReader hardware buffers need API 26
+        boolean supportedImageReader = imageReader && Build.VERSION.SDK_INT >= Build.VERSION_CODES.O;
+        notifyCodecChange(codec, realtime, nativeDecoder, supportedImageReader, dualStream);
     }
 
     public void onDisconnect() {
         mQueue.stop();
+        setStoppedNativeDecoder(true);
     }
 
-    private void notifyCodecChange(int codec, boolean realtime) {
+    private void notifyCodecChange(int codec, boolean realtime, boolean nativeDecoder, boolean imageReader, boolean dualStream) {
         final int priority = realtime ? 0 : 1;
-        if (codec != mCodec || priority != mPriority) {
-            Utils.logi(TAG, () -> "notifyCodecChange: Codec was changed. New Codec=" + codec);
+        if (codec != mCodec || priority != mPriority || nativeDecoder != mNativeDecoder || imageReader != mImageReader || dualStream != mDualStream) {
+            Utils.logi(TAG, () -> "notifyCodecChange: Codec was changed. New Codec=" + codec + " Native=" + nativeDecoder + " ImageReader=" + imageReader + " DualStream=" + dualStream);
             stopAndWait();
             mCodec = codec;
             mPriority = priority;
+            mNativeDecoder = nativeDecoder;
+            mImageReader = imageReader;
+            mDualStream = dualStream;
             if (mCodec == CODEC_H264) {
                 mFormat = VIDEO_FORMAT_H264;
+            } else if (mCodec == CODEC_AV1) {
+                mFormat = VIDEO_FORMAT_AV1;
             } else {
                 mFormat = VIDEO_FORMAT_H265;
             }
@@ -318,7 +363,44 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
         }
     }
 
+    // A key frame temporal unit carries the sequence header before its first frame, the OBUs all
+    // have their size field.
+    private static boolean isAv1KeyFrame(byte[] buf, int length) {
+        int offset = 0;
+        while (offset < length) {
+            int header = buf[offset] & 0xFF;
+            int type = (header >> 3) & 0xF;
+            if (type == AV1_OBU_SEQUENCE_HEADER) {
+                return true;
+            }
+            if (type == AV1_OBU_FRAME || type == AV1_OBU_FRAME_HEADER || (header & 0x2) == 0) {
+                return false;
+            }
+            offset += (header & 0x4) != 0 ? 2 : 1;
+
+            long size = 0;
+            for (int i = 0; i < 8 && offset < length; i++) {
+                int b = buf[offset++] & 0xFF;
+                size |= (long) (b & 0x7F) << (i * 7);
+                if ((b & 0x80) == 0) {
+                    break;
+                }
+            }
+            if (size > length - offset) {
+                return false;
+            }
+            offset += (int) size;
+        }
+        return false;
+    }
+
     private void detectNALType(NAL nal) {
+        if (mCodec == CODEC_AV1) {
+            nal.type = isAv1KeyFrame(nal.buf, nal.length) ? NAL_TYPE_IDR : NAL_TYPE_P;
+            Utils.frameLog(nal.frameIndex, () -> "Got AV1 frame Type=" + nal.type + " Length=" + nal.length + " QueueSize=" + mNalQueue.size());
+            return;
+        }
+
         int NALType;
 
         if (mCodec == CODEC_H264) {
@@ -352,18 +434,57 @@ public class DecoderThread extends ThreadBase implements Handler.Callback {
     }
 
     public void releaseBuffer() {
-        mQueue.render();
+        if (mNativeDecoder) {
+            renderNativeDecoder(0);
+            if (mDualStream) {
+                renderNativeDecoder(1);
+            }
+        } else {
+            mQueue.render();
+        }
     }
 
-    public void onFrameAvailable() {
-        mQueue.onFrameAvailable();
+    public void onFrameAvailable(int stream) {
+        if (mNativeDecoder) {
+            onFrameAvailableNativeDecoder(stream);
+        } else {
+            mQueue.onFrameAvailable();
+        }
     }
 
-    public long clearAvailable(SurfaceTexture surfaceTexture) {
-        return mQueue.clearAvailable(surfaceTexture);
+    // In dual stream mode the right eye texture is updated whenever it has a new frame, and the
+    // returned frame index is the one of the left eye, which drives the rendering.
+    public long clearAvailable(SurfaceTexture surfaceTexture, SurfaceTexture secondSurfaceTexture) {
+        if (!mNativeDecoder) {
+            return mQueue.clearAvailable(surfaceTexture);
+        }
+        if (mDualStream) {
+            clearAvailableStream(secondSurfaceTexture, 1);
+        }
+        return clearAvailableStream(surfaceTexture, 0);
+    }
+
+    private long clearAvailableStream(SurfaceTexture surfaceTexture, int stream) {
+        // With the image reader, the frame was already bound to the stream texture by native code
+        long frameIndex = clearAvailableNativeDecoder(stream);
+        if (frameIndex != -1) {
+            if (surfaceTexture != null && !mImageReader) {
+                surfaceTexture.updateTexImage();
+            }
+            // Render deferred frame.
+            renderNativeDecoder(stream);
+        }
+        return frameIndex;
     }
 
     public static native void DecoderInput(long frameIndex);
     public static native void DecoderOutput(long frameIndex);
     public static native void setWaitingNextIDR(boolean waiting);
+
+    private static native void createNativeDecoder(Surface surface, int codec, boolean realtime, boolean imageReader, int stream);
+    private static native void destroyNativeDecoder();
+    private static native long renderNativeDecoder(int stream);
+    private static native void onFrameAvailableNativeDecoder(int stream);
+    private static native long clearAvailableNativeDecoder(int stream);
+    private static native void setStoppedNativeDecoder(boolean stopped);
 }
@@ -31,9 +31,10 @@ public class LoadingTexture {
         mCurrentText = "";
     }
 
-    void drawMessage(String text) {
+    // Returns whether the texture was drawn again
+    boolean drawMessage(String text) {
         if (text.equals(mCurrentText)) {
-            return;
+            return false;
         }
         mCurrentText = text;
 
@@ -68,6 +69,7 @@ public class LoadingTexture {
         GLES32.glTexParameterf(GLES32.GL_TEXTURE_2D, GLES32.GL_TEXTURE_WRAP_T, GLES32.GL_REPEAT);
 
         GLUtils.texImage2D(GLES32.GL_TEXTURE_2D, 0, mBitmap, 0);
+        return true;
     }
 
     void destroyTexture() {
@@ -54,6 +54,7 @@ public class OvrActivity extends Activity {
 
     public static class OnCreateResult {
         public int streamSurfaceHandle;
+        public int secondStreamSurfaceHandle;
         public int loadingSurfaceHandle;
     }
 
@@ -92,6 +93,9 @@ public class OvrActivity extends Activity {
     Surface mScreenSurface;
     SurfaceTexture mStreamSurfaceTexture;
     Surface mStreamSurface;
+    // Right eye decoder output in dual stream mode
+    SurfaceTexture mSecondStreamSurfaceTexture;
+    Surface mSecondStreamSurface;
     final LoadingTexture mLoadingTexture = new LoadingTexture();
     DecoderThread mDecoderThread = null;
     EGLContext mEGLContext;
@@ -137,13 +141,22 @@ public class OvrActivity extends Activity {
         mStreamSurfaceTexture = new SurfaceTexture(deviceDescriptor.streamSurfaceHandle);
         mStreamSurfaceTexture.setOnFrameAvailableListener(surfaceTexture -> {
             if (mDecoderThread != null) {
-                mDecoderThread.onFrameAvailable();
+                mDecoderThread.onFrameAvailable(0);
             }
             mRenderingHandler.removeCallbacks(mRenderRunnable);
             mRenderingHandler.post(mRenderRunnable);
         }, new Handler(Looper.getMainLooper()));
         mStreamSurface = new Surface(mStreamSurfaceTexture);
 
+        // The left eye drives the rendering, the right one is latched when the left one is rendered
+        mSecondStreamSurfaceTexture = new SurfaceTexture(deviceDescriptor.secondStreamSurfaceHandle);
+        mSecondStreamSurfaceTexture.setOnFrameAvailableListener(surfaceTexture -> {
+            if (mDecoderThread != null) {
+                mDecoderThread.onFrameAvailable(1);
+            }
+        }, new Handler(Looper.getMainLooper()));
+        mSecondStreamSurface = new Surface(mSecondStreamSurfaceTexture);
+
         mLoadingTexture.initializeMessageCanvas(deviceDescriptor.loadingSurfaceHandle);
 
         mEGLContext = EGL14.eglGetCurrentContext();
@@ -192,8 +205,9 @@ public class OvrActivity extends Activity {
                 // and onFrameAvailable won't be called after next output.
                 // To avoid deadlock caused by it, we need to flush last output.
                 mStreamSurfaceTexture.updateTexImage();
+                mSecondStreamSurfaceTexture.updateTexImage();
 
-                mDecoderThread = new DecoderThread(mStreamSurface, mDecoderCallback);
+                mDecoderThread = new DecoderThread(mStreamSurface, mSecondStreamSurface, mDecoderCallback);
 
                 try {
                     mDecoderThread.start();
@@ -318,7 +332,7 @@ public class OvrActivity extends Activity {
     private void render() {
         if (mResumed && mScreenSurface != null) {
             if (isConnectedNative()) {
-                long renderedFrameIndex = mDecoderThread.clearAvailable(mStreamSurfaceTexture);
+                long renderedFrameIndex = mDecoderThread.clearAvailable(mStreamSurfaceTexture, mSecondStreamSurfaceTexture);
 
                 if (renderedFrameIndex != -1) {
                     renderNative(renderedFrameIndex);
@@ -327,9 +341,9 @@ public class OvrActivity extends Activity {
                 mRenderingHandler.removeCallbacks(mRenderRunnable);
                 mRenderingHandler.postDelayed(mRenderRunnable, 1);
             } else {
-                mLoadingTexture.drawMessage(mLoadingMessage);
+                boolean messageChanged = mLoadingTexture.drawMessage(mLoadingMessage);
 
-                renderLoadingNative();
+                renderLoadingNative(messageChanged);
                 mRenderingHandler.removeCallbacks(mRenderRunnable);
                 mRenderingHandler.postDelayed(mRenderRunnable, (long) (1f / mRefreshRate));
             }
@@ -372,7 +386,7 @@ public class OvrActivity extends Activity {
 
     native void renderNative(long renderedFrameIndex);
 
-    native void renderLoadingNative();
+    native void renderLoadingNative(boolean messageChanged);
 
     native boolean isVrModeNative();
 
@@ -398,12 +412,12 @@ public class OvrActivity extends Activity {
     }
 
     @SuppressWarnings("unused")
-    public void onServerConnected(float fps, int codec, boolean realtimeDecoder, String dashboardURL) {
+    public void onServerConnected(float fps, int codec, boolean realtimeDecoder, boolean nativeDecoder, boolean imageReader, boolean dualStream, String dashboardURL) {
         mRefreshRate = fps;
         mDashboardURL = dashboardURL;
         mRenderingHandler.post(() -> {
             onStreamStartNative();
-            mDecoderThread.onConnect(codec, realtimeDecoder);
+            mDecoderThread.onConnect(codec, realtimeDecoder, nativeDecoder, imageReader, dualStream);
         });
     }
 
@@ -0,0 +1,30 @@
+#version 450
+
+// Each eye comes from the frame of its decoder in dual stream mode
+layout(constant_id = 0) const bool DUAL_STREAM = false;
+
+layout(location = 0) in vec2 uv;
+layout(location = 0) out vec4 outColor;
+
+// The decoded frames, sampled through their Y'CbCr conversion. Stream1 is the same frame as
+// Stream0 with a single stream.
+layout(set = 0, binding = 0) uniform sampler2D Stream0;
+layout(set = 0, binding = 2) uniform sampler2D Stream1;
+layout(set = 0, binding = 1) uniform Uniforms {
+    // Dynamic resolution draws each eye scaled into the top left corner of its half
+    float ContentScale;
+};
+
+void main()
+{
+    if (DUAL_STREAM) {
+        if (uv.x < 0.5) {
+            outColor = texture(Stream0, vec2(uv.x * 2., uv.y) * ContentScale);
+        } else {
+            outColor = texture(Stream1, vec2(uv.x * 2. - 1., uv.y) * ContentScale);
+        }
+    } else {
+        float eyeStart = uv.x < 0.5 ? 0. : 0.5;
+        outColor = texture(Stream0, vec2(eyeStart + (uv.x - eyeStart) * ContentScale, uv.y * ContentScale));
+    }
+}
@@ -0,0 +1,10 @@
+#version 450
+
+// Quad covering the output, drawn as a triangle strip of 4 vertices without vertex buffer
+layout(location = 0) out vec2 uv;
+
+void main()
+{
+    uv = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
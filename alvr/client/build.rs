@@ -54,6 +54,7 @@ fn main() {
         println!("cargo:rustc-link-lib=GLESv3");
         println!("cargo:rustc-link-lib=EGL");
         println!("cargo:rustc-link-lib=android");
+        println!("cargo:rustc-link-lib=mediandk");
         println!("cargo:rustc-link-lib=OpenSLES");
         println!("cargo:rustc-link-lib=ovrplatformloader");
     }
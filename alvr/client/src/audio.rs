@@ -1,22 +1,16 @@
+use alvr_audio::{RingConsumer, RingProducer};
 use alvr_common::prelude::*;
-use alvr_session::AudioConfig;
-use alvr_sockets::{StreamReceiver, StreamSender, AUDIO};
+use alvr_session::{AudioCodec, AudioConfig};
+use alvr_sockets::{AudioPacketHeader, StreamReceiver, StreamSender, AUDIO};
 use oboe::{
     AudioInputCallback, AudioInputStreamSafe, AudioOutputCallback, AudioOutputStreamSafe,
     AudioStream, AudioStreamBuilder, DataCallbackResult, InputPreset, Mono, PerformanceMode,
     SampleRateConversionQuality, Stereo, Usage,
 };
-use parking_lot::Mutex;
-use std::{
-    collections::VecDeque,
-    mem,
-    sync::{mpsc as smpsc, Arc},
-    thread,
-};
-use tokio::sync::mpsc as tmpsc;
+use std::{sync::mpsc as smpsc, thread};
 
 struct RecorderCallback {
-    sender: tmpsc::UnboundedSender<Vec<u8>>,
+    producer: RingProducer<i16>,
 }
 
 impl AudioInputCallback for RecorderCallback {
@@ -27,21 +21,19 @@ impl AudioInputCallback for RecorderCallback {
         _: &mut dyn AudioInputStreamSafe,
         frames: &[i16],
     ) -> DataCallbackResult {
-        let mut sample_buffer = Vec::with_capacity(frames.len() * mem::size_of::<i16>());
-
-        for frame in frames {
-            sample_buffer.extend(&frame.to_ne_bytes());
-        }
-
-        self.sender.send(sample_buffer).ok();
+        self.producer.push(frames);
 
         DataCallbackResult::Continue
     }
 }
 
-pub async fn record_audio_loop(sample_rate: u32, mut sender: StreamSender<()>) -> StrResult {
+pub async fn record_audio_loop(
+    sample_rate: u32,
+    codec: AudioCodec,
+    sender: StreamSender<AudioPacketHeader>,
+) -> StrResult {
     let (_shutdown_notifier, shutdown_receiver) = smpsc::channel::<()>();
-    let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
+    let (producer, consumer) = alvr_audio::capture_ring(1, sample_rate);
 
     thread::spawn(move || -> StrResult {
         let mut stream = trace_err!(AudioStreamBuilder::default()
@@ -54,9 +46,7 @@ pub async fn record_audio_loop(sample_rate: u32, mut sender: StreamSender<()>) -
             .set_input()
             .set_usage(Usage::VoiceCommunication)
             .set_input_preset(InputPreset::VoiceCommunication)
-            .set_callback(RecorderCallback {
-                sender: data_sender
-            })
+            .set_callback(RecorderCallback { producer })
             .open_stream())?;
 
         trace_err!(stream.start())?;
@@ -69,18 +59,12 @@ pub async fn record_audio_loop(sample_rate: u32, mut sender: StreamSender<()>) -
         Ok(())
     });
 
-    while let Some(data) = data_receiver.recv().await {
-        let mut buffer = sender.new_buffer(&(), data.len())?;
-        buffer.get_mut().extend(data);
-        sender.send_buffer(buffer).await.ok();
-    }
-
-    Ok(())
+    alvr_audio::send_samples_loop(consumer, 1, sample_rate, codec, sender).await
 }
 
 struct PlayerCallback {
-    sample_buffer: Arc<Mutex<VecDeque<f32>>>,
-    batch_frames_count: usize,
+    consumer: RingConsumer<f32>,
+    batch: Vec<f32>,
 }
 
 impl AudioOutputCallback for PlayerCallback {
@@ -91,68 +75,70 @@ impl AudioOutputCallback for PlayerCallback {
         _: &mut dyn AudioOutputStreamSafe,
         out_frames: &mut [(f32, f32)],
     ) -> DataCallbackResult {
-        let samples = alvr_audio::get_next_frame_batch(
-            &mut *self.sample_buffer.lock(),
-            2,
-            self.batch_frames_count,
-        );
-
-        for f in 0..out_frames.len() {
-            out_frames[f] = (samples[f * 2], samples[f * 2 + 1]);
+        // The stream is opened with one batch per callback
+        for out_batch in out_frames.chunks_mut(self.batch.len() / 2) {
+            alvr_audio::get_next_frame_batch(&mut self.consumer, 2, &mut self.batch);
+
+            for (f, frame) in out_batch.iter_mut().enumerate() {
+                *frame = (self.batch[f * 2], self.batch[f * 2 + 1]);
+            }
         }
 
         DataCallbackResult::Continue
     }
 }
+
+// The server stamps the audio on its clock
+fn server_clock_offset() -> Option<i64> {
+    let mut time_diff = 0;
+    unsafe { crate::getServerTimeDiff(&mut time_diff) }.then(|| time_diff)
+}
+
 pub async fn play_audio_loop(
     sample_rate: u32,
     config: AudioConfig,
-    receiver: StreamReceiver<()>,
+    receiver: StreamReceiver<AudioPacketHeader>,
 ) -> StrResult {
-    let batch_frames_count = sample_rate as usize * config.batch_ms as usize / 1000;
-    let average_buffer_frames_count =
-        sample_rate as usize * config.average_buffering_ms as usize / 1000;
+    let batch_frames_count = (sample_rate as usize * config.batch_ms as usize / 1000).max(1);
 
-    let sample_buffer = Arc::new(Mutex::new(VecDeque::new()));
+    let (producer, consumer) = alvr_audio::playback_ring(2, sample_rate);
 
     // store the stream in a thread (because !Send) and extract the playback handle
     let (_shutdown_notifier, shutdown_receiver) = smpsc::channel::<()>();
-    thread::spawn({
-        let sample_buffer = Arc::clone(&sample_buffer);
-        move || -> StrResult {
-            let mut stream = trace_err!(AudioStreamBuilder::default()
-                .set_shared()
-                .set_performance_mode(PerformanceMode::LowLatency)
-                .set_sample_rate(sample_rate as _)
-                .set_sample_rate_conversion_quality(SampleRateConversionQuality::Fastest)
-                .set_stereo()
-                .set_f32()
-                .set_frames_per_callback(batch_frames_count as _)
-                .set_output()
-                .set_usage(Usage::Game)
-                .set_callback(PlayerCallback {
-                    sample_buffer,
-                    batch_frames_count,
-                })
-                .open_stream())?;
-
-            trace_err!(stream.start())?;
-
-            shutdown_receiver.recv().ok();
-
-            // Note: Oboe crahes if stream.stop() is NOT called on AudioPlayer
-            stream.stop_with_timeout(0).ok();
-
-            Ok(())
-        }
+    thread::spawn(move || -> StrResult {
+        let mut stream = trace_err!(AudioStreamBuilder::default()
+            .set_shared()
+            .set_performance_mode(PerformanceMode::LowLatency)
+            .set_sample_rate(sample_rate as _)
+            .set_sample_rate_conversion_quality(SampleRateConversionQuality::Fastest)
+            .set_stereo()
+            .set_f32()
+            .set_frames_per_callback(batch_frames_count as _)
+            .set_output()
+            .set_usage(Usage::Game)
+            .set_callback(PlayerCallback {
+                consumer,
+                batch: vec![0.; batch_frames_count * 2],
+            })
+            .open_stream())?;
+
+        trace_err!(stream.start())?;
+
+        shutdown_receiver.recv().ok();
+
+        // Note: Oboe crahes if stream.stop() is NOT called on AudioPlayer
+        stream.stop_with_timeout(0).ok();
+
+        Ok(())
     });
 
     alvr_audio::receive_samples_loop(
         receiver,
-        sample_buffer,
+        producer,
         2,
-        batch_frames_count,
-        average_buffer_frames_count,
+        sample_rate,
+        config,
+        server_clock_offset,
     )
     .await
 }
@@ -11,12 +11,13 @@ use alvr_common::{
     prelude::*,
     ALVR_NAME, ALVR_VERSION,
 };
-use alvr_session::{CodecType, SessionDesc};
+use alvr_session::{ClientPresentationMode, SessionDesc, SocketProtocol, VideoPacketSize};
 use alvr_sockets::{
     spawn_cancelable, ClientConfigPacket, ClientControlPacket, ClientHandshakePacket, Haptics,
-    HeadsetInfoPacket, PeerType, PrivateIdentity, ProtoControlSocket, ServerControlPacket,
-    ServerHandshakePacket, StreamSocketBuilder, VideoFrameHeaderPacket, AUDIO, HAPTICS, INPUT,
-    VIDEO,
+    HeadsetInfoPacket, PeerType, PrivateIdentity, ProtoControlSocket, ReceivedPacket,
+    ServerControlPacket, ServerHandshakePacket, StreamSocketBuilder, TimeSyncPacket,
+    VideoFrameHeaderPacket, AUDIO, CONTROL_PORT, DEFAULT_VIDEO_PACKET_SIZE, FEEDBACK_INTERVAL,
+    HAPTICS, INPUT, TIME_SYNC, VIDEO,
 };
 use futures::future::BoxFuture;
 use jni::{
@@ -28,9 +29,10 @@ use settings_schema::Switch;
 use std::{
     future, mem, ptr, slice,
     sync::{
-        atomic::{AtomicBool, Ordering},
+        atomic::{AtomicBool, AtomicU64, Ordering},
         mpsc as smpsc, Arc,
     },
+    thread,
     time::Duration,
 };
 use tokio::{
@@ -41,6 +43,8 @@ use tokio::{
 
 #[cfg(target_os = "android")]
 use crate::audio;
+#[cfg(target_os = "android")]
+use alvr_sockets::InPlaceReceiver;
 
 const INITIAL_MESSAGE: &str = "Searching for server...\n(open ALVR on your PC)";
 const NETWORK_UNREACHABLE_MESSAGE: &str = "Cannot connect to the internet";
@@ -61,6 +65,9 @@ const PLAYSPACE_SYNC_INTERVAL: Duration = Duration::from_millis(500);
 const NETWORK_KEEPALIVE_INTERVAL: Duration = Duration::from_secs(1);
 const CLEANUP_PAUSE: Duration = Duration::from_millis(500);
 
+// Token of the last stream, lets the server resume it after a short disconnection
+static RESUME_TOKEN: AtomicU64 = AtomicU64::new(0);
+
 // close stream on Drop (manual disconnection or execution canceling)
 struct StreamCloseGuard {
     is_connected: Arc<AtomicBool>,
@@ -72,6 +79,165 @@ impl Drop for StreamCloseGuard {
     }
 }
 
+// Restricts the calling thread to the big cores of the headset. The previous affinity is restored
+// on drop, because blocking tasks run on pooled threads.
+struct BigCoreAffinity {
+    #[cfg(target_os = "android")]
+    previous: libc::cpu_set_t,
+}
+
+impl BigCoreAffinity {
+    #[cfg(target_os = "android")]
+    fn new() -> Option<Self> {
+        // The big cores are the ones clocked above the slowest cluster
+        let cpu_count = unsafe { libc::sysconf(libc::_SC_NPROCESSORS_CONF) }.max(0) as usize;
+        let max_frequencies = (0..cpu_count)
+            .map(|cpu| {
+                std::fs::read_to_string(format!(
+                    "/sys/devices/system/cpu/cpu{cpu}/cpufreq/cpuinfo_max_freq"
+                ))
+                .ok()
+                .and_then(|frequency| frequency.trim().parse::<u64>().ok())
+            })
+            .collect::<Vec<_>>();
+        let slowest = max_frequencies.iter().flatten().min()?;
+
+        unsafe {
+            let mut previous = mem::zeroed::<libc::cpu_set_t>();
+            if libc::sched_getaffinity(0, mem::size_of_val(&previous), &mut previous) != 0 {
+                return None;
+            }
+
+            let mut big_cores = mem::zeroed::<libc::cpu_set_t>();
+            let mut any_big_core = false;
+            for (cpu, frequency) in max_frequencies.iter().enumerate() {
+                if matches!(frequency, Some(frequency) if frequency > slowest)
+                    && libc::CPU_ISSET(cpu, &previous)
+                {
+                    libc::CPU_SET(cpu, &mut big_cores);
+                    any_big_core = true;
+                }
+            }
+
+            if !any_big_core
+                || libc::sched_setaffinity(0, mem::size_of_val(&big_cores), &big_cores) != 0
+            {
+                return None;
+            }
+
+            Some(Self { previous })
+        }
+    }
+
+    #[cfg(not(target_os = "android"))]
+    fn new() -> Option<Self> {
+        None
+    }
+}
+
+impl Drop for BigCoreAffinity {
+    fn drop(&mut self) {
+        #[cfg(target_os = "android")]
+        unsafe {
+            libc::sched_setaffinity(0, mem::size_of_val(&self.previous), &self.previous);
+        }
+    }
+}
+
+fn to_legacy_video_header(header: &VideoFrameHeaderPacket) -> VideoFrame {
+    VideoFrame {
+        type_: 9, // ALVR_PACKET_TYPE_VIDEO_FRAME
+        packetCounter: header.packet_counter,
+        trackingFrameIndex: header.tracking_frame_index,
+        videoFrameIndex: header.video_frame_index,
+        sentTime: header.sent_time,
+        frameByteSize: header.frame_byte_size,
+        fecIndex: header.fec_index,
+        fecPercentage: header.fec_percentage,
+        streamIndex: header.stream_index,
+        contentScale: header.content_scale,
+        foveationCenter: header.foveation_center,
+        sliceIndex: header.slice_index,
+        sliceCount: header.slice_count,
+    }
+}
+
+// Packet layout expected by legacyReceive(). `buffer` is one the legacy thread gave back, if any.
+fn to_legacy_video_frame(
+    packet: &ReceivedPacket<VideoFrameHeaderPacket>,
+    mut buffer: Vec<u8>,
+) -> Vec<u8> {
+    let header = to_legacy_video_header(&packet.header);
+
+    buffer.clear();
+    buffer.extend_from_slice(unsafe {
+        &mem::transmute::<_, [u8; mem::size_of::<VideoFrame>()]>(header)
+    });
+    buffer.extend_from_slice(&packet.buffer);
+
+    buffer
+}
+
+// Send again IDR packet every 2s in case it is missed
+// (due to dropped burst of packets at the start of the stream or otherwise).
+fn request_missing_idr(deadline: &mut Option<Instant>) {
+    if !crate::IDR_PARSED.load(Ordering::Relaxed) {
+        if let Some(instant) = *deadline {
+            if instant < Instant::now() {
+                crate::IDR_REQUEST_NOTIFIER.notify_waiters();
+                *deadline = None;
+            }
+        } else {
+            *deadline = Some(Instant::now() + Duration::from_secs(2));
+        }
+    }
+}
+
+// Runs on the legacy thread, which owns the FEC queue the video payloads are received into. The
+// other legacy packets still come through the channel.
+#[cfg(target_os = "android")]
+struct LegacyVideoReceiver<'a> {
+    header: VideoFrame,
+    legacy_receive_data_receiver: &'a smpsc::Receiver<Vec<Vec<u8>>>,
+    idr_request_deadline: Option<Instant>,
+}
+
+#[cfg(target_os = "android")]
+impl InPlaceReceiver for LegacyVideoReceiver<'_> {
+    fn reserve(&mut self, header: &[u8]) -> Option<&mut [u8]> {
+        let header = bincode::deserialize::<VideoFrameHeaderPacket>(header).ok()?;
+        self.header = to_legacy_video_header(&header);
+
+        let mut capacity = 0;
+        let payload = unsafe { crate::legacyReserveVideo(&self.header, &mut capacity) };
+        if payload.is_null() {
+            None
+        } else {
+            Some(unsafe { slice::from_raw_parts_mut(payload as *mut u8, capacity as _) })
+        }
+    }
+
+    fn commit(&mut self, _: &[u8], payload_size: usize) {
+        unsafe { crate::legacyCommitVideo(&self.header, payload_size as _) };
+    }
+
+    fn poll(&mut self) -> bool {
+        request_missing_idr(&mut self.idr_request_deadline);
+
+        loop {
+            match self.legacy_receive_data_receiver.try_recv() {
+                Ok(batch) => {
+                    for mut data in batch {
+                        unsafe { crate::legacyReceive(data.as_mut_ptr(), data.len() as _) };
+                    }
+                }
+                Err(smpsc::TryRecvError::Empty) => return true,
+                Err(smpsc::TryRecvError::Disconnected) => return false,
+            }
+        }
+    }
+}
+
 fn set_loading_message(
     java_vm: &JavaVM,
     activity_ref: &GlobalRef,
@@ -164,15 +330,43 @@ async fn connection_pipeline(
         } => pair
     };
 
+    // Any port selects the same route as the stream
+    let headset_info = HeadsetInfoPacket {
+        path_mtu: alvr_sockets::path_mtu(server_ip, CONTROL_PORT).unwrap_or(0),
+        resume_token: RESUME_TOKEN.load(Ordering::Relaxed),
+        ..headset_info.clone()
+    };
     trace_err!(proto_socket.send(&(headset_info, server_ip)).await)?;
     let config_packet = trace_err!(proto_socket.recv::<ClientConfigPacket>().await)?;
+    RESUME_TOKEN.store(config_packet.resume_token, Ordering::Relaxed);
 
     let (control_sender, mut control_receiver) = proto_socket.split();
     let control_sender = Arc::new(Mutex::new(control_sender));
 
-    match control_receiver.recv().await {
+    let settings = {
+        let mut session_desc = SessionDesc::default();
+        session_desc.merge_from_json(&trace_err!(json::from_str(&config_packet.session_desc))?)?;
+        session_desc.to_settings()
+    };
+
+    // The stream socket is bound while the server prepares the stream, so StreamReady is sent as
+    // soon as StartStream arrives
+    let (stream_socket_builder, start_packet) = tokio::join!(
+        StreamSocketBuilder::listen_for_server(
+            settings.connection.stream_port,
+            settings.connection.stream_protocol.clone(),
+            settings.connection.client_send_buffer_bytes,
+            settings.connection.client_recv_buffer_bytes,
+            settings.connection.client_busy_poll_us,
+        ),
+        control_receiver.recv()
+    );
+
+    match start_packet {
         Ok(ServerControlPacket::StartStream) => {
             info!("Stream starting");
+            // The server sends the parameter sets of this stream once it is ready
+            unsafe { crate::decoderClearConfigs() };
             set_loading_message(&*java_vm, &*activity_ref, hostname, STREAM_STARTING_MESSAGE)?;
         }
         Ok(ServerControlPacket::Restarting) => {
@@ -197,17 +391,7 @@ async fn connection_pipeline(
         }
     }
 
-    let settings = {
-        let mut session_desc = SessionDesc::default();
-        session_desc.merge_from_json(&trace_err!(json::from_str(&config_packet.session_desc))?)?;
-        session_desc.to_settings()
-    };
-
-    let stream_socket_builder = StreamSocketBuilder::listen_for_server(
-        settings.connection.stream_port,
-        settings.connection.stream_protocol,
-    )
-    .await?;
+    let stream_socket_builder = stream_socket_builder?;
 
     if let Err(e) = control_sender
         .lock()
@@ -225,10 +409,22 @@ async fn connection_pipeline(
         return Ok(());
     }
 
+    // Set by the server to the size negotiated for this session
+    let video_packet_size = match settings.connection.video_packet_size {
+        VideoPacketSize::Custom(size) => size,
+        _ => DEFAULT_VIDEO_PACKET_SIZE,
+    };
+
     let stream_socket = tokio::select! {
         res = stream_socket_builder.accept_from_server(
             server_ip,
+            config_packet.secondary_server_ip,
             settings.connection.stream_port,
+            alvr_sockets::video_datagram_size(
+                &settings.connection.stream_protocol,
+                video_packet_size,
+            ),
+            settings.connection.transport_feedback,
         ) => res?,
         _ = time::sleep(Duration::from_secs(5)) => {
             return fmt_e!("Timeout while setting up streams");
@@ -304,18 +500,56 @@ async fn connection_pipeline(
             } else {
                 2_f32
             },
+            foveationSinglePass: if let Switch::Enabled(foveation_vars) =
+                &settings.video.foveated_rendering
+            {
+                foveation_vars.single_pass_decompression
+            } else {
+                false
+            },
+            foveationDirectLayer: if let Switch::Enabled(foveation_vars) =
+                &settings.video.foveated_rendering
+            {
+                foveation_vars.direct_compositor_layer
+            } else {
+                false
+            },
+            enableUpscaling: matches!(settings.video.client_upscaling, Switch::Enabled(_)),
+            upscalingSharpness: if let Switch::Enabled(upscaling) = &settings.video.client_upscaling
+            {
+                upscaling.sharpness
+            } else {
+                0_f32
+            },
+            dualStream: settings.video.dual_stream_encoding,
+            halfRate: settings.video.half_rate_streaming,
+            presentationDepth: match settings.video.client_presentation_mode {
+                ClientPresentationMode::LatestWins => 0,
+                ClientPresentationMode::TargetDepth(depth) => depth,
+            },
             extraLatencyMode: settings.headset.extra_latency_mode,
+            frameEvents: settings.headset.client_frame_events,
+            vulkanStreamPass: settings.video.client_vulkan_stream_pass,
         });
     }
 
     trace_err!(trace_err!(java_vm.attach_current_thread())?.call_method(
         &*activity_ref,
         "onServerConnected",
-        "(FIZLjava/lang/String;)V",
+        "(FIZZZZLjava/lang/String;)V",
         &[
             config_packet.fps.into(),
-            (matches!(settings.video.codec, CodecType::HEVC) as i32).into(),
+            (settings.video.codec as i32).into(),
             settings.video.client_request_realtime_decoder.into(),
+            // Only the native decoder can run a second codec instance or feed an image reader
+            (settings.video.client_native_decoder
+                || settings.video.dual_stream_encoding
+                || settings.video.client_image_reader
+                || settings.video.client_vulkan_stream_pass)
+                .into(),
+            // The Vulkan stream pass imports the image reader buffers
+            (settings.video.client_image_reader || settings.video.client_vulkan_stream_pass).into(),
+            settings.video.dual_stream_encoding.into(),
             trace_err!(trace_err!(java_vm.attach_current_thread())?
                 .new_string(config_packet.dashboard_url))?
             .into()
@@ -363,16 +597,14 @@ async fn connection_pipeline(
     };
 
     let time_sync_send_loop = {
-        let control_sender = Arc::clone(&control_sender);
+        let mut socket_sender = stream_socket.request_stream(TIME_SYNC).await?;
         async move {
             let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
             *TIME_SYNC_SENDER.lock() = Some(data_sender);
 
             while let Some(time_sync) = data_receiver.recv().await {
-                control_sender
-                    .lock()
-                    .await
-                    .send(&ClientControlPacket::TimeSync(time_sync))
+                socket_sender
+                    .send_buffer(socket_sender.new_buffer(&time_sync, 0)?)
                     .await
                     .ok();
             }
@@ -387,13 +619,12 @@ async fn connection_pipeline(
             let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
             *VIDEO_ERROR_REPORT_SENDER.lock() = Some(data_sender);
 
-            while let Some(()) = data_receiver.recv().await {
-                control_sender
-                    .lock()
-                    .await
-                    .send(&ClientControlPacket::VideoErrorReport)
-                    .await
-                    .ok();
+            while let Some(last_good_frame_index) = data_receiver.recv().await {
+                let packet = match last_good_frame_index {
+                    Some(index) => ClientControlPacket::VideoFrameLoss(index),
+                    None => ClientControlPacket::VideoErrorReport,
+                };
+                control_sender.lock().await.send(&packet).await.ok();
             }
 
             Ok(())
@@ -434,54 +665,137 @@ async fn connection_pipeline(
 
     let (legacy_receive_data_sender, legacy_receive_data_receiver) = smpsc::channel();
     let legacy_receive_data_sender = Arc::new(Mutex::new(legacy_receive_data_sender));
+    // The legacy thread gives the buffers back once the FEC queue copied them, for the next packets
+    let (legacy_buffer_sender, legacy_buffer_receiver) = smpsc::channel::<Vec<u8>>();
+
+    // The legacy thread then reads the whole stream socket, video payloads go straight into the
+    // FEC queue
+    #[cfg(target_os = "android")]
+    let in_place_receive_loop = if settings.connection.client_zero_copy_receive
+        && !matches!(settings.connection.stream_protocol, SocketProtocol::Tcp)
+    {
+        let header_size = trace_err!(bincode::serialized_size(&VideoFrameHeaderPacket::default()))?;
+        Some(
+            stream_socket
+                .in_place_receive_loop(VIDEO, header_size as _)
+                .await?,
+        )
+    } else {
+        None
+    };
+    #[cfg(target_os = "android")]
+    let receive_in_place = in_place_receive_loop.is_some();
+    #[cfg(not(target_os = "android"))]
+    let receive_in_place = false;
 
-    let video_receive_loop = {
+    let video_receive_loop: BoxFuture<StrResult> = if receive_in_place {
+        Box::pin(future::pending())
+    } else {
         let mut receiver = stream_socket
             .subscribe_to_stream::<VideoFrameHeaderPacket>(VIDEO)
             .await?;
         let legacy_receive_data_sender = legacy_receive_data_sender.clone();
-        async move {
+        Box::pin(async move {
             loop {
-                let packet = receiver.recv().await?;
-
-                let mut buffer = vec![0_u8; mem::size_of::<VideoFrame>() + packet.buffer.len()];
-                let header = VideoFrame {
-                    type_: 9, // ALVR_PACKET_TYPE_VIDEO_FRAME
-                    packetCounter: packet.header.packet_counter,
-                    trackingFrameIndex: packet.header.tracking_frame_index,
-                    videoFrameIndex: packet.header.video_frame_index,
-                    sentTime: packet.header.sent_time,
-                    frameByteSize: packet.header.frame_byte_size,
-                    fecIndex: packet.header.fec_index,
-                    fecPercentage: packet.header.fec_percentage,
-                };
+                // Forward the packets that arrived together in one batch, so the legacy thread
+                // wakes up once for all of them
+                let mut batch = vec![];
+                let mut maybe_packet = Some(receiver.recv().await);
+                while let Some(packet) = maybe_packet {
+                    let packet = packet?;
+                    let buffer = legacy_buffer_receiver.try_recv().unwrap_or_default();
+                    batch.push(to_legacy_video_frame(&packet, buffer));
+                    receiver.recycle(packet.buffer);
+
+                    maybe_packet = receiver.try_recv();
+                }
 
-                buffer[..mem::size_of::<VideoFrame>()].copy_from_slice(unsafe {
-                    &mem::transmute::<_, [u8; mem::size_of::<VideoFrame>()]>(header)
-                });
-                buffer[mem::size_of::<VideoFrame>()..].copy_from_slice(&packet.buffer);
+                legacy_receive_data_sender.lock().await.send(batch).ok();
+            }
+        })
+    };
 
-                legacy_receive_data_sender.lock().await.send(buffer).ok();
+    let haptics_receive_loop = {
+        let mut receiver = stream_socket
+            .subscribe_to_stream::<Vec<Haptics>>(HAPTICS)
+            .await?;
+        async move {
+            loop {
+                // Events of the devices merged by the server over a short window
+                for haptics in receiver.recv().await?.header {
+                    unsafe {
+                        crate::onHapticsFeedbackNative(
+                            haptics.path,
+                            haptics.duration.as_secs_f32(),
+                            haptics.frequency,
+                            haptics.amplitude,
+                        )
+                    };
+                }
             }
         }
     };
 
-    let haptics_receive_loop = {
+    let time_sync_receive_loop = {
         let mut receiver = stream_socket
-            .subscribe_to_stream::<Haptics>(HAPTICS)
+            .subscribe_to_stream::<TimeSyncPacket>(TIME_SYNC)
             .await?;
+        let legacy_receive_data_sender = legacy_receive_data_sender.clone();
         async move {
             loop {
-                let packet = receiver.recv().await?.header;
-
-                unsafe {
-                    crate::onHapticsFeedbackNative(
-                        packet.path,
-                        packet.duration.as_secs_f32(),
-                        packet.frequency,
-                        packet.amplitude,
-                    )
+                let packet = receiver.recv().await?;
+                let data = packet.header;
+
+                let time_sync = TimeSync {
+                    type_: 7, // ALVR_PACKET_TYPE_TIME_SYNC
+                    mode: data.mode,
+                    serverTime: data.server_time,
+                    clientTime: data.client_time,
+                    sequence: packet.packet_index as u64,
+                    packetsLostTotal: data.packets_lost_total,
+                    packetsLostInSecond: data.packets_lost_in_second,
+                    averageTotalLatency: 0,
+                    averageSendLatency: data.average_send_latency,
+                    averageTransportLatency: data.average_transport_latency,
+                    averageDecodeLatency: data.average_decode_latency,
+                    idleTime: data.idle_time,
+                    fecFailure: data.fec_failure,
+                    fecFailureInSecond: data.fec_failure_in_second,
+                    fecFailureTotal: data.fec_failure_total,
+                    fps: data.fps,
+                    predictionErrorRotation: data.prediction_error_rotation,
+                    predictionErrorPosition: data.prediction_error_position,
+                    predictionHorizon: data.prediction_horizon,
+                    predictionResidual: data.prediction_residual,
+                    fecRecoveryTime: data.fec_recovery_time,
+                    gpuTimeFfr: data.gpu_time_ffr,
+                    gpuTimeEyes: data.gpu_time_eyes,
+                    traceFrameIndex: data.trace_frame_index,
+                    traceTracking: data.trace_tracking,
+                    traceReceivedFirst: data.trace_received_first,
+                    traceReceivedLast: data.trace_received_last,
+                    traceDecoderInput: data.trace_decoder_input,
+                    traceDecoderOutput: data.trace_decoder_output,
+                    traceRendered: data.trace_rendered,
+                    traceSubmit: data.trace_submit,
+                    arrivalFrameIndex: data.arrival_frame_index,
+                    arrivalFirst: data.arrival_first,
+                    arrivalLast: data.arrival_last,
+                    arrivalPackets: data.arrival_packets,
+                    serverTotalLatency: data.server_total_latency,
+                    trackingRecvFrameIndex: data.tracking_recv_frame_index,
                 };
+
+                let mut buffer = vec![0_u8; mem::size_of::<TimeSync>()];
+                buffer.copy_from_slice(unsafe {
+                    &mem::transmute::<_, [u8; mem::size_of::<TimeSync>()]>(time_sync)
+                });
+
+                legacy_receive_data_sender
+                    .lock()
+                    .await
+                    .send(vec![buffer])
+                    .ok();
             }
         }
     };
@@ -495,7 +809,11 @@ async fn connection_pipeline(
         let nal_class_ref = Arc::clone(&nal_class_ref);
         let codec = settings.video.codec;
         let enable_fec = settings.connection.enable_fec;
+        let early_decode = settings.video.client_early_decode;
         move || -> StrResult {
+            // FEC recovery and NAL parsing run here, keep them off the little cores
+            let _affinity = BigCoreAffinity::new();
+
             let env = trace_err!(java_vm.attach_current_thread())?;
             let env_ptr = env.get_native_interface() as _;
             let activity_obj = activity_ref.as_obj();
@@ -506,27 +824,34 @@ async fn connection_pipeline(
                     env_ptr,
                     *activity_obj as _,
                     **nal_class as _,
-                    matches!(codec, CodecType::HEVC) as _,
+                    codec as _,
                     enable_fec,
+                    early_decode,
+                    video_packet_size,
                 );
 
+                #[cfg(target_os = "android")]
+                if let Some(receive_loop) = in_place_receive_loop {
+                    let res = receive_loop.run(&mut LegacyVideoReceiver {
+                        header: mem::zeroed(),
+                        legacy_receive_data_receiver: &legacy_receive_data_receiver,
+                        idr_request_deadline: None,
+                    });
+
+                    crate::closeSocket(env_ptr);
+
+                    return res;
+                }
+
                 let mut idr_request_deadline = None;
 
-                while let Ok(mut data) = legacy_receive_data_receiver.recv() {
-                    // Send again IDR packet every 2s in case it is missed
-                    // (due to dropped burst of packets at the start of the stream or otherwise).
-                    if !crate::IDR_PARSED.load(Ordering::Relaxed) {
-                        if let Some(deadline) = idr_request_deadline {
-                            if deadline < Instant::now() {
-                                crate::IDR_REQUEST_NOTIFIER.notify_waiters();
-                                idr_request_deadline = None;
-                            }
-                        } else {
-                            idr_request_deadline = Some(Instant::now() + Duration::from_secs(2));
-                        }
-                    }
+                while let Ok(batch) = legacy_receive_data_receiver.recv() {
+                    request_missing_idr(&mut idr_request_deadline);
 
-                    crate::legacyReceive(data.as_mut_ptr(), data.len() as _);
+                    for mut data in batch {
+                        crate::legacyReceive(data.as_mut_ptr(), data.len() as _);
+                        legacy_buffer_sender.send(data).ok();
+                    }
                 }
 
                 crate::closeSocket(env_ptr);
@@ -536,14 +861,30 @@ async fn connection_pipeline(
         }
     });
 
-    let tracking_interval = Duration::from_secs_f32(1_f32 / 360_f32);
+    // Sampled on a thread of its own: the period is a few milliseconds, which the tokio timer
+    // would round to whole milliseconds. The thread stops once the loop is dropped.
+    let tracking_interval = Duration::from_secs_f32(
+        1_f32 / (config_packet.fps * settings.headset.tracking_rate_multiplier.max(1) as f32),
+    );
     let tracking_loop = async move {
-        let mut deadline = Instant::now();
-        loop {
-            unsafe { crate::onTrackingNative(tracking_clientside_prediction) };
-            deadline += tracking_interval;
-            time::sleep_until(deadline).await;
-        }
+        let (_shutdown_notifier, shutdown_receiver) = smpsc::channel::<()>();
+        thread::spawn(move || {
+            let mut deadline = std::time::Instant::now();
+            loop {
+                unsafe { crate::onTrackingNative(tracking_clientside_prediction) };
+
+                // After a stall the next sample is taken right away, without a burst to catch up
+                let now = std::time::Instant::now();
+                deadline = (deadline + tracking_interval).max(now);
+                if let Err(smpsc::RecvTimeoutError::Disconnected) =
+                    shutdown_receiver.recv_timeout(deadline - now)
+                {
+                    break;
+                }
+            }
+        });
+
+        future::pending::<StrResult>().await
     };
 
     unsafe impl Send for crate::GuardianData {}
@@ -592,6 +933,7 @@ async fn connection_pipeline(
             let microphone_sender = stream_socket.request_stream(AUDIO).await?;
             Box::pin(audio::record_audio_loop(
                 config.sample_rate,
+                config.config.codec,
                 microphone_sender,
             ))
         }
@@ -603,10 +945,20 @@ async fn connection_pipeline(
 
     let keepalive_sender_loop = {
         let control_sender = Arc::clone(&control_sender);
+        let stream_socket = Arc::clone(&stream_socket);
         let java_vm = Arc::clone(&java_vm);
         let activity_ref = Arc::clone(&activity_ref);
         async move {
             loop {
+                if let Some(received) = stream_socket.path_reception() {
+                    control_sender
+                        .lock()
+                        .await
+                        .send(&ClientControlPacket::PathReception(received))
+                        .await
+                        .ok();
+                }
+
                 let res = control_sender
                     .lock()
                     .await
@@ -628,6 +980,27 @@ async fn connection_pipeline(
         }
     };
 
+    let transport_feedback_loop: BoxFuture<StrResult> = if settings.connection.transport_feedback {
+        let control_sender = Arc::clone(&control_sender);
+        let stream_socket = Arc::clone(&stream_socket);
+        Box::pin(async move {
+            loop {
+                if let Some(feedback) = stream_socket.transport_feedback() {
+                    control_sender
+                        .lock()
+                        .await
+                        .send(&ClientControlPacket::TransportFeedback(feedback))
+                        .await
+                        .ok();
+                }
+
+                time::sleep(FEEDBACK_INTERVAL).await;
+            }
+        })
+    } else {
+        Box::pin(future::pending())
+    };
+
     let control_loop = {
         let java_vm = Arc::clone(&java_vm);
         let activity_ref = Arc::clone(&activity_ref);
@@ -649,34 +1022,12 @@ async fn connection_pipeline(
                                 )?;
                                 break Ok(());
                             }
-                            Ok(ServerControlPacket::TimeSync(data)) => {
-                                let time_sync = TimeSync {
-                                    type_: 7, // ALVR_PACKET_TYPE_TIME_SYNC
-                                    mode: data.mode,
-                                    serverTime: data.server_time,
-                                    clientTime: data.client_time,
-                                    sequence: 0,
-                                    packetsLostTotal: data.packets_lost_total,
-                                    packetsLostInSecond: data.packets_lost_in_second,
-                                    averageTotalLatency: 0,
-                                    averageSendLatency: data.average_send_latency,
-                                    averageTransportLatency: data.average_transport_latency,
-                                    averageDecodeLatency: data.average_decode_latency,
-                                    idleTime: data.idle_time,
-                                    fecFailure: data.fec_failure,
-                                    fecFailureInSecond: data.fec_failure_in_second,
-                                    fecFailureTotal: data.fec_failure_total,
-                                    fps: data.fps,
-                                    serverTotalLatency: data.server_total_latency,
-                                    trackingRecvFrameIndex: data.tracking_recv_frame_index,
-                                };
-
-                                let mut buffer = vec![0_u8; mem::size_of::<TimeSync>()];
-                                buffer.copy_from_slice(unsafe {
-                                    &mem::transmute::<_, [u8; mem::size_of::<TimeSync>()]>(time_sync)
-                                });
-
-                                legacy_receive_data_sender.lock().await.send(buffer).ok();
+                            Ok(ServerControlPacket::VideoConfig(packet)) => unsafe {
+                                crate::decoderSetConfig(
+                                    packet.stream_index as _,
+                                    packet.config.as_ptr(),
+                                    packet.config.len() as _,
+                                );
                             },
                             Ok(_) => (),
                             Err(e) => {
@@ -695,7 +1046,11 @@ async fn connection_pipeline(
         }
     };
 
-    let receive_loop = async move { stream_socket.receive_loop().await };
+    let receive_loop: BoxFuture<StrResult> = if receive_in_place {
+        Box::pin(future::pending())
+    } else {
+        Box::pin(async move { stream_socket.receive_loop().await })
+    };
 
     // Run many tasks concurrently. Threading is managed by the runtime, for best performance.
     tokio::select! {
@@ -718,11 +1073,13 @@ async fn connection_pipeline(
         res = spawn_cancelable(playspace_sync_loop) => res,
         res = spawn_cancelable(input_send_loop) => res,
         res = spawn_cancelable(time_sync_send_loop) => res,
+        res = spawn_cancelable(time_sync_receive_loop) => res,
         res = spawn_cancelable(video_error_report_send_loop) => res,
         res = spawn_cancelable(views_config_send_loop) => res,
         res = spawn_cancelable(battery_send_loop) => res,
         res = spawn_cancelable(video_receive_loop) => res,
         res = spawn_cancelable(haptics_receive_loop) => res,
+        res = spawn_cancelable(transport_feedback_loop) => res,
         res = legacy_stream_socket_loop => trace_err!(res)?,
 
         // keep these loops on the current task
@@ -44,7 +44,7 @@ lazy_static! {
     static ref INPUT_SENDER: Mutex<Option<mpsc::UnboundedSender<Input>>> = Mutex::new(None);
     static ref TIME_SYNC_SENDER: Mutex<Option<mpsc::UnboundedSender<TimeSyncPacket>>> =
         Mutex::new(None);
-    static ref VIDEO_ERROR_REPORT_SENDER: Mutex<Option<mpsc::UnboundedSender<()>>> =
+    static ref VIDEO_ERROR_REPORT_SENDER: Mutex<Option<mpsc::UnboundedSender<Option<u64>>>> =
         Mutex::new(None);
     static ref VIEWS_CONFIG_SENDER: Mutex<Option<mpsc::UnboundedSender<ViewsConfig>>> =
         Mutex::new(None);
@@ -109,6 +109,70 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_setWaitin
     IDR_PARSED.store(!waiting, Ordering::Relaxed);
 }
 
+#[no_mangle]
+pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_createNativeDecoder(
+    env: JNIEnv,
+    _: JClass,
+    surface: JObject,
+    codec: i32,
+    realtime: bool,
+    image_reader: bool,
+    stream: i32,
+) {
+    createDecoder(
+        env.get_native_interface() as _,
+        *surface as _,
+        codec,
+        realtime,
+        image_reader,
+        stream,
+    );
+}
+
+#[no_mangle]
+pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_destroyNativeDecoder(
+    _: JNIEnv,
+    _: JClass,
+) {
+    destroyDecoder();
+}
+
+#[no_mangle]
+pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_renderNativeDecoder(
+    _: JNIEnv,
+    _: JClass,
+    stream: i32,
+) -> i64 {
+    decoderRender(stream)
+}
+
+#[no_mangle]
+pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_onFrameAvailableNativeDecoder(
+    _: JNIEnv,
+    _: JClass,
+    stream: i32,
+) {
+    decoderFrameAvailable(stream);
+}
+
+#[no_mangle]
+pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_clearAvailableNativeDecoder(
+    _: JNIEnv,
+    _: JClass,
+    stream: i32,
+) -> i64 {
+    decoderClearAvailable(stream)
+}
+
+#[no_mangle]
+pub unsafe extern "system" fn Java_com_polygraphene_alvr_DecoderThread_setStoppedNativeDecoder(
+    _: JNIEnv,
+    _: JClass,
+    stopped: bool,
+) {
+    decoderSetStopped(stopped);
+}
+
 #[no_mangle]
 pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onCreateNative(
     env: JNIEnv,
@@ -132,6 +196,8 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onCreateNat
         if let Some(sender) = &*INPUT_SENDER.lock() {
             let input = Input {
                 target_timestamp: Duration::from_nanos(data.targetTimestampNs),
+                // VrApi has no eye tracking
+                eye_gaze: None,
                 device_motions: vec![
                     (
                         *HEAD_ID,
@@ -296,6 +362,25 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onCreateNat
                 fec_failure_in_second: data.fecFailureInSecond,
                 fec_failure_total: data.fecFailureTotal,
                 fps: data.fps,
+                prediction_error_rotation: data.predictionErrorRotation,
+                prediction_error_position: data.predictionErrorPosition,
+                prediction_horizon: data.predictionHorizon,
+                prediction_residual: data.predictionResidual,
+                fec_recovery_time: data.fecRecoveryTime,
+                gpu_time_ffr: data.gpuTimeFfr,
+                gpu_time_eyes: data.gpuTimeEyes,
+                trace_frame_index: data.traceFrameIndex,
+                trace_tracking: data.traceTracking,
+                trace_received_first: data.traceReceivedFirst,
+                trace_received_last: data.traceReceivedLast,
+                trace_decoder_input: data.traceDecoderInput,
+                trace_decoder_output: data.traceDecoderOutput,
+                trace_rendered: data.traceRendered,
+                trace_submit: data.traceSubmit,
+                arrival_frame_index: data.arrivalFrameIndex,
+                arrival_first: data.arrivalFirst,
+                arrival_last: data.arrivalLast,
+                arrival_packets: data.arrivalPackets,
                 server_total_latency: data.serverTotalLatency,
                 tracking_recv_frame_index: data.trackingRecvFrameIndex,
             };
@@ -306,10 +391,20 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onCreateNat
 
     extern "C" fn video_error_report_send() {
         if let Some(sender) = &*VIDEO_ERROR_REPORT_SENDER.lock() {
-            sender.send(()).ok();
+            sender.send(None).ok();
+        }
+    }
+
+    extern "C" fn video_frame_loss_send(last_good_frame_index: u64) {
+        if let Some(sender) = &*VIDEO_ERROR_REPORT_SENDER.lock() {
+            sender.send(Some(last_good_frame_index)).ok();
         }
     }
 
+    extern "C" fn set_waiting_next_idr(waiting: bool) {
+        IDR_PARSED.store(!waiting, Ordering::Relaxed);
+    }
+
     extern "C" fn views_config_send(fov: *mut EyeFov, ipd_m: f32) {
         let fov = unsafe { slice::from_raw_parts(fov, 2) };
         if let Some(sender) = &*VIEWS_CONFIG_SENDER.lock() {
@@ -351,6 +446,8 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onCreateNat
     inputSend = Some(input_send);
     timeSyncSend = Some(time_sync_send);
     videoErrorReportSend = Some(video_error_report_send);
+    videoFrameLossSend = Some(video_frame_loss_send);
+    setWaitingNextIDR = Some(set_waiting_next_idr);
     viewsConfigSend = Some(views_config_send);
     batterySend = Some(battery_send);
 
@@ -367,6 +464,12 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onCreateNat
             "I",
             result.streamSurfaceHandle.into()
         ))?;
+        trace_err!(env.set_field(
+            jout_result,
+            "secondStreamSurfaceHandle",
+            "I",
+            result.secondStreamSurfaceHandle.into()
+        ))?;
         trace_err!(env.set_field(
             jout_result,
             "loadingSurfaceHandle",
@@ -399,8 +502,9 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_renderNativ
 pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_renderLoadingNative(
     _: JNIEnv,
     _: JObject,
+    message_changed: u8,
 ) {
-    renderLoadingNative()
+    renderLoadingNative(message_changed == 1)
 }
 
 #[no_mangle]
@@ -440,6 +544,9 @@ pub unsafe extern "system" fn Java_com_polygraphene_alvr_OvrActivity_onResumeNat
             recommended_eye_height: result.recommendedEyeHeight as _,
             available_refresh_rates,
             preferred_refresh_rate,
+            // Measured for each connection
+            path_mtu: 0,
+            resume_token: 0,
             reserved: format!("{}", *ALVR_VERSION),
         };
 
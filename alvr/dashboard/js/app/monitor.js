@@ -69,6 +69,9 @@ define([
                 initNotificationLevel();
                 initAddClientModal(templateAddClient);
                 initPerformanceGraphs();
+                initFrameTrace();
+                initFrameCapture();
+                initRecording();
 
                 updateClients();
             });
@@ -115,6 +118,109 @@ define([
             }
         }
 
+        function initFrameTrace() {
+            $("#writeFrameTrace").click(() => {
+                $.ajax({
+                    type: "POST",
+                    url: "api/frame-trace/write",
+                    success: () => {
+                        Lobibox.notify("success", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["frameTraceWritten"],
+                        });
+                    },
+                    error: () => {
+                        Lobibox.notify("error", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["error_FrameTraceUnavailable"],
+                        });
+                    },
+                });
+            });
+        }
+
+        function initFrameCapture() {
+            $("#captureFrames").click(() => {
+                $.ajax({
+                    type: "POST",
+                    url: "api/frame-capture/write",
+                    success: () => {
+                        Lobibox.notify("success", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["framesCaptured"],
+                        });
+                    },
+                    error: () => {
+                        Lobibox.notify("error", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["error_FrameCaptureUnavailable"],
+                        });
+                    },
+                });
+            });
+        }
+
+        function initRecording() {
+            $("#startRecording").click(() => {
+                $.ajax({
+                    type: "POST",
+                    url: "api/recording/start",
+                    success: () => {
+                        Lobibox.notify("success", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["recordingStarted"],
+                        });
+                    },
+                    error: () => {
+                        Lobibox.notify("error", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["error_RecordingUnavailable"],
+                        });
+                    },
+                });
+            });
+            $("#stopRecording").click(() => {
+                $.ajax({
+                    type: "POST",
+                    url: "api/recording/stop",
+                    success: () => {
+                        Lobibox.notify("success", {
+                            size: "mini",
+                            rounded: true,
+                            delayIndicator: false,
+                            sound: false,
+                            position: "bottom right",
+                            msg: i18n["recordingStopped"],
+                        });
+                    },
+                });
+            });
+        }
+
         function initAddClientModal(template) {
             $("#showAddClientModal").click(() => {
                 $("#addClientModal").remove();
@@ -35,6 +35,13 @@ define({
         totalSent: "Total sent",
         sentRate: "Sent rate",
         bitrate: "Bitrate",
+        encodedBitrate: "Encoder output / usage",
+        encodedFrameSize: "Frame size",
+        intraFramess: "Intra frames / s",
+        encodeQp: "Encoder QP",
+        encoderLatency: "Encoder time / load",
+        gpuLoad: "GPU 3D / encoder / clock",
+        pcieRate: "PCIe TX / RX",
         ping: "Ping",
         totalLatency: "Total latency",
         encodeLatency: "Encoder Latency",
@@ -44,8 +51,26 @@ define({
         fecPercentage: "Fec percentage",
         fecFailureTotal: "Fec failure total",
         fecFailureInSecond: "Fec failure / s",
+        fecRecoveryTime: "Fec recovery time",
+        clientGpuTime: "Client GPU decompress / eyes",
         clientFPS: "Client FPS",
         serverFPS: "Server FPS",
+        predictionError: "Prediction error",
+        predictionHorizon: "Prediction horizon / residual",
+        composePercentiles: "Compose p50/p95/p99",
+        encodePercentiles: "Encode p50/p95/p99",
+        sendPercentiles: "Send p50/p95/p99",
+        transportPercentiles: "Transport p50/p95/p99",
+        decodePercentiles: "Decode p50/p95/p99",
+        renderPercentiles: "Render p50/p95/p99",
+        writeFrameTrace: "Export frame trace",
+        frameTraceWritten: "Frame trace written to frame_trace.json next to the session file",
+        captureFrames: "Capture frames",
+        framesCaptured: "Frames written to the frame_capture folder next to the session file",
+        startRecording: "Start recording",
+        stopRecording: "Stop recording",
+        recordingStarted: "Recording the video to the recordings folder next to the session file",
+        recordingStopped: "Recording stopped",
         packets: "Packets",
         packetss: "Packets / s",
         batteries: "Batteries",
@@ -58,6 +83,9 @@ define({
         error_DuplicateHostname: "A device with this hostname is already registered",
         error_DuplicateIp: "This IP address is already registed on this device",
         error_InvalidIp: "Not a valid IPv4 formatted address",
+        error_FrameTraceUnavailable: "No client is streaming, there is no frame trace",
+        error_FrameCaptureUnavailable: "No frame is being encoded, or the platform cannot capture frames",
+        error_RecordingUnavailable: "No client is streaming, or a recording is already running",
         // Performance graphs tab
         performanceGraphs: "Performance graphs",
         performanceNetwork: "Network",
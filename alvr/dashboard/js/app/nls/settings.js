@@ -3,10 +3,19 @@ define({
         // Video tab
         "_root_video_tab.name": "Video",
         "_root_video_adapterIndex.name": "GPU index", // adv
+        "_root_video_encoderAdapterIndex.name": "Encoder GPU index (Windows)", // adv
+        "_root_video_encoderAdapterIndex.description":
+            "Encode the video on another GPU than the one rendering, for example the integrated GPU of a laptop. -1 encodes on the rendering GPU. Falls back to the rendering GPU if the two cannot share textures.",
+        "_root_video_encoderDedicatedDevice.name": "Dedicated encoder device (Windows)", // adv
+        "_root_video_encoderDedicatedDevice.description":
+            "Encode on a D3D11 device of its own with the highest GPU priority, so that the encoder work is not queued behind the frames of the game. Ignored when encoding on another GPU.",
         "_root_video_displayRefreshRate.name": "Refresh rate",
         "_root_video_displayRefreshRate.description":
             "Refresh rate to set for both SteamVR and the headset. Higher values require faster PC. 72 Hz is the maximum for Quest 1.",
         "_root_video_preferredFps.name": "Custom refresh rate", // adv
+        "_root_video_halfRateStreaming.name": "Half rate streaming", // adv
+        "_root_video_halfRateStreaming.description":
+            "SteamVR runs at half the refresh rate of the headset, which halves the rendering and encoding load of the PC and the bitrate per second. The headset shows each frame twice and only reprojects the rotation of the head for the second one: head rotation stays smooth, while head translation, parallax and animations update at half rate. Oculus client only.",
         "_root_video_resolutionDropdown.name": "Video resolution",
         "_root_video_resolutionDropdown.description":
             "100% results in the native resolution of the Oculus Quest. \nSetting the resolution can bring some improvement in visual quality, but is not recommended. \nA resolution lower than 100% can reduce latency and increase network performance",
@@ -22,6 +31,48 @@ define({
         "_root_video_secondsFromVsyncToPhotons.name": "Seconds from VSync to image", // adv
         "_root_video_secondsFromVsyncToPhotons.description":
             "The time elapsed from the virtual VSync until the image is visible on the viewer screen", // adv
+        "_root_video_preciseVsync.name": "Precise VSync timer", // adv
+        "_root_video_preciseVsync.description":
+            "Time the VSync of SteamVR with a high resolution timer and a short spin before each event, instead of a plain sleep that can be late by up to a millisecond.", // adv
+        "_root_video_idlePowerSave.name": "Idle power save", // adv
+        "_root_video_idlePowerSave.description":
+            "While the headset is off the head or the client app is in the background, SteamVR renders at a few frames per second and no video is encoded. The stream resumes with a keyframe on the first frame after the headset is put back on.", // adv
+        "_root_video_vsyncPhaseLock.name": "VSync phase lock", // adv
+        "_root_video_vsyncPhaseLock_enabled.description":
+            "Shift the VSync of SteamVR so that frames are decoded on the headset just before it displays them, instead of waiting there.", // adv
+        "_root_video_vsyncPhaseLock_content_queueWaitTarget.name": "Queue wait target (us)", // adv
+        "_root_video_vsyncPhaseLock_content_queueWaitTarget.description":
+            "Margin that frames keep on the headset between the decoder and the display. Lower values cut latency, higher values absorb more network jitter.", // adv
+        "_root_video_sendQueue.name": "Video send queue limits", // adv
+        "_root_video_sendQueue_enabled.description":
+            "Drop frames that waited too long to be sent, for example during a network stall, and resume on a new IDR frame instead of working through the backlog.", // adv
+        "_root_video_sendQueue_content_maxFrames.name": "Max queued frames", // adv
+        "_root_video_sendQueue_content_frameDeadlineMs.name": "Frame deadline (ms)", // adv
+        "_root_video_sendQueue_content_frameDeadlineMs.description":
+            "Age after which a frame that is still waiting to be sent is dropped", // adv
+        "_root_video_threadPolicy.name": "Thread scheduling", // adv
+        "_root_video_threadPolicy_realtimePriority.name": "Realtime priority", // adv
+        "_root_video_threadPolicy_realtimePriority.description":
+            "Run the vsync, tracking and encoder threads before the threads of the game: MMCSS on Windows, SCHED_FIFO or a lower nice level on Linux, which needs the rtprio or nice limit to be raised.", // adv
+        "_root_video_threadPolicy_encoderCpuMask.name": "Encoder CPU mask", // adv
+        "_root_video_threadPolicy_encoderCpuMask.description":
+            "Bit mask of the CPUs the thread may run on, for example 12 for CPUs 2 and 3. 0 does not pin the thread.", // adv
+        "_root_video_threadPolicy_vsyncCpuMask.name": "VSync CPU mask", // adv
+        "_root_video_threadPolicy_trackingCpuMask.name": "Tracking CPU mask", // adv
+        "_root_video_threadPolicy_presentCpuMask.name": "Present CPU mask (Linux)", // adv
+        "_root_video_threadPolicy_networkCpuMask.name": "Network CPU mask", // adv
+        "_root_video_frameCaptureHistory.name": "Frame capture history (Windows)", // adv
+        "_root_video_frameCaptureHistory.description":
+            "Composed frames kept in memory and written with the next frame capture, to look at the frames before a hitch. Each kept frame is read back from the GPU, 0 only captures the next frame.", // adv
+        "_root_video_encodeArbitration.name": "Encoder sharing (Windows)", // adv
+        "_root_video_encodeArbitration_enabled.description":
+            "Share the hardware encoder with the ALVR servers of the other SteamVR instances of this machine. Their frames are encoded in the order of their deadlines.", // adv
+        "_root_video_encodeArbitration_content_maxSessions.name": "Maximum encoder sessions", // adv
+        "_root_video_encodeArbitration_content_maxSessions.description":
+            "Streams started once this many encoders are open fail with an error instead of a driver failure.", // adv
+        "_root_video_encodeArbitration_content_concurrentEncodes.name": "Concurrent encodes", // adv
+        "_root_video_encodeArbitration_content_concurrentEncodes.description":
+            "Frames encoded at the same time by all the servers.", // adv
         "_root_video_foveatedRendering.name": "Foveated encoding",
         // "_root_video_foveatedRendering.description": use "_root_video_foveatedRendering_enabled.description"
         "_root_video_foveatedRendering_enabled.description":
@@ -44,6 +95,36 @@ define({
         "_root_video_foveatedRendering_content_edgeRatioY.name": "Vertical compression ratio",
         "_root_video_foveatedRendering_content_edgeRatioY.description":
             "Compression strength of the top and bottom edges",
+        "_root_video_foveatedRendering_content_singlePassDecompression.name": "Single pass decompression", // adv
+        "_root_video_foveatedRendering_content_singlePassDecompression.description":
+            "Decompress the foveated frame directly while rendering the eye layers on the headset, instead of expanding it to an intermediate texture first. Saves a full resolution render pass on the headset GPU.", // adv
+        "_root_video_foveatedRendering_content_directCompositorLayer.name": "Direct compositor layer", // adv
+        "_root_video_foveatedRendering_content_directCompositorLayer.description":
+            "Expand the foveated frame straight into the layer submitted to the headset compositor, instead of rendering it again into the eye layers. Saves a full resolution render pass on the headset GPU. Not used with single pass decompression.", // adv
+        "_root_video_foveatedRendering_content_followGaze.name": "Follow eye gaze",
+        "_root_video_foveatedRendering_content_followGaze.description":
+            "Moves the full resolution center of each frame to where the eyes look, for headsets that send their eye gaze. The center can then be made much smaller. Center shift is ignored while the gaze is known. Needs the fused composition on Windows, the Vulkan pre-encode stage on Linux.",
+        "_root_video_foveatedEncoding.name": "Foveated quantization",
+        // "_root_video_foveatedEncoding.description": use "_root_video_foveatedEncoding_enabled.description"
+        "_root_video_foveatedEncoding_enabled.description":
+            "Encodes the periphery of the vision with coarser quantization, around the center set in Foveated encoding. Saves bitrate without resampling the image, with or without Foveated encoding enabled. Supported by NVENC, AMF, VAAPI and the software encoder.",
+        "_root_video_foveatedEncoding_content_peripheryQpOffset.name": "Periphery QP offset",
+        "_root_video_foveatedEncoding_content_peripheryQpOffset.description":
+            "Quantization added at the frame edges, it ramps up from the uncompressed center. Higher values save more bitrate but blur the periphery",
+        "_root_video_dynamicResolution.name": "Dynamic resolution",
+        // "_root_video_dynamicResolution.description": use "_root_video_dynamicResolution_enabled.description"
+        "_root_video_dynamicResolution_enabled.description":
+            "Lowers the resolution of the streamed frames while the encoder cannot keep up or the network cannot carry the configured bitrate, and raises it back once there is headroom. The stream keeps its size, the headset scales the image back up.",
+        "_root_video_dynamicResolution_content_minimumScale.name": "Minimum scale",
+        "_root_video_dynamicResolution_content_minimumScale.description":
+            "Lowest fraction of the width and height of the frames the resolution is reduced to",
+        "_root_video_clientUpscaling.name": "Client upscaling",
+        // "_root_video_clientUpscaling.description": use "_root_video_clientUpscaling_enabled.description"
+        "_root_video_clientUpscaling_enabled.description":
+            "Upscales the stream to the display resolution on the headset, following the edges of the image and sharpening it, instead of letting the compositor stretch it. Lower \"Video encoding resolution base\" to stream a fraction of the display resolution for less encode time and bitrate. Oculus client only.",
+        "_root_video_clientUpscaling_content_sharpness.name": "Sharpness",
+        "_root_video_clientUpscaling_content_sharpness.description":
+            "Strength of the sharpening after the upscale. The sharpening is limited by the local contrast so it does not ring around edges",
         "_root_video_colorCorrection.name": "Color correction",
         // "_root_video_colorCorrection.description": use "_root_video_colorCorrection_enabled.description"
         "_root_video_colorCorrection_enabled.description":
@@ -65,18 +146,90 @@ define({
             "Sharpness: emphasizes the edges of the image.",
         "_root_video_codec-choice-.name": "Video codec",
         "_root_video_codec-choice-.description":
-            "HEVC is preferred to achieve better visual quality on lower bitrates. AMD video cards work best with HEVC.",
+            "HEVC is preferred to achieve better visual quality on lower bitrates. AMD video cards work best with HEVC. AV1 gives the best quality at low bitrates, it needs a recent GPU and a headset that can decode it. On Windows it is only supported by the software encoder.",
         "_root_video_codec_H264-choice-.name": "h264",
         "_root_video_codec_HEVC-choice-.name": "HEVC (h265)",
+        "_root_video_codec_AV1-choice-.name": "AV1",
         "_root_video_clientRequestRealtimeDecoder.name":
             "Request realtime decoder priority (client)", // adv
+        "_root_video_clientNativeDecoder.name": "Native decoder (client)", // adv
+        "_root_video_clientNativeDecoder.description":
+            "Decode with the NDK MediaCodec, frames are copied straight into the decoder input buffers instead of going through Java.",
+        "_root_video_clientImageReader.name": "Image reader decoder output (client)", // adv
+        "_root_video_clientImageReader.description":
+            "Import the decoded frames into the renderer as hardware buffers instead of going through a SurfaceTexture. Enables the native decoder, needs Android 8 or later.",
+        "_root_video_clientVulkanStreamPass.name": "Vulkan stream pass (client)", // adv
+        "_root_video_clientVulkanStreamPass.description":
+            "Convert and scale the decoded frames in Vulkan before the eye pass. Enables the image reader, not used with foveated encoding or upscaling. Falls back to OpenGL if Vulkan 1.1 is not available.",
+        "_root_video_clientPresentationMode-choice-.name": "Frame presentation (client)", // adv
+        "_root_video_clientPresentationMode-choice-.description":
+            "Which decoded frame the headset shows at each refresh when the network delivers them unevenly. Latest wins shows the newest frame and drops the older ones, for the lowest latency. A target depth queues the frames that many refreshes ahead and shows them one per refresh, which smooths out network jitter at the cost of that much latency. Native decoder only.",
+        "_root_video_clientPresentationMode_latestWins-choice-.name": "Latest wins", // adv
+        "_root_video_clientPresentationMode_targetDepth-choice-.name": "Target depth", // adv
+        "_root_video_clientEarlyDecode.name": "Early decode submission (client)", // adv
+        "_root_video_clientEarlyDecode.description":
+            "Queue each slice to the decoder as soon as it arrives instead of waiting for the whole frame. Needs the native decoder and more than one slice per frame to make a difference.",
         "_root_video_use10bitEncoder.name":
-            "Reduce color banding (newer nVidia cards or SW encoding only)",
+            "Reduce color banding (10 bit encoding)",
         "_root_video_use10bitEncoder.description":
-            "This increases visual quality by streaming 10 bit per color channel instead of 8",
+            "This increases visual quality by streaming 10 bit per color channel instead of 8. With H.265 (and AV1 on Linux) the hardware encoders encode Main10 from P010 frames, 10 bit H.264 needs the software encoder.",
         "_root_video_swThreadCount.name": "Number of threads (software encoding)",
         "_root_video_swThreadCount.description":
             "Sets the amount of threads to use when using software encoding. Setting to 0 will use the max amount available.",
+        "_root_video_swFrameThreads.name": "Frame threads (software encoding)", // adv
+        "_root_video_swFrameThreads.description":
+            "Encode several frames in parallel instead of splitting each frame between threads. Higher throughput, but adds one frame of latency per thread.",
+        "_root_video_swIntraRefresh.name": "Intra refresh (software encoding)", // adv
+        "_root_video_swIntraRefresh.description":
+            "Refresh the picture with a moving column of intra blocks instead of periodic keyframes, which avoids bitrate spikes.",
+        "_root_video_swPinThreads.name": "Pin encoder threads (software encoding, Linux)", // adv
+        "_root_video_swPinThreads.description":
+            "Restrict the encoder threads to the last CPUs, as many as the number of threads.",
+        "_root_video_swHoldFrameDeadline.name": "Hold frame deadline (software encoding, Linux)", // adv
+        "_root_video_swHoldFrameDeadline.description":
+            "Lower the bitrate when a frame takes longer than the frame interval to encode.",
+        "_root_video_dropLateFrames.name": "Drop late frames", // adv
+        "_root_video_dropLateFrames.description":
+            "Skip the encoding of a frame when, going by the measured latencies, it would reach the headset after its display time. The next frame is encoded instead, so that the latency does not build up when the encoder or the network falls behind.",
+        "_root_video_slicesPerFrame.name": "Slices per frame", // adv
+        "_root_video_slicesPerFrame.description":
+            "Split each frame into independently coded slices. More slices let encoders work in parallel and contain the damage of lost packets, at a small bitrate cost.",
+        "_root_video_intraRefreshFrames.name": "Intra refresh on packet loss", // adv
+        "_root_video_intraRefreshFrames.description":
+            "Recover from packet loss with an intra refresh spread over this many frames instead of a keyframe, which avoids bitrate spikes. 0 uses keyframes. Encoders without intra refresh support keep using keyframes.",
+        "_root_video_referenceFrameInvalidation.name": "Reference frame invalidation", // adv
+        "_root_video_referenceFrameInvalidation.description":
+            "When frames are lost, the encoder stops referencing them and predicts the next frame from the last one the client decoded, instead of sending a keyframe or an intra refresh. Falls back to those when the encoder cannot do it (Linux, software encoder) or the good frame is too old.",
+        "_root_video_dualStreamEncoding.name": "Dual stream encoding (NVENC)", // adv
+        "_root_video_dualStreamEncoding.description":
+            "Encode each eye with its own NVENC session, which run concurrently on GPUs with several encoder engines and stay under the per session resolution limits. The bitrate is shared by the two streams. The client decodes them with two native decoders. Only the Windows NVENC encoder and the Oculus client support it.",
+        "_root_video_yuvOutput.name": "Render into YUV (Windows)", // adv
+        "_root_video_yuvOutput.description":
+            "Convert the composed frame to NV12 on the GPU so the encoder receives YUV directly. This skips the colour conversion of the hardware encoders and the CPU conversion of the software encoder. Not used with the 10 bit encoder.",
+        "_root_video_linuxSwapchainImages.name": "Swapchain images (Linux)", // adv
+        "_root_video_linuxSwapchainImages.description":
+            "Number of images SteamVR renders into. 2 gives the lowest latency, 4 lets rendering run ahead when encoding is slow.",
+        "_root_video_linuxEarlyPresentNotify.name": "Early present notify (Linux)", // adv
+        "_root_video_linuxEarlyPresentNotify.description":
+            "Hand frames to the encoder as soon as SteamVR submits them, the encoder waits for the rendering on the GPU. Needs timeline semaphore support from the driver. When disabled the frame is only sent once the CPU sees the rendering done.",
+        "_root_video_linuxLayerCopy.name": "Copy swapchain images in the layer (Linux)", // adv
+        "_root_video_linuxLayerCopy.description":
+            "SteamVR renders into images with only the usage it asks for, so that the driver can keep them compressed, and the layer copies each frame into images shared with the encoder. Costs a copy on the GPU, reported as the layer copy time. Restart SteamVR to apply.",
+        "_root_video_linuxLayerAsyncCopy.name": "Copy on a separate queue (Linux)", // adv
+        "_root_video_linuxLayerAsyncCopy.description":
+            "With the layer copy, copy on a transfer or async compute queue of its own instead of after the rendering of SteamVR. SteamVR gets each image back as soon as it is copied, without waiting for the encoder. Needs timeline semaphore support from the driver. Restart SteamVR to apply.",
+        "_root_video_linuxEncodePipelineDepth.name": "Encode pipeline depth (Linux)", // adv
+        "_root_video_linuxEncodePipelineDepth.description":
+            "Frames that can be queued in the encoder while packets are retrieved on a separate thread. 0 encodes one frame at a time.",
+        "_root_video_nvencPipelineDepth.name": "NVENC pipeline depth (Windows)", // adv
+        "_root_video_nvencPipelineDepth.description":
+            "Frames that can be queued in NVENC while packets are retrieved on a separate thread, so the next frame is accepted without waiting for the previous one. Frames are then copied instead of encoded in place. 0 encodes one frame at a time.",
+        "_root_video_nvencMotionHints.name": "NVENC motion hints (Windows)", // adv
+        "_root_video_nvencMotionHints.description":
+            "Give NVENC the motion of the picture computed from the head rotation between frames as a motion estimation hint, so that fast head turns are predicted better. H.264 and HEVC only.",
+        "_root_video_nvencInterEyeHints.name": "NVENC inter-eye hints (Windows)", // adv
+        "_root_video_nvencInterEyeHints.description":
+            "Also give NVENC the position of the same content in the other eye, from the IPD and the eye fields of view, so that the motion search reaches across the middle of the frame. Needs the motion hints and a single stream. H.264 and HEVC only.",
         "_root_video_encodeBitrateMbs.name": "Video Bitrate",
         "_root_video_encodeBitrateMbs.description":
             "Bitrate of video streaming. 30Mbps is recommended. \nHigher bitrates result in better image but also higher latency and network traffic ",
@@ -102,13 +255,13 @@ define({
             "The target latency is offset by this amount", // adv
         "_root_video_adaptiveBitrate_content_latencyThreshold.name": "Latency threshold (us)", // adv
         "_root_video_adaptiveBitrate_content_latencyThreshold.description":
-            "Adaptive bitrate will adjust bitrate when the network latency reaches the latency threshold", // adv
+            "Adaptive bitrate will decrease bitrate when the network latency exceeds the target by this threshold", // adv
         "_root_video_adaptiveBitrate_content_bitrateUpRate.name": "Bitrate increasing rate", // adv
         "_root_video_adaptiveBitrate_content_bitrateUpRate.description":
-            "How much to increase bitrate when the network latency reaches the latency threshold", // adv
+            "Bitrate added per second (Mbps) while probing close to the last measured network capacity. Far from it the bitrate grows by 8% per second", // adv
         "_root_video_adaptiveBitrate_content_bitrateDownRate.name": "Bitrate decreasing rate", // adv
         "_root_video_adaptiveBitrate_content_bitrateDownRate.description":
-            "How much to decrease bitrate when the network latency reaches the latency threshold", // adv
+            "Minimum bitrate decrease (Mbps) when the network is congested. The bitrate drops to at least 85% of the rate received by the client", // adv
         "_root_video_adaptiveBitrate_content_bitrateLightLoadThreshold.name":
             "Bitrate light load threshold", // adv
         "_root_video_adaptiveBitrate_content_bitrateLightLoadThreshold.description":
@@ -133,7 +286,17 @@ define({
         "_root_audio_gameAudio_content_config.name": "Configuration",
         "_root_audio_gameAudio_content_config_averageBufferingMs.name": "Buffering (ms)",
         "_root_audio_gameAudio_content_config_averageBufferingMs.description":
-            "Increasing this value may reduce audio stuttering.",
+            "Increasing this value may reduce audio stuttering. With adaptive buffering this is the maximum buffering.",
+        "_root_audio_gameAudio_content_config_adaptiveBuffering.name": "Adaptive buffering",
+        "_root_audio_gameAudio_content_config_adaptiveBuffering.description":
+            "Follows the jitter of the network, measured over the last seconds, to buffer as little audio as possible without stuttering.",
+        "_root_audio_gameAudio_content_config_codec-choice-.name": "Codec", // adv
+        "_root_audio_gameAudio_content_config_codec-choice-.description":
+            "Opus reduces the bandwidth and can recover lost packets, at the cost of some latency. It is only used at 8, 12, 16, 24 or 48 kHz, otherwise the audio is sent in PCM.", // adv
+        "_root_audio_gameAudio_content_config_codec_pcm-choice-.name": "PCM", // adv
+        "_root_audio_gameAudio_content_config_codec_opus-choice-.name": "Opus", // adv
+        "_root_audio_gameAudio_content_config_codec_opus_frameMs.name": "Frame duration (ms)", // adv
+        "_root_audio_gameAudio_content_config_codec_opus_bitrateKbps.name": "Bitrate (kbps)", // adv
         "_root_audio_microphone.name": "Stream headset microphone",
         // "_root_audio_microphone.description": use "_root_audio_microphone_enabled.description"
         "_root_audio_microphone_enabled.description":
@@ -157,7 +320,17 @@ define({
         "_root_audio_microphone_content_config.name": "Configuration",
         "_root_audio_microphone_content_config_averageBufferingMs.name": "Buffering (ms)",
         "_root_audio_microphone_content_config_averageBufferingMs.description":
-            "Increasing this value may reduce audio stuttering.",
+            "Increasing this value may reduce audio stuttering. With adaptive buffering this is the maximum buffering.",
+        "_root_audio_microphone_content_config_adaptiveBuffering.name": "Adaptive buffering",
+        "_root_audio_microphone_content_config_adaptiveBuffering.description":
+            "Follows the jitter of the network, measured over the last seconds, to buffer as little audio as possible without stuttering.",
+        "_root_audio_microphone_content_config_codec-choice-.name": "Codec", // adv
+        "_root_audio_microphone_content_config_codec-choice-.description":
+            "Opus reduces the bandwidth and can recover lost packets, at the cost of some latency. It is only used at 8, 12, 16, 24 or 48 kHz, otherwise the audio is sent in PCM.", // adv
+        "_root_audio_microphone_content_config_codec_pcm-choice-.name": "PCM", // adv
+        "_root_audio_microphone_content_config_codec_opus-choice-.name": "Opus", // adv
+        "_root_audio_microphone_content_config_codec_opus_frameMs.name": "Frame duration (ms)", // adv
+        "_root_audio_microphone_content_config_codec_opus_bitrateKbps.name": "Bitrate (kbps)", // adv
         // Headset tab
         "_root_headset_tab.name": "Headset",
         "_root_headset_headsetEmulationMode.name": "Headset emulation mode",
@@ -182,6 +355,9 @@ define({
             "Registered device type of the emulated headset", // adv
         "_root_headset_trackingFrameOffset.name": "Tracking frame offset",
         "_root_headset_trackingFrameOffset.description": "Offset for the pose prediction algorithm",
+        "_root_headset_trackingRateMultiplier.name": "Tracking rate multiplier", // adv
+        "_root_headset_trackingRateMultiplier.description":
+            "Number of tracking samples the headset sends per display frame. The server renders with the latest one, more samples make it fresher at the cost of more packets.", // adv
         "_root_headset_positionOffset.name": "Headset position offset", // adv
         "_root_headset_positionOffset.description":
             "Headset position offset used by the position prediction algorithm.", // adv
@@ -253,7 +429,7 @@ define({
         "_root_headset_controllers_content_serversidePrediction.name":
             "Adaptive prediction (Server)", // adv
         "_root_headset_controllers_content_serversidePrediction.description":
-            "Use adaptive prediction from the server. \nAllows using prediction cutoffs to reduce jittering with slow or precise movements", // adv
+            "Use adaptive prediction from the server: the controller poses are extrapolated over the measured latency with the velocities reported by the headset and the accelerations estimated from them. \nAllows using prediction cutoffs to reduce jittering with slow or precise movements", // adv
         "_root_headset_controllers_content_linearVelocityCutoff.name":
             "Linear velocity cutoff (m/s)", // adv
         "_root_headset_controllers_content_linearVelocityCutoff.description":
@@ -290,6 +466,9 @@ define({
         "_root_headset_controllers_content_hapticsLowDurationRange.name": "Short haptics range", // adv
         "_root_headset_controllers_content_hapticsLowDurationRange.description":
             "Duration range for haptic pulses where intensity should be increased. \nIncrease the range if slightly longer haptic pulses feel too weak", // adv
+        "_root_headset_clientFrameEvents.name": "Record client frame events", // adv
+        "_root_headset_clientFrameEvents.description":
+            "Records what happens to each frame on the headset, from the packets to the display, into frame_events.bin in the external files directory of the app. The trace is written to memory shared with the file, so it costs almost nothing and survives a crash of the app. Oculus client only.", // adv
         // Connection tab
         "_root_connection_tab.name": "Connection",
         "_root_connection_clientDiscovery.name": "Client discovery",
@@ -301,7 +480,26 @@ define({
             "Network protocol used to stream data between client and server. UDP works best at low bitrates (<30), Throttled UDP works best at medium bitrates (~100), TCP works at any bitrate.",
         "_root_connection_streamProtocol_udp-choice-.name": "UDP",
         "_root_connection_streamProtocol_throttledUdp-choice-.name": "Throttled UDP",
+        "_root_connection_streamProtocol_throttledUdp_framePacing.name": "Frame pacing", // adv
+        "_root_connection_streamProtocol_throttledUdp_framePacing_enabled.description":
+            "Spread the packets of each video frame over part of the frame interval instead of sending them in one burst, which Wi-Fi access points handle badly.", // adv
+        "_root_connection_streamProtocol_throttledUdp_framePacing_content_frameIntervalFraction.name": "Fraction of the frame interval", // adv
+        "_root_connection_streamProtocol_throttledUdp_framePacing_content_kernelPacing-choice-.name": "Kernel pacing", // adv
+        "_root_connection_streamProtocol_throttledUdp_framePacing_content_kernelPacing-choice-.description":
+            "Linux only. Let the kernel send each packet at its departure time (SO_TXTIME) instead of waking up for every millisecond of the frame. Needs the fq or the etf queueing discipline on the network interface.", // adv
         "_root_connection_streamProtocol_tcp-choice-.name": "TCP",
+        "_root_connection_clientBusyPollUs.name": "Client socket busy poll (us)", // adv
+        "_root_connection_clientBusyPollUs.description":
+            "Time the headset spins on the streaming socket waiting for packets before sleeping. It lowers the receive jitter at high bitrates for some CPU time. Needs support from the network driver; 0 disables it.", // adv
+        "_root_connection_clientZeroCopyReceive.name": "Client zero-copy receive", // adv
+        "_root_connection_clientZeroCopyReceive.description":
+            "The headset reads the video packets straight into the buffers of the decoder input instead of copying them. It costs one extra system call per packet, which may or may not pay off on a given device. Not available with TCP.", // adv
+        "_root_connection_videoPacketSize-choice-.name": "Video packet size", // adv
+        "_root_connection_videoPacketSize-choice-.description":
+            "Payload bytes of the video packets. Larger packets need fewer of them, and fewer system calls, per frame, but every hop between the PC and the headset must carry them without fragmentation. Path MTU uses the MTU of the route to the headset, for wired links with jumbo frames. Clients that do not support it keep the default.", // adv
+        "_root_connection_videoPacketSize_default-choice-.name": "Default (1400)", // adv
+        "_root_connection_videoPacketSize_pathMtu-choice-.name": "Path MTU", // adv
+        "_root_connection_videoPacketSize_custom-choice-.name": "Custom", // adv
         "_root_connection_streamPort.name": "Server streaming port", // adv
         "_root_connection_streamPort.description": "Port used by the server to receive packets.", // adv
         "_root_connection_aggressiveKeyframeResend.name": "Aggressive keyframe resend",
@@ -313,6 +511,48 @@ define({
         "_root_connection_onDisconnectScript.name": "On disconnect script",
         "_root_connection_onDisconnectScript.description":
             "This script/executable will be run asynchronously when headset disconnects and on SteamVR shutdown.\nEnvironment variable ACTION will be set to &#34;disconnect&#34; (without quotes).",
+        "_root_connection_fecOnGpu.name": "Compute FEC on the GPU (Windows)", // adv
+        "_root_connection_fecOnGpu.description":
+            "The error correction data of large frames is computed by a compute shader instead of the CPU. Frees CPU time at high bitrates and FEC percentages, but the frame waits for the GPU, which can be busy with the game.",
+        "_root_connection_wiredLink.name": "Wired link",
+        "_root_connection_wiredLink_enabled.description":
+            "The headset is connected with a cable (USB tethering, USB Ethernet, or an ADB forward with TCP). The video is sent without FEC in large packets, and the bitrate can go much higher. Choose TCP or UDP, throttled UDP only adds pacing delay on a cable.",
+        "_root_connection_wiredLink_content_videoPacketSize.name": "Video packet size",
+        "_root_connection_wiredLink_content_videoPacketSize.description":
+            "Replaces the video packet size setting. Over UDP the larger packets are fragmented by the network stack.",
+        "_root_connection_wiredLink_content_bitrateMaximum.name": "Maximum bitrate (Mbps)",
+        "_root_connection_wiredLink_content_bitrateMaximum.description":
+            "Replaces the maximum bitrate of the adaptive bitrate.",
+        "_root_connection_videoSpectators.name": "Video spectators", // adv
+        "_root_connection_videoSpectators_enabled.description":
+            "Send the video to other devices too, it is encoded once. UDP only.", // adv
+        "_root_connection_videoSpectators_content_addresses.name": "Addresses", // adv
+        "_root_connection_videoSpectators_content_addresses.description":
+            "Comma separated IPs, optionally with a port (the stream port otherwise). A multicast group address reaches all the spectators of the network with one send.", // adv
+        "_root_connection_networkImpairment.name": "Network impairment", // adv
+        "_root_connection_networkImpairment_enabled.description":
+            "Emulate a bad network on the packets sent by the server, to test how the stream copes with loss and delay. Do not leave it enabled.", // adv
+        "_root_connection_networkImpairment_content_goodToBadProbability.name": "Loss burst start probability", // adv
+        "_root_connection_networkImpairment_content_goodToBadProbability.description":
+            "Probability for each packet that the link goes from the good to the bad state.", // adv
+        "_root_connection_networkImpairment_content_badToGoodProbability.name": "Loss burst end probability", // adv
+        "_root_connection_networkImpairment_content_badToGoodProbability.description":
+            "Probability for each packet that the link goes back to the good state. The average burst length is the inverse of this value.", // adv
+        "_root_connection_networkImpairment_content_goodLossProbability.name": "Loss probability (good state)", // adv
+        "_root_connection_networkImpairment_content_badLossProbability.name": "Loss probability (bad state)", // adv
+        "_root_connection_networkImpairment_content_baseDelayMs.name": "Delay (ms)", // adv
+        "_root_connection_networkImpairment_content_jitterMs.name": "Jitter (ms)", // adv
+        "_root_connection_networkImpairment_content_jitterMs.description":
+            "Random extra delay of each packet, up to this value. Packets keep their order.", // adv
+        "_root_connection_networkImpairment_content_reorderProbability.name": "Reorder probability", // adv
+        "_root_connection_networkImpairment_content_reorderDelayMs.name": "Reorder delay (ms)", // adv
+        "_root_connection_networkImpairment_content_reorderDelayMs.description":
+            "Extra delay of reordered packets, the following packets overtake them.", // adv
+        "_root_connection_networkImpairment_content_bandwidthLimit.name": "Bandwidth limit", // adv
+        "_root_connection_networkImpairment_content_bandwidthLimit_content_bitrateMbs.name": "Bitrate (Mbps)", // adv
+        "_root_connection_networkImpairment_content_bandwidthLimit_content_queueLimitMs.name": "Queue limit (ms)", // adv
+        "_root_connection_networkImpairment_content_bandwidthLimit_content_queueLimitMs.description":
+            "Packets which would wait longer than this for the link are dropped.", // adv
         // Extra tab
         "_root_extra_tab.name": "Extra",
         "_root_extra_theme-choice-.name": "Theme",
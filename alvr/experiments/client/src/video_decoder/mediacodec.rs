@@ -862,6 +862,7 @@ pub fn split(
     let mime = match codec_type {
         CodecType::H264 => "video/avc",
         CodecType::HEVC => "video/hevc",
+        CodecType::AV1 => "video/av01",
     };
 
     let format = MediaFormat::new();
@@ -10,7 +10,8 @@ use alvr_sockets::AUDIO;
 use alvr_sockets::{
     spawn_cancelable, ClientConfigPacket, ClientControlPacket, ClientHandshakePacket, Haptics,
     HeadsetInfoPacket, PeerType, PrivateIdentity, ProtoControlSocket, ServerControlPacket,
-    ServerHandshakePacket, StreamSocketBuilder, VideoFrameHeaderPacket, HAPTICS, INPUT, VIDEO,
+    ServerHandshakePacket, StreamSocketBuilder, TimeSyncPacket, VideoFrameHeaderPacket,
+    DEFAULT_VIDEO_PACKET_SIZE, FEEDBACK_INTERVAL, HAPTICS, INPUT, TIME_SYNC, VIDEO,
 };
 
 use futures::future::BoxFuture;
@@ -20,7 +21,7 @@ use settings_schema::Switch;
 use std::{
     future,
     sync::{
-        atomic::{AtomicBool, Ordering},
+        atomic::{AtomicBool, AtomicU64, Ordering},
         Arc,
     },
     time::Duration,
@@ -52,6 +53,9 @@ const PLAYSPACE_SYNC_INTERVAL: Duration = Duration::from_millis(500);
 const NETWORK_KEEPALIVE_INTERVAL: Duration = Duration::from_secs(1);
 const CLEANUP_PAUSE: Duration = Duration::from_millis(500);
 
+// Token of the last stream, lets the server resume it after a short disconnection
+static RESUME_TOKEN: AtomicU64 = AtomicU64::new(0);
+
 // close stream on Drop (manual disconnection or execution canceling)
 struct StreamCloseGuard {
     is_connected: Arc<AtomicBool>,
@@ -164,13 +168,37 @@ async fn connection_pipeline(
         } => pair
     };
 
+    let headset_info = HeadsetInfoPacket {
+        resume_token: RESUME_TOKEN.load(Ordering::Relaxed),
+        ..headset_info.clone()
+    };
     trace_err!(proto_socket.send(&(headset_info, server_ip)).await)?;
     let config_packet = trace_err!(proto_socket.recv::<ClientConfigPacket>().await)?;
+    RESUME_TOKEN.store(config_packet.resume_token, Ordering::Relaxed);
 
     let (control_sender, mut control_receiver) = proto_socket.split();
     let control_sender = Arc::new(Mutex::new(control_sender));
 
-    match control_receiver.recv().await {
+    let settings = {
+        let mut session_desc = SessionDesc::default();
+        session_desc.merge_from_json(&trace_err!(json::from_str(&config_packet.session_desc))?)?;
+        session_desc.to_settings()
+    };
+
+    // The stream socket is bound while the server prepares the stream, so StreamReady is sent as
+    // soon as StartStream arrives
+    let (stream_socket_builder, start_packet) = tokio::join!(
+        StreamSocketBuilder::listen_for_server(
+            settings.connection.stream_port,
+            settings.connection.stream_protocol.clone(),
+            settings.connection.client_send_buffer_bytes,
+            settings.connection.client_recv_buffer_bytes,
+            settings.connection.client_busy_poll_us,
+        ),
+        control_receiver.recv()
+    );
+
+    match start_packet {
         Ok(ServerControlPacket::StartStream) => {
             info!("Stream starting");
             // set_loading_message(
@@ -208,19 +236,7 @@ async fn connection_pipeline(
         }
     }
 
-    let settings = {
-        let mut session_desc = SessionDesc::default();
-        session_desc.merge_from_json(&trace_err!(json::from_str(&config_packet.session_desc))?)?;
-        session_desc.to_settings()
-    };
-
-    let stream_socket_builder = StreamSocketBuilder::listen_for_server(
-        settings.connection.stream_port,
-        settings.connection.stream_protocol,
-        settings.connection.client_send_buffer_bytes,
-        settings.connection.client_recv_buffer_bytes,
-    )
-    .await?;
+    let stream_socket_builder = stream_socket_builder?;
 
     if let Err(e) = control_sender
         .lock()
@@ -244,7 +260,13 @@ async fn connection_pipeline(
     let stream_socket = tokio::select! {
         res = stream_socket_builder.accept_from_server(
             server_ip,
+            config_packet.secondary_server_ip,
             settings.connection.stream_port,
+            alvr_sockets::video_datagram_size(
+                &settings.connection.stream_protocol,
+                DEFAULT_VIDEO_PACKET_SIZE,
+            ),
+            settings.connection.transport_feedback,
         ) => res?,
         _ = time::sleep(Duration::from_secs(5)) => {
             println!("Timeout while setting up streams");
@@ -381,16 +403,14 @@ async fn connection_pipeline(
     };
 
     let time_sync_send_loop = {
-        let control_sender = Arc::clone(&control_sender);
+        let mut socket_sender = stream_socket.request_stream(TIME_SYNC).await?;
         async move {
             let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
             *TIME_SYNC_SENDER.lock() = Some(data_sender);
 
             while let Some(time_sync) = data_receiver.recv().await {
-                control_sender
-                    .lock()
-                    .await
-                    .send(&ClientControlPacket::TimeSync(time_sync))
+                socket_sender
+                    .send_buffer(socket_sender.new_buffer(&time_sync, 0)?)
                     .await
                     .ok();
             }
@@ -496,20 +516,77 @@ async fn connection_pipeline(
 
     let haptics_receive_loop = {
         let mut receiver = stream_socket
-            .subscribe_to_stream::<Haptics>(HAPTICS)
+            .subscribe_to_stream::<Vec<Haptics>>(HAPTICS)
             .await?;
         async move {
             loop {
-                let packet = receiver.recv().await?.header;
+                // Events of the devices merged by the server over a short window
+                for haptics in receiver.recv().await?.header {
+                    unsafe {
+                        crate::alxr_on_haptics_feedback(
+                            haptics.path,
+                            haptics.duration.as_secs_f32(),
+                            haptics.frequency,
+                            haptics.amplitude,
+                        )
+                    };
+                }
+            }
+        }
+    };
 
-                unsafe {
-                    crate::alxr_on_haptics_feedback(
-                        packet.path,
-                        packet.duration.as_secs_f32(),
-                        packet.frequency,
-                        packet.amplitude,
-                    )
+    let time_sync_receive_loop = {
+        let mut receiver = stream_socket
+            .subscribe_to_stream::<TimeSyncPacket>(TIME_SYNC)
+            .await?;
+        async move {
+            loop {
+                let packet = receiver.recv().await?;
+                let data = packet.header;
+
+                let time_sync = TimeSync {
+                    type_: 7, // ALVR_PACKET_TYPE_TIME_SYNC
+                    mode: data.mode,
+                    serverTime: data.server_time,
+                    clientTime: data.client_time,
+                    sequence: packet.packet_index as u64,
+                    packetsLostTotal: data.packets_lost_total,
+                    packetsLostInSecond: data.packets_lost_in_second,
+                    averageTotalLatency: 0,
+                    averageSendLatency: data.average_send_latency,
+                    averageTransportLatency: data.average_transport_latency,
+                    averageDecodeLatency: data.average_decode_latency,
+                    idleTime: data.idle_time,
+                    fecFailure: data.fec_failure,
+                    fecFailureInSecond: data.fec_failure_in_second,
+                    fecFailureTotal: data.fec_failure_total,
+                    fps: data.fps,
+                    predictionErrorRotation: data.prediction_error_rotation,
+                    predictionErrorPosition: data.prediction_error_position,
+                    predictionHorizon: data.prediction_horizon,
+                    predictionResidual: data.prediction_residual,
+                    fecRecoveryTime: data.fec_recovery_time,
+                    gpuTimeFfr: data.gpu_time_ffr,
+                    gpuTimeEyes: data.gpu_time_eyes,
+                    traceFrameIndex: data.trace_frame_index,
+                    traceTracking: data.trace_tracking,
+                    traceReceivedFirst: data.trace_received_first,
+                    traceReceivedLast: data.trace_received_last,
+                    traceDecoderInput: data.trace_decoder_input,
+                    traceDecoderOutput: data.trace_decoder_output,
+                    traceRendered: data.trace_rendered,
+                    traceSubmit: data.trace_submit,
+                    arrivalFrameIndex: data.arrival_frame_index,
+                    arrivalFirst: data.arrival_first,
+                    arrivalLast: data.arrival_last,
+                    arrivalPackets: data.arrival_packets,
+                    serverTotalLatency: data.server_total_latency,
+                    trackingRecvFrameIndex: data.tracking_recv_frame_index,
                 };
+
+                unsafe {
+                    crate::alxr_on_time_sync(&time_sync);
+                }
             }
         }
     };
@@ -566,6 +643,7 @@ async fn connection_pipeline(
             let microphone_sender = stream_socket.request_stream(AUDIO).await?;
             Box::pin(audio::record_audio_loop(
                 _config.sample_rate,
+                _config.config.codec,
                 microphone_sender,
             ))
         }
@@ -577,10 +655,20 @@ async fn connection_pipeline(
 
     let keepalive_sender_loop = {
         let control_sender = Arc::clone(&control_sender);
+        let stream_socket = Arc::clone(&stream_socket);
         //let java_vm = Arc::clone(&java_vm);
         //let activity_ref = Arc::clone(&activity_ref);
         async move {
             loop {
+                if let Some(received) = stream_socket.path_reception() {
+                    control_sender
+                        .lock()
+                        .await
+                        .send(&ClientControlPacket::PathReception(received))
+                        .await
+                        .ok();
+                }
+
                 let res = control_sender
                     .lock()
                     .await
@@ -604,6 +692,27 @@ async fn connection_pipeline(
         }
     };
 
+    let transport_feedback_loop: BoxFuture<StrResult> = if settings.connection.transport_feedback {
+        let control_sender = Arc::clone(&control_sender);
+        let stream_socket = Arc::clone(&stream_socket);
+        Box::pin(async move {
+            loop {
+                if let Some(feedback) = stream_socket.transport_feedback() {
+                    control_sender
+                        .lock()
+                        .await
+                        .send(&ClientControlPacket::TransportFeedback(feedback))
+                        .await
+                        .ok();
+                }
+
+                time::sleep(FEEDBACK_INTERVAL).await;
+            }
+        })
+    } else {
+        Box::pin(future::pending())
+    };
+
     let control_loop = {
         // let java_vm = Arc::clone(&java_vm);
         // let activity_ref = Arc::clone(&activity_ref);
@@ -627,32 +736,6 @@ async fn connection_pipeline(
                                 // )?;
                                 break Ok(());
                             }
-                            Ok(ServerControlPacket::TimeSync(data)) => {
-                                let time_sync = TimeSync {
-                                    type_: 7, // ALVR_PACKET_TYPE_TIME_SYNC
-                                    mode: data.mode,
-                                    serverTime: data.server_time,
-                                    clientTime: data.client_time,
-                                    sequence: 0,
-                                    packetsLostTotal: data.packets_lost_total,
-                                    packetsLostInSecond: data.packets_lost_in_second,
-                                    averageTotalLatency: 0,
-                                    averageSendLatency: data.average_send_latency,
-                                    averageTransportLatency: data.average_transport_latency,
-                                    averageDecodeLatency: data.average_decode_latency,
-                                    idleTime: data.idle_time,
-                                    fecFailure: data.fec_failure,
-                                    fecFailureInSecond: data.fec_failure_in_second,
-                                    fecFailureTotal: data.fec_failure_total,
-                                    fps: data.fps,
-                                    serverTotalLatency: data.server_total_latency,
-                                    trackingRecvFrameIndex: data.tracking_recv_frame_index,
-                                };
-
-                                unsafe {
-                                    crate::alxr_on_time_sync(&time_sync);
-                                }
-                            },
                             Ok(_) => (),
                             Err(e) => {
                                 info!("Server disconnected. Cause: {}", e);
@@ -696,11 +779,13 @@ async fn connection_pipeline(
         res = spawn_cancelable(playspace_sync_loop) => res,
         res = spawn_cancelable(input_send_loop) => res,
         res = spawn_cancelable(time_sync_send_loop) => res,
+        res = spawn_cancelable(time_sync_receive_loop) => res,
         res = spawn_cancelable(video_error_report_send_loop) => res,
         res = spawn_cancelable(views_config_send_loop) => res,
         res = spawn_cancelable(battery_send_loop) => res,
         res = spawn_cancelable(video_receive_loop) => res,
         res = spawn_cancelable(haptics_receive_loop) => res,
+        res = spawn_cancelable(transport_feedback_loop) => res,
 
         // keep these loops on the current task
         res = keepalive_sender_loop => res,
@@ -381,6 +381,9 @@ pub fn init_connections(sys_properties: &ALXRSystemProperties) {
             recommended_eye_height: sys_properties.recommendedEyeHeight as _,
             available_refresh_rates,
             preferred_refresh_rate,
+            // The video packets of the engine are ALVR_MAX_VIDEO_BUFFER_SIZE bytes
+            path_mtu: 0,
+            resume_token: 0,
             reserved: format!("{}", *ALVR_VERSION),
         };
 
@@ -443,6 +446,7 @@ pub extern "C" fn input_send(data_ptr: *const TrackingInfo) {
     let data: &TrackingInfo = unsafe { &*data_ptr };
     let input = Input {
         target_timestamp: std::time::Duration::from_nanos(data.targetTimestampNs),
+        eye_gaze: None,
         device_motions: vec![
             (
                 *HEAD_ID,
@@ -617,6 +621,25 @@ pub extern "C" fn time_sync_send(data_ptr: *const TimeSync) {
             fec_failure_in_second: data.fecFailureInSecond,
             fec_failure_total: data.fecFailureTotal,
             fps: data.fps,
+            prediction_error_rotation: data.predictionErrorRotation,
+            prediction_error_position: data.predictionErrorPosition,
+            prediction_horizon: data.predictionHorizon,
+            prediction_residual: data.predictionResidual,
+            fec_recovery_time: data.fecRecoveryTime,
+            gpu_time_ffr: data.gpuTimeFfr,
+            gpu_time_eyes: data.gpuTimeEyes,
+            trace_frame_index: data.traceFrameIndex,
+            trace_tracking: data.traceTracking,
+            trace_received_first: data.traceReceivedFirst,
+            trace_received_last: data.traceReceivedLast,
+            trace_decoder_input: data.traceDecoderInput,
+            trace_decoder_output: data.traceDecoderOutput,
+            trace_rendered: data.traceRendered,
+            trace_submit: data.traceSubmit,
+            arrival_frame_index: data.arrivalFrameIndex,
+            arrival_first: data.arrivalFirst,
+            arrival_last: data.arrivalLast,
+            arrival_packets: data.arrivalPackets,
             server_total_latency: data.serverTotalLatency,
             tracking_recv_frame_index: data.trackingRecvFrameIndex,
         };
@@ -157,9 +157,34 @@ fn main() {
     );
     println!("cargo:rustc-link-lib=openvr_api");
 
+    #[cfg(target_os = "macos")]
+    for framework in [
+        "VideoToolbox",
+        "CoreMedia",
+        "CoreVideo",
+        "CoreFoundation",
+        "IOSurface",
+    ] {
+        println!("cargo:rustc-link-lib=framework={framework}");
+    }
+
     #[cfg(target_os = "linux")]
     {
+        // Vulkan compute shaders of the pre-encode stage, embedded like the Windows .cso files
+        for shader in ["FrameRender.comp", "RgbToYuv.comp"] {
+            let source = PathBuf::from(platform).join("shader").join(shader);
+            let status = std::process::Command::new("glslangValidator")
+                .args(["-V", "--target-env", "vulkan1.1", "-o"])
+                .arg(out_dir.join(format!("{shader}.spv")))
+                .arg(&source)
+                .status()
+                .expect("glslangValidator (glslang) is needed to compile the Linux shaders");
+            assert!(status.success(), "failed to compile {}", source.display());
+        }
+
         pkg_config::Config::new().probe("vulkan").unwrap();
+        // VA-API video processing for the color conversion in EncodePipelineVAAPI
+        pkg_config::Config::new().probe("libva").unwrap();
 
         // fail build if there are undefined symbols in final library
         println!("cargo:rustc-cdylib-link-arg=-Wl,--no-undefined");
@@ -16,6 +16,7 @@ enum ALVR_PACKET_TYPE {
 enum ALVR_CODEC {
 	ALVR_CODEC_H264 = 0,
 	ALVR_CODEC_H265 = 1,
+	ALVR_CODEC_AV1 = 2,
 };
 
 enum ALVR_LOST_FRAME_TYPE {
@@ -126,9 +127,24 @@ enum ALVR_HAND_INPUT {
 #define ALVR_BUTTON_FLAG(input) (1ULL << input)
 
 
+// Default payload size of the video packets, the one of each session is negotiated when the client
+// connects. The loss benchmark (alvr/server/cpp/tools/loss_bench.cpp) is built with other shard
+// layouts.
+#ifdef ALVR_BENCH_MAX_VIDEO_BUFFER_SIZE
+static const int ALVR_MAX_VIDEO_BUFFER_SIZE = ALVR_BENCH_MAX_VIDEO_BUFFER_SIZE;
+#else
 static const int ALVR_MAX_VIDEO_BUFFER_SIZE = 1400;
+#endif
 
-static const int ALVR_FEC_SHARDS_MAX = 20;
+// Shards of a frame, data and parity. Larger frames put several packets in each shard, and a row
+// of packets (fecIndex % shardPackets) is recovered only from the shards of its own row. More
+// shards make the rows longer, so the parity of a row covers uneven losses better, but the client
+// inverts a matrix of the size of the data shards for each damaged row.
+#ifdef ALVR_BENCH_FEC_SHARDS_MAX
+static const int ALVR_FEC_SHARDS_MAX = ALVR_BENCH_FEC_SHARDS_MAX;
+#else
+static const int ALVR_FEC_SHARDS_MAX = 64;
+#endif
 
 inline int CalculateParityShards(int dataShards, int fecPercentage) {
 	int totalParityShards = (dataShards * fecPercentage + 99) / 100;
@@ -136,14 +152,14 @@ inline int CalculateParityShards(int dataShards, int fecPercentage) {
 }
 
 // Calculate how many packet is needed for make signal shard.
-inline int CalculateFECShardPackets(int len, int fecPercentage) {
+inline int CalculateFECShardPackets(int len, int fecPercentage, int packetSize = ALVR_MAX_VIDEO_BUFFER_SIZE) {
 	// This reed solomon implementation accept only 255 shards.
-	// Normally, we use ALVR_MAX_VIDEO_BUFFER_SIZE as block_size and single packet becomes single shard.
+	// Normally, we use packetSize as block_size and single packet becomes single shard.
 	// If we need more than maxDataShards packets, we need to combine multiple packet to make single shrad.
 	// NOTE: Moonlight seems to use only 255 shards for video frame.
 	int maxDataShards = ((ALVR_FEC_SHARDS_MAX - 2) * 100 + 99 + fecPercentage) / (100 + fecPercentage);
 	int minBlockSize = (len + maxDataShards - 1) / maxDataShards;
-	int shardPackets = (minBlockSize + ALVR_MAX_VIDEO_BUFFER_SIZE - 1) / ALVR_MAX_VIDEO_BUFFER_SIZE;
+	int shardPackets = (minBlockSize + packetSize - 1) / packetSize;
 	assert(maxDataShards + CalculateParityShards(maxDataShards, fecPercentage) <= ALVR_FEC_SHARDS_MAX);
 	return shardPackets;
 }
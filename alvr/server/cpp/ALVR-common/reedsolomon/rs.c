@@ -53,18 +53,6 @@ typedef unsigned char gf;
 
 #define SWAP(a,b,t) {t tmp; tmp=a; a=b; b=tmp;}
 
-/*
- * USE_GF_MULC, GF_MULC0(c) and GF_ADDMULC(x) can be used when multiplying
- * many numbers by the same constant. In this case the first
- * call sets the constant, and others perform the multiplications.
- * A value related to the multiplication is held in a local variable
- * declared with USE_GF_MULC . See usage in addmul1().
- */
-#define USE_GF_MULC gf * __gf_mulc_
-#define GF_MULC0(c) __gf_mulc_ = &gf_mul_table[(c)<<8]
-#define GF_ADDMULC(dst, x) dst ^= __gf_mulc_[x]
-#define GF_MULC(dst, x) dst = __gf_mulc_[x]
-
 #define gf_mul(x,y) gf_mul_table[(x<<8)+y]
 
 /*
@@ -92,28 +80,188 @@ static inline gf modnn(int x) {
     return x;
 }
 
-static void addmul(gf *dst1, gf *src1, gf c, int sz) {
-    USE_GF_MULC;
-    if (c != 0) {
-        gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
+/*
+ * Vectorized GF(2^8) multiply kernels.
+ *
+ * Multiplication by a constant c is linear over GF(2), so c*x can be split
+ * into c*(x & 0x0f) ^ c*(x & 0xf0). Both halves only take 16 values and fit
+ * in a single 16-byte lookup table, which PSHUFB (x86) and TBL (ARM) can
+ * index with one instruction per 16 input bytes.
+ * The kernel is selected once in reed_solomon_init(); the byte-at-a-time
+ * table walk stays as the fallback and is still used for short rows.
+ */
+#define GF_SIMD_MIN_SIZE 16
 
-        GF_MULC0(c);
+typedef void (*gf_mul_kernel)(gf *dst, const gf *src, gf c, int sz, int accumulate);
+
+static void gf_mul_scalar(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    const gf *mulc = &gf_mul_table[c << 8];
+    gf *lim = &dst[sz];
+
+    if (accumulate) {
         for (; dst < lim; dst++, src++)
-            GF_ADDMULC(*dst, *src);
+            *dst ^= mulc[*src];
+    } else {
+        for (; dst < lim; dst++, src++)
+            *dst = mulc[*src];
+    }
+}
+
+static void gf_nibble_tables(gf c, gf *lo, gf *hi) {
+    const gf *mulc = &gf_mul_table[c << 8];
+    int i;
+    for (i = 0; i < 16; i++) {
+        lo[i] = mulc[i];
+        hi[i] = mulc[i << 4];
+    }
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define GF_TARGET(isa)
+#else
+#define GF_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+GF_TARGET("ssse3")
+static void gf_mul_ssse3(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    gf lo[16], hi[16];
+    __m128i tlo, thi, mask, s, p;
+    int i = 0;
+
+    gf_nibble_tables(c, lo, hi);
+    tlo = _mm_loadu_si128((const __m128i *)lo);
+    thi = _mm_loadu_si128((const __m128i *)hi);
+    mask = _mm_set1_epi8(0x0f);
+
+    for (; i + 16 <= sz; i += 16) {
+        s = _mm_loadu_si128((const __m128i *)(src + i));
+        p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+                          _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        if (accumulate)
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *)(dst + i)));
+        _mm_storeu_si128((__m128i *)(dst + i), p);
+    }
+    gf_mul_scalar(dst + i, src + i, c, sz - i, accumulate);
+}
+
+GF_TARGET("avx2")
+static void gf_mul_avx2(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    gf lo[16], hi[16];
+    __m256i tlo, thi, mask, s, p;
+    int i = 0;
+
+    gf_nibble_tables(c, lo, hi);
+    tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    mask = _mm256_set1_epi8(0x0f);
+
+    for (; i + 32 <= sz; i += 32) {
+        s = _mm256_loadu_si256((const __m256i *)(src + i));
+        p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask)),
+                             _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        if (accumulate)
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *)(dst + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), p);
+    }
+    gf_mul_scalar(dst + i, src + i, c, sz - i, accumulate);
+}
+
+static gf_mul_kernel gf_select_kernel(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    int has_ssse3, has_avx2 = 0;
+
+    __cpuid(info, 1);
+    has_ssse3 = (info[2] & (1 << 9)) != 0;
+    /* AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0) */
+    if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    int has_ssse3, has_avx2;
+
+    __builtin_cpu_init();
+    has_ssse3 = __builtin_cpu_supports("ssse3");
+    has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (has_avx2)
+        return gf_mul_avx2;
+    if (has_ssse3)
+        return gf_mul_ssse3;
+    return gf_mul_scalar;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static void gf_mul_neon(gf *dst, const gf *src, gf c, int sz, int accumulate) {
+    gf lo[16], hi[16];
+    uint8x16_t mask, s, l, h, p;
+    int i = 0;
+
+    gf_nibble_tables(c, lo, hi);
+    mask = vdupq_n_u8(0x0f);
+#if defined(__aarch64__)
+    uint8x16_t tlo = vld1q_u8(lo);
+    uint8x16_t thi = vld1q_u8(hi);
+#else
+    uint8x8x2_t tlo = {{vld1_u8(lo), vld1_u8(lo + 8)}};
+    uint8x8x2_t thi = {{vld1_u8(hi), vld1_u8(hi + 8)}};
+#endif
+
+    for (; i + 16 <= sz; i += 16) {
+        s = vld1q_u8(src + i);
+        l = vandq_u8(s, mask);
+        h = vshrq_n_u8(s, 4);
+#if defined(__aarch64__)
+        p = veorq_u8(vqtbl1q_u8(tlo, l), vqtbl1q_u8(thi, h));
+#else
+        p = veorq_u8(vcombine_u8(vtbl2_u8(tlo, vget_low_u8(l)), vtbl2_u8(tlo, vget_high_u8(l))),
+                     vcombine_u8(vtbl2_u8(thi, vget_low_u8(h)), vtbl2_u8(thi, vget_high_u8(h))));
+#endif
+        if (accumulate)
+            p = veorq_u8(p, vld1q_u8(dst + i));
+        vst1q_u8(dst + i, p);
+    }
+    gf_mul_scalar(dst + i, src + i, c, sz - i, accumulate);
+}
+
+static gf_mul_kernel gf_select_kernel(void) {
+    /* NEON is mandatory on aarch64 and assumed by every armeabi-v7a target we build for */
+    return gf_mul_neon;
+}
+
+#else
+
+static gf_mul_kernel gf_select_kernel(void) {
+    return gf_mul_scalar;
+}
+
+#endif
+
+static gf_mul_kernel gf_mul_simd = gf_mul_scalar;
+
+static void addmul(gf *dst1, gf *src1, gf c, int sz) {
+    if (c != 0) {
+        if (sz >= GF_SIMD_MIN_SIZE)
+            gf_mul_simd(dst1, src1, c, sz, 1);
+        else
+            gf_mul_scalar(dst1, src1, c, sz, 1);
     }
 }
 
 static void mul(gf *dst1, gf *src1, gf c, int sz) {
-    USE_GF_MULC;
     if (c != 0) {
-        gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
-        GF_MULC0(c);
-        for (; dst < lim; dst++, src++)
-            GF_MULC(*dst , *src);
+        if (sz >= GF_SIMD_MIN_SIZE)
+            gf_mul_simd(dst1, src1, c, sz, 0);
+        else
+            gf_mul_scalar(dst1, src1, c, sz, 0);
     } else
-        memset(dst1, 0, c);
+        memset(dst1, 0, sz);
 }
 
 /* y = a.dot(b) */
@@ -373,6 +521,7 @@ static inline int code_some_shards(gf* matrixRows, gf** inputs, gf** outputs, in
 void reed_solomon_init(void) {
     generate_gf();
     init_mul_table();
+    gf_mul_simd = gf_select_kernel();
 }
 
 reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
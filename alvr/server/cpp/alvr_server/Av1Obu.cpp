@@ -0,0 +1,71 @@
+#include "Av1Obu.h"
+
+#include <cstring>
+
+bool ParseAv1Obu(const uint8_t *data, size_t size, Av1Obu *obu) {
+	if (size < 1) {
+		return false;
+	}
+	uint8_t header = data[0];
+	bool hasExtension = (header >> 2) & 1;
+	bool hasSizeField = (header >> 1) & 1;
+	if (!hasSizeField) {
+		return false;
+	}
+	size_t offset = hasExtension ? 2 : 1;
+
+	// leb128 payload size, at most 8 bytes
+	uint64_t payloadSize = 0;
+	for (int i = 0; i < 8; i++) {
+		if (offset >= size) {
+			return false;
+		}
+		uint8_t byte = data[offset++];
+		payloadSize |= (uint64_t)(byte & 0x7F) << (i * 7);
+		if (!(byte & 0x80)) {
+			break;
+		}
+	}
+	if (payloadSize > size - offset) {
+		return false;
+	}
+	obu->type = (header >> 3) & 0xF;
+	obu->size = offset + (size_t)payloadSize;
+	return true;
+}
+
+bool IsAv1KeyFrame(const uint8_t *data, size_t size) {
+	Av1Obu obu;
+	while (size > 0 && ParseAv1Obu(data, size, &obu)) {
+		if (obu.type == AV1_OBU_SEQUENCE_HEADER) {
+			return true;
+		}
+		if (obu.type == AV1_OBU_FRAME || obu.type == AV1_OBU_FRAME_HEADER) {
+			return false;
+		}
+		data += obu.size;
+		size -= obu.size;
+	}
+	return false;
+}
+
+size_t FilterAv1Obus(uint8_t *data, size_t size) {
+	uint8_t *write = data;
+	const uint8_t *read = data;
+	size_t remaining = size;
+	Av1Obu obu;
+	while (remaining > 0) {
+		if (!ParseAv1Obu(read, remaining, &obu)) {
+			return 0;
+		}
+		if (obu.type != AV1_OBU_PADDING && obu.type != AV1_OBU_METADATA) {
+			if (write != read) {
+				memmove(write, read, obu.size);
+			}
+			write += obu.size;
+		}
+		read += obu.size;
+		remaining -= obu.size;
+	}
+	return write - data;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// AV1 frames are sent as temporal units of the low overhead bitstream format (AV1 spec 5.2): OBUs
+// one after the other, each with its size, instead of Annex-B NAL units behind start codes.
+
+enum Av1ObuType {
+	AV1_OBU_SEQUENCE_HEADER = 1,
+	AV1_OBU_TEMPORAL_DELIMITER = 2,
+	AV1_OBU_FRAME_HEADER = 3,
+	AV1_OBU_TILE_GROUP = 4,
+	AV1_OBU_METADATA = 5,
+	AV1_OBU_FRAME = 6,
+	AV1_OBU_PADDING = 15,
+};
+
+struct Av1Obu {
+	int type;
+	// Header, size field and payload
+	size_t size;
+};
+
+// Reads the OBU at the start of data. Returns false if it is truncated or has no size field.
+bool ParseAv1Obu(const uint8_t *data, size_t size, Av1Obu *obu);
+
+// Keyframes are preceded by the sequence header, which is all the decoder needs to start.
+bool IsAv1KeyFrame(const uint8_t *data, size_t size);
+
+// Drops the padding and metadata OBUs, compacting the kept ones at the start of data. Returns the
+// filtered size, the frame is dropped whole if it cannot be parsed.
+size_t FilterAv1Obus(uint8_t *data, size_t size);
@@ -0,0 +1,425 @@
+#include "BitrateController.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Logger.h"
+#include "Settings.h"
+#include "Utils.h"
+
+namespace {
+	const double BITS_PER_MBIT = 1e6;
+}
+
+BitrateController::BitrateController()
+{
+	Reset();
+}
+
+void BitrateController::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	LiveSettings live = Settings::Instance().GetLive();
+	ReadLimits();
+
+	for (auto &sent : m_sent) {
+		sent.videoFrameIndex = UINT64_MAX;
+	}
+
+	m_transportFeedback = false;
+	m_feedbackReceived = 0;
+	m_feedbackLost = 0;
+
+	m_hasReference = false;
+	m_referenceFrameIndex = 0;
+	m_referenceSendUs = 0;
+	m_referenceArrivalUs = 0;
+	m_firstArrivalUs = 0;
+	m_lastArrivalReport = 0;
+
+	m_accumulatedDelay = 0;
+	m_smoothedDelay = 0;
+	m_trendline.clear();
+	m_deltaCount = 0;
+	m_threshold = INITIAL_THRESHOLD;
+	m_lastThresholdUpdate = -1;
+	m_previousTrend = 0;
+	m_overuseTime = -1;
+	m_overuseCount = 0;
+	m_usage = USAGE_NORMAL;
+
+	m_received.clear();
+	m_receivedRate = 0;
+	m_capacity = -1;
+	m_capacityVariance = 0.4;
+
+	m_state = STATE_HOLD;
+	m_delayTarget = std::min(std::max(live.mEncodeBitrateMBs * BITS_PER_MBIT, m_minBitrate), m_maxBitrate);
+	m_lossTarget = m_maxBitrate;
+	m_lastUpdate = GetTimestampUs();
+	m_lastDecrease = 0;
+	m_lastLossUpdate = 0;
+
+	m_latencyOveruse = false;
+	m_latencyHold = false;
+	m_encodedBitrate = 0;
+	m_encoderLoad = 0;
+	m_lightLoadFactor = live.m_adaptiveBitrateLightLoadThreshold;
+
+	Publish();
+}
+
+void BitrateController::ApplySettings()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	ReadLimits();
+	m_delayTarget = std::min(std::max(m_delayTarget, m_minBitrate), m_maxBitrate);
+	m_lossTarget = std::min(std::max(m_lossTarget, m_minBitrate), m_maxBitrate);
+
+	Publish();
+}
+
+void BitrateController::ReadLimits()
+{
+	LiveSettings live = Settings::Instance().GetLive();
+	m_minBitrate = MIN_BITRATE_MBPS * BITS_PER_MBIT;
+	m_maxBitrate = std::max(live.m_adaptiveBitrateMaximum, MIN_BITRATE_MBPS) * BITS_PER_MBIT;
+	m_upRate = live.m_adaptiveBitrateUpRate * BITS_PER_MBIT;
+	m_downRate = live.m_adaptiveBitrateDownRate * BITS_PER_MBIT;
+}
+
+void BitrateController::OnFrameSent(uint64_t videoFrameIndex, uint64_t bytes)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	SentFrame &sent = m_sent[videoFrameIndex % SENT_HISTORY];
+	sent.videoFrameIndex = videoFrameIndex;
+	sent.sendTimeUs = GetTimestampUs();
+	sent.bytes = bytes;
+}
+
+void BitrateController::OnFrameArrival(uint64_t videoFrameIndex, uint64_t firstArrivalUs, uint64_t lastArrivalUs)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// The client repeats its last complete frame until the next one is received
+	if (m_transportFeedback || (m_hasReference && videoFrameIndex <= m_referenceFrameIndex)) {
+		return;
+	}
+	const SentFrame &sent = m_sent[videoFrameIndex % SENT_HISTORY];
+	if (sent.videoFrameIndex != videoFrameIndex || lastArrivalUs < firstArrivalUs) {
+		return;
+	}
+
+	m_referenceFrameIndex = videoFrameIndex;
+	OnGroupArrival(sent.sendTimeUs, firstArrivalUs, lastArrivalUs, sent.bytes);
+}
+
+void BitrateController::OnTransportFeedback(const TransportPacketGroup *groups, uint32_t count, uint64_t packetsReceived, uint64_t packetsLost)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (!m_transportFeedback) {
+		// The send times of the socket are on another clock than the ones of the frames
+		m_transportFeedback = true;
+		m_hasReference = false;
+		m_received.clear();
+		m_trendline.clear();
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (groups[i].lastArrivalUs >= groups[i].firstArrivalUs) {
+			OnGroupArrival(groups[i].sendUs, groups[i].firstArrivalUs, groups[i].lastArrivalUs, groups[i].bytes);
+		}
+	}
+
+	m_feedbackReceived += packetsReceived;
+	m_feedbackLost += packetsLost;
+	uint64_t now = GetTimestampUs();
+	if (m_feedbackReceived + m_feedbackLost > 0 && now - m_lastLossUpdate >= LOSS_INTERVAL_US) {
+		UpdateLoss(m_feedbackLost, m_feedbackReceived + m_feedbackLost, now);
+		m_feedbackReceived = 0;
+		m_feedbackLost = 0;
+		Publish();
+	}
+}
+
+void BitrateController::OnGroupArrival(uint64_t sendTimeUs, uint64_t firstArrivalUs, uint64_t lastArrivalUs, uint64_t bytes)
+{
+	uint64_t now = GetTimestampUs();
+	m_lastArrivalReport = now;
+
+	m_received.push_back({ firstArrivalUs, lastArrivalUs, bytes });
+	UpdateReceivedRate();
+
+	if (!m_hasReference) {
+		m_hasReference = true;
+		m_firstArrivalUs = lastArrivalUs;
+	} else {
+		// Growth of the one way delay since the reference group. The clocks of the server and the
+		// client are never compared, only their deltas.
+		double sendDeltaMs = (int64_t)(sendTimeUs - m_referenceSendUs) / 1000.;
+		double arrivalDeltaMs = (int64_t)(lastArrivalUs - m_referenceArrivalUs) / 1000.;
+		UpdateTrendline(arrivalDeltaMs - sendDeltaMs, sendDeltaMs, (lastArrivalUs - m_firstArrivalUs) / 1000.);
+	}
+	m_referenceSendUs = sendTimeUs;
+	m_referenceArrivalUs = lastArrivalUs;
+
+	UpdateRate(now);
+}
+
+void BitrateController::OnStatistics(uint64_t packetsLostInSecond, uint64_t packetsSentInSecond, uint64_t transportLatencyUs,
+	float fps, double encodedBitrateMbps, uint32_t encoderLoad)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint64_t now = GetTimestampUs();
+	auto &settings = Settings::Instance();
+	LiveSettings live = settings.GetLive();
+
+	m_encodedBitrate = encodedBitrateMbps * BITS_PER_MBIT;
+	m_encoderLoad = encoderLoad;
+	// Frames the compositor skips do not use their share of the bitrate
+	double frameRateRatio = fps > 0 && settings.m_refreshRate > 0 ? std::min<double>(fps / settings.m_refreshRate, 1.) : 1.;
+	m_lightLoadFactor = live.m_adaptiveBitrateLightLoadThreshold * frameRateRatio;
+
+	int64_t latencyTarget = live.m_adaptiveBitrateTarget;
+	if (live.m_adaptiveBitrateUseFrametime) {
+		if (fps > 0) {
+			latencyTarget = (int64_t)(1e6 / fps) + live.m_adaptiveBitrateTargetOffset;
+		}
+		latencyTarget = std::min<int64_t>(latencyTarget, live.m_adaptiveBitrateTargetMaximum);
+	}
+	int64_t latency = transportLatencyUs;
+	int64_t threshold = live.m_adaptiveBitrateThreshold;
+	m_latencyOveruse = latency != 0 && latency > latencyTarget + threshold;
+	m_latencyHold = latency == 0 || latency >= latencyTarget - threshold;
+
+	if (!m_transportFeedback && packetsSentInSecond > 0 && now - m_lastLossUpdate >= LOSS_INTERVAL_US) {
+		UpdateLoss(packetsLostInSecond, packetsSentInSecond, now);
+	}
+
+	if (now - m_lastArrivalReport > ARRIVAL_TIMEOUT_US) {
+		// No packet arrivals from this client, only the latency target applies
+		m_usage = USAGE_NORMAL;
+		UpdateRate(now);
+	} else {
+		Publish();
+	}
+}
+
+uint64_t BitrateController::GetBitrate() const
+{
+	return m_bitrate;
+}
+
+uint64_t BitrateController::GetNetworkBudget() const
+{
+	return m_networkBudget;
+}
+
+void BitrateController::UpdateTrendline(double delayDeltaMs, double sendDeltaMs, double arrivalMs)
+{
+	m_deltaCount = std::min(m_deltaCount + 1, 1000u);
+	m_accumulatedDelay += delayDeltaMs;
+	m_smoothedDelay = TRENDLINE_SMOOTHING * m_smoothedDelay + (1 - TRENDLINE_SMOOTHING) * m_accumulatedDelay;
+
+	m_trendline.push_back({ arrivalMs, m_smoothedDelay });
+	if (m_trendline.size() > TRENDLINE_WINDOW) {
+		m_trendline.pop_front();
+	}
+	if (m_trendline.size() < TRENDLINE_WINDOW) {
+		return;
+	}
+
+	// Least squares slope of the smoothed delay over the arrival time
+	double meanX = 0;
+	double meanY = 0;
+	for (auto &point : m_trendline) {
+		meanX += point.first;
+		meanY += point.second;
+	}
+	meanX /= m_trendline.size();
+	meanY /= m_trendline.size();
+	double numerator = 0;
+	double denominator = 0;
+	for (auto &point : m_trendline) {
+		numerator += (point.first - meanX) * (point.second - meanY);
+		denominator += (point.first - meanX) * (point.first - meanX);
+	}
+	if (denominator == 0) {
+		return;
+	}
+
+	Detect(numerator / denominator, sendDeltaMs, arrivalMs);
+}
+
+void BitrateController::Detect(double trend, double sendDeltaMs, double arrivalMs)
+{
+	double modifiedTrend = std::min<uint32_t>(m_deltaCount, 60) * trend * TRENDLINE_GAIN;
+
+	if (modifiedTrend > m_threshold) {
+		if (m_overuseTime < 0) {
+			m_overuseTime = sendDeltaMs / 2;
+		} else {
+			m_overuseTime += sendDeltaMs;
+		}
+		m_overuseCount++;
+		if (m_overuseTime > OVERUSE_TIME && m_overuseCount > 1 && trend >= m_previousTrend) {
+			m_overuseTime = 0;
+			m_overuseCount = 0;
+			m_usage = USAGE_OVERUSE;
+		}
+	} else if (modifiedTrend < -m_threshold) {
+		m_overuseTime = -1;
+		m_overuseCount = 0;
+		m_usage = USAGE_UNDERUSE;
+	} else {
+		m_overuseTime = -1;
+		m_overuseCount = 0;
+		m_usage = USAGE_NORMAL;
+	}
+	m_previousTrend = trend;
+
+	UpdateThreshold(modifiedTrend, arrivalMs);
+}
+
+void BitrateController::UpdateThreshold(double modifiedTrend, double arrivalMs)
+{
+	if (m_lastThresholdUpdate < 0) {
+		m_lastThresholdUpdate = arrivalMs;
+	}
+
+	// Spikes, like a Wi-Fi scan, must not make the detector less sensitive
+	double magnitude = std::abs(modifiedTrend);
+	if (magnitude > m_threshold + 15) {
+		m_lastThresholdUpdate = arrivalMs;
+		return;
+	}
+
+	// The threshold follows the trend, slowly upwards so that competing TCP flows do not starve
+	// the stream, faster downwards
+	double gain = magnitude < m_threshold ? THRESHOLD_DOWN_GAIN : THRESHOLD_UP_GAIN;
+	double elapsed = std::min(arrivalMs - m_lastThresholdUpdate, 100.);
+	m_threshold += gain * (magnitude - m_threshold) * elapsed;
+	m_threshold = std::min(std::max(m_threshold, MIN_THRESHOLD), MAX_THRESHOLD);
+	m_lastThresholdUpdate = arrivalMs;
+}
+
+void BitrateController::UpdateReceivedRate()
+{
+	while (m_received.size() > 1 && m_received.back().lastArrivalUs - m_received.front().firstArrivalUs > RECEIVED_RATE_WINDOW_US) {
+		m_received.pop_front();
+	}
+
+	uint64_t duration = m_received.back().lastArrivalUs - m_received.front().firstArrivalUs;
+	if (duration < RECEIVED_RATE_WINDOW_US / 2) {
+		return;
+	}
+	uint64_t bytes = 0;
+	for (auto &frame : m_received) {
+		bytes += frame.bytes;
+	}
+	m_receivedRate = bytes * 8. * 1e6 / duration;
+}
+
+void BitrateController::UpdateCapacity(double rate)
+{
+	const double alpha = 0.05;
+	if (m_capacity < 0) {
+		m_capacity = rate;
+	} else {
+		m_capacity = (1 - alpha) * m_capacity + alpha * rate;
+	}
+	// Variance normalized by the capacity, in Mbps
+	double error = (m_capacity - rate) / BITS_PER_MBIT;
+	m_capacityVariance = (1 - alpha) * m_capacityVariance + alpha * error * error / std::max(m_capacity / BITS_PER_MBIT, 1.);
+	m_capacityVariance = std::min(std::max(m_capacityVariance, 0.4), 2.5);
+}
+
+void BitrateController::UpdateLoss(uint64_t packetsLost, uint64_t packetsSent, uint64_t now)
+{
+	double loss = std::min((double)packetsLost / packetsSent, 1.);
+	if (loss > HIGH_LOSS) {
+		double lossTarget = std::min(m_lossTarget, m_delayTarget) * (1 - 0.5 * loss);
+		Debug("BitrateController: %.1f%% loss, bitrate limited to %.1f Mbps\n", loss * 100, lossTarget / BITS_PER_MBIT);
+		m_lossTarget = lossTarget;
+	} else if (loss < LOW_LOSS) {
+		m_lossTarget *= LOSS_INCREASE;
+	}
+	m_lossTarget = std::min(std::max(m_lossTarget, m_minBitrate), m_maxBitrate);
+	m_lastLossUpdate = now;
+}
+
+void BitrateController::UpdateRate(uint64_t now)
+{
+	Usage usage = m_latencyOveruse ? USAGE_OVERUSE : m_usage;
+	switch (usage) {
+	case USAGE_OVERUSE:
+		m_state = STATE_DECREASE;
+		break;
+	case USAGE_NORMAL:
+		if (m_state == STATE_HOLD) {
+			m_state = STATE_INCREASE;
+		}
+		break;
+	case USAGE_UNDERUSE:
+		// Queues are draining, probing now would measure a rate the link cannot sustain
+		m_state = STATE_HOLD;
+		break;
+	}
+	// The delay gradient finds the capacity on its own, without it the latency must also stay
+	// below the target before probing
+	if (m_state == STATE_INCREASE && m_latencyHold && now - m_lastArrivalReport > ARRIVAL_TIMEOUT_US) {
+		m_state = STATE_HOLD;
+	}
+
+	double elapsed = std::min((now - m_lastUpdate) / 1e6, 1.);
+	m_lastUpdate = now;
+
+	if (m_state == STATE_INCREASE) {
+		double target = std::min(m_delayTarget, m_lossTarget);
+		// A higher bitrate does not help while the encoder does not use the current one or is too
+		// slow for the frame rate, and it cannot be probed beyond what reaches the client.
+		bool encoderLimited = m_encoderLoad >= 100 || m_encodedBitrate < target * m_lightLoadFactor;
+		bool receiverLimited = m_receivedRate > 0 && m_delayTarget > m_receivedRate * MAX_RECEIVED_RATE_MULTIPLIER;
+		if (!encoderLimited && !receiverLimited) {
+			double capacityDeviation = std::sqrt(m_capacityVariance * std::max(m_capacity / BITS_PER_MBIT, 1.)) * BITS_PER_MBIT;
+			if (m_capacity > 0 && m_delayTarget > m_capacity + 3 * capacityDeviation) {
+				// The link got better than what was measured at the last overuse
+				m_capacity = -1;
+			}
+			if (m_capacity > 0) {
+				m_delayTarget += m_upRate * elapsed;
+			} else {
+				m_delayTarget *= std::pow(1 + INCREASE_PER_SECOND, elapsed);
+			}
+		}
+	} else if (m_state == STATE_DECREASE) {
+		if (now - m_lastDecrease >= DECREASE_INTERVAL_US) {
+			double base = m_delayTarget;
+			if (m_receivedRate > 0) {
+				UpdateCapacity(m_receivedRate);
+				base = m_receivedRate;
+			}
+			double target = std::min(base * DECREASE_FACTOR, m_delayTarget - m_downRate);
+			Debug("BitrateController: %s overuse, %.1f -> %.1f Mbps. received=%.1f Mbps\n",
+				m_latencyOveruse ? "latency" : "delay", m_delayTarget / BITS_PER_MBIT, target / BITS_PER_MBIT, m_receivedRate / BITS_PER_MBIT);
+			m_delayTarget = target;
+			m_lastDecrease = now;
+		}
+		m_state = STATE_HOLD;
+	}
+	m_delayTarget = std::min(std::max(m_delayTarget, m_minBitrate), m_maxBitrate);
+
+	Publish();
+}
+
+void BitrateController::Publish()
+{
+	double target = std::min(m_delayTarget, m_lossTarget);
+	m_bitrate = std::max<uint64_t>((uint64_t)std::llround(target / BITS_PER_MBIT), MIN_BITRATE_MBPS);
+	m_networkBudget = m_capacity > 0 ? (uint64_t)m_capacity : 0;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "bindings.h"
+
+// Chooses the video bitrate from the feedback of the client, the way Google Congestion Control
+// does. Each video frame is a packet group: the growth of its one way delay over the previous
+// group (the delay gradient) goes through a trendline filter that detects queues building up on
+// the link before packets are lost. An AIMD controller then backs off to the rate the client
+// actually receives on overuse and probes upwards otherwise. A loss based estimate caps the
+// result, and the transport latency target of the settings still counts as overuse, which also
+// keeps the controller working with clients that do not report packet arrivals.
+//
+// With the transport feedback of the UDP socket the packet groups are the send bursts of the
+// socket instead, with the send times taken when the packets reach the kernel, and the loss is
+// counted on the acknowledgements.
+class BitrateController
+{
+public:
+	BitrateController();
+
+	void Reset();
+	// Takes the limits of the settings after a live update, keeping the estimates
+	void ApplySettings();
+
+	// Called once the last packet of a video frame has been handed to the network. bytes
+	// includes the headers and the FEC parity.
+	void OnFrameSent(uint64_t videoFrameIndex, uint64_t bytes);
+	// Arrival of the first and last packet of a frame on the client clock, from a TimeSync.
+	void OnFrameArrival(uint64_t videoFrameIndex, uint64_t firstArrivalUs, uint64_t lastArrivalUs);
+	// Groups of a transport feedback report, in send order. Once called the frame arrivals and the
+	// loss of the statistics are ignored.
+	void OnTransportFeedback(const TransportPacketGroup *groups, uint32_t count, uint64_t packetsReceived, uint64_t packetsLost);
+	// Fed with every client statistics report. packetsSentInSecond is the server side count over
+	// the same one second window, encoderLoad the percentage from Statistics::GetEncoderLoad().
+	void OnStatistics(uint64_t packetsLostInSecond, uint64_t packetsSentInSecond, uint64_t transportLatencyUs,
+		float fps, double encodedBitrateMbps, uint32_t encoderLoad);
+
+	// In Mbps
+	uint64_t GetBitrate() const;
+	// Rate the link carried at the last overuses in bit/s, headers and FEC parity included. 0
+	// while the link has not been pushed to its capacity.
+	uint64_t GetNetworkBudget() const;
+
+	static const uint64_t MIN_BITRATE_MBPS = 5;
+
+private:
+	enum Usage {
+		USAGE_NORMAL,
+		USAGE_OVERUSE,
+		USAGE_UNDERUSE,
+	};
+	enum RateState {
+		STATE_HOLD,
+		STATE_INCREASE,
+		STATE_DECREASE,
+	};
+
+	struct SentFrame {
+		uint64_t videoFrameIndex;
+		uint64_t sendTimeUs;
+		uint64_t bytes;
+	};
+	struct ReceivedFrame {
+		uint64_t firstArrivalUs;
+		uint64_t lastArrivalUs;
+		uint64_t bytes;
+	};
+
+	void OnGroupArrival(uint64_t sendTimeUs, uint64_t firstArrivalUs, uint64_t lastArrivalUs, uint64_t bytes);
+	void UpdateTrendline(double delayDeltaMs, double sendDeltaMs, double arrivalMs);
+	void Detect(double trend, double sendDeltaMs, double arrivalMs);
+	void UpdateThreshold(double modifiedTrend, double arrivalMs);
+	void UpdateReceivedRate();
+	void UpdateCapacity(double rate);
+	void UpdateLoss(uint64_t packetsLost, uint64_t packetsSent, uint64_t now);
+	void UpdateRate(uint64_t now);
+	void Publish();
+	void ReadLimits();
+
+	// Frames whose feedback can still arrive
+	static const int SENT_HISTORY = 256;
+	// Groups in the linear regression of the trendline
+	static const size_t TRENDLINE_WINDOW = 20;
+	static constexpr double TRENDLINE_SMOOTHING = 0.9;
+	static constexpr double TRENDLINE_GAIN = 4;
+	// Adaptive threshold on the trend, in ms
+	static constexpr double INITIAL_THRESHOLD = 12.5;
+	static constexpr double MIN_THRESHOLD = 6;
+	static constexpr double MAX_THRESHOLD = 600;
+	static constexpr double THRESHOLD_UP_GAIN = 0.0087;
+	static constexpr double THRESHOLD_DOWN_GAIN = 0.039;
+	// Overuse must last this long, in ms, before the rate is lowered
+	static constexpr double OVERUSE_TIME = 10;
+	// Decrease to this fraction of the received rate on overuse
+	static constexpr double DECREASE_FACTOR = 0.85;
+	// Multiplicative increase per second while far from the last known capacity
+	static constexpr double INCREASE_PER_SECOND = 0.08;
+	// The target is not raised beyond this multiple of the received rate
+	static constexpr double MAX_RECEIVED_RATE_MULTIPLIER = 1.5;
+	static const uint64_t RECEIVED_RATE_WINDOW_US = 500 * 1000;
+	static const uint64_t DECREASE_INTERVAL_US = 200 * 1000;
+	// Without packet arrivals for this long, the latency target alone drives the rate
+	static const uint64_t ARRIVAL_TIMEOUT_US = 1000 * 1000;
+	// Loss ratios below which the loss estimate grows and above which it backs off
+	static constexpr double LOW_LOSS = 0.02;
+	static constexpr double HIGH_LOSS = 0.1;
+	static constexpr double LOSS_INCREASE = 1.05;
+	static const uint64_t LOSS_INTERVAL_US = 1000 * 1000;
+
+	// Arrivals and statistics come from the network threads, sent frames from the encoder thread.
+	std::mutex m_mutex;
+	std::atomic<uint64_t> m_bitrate;
+	std::atomic<uint64_t> m_networkBudget;
+
+	// In bit/s
+	double m_minBitrate;
+	double m_maxBitrate;
+	double m_upRate;
+	double m_downRate;
+
+	SentFrame m_sent[SENT_HISTORY];
+
+	bool m_transportFeedback;
+	// Acknowledgements since the last loss update
+	uint64_t m_feedbackReceived;
+	uint64_t m_feedbackLost;
+
+	// Reference group of the delay gradient
+	bool m_hasReference;
+	uint64_t m_referenceFrameIndex;
+	uint64_t m_referenceSendUs;
+	uint64_t m_referenceArrivalUs;
+	uint64_t m_firstArrivalUs;
+	// Server time of the last arrival report
+	uint64_t m_lastArrivalReport;
+
+	double m_accumulatedDelay;
+	double m_smoothedDelay;
+	// Arrival time and smoothed accumulated delay, in ms
+	std::deque<std::pair<double, double>> m_trendline;
+	uint32_t m_deltaCount;
+	double m_threshold;
+	double m_lastThresholdUpdate;
+	double m_previousTrend;
+	double m_overuseTime;
+	int m_overuseCount;
+	Usage m_usage;
+
+	// Acknowledged frames in the received rate window
+	std::deque<ReceivedFrame> m_received;
+	// bit/s, 0 until enough frames were acknowledged
+	double m_receivedRate;
+	// Received rate measured at the last overuses and its normalized variance, negative if unknown
+	double m_capacity;
+	double m_capacityVariance;
+
+	RateState m_state;
+	double m_delayTarget;
+	double m_lossTarget;
+	uint64_t m_lastUpdate;
+	uint64_t m_lastDecrease;
+	uint64_t m_lastLossUpdate;
+
+	bool m_latencyOveruse;
+	bool m_latencyHold;
+	double m_encodedBitrate;
+	uint32_t m_encoderLoad;
+	double m_lightLoadFactor;
+};
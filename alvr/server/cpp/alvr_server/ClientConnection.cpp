@@ -1,7 +1,10 @@
 #include "ClientConnection.h"
+#include <algorithm>
+#include <chrono>
 #include <mutex>
 #include <string.h>
 
+#include "Av1Obu.h"
 #include "Statistics.h"
 #include "Logger.h"
 #include "bindings.h"
@@ -10,124 +13,379 @@
 
 const int64_t STATISTICS_TIMEOUT_US = 100 * 1000;
 
+// Keyframes start with parameter sets or an IRAP slice. Only the NAL units in front of the first
+// slice are inspected, so this is cheap for every frame.
+static bool IsIdrFrame(const uint8_t *buf, int len, int codec) {
+	if (codec == ALVR_CODEC_AV1) {
+		return IsAv1KeyFrame(buf, len);
+	}
+	bool h265 = codec == ALVR_CODEC_H265;
+	for (int i = 0; i + 3 < len; i++) {
+		if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 1) {
+			continue;
+		}
+		uint8_t header = buf[i + 3];
+		if (h265) {
+			int type = (header >> 1) & 0x3F;
+			if ((type >= 16 && type <= 21) || type == 32 || type == 33) {
+				return true; // IRAP slice, VPS or SPS
+			}
+			if (type < 16) {
+				return false;
+			}
+		} else {
+			int type = header & 0x1F;
+			if (type == 5 || type == 7) {
+				return true; // IDR slice or SPS
+			}
+			if (type >= 1 && type <= 4) {
+				return false;
+			}
+		}
+		i += 3;
+	}
+	return false;
+}
+
+// Size of the parameter sets in front of the first other NAL unit of a keyframe, up to its start
+// code, 0 if the frame does not start with any. AV1 keeps its sequence header in band.
+static int ParameterSetsSize(const uint8_t *buf, int len, int codec) {
+	if (codec == ALVR_CODEC_AV1) {
+		return 0;
+	}
+	bool h265 = codec == ALVR_CODEC_H265;
+	bool found = false;
+	for (int i = 0; i + 3 < len; i++) {
+		if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 1) {
+			continue;
+		}
+		uint8_t header = buf[i + 3];
+		int type = h265 ? (header >> 1) & 0x3F : header & 0x1F;
+		// VPS, SPS and PPS, or SPS and PPS
+		bool parameterSet = h265 ? type >= 32 && type <= 34 : type == 7 || type == 8;
+		if (!parameterSet) {
+			if (!found) {
+				return 0;
+			}
+			// The zero byte of a 4 byte start code belongs to the next NAL unit
+			return buf[i - 1] == 0 ? i - 1 : i;
+		}
+		found = true;
+		i += 3;
+	}
+	// Parameter sets without a slice are not a frame
+	return 0;
+}
+
+// Slices a frame is split into at most, more are left in the last one
+static const int MAX_FRAME_SLICES = 64;
+// Wait for the frame of the other stream to be sent, a frame still waiting after it is dropped
+static const auto FRAME_SEND_TIMEOUT = std::chrono::milliseconds(100);
+
+// Fills offsets with the start of each slice of an Annex-B frame and the end of the frame after
+// them, and returns the number of slices, at most maxSlices. The NAL units in front of the first
+// slice, like the parameter sets, go with it, those after a slice go with that slice. Slices past
+// maxSlices are left in the last one. AV1 frames are never split.
+static int FindSlices(const uint8_t *buf, int len, int codec, int maxSlices, int *offsets) {
+	offsets[0] = 0;
+	int count = 0;
+	if (codec != ALVR_CODEC_AV1) {
+		bool h265 = codec == ALVR_CODEC_H265;
+		maxSlices = std::min(maxSlices, MAX_FRAME_SLICES);
+		for (int i = 0; i + 3 < len && count < maxSlices;) {
+			// No start code can begin in the next 3 bytes
+			if (buf[i + 2] > 1) {
+				i += 3;
+				continue;
+			}
+			if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 1) {
+				i++;
+				continue;
+			}
+			uint8_t header = buf[i + 3];
+			bool vcl = h265 ? ((header >> 1) & 0x3F) < 32 : (header & 0x1F) >= 1 && (header & 0x1F) <= 5;
+			if (vcl) {
+				// The zero byte of a 4 byte start code belongs to the next NAL unit
+				int start = i > 0 && buf[i - 1] == 0 ? i - 1 : i;
+				if (count > 0) {
+					offsets[count] = start;
+				}
+				count++;
+			}
+			i += 3;
+		}
+	}
+	count = std::max(count, 1);
+	offsets[count] = len;
+	return count;
+}
+
+static LatencyPercentiles GetPercentiles(Statistics &statistics, Statistics::Stage stage) {
+	LatencyPercentiles percentiles;
+	percentiles.p50 = statistics.GetStagePercentile(stage, Statistics::P50) / 1000.0;
+	percentiles.p95 = statistics.GetStagePercentile(stage, Statistics::P95) / 1000.0;
+	percentiles.p99 = statistics.GetStagePercentile(stage, Statistics::P99) / 1000.0;
+	return percentiles;
+}
+
 ClientConnection::ClientConnection() : m_LastStatisticsUpdate(0) {
 
 	m_Statistics = std::make_shared<Statistics>();
 
 	reed_solomon_init();
-	
+	ApplySettings();
+
 	videoPacketCounter = 0;
-	m_fecPercentage = INITIAL_FEC_PERCENTAGE;
+	m_fecController.Reset();
+	m_bitrateController.Reset();
+	m_resolutionController.Reset();
+	m_foveationController.Reset();
+	m_vsyncScheduler.Reset();
+	m_idleController.Reset();
 	memset(&m_reportedStatistics, 0, sizeof(m_reportedStatistics));
 	m_Statistics->ResetAll();
 }
 
-void ClientConnection::FECSend(uint8_t *buf, int len, uint64_t targetTimestampNs, uint64_t videoFrameIndex) {
-	int shardPackets = CalculateFECShardPackets(len, m_fecPercentage);
+void ClientConnection::ApplySettings() {
+	auto &settings = Settings::Instance();
+	LiveSettings live = settings.GetLive();
+	{
+		std::unique_lock<std::mutex> lock(m_sendMutex);
+		m_codec = settings.m_codec;
+		m_enableFec = live.m_enableFec;
+		m_videoPacketSize = settings.m_videoPacketSize;
+	}
+	m_enableAdaptiveBitrate = live.m_enableAdaptiveBitrate;
 
-	int blockSize = shardPackets * ALVR_MAX_VIDEO_BUFFER_SIZE;
+	m_bitrateController.ApplySettings();
+	// The encoders pick up the change with CheckBitrateUpdated()
+	if (!live.m_enableAdaptiveBitrate) {
+		m_Statistics->SetBitrate(live.mEncodeBitrateMBs);
+	}
+}
+
+uint64_t ClientConnection::FECSend(uint8_t *buf, int len, uint64_t targetTimestampNs, uint64_t videoFrameIndex, int fecPercentage, bool idr, uint8_t streamIndex,
+	uint8_t sliceIndex, bool lastSlice) {
+	const int packetSize = m_videoPacketSize;
+	int shardPackets = CalculateFECShardPackets(len, fecPercentage, packetSize);
+
+	int blockSize = shardPackets * packetSize;
 
 	int dataShards = (len + blockSize - 1) / blockSize;
-	int totalParityShards = CalculateParityShards(dataShards, m_fecPercentage);
+	int totalParityShards = CalculateParityShards(dataShards, fecPercentage);
 	int totalShards = dataShards + totalParityShards;
 
 	assert(totalShards <= DATA_SHARDS_MAX);
 
-	Debug("reed_solomon_new. dataShards=%d totalParityShards=%d totalShards=%d blockSize=%d shardPackets=%d\n"
-		, dataShards, totalParityShards, totalShards, blockSize, shardPackets);
-
-	reed_solomon *rs = reed_solomon_new(dataShards, totalParityShards);
+	Debug("FECSend. dataShards=%d totalParityShards=%d totalShards=%d blockSize=%d shardPackets=%d fecPercentage=%d\n"
+		, dataShards, totalParityShards, totalShards, blockSize, shardPackets, fecPercentage);
 
-	std::vector<uint8_t *> shards(totalShards);
-
-	for (int i = 0; i < dataShards; i++) {
-		shards[i] = buf + i * blockSize;
+	// The parity of large frames is computed by the workers of the encoder while the data goes out
+	bool parallel = len >= FecEncoder::PARALLEL_MIN_BYTES;
+	uint8_t **shards = parallel
+		? m_fecEncoder.EncodeAsync(buf, len, dataShards, totalParityShards, blockSize)
+		: m_fecEncoder.Encode(buf, len, dataShards, totalParityShards, blockSize);
+	if (shards == nullptr) {
+		return 0;
 	}
-	if (len % blockSize != 0) {
-		// Padding
-		shards[dataShards - 1] = new uint8_t[blockSize];
-		memset(shards[dataShards - 1], 0, blockSize);
-		memcpy(shards[dataShards - 1], buf + (dataShards - 1) * blockSize, len % blockSize);
-	}
-	for (int i = 0; i < totalParityShards; i++) {
-		shards[dataShards + i] = new uint8_t[blockSize];
-	}
-
-	int ret = reed_solomon_encode(rs, &shards[0], totalShards, blockSize);
-	assert(ret == 0);
 
-	reed_solomon_release(rs);
-
-	uint8_t packetBuffer[2000];
-	VideoFrame *header = (VideoFrame *)packetBuffer;
-	uint8_t *payload = packetBuffer + sizeof(VideoFrame);
+	VideoFrame header = {};
 	int dataRemain = len;
 
-	header->type = ALVR_PACKET_TYPE_VIDEO_FRAME;
-	header->trackingFrameIndex = targetTimestampNs;
-	header->videoFrameIndex = videoFrameIndex;
-	header->sentTime = GetTimestampUs();
-	header->frameByteSize = len;
-	header->fecIndex = 0;
-	header->fecPercentage = (uint16_t)m_fecPercentage;
+	header.type = ALVR_PACKET_TYPE_VIDEO_FRAME;
+	header.trackingFrameIndex = targetTimestampNs;
+	header.videoFrameIndex = videoFrameIndex;
+	header.sentTime = GetTimestampUs();
+	header.frameByteSize = len;
+	header.fecIndex = 0;
+	header.fecPercentage = (uint16_t)fecPercentage;
+	header.streamIndex = streamIndex;
+	header.contentScale = m_resolutionController.GetFrameScale(targetTimestampNs);
+	m_foveationController.GetFrameCenter(targetTimestampNs, header.foveationCenter);
+	header.sliceIndex = sliceIndex;
+	header.sliceCount = lastSlice ? sliceIndex + 1 : 0;
+
+	// Packets point straight into the shards, which stay valid until the next Encode().
+	// Shards are sent one after the other, so consecutive packets belong to consecutive
+	// Reed-Solomon rows (fecIndex % shardPackets). A burst of N lost packets therefore costs every
+	// row at most ceil(N / shardPackets) shards, which is the best any send order can do.
+	// The frame pacer does not delay the first slice, which the decoder can start on, nor the parity.
+	// With a single slice the first slice is the whole frame and is paced like the rest. A frame
+	// that could not be split, like AV1, has its first slice estimated from the settings.
+	// In parallel mode the data packets are queued as soon as they are counted, the parity follows
+	// in a second batch that continues the same frame. The batches of the next slices continue it
+	// too, the frame ends with the parity of its last slice.
+	int firstSliceBytes = 0;
+	if (sliceIndex > 0 || !lastSlice) {
+		firstSliceBytes = sliceIndex == 0 ? len : 0;
+	} else {
+		int slices = (int)Settings::Instance().m_slicesPerFrame;
+		firstSliceBytes = slices > 1 ? len / slices : 0;
+	}
+	m_batchHeaders.clear();
+	m_batchPayloads.clear();
+	uint64_t bytes = 0;
 	for (int i = 0; i < dataShards; i++) {
 		for (int j = 0; j < shardPackets; j++) {
-			int copyLength = std::min(ALVR_MAX_VIDEO_BUFFER_SIZE, dataRemain);
+			int copyLength = std::min(packetSize, dataRemain);
 			if (copyLength <= 0) {
 				break;
 			}
-			memcpy(payload, shards[i] + j * ALVR_MAX_VIDEO_BUFFER_SIZE, copyLength);
-			dataRemain -= ALVR_MAX_VIDEO_BUFFER_SIZE;
+			dataRemain -= packetSize;
 
-			header->packetCounter = videoPacketCounter;
+			header.packetCounter = videoPacketCounter;
 			videoPacketCounter++;
-			VideoSend(*header, (unsigned char *)packetBuffer + sizeof(VideoFrame), copyLength);
+			m_batchHeaders.push_back(header);
+			m_batchPayloads.push_back({shards[i] + j * packetSize, copyLength, (i * shardPackets + j) * packetSize < firstSliceBytes});
 			m_Statistics->CountPacket(sizeof(VideoFrame) + copyLength);
-			header->fecIndex++;
+			bytes += sizeof(VideoFrame) + copyLength;
+			header.fecIndex++;
 		}
 	}
-	header->fecIndex = dataShards * shardPackets;
+	if (parallel) {
+		VideoSendBatch(m_batchHeaders.data(), m_batchPayloads.data(), (int)m_batchHeaders.size(), idr, false);
+		m_batchHeaders.clear();
+		m_batchPayloads.clear();
+		m_fecEncoder.Wait();
+	}
+	header.fecIndex = dataShards * shardPackets;
 	for (int i = 0; i < totalParityShards; i++) {
 		for (int j = 0; j < shardPackets; j++) {
-			int copyLength = ALVR_MAX_VIDEO_BUFFER_SIZE;
-			memcpy(payload, shards[dataShards + i] + j * ALVR_MAX_VIDEO_BUFFER_SIZE, copyLength);
+			int copyLength = packetSize;
 
-			header->packetCounter = videoPacketCounter;
+			header.packetCounter = videoPacketCounter;
 			videoPacketCounter++;
-			
-			VideoSend(*header, (unsigned char *)packetBuffer + sizeof(VideoFrame), copyLength);
+			m_batchHeaders.push_back(header);
+			m_batchPayloads.push_back({shards[dataShards + i] + j * packetSize, copyLength, true});
 			m_Statistics->CountPacket(sizeof(VideoFrame) + copyLength);
-			header->fecIndex++;
+			bytes += sizeof(VideoFrame) + copyLength;
+			header.fecIndex++;
 		}
 	}
 
-	if (len % blockSize != 0) {
-		delete[] shards[dataShards - 1];
+	VideoSendBatch(m_batchHeaders.data(), m_batchPayloads.data(), (int)m_batchHeaders.size(), idr, lastSlice);
+
+	return bytes;
+}
+
+void ClientConnection::SendVideo(uint8_t *buf, int len, uint64_t targetTimestampNs, uint8_t streamIndex) {
+	std::unique_lock<std::mutex> lock(m_sendMutex);
+	if (!m_frameSent.wait_for(lock, FRAME_SEND_TIMEOUT, [&] { return m_sendingStream < 0; })) {
+		lock.unlock();
+		// The next frames refer to the dropped one
+		RequestIDR();
+		return;
+	}
+
+	SlicedFrame &frame = m_slicedFrames[streamIndex];
+	BeginFrame(frame, buf, len, targetTimestampNs, streamIndex);
+	if (streamIndex == 0) {
+		m_videoRecorder.Frame(buf, len, targetTimestampNs, frame.idr);
 	}
-	for (int i = 0; i < totalParityShards; i++) {
-		delete[] shards[dataShards + i];
+	if (frame.fec) {
+		// The encoder returned the frame in one piece, its slices are found after the fact
+		int offsets[MAX_FRAME_SLICES + 1];
+		int slices = FindSlices(buf, len, m_codec, (int)Settings::Instance().m_slicesPerFrame, offsets);
+		for (int i = 0; i < slices; i++) {
+			frame.bytes += FECSend(buf + offsets[i], offsets[i + 1] - offsets[i], targetTimestampNs, frame.videoFrameIndex,
+				frame.fecPercentage, frame.idr, streamIndex, (uint8_t)i, i == slices - 1);
+		}
+	} else {
+		frame.bytes = SendUnprotected(buf, len, targetTimestampNs, frame.videoFrameIndex, frame.idr, streamIndex);
 	}
+	EndFrame(frame, targetTimestampNs);
 }
 
-void ClientConnection::SendVideo(uint8_t *buf, int len, uint64_t targetTimestampNs) {
-	if (Settings::Instance().m_enableFec) {
-		FECSend(buf, len, targetTimestampNs, mVideoFrameIndex);
-	} else {
-		VideoFrame header = {};
-		header.packetCounter = this->videoPacketCounter;
-		header.trackingFrameIndex = targetTimestampNs;
-		header.videoFrameIndex = mVideoFrameIndex;
-		header.sentTime = GetTimestampUs();
-		header.frameByteSize = len;
+void ClientConnection::SendVideoSlice(uint8_t *buf, int len, uint64_t targetTimestampNs, uint8_t streamIndex, uint8_t sliceIndex, bool last) {
+	std::unique_lock<std::mutex> lock(m_sendMutex);
 
-		VideoSend(header, buf, len);
+	SlicedFrame &frame = m_slicedFrames[streamIndex];
+	if (sliceIndex == 0) {
+		if (!m_frameSent.wait_for(lock, FRAME_SEND_TIMEOUT, [&] { return m_sendingStream < 0 || m_sendingStream == streamIndex; })) {
+			lock.unlock();
+			RequestIDR();
+			return;
+		}
+		m_sendingStream = streamIndex;
+		BeginFrame(frame, buf, len, targetTimestampNs, streamIndex);
+	} else if (m_sendingStream != streamIndex) {
+		return;
+	}
 
-		m_Statistics->CountPacket(sizeof(VideoFrame) + len);
+	if (frame.keepData) {
+		frame.data.insert(frame.data.end(), buf, buf + len);
+	}
+	if (frame.fec) {
+		frame.bytes += FECSend(buf, len, targetTimestampNs, frame.videoFrameIndex, frame.fecPercentage, frame.idr, streamIndex, sliceIndex, last);
+	}
+	if (!last) {
+		return;
+	}
 
-		this->videoPacketCounter++;
+	if (!frame.fec) {
+		frame.bytes = SendUnprotected(frame.data.data(), (int)frame.data.size(), targetTimestampNs, frame.videoFrameIndex, frame.idr, streamIndex);
 	}
+	if (streamIndex == 0 && frame.keepData) {
+		m_videoRecorder.Frame(frame.data.data(), (int)frame.data.size(), targetTimestampNs, frame.idr);
+	}
+	EndFrame(frame, targetTimestampNs);
 
-	mVideoFrameIndex++;
+	m_sendingStream = -1;
+	lock.unlock();
+	m_frameSent.notify_all();
+}
+
+void ClientConnection::BeginFrame(SlicedFrame &frame, const uint8_t *buf, int len, uint64_t targetTimestampNs, uint8_t streamIndex) {
+	frame.videoFrameIndex = mVideoFrameIndex++;
+	m_frameTrace.RecordVideoFrame(targetTimestampNs, frame.videoFrameIndex, GetTimestampUs());
+
+	// The keyframe NAL units are in front of the first slice
+	frame.idr = IsIdrFrame(buf, len, m_codec);
+	frame.fec = m_enableFec;
+	frame.fecPercentage = m_fecController.GetPercentage(frame.idr);
+	frame.bytes = 0;
+	// Whole frames are only put together from the slices if they are needed
+	frame.keepData = !frame.fec || (streamIndex == 0 && m_videoRecorder.IsRecording());
+	frame.data.clear();
+
+	if (frame.idr && streamIndex < 2) {
+		int size = ParameterSetsSize(buf, len, m_codec);
+		auto &parameterSets = m_parameterSets[streamIndex];
+		if (size > 0 && (parameterSets.size() != (size_t)size || memcmp(parameterSets.data(), buf, size) != 0)) {
+			parameterSets.assign(buf, buf + size);
+			VideoConfigSend(streamIndex, parameterSets.data(), size);
+		}
+	}
+}
+
+void ClientConnection::EndFrame(SlicedFrame &frame, uint64_t targetTimestampNs) {
+	m_frameTrace.Record(targetTimestampNs, FrameTrace::SEND_END, GetTimestampUs());
+	m_bitrateController.OnFrameSent(frame.videoFrameIndex, frame.bytes);
+}
+
+uint64_t ClientConnection::SendUnprotected(const uint8_t *buf, int len, uint64_t targetTimestampNs, uint64_t videoFrameIndex, bool idr, uint8_t streamIndex) {
+	VideoFrame header = {};
+	header.packetCounter = this->videoPacketCounter;
+	header.trackingFrameIndex = targetTimestampNs;
+	header.videoFrameIndex = videoFrameIndex;
+	header.sentTime = GetTimestampUs();
+	header.frameByteSize = len;
+	header.streamIndex = streamIndex;
+	header.contentScale = m_resolutionController.GetFrameScale(targetTimestampNs);
+	m_foveationController.GetFrameCenter(targetTimestampNs, header.foveationCenter);
+	header.sliceCount = 1;
+
+	VideoSend(header, const_cast<uint8_t *>(buf), len, idr);
+
+	m_Statistics->CountPacket(sizeof(VideoFrame) + len);
+	this->videoPacketCounter++;
+
+	return sizeof(VideoFrame) + len;
+}
+
+void ClientConnection::SetParityOffload(std::shared_ptr<ParityOffload> offload) {
+	std::unique_lock<std::mutex> lock(m_sendMutex);
+	m_fecEncoder.SetOffload(offload);
 }
 
 void ClientConnection::ProcessTimeSync(TimeSync data) {
@@ -144,6 +402,8 @@ void ClientConnection::ProcessTimeSync(TimeSync data) {
 		vr::VRServerDriverHost()->GetFrameTimings(&timing[0], 2);
 
 		m_reportedStatistics = *timeSync;
+		m_predictionHorizon = timeSync->predictionHorizon;
+		m_frameTrace.RecordClient(*timeSync, m_clockSync.GetTimeDiff(Current));
 		TimeSync sendBuf = *timeSync;
 		sendBuf.mode = 1;
 		sendBuf.serverTime = Current;
@@ -152,112 +412,160 @@ void ClientConnection::ProcessTimeSync(TimeSync data) {
 
 		m_Statistics->NetworkTotal(sendBuf.serverTotalLatency);
 		m_Statistics->NetworkSend(m_reportedStatistics.averageTransportLatency);
+		m_Statistics->ClientLatencies(m_reportedStatistics.averageSendLatency,
+			m_reportedStatistics.averageTransportLatency,
+			m_reportedStatistics.averageDecodeLatency,
+			m_reportedStatistics.idleTime);
 
 		float renderTime = timing[0].m_flPreSubmitGpuMs + timing[0].m_flPostSubmitGpuMs + timing[0].m_flTotalRenderGpuMs + timing[0].m_flCompositorRenderGpuMs + timing[0].m_flCompositorRenderCpuMs;
 		float idleTime = timing[0].m_flCompositorIdleCpuMs;
 		float waitTime = timing[0].m_flClientFrameIntervalMs + timing[0].m_flPresentCallCpuMs + timing[0].m_flWaitForPresentCpuMs + timing[0].m_flSubmitFrameMs;
 
+		m_fecController.OnStatistics(timeSync->packetsLostInSecond, m_Statistics->GetPacketsSentInSecond(), timeSync->fecFailureInSecond);
 		if (timeSync->fecFailure) {
 			OnFecFailure();
 		}
 
+		if (timeSync->arrivalPackets > 0) {
+			m_bitrateController.OnFrameArrival(timeSync->arrivalFrameIndex, timeSync->arrivalFirst, timeSync->arrivalLast);
+		}
+		m_bitrateController.OnStatistics(timeSync->packetsLostInSecond, m_Statistics->GetPacketsSentInSecond(),
+			m_Statistics->GetSendLatencyAverage(), m_Statistics->GetFPS(), m_Statistics->GetEncodedBitrate(), m_Statistics->GetEncoderLoad());
+		if (m_enableAdaptiveBitrate) {
+			m_Statistics->SetBitrate(m_bitrateController.GetBitrate());
+		}
+		// Largest frame that goes out within one frame interval at the measured capacity, the
+		// parity of the frame shares it
+		uint64_t budget = m_bitrateController.GetNetworkBudget();
+		uint64_t frameBudget = budget / std::max<uint64_t>(Settings::Instance().m_refreshRate, 1);
+		m_Statistics->SetMaxFrameSize(frameBudget * 100 / (100 + m_fecController.GetPercentage(false)));
+		m_resolutionController.OnStatistics(m_Statistics->GetEncoderLoad(), m_Statistics->GetBitrate(), m_Statistics->GetEncodeQpAverage());
+		if (Settings::Instance().m_enableVSyncPhaseLock) {
+			m_vsyncScheduler.OnClientFrame(timeSync->traceFrameIndex, timeSync->traceDecoderOutput, timeSync->traceRendered);
+		}
+
 		m_Statistics->Add(sendBuf.serverTotalLatency / 1000.0, 
 			(double)(m_Statistics->GetEncodeLatencyAverage()) / US_TO_MS,
 			m_reportedStatistics.averageTransportLatency / 1000.0,
 			m_reportedStatistics.averageDecodeLatency / 1000.0,
 			m_reportedStatistics.fps,
-			m_RTT / 2. / 1000.);
+			m_clockSync.GetRTT() / 2. / 1000.);
+		m_Statistics->ClientLatency(m_reportedStatistics.averageTransportLatency, m_reportedStatistics.averageDecodeLatency);
 
 		uint64_t now = GetTimestampUs();
 		if (now - m_LastStatisticsUpdate > STATISTICS_TIMEOUT_US)
 		{
 			// Text statistics only, some values averaged
-			Info("#{ \"id\": \"Statistics\", \"data\": {"
-				"\"totalPackets\": %llu, "
-				"\"packetRate\": %llu, "
-				"\"packetsLostTotal\": %llu, "
-				"\"packetsLostPerSecond\": %llu, "
-				"\"totalSent\": %llu, "
-				"\"sentRate\": %.3f, "
-				"\"bitrate\": %llu, "
-				"\"ping\": %.3f, "
-				"\"totalLatency\": %.3f, "
-				"\"encodeLatency\": %.3f, "
-				"\"sendLatency\": %.3f, "
-				"\"decodeLatency\": %.3f, "
-				"\"fecPercentage\": %d, "
-				"\"fecFailureTotal\": %llu, "
-				"\"fecFailureInSecond\": %llu, "
-				"\"clientFPS\": %.3f, "
-				"\"serverFPS\": %.3f, "
-				"\"batteryHMD\": %d, "
-				"\"batteryLeft\": %d, "
-				"\"batteryRight\": %d"
-				"} }#\n",
-				m_Statistics->GetPacketsSentTotal(),
-				m_Statistics->GetPacketsSentInSecond(),
-				m_reportedStatistics.packetsLostTotal,
-				m_reportedStatistics.packetsLostInSecond,
-				m_Statistics->GetBitsSentTotal() / 8 / 1000 / 1000,
-				m_Statistics->GetBitsSentInSecond() / 1000. / 1000.0,
-				m_Statistics->GetBitrate(),
-				m_Statistics->Get(5),  //ping
-				m_Statistics->Get(0),  //totalLatency
-				m_Statistics->Get(1),  //encodeLatency
-				m_Statistics->Get(2),  //sendLatency
-				m_Statistics->Get(3),  //decodeLatency
-				m_fecPercentage,
-				m_reportedStatistics.fecFailureTotal,
-				m_reportedStatistics.fecFailureInSecond,
-				m_Statistics->Get(4),  //clientFPS
-				m_Statistics->GetFPS(),
-				(int)(m_Statistics->m_hmdBattery * 100),
-				(int)(m_Statistics->m_leftControllerBattery * 100),
-				(int)(m_Statistics->m_rightControllerBattery * 100));
+			StatisticsSummary summary = {};
+			summary.totalPackets = m_Statistics->GetPacketsSentTotal();
+			summary.packetRate = m_Statistics->GetPacketsSentInSecond();
+			summary.packetsLostTotal = m_reportedStatistics.packetsLostTotal;
+			summary.packetsLostPerSecond = m_reportedStatistics.packetsLostInSecond;
+			summary.totalSent = m_Statistics->GetBitsSentTotal() / 8 / 1000 / 1000;
+			summary.sentRate = m_Statistics->GetBitsSentInSecond() / 1000. / 1000.0;
+			summary.bitrate = m_Statistics->GetBitrate();
+			summary.encodedBitrate = m_Statistics->GetEncodedBitrate();
+			summary.bitrateUsage = m_Statistics->GetBitrateUsage();
+			summary.encodedFrameSize = m_Statistics->GetEncodedFrameSizeAverage() / 1000.;
+			summary.intraFramesInSecond = m_Statistics->GetIntraFramesInSecond();
+			summary.encodeQp = m_Statistics->GetEncodeQpAverage();
+			summary.encoderLoad = m_Statistics->GetEncoderLoad();
+			summary.encoderLatency = m_Statistics->GetEncoderLatencyAverage() / 1000.;
+			summary.ping = m_Statistics->Get(5);
+			summary.totalLatency = m_Statistics->Get(0);
+			summary.encodeLatency = m_Statistics->Get(1);
+			summary.sendLatency = m_Statistics->Get(2);
+			summary.decodeLatency = m_Statistics->Get(3);
+			summary.fecPercentage = m_fecController.GetPercentage(false);
+			summary.fecFailureTotal = m_reportedStatistics.fecFailureTotal;
+			summary.fecFailureInSecond = m_reportedStatistics.fecFailureInSecond;
+			summary.fecRecoveryTime = m_reportedStatistics.fecRecoveryTime / 1000.;
+			summary.clientGpuTimeFfr = m_reportedStatistics.gpuTimeFfr / 1000.;
+			summary.clientGpuTimeEyes = m_reportedStatistics.gpuTimeEyes / 1000.;
+			summary.presentsCoalescedInSecond = m_Statistics->GetPresentsCoalescedInSecond();
+			summary.presentLatency = m_Statistics->GetPresentLatencyAverage();
+			summary.compositorFramesDroppedInSecond = m_Statistics->GetCompositorFramesDroppedInSecond();
+			summary.compositorFramesLateInSecond = m_Statistics->GetCompositorFramesLateInSecond();
+			summary.duplicateFramesSkippedInSecond = m_Statistics->GetDuplicateFramesSkippedInSecond();
+			summary.lateFramesDroppedInSecond = m_Statistics->GetLateFramesDroppedInSecond();
+			summary.expiredFramesDroppedInSecond = m_Statistics->GetExpiredFramesDroppedInSecond();
+			summary.vsyncJitter = m_Statistics->GetVSyncJitterAverage() / 1000.;
+			summary.vsyncJitterMax = m_Statistics->GetVSyncJitterMax() / 1000.;
+			summary.gpuQueueWait = m_Statistics->GetGpuQueueWaitAverage() / 1000.;
+			GpuUtilization gpu = m_Statistics->GetGpuUtilization();
+			summary.gpuGraphicsLoad = gpu.graphics;
+			summary.gpuEncoderLoad = gpu.encoder;
+			summary.gpuClock = gpu.graphicsClock;
+			summary.pcieTxRate = gpu.pcieTx;
+			summary.pcieRxRate = gpu.pcieRx;
+			summary.clientFPS = m_Statistics->Get(4);
+			summary.serverFPS = m_Statistics->GetFPS();
+			summary.predictionErrorRotation = m_reportedStatistics.predictionErrorRotation;
+			summary.predictionErrorPosition = m_reportedStatistics.predictionErrorPosition;
+			summary.predictionHorizon = m_reportedStatistics.predictionHorizon / 1000.;
+			summary.predictionResidual = m_reportedStatistics.predictionResidual / 1000.;
+			summary.composePercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_COMPOSE);
+			summary.encodePercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_ENCODE);
+			summary.sendPercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_SEND);
+			summary.transportPercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_TRANSPORT);
+			summary.decodePercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_DECODE);
+			summary.renderPercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_RENDER);
+			summary.layerRenderPercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_LAYER_RENDER);
+			summary.layerHandoffPercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_LAYER_HANDOFF);
+			summary.presentPickupPercentiles = GetPercentiles(*m_Statistics, Statistics::STAGE_PRESENT_PICKUP);
+			summary.batteryHMD = (int)(m_Statistics->m_hmdBattery * 100);
+			summary.batteryLeft = (int)(m_Statistics->m_leftControllerBattery * 100);
+			summary.batteryRight = (int)(m_Statistics->m_rightControllerBattery * 100);
+			StatisticsSend(summary);
 
 			m_LastStatisticsUpdate = now;
 			m_Statistics->Reset();
 		};
 
 		// Continously send statistics info for updating graphs
-		Info("#{ \"id\": \"GraphStatistics\", \"data\": [%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f] }#\n",
-			Current / 1000,                                                //time
-			sendBuf.serverTotalLatency / 1000.0,                           //totalLatency
-			m_reportedStatistics.averageSendLatency / 1000.0,              //receiveLatency
-			renderTime,                                                    //renderTime
-			idleTime,                                                      //idleTime
-			waitTime,                                                      //waitTime
-			(double)(m_Statistics->GetEncodeLatencyAverage()) / US_TO_MS,  //encodeLatency
-			m_reportedStatistics.averageTransportLatency / 1000.0,         //sendLatency
-			m_reportedStatistics.averageDecodeLatency / 1000.0,            //decodeLatency
-			m_reportedStatistics.idleTime / 1000.0,                        //clientIdleTime
-			m_reportedStatistics.fps,                                      //clientFPS
-			m_Statistics->GetFPS());                                       //serverFPS
+		GraphStatistics graph = {};
+		graph.time = Current / 1000;
+		graph.totalLatency = sendBuf.serverTotalLatency / 1000.0;
+		graph.receiveLatency = m_reportedStatistics.averageSendLatency / 1000.0;
+		graph.renderTime = renderTime;
+		graph.idleTime = idleTime;
+		graph.waitTime = waitTime;
+		graph.encodeLatency = (double)(m_Statistics->GetEncodeLatencyAverage()) / US_TO_MS;
+		graph.sendLatency = m_reportedStatistics.averageTransportLatency / 1000.0;
+		graph.decodeLatency = m_reportedStatistics.averageDecodeLatency / 1000.0;
+		graph.clientIdleTime = m_reportedStatistics.idleTime / 1000.0;
+		graph.clientFPS = m_reportedStatistics.fps;
+		graph.serverFPS = m_Statistics->GetFPS();
+		graph.gpuCompositionTime = m_Statistics->GetGpuPassAverage(0);
+		graph.gpuColorCorrectionTime = m_Statistics->GetGpuPassAverage(1);
+		graph.gpuFfrTime = m_Statistics->GetGpuPassAverage(2);
+		graph.gpuEncoderCopyTime = m_Statistics->GetGpuPassAverage(3);
+		graph.layerRenderTime = (double)(m_Statistics->GetLayerRenderLatencyAverage()) / US_TO_MS;
+		graph.layerHandoffTime = (double)(m_Statistics->GetLayerHandoffLatencyAverage()) / US_TO_MS;
+		graph.presentPickupTime = (double)(m_Statistics->GetPresentLatencyAverage()) / US_TO_MS;
+		graph.layerCopyTime = (double)(m_Statistics->GetLayerCopyLatencyAverage()) / US_TO_MS;
+		GraphStatisticsSend(graph);
 
 	}
 	else if (timeSync->mode == 2) {
-		// Calclate RTT
-		uint64_t RTT = Current - timeSync->serverTime;
-		m_RTT = RTT;
-		// Estimated difference between server and client clock
-		int64_t TimeDiff = Current - (timeSync->clientTime + RTT / 2);
-		m_TimeDiff = TimeDiff;
-		Debug("TimeSync: server - client = %lld us RTT = %lld us\n", TimeDiff, RTT);
+		// The kernel timestamp leaves out the time the packet waited in the receive path
+		uint64_t receiveTime = timeSync->receiveTime != 0 ? timeSync->receiveTime : Current;
+		m_clockSync.OnSample(timeSync->serverTime, timeSync->clientTime, receiveTime);
 	}
 }
 
 float ClientConnection::GetPoseTimeOffset() {
-	return -(double)(m_Statistics->GetTotalLatencyAverage()) / 1000.0 / 1000.0;
+	// Before the first frame is displayed, the sum of the averages of the stages
+	uint64_t horizonUs = m_predictionHorizon;
+	if (horizonUs == 0) {
+		horizonUs = m_Statistics->GetTotalLatencyAverage();
+	}
+	return -(double)horizonUs / 1000.0 / 1000.0;
 }
 
 void ClientConnection::OnFecFailure() {
 	Debug("Listener::OnFecFailure()\n");
-	if (GetTimestampUs() - m_lastFecFailure < CONTINUOUS_FEC_FAILURE) {
-		if (m_fecPercentage < MAX_FEC_PERCENTAGE) {
-			m_fecPercentage += 5;
-		}
-	}
-	m_lastFecFailure = GetTimestampUs();
+	m_fecController.OnFecFailure();
 }
 
 std::shared_ptr<Statistics> ClientConnection::GetStatistics() {
@@ -1,12 +1,25 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <fstream>
 #include <mutex>
+#include <vector>
 
 #include "ALVR-common/packet_types.h"
+#include "BitrateController.h"
+#include "ClockSync.h"
+#include "FecController.h"
+#include "FecEncoder.h"
+#include "FoveationController.h"
+#include "FrameTrace.h"
+#include "IdleController.h"
+#include "ResolutionController.h"
 #include "Settings.h"
+#include "VSyncScheduler.h"
+#include "VideoRecorder.h"
 
 #include "openvr_driver.h"
 
@@ -17,9 +30,29 @@ public:
 
 	ClientConnection();
 
-	void FECSend(uint8_t *buf, int len, uint64_t targetTimestampNs, uint64_t videoFrameIndex);
-	void SendVideo(uint8_t *buf, int len, uint64_t targetTimestampNs);
+	// Copies the settings read for every frame and passes the bitrate settings on. Called when the
+	// settings are reloaded at stream start or updated live, the listener can outlive both.
+	void ApplySettings();
+
+	// Sends one slice of a frame as a FEC block of its own. Returns the bytes handed to the
+	// network, headers and parity included.
+	uint64_t FECSend(uint8_t *buf, int len, uint64_t targetTimestampNs, uint64_t videoFrameIndex, int fecPercentage, bool idr, uint8_t streamIndex,
+		uint8_t sliceIndex = 0, bool lastSlice = true);
+	// Thread safe, the encode sessions of the dual stream mode send from their own threads. The
+	// video frame index is shared by the streams so that every frame has its own.
+	// The frame is split at its slices, up to the slices per frame of the settings, so that the
+	// client recovers and decodes each one as soon as it arrived.
+	void SendVideo(uint8_t *buf, int len, uint64_t targetTimestampNs, uint8_t streamIndex = 0);
+	// For encoders that hand out the slices of a frame as they complete, so that the first ones are
+	// on the network while the next ones are encoded. The slices of a frame come in order, the
+	// first one with the parameter sets in front of it, `last` on the final one. The frames of the
+	// streams still go out one after the other, a stream waits for the frame of the other one.
+	void SendVideoSlice(uint8_t *buf, int len, uint64_t targetTimestampNs, uint8_t streamIndex, uint8_t sliceIndex, bool last);
+	// Set by the platform to compute the parity of large frames elsewhere, nullptr to stop
+	void SetParityOffload(std::shared_ptr<ParityOffload> offload);
  	void ProcessTimeSync(TimeSync data);
+	// Horizon of the poses the server predicts, the one the client measured from its tracking
+	// samples to the display of their frames
 	float GetPoseTimeOffset();
 	void OnFecFailure();
 	std::shared_ptr<Statistics> GetStatistics();
@@ -28,17 +61,69 @@ public:
 
 	uint32_t videoPacketCounter = 0;
 
-	uint64_t m_RTT = 0;
-	int64_t m_TimeDiff = 0;
+	ClockSync m_clockSync;
+	FrameTrace m_frameTrace;
 
 	TimeSync m_reportedStatistics;
-	uint64_t m_lastFecFailure = 0;
-	static const uint64_t CONTINUOUS_FEC_FAILURE = 60 * 1000 * 1000;
-	static const int INITIAL_FEC_PERCENTAGE = 5;
-	static const int MAX_FEC_PERCENTAGE = 10;
-	int m_fecPercentage = INITIAL_FEC_PERCENTAGE;
+	FecController m_fecController;
+	BitrateController m_bitrateController;
+	// Scale of the frames the platform renders, begun for each frame before rendering it
+	ResolutionController m_resolutionController;
+	// Foveation center of the frames the platform renders, begun like the scale
+	FoveationController m_foveationController;
+	// Read by the vsync generator of the platform
+	VSyncScheduler m_vsyncScheduler;
+	// Pauses the encoder and slows the vsync of the platform down
+	IdleController m_idleController;
+	// Tee of the frames of the primary stream
+	VideoRecorder m_videoRecorder;
 
 	uint64_t mVideoFrameIndex = 1;
 
 	uint64_t m_LastStatisticsUpdate;
+
+private:
+	// Frame of a stream being sent, slice by slice
+	struct SlicedFrame {
+		uint64_t videoFrameIndex = 0;
+		bool idr = false;
+		// Settings at the first slice, they hold for the whole frame
+		bool fec = false;
+		int fecPercentage = 0;
+		uint64_t bytes = 0;
+		// The slices so far when the whole frame is needed at its end, without FEC or while recording
+		bool keepData = false;
+		std::vector<uint8_t> data;
+	};
+
+	// Called with m_sendMutex held, at the first and after the last slice of a frame
+	void BeginFrame(SlicedFrame &frame, const uint8_t *buf, int len, uint64_t targetTimestampNs, uint8_t streamIndex);
+	void EndFrame(SlicedFrame &frame, uint64_t targetTimestampNs);
+	// Sends a whole frame without FEC, in a single slice
+	uint64_t SendUnprotected(const uint8_t *buf, int len, uint64_t targetTimestampNs, uint64_t videoFrameIndex, bool idr, uint8_t streamIndex);
+
+	// From the TimeSync of the client, in us, 0 until it measured one
+	std::atomic<uint32_t> m_predictionHorizon{ 0 };
+
+	FecEncoder m_fecEncoder;
+	std::mutex m_sendMutex;
+
+	int m_codec;
+	bool m_enableFec;
+	int m_videoPacketSize;
+	// Read on the statistics thread, updated by ApplySettings() on the Rust thread
+	std::atomic<bool> m_enableAdaptiveBitrate{ false };
+
+	// Parameter sets of the last keyframe of each stream, the dual stream mode has two. The client
+	// gets them over the control socket whenever they change.
+	std::vector<uint8_t> m_parameterSets[2];
+
+	SlicedFrame m_slicedFrames[2];
+	// Stream whose frame is on its way out, -1 between frames. The other stream waits for it.
+	int m_sendingStream = -1;
+	std::condition_variable m_frameSent;
+
+	// Reused across frames to hand a whole frame to VideoSendBatch without allocating.
+	std::vector<VideoFrame> m_batchHeaders;
+	std::vector<VideoPacketPayload> m_batchPayloads;
 };
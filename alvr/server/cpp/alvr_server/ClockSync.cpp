@@ -0,0 +1,129 @@
+#include "ClockSync.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Logger.h"
+
+ClockSync::ClockSync()
+{
+	Reset();
+}
+
+void ClockSync::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_sampleCount = 0;
+	m_nextSample = 0;
+	m_referenceTime = 0;
+	m_offset = 0;
+	m_drift = 0;
+	m_minRTT = 0;
+	m_errorBound = UINT64_MAX;
+}
+
+void ClockSync::OnSample(uint64_t serverSendTime, uint64_t clientTime, uint64_t serverReceiveTime)
+{
+	if (serverReceiveTime < serverSendTime) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	Sample &sample = m_samples[m_nextSample];
+	sample.serverTime = serverReceiveTime;
+	sample.rtt = serverReceiveTime - serverSendTime;
+	// The client answered halfway through the round trip
+	sample.offset = (int64_t)(serverReceiveTime - sample.rtt / 2) - (int64_t)clientTime;
+
+	m_nextSample = (m_nextSample + 1) % WINDOW_SIZE;
+	m_sampleCount = std::min(m_sampleCount + 1, WINDOW_SIZE);
+
+	Update();
+
+	Debug("ClockSync: sample offset=%lld us rtt=%llu us. estimate offset=%.0f us drift=%.1f ppm error=%llu us\n",
+		sample.offset, sample.rtt, m_offset, m_drift * 1e6, m_errorBound);
+}
+
+void ClockSync::Update()
+{
+	m_minRTT = UINT64_MAX;
+	for (int i = 0; i < m_sampleCount; i++) {
+		m_minRTT = std::min(m_minRTT, m_samples[i].rtt);
+	}
+	uint64_t maxRTT = m_minRTT + RTT_TOLERANCE_US;
+
+	uint64_t firstTime = UINT64_MAX;
+	uint64_t lastTime = 0;
+	for (int i = 0; i < m_sampleCount; i++) {
+		if (m_samples[i].rtt <= maxRTT) {
+			firstTime = std::min(firstTime, m_samples[i].serverTime);
+			lastTime = std::max(lastTime, m_samples[i].serverTime);
+		}
+	}
+
+	// Least squares fit of the offset over the selected samples, relative to the latest one to
+	// keep the doubles precise.
+	m_referenceTime = lastTime;
+	double count = 0, sumT = 0, sumO = 0, sumTT = 0, sumTO = 0;
+	for (int i = 0; i < m_sampleCount; i++) {
+		const Sample &sample = m_samples[i];
+		if (sample.rtt > maxRTT) {
+			continue;
+		}
+		double t = -(double)(m_referenceTime - sample.serverTime);
+		double o = (double)sample.offset;
+		count++;
+		sumT += t;
+		sumO += o;
+		sumTT += t * t;
+		sumTO += t * o;
+	}
+
+	double meanT = sumT / count;
+	double meanO = sumO / count;
+	double varianceT = sumTT / count - meanT * meanT;
+	m_drift = 0;
+	if (lastTime - firstTime >= MIN_DRIFT_SPAN_US && varianceT > 0) {
+		m_drift = std::clamp((sumTO / count - meanT * meanO) / varianceT, -MAX_DRIFT, MAX_DRIFT);
+	}
+	m_offset = meanO - m_drift * meanT;
+
+	double residual = 0;
+	for (int i = 0; i < m_sampleCount; i++) {
+		const Sample &sample = m_samples[i];
+		if (sample.rtt > maxRTT) {
+			continue;
+		}
+		double t = -(double)(m_referenceTime - sample.serverTime);
+		double error = (double)sample.offset - (m_offset + m_drift * t);
+		residual += error * error;
+	}
+	m_errorBound = m_minRTT / 2 + (uint64_t)std::sqrt(residual / count);
+}
+
+int64_t ClockSync::GetTimeDiff(uint64_t serverTime) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (m_sampleCount == 0) {
+		return 0;
+	}
+	double t = serverTime >= m_referenceTime ? (double)(serverTime - m_referenceTime) : -(double)(m_referenceTime - serverTime);
+	return (int64_t)std::llround(m_offset + m_drift * t);
+}
+
+uint64_t ClockSync::GetRTT() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	return m_minRTT;
+}
+
+uint64_t ClockSync::GetErrorBound() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	return m_errorBound;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+// Estimates the offset between the server and client clocks from the TimeSync round trips.
+// Samples with a round trip close to the minimum of the window are the ones least delayed by
+// queuing, only those are used. A linear fit over them gives the offset and the drift between the
+// two clocks, so a single noisy sample does not move the estimate.
+class ClockSync
+{
+public:
+	ClockSync();
+
+	void Reset();
+
+	// serverSendTime and serverReceiveTime are the server clock when the request left and when the
+	// answer arrived, clientTime is the client clock when it answered.
+	void OnSample(uint64_t serverSendTime, uint64_t clientTime, uint64_t serverReceiveTime);
+
+	// Server clock minus client clock at the given server time, in microseconds.
+	int64_t GetTimeDiff(uint64_t serverTime) const;
+	// Round trip time of the least delayed sample of the window.
+	uint64_t GetRTT() const;
+	// Bound of the error of GetTimeDiff(), in microseconds. Half of the round trip plus the spread
+	// of the samples around the fit. UINT64_MAX until there is a sample.
+	uint64_t GetErrorBound() const;
+
+private:
+	struct Sample {
+		uint64_t serverTime;
+		uint64_t rtt;
+		int64_t offset;
+	};
+
+	void Update();
+
+	static constexpr int WINDOW_SIZE = 32;
+	// Samples up to this much slower than the fastest one are considered for the fit.
+	static constexpr uint64_t RTT_TOLERANCE_US = 1000;
+	// Below this time span the drift cannot be told apart from noise.
+	static constexpr uint64_t MIN_DRIFT_SPAN_US = 2 * 1000 * 1000;
+	// Crystal oscillators drift by tens of ppm, anything larger comes from noise.
+	static constexpr double MAX_DRIFT = 500e-6;
+
+	mutable std::mutex m_mutex;
+	Sample m_samples[WINDOW_SIZE];
+	int m_sampleCount;
+	int m_nextSample;
+
+	// Fitted model: offset(t) = m_offset + m_drift * (t - m_referenceTime)
+	uint64_t m_referenceTime;
+	double m_offset;
+	double m_drift;
+	uint64_t m_minRTT;
+	uint64_t m_errorBound;
+};
@@ -0,0 +1,47 @@
+#include "DeadlineScheduler.h"
+
+#include <algorithm>
+
+#include "ClientConnection.h"
+#include "Logger.h"
+#include "Settings.h"
+#include "Statistics.h"
+#include "Utils.h"
+
+DeadlineScheduler::Verdict DeadlineScheduler::Check(ClientConnection &listener, uint64_t targetTimestampNs, bool mustEncode)
+{
+	if (!Settings::Instance().m_dropLateFrames || mustEncode || m_lastDropped) {
+		m_lastDropped = false;
+		return ENCODE;
+	}
+
+	// Without the arrival of the pose or the client averages there is nothing to go by
+	uint64_t receiveTime;
+	uint64_t encodeToDecodeUs = listener.GetStatistics()->GetEncodeToDecodeLatency();
+	if (!listener.m_frameTrace.GetTime(targetTimestampNs, FrameTrace::TRACKING_RECEIVED, &receiveTime)
+		|| encodeToDecodeUs == 0) {
+		return ENCODE;
+	}
+
+	uint64_t horizonUs = (uint64_t)(-listener.GetPoseTimeOffset() * 1000 * 1000);
+	uint64_t frameIntervalUs = 1000 * 1000 / std::max<uint64_t>(Settings::Instance().m_refreshRate, 1);
+	uint64_t deadlineUs = receiveTime + horizonUs + frameIntervalUs - std::min(listener.m_clockSync.GetRTT() / 2, receiveTime);
+
+	uint64_t now = GetTimestampUs();
+	Verdict verdict = ENCODE;
+	if (now > deadlineUs) {
+		verdict = DROP_EXPIRED;
+	}
+	else if (now + encodeToDecodeUs > deadlineUs) {
+		verdict = DROP_LATE;
+	}
+	if (verdict == ENCODE) {
+		return ENCODE;
+	}
+
+	Debug("DeadlineScheduler: frame %llu dropped, expected %lld us past its deadline\n",
+		targetTimestampNs, (int64_t)(now + encodeToDecodeUs) - (int64_t)deadlineUs);
+	listener.GetStatistics()->DeadlineFrameDropped(verdict == DROP_EXPIRED);
+	m_lastDropped = true;
+	return verdict;
+}
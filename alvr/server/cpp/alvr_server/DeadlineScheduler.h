@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+class ClientConnection;
+
+// Drops the frames that can no longer be displayed on time, before they are encoded. The display
+// time of a frame is the time the client sampled its pose plus the prediction horizon the client
+// measured, the sample time being the arrival of the pose minus half the round trip. The frame is
+// expected on the client once it went through the encoder, the network and the decoder, going by
+// the recent averages of the stages. A frame expected more than a frame interval after its display
+// time is dropped, so that the encoder starts on the next frame instead of delaying it and every
+// frame behind it. Both platforms already encode the newest frame presented, and the frame after
+// a drop is always encoded: under a sustained overload the stream goes on at a lower rate with a
+// bounded latency instead of stopping.
+class DeadlineScheduler
+{
+public:
+	enum Verdict {
+		ENCODE,
+		// The display time had already passed by more than a frame interval
+		DROP_EXPIRED,
+		// The frame would reach the client too late
+		DROP_LATE,
+	};
+
+	// Called by the encoder thread before encoding each frame. mustEncode is set for the frames
+	// that cannot be dropped, like the ones a recovery waits for. The drops are counted in the
+	// statistics.
+	Verdict Check(ClientConnection &listener, uint64_t targetTimestampNs, bool mustEncode);
+
+private:
+	bool m_lastDropped = false;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// What is known about one encoded frame. Encoders fill in what their API reports, the other
+// fields keep their defaults.
+struct EncodeStats {
+	enum FrameType {
+		FRAME_UNKNOWN,
+		FRAME_IDR,
+		FRAME_I,
+		FRAME_P,
+		FRAME_B,
+	};
+
+	// From the frame being handed to the encoder to its bitstream being available, measured by
+	// the driver, so it includes queuing in front of the encoder.
+	uint64_t latencyUs = 0;
+	// Time spent in the encoder alone, as reported by it or measured around the hardware encode.
+	// 0 if unknown.
+	uint64_t encoderLatencyUs = 0;
+	// Size of the bitstream given to the send path
+	uint64_t bytes = 0;
+	FrameType frameType = FRAME_UNKNOWN;
+	// Average quantizer of the frame, negative if unknown
+	float averageQp = -1;
+	// Frames the encoder works on at the same time, their latencies overlap
+	uint32_t pipelineDepth = 1;
+};
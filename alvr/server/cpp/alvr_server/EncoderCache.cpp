@@ -0,0 +1,67 @@
+#include "EncoderCache.h"
+#include "Logger.h"
+#define PICOJSON_USE_INT64
+#include "include/picojson.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <streambuf>
+#include "bindings.h"
+
+namespace {
+	std::filesystem::path CachePath() {
+		return std::filesystem::path(g_sessionPath).parent_path() / "encoder_cache.json";
+	}
+
+	picojson::object ReadCache() {
+		auto cacheFile = std::ifstream(CachePath());
+		if (!cacheFile) {
+			return {};
+		}
+		auto json = std::string(
+			std::istreambuf_iterator<char>(cacheFile),
+			std::istreambuf_iterator<char>());
+
+		picojson::value v;
+		std::string err = picojson::parse(v, json);
+		if (!err.empty() || !v.is<picojson::object>()) {
+			Warn("Ignoring invalid encoder cache: %hs\n", err.c_str());
+			return {};
+		}
+		return v.get<picojson::object>();
+	}
+}
+
+std::string LoadCachedEncoder(const std::string &configKey) {
+	auto cache = ReadCache();
+	auto entry = cache.find(configKey);
+	if (entry == cache.end() || !entry->second.is<std::string>()) {
+		return "";
+	}
+	return entry->second.get<std::string>();
+}
+
+void StoreCachedEncoder(const std::string &configKey, const std::string &encoder) {
+	auto cache = ReadCache();
+	auto entry = cache.find(configKey);
+	if (entry != cache.end() && entry->second.is<std::string>() && entry->second.get<std::string>() == encoder) {
+		return;
+	}
+	cache[configKey] = picojson::value(encoder);
+
+	auto cacheFile = std::ofstream(CachePath());
+	if (!cacheFile) {
+		Warn("Failed to write the encoder cache.\n");
+		return;
+	}
+	cacheFile << picojson::value(cache).serialize(true);
+}
+
+void PreferCachedEncoder(const std::string &configKey, std::vector<std::string> &candidates) {
+	auto cached = LoadCachedEncoder(configKey);
+	auto it = std::find(candidates.begin(), candidates.end(), cached);
+	if (it != candidates.end()) {
+		Debug("Using cached encoder %hs for %hs\n", cached.c_str(), configKey.c_str());
+		std::rotate(candidates.begin(), it, it + 1);
+	}
+}
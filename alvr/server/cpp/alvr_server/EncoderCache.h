@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Remembers which encoder could be created for a configuration, in encoder_cache.json next to the
+// session file, so the next stream start creates it first instead of failing through the others.
+// The configuration key holds everything the choice depends on (GPU, codec, size, bit depth).
+
+// Returns the cached encoder for configKey, or an empty string.
+std::string LoadCachedEncoder(const std::string &configKey);
+void StoreCachedEncoder(const std::string &configKey, const std::string &encoder);
+
+// Moves the cached encoder, if it is one of candidates, to the front.
+void PreferCachedEncoder(const std::string &configKey, std::vector<std::string> &candidates);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Rate control of the encoder, applied from the next frame without reinitializing it
+struct EncoderRate {
+	// Average and peak bitrate, in bit/s
+	uint64_t bitrate = 0;
+	// Size of the VBV (HRD) buffer in bits. One frame at the average bitrate keeps every frame
+	// close to the same size, which is what the transport latency depends on.
+	uint64_t vbvSize = 0;
+	// Largest single frame in bits, 0 for no cap. Bigger frames take more than a frame interval
+	// to go out at the network bandwidth, and their bursts are what the link drops.
+	uint64_t maxFrameSize = 0;
+	float fps = 0;
+
+	static EncoderRate ForBitrate(uint64_t bitrate, float fps) {
+		EncoderRate rate;
+		rate.bitrate = bitrate;
+		rate.fps = fps > 0 ? fps : 1;
+		rate.vbvSize = (uint64_t)(bitrate / rate.fps);
+		return rate;
+	}
+
+	// The VBV shrinks with the cap when the network carries less than the bitrate, the encoders
+	// without a frame size limit of their own get it through the VBV.
+	void CapFrameSize(uint64_t bits) {
+		maxFrameSize = bits;
+		if (bits > 0 && bits < vbvSize) {
+			vbvSize = bits;
+		}
+	}
+};
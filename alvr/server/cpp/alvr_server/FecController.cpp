@@ -0,0 +1,98 @@
+#include "FecController.h"
+
+#include <algorithm>
+
+#include "Logger.h"
+#include "Utils.h"
+
+FecController::FecController()
+{
+	Reset();
+}
+
+void FecController::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_percentage = INITIAL_FEC_PERCENTAGE;
+	m_lastRaise = 0;
+	m_lastDecrease = 0;
+	m_spectatorTarget = MIN_FEC_PERCENTAGE;
+	m_lastSpectatorReport = 0;
+}
+
+void FecController::OnStatistics(uint64_t packetsLostInSecond, uint64_t packetsSentInSecond, uint64_t fecFailureInSecond)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint64_t now = GetTimestampUs();
+
+	int target = LossTarget(packetsLostInSecond, packetsSentInSecond);
+	if (now - m_lastSpectatorReport < SPECTATOR_HOLD_US) {
+		target = std::max(target, m_spectatorTarget);
+	}
+
+	ApplyTarget(target, fecFailureInSecond != 0, now);
+}
+
+void FecController::OnSpectatorStatistics(uint64_t packetsLostInSecond, uint64_t packetsSentInSecond)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint64_t now = GetTimestampUs();
+
+	m_spectatorTarget = LossTarget(packetsLostInSecond, packetsSentInSecond);
+	m_lastSpectatorReport = now;
+
+	// Only raises, the statistics of the client lower the percentage
+	if (m_spectatorTarget > m_percentage) {
+		ApplyTarget(m_spectatorTarget, false, now);
+	}
+}
+
+int FecController::LossTarget(uint64_t packetsLost, uint64_t packetsSent)
+{
+	if (packetsSent == 0) {
+		return MIN_FEC_PERCENTAGE;
+	}
+	uint64_t lossPercentage = (packetsLost * 100 * LOSS_SAFETY_FACTOR + packetsSent - 1) / packetsSent;
+	return (int)std::min<uint64_t>(std::max<uint64_t>(lossPercentage, MIN_FEC_PERCENTAGE), MAX_FEC_PERCENTAGE);
+}
+
+void FecController::ApplyTarget(int target, bool fecFailure, uint64_t now)
+{
+	int percentage = m_percentage;
+	if (target > percentage) {
+		Debug("FecController: raising FEC percentage %d -> %d\n", percentage, target);
+		m_percentage = target;
+		m_lastRaise = now;
+		m_lastDecrease = now;
+	} else if (target < percentage && !fecFailure && now - m_lastDecrease > DECREASE_INTERVAL_US) {
+		m_percentage = percentage - 1;
+		m_lastDecrease = now;
+	}
+}
+
+void FecController::OnFecFailure()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint64_t now = GetTimestampUs();
+	if (now - m_lastRaise < FEC_FAILURE_HOLD_US) {
+		return;
+	}
+
+	int percentage = std::min((int)m_percentage + FEC_FAILURE_STEP, (int)MAX_FEC_PERCENTAGE);
+	Debug("FecController: FEC failure, FEC percentage %d -> %d\n", (int)m_percentage, percentage);
+	m_percentage = percentage;
+	m_lastRaise = now;
+	m_lastDecrease = now;
+}
+
+int FecController::GetPercentage(bool idr) const
+{
+	if (idr) {
+		return std::min(m_percentage * IDR_FEC_MULTIPLIER, (int)MAX_IDR_FEC_PERCENTAGE);
+	}
+	return m_percentage;
+}
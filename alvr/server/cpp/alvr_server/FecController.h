@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+// Chooses the FEC percentage of each video frame from the loss statistics reported by the client.
+// Redundancy is raised as soon as losses or FEC failures show up and lowered slowly once the link
+// has been clean for a while. IDR frames get extra parity since losing one stalls the stream until
+// the next keyframe.
+class FecController
+{
+public:
+	FecController();
+
+	void Reset();
+
+	// Fed with every client statistics report. packetsSentInSecond is the server side count over
+	// the same one second window.
+	void OnStatistics(uint64_t packetsLostInSecond, uint64_t packetsSentInSecond, uint64_t fecFailureInSecond);
+	void OnFecFailure();
+	// Worst loss among the spectators of the video in the last second. The percentage covers it
+	// as long as it is reported.
+	void OnSpectatorStatistics(uint64_t packetsLostInSecond, uint64_t packetsSentInSecond);
+
+	int GetPercentage(bool idr) const;
+
+	static const int INITIAL_FEC_PERCENTAGE = 5;
+	static const int MIN_FEC_PERCENTAGE = 2;
+	static const int MAX_FEC_PERCENTAGE = 25;
+	static const int MAX_IDR_FEC_PERCENTAGE = 50;
+
+private:
+	// Parity needed to cover the measured loss ratio, bursts included.
+	static const int LOSS_SAFETY_FACTOR = 3;
+	static const int IDR_FEC_MULTIPLIER = 2;
+	// Raise applied on every reported FEC failure.
+	static const int FEC_FAILURE_STEP = 5;
+	// Failures reported within this interval count as one (the client reports them both in the
+	// TimeSync packet and as a video error report).
+	static const uint64_t FEC_FAILURE_HOLD_US = 500 * 1000;
+	// The percentage is lowered by 1 each time this interval passes without losses above target.
+	static const uint64_t DECREASE_INTERVAL_US = 1000 * 1000;
+	// Spectators that stopped reporting no longer hold the percentage up
+	static const uint64_t SPECTATOR_HOLD_US = 3 * 1000 * 1000;
+
+	static int LossTarget(uint64_t packetsLost, uint64_t packetsSent);
+	// Called with m_mutex held
+	void ApplyTarget(int target, bool fecFailure, uint64_t now);
+
+	// Statistics and error reports arrive on the network threads, frames are sent from the encoder
+	// thread.
+	std::mutex m_mutex;
+	std::atomic<int> m_percentage;
+	uint64_t m_lastRaise;
+	uint64_t m_lastDecrease;
+	int m_spectatorTarget;
+	uint64_t m_lastSpectatorReport;
+};
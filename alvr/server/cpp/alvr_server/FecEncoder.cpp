@@ -0,0 +1,220 @@
+#include "FecEncoder.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "Logger.h"
+
+FecEncoder::FecEncoder()
+{
+}
+
+FecEncoder::~FecEncoder()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exiting = true;
+	}
+	m_jobCv.notify_all();
+	for (auto &worker : m_workers) {
+		worker.join();
+	}
+
+	for (auto &codec : m_codecs) {
+		reed_solomon_release(codec.second);
+	}
+}
+
+uint8_t **FecEncoder::Encode(uint8_t *buf, int len, int dataShards, int parityShards, int blockSize)
+{
+	reed_solomon *rs = PrepareShards(buf, len, dataShards, parityShards, blockSize);
+	if (rs == nullptr) {
+		return nullptr;
+	}
+
+	int ret = reed_solomon_encode(rs, &m_shards[0], dataShards + parityShards, blockSize);
+	if (ret != 0) {
+		Error("reed_solomon_encode failed. ret=%d\n", ret);
+		return nullptr;
+	}
+
+	return &m_shards[0];
+}
+
+uint8_t **FecEncoder::EncodeAsync(uint8_t *buf, int len, int dataShards, int parityShards, int blockSize)
+{
+	reed_solomon *rs = PrepareShards(buf, len, dataShards, parityShards, blockSize);
+	if (rs == nullptr) {
+		return nullptr;
+	}
+
+	if (m_offload && m_offload->Encode(rs, &m_shards[0], blockSize)) {
+		// An empty job, Wait() returns right away
+		std::unique_lock<std::mutex> lock(m_mutex);
+		PublishJob(lock, Job());
+		return &m_shards[0];
+	}
+
+	if (m_workers.empty()) {
+		unsigned count = std::min(std::max(std::thread::hardware_concurrency() / 2, 1u), MAX_WORKERS);
+		Debug("FecEncoder: starting %u workers\n", count);
+		for (unsigned i = 0; i < count; i++) {
+			m_workers.emplace_back(&FecEncoder::WorkerLoop, this);
+		}
+	}
+
+	int threads = (int)m_workers.size() + 1;
+	int sliceSize = (blockSize + threads * SLICES_PER_THREAD - 1) / (threads * SLICES_PER_THREAD);
+	sliceSize = std::max(sliceSize, MIN_SLICE_BYTES);
+	// Slices of the arena shards stay on SIMD friendly boundaries
+	sliceSize = (int)((sliceSize + SHARD_ALIGNMENT - 1) & ~(SHARD_ALIGNMENT - 1));
+
+	Job job;
+	job.codec = rs;
+	job.shards = dataShards + parityShards;
+	job.blockSize = blockSize;
+	job.sliceSize = sliceSize;
+	job.sliceCount = (blockSize + sliceSize - 1) / sliceSize;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		PublishJob(lock, job);
+	}
+	m_jobCv.notify_all();
+
+	return &m_shards[0];
+}
+
+void FecEncoder::Wait()
+{
+	// The caller takes the slices no worker got to yet. Only this thread writes the job.
+	RunSlices(m_job);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCv.wait(lock, [&] { return m_doneSlices == m_job.sliceCount && m_busyWorkers == 0; });
+}
+
+void FecEncoder::PublishJob(std::unique_lock<std::mutex> &lock, const Job &job)
+{
+	// A worker that woke up after Wait() returned may still be in RunSlices() of the previous job,
+	// with a slice number taken from its counter
+	m_doneCv.wait(lock, [&] { return m_busyWorkers == 0; });
+
+	m_job = job;
+	m_doneSlices = 0;
+	m_nextSlice = 0;
+	m_jobId++;
+}
+
+void FecEncoder::SetOffload(std::shared_ptr<ParityOffload> offload)
+{
+	m_offload = offload;
+}
+
+void FecEncoder::WorkerLoop()
+{
+	uint64_t jobId = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_jobCv.wait(lock, [&] { return m_exiting || m_jobId != jobId; });
+		if (m_exiting) {
+			return;
+		}
+		jobId = m_jobId;
+		Job job = m_job;
+		m_busyWorkers++;
+
+		lock.unlock();
+		RunSlices(job);
+		lock.lock();
+
+		if (--m_busyWorkers == 0) {
+			m_doneCv.notify_all();
+		}
+	}
+}
+
+void FecEncoder::RunSlices(const Job &job)
+{
+	int slice;
+	while ((slice = m_nextSlice.fetch_add(1)) < job.sliceCount) {
+		EncodeSlice(job, slice);
+		if (m_doneSlices.fetch_add(1) + 1 == job.sliceCount) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_doneCv.notify_all();
+		}
+	}
+}
+
+void FecEncoder::EncodeSlice(const Job &job, int slice)
+{
+	int offset = slice * job.sliceSize;
+	int size = std::min(job.sliceSize, job.blockSize - offset);
+
+	uint8_t *shards[DATA_SHARDS_MAX];
+	for (int i = 0; i < job.shards; i++) {
+		shards[i] = m_shards[i] + offset;
+	}
+	reed_solomon_encode(job.codec, shards, job.shards, size);
+}
+
+reed_solomon *FecEncoder::PrepareShards(uint8_t *buf, int len, int dataShards, int parityShards, int blockSize)
+{
+	reed_solomon *rs = GetCodec(dataShards, parityShards);
+	if (rs == nullptr) {
+		return nullptr;
+	}
+
+	int totalShards = dataShards + parityShards;
+	bool padTail = len % blockSize != 0;
+
+	// Every shard owned by the arena starts on a SHARD_ALIGNMENT boundary.
+	size_t stride = (blockSize + SHARD_ALIGNMENT - 1) & ~(SHARD_ALIGNMENT - 1);
+	size_t ownedShards = parityShards + (padTail ? 1 : 0);
+	uint8_t *arena = ReserveArena(stride * ownedShards);
+
+	m_shards.resize(totalShards);
+	for (int i = 0; i < dataShards; i++) {
+		m_shards[i] = buf + i * blockSize;
+	}
+	if (padTail) {
+		uint8_t *tail = arena + stride * parityShards;
+		int tailLength = len % blockSize;
+		memcpy(tail, buf + (dataShards - 1) * blockSize, tailLength);
+		memset(tail + tailLength, 0, blockSize - tailLength);
+		m_shards[dataShards - 1] = tail;
+	}
+	for (int i = 0; i < parityShards; i++) {
+		m_shards[dataShards + i] = arena + stride * i;
+	}
+
+	return rs;
+}
+
+reed_solomon *FecEncoder::GetCodec(int dataShards, int parityShards)
+{
+	auto key = std::make_pair(dataShards, parityShards);
+	auto it = m_codecs.find(key);
+	if (it != m_codecs.end()) {
+		return it->second;
+	}
+
+	Debug("reed_solomon_new. dataShards=%d parityShards=%d\n", dataShards, parityShards);
+
+	reed_solomon *rs = reed_solomon_new(dataShards, parityShards);
+	if (rs == nullptr) {
+		Error("reed_solomon_new failed. dataShards=%d parityShards=%d\n", dataShards, parityShards);
+		return nullptr;
+	}
+	// The key space is bounded by ALVR_FEC_SHARDS_MAX, so the cache never needs eviction.
+	m_codecs.emplace(key, rs);
+	return rs;
+}
+
+uint8_t *FecEncoder::ReserveArena(size_t size)
+{
+	if (m_arena.size() < size + SHARD_ALIGNMENT) {
+		m_arena.resize(size + SHARD_ALIGNMENT);
+	}
+	uintptr_t base = reinterpret_cast<uintptr_t>(m_arena.data());
+	return reinterpret_cast<uint8_t *>((base + SHARD_ALIGNMENT - 1) & ~(uintptr_t)(SHARD_ALIGNMENT - 1));
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ALVR-common/packet_types.h"
+
+// Computes the parity of the frames elsewhere than on the CPU, FecCompute on Windows
+class ParityOffload
+{
+public:
+	virtual ~ParityOffload() {}
+
+	// shards as given to reed_solomon_encode(): the data shards of rs, then its parity shards to
+	// fill, blockSize bytes each. Returns false if the parity is left to the CPU.
+	virtual bool Encode(reed_solomon *rs, uint8_t **shards, int blockSize) = 0;
+};
+
+// Persistent Reed-Solomon encoder for the video stream.
+// reed_solomon instances are cached per (dataShards, parityShards) pair and the padded tail shard
+// and parity shards live in a single arena that only grows, so steady-state frames do not touch
+// the heap.
+//
+// The parity of large frames can be computed by a few worker threads instead. Reed-Solomon works
+// on each byte column of the shards on its own, so the shards are cut into column slices that the
+// workers, and the caller in Wait(), take from a shared counter. With an offload, the parity of
+// those frames is computed by it instead.
+class FecEncoder
+{
+public:
+	FecEncoder();
+	~FecEncoder();
+
+	FecEncoder(const FecEncoder &) = delete;
+	FecEncoder &operator=(const FecEncoder &) = delete;
+
+	// Encode len bytes of buf into dataShards + parityShards shards of blockSize bytes.
+	// Returns the shard table (data shards first, then parity shards) or nullptr on failure.
+	// The returned pointers are valid until the next call to Encode().
+	uint8_t **Encode(uint8_t *buf, int len, int dataShards, int parityShards, int blockSize);
+
+	// Like Encode(), but the parity is computed by the workers. The data shards of the table can be
+	// read right away, the parity shards once Wait() returned. Wait() must be called before the
+	// next encode.
+	uint8_t **EncodeAsync(uint8_t *buf, int len, int dataShards, int parityShards, int blockSize);
+	void Wait();
+
+	// Takes over the parity of the frames given to EncodeAsync(), nullptr to stop
+	void SetOffload(std::shared_ptr<ParityOffload> offload);
+
+	// Frames from this size on are worth the handoff to the workers
+	static const int PARALLEL_MIN_BYTES = 128 * 1024;
+
+private:
+	static const size_t SHARD_ALIGNMENT = 64;
+	static const unsigned MAX_WORKERS = 4;
+	// Slices per thread, so that a worker that started late still finds some
+	static const int SLICES_PER_THREAD = 2;
+	static const int MIN_SLICE_BYTES = 1024;
+
+	// Fills m_shards, returns the codec or nullptr on failure
+	reed_solomon *PrepareShards(uint8_t *buf, int len, int dataShards, int parityShards, int blockSize);
+	reed_solomon *GetCodec(int dataShards, int parityShards);
+	uint8_t *ReserveArena(size_t size);
+
+	struct Job {
+		reed_solomon *codec = nullptr;
+		int shards = 0;
+		int blockSize = 0;
+		int sliceSize = 0;
+		int sliceCount = 0;
+	};
+
+	// Called with m_mutex held, waits for the workers to leave the previous job
+	void PublishJob(std::unique_lock<std::mutex> &lock, const Job &job);
+	void WorkerLoop();
+	// Encodes slices of job until none is left
+	void RunSlices(const Job &job);
+	void EncodeSlice(const Job &job, int slice);
+
+	std::map<std::pair<int, int>, reed_solomon *> m_codecs;
+
+	std::vector<uint8_t> m_arena;
+	std::vector<uint8_t *> m_shards;
+	std::shared_ptr<ParityOffload> m_offload;
+
+	// Started on the first EncodeAsync()
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_jobCv;
+	std::condition_variable m_doneCv;
+	bool m_exiting = false;
+	uint64_t m_jobId = 0;
+	// Workers in RunSlices(), the next job waits for them to leave
+	int m_busyWorkers = 0;
+
+	// Current job, tagged with m_jobId. Written under m_mutex while no worker is in RunSlices(),
+	// the workers copy it under m_mutex, so the slice counters never mix two jobs.
+	Job m_job;
+	std::atomic<int> m_nextSlice{ 0 };
+	std::atomic<int> m_doneSlices{ 0 };
+};
@@ -0,0 +1,103 @@
+#include "FoveatedEncoding.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FoveationVars.h"
+#include "Settings.h"
+
+namespace {
+
+// Foveation center of an eye, in eye UV of the encoded frame
+struct EyeCenter {
+	float left;
+	float top;
+	float right;
+	float bottom;
+};
+
+EyeCenter CalculateEyeCenter() {
+	auto vars = CalculateFoveationVars();
+	float size[2] = { vars.centerSizeX, vars.centerSizeY };
+	float shift[2] = { vars.centerShiftX, vars.centerShiftY };
+	float edgeRatio[2] = { vars.edgeRatioX, vars.edgeRatioY };
+	float eyeRatio[2] = { vars.eyeWidthRatio, vars.eyeHeightRatio };
+
+	float lo[2], hi[2];
+	for (int i = 0; i < 2; i++) {
+		float c0 = (1.f - size[i]) / 2.f;
+		if (Settings::Instance().m_enableFoveatedRendering) {
+			// Bounds of the uncompressed center in the compressed eye, see CompressAxisAlignedPixelShader
+			float c2 = (edgeRatio[i] - 1.f) * size[i] + 1.f;
+			lo[i] = c0 * (shift[i] + 1.f) / c2 * eyeRatio[i];
+			hi[i] = (c0 * (shift[i] - 1.f) / c2 + 1.f) * eyeRatio[i];
+		} else {
+			lo[i] = c0 * (shift[i] + 1.f);
+			hi[i] = lo[i] + size[i];
+		}
+	}
+	return { lo[0], lo[1], hi[0], hi[1] };
+}
+
+// 0 in the center to 1 at the eye edges, for a point in eye UV
+float CenterDistance(const EyeCenter &center, float u, float v) {
+	auto axis = [](float t, float lo, float hi) {
+		if (t < lo) {
+			return (lo - t) / lo;
+		}
+		if (t > hi) {
+			return (t - hi) / (1.f - hi);
+		}
+		return 0.f;
+	};
+	return std::min(1.f, std::max(axis(u, center.left, center.right), axis(v, center.top, center.bottom)));
+}
+
+}
+
+bool FoveatedEncodingEnabled() {
+	return Settings::Instance().m_enableFoveatedEncoding && Settings::Instance().m_foveatedEncodingQpOffset > 0;
+}
+
+std::vector<int8_t> BuildFoveationQpMap(uint32_t width, uint32_t height, uint32_t blockSize) {
+	auto center = CalculateEyeCenter();
+	float maxOffset = (float)Settings::Instance().m_foveatedEncodingQpOffset;
+
+	uint32_t blocksX = (width + blockSize - 1) / blockSize;
+	uint32_t blocksY = (height + blockSize - 1) / blockSize;
+	std::vector<int8_t> map(blocksX * blocksY);
+	for (uint32_t y = 0; y < blocksY; y++) {
+		for (uint32_t x = 0; x < blocksX; x++) {
+			float frameU = (x + 0.5f) * blockSize / width;
+			float v = (y + 0.5f) * blockSize / height;
+			// The right eye is mirrored, its center is shifted towards the nose too
+			float u = frameU < 0.5f ? frameU * 2.f : (1.f - frameU) * 2.f;
+			map[y * blocksX + x] = (int8_t)std::lround(maxOffset * CenterDistance(center, u, v));
+		}
+	}
+	return map;
+}
+
+std::vector<FoveationRect> BuildFoveationRects(uint32_t width, uint32_t height, uint32_t steps) {
+	auto center = CalculateEyeCenter();
+	float maxOffset = (float)Settings::Instance().m_foveatedEncodingQpOffset;
+	float eyeWidth = width / 2.f;
+
+	std::vector<FoveationRect> rects;
+	for (uint32_t step = 0; step < steps; step++) {
+		// Points up to this distance from the center
+		float t = (float)step / steps;
+		float left = center.left * (1.f - t);
+		float right = center.right + (1.f - center.right) * t;
+		auto top = (uint32_t)std::floor(center.top * (1.f - t) * height);
+		auto bottom = std::min(height, (uint32_t)std::ceil((center.bottom + (1.f - center.bottom) * t) * height));
+		int qpOffset = (int)std::lround(maxOffset * t);
+
+		rects.push_back({ (uint32_t)std::floor(left * eyeWidth), top,
+			(uint32_t)std::ceil(right * eyeWidth), bottom, qpOffset });
+		rects.push_back({ (uint32_t)std::floor(width - right * eyeWidth), top,
+			std::min(width, (uint32_t)std::ceil(width - left * eyeWidth)), bottom, qpOffset });
+	}
+	rects.push_back({ 0, 0, width, height, (int)maxOffset });
+	return rects;
+}
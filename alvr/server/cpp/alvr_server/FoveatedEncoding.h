@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Encoder side foveation: the quantization is raised with the distance to the foveation center
+// of the foveated rendering settings, the frame is not resampled. The center is placed in the
+// compressed frame when the geometric foveation is enabled too.
+
+// A rectangle of the encoded frame in pixels, right and bottom excluded
+struct FoveationRect {
+	uint32_t left;
+	uint32_t top;
+	uint32_t right;
+	uint32_t bottom;
+	int qpOffset;
+};
+
+bool FoveatedEncodingEnabled();
+
+// QP offset of each block of the encoded frame in raster order, from 0 in the center to
+// m_foveatedEncodingQpOffset at the eye edges. For per block maps, NVENC qpDeltaMap and AMF ROI.
+std::vector<int8_t> BuildFoveationQpMap(uint32_t width, uint32_t height, uint32_t blockSize);
+
+// The same ramp in steps, as nested rectangles from the center outwards, both eyes for each step.
+// The first rectangle containing a block gives its offset, the last one covers the whole frame.
+std::vector<FoveationRect> BuildFoveationRects(uint32_t width, uint32_t height, uint32_t steps);
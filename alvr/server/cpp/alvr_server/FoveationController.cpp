@@ -0,0 +1,138 @@
+#include "FoveationController.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Settings.h"
+#include "Utils.h"
+
+namespace {
+	// Gazes further than this from the view direction are not looking at the display
+	const float MIN_FORWARD = 0.2f;
+
+	// Shift that centers a center of centerSize at uv, both in eye UV
+	float ShiftToward(float uv, float centerSize) {
+		float c0 = (1.f - centerSize) / 2.f;
+		if (c0 <= 0.f) {
+			return 0.f;
+		}
+		return std::min(std::max((uv - 0.5f) / c0, -1.f), 1.f);
+	}
+}
+
+FoveationController::FoveationController()
+{
+	Reset();
+}
+
+void FoveationController::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (auto &gaze : m_gazes) {
+		gaze.targetTimestampNs = 0;
+	}
+	m_nextGaze = 0;
+	for (auto &frame : m_frames) {
+		frame.targetTimestampNs = 0;
+	}
+	m_nextFrame = 0;
+}
+
+void FoveationController::OnTracking(const TrackingInfo &info)
+{
+	if (!info.eyeGazeValid) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_gazes[m_nextGaze] = { info.targetTimestampNs, info.eyeGaze };
+	m_nextGaze = (m_nextGaze + 1) % HISTORY;
+}
+
+FoveationCenter FoveationController::BeginFrame(uint64_t targetTimestampNs)
+{
+	auto &settings = Settings::Instance();
+	if (!settings.m_enableFoveatedRendering || !settings.m_foveationFollowGaze) {
+		return StaticFoveationCenter();
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// The gaze sampled with the pose of the frame, or the latest one
+	const Gaze *gaze = nullptr;
+	const Gaze &latest = m_gazes[(m_nextGaze + HISTORY - 1) % HISTORY];
+	for (auto &g : m_gazes) {
+		if (g.targetTimestampNs != 0 && g.targetTimestampNs == targetTimestampNs) {
+			gaze = &g;
+			break;
+		}
+	}
+	if (gaze == nullptr && latest.targetTimestampNs != 0) {
+		gaze = &latest;
+	}
+	if (gaze == nullptr) {
+		return StaticFoveationCenter();
+	}
+
+	Frame &frame = m_frames[m_nextFrame];
+	m_nextFrame = (m_nextFrame + 1) % HISTORY;
+	frame.targetTimestampNs = targetTimestampNs;
+	GazeToCenter(gaze->orientation, frame.center);
+
+	// What the client decompresses with
+	return {
+		{ frame.center[0] / QUANTIZATION, frame.center[1] / QUANTIZATION },
+		{ frame.center[2] / QUANTIZATION, frame.center[3] / QUANTIZATION } };
+}
+
+void FoveationController::GetFrameCenter(uint64_t targetTimestampNs, int8_t center[4])
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (auto &frame : m_frames) {
+		if (frame.targetTimestampNs == targetTimestampNs) {
+			std::copy(frame.center, frame.center + 4, center);
+			return;
+		}
+	}
+	center[0] = CENTER_OF_SETTINGS;
+	center[1] = center[2] = center[3] = 0;
+}
+
+void FoveationController::GazeToCenter(const TrackingQuat &q, int8_t center[4])
+{
+	auto vars = CalculateFoveationVars();
+	auto &settings = Settings::Instance();
+
+	// -Z rotated by the gaze, in head space
+	float x = -2.f * (q.x * q.z + q.w * q.y);
+	float y = -2.f * (q.y * q.z - q.w * q.x);
+	float forward = 1.f - 2.f * (q.x * q.x + q.y * q.y);
+
+	float shifts[4] = { 0.f, 0.f, 0.f, 0.f };
+	if (forward >= MIN_FORWARD) {
+		float tanX = x / forward;
+		float tanY = y / forward;
+		for (int eye = 0; eye < 2; eye++) {
+			const EyeFov &fov = settings.m_eyeFov[eye];
+			float tanLeft = tanf(fov.left * DEG_TO_RAD);
+			float tanRight = tanf(fov.right * DEG_TO_RAD);
+			float tanTop = tanf(fov.top * DEG_TO_RAD);
+			float tanBottom = tanf(fov.bottom * DEG_TO_RAD);
+
+			float u = (tanX + tanLeft) / (tanLeft + tanRight);
+			// Pixel rows go down
+			float v = (tanTop - tanY) / (tanTop + tanBottom);
+
+			// The right eye is mirrored
+			shifts[eye * 2] = ShiftToward(eye == 0 ? u : 1.f - u, vars.centerSizeX);
+			shifts[eye * 2 + 1] = ShiftToward(v, vars.centerSizeY);
+		}
+	}
+
+	for (int i = 0; i < 4; i++) {
+		center[i] = (int8_t)std::lround(shifts[i] * QUANTIZATION);
+	}
+}
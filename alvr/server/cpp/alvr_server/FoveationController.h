@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+#include "ALVR-common/packet_types.h"
+#include "FoveationVars.h"
+
+// Moves the center of the foveated compression to where the eyes look, for headsets that send
+// their eye gaze with the tracking. The center of each frame goes to the client in the header of
+// the video packets and its decompression follows it. The size of the center stays the one of the
+// settings, which can be much smaller than without eye tracking.
+class FoveationController
+{
+public:
+	// Header value of the frames compressed around the center of the settings
+	static const int8_t CENTER_OF_SETTINGS = INT8_MIN;
+
+	FoveationController();
+
+	void Reset();
+
+	// Called with every tracking sample from the network thread
+	void OnTracking(const TrackingInfo &info);
+
+	// Center of the frame about to be rendered, from the gaze of its tracking sample or the latest
+	// gaze. The center of the settings without gaze. Remembered for GetFrameCenter().
+	FoveationCenter BeginFrame(uint64_t targetTimestampNs);
+	// For the header of the video packets, quantized like the center BeginFrame() returned.
+	// CENTER_OF_SETTINGS first for frames not begun here or rendered without gaze.
+	void GetFrameCenter(uint64_t targetTimestampNs, int8_t center[4]);
+
+private:
+	// Tracking samples and frames being rendered or encoded
+	static const int HISTORY = 64;
+	// Values of the header per unit of center shift
+	static constexpr float QUANTIZATION = 127.f;
+
+	struct Gaze {
+		uint64_t targetTimestampNs;
+		TrackingQuat orientation;
+	};
+
+	struct Frame {
+		uint64_t targetTimestampNs;
+		int8_t center[4];
+	};
+
+	// Shifts of the center of the settings size that put it at the gaze, quantized
+	static void GazeToCenter(const TrackingQuat &gaze, int8_t center[4]);
+
+	std::mutex m_mutex;
+
+	Gaze m_gazes[HISTORY];
+	int m_nextGaze;
+	Frame m_frames[HISTORY];
+	int m_nextFrame;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// Parameters of the foveated compression, laid out like the FoveationVars constant buffer of
+// FoveatedRendering.hlsli. Shared by the Direct3D passes and the Vulkan pre-encode stage of Linux.
+struct FoveationVars {
+	uint32_t targetEyeWidth;
+	uint32_t targetEyeHeight;
+	uint32_t optimizedEyeWidth;
+	uint32_t optimizedEyeHeight;
+
+	float eyeWidthRatio;
+	float eyeHeightRatio;
+
+	float centerSizeX;
+	float centerSizeY;
+	float centerShiftX;
+	float centerShiftY;
+	float edgeRatioX;
+	float edgeRatioY;
+};
+
+// Center shift of the foveated compression of one frame, in the units of
+// FoveationVars::centerShift. The shaders mirror the right eye horizontally, a center moved
+// towards the nose has the same sign for both eyes.
+struct FoveationCenter {
+	float left[2];
+	float right[2];
+};
+
+// For the current settings. The optimized eye size is aligned for the encoder, the compressed
+// frame is optimizedEyeWidth * 2 by optimizedEyeHeight.
+FoveationVars CalculateFoveationVars();
+
+// The center shift of the settings, for the frames rendered without the eye gaze
+FoveationCenter StaticFoveationCenter();
@@ -0,0 +1,192 @@
+#include "FrameTrace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include "Logger.h"
+
+namespace {
+	enum Process {
+		PROCESS_SERVER = 1,
+		PROCESS_CLIENT = 2,
+	};
+
+	struct Span {
+		const char *name;
+		Process process;
+		FrameTrace::Event begin;
+		FrameTrace::Event end;
+	};
+
+	const Span SPANS[] = {
+		{ "Uplink", PROCESS_CLIENT, FrameTrace::CLIENT_TRACKING, FrameTrace::TRACKING_RECEIVED },
+		{ "Game", PROCESS_SERVER, FrameTrace::TRACKING_RECEIVED, FrameTrace::PRESENT },
+		{ "Encode", PROCESS_SERVER, FrameTrace::PRESENT, FrameTrace::ENCODE_END },
+		{ "Send", PROCESS_SERVER, FrameTrace::ENCODE_END, FrameTrace::SEND_END },
+		{ "Receive", PROCESS_CLIENT, FrameTrace::CLIENT_RECEIVED_FIRST, FrameTrace::CLIENT_RECEIVED_LAST },
+		{ "Decode", PROCESS_CLIENT, FrameTrace::CLIENT_DECODER_INPUT, FrameTrace::CLIENT_DECODER_OUTPUT },
+		{ "Render", PROCESS_CLIENT, FrameTrace::CLIENT_DECODER_OUTPUT, FrameTrace::CLIENT_RENDERED },
+		{ "Submit", PROCESS_CLIENT, FrameTrace::CLIENT_RENDERED, FrameTrace::CLIENT_SUBMIT },
+	};
+
+	// Async events, every span gets its own category and id pair so that spans of pipelined
+	// frames can overlap.
+	void AppendEvent(std::string &out, const Span &span, char phase, uint64_t frameIndex,
+		uint64_t videoFrameIndex, uint64_t time)
+	{
+		char buf[256];
+		snprintf(buf, sizeof(buf),
+			",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id2\":{\"local\":\"0x%llx\"},"
+			"\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"frame\":%llu,\"videoFrame\":%llu}}",
+			span.name, span.name, phase, (unsigned long long)frameIndex, span.process, span.process,
+			(unsigned long long)time, (unsigned long long)frameIndex, (unsigned long long)videoFrameIndex);
+		out += buf;
+	}
+}
+
+FrameTrace::FrameTrace()
+{
+	Reset();
+}
+
+void FrameTrace::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_newest = MAX_FRAMES - 1;
+	m_count = 0;
+}
+
+FrameTrace::Frame &FrameTrace::GetFrame(uint64_t frameIndex)
+{
+	int depth = std::min(m_count, SEARCH_DEPTH);
+	for (int i = 0; i < depth; i++) {
+		Frame &frame = m_frames[(m_newest - i + MAX_FRAMES) % MAX_FRAMES];
+		if (frame.frameIndex == frameIndex) {
+			return frame;
+		}
+	}
+
+	m_newest = (m_newest + 1) % MAX_FRAMES;
+	m_count = std::min(m_count + 1, MAX_FRAMES);
+
+	Frame &frame = m_frames[m_newest];
+	frame = {};
+	frame.frameIndex = frameIndex;
+	return frame;
+}
+
+void FrameTrace::Record(uint64_t frameIndex, Event event, uint64_t time)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	GetFrame(frameIndex).times[event] = time;
+}
+
+void FrameTrace::RecordVideoFrame(uint64_t frameIndex, uint64_t videoFrameIndex, uint64_t encodeEndTime)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	Frame &frame = GetFrame(frameIndex);
+	frame.videoFrameIndex = videoFrameIndex;
+	frame.times[ENCODE_END] = encodeEndTime;
+}
+
+bool FrameTrace::FindVideoFrame(uint64_t videoFrameIndex, uint64_t *frameIndex) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	int depth = std::min(m_count, SEARCH_DEPTH);
+	for (int i = 0; i < depth; i++) {
+		const Frame &frame = m_frames[(m_newest - i + MAX_FRAMES) % MAX_FRAMES];
+		if (frame.videoFrameIndex == videoFrameIndex) {
+			*frameIndex = frame.frameIndex;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FrameTrace::GetTime(uint64_t frameIndex, Event event, uint64_t *time) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	int depth = std::min(m_count, SEARCH_DEPTH);
+	for (int i = 0; i < depth; i++) {
+		const Frame &frame = m_frames[(m_newest - i + MAX_FRAMES) % MAX_FRAMES];
+		if (frame.frameIndex == frameIndex) {
+			*time = frame.times[event];
+			return *time != 0;
+		}
+	}
+	return false;
+}
+
+void FrameTrace::RecordClient(const TimeSync &timeSync, int64_t timeDiff)
+{
+	if (timeSync.traceFrameIndex == 0) {
+		return;
+	}
+
+	std::pair<Event, uint64_t> clientTimes[] = {
+		{ CLIENT_TRACKING, timeSync.traceTracking },
+		{ CLIENT_RECEIVED_FIRST, timeSync.traceReceivedFirst },
+		{ CLIENT_RECEIVED_LAST, timeSync.traceReceivedLast },
+		{ CLIENT_DECODER_INPUT, timeSync.traceDecoderInput },
+		{ CLIENT_DECODER_OUTPUT, timeSync.traceDecoderOutput },
+		{ CLIENT_RENDERED, timeSync.traceRendered },
+		{ CLIENT_SUBMIT, timeSync.traceSubmit },
+	};
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	Frame &frame = GetFrame(timeSync.traceFrameIndex);
+	for (auto &clientTime : clientTimes) {
+		if (clientTime.second != 0) {
+			frame.times[clientTime.first] = clientTime.second + timeDiff;
+		}
+	}
+}
+
+bool FrameTrace::Write(const std::string &path) const
+{
+	std::vector<Frame> frames;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		frames.reserve(m_count);
+		for (int i = m_count - 1; i >= 0; i--) {
+			frames.push_back(m_frames[(m_newest - i + MAX_FRAMES) % MAX_FRAMES]);
+		}
+	}
+
+	std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Server\"}},\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"Client\"}}";
+	for (auto &frame : frames) {
+		for (auto &span : SPANS) {
+			uint64_t begin = frame.times[span.begin];
+			uint64_t end = frame.times[span.end];
+			if (begin == 0 || end == 0) {
+				continue;
+			}
+			// Spans crossing the clocks can come out slightly negative from the offset error.
+			end = std::max(begin, end);
+			AppendEvent(out, span, 'b', frame.frameIndex, frame.videoFrameIndex, begin);
+			AppendEvent(out, span, 'e', frame.frameIndex, frame.videoFrameIndex, end);
+		}
+	}
+	out += "\n]}\n";
+
+	auto file = std::ofstream(path);
+	if (!file) {
+		Warn("Failed to write the frame trace to %hs\n", path.c_str());
+		return false;
+	}
+	file << out;
+
+	Info("Wrote the trace of %d frames to %hs\n", (int)frames.size(), path.c_str());
+	return true;
+}
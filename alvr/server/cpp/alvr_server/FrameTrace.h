@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+
+#include "bindings.h"
+
+// Timestamps of every stage of the recent frames, on the server and on the client, joined by the
+// tracking frame index (the target timestamp the client sends with each pose). Client timestamps
+// are moved to the server clock when they arrive. Write() exports them as a Chrome JSON trace,
+// which chrome://tracing and Perfetto open.
+class FrameTrace
+{
+public:
+	enum Event {
+		CLIENT_TRACKING,
+		TRACKING_RECEIVED,
+		PRESENT,
+		ENCODE_END,
+		SEND_END,
+		CLIENT_RECEIVED_FIRST,
+		CLIENT_RECEIVED_LAST,
+		CLIENT_DECODER_INPUT,
+		CLIENT_DECODER_OUTPUT,
+		CLIENT_RENDERED,
+		CLIENT_SUBMIT,
+		EVENT_COUNT,
+	};
+
+	FrameTrace();
+
+	void Reset();
+
+	// time is on the server clock, in microseconds.
+	void Record(uint64_t frameIndex, Event event, uint64_t time);
+	void RecordVideoFrame(uint64_t frameIndex, uint64_t videoFrameIndex, uint64_t encodeEndTime);
+	// Tracking frame index of a recent video frame. Returns false if it is not in the trace.
+	bool FindVideoFrame(uint64_t videoFrameIndex, uint64_t *frameIndex) const;
+	// Time of an event of a recent frame. Returns false if it is not in the trace or not recorded.
+	bool GetTime(uint64_t frameIndex, Event event, uint64_t *time) const;
+	// Stages of the frame the client reported in a TimeSync. timeDiff is the server clock minus
+	// the client clock.
+	void RecordClient(const TimeSync &timeSync, int64_t timeDiff);
+
+	bool Write(const std::string &path) const;
+
+private:
+	struct Frame {
+		uint64_t frameIndex;
+		uint64_t videoFrameIndex;
+		uint64_t times[EVENT_COUNT];
+	};
+
+	Frame &GetFrame(uint64_t frameIndex);
+
+	// About ten seconds at 90 fps
+	static constexpr int MAX_FRAMES = 1024;
+	// Client reports arrive a few frames late, older frames are not looked up.
+	static constexpr int SEARCH_DEPTH = 64;
+
+	mutable std::mutex m_mutex;
+	Frame m_frames[MAX_FRAMES];
+	int m_newest;
+	int m_count;
+};
@@ -0,0 +1,404 @@
+#include "GpuMonitor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <pdh.h>
+#pragma comment(lib, "pdh.lib")
+#else
+#include <dlfcn.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+namespace {
+	// The subset of nvml.h that is used, NVML is loaded at runtime as it ships with the driver
+	typedef int nvmlReturn_t;
+	typedef struct nvmlDevice_st *nvmlDevice_t;
+	struct nvmlUtilization_t {
+		unsigned int gpu;
+		unsigned int memory;
+	};
+	const nvmlReturn_t NVML_SUCCESS = 0;
+	const int NVML_CLOCK_GRAPHICS = 0;
+	const int NVML_PCIE_UTIL_TX_BYTES = 0;
+	const int NVML_PCIE_UTIL_RX_BYTES = 1;
+
+	class NvmlSource : public GpuMonitor::Source {
+	public:
+		~NvmlSource() {
+			if (m_shutdown) {
+				m_shutdown();
+			}
+#ifdef _WIN32
+			if (m_library) {
+				FreeLibrary((HMODULE)m_library);
+			}
+#else
+			if (m_library) {
+				dlclose(m_library);
+			}
+#endif
+		}
+
+		bool Open() {
+#ifdef _WIN32
+			m_library = LoadLibraryA("nvml.dll");
+#else
+			m_library = dlopen("libnvidia-ml.so.1", RTLD_LAZY);
+#endif
+			if (!m_library) {
+				return false;
+			}
+			auto init = (nvmlReturn_t(*)())Load("nvmlInit_v2");
+			auto getHandle = (nvmlReturn_t(*)(unsigned int, nvmlDevice_t *))Load("nvmlDeviceGetHandleByIndex_v2");
+			m_getUtilization = (nvmlReturn_t(*)(nvmlDevice_t, nvmlUtilization_t *))Load("nvmlDeviceGetUtilizationRates");
+			m_getEncoderUtilization = (nvmlReturn_t(*)(nvmlDevice_t, unsigned int *, unsigned int *))Load("nvmlDeviceGetEncoderUtilization");
+			m_getClock = (nvmlReturn_t(*)(nvmlDevice_t, int, unsigned int *))Load("nvmlDeviceGetClockInfo");
+			m_getPcieThroughput = (nvmlReturn_t(*)(nvmlDevice_t, int, unsigned int *))Load("nvmlDeviceGetPcieThroughput");
+			if (!init || !getHandle || !m_getUtilization || init() != NVML_SUCCESS) {
+				return false;
+			}
+			m_shutdown = (nvmlReturn_t(*)())Load("nvmlShutdown");
+			return getHandle(0, &m_device) == NVML_SUCCESS;
+		}
+
+		bool Sample(GpuUtilization &utilization) override {
+			nvmlUtilization_t rates;
+			if (m_getUtilization(m_device, &rates) != NVML_SUCCESS) {
+				return false;
+			}
+			utilization.graphics = rates.gpu;
+
+			unsigned int value, samplingPeriodUs;
+			if (m_getEncoderUtilization && m_getEncoderUtilization(m_device, &value, &samplingPeriodUs) == NVML_SUCCESS) {
+				utilization.encoder = value;
+			}
+			if (m_getClock && m_getClock(m_device, NVML_CLOCK_GRAPHICS, &value) == NVML_SUCCESS) {
+				utilization.graphicsClock = value;
+			}
+			// KB/s, each call samples the bus for 20 ms
+			if (m_getPcieThroughput && m_getPcieThroughput(m_device, NVML_PCIE_UTIL_TX_BYTES, &value) == NVML_SUCCESS) {
+				utilization.pcieTx = value / 1000;
+			}
+			if (m_getPcieThroughput && m_getPcieThroughput(m_device, NVML_PCIE_UTIL_RX_BYTES, &value) == NVML_SUCCESS) {
+				utilization.pcieRx = value / 1000;
+			}
+			return true;
+		}
+
+	private:
+		void *Load(const char *name) {
+#ifdef _WIN32
+			return (void *)GetProcAddress((HMODULE)m_library, name);
+#else
+			return dlsym(m_library, name);
+#endif
+		}
+
+		void *m_library = nullptr;
+		nvmlDevice_t m_device = nullptr;
+		nvmlReturn_t (*m_shutdown)() = nullptr;
+		nvmlReturn_t (*m_getUtilization)(nvmlDevice_t, nvmlUtilization_t *) = nullptr;
+		nvmlReturn_t (*m_getEncoderUtilization)(nvmlDevice_t, unsigned int *, unsigned int *) = nullptr;
+		nvmlReturn_t (*m_getClock)(nvmlDevice_t, int, unsigned int *) = nullptr;
+		nvmlReturn_t (*m_getPcieThroughput)(nvmlDevice_t, int, unsigned int *) = nullptr;
+	};
+
+#ifdef __linux__
+	const int MAX_DRM_CARDS = 16;
+
+	bool ReadInt(const std::string &path, int &value) {
+		FILE *file = fopen(path.c_str(), "r");
+		if (!file) {
+			return false;
+		}
+		bool ok = fscanf(file, "%d", &value) == 1;
+		fclose(file);
+		return ok;
+	}
+
+	std::string CardPath(int card) {
+		return "/sys/class/drm/card" + std::to_string(card);
+	}
+
+	// gpu_busy_percent of amdgpu. The video engines have no busy counter outside of the binary
+	// gpu_metrics table, whose layout changes with the GPU generation.
+	class AmdgpuSource : public GpuMonitor::Source {
+	public:
+		bool Open() {
+			int busy;
+			for (int card = 0; card < MAX_DRM_CARDS; card++) {
+				if (ReadInt(CardPath(card) + "/device/gpu_busy_percent", busy)) {
+					m_devicePath = CardPath(card) + "/device";
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool Sample(GpuUtilization &utilization) override {
+			if (!ReadInt(m_devicePath + "/gpu_busy_percent", utilization.graphics)) {
+				return false;
+			}
+			// The current level is marked with a *, as in "1: 1200Mhz *"
+			FILE *file = fopen((m_devicePath + "/pp_dpm_sclk").c_str(), "r");
+			if (file) {
+				char line[64];
+				while (fgets(line, sizeof(line), file)) {
+					int level, mhz;
+					if (strchr(line, '*') && sscanf(line, "%d: %dMhz", &level, &mhz) == 2) {
+						utilization.graphicsClock = mhz;
+					}
+				}
+				fclose(file);
+			}
+			return true;
+		}
+
+	private:
+		std::string m_devicePath;
+	};
+
+	// The busy time of the render and video engines from the i915 PMU, what intel_gpu_top reads.
+	// System wide counters need CAP_PERFMON or perf_event_paranoid at 0, without them only the
+	// clock is known.
+	class I915Source : public GpuMonitor::Source {
+	public:
+		~I915Source() {
+			for (int fd : m_engineFds) {
+				if (fd >= 0) {
+					close(fd);
+				}
+			}
+		}
+
+		bool Open() {
+			int mhz;
+			for (int card = 0; card < MAX_DRM_CARDS; card++) {
+				if (ReadInt(CardPath(card) + "/gt_act_freq_mhz", mhz)) {
+					m_cardPath = CardPath(card);
+					break;
+				}
+			}
+			if (m_cardPath.empty()) {
+				return false;
+			}
+
+			const std::string pmu = "/sys/bus/event_source/devices/i915";
+			int type, cpu;
+			if (ReadInt(pmu + "/type", type) && ReadInt(pmu + "/cpumask", cpu)) {
+				const char *events[] = { "rcs0-busy", "vcs0-busy" };
+				for (int i = 0; i < ENGINE_COUNT; i++) {
+					m_engineFds[i] = OpenCounter(type, cpu, pmu + "/events/" + events[i]);
+				}
+			}
+			if (m_engineFds[0] < 0) {
+				Info("GpuMonitor: no access to the i915 PMU, only the clock is sampled.\n");
+			}
+			return true;
+		}
+
+		bool Sample(GpuUtilization &utilization) override {
+			if (!ReadInt(m_cardPath + "/gt_act_freq_mhz", utilization.graphicsClock)) {
+				return false;
+			}
+
+			uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+			int *results[] = { &utilization.graphics, &utilization.encoder };
+			for (int i = 0; i < ENGINE_COUNT; i++) {
+				uint64_t busyNs;
+				if (m_engineFds[i] < 0 || read(m_engineFds[i], &busyNs, sizeof(busyNs)) != sizeof(busyNs)) {
+					continue;
+				}
+				if (m_lastSampleNs != 0 && now > m_lastSampleNs) {
+					*results[i] = (int)std::min<uint64_t>((busyNs - m_lastBusyNs[i]) * 100 / (now - m_lastSampleNs), 100);
+				}
+				m_lastBusyNs[i] = busyNs;
+			}
+			m_lastSampleNs = now;
+			return true;
+		}
+
+	private:
+		static const int ENGINE_COUNT = 2;
+
+		// eventPath holds "config=0x..."
+		static int OpenCounter(int type, int cpu, const std::string &eventPath) {
+			FILE *file = fopen(eventPath.c_str(), "r");
+			if (!file) {
+				return -1;
+			}
+			unsigned long long config;
+			bool ok = fscanf(file, "config=%llx", &config) == 1;
+			fclose(file);
+			if (!ok) {
+				return -1;
+			}
+
+			perf_event_attr attr = {};
+			attr.type = type;
+			attr.size = sizeof(attr);
+			attr.config = config;
+			return (int)syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+		}
+
+		std::string m_cardPath;
+		int m_engineFds[ENGINE_COUNT] = { -1, -1 };
+		uint64_t m_lastBusyNs[ENGINE_COUNT] = {};
+		uint64_t m_lastSampleNs = 0;
+	};
+#endif
+
+#ifdef _WIN32
+	// The GPU Engine counters of Windows, per process and engine. The utilization of an engine type
+	// is the sum over its instances, as the engines of a type are usually a single one.
+	class PdhSource : public GpuMonitor::Source {
+	public:
+		~PdhSource() {
+			if (m_query) {
+				PdhCloseQuery(m_query);
+			}
+		}
+
+		bool Open() {
+			if (PdhOpenQueryW(nullptr, 0, &m_query) != ERROR_SUCCESS) {
+				return false;
+			}
+			if (PdhAddEnglishCounterW(m_query, L"\\GPU Engine(*engtype_3D)\\Utilization Percentage", 0, &m_graphicsCounter) != ERROR_SUCCESS) {
+				return false;
+			}
+			PdhAddEnglishCounterW(m_query, L"\\GPU Engine(*engtype_VideoEncode)\\Utilization Percentage", 0, &m_encoderCounter);
+			// Rates need two collections
+			return PdhCollectQueryData(m_query) == ERROR_SUCCESS;
+		}
+
+		bool Sample(GpuUtilization &utilization) override {
+			if (PdhCollectQueryData(m_query) != ERROR_SUCCESS) {
+				return false;
+			}
+			utilization.graphics = SumInstances(m_graphicsCounter);
+			utilization.encoder = SumInstances(m_encoderCounter);
+			return true;
+		}
+
+	private:
+		int SumInstances(PDH_HCOUNTER counter) {
+			if (!counter) {
+				return -1;
+			}
+			DWORD size = 0, count = 0;
+			if (PdhGetFormattedCounterArrayW(counter, PDH_FMT_DOUBLE, &size, &count, nullptr) != PDH_MORE_DATA) {
+				return -1;
+			}
+			m_items.resize(size / sizeof(PDH_FMT_COUNTERVALUE_ITEM_W) + 1);
+			if (PdhGetFormattedCounterArrayW(counter, PDH_FMT_DOUBLE, &size, &count, m_items.data()) != ERROR_SUCCESS) {
+				return -1;
+			}
+			double total = 0;
+			for (DWORD i = 0; i < count; i++) {
+				if (m_items[i].FmtValue.CStatus == PDH_CSTATUS_VALID_DATA) {
+					total += m_items[i].FmtValue.doubleValue;
+				}
+			}
+			return (int)std::min(total, 100.);
+		}
+
+		PDH_HQUERY m_query = nullptr;
+		PDH_HCOUNTER m_graphicsCounter = nullptr;
+		PDH_HCOUNTER m_encoderCounter = nullptr;
+		std::vector<PDH_FMT_COUNTERVALUE_ITEM_W> m_items;
+	};
+#endif
+
+	template <typename T>
+	std::unique_ptr<GpuMonitor::Source> TryOpen(const char *name) {
+		auto source = std::make_unique<T>();
+		if (!source->Open()) {
+			return nullptr;
+		}
+		Info("GpuMonitor: sampling the GPU utilization with %s.\n", name);
+		return source;
+	}
+
+	std::unique_ptr<GpuMonitor::Source> OpenSource() {
+		std::unique_ptr<GpuMonitor::Source> source = TryOpen<NvmlSource>("NVML");
+#ifdef __linux__
+		if (!source) {
+			source = TryOpen<AmdgpuSource>("amdgpu");
+		}
+		if (!source) {
+			source = TryOpen<I915Source>("i915");
+		}
+#endif
+#ifdef _WIN32
+		if (!source) {
+			source = TryOpen<PdhSource>("the GPU Engine counters");
+		}
+#endif
+		return source;
+	}
+}
+
+GpuMonitor::GpuMonitor()
+{
+	m_thread = std::thread(&GpuMonitor::SampleLoop, this);
+}
+
+GpuMonitor::~GpuMonitor()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_exiting = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+}
+
+GpuUtilization GpuMonitor::GetUtilization()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_utilization;
+}
+
+void GpuMonitor::SampleLoop()
+{
+	// Loading the driver libraries takes a while, it is kept off the thread creating the monitor
+	auto source = OpenSource();
+	if (!source) {
+		Info("GpuMonitor: no source of GPU utilization.\n");
+		return;
+	}
+
+	auto next = std::chrono::steady_clock::now();
+	while (true) {
+		GpuUtilization utilization;
+		bool sampled = source->Sample(utilization);
+		if (!sampled) {
+			Warn("GpuMonitor: the GPU utilization is no longer available.\n");
+			utilization = {};
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_utilization = utilization;
+		if (!sampled) {
+			break;
+		}
+		next += std::chrono::milliseconds(SAMPLE_INTERVAL_MS);
+		if (m_condition.wait_until(lock, next, [this] { return m_exiting; })) {
+			break;
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Load of the GPU engines, -1 for what the driver does not report
+struct GpuUtilization {
+	// Percentage of the time the 3D engine and the video encoder were busy
+	int graphics = -1;
+	int encoder = -1;
+	// Current clock of the 3D engine, in MHz
+	int graphicsClock = -1;
+	// PCIe throughput, in MB/s
+	int pcieTx = -1;
+	int pcieRx = -1;
+};
+
+// Samples the utilization of the GPU engines on a thread of its own, so that the driver queries
+// never stall the frame threads. NVML on NVIDIA, the amdgpu and i915 sysfs and PMU on Linux and
+// the GPU Engine performance counters on Windows for the other vendors. The first GPU each source
+// finds is the one sampled, which is the one encoding on single GPU systems.
+class GpuMonitor
+{
+public:
+	GpuMonitor();
+	~GpuMonitor();
+
+	GpuMonitor(const GpuMonitor&) = delete;
+	GpuMonitor& operator=(const GpuMonitor&) = delete;
+
+	// Over the last sampling period
+	GpuUtilization GetUtilization();
+
+	// One way to read the utilization, see GpuMonitor.cpp
+	class Source {
+	public:
+		virtual ~Source() = default;
+		// False once the source stops working
+		virtual bool Sample(GpuUtilization &utilization) = 0;
+	};
+
+private:
+	static const int SAMPLE_INTERVAL_MS = 500;
+
+	void SampleLoop();
+
+	GpuUtilization m_utilization;
+	std::mutex m_mutex;
+
+	std::thread m_thread;
+	std::condition_variable m_condition;
+	bool m_exiting = false;
+};
@@ -0,0 +1,371 @@
+#include "HandSkeleton.h"
+#include "ALVR-common/packet_types.h"
+
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SKELETON_SSE2
+#endif
+
+namespace {
+	const float PI = 3.14159265358979f;
+
+	// Below this sine of the angle between two orientations the slerp falls back to a lerp
+	const float MIN_SLERP_SINE = 1e-4f;
+
+	enum ThumbPose {
+		// Y or B
+		THUMB_UPPER_BUTTON_TOUCH,
+		// X or A
+		THUMB_LOWER_BUTTON_TOUCH,
+		THUMB_JOYSTICK_TOUCH,
+		THUMB_NO_TOUCH,
+		THUMB_POSE_COUNT
+	};
+
+	enum TriggerPose {
+		TRIGGER_CLICK,
+		TRIGGER_TOUCH,
+		TRIGGER_NO_TOUCH,
+		TRIGGER_POSE_COUNT
+	};
+
+	// Representative buttons of each pose, the left and right buttons can be set together because
+	// each hand only tests its own
+	const uint64_t THUMB_POSE_BUTTONS[THUMB_POSE_COUNT] = {
+		ALVR_BUTTON_FLAG(ALVR_INPUT_Y_TOUCH) | ALVR_BUTTON_FLAG(ALVR_INPUT_B_TOUCH),
+		ALVR_BUTTON_FLAG(ALVR_INPUT_X_TOUCH) | ALVR_BUTTON_FLAG(ALVR_INPUT_A_TOUCH),
+		ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_TOUCH),
+		0,
+	};
+	const uint64_t TRIGGER_POSE_BUTTONS[TRIGGER_POSE_COUNT] = {
+		ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK),
+		ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH),
+		0,
+	};
+
+	// Same precedence as GetThumbBoneTransform
+	int ThumbPoseIndex(bool isLeftHand, uint64_t buttons) {
+		uint64_t upper = isLeftHand ? ALVR_BUTTON_FLAG(ALVR_INPUT_Y_TOUCH) : ALVR_BUTTON_FLAG(ALVR_INPUT_B_TOUCH);
+		uint64_t lower = isLeftHand ? ALVR_BUTTON_FLAG(ALVR_INPUT_X_TOUCH) : ALVR_BUTTON_FLAG(ALVR_INPUT_A_TOUCH);
+		if ((buttons & upper) != 0) {
+			return THUMB_UPPER_BUTTON_TOUCH;
+		} else if ((buttons & lower) != 0) {
+			return THUMB_LOWER_BUTTON_TOUCH;
+		} else if ((buttons & ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_TOUCH)) != 0) {
+			return THUMB_JOYSTICK_TOUCH;
+		}
+		return THUMB_NO_TOUCH;
+	}
+
+	int TriggerPoseIndex(uint64_t buttons) {
+		if ((buttons & ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK)) != 0) {
+			return TRIGGER_CLICK;
+		} else if ((buttons & ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH)) != 0) {
+			return TRIGGER_TOUCH;
+		}
+		return TRIGGER_NO_TOUCH;
+	}
+
+	// Four bones in SSE2 registers, or in an array on other architectures
+	struct Lanes {
+#ifdef SKELETON_SSE2
+		__m128 v;
+
+		static Lanes Load(const float *p) { return { _mm_load_ps(p) }; }
+		static Lanes Splat(float x) { return { _mm_set1_ps(x) }; }
+		static Lanes Ramp(float first) { return { _mm_setr_ps(first, first + 1.f, first + 2.f, first + 3.f) }; }
+		void Store(float *p) const { _mm_store_ps(p, v); }
+
+		friend Lanes operator+(Lanes a, Lanes b) { return { _mm_add_ps(a.v, b.v) }; }
+		friend Lanes operator-(Lanes a, Lanes b) { return { _mm_sub_ps(a.v, b.v) }; }
+		friend Lanes operator*(Lanes a, Lanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+		friend Lanes operator/(Lanes a, Lanes b) { return { _mm_div_ps(a.v, b.v) }; }
+		friend Lanes Min(Lanes a, Lanes b) { return { _mm_min_ps(a.v, b.v) }; }
+		friend Lanes Max(Lanes a, Lanes b) { return { _mm_max_ps(a.v, b.v) }; }
+		friend Lanes Sqrt(Lanes a) { return { _mm_sqrt_ps(a.v) }; }
+		friend Lanes Abs(Lanes a) { return { _mm_andnot_ps(_mm_set1_ps(-0.f), a.v) }; }
+		// All bits set in the lanes where the comparison holds
+		friend Lanes Less(Lanes a, Lanes b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+		friend Lanes Select(Lanes mask, Lanes a, Lanes b) {
+			return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) };
+		}
+#else
+		float v[4];
+
+		template <typename F> static Lanes Map(F f) {
+			Lanes r;
+			for (int i = 0; i < 4; i++) {
+				r.v[i] = f(i);
+			}
+			return r;
+		}
+
+		static Lanes Load(const float *p) { return Map([&](int i) { return p[i]; }); }
+		static Lanes Splat(float x) { return Map([&](int) { return x; }); }
+		static Lanes Ramp(float first) { return Map([&](int i) { return first + i; }); }
+		void Store(float *p) const {
+			for (int i = 0; i < 4; i++) {
+				p[i] = v[i];
+			}
+		}
+
+		friend Lanes operator+(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] + b.v[i]; }); }
+		friend Lanes operator-(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] - b.v[i]; }); }
+		friend Lanes operator*(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] * b.v[i]; }); }
+		friend Lanes operator/(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] / b.v[i]; }); }
+		friend Lanes Min(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] < b.v[i] ? a.v[i] : b.v[i]; }); }
+		friend Lanes Max(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] > b.v[i] ? a.v[i] : b.v[i]; }); }
+		friend Lanes Sqrt(Lanes a) { return Map([&](int i) { return std::sqrt(a.v[i]); }); }
+		friend Lanes Abs(Lanes a) { return Map([&](int i) { return std::fabs(a.v[i]); }); }
+		// Non zero in the lanes where the comparison holds
+		friend Lanes Less(Lanes a, Lanes b) { return Map([&](int i) { return a.v[i] < b.v[i] ? 1.f : 0.f; }); }
+		friend Lanes Select(Lanes mask, Lanes a, Lanes b) {
+			return Map([&](int i) { return mask.v[i] != 0.f ? a.v[i] : b.v[i]; });
+		}
+#endif
+	};
+
+	// Polynomial approximations, the same operations for all lanes.
+	// Abramowitz and Stegun 4.4.46, error below 2e-8.
+	Lanes Acos(Lanes x) {
+		Lanes a = Abs(x);
+		Lanes p = Lanes::Splat(-0.0012624911f);
+		p = p * a + Lanes::Splat(0.0066700901f);
+		p = p * a - Lanes::Splat(0.0170881256f);
+		p = p * a + Lanes::Splat(0.0308918810f);
+		p = p * a - Lanes::Splat(0.0501743046f);
+		p = p * a + Lanes::Splat(0.0889789874f);
+		p = p * a - Lanes::Splat(0.2145988016f);
+		p = p * a + Lanes::Splat(1.5707963050f);
+		Lanes r = Sqrt(Lanes::Splat(1.f) - a) * p;
+		return Select(Less(x, Lanes::Splat(0.f)), Lanes::Splat(PI) - r, r);
+	}
+
+	// Taylor series folded to [0, pi/2], x in [0, pi], error below 1e-7
+	Lanes SinOfAngle(Lanes x) {
+		Lanes r = Min(x, Lanes::Splat(PI) - x);
+		Lanes r2 = r * r;
+		Lanes p = Lanes::Splat(-2.5052108e-8f);
+		p = p * r2 + Lanes::Splat(2.7557319e-6f);
+		p = p * r2 - Lanes::Splat(1.9841270e-4f);
+		p = p * r2 + Lanes::Splat(8.3333333e-3f);
+		p = p * r2 - Lanes::Splat(1.6666667e-1f);
+		return r + r * r2 * p;
+	}
+
+	// Lanes of [begin, end) in the group of four bones starting at `first`
+	Lanes RangeMask(int first, int begin, int end) {
+		Lanes index = Lanes::Ramp((float)first);
+		return Select(Less(index, Lanes::Splat((float)begin)), Lanes::Splat(0.f), Less(index, Lanes::Splat((float)end)));
+	}
+
+	// Angle between the orientations of the bones `first` to `first` + 3 and the inverse of its
+	// sine, 0 when they are too close to slerp. The dot product is clamped, for nearly equal
+	// orientations rounding can push it above 1.
+	void SlerpAngles(const SkeletonBones &from, const SkeletonBones &to, int first, Lanes &theta, Lanes &invSinTheta) {
+		Lanes dot = Lanes::Load(from.qw + first) * Lanes::Load(to.qw + first) +
+			Lanes::Load(from.qx + first) * Lanes::Load(to.qx + first) +
+			Lanes::Load(from.qy + first) * Lanes::Load(to.qy + first) +
+			Lanes::Load(from.qz + first) * Lanes::Load(to.qz + first);
+		theta = Acos(Max(Lanes::Splat(-1.f), Min(dot, Lanes::Splat(1.f))));
+		Lanes st = SinOfAngle(theta);
+		Lanes interpolate = Less(Lanes::Splat(MIN_SLERP_SINE), st);
+		invSinTheta = Select(interpolate, Lanes::Splat(1.f) / Select(interpolate, st, Lanes::Splat(1.f)), Lanes::Splat(0.f));
+	}
+
+	// Lerp of the positions and Shoemake's slerp of the orientations, like Lerp() and Slerp() in
+	// Utils.h, for the bones `first` to `first` + 3 that are in `inRange`
+	void BlendGroup(const SkeletonBones &from,
+		const SkeletonBones &to,
+		float lambda,
+		int first,
+		Lanes inRange,
+		Lanes theta,
+		Lanes invSinTheta,
+		SkeletonBones &out) {
+		Lanes t = Lanes::Splat(lambda);
+		Lanes inverse = Lanes::Splat(1.f - lambda);
+
+		auto store = [&](Lanes value, float *dest) {
+			Select(inRange, value, Lanes::Load(dest + first)).Store(dest + first);
+		};
+		auto lerp = [&](const float *a, const float *b, float *dest) {
+			store(inverse * Lanes::Load(a + first) + t * Lanes::Load(b + first), dest);
+		};
+		lerp(from.px, to.px, out.px);
+		lerp(from.py, to.py, out.py);
+		lerp(from.pz, to.pz, out.pz);
+
+		Lanes interpolate = Less(Lanes::Splat(0.f), invSinTheta);
+		Lanes coeff1 = Select(interpolate, SinOfAngle(inverse * theta) * invSinTheta, inverse);
+		Lanes coeff2 = Select(interpolate, SinOfAngle(t * theta) * invSinTheta, t);
+
+		Lanes w = coeff1 * Lanes::Load(from.qw + first) + coeff2 * Lanes::Load(to.qw + first);
+		Lanes x = coeff1 * Lanes::Load(from.qx + first) + coeff2 * Lanes::Load(to.qx + first);
+		Lanes y = coeff1 * Lanes::Load(from.qy + first) + coeff2 * Lanes::Load(to.qy + first);
+		Lanes z = coeff1 * Lanes::Load(from.qz + first) + coeff2 * Lanes::Load(to.qz + first);
+		Lanes invNorm = Lanes::Splat(1.f) / Sqrt(w * w + x * x + y * y + z * z);
+		store(w * invNorm, out.qw);
+		store(x * invNorm, out.qx);
+		store(y * invNorm, out.qy);
+		store(z * invNorm, out.qz);
+	}
+
+	void CopyBones(const SkeletonBones &from, int begin, int end, SkeletonBones &out) {
+		for (int i = begin; i < end; i++) {
+			out.px[i] = from.px[i];
+			out.py[i] = from.py[i];
+			out.pz[i] = from.pz[i];
+			out.qw[i] = from.qw[i];
+			out.qx[i] = from.qx[i];
+			out.qy[i] = from.qy[i];
+			out.qz[i] = from.qz[i];
+		}
+	}
+
+	// `out` can be one of the inputs. The lanes outside of [begin, end) keep their value.
+	void BlendBones(const SkeletonBones &from, const SkeletonBones &to, float lambda, int begin, int end, SkeletonBones &out) {
+		if (lambda <= 0.f) {
+			CopyBones(from, begin, end, out);
+			return;
+		} else if (lambda >= 1.f) {
+			CopyBones(to, begin, end, out);
+			return;
+		}
+		for (int first = begin & ~3; first < end; first += 4) {
+			Lanes theta, invSinTheta;
+			SlerpAngles(from, to, first, theta, invSinTheta);
+			BlendGroup(from, to, lambda, first, RangeMask(first, begin, end), theta, invSinTheta, out);
+		}
+	}
+
+	// A blend between two static poses, with the angles precomputed
+	struct PoseBlend {
+		const SkeletonBones *from;
+		const SkeletonBones *to;
+		alignas(16) float theta[SkeletonBones::LANES];
+		alignas(16) float invSinTheta[SkeletonBones::LANES];
+
+		void Init(const SkeletonBones &from, const SkeletonBones &to) {
+			this->from = &from;
+			this->to = &to;
+			for (int first = 0; first < SkeletonBones::LANES; first += 4) {
+				Lanes groupTheta, groupInvSinTheta;
+				SlerpAngles(from, to, first, groupTheta, groupInvSinTheta);
+				groupTheta.Store(theta + first);
+				groupInvSinTheta.Store(invSinTheta + first);
+			}
+		}
+
+		void Blend(float lambda, int begin, int end, SkeletonBones &out) const {
+			if (lambda <= 0.f) {
+				CopyBones(*from, begin, end, out);
+				return;
+			} else if (lambda >= 1.f) {
+				CopyBones(*to, begin, end, out);
+				return;
+			}
+			for (int first = begin & ~3; first < end; first += 4) {
+				BlendGroup(*from,
+					*to,
+					lambda,
+					first,
+					RangeMask(first, begin, end),
+					Lanes::Load(theta + first),
+					Lanes::Load(invSinTheta + first),
+					out);
+			}
+		}
+	};
+
+	// Indexed by [withController][isLeftHand]
+	struct PoseTables {
+		SkeletonBones thumb[2][2][THUMB_POSE_COUNT];
+		SkeletonBones trigger[2][2][TRIGGER_POSE_COUNT];
+		SkeletonBones gripClick[2][2];
+		// Indexed by [withController][isLeftHand][from][to]
+		PoseBlend thumbBlends[2][2][THUMB_POSE_COUNT][THUMB_POSE_COUNT];
+		PoseBlend triggerBlends[2][2][TRIGGER_POSE_COUNT][TRIGGER_POSE_COUNT];
+
+		PoseTables() {
+			for (int withController = 0; withController < 2; withController++) {
+				for (int isLeftHand = 0; isLeftHand < 2; isLeftHand++) {
+					for (int pose = 0; pose < THUMB_POSE_COUNT; pose++) {
+						vr::VRBoneTransform_t bones[SkeletonBones::COUNT] = {};
+						GetThumbBoneTransform(withController, isLeftHand, THUMB_POSE_BUTTONS[pose], bones);
+						thumb[withController][isLeftHand][pose].Load(bones, 0, SkeletonBones::COUNT);
+					}
+					for (int pose = 0; pose < TRIGGER_POSE_COUNT; pose++) {
+						vr::VRBoneTransform_t bones[SkeletonBones::COUNT] = {};
+						GetTriggerBoneTransform(withController, isLeftHand, TRIGGER_POSE_BUTTONS[pose], bones);
+						trigger[withController][isLeftHand][pose].Load(bones, 0, SkeletonBones::COUNT);
+					}
+					vr::VRBoneTransform_t bones[SkeletonBones::COUNT] = {};
+					GetGripClickBoneTransform(withController, isLeftHand, bones);
+					gripClick[withController][isLeftHand].Load(bones, 0, SkeletonBones::COUNT);
+
+					for (int from = 0; from < THUMB_POSE_COUNT; from++) {
+						for (int to = 0; to < THUMB_POSE_COUNT; to++) {
+							thumbBlends[withController][isLeftHand][from][to].Init(
+								thumb[withController][isLeftHand][from], thumb[withController][isLeftHand][to]);
+						}
+					}
+					for (int from = 0; from < TRIGGER_POSE_COUNT; from++) {
+						for (int to = 0; to < TRIGGER_POSE_COUNT; to++) {
+							triggerBlends[withController][isLeftHand][from][to].Init(
+								trigger[withController][isLeftHand][from], trigger[withController][isLeftHand][to]);
+						}
+					}
+				}
+			}
+		}
+	};
+
+	const PoseTables &GetPoseTables() {
+		static const PoseTables tables;
+		return tables;
+	}
+}
+
+void SkeletonBones::Load(const vr::VRBoneTransform_t bones[], int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		px[i] = bones[i].position.v[0];
+		py[i] = bones[i].position.v[1];
+		pz[i] = bones[i].position.v[2];
+		qw[i] = bones[i].orientation.w;
+		qx[i] = bones[i].orientation.x;
+		qy[i] = bones[i].orientation.y;
+		qz[i] = bones[i].orientation.z;
+	}
+	for (int i = COUNT; i < LANES; i++) {
+		px[i] = py[i] = pz[i] = 0.f;
+		qw[i] = 1.f;
+		qx[i] = qy[i] = qz[i] = 0.f;
+	}
+}
+
+void SkeletonBones::Store(vr::VRBoneTransform_t outBones[], int begin, int end) const {
+	for (int i = begin; i < end; i++) {
+		outBones[i].position = { { px[i], py[i], pz[i], 1.f } };
+		outBones[i].orientation = { qw[i], qx[i], qy[i], qz[i] };
+	}
+}
+
+void BlendThumbPoses(bool withController, bool isLeftHand, uint64_t fromButtons, uint64_t toButtons, float lambda, SkeletonBones &out) {
+	GetPoseTables()
+		.thumbBlends[withController][isLeftHand][ThumbPoseIndex(isLeftHand, fromButtons)][ThumbPoseIndex(isLeftHand, toButtons)]
+		.Blend(lambda, 2, 6, out);
+}
+
+void BlendTriggerPoses(bool withController, bool isLeftHand, uint64_t fromButtons, uint64_t toButtons, float lambda, SkeletonBones &out) {
+	GetPoseTables()
+		.triggerBlends[withController][isLeftHand][TriggerPoseIndex(fromButtons)][TriggerPoseIndex(toButtons)]
+		.Blend(lambda, 6, SkeletonBones::COUNT, out);
+}
+
+void BlendGripClickPose(bool withController, bool isLeftHand, float lambda, SkeletonBones &bones) {
+	const SkeletonBones &gripClick = GetPoseTables().gripClick[withController][isLeftHand];
+	BlendBones(bones, gripClick, lambda, 11, 26, bones);
+	BlendBones(bones, gripClick, lambda, 28, SkeletonBones::COUNT, bones);
+}
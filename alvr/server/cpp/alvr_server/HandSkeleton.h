@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+#include "openvr_driver.h"
+
+// Static poses of the emulated hand skeleton, defined in OvrController.cpp. Each one only writes
+// the bones of its finger group: 2 to 5 for the thumb, 6 to 30 for the trigger and 11 to 25 and 28
+// to 30 for the grip.
+void GetThumbBoneTransform(bool withController, bool isLeftHand, uint64_t buttons, vr::VRBoneTransform_t outBoneTransform[]);
+void GetTriggerBoneTransform(bool withController, bool isLeftHand, uint64_t buttons, vr::VRBoneTransform_t outBoneTransform[]);
+void GetGripClickBoneTransform(bool withController, bool isLeftHand, vr::VRBoneTransform_t outBoneTransform[]);
+
+// The 31 bones of the OpenVR hand skeleton in structure of arrays layout, one lane per bone, so that
+// four bones are blended at once with SSE2
+struct alignas(32) SkeletonBones {
+	static const int COUNT = 31;
+	// Padded to a whole number of vectors
+	static const int LANES = 32;
+
+	float px[LANES], py[LANES], pz[LANES];
+	float qw[LANES], qx[LANES], qy[LANES], qz[LANES];
+
+	void Load(const vr::VRBoneTransform_t bones[], int begin, int end);
+	void Store(vr::VRBoneTransform_t outBones[], int begin, int end) const;
+};
+
+// Blends of the static poses, converted once, over the bones of their finger group. `fromButtons`
+// and `toButtons` select the poses like for the Get*BoneTransform functions above. Lerp of the
+// positions and slerp of the orientations, like Lerp() and Slerp() in Utils.h.
+void BlendThumbPoses(bool withController, bool isLeftHand, uint64_t fromButtons, uint64_t toButtons, float lambda, SkeletonBones &out);
+void BlendTriggerPoses(bool withController, bool isLeftHand, uint64_t fromButtons, uint64_t toButtons, float lambda, SkeletonBones &out);
+// Blends the grip bones of `bones` toward the grip click pose
+void BlendGripClickPose(bool withController, bool isLeftHand, float lambda, SkeletonBones &bones);
@@ -1,6 +1,7 @@
 #include "IDRScheduler.h"
 
 #include "Utils.h"
+#include <algorithm>
 #include <mutex>
 
 IDRScheduler::IDRScheduler()
@@ -16,6 +17,19 @@ void IDRScheduler::OnPacketLoss()
 {
 	std::unique_lock lock(m_mutex);
 
+	auto &settings = Settings::Instance();
+	if (settings.IsLoaded() && settings.m_intraRefreshFrames > 0) {
+		if (m_refreshScheduled) {
+			// Waiting next wave.
+			return;
+		}
+		// A wave is not restarted before the previous one is complete
+		uint64_t waveDuration = (uint64_t)settings.m_intraRefreshFrames * 1000 * 1000 / settings.m_refreshRate;
+		m_refreshTime = std::max(GetTimestampUs(), m_refreshTime + waveDuration);
+		m_refreshScheduled = true;
+		return;
+	}
+
 	if (m_scheduled) {
 		// Waiting next insertion.
 		return;
@@ -32,6 +46,23 @@ void IDRScheduler::OnPacketLoss()
 	}
 }
 
+void IDRScheduler::OnFrameLoss(uint64_t lastGoodTimestampNs)
+{
+	auto &settings = Settings::Instance();
+	if (!settings.IsLoaded() || !settings.m_referenceFrameInvalidation) {
+		OnPacketLoss();
+		return;
+	}
+
+	std::unique_lock lock(m_mutex);
+
+	// Reports of the same loss can arrive before the invalidation, the oldest good frame covers them all
+	if (!m_invalidationScheduled || lastGoodTimestampNs < m_lastGoodTimestampNs) {
+		m_lastGoodTimestampNs = lastGoodTimestampNs;
+	}
+	m_invalidationScheduled = true;
+}
+
 void IDRScheduler::OnStreamStart()
 {
 	if (Settings::Instance().IsLoaded() && Settings::Instance().m_aggressiveKeyframeResend) {
@@ -48,6 +79,35 @@ void IDRScheduler::InsertIDR()
 
 	m_insertIDRTime = GetTimestampUs() - MIN_IDR_FRAME_INTERVAL * 2;
 	m_scheduled = true;
+	// Nothing before the IDR frame is referenced anyway
+	m_invalidationScheduled = false;
+}
+
+bool IDRScheduler::CheckRefreshInsertion() {
+	std::unique_lock lock(m_mutex);
+
+	if (m_refreshScheduled && m_refreshTime <= GetTimestampUs()) {
+		m_refreshScheduled = false;
+		return true;
+	}
+	return false;
+}
+
+bool IDRScheduler::CheckInvalidation(uint64_t *lastGoodTimestampNs) {
+	std::unique_lock lock(m_mutex);
+
+	if (m_invalidationScheduled) {
+		m_invalidationScheduled = false;
+		*lastGoodTimestampNs = m_lastGoodTimestampNs;
+		return true;
+	}
+	return false;
+}
+
+bool IDRScheduler::IsRecoveryPending() {
+	std::unique_lock lock(m_mutex);
+
+	return m_scheduled || m_refreshScheduled || m_invalidationScheduled;
 }
 
 bool IDRScheduler::CheckIDRInsertion() {
@@ -10,12 +10,26 @@ public:
 	IDRScheduler();
 	~IDRScheduler();
 
+	// Schedules an IDR frame, or an intra refresh wave if video.intraRefreshFrames is set
 	void OnPacketLoss();
+	// The client lost the frames after the one of target timestamp lastGoodTimestampNs. Schedules
+	// the invalidation of the lost references if video.referenceFrameInvalidation is set, the same
+	// as OnPacketLoss() otherwise.
+	void OnFrameLoss(uint64_t lastGoodTimestampNs);
 
 	void OnStreamStart();
 	void InsertIDR();
 
 	bool CheckIDRInsertion();
+	// True when the next frame must start an intra refresh wave. Encoders that cannot refresh
+	// must encode it as an IDR frame instead.
+	bool CheckRefreshInsertion();
+	// True when the references after *lastGoodTimestampNs must be invalidated before the next
+	// frame. Encoders that cannot invalidate them must call OnPacketLoss() instead.
+	bool CheckInvalidation(uint64_t *lastGoodTimestampNs);
+	// True while a keyframe, refresh wave or invalidation waits for a frame to be encoded. Frames
+	// that would otherwise be skipped must then be encoded.
+	bool IsRecoveryPending();
 private:
 	static const int MIN_IDR_FRAME_INTERVAL = 100 * 1000; // 100-milliseconds
 	static const int MIN_IDR_FRAME_INTERVAL_AGGRESSIVE = 5 * 1000; // 5-milliseconds (less than screen refresh interval)
@@ -23,4 +37,10 @@ private:
 	bool m_scheduled = false;
 	std::mutex m_mutex;
 	uint64_t m_minIDRFrameInterval = MIN_IDR_FRAME_INTERVAL;
+
+	uint64_t m_refreshTime = 0;
+	bool m_refreshScheduled = false;
+
+	uint64_t m_lastGoodTimestampNs = 0;
+	bool m_invalidationScheduled = false;
 };
@@ -0,0 +1,89 @@
+#include "IdleController.h"
+
+#include <algorithm>
+
+#include "Logger.h"
+#include "Settings.h"
+#include "Utils.h"
+
+IdleController::IdleController()
+{
+	Reset();
+}
+
+void IdleController::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_lastTracking = 0;
+	m_unmountedSince = 0;
+	m_paused = false;
+}
+
+void IdleController::OnTracking(bool mounted)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint64_t now = GetCounterUs();
+	bool wasIdle = IsIdle(now);
+	m_lastTracking = now;
+	if (mounted) {
+		m_unmountedSince = 0;
+	} else if (m_unmountedSince == 0) {
+		m_unmountedSince = now;
+	}
+	if (wasIdle && !IsIdle(now) && m_resumeCallback) {
+		m_resumeCallback();
+	}
+}
+
+uint32_t IdleController::GetVSyncDivider()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (!IsIdle(GetCounterUs())) {
+		return 1;
+	}
+	return (uint32_t)std::max(Settings::Instance().m_refreshRate / (int)IDLE_REFRESH_RATE, 1);
+}
+
+IdleController::Decision IdleController::CheckFrame()
+{
+	bool idle;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		idle = IsIdle(GetCounterUs());
+	}
+
+	if (idle) {
+		if (m_paused) {
+			return SKIP;
+		}
+		// This frame is the last one until the headset is worn again
+		Info("IdleController: headset idle, pausing the encoder\n");
+		m_paused = true;
+		return ENCODE;
+	}
+	if (m_paused) {
+		Info("IdleController: headset worn again, resuming the encoder\n");
+		m_paused = false;
+		return RESUME;
+	}
+	return ENCODE;
+}
+
+void IdleController::SetResumeCallback(std::function<void()> callback)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_resumeCallback = callback;
+}
+
+bool IdleController::IsIdle(uint64_t now)
+{
+	if (!Settings::Instance().m_idlePowerSave || m_lastTracking == 0) {
+		return false;
+	}
+	return now - m_lastTracking > TRACKING_TIMEOUT_US ||
+		(m_unmountedSince != 0 && now - m_unmountedSince > UNMOUNT_DELAY_US);
+}
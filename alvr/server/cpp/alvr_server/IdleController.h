@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+
+// Idles the stream while nobody looks at it: the headset has been off the head for a while, or the
+// client stopped sending tracking, which it does in the background. SteamVR then only gets a vsync
+// every few frames and the encoder stops after one last frame, so that the client keeps a current
+// picture. The first tracking sample of a worn headset ends the idle state: the next vsync is at
+// the full rate again and the next frame is an IDR frame, the client may have lost its references.
+class IdleController
+{
+public:
+	IdleController();
+
+	void Reset();
+
+	// Fed with every tracking sample of the client
+	void OnTracking(bool mounted);
+
+	// Vsync periods per vsync given to SteamVR, 1 unless idle. Read by the vsync generator of the
+	// platform before every vsync.
+	uint32_t GetVSyncDivider();
+
+	enum Decision {
+		ENCODE,
+		// First frame after an idle period, the encoder must insert an IDR frame
+		RESUME,
+		SKIP,
+	};
+	// For every frame about to be encoded. Called by the encoder thread only.
+	Decision CheckFrame();
+
+	// Called by OnTracking() when the idle state ends, for the platforms whose vsync only reads
+	// GetVSyncDivider() with the frames. nullptr to remove it, the callback is not running anymore
+	// once this returns.
+	void SetResumeCallback(std::function<void()> callback);
+
+private:
+	bool IsIdle(uint64_t now);
+
+	// The proximity sensor flickers while the headset is put on or taken off
+	static const uint64_t UNMOUNT_DELAY_US = 3 * 1000 * 1000;
+	// Longer than the tracking stalls of a bad network
+	static const uint64_t TRACKING_TIMEOUT_US = 2 * 1000 * 1000;
+	static const uint32_t IDLE_REFRESH_RATE = 5;
+
+	// Tracking arrives on the tracking thread, the vsync and the encoder have their own threads.
+	std::mutex m_mutex;
+	// Counter times in us, 0 before the first sample
+	uint64_t m_lastTracking;
+	// 0 while mounted
+	uint64_t m_unmountedSince;
+	std::function<void()> m_resumeCallback;
+
+	// Encoder thread
+	bool m_paused;
+};
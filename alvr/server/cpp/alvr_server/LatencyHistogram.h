@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Fixed-bucket latency histogram with a bounded relative error, in the spirit of HdrHistogram.
+// Values below 64us get a bucket each, above that every power of two is split in 32 buckets, so a
+// percentile is off by at most 1/32 of its value. Values are clamped to about two seconds.
+class LatencyHistogram {
+public:
+	LatencyHistogram() {
+		Reset();
+	}
+
+	void Reset() {
+		memset(m_counts, 0, sizeof(m_counts));
+		m_total = 0;
+	}
+
+	void Add(uint64_t valueUs) {
+		m_counts[BucketIndex(valueUs)]++;
+		m_total++;
+	}
+
+	uint64_t GetCount() const {
+		return m_total;
+	}
+
+	// Upper bound of the bucket holding the given percentile (0-100), 0 if empty.
+	uint64_t GetPercentile(double percentile) const {
+		if (m_total == 0) {
+			return 0;
+		}
+		uint64_t rank = (uint64_t)(percentile / 100. * m_total + 0.5);
+		if (rank == 0) {
+			rank = 1;
+		}
+		uint64_t cumulative = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++) {
+			cumulative += m_counts[i];
+			if (cumulative >= rank) {
+				return BucketUpperBound(i);
+			}
+		}
+		return BucketUpperBound(BUCKET_COUNT - 1);
+	}
+
+private:
+	static const int SUB_BUCKET_BITS = 5;
+	static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	// Highest tracked power of two, values go up to 2^21us
+	static const int MAX_EXPONENT = 20;
+	static const int BUCKET_COUNT = 2 * SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS) * SUB_BUCKETS;
+	static const uint64_t MAX_VALUE = (2ULL << MAX_EXPONENT) - 1;
+
+	static int BucketIndex(uint64_t value) {
+		if (value > MAX_VALUE) {
+			value = MAX_VALUE;
+		}
+		if (value < 2 * SUB_BUCKETS) {
+			return (int)value;
+		}
+		int shift = 0;
+		while ((value >> shift) >= 2 * SUB_BUCKETS) {
+			shift++;
+		}
+		// value >> shift is in [SUB_BUCKETS, 2 * SUB_BUCKETS)
+		return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + (int)((value >> shift) - SUB_BUCKETS);
+	}
+
+	static uint64_t BucketUpperBound(int index) {
+		if (index < 2 * SUB_BUCKETS) {
+			return index;
+		}
+		int shift = (index - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+		uint64_t subBucket = (index - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+		return ((subBucket + 1) << shift) - 1;
+	}
+
+	uint64_t m_counts[BUCKET_COUNT];
+	uint64_t m_total;
+};
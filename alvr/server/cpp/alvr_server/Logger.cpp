@@ -1,26 +1,226 @@
 #include "Logger.h"
 
+#include <atomic>
+#include <chrono>
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
 
 #include "driverlog.h"
 #include "bindings.h"
 
-void _log(const char *format, va_list args, void (*logFn)(const char *), bool driverLog = false)
-{
-	char buf[1024];
-	int count = vsnprintf(buf, sizeof(buf), format, args);
-	if (count > (int)sizeof(buf))
-		count = (int)sizeof(buf);
-	if (count > 0 && buf[count - 1] == '\n')
-		buf[count - 1] = '\0';
+namespace {
+	enum Level {
+		LEVEL_ERROR,
+		LEVEL_WARN,
+		LEVEL_INFO,
+		LEVEL_DEBUG,
+	};
+
+	uint64_t CurrentSecond() {
+		return std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Limits every call site, told apart by its format string, to a few lines per second. Lines
+	// logged every frame would otherwise flood the log and the dashboard.
+	class RateLimiter {
+	public:
+		// Returns false if the line must be dropped. Otherwise suppressed is set to the number of
+		// lines dropped at this call site since the last one that went through.
+		bool Allow(const char *format, uint32_t &suppressed) {
+			Site *site = FindSite(format);
+			suppressed = 0;
+			if (site == nullptr) {
+				return true;
+			}
+
+			uint64_t second = CurrentSecond();
+			uint64_t window = site->window.load(std::memory_order_relaxed);
+			if (window != second && site->window.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+				site->count.store(0, std::memory_order_relaxed);
+			}
+			if (site->count.fetch_add(1, std::memory_order_relaxed) >= MAX_LINES_PER_SECOND) {
+				site->suppressed.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+			return true;
+		}
+
+	private:
+		struct Site {
+			std::atomic<const char *> format{ nullptr };
+			std::atomic<uint64_t> window{ 0 };
+			std::atomic<uint32_t> count{ 0 };
+			std::atomic<uint32_t> suppressed{ 0 };
+		};
+
+		// Null if the table is too crowded, such lines are not limited.
+		Site *FindSite(const char *format) {
+			size_t hash = (reinterpret_cast<uintptr_t>(format) >> 3) * 0x9E3779B97F4A7C15ull;
+			for (int i = 0; i < MAX_PROBES; i++) {
+				Site &site = m_sites[(hash + i) % SITE_COUNT];
+				const char *current = site.format.load(std::memory_order_acquire);
+				if (current == nullptr && site.format.compare_exchange_strong(current, format, std::memory_order_acq_rel)) {
+					return &site;
+				}
+				if (current == format) {
+					return &site;
+				}
+			}
+			return nullptr;
+		}
+
+		static constexpr int SITE_COUNT = 512;
+		static constexpr int MAX_PROBES = 8;
+		static constexpr uint32_t MAX_LINES_PER_SECOND = 20;
+
+		Site m_sites[SITE_COUNT];
+	};
+
+	// Lines are formatted on the calling thread into a slot of a bounded multi-producer queue and
+	// handed to the Rust logger and the SteamVR log by a drain thread, so logging never waits for
+	// either of them.
+	class LogQueue {
+	public:
+		LogQueue() {
+			for (size_t i = 0; i < QUEUE_SIZE; i++) {
+				m_slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			std::thread(&LogQueue::DrainLoop, this).detach();
+		}
+
+		void Log(Level level, bool driverLog, const char *format, va_list args) {
+			uint32_t suppressed;
+			if (!m_rateLimiter.Allow(format, suppressed)) {
+				return;
+			}
+
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+			Slot *slot;
+			while (true) {
+				slot = &m_slots[pos % QUEUE_SIZE];
+				size_t sequence = slot->sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+				if (diff == 0) {
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (diff < 0) {
+					// Full, the drain thread reports the lost lines.
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				} else {
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			slot->level = level;
+			slot->driverLog = driverLog;
+			Format(slot->text, format, args, suppressed);
+			slot->sequence.store(pos + 1, std::memory_order_release);
+
+			if (level == LEVEL_ERROR) {
+				// Errors often come right before the driver goes down, wait until they are out.
+				auto deadline = std::chrono::steady_clock::now() + FLUSH_TIMEOUT;
+				while (m_deliveredPos.load(std::memory_order_acquire) <= pos
+					&& std::chrono::steady_clock::now() < deadline) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			}
+		}
 
-	logFn(buf);
+	private:
+		static constexpr size_t QUEUE_SIZE = 256;
+		static constexpr size_t LINE_SIZE = 1024;
+		static constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(5);
+		static constexpr auto FLUSH_TIMEOUT = std::chrono::milliseconds(100);
 
-	//TODO: driver logger should concider current log level
+		struct Slot {
+			std::atomic<size_t> sequence;
+			Level level;
+			bool driverLog;
+			char text[LINE_SIZE];
+		};
+
+		static void Format(char *buf, const char *format, va_list args, uint32_t suppressed) {
+			int count = vsnprintf(buf, LINE_SIZE, format, args);
+			if (count < 0) {
+				buf[0] = '\0';
+				count = 0;
+			}
+			if (count >= (int)LINE_SIZE) {
+				count = (int)LINE_SIZE - 1;
+			}
+			if (count > 0 && buf[count - 1] == '\n') {
+				buf[--count] = '\0';
+			}
+			if (suppressed > 0) {
+				snprintf(buf + count, LINE_SIZE - count, " (%u similar lines suppressed)", suppressed);
+			}
+		}
+
+		static void Deliver(Level level, bool driverLog, const char *text) {
+			switch (level) {
+			case LEVEL_ERROR:
+				LogError(text);
+				break;
+			case LEVEL_WARN:
+				LogWarn(text);
+				break;
+			case LEVEL_INFO:
+				LogInfo(text);
+				break;
+			case LEVEL_DEBUG:
+				LogDebug(text);
+				break;
+			}
+
+			//TODO: driver logger should concider current log level
 #ifndef ALVR_DEBUG_LOG
-	if (driverLog)
+			if (driverLog)
 #endif
-		DriverLogVarArgs(format, args);
+				DriverLog("%s\n", text);
+		}
+
+		void DrainLoop() {
+			size_t pos = 0;
+			while (true) {
+				Slot &slot = m_slots[pos % QUEUE_SIZE];
+				if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+					uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+					if (dropped > 0) {
+						char text[64];
+						snprintf(text, sizeof(text), "%llu log lines dropped, the log queue was full", (unsigned long long)dropped);
+						Deliver(LEVEL_WARN, false, text);
+					}
+					std::this_thread::sleep_for(DRAIN_INTERVAL);
+					continue;
+				}
+
+				Deliver(slot.level, slot.driverLog, slot.text);
+
+				slot.sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+				pos++;
+				m_deliveredPos.store(pos, std::memory_order_release);
+			}
+		}
+
+		Slot m_slots[QUEUE_SIZE];
+		std::atomic<size_t> m_enqueuePos{ 0 };
+		std::atomic<size_t> m_deliveredPos{ 0 };
+		std::atomic<uint64_t> m_dropped{ 0 };
+		RateLimiter m_rateLimiter;
+	};
+
+	// Never destroyed: the drain thread runs until the process exits, joining it while the driver
+	// is unloaded would deadlock.
+	LogQueue &Queue() {
+		static LogQueue *queue = new LogQueue();
+		return *queue;
+	}
 }
 
 Exception MakeException(const char *format, ...)
@@ -37,7 +237,7 @@ void Error(const char *format, ...)
 {
 	va_list args;
 	va_start(args, format);
-	_log(format, args, LogError, true);
+	Queue().Log(LEVEL_ERROR, true, format, args);
 	va_end(args);
 }
 
@@ -45,7 +245,7 @@ void Warn(const char *format, ...)
 {
 	va_list args;
 	va_start(args, format);
-	_log(format, args, LogWarn, true);
+	Queue().Log(LEVEL_WARN, true, format, args);
 	va_end(args);
 }
 
@@ -54,19 +254,16 @@ void Info(const char *format, ...)
 	va_list args;
 	va_start(args, format);
 	// Don't log to SteamVR/writing to file for info level, this is mostly statistics info
-	_log(format, args, LogInfo);
+	Queue().Log(LEVEL_INFO, false, format, args);
 	va_end(args);
 }
 
+#ifdef ALVR_DEBUG_LOG
 void Debug(const char *format, ...)
 {
-// Use our define instead of _DEBUG - see build.rs for details.
-#ifdef ALVR_DEBUG_LOG
 	va_list args;
 	va_start(args, format);
-	_log(format, args, LogDebug);
+	Queue().Log(LEVEL_DEBUG, false, format, args);
 	va_end(args);
-#else
-	(void)format;
-#endif
 }
+#endif
@@ -7,4 +7,10 @@ Exception MakeException(const char *format, ...);
 void Error(const char *format, ...);
 void Warn(const char *format, ...);
 void Info(const char *format, ...);
+// Use our define instead of _DEBUG - see build.rs for details. Without it Debug lines are
+// compiled out and their arguments are not evaluated.
+#ifdef ALVR_DEBUG_LOG
 void Debug(const char *format, ...);
+#else
+#define Debug(...) ((void)0)
+#endif
@@ -0,0 +1,119 @@
+#include "MotionHint.h"
+
+#include <atomic>
+#include <cmath>
+
+#include "Settings.h"
+
+namespace {
+	const double DEG_TO_RAD = 3.14159265358979323846 / 180.;
+	// Directions this close to the side of the head are not projected
+	const double MIN_FORWARD = 0.1;
+	// Distance of the content the inter-eye vectors are computed for, in m
+	const double INTER_EYE_DISTANCE = 2.;
+
+	std::atomic<float> g_ipd{ 0.063f };
+
+	vr::HmdQuaternion_t Multiply(const vr::HmdQuaternion_t &a, const vr::HmdQuaternion_t &b) {
+		return {
+			a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+			a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+			a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+			a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+		};
+	}
+
+	vr::HmdQuaternion_t Conjugate(const vr::HmdQuaternion_t &q) {
+		return { q.w, -q.x, -q.y, -q.z };
+	}
+
+	bool IsKnown(const vr::HmdQuaternion_t &q) {
+		return q.w != 0. || q.x != 0. || q.y != 0. || q.z != 0.;
+	}
+}
+
+bool EstimateGlobalMotion(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current,
+	int eye, float contentScale, GlobalMotion *motion)
+{
+	if (!IsKnown(reference) || !IsKnown(current)) {
+		return false;
+	}
+
+	auto &settings = Settings::Instance();
+	const EyeFov &fov = settings.m_eyeFov[eye];
+	double tanLeft = tan(fov.left * DEG_TO_RAD);
+	double tanRight = tan(fov.right * DEG_TO_RAD);
+	double tanTop = tan(fov.top * DEG_TO_RAD);
+	double tanBottom = tan(fov.bottom * DEG_TO_RAD);
+	double eyeWidth = settings.m_renderWidth / 2 * contentScale;
+	double eyeHeight = settings.m_renderHeight * contentScale;
+
+	// Center of the view in the head space of the current frame, -Z forward, +Y up
+	double centerX = (tanRight - tanLeft) / 2.;
+	double centerY = (tanTop - tanBottom) / 2.;
+	vr::HmdQuaternion_t direction = { 0., centerX, centerY, -1. };
+
+	// The same direction in the head space of the reference frame
+	vr::HmdQuaternion_t rotation = Multiply(Conjugate(reference), current);
+	direction = Multiply(Multiply(rotation, direction), Conjugate(rotation));
+	if (-direction.z < MIN_FORWARD) {
+		return false;
+	}
+
+	double x = direction.x / -direction.z;
+	double y = direction.y / -direction.z;
+	// Pixel rows go down
+	motion->x = (int)lround((x - centerX) / (tanLeft + tanRight) * eyeWidth);
+	motion->y = (int)lround((centerY - y) / (tanTop + tanBottom) * eyeHeight);
+	return motion->x != 0 || motion->y != 0;
+}
+
+void SetStereoIpd(float ipdM)
+{
+	g_ipd = ipdM;
+}
+
+bool EstimateInterEyeMotion(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current,
+	int eye, int eyeWidth, float contentScale, GlobalMotion *motion)
+{
+	auto &settings = Settings::Instance();
+	int other = 1 - eye;
+	const EyeFov &fov = settings.m_eyeFov[eye];
+	const EyeFov &otherFov = settings.m_eyeFov[other];
+	double tanLeft = tan(fov.left * DEG_TO_RAD);
+	double tanRight = tan(fov.right * DEG_TO_RAD);
+	double tanTop = tan(fov.top * DEG_TO_RAD);
+	double tanBottom = tan(fov.bottom * DEG_TO_RAD);
+	double otherTanLeft = tan(otherFov.left * DEG_TO_RAD);
+	double otherTanRight = tan(otherFov.right * DEG_TO_RAD);
+	double otherTanTop = tan(otherFov.top * DEG_TO_RAD);
+	double otherTanBottom = tan(otherFov.bottom * DEG_TO_RAD);
+	double viewWidth = settings.m_renderWidth / 2 * contentScale;
+	double viewHeight = settings.m_renderHeight * contentScale;
+
+	double centerX = (tanRight - tanLeft) / 2.;
+	double centerY = (tanTop - tanBottom) / 2.;
+	vr::HmdQuaternion_t direction = { 0., centerX, centerY, -1. };
+	if (IsKnown(reference) && IsKnown(current)) {
+		vr::HmdQuaternion_t rotation = Multiply(Conjugate(reference), current);
+		direction = Multiply(Multiply(rotation, direction), Conjugate(rotation));
+	}
+	if (-direction.z < MIN_FORWARD) {
+		return false;
+	}
+
+	// The right eye is ipd to the right of the left one, the content is seen that much more to the
+	// left from it
+	double x = direction.x / -direction.z + (eye == 0 ? -1. : 1.) * g_ipd / INTER_EYE_DISTANCE;
+	double y = direction.y / -direction.z;
+
+	// Columns and rows in the views, the centers keep their resolution in the foveated frame
+	double column = (centerX + tanLeft) / (tanLeft + tanRight) * viewWidth;
+	double row = (tanTop - centerY) / (tanTop + tanBottom) * viewHeight;
+	double otherColumn = (x + otherTanLeft) / (otherTanLeft + otherTanRight) * viewWidth;
+	double otherRow = (otherTanTop - y) / (otherTanTop + otherTanBottom) * viewHeight;
+
+	motion->x = (other - eye) * eyeWidth + (int)lround(otherColumn - column);
+	motion->y = (int)lround(otherRow - row);
+	return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "openvr_driver.h"
+
+// Motion of the picture between two frames, from the rotation of the head between their poses.
+// During head turns most of the picture moves by about the same vector, encoders that accept
+// motion estimation hints get it for every block so the search starts there.
+struct GlobalMotion {
+	// Pixels from a block of the current frame to its content in the reference frame
+	int x;
+	int y;
+};
+
+// reference and current are the head orientations the frames were rendered with, zero if
+// unknown. The vector is measured at the center of the eye view eye, in pixels of the frame
+// before the foveated compression, whose center keeps that resolution, times contentScale.
+// Returns false if an orientation is unknown or the picture moves by less than a pixel.
+bool EstimateGlobalMotion(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current,
+	int eye, float contentScale, GlobalMotion *motion);
+
+// Distance between the eyes reported by the client, in m. The inter-eye vectors are computed with it.
+void SetStereoIpd(float ipdM);
+
+// Position of the picture of the eye view eye in the other eye view of the reference frame, in a
+// frame with the eyes side by side, eyeWidth wide each. The content is taken at a typical distance,
+// nearer content is shifted further between the eyes, and the vector is exact at the center of the
+// view only, the search refines it. With the head rotation between the frames if both orientations
+// are known. Returns false if the direction cannot be projected.
+bool EstimateInterEyeMotion(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current,
+	int eye, int eyeWidth, float contentScale, GlobalMotion *motion);
@@ -1,4 +1,5 @@
 #include "OvrController.h"
+#include "HandSkeleton.h"
 #include "Logger.h"
 #include "Paths.h"
 #include "Settings.h"
@@ -61,34 +62,26 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
     this->object_id = unObjectId;
     this->prop_container = vr::VRProperties()->TrackedDeviceToPropertyContainer(this->object_id);
 
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container,
-        vr::Prop_TrackingSystemName_String,
-        Settings::Instance().m_useHeadsetTrackingSystem
-            ? Settings::Instance().mTrackingSystemName.c_str()
-            : Settings::Instance().m_controllerTrackingSystemName.c_str());
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container,
-        vr::Prop_ManufacturerName_String,
-        Settings::Instance().m_controllerManufacturerName.c_str());
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container,
+    PropertyBatch props;
+    props.SetStringProperty(vr::Prop_TrackingSystemName_String,
+                            Settings::Instance().m_useHeadsetTrackingSystem
+                                ? Settings::Instance().mTrackingSystemName.c_str()
+                                : Settings::Instance().m_controllerTrackingSystemName.c_str());
+    props.SetStringProperty(vr::Prop_ManufacturerName_String,
+                            Settings::Instance().m_controllerManufacturerName.c_str());
+    props.SetStringProperty(
         vr::Prop_ModelNumber_String,
         this->device_path == LEFT_HAND_PATH
             ? (Settings::Instance().m_controllerModelNumber + " (Left Controller)").c_str()
             : (Settings::Instance().m_controllerModelNumber + " (Right Controller)").c_str());
 
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container,
-        vr::Prop_RenderModelName_String,
-        this->device_path == LEFT_HAND_PATH
-            ? Settings::Instance().m_controllerRenderModelNameLeft.c_str()
-            : Settings::Instance().m_controllerRenderModelNameRight.c_str());
+    props.SetStringProperty(vr::Prop_RenderModelName_String,
+                            this->device_path == LEFT_HAND_PATH
+                                ? Settings::Instance().m_controllerRenderModelNameLeft.c_str()
+                                : Settings::Instance().m_controllerRenderModelNameRight.c_str());
 
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container, vr::Prop_SerialNumber_String, GetSerialNumber().c_str());
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container, vr::Prop_AttachedDeviceId_String, GetSerialNumber().c_str());
+    props.SetStringProperty(vr::Prop_SerialNumber_String, GetSerialNumber().c_str());
+    props.SetStringProperty(vr::Prop_AttachedDeviceId_String, GetSerialNumber().c_str());
 
     const std::string regDeviceTypeString = [this, isViveTracker]() {
         const auto &settings = Settings::Instance();
@@ -109,36 +102,27 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
                    ? (Settings::Instance().mControllerRegisteredDeviceType + "_Left")
                    : (Settings::Instance().mControllerRegisteredDeviceType + "_Right");
     }();
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container, vr::Prop_RegisteredDeviceType_String, regDeviceTypeString.c_str());
+    props.SetStringProperty(vr::Prop_RegisteredDeviceType_String, regDeviceTypeString.c_str());
 
     uint64_t supportedButtons = 0xFFFFFFFFFFFFFFFFULL;
-    vr::VRProperties()->SetUint64Property(
-        this->prop_container, vr::Prop_SupportedButtons_Uint64, supportedButtons);
-
-    vr::VRProperties()->SetBoolProperty(
-        this->prop_container, vr::Prop_DeviceProvidesBatteryStatus_Bool, true);
-
-    vr::VRProperties()->SetInt32Property(
-        this->prop_container, vr::Prop_Axis0Type_Int32, vr::k_eControllerAxis_Joystick);
-
-    vr::VRProperties()->SetInt32Property(this->prop_container,
-                                         vr::Prop_ControllerRoleHint_Int32,
-                                         isViveTracker
-                                             ? vr::TrackedControllerRole_Invalid
-                                             : (this->device_path == LEFT_HAND_PATH
-                                                    ? vr::TrackedControllerRole_LeftHand
-                                                    : vr::TrackedControllerRole_RightHand));
-
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_ControllerType_String,
-                                          this->device_path == LEFT_HAND_PATH
-                                              ? Settings::Instance().m_controllerTypeLeft.c_str()
-                                              : Settings::Instance().m_controllerTypeRight.c_str());
-    vr::VRProperties()->SetStringProperty(
-        this->prop_container,
-        vr::Prop_InputProfilePath_String,
-        Settings::Instance().m_controllerInputProfilePath.c_str());
+    props.SetUint64Property(vr::Prop_SupportedButtons_Uint64, supportedButtons);
+
+    props.SetBoolProperty(vr::Prop_DeviceProvidesBatteryStatus_Bool, true);
+
+    props.SetInt32Property(vr::Prop_Axis0Type_Int32, vr::k_eControllerAxis_Joystick);
+
+    props.SetInt32Property(vr::Prop_ControllerRoleHint_Int32,
+                           isViveTracker ? vr::TrackedControllerRole_Invalid
+                                         : (this->device_path == LEFT_HAND_PATH
+                                                ? vr::TrackedControllerRole_LeftHand
+                                                : vr::TrackedControllerRole_RightHand));
+
+    props.SetStringProperty(vr::Prop_ControllerType_String,
+                            this->device_path == LEFT_HAND_PATH
+                                ? Settings::Instance().m_controllerTypeLeft.c_str()
+                                : Settings::Instance().m_controllerTypeRight.c_str());
+    props.SetStringProperty(vr::Prop_InputProfilePath_String,
+                            Settings::Instance().m_controllerInputProfilePath.c_str());
 
     switch (Settings::Instance().m_controllerMode) {
     case 1: // Oculus Rift
@@ -182,29 +166,18 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
                 &m_compSkeleton);
 
             // icons
-            vr::VRProperties()->SetStringProperty(this->prop_container,
-                                                  vr::Prop_NamedIconPathDeviceOff_String,
-                                                  "{oculus}/icons/rifts_right_controller_off.png");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceSearching_String,
-                "{oculus}/icons/rifts_right_controller_searching.gif");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceSearchingAlert_String,
-                "{oculus}/icons/rifts_right_controller_searching_alert.gif");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceReady_String,
-                "{oculus}/icons/rifts_right_controller_ready.png");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceReadyAlert_String,
-                "{oculus}/icons/rifts_right_controller_ready_alert.png");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceAlertLow_String,
-                "{oculus}/icons/rifts_right_controller_ready_low.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceOff_String,
+                                    "{oculus}/icons/rifts_right_controller_off.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearching_String,
+                                    "{oculus}/icons/rifts_right_controller_searching.gif");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearchingAlert_String,
+                                    "{oculus}/icons/rifts_right_controller_searching_alert.gif");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceReady_String,
+                                    "{oculus}/icons/rifts_right_controller_ready.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceReadyAlert_String,
+                                    "{oculus}/icons/rifts_right_controller_ready_alert.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceAlertLow_String,
+                                    "{oculus}/icons/rifts_right_controller_ready_low.png");
 
         } else {
             // X,Y for left hand.
@@ -228,28 +201,18 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
                 &m_compSkeleton);
 
             // icons
-            vr::VRProperties()->SetStringProperty(this->prop_container,
-                                                  vr::Prop_NamedIconPathDeviceOff_String,
-                                                  "{oculus}/icons/rifts_left_controller_off.png");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceSearching_String,
-                "{oculus}/icons/rifts_left_controller_searching.gif");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceSearchingAlert_String,
-                "{oculus}/icons/rifts_left_controller_searching_alert.gif");
-            vr::VRProperties()->SetStringProperty(this->prop_container,
-                                                  vr::Prop_NamedIconPathDeviceReady_String,
-                                                  "{oculus}/icons/rifts_left_controller_ready.png");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceReadyAlert_String,
-                "{oculus}/icons/rifts_left_controller_ready_alert.png");
-            vr::VRProperties()->SetStringProperty(
-                this->prop_container,
-                vr::Prop_NamedIconPathDeviceAlertLow_String,
-                "{oculus}/icons/rifts_left_controller_ready_low.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceOff_String,
+                                    "{oculus}/icons/rifts_left_controller_off.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearching_String,
+                                    "{oculus}/icons/rifts_left_controller_searching.gif");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearchingAlert_String,
+                                    "{oculus}/icons/rifts_left_controller_searching_alert.gif");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceReady_String,
+                                    "{oculus}/icons/rifts_left_controller_ready.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceReadyAlert_String,
+                                    "{oculus}/icons/rifts_left_controller_ready_alert.png");
+            props.SetStringProperty(vr::Prop_NamedIconPathDeviceAlertLow_String,
+                                    "{oculus}/icons/rifts_left_controller_ready_low.png");
         }
 
         vr::VRDriverInput()->CreateBooleanComponent(
@@ -398,98 +361,63 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
         // All of these property values were dumped from real a vive tracker via
         // https://github.com/SDraw/openvr_dumper and were copied from
         // https://github.com/SDraw/driver_kinectV2
-        vr::VRProperties()->SetStringProperty(
-            this->prop_container, vr::Prop_ResourceRoot_String, "htc");
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_WillDriftInYaw_Bool, false);
-        vr::VRProperties()->SetStringProperty(
-            this->prop_container,
+        props.SetStringProperty(vr::Prop_ResourceRoot_String, "htc");
+        props.SetBoolProperty(vr::Prop_WillDriftInYaw_Bool, false);
+        props.SetStringProperty(
             vr::Prop_TrackingFirmwareVersion_String,
             "1541800000 RUNNER-WATCHMAN$runner-watchman@runner-watchman 2018-01-01 FPGA "
             "512(2.56/0/0) BL 0 VRC 1541800000 Radio 1518800000"); // Changed
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_HardwareRevision_String,
-                                              "product 128 rev 2.5.6 lot 2000/0/0 0");
-        vr::VRProperties()->SetStringProperty(
-            this->prop_container, vr::Prop_ConnectedWirelessDongle_String, "D0000BE000");
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_DeviceIsWireless_Bool, true);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_DeviceIsCharging_Bool, false);
-        vr::VRProperties()->SetInt32Property(
-            this->prop_container, vr::Prop_ControllerHandSelectionPriority_Int32, -1);
+        props.SetStringProperty(
+            vr::Prop_HardwareRevision_String, "product 128 rev 2.5.6 lot 2000/0/0 0");
+        props.SetStringProperty(vr::Prop_ConnectedWirelessDongle_String, "D0000BE000");
+        props.SetBoolProperty(vr::Prop_DeviceIsWireless_Bool, true);
+        props.SetBoolProperty(vr::Prop_DeviceIsCharging_Bool, false);
+        props.SetInt32Property(vr::Prop_ControllerHandSelectionPriority_Int32, -1);
         vr::HmdMatrix34_t l_transform = {
             -1.f, 0.f, 0.f, 0.f, 0.f, 0.f, -1.f, 0.f, 0.f, -1.f, 0.f, 0.f};
-        vr::VRProperties()->SetProperty(this->prop_container,
-                                        vr::Prop_StatusDisplayTransform_Matrix34,
-                                        &l_transform,
-                                        sizeof(vr::HmdMatrix34_t),
-                                        vr::k_unHmdMatrix34PropertyTag);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_Firmware_UpdateAvailable_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_Firmware_ManualUpdate_Bool, false);
-        vr::VRProperties()->SetStringProperty(
-            this->prop_container,
+        props.SetProperty(vr::Prop_StatusDisplayTransform_Matrix34,
+                          &l_transform,
+                          sizeof(vr::HmdMatrix34_t),
+                          vr::k_unHmdMatrix34PropertyTag);
+        props.SetBoolProperty(vr::Prop_Firmware_UpdateAvailable_Bool, false);
+        props.SetBoolProperty(vr::Prop_Firmware_ManualUpdate_Bool, false);
+        props.SetStringProperty(
             vr::Prop_Firmware_ManualUpdateURL_String,
             "https://developer.valvesoftware.com/wiki/SteamVR/HowTo_Update_Firmware");
-        vr::VRProperties()->SetUint64Property(
-            this->prop_container, vr::Prop_HardwareRevision_Uint64, 2214720000);
-        vr::VRProperties()->SetUint64Property(
-            this->prop_container, vr::Prop_FirmwareVersion_Uint64, 1541800000);
-        vr::VRProperties()->SetUint64Property(
-            this->prop_container, vr::Prop_FPGAVersion_Uint64, 512);
-        vr::VRProperties()->SetUint64Property(
-            this->prop_container, vr::Prop_VRCVersion_Uint64, 1514800000);
-        vr::VRProperties()->SetUint64Property(
-            this->prop_container, vr::Prop_RadioVersion_Uint64, 1518800000);
-        vr::VRProperties()->SetUint64Property(
-            this->prop_container, vr::Prop_DongleVersion_Uint64, 8933539758);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_DeviceCanPowerOff_Bool, true);
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_Firmware_ProgrammingTarget_String,
-                                              GetSerialNumber().c_str());
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_Firmware_ForceUpdateRequired_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_Identifiable_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_Firmware_RemindUpdate_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_HasDisplayComponent_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_HasCameraComponent_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_HasDriverDirectModeComponent_Bool, false);
-        vr::VRProperties()->SetBoolProperty(
-            this->prop_container, vr::Prop_HasVirtualDisplayComponent_Bool, false);
+        props.SetUint64Property(vr::Prop_HardwareRevision_Uint64, 2214720000);
+        props.SetUint64Property(vr::Prop_FirmwareVersion_Uint64, 1541800000);
+        props.SetUint64Property(vr::Prop_FPGAVersion_Uint64, 512);
+        props.SetUint64Property(vr::Prop_VRCVersion_Uint64, 1514800000);
+        props.SetUint64Property(vr::Prop_RadioVersion_Uint64, 1518800000);
+        props.SetUint64Property(vr::Prop_DongleVersion_Uint64, 8933539758);
+        props.SetBoolProperty(vr::Prop_DeviceCanPowerOff_Bool, true);
+        props.SetStringProperty(
+            vr::Prop_Firmware_ProgrammingTarget_String, GetSerialNumber().c_str());
+        props.SetBoolProperty(vr::Prop_Firmware_ForceUpdateRequired_Bool, false);
+        props.SetBoolProperty(vr::Prop_Identifiable_Bool, false);
+        props.SetBoolProperty(vr::Prop_Firmware_RemindUpdate_Bool, false);
+        props.SetBoolProperty(vr::Prop_HasDisplayComponent_Bool, false);
+        props.SetBoolProperty(vr::Prop_HasCameraComponent_Bool, false);
+        props.SetBoolProperty(vr::Prop_HasDriverDirectModeComponent_Bool, false);
+        props.SetBoolProperty(vr::Prop_HasVirtualDisplayComponent_Bool, false);
 
         // icons
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceOff_String,
-                                              "{htc}/icons/tracker_status_off.png");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceSearching_String,
-                                              "{htc}/icons/tracker_status_searching.gif");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceSearchingAlert_String,
-                                              "{htc}/icons/tracker_status_searching_alert.gif");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceReady_String,
-                                              "{htc}/icons/tracker_status_ready.png");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceReadyAlert_String,
-                                              "{htc}/icons/tracker_status_ready_alert.png");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceNotReady_String,
-                                              "{htc}/icons/tracker_status_error.png");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceStandby_String,
-                                              "{htc}/icons/tracker_status_standby.png");
-        vr::VRProperties()->SetStringProperty(this->prop_container,
-                                              vr::Prop_NamedIconPathDeviceAlertLow_String,
-                                              "{htc}/icons/tracker_status_ready_low.png");
+        props.SetStringProperty(
+            vr::Prop_NamedIconPathDeviceOff_String, "{htc}/icons/tracker_status_off.png");
+        props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearching_String,
+                                "{htc}/icons/tracker_status_searching.gif");
+        props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearchingAlert_String,
+                                "{htc}/icons/tracker_status_searching_alert.gif");
+        props.SetStringProperty(
+            vr::Prop_NamedIconPathDeviceReady_String, "{htc}/icons/tracker_status_ready.png");
+        props.SetStringProperty(vr::Prop_NamedIconPathDeviceReadyAlert_String,
+                                "{htc}/icons/tracker_status_ready_alert.png");
+        props.SetStringProperty(
+            vr::Prop_NamedIconPathDeviceNotReady_String, "{htc}/icons/tracker_status_error.png");
+        props.SetStringProperty(
+            vr::Prop_NamedIconPathDeviceStandby_String, "{htc}/icons/tracker_status_standby.png");
+        props.SetStringProperty(vr::Prop_NamedIconPathDeviceAlertLow_String,
+                                "{htc}/icons/tracker_status_ready_low.png");
         // yes we want to explicitly fallthrough to vive case!, vive trackers can have input when
         // POGO pins are connected to a peripheral. the input bindings are only active when the
         // tracker role is set to "vive_tracker_handed"/held_in_hand roles.
@@ -550,11 +478,11 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
         break;
     case 11: {// Pico Neo 3
 
-        const auto SetPathProperty = [](const vr::PropertyContainerHandle_t ulContainerHandle, const vr::ETrackedDeviceProperty prop, const char* const filename)
+        const auto SetPathProperty = [&props](const vr::PropertyContainerHandle_t, const vr::ETrackedDeviceProperty prop, const char* const filename)
         {
             if (filename == nullptr)
                 return;
-            vr::VRProperties()->SetStringProperty(ulContainerHandle, prop, filename);
+            props.SetStringProperty(prop, filename);
         };        
         vr::VRDriverInput()->CreateBooleanComponent(
             this->prop_container, "/input/system/click", &m_handles[ALVR_INPUT_SYSTEM_CLICK]);
@@ -711,11 +639,11 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
             this->prop_container, "/output/haptic", &m_compHaptic);
     } break;
     case 13: {// WMR
-        const auto SetPathProperty = [](const vr::PropertyContainerHandle_t ulContainerHandle, const vr::ETrackedDeviceProperty prop, const char* const filename)
+        const auto SetPathProperty = [&props](const vr::PropertyContainerHandle_t, const vr::ETrackedDeviceProperty prop, const char* const filename)
         {
             if (filename == nullptr)
                 return;
-            vr::VRProperties()->SetStringProperty(ulContainerHandle, prop, filename);
+            props.SetStringProperty(prop, filename);
         };        
         vr::VRDriverInput()->CreateBooleanComponent(
             this->prop_container, "/input/system/click", &m_handles[ALVR_INPUT_SYSTEM_CLICK]);
@@ -862,6 +790,8 @@ vr::EVRInitError OvrController::Activate(vr::TrackedDeviceIndex_t unObjectId) {
     } break;
     }
 
+    write_activation_props(props);
+
     return vr::VRInitError_None;
 }
 
@@ -925,12 +855,23 @@ vr::HmdQuaternionf_t QuatMultiply(const vr::HmdQuaternionf_t *q1, const vr::HmdQ
     return result;
 }
 
-bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
+bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c, uint64_t sampleTimeNs) {
 
     if (this->object_id == vr::k_unTrackedDeviceIndexInvalid) {
         return false;
     }
 
+    // SteamVR samples the skeleton once per frame, tracking samples in between would only cost
+    // the bone computation. A sample every frame passes even when it comes a bit early. Every
+    // sample is due while the refresh rate is not known yet.
+    bool skeletonDue = false;
+    uint64_t nowUs = GetTimestampUs();
+    uint64_t refreshRate = (uint64_t)std::max(Settings::Instance().m_refreshRate, 0);
+    if (refreshRate == 0 || nowUs - m_lastSkeletonUs >= 750000 / refreshRate) {
+        m_lastSkeletonUs = nowUs;
+        skeletonDue = true;
+    }
+
     if (c.isHand) {
 
         vr::HmdQuaternion_t rootBoneRot =
@@ -989,18 +930,37 @@ bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
         Shape(Magnitude(c.angularVelocity),
               Settings::Instance().m_angularVelocityCutoff * DEG_TO_RAD);
 
-    m_pose.vecVelocity[0] =
-        c.linearVelocity.x * LinearVelocityMultiplier;
-    m_pose.vecVelocity[1] =
-        c.linearVelocity.y * LinearVelocityMultiplier;
-    m_pose.vecVelocity[2] =
-        c.linearVelocity.z * LinearVelocityMultiplier;
-    m_pose.vecAngularVelocity[0] =
-        c.angularVelocity.x * AngularVelocityMultiplier;
-    m_pose.vecAngularVelocity[1] =
-        c.angularVelocity.y * AngularVelocityMultiplier;
-    m_pose.vecAngularVelocity[2] =
-        c.angularVelocity.z * AngularVelocityMultiplier;
+    if (Settings::Instance().m_serversidePrediction) {
+        // Extrapolate over the whole latency here, with the accelerations, instead of letting
+        // SteamVR extrapolate linearly from a pose in the past
+        double linearVelocity[3] = {c.linearVelocity.x, c.linearVelocity.y, c.linearVelocity.z};
+        double angularVelocity[3] = {c.angularVelocity.x, c.angularVelocity.y, c.angularVelocity.z};
+        m_predictor.Update(
+            sampleTimeNs, m_pose.qRotation, m_pose.vecPosition, linearVelocity, angularVelocity);
+
+        PosePredictor::State predicted = m_predictor.Predict(
+            -*m_poseTimeOffset, LinearVelocityMultiplier, AngularVelocityMultiplier);
+        m_pose.qRotation = predicted.orientation;
+        for (int i = 0; i < 3; i++) {
+            m_pose.vecPosition[i] = predicted.position[i];
+            m_pose.vecVelocity[i] = predicted.linearVelocity[i];
+            m_pose.vecAcceleration[i] = predicted.linearAcceleration[i];
+            m_pose.vecAngularVelocity[i] = predicted.angularVelocity[i];
+        }
+    } else {
+        m_pose.vecVelocity[0] =
+            c.linearVelocity.x * LinearVelocityMultiplier;
+        m_pose.vecVelocity[1] =
+            c.linearVelocity.y * LinearVelocityMultiplier;
+        m_pose.vecVelocity[2] =
+            c.linearVelocity.z * LinearVelocityMultiplier;
+        m_pose.vecAngularVelocity[0] =
+            c.angularVelocity.x * AngularVelocityMultiplier;
+        m_pose.vecAngularVelocity[1] =
+            c.angularVelocity.y * AngularVelocityMultiplier;
+        m_pose.vecAngularVelocity[2] =
+            c.angularVelocity.z * AngularVelocityMultiplier;
+    }
 
     // correct direction of velocities
     vr::HmdVector3d_t angVel;
@@ -1049,7 +1009,8 @@ bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
     m_pose.vecVelocity[2] = m_pose.vecVelocity[2] + tmp[2];
     */
 
-    m_pose.poseTimeOffset = *m_poseTimeOffset;
+    // The predicted pose is already at the display time
+    m_pose.poseTimeOffset = Settings::Instance().m_serversidePrediction ? 0. : *m_poseTimeOffset;
 
     if (c.isHand) {
         // m_pose.poseTimeOffset = 0.;
@@ -1181,206 +1142,10 @@ bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
                 m_handles[ALVR_INPUT_SYSTEM_CLICK], false, 0.0);
             break;
         }
-        // Hand
-        const vr::VRBoneTransform_t handRestPose = {{0, 0, 0, 1}, {1, 0, 0, 0}};
-        for (size_t i = 0U; i < HSB_Count; i++)
-            m_boneTransform[i] = handRestPose;
-#define COPY4(a, b)                                                                                \
-    do {                                                                                           \
-        b.w = a.w;                                                                                 \
-        b.x = a.x;                                                                                 \
-        b.y = a.y;                                                                                 \
-        b.z = a.z;                                                                                 \
-    } while (0)
-#define COPY4M(a, b, c)                                                                            \
-    do {                                                                                           \
-        b.w = a.w * c;                                                                             \
-        b.x = a.x * c;                                                                             \
-        b.y = a.y * c;                                                                             \
-        b.z = a.z * c;                                                                             \
-    } while (0)
-#define ADD4(a, b)                                                                                 \
-    do {                                                                                           \
-        b.w += a.w;                                                                                \
-        b.x += a.x;                                                                                \
-        b.y += a.y;                                                                                \
-        b.z += a.z;                                                                                \
-    } while (0)
-#define COPY3(a, b)                                                                                \
-    do {                                                                                           \
-        b.v[0] = a.x;                                                                              \
-        b.v[1] = a.y;                                                                              \
-        b.v[2] = a.z;                                                                              \
-    } while (0)
-#define COPY3M(a, b, c)                                                                            \
-    do {                                                                                           \
-        b.v[0] = a.x * c;                                                                          \
-        b.v[1] = a.y * c;                                                                          \
-        b.v[2] = a.z * c;                                                                          \
-    } while (0)
-#define SIZE4(b) (sqrt(b.v[0] * b.v[0] + b.v[1] * b.v[1] + b.v[2] * b.v[2]))
-#define APPSIZE4(a, b, c)                                                                          \
-    do {                                                                                           \
-        a.v[0] *= b / c;                                                                           \
-        a.v[1] *= b / c;                                                                           \
-        a.v[2] *= b / c;                                                                           \
-    } while (0)
-
-        vr::HmdQuaternion_t boneFixer = HmdQuaternion_Init(0, 0, 0.924, -0.383);
-        COPY4(c.boneRotations[alvrHandBone_WristRoot], m_boneTransform[HSB_Wrist].orientation);
-        m_boneTransform[HSB_Wrist].orientation =
-            QuatMultiply(&m_boneTransform[HSB_Wrist].orientation, &boneFixer);
-
-        COPY4(c.boneRotations[alvrHandBone_Thumb0], m_boneTransform[HSB_Thumb0].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Thumb1], m_boneTransform[HSB_Thumb1].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Thumb2], m_boneTransform[HSB_Thumb2].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Thumb3], m_boneTransform[HSB_Thumb3].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Index1], m_boneTransform[HSB_IndexFinger1].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Index2], m_boneTransform[HSB_IndexFinger2].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Index3], m_boneTransform[HSB_IndexFinger3].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Middle1],
-              m_boneTransform[HSB_MiddleFinger1].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Middle2],
-              m_boneTransform[HSB_MiddleFinger2].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Middle3],
-              m_boneTransform[HSB_MiddleFinger3].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Ring1], m_boneTransform[HSB_RingFinger1].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Ring2], m_boneTransform[HSB_RingFinger2].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Ring3], m_boneTransform[HSB_RingFinger3].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Pinky0], m_boneTransform[HSB_PinkyFinger0].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Pinky1], m_boneTransform[HSB_PinkyFinger1].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Pinky2], m_boneTransform[HSB_PinkyFinger2].orientation);
-        COPY4(c.boneRotations[alvrHandBone_Pinky3], m_boneTransform[HSB_PinkyFinger3].orientation);
-
-        // Will use one of the existing poses from the implementation below instead for position
-        // data.
-        // COPY3(c.boneRootPosition, m_boneTransform[HSB_Root].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_WristRoot], m_boneTransform[HSB_Wrist].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Thumb0], m_boneTransform[HSB_Thumb0].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Thumb1], m_boneTransform[HSB_Thumb1].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Thumb2], m_boneTransform[HSB_Thumb2].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Thumb3], m_boneTransform[HSB_Thumb3].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Index1],
-        // m_boneTransform[HSB_IndexFinger1].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Index2],
-        // m_boneTransform[HSB_IndexFinger2].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Index3],
-        // m_boneTransform[HSB_IndexFinger3].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Middle1],
-        // m_boneTransform[HSB_MiddleFinger1].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Middle2],
-        // m_boneTransform[HSB_MiddleFinger2].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Middle3],
-        // m_boneTransform[HSB_MiddleFinger3].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Ring1],
-        // m_boneTransform[HSB_RingFinger1].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Ring2],
-        // m_boneTransform[HSB_RingFinger2].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Ring3],
-        // m_boneTransform[HSB_RingFinger3].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Pinky0],
-        // m_boneTransform[HSB_PinkyFinger0].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Pinky1],
-        // m_boneTransform[HSB_PinkyFinger1].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Pinky2],
-        // m_boneTransform[HSB_PinkyFinger2].position);
-        // COPY3(c.bonePositionsBase[alvrHandBone_Pinky3],
-        // m_boneTransform[HSB_PinkyFinger3].position);
-
-        // Use position data (and orientation for missing bones - index, middle and ring finger bone
-        // 0) from the functions below.
-        if (this->device_path == LEFT_HAND_PATH) {
-            m_boneTransform[2].position = {-0.012083f, 0.028070f, 0.025050f, 1.f};
-            m_boneTransform[3].position = {0.040406f, 0.000000f, -0.000000f, 1.f};
-            m_boneTransform[4].position = {0.032517f, 0.000000f, 0.000000f, 1.f};
-
-            m_boneTransform[6].position = {0.000632f, 0.026866f, 0.015002f, 1.f};
-            m_boneTransform[7].position = {0.074204f, -0.005002f, 0.000234f, 1.f};
-            m_boneTransform[8].position = {0.043930f, -0.000000f, -0.000000f, 1.f};
-            m_boneTransform[9].position = {0.028695f, 0.000000f, 0.000000f, 1.f};
-
-            m_boneTransform[11].position = {0.002177f, 0.007120f, 0.016319f, 1.f};
-            m_boneTransform[12].position = {0.070953f, 0.000779f, 0.000997f, 1.f};
-            m_boneTransform[13].position = {0.043108f, 0.000000f, 0.000000f, 1.f};
-            m_boneTransform[14].position = {0.033266f, 0.000000f, 0.000000f, 1.f};
-
-            m_boneTransform[16].position = {0.000513f, -0.006545f, 0.016348f, 1.f};
-            m_boneTransform[17].position = {0.065876f, 0.001786f, 0.000693f, 1.f};
-            m_boneTransform[18].position = {0.040697f, 0.000000f, 0.000000f, 1.f};
-            m_boneTransform[19].position = {0.028747f, -0.000000f, -0.000000f, 1.f};
-
-            m_boneTransform[21].position = {-0.002478f, -0.018981f, 0.015214f, 1.f};
-            m_boneTransform[22].position = {0.062878f, 0.002844f, 0.000332f, 1.f};
-            m_boneTransform[23].position = {0.030220f, 0.000000f, 0.000000f, 1.f};
-            m_boneTransform[24].position = {0.018187f, 0.000000f, 0.000000f, 1.f};
-
-            m_boneTransform[6].orientation = {0.644251f, 0.421979f, -0.478202f, 0.422133f};
-            m_boneTransform[11].orientation = {0.546723f, 0.541277f, -0.442520f, 0.460749f};
-            m_boneTransform[16].orientation = {0.516692f, 0.550144f, -0.495548f, 0.429888f};
-        } else {
-            m_boneTransform[2].position = {0.012330f, 0.028661f, 0.025049f, 1.f};
-            m_boneTransform[3].position = {-0.040406f, -0.000000f, 0.000000f, 1.f};
-            m_boneTransform[4].position = {-0.032517f, -0.000000f, -0.000000f, 1.f};
-
-            m_boneTransform[6].position = {-0.000632f, 0.026866f, 0.015002f, 1.f};
-            m_boneTransform[7].position = {-0.074204f, 0.005002f, -0.000234f, 1.f};
-            m_boneTransform[8].position = {-0.043930f, 0.000000f, 0.000000f, 1.f};
-            m_boneTransform[9].position = {-0.028695f, -0.000000f, -0.000000f, 1.f};
-
-            m_boneTransform[11].position = {-0.002177f, 0.007120f, 0.016319f, 1.f};
-            m_boneTransform[12].position = {-0.070953f, -0.000779f, -0.000997f, 1.f};
-            m_boneTransform[13].position = {-0.043108f, -0.000000f, -0.000000f, 1.f};
-            m_boneTransform[14].position = {-0.033266f, -0.000000f, -0.000000f, 1.f};
-
-            m_boneTransform[16].position = {-0.000513f, -0.006545f, 0.016348f, 1.f};
-            m_boneTransform[17].position = {-0.065876f, -0.001786f, -0.000693f, 1.f};
-            m_boneTransform[18].position = {-0.040697f, -0.000000f, -0.000000f, 1.f};
-            m_boneTransform[19].position = {-0.028747f, 0.000000f, 0.000000f, 1.f};
-
-            m_boneTransform[21].position = {0.002478f, -0.018981f, 0.015214f, 1.f};
-            m_boneTransform[22].position = {-0.062878f, -0.002844f, -0.000332f, 1.f};
-            m_boneTransform[23].position = {-0.030220f, -0.000000f, -0.000000f, 1.f};
-            m_boneTransform[24].position = {-0.018187f, -0.000000f, -0.000000f, 1.f};
-
-            m_boneTransform[6].orientation = {0.421833f, -0.643793f, 0.422458f, 0.478661f};
-            m_boneTransform[11].orientation = {0.541874f, -0.547427f, 0.459996f, 0.441701f};
-            m_boneTransform[16].orientation = {0.548983f, -0.519068f, 0.426914f, 0.496920f};
-        }
-
-        // Move the hand itself back to counteract the translation applied to the controller
-        // position. (more or less)
-        float bonePosFixer[3] = {0.025f, 0.f, 0.1f};
-        if (this->device_path == RIGHT_HAND_PATH)
-            bonePosFixer[0] = -bonePosFixer[0];
-        m_boneTransform[HSB_Wrist].position.v[0] =
-            m_boneTransform[HSB_Wrist].position.v[0] + bonePosFixer[0];
-        m_boneTransform[HSB_Wrist].position.v[1] =
-            m_boneTransform[HSB_Wrist].position.v[1] + bonePosFixer[1];
-        m_boneTransform[HSB_Wrist].position.v[2] =
-            m_boneTransform[HSB_Wrist].position.v[2] + bonePosFixer[2];
-
-        // Rotate thumb0 and pinky0 properly.
-        if (this->device_path == LEFT_HAND_PATH) {
-            vr::HmdQuaternion_t fixer = HmdQuaternion_Init(0.5, 0.5, -0.5, 0.5);
-            m_boneTransform[HSB_Thumb0].orientation =
-                QuatMultiply(&fixer, &m_boneTransform[HSB_Thumb0].orientation);
-            m_boneTransform[HSB_PinkyFinger0].orientation =
-                QuatMultiply(&fixer, &m_boneTransform[HSB_PinkyFinger0].orientation);
-        } else {
-            vr::HmdQuaternion_t fixer = HmdQuaternion_Init(0.5, -0.5, 0.5, 0.5);
-            m_boneTransform[HSB_Thumb0].orientation =
-                QuatMultiply(&fixer, &m_boneTransform[HSB_Thumb0].orientation);
-            m_boneTransform[HSB_PinkyFinger0].orientation =
-                QuatMultiply(&fixer, &m_boneTransform[HSB_PinkyFinger0].orientation);
+        if (skeletonDue) {
+            UpdateHandSkeleton(c);
         }
 
-        vr::VRDriverInput()->UpdateSkeletonComponent(
-            m_compSkeleton, vr::VRSkeletalMotionRange_WithController, m_boneTransform, HSB_Count);
-        vr::VRDriverInput()->UpdateSkeletonComponent(m_compSkeleton,
-                                                     vr::VRSkeletalMotionRange_WithoutController,
-                                                     m_boneTransform,
-                                                     HSB_Count);
-
         vr::VRDriverInput()->UpdateScalarComponent(
             m_handles[ALVR_INPUT_FINGER_INDEX], rotIndex, 0.0);
         vr::VRDriverInput()->UpdateScalarComponent(
@@ -1388,9 +1153,6 @@ bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
         vr::VRDriverInput()->UpdateScalarComponent(m_handles[ALVR_INPUT_FINGER_RING], rotRing, 0.0);
         vr::VRDriverInput()->UpdateScalarComponent(
             m_handles[ALVR_INPUT_FINGER_PINKY], rotPinky, 0.0);
-
-        vr::VRServerDriverHost()->TrackedDevicePoseUpdated(
-            this->object_id, m_pose, sizeof(vr::DriverPose_t));
     } else {
         switch (Settings::Instance().m_controllerMode) {
         case 3:
@@ -1671,47 +1433,8 @@ bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
 
             uint64_t lastPoseTouch = m_lastThumbTouch + m_lastIndexTouch;
 
-            vr::VRBoneTransform_t boneTransforms[SKELETON_BONE_COUNT];
-
-            // Perform whatever logic is necessary to convert your device's input into a skeletal
-            // pose, first to create a pose "With Controller", that is as close to the pose of the
-            // user's real hand as possible
-            GetBoneTransform(true,
-                             this->device_path == LEFT_HAND_PATH,
-                             m_thumbAnimationProgress,
-                             m_indexAnimationProgress,
-                             lastPoseTouch,
-                             c,
-                             boneTransforms);
-
-            // Then update the WithController pose on the component with those transforms
-            vr::EVRInputError err = vr::VRDriverInput()->UpdateSkeletonComponent(
-                m_compSkeleton,
-                vr::VRSkeletalMotionRange_WithController,
-                boneTransforms,
-                SKELETON_BONE_COUNT);
-            if (err != vr::VRInputError_None) {
-                // Handle failure case
-                Debug("UpdateSkeletonComponentfailed.  Error: %i\n", err);
-            }
-
-            GetBoneTransform(false,
-                             this->device_path == LEFT_HAND_PATH,
-                             m_thumbAnimationProgress,
-                             m_indexAnimationProgress,
-                             lastPoseTouch,
-                             c,
-                             boneTransforms);
-
-            // Then update the WithoutController pose on the component
-            err = vr::VRDriverInput()->UpdateSkeletonComponent(
-                m_compSkeleton,
-                vr::VRSkeletalMotionRange_WithoutController,
-                boneTransforms,
-                SKELETON_BONE_COUNT);
-            if (err != vr::VRInputError_None) {
-                // Handle failure case
-                Debug("UpdateSkeletonComponentfailed.  Error: %i\n", err);
+            if (skeletonDue) {
+                UpdateControllerSkeleton(c, lastPoseTouch);
             }
             break;
         }
@@ -1719,12 +1442,262 @@ bool OvrController::onPoseUpdate(const TrackingInfo::Controller &c) {
         // Battery
         // vr::VRProperties()->SetFloatProperty(this->prop_container,
         // vr::Prop_DeviceBatteryPercentage_Float, c.batteryPercentRemaining / 100.0f);
+    }
+
+    return true;
+}
+
+void OvrController::PublishPose() {
+    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(
+        this->object_id, m_pose, sizeof(vr::DriverPose_t));
+}
+
+void OvrController::UpdateHandSkeleton(const TrackingInfo::Controller &c) {
+    // Hand
+    const vr::VRBoneTransform_t handRestPose = {{0, 0, 0, 1}, {1, 0, 0, 0}};
+    for (size_t i = 0U; i < HSB_Count; i++)
+        m_boneTransform[i] = handRestPose;
+#define COPY4(a, b)                                                                                \
+do {                                                                                           \
+    b.w = a.w;                                                                                 \
+    b.x = a.x;                                                                                 \
+    b.y = a.y;                                                                                 \
+    b.z = a.z;                                                                                 \
+} while (0)
+#define COPY4M(a, b, c)                                                                            \
+do {                                                                                           \
+    b.w = a.w * c;                                                                             \
+    b.x = a.x * c;                                                                             \
+    b.y = a.y * c;                                                                             \
+    b.z = a.z * c;                                                                             \
+} while (0)
+#define ADD4(a, b)                                                                                 \
+do {                                                                                           \
+    b.w += a.w;                                                                                \
+    b.x += a.x;                                                                                \
+    b.y += a.y;                                                                                \
+    b.z += a.z;                                                                                \
+} while (0)
+#define COPY3(a, b)                                                                                \
+do {                                                                                           \
+    b.v[0] = a.x;                                                                              \
+    b.v[1] = a.y;                                                                              \
+    b.v[2] = a.z;                                                                              \
+} while (0)
+#define COPY3M(a, b, c)                                                                            \
+do {                                                                                           \
+    b.v[0] = a.x * c;                                                                          \
+    b.v[1] = a.y * c;                                                                          \
+    b.v[2] = a.z * c;                                                                          \
+} while (0)
+#define SIZE4(b) (sqrt(b.v[0] * b.v[0] + b.v[1] * b.v[1] + b.v[2] * b.v[2]))
+#define APPSIZE4(a, b, c)                                                                          \
+do {                                                                                           \
+    a.v[0] *= b / c;                                                                           \
+    a.v[1] *= b / c;                                                                           \
+    a.v[2] *= b / c;                                                                           \
+} while (0)
+
+    vr::HmdQuaternion_t boneFixer = HmdQuaternion_Init(0, 0, 0.924, -0.383);
+    COPY4(c.boneRotations[alvrHandBone_WristRoot], m_boneTransform[HSB_Wrist].orientation);
+    m_boneTransform[HSB_Wrist].orientation =
+        QuatMultiply(&m_boneTransform[HSB_Wrist].orientation, &boneFixer);
+
+    COPY4(c.boneRotations[alvrHandBone_Thumb0], m_boneTransform[HSB_Thumb0].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Thumb1], m_boneTransform[HSB_Thumb1].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Thumb2], m_boneTransform[HSB_Thumb2].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Thumb3], m_boneTransform[HSB_Thumb3].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Index1], m_boneTransform[HSB_IndexFinger1].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Index2], m_boneTransform[HSB_IndexFinger2].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Index3], m_boneTransform[HSB_IndexFinger3].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Middle1],
+          m_boneTransform[HSB_MiddleFinger1].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Middle2],
+          m_boneTransform[HSB_MiddleFinger2].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Middle3],
+          m_boneTransform[HSB_MiddleFinger3].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Ring1], m_boneTransform[HSB_RingFinger1].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Ring2], m_boneTransform[HSB_RingFinger2].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Ring3], m_boneTransform[HSB_RingFinger3].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Pinky0], m_boneTransform[HSB_PinkyFinger0].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Pinky1], m_boneTransform[HSB_PinkyFinger1].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Pinky2], m_boneTransform[HSB_PinkyFinger2].orientation);
+    COPY4(c.boneRotations[alvrHandBone_Pinky3], m_boneTransform[HSB_PinkyFinger3].orientation);
+
+    // Will use one of the existing poses from the implementation below instead for position
+    // data.
+    // COPY3(c.boneRootPosition, m_boneTransform[HSB_Root].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_WristRoot], m_boneTransform[HSB_Wrist].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Thumb0], m_boneTransform[HSB_Thumb0].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Thumb1], m_boneTransform[HSB_Thumb1].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Thumb2], m_boneTransform[HSB_Thumb2].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Thumb3], m_boneTransform[HSB_Thumb3].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Index1],
+    // m_boneTransform[HSB_IndexFinger1].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Index2],
+    // m_boneTransform[HSB_IndexFinger2].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Index3],
+    // m_boneTransform[HSB_IndexFinger3].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Middle1],
+    // m_boneTransform[HSB_MiddleFinger1].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Middle2],
+    // m_boneTransform[HSB_MiddleFinger2].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Middle3],
+    // m_boneTransform[HSB_MiddleFinger3].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Ring1],
+    // m_boneTransform[HSB_RingFinger1].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Ring2],
+    // m_boneTransform[HSB_RingFinger2].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Ring3],
+    // m_boneTransform[HSB_RingFinger3].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Pinky0],
+    // m_boneTransform[HSB_PinkyFinger0].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Pinky1],
+    // m_boneTransform[HSB_PinkyFinger1].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Pinky2],
+    // m_boneTransform[HSB_PinkyFinger2].position);
+    // COPY3(c.bonePositionsBase[alvrHandBone_Pinky3],
+    // m_boneTransform[HSB_PinkyFinger3].position);
+
+    // Use position data (and orientation for missing bones - index, middle and ring finger bone
+    // 0) from the functions below.
+    if (this->device_path == LEFT_HAND_PATH) {
+        m_boneTransform[2].position = {-0.012083f, 0.028070f, 0.025050f, 1.f};
+        m_boneTransform[3].position = {0.040406f, 0.000000f, -0.000000f, 1.f};
+        m_boneTransform[4].position = {0.032517f, 0.000000f, 0.000000f, 1.f};
+
+        m_boneTransform[6].position = {0.000632f, 0.026866f, 0.015002f, 1.f};
+        m_boneTransform[7].position = {0.074204f, -0.005002f, 0.000234f, 1.f};
+        m_boneTransform[8].position = {0.043930f, -0.000000f, -0.000000f, 1.f};
+        m_boneTransform[9].position = {0.028695f, 0.000000f, 0.000000f, 1.f};
+
+        m_boneTransform[11].position = {0.002177f, 0.007120f, 0.016319f, 1.f};
+        m_boneTransform[12].position = {0.070953f, 0.000779f, 0.000997f, 1.f};
+        m_boneTransform[13].position = {0.043108f, 0.000000f, 0.000000f, 1.f};
+        m_boneTransform[14].position = {0.033266f, 0.000000f, 0.000000f, 1.f};
+
+        m_boneTransform[16].position = {0.000513f, -0.006545f, 0.016348f, 1.f};
+        m_boneTransform[17].position = {0.065876f, 0.001786f, 0.000693f, 1.f};
+        m_boneTransform[18].position = {0.040697f, 0.000000f, 0.000000f, 1.f};
+        m_boneTransform[19].position = {0.028747f, -0.000000f, -0.000000f, 1.f};
+
+        m_boneTransform[21].position = {-0.002478f, -0.018981f, 0.015214f, 1.f};
+        m_boneTransform[22].position = {0.062878f, 0.002844f, 0.000332f, 1.f};
+        m_boneTransform[23].position = {0.030220f, 0.000000f, 0.000000f, 1.f};
+        m_boneTransform[24].position = {0.018187f, 0.000000f, 0.000000f, 1.f};
+
+        m_boneTransform[6].orientation = {0.644251f, 0.421979f, -0.478202f, 0.422133f};
+        m_boneTransform[11].orientation = {0.546723f, 0.541277f, -0.442520f, 0.460749f};
+        m_boneTransform[16].orientation = {0.516692f, 0.550144f, -0.495548f, 0.429888f};
+    } else {
+        m_boneTransform[2].position = {0.012330f, 0.028661f, 0.025049f, 1.f};
+        m_boneTransform[3].position = {-0.040406f, -0.000000f, 0.000000f, 1.f};
+        m_boneTransform[4].position = {-0.032517f, -0.000000f, -0.000000f, 1.f};
+
+        m_boneTransform[6].position = {-0.000632f, 0.026866f, 0.015002f, 1.f};
+        m_boneTransform[7].position = {-0.074204f, 0.005002f, -0.000234f, 1.f};
+        m_boneTransform[8].position = {-0.043930f, 0.000000f, 0.000000f, 1.f};
+        m_boneTransform[9].position = {-0.028695f, -0.000000f, -0.000000f, 1.f};
+
+        m_boneTransform[11].position = {-0.002177f, 0.007120f, 0.016319f, 1.f};
+        m_boneTransform[12].position = {-0.070953f, -0.000779f, -0.000997f, 1.f};
+        m_boneTransform[13].position = {-0.043108f, -0.000000f, -0.000000f, 1.f};
+        m_boneTransform[14].position = {-0.033266f, -0.000000f, -0.000000f, 1.f};
+
+        m_boneTransform[16].position = {-0.000513f, -0.006545f, 0.016348f, 1.f};
+        m_boneTransform[17].position = {-0.065876f, -0.001786f, -0.000693f, 1.f};
+        m_boneTransform[18].position = {-0.040697f, -0.000000f, -0.000000f, 1.f};
+        m_boneTransform[19].position = {-0.028747f, 0.000000f, 0.000000f, 1.f};
+
+        m_boneTransform[21].position = {0.002478f, -0.018981f, 0.015214f, 1.f};
+        m_boneTransform[22].position = {-0.062878f, -0.002844f, -0.000332f, 1.f};
+        m_boneTransform[23].position = {-0.030220f, -0.000000f, -0.000000f, 1.f};
+        m_boneTransform[24].position = {-0.018187f, -0.000000f, -0.000000f, 1.f};
+
+        m_boneTransform[6].orientation = {0.421833f, -0.643793f, 0.422458f, 0.478661f};
+        m_boneTransform[11].orientation = {0.541874f, -0.547427f, 0.459996f, 0.441701f};
+        m_boneTransform[16].orientation = {0.548983f, -0.519068f, 0.426914f, 0.496920f};
+    }
+
+    // Move the hand itself back to counteract the translation applied to the controller
+    // position. (more or less)
+    float bonePosFixer[3] = {0.025f, 0.f, 0.1f};
+    if (this->device_path == RIGHT_HAND_PATH)
+        bonePosFixer[0] = -bonePosFixer[0];
+    m_boneTransform[HSB_Wrist].position.v[0] =
+        m_boneTransform[HSB_Wrist].position.v[0] + bonePosFixer[0];
+    m_boneTransform[HSB_Wrist].position.v[1] =
+        m_boneTransform[HSB_Wrist].position.v[1] + bonePosFixer[1];
+    m_boneTransform[HSB_Wrist].position.v[2] =
+        m_boneTransform[HSB_Wrist].position.v[2] + bonePosFixer[2];
+
+    // Rotate thumb0 and pinky0 properly.
+    if (this->device_path == LEFT_HAND_PATH) {
+        vr::HmdQuaternion_t fixer = HmdQuaternion_Init(0.5, 0.5, -0.5, 0.5);
+        m_boneTransform[HSB_Thumb0].orientation =
+            QuatMultiply(&fixer, &m_boneTransform[HSB_Thumb0].orientation);
+        m_boneTransform[HSB_PinkyFinger0].orientation =
+            QuatMultiply(&fixer, &m_boneTransform[HSB_PinkyFinger0].orientation);
+    } else {
+        vr::HmdQuaternion_t fixer = HmdQuaternion_Init(0.5, -0.5, 0.5, 0.5);
+        m_boneTransform[HSB_Thumb0].orientation =
+            QuatMultiply(&fixer, &m_boneTransform[HSB_Thumb0].orientation);
+        m_boneTransform[HSB_PinkyFinger0].orientation =
+            QuatMultiply(&fixer, &m_boneTransform[HSB_PinkyFinger0].orientation);
+    }
 
-        vr::VRServerDriverHost()->TrackedDevicePoseUpdated(
-            this->object_id, m_pose, sizeof(vr::DriverPose_t));
+    vr::VRDriverInput()->UpdateSkeletonComponent(
+        m_compSkeleton, vr::VRSkeletalMotionRange_WithController, m_boneTransform, HSB_Count);
+    vr::VRDriverInput()->UpdateSkeletonComponent(m_compSkeleton,
+                                                 vr::VRSkeletalMotionRange_WithoutController,
+                                                 m_boneTransform,
+                                                 HSB_Count);
+}
+
+void OvrController::UpdateControllerSkeleton(const TrackingInfo::Controller &c,
+                                             uint64_t lastPoseTouch) {
+    vr::VRBoneTransform_t boneTransforms[SKELETON_BONE_COUNT];
+
+    // Perform whatever logic is necessary to convert your device's input into a skeletal
+    // pose, first to create a pose "With Controller", that is as close to the pose of the
+    // user's real hand as possible
+    GetBoneTransform(true,
+                     this->device_path == LEFT_HAND_PATH,
+                     m_thumbAnimationProgress,
+                     m_indexAnimationProgress,
+                     lastPoseTouch,
+                     c,
+                     boneTransforms);
+
+    // Then update the WithController pose on the component with those transforms
+    vr::EVRInputError err = vr::VRDriverInput()->UpdateSkeletonComponent(
+        m_compSkeleton,
+        vr::VRSkeletalMotionRange_WithController,
+        boneTransforms,
+        SKELETON_BONE_COUNT);
+    if (err != vr::VRInputError_None) {
+        // Handle failure case
+        Debug("UpdateSkeletonComponentfailed.  Error: %i\n", err);
     }
 
-    return false;
+    GetBoneTransform(false,
+                     this->device_path == LEFT_HAND_PATH,
+                     m_thumbAnimationProgress,
+                     m_indexAnimationProgress,
+                     lastPoseTouch,
+                     c,
+                     boneTransforms);
+
+    // Then update the WithoutController pose on the component
+    err = vr::VRDriverInput()->UpdateSkeletonComponent(
+        m_compSkeleton,
+        vr::VRSkeletalMotionRange_WithoutController,
+        boneTransforms,
+        SKELETON_BONE_COUNT);
+    if (err != vr::VRInputError_None) {
+        // Handle failure case
+        Debug("UpdateSkeletonComponentfailed.  Error: %i\n", err);
+    }
 }
 
 void GetThumbBoneTransform(bool withController,
@@ -2567,8 +2540,8 @@ void OvrController::GetBoneTransform(bool withController,
                                      const TrackingInfo::Controller &c,
                                      vr::VRBoneTransform_t outBoneTransform[]) {
 
-    vr::VRBoneTransform_t boneTransform1[SKELETON_BONE_COUNT];
-    vr::VRBoneTransform_t boneTransform2[SKELETON_BONE_COUNT];
+    // Zeroed, the blends read whole groups of four bones
+    SkeletonBones bones = {};
 
     // root and wrist
     outBoneTransform[0] = {{0.000000f, 0.000000f, 0.000000f, 1},
@@ -2582,61 +2555,36 @@ void OvrController::GetBoneTransform(bool withController,
     }
 
     // thumb
-    GetThumbBoneTransform(withController, isLeftHand, lastPoseButtons, boneTransform1);
-    GetThumbBoneTransform(withController, isLeftHand, c.buttons, boneTransform2);
-    for (int boneIdx = 2; boneIdx < 6; boneIdx++) {
-        outBoneTransform[boneIdx].position = Lerp(boneTransform1[boneIdx].position,
-                                                  boneTransform2[boneIdx].position,
-                                                  thumbAnimationProgress);
-        outBoneTransform[boneIdx].orientation = Slerp(boneTransform1[boneIdx].orientation,
-                                                      boneTransform2[boneIdx].orientation,
-                                                      thumbAnimationProgress);
-    }
+    BlendThumbPoses(withController,
+                    isLeftHand,
+                    lastPoseButtons,
+                    c.buttons,
+                    thumbAnimationProgress,
+                    bones);
 
     // trigger (index to pinky)
     if (c.triggerValue > 0) {
-        GetTriggerBoneTransform(
-            withController, isLeftHand, ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH), boneTransform1);
-        GetTriggerBoneTransform(
-            withController, isLeftHand, ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK), boneTransform2);
-        for (int boneIdx = 6; boneIdx < SKELETON_BONE_COUNT; boneIdx++) {
-            outBoneTransform[boneIdx].position = Lerp(
-                boneTransform1[boneIdx].position, boneTransform2[boneIdx].position, c.triggerValue);
-            outBoneTransform[boneIdx].orientation = Slerp(boneTransform1[boneIdx].orientation,
-                                                          boneTransform2[boneIdx].orientation,
-                                                          c.triggerValue);
-        }
+        BlendTriggerPoses(withController,
+                          isLeftHand,
+                          ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH),
+                          ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK),
+                          c.triggerValue,
+                          bones);
     } else {
-        GetTriggerBoneTransform(withController, isLeftHand, lastPoseButtons, boneTransform1);
-        GetTriggerBoneTransform(withController, isLeftHand, c.buttons, boneTransform2);
-        for (int boneIdx = 6; boneIdx < SKELETON_BONE_COUNT; boneIdx++) {
-            outBoneTransform[boneIdx].position = Lerp(boneTransform1[boneIdx].position,
-                                                      boneTransform2[boneIdx].position,
-                                                      indexAnimationProgress);
-            outBoneTransform[boneIdx].orientation = Slerp(boneTransform1[boneIdx].orientation,
-                                                          boneTransform2[boneIdx].orientation,
-                                                          indexAnimationProgress);
-        }
+        BlendTriggerPoses(withController,
+                          isLeftHand,
+                          lastPoseButtons,
+                          c.buttons,
+                          indexAnimationProgress,
+                          bones);
     }
 
     // grip (middle to pinky)
     if (c.gripValue > 0) {
-        GetGripClickBoneTransform(withController, isLeftHand, boneTransform2);
-        for (int boneIdx = 11; boneIdx < 26; boneIdx++) {
-            outBoneTransform[boneIdx].position = Lerp(
-                outBoneTransform[boneIdx].position, boneTransform2[boneIdx].position, c.gripValue);
-            outBoneTransform[boneIdx].orientation = Slerp(outBoneTransform[boneIdx].orientation,
-                                                          boneTransform2[boneIdx].orientation,
-                                                          c.gripValue);
-        }
-        for (int boneIdx = 28; boneIdx < SKELETON_BONE_COUNT; boneIdx++) {
-            outBoneTransform[boneIdx].position = Lerp(
-                outBoneTransform[boneIdx].position, boneTransform2[boneIdx].position, c.gripValue);
-            outBoneTransform[boneIdx].orientation = Slerp(outBoneTransform[boneIdx].orientation,
-                                                          boneTransform2[boneIdx].orientation,
-                                                          c.gripValue);
-        }
+        BlendGripClickPose(withController, isLeftHand, c.gripValue, bones);
     }
+
+    bones.Store(outBoneTransform, 2, SKELETON_BONE_COUNT);
 }
 
 std::string OvrController::GetSerialNumber() {
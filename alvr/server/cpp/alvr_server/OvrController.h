@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ALVR-common/packet_types.h"
+#include "PosePredictor.h"
 #include "TrackedDevice.h"
 #include "openvr_driver.h"
 
@@ -34,7 +35,10 @@ class OvrController : public TrackedDevice, public vr::ITrackedDeviceServerDrive
 
     vr::VRInputComponentHandle_t getHapticComponent();
 
-    bool onPoseUpdate(const TrackingInfo::Controller &c);
+    // sampleTimeNs is the targetTimestampNs of the tracking sample. Updates the pose and the
+    // inputs, the pose is sent to SteamVR by PublishPose. Returns false if not activated.
+    bool onPoseUpdate(const TrackingInfo::Controller &c, uint64_t sampleTimeNs);
+    void PublishPose();
     std::string GetSerialNumber();
 
     void GetBoneTransform(bool withController,
@@ -46,10 +50,14 @@ class OvrController : public TrackedDevice, public vr::ITrackedDeviceServerDrive
                           vr::VRBoneTransform_t outBoneTransform[]);
 
   private:
+    void UpdateHandSkeleton(const TrackingInfo::Controller &c);
+    void UpdateControllerSkeleton(const TrackingInfo::Controller &c, uint64_t lastPoseTouch);
+
     static const int SKELETON_BONE_COUNT = 31;
     static const int ANIMATION_FRAME_COUNT = 15;
 
     float *m_poseTimeOffset;
+    PosePredictor m_predictor;
 
     vr::VRInputComponentHandle_t m_handles[ALVR_INPUT_COUNT];
     vr::VRInputComponentHandle_t m_compHaptic;
@@ -96,4 +104,6 @@ class OvrController : public TrackedDevice, public vr::ITrackedDeviceServerDrive
     float m_indexAnimationProgress = 0;
     uint64_t m_lastThumbTouch = 0;
     uint64_t m_lastIndexTouch = 0;
+    // GetTimestampUs() of the last skeleton update
+    uint64_t m_lastSkeletonUs = 0;
 };
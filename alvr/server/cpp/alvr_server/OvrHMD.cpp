@@ -2,12 +2,14 @@
 
 #include "ClientConnection.h"
 #include "Logger.h"
+#include "MotionHint.h"
 #include "OvrController.h"
 #include "OvrViveTrackerProxy.h"
 #include "Paths.h"
 #include "PoseHistory.h"
 #include "Settings.h"
 #include "Utils.h"
+#include "TrackingThread.h"
 #include "VSyncThread.h"
 #include "bindings.h"
 #include <cfloat>
@@ -18,6 +20,7 @@
 #include "platform/macos/CEncoder.h"
 #else
 #include "platform/linux/CEncoder.h"
+#include "platform/linux/EncodePipeline.h"
 #endif
 
 const vr::HmdMatrix34_t MATRIX_IDENTITY = {
@@ -114,6 +117,11 @@ OvrHmd::~OvrHmd() {
         m_encoder.reset();
     }
 
+    if (m_trackingThread) {
+        m_trackingThread->Shutdown();
+        m_trackingThread.reset();
+    }
+
     if (m_Listener) {
         Debug("OvrHmd::~OvrHmd(): Stopping network...\n");
         m_Listener.reset();
@@ -140,58 +148,43 @@ vr::EVRInitError OvrHmd::Activate(vr::TrackedDeviceIndex_t unObjectId) {
     this->object_id = unObjectId;
     this->prop_container = vr::VRProperties()->TrackedDeviceToPropertyContainer(this->object_id);
 
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_TrackingSystemName_String,
-                                          Settings::Instance().mTrackingSystemName.c_str());
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_ModelNumber_String,
-                                          Settings::Instance().mModelNumber.c_str());
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_ManufacturerName_String,
-                                          Settings::Instance().mManufacturerName.c_str());
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_RenderModelName_String,
-                                          Settings::Instance().mRenderModelName.c_str());
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_RegisteredDeviceType_String,
-                                          Settings::Instance().mRegisteredDeviceType.c_str());
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_DriverVersion_String,
-                                          Settings::Instance().mDriverVersion.c_str());
-    vr::VRProperties()->SetFloatProperty(
-        this->prop_container, vr::Prop_UserIpdMeters_Float, Settings::Instance().m_flIPD);
-    vr::VRProperties()->SetFloatProperty(
-        this->prop_container, vr::Prop_UserHeadToEyeDepthMeters_Float, 0.f);
-    vr::VRProperties()->SetFloatProperty(this->prop_container,
-                                         vr::Prop_DisplayFrequency_Float,
-                                         static_cast<float>(Settings::Instance().m_refreshRate));
-    vr::VRProperties()->SetFloatProperty(
-        this->prop_container, vr::Prop_SecondsFromVsyncToPhotons_Float, 0.);
-    // vr::VRProperties()->SetFloatProperty(this->prop_container,
-    // vr::Prop_SecondsFromVsyncToPhotons_Float,
+    PropertyBatch props;
+    props.SetStringProperty(
+        vr::Prop_TrackingSystemName_String, Settings::Instance().mTrackingSystemName.c_str());
+    props.SetStringProperty(vr::Prop_ModelNumber_String, Settings::Instance().mModelNumber.c_str());
+    props.SetStringProperty(
+        vr::Prop_ManufacturerName_String, Settings::Instance().mManufacturerName.c_str());
+    props.SetStringProperty(
+        vr::Prop_RenderModelName_String, Settings::Instance().mRenderModelName.c_str());
+    props.SetStringProperty(
+        vr::Prop_RegisteredDeviceType_String, Settings::Instance().mRegisteredDeviceType.c_str());
+    props.SetStringProperty(
+        vr::Prop_DriverVersion_String, Settings::Instance().mDriverVersion.c_str());
+    props.SetFloatProperty(vr::Prop_UserIpdMeters_Float, Settings::Instance().m_flIPD);
+    props.SetFloatProperty(vr::Prop_UserHeadToEyeDepthMeters_Float, 0.f);
+    props.SetFloatProperty(
+        vr::Prop_DisplayFrequency_Float, static_cast<float>(Settings::Instance().m_refreshRate));
+    props.SetFloatProperty(vr::Prop_SecondsFromVsyncToPhotons_Float, 0.);
+    // props.SetFloatProperty(vr::Prop_SecondsFromVsyncToPhotons_Float,
     // Settings::Instance().m_flSecondsFromVsyncToPhotons);
 
     // return a constant that's not 0 (invalid) or 1 (reserved for Oculus)
-    vr::VRProperties()->SetUint64Property(
-        this->prop_container, vr::Prop_CurrentUniverseId_Uint64, Settings::Instance().m_universeId);
+    props.SetUint64Property(vr::Prop_CurrentUniverseId_Uint64, Settings::Instance().m_universeId);
 
 #ifdef _WIN32
     // avoid "not fullscreen" warnings from vrmonitor
-    vr::VRProperties()->SetBoolProperty(this->prop_container, vr::Prop_IsOnDesktop_Bool, false);
+    props.SetBoolProperty(vr::Prop_IsOnDesktop_Bool, false);
 
     // Manually send VSync events on direct mode.
     // ref:https://github.com/ValveSoftware/virtual_display/issues/1
-    vr::VRProperties()->SetBoolProperty(
-        this->prop_container, vr::Prop_DriverDirectModeSendsVsyncEvents_Bool, true);
+    props.SetBoolProperty(vr::Prop_DriverDirectModeSendsVsyncEvents_Bool, true);
 #endif
 
     // Set battery as true
-    vr::VRProperties()->SetBoolProperty(
-        this->prop_container, vr::Prop_DeviceProvidesBatteryStatus_Bool, true);
+    props.SetBoolProperty(vr::Prop_DeviceProvidesBatteryStatus_Bool, true);
 
     // Use proximity sensor
-    vr::VRProperties()->SetBoolProperty(
-        this->prop_container, vr::Prop_ContainsProximitySensor_Bool, true);
+    props.SetBoolProperty(vr::Prop_ContainsProximitySensor_Bool, true);
     vr::VRDriverInput()->CreateBooleanComponent(this->prop_container, "/proximity", &m_proximity);
 
 #ifdef _WIN32
@@ -205,24 +198,18 @@ vr::EVRInitError OvrHmd::Activate(vr::TrackedDeviceIndex_t unObjectId) {
     HmdMatrix_SetIdentity(&m_eyeToHeadRight);
 
     // set the icons in steamvr to the default icons used for Oculus Link
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_NamedIconPathDeviceOff_String,
-                                          "{oculus}/icons/quest_headset_off.png");
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_NamedIconPathDeviceSearching_String,
-                                          "{oculus}/icons/quest_headset_searching.gif");
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_NamedIconPathDeviceSearchingAlert_String,
-                                          "{oculus}/icons/quest_headset_alert_searching.gif");
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_NamedIconPathDeviceReady_String,
-                                          "{oculus}/icons/quest_headset_ready.png");
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_NamedIconPathDeviceReadyAlert_String,
-                                          "{oculus}/icons/quest_headset_ready_alert.png");
-    vr::VRProperties()->SetStringProperty(this->prop_container,
-                                          vr::Prop_NamedIconPathDeviceStandby_String,
-                                          "{oculus}/icons/quest_headset_standby.png");
+    props.SetStringProperty(
+        vr::Prop_NamedIconPathDeviceOff_String, "{oculus}/icons/quest_headset_off.png");
+    props.SetStringProperty(
+        vr::Prop_NamedIconPathDeviceSearching_String, "{oculus}/icons/quest_headset_searching.gif");
+    props.SetStringProperty(vr::Prop_NamedIconPathDeviceSearchingAlert_String,
+                            "{oculus}/icons/quest_headset_alert_searching.gif");
+    props.SetStringProperty(
+        vr::Prop_NamedIconPathDeviceReady_String, "{oculus}/icons/quest_headset_ready.png");
+    props.SetStringProperty(vr::Prop_NamedIconPathDeviceReadyAlert_String,
+                            "{oculus}/icons/quest_headset_ready_alert.png");
+    props.SetStringProperty(
+        vr::Prop_NamedIconPathDeviceStandby_String, "{oculus}/icons/quest_headset_standby.png");
 
     // Disable async reprojection on Linux. Windows interface uses IVRDriverDirectModeComponent
     // which never applies reprojection
@@ -234,6 +221,8 @@ vr::EVRInitError OvrHmd::Activate(vr::TrackedDeviceIndex_t unObjectId) {
         vr::k_pch_SteamVR_Section, vr::k_pch_SteamVR_EnableLinuxVulkanAsync_Bool, Settings::Instance().m_enableLinuxVulkanAsync);
     #endif
 
+    write_activation_props(props);
+
     if (!m_baseComponentsInitialized) {
         m_baseComponentsInitialized = true;
 
@@ -269,6 +258,10 @@ vr::EVRInitError OvrHmd::Activate(vr::TrackedDeviceIndex_t unObjectId) {
 
             m_directModeComponent =
                 std::make_shared<OvrDirectModeComponent>(m_D3DRender, m_poseHistory);
+
+            PrepareEncoder();
+#elif !defined(__APPLE__)
+            alvr::EncodePipeline::Prewarm();
 #endif
         }
 
@@ -358,19 +351,28 @@ void OvrHmd::OnPoseUpdated(TrackingInfo info) {
 
         m_TrackingInfo = info;
 
-        // TODO: Right order?
-
+        // The whole sample is converted to device poses first, then they are sent to SteamVR
+        // back to back
+        bool controllerUpdated[2] = {false, false};
         if (!Settings::Instance().m_disableController) {
-            updateController(info);
+            updateController(info, controllerUpdated);
         }
+        vr::DriverPose_t pose = GetPose();
 
         m_poseHistory->OnPoseUpdated(info);
+        m_Listener->m_idleController.OnTracking(info.mounted == 1);
+
+        if (controllerUpdated[0])
+            m_leftController->PublishPose();
+        if (controllerUpdated[1])
+            m_rightController->PublishPose();
 
         vr::VRServerDriverHost()->TrackedDevicePoseUpdated(
-            this->object_id, GetPose(), sizeof(vr::DriverPose_t));
+            this->object_id, pose, sizeof(vr::DriverPose_t));
 
+        // Mirrors the HMD
         if (m_viveTrackerProxy != nullptr)
-            m_viveTrackerProxy->update();
+            m_viveTrackerProxy->update(pose);
     }
 }
 
@@ -379,29 +381,45 @@ void OvrHmd::StartStreaming() {
         return;
     }
 
-    // create listener
-    m_Listener.reset(new ClientConnection());
+    // create listener, unless the encoder was prepared with it at activation
+    if (!m_Listener) {
+        m_Listener.reset(new ClientConnection());
+    } else {
+        m_Listener->ApplySettings();
+    }
+
+    m_trackingThread = std::make_shared<TrackingThread>(this);
+    m_trackingThread->Start();
 
     // Spin up a separate thread to handle the overlapped encoding/transmit step.
     if (IsHMD()) {
 #ifdef _WIN32
-        m_encoder = std::make_shared<CEncoder>();
-        try {
-            m_encoder->Initialize(m_D3DRender, m_Listener);
-        } catch (Exception e) {
-            Error("Your GPU does not meet the requirements for video encoding. %s %s\n%s %s\n",
-                  "If you get this error after changing some settings, you can revert them by",
-                  "deleting the file \"session.json\" in the installation folder.",
-                  "Failed to initialize CEncoder:",
-                  e.what());
+        if (m_encoder && !m_encoder->MatchesSettings()) {
+            Info("CEncoder: Encoding settings changed since activation, recreating the encoder.\n");
+            m_encoder.reset();
+        }
+        if (!m_encoder) {
+            m_encoder = std::make_shared<CEncoder>();
+            try {
+                m_encoder->Initialize(m_D3DRender, m_Listener);
+            } catch (Exception e) {
+                Error("Your GPU does not meet the requirements for video encoding. %s %s\n%s %s\n",
+                      "If you get this error after changing some settings, you can revert them by",
+                      "deleting the file \"session.json\" in the installation folder.",
+                      "Failed to initialize CEncoder:",
+                      e.what());
+            }
         }
         m_encoder->Start();
 
         m_directModeComponent->SetEncoder(m_encoder);
+        m_directModeComponent->SetListener(m_Listener);
+        m_VSyncThread->SetListener(m_Listener);
 
         m_encoder->OnStreamStart();
 #elif __APPLE__
-        m_encoder = std::make_shared<CEncoder>();
+        m_encoder = std::make_shared<CEncoder>(m_Listener, m_poseHistory);
+        m_encoder->Start();
 #else
         // This has to be set after initialization is done, because something in vrcompositor is
         // setting it to 90Hz in the meantime
@@ -417,8 +435,26 @@ void OvrHmd::StartStreaming() {
     m_streamComponentsInitialized = true;
 }
 
+#ifdef _WIN32
+void OvrHmd::PrepareEncoder() {
+    // Creating the encoder session takes a noticeable part of the time to first frame, do it while
+    // no client is connected. StartStreaming() keeps it when the settings did not change.
+    m_Listener.reset(new ClientConnection());
+
+    auto encoder = std::make_shared<CEncoder>();
+    try {
+        encoder->Initialize(m_D3DRender, m_Listener);
+        m_encoder = encoder;
+    } catch (Exception e) {
+        // Retried on connection, which reports the error
+        Warn("CEncoder: Cannot prepare the encoder before the client connects: %s\n", e.what());
+    }
+}
+#endif
+
 void OvrHmd::SetViewsConfig(ViewsConfigData config) {
     this->views_config = config;
+    SetStereoIpd(config.ipd_m);
 
     auto left_transform = MATRIX_IDENTITY;
     left_transform.m[0][3] = -config.ipd_m / 2.0;
@@ -436,7 +472,7 @@ void OvrHmd::SetViewsConfig(ViewsConfigData config) {
         object_id, vr::VREvent_LensDistortionChanged, {}, 0);
 }
 
-void OvrHmd::updateController(const TrackingInfo &info) {
+void OvrHmd::updateController(const TrackingInfo &info, bool updated[2]) {
     // Update controller
 
     if (Settings::Instance().m_serversidePrediction)
@@ -445,10 +481,10 @@ void OvrHmd::updateController(const TrackingInfo &info) {
         m_poseTimeOffset = Settings::Instance().m_controllerPoseOffset;
 
     if (info.controller[0].enabled) {
-        m_leftController->onPoseUpdate(info.controller[0]);
+        updated[0] = m_leftController->onPoseUpdate(info.controller[0], info.targetTimestampNs);
     }
     if (info.controller[1].enabled) {
-        m_rightController->onPoseUpdate(info.controller[1]);
+        updated[1] = m_rightController->onPoseUpdate(info.controller[1], info.targetTimestampNs);
     }
 }
 
@@ -10,6 +10,7 @@
 
 class ClientConnection;
 class VSyncThread;
+class TrackingThread;
 
 class OvrController;
 class OvrController;
@@ -44,7 +45,8 @@ class OvrHmd : public TrackedDevice,
 
     void OnStreamStart();
 
-    void updateController(const TrackingInfo &info);
+    // updated[i] is set for the controllers whose pose is to be published
+    void updateController(const TrackingInfo &info, bool updated[2]);
 
     void SetViewsConfig(ViewsConfigData config);
 
@@ -64,6 +66,8 @@ class OvrHmd : public TrackedDevice,
     virtual vr::DistortionCoordinates_t ComputeDistortion(vr::EVREye eEye, float fU, float fV);
 
     std::shared_ptr<ClientConnection> m_Listener;
+    // Applies the received tracking, created with the listener
+    std::shared_ptr<TrackingThread> m_trackingThread;
     float m_poseTimeOffset;
 
     vr::VRInputComponentHandle_t m_proximity;
@@ -75,6 +79,11 @@ class OvrHmd : public TrackedDevice,
 
     TrackingInfo m_TrackingInfo;
   private:
+#ifdef _WIN32
+    // Initializes the encoder ahead of the first connection
+    void PrepareEncoder();
+#endif
+
     ViewsConfigData views_config;
 
     bool m_baseComponentsInitialized;
@@ -39,5 +39,6 @@ public:
     
 	virtual vr::DriverPose_t GetPose() override;
 
-    void update();
+    // pose of the HMD for the same tracking sample
+    void update(const vr::DriverPose_t &pose);
 };
\ No newline at end of file
@@ -1,76 +1,249 @@
 #include "PoseHistory.h"
 #include "Utils.h"
 #include "Logger.h"
-#include <mutex>
+#include <math.h>
 #include <optional>
+#include <string.h>
+
+PoseHistory::PoseHistory()
+	: m_sequences(new std::atomic<uint64_t>[HISTORY_CAPACITY])
+	, m_rotations(new HeadRotation[HISTORY_CAPACITY])
+	, m_timestamps(new uint64_t[HISTORY_CAPACITY])
+	, m_infos(new TrackingInfo[HISTORY_CAPACITY])
+	, m_rotationIndex(new std::atomic<uint64_t>[INDEX_SIZE])
+	, m_timestampIndex(new std::atomic<uint64_t>[INDEX_SIZE])
+{
+	for (uint64_t i = 0; i < HISTORY_CAPACITY; i++) {
+		m_sequences[i] = 0;
+	}
+	for (uint64_t i = 0; i < INDEX_SIZE; i++) {
+		m_rotationIndex[i] = 0;
+		m_timestampIndex[i] = 0;
+	}
+}
+
+PoseHistory::HeadRotation PoseHistory::ToHeadRotation(const vr::HmdMatrix34_t &matrix)
+{
+	HeadRotation rotation;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			rotation.m[i][j] = matrix.m[i][j];
+		}
+	}
+	return rotation;
+}
+
+void PoseHistory::QuantizeRotation(const HeadRotation &rotation, QuantizedRotation &out)
+{
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			out[i * 3 + j] = (int32_t)lroundf(rotation.m[j][i] * ROTATION_QUANTIZATION);
+		}
+	}
+}
+
+uint64_t PoseHistory::HashRotation(const QuantizedRotation &rotation)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i = 0; i < 9; i++) {
+		hash = (hash ^ (uint32_t)rotation[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+uint64_t PoseHistory::HashTimestamp(uint64_t timestampNs)
+{
+	// splitmix64 finalizer, timestamps are too regular to be used as is
+	timestampNs = (timestampNs ^ (timestampNs >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	timestampNs = (timestampNs ^ (timestampNs >> 27)) * 0x94d049bb133111ebULL;
+	return timestampNs ^ (timestampNs >> 31);
+}
 
 void PoseHistory::OnPoseUpdated(const TrackingInfo &info) {
-	// Put pose history buffer
-	TrackingHistoryFrame history;
-	history.info = info;
+	uint64_t index = m_poseCount.load(std::memory_order_relaxed);
+	if (index != 0 && m_lastTargetTimestampNs == info.targetTimestampNs) {
+		// Same track info
+		return;
+	}
+	m_lastTargetTimestampNs = info.targetTimestampNs;
 
+	const uint64_t slot = index % HISTORY_CAPACITY;
+	uint64_t sequence = 2 * (index + 1);
 
+	vr::HmdMatrix34_t rotationMatrix;
 	HmdMatrix_QuatToMat(info.HeadPose_Pose_Orientation.w,
 		info.HeadPose_Pose_Orientation.x,
 		info.HeadPose_Pose_Orientation.y,
 		info.HeadPose_Pose_Orientation.z,
-		&history.rotationMatrix);
+		&rotationMatrix);
 
 	Debug("Rotation Matrix=(%f, %f, %f, %f) (%f, %f, %f, %f) (%f, %f, %f, %f)\n"
-		, history.rotationMatrix.m[0][0], history.rotationMatrix.m[0][1], history.rotationMatrix.m[0][2], history.rotationMatrix.m[0][3]
-		, history.rotationMatrix.m[1][0], history.rotationMatrix.m[1][1], history.rotationMatrix.m[1][2], history.rotationMatrix.m[1][3]
-		, history.rotationMatrix.m[2][0], history.rotationMatrix.m[2][1], history.rotationMatrix.m[2][2], history.rotationMatrix.m[2][3]);
+		, rotationMatrix.m[0][0], rotationMatrix.m[0][1], rotationMatrix.m[0][2], rotationMatrix.m[0][3]
+		, rotationMatrix.m[1][0], rotationMatrix.m[1][1], rotationMatrix.m[1][2], rotationMatrix.m[1][3]
+		, rotationMatrix.m[2][0], rotationMatrix.m[2][1], rotationMatrix.m[2][2], rotationMatrix.m[2][3]);
 
-	std::unique_lock<std::mutex> lock(m_mutex);
-	if (m_poseBuffer.size() == 0) {
-		m_poseBuffer.push_back(history);
-	}
-	else {
-		if (m_poseBuffer.back().info.targetTimestampNs != info.targetTimestampNs) {
-			// New track info
-			m_poseBuffer.push_back(history);
-		}
-	}
-        // The value should match with the client's MAXIMUM_TRACKING_FRAMES in ovr_context.cpp
-	if (m_poseBuffer.size() > 120 * 3) {
-		m_poseBuffer.pop_front();
+	// Mark the slot as being written before touching its entries.
+	m_sequences[slot].store(sequence - 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	// Put pose history buffer
+	m_rotations[slot] = ToHeadRotation(rotationMatrix);
+	m_timestamps[slot] = info.targetTimestampNs;
+	m_infos[slot] = info;
+
+	m_sequences[slot].store(sequence, std::memory_order_release);
+	m_poseCount.store(index + 1, std::memory_order_release);
+
+	QuantizedRotation rotation;
+	QuantizeRotation(m_rotations[slot], rotation);
+	m_rotationIndex[HashRotation(rotation) & (INDEX_SIZE - 1)].store(index + 1, std::memory_order_release);
+	m_timestampIndex[HashTimestamp(info.targetTimestampNs) & (INDEX_SIZE - 1)].store(index + 1, std::memory_order_release);
+}
+
+template <typename F>
+bool PoseHistory::ReadPose(uint64_t index, F &&read) const
+{
+	const uint64_t slot = index % HISTORY_CAPACITY;
+	uint64_t sequence = 2 * (index + 1);
+
+	if (m_sequences[slot].load(std::memory_order_acquire) != sequence) {
+		// Being written or already replaced by a newer pose
+		return false;
 	}
+	read(slot);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return m_sequences[slot].load(std::memory_order_relaxed) == sequence;
 }
 
-std::optional<PoseHistory::TrackingHistoryFrame> PoseHistory::GetBestPoseMatch(const vr::HmdMatrix34_t &pose) const
+bool PoseHistory::ReadFrame(uint64_t index, TrackingHistoryFrame &frame) const
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
-	float minDiff = 100000;
-	auto minIt = m_poseBuffer.begin();
-	for (auto it = m_poseBuffer.begin(); it != m_poseBuffer.end(); ++it) {
-		float distance = 0;
-		// Rotation matrix composes a part of ViewMatrix of TrackingInfo.
-		// Be carefull of transpose.
-		// And bottom side and right side of matrix should not be compared, because pPose does not contain that part of matrix.
+	return ReadPose(index, [&](uint64_t slot) {
+		frame.info = m_infos[slot];
+		const HeadRotation &rotation = m_rotations[slot];
 		for (int i = 0; i < 3; i++) {
 			for (int j = 0; j < 3; j++) {
-				distance += pow(it->rotationMatrix.m[j][i] - pose.m[j][i], 2);
+				frame.rotationMatrix.m[i][j] = rotation.m[i][j];
 			}
+			frame.rotationMatrix.m[i][3] = 0.f;
 		}
-		//LogDriver("diff %f %llu", distance, it->info.FrameIndex);
-		if (minDiff > distance) {
-			minIt = it;
-			minDiff = distance;
+	});
+}
+
+std::optional<PoseHistory::TrackingHistoryFrame> PoseHistory::GetBestPoseMatch(const vr::HmdMatrix34_t &pose) const
+{
+	QuantizedRotation rotation;
+	QuantizeRotation(ToHeadRotation(pose), rotation);
+
+	uint64_t entry = m_rotationIndex[HashRotation(rotation) & (INDEX_SIZE - 1)].load(std::memory_order_acquire);
+	if (entry != 0) {
+		HeadRotation stored;
+		if (ReadPose(entry - 1, [&](uint64_t slot) { stored = m_rotations[slot]; })) {
+			QuantizedRotation storedRotation;
+			QuantizeRotation(stored, storedRotation);
+			TrackingHistoryFrame frame;
+			if (memcmp(rotation, storedRotation, sizeof(QuantizedRotation)) == 0 && ReadFrame(entry - 1, frame)) {
+				return frame;
+			}
 		}
 	}
-	if (minIt != m_poseBuffer.end()) {
-		return *minIt;
+
+	return ScanBestPoseMatch(pose);
+}
+
+std::optional<PoseHistory::TrackingHistoryFrame> PoseHistory::ScanBestPoseMatch(const vr::HmdMatrix34_t &pose) const
+{
+	const HeadRotation target = ToHeadRotation(pose);
+
+	// The best pose can only get overwritten if the writer went around the whole ring during the
+	// search. Retry a few times in that case.
+	for (int attempt = 0; attempt < 3; attempt++) {
+		uint64_t count = m_poseCount.load(std::memory_order_acquire);
+		uint64_t oldest = count > HISTORY_CAPACITY ? count - HISTORY_CAPACITY : 0;
+
+		float minDiff = 100000;
+		std::optional<uint64_t> minIndex;
+		for (uint64_t index = oldest; index < count; index++) {
+			HeadRotation rotation;
+			if (!ReadPose(index, [&](uint64_t slot) { rotation = m_rotations[slot]; })) {
+				continue;
+			}
+
+			float distance = 0;
+			// Rotation matrix composes a part of ViewMatrix of TrackingInfo.
+			// Be carefull of transpose.
+			// And bottom side and right side of matrix should not be compared, because pPose does not contain that part of matrix.
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) {
+					float diff = rotation.m[j][i] - target.m[j][i];
+					distance += diff * diff;
+				}
+			}
+			//LogDriver("diff %f %llu", distance, it->info.FrameIndex);
+			if (minDiff > distance) {
+				minIndex = index;
+				minDiff = distance;
+			}
+		}
+		if (!minIndex) {
+			return {};
+		}
+
+		TrackingHistoryFrame frame;
+		if (ReadFrame(*minIndex, frame)) {
+			return frame;
+		}
 	}
 	return {};
 }
 
 std::optional<PoseHistory::TrackingHistoryFrame> PoseHistory::GetPoseAt(uint64_t client_timestamp_ns) const
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
-	for (auto it = m_poseBuffer.rbegin(), end = m_poseBuffer.rend() ; it != end ; ++it)
+	uint64_t entry = m_timestampIndex[HashTimestamp(client_timestamp_ns) & (INDEX_SIZE - 1)].load(std::memory_order_acquire);
+	if (entry != 0) {
+		TrackingHistoryFrame frame;
+		if (ReadFrame(entry - 1, frame) && frame.info.targetTimestampNs == client_timestamp_ns) {
+			return frame;
+		}
+	}
+
+	return ScanPoseAt(client_timestamp_ns);
+}
+
+std::optional<PoseHistory::TrackingHistoryFrame> PoseHistory::GetLatestPose() const
+{
+	// Only fails if the writer replaced the slot in the meantime, the newer one is then read
+	for (int attempt = 0; attempt < 3; attempt++) {
+		uint64_t count = m_poseCount.load(std::memory_order_acquire);
+		if (count == 0) {
+			return {};
+		}
+		TrackingHistoryFrame frame;
+		if (ReadFrame(count - 1, frame)) {
+			return frame;
+		}
+	}
+	return {};
+}
+
+std::optional<PoseHistory::TrackingHistoryFrame> PoseHistory::ScanPoseAt(uint64_t client_timestamp_ns) const
+{
+	uint64_t count = m_poseCount.load(std::memory_order_acquire);
+	uint64_t oldest = count > HISTORY_CAPACITY ? count - HISTORY_CAPACITY : 0;
+	for (uint64_t index = count; index-- > oldest;)
 	{
-		if (it->info.targetTimestampNs == client_timestamp_ns)
-			return *it;
+		uint64_t targetTimestampNs = 0;
+		if (!ReadPose(index, [&](uint64_t slot) { targetTimestampNs = m_timestamps[slot]; })) {
+			continue;
+		}
+		if (targetTimestampNs != client_timestamp_ns) {
+			continue;
+		}
+
+		TrackingHistoryFrame frame;
+		if (ReadFrame(index, frame)) {
+			return frame;
+		}
 	}
 	return {};
 }
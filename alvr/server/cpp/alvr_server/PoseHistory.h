@@ -1,11 +1,19 @@
 #pragma once
 
-#include <list>
-#include <mutex>
+#include <atomic>
+#include <memory>
 #include <openvr_driver.h>
 #include <optional>
 #include "ALVR-common/packet_types.h"
 
+// Fixed-capacity history of the poses sent to SteamVR.
+// OnPoseUpdated() must only be called from the tracking thread. The other methods can be called
+// from any thread: slots are read seqlock-style, so readers never block the writer or each other
+// and no pose allocates.
+// Lookups first go through direct-mapped indices keyed on the quantized rotation and on the
+// timestamp, the linear scan only runs when the index misses. The scans only touch contiguous
+// arrays of head rotations and timestamps, the full TrackingInfo with the controllers and bones is
+// kept apart and only copied for the pose found.
 class PoseHistory
 {
 public:
@@ -14,13 +22,63 @@ public:
 		vr::HmdMatrix34_t rotationMatrix;
 	};
 
+	PoseHistory();
+
 	void OnPoseUpdated(const TrackingInfo &info);
 
 	std::optional<TrackingHistoryFrame> GetBestPoseMatch(const vr::HmdMatrix34_t &pose) const;
 	// Return the most recent pose known at the given timestamp
 	std::optional<TrackingHistoryFrame> GetPoseAt(uint64_t client_timestamp_us) const;
+	// Return the last pose sent to SteamVR, for frames whose pose is not known
+	std::optional<TrackingHistoryFrame> GetLatestPose() const;
+
+	// The value should match with the client's MAXIMUM_TRACKING_FRAMES in ovr_context.cpp
+	static const uint64_t HISTORY_CAPACITY = 120 * 3;
 
 private:
-	mutable std::mutex m_mutex;
-	std::list<TrackingHistoryFrame> m_poseBuffer;
+	// Rotation part of TrackingHistoryFrame::rotationMatrix, the rest of it is zero
+	struct HeadRotation {
+		float m[3][3];
+	};
+
+	// Run read() on the slot of pose number index and return whether its entries were stable.
+	// read() must only copy data out, it can observe a torn entry when false is returned.
+	template <typename F>
+	bool ReadPose(uint64_t index, F &&read) const;
+	// Copy of the whole pose
+	bool ReadFrame(uint64_t index, TrackingHistoryFrame &frame) const;
+
+	static HeadRotation ToHeadRotation(const vr::HmdMatrix34_t &matrix);
+
+	typedef int32_t QuantizedRotation[9];
+	static void QuantizeRotation(const HeadRotation &rotation, QuantizedRotation &out);
+	static uint64_t HashRotation(const QuantizedRotation &rotation);
+	static uint64_t HashTimestamp(uint64_t timestampNs);
+
+	std::optional<TrackingHistoryFrame> ScanBestPoseMatch(const vr::HmdMatrix34_t &pose) const;
+	std::optional<TrackingHistoryFrame> ScanPoseAt(uint64_t client_timestamp_ns) const;
+
+	// Power of two, large enough to keep collisions between live poses rare.
+	static const uint64_t INDEX_SIZE = 4096;
+	// The rotation matrix SteamVR hands back is recomputed from the pose we sent, so it is only
+	// equal to the stored one up to rounding. Quantization steps are 1/4096.
+	static constexpr float ROTATION_QUANTIZATION = 4096.f;
+
+	// Pose number i lives in slot i % HISTORY_CAPACITY of each array. The sequence of a slot is
+	// 2 * (pose index + 1) once the pose is stored, odd while it is being written.
+	std::unique_ptr<std::atomic<uint64_t>[]> m_sequences;
+	std::unique_ptr<HeadRotation[]> m_rotations;
+	std::unique_ptr<uint64_t[]> m_timestamps;
+	// Only read for the pose found
+	std::unique_ptr<TrackingInfo[]> m_infos;
+	// Number of poses written so far
+	std::atomic<uint64_t> m_poseCount{0};
+
+	// Pose index + 1 of the latest pose with the bucket's key, 0 if empty. Entries can be stale or
+	// belong to a colliding key, lookups verify them against the slot.
+	std::unique_ptr<std::atomic<uint64_t>[]> m_rotationIndex;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_timestampIndex;
+
+	// Only accessed by the writer
+	uint64_t m_lastTargetTimestampNs = 0;
 };
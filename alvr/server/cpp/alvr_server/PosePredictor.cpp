@@ -0,0 +1,92 @@
+#include "PosePredictor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Utils.h"
+
+// Orientation after rotating `orientation` by the rotation vector `rotation`, in the tracking space
+static vr::HmdQuaternion_t Rotate(const vr::HmdQuaternion_t &orientation, const double rotation[3])
+{
+	double angle = sqrt(rotation[0] * rotation[0] + rotation[1] * rotation[1] + rotation[2] * rotation[2]);
+	if (angle < 1e-9) {
+		return orientation;
+	}
+
+	double s = sin(angle / 2) / angle;
+	double w = cos(angle / 2), x = rotation[0] * s, y = rotation[1] * s, z = rotation[2] * s;
+	const vr::HmdQuaternion_t &q = orientation;
+	vr::HmdQuaternion_t result = HmdQuaternion_Init(
+		w * q.w - x * q.x - y * q.y - z * q.z,
+		w * q.x + x * q.w + y * q.z - z * q.y,
+		w * q.y - x * q.z + y * q.w + z * q.x,
+		w * q.z + x * q.y - y * q.x + z * q.w);
+	return HmdQuaternion_Scale(&result, 1 / sqrt(HmdQuaternion_Norm(&result)));
+}
+
+PosePredictor::PosePredictor()
+{
+	Reset();
+}
+
+void PosePredictor::Reset()
+{
+	m_lastSampleNs = 0;
+	m_state = {};
+	m_state.orientation = HmdQuaternion_Init(1, 0, 0, 0);
+}
+
+void PosePredictor::Update(uint64_t sampleTimeNs,
+	const vr::HmdQuaternion_t &orientation,
+	const double position[3],
+	const double linearVelocity[3],
+	const double angularVelocity[3])
+{
+	double dt = (double)(int64_t)(sampleTimeNs - m_lastSampleNs) / 1e9;
+	bool restart = m_lastSampleNs == 0 || dt <= 0 || dt > MAX_SAMPLE_GAP;
+
+	m_lastSampleNs = sampleTimeNs;
+	m_state.orientation = orientation;
+	for (int i = 0; i < 3; i++) {
+		m_state.position[i] = position[i];
+
+		if (restart) {
+			m_state.linearVelocity[i] = linearVelocity[i];
+			m_state.angularVelocity[i] = angularVelocity[i];
+			m_state.linearAcceleration[i] = 0;
+			m_state.angularAcceleration[i] = 0;
+			continue;
+		}
+
+		double residual = linearVelocity[i] - (m_state.linearVelocity[i] + m_state.linearAcceleration[i] * dt);
+		m_state.linearVelocity[i] += m_state.linearAcceleration[i] * dt + VELOCITY_GAIN * residual;
+		m_state.linearAcceleration[i] += ACCELERATION_GAIN * residual / dt;
+
+		residual = angularVelocity[i] - (m_state.angularVelocity[i] + m_state.angularAcceleration[i] * dt);
+		m_state.angularVelocity[i] += m_state.angularAcceleration[i] * dt + VELOCITY_GAIN * residual;
+		m_state.angularAcceleration[i] += ACCELERATION_GAIN * residual / dt;
+	}
+}
+
+PosePredictor::State PosePredictor::Predict(double horizon, double linearScale, double angularScale) const
+{
+	double t = std::clamp(horizon, 0.0, MAX_HORIZON);
+
+	State predicted = m_state;
+	double rotation[3];
+	for (int i = 0; i < 3; i++) {
+		predicted.linearVelocity[i] *= linearScale;
+		predicted.linearAcceleration[i] *= linearScale;
+		predicted.angularVelocity[i] *= angularScale;
+		predicted.angularAcceleration[i] *= angularScale;
+
+		predicted.position[i] += (predicted.linearVelocity[i] + predicted.linearAcceleration[i] * t / 2) * t;
+		rotation[i] = (predicted.angularVelocity[i] + predicted.angularAcceleration[i] * t / 2) * t;
+
+		predicted.linearVelocity[i] += predicted.linearAcceleration[i] * t;
+		predicted.angularVelocity[i] += predicted.angularAcceleration[i] * t;
+	}
+	predicted.orientation = Rotate(m_state.orientation, rotation);
+
+	return predicted;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+
+#include "openvr_driver.h"
+
+// Second order motion model of a controller, for the server side prediction. The client reports
+// the velocities of the controllers with each pose. An alpha-beta filter of those velocities
+// estimates the accelerations, and the pose is extrapolated with both over the prediction horizon,
+// the end to end latency. SteamVR then only extrapolates from the pose update to its own display
+// time, which it knows better than the driver.
+class PosePredictor
+{
+public:
+	struct State {
+		vr::HmdQuaternion_t orientation;
+		double position[3];
+		// In the tracking space, like the velocities reported by the client
+		double linearVelocity[3];
+		double angularVelocity[3];
+		double linearAcceleration[3];
+		double angularAcceleration[3];
+	};
+
+	PosePredictor();
+
+	void Reset();
+
+	// sampleTimeNs is the client timestamp of the tracking sample
+	void Update(uint64_t sampleTimeNs,
+		const vr::HmdQuaternion_t &orientation,
+		const double position[3],
+		const double linearVelocity[3],
+		const double angularVelocity[3]);
+
+	// The pose `horizon` seconds after the last sample, clamped to MAX_HORIZON. The velocity cutoffs
+	// scale the motion used for the extrapolation, so that slow and precise movements do not jitter.
+	State Predict(double horizon, double linearScale, double angularScale) const;
+
+private:
+	// Gain of the velocity residual, close to 1 to follow the reported velocities
+	static constexpr double VELOCITY_GAIN = 0.8;
+	// Gain of the acceleration, low because the difference of two velocities is noisy
+	static constexpr double ACCELERATION_GAIN = 0.1;
+	// Samples further apart restart the filter
+	static constexpr double MAX_SAMPLE_GAP = 0.1;
+	static constexpr double MAX_HORIZON = 0.1;
+
+	uint64_t m_lastSampleNs = 0;
+	State m_state;
+};
@@ -0,0 +1,103 @@
+#include "ResolutionController.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ALVR-common/packet_types.h"
+#include "Logger.h"
+#include "Settings.h"
+#include "Utils.h"
+
+ResolutionController::ResolutionController()
+{
+	Reset();
+}
+
+void ResolutionController::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// Whole steps, so that the scale always comes back to 100
+	uint32_t minScale = (uint32_t)std::lround(Settings::Instance().m_dynamicResolutionMinimumScale * FULL_SCALE);
+	m_minScale = std::min(std::max(minScale / SCALE_STEP * SCALE_STEP, SCALE_STEP), FULL_SCALE);
+	m_scale = FULL_SCALE;
+	m_headroomReports = 0;
+	m_lastStep = 0;
+
+	for (auto &frame : m_frames) {
+		frame.targetTimestampNs = 0;
+		frame.scale = FULL_SCALE;
+	}
+	m_nextFrame = 0;
+}
+
+void ResolutionController::OnStatistics(uint32_t encoderLoad, uint64_t bitrateMbps, double encodeQp)
+{
+	auto &settings = Settings::Instance();
+	if (!settings.m_enableDynamicResolution) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint64_t configuredBitrate = settings.GetLive().mEncodeBitrateMBs;
+	double bitrateRatio = configuredBitrate > 0 ? (double)bitrateMbps / configuredBitrate : 1.;
+	// The AV1 quantizer has another range
+	bool useQp = encodeQp > 0 && settings.m_codec != ALVR_CODEC_AV1;
+
+	bool overload = encoderLoad > HIGH_ENCODER_LOAD || bitrateRatio < LOW_BITRATE_RATIO || (useQp && encodeQp > HIGH_QP);
+	bool headroom = encoderLoad < LOW_ENCODER_LOAD && bitrateRatio > HIGH_BITRATE_RATIO && (!useQp || encodeQp < LOW_QP);
+
+	uint64_t now = GetTimestampUs();
+	if (overload) {
+		m_headroomReports = 0;
+		if (now - m_lastStep >= MIN_STEP_INTERVAL_US) {
+			Step(-1, now);
+		}
+	} else if (headroom) {
+		m_headroomReports++;
+		if (m_headroomReports >= RAISE_REPORTS && now - m_lastStep >= RAISE_INTERVAL_US) {
+			m_headroomReports = 0;
+			Step(1, now);
+		}
+	} else {
+		m_headroomReports = 0;
+	}
+}
+
+float ResolutionController::BeginFrame(uint64_t targetTimestampNs)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	uint32_t scale = m_scale;
+	m_frames[m_nextFrame] = { targetTimestampNs, (uint8_t)scale };
+	m_nextFrame = (m_nextFrame + 1) % FRAME_HISTORY;
+	return (float)scale / FULL_SCALE;
+}
+
+uint8_t ResolutionController::GetFrameScale(uint64_t targetTimestampNs)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (auto &frame : m_frames) {
+		if (frame.targetTimestampNs == targetTimestampNs) {
+			return frame.scale;
+		}
+	}
+	return FULL_SCALE;
+}
+
+uint32_t ResolutionController::GetScale() const
+{
+	return m_scale;
+}
+
+void ResolutionController::Step(int direction, uint64_t now)
+{
+	uint32_t scale = direction < 0 ? std::max(m_scale - SCALE_STEP, m_minScale) : std::min(m_scale + SCALE_STEP, FULL_SCALE);
+	if (scale != m_scale) {
+		Info("ResolutionController: frames rendered at %u%% of the resolution\n", scale);
+		m_scale = scale;
+		m_lastStep = now;
+	}
+}
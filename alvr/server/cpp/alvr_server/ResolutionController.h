@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+// Lowers the resolution of the video frames while the encoder cannot keep up with the frame rate or
+// the bitrate controller has backed off well below the configured bitrate, and raises it again once
+// both have headroom. The size of the frames given to the encoder never changes, which would need
+// a new encode and decode session: each eye is drawn scaled into the top left corner of its half
+// of the frame and the client reads the scale from the header of the video packets.
+class ResolutionController
+{
+public:
+	ResolutionController();
+
+	void Reset();
+
+	// Fed with every client statistics report. encoderLoad is the percentage from
+	// Statistics::GetEncoderLoad(), encodeQp the average QP of the last second, 0 if the encoder
+	// does not report it.
+	void OnStatistics(uint32_t encoderLoad, uint64_t bitrateMbps, double encodeQp);
+
+	// Scale of the frame about to be rendered, in (0, 1]. Remembered for GetFrameScale().
+	float BeginFrame(uint64_t targetTimestampNs);
+	// Percentage for the header of the video packets, 100 for frames not begun here.
+	uint8_t GetFrameScale(uint64_t targetTimestampNs);
+
+	// Percentage of the width and height the frames are currently rendered at.
+	uint32_t GetScale() const;
+
+private:
+	void Step(int direction, uint64_t now);
+
+	static const uint32_t FULL_SCALE = 100;
+	static const uint32_t SCALE_STEP = 10;
+	// Percentage of the frame interval spent encoding
+	static const uint32_t HIGH_ENCODER_LOAD = 90;
+	// The encode time shrinks with the square of the scale, this leaves room for one step up
+	static const uint32_t LOW_ENCODER_LOAD = 60;
+	// Fraction of the configured bitrate the bitrate controller allows
+	static constexpr double LOW_BITRATE_RATIO = 0.6;
+	static constexpr double HIGH_BITRATE_RATIO = 0.85;
+	// Average H.264/HEVC QP above which the frames are too large for the bitrate
+	static constexpr double HIGH_QP = 40;
+	static constexpr double LOW_QP = 32;
+	// Reports in a row with headroom before the scale is raised
+	static const uint32_t RAISE_REPORTS = 3;
+	static const uint64_t MIN_STEP_INTERVAL_US = 1000 * 1000;
+	static const uint64_t RAISE_INTERVAL_US = 3 * 1000 * 1000;
+	// Frames being rendered or encoded whose scale is still needed
+	static const int FRAME_HISTORY = 64;
+
+	struct Frame {
+		uint64_t targetTimestampNs;
+		uint8_t scale;
+	};
+
+	// The scale is set from the network thread and read by the render and encoder threads.
+	std::mutex m_mutex;
+	std::atomic<uint32_t> m_scale;
+
+	uint32_t m_minScale;
+	uint32_t m_headroomReports;
+	uint64_t m_lastStep;
+
+	Frame m_frames[FRAME_HISTORY];
+	int m_nextFrame;
+};
@@ -1,13 +1,6 @@
 #include "Settings.h"
 #include "Logger.h"
-#define PICOJSON_USE_INT64
-#include "include/picojson.h"
-#include <string>
-#include <fstream>
-#include <streambuf>
-#include <filesystem>
-#include <cstdlib>
-#include "bindings.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -27,153 +20,192 @@ Settings::~Settings()
 {
 }
 
-void Settings::Load()
+void Settings::Load(const OpenvrSettings &settings)
 {
-	try
+	m_universeId = settings.universe_id;
+
+	mSerialNumber = settings.headset_serial_number;
+	mTrackingSystemName = settings.headset_tracking_system_name;
+	mModelNumber = settings.headset_model_number;
+	mDriverVersion = settings.headset_driver_version;
+	mManufacturerName = settings.headset_manufacturer_name;
+	mRenderModelName = settings.headset_render_model_name;
+	mRegisteredDeviceType = settings.headset_registered_device_type;
+
+	m_renderWidth = settings.eye_resolution_width * 2;
+	m_renderHeight = settings.eye_resolution_height;
+
+	m_recommendedTargetWidth = settings.target_eye_resolution_width * 2;
+	m_recommendedTargetHeight = settings.target_eye_resolution_height;
+
+	for (int eye = 0; eye < 2; eye++)
 	{
-		auto sessionFile = std::ifstream(g_sessionPath);
-
-		auto json = std::string(
-			std::istreambuf_iterator<char>(sessionFile),
-			std::istreambuf_iterator<char>());
-
-		picojson::value v;
-		std::string err = picojson::parse(v, json);
-		if (!err.empty())
-		{
-			Error("Error on parsing json: %hs\n", err.c_str());
-			return;
-		}
-
-		auto config = v.get("openvr_config");
-
-		m_universeId = config.get("universe_id").get<int64_t>();
-
-		mSerialNumber = config.get("headset_serial_number").get<std::string>();
-		mTrackingSystemName = config.get("headset_tracking_system_name").get<std::string>();
-		mModelNumber = config.get("headset_model_number").get<std::string>();
-		mDriverVersion = config.get("headset_driver_version").get<std::string>();
-		mManufacturerName = config.get("headset_manufacturer_name").get<std::string>();
-		mRenderModelName = config.get("headset_render_model_name").get<std::string>();
-		mRegisteredDeviceType = config.get("headset_registered_device_type").get<std::string>();
-
-		m_renderWidth = config.get("eye_resolution_width").get<int64_t>() * 2;
-		m_renderHeight = config.get("eye_resolution_height").get<int64_t>();
-
-		m_recommendedTargetWidth = config.get("target_eye_resolution_width").get<int64_t>() * 2;
-		m_recommendedTargetHeight = config.get("target_eye_resolution_height").get<int64_t>();
-
-		for (int eye = 0; eye < 2; eye++)
-		{
-			m_eyeFov[eye].left = 45;
-			m_eyeFov[eye].right = 45;
-			m_eyeFov[eye].top = 45;
-			m_eyeFov[eye].bottom = 45;
-		}
-
-		m_flSecondsFromVsyncToPhotons = (float)config.get("seconds_from_vsync_to_photons").get<double>();
-
-		m_flIPD = 0.063;
-
-		m_force3DOF = config.get("force_3dof").get<bool>();		
-		m_TrackingRefOnly = config.get("tracking_ref_only").get<bool>();
-
-		m_enableViveTrackerProxy = config.get("enable_vive_tracker_proxy").get<bool>();
-
-		m_aggressiveKeyframeResend = config.get("aggressive_keyframe_resend").get<bool>();
-
-		m_nAdapterIndex = (int32_t)config.get("adapter_index").get<int64_t>();
-
-		m_codec = (int32_t)config.get("codec").get<int64_t>();
-		m_refreshRate = (int)config.get("refresh_rate").get<int64_t>();
-		mEncodeBitrateMBs = (int)config.get("encode_bitrate_mbs").get<int64_t>();
-		m_enableAdaptiveBitrate = config.get("enable_adaptive_bitrate").get<bool>();
-		m_adaptiveBitrateMaximum = (int)config.get("bitrate_maximum").get<int64_t>();
-		m_adaptiveBitrateTarget = (int)config.get("latency_target").get<int64_t>();
-		m_adaptiveBitrateUseFrametime = config.get("latency_use_frametime").get<bool>();
-		m_adaptiveBitrateTargetMaximum = (int)config.get("latency_target_maximum").get<int64_t>();
-		m_adaptiveBitrateTargetOffset = (int)config.get("latency_target_offset").get<int64_t>();
-		m_adaptiveBitrateThreshold = (int)config.get("latency_threshold").get<int64_t>();
-		m_adaptiveBitrateUpRate = (int)config.get("bitrate_up_rate").get<int64_t>();
-		m_adaptiveBitrateDownRate = (int)config.get("bitrate_down_rate").get<int64_t>();
-		m_adaptiveBitrateLightLoadThreshold = config.get("bitrate_light_load_threshold").get<double>();
-		m_use10bitEncoder = config.get("use_10bit_encoder").get<bool>();
-		m_swThreadCount = (int32_t)config.get("sw_thread_count").get<int64_t>();
-
-		m_controllerTrackingSystemName = config.get("controllers_tracking_system_name").get<std::string>();
-		m_controllerManufacturerName = config.get("controllers_manufacturer_name").get<std::string>();
-		m_controllerModelNumber = config.get("controllers_model_number").get<std::string>();
-		m_controllerRenderModelNameLeft = config.get("render_model_name_left_controller").get<std::string>();
-		m_controllerRenderModelNameRight = config.get("render_model_name_right_controller").get<std::string>();
-		m_controllerSerialNumber = config.get("controllers_serial_number").get<std::string>();
-		m_controllerTypeLeft = config.get("controllers_type_left").get<std::string>();
-		m_controllerTypeRight = config.get("controllers_type_right").get<std::string>();
-		mControllerRegisteredDeviceType = config.get("controllers_registered_device_type").get<std::string>();
-		m_controllerInputProfilePath = config.get("controllers_input_profile_path").get<std::string>();
-
-		m_controllerMode = (int32_t)config.get("controllers_mode_idx").get<int64_t>();
-
-		m_disableController = !config.get("controllers_enabled").get<bool>();
-
-		m_EnableOffsetPos = true;
-		auto headsetPositionOffset = config.get("position_offset").get<picojson::array>();
-		m_OffsetPos[0] = (float)headsetPositionOffset[0].get<double>();
-		m_OffsetPos[1] = (float)headsetPositionOffset[1].get<double>();
-		m_OffsetPos[2] = (float)headsetPositionOffset[2].get<double>();
-
-		m_trackingFrameOffset = (int32_t)config.get("tracking_frame_offset").get<int64_t>();
-		m_controllerPoseOffset = (double)config.get("controller_pose_offset").get<double>();
-		m_serversidePrediction = config.get("serverside_prediction").get<bool>();
-		m_linearVelocityCutoff = (float)config.get("linear_velocity_cutoff").get<double>();
-		m_angularVelocityCutoff = (float)config.get("angular_velocity_cutoff").get<double>();
-
-		auto leftControllerPositionOffset = config.get("position_offset_left").get<picojson::array>();
-		m_leftControllerPositionOffset[0] = leftControllerPositionOffset[0].get<double>();
-		m_leftControllerPositionOffset[1] = leftControllerPositionOffset[1].get<double>();
-		m_leftControllerPositionOffset[2] = leftControllerPositionOffset[2].get<double>();
-
-		auto leftControllerRotationOffset = config.get("rotation_offset_left").get<picojson::array>();
-		m_leftControllerRotationOffset[0] = leftControllerRotationOffset[0].get<double>();
-		m_leftControllerRotationOffset[1] = leftControllerRotationOffset[1].get<double>();
-		m_leftControllerRotationOffset[2] = leftControllerRotationOffset[2].get<double>();
-
-		m_hapticsIntensity = config.get("haptics_intensity").get<double>();
-		m_hapticsAmplitudeCurve = config.get("haptics_amplitude_curve").get<double>();
-		m_hapticsMinDuration = config.get("haptics_min_duration").get<double>();
-		m_hapticsLowDurationAmplitudeMultiplier = config.get("haptics_low_duration_amplitude_multiplier").get<double>();
-		m_hapticsLowDurationRange = config.get("haptics_low_duration_range").get<double>();
-
-		m_useHeadsetTrackingSystem = config.get("use_headset_tracking_system").get<bool>();
-
-		m_enableFoveatedRendering = config.get("enable_foveated_rendering").get<bool>();
-		m_foveationCenterSizeX = (float)config.get("foveation_center_size_x").get<double>();
-		m_foveationCenterSizeY = (float)config.get("foveation_center_size_y").get<double>();
-		m_foveationCenterShiftX = (float)config.get("foveation_center_shift_x").get<double>();
-		m_foveationCenterShiftY = (float)config.get("foveation_center_shift_y").get<double>();
-		m_foveationEdgeRatioX = (float)config.get("foveation_edge_ratio_x").get<double>();
-		m_foveationEdgeRatioY = (float)config.get("foveation_edge_ratio_y").get<double>();
-
-		m_enableColorCorrection = config.get("enable_color_correction").get<bool>();
-		m_brightness = (float)config.get("brightness").get<double>();
-		m_contrast = (float)config.get("contrast").get<double>();
-		m_saturation = (float)config.get("saturation").get<double>();
-		m_gamma = (float)config.get("gamma").get<double>();
-		m_sharpening = (float)config.get("sharpening").get<double>();
-
-		m_enableFec = config.get("enable_fec").get<bool>();
-
-		m_enableLinuxVulkanAsync = config.get("linux_async_reprojection").get<bool>();
-		
-		Debug("Config JSON: %hs\n", json.c_str());
-		Info("Serial Number: %hs\n", mSerialNumber.c_str());
-		Info("Model Number: %hs\n", mModelNumber.c_str());
-		Info("Render Target: %d %d\n", m_renderWidth, m_renderHeight);
-		Info("Seconds from Vsync to Photons: %f\n", m_flSecondsFromVsyncToPhotons);
-		Info("Refresh Rate: %d\n", m_refreshRate);
-		m_loaded = true;
+		m_eyeFov[eye].left = 45;
+		m_eyeFov[eye].right = 45;
+		m_eyeFov[eye].top = 45;
+		m_eyeFov[eye].bottom = 45;
 	}
-	catch (std::exception &e)
+
+	m_flSecondsFromVsyncToPhotons = settings.seconds_from_vsync_to_photons;
+
+	m_flIPD = 0.063;
+
+	m_force3DOF = settings.force_3dof;
+	m_TrackingRefOnly = settings.tracking_ref_only;
+
+	m_enableViveTrackerProxy = settings.enable_vive_tracker_proxy;
+
+	m_aggressiveKeyframeResend = settings.aggressive_keyframe_resend;
+
+	m_nAdapterIndex = settings.adapter_index;
+	m_encoderAdapterIndex = settings.encoder_adapter_index;
+	m_encoderDedicatedDevice = settings.encoder_dedicated_device;
+
+	m_codec = settings.codec;
+	m_refreshRate = settings.refresh_rate;
+	m_use10bitEncoder = settings.use_10bit_encoder;
+	m_swThreadCount = settings.sw_thread_count;
+	m_swFrameThreads = settings.sw_frame_threads;
+	m_swIntraRefresh = settings.sw_intra_refresh;
+	m_swPinThreads = settings.sw_pin_threads;
+	m_swHoldFrameDeadline = settings.sw_hold_frame_deadline;
+	m_dropLateFrames = settings.drop_late_frames;
+	m_preciseVSync = settings.precise_vsync;
+	m_idlePowerSave = settings.idle_power_save;
+	m_threadRealtimePriority = settings.thread_realtime_priority;
+	m_encoderCpuMask = settings.encoder_cpu_mask;
+	m_vsyncCpuMask = settings.vsync_cpu_mask;
+	m_trackingCpuMask = settings.tracking_cpu_mask;
+	m_frameCaptureHistory = settings.frame_capture_history;
+	m_enableEncodeArbitration = settings.enable_encode_arbitration;
+	m_encoderMaxSessions = settings.encoder_max_sessions;
+	m_concurrentEncodes = settings.concurrent_encodes;
+	m_enableVSyncPhaseLock = settings.enable_vsync_phase_lock;
+	m_vsyncQueueWaitTarget = settings.vsync_queue_wait_target;
+	m_encodePipelineDepth = settings.linux_encode_pipeline_depth;
+	m_nvencPipelineDepth = settings.nvenc_pipeline_depth;
+	m_nvencMotionHints = settings.nvenc_motion_hints;
+	m_nvencInterEyeHints = settings.nvenc_inter_eye_hints;
+	m_amfPipelineDepth = std::max<uint32_t>(settings.amf_pipeline_depth, 1);
+	m_amfPreAnalysis = settings.amf_pre_analysis;
+	m_slicesPerFrame = std::max<uint32_t>(settings.slices_per_frame, 1);
+	m_intraRefreshFrames = settings.intra_refresh_frames;
+	m_referenceFrameInvalidation = settings.reference_frame_invalidation;
+	m_dualStreamEncoding = settings.dual_stream_encoding;
+	m_yuvOutput = settings.yuv_output;
+
+	m_controllerTrackingSystemName = settings.controllers_tracking_system_name;
+	m_controllerManufacturerName = settings.controllers_manufacturer_name;
+	m_controllerModelNumber = settings.controllers_model_number;
+	m_controllerRenderModelNameLeft = settings.render_model_name_left_controller;
+	m_controllerRenderModelNameRight = settings.render_model_name_right_controller;
+	m_controllerSerialNumber = settings.controllers_serial_number;
+	m_controllerTypeLeft = settings.controllers_type_left;
+	m_controllerTypeRight = settings.controllers_type_right;
+	mControllerRegisteredDeviceType = settings.controllers_registered_device_type;
+	m_controllerInputProfilePath = settings.controllers_input_profile_path;
+
+	m_controllerMode = settings.controllers_mode_idx;
+
+	m_disableController = !settings.controllers_enabled;
+
+	m_EnableOffsetPos = true;
+	m_OffsetPos[0] = settings.position_offset[0];
+	m_OffsetPos[1] = settings.position_offset[1];
+	m_OffsetPos[2] = settings.position_offset[2];
+
+	m_trackingFrameOffset = settings.tracking_frame_offset;
+	m_controllerPoseOffset = settings.controller_pose_offset;
+	m_serversidePrediction = settings.serverside_prediction;
+	m_linearVelocityCutoff = settings.linear_velocity_cutoff;
+	m_angularVelocityCutoff = settings.angular_velocity_cutoff;
+
+	m_leftControllerPositionOffset[0] = settings.position_offset_left[0];
+	m_leftControllerPositionOffset[1] = settings.position_offset_left[1];
+	m_leftControllerPositionOffset[2] = settings.position_offset_left[2];
+
+	m_leftControllerRotationOffset[0] = settings.rotation_offset_left[0];
+	m_leftControllerRotationOffset[1] = settings.rotation_offset_left[1];
+	m_leftControllerRotationOffset[2] = settings.rotation_offset_left[2];
+
+	m_hapticsIntensity = settings.haptics_intensity;
+	m_hapticsAmplitudeCurve = settings.haptics_amplitude_curve;
+	m_hapticsMinDuration = settings.haptics_min_duration;
+	m_hapticsLowDurationAmplitudeMultiplier = settings.haptics_low_duration_amplitude_multiplier;
+	m_hapticsLowDurationRange = settings.haptics_low_duration_range;
+
+	m_useHeadsetTrackingSystem = settings.use_headset_tracking_system;
+
+	m_enableFoveatedRendering = settings.enable_foveated_rendering;
+	m_foveationCenterSizeX = settings.foveation_center_size_x;
+	m_foveationCenterSizeY = settings.foveation_center_size_y;
+	m_foveationCenterShiftX = settings.foveation_center_shift_x;
+	m_foveationCenterShiftY = settings.foveation_center_shift_y;
+	m_foveationEdgeRatioX = settings.foveation_edge_ratio_x;
+	m_foveationEdgeRatioY = settings.foveation_edge_ratio_y;
+	m_foveationFollowGaze = settings.foveation_follow_gaze;
+
+	m_enableFoveatedEncoding = settings.enable_foveated_encoding;
+	m_foveatedEncodingQpOffset = settings.foveated_encoding_qp_offset;
+
+	m_enableDynamicResolution = settings.enable_dynamic_resolution;
+	m_dynamicResolutionMinimumScale = settings.dynamic_resolution_minimum_scale;
+
+	m_enableColorCorrection = settings.enable_color_correction;
+
+	m_videoPacketSize = settings.video_packet_size;
+
+	m_enableLinuxVulkanAsync = settings.linux_async_reprojection;
+
+	ApplyLive(settings);
+
+	Info("Serial Number: %hs\n", mSerialNumber.c_str());
+	Info("Model Number: %hs\n", mModelNumber.c_str());
+	Info("Render Target: %d %d\n", m_renderWidth, m_renderHeight);
+	Info("Seconds from Vsync to Photons: %f\n", m_flSecondsFromVsyncToPhotons);
+	Info("Refresh Rate: %d\n", m_refreshRate);
+	m_loaded = true;
+}
+
+void Settings::ApplyLive(const OpenvrSettings &settings)
+{
+	LiveSettings live;
+	live.mEncodeBitrateMBs = settings.encode_bitrate_mbs;
+	live.m_enableAdaptiveBitrate = settings.enable_adaptive_bitrate;
+	live.m_adaptiveBitrateMaximum = settings.bitrate_maximum;
+	live.m_adaptiveBitrateTarget = settings.latency_target;
+	live.m_adaptiveBitrateUseFrametime = settings.latency_use_frametime;
+	live.m_adaptiveBitrateTargetMaximum = settings.latency_target_maximum;
+	live.m_adaptiveBitrateTargetOffset = settings.latency_target_offset;
+	live.m_adaptiveBitrateThreshold = settings.latency_threshold;
+	live.m_adaptiveBitrateUpRate = settings.bitrate_up_rate;
+	live.m_adaptiveBitrateDownRate = settings.bitrate_down_rate;
+	live.m_adaptiveBitrateLightLoadThreshold = settings.bitrate_light_load_threshold;
+
+	live.m_brightness = settings.brightness;
+	live.m_contrast = settings.contrast;
+	live.m_saturation = settings.saturation;
+	live.m_gamma = settings.gamma;
+	live.m_sharpening = settings.sharpening;
+
+	live.m_enableFec = settings.enable_fec;
+	live.m_fecOnGpu = settings.fec_on_gpu;
+
+	ApplyLive(live);
+}
+
+void Settings::ApplyLive(const LiveSettings &live)
+{
 	{
-		Error("Exception on parsing json: %hs\n", e.what());
+		std::unique_lock<std::mutex> lock(m_liveMutex);
+		m_live = live;
 	}
+	// A reader that sees the new revision gets the new settings from GetLive()
+	m_liveRevision.fetch_add(1, std::memory_order_release);
+}
+
+LiveSettings Settings::GetLive()
+{
+	std::unique_lock<std::mutex> lock(m_liveMutex);
+	return m_live;
 }
@@ -1,7 +1,36 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <string>
 #include "ALVR-common/packet_types.h"
+#include "bindings.h"
+
+// The settings that can change while streaming: bitrate, FEC and color correction parameters
+struct LiveSettings
+{
+	uint64_t mEncodeBitrateMBs;
+	bool m_enableAdaptiveBitrate;
+	uint64_t m_adaptiveBitrateMaximum;
+	uint64_t m_adaptiveBitrateTarget;
+	bool m_adaptiveBitrateUseFrametime;
+	uint64_t m_adaptiveBitrateTargetMaximum;
+	int32_t m_adaptiveBitrateTargetOffset;
+	uint64_t m_adaptiveBitrateThreshold;
+	uint64_t m_adaptiveBitrateUpRate;
+	uint64_t m_adaptiveBitrateDownRate;
+	float m_adaptiveBitrateLightLoadThreshold;
+
+	float m_brightness;
+	float m_contrast;
+	float m_saturation;
+	float m_gamma;
+	float m_sharpening;
+
+	bool m_enableFec;
+	// Windows: the parity of the large frames is computed by a compute shader
+	bool m_fecOnGpu;
+};
 
 class Settings
 {
@@ -12,7 +41,15 @@ class Settings
 	virtual ~Settings();
 
 public:
-	void Load();
+	// The snapshot is built by the Rust side from the session, the session file is not parsed here
+	void Load(const OpenvrSettings &settings);
+	// Publishes the fields that can change while streaming. Called by Load and on live updates
+	// from the dashboard, on the Rust thread.
+	void ApplyLive(const OpenvrSettings &settings);
+	void ApplyLive(const LiveSettings &live);
+	// Copy of the live settings, for any thread. Readers on a hot path keep the copy until
+	// m_liveRevision changes.
+	LiveSettings GetLive();
 	static Settings &Instance() {
 		return m_Instance;
 	}
@@ -32,6 +69,10 @@ public:
 	std::string mRegisteredDeviceType;
 
 	int32_t m_nAdapterIndex;
+	// Adapter of the video encoder, -1 to encode on m_nAdapterIndex
+	int32_t m_encoderAdapterIndex;
+	// Encode on a device of its own on the rendering adapter, with the highest GPU priority
+	bool m_encoderDedicatedDevice;
 
 	uint64_t m_DriverTestMode = 0;
 
@@ -53,28 +94,52 @@ public:
 	float m_foveationCenterShiftY;
 	float m_foveationEdgeRatioX;
 	float m_foveationEdgeRatioY;
+	bool m_foveationFollowGaze;
+
+	bool m_enableFoveatedEncoding;
+	uint32_t m_foveatedEncodingQpOffset;
+
+	bool m_enableDynamicResolution;
+	float m_dynamicResolutionMinimumScale;
 
 	bool m_enableColorCorrection;
-	float m_brightness;
-	float m_contrast;
-	float m_saturation;
-	float m_gamma;
-	float m_sharpening;
 
 	int m_codec;
-	uint64_t mEncodeBitrateMBs;
-	bool m_enableAdaptiveBitrate;
-	uint64_t m_adaptiveBitrateMaximum;
-	uint64_t m_adaptiveBitrateTarget;
-	bool m_adaptiveBitrateUseFrametime;
-	uint64_t m_adaptiveBitrateTargetMaximum;
-	int32_t m_adaptiveBitrateTargetOffset;
-	uint64_t m_adaptiveBitrateThreshold;
-	uint64_t m_adaptiveBitrateUpRate;
-	uint64_t m_adaptiveBitrateDownRate;
-	float m_adaptiveBitrateLightLoadThreshold;
 	bool m_use10bitEncoder;
 	uint32_t m_swThreadCount;
+	bool m_swFrameThreads;
+	bool m_swIntraRefresh;
+	bool m_swPinThreads;
+	bool m_swHoldFrameDeadline;
+	// Drop the frames that can no longer be displayed on time, see DeadlineScheduler
+	bool m_dropLateFrames;
+	bool m_preciseVSync;
+	// Pause the encoder and slow the vsync down while the headset is idle, see IdleController
+	bool m_idlePowerSave;
+	bool m_threadRealtimePriority;
+	// Bit per CPU, 0 if not pinned
+	uint64_t m_encoderCpuMask;
+	uint64_t m_vsyncCpuMask;
+	uint64_t m_trackingCpuMask;
+	// Frames of composed output kept for CaptureFrames, 0 to only capture the next frame
+	uint32_t m_frameCaptureHistory;
+	// Encoder shared with the servers of the other SteamVR instances, see EncodeArbiter
+	bool m_enableEncodeArbitration;
+	uint32_t m_encoderMaxSessions;
+	uint32_t m_concurrentEncodes;
+	bool m_enableVSyncPhaseLock;
+	uint64_t m_vsyncQueueWaitTarget;
+	uint32_t m_encodePipelineDepth;
+	uint32_t m_nvencPipelineDepth;
+	bool m_nvencMotionHints;
+	bool m_nvencInterEyeHints;
+	uint32_t m_amfPipelineDepth;
+	bool m_amfPreAnalysis;
+	uint32_t m_slicesPerFrame;
+	uint32_t m_intraRefreshFrames;
+	bool m_referenceFrameInvalidation;
+	bool m_dualStreamEncoding;
+	bool m_yuvOutput;
 
 	// Controller configs
 	std::string m_controllerTrackingSystemName;
@@ -106,18 +171,12 @@ public:
 	float m_hapticsLowDurationAmplitudeMultiplier;
 	float m_hapticsLowDurationRange;
 
-	int32_t m_causePacketLoss;
-
 	int32_t m_trackingFrameOffset;
 
 	bool m_force3DOF;
 
 	bool m_aggressiveKeyframeResend;
 
-	// They are not in config json and set by "SetConfig" command.
-	bool m_captureLayerDDSTrigger = false;
-	bool m_captureComposedDDSTrigger = false;
-	
 	int m_controllerMode = 0;
 
 	bool m_TrackingRefOnly = false;
@@ -125,8 +184,19 @@ public:
 	bool m_enableViveTrackerProxy = false;
 
 	bool m_useHeadsetTrackingSystem = false;
-	
-	bool m_enableFec;
+
+	// Payload bytes of the video packets, negotiated with the client
+	int m_videoPacketSize = ALVR_MAX_VIDEO_BUFFER_SIZE;
 
 	bool m_enableLinuxVulkanAsync;
+
+	// Bumped by ApplyLive once the new live settings are published. The renderers keep the
+	// revision they were built with and update their color correction between frames when it
+	// changes.
+	std::atomic<uint32_t> m_liveRevision{0};
+
+private:
+	// Written on the Rust thread, read by the encoder, FEC and render threads
+	std::mutex m_liveMutex;
+	LiveSettings m_live = {};
 };
@@ -1,23 +1,74 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
 #include <stdint.h>
-#include <time.h>
+#include <thread>
 
 #include "Utils.h"
 #include "Settings.h"
+#include "EncodeStats.h"
+#include "EncoderRate.h"
+#include "GpuMonitor.h"
+#include "LatencyHistogram.h"
 
 #define BITS_IN_MBIT 1000000
 #define US_IN_S 1000000
 
+// Counters are updated from the encoder, network and FFI threads. Per packet and per event
+// counters are relaxed atomics, everything updated once per frame is guarded by m_mutex. The
+// one second window rolls over on its own thread, so no update has to check the clock.
 class Statistics {
 public:
+	// Pipeline stages with a latency histogram. STAGE_SEND to STAGE_RENDER are measured by the
+	// client, the layer stages only exist on Linux.
+	enum Stage {
+		STAGE_COMPOSE,
+		STAGE_ENCODE,
+		STAGE_SEND,
+		STAGE_TRANSPORT,
+		STAGE_DECODE,
+		STAGE_RENDER,
+		// QueuePresent to the present fence, when the layer waits for it
+		STAGE_LAYER_RENDER,
+		// Present fence, or QueuePresent, to the layer publishing the present
+		STAGE_LAYER_HANDOFF,
+		// Layer publishing the present to the encoder picking it up
+		STAGE_PRESENT_PICKUP,
+		STAGE_COUNT,
+	};
+	enum Percentile {
+		P50,
+		P95,
+		P99,
+		PERCENTILE_COUNT,
+	};
+
 	Statistics() {
 		ResetAll();
-		m_current = time(NULL);
+		m_tickThread = std::thread(&Statistics::TickLoop, this);
+	}
+
+	~Statistics() {
+		{
+			std::unique_lock<std::mutex> lock(m_tickMutex);
+			m_exiting = true;
+		}
+		m_tickCondition.notify_all();
+		m_tickThread.join();
 	}
 
+	Statistics(const Statistics&) = delete;
+	Statistics& operator=(const Statistics&) = delete;
+
 	void ResetAll() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
 		m_packetsSentTotal = 0;
 		m_packetsSentInSecond = 0;
 		m_packetsSentInSecondPrev = 0;
@@ -39,30 +90,205 @@ public:
 		m_encodeLatencyMinPrev = 0;
 		m_encodeLatencyMaxPrev = 0;
 
+		m_encodedBytesInSecond = 0;
+		m_intraFramesInSecond = 0;
+		m_encodeQpTotal = 0;
+		m_encodeQpCount = 0;
+		m_encoderLatencyTotalUs = 0;
+		m_encoderLatencyCount = 0;
+		m_encodedBitratePrev = 0;
+		m_encodedFrameBytesPrev = 0;
+		m_intraFramesInSecondPrev = 0;
+		m_encodeQpPrev = 0;
+		m_encoderLatencyPrev = 0;
+		m_encoderLoadPrev = 0;
+		m_bitrateUsagePrev = 0;
+
 		m_sendLatency = 0;
+		m_clientTransportLatency = 0;
+		m_clientDecodeLatency = 0;
+
+		m_presentsCoalescedTotal = 0;
+		m_presentsCoalescedInSecond = 0;
+		m_presentsCoalescedInSecondPrev = 0;
+		m_presentLatency = 0;
+		m_layerRenderLatency = 0;
+		m_layerHandoffLatency = 0;
+		m_layerCopyLatency = 0;
+		m_gpuQueueWait = 0;
+
+		m_compositorFramesDroppedTotal = 0;
+		m_compositorFramesDroppedInSecond = 0;
+		m_compositorFramesDroppedInSecondPrev = 0;
+		m_compositorFramesLateInSecond = 0;
+		m_compositorFramesLateInSecondPrev = 0;
+		m_duplicateFramesSkippedInSecond = 0;
+		m_duplicateFramesSkippedInSecondPrev = 0;
+		m_lateFramesDroppedInSecond = 0;
+		m_lateFramesDroppedInSecondPrev = 0;
+		m_expiredFramesDroppedInSecond = 0;
+		m_expiredFramesDroppedInSecondPrev = 0;
+
+		m_vsyncJitterTotalUs = 0;
+		m_vsyncJitterCount = 0;
+		m_vsyncJitterMaxUs = 0;
+		m_vsyncJitterAveragePrev = 0;
+		m_vsyncJitterMaxPrev = 0;
+
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			m_stageHistograms[i].Reset();
+			for (int j = 0; j < PERCENTILE_COUNT; j++) {
+				m_stagePercentilesPrev[i][j] = 0;
+			}
+		}
 	}
 
 	void CountPacket(int bytes) {
-		CheckAndResetSecond();
-
-		m_packetsSentTotal++;
-		m_packetsSentInSecond++;
-		m_bitsSentTotal += bytes * 8;
-		m_bitsSentInSecond += bytes * 8;
+		m_packetsSentTotal.fetch_add(1, std::memory_order_relaxed);
+		m_packetsSentInSecond.fetch_add(1, std::memory_order_relaxed);
+		m_bitsSentTotal.fetch_add(bytes * 8, std::memory_order_relaxed);
+		m_bitsSentInSecond.fetch_add(bytes * 8, std::memory_order_relaxed);
 	}
 
-	void EncodeOutput(uint64_t latencyUs) {
-		CheckAndResetSecond();
+	void EncodeOutput(const EncodeStats &stats) {
+		std::unique_lock<std::mutex> lock(m_mutex);
 
+		uint64_t latencyUs = stats.latencyUs;
 		m_framesInSecond++;
 		m_encodeLatencyAveragePrev = latencyUs;
 		m_encodeLatencyTotalUs += latencyUs;
 		m_encodeLatencyMin = std::min(latencyUs, m_encodeLatencyMin);
 		m_encodeLatencyMax = std::max(latencyUs, m_encodeLatencyMax);
 		m_encodeSampleCount++;
+		m_stageHistograms[STAGE_ENCODE].Add(latencyUs);
+
+		m_encodedBytesInSecond += stats.bytes;
+		m_encodePipelineDepth = std::max<uint32_t>(stats.pipelineDepth, 1);
+		if (stats.frameType == EncodeStats::FRAME_IDR || stats.frameType == EncodeStats::FRAME_I) {
+			m_intraFramesInSecond++;
+		}
+		if (stats.averageQp >= 0) {
+			m_encodeQpTotal += stats.averageQp;
+			m_encodeQpCount++;
+		}
+		if (stats.encoderLatencyUs != 0) {
+			m_encoderLatencyTotalUs += stats.encoderLatencyUs;
+			m_encoderLatencyCount++;
+		}
+	}
+
+	// Latencies of the last frame reported by the client with each TimeSync.
+	void ClientLatencies(uint64_t sendUs, uint64_t transportUs, uint64_t decodeUs, uint64_t renderUs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_stageHistograms[STAGE_SEND].Add(sendUs);
+		m_stageHistograms[STAGE_TRANSPORT].Add(transportUs);
+		m_stageHistograms[STAGE_DECODE].Add(decodeUs);
+		m_stageHistograms[STAGE_RENDER].Add(renderUs);
+	}
+
+	// Presents that were superseded by a newer one before the encoder picked them up.
+	void PresentsCoalesced(uint32_t count) {
+		m_presentsCoalescedTotal.fetch_add(count, std::memory_order_relaxed);
+		m_presentsCoalescedInSecond.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	// Timestamps of a present of the Linux layer, CLOCK_MONOTONIC in ns: QueuePresent, the present
+	// fence (0 when the layer does not wait for it), the publish on the present ring and the
+	// pickup by the encoder.
+	void LayerPresent(uint64_t presentNs, uint64_t renderedNs, uint64_t publishNs, uint64_t pickupNs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		uint64_t handoffStartNs = presentNs;
+		if (renderedNs != 0) {
+			uint64_t renderUs = ElapsedUs(presentNs, renderedNs);
+			m_stageHistograms[STAGE_LAYER_RENDER].Add(renderUs);
+			Smooth(m_layerRenderLatency, renderUs);
+			handoffStartNs = renderedNs;
+		}
+		uint64_t handoffUs = ElapsedUs(handoffStartNs, publishNs);
+		m_stageHistograms[STAGE_LAYER_HANDOFF].Add(handoffUs);
+		Smooth(m_layerHandoffLatency, handoffUs);
+		uint64_t pickupUs = ElapsedUs(publishNs, pickupNs);
+		m_stageHistograms[STAGE_PRESENT_PICKUP].Add(pickupUs);
+		Smooth(m_presentLatency, pickupUs);
+	}
+
+	// GPU time of the copy of the swapchain images by the Linux layer, when it makes one
+	void LayerCopy(uint64_t copyNs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		Smooth(m_layerCopyLatency, copyNs / 1000);
+	}
+
+	// Frames the compositor did not release in time for the next vsync.
+	void CompositorFrameDropped() {
+		m_compositorFramesDroppedTotal.fetch_add(1, std::memory_order_relaxed);
+		m_compositorFramesDroppedInSecond.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Frames the compositor released only after Present was called.
+	void CompositorFrameLate() {
+		m_compositorFramesLateInSecond.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Presents of the frame already encoded last, which were not encoded again.
+	void DuplicateFrameSkipped() {
+		m_duplicateFramesSkippedInSecond.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Frames the encoder dropped as they could no longer be displayed on time, see DeadlineScheduler.
+	// Expired ones were past their display time already.
+	void DeadlineFrameDropped(bool expired) {
+		if (expired) {
+			m_expiredFramesDroppedInSecond.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			m_lateFramesDroppedInSecond.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Averages of the last TimeSync of the client, in us.
+	void ClientLatency(uint64_t transportUs, uint64_t decodeUs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_clientTransportLatency = transportUs;
+		m_clientDecodeLatency = decodeUs;
+	}
+
+	// Time of a VsyncEvent minus the time it was scheduled for, in us.
+	void VSyncJitter(int64_t errorUs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		uint64_t jitterUs = (uint64_t)std::abs(errorUs);
+		m_vsyncJitterTotalUs += jitterUs;
+		m_vsyncJitterCount++;
+		m_vsyncJitterMaxUs = std::max(jitterUs, m_vsyncJitterMaxUs);
+	}
+
+	// GPU time of each composition pass, in milliseconds.
+	void GpuPassTimes(double compositionMs, double colorCorrectionMs, double ffrMs, double encoderCopyMs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_stageHistograms[STAGE_COMPOSE].Add((uint64_t)(compositionMs * 1000));
+
+		double times[] = { compositionMs, colorCorrectionMs, ffrMs, encoderCopyMs };
+		for (int i = 0; i < GPU_PASS_COUNT; i++) {
+			if (m_gpuPassMs[i] == 0) {
+				m_gpuPassMs[i] = times[i];
+			} else {
+				m_gpuPassMs[i] = times[i] * 0.1 + m_gpuPassMs[i] * 0.9;
+			}
+		}
+	}
+
+	// Time the frame work waited in the GPU queue before it ran, in us. Windows only.
+	void GpuQueueWait(uint64_t waitUs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		Smooth(m_gpuQueueWait, waitUs);
 	}
 
 	void NetworkTotal(uint64_t latencyUs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
 		if (latencyUs > 5e5) // limit to 0.5s
 			latencyUs = 5e5;
 		if (m_totalLatency == 0) {
@@ -73,6 +299,8 @@ public:
 	}
 
 	void NetworkSend(uint64_t latencyUs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
 		if (latencyUs > 5e5 || latencyUs == 0) // remove invalid latency, limit to 0.5s
 			latencyUs = 5e5;
 		if (m_sendLatency == 0) {
@@ -83,64 +311,198 @@ public:
 	}
 
 	uint64_t GetPacketsSentTotal() {
-		return m_packetsSentTotal;
+		return m_packetsSentTotal.load(std::memory_order_relaxed);
 	}
 	uint64_t GetPacketsSentInSecond() {
-		return m_packetsSentInSecondPrev;
+		return m_packetsSentInSecondPrev.load(std::memory_order_relaxed);
 	}
 	uint64_t GetBitrate() {
+		std::unique_lock<std::mutex> lock(m_mutex);
 		return m_bitrate;
 	}
+	// What the encoders are given for the current bitrate and frame size cap
+	EncoderRate GetEncoderRate() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		auto rate = EncoderRate::ForBitrate(m_bitrate * BITS_IN_MBIT, (float)m_refreshRate);
+		rate.CapFrameSize(m_maxFrameSize);
+		return rate;
+	}
 	uint64_t GetBitsSentTotal() {
-		return m_bitsSentTotal;
+		return m_bitsSentTotal.load(std::memory_order_relaxed);
 	}
 	uint64_t GetBitsSentInSecond() {
-		return m_bitsSentInSecondPrev;
+		return m_bitsSentInSecondPrev.load(std::memory_order_relaxed);
 	}
 	float GetFPS() {
+		std::unique_lock<std::mutex> lock(m_mutex);
 		return m_framesPrevious;
 	}
 	uint64_t GetTotalLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
 		return m_totalLatency;
 	}
 	uint64_t GetEncodeLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
 		return m_encodeLatencyAveragePrev;
 	}
 	uint64_t GetSendLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
 		return m_sendLatency;
 	}
+	// Expected time from the start of the encode of a frame to its decoder output on the client, in
+	// us. 0 until the client reported its averages.
+	uint64_t GetEncodeToDecodeLatency() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_clientTransportLatency == 0 && m_clientDecodeLatency == 0) {
+			return 0;
+		}
+		return m_encodeLatencyAveragePrev + m_sendLatency + m_clientTransportLatency + m_clientDecodeLatency;
+	}
+	uint64_t GetPresentsCoalescedTotal() {
+		return m_presentsCoalescedTotal.load(std::memory_order_relaxed);
+	}
+	uint64_t GetPresentsCoalescedInSecond() {
+		return m_presentsCoalescedInSecondPrev.load(std::memory_order_relaxed);
+	}
+	uint64_t GetPresentLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_presentLatency;
+	}
+	// us, 0 outside of Linux
+	uint64_t GetLayerRenderLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_layerRenderLatency;
+	}
+	uint64_t GetLayerHandoffLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_layerHandoffLatency;
+	}
+	uint64_t GetLayerCopyLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_layerCopyLatency;
+	}
+	// 0: composition, 1: color correction, 2: FFR, 3: copy to the encoder
+	double GetGpuPassAverage(int pass) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_gpuPassMs[pass];
+	}
+	// us
+	uint64_t GetGpuQueueWaitAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_gpuQueueWait;
+	}
+	uint64_t GetCompositorFramesDroppedTotal() {
+		return m_compositorFramesDroppedTotal.load(std::memory_order_relaxed);
+	}
+	uint64_t GetCompositorFramesDroppedInSecond() {
+		return m_compositorFramesDroppedInSecondPrev.load(std::memory_order_relaxed);
+	}
+	uint64_t GetCompositorFramesLateInSecond() {
+		return m_compositorFramesLateInSecondPrev.load(std::memory_order_relaxed);
+	}
+	uint64_t GetDuplicateFramesSkippedInSecond() {
+		return m_duplicateFramesSkippedInSecondPrev.load(std::memory_order_relaxed);
+	}
+	uint64_t GetLateFramesDroppedInSecond() {
+		return m_lateFramesDroppedInSecondPrev.load(std::memory_order_relaxed);
+	}
+	uint64_t GetExpiredFramesDroppedInSecond() {
+		return m_expiredFramesDroppedInSecondPrev.load(std::memory_order_relaxed);
+	}
+	// Over the previous second, in us
+	uint64_t GetVSyncJitterAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_vsyncJitterAveragePrev;
+	}
+	uint64_t GetVSyncJitterMax() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_vsyncJitterMaxPrev;
+	}
+	// Output of the encoder over the previous second, in mbit/s
+	double GetEncodedBitrate() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_encodedBitratePrev;
+	}
+	uint64_t GetEncodedFrameSizeAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_encodedFrameBytesPrev;
+	}
+	// IDR and I frames
+	uint64_t GetIntraFramesInSecond() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_intraFramesInSecondPrev;
+	}
+	// 0 if the encoder does not report it
+	double GetEncodeQpAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_encodeQpPrev;
+	}
+	// us, 0 if the encoder does not report it
+	uint64_t GetEncoderLatencyAverage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_encoderLatencyPrev;
+	}
+	// Encode latency in percent of the frame interval times the encoder pipeline depth, or the
+	// utilization of the video encoder engine when it is higher. Above 100 the encoder cannot keep
+	// up with the frame rate, whatever the bitrate.
+	uint32_t GetEncoderLoad() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_encoderLoadPrev;
+	}
+	// Encoder output in percent of the target bitrate. Close to 100 the rate control spends the
+	// whole budget, so the bitrate limits the quality.
+	uint32_t GetBitrateUsage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_bitrateUsagePrev;
+	}
+	// Sampled on its own thread, see GpuMonitor
+	GpuUtilization GetGpuUtilization() {
+		return m_gpuMonitor.GetUtilization();
+	}
+	// Over the previous second, in us
+	uint64_t GetStagePercentile(Stage stage, Percentile percentile) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_stagePercentilesPrev[stage][percentile];
+	}
+
+	// In Mbps, chosen by the BitrateController when the adaptive bitrate is enabled
+	void SetBitrate(uint64_t bitrate) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_bitrate = bitrate;
+	}
+
+	// In bits, the video of one frame the network carries in a frame interval. 0 while the
+	// bandwidth is unknown.
+	void SetMaxFrameSize(uint64_t bits) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_maxFrameSize = bits;
+	}
 
 	bool CheckBitrateUpdated() {
-		if (m_enableAdaptiveBitrate) {
-			uint64_t latencyUs = m_sendLatency; // using video stream transport latency
-			if (latencyUs != 0) { // check valid latency
-				if (latencyUs > m_adaptiveBitrateTarget + m_adaptiveBitrateThreshold) {
-					if (m_bitrate <= 5 + m_adaptiveBitrateDownRate)
-						m_bitrate = 5; // minimum bitrate 5mbps
-					else
-						m_bitrate -= m_adaptiveBitrateDownRate;
-				} else if (latencyUs < m_adaptiveBitrateTarget - m_adaptiveBitrateThreshold) {
-					if (m_bitrate >= m_adaptiveBitrateMaximum - m_adaptiveBitrateUpRate)
-						m_bitrate = m_adaptiveBitrateMaximum; // maximum bitrate
-					else if (m_bitrateSent > m_bitrate * m_adaptiveBitrateLightLoadThreshold * (m_framesPrevious == 0 ? m_refreshRate : m_framesPrevious) / m_refreshRate)
-						m_bitrate += m_adaptiveBitrateUpRate; // increase bitrate if sent mbps is higher than set bitrate threshold (set bitrate * load threshold * valid framerate)
-				}
-			}
-			if (m_bitrateUpdated != m_bitrate) { // bitrate changed
-				m_bitrateUpdated = m_bitrate;
-				return true;
-			}
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// The cap follows the bandwidth estimate, which moves with every report
+		bool capChanged = (m_maxFrameSize == 0) != (m_maxFrameSizeUpdated == 0)
+			|| std::abs((double)m_maxFrameSize - (double)m_maxFrameSizeUpdated) > m_maxFrameSizeUpdated * MAX_FRAME_SIZE_THRESHOLD;
+		if (m_bitrateUpdated != m_bitrate || capChanged) { // bitrate changed
+			m_bitrateUpdated = m_bitrate;
+			m_maxFrameSizeUpdated = m_maxFrameSize;
+			return true;
 		}
 		return false;
 	}
 
 	void Reset() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
 		for(int i = 0; i < 6; i++) {
 			m_statistics[i] = 0;
 		}
 		m_statisticsCount = 0;
 	}
 	void Add(float total, float encode, float send, float decode, float fps, float ping) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
 		m_statistics[0] += total;
 		m_statistics[1] += encode;
 		m_statistics[2] += send;
@@ -150,25 +512,76 @@ public:
 		m_statisticsCount++;
 	}
 	float Get(uint32_t i) {
+		std::unique_lock<std::mutex> lock(m_mutex);
 		return (m_statistics[i] / m_statisticsCount);
 	}
 
-	float m_hmdBattery;
-	bool m_hmdPlugged;
-	float m_leftControllerBattery;
-	float m_rightControllerBattery;
+	std::atomic<float> m_hmdBattery{ 0 };
+	std::atomic<bool> m_hmdPlugged{ false };
+	std::atomic<float> m_leftControllerBattery{ 0 };
+	std::atomic<float> m_rightControllerBattery{ 0 };
 
 private:
+	static uint64_t ElapsedUs(uint64_t fromNs, uint64_t toNs) {
+		return toNs > fromNs ? (toNs - fromNs) / 1000 : 0;
+	}
+
+	static void Smooth(uint64_t &average, uint64_t latencyUs) {
+		if (average == 0) {
+			average = latencyUs;
+		} else {
+			average = latencyUs * 0.1 + average * 0.9;
+		}
+	}
+
 	void ResetSecond() {
-		m_packetsSentInSecondPrev = m_packetsSentInSecond;
-		m_bitsSentInSecondPrev = m_bitsSentInSecond;
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_packetsSentInSecondPrev = m_packetsSentInSecond.exchange(0, std::memory_order_relaxed);
+		m_bitsSentInSecondPrev = m_bitsSentInSecond.exchange(0, std::memory_order_relaxed);
 		m_bitrateSent = m_bitsSentInSecondPrev / BITS_IN_MBIT;
-		m_packetsSentInSecond = 0;
-		m_bitsSentInSecond = 0;
 
 		m_framesPrevious = m_framesInSecond;
 		m_framesInSecond = 0;
 
+		m_presentsCoalescedInSecondPrev = m_presentsCoalescedInSecond.exchange(0, std::memory_order_relaxed);
+
+		m_compositorFramesDroppedInSecondPrev = m_compositorFramesDroppedInSecond.exchange(0, std::memory_order_relaxed);
+		m_compositorFramesLateInSecondPrev = m_compositorFramesLateInSecond.exchange(0, std::memory_order_relaxed);
+		m_duplicateFramesSkippedInSecondPrev = m_duplicateFramesSkippedInSecond.exchange(0, std::memory_order_relaxed);
+		m_lateFramesDroppedInSecondPrev = m_lateFramesDroppedInSecond.exchange(0, std::memory_order_relaxed);
+		m_expiredFramesDroppedInSecondPrev = m_expiredFramesDroppedInSecond.exchange(0, std::memory_order_relaxed);
+
+		m_vsyncJitterAveragePrev = m_vsyncJitterCount ? m_vsyncJitterTotalUs / m_vsyncJitterCount : 0;
+		m_vsyncJitterMaxPrev = m_vsyncJitterMaxUs;
+		m_vsyncJitterTotalUs = 0;
+		m_vsyncJitterCount = 0;
+		m_vsyncJitterMaxUs = 0;
+
+		m_encodedBitratePrev = m_encodedBytesInSecond * 8. / BITS_IN_MBIT;
+		m_encodedFrameBytesPrev = m_framesPrevious ? m_encodedBytesInSecond / m_framesPrevious : 0;
+		m_intraFramesInSecondPrev = m_intraFramesInSecond;
+		m_encodeQpPrev = m_encodeQpCount ? m_encodeQpTotal / m_encodeQpCount : 0;
+		m_encoderLatencyPrev = m_encoderLatencyCount ? m_encoderLatencyTotalUs / m_encoderLatencyCount : 0;
+		if (m_encodeSampleCount != 0) {
+			double frameIntervalUs = (double)US_IN_S / (m_refreshRate > 0 ? m_refreshRate : 1);
+			m_encoderLoadPrev = (uint32_t)(m_encodeLatencyTotalUs / m_encodeSampleCount * 100 / (frameIntervalUs * m_encodePipelineDepth));
+		} else {
+			m_encoderLoadPrev = 0;
+		}
+		// The encode latency does not show an engine shared with other encode sessions
+		int encoderEngine = m_gpuMonitor.GetUtilization().encoder;
+		if (encoderEngine > 0) {
+			m_encoderLoadPrev = std::max(m_encoderLoadPrev, (uint32_t)encoderEngine);
+		}
+		m_bitrateUsagePrev = m_bitrate ? (uint32_t)(m_encodedBitratePrev * 100 / m_bitrate) : 0;
+		m_encodedBytesInSecond = 0;
+		m_intraFramesInSecond = 0;
+		m_encodeQpTotal = 0;
+		m_encodeQpCount = 0;
+		m_encoderLatencyTotalUs = 0;
+		m_encoderLatencyCount = 0;
+
 		m_encodeLatencyMinPrev = m_encodeLatencyMin;
 		m_encodeLatencyMaxPrev = m_encodeLatencyMax;
 		m_encodeLatencyTotalUs = 0;
@@ -176,32 +589,34 @@ private:
 		m_encodeLatencyMin = UINT64_MAX;
 		m_encodeLatencyMax = 0;
 
-		if (m_adaptiveBitrateUseFrametime) {
-			if (m_framesPrevious > 0) {
-				m_adaptiveBitrateTarget = US_IN_S / m_framesPrevious + m_adaptiveBitrateTargetOffset; // fps to frametime (us) + offset
-			}
-			if (m_adaptiveBitrateTarget > m_adaptiveBitrateTargetMaximum) {
-				m_adaptiveBitrateTarget = m_adaptiveBitrateTargetMaximum;
-			}
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			m_stagePercentilesPrev[i][P50] = m_stageHistograms[i].GetPercentile(50);
+			m_stagePercentilesPrev[i][P95] = m_stageHistograms[i].GetPercentile(95);
+			m_stagePercentilesPrev[i][P99] = m_stageHistograms[i].GetPercentile(99);
+			m_stageHistograms[i].Reset();
 		}
 	}
 
-	void CheckAndResetSecond() {
-		time_t current = time(NULL);
-		if (m_current != current) {
-			m_current = current;
+	void TickLoop() {
+		auto next = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(m_tickMutex);
+		while (true) {
+			next += std::chrono::seconds(1);
+			if (m_tickCondition.wait_until(lock, next, [this] { return m_exiting; })) {
+				break;
+			}
 			ResetSecond();
 		}
 	}
 
-	uint64_t m_packetsSentTotal;
-	uint64_t m_packetsSentInSecond;
-	uint64_t m_packetsSentInSecondPrev;
+	std::atomic<uint64_t> m_packetsSentTotal;
+	std::atomic<uint64_t> m_packetsSentInSecond;
+	std::atomic<uint64_t> m_packetsSentInSecondPrev;
 
 	// bit/s
-	uint64_t m_bitsSentTotal;
-	uint64_t m_bitsSentInSecond;
-	uint64_t m_bitsSentInSecondPrev;
+	std::atomic<uint64_t> m_bitsSentTotal;
+	std::atomic<uint64_t> m_bitsSentInSecond;
+	std::atomic<uint64_t> m_bitsSentInSecondPrev;
 	// mbit/s
 	uint64_t m_bitrateSent;
 
@@ -218,31 +633,81 @@ private:
 	uint64_t m_encodeLatencyMinPrev;
 	uint64_t m_encodeLatencyMaxPrev;
 
-	uint64_t m_sendLatency = 0;
-
+	uint64_t m_encodedBytesInSecond;
+	uint64_t m_intraFramesInSecond;
+	double m_encodeQpTotal;
+	uint64_t m_encodeQpCount;
+	uint64_t m_encoderLatencyTotalUs;
+	uint64_t m_encoderLatencyCount;
+	uint32_t m_encodePipelineDepth = 1;
 	// mbit/s
-	uint64_t m_bitrate = Settings::Instance().mEncodeBitrateMBs;
-	uint64_t m_bitrateUpdated = Settings::Instance().mEncodeBitrateMBs;
+	double m_encodedBitratePrev;
+	uint64_t m_encodedFrameBytesPrev;
+	uint64_t m_intraFramesInSecondPrev;
+	double m_encodeQpPrev;
+	uint64_t m_encoderLatencyPrev;
+	// Percentages
+	uint32_t m_encoderLoadPrev;
+	uint32_t m_bitrateUsagePrev;
 
-	int64_t m_refreshRate = Settings::Instance().m_refreshRate;
+	uint64_t m_sendLatency = 0;
+	uint64_t m_clientTransportLatency = 0;
+	uint64_t m_clientDecodeLatency = 0;
+
+	std::atomic<uint64_t> m_presentsCoalescedTotal;
+	std::atomic<uint64_t> m_presentsCoalescedInSecond;
+	std::atomic<uint64_t> m_presentsCoalescedInSecondPrev;
+	uint64_t m_presentLatency = 0;
+	uint64_t m_layerRenderLatency = 0;
+	uint64_t m_layerHandoffLatency = 0;
+	uint64_t m_layerCopyLatency = 0;
+
+	static const int GPU_PASS_COUNT = 4;
+	double m_gpuPassMs[GPU_PASS_COUNT] = {};
+	uint64_t m_gpuQueueWait = 0;
+
+	std::atomic<uint64_t> m_compositorFramesDroppedTotal;
+	std::atomic<uint64_t> m_compositorFramesDroppedInSecond;
+	std::atomic<uint64_t> m_compositorFramesDroppedInSecondPrev;
+	std::atomic<uint64_t> m_compositorFramesLateInSecond;
+	std::atomic<uint64_t> m_compositorFramesLateInSecondPrev;
+	std::atomic<uint64_t> m_duplicateFramesSkippedInSecond;
+	std::atomic<uint64_t> m_duplicateFramesSkippedInSecondPrev;
+	std::atomic<uint64_t> m_lateFramesDroppedInSecond;
+	std::atomic<uint64_t> m_lateFramesDroppedInSecondPrev;
+	std::atomic<uint64_t> m_expiredFramesDroppedInSecond;
+	std::atomic<uint64_t> m_expiredFramesDroppedInSecondPrev;
+
+	uint64_t m_vsyncJitterTotalUs;
+	uint64_t m_vsyncJitterCount;
+	uint64_t m_vsyncJitterMaxUs;
+	uint64_t m_vsyncJitterAveragePrev;
+	uint64_t m_vsyncJitterMaxPrev;
+
+	LatencyHistogram m_stageHistograms[STAGE_COUNT];
+	uint64_t m_stagePercentilesPrev[STAGE_COUNT][PERCENTILE_COUNT];
 
 	// mbit/s
-	bool m_enableAdaptiveBitrate = Settings::Instance().m_enableAdaptiveBitrate;
-	uint64_t m_adaptiveBitrateMaximum = Settings::Instance().m_adaptiveBitrateMaximum;
-	uint64_t m_adaptiveBitrateUpRate = Settings::Instance().m_adaptiveBitrateUpRate;
-	uint64_t m_adaptiveBitrateDownRate = Settings::Instance().m_adaptiveBitrateDownRate;
-	// us
-	bool m_adaptiveBitrateUseFrametime = Settings::Instance().m_adaptiveBitrateUseFrametime;
-	uint64_t m_adaptiveBitrateTarget = Settings::Instance().m_adaptiveBitrateTarget;
-	uint64_t m_adaptiveBitrateTargetMaximum = Settings::Instance().m_adaptiveBitrateTargetMaximum;
-	int32_t m_adaptiveBitrateTargetOffset = Settings::Instance().m_adaptiveBitrateTargetOffset;
-	uint64_t m_adaptiveBitrateThreshold = Settings::Instance().m_adaptiveBitrateThreshold;
-	
-	float m_adaptiveBitrateLightLoadThreshold = Settings::Instance().m_adaptiveBitrateLightLoadThreshold;
+	uint64_t m_bitrate = Settings::Instance().GetLive().mEncodeBitrateMBs;
+	uint64_t m_bitrateUpdated = m_bitrate;
+	// bits, 0 for none
+	uint64_t m_maxFrameSize = 0;
+	uint64_t m_maxFrameSizeUpdated = 0;
+	static constexpr double MAX_FRAME_SIZE_THRESHOLD = 0.1;
 
-	time_t m_current;
+	int64_t m_refreshRate = Settings::Instance().m_refreshRate;
 
 	// Total/Encode/Send/Decode/ClientFPS/Ping
 	float m_statistics[6];
 	uint64_t m_statisticsCount = 0;
+
+	// Guards everything but the atomics
+	std::mutex m_mutex;
+
+	GpuMonitor m_gpuMonitor;
+
+	std::thread m_tickThread;
+	std::mutex m_tickMutex;
+	std::condition_variable m_tickCondition;
+	bool m_exiting = false;
 };
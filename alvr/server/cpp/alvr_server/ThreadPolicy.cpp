@@ -0,0 +1,31 @@
+#include "ThreadPolicy.h"
+
+#include "Logger.h"
+#include "Settings.h"
+
+void ApplyThreadPolicy(ThreadRole role, const char *name) {
+	auto &settings = Settings::Instance();
+
+	uint64_t cpuMask = 0;
+	switch (role) {
+	case THREAD_ROLE_VSYNC:
+		cpuMask = settings.m_vsyncCpuMask;
+		break;
+	case THREAD_ROLE_TRACKING:
+		cpuMask = settings.m_trackingCpuMask;
+		break;
+	case THREAD_ROLE_ENCODER:
+		cpuMask = settings.m_encoderCpuMask;
+		break;
+	default:
+		break;
+	}
+
+	auto result = SetCurrentThreadPolicy(role, settings.m_threadRealtimePriority, cpuMask);
+	if (settings.m_threadRealtimePriority && !result.prioritized) {
+		Info("%s: realtime priority not available, check the rtprio limit.\n", name);
+	}
+	if (cpuMask != 0 && !result.pinned) {
+		Warn("%s: could not pin the thread to the CPUs %llx.\n", name, cpuMask);
+	}
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "shared/threadpolicy.h"
+
+// Applies the thread policy of the settings to the calling thread, name is for the log
+void ApplyThreadPolicy(ThreadRole role, const char *name);
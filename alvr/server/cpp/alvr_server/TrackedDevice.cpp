@@ -1,46 +1,132 @@
 #include "TrackedDevice.h"
 #include "Logger.h"
+#include <cstring>
 
-void TrackedDevice::set_prop(OpenvrProperty prop) {
-    auto key = (vr::ETrackedDeviceProperty)prop.key;
+void PropertyBatch::SetBoolProperty(vr::ETrackedDeviceProperty prop, bool value) {
+    SetProperty(prop, &value, sizeof(value), vr::k_unBoolPropertyTag);
+}
+
+void PropertyBatch::SetFloatProperty(vr::ETrackedDeviceProperty prop, float value) {
+    SetProperty(prop, &value, sizeof(value), vr::k_unFloatPropertyTag);
+}
+
+void PropertyBatch::SetInt32Property(vr::ETrackedDeviceProperty prop, int32_t value) {
+    SetProperty(prop, &value, sizeof(value), vr::k_unInt32PropertyTag);
+}
+
+void PropertyBatch::SetUint64Property(vr::ETrackedDeviceProperty prop, uint64_t value) {
+    SetProperty(prop, &value, sizeof(value), vr::k_unUint64PropertyTag);
+}
+
+void PropertyBatch::SetVec3Property(vr::ETrackedDeviceProperty prop,
+                                    const vr::HmdVector3_t &value) {
+    SetProperty(prop, &value, sizeof(value), vr::k_unHmdVector3PropertyTag);
+}
+
+void PropertyBatch::SetDoubleProperty(vr::ETrackedDeviceProperty prop, double value) {
+    SetProperty(prop, &value, sizeof(value), vr::k_unDoublePropertyTag);
+}
 
-    vr::ETrackedPropertyError result;
+void PropertyBatch::SetStringProperty(vr::ETrackedDeviceProperty prop, const char *value) {
+    SetProperty(prop, value, (uint32_t)strlen(value) + 1, vr::k_unStringPropertyTag);
+}
+
+void PropertyBatch::SetProperty(vr::ETrackedDeviceProperty prop,
+                                const void *value,
+                                uint32_t size,
+                                vr::PropertyTypeTag_t tag) {
+    auto bytes = (const char *)value;
+    m_entries.push_back({prop, tag, std::vector<char>(bytes, bytes + size)});
+}
+
+void PropertyBatch::Add(const OpenvrProperty &prop) {
+    auto key = (vr::ETrackedDeviceProperty)prop.key;
 
     if (prop.type == OpenvrPropertyType::Bool) {
-        result = vr::VRProperties()->SetBoolProperty(this->prop_container, key, prop.value.bool_);
+        SetBoolProperty(key, prop.value.bool_);
     } else if (prop.type == OpenvrPropertyType::Float) {
-        result = vr::VRProperties()->SetFloatProperty(this->prop_container, key, prop.value.float_);
+        SetFloatProperty(key, prop.value.float_);
     } else if (prop.type == OpenvrPropertyType::Int32) {
-        result = vr::VRProperties()->SetInt32Property(this->prop_container, key, prop.value.int32);
+        SetInt32Property(key, prop.value.int32);
     } else if (prop.type == OpenvrPropertyType::Uint64) {
-        result =
-            vr::VRProperties()->SetUint64Property(this->prop_container, key, prop.value.uint64);
+        SetUint64Property(key, prop.value.uint64);
     } else if (prop.type == OpenvrPropertyType::Vector3) {
         auto vec3 = vr::HmdVector3_t{};
         vec3.v[0] = prop.value.vector3[0];
         vec3.v[1] = prop.value.vector3[1];
         vec3.v[2] = prop.value.vector3[2];
-        result = vr::VRProperties()->SetVec3Property(this->prop_container, key, vec3);
+        SetVec3Property(key, vec3);
     } else if (prop.type == OpenvrPropertyType::Double) {
-        result =
-            vr::VRProperties()->SetDoubleProperty(this->prop_container, key, prop.value.double_);
+        SetDoubleProperty(key, prop.value.double_);
     } else if (prop.type == OpenvrPropertyType::String) {
-        result =
-            vr::VRProperties()->SetStringProperty(this->prop_container, key, prop.value.string);
+        // The string may fill the whole buffer without a terminator
+        SetProperty(key,
+                    prop.value.string,
+                    (uint32_t)strnlen(prop.value.string, sizeof(prop.value.string)),
+                    vr::k_unStringPropertyTag);
+        m_entries.back().value.push_back('\0');
     } else {
         Error("Unreachable");
-        result = vr::TrackedProp_Success;
     }
+}
+
+void PropertyBatch::Write(vr::PropertyContainerHandle_t container) {
+    if (m_entries.empty()) {
+        return;
+    }
+
+    std::vector<vr::PropertyWrite_t> writes(m_entries.size());
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        writes[i].prop = m_entries[i].prop;
+        writes[i].writeType = vr::PropertyWrite_Set;
+        writes[i].pvBuffer = m_entries[i].value.data();
+        writes[i].unBufferSize = (uint32_t)m_entries[i].value.size();
+        writes[i].unTag = m_entries[i].tag;
+        writes[i].eError = vr::TrackedProp_Success;
+    }
+
+    vr::VRPropertiesRaw()->WritePropertyBatch(container, writes.data(), (uint32_t)writes.size());
+
+    for (auto &write : writes) {
+        if (write.eError != vr::TrackedProp_Success) {
+            Error("Error setting property %d: %s",
+                  write.prop,
+                  vr::VRPropertiesRaw()->GetPropErrorNameFromEnum(write.eError));
+        }
+    }
+
+    m_entries.clear();
+}
+
+void TrackedDevice::set_prop(OpenvrProperty prop) { set_props(&prop, 1); }
+
+void TrackedDevice::set_props(const OpenvrProperty *props, unsigned int count) {
+    if (this->prop_container == vr::k_ulInvalidPropertyContainer) {
+        this->pending_props.insert(this->pending_props.end(), props, props + count);
+        return;
+    }
+
+    PropertyBatch batch;
+    for (unsigned int i = 0; i < count; i++) {
+        batch.Add(props[i]);
+    }
+    batch.Write(this->prop_container);
+
+    for (unsigned int i = 0; i < count; i++) {
+        auto event_data = vr::VREvent_Data_t{};
+        event_data.property.container = this->prop_container;
+        event_data.property.prop = (vr::ETrackedDeviceProperty)props[i].key;
+        vr::VRServerDriverHost()->VendorSpecificEvent(
+            this->object_id, vr::VREvent_PropertyChanged, event_data, 0.);
+    }
+}
 
-    if (result != vr::TrackedProp_Success) {
-        Error("Error setting property %d: %s",
-              key,
-              vr::VRPropertiesRaw()->GetPropErrorNameFromEnum(result));
+void TrackedDevice::write_activation_props(PropertyBatch &batch) {
+    // Written last, so that they override the defaults of the device
+    for (auto &prop : this->pending_props) {
+        batch.Add(prop);
     }
+    this->pending_props.clear();
 
-    auto event_data = vr::VREvent_Data_t{};
-    event_data.property.container = this->prop_container;
-    event_data.property.prop = key;
-    vr::VRServerDriverHost()->VendorSpecificEvent(
-        this->object_id, vr::VREvent_PropertyChanged, event_data, 0.);
-}
\ No newline at end of file
+    batch.Write(this->prop_container);
+}
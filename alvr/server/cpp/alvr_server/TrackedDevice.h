@@ -3,6 +3,37 @@
 #include "bindings.h"
 #include "openvr_driver.h"
 #include <map>
+#include <vector>
+
+// Property writes of a device collected and sent with a single WritePropertyBatch() call, instead
+// of a call to vrserver for each property. The setters mirror vr::CVRPropertyHelpers.
+class PropertyBatch {
+  public:
+    void SetBoolProperty(vr::ETrackedDeviceProperty prop, bool value);
+    void SetFloatProperty(vr::ETrackedDeviceProperty prop, float value);
+    void SetInt32Property(vr::ETrackedDeviceProperty prop, int32_t value);
+    void SetUint64Property(vr::ETrackedDeviceProperty prop, uint64_t value);
+    void SetVec3Property(vr::ETrackedDeviceProperty prop, const vr::HmdVector3_t &value);
+    void SetDoubleProperty(vr::ETrackedDeviceProperty prop, double value);
+    void SetStringProperty(vr::ETrackedDeviceProperty prop, const char *value);
+    void SetProperty(vr::ETrackedDeviceProperty prop,
+                     const void *value,
+                     uint32_t size,
+                     vr::PropertyTypeTag_t tag);
+    void Add(const OpenvrProperty &prop);
+
+    // Sends the writes and clears the batch. Failed writes are logged.
+    void Write(vr::PropertyContainerHandle_t container);
+
+  private:
+    struct Entry {
+        vr::ETrackedDeviceProperty prop;
+        vr::PropertyTypeTag_t tag;
+        // The value is copied, the batch can outlive the arguments
+        std::vector<char> value;
+    };
+    std::vector<Entry> m_entries;
+};
 
 class TrackedDevice {
   public:
@@ -11,6 +42,15 @@ class TrackedDevice {
     vr::PropertyContainerHandle_t prop_container = vr::k_ulInvalidPropertyContainer;
 
     void set_prop(OpenvrProperty prop);
+    // Before the activation the properties are kept and written with the ones of Activate()
+    void set_props(const OpenvrProperty *props, unsigned int count);
 
     TrackedDevice(uint64_t device_path) : device_path(device_path) {}
-};
\ No newline at end of file
+
+  protected:
+    // Called by Activate() once prop_container is set
+    void write_activation_props(PropertyBatch &batch);
+
+  private:
+    std::vector<OpenvrProperty> pending_props;
+};
@@ -0,0 +1,76 @@
+#include "TrackingThread.h"
+
+#include <chrono>
+
+#include "ClientConnection.h"
+#include "Logger.h"
+#include "OvrHMD.h"
+#include "ThreadPolicy.h"
+
+TrackingThread::TrackingThread(OvrHmd *hmd)
+	: m_hmd(hmd) {}
+
+void TrackingThread::Run()
+{
+	ApplyThreadPolicy(THREAD_ROLE_TRACKING, "TrackingThread");
+
+	while (!m_exit) {
+		{
+			std::unique_lock<std::mutex> lock(m_wakeMutex);
+			m_wake.wait_for(lock, std::chrono::milliseconds(100), [&] {
+				return m_exit || (m_middle.load() & FRESH);
+			});
+		}
+		if (m_exit || !(m_middle.load() & FRESH)) {
+			continue;
+		}
+
+		m_front = m_middle.exchange(m_front) & ~FRESH;
+		Apply(m_samples[m_front]);
+	}
+
+	Info("TrackingThread: %llu tracking samples superseded before they were applied.\n", (unsigned long long)m_coalesced.load());
+}
+
+void TrackingThread::Shutdown()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_exit = true;
+	}
+	m_wake.notify_one();
+}
+
+void TrackingThread::Push(const TrackingInfo &info, uint64_t receiveTime)
+{
+	m_samples[m_back] = { info, receiveTime };
+	uint8_t previous = m_middle.exchange(m_back | FRESH);
+	m_back = previous & ~FRESH;
+
+	if (previous & FRESH) {
+		// The thread has not taken the previous one yet, so it is awake or about to be
+		m_coalesced++;
+	} else {
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wake.notify_one();
+	}
+}
+
+void TrackingThread::Apply(const Sample &sample)
+{
+	auto &listener = m_hmd->m_Listener;
+	if (!listener) {
+		return;
+	}
+
+	TimeSync sendBuf = {};
+	sendBuf.mode = 3;
+	sendBuf.serverTime = sample.receiveTime - listener->m_clockSync.GetTimeDiff(sample.receiveTime);
+	sendBuf.trackingRecvFrameIndex = sample.info.targetTimestampNs;
+	TimeSyncSend(sendBuf);
+
+	listener->m_frameTrace.Record(
+		sample.info.targetTimestampNs, FrameTrace::TRACKING_RECEIVED, sample.receiveTime);
+
+	m_hmd->OnPoseUpdated(sample.info);
+}
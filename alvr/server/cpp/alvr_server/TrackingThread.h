@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "bindings.h"
+#include "shared/threadtools.h"
+
+class OvrHmd;
+
+// Applies the tracking samples received from the client on a thread of realtime priority, so the
+// pose reaches SteamVR at the same latency however busy the Rust runtime that received it is.
+//
+// The handover is a lock-free triple buffer: the input task never waits, and the thread always
+// applies the newest sample. Samples it did not get to in time are superseded and skipped. Only the
+// applied sample is acknowledged with a TimeSync mode 3, skipped samples never become the pose of
+// a video frame.
+class TrackingThread : public CThread
+{
+public:
+	TrackingThread(OvrHmd *hmd);
+
+	virtual void Run();
+
+	void Shutdown();
+
+	// Called by the input task, never blocks on the tracking thread
+	void Push(const TrackingInfo &info, uint64_t receiveTime);
+
+private:
+	struct Sample {
+		TrackingInfo info;
+		uint64_t receiveTime;
+	};
+
+	void Apply(const Sample &sample);
+
+	static constexpr uint8_t FRESH = 4;
+
+	OvrHmd *m_hmd;
+	std::atomic<bool> m_exit{false};
+
+	Sample m_samples[3] = {};
+	// Index of the last written sample, with FRESH until the thread takes it
+	std::atomic<uint8_t> m_middle{0};
+	// Written by the input task only
+	uint8_t m_back = 1;
+	// Read by the tracking thread only
+	uint8_t m_front = 2;
+	std::atomic<uint64_t> m_coalesced{0};
+
+	// Only to sleep while there is no sample, the samples do not go through it
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wake;
+};
@@ -0,0 +1,61 @@
+#include "VSyncScheduler.h"
+
+#include <algorithm>
+
+#include "Logger.h"
+#include "Settings.h"
+
+VSyncScheduler::VSyncScheduler()
+	: m_shift(0)
+{
+	Reset();
+}
+
+void VSyncScheduler::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_shift = 0;
+	m_lastFrameIndex = 0;
+	m_waits.clear();
+	m_waits.reserve(WINDOW_FRAMES);
+	m_target = Settings::Instance().m_vsyncQueueWaitTarget;
+}
+
+void VSyncScheduler::OnClientFrame(uint64_t frameIndex, uint64_t decoderOutput, uint64_t rendered)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (frameIndex == 0 || decoderOutput == 0 || rendered < decoderOutput) {
+		return;
+	}
+	if (frameIndex == m_lastFrameIndex) {
+		// The next frame missed the client compositor. The window starts over so that the increase
+		// waits for a full window of frames at the new phase.
+		Debug("VSyncScheduler: frame %llu rendered again, vsync %lld us earlier\n", frameIndex, REPEAT_STEP_US);
+		m_shift -= REPEAT_STEP_US;
+		m_waits.clear();
+		return;
+	}
+	m_lastFrameIndex = frameIndex;
+
+	m_waits.push_back(rendered - decoderOutput);
+	if (m_waits.size() < WINDOW_FRAMES) {
+		return;
+	}
+
+	auto percentile = m_waits.begin() + (size_t)(WAIT_PERCENTILE * m_waits.size());
+	std::nth_element(m_waits.begin(), percentile, m_waits.end());
+	int64_t error = (int64_t)*percentile - (int64_t)m_target;
+	int64_t step = std::clamp((int64_t)(error * GAIN), -MAX_STEP_US, MAX_STEP_US);
+	if (step != 0) {
+		Debug("VSyncScheduler: queue wait %llu us, vsync %lld us later\n", *percentile, step);
+		m_shift += step;
+	}
+	m_waits.clear();
+}
+
+int64_t VSyncScheduler::TakeShift()
+{
+	return m_shift.exchange(0);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Moves the phase of the server vsync so that video frames leave the client decoder just before
+// the client compositor takes them. The client reports, for every frame it renders, when the
+// decoder output it and when it was rendered: the time in between is queue wait that only adds
+// latency, while a frame that comes too late is shown one client frame later. The scheduler keeps
+// a low percentile of the queue wait at the target margin, delaying the vsync while even the
+// tightest frames wait longer than that, and moves it earlier as soon as the client renders a
+// frame twice. The phase is circular, a shift of a whole frame interval changes nothing, so the
+// accumulated shift needs no bound.
+class VSyncScheduler
+{
+public:
+	VSyncScheduler();
+
+	void Reset();
+
+	// Last frame rendered by the client, from every client statistics report. Times are on the
+	// client clock in microseconds, zero for the stages the frame skipped.
+	void OnClientFrame(uint64_t frameIndex, uint64_t decoderOutput, uint64_t rendered);
+
+	// Change of the vsync phase since the last call, in microseconds. Positive delays the vsync.
+	int64_t TakeShift();
+
+private:
+	// Queue waits per phase update, about half a second
+	static constexpr size_t WINDOW_FRAMES = 45;
+	// The wait at this percentile is kept at the target, the jitter of the other frames is covered
+	// by their longer wait
+	static constexpr double WAIT_PERCENTILE = 0.1;
+	static constexpr double GAIN = 0.5;
+	// SteamVR copes with small steps of the vsync better than with jumps
+	static constexpr int64_t MAX_STEP_US = 1000;
+	// Applied earlier when the client renders the same frame again
+	static constexpr int64_t REPEAT_STEP_US = 1000;
+
+	// Reports arrive on the network thread, the vsync is generated on its own thread.
+	std::mutex m_mutex;
+	std::atomic<int64_t> m_shift;
+	uint64_t m_lastFrameIndex;
+	std::vector<uint64_t> m_waits;
+	uint64_t m_target;
+};
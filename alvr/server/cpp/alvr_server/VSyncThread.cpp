@@ -1,36 +1,141 @@
 #include "VSyncThread.h"
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+// Windows SDK 10.0.17134 and later
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <errno.h>
+#include <time.h>
+#endif
 
+#include "ClientConnection.h"
+#include "Settings.h"
+#include "Statistics.h"
+#include "ThreadPolicy.h"
 #include "Utils.h"
 #include "Logger.h"
 
+namespace {
+	// The timers of the OS still wake up tens of us late, the end of the wait is spun
+	const uint64_t SPIN_TIME_US = 100;
+
+	// Waits until a time of GetCounterUs
+	class VSyncTimer {
+	public:
+		explicit VSyncTimer(bool precise) : m_precise(precise) {
+#ifdef _WIN32
+			if (m_precise) {
+				// Windows 10 1803 and later, the default timers follow the 1 to 15.6 ms tick
+				m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+				if (!m_timer) {
+					Warn("High resolution timer unavailable (%d), VSync may jitter by up to 1 ms.\n", GetLastError());
+				}
+			}
+#endif
+		}
+
+		~VSyncTimer() {
+#ifdef _WIN32
+			if (m_timer) {
+				CloseHandle(m_timer);
+			}
+#endif
+		}
+
+		void WaitUntil(uint64_t targetUs) {
+			uint64_t now = GetCounterUs();
+			if (!m_precise) {
+				if (targetUs > now) {
+					std::this_thread::sleep_for(std::chrono::microseconds(targetUs - now));
+				}
+				return;
+			}
+
+			if (targetUs > now + SPIN_TIME_US) {
+				uint64_t wakeUs = targetUs - SPIN_TIME_US;
+#ifdef _WIN32
+				LARGE_INTEGER dueTime;
+				// Relative, in 100 ns units
+				dueTime.QuadPart = -(LONGLONG)(wakeUs - now) * 10;
+				if (m_timer && SetWaitableTimer(m_timer, &dueTime, 0, nullptr, nullptr, FALSE)) {
+					WaitForSingleObject(m_timer, INFINITE);
+				} else {
+					std::this_thread::sleep_for(std::chrono::microseconds(wakeUs - now));
+				}
+#else
+				// GetCounterUs is CLOCK_MONOTONIC
+				timespec wakeTime;
+				wakeTime.tv_sec = wakeUs / 1000000;
+				wakeTime.tv_nsec = (wakeUs % 1000000) * 1000;
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, nullptr) == EINTR) {}
+#endif
+			}
+			while (GetCounterUs() < targetUs) {
+				std::this_thread::yield();
+			}
+		}
+
+	private:
+		bool m_precise;
+#ifdef _WIN32
+		HANDLE m_timer = nullptr;
+#endif
+	};
+}
+
 VSyncThread::VSyncThread(int refreshRate)
 	: m_bExit(false)
 	, m_refreshRate(refreshRate) {}
 
 // Trigger VSync if elapsed time from previous VSync is larger than 30ms.
 void VSyncThread::Run() {
+	ApplyThreadPolicy(THREAD_ROLE_VSYNC, "VSyncThread");
+
+	VSyncTimer timer(Settings::Instance().m_preciseVSync);
 	m_PreviousVsync = 0;
 
 	while (!m_bExit) {
-		uint64_t current = GetTimestampUs();
-		uint64_t interval = 1000 * 1000 / m_refreshRate;
+		uint64_t current = GetCounterUs();
+		int64_t shift = 0;
+		uint32_t divider = 1;
+		std::shared_ptr<Statistics> statistics;
+		{
+			std::unique_lock<std::mutex> lock(m_listenerMutex);
+			if (m_listener) {
+				shift = m_listener->m_vsyncScheduler.TakeShift();
+				divider = m_listener->m_idleController.GetVSyncDivider();
+				statistics = m_listener->m_Statistics;
+			}
+		}
+		uint64_t interval = (uint64_t)std::max<int64_t>(1000 * 1000 / m_refreshRate + shift, 0);
+		uint64_t target = m_PreviousVsync + interval;
 
-		if (m_PreviousVsync + interval > current) {
-			uint64_t sleepTimeMs = (m_PreviousVsync + interval - current) / 1000;
+		if (target > current) {
+			// Microseconds, the scheduler moves the phase by less than a millisecond
+			Debug("Sleep %llu us for next VSync.\n", target - current);
+			timer.WaitUntil(target);
 
-			if (sleepTimeMs > 0) {
-				Debug("Sleep %llu ms for next VSync.\n", sleepTimeMs);
-				std::this_thread::sleep_for(std::chrono::milliseconds(sleepTimeMs));
-			}
+			m_PreviousVsync = target;
 
-			m_PreviousVsync += interval;
+			if (statistics) {
+				statistics->VSyncJitter((int64_t)(GetCounterUs() - target));
+			}
 		}
 		else {
+			// Restarts the schedule after a stall, this is not counted as jitter
 			m_PreviousVsync = current;
 		}
+		// While idle the vsync keeps its phase but SteamVR only gets every divider-th one, the full
+		// rate is back on the next vsync after the headset is worn again
+		m_vsyncCount++;
+		if (m_vsyncCount % divider != 0) {
+			continue;
+		}
 		Debug("Generate VSync Event by VSyncThread\n");
 		vr::VRServerDriverHost()->VsyncEvent(0);
 	}
@@ -43,3 +148,8 @@ void VSyncThread::Shutdown() {
 void VSyncThread::SetRefreshRate(int refreshRate) {
 	m_refreshRate = refreshRate;
 }
+
+void VSyncThread::SetListener(std::shared_ptr<ClientConnection> listener) {
+	std::unique_lock<std::mutex> lock(m_listenerMutex);
+	m_listener = listener;
+}
@@ -1,6 +1,11 @@
 #pragma once
+#include <memory>
+#include <mutex>
+
 #include "shared/threadtools.h"
 
+class ClientConnection;
+
 // VSync Event Thread
 
 class VSyncThread : public CThread
@@ -15,8 +20,15 @@ public:
 
 	void SetRefreshRate(int refreshRate);
 
+	// The phase of the vsync follows the VSyncScheduler of the listener once it is set
+	void SetListener(std::shared_ptr<ClientConnection> listener);
+
 private:
 	bool m_bExit;
 	uint64_t m_PreviousVsync;
 	int m_refreshRate = 60;
+	uint64_t m_vsyncCount = 0;
+
+	std::mutex m_listenerMutex;
+	std::shared_ptr<ClientConnection> m_listener;
 };
@@ -0,0 +1,487 @@
+#include "VideoRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "ALVR-common/packet_types.h"
+#include "Av1Obu.h"
+#include "FoveationVars.h"
+#include "Logger.h"
+#include "Settings.h"
+
+namespace {
+	// Frames waiting for the disk, beyond them the recording skips to the next keyframe
+	const size_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+	const size_t FILE_BUFFER_SIZE = 4 * 1024 * 1024;
+	// Timestamps are in units of 100 us
+	const uint64_t TIMESTAMP_SCALE_NS = 100000;
+	// The timestamps of the blocks are 16 bit, relative to their cluster
+	const uint64_t MAX_CLUSTER_SPAN = 20000;
+
+	const uint32_t ID_EBML = 0x1A45DFA3;
+	const uint32_t ID_EBML_VERSION = 0x4286;
+	const uint32_t ID_EBML_READ_VERSION = 0x42F7;
+	const uint32_t ID_EBML_MAX_ID_LENGTH = 0x42F2;
+	const uint32_t ID_EBML_MAX_SIZE_LENGTH = 0x42F3;
+	const uint32_t ID_DOC_TYPE = 0x4282;
+	const uint32_t ID_DOC_TYPE_VERSION = 0x4287;
+	const uint32_t ID_DOC_TYPE_READ_VERSION = 0x4285;
+	const uint32_t ID_SEGMENT = 0x18538067;
+	const uint32_t ID_INFO = 0x1549A966;
+	const uint32_t ID_TIMESTAMP_SCALE = 0x2AD7B1;
+	const uint32_t ID_MUXING_APP = 0x4D80;
+	const uint32_t ID_WRITING_APP = 0x5741;
+	const uint32_t ID_TRACKS = 0x1654AE6B;
+	const uint32_t ID_TRACK_ENTRY = 0xAE;
+	const uint32_t ID_TRACK_NUMBER = 0xD7;
+	const uint32_t ID_TRACK_UID = 0x73C5;
+	const uint32_t ID_TRACK_TYPE = 0x83;
+	const uint32_t ID_FLAG_LACING = 0x9C;
+	const uint32_t ID_CODEC_ID = 0x86;
+	const uint32_t ID_CODEC_PRIVATE = 0x63A2;
+	const uint32_t ID_VIDEO = 0xE0;
+	const uint32_t ID_PIXEL_WIDTH = 0xB0;
+	const uint32_t ID_PIXEL_HEIGHT = 0xBA;
+	const uint32_t ID_CLUSTER = 0x1F43B675;
+	const uint32_t ID_TIMESTAMP = 0xE7;
+	const uint32_t ID_SIMPLE_BLOCK = 0xA3;
+
+	void PutId(std::vector<uint8_t> &out, uint32_t id) {
+		// The length of an ID is in its leading bits already
+		int bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+		for (int i = bytes - 1; i >= 0; i--) {
+			out.push_back((uint8_t)(id >> (i * 8)));
+		}
+	}
+
+	void PutSize(std::vector<uint8_t> &out, uint64_t size) {
+		// All ones is reserved for the unknown size
+		int bytes = 1;
+		while (bytes < 8 && size >= (1ull << (7 * bytes)) - 1) {
+			bytes++;
+		}
+		uint64_t value = size | (1ull << (7 * bytes));
+		for (int i = bytes - 1; i >= 0; i--) {
+			out.push_back((uint8_t)(value >> (i * 8)));
+		}
+	}
+
+	void PutBytes(std::vector<uint8_t> &out, uint32_t id, const uint8_t *data, size_t size) {
+		PutId(out, id);
+		PutSize(out, size);
+		out.insert(out.end(), data, data + size);
+	}
+
+	void PutMaster(std::vector<uint8_t> &out, uint32_t id, const std::vector<uint8_t> &children) {
+		PutBytes(out, id, children.data(), children.size());
+	}
+
+	void PutString(std::vector<uint8_t> &out, uint32_t id, const char *value) {
+		PutBytes(out, id, (const uint8_t *)value, strlen(value));
+	}
+
+	void PutUInt(std::vector<uint8_t> &out, uint32_t id, uint64_t value) {
+		int bytes = 1;
+		while (bytes < 8 && (value >> (8 * bytes)) != 0) {
+			bytes++;
+		}
+		PutId(out, id);
+		PutSize(out, bytes);
+		for (int i = bytes - 1; i >= 0; i--) {
+			out.push_back((uint8_t)(value >> (i * 8)));
+		}
+	}
+
+	void PutBigEndian(std::vector<uint8_t> &out, uint32_t value, int bytes) {
+		for (int i = bytes - 1; i >= 0; i--) {
+			out.push_back((uint8_t)(value >> (i * 8)));
+		}
+	}
+
+	struct Nal {
+		const uint8_t *data;
+		size_t size;
+	};
+
+	// NAL units of an Annex-B frame, without their start codes
+	std::vector<Nal> SplitNals(const uint8_t *data, size_t size) {
+		std::vector<Nal> nals;
+		size_t start = 0;
+		bool started = false;
+		size_t i = 0;
+		while (i + 2 < size) {
+			if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+				i++;
+				continue;
+			}
+			if (started) {
+				// Drops the zero of a 4 byte start code, NAL units end with a stop bit
+				size_t end = i;
+				while (end > start && data[end - 1] == 0) {
+					end--;
+				}
+				nals.push_back({ data + start, end - start });
+			}
+			i += 3;
+			start = i;
+			started = true;
+		}
+		if (started && start < size) {
+			nals.push_back({ data + start, size - start });
+		}
+		return nals;
+	}
+
+	// Payload of a NAL unit without the emulation prevention bytes
+	std::vector<uint8_t> Unescape(const uint8_t *data, size_t size) {
+		std::vector<uint8_t> rbsp;
+		rbsp.reserve(size);
+		int zeros = 0;
+		for (size_t i = 0; i < size; i++) {
+			if (zeros >= 2 && data[i] == 3) {
+				zeros = 0;
+				continue;
+			}
+			zeros = data[i] == 0 ? zeros + 1 : 0;
+			rbsp.push_back(data[i]);
+		}
+		return rbsp;
+	}
+
+	// AVCDecoderConfigurationRecord (ISO 14496-15 5.3.3)
+	bool AvcConfig(const std::vector<Nal> &nals, std::vector<uint8_t> &config) {
+		const Nal *sps = nullptr;
+		const Nal *pps = nullptr;
+		for (auto &nal : nals) {
+			int type = nal.data[0] & 0x1F;
+			if (type == 7 && !sps) {
+				sps = &nal;
+			} else if (type == 8 && !pps) {
+				pps = &nal;
+			}
+		}
+		if (!sps || !pps || sps->size < 4) {
+			return false;
+		}
+
+		config = { 1, sps->data[1], sps->data[2], sps->data[3], 0xFF, 0xE1 };
+		PutBigEndian(config, (uint32_t)sps->size, 2);
+		config.insert(config.end(), sps->data, sps->data + sps->size);
+		config.push_back(1);
+		PutBigEndian(config, (uint32_t)pps->size, 2);
+		config.insert(config.end(), pps->data, pps->data + pps->size);
+		return true;
+	}
+
+	// HEVCDecoderConfigurationRecord (ISO 14496-15 8.3.3)
+	bool HevcConfig(const std::vector<Nal> &nals, bool tenBit, std::vector<uint8_t> &config) {
+		const Nal *parameterSets[3] = {};
+		for (auto &nal : nals) {
+			int type = (nal.data[0] >> 1) & 0x3F;
+			if (type >= 32 && type <= 34 && !parameterSets[type - 32]) {
+				parameterSets[type - 32] = &nal;
+			}
+		}
+		const Nal *sps = parameterSets[1];
+		if (!parameterSets[0] || !sps || !parameterSets[2] || sps->size < 2) {
+			return false;
+		}
+		// The general profile_tier_level follows the first byte of the SPS payload
+		auto rbsp = Unescape(sps->data + 2, sps->size - 2);
+		if (rbsp.size() < 13) {
+			return false;
+		}
+
+		uint8_t bitDepth = tenBit ? 2 : 0;
+		config = { 1 };
+		config.insert(config.end(), rbsp.begin() + 1, rbsp.begin() + 13);
+		// No spatial segmentation or parallelism, 4:2:0, no frame rate, one temporal layer and
+		// 4 byte NAL unit lengths
+		config.insert(config.end(), { 0xF0, 0x00, 0xFC, 0xFD, (uint8_t)(0xF8 | bitDepth), (uint8_t)(0xF8 | bitDepth), 0x00, 0x00, 0x0F, 3 });
+		for (auto nal : parameterSets) {
+			config.push_back(0x80 | ((nal->data[0] >> 1) & 0x3F));
+			PutBigEndian(config, 1, 2);
+			PutBigEndian(config, (uint32_t)nal->size, 2);
+			config.insert(config.end(), nal->data, nal->data + nal->size);
+		}
+		return true;
+	}
+
+	// AV1CodecConfigurationRecord of the AV1 ISOBMFF binding, followed by the sequence header
+	bool Av1Config(const std::vector<uint8_t> &frame, bool tenBit, std::vector<uint8_t> &config) {
+		const uint8_t *data = frame.data();
+		size_t size = frame.size();
+		Av1Obu obu;
+		while (size > 0 && ParseAv1Obu(data, size, &obu)) {
+			if (obu.type == AV1_OBU_SEQUENCE_HEADER) {
+				// seq_profile leads the payload, after the header and the leb128 size
+				size_t offset = (data[0] & 0x4) ? 2 : 1;
+				while (offset < obu.size && (data[offset] & 0x80)) {
+					offset++;
+				}
+				offset++;
+				if (offset >= obu.size) {
+					return false;
+				}
+				uint8_t profile = data[offset] >> 5;
+				// The level is not parsed, 31 places no constraint. Decoders configure themselves
+				// from the sequence header.
+				config = { 0x81, (uint8_t)((profile << 5) | 31), (uint8_t)((tenBit ? 0x40 : 0) | 0x0C), 0 };
+				config.insert(config.end(), data, data + obu.size);
+				return true;
+			}
+			data += obu.size;
+			size -= obu.size;
+		}
+		return false;
+	}
+
+	// Like FrameRender::GetEncodingResolution of the platforms
+	void EncodingResolution(uint32_t *width, uint32_t *height) {
+		if (Settings::Instance().m_enableFoveatedRendering) {
+			auto foveation = CalculateFoveationVars();
+			*width = foveation.optimizedEyeWidth * 2;
+			*height = foveation.optimizedEyeHeight;
+		} else {
+			*width = Settings::Instance().m_renderWidth;
+			*height = Settings::Instance().m_renderHeight;
+		}
+	}
+}
+
+VideoRecorder::~VideoRecorder() {
+	Stop();
+}
+
+bool VideoRecorder::Start(const std::string &path, int codec) {
+	std::unique_lock<std::mutex> controlLock(m_controlMutex);
+	if (m_recording) {
+		return false;
+	}
+
+	m_fileBuffer.resize(FILE_BUFFER_SIZE);
+	m_file = std::ofstream();
+	m_file.rdbuf()->pubsetbuf(m_fileBuffer.data(), m_fileBuffer.size());
+	m_file.open(path, std::ios::binary);
+	if (!m_file) {
+		Warn("VideoRecorder: Cannot create %hs\n", path.c_str());
+		return false;
+	}
+
+	m_codec = codec;
+	m_headerWritten = false;
+	m_lastTimestamp = 0;
+	m_cluster.clear();
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_queue.clear();
+		m_queuedBytes = 0;
+		m_waitKeyframe = true;
+		m_stopping = false;
+	}
+	m_thread = std::thread(&VideoRecorder::Run, this);
+	m_recording = true;
+
+	Info("VideoRecorder: Recording to %hs\n", path.c_str());
+	return true;
+}
+
+void VideoRecorder::Stop() {
+	std::unique_lock<std::mutex> controlLock(m_controlMutex);
+	if (!m_recording) {
+		return;
+	}
+	m_recording = false;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_one();
+	m_thread.join();
+}
+
+bool VideoRecorder::IsRecording() {
+	return m_recording;
+}
+
+void VideoRecorder::Frame(const uint8_t *buf, int len, uint64_t targetTimestampNs, bool idr) {
+	if (!m_recording.load(std::memory_order_relaxed)) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_stopping) {
+			return;
+		}
+		if (m_waitKeyframe) {
+			if (!idr) {
+				return;
+			}
+			m_waitKeyframe = false;
+		}
+		if (m_queuedBytes + len > MAX_QUEUED_BYTES) {
+			Warn("VideoRecorder: The disk cannot keep up, skipping to the next keyframe.\n");
+			m_waitKeyframe = true;
+			return;
+		}
+		m_queue.push_back({ std::vector<uint8_t>(buf, buf + len), targetTimestampNs, idr });
+		m_queuedBytes += len;
+	}
+	m_condition.notify_one();
+}
+
+void VideoRecorder::Run() {
+	while (true) {
+		QueuedFrame frame;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+			// The queued frames are still written when stopping
+			if (m_queue.empty()) {
+				break;
+			}
+			frame = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_queuedBytes -= frame.data.size();
+		}
+
+		if (!m_headerWritten) {
+			if (!frame.idr || !WriteHeader(frame.data)) {
+				continue;
+			}
+			m_headerWritten = true;
+			m_firstTimestampNs = frame.targetTimestampNs;
+		}
+		WriteBlock(frame);
+	}
+
+	FlushCluster();
+	m_file.close();
+	if (!m_headerWritten) {
+		Warn("VideoRecorder: No keyframe with parameter sets was sent, the recording is empty.\n");
+	} else {
+		Info("VideoRecorder: Recording stopped.\n");
+	}
+}
+
+bool VideoRecorder::WriteHeader(const std::vector<uint8_t> &keyframe) {
+	bool tenBit = Settings::Instance().m_use10bitEncoder;
+	std::vector<uint8_t> codecPrivate;
+	const char *codecId;
+	bool valid;
+	if (m_codec == ALVR_CODEC_AV1) {
+		codecId = "V_AV1";
+		valid = Av1Config(keyframe, tenBit, codecPrivate);
+	} else if (m_codec == ALVR_CODEC_H265) {
+		codecId = "V_MPEGH/ISO/HEVC";
+		valid = HevcConfig(SplitNals(keyframe.data(), keyframe.size()), tenBit, codecPrivate);
+	} else {
+		codecId = "V_MPEG4/ISO/AVC";
+		valid = AvcConfig(SplitNals(keyframe.data(), keyframe.size()), codecPrivate);
+	}
+	if (!valid) {
+		return false;
+	}
+
+	uint32_t width, height;
+	EncodingResolution(&width, &height);
+
+	std::vector<uint8_t> ebml;
+	PutUInt(ebml, ID_EBML_VERSION, 1);
+	PutUInt(ebml, ID_EBML_READ_VERSION, 1);
+	PutUInt(ebml, ID_EBML_MAX_ID_LENGTH, 4);
+	PutUInt(ebml, ID_EBML_MAX_SIZE_LENGTH, 8);
+	PutString(ebml, ID_DOC_TYPE, "matroska");
+	PutUInt(ebml, ID_DOC_TYPE_VERSION, 4);
+	PutUInt(ebml, ID_DOC_TYPE_READ_VERSION, 2);
+
+	std::vector<uint8_t> info;
+	PutUInt(info, ID_TIMESTAMP_SCALE, TIMESTAMP_SCALE_NS);
+	PutString(info, ID_MUXING_APP, "ALVR");
+	PutString(info, ID_WRITING_APP, "ALVR");
+
+	std::vector<uint8_t> video;
+	PutUInt(video, ID_PIXEL_WIDTH, width);
+	PutUInt(video, ID_PIXEL_HEIGHT, height);
+
+	std::vector<uint8_t> track;
+	PutUInt(track, ID_TRACK_NUMBER, 1);
+	PutUInt(track, ID_TRACK_UID, 1);
+	PutUInt(track, ID_TRACK_TYPE, 1);
+	PutUInt(track, ID_FLAG_LACING, 0);
+	PutString(track, ID_CODEC_ID, codecId);
+	PutBytes(track, ID_CODEC_PRIVATE, codecPrivate.data(), codecPrivate.size());
+	PutMaster(track, ID_VIDEO, video);
+
+	std::vector<uint8_t> tracks;
+	PutMaster(tracks, ID_TRACK_ENTRY, track);
+
+	std::vector<uint8_t> header;
+	PutMaster(header, ID_EBML, ebml);
+	// Unknown size, the file is complete after every cluster
+	PutId(header, ID_SEGMENT);
+	header.insert(header.end(), { 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF });
+	PutMaster(header, ID_INFO, info);
+	PutMaster(header, ID_TRACKS, tracks);
+	m_file.write((const char *)header.data(), header.size());
+	return true;
+}
+
+void VideoRecorder::WriteBlock(const QueuedFrame &frame) {
+	uint64_t timestamp = frame.targetTimestampNs > m_firstTimestampNs ? (frame.targetTimestampNs - m_firstTimestampNs) / TIMESTAMP_SCALE_NS : 0;
+	timestamp = std::max(timestamp, m_lastTimestamp);
+	m_lastTimestamp = timestamp;
+
+	// Clusters start at keyframes, to seek to them
+	if (!m_cluster.empty() && (frame.idr || timestamp - m_clusterTimestamp > MAX_CLUSTER_SPAN)) {
+		FlushCluster();
+	}
+	if (m_cluster.empty()) {
+		m_clusterTimestamp = timestamp;
+	}
+
+	// Matroska stores the NAL units behind their length and the OBUs without temporal delimiters
+	m_blockData.clear();
+	if (m_codec == ALVR_CODEC_AV1) {
+		const uint8_t *data = frame.data.data();
+		size_t size = frame.data.size();
+		Av1Obu obu;
+		while (size > 0 && ParseAv1Obu(data, size, &obu)) {
+			if (obu.type != AV1_OBU_TEMPORAL_DELIMITER) {
+				m_blockData.insert(m_blockData.end(), data, data + obu.size);
+			}
+			data += obu.size;
+			size -= obu.size;
+		}
+	} else {
+		for (auto &nal : SplitNals(frame.data.data(), frame.data.size())) {
+			PutBigEndian(m_blockData, (uint32_t)nal.size, 4);
+			m_blockData.insert(m_blockData.end(), nal.data, nal.data + nal.size);
+		}
+	}
+
+	PutId(m_cluster, ID_SIMPLE_BLOCK);
+	PutSize(m_cluster, 4 + m_blockData.size());
+	// Track number as a 1 byte vint, relative timestamp and the keyframe flag
+	m_cluster.push_back(0x81);
+	PutBigEndian(m_cluster, (uint32_t)(timestamp - m_clusterTimestamp), 2);
+	m_cluster.push_back(frame.idr ? 0x80 : 0);
+	m_cluster.insert(m_cluster.end(), m_blockData.begin(), m_blockData.end());
+}
+
+void VideoRecorder::FlushCluster() {
+	if (m_cluster.empty()) {
+		return;
+	}
+	std::vector<uint8_t> timestamp;
+	PutUInt(timestamp, ID_TIMESTAMP, m_clusterTimestamp);
+
+	std::vector<uint8_t> header;
+	PutId(header, ID_CLUSTER);
+	PutSize(header, timestamp.size() + m_cluster.size());
+	header.insert(header.end(), timestamp.begin(), timestamp.end());
+	m_file.write((const char *)header.data(), header.size());
+	m_file.write((const char *)m_cluster.data(), m_cluster.size());
+	m_cluster.clear();
+}
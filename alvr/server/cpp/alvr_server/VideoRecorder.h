@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records the encoded video to a Matroska file as it is sent, without encoding it again. The
+// frames are copied to a queue and muxed by a thread of its own, the send path never waits for the
+// disk. Blocks are timestamped with the tracking frame index of their frame. The segment and the
+// clusters are written as they complete, a recording cut short is still readable.
+class VideoRecorder
+{
+public:
+	~VideoRecorder();
+
+	// The recording begins with the next keyframe. Returns false if a recording is running or the
+	// file cannot be created.
+	bool Start(const std::string &path, int codec);
+	// Writes the queued frames and closes the file.
+	void Stop();
+	bool IsRecording();
+
+	// Frame of the primary stream, from SendVideo. Copied if recording.
+	void Frame(const uint8_t *buf, int len, uint64_t targetTimestampNs, bool idr);
+
+private:
+	struct QueuedFrame {
+		std::vector<uint8_t> data;
+		uint64_t targetTimestampNs;
+		bool idr;
+	};
+
+	void Run();
+	// From the parameter sets of a keyframe, returns false if they are not all there
+	bool WriteHeader(const std::vector<uint8_t> &keyframe);
+	void WriteBlock(const QueuedFrame &frame);
+	void FlushCluster();
+
+	// Start and Stop come from the web server
+	std::mutex m_controlMutex;
+	std::atomic<bool> m_recording{ false };
+	int m_codec = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<QueuedFrame> m_queue;
+	size_t m_queuedBytes = 0;
+	// Frames are dropped until the next keyframe once the queue overflowed
+	bool m_waitKeyframe = true;
+	bool m_stopping = false;
+	std::thread m_thread;
+
+	// Writer thread
+	std::ofstream m_file;
+	std::vector<char> m_fileBuffer;
+	bool m_headerWritten = false;
+	uint64_t m_firstTimestampNs = 0;
+	uint64_t m_lastTimestamp = 0;
+	std::vector<uint8_t> m_cluster;
+	uint64_t m_clusterTimestamp = 0;
+	// Length prefixed NAL units or OBUs of the frame being written
+	std::vector<uint8_t> m_blockData;
+};
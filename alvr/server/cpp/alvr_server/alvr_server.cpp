@@ -13,11 +13,15 @@
 #include "Paths.h"
 #include "Settings.h"
 #include "Statistics.h"
+#include "ThreadPolicy.h"
 #include "TrackedDevice.h"
+#include "TrackingThread.h"
 #include "bindings.h"
 #include "driverlog.h"
 #include "openvr_driver.h"
 #include <cstring>
+#include <ctime>
+#include <filesystem>
 #include <map>
 #include <optional>
 
@@ -156,6 +160,20 @@ const unsigned char *COMPRESS_AXIS_ALIGNED_CSO_PTR;
 unsigned int COMPRESS_AXIS_ALIGNED_CSO_LEN;
 const unsigned char *COLOR_CORRECTION_CSO_PTR;
 unsigned int COLOR_CORRECTION_CSO_LEN;
+const unsigned char *COMPOSITION_CS_HLSL_PTR;
+unsigned int COMPOSITION_CS_HLSL_LEN;
+const unsigned char *FOVEATED_RENDERING_HLSLI_PTR;
+unsigned int FOVEATED_RENDERING_HLSLI_LEN;
+const unsigned char *RGB_TO_NV12_CS_HLSL_PTR;
+unsigned int RGB_TO_NV12_CS_HLSL_LEN;
+const unsigned char *CONTENT_SCALE_CS_HLSL_PTR;
+unsigned int CONTENT_SCALE_CS_HLSL_LEN;
+const unsigned char *REED_SOLOMON_CS_HLSL_PTR;
+unsigned int REED_SOLOMON_CS_HLSL_LEN;
+const unsigned char *FRAME_RENDER_COMP_SPV_PTR;
+unsigned int FRAME_RENDER_COMP_SPV_LEN;
+const unsigned char *RGB_TO_YUV_COMP_SPV_PTR;
+unsigned int RGB_TO_YUV_COMP_SPV_LEN;
 
 const char *g_sessionPath;
 const char *g_driverRootDir;
@@ -165,17 +183,23 @@ void (*LogWarn)(const char *stringPtr);
 void (*LogInfo)(const char *stringPtr);
 void (*LogDebug)(const char *stringPtr);
 void (*DriverReadyIdle)(bool setDefaultChaprone);
-void (*VideoSend)(VideoFrame header, unsigned char *buf, int len);
+void (*VideoSend)(VideoFrame header, unsigned char *buf, int len, bool idr);
+void (*VideoSendBatch)(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool idr, bool frameEnd);
+void (*VideoConfigSend)(unsigned char streamIndex, const unsigned char *buf, int len);
 void (*HapticsSend)(unsigned long long path, float duration_s, float frequency, float amplitude);
 void (*TimeSyncSend)(TimeSync packet);
+void (*StatisticsSend)(StatisticsSummary summary);
+void (*GraphStatisticsSend)(GraphStatistics statistics);
 void (*ShutdownRuntime)();
 unsigned long long (*PathStringToHash)(const char *path);
 
-void *CppEntryPoint(const char *interface_name, int *return_code) {
+void *CppEntryPoint(const char *interface_name,
+                    int *return_code,
+                    const OpenvrSettings *settings) {
     // Initialize path constants
     init_paths();
 
-    Settings::Instance().Load();
+    Settings::Instance().Load(*settings);
 
     load_debug_privilege();
 
@@ -188,15 +212,22 @@ void *CppEntryPoint(const char *interface_name, int *return_code) {
     }
 }
 
-void InitializeStreaming() {
-    // set correct client ip
-    Settings::Instance().Load();
+void InitializeStreaming(const OpenvrSettings *settings) {
+    Settings::Instance().Load(*settings);
 
     if (g_driver_provider.hmd) {
         g_driver_provider.hmd->StartStreaming();
     }
 }
 
+void UpdateSettings(const OpenvrSettings *settings) {
+    Settings::Instance().ApplyLive(*settings);
+
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        g_driver_provider.hmd->m_Listener->ApplySettings();
+    }
+}
+
 void DeinitializeStreaming() {
     // nothing to do
 }
@@ -207,18 +238,72 @@ void RequestIDR() {
     }
 }
 
-void InputReceive(TrackingInfo data) {
+bool WriteFrameTrace() {
     if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
-        g_driver_provider.hmd->m_Listener->m_Statistics->CountPacket(sizeof(TrackingInfo));
+        auto path = std::filesystem::path(g_sessionPath).parent_path() / "frame_trace.json";
+        return g_driver_provider.hmd->m_Listener->m_frameTrace.Write(path.string());
+    }
+    return false;
+}
 
-        uint64_t Current = GetTimestampUs();
-        TimeSync sendBuf = {};
-        sendBuf.mode = 3;
-        sendBuf.serverTime = Current - g_driver_provider.hmd->m_Listener->m_TimeDiff;
-        sendBuf.trackingRecvFrameIndex = data.targetTimestampNs;
-        TimeSyncSend(sendBuf);
+bool CaptureFrames() {
+#ifdef _WIN32
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_encoder) {
+        auto path = std::filesystem::path(g_sessionPath).parent_path() / "frame_capture";
+        g_driver_provider.hmd->m_encoder->CaptureFrames(path.string());
+        return true;
+    }
+#endif
+    return false;
+}
 
-        g_driver_provider.hmd->OnPoseUpdated(data);
+bool StartRecording() {
+    if (!g_driver_provider.hmd || !g_driver_provider.hmd->m_Listener) {
+        return false;
+    }
+
+    char name[64];
+    time_t now = time(nullptr);
+    strftime(name, sizeof(name), "recording_%Y-%m-%d_%H-%M-%S.mkv", localtime(&now));
+    auto directory = std::filesystem::path(g_sessionPath).parent_path() / "recordings";
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    if (!g_driver_provider.hmd->m_Listener->m_videoRecorder.Start((directory / name).string(),
+                                                                  Settings::Instance().m_codec)) {
+        return false;
+    }
+    // The recording begins with a keyframe
+    RequestIDR();
+    return true;
+}
+
+void StopRecording() {
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        g_driver_provider.hmd->m_Listener->m_videoRecorder.Stop();
+    }
+}
+
+bool GetClientTimeDiff(long long *timeDiff) {
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        auto &clockSync = g_driver_provider.hmd->m_Listener->m_clockSync;
+        if (clockSync.GetErrorBound() != UINT64_MAX) {
+            *timeDiff = clockSync.GetTimeDiff(GetTimestampUs());
+            return true;
+        }
+    }
+    return false;
+}
+
+void InputReceive(TrackingInfo data, unsigned int packetSize) {
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        g_driver_provider.hmd->m_Listener->m_Statistics->CountPacket(packetSize);
+        g_driver_provider.hmd->m_Listener->m_foveationController.OnTracking(data);
+
+        // Acknowledged and applied on the tracking thread
+        if (g_driver_provider.hmd->m_trackingThread) {
+            g_driver_provider.hmd->m_trackingThread->Push(data, GetTimestampUs());
+        }
     }
 }
 void TimeSyncReceive(TimeSync data) {
@@ -232,6 +317,39 @@ void VideoErrorReportReceive() {
         g_driver_provider.hmd->m_encoder->OnPacketLoss();
     }
 }
+void VideoFrameLossReceive(unsigned long long lastGoodFrameIndex) {
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        auto &listener = g_driver_provider.hmd->m_Listener;
+        listener->OnFecFailure();
+        // Encoders identify the frames by their target timestamp
+        uint64_t lastGoodTimestampNs;
+        if (listener->m_frameTrace.FindVideoFrame(lastGoodFrameIndex, &lastGoodTimestampNs)) {
+            g_driver_provider.hmd->m_encoder->OnFrameLoss(lastGoodTimestampNs);
+        } else {
+            g_driver_provider.hmd->m_encoder->OnPacketLoss();
+        }
+    }
+}
+void SpectatorReportReceive(unsigned long long packetsLost,
+                            unsigned long long packetsReceived,
+                            bool requestIdr) {
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        g_driver_provider.hmd->m_Listener->m_fecController.OnSpectatorStatistics(
+            packetsLost, packetsLost + packetsReceived);
+        if (requestIdr) {
+            g_driver_provider.hmd->m_encoder->OnPacketLoss();
+        }
+    }
+}
+void TransportFeedbackReceive(const TransportPacketGroup *groups,
+                              unsigned int count,
+                              unsigned int packetsReceived,
+                              unsigned int packetsLost) {
+    if (g_driver_provider.hmd && g_driver_provider.hmd->m_Listener) {
+        g_driver_provider.hmd->m_Listener->m_bitrateController.OnTransportFeedback(
+            groups, count, packetsReceived, packetsLost);
+    }
+}
 
 void ShutdownSteamvr() {
     if (g_driver_provider.hmd) {
@@ -240,6 +358,11 @@ void ShutdownSteamvr() {
     }
 }
 
+bool SetNetworkThreadPolicy(bool realtimePriority, unsigned long long cpuMask) {
+    auto result = SetCurrentThreadPolicy(THREAD_ROLE_NETWORK, realtimePriority, cpuMask);
+    return (result.prioritized || !realtimePriority) && (result.pinned || cpuMask == 0);
+}
+
 void SetOpenvrProperty(unsigned long long top_level_path, OpenvrProperty prop) {
     auto device_it = g_driver_provider.tracked_devices.find(top_level_path);
 
@@ -248,6 +371,16 @@ void SetOpenvrProperty(unsigned long long top_level_path, OpenvrProperty prop) {
     }
 }
 
+void SetOpenvrProperties(unsigned long long top_level_path,
+                         const OpenvrProperty *props,
+                         unsigned int count) {
+    auto device_it = g_driver_provider.tracked_devices.find(top_level_path);
+
+    if (device_it != g_driver_provider.tracked_devices.end()) {
+        device_it->second->set_props(props, count);
+    }
+}
+
 void SetViewsConfig(ViewsConfigData config) {
     if (g_driver_provider.hmd) {
         g_driver_provider.hmd->SetViewsConfig(config);
@@ -58,6 +58,10 @@ struct TrackingInfo {
 
     unsigned long long targetTimestampNs;
     unsigned char mounted;
+
+    // Gaze of the eyes relative to the head, -Z forward, from headsets with eye tracking
+    TrackingQuat eyeGaze;
+    bool eyeGazeValid;
 };
 // Client >----(mode 0)----> Server
 // Client <----(mode 1)----< Server
@@ -89,11 +93,51 @@ struct TimeSync {
 
     float fps;
 
+    // Average difference between the pose a frame was rendered with and the latest prediction for
+    // its display time, in degrees and millimeters.
+    float predictionErrorRotation;
+    float predictionErrorPosition;
+
+    // Prediction horizon of the tracking samples, and average of the display time of the frames
+    // minus the time they were predicted for over the last second, in us.
+    unsigned int predictionHorizon;
+    int predictionResidual;
+
+    // Time the client spent recovering lost shards with FEC over the last second, in us.
+    unsigned int fecRecoveryTime;
+
+    // Average GPU time of the decompression and eye passes of the client over the last second,
+    // in us. Zero if the client cannot measure them.
+    unsigned int gpuTimeFfr;
+    unsigned int gpuTimeEyes;
+
+    // Timestamps of the last submitted frame on the client clock, in us. Zero for the stages the
+    // frame skipped. The server joins them with its own in the frame trace.
+    unsigned long long traceFrameIndex;
+    unsigned long long traceTracking;
+    unsigned long long traceReceivedFirst;
+    unsigned long long traceReceivedLast;
+    unsigned long long traceDecoderInput;
+    unsigned long long traceDecoderOutput;
+    unsigned long long traceRendered;
+    unsigned long long traceSubmit;
+
+    // Arrival of the last video frame followed by a newer one on the client clock, in us, for the
+    // congestion control of the server. arrivalPackets is 0 if none.
+    unsigned long long arrivalFrameIndex;
+    unsigned long long arrivalFirst;
+    unsigned long long arrivalLast;
+    unsigned int arrivalPackets;
+
     // Following value are filled by server only when mode=1.
     unsigned int serverTotalLatency;
 
     // Following value are filled by server only when mode=3.
     unsigned long long trackingRecvFrameIndex;
+
+    // Set by the server on reception: the time the kernel received the packet, in us since the
+    // epoch. 0 if the socket does not report it.
+    unsigned long long receiveTime;
 };
 struct VideoFrame {
     unsigned int type; // ALVR_PACKET_TYPE_VIDEO_FRAME
@@ -107,8 +151,29 @@ struct VideoFrame {
     unsigned int frameByteSize;
     unsigned int fecIndex;
     unsigned short fecPercentage;
+    // Eye encoded in the frame in dual stream mode, 0 for the left one, always 0 otherwise
+    unsigned char streamIndex;
+    // Percentage of the width and height of each eye filled by the image, which is drawn in the top
+    // left corner of its half of the frame. 100 unless dynamic resolution lowered it.
+    unsigned char contentScale;
+    // Foveation center shift of the frame: left eye x, y then right eye x, y in 1/127 of the
+    // FoveationVars::centerShift range. -128 first for the center of the settings.
+    signed char foveationCenter[4];
+    // Slice of the frame in the packet, each slice is a FEC block of its own that the client
+    // recovers and decodes without waiting for the others. frameByteSize, fecIndex and
+    // fecPercentage are those of the slice. sliceCount is only set in the packets of the last slice,
+    // 0 before it: the encoder may hand out the first slices before it knows how many there are.
+    unsigned char sliceIndex;
+    unsigned char sliceCount;
     // char frameBuffer[];
 };
+// Payload of a single video packet, like iovec. Used by VideoSendBatch.
+struct VideoPacketPayload {
+    const unsigned char *buf;
+    int len;
+    // First slice or FEC parity, sent without waiting for the frame pacer
+    bool priority;
+};
 enum OpenvrPropertyType {
     Bool,
     Float,
@@ -135,11 +200,241 @@ struct OpenvrProperty {
     OpenvrPropertyValue value;
 };
 
+#define OPENVR_SETTINGS_STRING_SIZE 256
+
+// Snapshot of the openvr_config section of the session, built once by the Rust side and copied into
+// Settings. The fields and their names follow OpenvrConfig. Strings are null terminated.
+struct OpenvrSettings {
+    unsigned long long universe_id;
+    char headset_serial_number[OPENVR_SETTINGS_STRING_SIZE];
+    char headset_tracking_system_name[OPENVR_SETTINGS_STRING_SIZE];
+    char headset_model_number[OPENVR_SETTINGS_STRING_SIZE];
+    char headset_driver_version[OPENVR_SETTINGS_STRING_SIZE];
+    char headset_manufacturer_name[OPENVR_SETTINGS_STRING_SIZE];
+    char headset_render_model_name[OPENVR_SETTINGS_STRING_SIZE];
+    char headset_registered_device_type[OPENVR_SETTINGS_STRING_SIZE];
+    unsigned int eye_resolution_width;
+    unsigned int eye_resolution_height;
+    unsigned int target_eye_resolution_width;
+    unsigned int target_eye_resolution_height;
+    float seconds_from_vsync_to_photons;
+    bool force_3dof;
+    bool tracking_ref_only;
+    bool enable_vive_tracker_proxy;
+    bool aggressive_keyframe_resend;
+    unsigned int adapter_index;
+    int encoder_adapter_index;
+    bool encoder_dedicated_device;
+    unsigned int codec;
+    unsigned int refresh_rate;
+    bool use_10bit_encoder;
+    unsigned int sw_thread_count;
+    bool sw_frame_threads;
+    bool sw_intra_refresh;
+    bool sw_pin_threads;
+    bool sw_hold_frame_deadline;
+    bool drop_late_frames;
+    bool precise_vsync;
+    bool idle_power_save;
+    bool thread_realtime_priority;
+    unsigned long long encoder_cpu_mask;
+    unsigned long long vsync_cpu_mask;
+    unsigned long long tracking_cpu_mask;
+    unsigned int frame_capture_history;
+    bool enable_encode_arbitration;
+    unsigned int encoder_max_sessions;
+    unsigned int concurrent_encodes;
+    bool enable_vsync_phase_lock;
+    unsigned long long vsync_queue_wait_target;
+    unsigned int slices_per_frame;
+    unsigned int intra_refresh_frames;
+    bool reference_frame_invalidation;
+    bool dual_stream_encoding;
+    bool yuv_output;
+    unsigned int linux_encode_pipeline_depth;
+    unsigned int nvenc_pipeline_depth;
+    bool nvenc_motion_hints;
+    bool nvenc_inter_eye_hints;
+    unsigned int amf_pipeline_depth;
+    bool amf_pre_analysis;
+    unsigned long long encode_bitrate_mbs;
+    bool enable_adaptive_bitrate;
+    unsigned long long bitrate_maximum;
+    unsigned long long latency_target;
+    bool latency_use_frametime;
+    unsigned long long latency_target_maximum;
+    int latency_target_offset;
+    unsigned long long latency_threshold;
+    unsigned long long bitrate_up_rate;
+    unsigned long long bitrate_down_rate;
+    float bitrate_light_load_threshold;
+    char controllers_tracking_system_name[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_manufacturer_name[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_model_number[OPENVR_SETTINGS_STRING_SIZE];
+    char render_model_name_left_controller[OPENVR_SETTINGS_STRING_SIZE];
+    char render_model_name_right_controller[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_serial_number[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_type_left[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_type_right[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_registered_device_type[OPENVR_SETTINGS_STRING_SIZE];
+    char controllers_input_profile_path[OPENVR_SETTINGS_STRING_SIZE];
+    int controllers_mode_idx;
+    bool controllers_enabled;
+    float position_offset[3];
+    int tracking_frame_offset;
+    float controller_pose_offset;
+    bool serverside_prediction;
+    float linear_velocity_cutoff;
+    float angular_velocity_cutoff;
+    float position_offset_left[3];
+    float rotation_offset_left[3];
+    float haptics_intensity;
+    float haptics_amplitude_curve;
+    float haptics_min_duration;
+    float haptics_low_duration_amplitude_multiplier;
+    float haptics_low_duration_range;
+    bool use_headset_tracking_system;
+    bool enable_foveated_rendering;
+    float foveation_center_size_x;
+    float foveation_center_size_y;
+    float foveation_center_shift_x;
+    float foveation_center_shift_y;
+    float foveation_edge_ratio_x;
+    float foveation_edge_ratio_y;
+    bool foveation_follow_gaze;
+    bool enable_foveated_encoding;
+    unsigned int foveated_encoding_qp_offset;
+    bool enable_dynamic_resolution;
+    float dynamic_resolution_minimum_scale;
+    bool enable_color_correction;
+    float brightness;
+    float contrast;
+    float saturation;
+    float gamma;
+    float sharpening;
+    bool enable_fec;
+    bool fec_on_gpu;
+    unsigned int video_packet_size;
+    bool linux_async_reprojection;
+};
+
 struct ViewsConfigData {
     EyeFov fov[2];
     float ipd_m;
 };
 
+// Statistics card of the dashboard, sent about once per second
+// Packets sent in one burst and acknowledged by the transport feedback of the client. The send
+// time is on the clock of the socket, the arrival times on the client clock, in us.
+struct TransportPacketGroup {
+    unsigned long long sendUs;
+    unsigned long long firstArrivalUs;
+    unsigned long long lastArrivalUs;
+    unsigned long long bytes;
+};
+
+// Over the previous second, in ms
+struct LatencyPercentiles {
+    double p50;
+    double p95;
+    double p99;
+};
+
+struct StatisticsSummary {
+    unsigned long long totalPackets;
+    unsigned long long packetRate;
+    unsigned long long packetsLostTotal;
+    unsigned long long packetsLostPerSecond;
+    unsigned long long totalSent; // MB
+    double sentRate; // Mbps
+    unsigned long long bitrate;
+    double encodedBitrate; // Mbps
+    unsigned int bitrateUsage; // % of bitrate
+    double encodedFrameSize; // KB
+    unsigned long long intraFramesInSecond;
+    double encodeQp; // 0 if unknown
+    unsigned int encoderLoad; // % of the frame interval
+    // Latencies in ms
+    double encoderLatency;
+    double ping;
+    double totalLatency;
+    double encodeLatency;
+    double sendLatency;
+    double decodeLatency;
+    int fecPercentage;
+    unsigned long long fecFailureTotal;
+    unsigned long long fecFailureInSecond;
+    // Spent by the client recovering lost shards over the last second
+    double fecRecoveryTime; // ms
+    // GPU time of the client render passes, averaged over the last second
+    double clientGpuTimeFfr; // ms
+    double clientGpuTimeEyes; // ms
+    unsigned long long presentsCoalescedInSecond;
+    unsigned long long presentLatency;
+    unsigned long long compositorFramesDroppedInSecond;
+    unsigned long long compositorFramesLateInSecond;
+    unsigned long long duplicateFramesSkippedInSecond;
+    // Frames dropped before encoding as they could no longer be displayed on time
+    unsigned long long lateFramesDroppedInSecond;
+    unsigned long long expiredFramesDroppedInSecond;
+    // VsyncEvent time minus its scheduled time, over the last second
+    double vsyncJitter; // ms
+    double vsyncJitterMax; // ms
+    // Submission to completion of the frame work on the GPU, minus its GPU time
+    double gpuQueueWait; // ms
+    // GPU utilization sampled by GpuMonitor, -1 if unknown
+    int gpuGraphicsLoad; // %
+    int gpuEncoderLoad; // %
+    int gpuClock; // MHz
+    int pcieTxRate; // MB/s
+    int pcieRxRate; // MB/s
+    double clientFPS;
+    double serverFPS;
+    float predictionErrorRotation;
+    float predictionErrorPosition;
+    // Measured by the client, in ms
+    double predictionHorizon;
+    double predictionResidual;
+    LatencyPercentiles composePercentiles;
+    LatencyPercentiles encodePercentiles;
+    LatencyPercentiles sendPercentiles;
+    LatencyPercentiles transportPercentiles;
+    LatencyPercentiles decodePercentiles;
+    LatencyPercentiles renderPercentiles;
+    // Linux layer, see Statistics::Stage
+    LatencyPercentiles layerRenderPercentiles;
+    LatencyPercentiles layerHandoffPercentiles;
+    LatencyPercentiles presentPickupPercentiles;
+    // Percentages
+    int batteryHMD;
+    int batteryLeft;
+    int batteryRight;
+};
+
+// Graph points of the dashboard, sent with every client statistics report. Times in ms.
+struct GraphStatistics {
+    unsigned long long time;
+    double totalLatency;
+    double receiveLatency;
+    double renderTime;
+    double idleTime;
+    double waitTime;
+    double encodeLatency;
+    double sendLatency;
+    double decodeLatency;
+    double clientIdleTime;
+    double clientFPS;
+    double serverFPS;
+    double gpuCompositionTime;
+    double gpuColorCorrectionTime;
+    double gpuFfrTime;
+    double gpuEncoderCopyTime;
+    double layerRenderTime;
+    double layerHandoffTime;
+    double presentPickupTime;
+    double layerCopyTime;
+};
+
 extern "C" const unsigned char *FRAME_RENDER_VS_CSO_PTR;
 extern "C" unsigned int FRAME_RENDER_VS_CSO_LEN;
 extern "C" const unsigned char *FRAME_RENDER_PS_CSO_PTR;
@@ -150,6 +445,21 @@ extern "C" const unsigned char *COMPRESS_AXIS_ALIGNED_CSO_PTR;
 extern "C" unsigned int COMPRESS_AXIS_ALIGNED_CSO_LEN;
 extern "C" const unsigned char *COLOR_CORRECTION_CSO_PTR;
 extern "C" unsigned int COLOR_CORRECTION_CSO_LEN;
+extern "C" const unsigned char *COMPOSITION_CS_HLSL_PTR;
+extern "C" unsigned int COMPOSITION_CS_HLSL_LEN;
+extern "C" const unsigned char *FOVEATED_RENDERING_HLSLI_PTR;
+extern "C" unsigned int FOVEATED_RENDERING_HLSLI_LEN;
+extern "C" const unsigned char *RGB_TO_NV12_CS_HLSL_PTR;
+extern "C" unsigned int RGB_TO_NV12_CS_HLSL_LEN;
+extern "C" const unsigned char *CONTENT_SCALE_CS_HLSL_PTR;
+extern "C" unsigned int CONTENT_SCALE_CS_HLSL_LEN;
+extern "C" const unsigned char *REED_SOLOMON_CS_HLSL_PTR;
+extern "C" unsigned int REED_SOLOMON_CS_HLSL_LEN;
+// Linux only, SPIR-V compiled by build.rs
+extern "C" const unsigned char *FRAME_RENDER_COMP_SPV_PTR;
+extern "C" unsigned int FRAME_RENDER_COMP_SPV_LEN;
+extern "C" const unsigned char *RGB_TO_YUV_COMP_SPV_PTR;
+extern "C" unsigned int RGB_TO_YUV_COMP_SPV_LEN;
 
 extern "C" const char *g_sessionPath;
 extern "C" const char *g_driverRootDir;
@@ -159,25 +469,71 @@ extern "C" void (*LogWarn)(const char *stringPtr);
 extern "C" void (*LogInfo)(const char *stringPtr);
 extern "C" void (*LogDebug)(const char *stringPtr);
 extern "C" void (*DriverReadyIdle)(bool setDefaultChaprone);
-extern "C" void (*VideoSend)(VideoFrame header, unsigned char *buf, int len);
+// `idr` marks the frames the send queue can resume on after dropping stale frames
+extern "C" void (*VideoSend)(VideoFrame header, unsigned char *buf, int len, bool idr);
+// `frameEnd` is false when the rest of the frame follows in the next batch
+extern "C" void (*VideoSendBatch)(const VideoFrame *headers,
+                                  const VideoPacketPayload *payloads,
+                                  int count,
+                                  bool idr,
+                                  bool frameEnd);
+// Parameter sets of a new keyframe of the stream, with their start codes. Only called when they
+// differ from the last ones of the stream.
+extern "C" void (*VideoConfigSend)(unsigned char streamIndex, const unsigned char *buf, int len);
 extern "C" void (*HapticsSend)(unsigned long long path,
                                float duration_s,
                                float frequency,
                                float amplitude);
 extern "C" void (*TimeSyncSend)(TimeSync packet);
+// The statistics are serialized for the dashboard on the Rust side, off the driver threads.
+extern "C" void (*StatisticsSend)(StatisticsSummary summary);
+extern "C" void (*GraphStatisticsSend)(GraphStatistics statistics);
 extern "C" void (*ShutdownRuntime)();
 extern "C" unsigned long long (*PathStringToHash)(const char *path);
 
-extern "C" void *CppEntryPoint(const char *pInterfaceName, int *pReturnCode);
-extern "C" void InitializeStreaming();
+extern "C" void *CppEntryPoint(const char *pInterfaceName,
+                               int *pReturnCode,
+                               const OpenvrSettings *settings);
+extern "C" void InitializeStreaming(const OpenvrSettings *settings);
+// Applies the settings that can change while streaming, see Settings::ApplyLive. The others are
+// ignored, changing them needs a restart.
+extern "C" void UpdateSettings(const OpenvrSettings *settings);
 extern "C" void DeinitializeStreaming();
 extern "C" void RequestIDR();
+// Writes the trace of the recent frames next to the session file, returns false if there is no client.
+extern "C" bool WriteFrameTrace();
+// Writes the textures of the next frame and the frame capture history as DDS files to the
+// frame_capture directory next to the session file. Returns false if no frame is composed here.
+extern "C" bool CaptureFrames();
+// Records the video sent to the client to a Matroska file in the recordings directory next to the
+// session file, from the next keyframe. Returns false if there is no stream or already recording.
+extern "C" bool StartRecording();
+extern "C" void StopRecording();
+// Server clock minus client clock in us, returns false until the clocks are synchronized.
+extern "C" bool GetClientTimeDiff(long long *timeDiff);
 extern "C" void SetChaperone(float areaWidth, float areaHeight);
-extern "C" void InputReceive(TrackingInfo data);
+extern "C" void InputReceive(TrackingInfo data, unsigned int packetSize);
 extern "C" void TimeSyncReceive(TimeSync data);
 extern "C" void VideoErrorReportReceive();
+extern "C" void VideoFrameLossReceive(unsigned long long lastGoodFrameIndex);
+// Counts of the spectator that lost the most packets in the last second
+extern "C" void SpectatorReportReceive(unsigned long long packetsLost,
+                                       unsigned long long packetsReceived,
+                                       bool requestIdr);
+extern "C" void TransportFeedbackReceive(const TransportPacketGroup *groups,
+                                         unsigned int count,
+                                         unsigned int packetsReceived,
+                                         unsigned int packetsLost);
 extern "C" void ShutdownSteamvr();
+// Scheduling of the calling worker thread of the async runtime, see shared/threadpolicy.h. Returns
+// false if it could not be applied entirely.
+extern "C" bool SetNetworkThreadPolicy(bool realtimePriority, unsigned long long cpuMask);
 
 extern "C" void SetOpenvrProperty(unsigned long long topLevelPath, OpenvrProperty prop);
+// Writes the properties of a device in one batch. Before its activation they are kept and written
+// with the activation ones.
+extern "C" void SetOpenvrProperties(unsigned long long topLevelPath,
+                                    const OpenvrProperty *props,
+                                    unsigned int count);
 extern "C" void SetViewsConfig(ViewsConfigData config);
 extern "C" void SetBattery(unsigned long long topLevelPath, float gauge_value, bool is_plugged);
\ No newline at end of file
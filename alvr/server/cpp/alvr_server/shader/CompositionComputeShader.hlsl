@@ -0,0 +1,173 @@
+// Layer composition, color correction and foveated compression in a single dispatch.
+// Compiled at runtime by FusedComposition, MAX_LAYERS and COLOR_LUT_SIZE are defined by the host.
+
+#include "FoveatedRendering.hlsli"
+
+cbuffer CompositionParams : register(b1) {
+	// uMin, vMin, uMax, vMax of each layer, left eye then right eye
+	float4 layerBounds[MAX_LAYERS * 2];
+	uint layerCount;
+	// Bit i is set if layer i has both textures
+	uint layerMask;
+	uint enableColorCorrection;
+	uint enableFoveation;
+	float2 compositionSize;
+	float2 outputSize;
+	float sharpening;
+	// Set with sharpening when the output pixels are the composition pixels
+	uint tiledSharpening;
+	float2 _align;
+	// centerShift of the frame, left eye then right eye, see FoveationController
+	float4 centerShifts;
+};
+
+// Brightness, contrast, saturation and gamma of the settings, baked by FusedComposition
+Texture3D<float4> colorLut : register(t0);
+Texture2D<float4> layers[MAX_LAYERS * 2] : register(t1);
+SamplerState layerSampler : register(s0);
+SamplerState lutSampler : register(s1);
+RWTexture2D<unorm float4> outputTexture : register(u0);
+
+static const uint GROUP_SIZE = 8;
+// The pixels of the group and a border of one pixel for the 3x3 sharpening kernel
+static const uint TILE_SIZE = GROUP_SIZE + 2;
+
+groupshared float3 tile[TILE_SIZE][TILE_SIZE];
+groupshared float3 rowSums[TILE_SIZE][GROUP_SIZE];
+
+// MidnightBlue, the clear color of the render target path
+static const float3 CLEAR_COLOR = float3(0.098, 0.098, 0.439);
+
+float4 SampleLayer(uint i, bool isRightEye, float2 eyeUV) {
+	float4 bounds = layerBounds[i * 2 + (isRightEye ? 1 : 0)];
+	float2 layerUV = bounds.xy + eyeUV * (bounds.zw - bounds.xy);
+	// Resource arrays need literal indices, the branch is uniform over most thread groups.
+	if (isRightEye) {
+		return layers[i * 2 + 1].SampleLevel(layerSampler, layerUV, 0);
+	}
+	return layers[i * 2].SampleLevel(layerSampler, layerUV, 0);
+}
+
+// Same blending as FrameRender: the first layer is opaque, the others are alpha blended.
+float3 Compose(float2 uv) {
+	bool isRightEye = uv.x >= 0.5;
+	float2 eyeUV = float2(uv.x * 2. - float(isRightEye), uv.y);
+
+	float3 color = CLEAR_COLOR;
+	[unroll]
+	for (uint i = 0; i < MAX_LAYERS; i++) {
+		if (i < layerCount && (layerMask & (1u << i)) != 0) {
+			float4 layer = SampleLayer(i, isRightEye, eyeUV);
+			color = i == 0 ? layer.rgb : lerp(color, layer.rgb, layer.a);
+		}
+	}
+	return color;
+}
+
+// CompressAxisAlignedPixelShader, returns where an output pixel is in the composition.
+float2 DecompressUV(float2 uv) {
+	bool isRightEye = uv.x > 0.5;
+	float2 eyeUV = TextureToEyeUV(uv, isRightEye);
+
+	float2 alignedUV = eyeUV / eyeSizeRatio;
+	float2 centerShift = isRightEye ? centerShifts.zw : centerShifts.xy;
+
+	float2 c0 = (1.-centerSize)/2.;
+	float2 c1 = (edgeRatio-1.)*c0*(centerShift+1.)/edgeRatio;
+	float2 c2 = (edgeRatio-1.)*centerSize+1.;
+
+	float2 loBound = c0*(centerShift+1.)/c2;
+	float2 hiBound = c0*(centerShift-1.)/c2+1.;
+	float2 underBound = float2(alignedUV.x<loBound.x,alignedUV.y<loBound.y);
+	float2 inBound = float2(loBound.x<alignedUV.x&&alignedUV.x<hiBound.x,loBound.y<alignedUV.y&&alignedUV.y<hiBound.y);
+	float2 overBound = float2(alignedUV.x>hiBound.x,alignedUV.y>hiBound.y);
+
+	float2 d1 = alignedUV*c2/edgeRatio+c1;
+	float2 d2 = alignedUV*c2;
+	float2 d3 = (alignedUV-1.)*c2+1.;
+	float2 g1 = alignedUV/loBound;
+	float2 g2 = (1.-alignedUV)/(1.-hiBound);
+
+	float2 center = d1;
+	float2 leftEdge = g1*d1+(1.-g1)*d2;
+	float2 rightEdge = g2*d1+(1.-g2)*d3;
+
+	float2 compressedUV = underBound*leftEdge+inBound*center+overBound*rightEdge;
+
+	return EyeToTextureUV(compressedUV, isRightEye);
+}
+
+// The sharpening of ColorCorrectionPixelShader, composes the neighbours instead of reading them back.
+// For the foveated output, whose neighbour pixels are not the neighbours in the composition.
+float3 Sharpen(float2 uv) {
+	float3 pixel = Compose(uv);
+	if (sharpening != 0) {
+		float2 d = 1. / compositionSize;
+		float3 neighbours = Compose(uv + float2(-d.x, -d.y)) + Compose(uv + float2(0, -d.y))
+			+ Compose(uv + float2(+d.x, -d.y)) + Compose(uv + float2(+d.x, 0))
+			+ Compose(uv + float2(+d.x, +d.y)) + Compose(uv + float2(0, +d.y))
+			+ Compose(uv + float2(-d.x, +d.y)) + Compose(uv + float2(-d.x, 0));
+		pixel = pixel * (sharpening + 1.) - neighbours * sharpening / 8.;
+	}
+	return pixel;
+}
+
+// Same kernel, whose 3x3 box is separable: every pixel of the tile is composed once, then
+// summed by rows and by columns. All the threads of the group have to call it.
+float3 SharpenTile(uint2 groupOrigin, uint2 local) {
+	uint index = local.y * GROUP_SIZE + local.x;
+	for (uint i = index; i < TILE_SIZE * TILE_SIZE; i += GROUP_SIZE * GROUP_SIZE) {
+		uint2 pos = uint2(i % TILE_SIZE, i / TILE_SIZE);
+		float2 pixel = float2(groupOrigin + pos) - 0.5;
+		tile[pos.y][pos.x] = Compose(pixel / compositionSize);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	for (uint j = index; j < TILE_SIZE * GROUP_SIZE; j += GROUP_SIZE * GROUP_SIZE) {
+		uint2 pos = uint2(j % GROUP_SIZE, j / GROUP_SIZE);
+		rowSums[pos.y][pos.x] = tile[pos.y][pos.x] + tile[pos.y][pos.x + 1] + tile[pos.y][pos.x + 2];
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	float3 center = tile[local.y + 1][local.x + 1];
+	float3 box = rowSums[local.y][local.x] + rowSums[local.y + 1][local.x] + rowSums[local.y + 2][local.x];
+	// The box includes the center, whose weight is sharpening + 1 in the kernel
+	return center * (sharpening * 9. / 8. + 1.) - box * sharpening / 8.;
+}
+
+// The rest of ColorCorrectionPixelShader after the sharpening, the texel centers of the LUT are at
+// the grid points it was baked for
+float3 ColorCorrect(float3 pixel) {
+	float3 coord = saturate(pixel) * ((COLOR_LUT_SIZE - 1.) / COLOR_LUT_SIZE) + 0.5 / COLOR_LUT_SIZE;
+	return colorLut.SampleLevel(lutSampler, coord, 0).rgb;
+}
+
+// The output is UNORM since sRGB formats cannot be bound as UAV
+float3 LinearToSrgb(float3 color) {
+	color = saturate(color);
+	return color <= 0.0031308 ? color * 12.92 : 1.055 * pow(color, 1. / 2.4) - 0.055;
+}
+
+// No early return for the threads outside of the frame, they take part in the tile.
+[numthreads(GROUP_SIZE, GROUP_SIZE, 1)]
+void main(uint3 id : SV_DispatchThreadID, uint3 groupId : SV_GroupID, uint3 local : SV_GroupThreadID) {
+	float3 color;
+	if (tiledSharpening) {
+		color = ColorCorrect(SharpenTile(groupId.xy * GROUP_SIZE, local.xy));
+	} else {
+		float2 uv = (id.xy + 0.5) / outputSize;
+		if (enableFoveation) {
+			uv = DecompressUV(uv);
+		}
+
+		if (enableColorCorrection) {
+			color = ColorCorrect(Sharpen(uv));
+		} else {
+			color = Compose(uv);
+		}
+	}
+
+	if (id.x < (uint)outputSize.x && id.y < (uint)outputSize.y) {
+		outputTexture[id.xy] = float4(LinearToSrgb(color), 1);
+	}
+}
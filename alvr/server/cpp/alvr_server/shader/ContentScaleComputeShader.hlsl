@@ -0,0 +1,47 @@
+// Draws each eye of the composed frame scaled into the top left corner of its half, for dynamic
+// resolution. The rest of the half is black, except a margin repeating the edge of the image so the
+// bilinear filter of the client does not blend the border with black. Compiled at runtime by
+// ContentScaler.
+
+cbuffer ScaleParams : register(b0) {
+	uint2 frameSize;
+	float scale;
+	// The composition textures are sRGB, their samples have to be encoded again
+	uint srgbInput;
+};
+
+Texture2D<float4> inputTexture : register(t0);
+SamplerState linearSampler : register(s0);
+RWTexture2D<unorm float4> outputTexture : register(u0);
+
+static const float EDGE_MARGIN = 8.;
+
+float3 LinearToSrgb(float3 color) {
+	color = saturate(color);
+	return color <= 0.0031308 ? color * 12.92 : 1.055 * pow(color, 1. / 2.4) - 0.055;
+}
+
+[numthreads(8, 8, 1)]
+void main(uint3 id : SV_DispatchThreadID) {
+	if (id.x >= frameSize.x || id.y >= frameSize.y) {
+		return;
+	}
+
+	float2 eyeSize = float2(frameSize.x / 2, frameSize.y);
+	float eyeStart = id.x < frameSize.x / 2 ? 0. : eyeSize.x;
+	float2 contentSize = eyeSize * scale;
+	float2 pos = float2(id.x - eyeStart, id.y) + 0.5;
+	if (any(pos > contentSize + EDGE_MARGIN)) {
+		outputTexture[id.xy] = float4(0., 0., 0., 1.);
+		return;
+	}
+
+	// The margin repeats the last pixels of the image. Half a texel inside the eye, so the other
+	// eye does not bleed in.
+	float2 source = clamp(min(pos, contentSize - 0.5) / scale, 0.5, eyeSize - 0.5);
+	float4 color = inputTexture.SampleLevel(linearSampler, float2(eyeStart + source.x, source.y) / float2(frameSize), 0);
+	if (srgbInput) {
+		color.rgb = LinearToSrgb(color.rgb);
+	}
+	outputTexture[id.xy] = color;
+}
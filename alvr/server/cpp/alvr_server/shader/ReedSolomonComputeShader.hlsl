@@ -0,0 +1,48 @@
+// Reed-Solomon parity of the video frames, the same as reed_solomon_encode() of rs.c: every parity
+// byte is the sum over GF(2^8) of the bytes of its column in the data shards times the coefficients
+// of its row of the encoding matrix. Each thread computes four bytes of one parity shard. Compiled
+// at runtime by FecCompute.
+
+cbuffer ParityParams : register(b0) {
+	uint dataShards;
+	uint parityShards;
+	// Shard length in 32 bit words, the shards follow each other in the buffers
+	uint blockWords;
+	uint padding;
+};
+
+ByteAddressBuffer dataBuffer : register(t0);
+// parityShards rows of dataShards coefficients, one per word
+ByteAddressBuffer matrixBuffer : register(t1);
+RWByteAddressBuffer parityBuffer : register(u0);
+
+// Each byte of bytes times coefficient, over GF(2^8) with the polynomial of rs.c (0x11d)
+uint MultiplyBytes(uint bytes, uint coefficient) {
+	uint product = 0;
+	for (uint bit = 0; bit < 8; bit++) {
+		if (coefficient & (1u << bit)) {
+			product ^= bytes;
+		}
+		// Times x: the bytes that overflow are reduced by the low part of the polynomial
+		bytes = ((bytes & 0x7f7f7f7f) << 1) ^ (((bytes >> 7) & 0x01010101) * 0x1d);
+	}
+	return product;
+}
+
+[numthreads(64, 1, 1)]
+void main(uint3 id : SV_DispatchThreadID) {
+	uint word = id.x;
+	uint row = id.y;
+	if (word >= blockWords || row >= parityShards) {
+		return;
+	}
+
+	uint parity = 0;
+	for (uint shard = 0; shard < dataShards; shard++) {
+		uint coefficient = matrixBuffer.Load((row * dataShards + shard) * 4);
+		if (coefficient != 0) {
+			parity ^= MultiplyBytes(dataBuffer.Load((shard * blockWords + word) * 4), coefficient);
+		}
+	}
+	parityBuffer.Store((row * blockWords + word) * 4, parity);
+}
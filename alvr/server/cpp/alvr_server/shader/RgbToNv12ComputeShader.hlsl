@@ -0,0 +1,49 @@
+// Converts the composed frame to NV12 or P010 (BT.601 limited range, like swscale and the encoders'
+// own conversion). Each thread writes a 2x2 block of luma and the chroma sample they share.
+// Compiled at runtime by Nv12Converter.
+
+cbuffer ConversionParams : register(b0) {
+	uint2 frameSize;
+	// The composition textures are sRGB, their samples have to be encoded again
+	uint srgbInput;
+	// P010 keeps 10 bit samples in the high bits of the 16 bit UNORM planes
+	uint tenBit;
+};
+
+Texture2D<float4> inputTexture : register(t0);
+RWTexture2D<unorm float> lumaTexture : register(u0);
+RWTexture2D<unorm float2> chromaTexture : register(u1);
+
+float3 LinearToSrgb(float3 color) {
+	color = saturate(color);
+	return color <= 0.0031308 ? color * 12.92 : 1.055 * pow(color, 1. / 2.4) - 0.055;
+}
+
+float Quantize(float value) {
+	return tenBit ? round(saturate(value) * 1023.) * 64. / 65535. : value;
+}
+
+[numthreads(8, 8, 1)]
+void main(uint3 id : SV_DispatchThreadID) {
+	uint2 block = id.xy * 2;
+	if (block.x >= frameSize.x || block.y >= frameSize.y) {
+		return;
+	}
+
+	float3 sum = 0;
+	[unroll]
+	for (uint i = 0; i < 4; i++) {
+		uint2 pos = min(block + uint2(i & 1, i >> 1), frameSize - 1);
+		float3 rgb = inputTexture.Load(int3(pos, 0)).rgb;
+		if (srgbInput) {
+			rgb = LinearToSrgb(rgb);
+		}
+		lumaTexture[pos] = Quantize(16. / 255. + dot(rgb, float3(0.2568, 0.5041, 0.0979)));
+		sum += rgb;
+	}
+
+	float3 rgb = sum / 4.;
+	chromaTexture[id.xy] = float2(
+		Quantize(128. / 255. + dot(rgb, float3(-0.1482, -0.2910, 0.4392))),
+		Quantize(128. / 255. + dot(rgb, float3(0.4392, -0.3678, -0.0714))));
+}
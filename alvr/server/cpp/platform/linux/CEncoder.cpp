@@ -7,6 +7,8 @@
 #include <stdexcept>
 #include <stdlib.h>
 #include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -19,9 +21,13 @@
 #include "alvr_server/PoseHistory.h"
 #include "alvr_server/Settings.h"
 #include "alvr_server/Statistics.h"
+#include "alvr_server/ThreadPolicy.h"
+#include "alvr_server/Utils.h"
+#include "present_ring.h"
 #include "protocol.h"
 #include "ffmpeg_helper.h"
 #include "EncodePipeline.h"
+#include "FrameRender.h"
 
 extern "C" {
 #include <libavutil/avutil.h>
@@ -29,69 +35,130 @@ extern "C" {
 
 CEncoder::CEncoder(std::shared_ptr<ClientConnection> listener,
                    std::shared_ptr<PoseHistory> poseHistory)
-    : m_listener(listener), m_poseHistory(poseHistory) {}
+    : m_listener(listener), m_poseHistory(poseHistory) {
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_stopEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_epoll == -1 or m_stopEvent == -1) {
+        throw MakeException("failed to create encoder event loop: %s", strerror(errno));
+    }
+    epoll_event event{.events = EPOLLIN, .data = {.fd = m_stopEvent}};
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_stopEvent, &event);
+}
 
-CEncoder::~CEncoder() { Stop(); }
+CEncoder::~CEncoder() {
+    Stop();
+    close(m_epoll);
+    close(m_stopEvent);
+}
 
 namespace {
-void read_exactly(int fd, char *out, size_t size, std::atomic_bool &exiting) {
-    while (not exiting and size != 0) {
-        timeval timeout{.tv_sec = 0, .tv_usec = 100};
-        fd_set read_fd, write_fd, except_fd;
-        FD_ZERO(&read_fd);
-        FD_SET(fd, &read_fd);
-        FD_ZERO(&write_fd);
-        FD_ZERO(&except_fd);
-        // TODO move away from select as it can only take fd < 1024
-        int count = select(fd + 1, &read_fd, &write_fd, &except_fd, &timeout);
+// Block until fd is readable. Returns false once the stop event is signaled, or when timeout_ms
+// (-1 for none) runs out.
+bool wait_readable(int epoll, int stop_event, int fd, int timeout_ms) {
+    while (true) {
+        epoll_event events[2];
+        int count = epoll_wait(epoll, events, 2, timeout_ms);
         if (count < 0) {
-            throw MakeException("select failed: %s", strerror(errno));
-        } else if (count == 1) {
-            int s = read(fd, out, size);
-            if (s == -1) {
-                throw MakeException("read failed: %s", strerror(errno));
-            }
-            out += s;
-            size -= s;
+            if (errno == EINTR)
+                continue;
+            throw MakeException("epoll_wait failed: %s", strerror(errno));
+        }
+        bool readable = false;
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.fd == stop_event)
+                return false;
+            if (events[i].data.fd == fd)
+                readable = true;
         }
+        if (readable or timeout_ms >= 0)
+            return readable;
     }
 }
 
-void read_latest(int fd, char *out, size_t size, std::atomic_bool &exiting) {
-    read_exactly(fd, out, size, exiting);
-    while (not exiting)
-    {
-        timeval timeout{.tv_sec = 0, .tv_usec = 0};
-        fd_set read_fd, write_fd, except_fd;
-        FD_ZERO(&read_fd);
-        FD_SET(fd, &read_fd);
-        FD_ZERO(&write_fd);
-        FD_ZERO(&except_fd);
-        // TODO move away from select as it can only take fd < 1024
-        int count = select(fd + 1, &read_fd, &write_fd, &except_fd, &timeout);
-        if (count == 0)
-            return;
-        read_exactly(fd, out, size, exiting);
+void watch_fd(int epoll, int fd) {
+    epoll_event event{.events = EPOLLIN, .data = {.fd = fd}};
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+        throw MakeException("epoll_ctl failed: %s", strerror(errno));
+    }
+}
+
+void unwatch_fd(int epoll, int fd) { epoll_ctl(epoll, EPOLL_CTL_DEL, fd, NULL); }
+
+bool read_exactly(int epoll, int stop_event, int fd, char *out, size_t size) {
+    while (size != 0) {
+        if (not wait_readable(epoll, stop_event, fd, -1))
+            return false;
+        int s = read(fd, out, size);
+        if (s == -1) {
+            throw MakeException("read failed: %s", strerror(errno));
+        }
+        if (s == 0) {
+            Info("CEncoder client disconnected\n");
+            return false;
+        }
+        out += s;
+        size -= s;
     }
+    return true;
 }
 
-int accept_timeout(int socket, std::atomic_bool &exiting) {
-    while (not exiting) {
-        timeval timeout{.tv_sec = 0, .tv_usec = 15000};
-        fd_set read_fd, write_fd, except_fd;
-        FD_ZERO(&read_fd);
-        FD_SET(socket, &read_fd);
-        FD_ZERO(&write_fd);
-        FD_ZERO(&except_fd);
-        // TODO move away from select as it can only take fd < 1024
-        int count = select(socket + 1, &read_fd, &write_fd, &except_fd, &timeout);
+// Wait for a present newer than *consumed and copy the latest one. The doorbell is only rung
+// when consumer_waiting is set, so it is raised before sleeping and head is checked once more.
+// Returns false on stop, when the layer disconnects or when a new swapchain connects to listener.
+bool wait_present(int epoll, int stop_event, int client, int listener, int doorbell, present_ring &ring,
+                  uint64_t *consumed, present_packet *packet, uint64_t *publish_ns,
+                  uint32_t *skipped) {
+    while (true) {
+        if (present_ring_consume(ring, consumed, packet, publish_ns, skipped))
+            return true;
+
+        ring.consumer_waiting.store(1, std::memory_order_seq_cst);
+        if (present_ring_consume(ring, consumed, packet, publish_ns, skipped)) {
+            ring.consumer_waiting.store(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        epoll_event events[4];
+        int count = epoll_wait(epoll, events, 4, -1);
+        ring.consumer_waiting.store(0, std::memory_order_relaxed);
         if (count < 0) {
-            throw MakeException("select failed: %s", strerror(errno));
-        } else if (count == 1) {
-          return accept(socket, NULL, NULL);
+            if (errno == EINTR)
+                continue;
+            throw MakeException("epoll_wait failed: %s", strerror(errno));
+        }
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.fd == stop_event)
+                return false;
+            // the layer never writes to the socket after init, so this is the hang up
+            if (events[i].data.fd == client) {
+                Info("CEncoder client disconnected\n");
+                return false;
+            }
+            if (events[i].data.fd == listener) {
+                Info("CEncoder switching to a new swapchain\n");
+                return false;
+            }
+            if (events[i].data.fd == doorbell) {
+                uint64_t value;
+                read(doorbell, &value, sizeof(value));
+            }
         }
     }
-    return -1;
+}
+
+// Removes the resume callback of the idle controller before the present ring it writes is unmapped
+struct resume_callback_guard {
+    IdleController &controller;
+    ~resume_callback_guard() { controller.SetResumeCallback(nullptr); }
+};
+
+// Whether the encoder session made for `active` can take the images of `init`: the frame context
+// and the encoder only depend on the device, the format and the size.
+bool same_stream(const init_packet &active, const init_packet &init) {
+    return strcmp(active.device_name.data(), init.device_name.data()) == 0 and
+           active.image_create_info.format == init.image_create_info.format and
+           active.image_create_info.extent.width == init.image_create_info.extent.width and
+           active.image_create_info.extent.height == init.image_create_info.extent.height;
 }
 
 #ifdef DEBUG
@@ -103,7 +170,7 @@ void logfn(void*, int level, const char* data, va_list va)
 
 } // namespace
 
-void CEncoder::GetFds(int client, int (*received_fds)[6]) {
+void CEncoder::GetFds(int client, std::vector<int> &received_fds) {
     struct msghdr msg;
     struct cmsghdr *cmsg;
     union {
@@ -131,7 +198,11 @@ void CEncoder::GetFds(int client, int (*received_fds)[6]) {
 
     for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
-            memcpy(received_fds, CMSG_DATA(cmsg), sizeof(*received_fds));
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (count != received_fds.size()) {
+                throw MakeException("expected %zu fds, received %zu", received_fds.size(), count);
+            }
+            memcpy(received_fds.data(), CMSG_DATA(cmsg), count * sizeof(int));
             break;
         }
     }
@@ -143,6 +214,7 @@ void CEncoder::GetFds(int client, int (*received_fds)[6]) {
 
 void CEncoder::Run() {
     Info("CEncoder::Run\n");
+    ApplyThreadPolicy(THREAD_ROLE_ENCODER, "CEncoder");
     m_socketPath = getenv("XDG_RUNTIME_DIR");
     m_socketPath += "/alvr-ipc";
 
@@ -175,100 +247,259 @@ void CEncoder::Run() {
     }
 
     Info("CEncoder Listening\n");
-    int client = accept_timeout(m_socket, m_exiting);
-    if (m_exiting)
-      return;
-    init_packet init;
-    read_exactly(client, (char *)&init, sizeof(init), m_exiting);
-    if (m_exiting)
-      return;
-
-    // check that pointer types are null, other values would not make sense over a socket
-    assert(init.image_create_info.queueFamilyIndexCount == 0);
-    assert(init.image_create_info.pNext == NULL);
-
-    char ifbuf[256];
-    char ifbuf2[256];
-    sprintf(ifbuf, "/proc/%d/cmdline", (int)init.source_pid);
-    std::ifstream ifscmdl(ifbuf);
-    ifscmdl >> ifbuf2;
-    Info("CEncoder client connected, pid %d, cmdline %s\n", (int)init.source_pid, ifbuf2);
-
-    try {
-        GetFds(client, &m_fds);
-
-      fprintf(stderr, "\n\nWe are initalizing Vulkan in CEncoder thread\n\n\n");
 
-#ifdef DEBUG
-      AVUTIL.av_log_set_level(AV_LOG_DEBUG);
-      AVUTIL.av_log_set_callback(logfn);
-#endif
-
-      AVDictionary *d = NULL; // "create" an empty dictionary
-      //av_dict_set(&d, "debug", "1", 0); // add an entry
-      alvr::VkContext vk_ctx(init.device_name.data(), d);
-      alvr::VkFrameCtx vk_frame_ctx(vk_ctx, init.image_create_info);
+    // Every swapchain of the layer is a new connection. They all go to the same encoder session as
+    // long as the images keep their format and size, only the images are imported again.
+    std::unique_ptr<alvr::VkContext> vk_ctx;
+    std::unique_ptr<alvr::VkFrameCtx> vk_frame_ctx;
+    std::vector<alvr::VkFrame> images;
+    // Foveation and color correction, the encoder then reads its frames instead of the images
+    std::unique_ptr<alvr::FrameRender> frame_render;
+    std::unique_ptr<alvr::EncodePipeline> encode_pipeline;
+    init_packet active = {};
+    bool async_encode = Settings::Instance().m_encodePipelineDepth > 0;
+
+    while (not m_exiting) {
+      watch_fd(m_epoll, m_socket);
+      bool accepted = wait_readable(m_epoll, m_stopEvent, m_socket, -1);
+      unwatch_fd(m_epoll, m_socket);
+      if (not accepted)
+        break;
+      int client = accept(m_socket, NULL, NULL);
+      if (client == -1) {
+        perror("accept");
+        break;
+      }
+      watch_fd(m_epoll, client);
+      init_packet init;
+      if (not read_exactly(m_epoll, m_stopEvent, client, (char *)&init, sizeof(init))) {
+        close(client);
+        continue;
+      }
 
-      std::vector<alvr::VkFrame> images;
-        images.reserve(3);
-        for (size_t i = 0; i < 3; ++i) {
-            images.emplace_back(vk_ctx, init.image_create_info, init.mem_index, m_fds[2*i], m_fds[2*i+1]);
+      // check that pointer types are null, other values would not make sense over a socket
+      assert(init.image_create_info.queueFamilyIndexCount == 0);
+      assert(init.image_create_info.pNext == NULL);
+
+      char ifbuf[256];
+      char ifbuf2[256];
+      sprintf(ifbuf, "/proc/%d/cmdline", (int)init.source_pid);
+      std::ifstream ifscmdl(ifbuf);
+      ifscmdl >> ifbuf2;
+      Info("CEncoder client connected, pid %d, cmdline %s\n", (int)init.source_pid, ifbuf2);
+
+      int doorbell = -1;
+      try {
+        if (init.num_images == 0 or init.num_images > MAX_SWAPCHAIN_IMAGES) {
+            throw MakeException("unsupported swapchain image count %u", init.num_images);
         }
+        m_fds.resize(2 * init.num_images + 2);
+        GetFds(client, m_fds);
+        int ring_fd = m_fds[2 * init.num_images];
+        doorbell = m_fds[2 * init.num_images + 1];
+
+        // The images go first, the frames derived from them by the pipeline are released before
+        bool reuse_session = encode_pipeline and same_stream(active, init) and
+            (frame_render ? (frame_render->ReleaseInputFrames(), true) : encode_pipeline->ReleaseInputFrames());
+        if (not reuse_session) {
+          encode_pipeline.reset();
+          frame_render.reset();
+        }
+        images.clear();
+        if (not vk_ctx or strcmp(active.device_name.data(), init.device_name.data()) != 0) {
+          vk_frame_ctx.reset();
+          vk_ctx.reset();
+          fprintf(stderr, "\n\nWe are initalizing Vulkan in CEncoder thread\n\n\n");
 
-      auto encode_pipeline = alvr::EncodePipeline::Create(images, vk_frame_ctx);
-
-      fprintf(stderr, "CEncoder starting to read present packets");
-      present_packet frame_info;
-      std::vector<uint8_t> encoded_data;
-      double avg_real_encode_time_ms = 0;
-      while (not m_exiting) {
-        read_latest(client, (char *)&frame_info, sizeof(frame_info), m_exiting);
+#ifdef DEBUG
+          AVUTIL.av_log_set_level(AV_LOG_DEBUG);
+          AVUTIL.av_log_set_callback(logfn);
+#endif
 
-        if (m_listener->GetStatistics()->CheckBitrateUpdated()) {
-          encode_pipeline->SetBitrate(m_listener->GetStatistics()->GetBitrate() * 1000000L); // in bits;
+          AVDictionary *d = NULL; // "create" an empty dictionary
+          //av_dict_set(&d, "debug", "1", 0); // add an entry
+          vk_ctx = std::make_unique<alvr::VkContext>(init.device_name.data(), d);
         }
-
-        auto pose = m_poseHistory->GetBestPoseMatch((const vr::HmdMatrix34_t&)frame_info.pose);
-        if (!pose)
-        {
-          continue;
+        if (not reuse_session) {
+          vk_frame_ctx.reset();
+          vk_frame_ctx = std::make_unique<alvr::VkFrameCtx>(*vk_ctx, init.image_create_info);
         }
+        active = init;
 
-        auto encode_start = std::chrono::steady_clock::now();
-        encode_pipeline->PushFrame(frame_info.image, pose->info.targetTimestampNs, m_scheduler.CheckIDRInsertion());
-
-        static_assert(sizeof(frame_info.pose) == sizeof(vr::HmdMatrix34_t&));
-
-        encoded_data.clear();
-        uint64_t pts;
-        // Encoders can req more then once frame, need to accumulate more data before sending it to the client
-        if (!encode_pipeline->GetEncoded(encoded_data, &pts)) {
-          continue;
+        alvr::DrmImageLayout drm_layout{init.drm_modifier, init.plane_offset, init.plane_pitch};
+        images.reserve(init.num_images);
+        for (size_t i = 0; i < init.num_images; ++i) {
+            images.emplace_back(*vk_ctx, init.image_create_info, init.mem_index, m_fds[2*i], m_fds[2*i+1], init.timeline_semaphores,
+                init.dma_buf ? &drm_layout : nullptr);
         }
 
-        m_listener->SendVideo(encoded_data.data(), encoded_data.size(), pts);
-
-        auto encode_end = std::chrono::steady_clock::now();
+        if (reuse_session) {
+          Info("CEncoder keeps the encoder session for the new swapchain\n");
+          if (frame_render)
+            frame_render->SetInputFrames(images);
+          else
+            encode_pipeline->SetInputFrames(images, *vk_frame_ctx);
+        } else {
+          if (alvr::FrameRender::Enabled()) {
+            frame_render = std::make_unique<alvr::FrameRender>(*vk_ctx, images);
+            encode_pipeline = alvr::EncodePipeline::Create(frame_render->GetOutputFrames(), frame_render->GetOutputFrameCtx());
+          } else {
+            encode_pipeline = alvr::EncodePipeline::Create(images, *vk_frame_ctx);
+          }
+          if (async_encode) {
+            encode_pipeline->StartAsync(Settings::Instance().m_encodePipelineDepth,
+                [this](std::vector<uint8_t> &data, uint64_t pts, const EncodeStats &stats) {
+                  m_listener->SendVideo(data.data(), data.size(), pts);
+                  m_listener->GetStatistics()->EncodeOutput(stats);
+                });
+          }
+        }
 
-        m_listener->GetStatistics()->EncodeOutput(std::chrono::duration_cast<std::chrono::microseconds>(encode_end - encode_start).count());
+        void *ring_map = mmap(NULL, sizeof(present_ring), PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+        close(ring_fd);
+        if (ring_map == MAP_FAILED) {
+          throw MakeException("failed to map present ring: %s", strerror(errno));
+        }
+        std::unique_ptr<present_ring, void (*)(present_ring *)> ring(
+            reinterpret_cast<present_ring *>(ring_map),
+            [](present_ring *ring) { munmap(ring, sizeof(present_ring)); });
+        watch_fd(m_epoll, doorbell);
+        // A new swapchain connects before the old one is destroyed
+        watch_fd(m_epoll, m_socket);
+        // While idle the frames come at the idle rate, the vsync of the layer is woken up without
+        // waiting for one
+        m_listener->m_idleController.SetResumeCallback([&ring]() {
+          ring->vsync.divider.store(1, std::memory_order_relaxed);
+        });
+        resume_callback_guard resume_guard{m_listener->m_idleController};
+
+        fprintf(stderr, "CEncoder starting to read present packets");
+        present_packet frame_info;
+        uint64_t consumed = 0;
+        std::vector<uint8_t> encoded_data;
+        while (not m_exiting) {
+          uint64_t publish_ns;
+          uint32_t skipped;
+          if (not wait_present(m_epoll, m_stopEvent, client, m_socket, doorbell, *ring, &consumed, &frame_info, &publish_ns, &skipped))
+            break;
+          m_listener->GetStatistics()->PresentsCoalesced(skipped);
+          m_listener->GetStatistics()->LayerPresent(frame_info.present_ns, frame_info.rendered_ns, publish_ns, present_ring_now_ns());
+          if (frame_info.copy_ns != 0)
+            m_listener->GetStatistics()->LayerCopy(frame_info.copy_ns);
+          if (int64_t shift = m_listener->m_vsyncScheduler.TakeShift())
+            ring->vsync.epoch_ns.fetch_add(uint64_t(shift * 1000), std::memory_order_relaxed);
+          ring->vsync.divider.store(m_listener->m_idleController.GetVSyncDivider(), std::memory_order_relaxed);
+
+          if (m_listener->GetStatistics()->CheckBitrateUpdated()) {
+            encode_pipeline->Reconfigure(m_listener->GetStatistics()->GetEncoderRate());
+          }
+
+          auto pose = frame_info.pose_found
+              ? m_poseHistory->GetBestPoseMatch((const vr::HmdMatrix34_t&)frame_info.pose)
+              : m_poseHistory->GetLatestPose();
+          if (!pose)
+          {
+            continue;
+          }
+
+          static_assert(sizeof(frame_info.pose) == sizeof(vr::HmdMatrix34_t&));
+
+          if (frame_info.image >= init.num_images)
+            continue;
+          // Not claimed, the layer gets the image back as if the encoder never took it
+          if (m_deadlineScheduler.Check(*m_listener, pose->info.targetTimestampNs, m_scheduler.IsRecoveryPending()) !=
+              DeadlineScheduler::ENCODE)
+            continue;
+          IdleController::Decision idle = m_listener->m_idleController.CheckFrame();
+          if (idle == IdleController::SKIP)
+            continue;
+          if (idle == IdleController::RESUME)
+            m_scheduler.InsertIDR();
+          // The application got the image back since this present, a newer one is coming
+          if (init.timeline_semaphores) {
+            if (not present_ring_claim(*ring, frame_info))
+              continue;
+            images[frame_info.image].set_semaphore_value(frame_info.semaphore_value);
+          }
+
+          m_listener->m_frameTrace.Record(pose->info.targetTimestampNs, FrameTrace::PRESENT, GetTimestampUs());
+
+          uint64_t last_good_timestamp;
+          if (m_scheduler.CheckInvalidation(&last_good_timestamp) and
+              not encode_pipeline->InvalidateReferences(last_good_timestamp)) {
+            m_scheduler.OnPacketLoss();
+          }
+          bool idr = m_scheduler.CheckIDRInsertion();
+          if (m_scheduler.CheckRefreshInsertion() and not encode_pipeline->StartIntraRefresh()) {
+            idr = true;
+          }
+
+          uint32_t encode_index = frame_info.image;
+          if (frame_render)
+            encode_index = frame_render->Render(frame_info.image,
+                m_listener->m_resolutionController.BeginFrame(pose->info.targetTimestampNs),
+                m_listener->m_foveationController.BeginFrame(pose->info.targetTimestampNs));
+          if (async_encode) {
+            encode_pipeline->Submit(encode_index, pose->info.targetTimestampNs, idr);
+            continue;
+          }
+
+          auto encode_start = std::chrono::steady_clock::now();
+          encode_pipeline->PushFrame(encode_index, pose->info.targetTimestampNs, idr);
+
+          encoded_data.clear();
+          uint64_t pts;
+          EncodeStats stats;
+          // Encoders can req more then once frame, need to accumulate more data before sending it to the client
+          if (!encode_pipeline->GetEncoded(encoded_data, &pts, &stats)) {
+            continue;
+          }
+
+          m_listener->SendVideo(encoded_data.data(), encoded_data.size(), pts);
+
+          auto encode_end = std::chrono::steady_clock::now();
+
+          stats.latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(encode_end - encode_start).count();
+          m_listener->GetStatistics()->EncodeOutput(stats);
 
+        }
+        unwatch_fd(m_epoll, m_socket);
+        unwatch_fd(m_epoll, doorbell);
+        close(doorbell);
+      }
+      catch (std::exception &e) {
+        std::stringstream err;
+        err << "error in encoder thread: " << e.what();
+        Error(err.str().c_str());
+        unwatch_fd(m_epoll, m_socket);
+        if (doorbell != -1) {
+          unwatch_fd(m_epoll, doorbell);
+          close(doorbell);
+        }
+        // Start over with the next swapchain
+        encode_pipeline.reset();
+        frame_render.reset();
+        images.clear();
+        vk_frame_ctx.reset();
+        vk_ctx.reset();
+        active = {};
       }
-    }
-    catch (std::exception &e) {
-      std::stringstream err;
-      err << "error in encoder thread: " << e.what();
-      Error(err.str().c_str());
-    }
 
-    close(client);
+      unwatch_fd(m_epoll, client);
+      close(client);
+    }
 }
 
 void CEncoder::Stop() {
     m_exiting = true;
+    uint64_t one = 1;
+    write(m_stopEvent, &one, sizeof(one));
     close(m_socket);
     unlink(m_socketPath.c_str());
 }
 
 void CEncoder::OnPacketLoss() { m_scheduler.OnPacketLoss(); }
 
+void CEncoder::OnFrameLoss(uint64_t lastGoodTimestampNs) { m_scheduler.OnFrameLoss(lastGoodTimestampNs); }
+
 void CEncoder::InsertIDR() { m_scheduler.InsertIDR(); }
@@ -1,10 +1,12 @@
 #pragma once
 
+#include "alvr_server/DeadlineScheduler.h"
 #include "alvr_server/IDRScheduler.h"
 #include "shared/threadtools.h"
 #include <atomic>
 #include <memory>
 #include <sys/types.h>
+#include <vector>
 
 class ClientConnection;
 class PoseHistory;
@@ -18,15 +20,21 @@ class CEncoder : public CThread {
 
     void Stop();
     void OnPacketLoss();
+    void OnFrameLoss(uint64_t lastGoodTimestampNs);
     void InsertIDR();
 
   private:
-    void GetFds(int client, int (*fds)[6]);
+    void GetFds(int client, std::vector<int> &fds);
     std::shared_ptr<ClientConnection> m_listener;
     std::shared_ptr<PoseHistory> m_poseHistory;
     std::atomic_bool m_exiting{false};
     IDRScheduler m_scheduler;
+    DeadlineScheduler m_deadlineScheduler;
     int m_socket;
+    // Event loop for the layer socket and present doorbell, m_stopEvent wakes it up on Stop()
+    int m_epoll;
+    int m_stopEvent;
     std::string m_socketPath;
-    int m_fds[6];
+    // Memory and semaphore of each image, then the present ring memfd and its doorbell eventfd
+    std::vector<int> m_fds;
 };
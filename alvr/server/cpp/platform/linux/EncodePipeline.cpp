@@ -1,18 +1,46 @@
 #include "EncodePipeline.h"
 
+#include "alvr_server/Av1Obu.h"
 #include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
+#include "alvr_server/EncoderCache.h"
+#include "alvr_server/FoveatedEncoding.h"
 #include "EncodePipelineSW.h"
 #include "EncodePipelineVAAPI.h"
 #include "EncodePipelineNvEnc.h"
+#include "EncodePipelineVulkan.h"
+#include "FrameRender.h"
 #include "ffmpeg_helper.h"
 
+#include <cstring>
+#include <future>
+
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/intreadwrite.h>
 }
 
 namespace {
 
+// Key of the encoder cache for the current settings
+std::string encoder_config_key()
+{
+  auto &settings = Settings::Instance();
+  uint32_t width, height;
+  alvr::FrameRender::GetEncodingResolution(&width, &height);
+  return "linux codec=" + std::to_string(settings.m_codec)
+    + " " + std::to_string(width) + "x" + std::to_string(height)
+    + " 10bit=" + std::to_string(settings.m_use10bitEncoder);
+}
+
+// Set by EncodePipeline::ForceEncoder()
+std::string forced_encoder;
+
+// VAAPI device opened by EncodePipeline::Prewarm(), until the first VAAPI pipeline takes it
+std::mutex prewarm_mutex;
+std::future<AVBufferRef *> prewarmed_vaapi_device;
+
 bool should_keep_nal_h264(const uint8_t * header_start)
 {
   uint8_t nal_type = (header_start[2] == 0 ? header_start[4] : header_start[3]) & 0x1F;
@@ -39,74 +67,349 @@ bool should_keep_nal_h265(const uint8_t * header_start)
   }
 }
 
-void filter_NAL(const uint8_t* input, size_t input_size, std::vector<uint8_t> &out)
+// Start of the next 00 00 01 start code at or after p (including a leading zero of a 4 byte start
+// code), or end. memchr is vectorized and 0x01 is much rarer than 0x00 in the bitstream.
+const uint8_t *find_start_code(const uint8_t *p, const uint8_t *end)
 {
-  if (input_size < 4)
-    return;
-  auto codec = Settings::Instance().m_codec;
-  std::array<uint8_t, 3> header = {{0, 0, 1}};
-  auto end = input + input_size;
-  auto header_start = input;
+  const uint8_t *search = p + 2;
+  while (search < end)
+  {
+    auto one = (const uint8_t *)memchr(search, 1, end - search);
+    if (one == nullptr)
+      return end;
+    if (one[-1] == 0 and one[-2] == 0)
+    {
+      auto start = one - 2;
+      return (start > p and start[-1] == 0) ? start - 1 : start;
+    }
+    search = one + 1;
+  }
+  return end;
+}
+
+// Drop the NALs the client does not need, compacting the kept ones at the start of data.
+// Returns the filtered size.
+size_t filter_NAL(uint8_t *data, size_t size, int codec)
+{
+  if (size < 4)
+    return 0;
+  const uint8_t *end = data + size;
+  uint8_t *write = data;
+  const uint8_t *header_start = data;
   while (header_start != end)
   {
-    auto next_header = std::search(header_start + 3, end, header.begin(), header.end());
-    if (next_header != end and next_header[-1] == 0)
+    auto next_header = find_start_code(header_start + 3, end);
+    bool keep = codec == ALVR_CODEC_H264 ? should_keep_nal_h264(header_start) : should_keep_nal_h265(header_start);
+    if (keep)
     {
-      next_header--;
+      size_t nal_size = next_header - header_start;
+      if (write != header_start)
+        memmove(write, header_start, nal_size);
+      write += nal_size;
     }
-    if (codec == ALVR_CODEC_H264 and should_keep_nal_h264(header_start))
-      out.insert(out.end(), header_start, next_header);
-    if (codec == ALVR_CODEC_H265 and should_keep_nal_h265(header_start))
-      out.insert(out.end(), header_start, next_header);
     header_start = next_header;
   }
+  return write - data;
 }
 
+// libx264, NVENC and most other libavcodec encoders attach the frame quality and picture type to
+// the packet. VAAPI does not, its packets only have the key flag.
+void read_encode_stats(const AVPacket *pkt, EncodeStats &stats)
+{
+  if (pkt->flags & AV_PKT_FLAG_KEY)
+    stats.frameType = EncodeStats::FRAME_IDR;
+
+#if LIBAVCODEC_VERSION_MAJOR >= 59
+  size_t side_data_size = 0;
+#else
+  int side_data_size = 0;
+#endif
+  const uint8_t *quality_stats = AVCODEC.av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS, &side_data_size);
+  if (quality_stats == nullptr or side_data_size < 5)
+    return;
+
+  stats.averageQp = (float)AV_RL32(quality_stats) / FF_QP2LAMBDA;
+  if (stats.frameType != EncodeStats::FRAME_UNKNOWN)
+    return;
+  switch (quality_stats[4])
+  {
+    case AV_PICTURE_TYPE_I:
+      stats.frameType = EncodeStats::FRAME_I;
+      break;
+    case AV_PICTURE_TYPE_P:
+      stats.frameType = EncodeStats::FRAME_P;
+      break;
+    case AV_PICTURE_TYPE_B:
+      stats.frameType = EncodeStats::FRAME_B;
+      break;
+    default:
+      break;
+  }
 }
 
-void alvr::EncodePipeline::SetBitrate(int64_t bitrate) {
-  encoder_ctx->bit_rate = bitrate;
 }
 
-std::unique_ptr<alvr::EncodePipeline> alvr::EncodePipeline::Create(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx)
+alvr::EncodePipeline::EncodePipeline(): codec(Settings::Instance().m_codec) {}
+
+void alvr::EncodePipeline::Reconfigure(const EncoderRate &rate) {
+  std::lock_guard<std::mutex> lock(codec_mutex);
+  ApplyRate(rate);
+}
+
+EncoderRate alvr::EncodePipeline::DefaultRate()
+{
+  auto &settings = Settings::Instance();
+  return EncoderRate::ForBitrate(settings.GetLive().mEncodeBitrateMBs * 1000 * 1000, settings.m_refreshRate);
+}
+
+void alvr::EncodePipeline::ApplyRate(const EncoderRate &rate)
+{
+  encoder_ctx->bit_rate = rate.bitrate;
+  encoder_ctx->rc_max_rate = rate.bitrate;
+  encoder_ctx->rc_buffer_size = rate.vbvSize;
+  encoder_ctx->rc_initial_buffer_occupancy = rate.vbvSize;
+  encoder_ctx->framerate = AVRational{(int)(rate.fps + 0.5f), 1};
+}
+
+void alvr::EncodePipeline::Drain()
+{
+  int err = AVCODEC.avcodec_send_frame(encoder_ctx, nullptr);
+  if (err < 0)
+    throw alvr::AvException("failed to flush the encoder", err);
+  while (true)
+  {
+    AVPacket *pkt = AVCODEC.av_packet_alloc();
+    err = AVCODEC.avcodec_receive_packet(encoder_ctx, pkt);
+    if (err) {
+      AVCODEC.av_packet_free(&pkt);
+      if (err == AVERROR_EOF)
+        return;
+      throw alvr::AvException("failed to flush the encoder", err);
+    }
+    drained.push_back(pkt);
+  }
+}
+
+void alvr::EncodePipeline::AddFoveationRegions(AVFrame *frame, int qp_range)
+{
+  // Steps of the QP ramp, libavcodec takes rectangles and not per block maps
+  constexpr uint32_t FOVEATION_STEPS = 4;
+  auto rects = BuildFoveationRects(frame->width, frame->height, FOVEATION_STEPS);
+  AVFrameSideData *side_data = AVUTIL.av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, rects.size() * sizeof(AVRegionOfInterest));
+  if (not side_data)
+    throw std::runtime_error("failed to allocate the foveation regions");
+  auto regions = (AVRegionOfInterest *)side_data->data;
+  for (size_t i = 0; i < rects.size(); ++i)
+  {
+    regions[i].self_size = sizeof(AVRegionOfInterest);
+    regions[i].top = rects[i].top;
+    regions[i].bottom = rects[i].bottom;
+    regions[i].left = rects[i].left;
+    regions[i].right = rects[i].right;
+    regions[i].qoffset = AVRational{rects[i].qpOffset, qp_range};
+  }
+}
+
+void alvr::EncodePipeline::StartAsync(uint32_t max_in_flight, PacketCallback callback)
+{
+  this->max_in_flight = max_in_flight;
+  packet_callback = std::move(callback);
+  retrieve_thread = std::thread(&EncodePipeline::RetrieveLoop, this);
+}
+
+void alvr::EncodePipeline::StopAsync()
 {
-  try {
-    auto vaapi = std::make_unique<alvr::EncodePipelineVAAPI>(input_frames, vk_frame_ctx);
-    Info("using VAAPI encoder");
-    return vaapi;
-  } catch (...)
   {
-    Info("failed to create VAAPI encoder");
+    std::lock_guard<std::mutex> lock(codec_mutex);
+    stopping = true;
   }
+  codec_cv.notify_all();
+  if (retrieve_thread.joinable())
+    retrieve_thread.join();
+}
+
+void alvr::EncodePipeline::Submit(uint32_t frame_index, uint64_t targetTimestampNs, bool idr)
+{
+  std::unique_lock<std::mutex> lock(codec_mutex);
+  codec_cv.wait(lock, [&] { return in_flight.size() < max_in_flight or retrieve_error; });
+  if (retrieve_error)
+    std::rethrow_exception(retrieve_error);
+
+  PushFrame(frame_index, targetTimestampNs, idr);
+  in_flight.emplace_back(targetTimestampNs, std::chrono::steady_clock::now());
+  submitted++;
+  lock.unlock();
+  codec_cv.notify_all();
+}
+
+void alvr::EncodePipeline::RetrieveLoop()
+{
+  std::vector<uint8_t> encoded_data;
+  std::unique_lock<std::mutex> lock(codec_mutex);
   try {
-    auto nvenc = std::make_unique<alvr::EncodePipelineNvEnc>(input_frames, vk_frame_ctx);
-    Info("using NvEnc encoder");
-    return nvenc;
-  } catch (...)
+    while (true) {
+      codec_cv.wait(lock, [&] { return stopping or not in_flight.empty(); });
+      if (stopping)
+        return;
+
+      encoded_data.clear();
+      uint64_t pts;
+      EncodeStats stats;
+      if (not GetEncoded(encoded_data, &pts, &stats)) {
+        // The encoder keeps these frames until it gets more input, they must not hold back Submit()
+        in_flight.clear();
+        uint64_t seen = submitted;
+        codec_cv.notify_all();
+        codec_cv.wait(lock, [&] { return stopping or submitted != seen; });
+        continue;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      auto submit_time = now;
+      while (not in_flight.empty()) {
+        auto [frame_pts, time] = in_flight.front();
+        in_flight.pop_front();
+        if (frame_pts == pts) {
+          submit_time = time;
+          break;
+        }
+      }
+      lock.unlock();
+      codec_cv.notify_all();
+
+      stats.latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(now - submit_time).count();
+      stats.pipelineDepth = max_in_flight;
+      packet_callback(encoded_data, pts, stats);
+
+      lock.lock();
+    }
+  } catch (...) {
+    if (not lock.owns_lock())
+      lock.lock();
+    retrieve_error = std::current_exception();
+    codec_cv.notify_all();
+  }
+}
+
+std::unique_ptr<alvr::EncodePipeline> alvr::EncodePipeline::Create(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx)
+{
+  // Start with the encoder that worked last time for this configuration. The key does not identify
+  // the GPU, so the software encoder stays the last resort and is not cached. Vulkan Video comes
+  // first, it encodes the frames on their own device without going through another API.
+  std::string config_key = encoder_config_key();
+  std::vector<std::string> candidates = {"vulkan", "vaapi", "nvenc"};
+  if (forced_encoder.empty())
+    PreferCachedEncoder(config_key, candidates);
+  else if (forced_encoder != "sw")
+    candidates = {forced_encoder};
+  else
+    candidates.clear();
+
+  for (const auto &candidate: candidates)
   {
-    Info("failed to create NvEnc encoder");
+    try {
+      std::unique_ptr<EncodePipeline> pipeline;
+      if (candidate == "vulkan")
+        pipeline = std::make_unique<alvr::EncodePipelineVulkan>(input_frames, vk_frame_ctx);
+      else if (candidate == "vaapi")
+        pipeline = std::make_unique<alvr::EncodePipelineVAAPI>(input_frames, vk_frame_ctx);
+      else if (candidate == "nvenc")
+        pipeline = std::make_unique<alvr::EncodePipelineNvEnc>(input_frames, vk_frame_ctx);
+      else
+        throw std::runtime_error("unknown encoder " + candidate);
+      Info("using %s encoder", candidate.c_str());
+      if (forced_encoder.empty())
+        StoreCachedEncoder(config_key, candidate);
+      return pipeline;
+    } catch (...)
+    {
+      Info("failed to create %s encoder", candidate.c_str());
+      if (not forced_encoder.empty())
+        throw;
+    }
   }
   auto sw = std::make_unique<alvr::EncodePipelineSW>(input_frames, vk_frame_ctx);
   Info("using SW encoder");
   return sw;
 }
 
+void alvr::EncodePipeline::ForceEncoder(const std::string &name)
+{
+  forced_encoder = name;
+}
+
+void alvr::EncodePipeline::Prewarm()
+{
+  std::lock_guard<std::mutex> lock(prewarm_mutex);
+  if (prewarmed_vaapi_device.valid())
+    return;
+  prewarmed_vaapi_device = std::async(std::launch::async, []() -> AVBufferRef * {
+    auto start = std::chrono::steady_clock::now();
+    try {
+      libav::instance();
+    } catch (std::exception &e) {
+      Error("Failed to load the encoder libraries: %s\n", e.what());
+      return nullptr;
+    }
+
+    // Vulkan Video and NVENC run on the Vulkan device of the layer, which is only known once
+    // vrcompositor connects
+    std::vector<std::string> candidates = {"vulkan", "vaapi", "nvenc"};
+    PreferCachedEncoder(encoder_config_key(), candidates);
+    AVBufferRef *device = nullptr;
+    if (candidates.front() == "vaapi" and
+        AVUTIL.av_hwdevice_ctx_create(&device, AV_HWDEVICE_TYPE_VAAPI, NULL, NULL, 0) < 0) {
+      device = nullptr;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    Info("Encoder libraries loaded%s in %lld ms\n", device ? " and VAAPI device opened" : "",
+        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    return device;
+  });
+}
+
+AVBufferRef *alvr::EncodePipeline::TakePrewarmedVaapiDevice()
+{
+  std::lock_guard<std::mutex> lock(prewarm_mutex);
+  if (not prewarmed_vaapi_device.valid())
+    return nullptr;
+  return prewarmed_vaapi_device.get();
+}
+
 alvr::EncodePipeline::~EncodePipeline()
 {
+  for (auto pkt: drained)
+    AVCODEC.av_packet_free(&pkt);
+  AVCODEC.av_packet_free(&enc_pkt);
   AVCODEC.avcodec_free_context(&encoder_ctx);
 }
 
-bool alvr::EncodePipeline::GetEncoded(std::vector<uint8_t> &out, uint64_t *pts)
+bool alvr::EncodePipeline::GetEncoded(std::vector<uint8_t> &out, uint64_t *pts, EncodeStats *stats)
 {
-  AVPacket * enc_pkt = AVCODEC.av_packet_alloc();
-  int err = AVCODEC.avcodec_receive_packet(encoder_ctx, enc_pkt);
-  if (err == AVERROR(EAGAIN)) {
-    return false;
-  } else if (err) {
-    throw alvr::AvException("failed to encode", err);
+  if (not enc_pkt)
+    enc_pkt = AVCODEC.av_packet_alloc();
+  if (not drained.empty()) {
+    AVCODEC.av_packet_move_ref(enc_pkt, drained.front());
+    AVCODEC.av_packet_free(&drained.front());
+    drained.pop_front();
+  } else {
+    int err = AVCODEC.avcodec_receive_packet(encoder_ctx, enc_pkt);
+    if (err == AVERROR(EAGAIN)) {
+      return false;
+    } else if (err) {
+      throw alvr::AvException("failed to encode", err);
+    }
   }
-  filter_NAL(enc_pkt->data, enc_pkt->size, out);
+  // The packet buffer belongs to us until the next unref, filter it in place
+  size_t size = codec == ALVR_CODEC_AV1 ? FilterAv1Obus(enc_pkt->data, enc_pkt->size)
+    : filter_NAL(enc_pkt->data, enc_pkt->size, codec);
+  out.insert(out.end(), enc_pkt->data, enc_pkt->data + size);
   *pts = enc_pkt->pts;
-  AVCODEC.av_packet_free(&enc_pkt);
+  if (stats) {
+    stats->bytes = size;
+    read_encode_stats(enc_pkt, *stats);
+  }
+  AVCODEC.av_packet_unref(enc_pkt);
   return true;
 }
@@ -1,9 +1,23 @@
 #pragma once
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "alvr_server/EncodeStats.h"
+#include "alvr_server/EncoderRate.h"
+
+extern "C" struct AVBufferRef;
 extern "C" struct AVCodecContext;
+extern "C" struct AVFrame;
+extern "C" struct AVPacket;
 
 namespace alvr
 {
@@ -14,15 +28,84 @@ class VkFrameCtx;
 class EncodePipeline
 {
 public:
+  EncodePipeline();
   virtual ~EncodePipeline();
 
   virtual void PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr) = 0;
-  bool GetEncoded(std::vector<uint8_t> & out, uint64_t *pts);
+  // stats gets what the encoder reports about the frame, the latency is left to the caller
+  bool GetEncoded(std::vector<uint8_t> & out, uint64_t *pts, EncodeStats *stats = nullptr);
 
-  void SetBitrate(int64_t bitrate);
+  // Takes effect on the next frame. The base version updates the rate control fields of the codec
+  // context, which libavcodec passes on to nvenc (nvEncReconfigureEncoder) and libx264 at the next
+  // frame.
+  virtual void Reconfigure(const EncoderRate &rate);
+  // Called instead of requesting an IDR after packet loss, returns false if the encoder cannot
+  // refresh the picture gradually and an IDR is needed.
+  virtual bool StartIntraRefresh() { return false; }
+  // Called before the next frame when the client lost the frames after the one of target timestamp
+  // last_good_timestamp, returns false if the encoder cannot stop referencing them. None of the
+  // libavcodec encoders exposes it, they recover with an IDR or an intra refresh.
+  virtual bool InvalidateReferences(uint64_t last_good_timestamp) { return false; }
+  // Swapchain recreation with images of the same size and format. ReleaseInputFrames() drops all
+  // the pipeline derived from the input frames, the caller then refills the vector it gave to
+  // Create() and passes it to SetInputFrames(). The encoder session is kept. Returns false if the
+  // pipeline has to be recreated instead.
+  virtual bool ReleaseInputFrames() { return false; }
+  virtual void SetInputFrames(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx) {}
   static std::unique_ptr<EncodePipeline> Create(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx);
+  // Restricts Create() to one encoder, "vulkan", "vaapi", "nvenc" or "sw", which then throws when it
+  // cannot be created. The encoder cache is left alone. Empty for the usual order, set by the
+  // capture benchmark.
+  static void ForceEncoder(const std::string &name);
+
+  // Loads the libav libraries and opens the VAAPI device on a background thread, called when the
+  // driver activates so that the warm-up overlaps with the client connection.
+  static void Prewarm();
+  // The VAAPI device of Prewarm(), waiting for it if needed, or nullptr. Only the first call gets
+  // it, and the caller owns the reference.
+  static AVBufferRef *TakePrewarmedVaapiDevice();
+
+  // Async mode: packets are retrieved on a separate thread and passed to the callback as soon as
+  // the encoder yields them, along with the encoder stats and the time since the frame was submitted.
+  // Frames are then given with Submit() instead of PushFrame()/GetEncoded(), which only blocks
+  // while max_in_flight frames are waiting for their packet.
+  using PacketCallback = std::function<void(std::vector<uint8_t> &data, uint64_t pts, const EncodeStats &stats)>;
+  void StartAsync(uint32_t max_in_flight, PacketCallback callback);
+  void Submit(uint32_t frame_index, uint64_t targetTimestampNs, bool idr);
+  // Must be called by child class destructors, the retrieval thread uses their resources
+  void StopAsync();
+
 protected:
+  // Rate from the settings, for the encoder creation
+  static EncoderRate DefaultRate();
+  // Sets the rate control fields of encoder_ctx
+  void ApplyRate(const EncoderRate &rate);
+  // Flushes encoder_ctx before it is replaced, GetEncoded() returns the remaining packets first
+  void Drain();
+  // Foveated encoding regions as frame side data, for the encoders that read it (VAAPI, libx264,
+  // libx265). qp_range is what the encoder multiplies the offsets by to get QP deltas.
+  static void AddFoveationRegions(AVFrame *frame, int qp_range);
+
   AVCodecContext *encoder_ctx = nullptr; //shall be initialized by child class
+  // libavcodec contexts are not thread safe, every call on encoder_ctx is done under this mutex
+  std::mutex codec_mutex;
+
+private:
+  void RetrieveLoop();
+
+  AVPacket *enc_pkt = nullptr;
+  int codec;
+  std::deque<AVPacket *> drained;
+
+  std::condition_variable codec_cv;
+  std::thread retrieve_thread;
+  PacketCallback packet_callback;
+  uint32_t max_in_flight = 0;
+  // pts and submission time of the frames that have not produced a packet yet
+  std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> in_flight;
+  uint64_t submitted = 0;
+  bool stopping = false;
+  std::exception_ptr retrieve_error;
 };
 
 }
@@ -1,6 +1,8 @@
 #include "EncodePipelineNvEnc.h"
 #include "ALVR-common/packet_types.h"
+#include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
+#include "FrameRender.h"
 #include "ffmpeg_helper.h"
 #include <chrono>
 
@@ -18,20 +20,41 @@ const char *encoder(ALVR_CODEC codec) {
         return "h264_nvenc";
     case ALVR_CODEC_H265:
         return "hevc_nvenc";
+    case ALVR_CODEC_AV1:
+        // Ada and newer, ffmpeg 6.0
+        return "av1_nvenc";
     }
     throw std::runtime_error("invalid codec " + std::to_string(codec));
 }
 
+// CUDA frames the Vulkan images are copied into. ffmpeg imports the exported Vulkan memory as
+// CUDA external memory, so the copy stays on the GPU, and NVENC takes BGR0/RGB0 input directly.
+AVBufferRef *create_cuda_frames_ctx(AVBufferRef *cuda_ctx, AVPixelFormat sw_format, int width, int height) {
+    AVBufferRef *hw_frames_ref = AVUTIL.av_hwframe_ctx_alloc(cuda_ctx);
+    if (not hw_frames_ref) {
+        throw std::runtime_error("Failed to create CUDA frame context.");
+    }
+    auto frames_ctx = (AVHWFramesContext *)hw_frames_ref->data;
+    frames_ctx->format = AV_PIX_FMT_CUDA;
+    frames_ctx->sw_format = sw_format;
+    frames_ctx->width = width;
+    frames_ctx->height = height;
+    int err = AVUTIL.av_hwframe_ctx_init(hw_frames_ref);
+    if (err < 0) {
+        AVUTIL.av_buffer_unref(&hw_frames_ref);
+        throw alvr::AvException("Failed to initialize CUDA frame context:", err);
+    }
+    return hw_frames_ref;
+}
+
 } // namespace
 alvr::EncodePipelineNvEnc::EncodePipelineNvEnc(std::vector<VkFrame> &input_frames,
                                                VkFrameCtx &vk_frame_ctx) {
     auto input_frame_ctx = (AVHWFramesContext *)vk_frame_ctx.ctx->data;
-    assert(input_frame_ctx->sw_format == AV_PIX_FMT_BGRA);
+    assert(input_frame_ctx->sw_format == AV_PIX_FMT_BGRA or input_frame_ctx->sw_format == AV_PIX_FMT_RGBA);
 
     int err;
-    for (auto &input_frame : input_frames) {
-        vk_frames.push_back(std::move(input_frame.make_av_frame(vk_frame_ctx)));
-    }
+    SetInputFrames(input_frames, vk_frame_ctx);
 
     const auto &settings = Settings::Instance();
 
@@ -56,6 +79,19 @@ alvr::EncodePipelineNvEnc::EncodePipelineNvEnc(std::vector<VkFrame> &input_frame
         AVUTIL.av_opt_set(encoder_ctx, "preset", "llhq", 0);
         AVUTIL.av_opt_set(encoder_ctx, "zerolatency", "1", 0);
         break;
+    case ALVR_CODEC_AV1:
+        // av1_nvenc only has the new presets, llhq maps to p1 with the ultra low latency tune
+        AVUTIL.av_opt_set(encoder_ctx, "preset", "p1", 0);
+        AVUTIL.av_opt_set(encoder_ctx, "tune", "ull", 0);
+        AVUTIL.av_opt_set(encoder_ctx, "zerolatency", "1", 0);
+        break;
+    }
+    if (settings.m_use10bitEncoder and codec_id != ALVR_CODEC_H264) {
+        // The CUDA frames are the RGB input frames, NVENC converts them to P010 internally and
+        // encodes HEVC Main10 (AV1 Main). There is no 10 bit H.264.
+        if (AVUTIL.av_opt_set(encoder_ctx, "highbitdepth", "1", AV_OPT_SEARCH_CHILDREN) < 0) {
+            Info("NvEnc: 10 bit encoding of 8 bit input needs ffmpeg 6.1, encoding 8 bit\n");
+        }
     }
 
     /**
@@ -66,17 +102,45 @@ alvr::EncodePipelineNvEnc::EncodePipelineNvEnc(std::vector<VkFrame> &input_frame
      * AV_PIX_FMT_BGRA - 28  ///< packed BGRA 8:8:8:8, 32bpp, BGRABGRA...
      * AV_PIX_FMT_BGR0 - 123 ///< packed BGR 8:8:8,    32bpp, BGRXBGRX...   X=unused/undefined
      *
-     * We just to ignore the alpha channel and it's done
+     * We just to ignore the alpha channel and it's done. The same goes for the RGBA frames of
+     * FrameRender and RGB0.
      */
-    encoder_ctx->pix_fmt = AV_PIX_FMT_BGR0;
-    encoder_ctx->width = settings.m_renderWidth;
-    encoder_ctx->height = settings.m_renderHeight;
+    const AVPixelFormat sw_format = input_frame_ctx->sw_format == AV_PIX_FMT_RGBA ? AV_PIX_FMT_RGB0 : AV_PIX_FMT_BGR0;
+    encoder_ctx->pix_fmt = sw_format;
+    uint32_t width, height;
+    FrameRender::GetEncodingResolution(&width, &height);
+
+    // Prefer feeding NVENC from CUDA memory derived from the Vulkan device, the fallback
+    // downloads every frame to system memory first.
+    err = AVUTIL.av_hwdevice_ctx_create_derived(&hw_ctx, AV_HWDEVICE_TYPE_CUDA, input_frame_ctx->device_ref, 0);
+    if (err == 0) {
+        try {
+            encoder_ctx->hw_frames_ctx = create_cuda_frames_ctx(hw_ctx, sw_format, width, height);
+            encoder_ctx->pix_fmt = AV_PIX_FMT_CUDA;
+        } catch (std::exception &e) {
+            Info("NvEnc: %s, using system memory input\n", e.what());
+            AVUTIL.av_buffer_unref(&hw_ctx);
+        }
+    } else {
+        Info("NvEnc: failed to derive CUDA device from Vulkan, using system memory input\n");
+    }
+
+    encoder_ctx->width = width;
+    encoder_ctx->height = height;
     encoder_ctx->time_base = {1, (int)1e9};
-    encoder_ctx->framerate = AVRational{settings.m_refreshRate, 1};
     encoder_ctx->sample_aspect_ratio = AVRational{1, 1};
     encoder_ctx->max_b_frames = 0;
+    encoder_ctx->slices = settings.m_slicesPerFrame;
     encoder_ctx->gop_size = 30;
-    encoder_ctx->bit_rate = settings.mEncodeBitrateMBs * 1000 * 1000;
+    if (settings.m_intraRefreshFrames > 0) {
+        intra_refresh = AVUTIL.av_opt_set(encoder_ctx, "intra-refresh", "1", AV_OPT_SEARCH_CHILDREN) >= 0;
+        if (intra_refresh) {
+            encoder_ctx->gop_size = settings.m_intraRefreshFrames;
+        } else {
+            Info("NvEnc: intra refresh is not available, using IDR frames on packet loss\n");
+        }
+    }
+    ApplyRate(DefaultRate());
 
     err = AVCODEC.avcodec_open2(encoder_ctx, codec, NULL);
     if (err < 0) {
@@ -87,14 +151,36 @@ alvr::EncodePipelineNvEnc::EncodePipelineNvEnc(std::vector<VkFrame> &input_frame
 }
 
 alvr::EncodePipelineNvEnc::~EncodePipelineNvEnc() {
+    StopAsync();
     AVUTIL.av_buffer_unref(&hw_ctx);
     AVUTIL.av_frame_free(&hw_frame);
 }
 
+bool alvr::EncodePipelineNvEnc::ReleaseInputFrames() {
+    vk_frames.clear();
+    return true;
+}
+
+void alvr::EncodePipelineNvEnc::SetInputFrames(std::vector<VkFrame> &input_frames,
+                                               VkFrameCtx &vk_frame_ctx) {
+    for (auto &input_frame : input_frames) {
+        vk_frames.push_back(std::move(input_frame.make_av_frame(vk_frame_ctx)));
+    }
+}
+
 void alvr::EncodePipelineNvEnc::PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr) {
     assert(frame_index < vk_frames.size());
 
-    int err = AVUTIL.av_hwframe_transfer_data(hw_frame, vk_frames[frame_index].get(), 0);
+    int err;
+    if (encoder_ctx->hw_frames_ctx) {
+        // The encoder keeps a reference to the frames it has not consumed yet, take a new one
+        // from the pool instead of overwriting them
+        AVUTIL.av_frame_unref(hw_frame);
+        if ((err = AVUTIL.av_hwframe_get_buffer(encoder_ctx->hw_frames_ctx, hw_frame, 0)) < 0) {
+            throw alvr::AvException("av_hwframe_get_buffer failed:", err);
+        }
+    }
+    err = AVUTIL.av_hwframe_transfer_data(hw_frame, vk_frames[frame_index].get(), 0);
     if (err) {
         throw alvr::AvException("av_hwframe_transfer_data", err);
     }
@@ -17,8 +17,13 @@ public:
   EncodePipelineNvEnc(std::vector<VkFrame> &input_frames, VkFrameCtx& vk_frame_ctx);
 
   void PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr) override;
+  bool StartIntraRefresh() override { return intra_refresh; }
+  bool ReleaseInputFrames() override;
+  void SetInputFrames(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx) override;
 
 private:
+  // Refresh waves run continuously, one every gop_size frames
+  bool intra_refresh = false;
   AVBufferRef *hw_ctx = nullptr;
   std::vector<std::unique_ptr<AVFrame, std::function<void(AVFrame*)>>> vk_frames;
   AVFrame * hw_frame = nullptr;
@@ -2,14 +2,20 @@
 
 #include <algorithm>
 #include <chrono>
-
+#include <cmath>
+#include <pthread.h>
+#include <sched.h>
+
+#include "FrameRender.h"
+#include "YuvDownload.h"
+#include "alvr_server/FoveatedEncoding.h"
+#include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
 #include "ffmpeg_helper.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavutil/opt.h>
-#include <libswscale/swscale.h>
 }
 
 namespace
@@ -23,20 +29,52 @@ const char * encoder(ALVR_CODEC codec)
       return "libx264";
     case ALVR_CODEC_H265:
       return "libx265";
+    case ALVR_CODEC_AV1:
+      return "libsvtav1";
   }
   throw std::runtime_error("invalid codec " + std::to_string(codec));
 }
 
+// x264 and x265 create their worker threads when the encoder is opened, and threads inherit the
+// affinity of their creator. Restrict the calling thread to the last thread_count allowed CPUs
+// for the duration of the scope.
+class ScopedEncoderAffinity
+{
+public:
+  ScopedEncoderAffinity(uint32_t thread_count)
+  {
+    if (thread_count == 0 or pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0)
+      return;
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    uint32_t count = 0;
+    for (int cpu = CPU_SETSIZE - 1; cpu >= 0 and count < thread_count; --cpu)
+    {
+      if (CPU_ISSET(cpu, &previous))
+      {
+        CPU_SET(cpu, &pinned);
+        count++;
+      }
+    }
+    active = pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) == 0;
+    if (active)
+      Info("pinned %u software encoder threads\n", count);
+  }
+  ~ScopedEncoderAffinity()
+  {
+    if (active)
+      pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+  }
+private:
+  cpu_set_t previous;
+  bool active = false;
+};
+
 
 }
 
 alvr::EncodePipelineSW::EncodePipelineSW(std::vector<VkFrame>& input_frames, VkFrameCtx& vk_frame_ctx)
 {
-  for (auto& input_frame: input_frames)
-  {
-    vk_frames.push_back(input_frame.make_av_frame(vk_frame_ctx).release());
-  }
-
   const auto& settings = Settings::Instance();
 
   auto codec_id = ALVR_CODEC(settings.m_codec);
@@ -53,76 +91,165 @@ alvr::EncodePipelineSW::EncodePipelineSW(std::vector<VkFrame>& input_frames, VkF
     throw std::runtime_error("failed to allocate " + std::string(encoder_name) + " encoder");
   }
 
+  // tune=zerolatency already disables lookahead and B-frames, and selects sliced threads
   AVDictionary * opt = NULL;
+  // With intra refresh the keyframe interval is the length of a refresh wave
+  bool refresh_wave = settings.m_swIntraRefresh and settings.m_intraRefreshFrames > 0;
   switch (codec_id)
   {
     case ALVR_CODEC_H264:
+    {
       encoder_ctx->profile = settings.m_use10bitEncoder ? FF_PROFILE_H264_HIGH_10 : FF_PROFILE_H264_HIGH;
       AVUTIL.av_dict_set(&opt, "preset", "ultrafast", 0);
       AVUTIL.av_dict_set(&opt, "tune", "zerolatency", 0);
-      encoder_ctx->gop_size = 72;
+      std::string params = "rc-lookahead=0:sync-lookahead=0";
+      if (settings.m_swFrameThreads)
+        params += ":sliced-threads=0";
+      AVUTIL.av_dict_set(&opt, "x264-params", params.c_str(), 0);
+      if (settings.m_swIntraRefresh)
+        AVUTIL.av_dict_set(&opt, "intra-refresh", "1", 0);
+      encoder_ctx->gop_size = refresh_wave ? settings.m_intraRefreshFrames : 72;
       break;
+    }
     case ALVR_CODEC_H265:
+    {
       encoder_ctx->profile = settings.m_use10bitEncoder ? FF_PROFILE_HEVC_MAIN_10 : FF_PROFILE_HEVC_MAIN;
       AVUTIL.av_dict_set(&opt, "preset", "ultrafast", 0);
       AVUTIL.av_dict_set(&opt, "tune", "zerolatency", 0);
+      // libx265 does not read AVCodecContext::slices
+      std::string params = "slices=" + std::to_string(settings.m_slicesPerFrame) + ":rc-lookahead=0";
+      if (settings.m_swFrameThreads)
+        params += ":frame-threads=0";
+      if (settings.m_swIntraRefresh)
+        params += ":intra-refresh=1";
+      AVUTIL.av_dict_set(&opt, "x265-params", params.c_str(), 0);
+      encoder_ctx->gop_size = refresh_wave ? settings.m_intraRefreshFrames : 72;
+      break;
+    }
+    case ALVR_CODEC_AV1:
+    {
+      // Main profile covers 8 and 10 bit. SVT-AV1 has no intra refresh, the low delay prediction
+      // structure without lookahead is its real time mode.
+      encoder_ctx->profile = FF_PROFILE_AV1_MAIN;
+      AVUTIL.av_dict_set(&opt, "preset", "12", 0);
+      AVUTIL.av_dict_set(&opt, "svtav1-params", "pred-struct=1:lookahead=0", 0);
       encoder_ctx->gop_size = 72;
       break;
+    }
   }
 
 
-  encoder_ctx->width = settings.m_renderWidth;
-  encoder_ctx->height = settings.m_renderHeight;
+  uint32_t width, height;
+  FrameRender::GetEncodingResolution(&width, &height);
+  encoder_ctx->width = width;
+  encoder_ctx->height = height;
   encoder_ctx->time_base = {1, (int)1e9};
-  encoder_ctx->framerate = AVRational{settings.m_refreshRate, 1};
   encoder_ctx->sample_aspect_ratio = AVRational{1, 1};
   encoder_ctx->pix_fmt = settings.m_use10bitEncoder ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P;
   encoder_ctx->max_b_frames = 0;
-  encoder_ctx->bit_rate = settings.mEncodeBitrateMBs * 1000 * 1000;
+  encoder_ctx->slices = settings.m_slicesPerFrame;
+  target_rate = DefaultRate();
+  ApplyRate(target_rate);
   encoder_ctx->thread_count = settings.m_swThreadCount;
 
-  int err = AVCODEC.avcodec_open2(encoder_ctx, codec, &opt);
+  int err;
+  {
+    ScopedEncoderAffinity affinity(settings.m_swPinThreads ? settings.m_swThreadCount : 0);
+    err = AVCODEC.avcodec_open2(encoder_ctx, codec, &opt);
+  }
   if (err < 0) {
     throw alvr::AvException("Cannot open video encoder codec:", err);
   }
 
-  transferred_frame = AVUTIL.av_frame_alloc();
+  hold_deadline = settings.m_swHoldFrameDeadline;
+  frame_budget_us = 1e6 / settings.m_refreshRate;
+
   encoder_frame = AVUTIL.av_frame_alloc();
-  encoder_frame->width = settings.m_renderWidth;
-  encoder_frame->height = settings.m_renderHeight;
+  encoder_frame->width = encoder_ctx->width;
+  encoder_frame->height = encoder_ctx->height;
   encoder_frame->format = encoder_ctx->pix_fmt;
-  AVUTIL.av_frame_get_buffer(encoder_frame, 0);
+  // Kept by the frame for every encode, libx264 and libx265 scale the offsets by 25
+  if (FoveatedEncodingEnabled())
+    AddFoveationRegions(encoder_frame, 25);
 
-  scaler_ctx = SWSCALE.sws_getContext(
-          vk_frames[0]->width, vk_frames[0]->height, ((AVHWFramesContext*)vk_frames[0]->hw_frames_ctx->data)->sw_format,
-          encoder_ctx->width, encoder_ctx->height, encoder_ctx->pix_fmt,
-          SWS_BILINEAR,
-          NULL, NULL, NULL);
+  // One buffer for the frame being converted, and one per frame an encoder may hold on to
+  download = std::make_unique<YuvDownload>(vk_frame_ctx, input_frames, width, height,
+      settings.m_use10bitEncoder, settings.m_encodePipelineDepth + 1);
 }
 
 alvr::EncodePipelineSW::~EncodePipelineSW()
 {
-  for (auto &vk_frame: vk_frames)
-    AVUTIL.av_frame_free(&vk_frame);
-  AVUTIL.av_frame_free(&transferred_frame);
+  StopAsync();
   AVUTIL.av_frame_free(&encoder_frame);
 }
 
-void alvr::EncodePipelineSW::PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr)
+bool alvr::EncodePipelineSW::ReleaseInputFrames()
+{
+  download->ReleaseInputFrames();
+  return true;
+}
+
+void alvr::EncodePipelineSW::SetInputFrames(std::vector<VkFrame>& input_frames, VkFrameCtx& vk_frame_ctx)
+{
+  download->SetInputFrames(input_frames);
+}
+
+bool alvr::EncodePipelineSW::StartIntraRefresh()
+{
+  return Settings::Instance().m_swIntraRefresh;
+}
+
+void alvr::EncodePipelineSW::Reconfigure(const EncoderRate &rate)
+{
+  std::lock_guard<std::mutex> lock(codec_mutex);
+  target_rate = rate;
+  ApplyScaledRate();
+}
+
+void alvr::EncodePipelineSW::ApplyScaledRate()
+{
+  EncoderRate rate = target_rate;
+  rate.bitrate *= deadline_scale;
+  rate.vbvSize *= deadline_scale;
+  ApplyRate(rate);
+}
+
+void alvr::EncodePipelineSW::HoldDeadline(std::chrono::steady_clock::duration frame_time)
 {
-  int err = AVUTIL.av_hwframe_transfer_data(transferred_frame, vk_frames[frame_index], 0);
-  if (err)
-    throw alvr::AvException("av_hwframe_transfer_data", err);
+  // Exponential average over a few frames, to react within a fraction of a second
+  double frame_us = std::chrono::duration_cast<std::chrono::microseconds>(frame_time).count();
+  average_frame_us = average_frame_us == 0 ? frame_us : average_frame_us * 0.8 + frame_us * 0.2;
+
+  double scale = deadline_scale;
+  if (average_frame_us > frame_budget_us)
+    scale = std::max(scale * 0.9, MIN_DEADLINE_SCALE);
+  else if (average_frame_us < frame_budget_us * 0.7)
+    scale = std::min(scale * 1.02, 1.);
+
+  if (std::abs(scale - deadline_scale) > 0.01 or (scale == 1. and deadline_scale != 1.))
+  {
+    deadline_scale = scale;
+    ApplyScaledRate();
+  }
+}
 
-  err = SWSCALE.sws_scale(scaler_ctx, transferred_frame->data, transferred_frame->linesize, 0, transferred_frame->height,
-      encoder_frame->data, encoder_frame->linesize);
-  if (err == 0)
-    throw alvr::AvException("sws_scale failed:", err);
+void alvr::EncodePipelineSW::PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr)
+{
+  auto start = std::chrono::steady_clock::now();
+  download->Download(frame_index, encoder_frame);
 
   encoder_frame->pict_type = idr ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
   encoder_frame->pts = targetTimestampNs;
 
-  if ((err = AVCODEC.avcodec_send_frame(encoder_ctx, encoder_frame)) < 0) {
+  // With sliced threads libx264 encodes the frame during avcodec_send_frame(). libavcodec takes
+  // its own reference to the buffer, dropping ours lets the buffer go back to the ring as soon as
+  // the encoder has copied it.
+  int err = AVCODEC.avcodec_send_frame(encoder_ctx, encoder_frame);
+  AVUTIL.av_buffer_unref(&encoder_frame->buf[0]);
+  if (err < 0) {
     throw alvr::AvException("avcodec_send_frame failed:", err);
   }
+
+  if (hold_deadline)
+    HoldDeadline(std::chrono::steady_clock::now() - start);
 }
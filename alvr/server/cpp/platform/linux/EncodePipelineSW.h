@@ -3,11 +3,12 @@
 #include "EncodePipeline.h"
 
 extern "C" struct AVFrame;
-extern "C" struct SwsContext;
 
 namespace alvr
 {
 
+class YuvDownload;
+
 class EncodePipelineSW: public EncodePipeline
 {
 public:
@@ -15,11 +16,26 @@ public:
   EncodePipelineSW(std::vector<VkFrame> &input_frames, VkFrameCtx& vk_frame_ctx);
 
   void PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr) override;
+  void Reconfigure(const EncoderRate &rate) override;
+  bool StartIntraRefresh() override;
+  bool ReleaseInputFrames() override;
+  void SetInputFrames(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx) override;
 
 private:
-  std::vector<AVFrame *> vk_frames;
-  AVFrame * transferred_frame = nullptr;
+  // Lower the bitrate while frames take longer than the frame interval, the entropy coder and
+  // mode decision get cheaper with fewer bits.
+  void HoldDeadline(std::chrono::steady_clock::duration frame_time);
+  // target_rate lowered by deadline_scale
+  void ApplyScaledRate();
+  static constexpr double MIN_DEADLINE_SCALE = 0.5;
+  bool hold_deadline = false;
+  double frame_budget_us = 0;
+  double average_frame_us = 0;
+  double deadline_scale = 1.;
+  EncoderRate target_rate;
+
+  // Converts the input frames on the GPU, encoder_frame references its buffers
+  std::unique_ptr<YuvDownload> download;
   AVFrame * encoder_frame = nullptr;
-  SwsContext *scaler_ctx = nullptr;
 };
 }
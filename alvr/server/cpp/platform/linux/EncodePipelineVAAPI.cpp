@@ -1,18 +1,24 @@
 #include "EncodePipelineVAAPI.h"
 #include "ALVR-common/packet_types.h"
+#include "FrameRender.h"
 #include "ffmpeg_helper.h"
+#include "alvr_server/FoveatedEncoding.h"
+#include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
 #include <chrono>
+#include <cmath>
+#include <unistd.h>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersink.h>
-#include <libavfilter/buffersrc.h>
 #include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_vaapi.h>
 #include <libavutil/opt.h>
 }
 
+#include <va/va_drmcommon.h>
+#include <va/va_vpp.h>
+
 namespace
 {
 
@@ -24,11 +30,14 @@ const char * encoder(ALVR_CODEC codec)
       return "h264_vaapi";
     case ALVR_CODEC_H265:
       return "hevc_vaapi";
+    case ALVR_CODEC_AV1:
+      // ffmpeg 6.1, Intel Arc and RDNA3
+      return "av1_vaapi";
   }
   throw std::runtime_error("invalid codec " + std::to_string(codec));
 }
 
-void set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx)
+void set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx, AVPixelFormat sw_format)
 {
   AVBufferRef *hw_frames_ref;
   AVHWFramesContext *frames_ctx = NULL;
@@ -39,10 +48,11 @@ void set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx)
   }
   frames_ctx = (AVHWFramesContext *)(hw_frames_ref->data);
   frames_ctx->format = AV_PIX_FMT_VAAPI;
-  frames_ctx->sw_format = AV_PIX_FMT_NV12;
+  frames_ctx->sw_format = sw_format;
   frames_ctx->width = ctx->width;
   frames_ctx->height = ctx->height;
-  frames_ctx->initial_pool_size = 3;
+  // one surface being converted, the others held by the encoder
+  frames_ctx->initial_pool_size = Settings::Instance().m_encodePipelineDepth + 3;
   if ((err = AVUTIL.av_hwframe_ctx_init(hw_frames_ref)) < 0) {
     AVUTIL.av_buffer_unref(&hw_frames_ref);
     throw alvr::AvException("Failed to initialize VAAPI frame context:", err);
@@ -91,25 +101,163 @@ std::vector<AVFrame*> map_frames(AVBufferRef *hw_device_ctx, std::vector<alvr::V
   return result;
 }
 
+// DRM and VA fourcc codes share their packing
+constexpr uint32_t DRM_FORMAT_ARGB8888 = VA_FOURCC('A', 'R', '2', '4');
+constexpr uint32_t DRM_FORMAT_ABGR8888 = VA_FOURCC('A', 'B', '2', '4');
+
+// Import the frames shared as dma-bufs as VAAPI surfaces, without going through a Vulkan mapping.
+// Returns false if they are not dma-bufs or the driver refuses them.
+bool import_surfaces(VADisplay va_display, std::vector<alvr::VkFrame>& input_frames, std::vector<VASurfaceID>& surfaces)
+{
+  for (auto& input_frame: input_frames)
+  {
+    if (input_frame.get_dmabuf_fd() == -1)
+      return false;
+
+    uint32_t va_fourcc, drm_format;
+    switch (input_frame.get_format())
+    {
+      case vk::Format::eB8G8R8A8Unorm:
+      case vk::Format::eB8G8R8A8Srgb:
+        va_fourcc = VA_FOURCC_BGRA;
+        drm_format = DRM_FORMAT_ARGB8888;
+        break;
+      case vk::Format::eR8G8B8A8Unorm:
+      case vk::Format::eR8G8B8A8Srgb:
+        va_fourcc = VA_FOURCC_RGBA;
+        drm_format = DRM_FORMAT_ABGR8888;
+        break;
+      default:
+        return false;
+    }
+
+    const auto& layout = input_frame.get_drm_layout();
+    VADRMPRIMESurfaceDescriptor desc = {};
+    desc.fourcc = va_fourcc;
+    desc.width = input_frame.get_width();
+    desc.height = input_frame.get_height();
+    desc.num_objects = 1;
+    desc.objects[0].fd = input_frame.get_dmabuf_fd();
+    desc.objects[0].size = lseek(input_frame.get_dmabuf_fd(), 0, SEEK_END);
+    desc.objects[0].drm_format_modifier = layout.modifier;
+    desc.num_layers = 1;
+    desc.layers[0].drm_format = drm_format;
+    desc.layers[0].num_planes = 1;
+    desc.layers[0].object_index[0] = 0;
+    desc.layers[0].offset[0] = layout.offset;
+    desc.layers[0].pitch[0] = layout.pitch;
+
+    VASurfaceAttrib attribs[2] = {};
+    attribs[0].type = VASurfaceAttribMemoryType;
+    attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[0].value.type = VAGenericValueTypeInteger;
+    attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2;
+    attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+    attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[1].value.type = VAGenericValueTypePointer;
+    attribs[1].value.value.p = &desc;
+
+    VASurfaceID surface;
+    VAStatus status = vaCreateSurfaces(va_display, VA_RT_FORMAT_RGB32, desc.width, desc.height, &surface, 1, attribs, 2);
+    if (status != VA_STATUS_SUCCESS)
+    {
+      Warn("VAAPI cannot import the swapchain dma-bufs (%s), mapping them instead\n", vaErrorStr(status));
+      vaDestroySurfaces(va_display, surfaces.data(), surfaces.size());
+      surfaces.clear();
+      return false;
+    }
+    surfaces.push_back(surface);
+  }
+  return true;
+}
+
 }
 
-alvr::EncodePipelineVAAPI::EncodePipelineVAAPI(std::vector<VkFrame>& input_frames, VkFrameCtx& vk_frame_ctx)
+alvr::EncodePipelineVAAPI::EncodePipelineVAAPI(std::vector<VkFrame>& input_frames, VkFrameCtx& vk_frame_ctx):
+  input_frames(input_frames)
 {
   /* VAAPI Encoding pipeline
    * The encoding pipeline has 3 frame types:
    * - input vulkan frames, only used to initialize the mapped frames
-   * - mapped frames, one per input frame, same format, and point to the same memory on the device
-   * - encoder frame, with a format compatible with the encoder, created by the filter
+   * - input surfaces, one per input frame, same format, and point to the same memory on the device.
+   *   They are imported from the dma-bufs of the input frames when the layer shares them that
+   *   way, or mapped from the Vulkan frames by libavutil otherwise
+   * - encoder frame, with a format compatible with the encoder, taken from the encoder pool
    * Each frame type has a corresponding hardware frame context, the vulkan one is provided
    *
-   * The pipeline is simply made of a scale_vaapi object, that does the conversion between formats
-   * and the encoder that takes the converted frame and produces packets.
+   * The pipeline is simply made of a VA-API video processing context, created once, that does the
+   * conversion between formats and the encoder that takes the converted frame and produces packets.
    */
-  int err = AVUTIL.av_hwdevice_ctx_create(&hw_ctx, AV_HWDEVICE_TYPE_VAAPI, NULL, NULL, 0);
-  if (err < 0) {
-    throw alvr::AvException("Failed to create a VAAPI device:", err);
+  hw_ctx = TakePrewarmedVaapiDevice();
+  if (not hw_ctx) {
+    int err = AVUTIL.av_hwdevice_ctx_create(&hw_ctx, AV_HWDEVICE_TYPE_VAAPI, NULL, NULL, 0);
+    if (err < 0) {
+      throw alvr::AvException("Failed to create a VAAPI device:", err);
+    }
+  }
+
+  OpenEncoder(DefaultRate(), nullptr);
+  last_reopen = std::chrono::steady_clock::now();
+
+  va_display = ((AVVAAPIDeviceContext *)((AVHWDeviceContext *)hw_ctx->data)->hwctx)->display;
+
+  SetInputFrames(input_frames, vk_frame_ctx);
+
+  VAStatus status = vaCreateConfig(va_display, VAProfileNone, VAEntrypointVideoProc, NULL, 0, &vpp_config);
+  if (status != VA_STATUS_SUCCESS)
+  {
+    throw std::runtime_error(std::string("vaCreateConfig failed: ") + vaErrorStr(status));
+  }
+  status = vaCreateContext(va_display, vpp_config, encoder_ctx->width, encoder_ctx->height, VA_PROGRESSIVE, NULL, 0, &vpp_context);
+  if (status != VA_STATUS_SUCCESS)
+  {
+    throw std::runtime_error(std::string("vaCreateContext failed: ") + vaErrorStr(status));
   }
 
+  encoder_frame = AVUTIL.av_frame_alloc();
+}
+
+alvr::EncodePipelineVAAPI::~EncodePipelineVAAPI()
+{
+  StopAsync();
+  AVUTIL.av_frame_free(&encoder_frame);
+  if (vpp_context != VA_INVALID_ID)
+    vaDestroyContext(va_display, vpp_context);
+  if (vpp_config != VA_INVALID_ID)
+    vaDestroyConfig(va_display, vpp_config);
+  ReleaseInputFrames();
+  AVUTIL.av_buffer_unref(&hw_ctx);
+}
+
+bool alvr::EncodePipelineVAAPI::ReleaseInputFrames()
+{
+  for (auto frame: mapped_frames)
+  {
+    AVUTIL.av_frame_free(&frame);
+  }
+  mapped_frames.clear();
+  if (imported_surfaces)
+    vaDestroySurfaces(va_display, input_surfaces.data(), input_surfaces.size());
+  input_surfaces.clear();
+  imported_surfaces = false;
+  return true;
+}
+
+void alvr::EncodePipelineVAAPI::SetInputFrames(std::vector<VkFrame>& frames, VkFrameCtx& vk_frame_ctx)
+{
+  assert(&frames == &input_frames);
+  (void)frames;
+  imported_surfaces = import_surfaces(va_display, input_frames, input_surfaces);
+  if (not imported_surfaces)
+  {
+    mapped_frames = map_frames(hw_ctx, input_frames, vk_frame_ctx);
+    for (auto frame: mapped_frames)
+      input_surfaces.push_back((VASurfaceID)(uintptr_t)frame->data[3]);
+  }
+}
+
+void alvr::EncodePipelineVAAPI::OpenEncoder(const EncoderRate &rate, AVBufferRef *hw_frames)
+{
   const auto& settings = Settings::Instance();
 
   auto codec_id = ALVR_CODEC(settings.m_codec);
@@ -126,117 +274,129 @@ alvr::EncodePipelineVAAPI::EncodePipelineVAAPI(std::vector<VkFrame>& input_frame
     throw std::runtime_error("failed to allocate VAAPI encoder");
   }
 
+  // The video processor converts the RGB input to P010 for the 10 bit profiles, VAAPI has no 10 bit
+  // H.264.
+  ten_bit = settings.m_use10bitEncoder and codec_id != ALVR_CODEC_H264;
   switch (codec_id)
   {
     case ALVR_CODEC_H264:
       encoder_ctx->profile = FF_PROFILE_H264_MAIN;
       AVUTIL.av_opt_set(encoder_ctx, "rc_mode", "2", 0); //CBR
+      if (settings.m_use10bitEncoder)
+        Info("VAAPI has no 10 bit H.264 profile, encoding 8 bit\n");
       break;
     case ALVR_CODEC_H265:
-      encoder_ctx->profile = FF_PROFILE_HEVC_MAIN;
+      encoder_ctx->profile = ten_bit ? FF_PROFILE_HEVC_MAIN_10 : FF_PROFILE_HEVC_MAIN;
+      AVUTIL.av_opt_set(encoder_ctx, "rc_mode", "2", 0);
+      break;
+    case ALVR_CODEC_AV1:
+      encoder_ctx->profile = FF_PROFILE_AV1_MAIN;
       AVUTIL.av_opt_set(encoder_ctx, "rc_mode", "2", 0);
       break;
   }
 
-  encoder_ctx->width = settings.m_renderWidth;
-  encoder_ctx->height = settings.m_renderHeight;
+  uint32_t width, height;
+  FrameRender::GetEncodingResolution(&width, &height);
+  encoder_ctx->width = width;
+  encoder_ctx->height = height;
   encoder_ctx->time_base = {1, (int)1e9};
-  encoder_ctx->framerate = AVRational{settings.m_refreshRate, 1};
   encoder_ctx->sample_aspect_ratio = AVRational{1, 1};
   encoder_ctx->pix_fmt = AV_PIX_FMT_VAAPI;
   encoder_ctx->max_b_frames = 0;
-  encoder_ctx->bit_rate = settings.mEncodeBitrateMBs * 1000 * 1000;
+  encoder_ctx->slices = settings.m_slicesPerFrame;
+  ApplyRate(rate);
+  active_rate = rate;
 
-  set_hwframe_ctx(encoder_ctx, hw_ctx);
+  if (hw_frames)
+    encoder_ctx->hw_frames_ctx = hw_frames;
+  else
+    set_hwframe_ctx(encoder_ctx, hw_ctx, ten_bit ? AV_PIX_FMT_P010 : AV_PIX_FMT_NV12);
 
-  err = AVCODEC.avcodec_open2(encoder_ctx, codec, NULL);
+  int err = AVCODEC.avcodec_open2(encoder_ctx, codec, NULL);
   if (err < 0) {
     throw alvr::AvException("Cannot open video encoder codec:", err);
   }
+}
 
-  mapped_frames = map_frames(hw_ctx, input_frames, vk_frame_ctx);
-
-  filter_graph = AVFILTER.avfilter_graph_alloc();
-
-  AVFilterInOut *outputs = AVFILTER.avfilter_inout_alloc();
-  AVFilterInOut *inputs = AVFILTER.avfilter_inout_alloc();
-
-  filter_in = AVFILTER.avfilter_graph_alloc_filter(filter_graph, AVFILTER.avfilter_get_by_name("buffer"), "in");
+void alvr::EncodePipelineVAAPI::Reconfigure(const EncoderRate &rate)
+{
+  std::lock_guard<std::mutex> lock(codec_mutex);
+  pending_rate = rate;
+  double change = std::abs((double)rate.bitrate - (double)active_rate.bitrate) / active_rate.bitrate;
+  // The VBV also follows the frame size cap of the network
+  double vbv_change = std::abs((double)rate.vbvSize - (double)active_rate.vbvSize) / active_rate.vbvSize;
+  rate_pending = change > REOPEN_THRESHOLD or vbv_change > REOPEN_THRESHOLD or rate.fps != active_rate.fps;
+}
 
-  AVBufferSrcParameters *par = AVFILTER.av_buffersrc_parameters_alloc();
-  memset(par, 0, sizeof(*par));
-  par->width = mapped_frames[0]->width;
-  par->height = mapped_frames[0]->height;
-  par->time_base = encoder_ctx->time_base;
-  par->format = mapped_frames[0]->format;
-  par->hw_frames_ctx = AVUTIL.av_buffer_ref(mapped_frames[0]->hw_frames_ctx);
-  AVFILTER.av_buffersrc_parameters_set(filter_in, par);
-  AVUTIL.av_free(par);
+void alvr::EncodePipelineVAAPI::PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr)
+{
+  assert(frame_index < input_surfaces.size());
 
-  if ((err = AVFILTER.avfilter_graph_create_filter(&filter_out, AVFILTER.avfilter_get_by_name("buffersink"), "out", NULL, NULL, filter_graph)))
+  auto now = std::chrono::steady_clock::now();
+  if (rate_pending and now - last_reopen >= REOPEN_INTERVAL)
   {
-    throw alvr::AvException("filter_out creation failed:", err);
+    // The frames given to the old encoder are still delivered by GetEncoded()
+    Drain();
+    AVBufferRef *hw_frames = AVUTIL.av_buffer_ref(encoder_ctx->hw_frames_ctx);
+    AVCODEC.avcodec_free_context(&encoder_ctx);
+    OpenEncoder(pending_rate, hw_frames);
+    rate_pending = false;
+    last_reopen = now;
+    idr = true;
   }
 
-  outputs->name = AVUTIL.av_strdup("in");
-  outputs->filter_ctx = filter_in;
-  outputs->pad_idx = 0;
-  outputs->next = NULL;
-
-  inputs->name = AVUTIL.av_strdup("out");
-  inputs->filter_ctx = filter_out;
-  inputs->pad_idx = 0;
-  inputs->next = NULL;
-
-  if ((err = AVFILTER.avfilter_graph_parse_ptr(filter_graph, "scale_vaapi=format=nv12", &inputs, &outputs, NULL)) < 0)
+  // The encoder may still hold the previous surface, take a new one from the pool
+  AVUTIL.av_frame_unref(encoder_frame);
+  int err = AVUTIL.av_hwframe_get_buffer(encoder_ctx->hw_frames_ctx, encoder_frame, 0);
+  if (err != 0)
   {
-    throw alvr::AvException("avfilter_graph_parse_ptr failed:", err);
+    throw alvr::AvException("av_hwframe_get_buffer failed", err);
   }
 
-  AVFILTER.avfilter_inout_free(&outputs);
-  AVFILTER.avfilter_inout_free(&inputs);
+  VkFrame &input_frame = input_frames[frame_index];
+  input_frame.wait_rendered();
 
-  for (unsigned i = 0 ; i < filter_graph->nb_filters; ++i)
-  {
-    filter_graph->filters[i]->hw_device_ctx = AVUTIL.av_buffer_ref(hw_ctx);
-  }
+  VAProcPipelineParameterBuffer params = {};
+  params.surface = input_surfaces[frame_index];
+  params.output_background_color = 0xff000000;
+  params.filter_flags = VA_FILTER_SCALING_DEFAULT;
 
-  if ((err = AVFILTER.avfilter_graph_config(filter_graph, NULL)))
+  VASurfaceID output_surface = (VASurfaceID)(uintptr_t)encoder_frame->data[3];
+  VABufferID params_buffer;
+  VAStatus status = vaCreateBuffer(va_display, vpp_context, VAProcPipelineParameterBufferType, sizeof(params), 1, &params, &params_buffer);
+  if (status != VA_STATUS_SUCCESS)
   {
-    throw alvr::AvException("avfilter_graph_config failed:", err);
+    throw std::runtime_error(std::string("vaCreateBuffer failed: ") + vaErrorStr(status));
   }
-}
-
-alvr::EncodePipelineVAAPI::~EncodePipelineVAAPI()
-{
-  AVFILTER.avfilter_graph_free(&filter_graph);
-  for (auto frame: mapped_frames)
+  if ((status = vaBeginPicture(va_display, vpp_context, output_surface)) == VA_STATUS_SUCCESS)
   {
-    AVUTIL.av_frame_free(&frame);
+    if ((status = vaRenderPicture(va_display, vpp_context, &params_buffer, 1)) == VA_STATUS_SUCCESS)
+      status = vaEndPicture(va_display, vpp_context);
+    else
+      vaEndPicture(va_display, vpp_context);
   }
-  AVUTIL.av_buffer_unref(&hw_ctx);
-}
-
-void alvr::EncodePipelineVAAPI::PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr)
-{
-  assert(frame_index < mapped_frames.size());
-  AVFrame *encoder_frame = AVUTIL.av_frame_alloc();
-  int err = AVFILTER.av_buffersrc_add_frame_flags(filter_in, mapped_frames[frame_index], AV_BUFFERSRC_FLAG_PUSH | AV_BUFFERSRC_FLAG_KEEP_REF);
-  if (err != 0)
+  vaDestroyBuffer(va_display, params_buffer);
+  if (status != VA_STATUS_SUCCESS)
   {
-    throw alvr::AvException("av_buffersrc_add_frame failed", err);
+    throw std::runtime_error(std::string("color conversion failed: ") + vaErrorStr(status));
   }
-  err = AVFILTER.av_buffersink_get_frame(filter_out, encoder_frame);
-  if (err != 0)
+  // The layer hands the image back to the application once it is released, the conversion must
+  // be done reading it
+  if (not input_frame.release_on_gpu())
   {
-    throw alvr::AvException("av_buffersink_get_frame failed", err);
+    vaSyncSurface(va_display, output_surface);
+    input_frame.signal_released();
   }
 
   encoder_frame->pict_type = idr ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
   encoder_frame->pts = targetTimestampNs;
+  // Sent as VAEncMiscParameterBufferROI when the driver supports it, the 8 bit profiles have a
+  // QP range of 51 and Main10 has 12 more. av1_vaapi scales the offsets to its 255 qindex range, so
+  // the offsets keep the strength they have with H.264 and HEVC.
+  if (FoveatedEncodingEnabled())
+    AddFoveationRegions(encoder_frame, encoder_ctx->profile == FF_PROFILE_HEVC_MAIN_10 ? 63 : 51);
 
   if ((err = AVCODEC.avcodec_send_frame(encoder_ctx, encoder_frame)) < 0) {
     throw alvr::AvException("avcodec_send_frame failed: ", err);
   }
-  AVUTIL.av_frame_unref(encoder_frame);
 }
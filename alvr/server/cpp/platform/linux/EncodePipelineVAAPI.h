@@ -2,10 +2,10 @@
 
 #include "EncodePipeline.h"
 
+#include <va/va.h>
+
 extern "C" struct AVBufferRef;
 extern "C" struct AVCodecContext;
-extern "C" struct AVFilterContext;
-extern "C" struct AVFilterGraph;
 extern "C" struct AVFrame;
 
 namespace alvr
@@ -18,12 +18,38 @@ public:
   EncodePipelineVAAPI(std::vector<VkFrame> &input_frames, VkFrameCtx& vk_frame_ctx);
 
   void PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr) override;
+  void Reconfigure(const EncoderRate &rate) override;
+  bool ReleaseInputFrames() override;
+  // input_frames is the vector of the constructor, refilled
+  void SetInputFrames(std::vector<VkFrame> &input_frames, VkFrameCtx &vk_frame_ctx) override;
 
 private:
+  // Creates and opens encoder_ctx, on a new frame pool if hw_frames is null
+  void OpenEncoder(const EncoderRate &rate, AVBufferRef *hw_frames);
+
+  // The VAAPI encoder of libavcodec sends its rate control parameters to the driver only once, a
+  // new rate needs a new encoder. It is reopened on the next frame, which becomes an IDR, when the
+  // bitrate moved by more than REOPEN_THRESHOLD, at most once per REOPEN_INTERVAL.
+  static constexpr double REOPEN_THRESHOLD = 0.1;
+  static constexpr std::chrono::seconds REOPEN_INTERVAL{1};
+  EncoderRate active_rate;
+  EncoderRate pending_rate;
+  bool rate_pending = false;
+  std::chrono::steady_clock::time_point last_reopen;
+
   AVBufferRef *hw_ctx = nullptr;
+  // Owned by CEncoder and refilled on swapchain recreation, synchronized with the layer on the CPU as VAAPI does not see the semaphores
+  std::vector<VkFrame> &input_frames;
   std::vector<AVFrame *> mapped_frames;
-  AVFilterGraph *filter_graph = nullptr;
-  AVFilterContext *filter_in = nullptr;
-  AVFilterContext *filter_out = nullptr;
+  // Conversion sources, either imported from the dma-bufs or taken from mapped_frames
+  std::vector<VASurfaceID> input_surfaces;
+  bool imported_surfaces = false;
+  AVFrame *encoder_frame = nullptr;
+  // The encoder frames are P010 instead of NV12
+  bool ten_bit = false;
+  // RGB to NV12 (P010) conversion, from the mapped frames into encoder_frame
+  VADisplay va_display = nullptr;
+  VAConfigID vpp_config = VA_INVALID_ID;
+  VAContextID vpp_context = VA_INVALID_ID;
 };
 }
@@ -0,0 +1,229 @@
+#include "EncodePipelineVulkan.h"
+#include "ALVR-common/packet_types.h"
+#include "FrameRender.h"
+#include "ffmpeg_helper.h"
+#include "alvr_server/Logger.h"
+#include "alvr_server/Settings.h"
+#include <chrono>
+#include <cmath>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/opt.h>
+}
+
+namespace
+{
+
+const char * encoder(ALVR_CODEC codec)
+{
+  switch (codec)
+  {
+    case ALVR_CODEC_H264:
+      // ffmpeg 7.1
+      return "h264_vulkan";
+    case ALVR_CODEC_H265:
+      return "hevc_vulkan";
+    case ALVR_CODEC_AV1:
+      // ffmpeg 8.0
+      return "av1_vulkan";
+  }
+  throw std::runtime_error("invalid codec " + std::to_string(codec));
+}
+
+}
+
+alvr::EncodePipelineVulkan::EncodePipelineVulkan(std::vector<VkFrame>& input_frames, VkFrameCtx& vk_frame_ctx)
+{
+  // libavcodec and scale_vulkan order their work with the timeline semaphores of the frames
+  if (not input_frames[0].has_timeline_semaphore())
+    throw std::runtime_error("Vulkan Video encoding needs timeline semaphores");
+  for (auto &input_frame: input_frames)
+    vk_frames.push_back(input_frame.make_av_frame(vk_frame_ctx));
+
+  if (Settings::Instance().m_use10bitEncoder)
+    Info("Vulkan: scale_vulkan has no 10 bit output, encoding 8 bit\n");
+
+  uint32_t width, height;
+  FrameRender::GetEncodingResolution(&width, &height);
+  CreateFilterGraph(vk_frame_ctx, width, height);
+  OpenEncoder(DefaultRate());
+  last_reopen = std::chrono::steady_clock::now();
+
+  encoder_frame = AVUTIL.av_frame_alloc();
+}
+
+alvr::EncodePipelineVulkan::~EncodePipelineVulkan()
+{
+  StopAsync();
+  AVUTIL.av_frame_free(&encoder_frame);
+  AVFILTER.avfilter_graph_free(&filter_graph);
+}
+
+void alvr::EncodePipelineVulkan::CreateFilterGraph(VkFrameCtx &vk_frame_ctx, uint32_t width, uint32_t height)
+{
+  filter_graph = AVFILTER.avfilter_graph_alloc();
+  if (not filter_graph)
+  {
+    throw std::runtime_error("failed to allocate the filter graph");
+  }
+
+  auto input_frame_ctx = (AVHWFramesContext *)vk_frame_ctx.ctx->data;
+  std::string source_args = "video_size=" + std::to_string(input_frame_ctx->width) + "x" + std::to_string(input_frame_ctx->height)
+    + ":pix_fmt=" + std::to_string(AV_PIX_FMT_VULKAN) + ":time_base=1/1000000000:pixel_aspect=1/1";
+  int err = AVFILTER.avfilter_graph_create_filter(&filter_in, AVFILTER.avfilter_get_by_name("buffer"), "in", source_args.c_str(), NULL, filter_graph);
+  if (err < 0)
+  {
+    throw alvr::AvException("failed to create the filter source:", err);
+  }
+  // The source takes its own reference
+  AVBufferSrcParameters *source_params = AVFILTER.av_buffersrc_parameters_alloc();
+  source_params->hw_frames_ctx = vk_frame_ctx.ctx;
+  err = AVFILTER.av_buffersrc_parameters_set(filter_in, source_params);
+  AVUTIL.av_free(source_params);
+  if (err < 0)
+  {
+    throw alvr::AvException("failed to set the filter source frames:", err);
+  }
+
+  err = AVFILTER.avfilter_graph_create_filter(&filter_out, AVFILTER.avfilter_get_by_name("buffersink"), "out", NULL, NULL, filter_graph);
+  if (err < 0)
+  {
+    throw alvr::AvException("failed to create the filter sink:", err);
+  }
+
+  AVFilterInOut *outputs = AVFILTER.avfilter_inout_alloc();
+  outputs->name = AVUTIL.av_strdup("in");
+  outputs->filter_ctx = filter_in;
+  outputs->pad_idx = 0;
+  outputs->next = NULL;
+  AVFilterInOut *inputs = AVFILTER.avfilter_inout_alloc();
+  inputs->name = AVUTIL.av_strdup("out");
+  inputs->filter_ctx = filter_out;
+  inputs->pad_idx = 0;
+  inputs->next = NULL;
+
+  // RGB to NV12, scaled to the encoding size if the input is not that size
+  std::string filters = "scale_vulkan=w=" + std::to_string(width) + ":h=" + std::to_string(height) + ":format=nv12";
+  err = AVFILTER.avfilter_graph_parse_ptr(filter_graph, filters.c_str(), &inputs, &outputs, NULL);
+  AVFILTER.avfilter_inout_free(&inputs);
+  AVFILTER.avfilter_inout_free(&outputs);
+  if (err < 0)
+  {
+    throw alvr::AvException("failed to parse " + filters + ":", err);
+  }
+  if ((err = AVFILTER.avfilter_graph_config(filter_graph, NULL)) < 0)
+  {
+    throw alvr::AvException("failed to configure the scale_vulkan filter:", err);
+  }
+}
+
+void alvr::EncodePipelineVulkan::OpenEncoder(const EncoderRate &rate)
+{
+  const auto& settings = Settings::Instance();
+
+  auto codec_id = ALVR_CODEC(settings.m_codec);
+  const char * encoder_name = encoder(codec_id);
+  const AVCodec *codec = AVCODEC.avcodec_find_encoder_by_name(encoder_name);
+  if (codec == nullptr)
+  {
+    throw std::runtime_error(std::string("Failed to find encoder ") + encoder_name);
+  }
+
+  encoder_ctx = AVCODEC.avcodec_alloc_context3(codec);
+  if (not encoder_ctx)
+  {
+    throw std::runtime_error("failed to allocate Vulkan encoder");
+  }
+
+  switch (codec_id)
+  {
+    case ALVR_CODEC_H264:
+      encoder_ctx->profile = FF_PROFILE_H264_MAIN;
+      break;
+    case ALVR_CODEC_H265:
+      encoder_ctx->profile = FF_PROFILE_HEVC_MAIN;
+      break;
+    case ALVR_CODEC_AV1:
+      encoder_ctx->profile = FF_PROFILE_AV1_MAIN;
+      break;
+  }
+  // Hints of VkVideoEncodeUsageInfoKHR, the drivers pick their low latency settings from them
+  AVUTIL.av_opt_set(encoder_ctx, "usage", "stream", AV_OPT_SEARCH_CHILDREN);
+  AVUTIL.av_opt_set(encoder_ctx, "content", "rendered", AV_OPT_SEARCH_CHILDREN);
+  AVUTIL.av_opt_set(encoder_ctx, "tune", "ull", AV_OPT_SEARCH_CHILDREN);
+  AVUTIL.av_opt_set(encoder_ctx, "rc_mode", "cbr", AV_OPT_SEARCH_CHILDREN);
+
+  uint32_t width, height;
+  FrameRender::GetEncodingResolution(&width, &height);
+  encoder_ctx->width = width;
+  encoder_ctx->height = height;
+  encoder_ctx->time_base = {1, (int)1e9};
+  encoder_ctx->sample_aspect_ratio = AVRational{1, 1};
+  encoder_ctx->pix_fmt = AV_PIX_FMT_VULKAN;
+  encoder_ctx->max_b_frames = 0;
+  encoder_ctx->slices = settings.m_slicesPerFrame;
+  ApplyRate(rate);
+  active_rate = rate;
+
+  // The frames of the scale_vulkan pool, on the device of the input frames
+  encoder_ctx->hw_frames_ctx = AVUTIL.av_buffer_ref(AVFILTER.av_buffersink_get_hw_frames_ctx(filter_out));
+
+  int err = AVCODEC.avcodec_open2(encoder_ctx, codec, NULL);
+  if (err < 0) {
+    throw alvr::AvException("Cannot open video encoder codec:", err);
+  }
+}
+
+void alvr::EncodePipelineVulkan::Reconfigure(const EncoderRate &rate)
+{
+  std::lock_guard<std::mutex> lock(codec_mutex);
+  pending_rate = rate;
+  double change = std::abs((double)rate.bitrate - (double)active_rate.bitrate) / active_rate.bitrate;
+  // The VBV also follows the frame size cap of the network
+  double vbv_change = std::abs((double)rate.vbvSize - (double)active_rate.vbvSize) / active_rate.vbvSize;
+  rate_pending = change > REOPEN_THRESHOLD or vbv_change > REOPEN_THRESHOLD or rate.fps != active_rate.fps;
+}
+
+void alvr::EncodePipelineVulkan::PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr)
+{
+  assert(frame_index < vk_frames.size());
+
+  auto now = std::chrono::steady_clock::now();
+  if (rate_pending and now - last_reopen >= REOPEN_INTERVAL)
+  {
+    // The frames given to the old encoder are still delivered by GetEncoded()
+    Drain();
+    AVCODEC.avcodec_free_context(&encoder_ctx);
+    OpenEncoder(pending_rate);
+    rate_pending = false;
+    last_reopen = now;
+    idr = true;
+  }
+
+  // scale_vulkan waits for the present on the GPU and signals the next value of the semaphore
+  // once it has read the frame, which releases it to the layer
+  AVFrame *input_frame = vk_frames[frame_index].get();
+  input_frame->pts = targetTimestampNs;
+  int err = AVFILTER.av_buffersrc_add_frame_flags(filter_in, input_frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+  if (err < 0)
+  {
+    throw alvr::AvException("av_buffersrc_add_frame_flags failed:", err);
+  }
+  // The encoder may still hold the previous frame, its reference is its own
+  AVUTIL.av_frame_unref(encoder_frame);
+  if ((err = AVFILTER.av_buffersink_get_frame(filter_out, encoder_frame)) < 0)
+  {
+    throw alvr::AvException("av_buffersink_get_frame failed:", err);
+  }
+
+  encoder_frame->pict_type = idr ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+  encoder_frame->pts = targetTimestampNs;
+
+  if ((err = AVCODEC.avcodec_send_frame(encoder_ctx, encoder_frame)) < 0) {
+    throw alvr::AvException("avcodec_send_frame failed: ", err);
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <functional>
+#include "EncodePipeline.h"
+
+extern "C" struct AVBufferRef;
+extern "C" struct AVCodecContext;
+extern "C" struct AVFilterContext;
+extern "C" struct AVFilterGraph;
+extern "C" struct AVFrame;
+
+namespace alvr
+{
+
+// Vulkan Video encoding (VK_KHR_video_encode_h264/h265/av1) on the device of the input frames,
+// through the Vulkan encoders of libavcodec. A scale_vulkan filter converts the input frames to
+// NV12 frames the encoder takes directly, conversion and encode are ordered by the timeline
+// semaphores of the frames and never leave Vulkan. The filter graph is bound to the frame context
+// of the input frames, so a swapchain recreation recreates the pipeline.
+class EncodePipelineVulkan: public EncodePipeline
+{
+public:
+  ~EncodePipelineVulkan();
+  EncodePipelineVulkan(std::vector<VkFrame> &input_frames, VkFrameCtx& vk_frame_ctx);
+
+  void PushFrame(uint32_t frame_index, uint64_t targetTimestampNs, bool idr) override;
+  void Reconfigure(const EncoderRate &rate) override;
+
+private:
+  void CreateFilterGraph(VkFrameCtx &vk_frame_ctx, uint32_t width, uint32_t height);
+  // Creates and opens encoder_ctx on the frames of the filter graph
+  void OpenEncoder(const EncoderRate &rate);
+
+  // The rate control parameters go to the session once, like with VAAPI a new rate needs a new
+  // encoder. It is reopened on the next frame, which becomes an IDR, when the bitrate moved by
+  // more than REOPEN_THRESHOLD, at most once per REOPEN_INTERVAL.
+  static constexpr double REOPEN_THRESHOLD = 0.1;
+  static constexpr std::chrono::seconds REOPEN_INTERVAL{1};
+  EncoderRate active_rate;
+  EncoderRate pending_rate;
+  bool rate_pending = false;
+  std::chrono::steady_clock::time_point last_reopen;
+
+  std::vector<std::unique_ptr<AVFrame, std::function<void(AVFrame*)>>> vk_frames;
+  AVFilterGraph *filter_graph = nullptr;
+  AVFilterContext *filter_in = nullptr;
+  AVFilterContext *filter_out = nullptr;
+  AVFrame *encoder_frame = nullptr;
+};
+}
@@ -0,0 +1,475 @@
+#include "FrameRender.h"
+
+#include <cstring>
+#include <unistd.h>
+
+#include "alvr_server/Logger.h"
+#include "alvr_server/Settings.h"
+#include "alvr_server/bindings.h"
+#include "ffmpeg_helper.h"
+
+namespace
+{
+
+// Storage images of this format are supported everywhere, and every encode pipeline takes it
+constexpr vk::Format OUTPUT_FORMAT = vk::Format::eR8G8B8A8Unorm;
+constexpr vk::ImageUsageFlags OUTPUT_USAGE = vk::ImageUsageFlagBits::eStorage
+  | vk::ImageUsageFlagBits::eSampled
+  | vk::ImageUsageFlagBits::eTransferSrc;
+constexpr vk::FormatFeatureFlags OUTPUT_FEATURES = vk::FormatFeatureFlagBits::eStorageImage
+  | vk::FormatFeatureFlagBits::eSampledImage
+  | vk::FormatFeatureFlagBits::eTransferSrc;
+constexpr uint32_t WORKGROUP_SIZE = 8;
+
+const vk::ImageSubresourceRange COLOR_RANGE{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+
+bool is_srgb(vk::Format format)
+{
+  return format == vk::Format::eB8G8R8A8Srgb or format == vk::Format::eR8G8B8A8Srgb;
+}
+
+uint32_t find_memory_type(vk::PhysicalDevice physical_device, uint32_t type_bits)
+{
+  auto props = physical_device.getMemoryProperties();
+  for (uint32_t i = 0; i < props.memoryTypeCount; ++i)
+  {
+    if ((type_bits & (1 << i)) and (props.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal))
+      return i;
+  }
+  throw std::runtime_error("no device local memory for the encoder frames");
+}
+
+}
+
+bool alvr::FrameRender::Enabled()
+{
+  const auto &settings = Settings::Instance();
+  return settings.m_enableFoveatedRendering or settings.m_enableColorCorrection or settings.m_enableDynamicResolution;
+}
+
+void alvr::FrameRender::GetEncodingResolution(uint32_t *width, uint32_t *height)
+{
+  if (Settings::Instance().m_enableFoveatedRendering)
+  {
+    auto foveation = CalculateFoveationVars();
+    *width = foveation.optimizedEyeWidth * 2;
+    *height = foveation.optimizedEyeHeight;
+  }
+  else
+  {
+    *width = Settings::Instance().m_renderWidth;
+    *height = Settings::Instance().m_renderHeight;
+  }
+}
+
+alvr::FrameRender::FrameRender(VkContext &vk_ctx, std::vector<VkFrame> &input_frames):
+  vk_ctx(vk_ctx),
+  device(vk_ctx.get_vk_device()),
+  queue(vk_ctx.get_vk_queue())
+{
+  GetEncodingResolution(&width, &height);
+
+  const auto &settings = Settings::Instance();
+  params.foveation = CalculateFoveationVars();
+  params.enableFoveation = settings.m_enableFoveatedRendering;
+  params.enableColorCorrection = settings.m_enableColorCorrection;
+  SetColorCorrection();
+  params.contentScale = 1.f;
+
+  CreatePipeline();
+  // One frame being rendered, the others waiting for or read by the encoder
+  CreateOutputFrames(settings.m_encodePipelineDepth + 2);
+  SetInputFrames(input_frames);
+
+  Info("FrameRender: %ux%u to %ux%u, foveation %d, color correction %d\n",
+      input_frames[0].get_width(), input_frames[0].get_height(), width, height,
+      params.enableFoveation, params.enableColorCorrection);
+}
+
+void alvr::FrameRender::SetColorCorrection()
+{
+  // The revision first, a later update is picked up by the next frame
+  live_revision = Settings::Instance().m_liveRevision.load(std::memory_order_acquire);
+  const LiveSettings live = Settings::Instance().GetLive();
+  params.brightness = live.m_brightness;
+  params.contrast = live.m_contrast + 1.f;
+  params.saturation = live.m_saturation + 1.f;
+  params.gamma = live.m_gamma;
+  params.sharpening = live.m_sharpening;
+}
+
+alvr::FrameRender::~FrameRender()
+{
+  WaitIdle();
+  ReleaseInputFrames();
+  for (auto &slot: slots)
+  {
+    device.destroyFence(slot.fence);
+    device.destroyImageView(slot.view);
+  }
+  device.destroyCommandPool(command_pool);
+  device.destroyDescriptorPool(output_descriptor_pool);
+  device.destroyPipeline(pipeline);
+  device.destroyShaderModule(shader);
+  device.destroyPipelineLayout(pipeline_layout);
+  device.destroyDescriptorSetLayout(output_set_layout);
+  device.destroyDescriptorSetLayout(input_set_layout);
+  device.destroySampler(sampler);
+}
+
+void alvr::FrameRender::CreatePipeline()
+{
+  vk::SamplerCreateInfo sampler_info;
+  sampler_info.magFilter = vk::Filter::eLinear;
+  sampler_info.minFilter = vk::Filter::eLinear;
+  sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  sampler = device.createSampler(sampler_info);
+
+  vk::DescriptorSetLayoutBinding input_binding;
+  input_binding.binding = 0;
+  input_binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  input_binding.descriptorCount = 1;
+  input_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  input_binding.pImmutableSamplers = &sampler;
+  input_set_layout = device.createDescriptorSetLayout({{}, 1, &input_binding});
+
+  vk::DescriptorSetLayoutBinding output_binding;
+  output_binding.binding = 0;
+  output_binding.descriptorType = vk::DescriptorType::eStorageImage;
+  output_binding.descriptorCount = 1;
+  output_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  output_set_layout = device.createDescriptorSetLayout({{}, 1, &output_binding});
+
+  vk::DescriptorSetLayout set_layouts[] = {input_set_layout, output_set_layout};
+  vk::PushConstantRange push_constants{vk::ShaderStageFlagBits::eCompute, 0, sizeof(Params)};
+  pipeline_layout = device.createPipelineLayout({{}, 2, set_layouts, 1, &push_constants});
+
+  // The embedded bytes are not guaranteed to be aligned for the module
+  std::vector<uint32_t> code((FRAME_RENDER_COMP_SPV_LEN + 3) / 4);
+  memcpy(code.data(), FRAME_RENDER_COMP_SPV_PTR, FRAME_RENDER_COMP_SPV_LEN);
+  shader = device.createShaderModule({{}, FRAME_RENDER_COMP_SPV_LEN, code.data()});
+
+  vk::ComputePipelineCreateInfo pipeline_info;
+  pipeline_info.stage = vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eCompute, shader, "main"};
+  pipeline_info.layout = pipeline_layout;
+  auto result = device.createComputePipeline(nullptr, pipeline_info);
+  if (result.result != vk::Result::eSuccess)
+    throw std::runtime_error("failed to create the FrameRender pipeline: " + vk::to_string(result.result));
+  pipeline = result.value;
+
+  command_pool = device.createCommandPool({vk::CommandPoolCreateFlagBits::eResetCommandBuffer, vk_ctx.get_vk_queue_family()});
+}
+
+std::vector<uint64_t> alvr::FrameRender::FindDrmModifiers(const vk::ImageCreateInfo &image_info)
+{
+  if (not vk_ctx.has_device_extension(VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME) or
+      not vk_ctx.has_device_extension(VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME))
+    return {};
+
+  auto physical_device = vk_ctx.get_vk_phys_device();
+  vk::DrmFormatModifierPropertiesListEXT modifier_list;
+  vk::FormatProperties2 format_props;
+  format_props.pNext = &modifier_list;
+  physical_device.getFormatProperties2(image_info.format, &format_props);
+  std::vector<vk::DrmFormatModifierPropertiesEXT> modifier_props(modifier_list.drmFormatModifierCount);
+  modifier_list.pDrmFormatModifierProperties = modifier_props.data();
+  physical_device.getFormatProperties2(image_info.format, &format_props);
+
+  // Same selection as the layer for the swapchain images: VAAPI imports a single plane
+  std::vector<uint64_t> modifiers;
+  for (const auto &props: modifier_props)
+  {
+    if (props.drmFormatModifierPlaneCount != 1 or
+        (props.drmFormatModifierTilingFeatures & OUTPUT_FEATURES) != OUTPUT_FEATURES)
+      continue;
+
+    vk::PhysicalDeviceImageDrmFormatModifierInfoEXT modifier_info;
+    modifier_info.drmFormatModifier = props.drmFormatModifier;
+    modifier_info.sharingMode = vk::SharingMode::eExclusive;
+    vk::PhysicalDeviceExternalImageFormatInfo external_info;
+    external_info.pNext = &modifier_info;
+    external_info.handleType = vk::ExternalMemoryHandleTypeFlagBits::eDmaBufEXT;
+    vk::PhysicalDeviceImageFormatInfo2 format_info;
+    format_info.pNext = &external_info;
+    format_info.format = image_info.format;
+    format_info.type = image_info.imageType;
+    format_info.tiling = vk::ImageTiling::eDrmFormatModifierEXT;
+    format_info.usage = image_info.usage;
+
+    vk::ExternalImageFormatProperties external_props;
+    vk::ImageFormatProperties2 image_props;
+    image_props.pNext = &external_props;
+    if (physical_device.getImageFormatProperties2(&format_info, &image_props) != vk::Result::eSuccess)
+      continue;
+    if (not (external_props.externalMemoryProperties.externalMemoryFeatures & vk::ExternalMemoryFeatureFlagBits::eExportable))
+      continue;
+    modifiers.push_back(props.drmFormatModifier);
+  }
+  return modifiers;
+}
+
+void alvr::FrameRender::CreateOutputFrames(uint32_t count)
+{
+  vk::ImageCreateInfo image_info;
+  image_info.imageType = vk::ImageType::e2D;
+  image_info.format = OUTPUT_FORMAT;
+  image_info.extent = vk::Extent3D{width, height, 1};
+  image_info.mipLevels = 1;
+  image_info.arrayLayers = 1;
+  image_info.samples = vk::SampleCountFlagBits::e1;
+  image_info.tiling = vk::ImageTiling::eOptimal;
+  image_info.usage = OUTPUT_USAGE;
+  image_info.sharingMode = vk::SharingMode::eExclusive;
+  image_info.initialLayout = vk::ImageLayout::eUndefined;
+
+  // The frames are exported and imported again as VkFrame, the encode pipelines then see them
+  // like the swapchain images, dma-buf included.
+  std::vector<uint64_t> modifiers = FindDrmModifiers(image_info);
+  const bool dma_buf = not modifiers.empty();
+  const auto handle_type = dma_buf ? vk::ExternalMemoryHandleTypeFlagBits::eDmaBufEXT : vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
+  Debug("FrameRender: %s output frames\n", dma_buf ? "dma-buf" : "opaque fd");
+
+  vk::ImageDrmFormatModifierListCreateInfoEXT modifier_info;
+  modifier_info.drmFormatModifierCount = modifiers.size();
+  modifier_info.pDrmFormatModifiers = modifiers.data();
+  vk::ExternalMemoryImageCreateInfo ext_info;
+  ext_info.handleTypes = handle_type;
+  if (dma_buf)
+    ext_info.pNext = &modifier_info;
+  vk::ImageCreateInfo export_info = image_info;
+  export_info.pNext = &ext_info;
+  if (dma_buf)
+    export_info.tiling = vk::ImageTiling::eDrmFormatModifierEXT;
+
+  output_frame_ctx = std::make_unique<VkFrameCtx>(vk_ctx, image_info);
+  output_frames.reserve(count);
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    vk::Image image = device.createImage(export_info);
+    auto req = device.getImageMemoryRequirements(image);
+    uint32_t memory_index = find_memory_type(vk_ctx.get_vk_phys_device(), req.memoryTypeBits);
+
+    vk::ExportMemoryAllocateInfo export_memory;
+    export_memory.handleTypes = handle_type;
+    vk::MemoryDedicatedAllocateInfo dedicated;
+    dedicated.pNext = &export_memory;
+    dedicated.image = image;
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.pNext = &dedicated;
+    alloc_info.allocationSize = req.size;
+    alloc_info.memoryTypeIndex = memory_index;
+    vk::DeviceMemory memory = device.allocateMemory(alloc_info);
+    device.bindImageMemory(image, memory, 0);
+
+    DrmImageLayout drm_layout = {};
+    if (dma_buf)
+    {
+      vk::ImageDrmFormatModifierPropertiesEXT modifier_props;
+      if (vk_ctx.d.vkGetImageDrmFormatModifierPropertiesEXT(device, image, reinterpret_cast<VkImageDrmFormatModifierPropertiesEXT *>(&modifier_props)) != VK_SUCCESS)
+        throw std::runtime_error("failed to query the DRM format modifier of the encoder frames");
+      auto plane_layout = device.getImageSubresourceLayout(image, {vk::ImageAspectFlagBits::eMemoryPlane0EXT, 0, 0});
+      drm_layout = {modifier_props.drmFormatModifier, plane_layout.offset, plane_layout.rowPitch};
+    }
+    int image_fd = device.getMemoryFdKHR({memory, handle_type}, vk_ctx.d);
+
+    vk::SemaphoreTypeCreateInfo semaphore_type;
+    semaphore_type.semaphoreType = vk::SemaphoreType::eTimeline;
+    vk::ExportSemaphoreCreateInfo export_semaphore;
+    export_semaphore.pNext = &semaphore_type;
+    export_semaphore.handleTypes = vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueFd;
+    vk::SemaphoreCreateInfo semaphore_info;
+    semaphore_info.pNext = &export_semaphore;
+    vk::Semaphore semaphore = device.createSemaphore(semaphore_info);
+    int semaphore_fd = device.getSemaphoreFdKHR({semaphore, vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueFd}, vk_ctx.d);
+
+    // The imported handles keep the payloads alive
+    output_frames.emplace_back(vk_ctx, image_info, memory_index, image_fd, semaphore_fd, true, dma_buf ? &drm_layout : nullptr);
+    device.destroySemaphore(semaphore);
+    device.destroyImage(image);
+    device.freeMemory(memory);
+  }
+
+  vk::DescriptorPoolSize pool_size{vk::DescriptorType::eStorageImage, count};
+  output_descriptor_pool = device.createDescriptorPool({{}, count, 1, &pool_size});
+  std::vector<vk::DescriptorSetLayout> set_layouts(count, output_set_layout);
+  auto descriptor_sets = device.allocateDescriptorSets({output_descriptor_pool, count, set_layouts.data()});
+  auto command_buffers = device.allocateCommandBuffers({command_pool, vk::CommandBufferLevel::ePrimary, count});
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    Slot slot;
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = ((AVVkFrame *)output_frames[i])->img[0];
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = OUTPUT_FORMAT;
+    view_info.subresourceRange = COLOR_RANGE;
+    slot.view = device.createImageView(view_info);
+    slot.descriptor_set = descriptor_sets[i];
+    slot.command_buffer = command_buffers[i];
+    slot.fence = device.createFence({vk::FenceCreateFlagBits::eSignaled});
+
+    vk::DescriptorImageInfo image_desc{nullptr, slot.view, vk::ImageLayout::eGeneral};
+    vk::WriteDescriptorSet write;
+    write.dstSet = slot.descriptor_set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eStorageImage;
+    write.pImageInfo = &image_desc;
+    device.updateDescriptorSets(write, {});
+    slots.push_back(slot);
+  }
+}
+
+void alvr::FrameRender::WaitIdle()
+{
+  std::vector<vk::Fence> fences;
+  for (auto &slot: slots)
+    fences.push_back(slot.fence);
+  if (not fences.empty() and device.waitForFences(fences, true, UINT64_MAX) != vk::Result::eSuccess)
+    throw std::runtime_error("failed to wait for FrameRender");
+}
+
+void alvr::FrameRender::ReleaseInputFrames()
+{
+  // The renders submitted so far read the images that are about to go
+  WaitIdle();
+  if (input_descriptor_pool)
+    device.destroyDescriptorPool(input_descriptor_pool);
+  input_descriptor_pool = nullptr;
+  input_descriptor_sets.clear();
+  for (auto view: input_views)
+    device.destroyImageView(view);
+  input_views.clear();
+  input_frames = nullptr;
+}
+
+void alvr::FrameRender::SetInputFrames(std::vector<VkFrame> &frames)
+{
+  input_frames = &frames;
+  uint32_t count = frames.size();
+  params.inputSize[0] = frames[0].get_width();
+  params.inputSize[1] = frames[0].get_height();
+  params.srgbInput = is_srgb(frames[0].get_format());
+
+  vk::DescriptorPoolSize pool_size{vk::DescriptorType::eCombinedImageSampler, count};
+  input_descriptor_pool = device.createDescriptorPool({{}, count, 1, &pool_size});
+  std::vector<vk::DescriptorSetLayout> set_layouts(count, input_set_layout);
+  input_descriptor_sets = device.allocateDescriptorSets({input_descriptor_pool, count, set_layouts.data()});
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = ((AVVkFrame *)frames[i])->img[0];
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = frames[i].get_format();
+    view_info.subresourceRange = COLOR_RANGE;
+    input_views.push_back(device.createImageView(view_info));
+
+    vk::DescriptorImageInfo image_desc{nullptr, input_views[i], vk::ImageLayout::eShaderReadOnlyOptimal};
+    vk::WriteDescriptorSet write;
+    write.dstSet = input_descriptor_sets[i];
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    write.pImageInfo = &image_desc;
+    device.updateDescriptorSets(write, {});
+  }
+}
+
+uint32_t alvr::FrameRender::Render(uint32_t input_index, float content_scale, const FoveationCenter &center)
+{
+  uint32_t output_index = next_slot;
+  next_slot = (next_slot + 1) % slots.size();
+  Slot &slot = slots[output_index];
+  VkFrame &input_frame = (*input_frames)[input_index];
+  VkFrame &output_frame = output_frames[output_index];
+  AVVkFrame *input = input_frame;
+  AVVkFrame *output = output_frame;
+
+  // Only waits when the GPU is a whole pool behind
+  if (device.waitForFences(slot.fence, true, UINT64_MAX) != vk::Result::eSuccess)
+    throw std::runtime_error("failed to wait for FrameRender");
+  device.resetFences(slot.fence);
+
+  auto &cmd = slot.command_buffer;
+  cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  vk::ImageMemoryBarrier barriers[2];
+  barriers[0].srcAccessMask = vk::AccessFlags(input->access[0]);
+  barriers[0].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  barriers[0].oldLayout = vk::ImageLayout(input->layout[0]);
+  barriers[0].newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].image = input->img[0];
+  barriers[0].subresourceRange = COLOR_RANGE;
+  // Overwritten entirely
+  barriers[1].dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barriers[1].oldLayout = vk::ImageLayout::eUndefined;
+  barriers[1].newLayout = vk::ImageLayout::eGeneral;
+  barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].image = output->img[0];
+  barriers[1].subresourceRange = COLOR_RANGE;
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0, nullptr, 2, barriers);
+
+  if (live_revision != Settings::Instance().m_liveRevision.load(std::memory_order_acquire))
+  {
+    SetColorCorrection();
+  }
+  params.contentScale = content_scale;
+  memcpy(params.centerShifts, center.left, sizeof(center.left));
+  memcpy(params.centerShifts + 2, center.right, sizeof(center.right));
+  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  vk::DescriptorSet sets[] = {input_descriptor_sets[input_index], slot.descriptor_set};
+  cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, 2, sets, 0, nullptr);
+  cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+  cmd.dispatch((width + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, (height + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+  cmd.end();
+
+  input->layout[0] = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  input->access[0] = VK_ACCESS_SHADER_READ_BIT;
+  output->layout[0] = VK_IMAGE_LAYOUT_GENERAL;
+  output->access[0] = VK_ACCESS_SHADER_WRITE_BIT;
+
+  // The output semaphore is at its released value once the encoder is done with the frame, the
+  // input one at the value of the present. A binary input semaphore is waited and signaled again,
+  // as libavutil does, its values are ignored.
+  vk::Semaphore semaphores[] = {output->sem[0], input->sem[0]};
+  uint64_t wait_values[] = {output->sem_value[0], input->sem_value[0]};
+  uint64_t signal_values[] = {output->sem_value[0] + 1, input->sem_value[0] + 1};
+  vk::PipelineStageFlags wait_stages[] = {vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader};
+
+  vk::TimelineSemaphoreSubmitInfo timeline_info;
+  timeline_info.waitSemaphoreValueCount = 2;
+  timeline_info.pWaitSemaphoreValues = wait_values;
+  timeline_info.signalSemaphoreValueCount = 2;
+  timeline_info.pSignalSemaphoreValues = signal_values;
+  vk::SubmitInfo submit;
+  submit.pNext = &timeline_info;
+  submit.waitSemaphoreCount = 2;
+  submit.pWaitSemaphores = semaphores;
+  submit.pWaitDstStageMask = wait_stages;
+  submit.commandBufferCount = 1;
+  submit.pCommandBuffers = &cmd;
+  submit.signalSemaphoreCount = 2;
+  submit.pSignalSemaphores = semaphores;
+  queue.submit(submit, slot.fence);
+
+  output_frame.set_semaphore_value(output->sem_value[0] + 1);
+  if (input_frame.has_timeline_semaphore())
+  {
+    input_frame.set_semaphore_value(input->sem_value[0] + 1);
+  }
+  else if (device.waitForFences(slot.fence, true, UINT64_MAX) != vk::Result::eSuccess)
+  {
+    // Without a semaphore to release it, the image must have been read once the next present
+    // can come
+    throw std::runtime_error("failed to wait for FrameRender");
+  }
+
+  return output_index;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "alvr_server/FoveationVars.h"
+
+namespace alvr
+{
+
+class VkContext;
+class VkFrame;
+class VkFrameCtx;
+
+// Foveated compression and color correction ahead of the encoder, the Vulkan compute counterpart
+// of the win32 FrameRender. Every present is rendered into one of a pool of encoder sized frames,
+// which the encode pipeline takes in place of the swapchain images.
+class FrameRender
+{
+public:
+  FrameRender(VkContext &vk_ctx, std::vector<VkFrame> &input_frames);
+  ~FrameRender();
+
+  // Whether the settings need the pass, the swapchain images are encoded as they are otherwise
+  static bool Enabled();
+  // Size of the encoded frames, reduced by the foveated compression
+  static void GetEncodingResolution(uint32_t *width, uint32_t *height);
+
+  // Swapchain recreation with images of the same size and format. The output frames stay the
+  // same, so does the encode pipeline that reads them.
+  void ReleaseInputFrames();
+  void SetInputFrames(std::vector<VkFrame> &input_frames);
+
+  std::vector<VkFrame> &GetOutputFrames() { return output_frames; }
+  VkFrameCtx &GetOutputFrameCtx() { return *output_frame_ctx; }
+
+  // Renders an input frame into the next output frame and returns the index of the latter. With
+  // timeline semaphores nothing waits on the CPU: the input frame is released to the layer once
+  // read, like a libavutil transfer does, and the encoder waits for the output frame on the GPU.
+  // content_scale is the dynamic resolution scale of the frame, see ResolutionController, and
+  // center its foveation center, see FoveationController.
+  uint32_t Render(uint32_t input_index, float content_scale = 1.f,
+                  const FoveationCenter &center = StaticFoveationCenter());
+
+private:
+  // Push constants of FrameRender.comp
+  struct Params
+  {
+    FoveationVars foveation;
+    float inputSize[2];
+    uint32_t enableFoveation;
+    uint32_t enableColorCorrection;
+    uint32_t srgbInput;
+    float brightness;
+    float contrast;
+    float saturation;
+    float gamma;
+    float sharpening;
+    float contentScale;
+    float _align;
+    float centerShifts[4];
+  };
+
+  // An output frame and the commands that render into it
+  struct Slot
+  {
+    vk::ImageView view;
+    vk::DescriptorSet descriptor_set;
+    vk::CommandBuffer command_buffer;
+    vk::Fence fence;
+  };
+
+  // From the settings, again after each live update. The push constants take it at the next frame.
+  void SetColorCorrection();
+  void CreatePipeline();
+  void CreateOutputFrames(uint32_t count);
+  // Exportable memory, as a dma-buf when VAAPI can import it
+  std::vector<uint64_t> FindDrmModifiers(const vk::ImageCreateInfo &image_info);
+  void WaitIdle();
+
+  VkContext &vk_ctx;
+  vk::Device device;
+  vk::Queue queue;
+  uint32_t width;
+  uint32_t height;
+  Params params = {};
+  // Settings::m_liveRevision of the color correction parameters
+  uint32_t live_revision = 0;
+
+  vk::Sampler sampler;
+  vk::DescriptorSetLayout input_set_layout;
+  vk::DescriptorSetLayout output_set_layout;
+  vk::DescriptorPool output_descriptor_pool;
+  vk::PipelineLayout pipeline_layout;
+  vk::ShaderModule shader;
+  vk::Pipeline pipeline;
+  vk::CommandPool command_pool;
+
+  std::vector<VkFrame> *input_frames = nullptr;
+  std::vector<vk::ImageView> input_views;
+  std::vector<vk::DescriptorSet> input_descriptor_sets;
+  vk::DescriptorPool input_descriptor_pool;
+
+  std::vector<VkFrame> output_frames;
+  std::unique_ptr<VkFrameCtx> output_frame_ctx;
+  std::vector<Slot> slots;
+  uint32_t next_slot = 0;
+};
+
+}
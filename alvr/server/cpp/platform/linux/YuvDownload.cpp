@@ -0,0 +1,338 @@
+#include "YuvDownload.h"
+
+#include <cstring>
+
+#include "alvr_server/Logger.h"
+#include "alvr_server/bindings.h"
+#include "ffmpeg_helper.h"
+
+namespace
+{
+
+// Pixels converted by an invocation of RgbToYuv.comp, and invocations per workgroup along each axis
+constexpr uint32_t BLOCK_WIDTH = 8;
+constexpr uint32_t WORKGROUP_SIZE = 8;
+// Row alignment of the luma plane in pixels, the chroma rows get half of it
+constexpr uint32_t STRIDE_ALIGNMENT = 64;
+
+const vk::ImageSubresourceRange COLOR_RANGE{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+
+bool is_srgb(vk::Format format)
+{
+  return format == vk::Format::eB8G8R8A8Srgb or format == vk::Format::eR8G8B8A8Srgb;
+}
+
+uint32_t align(uint32_t value, uint32_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Cached memory if there is some, the CPU reads every byte of it
+uint32_t find_memory_type(vk::PhysicalDevice physical_device, uint32_t type_bits, bool *coherent)
+{
+  auto props = physical_device.getMemoryProperties();
+  for (auto wanted: {vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCached,
+      vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eHostVisible)})
+  {
+    for (uint32_t i = 0; i < props.memoryTypeCount; ++i)
+    {
+      auto flags = props.memoryTypes[i].propertyFlags;
+      if ((type_bits & (1 << i)) and (flags & wanted) == wanted)
+      {
+        *coherent = bool(flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+        return i;
+      }
+    }
+  }
+  throw std::runtime_error("no host visible memory for the YUV download");
+}
+
+}
+
+alvr::YuvDownload::YuvDownload(VkFrameCtx &vk_frame_ctx, std::vector<VkFrame> &input_frames,
+    uint32_t width, uint32_t height, bool ten_bit, uint32_t buffer_count):
+  width(width),
+  height(height),
+  slots(buffer_count)
+{
+  // The device of the frames, the software pipeline has no VkContext
+  auto frames_ctx = (AVHWFramesContext *)vk_frame_ctx.ctx->data;
+  auto vk_device_ctx = (AVVulkanDeviceContext *)frames_ctx->device_ctx->hwctx;
+  device = vk_device_ctx->act_dev;
+  queue = device.getQueue(vk_device_ctx->queue_family_index, 0);
+
+  uint32_t bytes_per_sample = ten_bit ? 2 : 1;
+  uint32_t luma_stride = align(width, STRIDE_ALIGNMENT) * bytes_per_sample;
+  uint32_t chroma_stride = luma_stride / 2;
+  chroma_rows = (height + 1) / 2;
+  luma_size = luma_stride * chroma_rows * 2;
+  chroma_size = chroma_stride * chroma_rows;
+
+  params.frameSize[0] = width;
+  params.frameSize[1] = height;
+  params.lumaStride = luma_stride / 4;
+  params.chromaStride = chroma_stride / 4;
+  params.uOffset = luma_size / 4;
+  params.vOffset = (luma_size + chroma_size) / 4;
+  params.tenBit = ten_bit;
+
+  CreatePipeline(vk_device_ctx->queue_family_index);
+  CreateBuffers(vk_device_ctx->phys_dev);
+  SetInputFrames(input_frames);
+
+  Info("YuvDownload: %ux%u to %ux%u %s, %zu buffers of %u bytes\n",
+      input_frames[0].get_width(), input_frames[0].get_height(), width, height,
+      ten_bit ? "yuv420p10le" : "yuv420p", slots.size(), luma_size + 2 * chroma_size);
+}
+
+alvr::YuvDownload::~YuvDownload()
+{
+  ReleaseInputFrames();
+  for (auto &slot: slots)
+  {
+    device.destroyFence(slot.fence);
+    device.unmapMemory(slot.memory);
+    device.destroyBuffer(slot.buffer);
+    device.freeMemory(slot.memory);
+  }
+  device.destroyCommandPool(command_pool);
+  device.destroyDescriptorPool(output_descriptor_pool);
+  device.destroyPipeline(pipeline);
+  device.destroyShaderModule(shader);
+  device.destroyPipelineLayout(pipeline_layout);
+  device.destroyDescriptorSetLayout(output_set_layout);
+  device.destroyDescriptorSetLayout(input_set_layout);
+  device.destroySampler(sampler);
+}
+
+void alvr::YuvDownload::CreatePipeline(uint32_t queue_family)
+{
+  vk::SamplerCreateInfo sampler_info;
+  sampler_info.magFilter = vk::Filter::eLinear;
+  sampler_info.minFilter = vk::Filter::eLinear;
+  sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  sampler = device.createSampler(sampler_info);
+
+  vk::DescriptorSetLayoutBinding input_binding;
+  input_binding.binding = 0;
+  input_binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  input_binding.descriptorCount = 1;
+  input_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  input_binding.pImmutableSamplers = &sampler;
+  input_set_layout = device.createDescriptorSetLayout({{}, 1, &input_binding});
+
+  vk::DescriptorSetLayoutBinding output_binding;
+  output_binding.binding = 0;
+  output_binding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  output_binding.descriptorCount = 1;
+  output_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  output_set_layout = device.createDescriptorSetLayout({{}, 1, &output_binding});
+
+  vk::DescriptorSetLayout set_layouts[] = {input_set_layout, output_set_layout};
+  vk::PushConstantRange push_constants{vk::ShaderStageFlagBits::eCompute, 0, sizeof(Params)};
+  pipeline_layout = device.createPipelineLayout({{}, 2, set_layouts, 1, &push_constants});
+
+  // The embedded bytes are not guaranteed to be aligned for the module
+  std::vector<uint32_t> code((RGB_TO_YUV_COMP_SPV_LEN + 3) / 4);
+  memcpy(code.data(), RGB_TO_YUV_COMP_SPV_PTR, RGB_TO_YUV_COMP_SPV_LEN);
+  shader = device.createShaderModule({{}, RGB_TO_YUV_COMP_SPV_LEN, code.data()});
+
+  vk::ComputePipelineCreateInfo pipeline_info;
+  pipeline_info.stage = vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eCompute, shader, "main"};
+  pipeline_info.layout = pipeline_layout;
+  auto result = device.createComputePipeline(nullptr, pipeline_info);
+  if (result.result != vk::Result::eSuccess)
+    throw std::runtime_error("failed to create the YuvDownload pipeline: " + vk::to_string(result.result));
+  pipeline = result.value;
+
+  command_pool = device.createCommandPool({vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queue_family});
+}
+
+void alvr::YuvDownload::CreateBuffers(vk::PhysicalDevice physical_device)
+{
+  uint32_t count = slots.size();
+  vk::DescriptorPoolSize pool_size{vk::DescriptorType::eStorageBuffer, count};
+  output_descriptor_pool = device.createDescriptorPool({{}, count, 1, &pool_size});
+  std::vector<vk::DescriptorSetLayout> set_layouts(count, output_set_layout);
+  auto descriptor_sets = device.allocateDescriptorSets({output_descriptor_pool, count, set_layouts.data()});
+  auto command_buffers = device.allocateCommandBuffers({command_pool, vk::CommandBufferLevel::ePrimary, count});
+
+  vk::DeviceSize size = luma_size + 2 * chroma_size;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    Slot &slot = slots[i];
+    slot.buffer = device.createBuffer({{}, size, vk::BufferUsageFlagBits::eStorageBuffer, vk::SharingMode::eExclusive});
+    auto req = device.getBufferMemoryRequirements(slot.buffer);
+    slot.memory = device.allocateMemory({req.size, find_memory_type(physical_device, req.memoryTypeBits, &coherent)});
+    device.bindBufferMemory(slot.buffer, slot.memory, 0);
+    slot.mapped = (uint8_t *)device.mapMemory(slot.memory, 0, VK_WHOLE_SIZE);
+    slot.descriptor_set = descriptor_sets[i];
+    slot.command_buffer = command_buffers[i];
+    slot.fence = device.createFence({vk::FenceCreateFlagBits::eSignaled});
+
+    vk::DescriptorBufferInfo buffer_desc{slot.buffer, 0, size};
+    vk::WriteDescriptorSet write;
+    write.dstSet = slot.descriptor_set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eStorageBuffer;
+    write.pBufferInfo = &buffer_desc;
+    device.updateDescriptorSets(write, {});
+  }
+}
+
+void alvr::YuvDownload::WaitIdle()
+{
+  std::vector<vk::Fence> fences;
+  for (auto &slot: slots)
+    fences.push_back(slot.fence);
+  if (not fences.empty() and device.waitForFences(fences, true, UINT64_MAX) != vk::Result::eSuccess)
+    throw std::runtime_error("failed to wait for YuvDownload");
+}
+
+void alvr::YuvDownload::ReleaseInputFrames()
+{
+  WaitIdle();
+  if (input_descriptor_pool)
+    device.destroyDescriptorPool(input_descriptor_pool);
+  input_descriptor_pool = nullptr;
+  input_descriptor_sets.clear();
+  for (auto view: input_views)
+    device.destroyImageView(view);
+  input_views.clear();
+  input_frames = nullptr;
+}
+
+void alvr::YuvDownload::SetInputFrames(std::vector<VkFrame> &frames)
+{
+  input_frames = &frames;
+  uint32_t count = frames.size();
+  params.srgbInput = is_srgb(frames[0].get_format());
+
+  vk::DescriptorPoolSize pool_size{vk::DescriptorType::eCombinedImageSampler, count};
+  input_descriptor_pool = device.createDescriptorPool({{}, count, 1, &pool_size});
+  std::vector<vk::DescriptorSetLayout> set_layouts(count, input_set_layout);
+  input_descriptor_sets = device.allocateDescriptorSets({input_descriptor_pool, count, set_layouts.data()});
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = ((AVVkFrame *)frames[i])->img[0];
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = frames[i].get_format();
+    view_info.subresourceRange = COLOR_RANGE;
+    input_views.push_back(device.createImageView(view_info));
+
+    vk::DescriptorImageInfo image_desc{nullptr, input_views[i], vk::ImageLayout::eShaderReadOnlyOptimal};
+    vk::WriteDescriptorSet write;
+    write.dstSet = input_descriptor_sets[i];
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    write.pImageInfo = &image_desc;
+    device.updateDescriptorSets(write, {});
+  }
+}
+
+void alvr::YuvDownload::Download(uint32_t input_index, AVFrame *frame)
+{
+  // The encoders copy the frame on input, so the next buffer is free unless one of them keeps it
+  Slot *slot = nullptr;
+  for (uint32_t i = 0; i < slots.size() and not slot; ++i)
+  {
+    uint32_t index = (next_slot + i) % slots.size();
+    if (not slots[index].referenced)
+    {
+      slot = &slots[index];
+      next_slot = (index + 1) % slots.size();
+    }
+  }
+  if (not slot)
+    throw std::runtime_error("all the YUV download buffers are held by the encoder");
+
+  VkFrame &input_frame = (*input_frames)[input_index];
+  AVVkFrame *input = input_frame;
+
+  device.resetFences(slot->fence);
+  auto &cmd = slot->command_buffer;
+  cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  vk::ImageMemoryBarrier image_barrier;
+  image_barrier.srcAccessMask = vk::AccessFlags(input->access[0]);
+  image_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  image_barrier.oldLayout = vk::ImageLayout(input->layout[0]);
+  image_barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  image_barrier.image = input->img[0];
+  image_barrier.subresourceRange = COLOR_RANGE;
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0, nullptr, 1, &image_barrier);
+
+  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  vk::DescriptorSet sets[] = {input_descriptor_sets[input_index], slot->descriptor_set};
+  cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, 2, sets, 0, nullptr);
+  cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+  uint32_t blocks = (width + BLOCK_WIDTH - 1) / BLOCK_WIDTH;
+  cmd.dispatch((blocks + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, (chroma_rows + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+  vk::BufferMemoryBarrier buffer_barrier;
+  buffer_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  buffer_barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+  buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.buffer = slot->buffer;
+  buffer_barrier.size = VK_WHOLE_SIZE;
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, 0, nullptr, 1, &buffer_barrier, 0, nullptr);
+  cmd.end();
+
+  input->layout[0] = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  input->access[0] = VK_ACCESS_SHADER_READ_BIT;
+
+  // Same semaphore use as FrameRender: the input semaphore is at the value of the present, and
+  // the next value releases the image. A binary one is waited and signaled again.
+  uint64_t wait_value = input->sem_value[0];
+  uint64_t signal_value = input->sem_value[0] + 1;
+  vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eComputeShader;
+  vk::TimelineSemaphoreSubmitInfo timeline_info;
+  timeline_info.waitSemaphoreValueCount = 1;
+  timeline_info.pWaitSemaphoreValues = &wait_value;
+  timeline_info.signalSemaphoreValueCount = 1;
+  timeline_info.pSignalSemaphoreValues = &signal_value;
+  vk::SubmitInfo submit;
+  submit.pNext = &timeline_info;
+  submit.waitSemaphoreCount = 1;
+  submit.pWaitSemaphores = (vk::Semaphore *)&input->sem[0];
+  submit.pWaitDstStageMask = &wait_stage;
+  submit.commandBufferCount = 1;
+  submit.pCommandBuffers = &cmd;
+  submit.signalSemaphoreCount = 1;
+  submit.pSignalSemaphores = (vk::Semaphore *)&input->sem[0];
+  queue.submit(submit, slot->fence);
+  input_frame.set_semaphore_value(signal_value);
+
+  // Only the dispatch is waited for, a fraction of what the transfer and swscale took on the CPU
+  if (device.waitForFences(slot->fence, true, UINT64_MAX) != vk::Result::eSuccess)
+    throw std::runtime_error("failed to wait for YuvDownload");
+  if (not coherent)
+    device.invalidateMappedMemoryRanges(vk::MappedMemoryRange{slot->memory, 0, VK_WHOLE_SIZE});
+
+  slot->referenced = true;
+  AVUTIL.av_buffer_unref(&frame->buf[0]);
+  frame->buf[0] = AVUTIL.av_buffer_create(slot->mapped, luma_size + 2 * chroma_size,
+      [](void *opaque, uint8_t *) { static_cast<Slot *>(opaque)->referenced = false; },
+      slot, AV_BUFFER_FLAG_READONLY);
+  if (not frame->buf[0])
+  {
+    slot->referenced = false;
+    throw std::runtime_error("failed to reference the YUV download buffer");
+  }
+  frame->data[0] = slot->mapped;
+  frame->data[1] = slot->mapped + luma_size;
+  frame->data[2] = slot->mapped + luma_size + chroma_size;
+  frame->linesize[0] = params.lumaStride * 4;
+  frame->linesize[1] = params.chromaStride * 4;
+  frame->linesize[2] = params.chromaStride * 4;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+extern "C" struct AVFrame;
+
+namespace alvr
+{
+
+class VkFrame;
+class VkFrameCtx;
+
+// Color conversion and download of the encoder input frames for the software encoders. A compute
+// shader converts each frame to planar YUV 4:2:0 straight into one of a ring of host visible
+// buffers, and the AVFrame given to the encoder references that buffer: the CPU neither converts
+// nor copies the frames, which took swscale most of a frame interval at high resolutions.
+class YuvDownload
+{
+public:
+  // ten_bit gives yuv420p10le frames, yuv420p otherwise. buffer_count is the number of frames the
+  // encoder can hold at a time.
+  YuvDownload(VkFrameCtx &vk_frame_ctx, std::vector<VkFrame> &input_frames,
+      uint32_t width, uint32_t height, bool ten_bit, uint32_t buffer_count);
+  ~YuvDownload();
+
+  // Swapchain recreation with images of the same size and format, the buffers stay.
+  void ReleaseInputFrames();
+  void SetInputFrames(std::vector<VkFrame> &input_frames);
+
+  // Converts an input frame and points the planes of frame at the result, once the GPU is done.
+  // The input frame is released to the layer like a libavutil transfer does. The buffer goes back
+  // to the ring when the last reference to it is dropped, the caller unreferences frame->buf[0]
+  // once the encoder has taken its own.
+  void Download(uint32_t input_index, AVFrame *frame);
+
+private:
+  // Push constants of RgbToYuv.comp
+  struct Params
+  {
+    uint32_t frameSize[2];
+    uint32_t lumaStride;
+    uint32_t chromaStride;
+    uint32_t uOffset;
+    uint32_t vOffset;
+    uint32_t srgbInput;
+    uint32_t tenBit;
+  };
+
+  // A buffer of the ring and the commands that convert into it
+  struct Slot
+  {
+    vk::Buffer buffer;
+    vk::DeviceMemory memory;
+    uint8_t *mapped = nullptr;
+    vk::DescriptorSet descriptor_set;
+    vk::CommandBuffer command_buffer;
+    vk::Fence fence;
+    // Set while an AVFrame references the buffer
+    std::atomic<bool> referenced{false};
+  };
+
+  void CreatePipeline(uint32_t queue_family);
+  void CreateBuffers(vk::PhysicalDevice physical_device);
+  void WaitIdle();
+
+  vk::Device device;
+  vk::Queue queue;
+  uint32_t width;
+  uint32_t height;
+  Params params = {};
+  // Plane sizes in bytes
+  uint32_t luma_size;
+  uint32_t chroma_size;
+  uint32_t chroma_rows;
+  // Whether the memory has to be invalidated before it is read
+  bool coherent = true;
+
+  vk::Sampler sampler;
+  vk::DescriptorSetLayout input_set_layout;
+  vk::DescriptorSetLayout output_set_layout;
+  vk::DescriptorPool output_descriptor_pool;
+  vk::PipelineLayout pipeline_layout;
+  vk::ShaderModule shader;
+  vk::Pipeline pipeline;
+  vk::CommandPool command_pool;
+
+  std::vector<VkFrame> *input_frames = nullptr;
+  std::vector<vk::ImageView> input_views;
+  std::vector<vk::DescriptorSet> input_descriptor_sets;
+  vk::DescriptorPool input_descriptor_pool;
+
+  std::vector<Slot> slots;
+  uint32_t next_slot = 0;
+};
+
+}
@@ -1,6 +1,10 @@
 #include "ffmpeg_helper.h"
 
 #include <chrono>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
 
 #include "alvr_server/bindings.h"
 
@@ -59,6 +63,11 @@ alvr::VkContext::VkContext(const char* device, AVDictionary * opt)
 
 #define VK_LOAD_PFN(inst, name) (PFN_##name) vkGetInstanceProcAddr(inst, #name)
   d.vkImportSemaphoreFdKHR = VK_LOAD_PFN(vkctx->inst, vkImportSemaphoreFdKHR);
+  d.vkGetSemaphoreFdKHR = VK_LOAD_PFN(vkctx->inst, vkGetSemaphoreFdKHR);
+  d.vkWaitSemaphores = VK_LOAD_PFN(vkctx->inst, vkWaitSemaphores);
+  d.vkSignalSemaphore = VK_LOAD_PFN(vkctx->inst, vkSignalSemaphore);
+  d.vkGetMemoryFdKHR = VK_LOAD_PFN(vkctx->inst, vkGetMemoryFdKHR);
+  d.vkGetImageDrmFormatModifierPropertiesEXT = VK_LOAD_PFN(vkctx->inst, vkGetImageDrmFormatModifierPropertiesEXT);
 }
 
 vk::Device alvr::VkContext::get_vk_device() const
@@ -68,6 +77,38 @@ vk::Device alvr::VkContext::get_vk_device() const
   return vkctx->act_dev;
 }
 
+vk::PhysicalDevice alvr::VkContext::get_vk_phys_device() const
+{
+  AVHWDeviceContext *hwctx = (AVHWDeviceContext *)ctx->data;
+  AVVulkanDeviceContext *vkctx = (AVVulkanDeviceContext *)hwctx->hwctx;
+  return vkctx->phys_dev;
+}
+
+vk::Queue alvr::VkContext::get_vk_queue() const
+{
+  return get_vk_device().getQueue(get_vk_queue_family(), 0);
+}
+
+uint32_t alvr::VkContext::get_vk_queue_family() const
+{
+  AVHWDeviceContext *hwctx = (AVHWDeviceContext *)ctx->data;
+  AVVulkanDeviceContext *vkctx = (AVVulkanDeviceContext *)hwctx->hwctx;
+  return vkctx->queue_family_index;
+}
+
+bool alvr::VkContext::has_device_extension(const char *name) const
+{
+  // libavutil enables the optional extensions the device supports
+  AVHWDeviceContext *hwctx = (AVHWDeviceContext *)ctx->data;
+  AVVulkanDeviceContext *vkctx = (AVVulkanDeviceContext *)hwctx->hwctx;
+  for (int i = 0; i < vkctx->nb_enabled_dev_extensions; ++i)
+  {
+    if (strcmp(vkctx->enabled_dev_extensions[i], name) == 0)
+      return true;
+  }
+  return false;
+}
+
 alvr::VkContext::~VkContext()
 {
   AVUTIL.av_buffer_unref(&ctx);
@@ -102,14 +143,34 @@ alvr::VkFrame::VkFrame(
     const VkContext& vk_ctx,
     vk::ImageCreateInfo image_create_info,
     size_t memory_index,
-    int image_fd, int semaphore_fd):
+    int image_fd, int semaphore_fd, bool timeline_semaphore,
+    const DrmImageLayout *drm_layout):
   width(image_create_info.extent.width),
-  height(image_create_info.extent.height)
+  height(image_create_info.extent.height),
+  format(image_create_info.format),
+  d(vk_ctx.d),
+  timeline(timeline_semaphore)
 {
   device = vk_ctx.get_vk_device();
+  queue = vk_ctx.get_vk_queue();
 
+  auto handleType = drm_layout ? vk::ExternalMemoryHandleTypeFlagBits::eDmaBufEXT : vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
+  vk::SubresourceLayout planeLayout;
+  vk::ImageDrmFormatModifierExplicitCreateInfoEXT modifierInfo;
   vk::ExternalMemoryImageCreateInfo extMemImageInfo;
-  extMemImageInfo.handleTypes = vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
+  extMemImageInfo.handleTypes = handleType;
+  if (drm_layout) {
+    // The Vulkan import takes the fd, VAAPI imports the dma-buf on its own
+    this->drm_layout = *drm_layout;
+    dmabuf_fd = dup(image_fd);
+    planeLayout.offset = drm_layout->offset;
+    planeLayout.rowPitch = drm_layout->pitch;
+    modifierInfo.drmFormatModifier = drm_layout->modifier;
+    modifierInfo.drmFormatModifierPlaneCount = 1;
+    modifierInfo.pPlaneLayouts = &planeLayout;
+    extMemImageInfo.pNext = &modifierInfo;
+    image_create_info.tiling = vk::ImageTiling::eDrmFormatModifierEXT;
+  }
   image_create_info.pNext = &extMemImageInfo;
   image_create_info.initialLayout = vk::ImageLayout::eUndefined;// VUID-VkImageCreateInfo-pNext-01443
   vk::Image image = device.createImage(image_create_info);
@@ -121,7 +182,7 @@ alvr::VkFrame::VkFrame(
 
   vk::ImportMemoryFdInfoKHR importMemInfo;
   importMemInfo.pNext = &dedicatedMemInfo;
-  importMemInfo.handleType = vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
+  importMemInfo.handleType = handleType;
   importMemInfo.fd = image_fd;
 
   vk::MemoryAllocateInfo memAllocInfo;
@@ -132,7 +193,12 @@ alvr::VkFrame::VkFrame(
   vk::DeviceMemory mem = device.allocateMemory(memAllocInfo);
   device.bindImageMemory(image, mem, 0);
 
+  // The imported payload must be of the type it was exported with
+  vk::SemaphoreTypeCreateInfo semTypeInfo;
+  semTypeInfo.semaphoreType = vk::SemaphoreType::eTimeline;
   vk::SemaphoreCreateInfo semInfo;
+  if (timeline)
+    semInfo.pNext = &semTypeInfo;
   vk::Semaphore semaphore = device.createSemaphore(semInfo);
 
   vk::ImportSemaphoreFdInfoKHR impSemInfo;
@@ -149,10 +215,130 @@ alvr::VkFrame::VkFrame(
   av_vkframe->size[0] = req.size;
   av_vkframe->layout[0] = VK_IMAGE_LAYOUT_UNDEFINED;
   av_vkframe->sem[0] = semaphore;
+
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+  if (timeline and dmabuf_fd != -1) {
+    vk::ExportSemaphoreCreateInfo exportInfo;
+    exportInfo.handleTypes = vk::ExternalSemaphoreHandleTypeFlagBits::eSyncFd;
+    vk::SemaphoreCreateInfo exportSemInfo;
+    exportSemInfo.pNext = &exportInfo;
+    rendered_sem = device.createSemaphore(exportSemInfo);
+    released_sem = device.createSemaphore(vk::SemaphoreCreateInfo());
+    implicit_sync = true;
+  }
+#endif
+}
+
+void alvr::VkFrame::set_semaphore_value(uint64_t value)
+{
+  if (timeline)
+    av_vkframe->sem_value[0] = value;
+}
+
+void alvr::VkFrame::wait_rendered()
+{
+  if (not timeline)
+    return;
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+  if (implicit_sync) {
+    // Signal a sync_file once the image is rendered and add it to the fences of the dma-buf as a
+    // write, the reads that come next wait for it in the kernel
+    uint64_t unused = 0;
+    vk::TimelineSemaphoreSubmitInfo timelineInfo;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &av_vkframe->sem_value[0];
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &unused;
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    vk::SubmitInfo submit;
+    submit.pNext = &timelineInfo;
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = (vk::Semaphore*)&av_vkframe->sem[0];
+    submit.pWaitDstStageMask = &waitStage;
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &rendered_sem;
+    queue.submit(submit);
+
+    int fd = device.getSemaphoreFdKHR({rendered_sem, vk::ExternalSemaphoreHandleTypeFlagBits::eSyncFd}, d);
+    dma_buf_import_sync_file import = {};
+    import.flags = DMA_BUF_SYNC_WRITE;
+    import.fd = fd;
+    int ret = ioctl(dmabuf_fd, DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &import);
+    close(fd);
+    if (ret == 0)
+      return;
+    // Kernels before 6.0, the sync_file was consumed by the export so it is safe to go on
+    implicit_sync = false;
+  }
+#endif
+  vk::SemaphoreWaitInfo waitInfo;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = (vk::Semaphore*)&av_vkframe->sem[0];
+  waitInfo.pValues = &av_vkframe->sem_value[0];
+  if (device.waitSemaphores(waitInfo, UINT64_MAX, d) != vk::Result::eSuccess)
+    throw std::runtime_error("failed to wait for the frame to be rendered");
+}
+
+bool alvr::VkFrame::release_on_gpu()
+{
+  if (not timeline)
+    return true;
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+  if (implicit_sync) {
+    // All the fences of the dma-buf, which include the reads submitted so far
+    dma_buf_export_sync_file exported = {};
+    exported.flags = DMA_BUF_SYNC_WRITE;
+    exported.fd = -1;
+    if (ioctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &exported) == 0) {
+      vk::ImportSemaphoreFdInfoKHR importInfo;
+      importInfo.semaphore = released_sem;
+      importInfo.flags = vk::SemaphoreImportFlagBits::eTemporary;
+      importInfo.handleType = vk::ExternalSemaphoreHandleTypeFlagBits::eSyncFd;
+      importInfo.fd = exported.fd;
+      device.importSemaphoreFdKHR(importInfo, d);
+
+      uint64_t unused = 0;
+      uint64_t released = ++av_vkframe->sem_value[0];
+      vk::TimelineSemaphoreSubmitInfo timelineInfo;
+      timelineInfo.waitSemaphoreValueCount = 1;
+      timelineInfo.pWaitSemaphoreValues = &unused;
+      timelineInfo.signalSemaphoreValueCount = 1;
+      timelineInfo.pSignalSemaphoreValues = &released;
+      vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+      vk::SubmitInfo submit;
+      submit.pNext = &timelineInfo;
+      submit.waitSemaphoreCount = 1;
+      submit.pWaitSemaphores = &released_sem;
+      submit.pWaitDstStageMask = &waitStage;
+      submit.signalSemaphoreCount = 1;
+      submit.pSignalSemaphores = (vk::Semaphore*)&av_vkframe->sem[0];
+      queue.submit(submit);
+      return true;
+    }
+    implicit_sync = false;
+  }
+#endif
+  return false;
+}
+
+void alvr::VkFrame::signal_released()
+{
+  if (not timeline)
+    return;
+  vk::SemaphoreSignalInfo signalInfo;
+  signalInfo.semaphore = av_vkframe->sem[0];
+  signalInfo.value = ++av_vkframe->sem_value[0];
+  device.signalSemaphore(signalInfo, d);
 }
 
 alvr::VkFrame::~VkFrame()
 {
+  if (rendered_sem)
+    device.destroySemaphore(rendered_sem);
+  if (released_sem)
+    device.destroySemaphore(released_sem);
+  if (dmabuf_fd != -1)
+    close(dmabuf_fd);
   device.destroySemaphore(av_vkframe->sem[0]);
   device.destroyImage(av_vkframe->img[0]);
   device.freeMemory(av_vkframe->mem[0]);
@@ -46,12 +46,21 @@ public:
   struct dispatch
   {
     PFN_vkImportSemaphoreFdKHR vkImportSemaphoreFdKHR;
+    PFN_vkGetSemaphoreFdKHR vkGetSemaphoreFdKHR;
+    PFN_vkWaitSemaphores vkWaitSemaphores;
+    PFN_vkSignalSemaphore vkSignalSemaphore;
+    PFN_vkGetMemoryFdKHR vkGetMemoryFdKHR;
+    PFN_vkGetImageDrmFormatModifierPropertiesEXT vkGetImageDrmFormatModifierPropertiesEXT;
     int getVkHeaderVersion() const { return VK_HEADER_VERSION; }
   };
 
   VkContext(const char* device, AVDictionary* opt = nullptr);
   ~VkContext();
   vk::Device get_vk_device() const;
+  vk::PhysicalDevice get_vk_phys_device() const;
+  vk::Queue get_vk_queue() const;
+  uint32_t get_vk_queue_family() const;
+  bool has_device_extension(const char *name) const;
 
   AVBufferRef *ctx;
   dispatch d;
@@ -66,23 +75,64 @@ public:
   AVBufferRef *ctx;
 };
 
+// Layout of an image shared as a single plane dma-buf
+struct DrmImageLayout
+{
+  uint64_t modifier;
+  uint64_t offset;
+  uint64_t pitch;
+};
+
 class VkFrame
 {
 public:
+  // image_fd is an opaque fd, or a dma-buf when drm_layout is set
   VkFrame(
       const VkContext& vk_ctx,
       vk::ImageCreateInfo image_create_info,
       size_t memory_index,
       int image_fd,
-      int semaphore_fd);
+      int semaphore_fd,
+      bool timeline_semaphore,
+      const DrmImageLayout *drm_layout = nullptr);
   ~VkFrame();
   operator AVVkFrame*() const { return av_vkframe;}
   std::unique_ptr<AVFrame, std::function<void(AVFrame*)>> make_av_frame(VkFrameCtx & frame_ctx);
+
+  // With a timeline semaphore, the value the layer signals once the present is rendered.
+  // libavutil transfers wait for it on the GPU and signal the next value, which releases the image
+  // to the layer (present_ring_claim).
+  void set_semaphore_value(uint64_t value);
+  // For encoders that read the image outside of Vulkan (VAAPI surfaces). wait_rendered() makes
+  // the next reads of the dma-buf wait for the rendering through its implicit fences, or waits
+  // on the CPU. release_on_gpu() releases the image once the reads submitted so far are done, if
+  // it returns false the caller waits for them and calls signal_released().
+  void wait_rendered();
+  bool release_on_gpu();
+  void signal_released();
+
+  // The dma-buf of the image, -1 if it was shared as an opaque fd
+  int get_dmabuf_fd() const { return dmabuf_fd; }
+  const DrmImageLayout &get_drm_layout() const { return drm_layout; }
+  vk::Format get_format() const { return format; }
+  bool has_timeline_semaphore() const { return timeline; }
+  uint32_t get_width() const { return width; }
+  uint32_t get_height() const { return height; }
 private:
   AVVkFrame* av_vkframe;
   const uint32_t width;
   const uint32_t height;
+  const vk::Format format;
   vk::Device device;
+  vk::Queue queue;
+  VkContext::dispatch d;
+  const bool timeline;
+  int dmabuf_fd = -1;
+  DrmImageLayout drm_layout = {};
+  // Binary semaphores for the sync_file exchanges with the dma-buf implicit fences
+  vk::Semaphore rendered_sem;
+  vk::Semaphore released_sem;
+  bool implicit_sync = false;
 };
 
 }
@@ -121,6 +121,42 @@ bool avcodec::Load(const std::string& library_name) {
     return false;
   }
 
+#if defined(LIBRARY_LOADER_AVCODEC_LOADER_H_DLOPEN)
+  av_packet_get_side_data =
+      reinterpret_cast<decltype(this->av_packet_get_side_data)>(
+          dlsym(library_, "av_packet_get_side_data"));
+#else
+  av_packet_get_side_data = &::av_packet_get_side_data;
+#endif
+  if (!av_packet_get_side_data) {
+    CleanUp(true);
+    return false;
+  }
+
+#if defined(LIBRARY_LOADER_AVCODEC_LOADER_H_DLOPEN)
+  av_packet_move_ref =
+      reinterpret_cast<decltype(this->av_packet_move_ref)>(
+          dlsym(library_, "av_packet_move_ref"));
+#else
+  av_packet_move_ref = &::av_packet_move_ref;
+#endif
+  if (!av_packet_move_ref) {
+    CleanUp(true);
+    return false;
+  }
+
+#if defined(LIBRARY_LOADER_AVCODEC_LOADER_H_DLOPEN)
+  av_packet_unref =
+      reinterpret_cast<decltype(this->av_packet_unref)>(
+          dlsym(library_, "av_packet_unref"));
+#else
+  av_packet_unref = &::av_packet_unref;
+#endif
+  if (!av_packet_unref) {
+    CleanUp(true);
+    return false;
+  }
+
 
   loaded_ = true;
   return true;
@@ -144,5 +180,8 @@ void avcodec::CleanUp(bool unload) {
   avcodec_send_frame = NULL;
   av_packet_alloc = NULL;
   av_packet_free = NULL;
+  av_packet_get_side_data = NULL;
+  av_packet_move_ref = NULL;
+  av_packet_unref = NULL;
 
 }
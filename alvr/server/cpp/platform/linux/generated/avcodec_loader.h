@@ -30,6 +30,9 @@ class avcodec {
   decltype(&::avcodec_send_frame) avcodec_send_frame;
   decltype(&::av_packet_alloc) av_packet_alloc;
   decltype(&::av_packet_free) av_packet_free;
+  decltype(&::av_packet_get_side_data) av_packet_get_side_data;
+  decltype(&::av_packet_move_ref) av_packet_move_ref;
+  decltype(&::av_packet_unref) av_packet_unref;
 
 
  private:
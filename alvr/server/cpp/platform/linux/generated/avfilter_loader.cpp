@@ -37,6 +37,18 @@ bool avfilter::Load(const std::string& library_name) {
     return false;
   }
 
+#if defined(LIBRARY_LOADER_AVFILTER_LOADER_H_DLOPEN)
+  av_buffersink_get_hw_frames_ctx =
+      reinterpret_cast<decltype(this->av_buffersink_get_hw_frames_ctx)>(
+          dlsym(library_, "av_buffersink_get_hw_frames_ctx"));
+#else
+  av_buffersink_get_hw_frames_ctx = &::av_buffersink_get_hw_frames_ctx;
+#endif
+  if (!av_buffersink_get_hw_frames_ctx) {
+    CleanUp(true);
+    return false;
+  }
+
 #if defined(LIBRARY_LOADER_AVFILTER_LOADER_H_DLOPEN)
   av_buffersrc_add_frame_flags =
       reinterpret_cast<decltype(this->av_buffersrc_add_frame_flags)>(
@@ -197,6 +209,7 @@ void avfilter::CleanUp(bool unload) {
 #endif
   loaded_ = false;
   av_buffersink_get_frame = NULL;
+  av_buffersink_get_hw_frames_ctx = NULL;
   av_buffersrc_add_frame_flags = NULL;
   av_buffersrc_parameters_alloc = NULL;
   av_buffersrc_parameters_set = NULL;
@@ -26,6 +26,7 @@ class avfilter {
   bool loaded() const { return loaded_; }
 
   decltype(&::av_buffersink_get_frame) av_buffersink_get_frame;
+  decltype(&::av_buffersink_get_hw_frames_ctx) av_buffersink_get_hw_frames_ctx;
   decltype(&::av_buffersrc_add_frame_flags) av_buffersrc_add_frame_flags;
   decltype(&::av_buffersrc_parameters_alloc) av_buffersrc_parameters_alloc;
   decltype(&::av_buffersrc_parameters_set) av_buffersrc_parameters_set;
@@ -37,6 +37,18 @@ bool avutil::Load(const std::string& library_name) {
     return false;
   }
 
+#if defined(LIBRARY_LOADER_AVUTIL_LOADER_H_DLOPEN)
+  av_buffer_create =
+      reinterpret_cast<decltype(this->av_buffer_create)>(
+          dlsym(library_, "av_buffer_create"));
+#else
+  av_buffer_create = &::av_buffer_create;
+#endif
+  if (!av_buffer_create) {
+    CleanUp(true);
+    return false;
+  }
+
 #if defined(LIBRARY_LOADER_AVUTIL_LOADER_H_DLOPEN)
   av_buffer_ref =
       reinterpret_cast<decltype(this->av_buffer_ref)>(
@@ -109,6 +121,18 @@ bool avutil::Load(const std::string& library_name) {
     return false;
   }
 
+#if defined(LIBRARY_LOADER_AVUTIL_LOADER_H_DLOPEN)
+  av_frame_new_side_data =
+      reinterpret_cast<decltype(this->av_frame_new_side_data)>(
+          dlsym(library_, "av_frame_new_side_data"));
+#else
+  av_frame_new_side_data = &::av_frame_new_side_data;
+#endif
+  if (!av_frame_new_side_data) {
+    CleanUp(true);
+    return false;
+  }
+
 #if defined(LIBRARY_LOADER_AVUTIL_LOADER_H_DLOPEN)
   av_frame_unref =
       reinterpret_cast<decltype(this->av_frame_unref)>(
@@ -145,6 +169,18 @@ bool avutil::Load(const std::string& library_name) {
     return false;
   }
 
+#if defined(LIBRARY_LOADER_AVUTIL_LOADER_H_DLOPEN)
+  av_hwdevice_ctx_create_derived =
+      reinterpret_cast<decltype(this->av_hwdevice_ctx_create_derived)>(
+          dlsym(library_, "av_hwdevice_ctx_create_derived"));
+#else
+  av_hwdevice_ctx_create_derived = &::av_hwdevice_ctx_create_derived;
+#endif
+  if (!av_hwdevice_ctx_create_derived) {
+    CleanUp(true);
+    return false;
+  }
+
 #if defined(LIBRARY_LOADER_AVUTIL_LOADER_H_DLOPEN)
   av_hwframe_ctx_alloc =
       reinterpret_cast<decltype(this->av_hwframe_ctx_alloc)>(
@@ -305,15 +341,18 @@ void avutil::CleanUp(bool unload) {
 #endif
   loaded_ = false;
   av_buffer_alloc = NULL;
+  av_buffer_create = NULL;
   av_buffer_ref = NULL;
   av_buffer_unref = NULL;
   av_dict_set = NULL;
   av_frame_alloc = NULL;
   av_frame_free = NULL;
   av_frame_get_buffer = NULL;
+  av_frame_new_side_data = NULL;
   av_frame_unref = NULL;
   av_free = NULL;
   av_hwdevice_ctx_create = NULL;
+  av_hwdevice_ctx_create_derived = NULL;
   av_hwframe_ctx_alloc = NULL;
   av_hwframe_ctx_init = NULL;
   av_hwframe_get_buffer = NULL;
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include "protocol.h"
+
+// Vsync clock of the headless display: vsyncs are at epoch_ns + n * interval_ns, CLOCK_MONOTONIC.
+// The layer seeds it with the phase of its display, VSyncScheduler then moves the phase from the
+// encoder side by shifting the epoch. The layer vsync thread sleeps until the next vsync of the
+// clock, so it cannot drift away from the encoder.
+struct vsync_clock {
+    std::atomic<uint64_t> epoch_ns;
+    std::atomic<uint64_t> interval_ns;
+    // Set by the encoder while the headset is idle: only every divider-th vsync is signaled, the
+    // others keep the phase. 0 is the same as 1.
+    std::atomic<uint32_t> divider;
+};
+
+// Single producer / single consumer ring carrying present_packet from the layer to CEncoder.
+// It lives in a memfd mapped by both processes, the layer rings an eventfd doorbell only when the
+// encoder is asleep, so in steady state a present costs no syscall on either side.
+//
+// Every slot is a seqlock: seq is odd while the layer writes it and 2 * (index + 1) once present
+// number index is complete. The encoder only ever wants the latest present, if the layer laps it
+// the check on seq fails and it retries with the new head.
+struct present_ring {
+    static constexpr uint32_t SLOTS = 8;
+
+    struct slot {
+        std::atomic<uint64_t> seq;
+        // CLOCK_MONOTONIC, in nanoseconds, when the layer published the present
+        uint64_t publish_ns;
+        present_packet packet;
+    };
+
+    // Number of presents published so far
+    alignas(64) std::atomic<uint64_t> head;
+    // Set by the encoder before it blocks on the doorbell
+    alignas(64) std::atomic<uint32_t> consumer_waiting;
+    alignas(64) vsync_clock vsync;
+    alignas(64) slot slots[SLOTS];
+    // With timeline semaphores, semaphore_value of the last present of every image while the
+    // encoder may take it, with CLAIMED set once it did. See present_ring_claim().
+    alignas(64) std::atomic<uint64_t> claims[MAX_SWAPCHAIN_IMAGES];
+
+    static constexpr uint64_t CLAIMED = 1ull << 63;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+inline uint64_t present_ring_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// First vsync of the clock strictly after after_ns
+inline uint64_t vsync_clock_next(const vsync_clock &clock, uint64_t after_ns) {
+    uint64_t epoch = clock.epoch_ns.load(std::memory_order_relaxed);
+    uint64_t interval = clock.interval_ns.load(std::memory_order_relaxed);
+    if (after_ns >= epoch)
+        return epoch + ((after_ns - epoch) / interval + 1) * interval;
+    return epoch - ((epoch - after_ns - 1) / interval) * interval;
+}
+
+// Layer side. Returns true if the doorbell must be rung.
+inline bool present_ring_publish(present_ring &ring, const present_packet &packet) {
+    uint64_t index = ring.head.load(std::memory_order_relaxed);
+    auto &slot = ring.slots[index % present_ring::SLOTS];
+
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.publish_ns = present_ring_now_ns();
+    slot.packet = packet;
+    slot.seq.store(2 * (index + 1), std::memory_order_release);
+
+    // seq_cst pairs with the encoder storing consumer_waiting then loading head, one of the two
+    // sides always sees the other.
+    ring.head.store(index + 1, std::memory_order_seq_cst);
+    return ring.consumer_waiting.load(std::memory_order_seq_cst) != 0;
+}
+
+// Encoder side. Copies the latest present newer than *consumed and advances *consumed to it.
+// Returns false if there is none yet, skipped is set to the number of presents jumped over.
+inline bool present_ring_consume(present_ring &ring, uint64_t *consumed, present_packet *packet,
+                                 uint64_t *publish_ns, uint32_t *skipped) {
+    while (true) {
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        if (head == *consumed)
+            return false;
+
+        uint64_t index = head - 1;
+        auto &slot = ring.slots[index % present_ring::SLOTS];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * (index + 1))
+            continue;
+        *publish_ns = slot.publish_ns;
+        *packet = slot.packet;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != 2 * (index + 1))
+            continue;
+
+        *skipped = uint32_t(index - *consumed);
+        *consumed = head;
+        return true;
+    }
+}
+
+// Image handoff with timeline semaphores: the layer offers every present of an image, and revokes
+// the offer when the application acquires the image again. The encoder claims the image before
+// encoding it, so the layer knows whether it must wait for the encoder to be done reading.
+
+// Layer side, when the present is published
+inline void present_ring_offer(present_ring &ring, uint32_t image, uint64_t semaphore_value) {
+    ring.claims[image].store(semaphore_value, std::memory_order_release);
+}
+
+// Layer side, when the image is acquired. Returns the claimed semaphore value, or 0 if the
+// encoder did not take the image and never will.
+inline uint64_t present_ring_revoke(present_ring &ring, uint32_t image) {
+    uint64_t claim = ring.claims[image].exchange(0, std::memory_order_acq_rel);
+    return (claim & present_ring::CLAIMED) ? claim & ~present_ring::CLAIMED : 0;
+}
+
+// Encoder side. Returns false if the image was acquired again since the present, it must then be
+// skipped. On success the encoder must signal semaphore_value + 1 once it is done with the image.
+inline bool present_ring_claim(present_ring &ring, const present_packet &packet) {
+    uint64_t expected = packet.semaphore_value;
+    return ring.claims[packet.image].compare_exchange_strong(
+        expected, packet.semaphore_value | present_ring::CLAIMED, std::memory_order_acq_rel);
+}
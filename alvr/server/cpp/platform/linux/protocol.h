@@ -8,16 +8,50 @@
 #include <mutex>
 #include <vulkan/vulkan.h>
 
+// Sent by the layer for every presented image.
+// The layer runs in vrcompositor and only knows the pose the frame was rendered with, SteamVR
+// derives it from the driver pose so no driver side identifier (targetTimestampNs) survives.
+// CEncoder maps the pose back to the tracking frame through PoseHistory::GetBestPoseMatch(),
+// which is an index lookup in the common case.
 struct present_packet {
     uint32_t image;
     uint32_t frame;
+    // With timeline semaphores, the value the image semaphore reaches once the image is rendered.
+    // The encoder waits for it on the GPU and signals the next value when it is done reading.
+    uint64_t semaphore_value;
     float pose[3][4];
+    // False when the layer could not find the pose in the vrcompositor stack, CEncoder then takes
+    // the newest pose sent to SteamVR
+    bool pose_found;
+    // CLOCK_MONOTONIC, in nanoseconds, when vrcompositor called QueuePresent and when the page
+    // flip thread saw the present fence signaled. rendered_ns is 0 with timeline semaphores, the
+    // layer does not wait for the rendering then. The ring slot adds the publish time.
+    uint64_t present_ns;
+    uint64_t rendered_ns;
+    // GPU time of the latest finished copy into the shared images, in nanoseconds. 0 without the
+    // layer copy, or when the queue has no timestamps.
+    uint64_t copy_ns;
 };
 
+// Upper bound of init_packet.num_images, the layer advertises the configured count (2 to 4) as
+// both the minimum and maximum of the surface.
+constexpr uint32_t MAX_SWAPCHAIN_IMAGES = 4;
+// Sent with SCM_RIGHTS right after init_packet: the memory and semaphore of every image, then
+// the present ring memfd and its doorbell eventfd.
+constexpr uint32_t IPC_FDS_MAX = 2 * MAX_SWAPCHAIN_IMAGES + 2;
+
 struct init_packet {
     uint32_t num_images;
     std::array<char, VK_MAX_PHYSICAL_DEVICE_NAME_SIZE> device_name;
     VkImageCreateInfo image_create_info;
     size_t mem_index;
     pid_t source_pid;
+    // The image semaphores are timeline semaphores, see present_ring_claim()
+    bool timeline_semaphores;
+    // The image memory fds are dma-bufs, image_create_info.tiling is then
+    // VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT with this modifier and a single plane
+    bool dma_buf;
+    uint64_t drm_modifier;
+    uint64_t plane_offset;
+    uint64_t plane_pitch;
 };
@@ -0,0 +1,356 @@
+#include "CEncoder.h"
+
+#include <CoreVideo/CoreVideo.h>
+#include <exception>
+#include <memory>
+
+#include "ALVR-common/packet_types.h"
+#include "alvr_server/ClientConnection.h"
+#include "alvr_server/Logger.h"
+#include "alvr_server/PoseHistory.h"
+#include "alvr_server/Settings.h"
+#include "alvr_server/Statistics.h"
+#include "alvr_server/Utils.h"
+
+namespace {
+
+const uint8_t START_CODE[] = {0, 0, 0, 1};
+
+void SetNumber(VTCompressionSessionRef session, CFStringRef key, int64_t value) {
+    CFNumberRef number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &value);
+    VTSessionSetProperty(session, key, number);
+    CFRelease(number);
+}
+
+OSStatus GetParameterSet(CMFormatDescriptionRef format, bool hevc, size_t index,
+                         const uint8_t **data, size_t *size, size_t *count, int *lengthSize) {
+    if (hevc) {
+        return CMVideoFormatDescriptionGetHEVCParameterSetAtIndex(format, index, data, size, count,
+                                                                  lengthSize);
+    }
+    return CMVideoFormatDescriptionGetH264ParameterSetAtIndex(format, index, data, size, count,
+                                                              lengthSize);
+}
+
+} // namespace
+
+CEncoder::CEncoder(std::shared_ptr<ClientConnection> listener,
+                   std::shared_ptr<PoseHistory> poseHistory)
+    : m_listener(listener), m_poseHistory(poseHistory) {}
+
+CEncoder::~CEncoder() {
+    Stop();
+    Join();
+    if (m_pendingSurface) {
+        CFRelease(m_pendingSurface);
+    }
+}
+
+void CEncoder::PresentSurface(IOSurfaceRef surface, uint64_t targetTimestampNs) {
+    CFRetain(surface);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pendingSurface) {
+            CFRelease(m_pendingSurface);
+            m_listener->GetStatistics()->PresentsCoalesced(1);
+        }
+        m_pendingSurface = surface;
+        m_pendingTimestampNs = targetTimestampNs;
+    }
+    m_cv.notify_one();
+}
+
+void CEncoder::Run() {
+    Info("CEncoder::Run\n");
+
+    while (!m_exiting) {
+        IOSurfaceRef surface;
+        uint64_t targetTimestampNs;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&] { return m_exiting || m_pendingSurface; });
+            if (m_exiting) {
+                break;
+            }
+            surface = m_pendingSurface;
+            targetTimestampNs = m_pendingTimestampNs;
+            m_pendingSurface = nullptr;
+        }
+
+        try {
+            Encode(surface, targetTimestampNs);
+        } catch (std::exception &e) {
+            Error("VideoToolbox: %s\n", e.what());
+            // Start over with a new session, and an IDR for the client
+            DestroySession();
+        }
+        CFRelease(surface);
+    }
+
+    DestroySession();
+    Info("CEncoder: exiting\n");
+}
+
+void CEncoder::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exiting = true;
+    }
+    m_cv.notify_all();
+}
+
+void CEncoder::CreateSession(int32_t width, int32_t height) {
+    auto &settings = Settings::Instance();
+
+    CMVideoCodecType codecType;
+    switch (settings.m_codec) {
+    case ALVR_CODEC_H264:
+        codecType = kCMVideoCodecType_H264;
+        break;
+    case ALVR_CODEC_H265:
+        codecType = kCMVideoCodecType_HEVC;
+        break;
+    default:
+        throw MakeException("VideoToolbox has no encoder for codec %d", settings.m_codec);
+    }
+    m_hevc = codecType == kCMVideoCodecType_HEVC;
+
+    CFMutableDictionaryRef specification =
+        CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                  &kCFTypeDictionaryValueCallBacks);
+    CFDictionarySetValue(specification,
+                         kVTVideoEncoderSpecification_RequireHardwareAcceleratedVideoEncoder,
+                         kCFBooleanTrue);
+    bool lowLatency = false;
+    if (__builtin_available(macOS 11.3, *)) {
+        // Rate control made for video calls: no lookahead, and frame sizes kept close to the
+        // average instead of spending the bitrate over a GOP
+        CFDictionarySetValue(specification,
+                             kVTVideoEncoderSpecification_EnableLowLatencyRateControl,
+                             kCFBooleanTrue);
+        lowLatency = true;
+    }
+
+    OSStatus status = VTCompressionSessionCreate(kCFAllocatorDefault, width, height, codecType,
+                                                 specification, NULL, NULL, OnOutput, this,
+                                                 &m_session);
+    if (status != noErr && lowLatency) {
+        // Older encoders only have it for H.264
+        Info("VideoToolbox: no low latency rate control for this codec (%d)\n", (int)status);
+        CFDictionaryRemoveValue(specification,
+                                kVTVideoEncoderSpecification_EnableLowLatencyRateControl);
+        status = VTCompressionSessionCreate(kCFAllocatorDefault, width, height, codecType,
+                                            specification, NULL, NULL, OnOutput, this, &m_session);
+    }
+    CFRelease(specification);
+    if (status != noErr) {
+        m_session = nullptr;
+        throw MakeException("VTCompressionSessionCreate failed: %d", (int)status);
+    }
+    m_width = width;
+    m_height = height;
+
+    VTSessionSetProperty(m_session, kVTCompressionPropertyKey_RealTime, kCFBooleanTrue);
+    VTSessionSetProperty(m_session, kVTCompressionPropertyKey_AllowFrameReordering, kCFBooleanFalse);
+    SetNumber(m_session, kVTCompressionPropertyKey_MaxFrameDelayCount, 0);
+    // Keyframes come from the IDRScheduler only
+    SetNumber(m_session, kVTCompressionPropertyKey_MaxKeyFrameInterval, 0);
+    CFStringRef profile = kVTProfileLevel_H264_High_AutoLevel;
+    if (m_hevc) {
+        profile = settings.m_use10bitEncoder ? kVTProfileLevel_HEVC_Main10_AutoLevel
+                                             : kVTProfileLevel_HEVC_Main_AutoLevel;
+    }
+    VTSessionSetProperty(m_session, kVTCompressionPropertyKey_ProfileLevel, profile);
+    ApplyRate();
+
+    status = VTCompressionSessionPrepareToEncodeFrames(m_session);
+    if (status != noErr) {
+        throw MakeException("VTCompressionSessionPrepareToEncodeFrames failed: %d", (int)status);
+    }
+    Info("VideoToolbox: %s session of %dx%d\n", m_hevc ? "HEVC" : "H.264", width, height);
+}
+
+void CEncoder::DestroySession() {
+    if (!m_session) {
+        return;
+    }
+    VTCompressionSessionCompleteFrames(m_session, kCMTimeInvalid);
+    VTCompressionSessionInvalidate(m_session);
+    CFRelease(m_session);
+    m_session = nullptr;
+}
+
+void CEncoder::ApplyRate() {
+    EncoderRate rate = m_listener->GetStatistics()->GetEncoderRate();
+
+    SetNumber(m_session, kVTCompressionPropertyKey_AverageBitRate, rate.bitrate);
+    SetNumber(m_session, kVTCompressionPropertyKey_ExpectedFrameRate, (int64_t)rate.fps);
+
+    // Hard limit of one VBV buffer over its duration, like the HRD of the other encoders
+    int64_t bytes = rate.vbvSize / 8;
+    double seconds = (double)rate.vbvSize / rate.bitrate;
+    CFNumberRef limit[2] = {
+        CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &bytes),
+        CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &seconds),
+    };
+    CFArrayRef limits =
+        CFArrayCreate(kCFAllocatorDefault, (const void **)limit, 2, &kCFTypeArrayCallBacks);
+    VTSessionSetProperty(m_session, kVTCompressionPropertyKey_DataRateLimits, limits);
+    CFRelease(limits);
+    CFRelease(limit[0]);
+    CFRelease(limit[1]);
+}
+
+void CEncoder::Encode(IOSurfaceRef surface, uint64_t targetTimestampNs) {
+    int32_t width = (int32_t)IOSurfaceGetWidth(surface);
+    int32_t height = (int32_t)IOSurfaceGetHeight(surface);
+    if (m_session && (width != m_width || height != m_height)) {
+        DestroySession();
+    }
+    if (!m_session) {
+        // The first frame of a session is a keyframe
+        CreateSession(width, height);
+    } else if (m_listener->GetStatistics()->CheckBitrateUpdated()) {
+        // Unlike VAAPI the session takes a new rate between two frames
+        ApplyRate();
+    }
+
+    m_listener->m_frameTrace.Record(targetTimestampNs, FrameTrace::PRESENT, GetTimestampUs());
+
+    uint64_t lastGoodTimestamp;
+    if (m_scheduler.CheckInvalidation(&lastGoodTimestamp)) {
+        m_scheduler.OnPacketLoss();
+    }
+    bool idr = m_scheduler.CheckIDRInsertion();
+    if (m_scheduler.CheckRefreshInsertion()) {
+        idr = true;
+    }
+
+    CVPixelBufferRef pixelBuffer = nullptr;
+    CVReturn ret =
+        CVPixelBufferCreateWithIOSurface(kCFAllocatorDefault, surface, NULL, &pixelBuffer);
+    if (ret != kCVReturnSuccess) {
+        throw MakeException("CVPixelBufferCreateWithIOSurface failed: %d", (int)ret);
+    }
+
+    CFDictionaryRef frameProperties = NULL;
+    if (idr) {
+        const void *keys[] = {kVTEncodeFrameOptionKey_ForceKeyFrame};
+        const void *values[] = {kCFBooleanTrue};
+        frameProperties = CFDictionaryCreate(kCFAllocatorDefault, keys, values, 1,
+                                             &kCFTypeDictionaryKeyCallBacks,
+                                             &kCFTypeDictionaryValueCallBacks);
+    }
+
+    // Given back to OnOutput, which deletes it
+    auto info = new FrameInfo{targetTimestampNs, GetTimestampUs()};
+    OSStatus status = VTCompressionSessionEncodeFrame(
+        m_session, pixelBuffer, CMTimeMake(targetTimestampNs, 1000000000), kCMTimeInvalid,
+        frameProperties, info, NULL);
+    CVPixelBufferRelease(pixelBuffer);
+    if (frameProperties) {
+        CFRelease(frameProperties);
+    }
+    if (status != noErr) {
+        delete info;
+        throw MakeException("VTCompressionSessionEncodeFrame failed: %d", (int)status);
+    }
+}
+
+void CEncoder::OnOutput(void *encoder, void *frame, OSStatus status, VTEncodeInfoFlags flags,
+                        CMSampleBufferRef sample) {
+    auto self = static_cast<CEncoder *>(encoder);
+    std::unique_ptr<FrameInfo> info(static_cast<FrameInfo *>(frame));
+
+    if (status != noErr) {
+        Error("VideoToolbox: frame encode failed: %d\n", (int)status);
+        self->m_scheduler.InsertIDR();
+        return;
+    }
+    // A dropped frame is never referenced, the stream stays decodable
+    if (!sample || (flags & kVTEncodeInfo_FrameDropped)) {
+        return;
+    }
+    self->SendSample(*info, sample);
+}
+
+void CEncoder::SendSample(const FrameInfo &info, CMSampleBufferRef sample) {
+    bool keyFrame = true;
+    CFArrayRef attachments = CMSampleBufferGetSampleAttachmentsArray(sample, false);
+    if (attachments && CFArrayGetCount(attachments) > 0) {
+        auto attachment = (CFDictionaryRef)CFArrayGetValueAtIndex(attachments, 0);
+        keyFrame = !CFDictionaryContainsKey(attachment, kCMSampleAttachmentKey_NotSync);
+    }
+
+    m_annexB.clear();
+
+    // VideoToolbox keeps the parameter sets in the format description, the client finds them
+    // in-band in front of each keyframe
+    CMFormatDescriptionRef format = CMSampleBufferGetFormatDescription(sample);
+    const uint8_t *data;
+    size_t size;
+    size_t count = 0;
+    int lengthSize = 4;
+    if (GetParameterSet(format, m_hevc, 0, &data, &size, &count, &lengthSize) != noErr) {
+        Error("VideoToolbox: no parameter sets in the output\n");
+        return;
+    }
+    if (keyFrame) {
+        for (size_t i = 0; i < count; i++) {
+            if (GetParameterSet(format, m_hevc, i, &data, &size, NULL, NULL) != noErr) {
+                Error("VideoToolbox: no parameter set %zu\n", i);
+                return;
+            }
+            m_annexB.insert(m_annexB.end(), START_CODE, START_CODE + sizeof(START_CODE));
+            m_annexB.insert(m_annexB.end(), data, data + size);
+        }
+    }
+
+    // The NAL units are prefixed with their length, big endian
+    CMBlockBufferRef block = CMSampleBufferGetDataBuffer(sample);
+    size_t contiguous = 0;
+    size_t total = 0;
+    char *bytes = nullptr;
+    if (CMBlockBufferGetDataPointer(block, 0, &contiguous, &total, &bytes) != kCMBlockBufferNoErr) {
+        Error("VideoToolbox: cannot read the output\n");
+        return;
+    }
+    std::vector<uint8_t> copy;
+    if (contiguous < total) {
+        copy.resize(total);
+        CMBlockBufferCopyDataBytes(block, 0, total, copy.data());
+        bytes = (char *)copy.data();
+    }
+    auto nals = (const uint8_t *)bytes;
+    size_t offset = 0;
+    while (offset + lengthSize <= total) {
+        size_t nalSize = 0;
+        for (int i = 0; i < lengthSize; i++) {
+            nalSize = (nalSize << 8) | nals[offset + i];
+        }
+        offset += lengthSize;
+        if (nalSize > total - offset) {
+            break;
+        }
+        m_annexB.insert(m_annexB.end(), START_CODE, START_CODE + sizeof(START_CODE));
+        m_annexB.insert(m_annexB.end(), nals + offset, nals + offset + nalSize);
+        offset += nalSize;
+    }
+
+    m_listener->SendVideo(m_annexB.data(), (int)m_annexB.size(), info.targetTimestampNs);
+
+    EncodeStats stats;
+    stats.latencyUs = GetTimestampUs() - info.submitUs;
+    stats.encoderLatencyUs = stats.latencyUs;
+    stats.bytes = m_annexB.size();
+    stats.frameType = keyFrame ? EncodeStats::FRAME_IDR : EncodeStats::FRAME_P;
+    m_listener->GetStatistics()->EncodeOutput(stats);
+}
+
+void CEncoder::OnPacketLoss() { m_scheduler.OnPacketLoss(); }
+
+void CEncoder::OnFrameLoss(uint64_t lastGoodTimestampNs) {
+    m_scheduler.OnFrameLoss(lastGoodTimestampNs);
+}
+
+void CEncoder::InsertIDR() { m_scheduler.InsertIDR(); }
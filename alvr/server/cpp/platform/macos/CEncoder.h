@@ -1,15 +1,70 @@
 #pragma once
 
+#include "alvr_server/IDRScheduler.h"
 #include "shared/threadtools.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
+#include <IOSurface/IOSurfaceRef.h>
+#include <VideoToolbox/VideoToolbox.h>
+
+class ClientConnection;
+class PoseHistory;
+
+// VideoToolbox encoder of the macOS driver. The frames come as IOSurfaces, which the hardware
+// encoder reads without a copy, and a VTCompressionSession in real time mode outputs each frame
+// before the next one is submitted. The bitstream is converted to Annex B and goes to
+// ClientConnection::SendVideo() like on the other platforms.
 class CEncoder : public CThread {
   public:
-    CEncoder() {}
-    ~CEncoder() {}
+    CEncoder(std::shared_ptr<ClientConnection> listener, std::shared_ptr<PoseHistory> poseHistory);
+    ~CEncoder();
     bool Init() override { return true; }
-    void Run() override {}
+    void Run() override;
+
+    void Stop();
+    void OnPacketLoss();
+    void OnFrameLoss(uint64_t lastGoodTimestampNs);
+    void InsertIDR();
+
+    // Called by the frame source with a BGRA or NV12 surface of the encoding size, which is
+    // retained until it is encoded. A frame still waiting for the encoder is replaced, the newest
+    // one is encoded.
+    void PresentSurface(IOSurfaceRef surface, uint64_t targetTimestampNs);
+
+  private:
+    // Submission time of a frame, given back with its output
+    struct FrameInfo {
+        uint64_t targetTimestampNs;
+        uint64_t submitUs;
+    };
+
+    void CreateSession(int32_t width, int32_t height);
+    void DestroySession();
+    void ApplyRate();
+    void Encode(IOSurfaceRef surface, uint64_t targetTimestampNs);
+    static void OnOutput(void *encoder, void *frame, OSStatus status, VTEncodeInfoFlags flags,
+                         CMSampleBufferRef sample);
+    void SendSample(const FrameInfo &info, CMSampleBufferRef sample);
+
+    std::shared_ptr<ClientConnection> m_listener;
+    std::shared_ptr<PoseHistory> m_poseHistory;
+    std::atomic_bool m_exiting{false};
+    IDRScheduler m_scheduler;
+
+    // Latest presented surface, taken by the encoder thread
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    IOSurfaceRef m_pendingSurface = nullptr;
+    uint64_t m_pendingTimestampNs = 0;
 
-    void Stop() {}
-    void OnPacketLoss() {}
-    void InsertIDR() {}
+    // Used by the encoder thread, and by VideoToolbox during the encode
+    VTCompressionSessionRef m_session = nullptr;
+    int32_t m_width = 0;
+    int32_t m_height = 0;
+    bool m_hevc = false;
+    std::vector<uint8_t> m_annexB;
 };
@@ -1,9 +1,12 @@
 #include "CEncoder.h"
 
+#include "FecCompute.h"
+#include "alvr_server/Statistics.h"
+#include "alvr_server/ThreadPolicy.h"
+
 
 		CEncoder::CEncoder()
 			: m_bExiting(false)
-			, m_targetTimestampNs(0)
 		{
 			m_encodeFinished.Set();
 		}
@@ -11,73 +14,435 @@
 		
 			CEncoder::~CEncoder()
 		{
+			m_queueMonitor.reset();
+			// The setting may have changed since the offload was installed
+			if (m_listener) {
+				m_listener->SetParityOffload(nullptr);
+			}
 			if (m_videoEncoder)
 			{
 				m_videoEncoder->Shutdown();
 				m_videoEncoder.reset();
 			}
+			if (m_fenceEvent) {
+				CloseHandle(m_fenceEvent);
+			}
 		}
 
 		void CEncoder::Initialize(std::shared_ptr<CD3DRender> d3dRender, std::shared_ptr<ClientConnection> listener) {
+			m_d3dRender = d3dRender;
+			m_listener = listener;
+			m_settingsKey = EncoderSettingsKey();
+
+			// The encoder thread keeps using the immediate context while the next frame is composed,
+			// which needs D3D to lock it around every call.
+			if (SUCCEEDED(d3dRender->GetContext()->QueryInterface(IID_PPV_ARGS(&m_multithread)))) {
+				m_multithread->SetMultithreadProtected(TRUE);
+
+				// Without a fence the encoder could block inside the lock waiting for the copy of its frame.
+				ComPtr<ID3D11Device5> device5;
+				if (SUCCEEDED(d3dRender->GetDevice()->QueryInterface(IID_PPV_ARGS(&device5)))
+					&& SUCCEEDED(d3dRender->GetContext()->QueryInterface(IID_PPV_ARGS(&m_context4)))
+					&& SUCCEEDED(device5->CreateFence(0, D3D11_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)))) {
+					m_fenceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+				}
+				else {
+					m_context4.Reset();
+				}
+			}
+			else {
+				Info("CEncoder: D3D11 multithread protection is not available, composition will wait for the encoder.\n");
+			}
+			Debug("CEncoder: Pipelined=%d Fence=%d\n", m_multithread != nullptr, m_fence != nullptr);
+
 			m_FrameRender = std::make_shared<FrameRender>(d3dRender);
 			m_FrameRender->Startup();
+			m_capture = std::make_unique<FrameCapture>(d3dRender->GetDevice(), d3dRender->GetContext(),
+				Settings::Instance().m_frameCaptureHistory);
 			uint32_t encoderWidth, encoderHeight;
 			m_FrameRender->GetEncodingResolution(&encoderWidth, &encoderHeight);
+			DXGI_FORMAT encoderFormat = m_FrameRender->GetEncodingFormat();
+
+			m_encodeRender = d3dRender;
+			int32_t encoderAdapterIndex = Settings::Instance().m_encoderAdapterIndex;
+			if (encoderAdapterIndex >= 0 && encoderAdapterIndex != Settings::Instance().m_nAdapterIndex) {
+				if (InitializeEncoderDevice(encoderAdapterIndex)) {
+					Info("CEncoder: Encoding on adapter %d.\n", encoderAdapterIndex);
+				}
+				else {
+					Warn("CEncoder: Cannot encode on adapter %d, using the rendering adapter.\n", encoderAdapterIndex);
+				}
+			}
+			else if (Settings::Instance().m_encoderDedicatedDevice) {
+				// The encoder gets GPU contexts of its own, its work is not queued behind the composition
+				if (InitializeEncoderDevice(Settings::Instance().m_nAdapterIndex)) {
+					Info("CEncoder: Encoding on a dedicated device.\n");
+				}
+				else {
+					Warn("CEncoder: Cannot create a dedicated encoder device, sharing the rendering device.\n");
+				}
+			}
+			if (m_encodeRender != d3dRender) {
+				FrameRender::SetGpuPriority(m_encodeRender->GetDevice());
+			}
+
+			if (Settings::Instance().GetLive().m_fecOnGpu && m_listener) {
+				try {
+					m_listener->SetParityOffload(std::make_shared<FecCompute>(Settings::Instance().m_nAdapterIndex));
+					Info("CEncoder: Computing the FEC parity on the GPU.\n");
+				}
+				catch (Exception e) {
+					Warn("CEncoder: Cannot compute the FEC parity on the GPU: %s\n", e.what());
+				}
+			}
+
+			if (m_fence) {
+				m_queueMonitor = std::make_unique<GpuQueueMonitor>(m_fence, [this](uint64_t latencyUs) {
+					uint64_t busyUs = m_gpuBusyUs.load(std::memory_order_relaxed);
+					if (m_listener) {
+						m_listener->GetStatistics()->GpuQueueWait(latencyUs > busyUs ? latencyUs - busyUs : 0);
+					}
+				});
+			}
+			std::shared_ptr<CD3DRender> encodeRender = m_encodeRender;
+
+			if (Settings::Instance().m_enableEncodeArbitration) {
+				m_arbiter = std::make_unique<EncodeArbiter>(Settings::Instance().m_encoderMaxSessions,
+					Settings::Instance().m_concurrentEncodes);
+			}
 
-			Exception vceException;
-			Exception nvencException;
+			// Probe the adapter vendor so the encoder of the GPU is tried first, then prefer whichever
+			// encoder worked last time for this configuration.
+			std::vector<std::string> candidates = { "VCE", "NVENC" };
+			DXGI_ADAPTER_DESC adapterDesc = {};
+			ComPtr<IDXGIDevice> dxgiDevice;
+			ComPtr<IDXGIAdapter> adapter;
+			if (SUCCEEDED(encodeRender->GetDevice()->QueryInterface(IID_PPV_ARGS(&dxgiDevice)))
+				&& SUCCEEDED(dxgiDevice->GetAdapter(&adapter))) {
+				adapter->GetDesc(&adapterDesc);
+			}
+			if (adapterDesc.VendorId == NVIDIA_VENDOR_ID) {
+				candidates = { "NVENC", "VCE" };
+			}
 #ifdef ALVR_GPL
-			Exception swException;
+			candidates.push_back("SW");
 #endif
-			try {
-				Debug("Try to use VideoEncoderVCE.\n");
-				m_videoEncoder = std::make_shared<VideoEncoderVCE>(d3dRender, listener, encoderWidth, encoderHeight);
-				m_videoEncoder->Initialize();
-				return;
+			// The client expects two streams, only NVENC can produce them
+			if (Settings::Instance().m_dualStreamEncoding) {
+				candidates = { "NVENC" };
 			}
-			catch (Exception e) {
-				vceException = e;
+			char configKey[256];
+			snprintf(configKey, sizeof(configKey), "win32 %04x:%04x codec=%d %dx%d 10bit=%d format=%d dual=%d",
+				adapterDesc.VendorId, adapterDesc.DeviceId, Settings::Instance().m_codec, encoderWidth, encoderHeight,
+				Settings::Instance().m_use10bitEncoder, encoderFormat, Settings::Instance().m_dualStreamEncoding);
+			PreferCachedEncoder(configKey, candidates);
+
+			std::string errors;
+			for (auto &candidate : candidates) {
+				try {
+					Debug("Try to use VideoEncoder%hs.\n", candidate.c_str());
+					if (candidate == "VCE") {
+						m_videoEncoder = std::make_shared<VideoEncoderVCE>(encodeRender, listener, encoderWidth, encoderHeight, encoderFormat);
+					}
+					else if (candidate == "NVENC") {
+						if (Settings::Instance().m_dualStreamEncoding) {
+							m_videoEncoder = std::make_shared<VideoEncoderDualStream>(
+								std::make_shared<VideoEncoderNVENC>(encodeRender, listener, encoderWidth, encoderHeight, encoderFormat, 0, 2),
+								std::make_shared<VideoEncoderNVENC>(encodeRender, listener, encoderWidth, encoderHeight, encoderFormat, 1, 2));
+						}
+						else {
+							m_videoEncoder = std::make_shared<VideoEncoderNVENC>(encodeRender, listener, encoderWidth, encoderHeight, encoderFormat);
+						}
+					}
+#ifdef ALVR_GPL
+					else {
+						m_videoEncoder = std::make_shared<VideoEncoderSW>(encodeRender, listener, encoderWidth, encoderHeight);
+					}
+#endif
+					m_videoEncoder->Initialize();
+					StoreCachedEncoder(configKey, candidate);
+					return;
+				}
+				catch (Exception e) {
+					errors += " " + candidate + ": " + e.what();
+				}
 			}
-			try {
-				Debug("Try to use VideoEncoderNVENC.\n");
-				m_videoEncoder = std::make_shared<VideoEncoderNVENC>(d3dRender, listener, encoderWidth, encoderHeight);
-				m_videoEncoder->Initialize();
-				return;
+			m_videoEncoder.reset();
+			throw MakeException("All VideoEncoder are not available.%hs", errors.c_str());
+		}
+
+		bool CEncoder::CopyToStaging(ID3D11Texture2D *pTexture[][2], ID3D11ShaderResourceView *pView[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering
+			, uint64_t presentationTime, uint64_t targetTimestampNs, const vr::HmdQuaternion_t &headOrientation
+			, const std::string& message, const std::string& debugText)
+		{
+			if (!m_multithread) {
+				// The encoder thread blocks on transmit which uses our shared d3d context.
+				Debug("Waiting for finish of previous encode.\n");
+				WaitForEncode();
 			}
-			catch (Exception e) {
-				nvencException = e;
+
+			m_FrameRender->Startup();
+			if (!m_stagingRing[0].texture) {
+				InitializeStagingRing(m_FrameRender->GetTexture().Get());
 			}
-#ifdef ALVR_GPL
+
+			int slot;
+			{
+				// Any slot the encoder is not reading or about to read. A frame still pending when this one
+				// is published is dropped.
+				std::unique_lock<std::mutex> lock(m_slotMutex);
+				for (slot = 0; slot < STAGING_RING_SIZE; slot++) {
+					if (slot != m_encodingSlot && slot != m_pendingSlot) {
+						break;
+					}
+				}
+			}
+
+			if (m_multithread) {
+				m_multithread->Enter();
+			}
+			float contentScale = m_listener ? m_listener->m_resolutionController.BeginFrame(targetTimestampNs) : 1.f;
+			FoveationCenter center = m_listener && m_FrameRender->FollowsFoveationCenter(layerCount, recentering)
+				? m_listener->m_foveationController.BeginFrame(targetTimestampNs) : StaticFoveationCenter();
+			m_capture->BeginFrame(pTexture, layerCount);
+			m_FrameRender->RenderFrame(pTexture, pView, bounds, layerCount, recentering, message, debugText, contentScale, center);
+			m_capture->EndFrame(m_FrameRender->GetTexture().Get());
+
+			StagingSlot &staging = m_stagingRing[slot];
+			m_d3dRender->GetContext()->CopyResource(staging.texture.Get(), m_FrameRender->GetTexture().Get());
+
+			GpuProfiler *profiler = m_FrameRender->GetProfiler();
+			profiler->EndPass(GpuProfiler::PASS_ENCODER_COPY);
+			profiler->EndFrame();
+			double passMs[GpuProfiler::PASS_COUNT];
+			if (profiler->Collect(passMs)) {
+				double busyMs = 0;
+				for (double ms : passMs) {
+					busyMs += ms;
+				}
+				m_gpuBusyUs.store((uint64_t)(busyMs * 1000), std::memory_order_relaxed);
+				if (m_listener) {
+					m_listener->GetStatistics()->GpuPassTimes(passMs[GpuProfiler::PASS_COMPOSITION], passMs[GpuProfiler::PASS_COLOR_CORRECTION],
+						passMs[GpuProfiler::PASS_FFR], passMs[GpuProfiler::PASS_ENCODER_COPY]);
+				}
+			}
+			if (m_fence) {
+				staging.fenceValue = ++m_lastFenceValue;
+				m_context4->Signal(m_fence.Get(), staging.fenceValue);
+				// The other device only sees the signal once it is submitted, and the queue wait is
+				// measured from the submission
+				m_d3dRender->GetContext()->Flush();
+				m_queueMonitor->Submitted(staging.fenceValue);
+			}
+			if (m_multithread) {
+				m_multithread->Leave();
+			}
+
+			staging.presentationTime = presentationTime;
+			staging.targetTimestampNs = targetTimestampNs;
+			staging.headOrientation = headOrientation;
+			staging.deadlineUs = GetCounterUs() + 1000000 / Settings::Instance().m_refreshRate;
+			if (m_listener) {
+				m_listener->m_frameTrace.Record(targetTimestampNs, FrameTrace::PRESENT, presentationTime);
+			}
+
+			std::unique_lock<std::mutex> lock(m_slotMutex);
+			m_writeSlot = slot;
+			return true;
+		}
+
+		bool CEncoder::MatchesSettings()
+		{
+			return m_videoEncoder && m_settingsKey == EncoderSettingsKey();
+		}
+
+		std::string CEncoder::EncoderSettingsKey()
+		{
+			// Everything that decides the encoding resolution, format or session, the bitrate is
+			// reconfigured on the fly.
+			auto &settings = Settings::Instance();
+			char key[256];
+			snprintf(key, sizeof(key), "%d %d dedicated=%d codec=%d %ux%u 10bit=%d dual=%d ffr=%d %f %f %f %f %f %f",
+				settings.m_nAdapterIndex, settings.m_encoderAdapterIndex, settings.m_encoderDedicatedDevice, settings.m_codec,
+				settings.m_renderWidth, settings.m_renderHeight, settings.m_use10bitEncoder, settings.m_dualStreamEncoding,
+				settings.m_enableFoveatedRendering, settings.m_foveationCenterSizeX, settings.m_foveationCenterSizeY,
+				settings.m_foveationCenterShiftX, settings.m_foveationCenterShiftY,
+				settings.m_foveationEdgeRatioX, settings.m_foveationEdgeRatioY);
+			return key;
+		}
+
+		bool CEncoder::InitializeEncoderDevice(int32_t adapterIndex)
+		{
+			bool crossAdapter = adapterIndex != Settings::Instance().m_nAdapterIndex;
+
+			// The frames are handed over with shared textures and a shared fence, which needs the
+			// pipelined mode.
+			if (!m_fence) {
+				return false;
+			}
+
+			auto encodeRender = std::make_shared<CD3DRender>();
+			if (!encodeRender->Initialize(adapterIndex)) {
+				return false;
+			}
+
+			ComPtr<ID3D11Device5> renderDevice5;
+			ComPtr<ID3D11Device5> encodeDevice5;
+			ComPtr<ID3D11DeviceContext4> encodeContext4;
+			ComPtr<ID3D11Fence> fence;
+			ComPtr<ID3D11Fence> encoderFence;
+			HANDLE fenceHandle = NULL;
+			if (FAILED(m_d3dRender->GetDevice()->QueryInterface(IID_PPV_ARGS(&renderDevice5)))
+				|| FAILED(encodeRender->GetDevice()->QueryInterface(IID_PPV_ARGS(&encodeDevice5)))
+				|| FAILED(encodeRender->GetContext()->QueryInterface(IID_PPV_ARGS(&encodeContext4)))
+				|| FAILED(renderDevice5->CreateFence(0, D3D11_FENCE_FLAG_SHARED | (crossAdapter ? D3D11_FENCE_FLAG_SHARED_CROSS_ADAPTER : 0), IID_PPV_ARGS(&fence)))
+				|| FAILED(fence->CreateSharedHandle(NULL, GENERIC_ALL, NULL, &fenceHandle))) {
+				Warn("CEncoder: Failed to create the encoder fence.\n");
+				return false;
+			}
+			HRESULT hr = encodeDevice5->OpenSharedFence(fenceHandle, IID_PPV_ARGS(&encoderFence));
+			CloseHandle(fenceHandle);
+			if (FAILED(hr)) {
+				Warn("CEncoder: Failed to open the encoder fence. %p %ls\n", hr, GetErrorStr(hr).c_str());
+				return false;
+			}
+
+			m_encodeRender = encodeRender;
+
+			// On the same adapter, the YUV conversion runs on the GPU context of the encoder, where
+			// it overlaps the composition of the next frame instead of being queued behind it. Across
+			// adapters the smaller YUV frames are the ones worth copying.
+			ComPtr<ID3D11Texture2D> conversionInput = m_FrameRender->GetConversionInput();
+			if (!crossAdapter && conversionInput) {
+				try {
+					InitializeStagingRing(conversionInput.Get());
+					bool tenBit = m_FrameRender->GetEncodingFormat() == DXGI_FORMAT_P010;
+					for (auto &staging : m_stagingRing) {
+						staging.converter = std::make_unique<Nv12Converter>(encodeRender->GetDevice(), encodeRender->GetContext(), tenBit);
+						staging.converter->Initialize(staging.encoderTexture.Get());
+					}
+					m_FrameRender->OffloadConversion();
+					Info("CEncoder: Converting the frames on the encoder device.\n");
+				}
+				catch (Exception e) {
+					Warn("CEncoder: Cannot convert the frames on the encoder device: %s\n", e.what());
+					ResetStagingRing();
+				}
+			}
+
 			try {
-				Debug("Try to use VideoEncoderSW.\n");
-				m_videoEncoder = std::make_shared<VideoEncoderSW>(d3dRender, listener, encoderWidth, encoderHeight);
-				m_videoEncoder->Initialize();
-				return;
+				if (!m_stagingRing[0].texture) {
+					InitializeStagingRing(m_FrameRender->GetTexture().Get());
+				}
 			}
 			catch (Exception e) {
-				swException = e;
+				Warn("CEncoder: %s\n", e.what());
+				m_encodeRender = m_d3dRender;
+				ResetStagingRing();
+				return false;
 			}
-			throw MakeException("All VideoEncoder are not available. VCE: %s, NVENC: %s, SW: %s", vceException.what(), nvencException.what(), swException.what());
-#else
-			throw MakeException("All VideoEncoder are not available. VCE: %s, NVENC: %s", vceException.what(), nvencException.what());
-#endif
+
+			m_fence = fence;
+			m_lastFenceValue = 0;
+			m_encoderFence = encoderFence;
+			m_encoderContext4 = encodeContext4;
+			return true;
 		}
 
-		bool CEncoder::CopyToStaging(ID3D11Texture2D *pTexture[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering
-			, uint64_t presentationTime, uint64_t targetTimestampNs, const std::string& message, const std::string& debugText)
+		void CEncoder::InitializeStagingRing(ID3D11Texture2D *composedTexture)
 		{
-			m_presentationTime = presentationTime;
-			m_targetTimestampNs = targetTimestampNs;
-			m_FrameRender->Startup();
+			D3D11_TEXTURE2D_DESC desc;
+			composedTexture->GetDesc(&desc);
+			// The encoders take these textures as input directly, which they only accept with a UNORM
+			// format. CopyResource keeps the bits as they are.
+			if (desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB) {
+				desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			}
+			// YUV render targets are optional, the converter output flags are known to be supported.
+			if (desc.Format != DXGI_FORMAT_NV12 && desc.Format != DXGI_FORMAT_P010) {
+				desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+			}
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+			// Textures of another device are shared
+			bool sharedTextures = m_encodeRender != m_d3dRender;
+			if (sharedTextures) {
+				desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE;
+			}
 
-			m_FrameRender->RenderFrame(pTexture, bounds, layerCount, recentering, message, debugText);
-			return true;
+			ComPtr<ID3D11Device1> encodeDevice1;
+			if (sharedTextures) {
+				HRESULT hr = m_encodeRender->GetDevice()->QueryInterface(IID_PPV_ARGS(&encodeDevice1));
+				if (FAILED(hr)) {
+					throw MakeException("Failed to query ID3D11Device1 of the encoder. %p %ls", hr, GetErrorStr(hr).c_str());
+				}
+			}
+
+			for (auto &staging : m_stagingRing) {
+				HRESULT hr = m_d3dRender->GetDevice()->CreateTexture2D(&desc, NULL, &staging.texture);
+				if (FAILED(hr)) {
+					throw MakeException("Failed to create staging ring texture. %p %ls", hr, GetErrorStr(hr).c_str());
+				}
+				if (!sharedTextures) {
+					staging.encoderTexture = staging.texture;
+					continue;
+				}
+
+				ComPtr<IDXGIResource1> resource;
+				HANDLE handle = NULL;
+				hr = staging.texture.As(&resource);
+				if (SUCCEEDED(hr)) {
+					hr = resource->CreateSharedHandle(NULL, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, NULL, &handle);
+				}
+				if (FAILED(hr)) {
+					throw MakeException("Failed to share staging ring texture. %p %ls", hr, GetErrorStr(hr).c_str());
+				}
+				hr = encodeDevice1->OpenSharedResource1(handle, IID_PPV_ARGS(&staging.encoderTexture));
+				CloseHandle(handle);
+				if (FAILED(hr)) {
+					throw MakeException("Failed to open staging ring texture on the encoder adapter. %p %ls", hr, GetErrorStr(hr).c_str());
+				}
+			}
+		}
+
+		void CEncoder::ResetStagingRing()
+		{
+			for (auto &staging : m_stagingRing) {
+				staging.texture.Reset();
+				staging.encoderTexture.Reset();
+				staging.converter.reset();
+			}
+		}
+
+		int CEncoder::TakePendingSlot()
+		{
+			std::unique_lock<std::mutex> lock(m_slotMutex);
+			m_encodingSlot = m_pendingSlot;
+			m_pendingSlot = -1;
+			return m_encodingSlot;
+		}
+
+		void CEncoder::WaitForSlot(int slot)
+		{
+			uint64_t value = m_stagingRing[slot].fenceValue;
+			if (m_encoderFence) {
+				// Queued on the encoder device, its commands for this frame start after the copy
+				m_encoderContext4->Wait(m_encoderFence.Get(), value);
+				return;
+			}
+
+			// Wait outside of the D3D lock so the compositor is not held up meanwhile.
+			if (m_fence && m_fence->GetCompletedValue() < value) {
+				if (SUCCEEDED(m_fence->SetEventOnCompletion(value, m_fenceEvent))) {
+					WaitForSingleObject(m_fenceEvent, INFINITE);
+				}
+			}
 		}
 
 		void CEncoder::Run()
 		{
 			Debug("CEncoder: Start thread. Id=%d\n", GetCurrentThreadId());
-			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_MOST_URGENT);
+			ApplyThreadPolicy(THREAD_ROLE_ENCODER, "CEncoder");
 
 			while (!m_bExiting)
 			{
@@ -87,11 +452,64 @@
 				if (m_bExiting)
 					break;
 
-				if (m_FrameRender->GetTexture())
+				int slot = TakePendingSlot();
+				// A frame that would be displayed too late leaves the encoder to the next one
+				if (slot >= 0 && m_listener && m_deadlineScheduler.Check(*m_listener, m_stagingRing[slot].targetTimestampNs,
+					m_scheduler.IsRecoveryPending()) != DeadlineScheduler::ENCODE) {
+					slot = -1;
+				}
+				if (slot >= 0 && m_listener) {
+					switch (m_listener->m_idleController.CheckFrame()) {
+					case IdleController::SKIP:
+						slot = -1;
+						break;
+					case IdleController::RESUME:
+						m_scheduler.InsertIDR();
+						break;
+					default:
+						break;
+					}
+				}
+				if (slot >= 0)
 				{
-					m_videoEncoder->Transmit(m_FrameRender->GetTexture().Get(), m_presentationTime, m_targetTimestampNs, m_scheduler.CheckIDRInsertion());
+					WaitForSlot(slot);
+
+					uint64_t lastGoodTimestampNs;
+					if (m_scheduler.CheckInvalidation(&lastGoodTimestampNs) && !m_videoEncoder->InvalidateReferences(lastGoodTimestampNs)) {
+						m_scheduler.OnPacketLoss();
+					}
+					bool insertIDR = m_scheduler.CheckIDRInsertion();
+					if (m_scheduler.CheckRefreshInsertion() && !m_videoEncoder->StartIntraRefresh()) {
+						insertIDR = true;
+					}
+					if (m_listener && m_listener->GetStatistics()->CheckBitrateUpdated()) {
+						m_videoEncoder->Reconfigure(m_listener->GetStatistics()->GetEncoderRate());
+					}
+					const StagingSlot &staging = m_stagingRing[slot];
+					m_videoEncoder->SetHeadRotation(m_lastHeadOrientation, staging.headOrientation);
+					m_lastHeadOrientation = staging.headOrientation;
+					if (m_arbiter) {
+						uint64_t waitUs = m_arbiter->Acquire(staging.deadlineUs);
+						if (waitUs > 0) {
+							Debug("CEncoder: Waited %lluus for the shared encoder.\n", waitUs);
+						}
+					}
+					ID3D11Texture2D *encoderInput = staging.encoderTexture.Get();
+					if (staging.converter) {
+						// Queued after the wait for the copy of the frame
+						staging.converter->Convert();
+						encoderInput = staging.converter->GetOutputTexture();
+					}
+					m_videoEncoder->Transmit(encoderInput, staging.presentationTime, staging.targetTimestampNs, insertIDR);
+					if (m_arbiter) {
+						m_arbiter->Release();
+					}
 				}
 
+				{
+					std::unique_lock<std::mutex> lock(m_slotMutex);
+					m_encodingSlot = -1;
+				}
 				m_encodeFinished.Set();
 			}
 		}
@@ -107,6 +525,14 @@
 		void CEncoder::NewFrameReady()
 		{
 			Debug("New Frame Ready\n");
+			{
+				std::unique_lock<std::mutex> lock(m_slotMutex);
+				if (m_writeSlot < 0) {
+					return;
+				}
+				m_pendingSlot = m_writeSlot;
+				m_writeSlot = -1;
+			}
 			m_encodeFinished.Reset();
 			m_newFrameReady.Set();
 		}
@@ -124,6 +550,18 @@
 			m_scheduler.OnPacketLoss();
 		}
 
+		void CEncoder::OnFrameLoss(uint64_t lastGoodTimestampNs) {
+			m_scheduler.OnFrameLoss(lastGoodTimestampNs);
+		}
+
 		void CEncoder::InsertIDR() {
 			m_scheduler.InsertIDR();
+		}
+
+		bool CEncoder::IsRecoveryPending() {
+			return m_scheduler.IsRecoveryPending();
+		}
+
+		void CEncoder::CaptureFrames(const std::string &directory) {
+			m_capture->Request(directory);
 		}
\ No newline at end of file
@@ -5,20 +5,30 @@
 
 #include <d3d11.h>
 #include <wrl.h>
+#include <atomic>
 #include <map>
 #include <d3d11_1.h>
+#include <d3d11_4.h>
+#include <dxgi1_2.h>
+#include <mutex>
 #include <wincodec.h>
 #include <wincodecsdk.h>
 #include "alvr_server/ClientConnection.h"
 #include "alvr_server/Utils.h"
+#include "EncodeArbiter.h"
+#include "FrameCapture.h"
 #include "FrameRender.h"
+#include "GpuQueueMonitor.h"
 #include "VideoEncoder.h"
 #include "VideoEncoderNVENC.h"
+#include "VideoEncoderDualStream.h"
 #include "VideoEncoderVCE.h"
 #ifdef ALVR_GPL
 	#include "VideoEncoderSW.h"
 #endif
+#include "alvr_server/DeadlineScheduler.h"
 #include "alvr_server/IDRScheduler.h"
+#include "alvr_server/EncoderCache.h"
 
 
 	using Microsoft::WRL::ComPtr;
@@ -27,6 +37,10 @@
 	// Blocks on reading backbuffer from gpu, so WaitForPresent can return
 	// as soon as we know rendering made it this frame.  This step of the pipeline
 	// should run about 3ms per frame.
+	//
+	// Composed frames are copied into a ring of textures so the compositor can
+	// work on the next frame while the previous one is encoded. If the device
+	// cannot be shared between threads, composition waits for the encoder.
 	//----------------------------------------------------------------------------
 	class CEncoder : public CThread
 	{
@@ -36,8 +50,12 @@
 
 		void Initialize(std::shared_ptr<CD3DRender> d3dRender, std::shared_ptr<ClientConnection> listener);
 
-		bool CopyToStaging(ID3D11Texture2D *pTexture[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering
-			, uint64_t presentationTime, uint64_t targetTimestampNs, const std::string& message, const std::string& debugText);
+		// Whether the encoder was initialized for the encoding settings currently loaded
+		bool MatchesSettings();
+
+		bool CopyToStaging(ID3D11Texture2D *pTexture[][2], ID3D11ShaderResourceView *pView[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering
+			, uint64_t presentationTime, uint64_t targetTimestampNs, const vr::HmdQuaternion_t &headOrientation
+			, const std::string& message, const std::string& debugText);
 
 		virtual void Run();
 
@@ -51,17 +69,84 @@
 
 		void OnPacketLoss();
 
+		void OnFrameLoss(uint64_t lastGoodTimestampNs);
+
 		void InsertIDR();
 
+		bool IsRecoveryPending();
+
+		// Writes the layers and the composed output of the next frame to directory, see FrameCapture
+		void CaptureFrames(const std::string &directory);
+
 	private:
+		// A device of its own for the encoder, on adapterIndex
+		bool InitializeEncoderDevice(int32_t adapterIndex);
+		void InitializeStagingRing(ID3D11Texture2D *composedTexture);
+		void ResetStagingRing();
+		static std::string EncoderSettingsKey();
+		int TakePendingSlot();
+		void WaitForSlot(int slot);
+
+		static const UINT NVIDIA_VENDOR_ID = 0x10DE;
+
+		// One frame being composed, one waiting for the encoder and one being encoded.
+		static const int STAGING_RING_SIZE = 3;
+
+		struct StagingSlot {
+			ComPtr<ID3D11Texture2D> texture;
+			// texture opened on the encoder device, texture itself if both are the same
+			ComPtr<ID3D11Texture2D> encoderTexture;
+			// Converts encoderTexture to YUV on the encoder device, if FrameRender offloaded it
+			std::unique_ptr<Nv12Converter> converter;
+			uint64_t presentationTime = 0;
+			uint64_t targetTimestampNs = 0;
+			// Head orientation the frame was rendered with, zero if unknown
+			vr::HmdQuaternion_t headOrientation = {};
+			// Fence value signaled once the copy into texture is complete on the GPU
+			uint64_t fenceValue = 0;
+			// One frame interval after the composition, GetCounterUs()
+			uint64_t deadlineUs = 0;
+		};
+
 		CThreadEvent m_newFrameReady, m_encodeFinished;
 		std::shared_ptr<VideoEncoder> m_videoEncoder;
 		bool m_bExiting;
-		uint64_t m_presentationTime;
-		uint64_t m_targetTimestampNs;
+
+		std::shared_ptr<CD3DRender> m_d3dRender;
+		// Device of the video encoder, m_d3dRender unless encoding on another adapter or on a
+		// dedicated device
+		std::shared_ptr<CD3DRender> m_encodeRender;
+		// m_fence opened on the encoder device, the encoder waits on the GPU for the copy
+		ComPtr<ID3D11Fence> m_encoderFence;
+		ComPtr<ID3D11DeviceContext4> m_encoderContext4;
+		std::shared_ptr<ClientConnection> m_listener;
+		// Serializes the compositor and the encoder on the immediate context
+		ComPtr<ID3D11Multithread> m_multithread;
+		ComPtr<ID3D11Fence> m_fence;
+		ComPtr<ID3D11DeviceContext4> m_context4;
+		HANDLE m_fenceEvent = NULL;
+		uint64_t m_lastFenceValue = 0;
+		// Watches m_fence, with the GPU time of the latest profiled frame in us
+		std::unique_ptr<GpuQueueMonitor> m_queueMonitor;
+		std::atomic<uint64_t> m_gpuBusyUs{ 0 };
+
+		StagingSlot m_stagingRing[STAGING_RING_SIZE];
+		std::mutex m_slotMutex;
+		int m_writeSlot = -1;
+		int m_pendingSlot = -1;
+		int m_encodingSlot = -1;
 
 		std::shared_ptr<FrameRender> m_FrameRender;
+		std::unique_ptr<FrameCapture> m_capture;
+		// Set if the encoder is shared with the servers of other SteamVR instances
+		std::unique_ptr<EncodeArbiter> m_arbiter;
 
 		IDRScheduler m_scheduler;
+		DeadlineScheduler m_deadlineScheduler;
+		// Of the last frame given to the encoder, the reference of the next one
+		vr::HmdQuaternion_t m_lastHeadOrientation = {};
+
+		// EncoderSettingsKey() at Initialize
+		std::string m_settingsKey;
 	};
 
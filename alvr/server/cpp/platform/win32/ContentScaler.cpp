@@ -0,0 +1,90 @@
+#include "ContentScaler.h"
+
+#include <d3dcompiler.h>
+
+#include "alvr_server/bindings.h"
+
+#pragma comment(lib, "d3dcompiler.lib")
+
+using Microsoft::WRL::ComPtr;
+using namespace d3d_render_utils;
+
+ContentScaler::ContentScaler(ID3D11Device *device, ID3D11DeviceContext *context)
+	: mDevice(device)
+	, mContext(context)
+{}
+
+void ContentScaler::Initialize(ID3D11Texture2D *inputTexture)
+{
+	ComPtr<ID3DBlob> shaderBlob;
+	ComPtr<ID3DBlob> errorBlob;
+	HRESULT hr = D3DCompile(CONTENT_SCALE_CS_HLSL_PTR, CONTENT_SCALE_CS_HLSL_LEN, "ContentScaleComputeShader.hlsl",
+		nullptr, nullptr, "main", "cs_5_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &shaderBlob, &errorBlob);
+	if (FAILED(hr)) {
+		throw MakeException("Failed to compile content scale shader. HR=%p %hs", hr,
+			errorBlob ? (const char *)errorBlob->GetBufferPointer() : "");
+	}
+	OK_OR_THROW(mDevice->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &mComputeShader),
+		L"Failed to create content scale shader.");
+
+	D3D11_SAMPLER_DESC sampDesc = {};
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	OK_OR_THROW(mDevice->CreateSamplerState(&sampDesc, &mSampler), L"Failed to create content scale sampler.");
+
+	D3D11_TEXTURE2D_DESC inputDesc;
+	inputTexture->GetDesc(&inputDesc);
+	mInputTexture = inputTexture;
+	OK_OR_THROW(mDevice->CreateShaderResourceView(inputTexture, nullptr, &mInputView), L"Failed to create content scale input view.");
+
+	// UNORM because sRGB formats cannot be bound as UAV, the bytes are the same for the full scale copy
+	D3D11_TEXTURE2D_DESC outputDesc = {};
+	outputDesc.Width = inputDesc.Width;
+	outputDesc.Height = inputDesc.Height;
+	outputDesc.MipLevels = 1;
+	outputDesc.ArraySize = 1;
+	outputDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	outputDesc.SampleDesc.Count = 1;
+	outputDesc.Usage = D3D11_USAGE_DEFAULT;
+	outputDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	OK_OR_THROW(mDevice->CreateTexture2D(&outputDesc, nullptr, &mOutputTexture), L"Failed to create content scale texture.");
+	OK_OR_THROW(mDevice->CreateUnorderedAccessView(mOutputTexture.Get(), nullptr, &mOutputView), L"Failed to create content scale output view.");
+
+	mParams = { { inputDesc.Width, inputDesc.Height }, 1.f, inputDesc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB };
+	mParamsBuffer.Attach(CreateBuffer(mDevice.Get(), mParams, D3D11_USAGE_DEFAULT));
+}
+
+void ContentScaler::Render(float scale)
+{
+	if (scale >= 1.f) {
+		mContext->CopyResource(mOutputTexture.Get(), mInputTexture.Get());
+		return;
+	}
+
+	if (mParams.scale != scale) {
+		mParams.scale = scale;
+		UpdateBuffer(mContext.Get(), mParamsBuffer.Get(), &mParams);
+	}
+
+	mContext->CSSetShader(mComputeShader.Get(), nullptr, 0);
+	mContext->CSSetConstantBuffers(0, 1, mParamsBuffer.GetAddressOf());
+	mContext->CSSetShaderResources(0, 1, mInputView.GetAddressOf());
+	mContext->CSSetSamplers(0, 1, mSampler.GetAddressOf());
+	mContext->CSSetUnorderedAccessViews(0, 1, mOutputView.GetAddressOf(), nullptr);
+
+	mContext->Dispatch((mParams.frameSize[0] + 7) / 8, (mParams.frameSize[1] + 7) / 8, 1);
+
+	ID3D11ShaderResourceView *nullInput = nullptr;
+	ID3D11UnorderedAccessView *nullOutput = nullptr;
+	mContext->CSSetShaderResources(0, 1, &nullInput);
+	mContext->CSSetUnorderedAccessViews(0, 1, &nullOutput, nullptr);
+}
+
+ID3D11Texture2D *ContentScaler::GetOutputTexture()
+{
+	return mOutputTexture.Get();
+}
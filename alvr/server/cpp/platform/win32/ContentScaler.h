@@ -0,0 +1,35 @@
+#pragma once
+
+#include "d3d-render-utils/RenderUtils.h"
+
+// Draws each eye of the output of FrameRender scaled into the top left corner of its half with a
+// compute pass, for dynamic resolution. The frame keeps its size so the encoder is not recreated.
+// At full scale the frame is copied as is.
+class ContentScaler
+{
+public:
+	ContentScaler(ID3D11Device *device, ID3D11DeviceContext *context);
+	void Initialize(ID3D11Texture2D *inputTexture);
+	// scale in (0, 1]
+	void Render(float scale);
+	ID3D11Texture2D *GetOutputTexture();
+
+private:
+	struct ScaleParams {
+		uint32_t frameSize[2];
+		float scale;
+		uint32_t srgbInput;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D11Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> mContext;
+	Microsoft::WRL::ComPtr<ID3D11ComputeShader> mComputeShader;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mParamsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> mSampler;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> mInputTexture;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mInputView;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> mOutputTexture;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> mOutputView;
+
+	ScaleParams mParams = {};
+};
@@ -0,0 +1,208 @@
+#include "EncodeArbiter.h"
+
+#include "alvr_server/Logger.h"
+#include "alvr_server/Utils.h"
+
+// Per logon session, the SteamVR instances of a render server run as the same user
+static const wchar_t *TABLE_NAME = L"Local\\ALVR_EncodeArbiter";
+static const wchar_t *MUTEX_NAME = L"Local\\ALVR_EncodeArbiterMutex";
+// A server that waits or encodes refreshes its entry at least this often
+static const uint64_t STALE_ENTRY_US = 500 * 1000;
+// Wakeups can be missed when the server that should send them hangs
+static const DWORD WAIT_SLICE_MS = 2;
+
+static bool IsProcessAlive(DWORD processId)
+{
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processId);
+	if (!process) {
+		// Exited, or of another user, which cannot be in the table of this logon session
+		return GetLastError() == ERROR_ACCESS_DENIED;
+	}
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+}
+
+EncodeArbiter::EncodeArbiter(uint32_t maxSessions, uint32_t concurrentEncodes)
+	: m_concurrentEncodes(concurrentEncodes)
+{
+	m_mutex = CreateMutexW(NULL, FALSE, MUTEX_NAME);
+	// Zeroed when created, all the entries are free
+	m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedTable), TABLE_NAME);
+	if (m_mapping) {
+		m_table = (SharedTable *)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedTable));
+	}
+	if (!m_mutex || !m_table) {
+		Warn("EncodeArbiter: Cannot open the shared table (%d), encoding without arbitration.\n", GetLastError());
+		return;
+	}
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		wchar_t eventName[64];
+		swprintf_s(eventName, L"Local\\ALVR_EncodeArbiter_%d", i);
+		m_events[i] = CreateEventW(NULL, FALSE, FALSE, eventName);
+	}
+
+	Lock();
+	uint32_t sessions = 0;
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		Entry &entry = m_table->entries[i];
+		if (entry.state != ENTRY_FREE && !IsProcessAlive(entry.processId)) {
+			entry.state = ENTRY_FREE;
+		}
+		if (entry.state != ENTRY_FREE) {
+			sessions++;
+		}
+		else if (m_index < 0) {
+			m_index = i;
+		}
+	}
+	if (sessions >= maxSessions || m_index < 0) {
+		Unlock();
+		m_index = -1;
+		Close();
+		throw MakeException("The %d encoder sessions of this machine are in use.", sessions);
+	}
+	Entry &entry = m_table->entries[m_index];
+	entry.processId = GetCurrentProcessId();
+	entry.state = ENTRY_IDLE;
+	entry.deadlineUs = 0;
+	entry.updateUs = GetCounterUs();
+	Unlock();
+
+	Info("EncodeArbiter: Encoder session %d of %d, %d concurrent encodes.\n", sessions + 1, maxSessions, concurrentEncodes);
+}
+
+EncodeArbiter::~EncodeArbiter()
+{
+	if (m_table && m_index >= 0) {
+		Lock();
+		m_table->entries[m_index].state = ENTRY_FREE;
+		WakeNext();
+		Unlock();
+	}
+	Close();
+}
+
+void EncodeArbiter::Close()
+{
+	for (HANDLE event : m_events) {
+		if (event) {
+			CloseHandle(event);
+		}
+	}
+	if (m_table) {
+		UnmapViewOfFile(m_table);
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+	}
+	if (m_mutex) {
+		CloseHandle(m_mutex);
+	}
+}
+
+uint64_t EncodeArbiter::Acquire(uint64_t deadlineUs)
+{
+	if (!m_table || m_index < 0) {
+		return 0;
+	}
+
+	uint64_t startUs = GetCounterUs();
+	Entry &entry = m_table->entries[m_index];
+
+	Lock();
+	while (true) {
+		uint64_t nowUs = GetCounterUs();
+		ReclaimStale(nowUs);
+
+		entry.deadlineUs = deadlineUs;
+		entry.updateUs = nowUs;
+		if (CanEncode()) {
+			entry.state = ENTRY_ENCODING;
+			// Another encode can start alongside
+			WakeNext();
+			Unlock();
+			return nowUs - startUs;
+		}
+		entry.state = ENTRY_WAITING;
+		Unlock();
+
+		WaitForSingleObject(m_events[m_index], WAIT_SLICE_MS);
+		Lock();
+	}
+}
+
+void EncodeArbiter::Release()
+{
+	if (!m_table || m_index < 0) {
+		return;
+	}
+
+	Lock();
+	Entry &entry = m_table->entries[m_index];
+	entry.state = ENTRY_IDLE;
+	entry.updateUs = GetCounterUs();
+	WakeNext();
+	Unlock();
+}
+
+void EncodeArbiter::ReclaimStale(uint64_t nowUs)
+{
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		Entry &entry = m_table->entries[i];
+		if ((entry.state == ENTRY_WAITING || entry.state == ENTRY_ENCODING) && nowUs > entry.updateUs + STALE_ENTRY_US) {
+			Warn("EncodeArbiter: Server %d stopped responding.\n", entry.processId);
+			entry.state = ENTRY_IDLE;
+		}
+	}
+}
+
+bool EncodeArbiter::CanEncode()
+{
+	const Entry &own = m_table->entries[m_index];
+
+	uint32_t encoding = 0;
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		const Entry &entry = m_table->entries[i];
+		if (entry.state == ENTRY_ENCODING) {
+			encoding++;
+		}
+		// Earliest deadline first, ties by entry
+		else if (i != m_index && entry.state == ENTRY_WAITING
+			&& (entry.deadlineUs < own.deadlineUs || (entry.deadlineUs == own.deadlineUs && i < m_index))) {
+			return false;
+		}
+	}
+
+	return encoding < m_concurrentEncodes;
+}
+
+void EncodeArbiter::WakeNext()
+{
+	uint32_t encoding = 0;
+	int next = -1;
+	for (int i = 0; i < MAX_ENTRIES; i++) {
+		const Entry &entry = m_table->entries[i];
+		if (entry.state == ENTRY_ENCODING) {
+			encoding++;
+		}
+		else if (entry.state == ENTRY_WAITING && (next < 0 || entry.deadlineUs < m_table->entries[next].deadlineUs)) {
+			next = i;
+		}
+	}
+
+	if (next >= 0 && encoding < m_concurrentEncodes && m_events[next]) {
+		SetEvent(m_events[next]);
+	}
+}
+
+void EncodeArbiter::Lock()
+{
+	// WAIT_ABANDONED when the owner exited while holding it, the table is still usable
+	WaitForSingleObject(m_mutex, INFINITE);
+}
+
+void EncodeArbiter::Unlock()
+{
+	ReleaseMutex(m_mutex);
+}
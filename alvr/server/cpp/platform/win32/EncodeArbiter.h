@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <windows.h>
+
+// Shares the hardware encoder between the ALVR servers of the SteamVR instances running on the
+// machine. The servers register in a table in named shared memory: a session is refused once
+// maxSessions are registered, instead of failing in the driver of the encoder. Each frame is then
+// encoded only when fewer than concurrentEncodes frames are being encoded and no other server
+// waits with an earlier deadline. The server that finishes wakes the next one by its event.
+//
+// Entries of servers that exited or stopped encoding for a while are reclaimed, a crashed server
+// cannot block the others.
+class EncodeArbiter
+{
+public:
+	// Throws if the session limit is reached
+	EncodeArbiter(uint32_t maxSessions, uint32_t concurrentEncodes);
+	~EncodeArbiter();
+
+	// Before encoding a frame, deadlineUs is on the GetCounterUs() clock, which is the same for
+	// all the processes. Returns the time waited in us.
+	uint64_t Acquire(uint64_t deadlineUs);
+	void Release();
+
+private:
+	static const int MAX_ENTRIES = 16;
+
+	enum EntryState : uint32_t {
+		ENTRY_FREE,
+		ENTRY_IDLE,
+		ENTRY_WAITING,
+		ENTRY_ENCODING,
+	};
+
+	struct Entry {
+		DWORD processId;
+		EntryState state;
+		uint64_t deadlineUs;
+		// Last change of state, GetCounterUs()
+		uint64_t updateUs;
+	};
+
+	struct SharedTable {
+		Entry entries[MAX_ENTRIES];
+	};
+
+	// With the table locked
+	void ReclaimStale(uint64_t nowUs);
+	bool CanEncode();
+	void WakeNext();
+	void Lock();
+	void Unlock();
+	void Close();
+
+	uint32_t m_concurrentEncodes;
+	HANDLE m_mapping = NULL;
+	HANDLE m_mutex = NULL;
+	SharedTable *m_table = nullptr;
+	int m_index = -1;
+	HANDLE m_events[MAX_ENTRIES] = {};
+};
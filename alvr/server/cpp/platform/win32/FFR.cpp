@@ -1,5 +1,6 @@
 #include "FFR.h"
 
+#include "alvr_server/FoveationVars.h"
 #include "alvr_server/Settings.h"
 #include "alvr_server/Utils.h"
 #include "alvr_server/bindings.h"
@@ -7,68 +8,6 @@
 using Microsoft::WRL::ComPtr;
 using namespace d3d_render_utils;
 
-namespace {
-
-	struct FoveationVars {
-		uint32_t targetEyeWidth;
-		uint32_t targetEyeHeight;
-		uint32_t optimizedEyeWidth;
-		uint32_t optimizedEyeHeight;
-
-		float eyeWidthRatio;
-		float eyeHeightRatio;
-
-		float centerSizeX;
-		float centerSizeY;
-		float centerShiftX;
-		float centerShiftY;
-		float edgeRatioX;
-		float edgeRatioY;
-	};
-
-	FoveationVars CalculateFoveationVars() {
-		float targetEyeWidth = (float)Settings::Instance().m_renderWidth / 2;
-		float targetEyeHeight = (float)Settings::Instance().m_renderHeight;
-
-		float centerSizeX = (float)Settings::Instance().m_foveationCenterSizeX;
-		float centerSizeY = (float)Settings::Instance().m_foveationCenterSizeY;
-		float centerShiftX = (float)Settings::Instance().m_foveationCenterShiftX;
-		float centerShiftY = (float)Settings::Instance().m_foveationCenterShiftY;
-		float edgeRatioX = (float)Settings::Instance().m_foveationEdgeRatioX;
-		float edgeRatioY = (float)Settings::Instance().m_foveationEdgeRatioY;
-
-		float edgeSizeX = targetEyeWidth-centerSizeX*targetEyeWidth;
-		float edgeSizeY = targetEyeHeight-centerSizeY*targetEyeHeight;
-
-		float centerSizeXAligned = 1.-ceil(edgeSizeX/(edgeRatioX*2.))*(edgeRatioX*2.)/targetEyeWidth;
-		float centerSizeYAligned = 1.-ceil(edgeSizeY/(edgeRatioY*2.))*(edgeRatioY*2.)/targetEyeHeight;
-
-		float edgeSizeXAligned = targetEyeWidth-centerSizeXAligned*targetEyeWidth;
-		float edgeSizeYAligned = targetEyeHeight-centerSizeYAligned*targetEyeHeight;
-
-		float centerShiftXAligned = ceil(centerShiftX*edgeSizeXAligned/(edgeRatioX*2.))*(edgeRatioX*2.)/edgeSizeXAligned;
-		float centerShiftYAligned = ceil(centerShiftY*edgeSizeYAligned/(edgeRatioY*2.))*(edgeRatioY*2.)/edgeSizeYAligned;
-
-		float foveationScaleX = (centerSizeXAligned+(1.-centerSizeXAligned)/edgeRatioX);
-		float foveationScaleY = (centerSizeYAligned+(1.-centerSizeYAligned)/edgeRatioY);
-
-		float optimizedEyeWidth = foveationScaleX*targetEyeWidth;
-		float optimizedEyeHeight = foveationScaleY*targetEyeHeight;
-
-		// round the frame dimensions to a number of pixel multiple of 32 for the encoder
-		auto optimizedEyeWidthAligned = (uint32_t)ceil(optimizedEyeWidth / 32.f) * 32;
-		auto optimizedEyeHeightAligned = (uint32_t)ceil(optimizedEyeHeight / 32.f) * 32;
-
-		float eyeWidthRatioAligned = optimizedEyeWidth/optimizedEyeWidthAligned;
-		float eyeHeightRatioAligned = optimizedEyeHeight/optimizedEyeHeightAligned;
-
-		return { (uint32_t)targetEyeWidth, (uint32_t)targetEyeHeight, optimizedEyeWidthAligned, optimizedEyeHeightAligned,
-			eyeWidthRatioAligned, eyeHeightRatioAligned,
-			centerSizeXAligned, centerSizeYAligned, centerShiftXAligned, centerShiftYAligned, edgeRatioX, edgeRatioY };
-	}
-}
-
-
 void FFR::GetOptimizedResolution(uint32_t* width, uint32_t* height) {
 	auto fovVars = CalculateFoveationVars();
 	*width = fovVars.optimizedEyeWidth * 2;
@@ -107,4 +46,11 @@ void FFR::Render() {
 
 ID3D11Texture2D* FFR::GetOutputTexture() {
 	return mOptimizedTexture.Get();
+}
+
+ComPtr<ID3D11Buffer> FFR::CreateFoveationBuffer() {
+	auto fovVars = CalculateFoveationVars();
+	ComPtr<ID3D11Buffer> foveatedRenderingBuffer;
+	foveatedRenderingBuffer.Attach(CreateBuffer(mDevice.Get(), fovVars));
+	return foveatedRenderingBuffer;
 }
\ No newline at end of file
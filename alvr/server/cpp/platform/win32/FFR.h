@@ -10,6 +10,8 @@ public:
 	void Render();
 	void GetOptimizedResolution(uint32_t* width, uint32_t* height);
 	ID3D11Texture2D* GetOutputTexture();
+	// Constant buffer with the FoveationVars of the current settings
+	Microsoft::WRL::ComPtr<ID3D11Buffer> CreateFoveationBuffer();
 
 private:
 	Microsoft::WRL::ComPtr<ID3D11Device> mDevice;
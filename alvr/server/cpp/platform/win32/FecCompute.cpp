@@ -0,0 +1,173 @@
+#include "FecCompute.h"
+
+#include <d3dcompiler.h>
+#include <string.h>
+#include <vector>
+
+#include "alvr_server/Logger.h"
+#include "alvr_server/bindings.h"
+
+#pragma comment(lib, "d3dcompiler.lib")
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+	// The buffers grow by this much, so that the frame sizes of a stream settle on one allocation
+	const uint32_t BUFFER_GRANULARITY = 256 * 1024;
+
+	ComPtr<ID3D11Buffer> CreateRawBuffer(ID3D11Device *device, uint32_t size, UINT bindFlags, const void *data = nullptr)
+	{
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth = size;
+		desc.Usage = data ? D3D11_USAGE_IMMUTABLE : D3D11_USAGE_DEFAULT;
+		desc.BindFlags = bindFlags;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+		D3D11_SUBRESOURCE_DATA initialData = { data };
+		ComPtr<ID3D11Buffer> buffer;
+		OK_OR_THROW(device->CreateBuffer(&desc, data ? &initialData : nullptr, &buffer), L"Failed to create FEC buffer.");
+		return buffer;
+	}
+
+	ComPtr<ID3D11ShaderResourceView> CreateRawView(ID3D11Device *device, ID3D11Buffer *buffer, uint32_t size)
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC desc = {};
+		desc.Format = DXGI_FORMAT_R32_TYPELESS;
+		desc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+		desc.BufferEx.NumElements = size / 4;
+		desc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+		ComPtr<ID3D11ShaderResourceView> view;
+		OK_OR_THROW(device->CreateShaderResourceView(buffer, &desc, &view), L"Failed to create FEC buffer view.");
+		return view;
+	}
+}
+
+FecCompute::FecCompute(uint32_t adapterIndex)
+	: mRender(std::make_shared<CD3DRender>())
+{
+	if (!mRender->Initialize(adapterIndex)) {
+		throw MakeException("Failed to create the FEC device on adapter %u.", adapterIndex);
+	}
+
+	ComPtr<ID3DBlob> shaderBlob;
+	ComPtr<ID3DBlob> errorBlob;
+	HRESULT hr = D3DCompile(REED_SOLOMON_CS_HLSL_PTR, REED_SOLOMON_CS_HLSL_LEN, "ReedSolomonComputeShader.hlsl",
+		nullptr, nullptr, "main", "cs_5_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &shaderBlob, &errorBlob);
+	if (FAILED(hr)) {
+		throw MakeException("Failed to compile Reed-Solomon shader. HR=%p %hs", hr,
+			errorBlob ? (const char *)errorBlob->GetBufferPointer() : "");
+	}
+	OK_OR_THROW(mRender->GetDevice()->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &mComputeShader),
+		L"Failed to create Reed-Solomon shader.");
+
+	mParamsBuffer.Attach(d3d_render_utils::CreateBuffer(mRender->GetDevice(), mParams, D3D11_USAGE_DEFAULT));
+}
+
+bool FecCompute::Encode(reed_solomon *rs, uint8_t **shards, int blockSize)
+{
+	if (blockSize % 4 != 0) {
+		return false;
+	}
+
+	ID3D11DeviceContext *context = mRender->GetContext();
+	uint32_t dataBytes = rs->data_shards * blockSize;
+	uint32_t parityBytes = rs->parity_shards * blockSize;
+	try {
+		PrepareMatrix(rs);
+		ReserveBuffers(dataBytes, parityBytes);
+	}
+	catch (Exception e) {
+		if (!mFailureLogged) {
+			Error("FecCompute: %s\n", e.what());
+			mFailureLogged = true;
+		}
+		return false;
+	}
+
+	// The tail shard is padded in the arena of FecEncoder, so the shards are uploaded one by one
+	for (int i = 0; i < rs->data_shards; i++) {
+		D3D11_BOX box = { (UINT)(i * blockSize), 0, 0, (UINT)((i + 1) * blockSize), 1, 1 };
+		context->UpdateSubresource(mDataBuffer.Get(), 0, &box, shards[i], 0, 0);
+	}
+
+	ParityParams params = { (uint32_t)rs->data_shards, (uint32_t)rs->parity_shards, (uint32_t)blockSize / 4, 0 };
+	if (memcmp(&params, &mParams, sizeof(params)) != 0) {
+		mParams = params;
+		d3d_render_utils::UpdateBuffer(context, mParamsBuffer.Get(), &mParams);
+	}
+
+	ID3D11ShaderResourceView *views[] = { mDataView.Get(), mMatrixView.Get() };
+	context->CSSetShader(mComputeShader.Get(), nullptr, 0);
+	context->CSSetConstantBuffers(0, 1, mParamsBuffer.GetAddressOf());
+	context->CSSetShaderResources(0, 2, views);
+	context->CSSetUnorderedAccessViews(0, 1, mParityView.GetAddressOf(), nullptr);
+	context->Dispatch((mParams.blockWords + 63) / 64, mParams.parityShards, 1);
+
+	D3D11_BOX parityBox = { 0, 0, 0, parityBytes, 1, 1 };
+	context->CopySubresourceRegion(mReadbackBuffer.Get(), 0, 0, 0, 0, mParityBuffer.Get(), 0, &parityBox);
+
+	// Waits for the GPU
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	HRESULT hr = context->Map(mReadbackBuffer.Get(), 0, D3D11_MAP_READ, 0, &mapped);
+	if (FAILED(hr)) {
+		if (!mFailureLogged) {
+			Error("FecCompute: Failed to read the parity back. HR=%p\n", hr);
+			mFailureLogged = true;
+		}
+		return false;
+	}
+	for (int i = 0; i < rs->parity_shards; i++) {
+		memcpy(shards[rs->data_shards + i], (uint8_t *)mapped.pData + i * blockSize, blockSize);
+	}
+	context->Unmap(mReadbackBuffer.Get(), 0);
+
+	return true;
+}
+
+void FecCompute::PrepareMatrix(reed_solomon *rs)
+{
+	if (rs == mMatrixCodec) {
+		return;
+	}
+
+	// A word per coefficient, the shader loads them without unpacking
+	std::vector<uint32_t> coefficients(rs->parity_shards * rs->data_shards);
+	for (size_t i = 0; i < coefficients.size(); i++) {
+		coefficients[i] = rs->parity[i];
+	}
+	uint32_t size = (uint32_t)(coefficients.size() * sizeof(uint32_t));
+	mMatrixBuffer = CreateRawBuffer(mRender->GetDevice(), size, D3D11_BIND_SHADER_RESOURCE, coefficients.data());
+	mMatrixView = CreateRawView(mRender->GetDevice(), mMatrixBuffer.Get(), size);
+	mMatrixCodec = rs;
+}
+
+void FecCompute::ReserveBuffers(uint32_t dataBytes, uint32_t parityBytes)
+{
+	ID3D11Device *device = mRender->GetDevice();
+
+	if (dataBytes > mDataCapacity) {
+		mDataView.Reset();
+		mDataCapacity = (dataBytes + BUFFER_GRANULARITY - 1) / BUFFER_GRANULARITY * BUFFER_GRANULARITY;
+		mDataBuffer = CreateRawBuffer(device, mDataCapacity, D3D11_BIND_SHADER_RESOURCE);
+		mDataView = CreateRawView(device, mDataBuffer.Get(), mDataCapacity);
+	}
+
+	if (parityBytes > mParityCapacity) {
+		mParityView.Reset();
+		mParityCapacity = (parityBytes + BUFFER_GRANULARITY - 1) / BUFFER_GRANULARITY * BUFFER_GRANULARITY;
+		mParityBuffer = CreateRawBuffer(device, mParityCapacity, D3D11_BIND_UNORDERED_ACCESS);
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.NumElements = mParityCapacity / 4;
+		uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+		OK_OR_THROW(device->CreateUnorderedAccessView(mParityBuffer.Get(), &uavDesc, &mParityView), L"Failed to create FEC parity view.");
+
+		D3D11_BUFFER_DESC readbackDesc = {};
+		readbackDesc.ByteWidth = mParityCapacity;
+		readbackDesc.Usage = D3D11_USAGE_STAGING;
+		readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		mReadbackBuffer.Reset();
+		OK_OR_THROW(device->CreateBuffer(&readbackDesc, nullptr, &mReadbackBuffer), L"Failed to create FEC readback buffer.");
+	}
+}
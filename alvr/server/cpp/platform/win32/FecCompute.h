@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+
+#include "alvr_server/FecEncoder.h"
+#include "d3d-render-utils/RenderUtils.h"
+#include "shared/d3drender.h"
+
+// Computes the Reed-Solomon parity of the large video frames with a compute shader, taking the
+// FEC load off the CPU. NVENC and AMF hand the bitstream over in system memory, so the data shards
+// are uploaded and the parity shards read back, the frame waits for both. The shader runs on a
+// device of its own, it neither takes the lock of the immediate context of the compositor nor
+// queues behind the frames of the encoder.
+class FecCompute : public ParityOffload
+{
+public:
+	// Throws if the device or the shader cannot be created
+	explicit FecCompute(uint32_t adapterIndex);
+
+	// Leaves the shards whose size is not a multiple of 4 bytes to the CPU, and the frames the GPU
+	// failed on
+	bool Encode(reed_solomon *rs, uint8_t **shards, int blockSize) override;
+
+private:
+	struct ParityParams {
+		uint32_t dataShards;
+		uint32_t parityShards;
+		uint32_t blockWords;
+		uint32_t padding;
+	};
+
+	void PrepareMatrix(reed_solomon *rs);
+	void ReserveBuffers(uint32_t dataBytes, uint32_t parityBytes);
+
+	std::shared_ptr<CD3DRender> mRender;
+	Microsoft::WRL::ComPtr<ID3D11ComputeShader> mComputeShader;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mParamsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mMatrixBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mMatrixView;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mDataBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mDataView;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mParityBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> mParityView;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mReadbackBuffer;
+
+	// Codec of the matrix in mMatrixBuffer, FecEncoder keeps its codecs until it is destroyed
+	reed_solomon *mMatrixCodec = nullptr;
+	uint32_t mDataCapacity = 0;
+	uint32_t mParityCapacity = 0;
+	ParityParams mParams = {};
+	bool mFailureLogged = false;
+};
@@ -0,0 +1,340 @@
+#include "FrameCapture.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "alvr_server/Logger.h"
+
+namespace {
+	struct DdsPixelFormat {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask;
+		uint32_t gBitMask;
+		uint32_t bBitMask;
+		uint32_t aBitMask;
+	};
+
+	struct DdsHeader {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t height;
+		uint32_t width;
+		uint32_t pitchOrLinearSize;
+		uint32_t depth;
+		uint32_t mipMapCount;
+		uint32_t reserved1[11];
+		DdsPixelFormat pixelFormat;
+		uint32_t caps;
+		uint32_t caps2;
+		uint32_t caps3;
+		uint32_t caps4;
+		uint32_t reserved2;
+	};
+
+	// The DXGI format is given by this extension header, any format can be written
+	struct DdsHeaderDxt10 {
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+	const uint32_t DDSD_CAPS = 0x1;
+	const uint32_t DDSD_HEIGHT = 0x2;
+	const uint32_t DDSD_WIDTH = 0x4;
+	const uint32_t DDSD_PITCH = 0x8;
+	const uint32_t DDSD_PIXELFORMAT = 0x1000;
+	const uint32_t DDPF_FOURCC = 0x4;
+	const uint32_t DDSCAPS_TEXTURE = 0x1000;
+	const uint32_t FOURCC_DX10 = MAKEFOURCC('D', 'X', '1', '0');
+
+	// Layout of the rows of the formats the layers and the composition use. The chroma rows of the
+	// YUV formats follow the luma rows.
+	bool RowLayout(DXGI_FORMAT format, uint32_t width, uint32_t height, uint32_t *rowBytes, uint32_t *rowCount)
+	{
+		*rowCount = height;
+		switch (format) {
+		case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+		case DXGI_FORMAT_R10G10B10A2_TYPELESS:
+		case DXGI_FORMAT_R10G10B10A2_UNORM:
+			*rowBytes = width * 4;
+			return true;
+		case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+			*rowBytes = width * 8;
+			return true;
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+			*rowBytes = width * 16;
+			return true;
+		case DXGI_FORMAT_NV12:
+			*rowBytes = width;
+			*rowCount = height + height / 2;
+			return true;
+		case DXGI_FORMAT_P010:
+			*rowBytes = width * 2;
+			*rowCount = height + height / 2;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Viewers do not open typeless textures
+	DXGI_FORMAT FileFormat(DXGI_FORMAT format)
+	{
+		switch (format) {
+		case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+			return DXGI_FORMAT_R8G8B8A8_UNORM;
+		case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+			return DXGI_FORMAT_B8G8R8A8_UNORM;
+		case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+			return DXGI_FORMAT_B8G8R8X8_UNORM;
+		case DXGI_FORMAT_R10G10B10A2_TYPELESS:
+			return DXGI_FORMAT_R10G10B10A2_UNORM;
+		case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+			return DXGI_FORMAT_R16G16B16A16_FLOAT;
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+			return DXGI_FORMAT_R32G32B32A32_FLOAT;
+		default:
+			return format;
+		}
+	}
+}
+
+FrameCapture::FrameCapture(ID3D11Device *device, ID3D11DeviceContext *context, uint32_t historyFrames)
+	: m_device(device)
+	, m_context(context)
+	, m_historyFrames(historyFrames)
+{
+	m_thread = std::thread(&FrameCapture::Run, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_exiting = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+}
+
+void FrameCapture::Request(const std::string &directory)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_requestedDirectory = directory;
+}
+
+void FrameCapture::BeginFrame(ID3D11Texture2D *pTexture[][2], int layerCount)
+{
+	Collect();
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_directory = std::move(m_requestedDirectory);
+		m_requestedDirectory.clear();
+	}
+	if (m_directory.empty()) {
+		return;
+	}
+
+	Info("FrameCapture: Writing frame %llu and %d frames of history to %hs\n", m_frameIndex, (int)m_history.size(), m_directory.c_str());
+	while (!m_history.empty()) {
+		Queue(m_directory, std::move(m_history.front()));
+		m_history.pop_front();
+	}
+
+	const char *eyes[] = { "left", "right" };
+	for (int layer = 0; layer < layerCount; layer++) {
+		for (int eye = 0; eye < 2; eye++) {
+			if (pTexture[layer][eye]) {
+				char name[64];
+				snprintf(name, sizeof(name), "frame%llu_layer%d_%s.dds", m_frameIndex, layer, eyes[eye]);
+				Copy(pTexture[layer][eye], name, m_directory);
+			}
+		}
+	}
+}
+
+void FrameCapture::EndFrame(ID3D11Texture2D *composed)
+{
+	if (!m_directory.empty() || m_historyFrames > 0) {
+		char name[64];
+		snprintf(name, sizeof(name), "frame%llu_composed.dds", m_frameIndex);
+		Copy(composed, name, m_directory);
+	}
+	m_directory.clear();
+	m_frameIndex++;
+}
+
+void FrameCapture::Copy(ID3D11Texture2D *texture, const std::string &name, const std::string &directory)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	texture->GetDesc(&desc);
+	uint32_t rowBytes, rowCount;
+	if (desc.SampleDesc.Count > 1 || !RowLayout(desc.Format, desc.Width, desc.Height, &rowBytes, &rowCount)) {
+		if (!directory.empty()) {
+			Warn("FrameCapture: Cannot capture %hs, format %d with %d samples.\n", name.c_str(), desc.Format, desc.SampleDesc.Count);
+		}
+		return;
+	}
+
+	// A staging texture of the same size and format, or any free one to recreate
+	Staging *staging = nullptr;
+	for (auto &candidate : m_staging) {
+		if (candidate.pending) {
+			continue;
+		}
+		if (candidate.texture && candidate.desc.Width == desc.Width && candidate.desc.Height == desc.Height
+			&& candidate.desc.Format == desc.Format) {
+			staging = &candidate;
+			break;
+		}
+		if (!staging) {
+			staging = &candidate;
+		}
+	}
+	if (!staging) {
+		if (!directory.empty()) {
+			Warn("FrameCapture: No staging texture left, %hs is dropped.\n", name.c_str());
+		}
+		return;
+	}
+
+	if (!staging->texture || staging->desc.Width != desc.Width || staging->desc.Height != desc.Height
+		|| staging->desc.Format != desc.Format) {
+		D3D11_TEXTURE2D_DESC stagingDesc = desc;
+		stagingDesc.MipLevels = 1;
+		stagingDesc.ArraySize = 1;
+		stagingDesc.Usage = D3D11_USAGE_STAGING;
+		stagingDesc.BindFlags = 0;
+		stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		stagingDesc.MiscFlags = 0;
+		D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+
+		staging->texture.Reset();
+		staging->query.Reset();
+		if (FAILED(m_device->CreateTexture2D(&stagingDesc, NULL, &staging->texture))
+			|| FAILED(m_device->CreateQuery(&queryDesc, &staging->query))) {
+			Warn("FrameCapture: Failed to create a staging texture for %hs.\n", name.c_str());
+			staging->texture.Reset();
+			return;
+		}
+		staging->desc = stagingDesc;
+	}
+
+	// Only the first mip of the first slice, the textures of the layers can have more
+	m_context->CopySubresourceRegion(staging->texture.Get(), 0, 0, 0, 0, texture, 0, NULL);
+	m_context->End(staging->query.Get());
+	staging->name = name;
+	staging->directory = directory;
+	staging->pending = true;
+}
+
+void FrameCapture::Collect()
+{
+	for (auto &staging : m_staging) {
+		if (!staging.pending || m_context->GetData(staging.query.Get(), NULL, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+			continue;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		HRESULT hr = m_context->Map(staging.texture.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+		if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+			continue;
+		}
+		staging.pending = false;
+		if (FAILED(hr)) {
+			Warn("FrameCapture: Failed to map %hs. %p\n", staging.name.c_str(), hr);
+			continue;
+		}
+
+		Image image;
+		image.name = staging.name;
+		image.desc = staging.desc;
+		RowLayout(staging.desc.Format, staging.desc.Width, staging.desc.Height, &image.rowBytes, &image.rowCount);
+		image.data.resize((size_t)image.rowBytes * image.rowCount);
+		for (uint32_t row = 0; row < image.rowCount; row++) {
+			memcpy(image.data.data() + (size_t)row * image.rowBytes, (uint8_t *)mapped.pData + (size_t)row * mapped.RowPitch, image.rowBytes);
+		}
+		m_context->Unmap(staging.texture.Get(), 0);
+
+		if (!staging.directory.empty()) {
+			Queue(staging.directory, std::move(image));
+		} else {
+			m_history.push_back(std::move(image));
+			while (m_history.size() > m_historyFrames) {
+				m_history.pop_front();
+			}
+		}
+	}
+}
+
+void FrameCapture::Queue(const std::string &directory, Image &&image)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_writeQueue.push_back({ directory, std::move(image) });
+	}
+	m_condition.notify_one();
+}
+
+void FrameCapture::Run()
+{
+	while (true) {
+		std::pair<std::string, Image> item;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this] { return m_exiting || !m_writeQueue.empty(); });
+			// The captured frames are still written when exiting
+			if (m_writeQueue.empty()) {
+				return;
+			}
+			item = std::move(m_writeQueue.front());
+			m_writeQueue.pop_front();
+		}
+		const Image &image = item.second;
+
+		DdsHeader header = {};
+		header.size = sizeof(DdsHeader);
+		header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PITCH | DDSD_PIXELFORMAT;
+		header.height = image.desc.Height;
+		header.width = image.desc.Width;
+		header.pitchOrLinearSize = image.rowBytes;
+		header.mipMapCount = 1;
+		header.pixelFormat.size = sizeof(DdsPixelFormat);
+		header.pixelFormat.flags = DDPF_FOURCC;
+		header.pixelFormat.fourCC = FOURCC_DX10;
+		header.caps = DDSCAPS_TEXTURE;
+		DdsHeaderDxt10 headerDxt10 = {};
+		headerDxt10.dxgiFormat = FileFormat(image.desc.Format);
+		headerDxt10.resourceDimension = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+		headerDxt10.arraySize = 1;
+
+		std::error_code error;
+		std::filesystem::create_directories(item.first, error);
+		auto path = std::filesystem::path(item.first) / image.name;
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char *)&DDS_MAGIC, sizeof(DDS_MAGIC));
+		file.write((const char *)&header, sizeof(header));
+		file.write((const char *)&headerDxt10, sizeof(headerDxt10));
+		file.write((const char *)image.data.data(), image.data.size());
+		if (!file) {
+			Warn("FrameCapture: Failed to write %hs\n", path.string().c_str());
+		}
+	}
+}
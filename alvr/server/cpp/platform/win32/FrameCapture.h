@@ -0,0 +1,82 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <d3d11.h>
+#include <wrl.h>
+
+// Writes textures of the frames to DDS files without stalling the render path. Each texture is
+// copied to a staging texture of a ring and an event query is issued after the copy. The copies
+// are mapped without waiting once their query has completed, some frames later, and the files are
+// written by a thread of its own. Captures that find no free staging texture are dropped.
+//
+// With a history, the composed output of every frame is also read back and the last frames are
+// kept in memory, to be written with the next capture for post-mortem analysis.
+class FrameCapture
+{
+public:
+	FrameCapture(ID3D11Device *device, ID3D11DeviceContext *context, uint32_t historyFrames);
+	~FrameCapture();
+
+	// From any thread. The layers and the composed output of the next frame are written to
+	// directory, with the history if there is one.
+	void Request(const std::string &directory);
+
+	// Render thread, around the composition of each frame. BeginFrame also collects the copies
+	// of the previous frames.
+	void BeginFrame(ID3D11Texture2D *pTexture[][2], int layerCount);
+	void EndFrame(ID3D11Texture2D *composed);
+
+private:
+	static const int STAGING_COUNT = 16;
+
+	struct Image {
+		// File name, with the index of the frame
+		std::string name;
+		D3D11_TEXTURE2D_DESC desc;
+		uint32_t rowBytes;
+		uint32_t rowCount;
+		std::vector<uint8_t> data;
+	};
+
+	struct Staging {
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+		Microsoft::WRL::ComPtr<ID3D11Query> query;
+		D3D11_TEXTURE2D_DESC desc;
+		std::string name;
+		// Empty for a frame of the history
+		std::string directory;
+		bool pending = false;
+	};
+
+	// Empty directory for a frame of the history
+	void Copy(ID3D11Texture2D *texture, const std::string &name, const std::string &directory);
+	void Collect();
+	void Queue(const std::string &directory, Image &&image);
+	void Run();
+
+	Microsoft::WRL::ComPtr<ID3D11Device> m_device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_context;
+	uint32_t m_historyFrames;
+
+	Staging m_staging[STAGING_COUNT];
+	// Render thread
+	uint64_t m_frameIndex = 0;
+	// Directory the current frame is captured to, empty if it is not
+	std::string m_directory;
+	std::deque<Image> m_history;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	// Directory of the pending request, empty if none
+	std::string m_requestedDirectory;
+	std::deque<std::pair<std::string, Image>> m_writeQueue;
+	bool m_exiting = false;
+	std::thread m_thread;
+};
@@ -1,4 +1,8 @@
 #include "FrameRender.h"
+
+#include <cmath>
+
+#include "ALVR-common/packet_types.h"
 #include "alvr_server/Utils.h"
 #include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
@@ -11,6 +15,7 @@ using namespace d3d_render_utils;
 
 FrameRender::FrameRender(std::shared_ptr<CD3DRender> pD3DRender)
 	: m_pD3DRender(pD3DRender)
+	, m_profiler(std::make_unique<GpuProfiler>(pD3DRender->GetDevice(), pD3DRender->GetContext()))
 {
 		FrameRender::SetGpuPriority(m_pD3DRender->GetDevice());
 }
@@ -269,10 +274,12 @@ bool FrameRender::Startup()
 	}
 
 	m_pStagingTexture = compositionTexture;
+	m_compositionTexture = compositionTexture;
 
 	std::vector<uint8_t> quadShaderCSO(QUAD_SHADER_CSO_PTR, QUAD_SHADER_CSO_PTR + QUAD_SHADER_CSO_LEN);
 	ComPtr<ID3D11VertexShader> quadVertexShader = CreateVertexShader(m_pD3DRender->GetDevice(), quadShaderCSO);
 
+	m_liveRevision = Settings::Instance().m_liveRevision.load(std::memory_order_acquire);
 	enableColorCorrection = Settings::Instance().m_enableColorCorrection;
 	if (enableColorCorrection) {
 		std::vector<uint8_t> colorCorrectionShaderCSO(COLOR_CORRECTION_CSO_PTR, COLOR_CORRECTION_CSO_PTR + COLOR_CORRECTION_CSO_LEN);
@@ -281,25 +288,12 @@ bool FrameRender::Startup()
 			Settings::Instance().m_renderWidth, Settings::Instance().m_renderHeight,
 			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
 
-		struct ColorCorrection {
-			float renderWidth;
-			float renderHeight;
-			float brightness;
-			float contrast;
-			float saturation;
-			float gamma;
-			float sharpening;
-			float _align;
-		};
-		ColorCorrection colorCorrectionStruct = { (float)Settings::Instance().m_renderWidth, (float)Settings::Instance().m_renderHeight,
-												  Settings::Instance().m_brightness, Settings::Instance().m_contrast + 1.f,
-												  Settings::Instance().m_saturation + 1.f, Settings::Instance().m_gamma,
-												  Settings::Instance().m_sharpening };
-		ComPtr<ID3D11Buffer> colorCorrectionBuffer = CreateBuffer(m_pD3DRender->GetDevice(), colorCorrectionStruct);
+		// Updatable, for the live updates of the parameters
+		m_colorCorrectionBuffer.Attach(CreateBuffer(m_pD3DRender->GetDevice(), GetColorCorrection(), D3D11_USAGE_DEFAULT));
 
 		m_colorCorrectionPipeline = std::make_unique<RenderPipeline>(m_pD3DRender->GetDevice());
 		m_colorCorrectionPipeline->Initialize({ m_pStagingTexture.Get() }, quadVertexShader.Get(), colorCorrectionShaderCSO,
-											  colorCorrectedTexture.Get(), colorCorrectionBuffer.Get());
+											  colorCorrectedTexture.Get(), m_colorCorrectionBuffer.Get());
 
 		m_pStagingTexture = colorCorrectedTexture;
 	}
@@ -312,14 +306,117 @@ bool FrameRender::Startup()
 		m_pStagingTexture = m_ffr->GetOutputTexture();
 	}
 
+	if (enableColorCorrection || enableFFR) {
+		uint32_t outputWidth, outputHeight;
+		GetEncodingResolution(&outputWidth, &outputHeight);
+		ComPtr<ID3D11Buffer> foveationBuffer;
+		if (enableFFR) {
+			foveationBuffer = m_ffr->CreateFoveationBuffer();
+		}
+		m_passOutputTexture = m_pStagingTexture;
+		try {
+			auto fusedComposition = std::make_unique<FusedComposition>(m_pD3DRender->GetDevice(), m_pD3DRender->GetContext());
+			fusedComposition->Initialize(outputWidth, outputHeight, enableColorCorrection, enableFFR, foveationBuffer.Get());
+			m_fusedComposition = std::move(fusedComposition);
+
+			m_pStagingTexture = m_fusedComposition->GetOutputTexture();
+			Debug("Using fused composition\n");
+		}
+		catch (Exception e) {
+			Warn("Fused composition unavailable, using separate passes: %s\n", e.what());
+		}
+	}
+
+	if (Settings::Instance().m_enableDynamicResolution) {
+		m_contentScaler = std::make_unique<ContentScaler>(m_pD3DRender->GetDevice(), m_pD3DRender->GetContext());
+		m_contentScaler->Initialize(m_pStagingTexture.Get());
+
+		m_pStagingTexture = m_contentScaler->GetOutputTexture();
+	}
+
+	// The HEVC Main10 hardware encoders take P010, the RGB path would truncate the frames to 8 bit
+	// before them. 10 bit H.264 is only done by the software encoder, from RGB.
+	bool tenBit = Settings::Instance().m_use10bitEncoder && Settings::Instance().m_codec == ALVR_CODEC_H265;
+	if (Settings::Instance().m_yuvOutput || tenBit) {
+		try {
+			auto nv12Converter = std::make_unique<Nv12Converter>(m_pD3DRender->GetDevice(), m_pD3DRender->GetContext(), tenBit);
+			nv12Converter->Initialize(m_pStagingTexture.Get());
+			m_nv12Converter = std::move(nv12Converter);
+			m_conversionInput = m_pStagingTexture;
+
+			m_pStagingTexture = m_nv12Converter->GetOutputTexture();
+			Debug("Using %hs output\n", tenBit ? "P010" : "NV12");
+		}
+		catch (Exception e) {
+			Warn("YUV output unavailable, the encoder converts the frames: %s\n", e.what());
+		}
+	}
+
 	Debug("Staging Texture created\n");
 
 	return true;
 }
 
 
-bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering, const std::string &message, const std::string& debugText)
+bool FrameRender::FollowsFoveationCenter(int layerCount, bool recentering)
+{
+	return enableFFR && UsesFusedComposition(layerCount, recentering);
+}
+
+bool FrameRender::UsesFusedComposition(int layerCount, bool recentering)
+{
+	return m_fusedComposition && layerCount + (recentering ? 1 : 0) <= FusedComposition::MAX_LAYERS;
+}
+
+bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], ID3D11ShaderResourceView *pView[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering, const std::string &message, const std::string& debugText, float contentScale, const FoveationCenter &center)
 {
+	uint32_t liveRevision = Settings::Instance().m_liveRevision.load(std::memory_order_acquire);
+	if (liveRevision != m_liveRevision) {
+		m_liveRevision = liveRevision;
+		UpdateColorCorrection();
+	}
+
+	m_profiler->BeginFrame();
+
+	if (UsesFusedComposition(layerCount, recentering)) {
+		ID3D11ShaderResourceView *views[FusedComposition::MAX_LAYERS][2];
+		vr::VRTextureBounds_t bound[FusedComposition::MAX_LAYERS][2];
+		int fusedCount = 0;
+		for (int i = 0; i < layerCount; i++) {
+			if (IsEmptyLayer(bounds[i])) {
+				continue;
+			}
+			views[fusedCount][0] = pView[i][0];
+			views[fusedCount][1] = pView[i][1];
+			bound[fusedCount][0] = bounds[i][0];
+			bound[fusedCount][1] = bounds[i][1];
+			fusedCount++;
+		}
+		layerCount = fusedCount;
+		// Overlay recentering texture on top of all layers.
+		if (recentering) {
+			views[layerCount][0] = m_recenterResourceView.Get();
+			views[layerCount][1] = m_recenterResourceView.Get();
+			bound[layerCount][0].uMin = bound[layerCount][0].vMin = bound[layerCount][1].uMin = bound[layerCount][1].vMin = 0.0f;
+			bound[layerCount][0].uMax = bound[layerCount][0].vMax = bound[layerCount][1].uMax = bound[layerCount][1].vMax = 1.0f;
+			layerCount++;
+		}
+
+		m_fusedComposition->Render(views, bound, layerCount, center);
+		// The single dispatch is accounted as composition
+		m_profiler->EndPass(GpuProfiler::PASS_COMPOSITION);
+		m_profiler->EndPass(GpuProfiler::PASS_COLOR_CORRECTION);
+		m_profiler->EndPass(GpuProfiler::PASS_FFR);
+
+		if (m_nv12Converter && !m_conversionOffloaded) {
+			m_nv12Converter->Convert();
+		}
+
+		m_pD3DRender->GetContext()->Flush();
+
+		return true;
+	}
+
 	// Set render target
 	m_pD3DRender->GetContext()->OMSetRenderTargets(1, m_pRenderTargetView.GetAddressOf(), m_pDepthStencilView.Get());
 
@@ -333,8 +430,17 @@ bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBound
 	viewport.TopLeftY = 0;
 	m_pD3DRender->GetContext()->RSSetViewports(1, &viewport);
 
+	// The usual single layer of the game is copied, only the layers above it are drawn
+	bool copiedLayer = layerCount > 0 && pTexture[0][0] && pTexture[0][1] && CopyLayer(pTexture[0], bounds[0]);
+	if (copiedLayer != m_copiedLayer) {
+		Debug("RenderFrame: bottom layer %hs\n", copiedLayer ? "copied" : "drawn");
+		m_copiedLayer = copiedLayer;
+	}
+
 	// Clear the back buffer
-	m_pD3DRender->GetContext()->ClearRenderTargetView(m_pRenderTargetView.Get(), DirectX::Colors::MidnightBlue);
+	if (!copiedLayer) {
+		m_pD3DRender->GetContext()->ClearRenderTargetView(m_pRenderTargetView.Get(), DirectX::Colors::MidnightBlue);
+	}
 
 	// Overlay recentering texture on top of all layers.
 	int recenterLayer = -1;
@@ -343,27 +449,35 @@ bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBound
 		layerCount++;
 	}
 
-	for (int i = 0; i < layerCount; i++) {
+	for (int i = copiedLayer ? 1 : 0; i < layerCount; i++) {
 		ID3D11Texture2D *textures[2];
+		ID3D11ShaderResourceView *shaderResourceView[2];
 		vr::VRTextureBounds_t bound[2];
 
 		if (i == recenterLayer) {
 			textures[0] = (ID3D11Texture2D *)m_recenterTexture.Get();
 			textures[1] = (ID3D11Texture2D *)m_recenterTexture.Get();
+			shaderResourceView[0] = m_recenterResourceView.Get();
+			shaderResourceView[1] = m_recenterResourceView.Get();
 			bound[0].uMin = bound[0].vMin = bound[1].uMin = bound[1].vMin = 0.0f;
 			bound[0].uMax = bound[0].vMax = bound[1].uMax = bound[1].vMax = 1.0f;
 		}
 		else {
 			textures[0] = pTexture[i][0];
 			textures[1] = pTexture[i][1];
+			shaderResourceView[0] = pView[i][0];
+			shaderResourceView[1] = pView[i][1];
 			bound[0] = bounds[i][0];
 			bound[1] = bounds[i][1];
 		}
-		if (textures[0] == NULL || textures[1] == NULL) {
+		if (shaderResourceView[0] == NULL || shaderResourceView[1] == NULL) {
 			Debug("Ignore NULL layer. layer=%d/%d%s%s\n", i, layerCount
 				, recentering ? L" (recentering)" : L"", !message.empty() ? L" (message)" : L"");
 			continue;
 		}
+		if (IsEmptyLayer(bound)) {
+			continue;
+		}
 
 		D3D11_TEXTURE2D_DESC srcDesc;
 		textures[0]->GetDesc(&srcDesc);
@@ -371,25 +485,6 @@ bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBound
 		Debug("RenderFrame layer=%d/%d %dx%d %d%s%s\n", i, layerCount, srcDesc.Width, srcDesc.Height, srcDesc.Format
 			, recentering ? L" (recentering)" : L"", !message.empty() ? L" (message)" : L"");
 
-		D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc = {};
-		SRVDesc.Format = srcDesc.Format;
-		SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-		SRVDesc.Texture2D.MostDetailedMip = 0;
-		SRVDesc.Texture2D.MipLevels = 1;
-
-		ComPtr<ID3D11ShaderResourceView> pShaderResourceView[2];
-
-		HRESULT hr = m_pD3DRender->GetDevice()->CreateShaderResourceView(textures[0], &SRVDesc, pShaderResourceView[0].ReleaseAndGetAddressOf());
-		if (FAILED(hr)) {
-			Error("CreateShaderResourceView %p %ls\n", hr, GetErrorStr(hr).c_str());
-			return false;
-		}
-		hr = m_pD3DRender->GetDevice()->CreateShaderResourceView(textures[1], &SRVDesc, pShaderResourceView[1].ReleaseAndGetAddressOf());
-		if (FAILED(hr)) {
-			Error("CreateShaderResourceView %p %ls\n", hr, GetErrorStr(hr).c_str());
-			return false;
-		}
-
 		if (i == 0) {
 			m_pD3DRender->GetContext()->OMSetBlendState(m_pBlendStateFirst.Get(), NULL, 0xffffffff);
 		}
@@ -405,32 +500,36 @@ bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBound
 		// Update uv-coordinates in vertex buffer according to bounds.
 		//
 
-		SimpleVertex vertices[] =
-		{
-			// Left View
-			{ DirectX::XMFLOAT3(-1.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMin, bound[0].vMax), 0 },
-		{ DirectX::XMFLOAT3(0.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMax, bound[0].vMin), 0 },
-		{ DirectX::XMFLOAT3(0.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMax, bound[0].vMax), 0 },
-		{ DirectX::XMFLOAT3(-1.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMin, bound[0].vMin), 0 },
-		// Right View
-		{ DirectX::XMFLOAT3(0.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMin, bound[1].vMax), 1 },
-		{ DirectX::XMFLOAT3(1.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMax, bound[1].vMin), 1 },
-		{ DirectX::XMFLOAT3(1.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMax, bound[1].vMax), 1 },
-		{ DirectX::XMFLOAT3(0.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMin, bound[1].vMin), 1 },
-		};
-
-		// TODO: Which is better? UpdateSubresource or Map
-		//m_pD3DRender->GetContext()->UpdateSubresource(m_pVertexBuffer.Get(), 0, nullptr, &vertices, 0, 0);
-
-		D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
-		hr = m_pD3DRender->GetContext()->Map(m_pVertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-		if (FAILED(hr)) {
-			Error("Map %p %ls\n", hr, GetErrorStr(hr).c_str());
-			return false;
+		if (!m_vertexBoundsValid || memcmp(m_vertexBounds, bound, sizeof(bound)) != 0) {
+			SimpleVertex vertices[] =
+			{
+				// Left View
+				{ DirectX::XMFLOAT3(-1.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMin, bound[0].vMax), 0 },
+			{ DirectX::XMFLOAT3(0.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMax, bound[0].vMin), 0 },
+			{ DirectX::XMFLOAT3(0.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMax, bound[0].vMax), 0 },
+			{ DirectX::XMFLOAT3(-1.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[0].uMin, bound[0].vMin), 0 },
+			// Right View
+			{ DirectX::XMFLOAT3(0.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMin, bound[1].vMax), 1 },
+			{ DirectX::XMFLOAT3(1.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMax, bound[1].vMin), 1 },
+			{ DirectX::XMFLOAT3(1.0f, -1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMax, bound[1].vMax), 1 },
+			{ DirectX::XMFLOAT3(0.0f,  1.0f, 0.5f), DirectX::XMFLOAT2(bound[1].uMin, bound[1].vMin), 1 },
+			};
+
+			D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+			HRESULT hr = m_pD3DRender->GetContext()->Map(m_pVertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+			if (FAILED(hr)) {
+				Error("Map %p %ls\n", hr, GetErrorStr(hr).c_str());
+				m_vertexBoundsValid = false;
+				return false;
+			}
+			memcpy(mapped.pData, vertices, sizeof(vertices));
+
+			m_pD3DRender->GetContext()->Unmap(m_pVertexBuffer.Get(), 0);
+
+			// Kept by the buffer until the next discard
+			memcpy(m_vertexBounds, bound, sizeof(bound));
+			m_vertexBoundsValid = true;
 		}
-		memcpy(mapped.pData, vertices, sizeof(vertices));
-
-		m_pD3DRender->GetContext()->Unmap(m_pVertexBuffer.Get(), 0);
 
 		// Set the input layout
 		m_pD3DRender->GetContext()->IASetInputLayout(m_pVertexLayout.Get());
@@ -453,7 +552,6 @@ bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBound
 		m_pD3DRender->GetContext()->VSSetShader(m_pVertexShader.Get(), nullptr, 0);
 		m_pD3DRender->GetContext()->PSSetShader(m_pPixelShader.Get(), nullptr, 0);
 
-		ID3D11ShaderResourceView *shaderResourceView[2] = { pShaderResourceView[0].Get(), pShaderResourceView[1].Get() };
 		m_pD3DRender->GetContext()->PSSetShaderResources(0, 2, shaderResourceView);
 
 		m_pD3DRender->GetContext()->PSSetSamplers(0, 1, m_pSamplerLinear.GetAddressOf());
@@ -464,23 +562,127 @@ bool FrameRender::RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBound
 
 		m_pD3DRender->GetContext()->DrawIndexed(VERTEX_INDEX_COUNT, 0, 0);
 	}
+	m_profiler->EndPass(GpuProfiler::PASS_COMPOSITION);
 
 	if (enableColorCorrection) {
 		m_colorCorrectionPipeline->Render();
 	}
+	m_profiler->EndPass(GpuProfiler::PASS_COLOR_CORRECTION);
 
 	if (enableFFR) {
 		m_ffr->Render();
 	}
+	if (m_fusedComposition) {
+		// Same bytes, the fused output is UNORM because sRGB formats cannot be bound as UAV
+		m_pD3DRender->GetContext()->CopyResource(m_fusedComposition->GetOutputTexture(), m_passOutputTexture.Get());
+	}
+	m_profiler->EndPass(GpuProfiler::PASS_FFR);
+
+	// Measured with the encoder copy, the conversion replaces the one the encoder would do
+	if (m_contentScaler) {
+		m_contentScaler->Render(contentScale);
+	}
+	if (m_nv12Converter && !m_conversionOffloaded) {
+		m_nv12Converter->Convert();
+	}
 
 	m_pD3DRender->GetContext()->Flush();
 
 	return true;
 }
 
+bool FrameRender::IsEmptyLayer(const vr::VRTextureBounds_t bound[2])
+{
+	for (int eye = 0; eye < 2; eye++) {
+		if (bound[eye].uMin != bound[eye].uMax && bound[eye].vMin != bound[eye].vMax) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FrameRender::CopyLayer(ID3D11Texture2D *textures[2], const vr::VRTextureBounds_t bound[2])
+{
+	if (Settings::Instance().m_renderWidth % 2 != 0) {
+		return false;
+	}
+	uint32_t eyeWidth = Settings::Instance().m_renderWidth / 2;
+	uint32_t eyeHeight = Settings::Instance().m_renderHeight;
+
+	D3D11_BOX boxes[2];
+	for (int eye = 0; eye < 2; eye++) {
+		D3D11_TEXTURE2D_DESC desc;
+		textures[eye]->GetDesc(&desc);
+		// The draw would convert any other format, and resample a flipped or scaled eye
+		if (desc.Format != DXGI_FORMAT_R8G8B8A8_UNORM_SRGB || desc.SampleDesc.Count != 1
+			|| bound[eye].uMin >= bound[eye].uMax || bound[eye].vMin >= bound[eye].vMax) {
+			return false;
+		}
+
+		float left = bound[eye].uMin * desc.Width;
+		float top = bound[eye].vMin * desc.Height;
+		boxes[eye].left = (UINT)(left + 0.5f);
+		boxes[eye].top = (UINT)(top + 0.5f);
+		boxes[eye].right = boxes[eye].left + eyeWidth;
+		boxes[eye].bottom = boxes[eye].top + eyeHeight;
+		boxes[eye].front = 0;
+		boxes[eye].back = 1;
+		if (fabsf(left - boxes[eye].left) > 0.01f || fabsf(top - boxes[eye].top) > 0.01f
+			|| fabsf(bound[eye].uMax * desc.Width - boxes[eye].right) > 0.01f
+			|| fabsf(bound[eye].vMax * desc.Height - boxes[eye].bottom) > 0.01f) {
+			return false;
+		}
+	}
+
+	for (int eye = 0; eye < 2; eye++) {
+		m_pD3DRender->GetContext()->CopySubresourceRegion(m_compositionTexture.Get(), 0, eye * eyeWidth, 0, 0,
+			textures[eye], 0, &boxes[eye]);
+	}
+	return true;
+}
+
 ComPtr<ID3D11Texture2D> FrameRender::GetTexture()
 {
-	return m_pStagingTexture;
+	return m_conversionOffloaded ? m_conversionInput : m_pStagingTexture;
+}
+
+ComPtr<ID3D11Texture2D> FrameRender::GetConversionInput()
+{
+	return m_conversionInput;
+}
+
+void FrameRender::OffloadConversion()
+{
+	if (m_conversionInput) {
+		m_conversionOffloaded = true;
+	}
+}
+
+GpuProfiler *FrameRender::GetProfiler()
+{
+	return m_profiler.get();
+}
+
+FrameRender::ColorCorrection FrameRender::GetColorCorrection()
+{
+	auto &settings = Settings::Instance();
+	LiveSettings live = settings.GetLive();
+	return { (float)settings.m_renderWidth, (float)settings.m_renderHeight, live.m_brightness,
+			 live.m_contrast + 1.f, live.m_saturation + 1.f, live.m_gamma, live.m_sharpening };
+}
+
+void FrameRender::UpdateColorCorrection()
+{
+	if (!enableColorCorrection) {
+		return;
+	}
+
+	auto colorCorrection = GetColorCorrection();
+	UpdateBuffer(m_pD3DRender->GetContext(), m_colorCorrectionBuffer.Get(), &colorCorrection);
+	if (m_fusedComposition) {
+		m_fusedComposition->UpdateColorCorrection();
+	}
+	Info("FrameRender: color correction updated\n");
 }
 
 void FrameRender::GetEncodingResolution(uint32_t *width, uint32_t *height) {
@@ -492,4 +694,9 @@ void FrameRender::GetEncodingResolution(uint32_t *width, uint32_t *height) {
 		*height = Settings::Instance().m_renderHeight;
 	}
 	
-}
\ No newline at end of file
+}
+
+DXGI_FORMAT FrameRender::GetEncodingFormat()
+{
+	return m_nv12Converter ? m_nv12Converter->GetOutputFormat() : DXGI_FORMAT_R8G8B8A8_UNORM;
+}
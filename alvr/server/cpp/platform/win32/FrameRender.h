@@ -18,6 +18,10 @@
 #include "shared/d3drender.h"
 #include "openvr_driver.h"
 #include "FFR.h"
+#include "GpuProfiler.h"
+#include "FusedComposition.h"
+#include "Nv12Converter.h"
+#include "ContentScaler.h"
 
 #define GPU_PRIORITY_VAL 7
 
@@ -47,13 +51,96 @@ public:
 	virtual ~FrameRender();
 
 	bool Startup();
-	bool RenderFrame(ID3D11Texture2D *pTexture[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering, const std::string& message, const std::string& debugText);
+	// pView are the shader resource views of the textures, created with the swap texture sets.
+	// contentScale is the dynamic resolution scale of the frame, see ResolutionController.
+	// center is the foveation center of the frame, only applied when FollowsFoveationCenter().
+	bool RenderFrame(ID3D11Texture2D *pTexture[][2], ID3D11ShaderResourceView *pView[][2], vr::VRTextureBounds_t bounds[][2], int layerCount, bool recentering, const std::string& message, const std::string& debugText, float contentScale = 1.f, const FoveationCenter &center = StaticFoveationCenter());
+	// Whether a frame of these layers is compressed around the center given to RenderFrame. The
+	// separate FFR pass uses the center of the settings.
+	bool FollowsFoveationCenter(int layerCount, bool recentering);
 	void GetEncodingResolution(uint32_t *width, uint32_t *height);
+	// DXGI_FORMAT_NV12 (P010 with the 10 bit encoder) if frames are converted to YUV,
+	// DXGI_FORMAT_R8G8B8A8_UNORM otherwise
+	DXGI_FORMAT GetEncodingFormat();
 
 	ComPtr<ID3D11Texture2D> GetTexture();
+	// Frame before the YUV conversion, NULL if the frames are not converted
+	ComPtr<ID3D11Texture2D> GetConversionInput();
+	// The encoder device converts the frames itself, GetTexture returns them before the conversion
+	// from now on. GetEncodingFormat does not change.
+	void OffloadConversion();
+	// RenderFrame begins a profiled frame, the caller ends it once the frame is handed over.
+	GpuProfiler *GetProfiler();
+
+	// Realtime GPU scheduling class for the process and the highest GPU thread priority for the
+	// contexts of device. Also used for the device of the encoder when it has its own.
+	static bool SetGpuPriority(ID3D11Device* device)
+	{
+		typedef enum _D3DKMT_SCHEDULINGPRIORITYCLASS {
+			D3DKMT_SCHEDULINGPRIORITYCLASS_IDLE,
+			D3DKMT_SCHEDULINGPRIORITYCLASS_BELOW_NORMAL,
+			D3DKMT_SCHEDULINGPRIORITYCLASS_NORMAL,
+			D3DKMT_SCHEDULINGPRIORITYCLASS_ABOVE_NORMAL,
+			D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH,
+			D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME
+		} D3DKMT_SCHEDULINGPRIORITYCLASS;
+
+		ComQIPtr<IDXGIDevice> dxgiDevice(device);
+		if (!dxgiDevice) {
+			Info("[GPU PRIO FIX] Failed to get IDXGIDevice\n");
+			return false;
+		}
+
+		HMODULE gdi32 = GetModuleHandleW(L"GDI32");
+		if (!gdi32) {
+			Info("[GPU PRIO FIX] Failed to get GDI32\n");
+			return false;
+		}
+
+		NTSTATUS(WINAPI* d3dkmt_spspc)(HANDLE, D3DKMT_SCHEDULINGPRIORITYCLASS);
+		d3dkmt_spspc = (decltype(d3dkmt_spspc))GetProcAddress(gdi32, "D3DKMTSetProcessSchedulingPriorityClass");
+		if (!d3dkmt_spspc) {
+			Info("[GPU PRIO FIX] Failed to get d3dkmt_spspc\n");
+			return false;
+		}
+
+		// For the whole process, the devices only differ by their thread priority
+		static bool processClassSet = false;
+		if (!processClassSet) {
+			NTSTATUS status = d3dkmt_spspc(GetCurrentProcess(), D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME);
+			if (status == 0xc0000022) { // STATUS_ACCESS_DENIED, see http://deusexmachina.uk/ntstatus.html
+				Info("[GPU PRIO FIX] Failed to set process (%d) priority class, please run ALVR as Administrator.\n", GetCurrentProcess());
+				return false;
+			} else if (status != 0) {
+				Info("[GPU PRIO FIX] Failed to set process (%d) priority class: %u\n", GetCurrentProcess(), status);
+				return false;
+			}
+			processClassSet = true;
+		}
+
+		HRESULT hr = dxgiDevice->SetGPUThreadPriority(GPU_PRIORITY_VAL);
+		if (FAILED(hr)) {
+			Info("[GPU PRIO FIX] SetGPUThreadPriority failed\n");
+			return false;
+		}
+
+		Debug("[GPU PRIO FIX] D3D11 GPU priority setup success\n");
+		return true;
+	}
 private:
+	// Layers with a zero area on both eyes are not drawn
+	static bool IsEmptyLayer(const vr::VRTextureBounds_t bound[2]);
+	// Copies the eyes of an opaque bottom layer into the composition texture when they map one to
+	// one onto its halves in the same format, which is what drawing them would produce. Returns
+	// false without copying anything otherwise.
+	bool CopyLayer(ID3D11Texture2D *textures[2], const vr::VRTextureBounds_t bound[2]);
+	// The layers and the recentering overlay fit in one dispatch
+	bool UsesFusedComposition(int layerCount, bool recentering);
+
 	std::shared_ptr<CD3DRender> m_pD3DRender;
 	ComPtr<ID3D11Texture2D> m_pStagingTexture;
+	// Render target of the composition, input of the passes that follow it
+	ComPtr<ID3D11Texture2D> m_compositionTexture;
 
 	ComPtr<ID3D11VertexShader> m_pVertexShader;
 	ComPtr<ID3D11PixelShader> m_pPixelShader;
@@ -61,6 +148,11 @@ private:
 	ComPtr<ID3D11InputLayout> m_pVertexLayout;
 	ComPtr<ID3D11Buffer> m_pVertexBuffer;
 	ComPtr<ID3D11Buffer> m_pIndexBuffer;
+	// Bounds the vertex buffer holds, its update is skipped while they do not change
+	vr::VRTextureBounds_t m_vertexBounds[2] = {};
+	bool m_vertexBoundsValid = false;
+	// Whether the last bottom layer was copied, for the log
+	bool m_copiedLayer = false;
 
 	ComPtr<ID3D11SamplerState> m_pSamplerLinear;
 
@@ -85,58 +177,40 @@ private:
 	// Parameter for Draw method. 2-triangles for both eyes.
 	static const int VERTEX_INDEX_COUNT = 12;
 
+	struct ColorCorrection {
+		float renderWidth;
+		float renderHeight;
+		float brightness;
+		float contrast;
+		float saturation;
+		float gamma;
+		float sharpening;
+		float _align;
+	};
+	ColorCorrection GetColorCorrection();
+	// Applies live updates of the parameters, toggling the color correction needs a restart
+	void UpdateColorCorrection();
+
 	std::unique_ptr<d3d_render_utils::RenderPipeline> m_colorCorrectionPipeline;
+	ComPtr<ID3D11Buffer> m_colorCorrectionBuffer;
 	bool enableColorCorrection;
+	// Settings::m_liveRevision the color correction was last updated with
+	uint32_t m_liveRevision = 0;
 
 	std::unique_ptr<FFR> m_ffr;
 	bool enableFFR;
 
-	static bool SetGpuPriority(ID3D11Device* device)
-	{
-		typedef enum _D3DKMT_SCHEDULINGPRIORITYCLASS {
-			D3DKMT_SCHEDULINGPRIORITYCLASS_IDLE,
-			D3DKMT_SCHEDULINGPRIORITYCLASS_BELOW_NORMAL,
-			D3DKMT_SCHEDULINGPRIORITYCLASS_NORMAL,
-			D3DKMT_SCHEDULINGPRIORITYCLASS_ABOVE_NORMAL,
-			D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH,
-			D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME
-		} D3DKMT_SCHEDULINGPRIORITYCLASS;
-
-		ComQIPtr<IDXGIDevice> dxgiDevice(device);
-		if (!dxgiDevice) {
-			Info("[GPU PRIO FIX] Failed to get IDXGIDevice\n");
-			return false;
-		}
-
-		HMODULE gdi32 = GetModuleHandleW(L"GDI32");
-		if (!gdi32) {
-			Info("[GPU PRIO FIX] Failed to get GDI32\n");
-			return false;
-		}
-
-		NTSTATUS(WINAPI* d3dkmt_spspc)(HANDLE, D3DKMT_SCHEDULINGPRIORITYCLASS);
-		d3dkmt_spspc = (decltype(d3dkmt_spspc))GetProcAddress(gdi32, "D3DKMTSetProcessSchedulingPriorityClass");
-		if (!d3dkmt_spspc) {
-			Info("[GPU PRIO FIX] Failed to get d3dkmt_spspc\n");
-			return false;
-		}
+	// Replaces the composition, color correction and FFR passes when available
+	std::unique_ptr<FusedComposition> m_fusedComposition;
+	// Output of the separate passes, copied to the fused output when a frame cannot be fused
+	ComPtr<ID3D11Texture2D> m_passOutputTexture;
 
-		NTSTATUS status = d3dkmt_spspc(GetCurrentProcess(), D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME);
-		if (status == 0xc0000022) { // STATUS_ACCESS_DENIED, see http://deusexmachina.uk/ntstatus.html
-			Info("[GPU PRIO FIX] Failed to set process (%d) priority class, please run ALVR as Administrator.\n", GetCurrentProcess());
-			return false;
-		} else if (status != 0) {
-			Info("[GPU PRIO FIX] Failed to set process (%d) priority class: %u\n", GetCurrentProcess(), status);
-			return false;
-		}
+	// Only with dynamic resolution
+	std::unique_ptr<ContentScaler> m_contentScaler;
 
-		HRESULT hr = dxgiDevice->SetGPUThreadPriority(GPU_PRIORITY_VAL);
-		if (FAILED(hr)) {
-			Info("[GPU PRIO FIX] SetGPUThreadPriority failed\n");
-			return false;
-		}
+	std::unique_ptr<Nv12Converter> m_nv12Converter;
+	ComPtr<ID3D11Texture2D> m_conversionInput;
+	bool m_conversionOffloaded = false;
 
-		Debug("[GPU PRIO FIX] D3D11 GPU priority setup success\n");
-		return true;
-	}
+	std::unique_ptr<GpuProfiler> m_profiler;
 };
@@ -0,0 +1,218 @@
+#include "FusedComposition.h"
+
+#include <d3dcompiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "alvr_server/Settings.h"
+#include "alvr_server/bindings.h"
+
+#pragma comment(lib, "d3dcompiler.lib")
+
+using Microsoft::WRL::ComPtr;
+using namespace d3d_render_utils;
+
+namespace {
+	// Serves FoveatedRendering.hlsli, the only include of the compute shader.
+	class EmbeddedInclude : public ID3DInclude {
+	public:
+		HRESULT __stdcall Open(D3D_INCLUDE_TYPE, LPCSTR fileName, LPCVOID, LPCVOID *data, UINT *bytes) override {
+			if (std::string(fileName) != "FoveatedRendering.hlsli") {
+				return E_FAIL;
+			}
+			*data = FOVEATED_RENDERING_HLSLI_PTR;
+			*bytes = FOVEATED_RENDERING_HLSLI_LEN;
+			return S_OK;
+		}
+		HRESULT __stdcall Close(LPCVOID) override {
+			return S_OK;
+		}
+	};
+}
+
+FusedComposition::FusedComposition(ID3D11Device *device, ID3D11DeviceContext *context)
+	: mDevice(device)
+	, mContext(context)
+{}
+
+void FusedComposition::Initialize(uint32_t outputWidth, uint32_t outputHeight, bool enableColorCorrection,
+	bool enableFoveation, ID3D11Buffer *foveationBuffer)
+{
+	std::string maxLayers = std::to_string(MAX_LAYERS);
+	std::string lutSize = std::to_string(COLOR_LUT_SIZE);
+	D3D_SHADER_MACRO defines[] = { { "MAX_LAYERS", maxLayers.c_str() }, { "COLOR_LUT_SIZE", lutSize.c_str() }, { NULL, NULL } };
+	EmbeddedInclude include;
+	ComPtr<ID3DBlob> shaderBlob;
+	ComPtr<ID3DBlob> errorBlob;
+	HRESULT hr = D3DCompile(COMPOSITION_CS_HLSL_PTR, COMPOSITION_CS_HLSL_LEN, "CompositionComputeShader.hlsl",
+		defines, &include, "main", "cs_5_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &shaderBlob, &errorBlob);
+	if (FAILED(hr)) {
+		throw MakeException("Failed to compile composition compute shader. HR=%p %hs", hr,
+			errorBlob ? (const char *)errorBlob->GetBufferPointer() : "");
+	}
+	OK_OR_THROW(mDevice->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &mComputeShader),
+		L"Failed to create composition compute shader.");
+
+	// Same filtering as the layer quads of FrameRender
+	D3D11_SAMPLER_DESC sampDesc = {};
+	sampDesc.Filter = D3D11_FILTER_ANISOTROPIC;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.MaxAnisotropy = D3D11_REQ_MAXANISOTROPY;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	OK_OR_THROW(mDevice->CreateSamplerState(&sampDesc, &mSampler), L"Failed to create composition sampler.");
+
+	D3D11_SAMPLER_DESC lutSampDesc = {};
+	lutSampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	lutSampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	lutSampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	lutSampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	lutSampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	lutSampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	OK_OR_THROW(mDevice->CreateSamplerState(&lutSampDesc, &mLutSampler), L"Failed to create color LUT sampler.");
+	if (enableColorCorrection) {
+		CreateColorLut();
+	}
+
+	mOutputWidth = outputWidth;
+	mOutputHeight = outputHeight;
+
+	D3D11_TEXTURE2D_DESC outputDesc = {};
+	outputDesc.Width = outputWidth;
+	outputDesc.Height = outputHeight;
+	outputDesc.MipLevels = 1;
+	outputDesc.ArraySize = 1;
+	outputDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	outputDesc.SampleDesc.Count = 1;
+	outputDesc.Usage = D3D11_USAGE_DEFAULT;
+	outputDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	OK_OR_THROW(mDevice->CreateTexture2D(&outputDesc, nullptr, &mOutputTexture), L"Failed to create composition output texture.");
+	OK_OR_THROW(mDevice->CreateUnorderedAccessView(mOutputTexture.Get(), nullptr, &mOutputView), L"Failed to create composition output view.");
+
+	auto &settings = Settings::Instance();
+	mParams.enableColorCorrection = enableColorCorrection;
+	mParams.enableFoveation = enableFoveation;
+	mParams.compositionSize[0] = (float)settings.m_renderWidth;
+	mParams.compositionSize[1] = (float)settings.m_renderHeight;
+	mParams.outputSize[0] = (float)outputWidth;
+	mParams.outputSize[1] = (float)outputHeight;
+	SetSharpening();
+	mParamsBuffer.Attach(CreateBuffer(mDevice.Get(), mParams, D3D11_USAGE_DEFAULT));
+
+	mFoveationBuffer = foveationBuffer;
+}
+
+void FusedComposition::UpdateColorCorrection()
+{
+	if (!mParams.enableColorCorrection) {
+		return;
+	}
+	CreateColorLut();
+	// The params buffer is uploaded by the next Render
+	SetSharpening();
+}
+
+void FusedComposition::SetSharpening()
+{
+	auto &settings = Settings::Instance();
+	mParams.sharpening = settings.GetLive().m_sharpening;
+	mParams.tiledSharpening = mParams.enableColorCorrection && mParams.sharpening != 0.f && !mParams.enableFoveation
+		&& mOutputWidth == (uint32_t)settings.m_renderWidth && mOutputHeight == (uint32_t)settings.m_renderHeight;
+}
+
+void FusedComposition::CreateColorLut()
+{
+	LiveSettings live = Settings::Instance().GetLive();
+	float contrast = live.m_contrast + 1.f;
+	float saturation = live.m_saturation + 1.f;
+
+	// ColorCorrectionPixelShader after the sharpening, evaluated at each grid point. The sharpened
+	// colors are clamped to the grid, the shader only clamped them after the contrast.
+	std::vector<uint16_t> texels(COLOR_LUT_SIZE * COLOR_LUT_SIZE * COLOR_LUT_SIZE * 4);
+	for (uint32_t b = 0; b < COLOR_LUT_SIZE; b++) {
+		for (uint32_t g = 0; g < COLOR_LUT_SIZE; g++) {
+			for (uint32_t r = 0; r < COLOR_LUT_SIZE; r++) {
+				float pixel[3] = { (float)r, (float)g, (float)b };
+				for (float &channel : pixel) {
+					channel = (channel / (COLOR_LUT_SIZE - 1) + live.m_brightness - 0.5f) * contrast + 0.5f;
+				}
+				float luma = pixel[0] * 0.299f + pixel[1] * 0.587f + pixel[2] * 0.114f;
+
+				uint16_t *texel = &texels[((b * COLOR_LUT_SIZE + g) * COLOR_LUT_SIZE + r) * 4];
+				for (int c = 0; c < 3; c++) {
+					// Saturation, lighten only
+					float value = std::max(luma + (pixel[c] - luma) * saturation, pixel[c]);
+					value = powf(std::min(std::max(value, 0.f), 1.f), 1.f / live.m_gamma);
+					texel[c] = (uint16_t)lroundf(value * 65535.f);
+				}
+				texel[3] = 65535;
+			}
+		}
+	}
+
+	D3D11_TEXTURE3D_DESC desc = {};
+	desc.Width = desc.Height = desc.Depth = COLOR_LUT_SIZE;
+	desc.MipLevels = 1;
+	desc.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA data = { texels.data(), COLOR_LUT_SIZE * 4 * sizeof(uint16_t), COLOR_LUT_SIZE * COLOR_LUT_SIZE * 4 * sizeof(uint16_t) };
+	OK_OR_THROW(mDevice->CreateTexture3D(&desc, &data, &mColorLut), L"Failed to create color LUT.");
+	OK_OR_THROW(mDevice->CreateShaderResourceView(mColorLut.Get(), nullptr, &mColorLutView), L"Failed to create color LUT view.");
+}
+
+void FusedComposition::Render(ID3D11ShaderResourceView *views[][2], vr::VRTextureBounds_t bounds[][2], int layerCount,
+	const FoveationCenter &center)
+{
+	mParams.layerCount = (uint32_t)layerCount;
+	mParams.layerMask = 0;
+	memcpy(mParams.centerShifts, center.left, sizeof(center.left));
+	memcpy(mParams.centerShifts + 2, center.right, sizeof(center.right));
+
+	for (int i = 0; i < layerCount && i < MAX_LAYERS; i++) {
+		if (views[i][0] == NULL || views[i][1] == NULL) {
+			continue;
+		}
+
+		for (int eye = 0; eye < 2; eye++) {
+			auto &bound = bounds[i][eye];
+			float layerBounds[4] = { bound.uMin, bound.vMin, bound.uMax, bound.vMax };
+			memcpy(mParams.layerBounds[i * 2 + eye], layerBounds, sizeof(layerBounds));
+		}
+		mParams.layerMask |= 1u << i;
+	}
+	UpdateBuffer(mContext.Get(), mParamsBuffer.Get(), &mParams);
+
+	// The LUT, then the layers
+	ID3D11ShaderResourceView *shaderResourceViews[MAX_LAYERS * 2 + 1];
+	shaderResourceViews[0] = mColorLutView.Get();
+	for (int i = 0; i < MAX_LAYERS * 2; i++) {
+		int layer = i / 2;
+		shaderResourceViews[i + 1] = layer < layerCount && (mParams.layerMask & (1u << layer)) ? views[layer][i % 2] : NULL;
+	}
+	ID3D11Buffer *constantBuffers[] = { mFoveationBuffer.Get(), mParamsBuffer.Get() };
+	ID3D11SamplerState *samplers[] = { mSampler.Get(), mLutSampler.Get() };
+
+	mContext->CSSetShader(mComputeShader.Get(), nullptr, 0);
+	mContext->CSSetConstantBuffers(0, 2, constantBuffers);
+	mContext->CSSetShaderResources(0, MAX_LAYERS * 2 + 1, shaderResourceViews);
+	mContext->CSSetSamplers(0, 2, samplers);
+	mContext->CSSetUnorderedAccessViews(0, 1, mOutputView.GetAddressOf(), nullptr);
+
+	mContext->Dispatch((mOutputWidth + 7) / 8, (mOutputHeight + 7) / 8, 1);
+
+	// Unbind so the output and the layers can be used by the next passes
+	ID3D11ShaderResourceView *nullViews[MAX_LAYERS * 2 + 1] = {};
+	ID3D11UnorderedAccessView *nullOutput = nullptr;
+	mContext->CSSetShaderResources(0, MAX_LAYERS * 2 + 1, nullViews);
+	mContext->CSSetUnorderedAccessViews(0, 1, &nullOutput, nullptr);
+}
+
+ID3D11Texture2D *FusedComposition::GetOutputTexture()
+{
+	return mOutputTexture.Get();
+}
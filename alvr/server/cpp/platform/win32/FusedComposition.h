@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+#include "d3d-render-utils/RenderUtils.h"
+#include "openvr_driver.h"
+#include "alvr_server/FoveationVars.h"
+
+// Composes the layers, applies color correction and foveated compression in one compute
+// dispatch, instead of one render pass each that reads and writes the whole frame.
+// The shader is compiled at startup, if that fails FrameRender keeps the render pipelines.
+// The color correction after the sharpening is baked into a 3D LUT at Initialize and rebuilt when
+// the settings are updated live.
+class FusedComposition
+{
+public:
+	static const int MAX_LAYERS = 12;
+
+	FusedComposition(ID3D11Device *device, ID3D11DeviceContext *context);
+	// foveationBuffer is the FFR constant buffer, it is only read when enableFoveation is set.
+	void Initialize(uint32_t outputWidth, uint32_t outputHeight, bool enableColorCorrection,
+		bool enableFoveation, ID3D11Buffer *foveationBuffer);
+	// Rebuilds the LUT from the color correction settings after a live update. Called between
+	// frames from the render thread.
+	void UpdateColorCorrection();
+	// views of the swap textures of the layers, layers with a NULL view are skipped like in
+	// FrameRender. center replaces the center shift of the foveation buffer.
+	void Render(ID3D11ShaderResourceView *views[][2], vr::VRTextureBounds_t bounds[][2], int layerCount,
+		const FoveationCenter &center);
+	ID3D11Texture2D *GetOutputTexture();
+
+private:
+	// Grid points per channel, so that 0.5 is one of them
+	static const uint32_t COLOR_LUT_SIZE = 33;
+
+	void CreateColorLut();
+	void SetSharpening();
+
+	struct CompositionParams {
+		float layerBounds[MAX_LAYERS * 2][4];
+		uint32_t layerCount;
+		uint32_t layerMask;
+		uint32_t enableColorCorrection;
+		uint32_t enableFoveation;
+		float compositionSize[2];
+		float outputSize[2];
+		float sharpening;
+		uint32_t tiledSharpening;
+		float _align[2];
+		float centerShifts[4];
+	};
+
+	Microsoft::WRL::ComPtr<ID3D11Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> mContext;
+	Microsoft::WRL::ComPtr<ID3D11ComputeShader> mComputeShader;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> mSampler;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> mLutSampler;
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> mColorLut;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mColorLutView;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mFoveationBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mParamsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> mOutputTexture;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> mOutputView;
+
+	CompositionParams mParams = {};
+	uint32_t mOutputWidth = 0;
+	uint32_t mOutputHeight = 0;
+};
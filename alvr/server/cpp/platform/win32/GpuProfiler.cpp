@@ -0,0 +1,101 @@
+#include "GpuProfiler.h"
+#include "alvr_server/Logger.h"
+
+GpuProfiler::GpuProfiler(ID3D11Device *device, ID3D11DeviceContext *context)
+	: mContext(context)
+{
+	D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+	D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+
+	for (auto &frame : mFrames) {
+		if (FAILED(device->CreateQuery(&disjointDesc, &frame.disjoint))) {
+			mAvailable = false;
+		}
+		for (auto &timestamp : frame.timestamps) {
+			if (FAILED(device->CreateQuery(&timestampDesc, &timestamp))) {
+				mAvailable = false;
+			}
+		}
+	}
+	if (!mAvailable) {
+		Info("GpuProfiler: Timestamp queries are not available, GPU pass times will not be reported.\n");
+	}
+}
+
+void GpuProfiler::BeginFrame()
+{
+	mCurrent = -1;
+	// Skip measuring while all frames of the ring are still in flight
+	if (!mAvailable || mFrames[mNext].pending) {
+		return;
+	}
+	mCurrent = mNext;
+	for (auto &ended : mPassEnded) {
+		ended = false;
+	}
+
+	Frame &frame = mFrames[mCurrent];
+	mContext->Begin(frame.disjoint.Get());
+	mContext->End(frame.timestamps[0].Get());
+}
+
+void GpuProfiler::EndPass(Pass pass)
+{
+	if (mCurrent < 0) {
+		return;
+	}
+	mContext->End(mFrames[mCurrent].timestamps[pass + 1].Get());
+	mPassEnded[pass] = true;
+}
+
+void GpuProfiler::EndFrame()
+{
+	if (mCurrent < 0) {
+		return;
+	}
+	Frame &frame = mFrames[mCurrent];
+	// A frame left early still has to issue every query to complete
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		if (!mPassEnded[pass]) {
+			mContext->End(frame.timestamps[pass + 1].Get());
+		}
+	}
+	mContext->End(frame.disjoint.Get());
+	frame.pending = true;
+
+	mNext = (mNext + 1) % FRAME_LATENCY;
+	mCurrent = -1;
+}
+
+bool GpuProfiler::Collect(double passMs[PASS_COUNT])
+{
+	bool collected = false;
+	while (mFrames[mCollect].pending) {
+		Frame &frame = mFrames[mCollect];
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		if (mContext->GetData(frame.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+			break;
+		}
+		// The timestamps were issued before the end of the disjoint query, they are ready too.
+		uint64_t timestamps[PASS_COUNT + 1];
+		bool valid = !disjoint.Disjoint && disjoint.Frequency != 0;
+		for (int i = 0; i < PASS_COUNT + 1; i++) {
+			if (mContext->GetData(frame.timestamps[i].Get(), &timestamps[i], sizeof(uint64_t), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+				valid = false;
+			}
+		}
+		frame.pending = false;
+		mCollect = (mCollect + 1) % FRAME_LATENCY;
+
+		if (valid) {
+			for (int pass = 0; pass < PASS_COUNT; pass++) {
+				// Passes ended out of order by EndFrame count as 0
+				uint64_t ticks = timestamps[pass + 1] > timestamps[pass] ? timestamps[pass + 1] - timestamps[pass] : 0;
+				passMs[pass] = ticks * 1000.0 / disjoint.Frequency;
+			}
+			collected = true;
+		}
+	}
+	return collected;
+}
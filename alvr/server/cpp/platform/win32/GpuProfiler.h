@@ -0,0 +1,50 @@
+#pragma once
+
+#include <d3d11.h>
+#include <wrl.h>
+#include <stdint.h>
+
+// Measures the GPU time of each pass of a frame with timestamp queries.
+// Queries are kept in a ring of a few frames and read back without waiting, so results arrive
+// with some frames of delay and never stall the immediate context.
+class GpuProfiler
+{
+public:
+	enum Pass {
+		PASS_COMPOSITION,
+		PASS_COLOR_CORRECTION,
+		PASS_FFR,
+		PASS_ENCODER_COPY,
+		PASS_COUNT
+	};
+
+	GpuProfiler(ID3D11Device *device, ID3D11DeviceContext *context);
+
+	void BeginFrame();
+	// Marks the end of the pass, passes that did not run are marked anyway and measure ~0.
+	void EndPass(Pass pass);
+	void EndFrame();
+
+	// Returns true and fills passMs with the times of the latest completed frame, if any.
+	bool Collect(double passMs[PASS_COUNT]);
+
+private:
+	static const int FRAME_LATENCY = 4;
+
+	struct Frame {
+		Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+		// Start of the frame, then the end of each pass
+		Microsoft::WRL::ComPtr<ID3D11Query> timestamps[PASS_COUNT + 1];
+		bool pending = false;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> mContext;
+	Frame mFrames[FRAME_LATENCY];
+	bool mAvailable = true;
+	// Frame being recorded, -1 if this frame is not measured
+	int mCurrent = -1;
+	bool mPassEnded[PASS_COUNT] = {};
+	int mNext = 0;
+	// Oldest frame which may still be pending
+	int mCollect = 0;
+};
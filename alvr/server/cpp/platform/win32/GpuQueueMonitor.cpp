@@ -0,0 +1,72 @@
+#include "GpuQueueMonitor.h"
+
+#include "alvr_server/Utils.h"
+
+// Frames further behind are not measured, the GPU is stalled anyway
+static const size_t MAX_PENDING_FRAMES = 8;
+
+GpuQueueMonitor::GpuQueueMonitor(Microsoft::WRL::ComPtr<ID3D11Fence> fence, std::function<void(uint64_t)> onComplete)
+	: m_fence(fence)
+	, m_onComplete(onComplete)
+{
+	m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_thread = std::thread(&GpuQueueMonitor::Run, this);
+}
+
+GpuQueueMonitor::~GpuQueueMonitor()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_exiting = true;
+	}
+	m_condition.notify_all();
+	// Wakes a wait for a fence value that will never be signaled
+	SetEvent(m_event);
+	m_thread.join();
+	CloseHandle(m_event);
+}
+
+void GpuQueueMonitor::Submitted(uint64_t fenceValue)
+{
+	uint64_t submitUs = GetCounterUs();
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_submitted.size() >= MAX_PENDING_FRAMES) {
+			return;
+		}
+		m_submitted.push_back({ fenceValue, submitUs });
+	}
+	m_condition.notify_one();
+}
+
+void GpuQueueMonitor::Run()
+{
+	while (true) {
+		std::pair<uint64_t, uint64_t> frame;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this] { return m_exiting || !m_submitted.empty(); });
+			if (m_exiting) {
+				return;
+			}
+			frame = m_submitted.front();
+			m_submitted.pop_front();
+		}
+
+		if (m_fence->GetCompletedValue() < frame.first) {
+			if (FAILED(m_fence->SetEventOnCompletion(frame.first, m_event))) {
+				continue;
+			}
+			WaitForSingleObject(m_event, INFINITE);
+		}
+
+		uint64_t completeUs = GetCounterUs();
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_exiting) {
+				return;
+			}
+		}
+		m_onComplete(completeUs - frame.second);
+	}
+}
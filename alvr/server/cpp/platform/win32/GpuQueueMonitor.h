@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+#include <d3d11_4.h>
+#include <wrl.h>
+
+// Measures the time from the submission of the passes of a frame to their completion on the GPU,
+// by waiting for the fence signaled after them on a thread of its own. Minus the GPU time of the
+// passes, this is the time they waited behind the work of other processes, like the game.
+class GpuQueueMonitor
+{
+public:
+	// onComplete gets the submit to completion time of each frame, in us
+	GpuQueueMonitor(Microsoft::WRL::ComPtr<ID3D11Fence> fence, std::function<void(uint64_t)> onComplete);
+	~GpuQueueMonitor();
+
+	// Once the signal of fenceValue has been flushed
+	void Submitted(uint64_t fenceValue);
+
+private:
+	void Run();
+
+	Microsoft::WRL::ComPtr<ID3D11Fence> m_fence;
+	std::function<void(uint64_t)> m_onComplete;
+	HANDLE m_event;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	// Fence value and submit time in us
+	std::deque<std::pair<uint64_t, uint64_t>> m_submitted;
+	bool m_exiting = false;
+	std::thread m_thread;
+};
@@ -0,0 +1,100 @@
+#include "Nv12Converter.h"
+
+#include <d3d11_3.h>
+#include <d3dcompiler.h>
+
+#include "alvr_server/bindings.h"
+
+#pragma comment(lib, "d3dcompiler.lib")
+
+using Microsoft::WRL::ComPtr;
+using namespace d3d_render_utils;
+
+Nv12Converter::Nv12Converter(ID3D11Device *device, ID3D11DeviceContext *context, bool tenBit)
+	: mDevice(device)
+	, mContext(context)
+	, mTenBit(tenBit)
+{}
+
+void Nv12Converter::Initialize(ID3D11Texture2D *inputTexture)
+{
+	ComPtr<ID3D11Device3> device3;
+	OK_OR_THROW(mDevice.As(&device3), L"NV12 output needs a D3D11.3 device.");
+
+	UINT formatSupport = 0;
+	if (FAILED(mDevice->CheckFormatSupport(GetOutputFormat(), &formatSupport))
+		|| !(formatSupport & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW)) {
+		throw MakeException("The GPU cannot write %hs textures from a shader.", mTenBit ? "P010" : "NV12");
+	}
+
+	ComPtr<ID3DBlob> shaderBlob;
+	ComPtr<ID3DBlob> errorBlob;
+	HRESULT hr = D3DCompile(RGB_TO_NV12_CS_HLSL_PTR, RGB_TO_NV12_CS_HLSL_LEN, "RgbToNv12ComputeShader.hlsl",
+		nullptr, nullptr, "main", "cs_5_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &shaderBlob, &errorBlob);
+	if (FAILED(hr)) {
+		throw MakeException("Failed to compile NV12 conversion shader. HR=%p %hs", hr,
+			errorBlob ? (const char *)errorBlob->GetBufferPointer() : "");
+	}
+	OK_OR_THROW(mDevice->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &mComputeShader),
+		L"Failed to create NV12 conversion shader.");
+
+	D3D11_TEXTURE2D_DESC inputDesc;
+	inputTexture->GetDesc(&inputDesc);
+	mWidth = inputDesc.Width;
+	mHeight = inputDesc.Height;
+	OK_OR_THROW(mDevice->CreateShaderResourceView(inputTexture, nullptr, &mInputView), L"Failed to create NV12 conversion input view.");
+
+	D3D11_TEXTURE2D_DESC outputDesc = {};
+	outputDesc.Width = mWidth;
+	outputDesc.Height = mHeight;
+	outputDesc.MipLevels = 1;
+	outputDesc.ArraySize = 1;
+	outputDesc.Format = GetOutputFormat();
+	outputDesc.SampleDesc.Count = 1;
+	outputDesc.Usage = D3D11_USAGE_DEFAULT;
+	outputDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	OK_OR_THROW(mDevice->CreateTexture2D(&outputDesc, nullptr, &mOutputTexture), L"Failed to create NV12 texture.");
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC1 viewDesc = {};
+	viewDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+	viewDesc.Format = mTenBit ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R8_UNORM;
+	viewDesc.Texture2D.PlaneSlice = 0;
+	ComPtr<ID3D11UnorderedAccessView1> lumaView;
+	OK_OR_THROW(device3->CreateUnorderedAccessView1(mOutputTexture.Get(), &viewDesc, &lumaView), L"Failed to create NV12 luma view.");
+	viewDesc.Format = mTenBit ? DXGI_FORMAT_R16G16_UNORM : DXGI_FORMAT_R8G8_UNORM;
+	viewDesc.Texture2D.PlaneSlice = 1;
+	ComPtr<ID3D11UnorderedAccessView1> chromaView;
+	OK_OR_THROW(device3->CreateUnorderedAccessView1(mOutputTexture.Get(), &viewDesc, &chromaView), L"Failed to create NV12 chroma view.");
+	mLumaView = lumaView;
+	mChromaView = chromaView;
+
+	ConversionParams params = { { mWidth, mHeight }, inputDesc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, mTenBit };
+	mParamsBuffer.Attach(CreateBuffer(mDevice.Get(), params));
+}
+
+void Nv12Converter::Convert()
+{
+	ID3D11UnorderedAccessView *outputViews[] = { mLumaView.Get(), mChromaView.Get() };
+
+	mContext->CSSetShader(mComputeShader.Get(), nullptr, 0);
+	mContext->CSSetConstantBuffers(0, 1, mParamsBuffer.GetAddressOf());
+	mContext->CSSetShaderResources(0, 1, mInputView.GetAddressOf());
+	mContext->CSSetUnorderedAccessViews(0, 2, outputViews, nullptr);
+
+	mContext->Dispatch(((mWidth + 1) / 2 + 7) / 8, ((mHeight + 1) / 2 + 7) / 8, 1);
+
+	ID3D11ShaderResourceView *nullInput = nullptr;
+	ID3D11UnorderedAccessView *nullOutputs[2] = {};
+	mContext->CSSetShaderResources(0, 1, &nullInput);
+	mContext->CSSetUnorderedAccessViews(0, 2, nullOutputs, nullptr);
+}
+
+ID3D11Texture2D *Nv12Converter::GetOutputTexture()
+{
+	return mOutputTexture.Get();
+}
+
+DXGI_FORMAT Nv12Converter::GetOutputFormat() const
+{
+	return mTenBit ? DXGI_FORMAT_P010 : DXGI_FORMAT_NV12;
+}
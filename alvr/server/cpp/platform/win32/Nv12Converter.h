@@ -0,0 +1,38 @@
+#pragma once
+
+#include "d3d-render-utils/RenderUtils.h"
+
+// Converts the output of FrameRender to an NV12 texture with a compute pass, so the encoders
+// take YUV as input instead of converting themselves (on the CPU for the software encoder).
+// With tenBit the output is P010, for the HEVC Main10 encoders.
+// Needs typed UAV stores on the NV12 planes (D3D11.3).
+class Nv12Converter
+{
+public:
+	Nv12Converter(ID3D11Device *device, ID3D11DeviceContext *context, bool tenBit = false);
+	// Throws if the device cannot write NV12 (P010) textures from a shader.
+	void Initialize(ID3D11Texture2D *inputTexture);
+	void Convert();
+	ID3D11Texture2D *GetOutputTexture();
+	DXGI_FORMAT GetOutputFormat() const;
+
+private:
+	struct ConversionParams {
+		uint32_t frameSize[2];
+		uint32_t srgbInput;
+		uint32_t tenBit;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D11Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> mContext;
+	Microsoft::WRL::ComPtr<ID3D11ComputeShader> mComputeShader;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> mParamsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mInputView;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> mOutputTexture;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> mLumaView;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> mChromaView;
+
+	bool mTenBit;
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+};
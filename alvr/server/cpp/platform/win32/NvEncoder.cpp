@@ -11,6 +11,9 @@
 
 #include "NvEncoder.h"
 
+#include <algorithm>
+#include <thread>
+
 #ifndef _WIN32
 #include <cstring>
 static inline bool operator==(const GUID &guid1, const GUID &guid2) {
@@ -280,6 +283,7 @@ void NvEncoder::CreateEncoder(const NV_ENC_INITIALIZE_PARAMS* pEncoderParams)
     m_nOutputDelay = m_nEncoderBuffer - 1;
     m_vMappedInputBuffers.resize(m_nEncoderBuffer, nullptr);
     m_vBitstreamOutputBuffer.resize(m_nEncoderBuffer, nullptr);
+    m_vSubmitTime.resize(m_nEncoderBuffer);
 
     for (int i = 0; i < m_nEncoderBuffer; i++) 
     {
@@ -290,7 +294,8 @@ void NvEncoder::CreateEncoder(const NV_ENC_INITIALIZE_PARAMS* pEncoderParams)
 
     m_vpCompletionEvent.resize(m_nEncoderBuffer, nullptr);
 #if defined(_WIN32)
-    for (int i = 0; i < m_nEncoderBuffer; i++) 
+    // The events are only signaled in asynchronous mode
+    for (int i = 0; i < m_nEncoderBuffer && m_initializeParams.enableEncodeAsync; i++) 
     {
         m_vpCompletionEvent[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
         NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
@@ -364,6 +369,7 @@ void NvEncoder::DestroyHWEncoder()
 
 const NvEncInputFrame* NvEncoder::GetNextInputFrame()
 {
+    WaitForFreeBuffer();
     int i = m_iToSend % m_nEncoderBuffer;
     return &m_vInputFrames[i];
 }
@@ -389,6 +395,47 @@ void NvEncoder::EncodeFrame(std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_P
     DoEncode(m_vMappedInputBuffers[i], vPacket, pPicParams);
 }
 
+void NvEncoder::EncodeExternalFrame(void *pResource, NV_ENC_INPUT_RESOURCE_TYPE eResourceType,
+    std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams)
+{
+    vPacket.clear();
+    if (!IsHWEncoderInitialized())
+    {
+        NVENC_THROW_ERROR("Encoder device not found", NV_ENC_ERR_NO_ENCODE_DEVICE);
+    }
+
+    NV_ENC_REGISTERED_PTR registeredResource = nullptr;
+    for (auto &external : m_vExternalResources)
+    {
+        if (external.first == pResource)
+        {
+            registeredResource = external.second;
+            break;
+        }
+    }
+    if (!registeredResource)
+    {
+        NV_ENC_REGISTER_RESOURCE registerResource = { NV_ENC_REGISTER_RESOURCE_VER };
+        registerResource.resourceType = eResourceType;
+        registerResource.resourceToRegister = pResource;
+        registerResource.width = GetEncodeWidth();
+        registerResource.height = GetEncodeHeight();
+        registerResource.pitch = 0;
+        registerResource.bufferFormat = GetPixelFormat();
+        NVENC_API_CALL(m_nvenc.nvEncRegisterResource(m_hEncoder, &registerResource));
+        registeredResource = registerResource.registeredResource;
+        m_vExternalResources.push_back(std::make_pair(pResource, registeredResource));
+    }
+
+    WaitForFreeBuffer();
+    int i = m_iToSend % m_nEncoderBuffer;
+    NV_ENC_MAP_INPUT_RESOURCE mapInputResource = { NV_ENC_MAP_INPUT_RESOURCE_VER };
+    mapInputResource.registeredResource = registeredResource;
+    NVENC_API_CALL(m_nvenc.nvEncMapInputResource(m_hEncoder, &mapInputResource));
+    m_vMappedInputBuffers[i] = mapInputResource.mappedResource;
+    DoEncode(m_vMappedInputBuffers[i], vPacket, pPicParams);
+}
+
 void NvEncoder::RunMotionEstimation(std::vector<uint8_t> &mvData)
 {
     if (!m_hEncoder)
@@ -445,8 +492,17 @@ void NvEncoder::DoEncode(NV_ENC_INPUT_PTR inputBuffer, std::vector<std::vector<u
     picParams.inputHeight = GetEncodeHeight();
     picParams.outputBitstream = m_vBitstreamOutputBuffer[m_iToSend % m_nEncoderBuffer];
     picParams.completionEvent = m_vpCompletionEvent[m_iToSend % m_nEncoderBuffer];
+    m_vSubmitTime[m_iToSend % m_nEncoderBuffer] = std::chrono::steady_clock::now();
     NVENCSTATUS nvStatus = m_nvenc.nvEncEncodePicture(m_hEncoder, &picParams);
-    if (nvStatus == NV_ENC_SUCCESS || nvStatus == NV_ENC_ERR_NEED_MORE_INPUT)
+    if ((nvStatus == NV_ENC_SUCCESS || nvStatus == NV_ENC_ERR_NEED_MORE_INPUT) && m_bAsyncOutput)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_asyncMutex);
+            m_iToSend++;
+        }
+        m_asyncCondition.notify_all();
+    }
+    else if (nvStatus == NV_ENC_SUCCESS || nvStatus == NV_ENC_ERR_NEED_MORE_INPUT)
     {
         m_iToSend++;
         GetEncodedPacket(m_vBitstreamOutputBuffer, vPacket, true);
@@ -476,37 +532,166 @@ void NvEncoder::GetEncodedPacket(std::vector<NV_ENC_OUTPUT_PTR> &vOutputBuffer,
 {
     unsigned i = 0;
     int iEnd = bOutputDelay ? m_iToSend - m_nOutputDelay : m_iToSend;
+    m_vPacketStats.clear();
     for (; m_iGot < iEnd; m_iGot++)
     {
-        WaitForCompletionEvent(m_iGot % m_nEncoderBuffer);
-        NV_ENC_LOCK_BITSTREAM lockBitstreamData = { NV_ENC_LOCK_BITSTREAM_VER };
-        lockBitstreamData.outputBitstream = vOutputBuffer[m_iGot % m_nEncoderBuffer];
-        lockBitstreamData.doNotWait = false;
-        NVENC_API_CALL(m_nvenc.nvEncLockBitstream(m_hEncoder, &lockBitstreamData));
-  
-        uint8_t *pData = (uint8_t *)lockBitstreamData.bitstreamBufferPtr;
         if (vPacket.size() < i + 1)
         {
             vPacket.push_back(std::vector<uint8_t>());
         }
-        vPacket[i].clear();
-        vPacket[i].insert(vPacket[i].end(), &pData[0], &pData[lockBitstreamData.bitstreamSizeInBytes]);
+        m_vPacketStats.emplace_back();
+        ReadPacket(vOutputBuffer, m_iGot % m_nEncoderBuffer, vPacket[i], &m_vPacketStats.back());
         i++;
+    }
+}
+
+void NvEncoder::ReadPacket(std::vector<NV_ENC_OUTPUT_PTR> &vOutputBuffer, int iBuffer, std::vector<uint8_t> &packet, NvEncFrameStats *pStats)
+{
+    if (m_sliceCallback && m_initializeParams.enableSubFrameWrite)
+    {
+        ReadSlices(vOutputBuffer[iBuffer]);
+    }
+    WaitForCompletionEvent(iBuffer);
+    auto completionTime = std::chrono::steady_clock::now();
+    NV_ENC_LOCK_BITSTREAM lockBitstreamData = { NV_ENC_LOCK_BITSTREAM_VER };
+    lockBitstreamData.outputBitstream = vOutputBuffer[iBuffer];
+    lockBitstreamData.doNotWait = false;
+    NVENC_API_CALL(m_nvenc.nvEncLockBitstream(m_hEncoder, &lockBitstreamData));
+
+    uint8_t *pData = (uint8_t *)lockBitstreamData.bitstreamBufferPtr;
+    packet.clear();
+    packet.insert(packet.end(), &pData[0], &pData[lockBitstreamData.bitstreamSizeInBytes]);
+
+    if (pStats)
+    {
+        pStats->averageQp = lockBitstreamData.frameAvgQP;
+        pStats->pictureType = lockBitstreamData.pictureType;
+        pStats->sizeInBytes = lockBitstreamData.bitstreamSizeInBytes;
+        pStats->encodeTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            completionTime - m_vSubmitTime[iBuffer]).count();
+    }
+
+    NVENC_API_CALL(m_nvenc.nvEncUnlockBitstream(m_hEncoder, lockBitstreamData.outputBitstream));
+
+    if (m_vMappedInputBuffers[iBuffer])
+    {
+        NVENC_API_CALL(m_nvenc.nvEncUnmapInputResource(m_hEncoder, m_vMappedInputBuffers[iBuffer]));
+        m_vMappedInputBuffers[iBuffer] = nullptr;
+    }
+
+    if (m_bMotionEstimationOnly && m_vMappedRefBuffers[iBuffer])
+    {
+        NVENC_API_CALL(m_nvenc.nvEncUnmapInputResource(m_hEncoder, m_vMappedRefBuffers[iBuffer]));
+        m_vMappedRefBuffers[iBuffer] = nullptr;
+    }
+}
+
+void NvEncoder::ReadSlices(NV_ENC_OUTPUT_PTR outputBuffer)
+{
+    // hwEncodeStatus once the whole picture is written
+    const uint32_t HW_ENCODE_COMPLETE = 2;
+
+    size_t nMacroblocks = ((m_nWidth + 15) / 16) * ((m_nHeight + 15) / 16);
+    if (m_vSliceOffsets.size() < nMacroblocks)
+    {
+        m_vSliceOffsets.resize(nMacroblocks);
+    }
+
+    uint32_t iSlice = 0;
+    bool bComplete = false;
+    while (!bComplete)
+    {
+        NV_ENC_LOCK_BITSTREAM lockBitstreamData = { NV_ENC_LOCK_BITSTREAM_VER };
+        lockBitstreamData.outputBitstream = outputBuffer;
+        lockBitstreamData.doNotWait = true;
+        lockBitstreamData.sliceOffsets = m_vSliceOffsets.data();
+        NVENCSTATUS nvStatus = m_nvenc.nvEncLockBitstream(m_hEncoder, &lockBitstreamData);
+        if (nvStatus == NV_ENC_ERR_LOCK_BUSY)
+        {
+            // Nothing written yet, the encoder only takes a few ms per frame
+            std::this_thread::yield();
+            continue;
+        }
+        if (nvStatus != NV_ENC_SUCCESS)
+        {
+            NVENC_THROW_ERROR("nvEncLockBitstream API failed", nvStatus);
+        }
 
+        // The slice being written is complete once the next one started, the last one once the
+        // picture is. Slices are copied out so that the encoder is not held up by the network.
+        bComplete = lockBitstreamData.hwEncodeStatus == HW_ENCODE_COMPLETE;
+        uint32_t nSlices = lockBitstreamData.numSlices;
+        uint32_t nCompleteSlices = bComplete ? std::max(nSlices, 1u) : (nSlices > 0 ? nSlices - 1 : 0);
+        uint32_t iFirstSlice = iSlice;
+        uint32_t nBegin = iSlice == 0 ? 0 : m_vSliceOffsets[iSlice];
+        uint32_t nEnd = nCompleteSlices < nSlices ? m_vSliceOffsets[nCompleteSlices] : lockBitstreamData.bitstreamSizeInBytes;
+        m_vSliceSizes.clear();
+        if (nCompleteSlices > iSlice && nEnd > nBegin)
+        {
+            uint8_t *pData = (uint8_t *)lockBitstreamData.bitstreamBufferPtr;
+            m_vSlice.assign(pData + nBegin, pData + nEnd);
+            for (; iSlice < nCompleteSlices; iSlice++)
+            {
+                uint32_t nSliceEnd = iSlice + 1 < nCompleteSlices ? m_vSliceOffsets[iSlice + 1] : nEnd;
+                m_vSliceSizes.push_back(nSliceEnd - (iSlice == 0 ? 0 : m_vSliceOffsets[iSlice]));
+            }
+        }
         NVENC_API_CALL(m_nvenc.nvEncUnlockBitstream(m_hEncoder, lockBitstreamData.outputBitstream));
 
-        if (m_vMappedInputBuffers[m_iGot % m_nEncoderBuffer])
+        uint32_t nOffset = 0;
+        for (size_t i = 0; i < m_vSliceSizes.size(); i++)
+        {
+            uint32_t iCallbackSlice = iFirstSlice + (uint32_t)i;
+            m_sliceCallback(m_vSlice.data() + nOffset, m_vSliceSizes[i], iCallbackSlice, bComplete && iCallbackSlice + 1 == iSlice);
+            nOffset += m_vSliceSizes[i];
+        }
+        if (!bComplete && m_vSliceSizes.empty())
         {
-            NVENC_API_CALL(m_nvenc.nvEncUnmapInputResource(m_hEncoder, m_vMappedInputBuffers[m_iGot % m_nEncoderBuffer]));
-            m_vMappedInputBuffers[m_iGot % m_nEncoderBuffer] = nullptr;
+            std::this_thread::yield();
         }
+    }
+}
 
-        if (m_bMotionEstimationOnly && m_vMappedRefBuffers[m_iGot % m_nEncoderBuffer])
+bool NvEncoder::GetNextPacket(std::vector<uint8_t> &packet, NvEncFrameStats *pStats)
+{
+    int iBuffer;
+    {
+        std::unique_lock<std::mutex> lock(m_asyncMutex);
+        m_asyncCondition.wait(lock, [&] { return m_iGot < m_iToSend || m_bAsyncStopped; });
+        if (m_bAsyncStopped)
         {
-            NVENC_API_CALL(m_nvenc.nvEncUnmapInputResource(m_hEncoder, m_vMappedRefBuffers[m_iGot % m_nEncoderBuffer]));
-            m_vMappedRefBuffers[m_iGot % m_nEncoderBuffer] = nullptr;
+            return false;
         }
+        iBuffer = m_iGot % m_nEncoderBuffer;
     }
+
+    ReadPacket(m_vBitstreamOutputBuffer, iBuffer, packet, pStats);
+
+    {
+        std::unique_lock<std::mutex> lock(m_asyncMutex);
+        m_iGot++;
+    }
+    m_asyncCondition.notify_all();
+    return true;
+}
+
+void NvEncoder::StopAsyncOutput()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_asyncMutex);
+        m_bAsyncStopped = true;
+    }
+    m_asyncCondition.notify_all();
+}
+
+void NvEncoder::WaitForFreeBuffer()
+{
+    if (!m_bAsyncOutput)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_asyncMutex);
+    m_asyncCondition.wait(lock, [&] { return m_iToSend - m_iGot < m_nEncoderBuffer || m_bAsyncStopped; });
 }
 
 bool NvEncoder::Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *pReconfigureParams)
@@ -527,6 +712,11 @@ bool NvEncoder::Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *pReconfigureParams)
     return true;
 }
 
+void NvEncoder::InvalidateRefFrames(uint64_t invalidRefFrameTimeStamp)
+{
+    NVENC_API_CALL(m_nvenc.nvEncInvalidateRefFrames(m_hEncoder, invalidRefFrameTimeStamp));
+}
+
 void NvEncoder::RegisterResources(std::vector<void*> inputframes, NV_ENC_INPUT_RESOURCE_TYPE eResourceType,
                                          int width, int height, int pitch, NV_ENC_BUFFER_FORMAT bufferFormat, bool bReferenceFrame)
 {
@@ -623,12 +813,22 @@ void NvEncoder::UnregisterResources()
     }
     m_vRegisteredResourcesForReference.clear();
 
+    for (uint32_t i = 0; i < m_vExternalResources.size(); ++i)
+    {
+        m_nvenc.nvEncUnregisterResource(m_hEncoder, m_vExternalResources[i].second);
+    }
+    m_vExternalResources.clear();
 }
 
 
 void NvEncoder::WaitForCompletionEvent(int iEvent)
 {
 #if defined(_WIN32)
+    if (!m_vpCompletionEvent[iEvent])
+    {
+        // Synchronous mode, nvEncLockBitstream waits
+        return;
+    }
 #ifdef DEBUG
     WaitForSingleObject(m_vpCompletionEvent[iEvent], INFINITE);
 #else
@@ -878,6 +1078,7 @@ void NvEncoder::DoMotionEstimation(NV_ENC_INPUT_PTR inputBuffer, NV_ENC_INPUT_PT
     meParams.inputHeight = GetEncodeHeight();
     meParams.mvBuffer = m_vMVDataOutputBuffer[m_iToSend % m_nEncoderBuffer];
     meParams.completionEvent = m_vpCompletionEvent[m_iToSend % m_nEncoderBuffer];
+    m_vSubmitTime[m_iToSend % m_nEncoderBuffer] = std::chrono::steady_clock::now();
     NVENCSTATUS nvStatus = m_nvenc.nvEncRunMotionEstimationOnly(m_hEncoder, &meParams);
     if (nvStatus == NV_ENC_SUCCESS || nvStatus == NV_ENC_ERR_NEED_MORE_INPUT)
     {
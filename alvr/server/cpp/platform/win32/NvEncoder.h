@@ -12,9 +12,13 @@
 #pragma once
 
 #include <vector>
+#include <functional>
+#include <utility>
 #include "alvr_server/nvEncodeAPI.h"
 #include <stdint.h>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -79,6 +83,18 @@ struct NvEncInputFrame
     NV_ENC_INPUT_RESOURCE_TYPE resourceType;
 };
 
+/**
+* @brief What the encoder reported about one output packet.
+*/
+struct NvEncFrameStats
+{
+    uint32_t averageQp = 0;
+    NV_ENC_PIC_TYPE pictureType = NV_ENC_PIC_TYPE_UNKNOWN;
+    uint32_t sizeInBytes = 0;
+    // From the submission of the frame to its completion event
+    uint64_t encodeTimeUs = 0;
+};
+
 /**
 * @brief Shared base class for different encoder interfaces.
 */
@@ -108,6 +124,13 @@ public:
     */
     bool Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *pReconfigureParams);
 
+    /**
+    *  @brief  This function is used to invalidate a reference frame, identified by
+    *  the NV_ENC_PIC_PARAMS::inputTimeStamp it was encoded with. The next frames
+    *  reference older frames instead, or are intra coded if none is left.
+    */
+    void InvalidateRefFrames(uint64_t invalidRefFrameTimeStamp);
+
     /**
     *  @brief  This function is used to get the next available input buffer.
     *  Applications must call this function to obtain a pointer to the next
@@ -125,6 +148,57 @@ public:
     */
     void EncodeFrame(std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams = nullptr);
 
+    /**
+    *  @brief  This function is used to encode a resource owned by the application.
+    *  It saves copying the data to an input buffer. The resource must have the
+    *  encode size and the pixel format of the encoder. It is registered the first
+    *  time it is encoded and stays registered until the input buffers are released,
+    *  so it must outlive them.
+    */
+    void EncodeExternalFrame(void *pResource, NV_ENC_INPUT_RESOURCE_TYPE eResourceType,
+        std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams = nullptr);
+
+    /**
+    *  @brief  This function is used to retrieve bitstreams on another thread.
+    *  With async output, EncodeFrame() and EncodeExternalFrame() return as soon as
+    *  the frame is submitted and the packets are returned by GetNextPacket().
+    *  The encoder needs an output delay for frames to overlap. Must be enabled
+    *  before the first frame.
+    */
+    void SetAsyncOutput(bool bAsyncOutput) { m_bAsyncOutput = bAsyncOutput; }
+
+    /**
+    *  @brief  This function waits for the oldest submitted frame and returns its bitstream.
+    *  It returns false once StopAsyncOutput() is called.
+    */
+    bool GetNextPacket(std::vector<uint8_t> &packet, NvEncFrameStats *pStats = nullptr);
+
+    /**
+    *  @brief  Callback of the sub-frame output, with a slice of the frame being read, its
+    *  index in the frame and whether it is the last one.
+    */
+    using SliceCallback = std::function<void(uint8_t *pSlice, uint32_t nSize, uint32_t iSlice, bool bLast)>;
+
+    /**
+    *  @brief  This function is used to get the slices of each frame as soon as the encoder
+    *  wrote them. It needs the sub-frame write and the slice offsets of the initialize params,
+    *  which are only supported in synchronous mode. The callback is called on the thread which
+    *  reads the frame, before its packet is returned as usual. nullptr to stop.
+    */
+    void SetSliceOutput(SliceCallback callback) { m_sliceCallback = std::move(callback); }
+
+    /**
+    *  @brief  This function returns the stats of the packets returned by the last call to
+    *  EncodeFrame(), EncodeExternalFrame() or EndEncode(), in the same order.
+    */
+    const std::vector<NvEncFrameStats> &GetPacketStats() const { return m_vPacketStats; }
+
+    /**
+    *  @brief  This function wakes GetNextPacket() up so the output thread can exit.
+    *  EndEncode() returns the frames that were not retrieved.
+    */
+    void StopAsyncOutput();
+
     /**
     *  @brief  This function to flush the encoder queue.
     *  The encoder might be queuing frames for B picture encoding or lookahead;
@@ -332,6 +406,23 @@ private:
     */
     void GetEncodedPacket(std::vector<NV_ENC_OUTPUT_PTR> &vOutputBuffer, std::vector<std::vector<uint8_t>> &vPacket, bool bOutputDelay);
 
+    /**
+    *  @brief  This function copies the bitstream of a completed frame and releases its input.
+    */
+    void ReadPacket(std::vector<NV_ENC_OUTPUT_PTR> &vOutputBuffer, int iBuffer, std::vector<uint8_t> &packet, NvEncFrameStats *pStats = nullptr);
+
+    /**
+    *  @brief  This function polls the bitstream of a frame being encoded with sub-frame write,
+    *  and passes its slices to the slice callback as they complete. It returns once the frame
+    *  is complete.
+    */
+    void ReadSlices(NV_ENC_OUTPUT_PTR outputBuffer);
+
+    /**
+    *  @brief  With async output, this function waits until a buffer is no longer used by the encoder.
+    */
+    void WaitForFreeBuffer();
+
     /**
     *  @brief This is a private function which is used to initialize MV output buffers.
     *  This is only used in ME-only Mode.
@@ -370,6 +461,7 @@ protected:
     std::vector<NV_ENC_REGISTERED_PTR> m_vRegisteredResources;
     std::vector<NvEncInputFrame> m_vReferenceFrames;
     std::vector<NV_ENC_REGISTERED_PTR> m_vRegisteredResourcesForReference;
+    std::vector<std::pair<void *, NV_ENC_REGISTERED_PTR>> m_vExternalResources;
 private:
     uint32_t m_nWidth;
     uint32_t m_nHeight;
@@ -385,6 +477,13 @@ private:
     std::vector<NV_ENC_OUTPUT_PTR> m_vBitstreamOutputBuffer;
     std::vector<NV_ENC_OUTPUT_PTR> m_vMVDataOutputBuffer;
     std::vector<void *> m_vpCompletionEvent;
+    std::vector<std::chrono::steady_clock::time_point> m_vSubmitTime;
+    std::vector<NvEncFrameStats> m_vPacketStats;
+    SliceCallback m_sliceCallback;
+    // Filled by nvEncLockBitstream, one entry per macroblock of the frame at most
+    std::vector<uint32_t> m_vSliceOffsets;
+    std::vector<uint8_t> m_vSlice;
+    std::vector<uint32_t> m_vSliceSizes;
     uint32_t m_nMaxEncodeWidth = 0;
     uint32_t m_nMaxEncodeHeight = 0;
     void* m_hModule = nullptr;
@@ -392,4 +491,9 @@ private:
     int32_t m_iGot = 0;
     int32_t m_nEncoderBuffer = 0;
     int32_t m_nOutputDelay = 0;
+    bool m_bAsyncOutput = false;
+    bool m_bAsyncStopped = false;
+    // Guards m_iToSend and m_iGot with async output
+    std::mutex m_asyncMutex;
+    std::condition_variable m_asyncCondition;
 };
@@ -1,9 +1,15 @@
 #include "OvrDirectModeComponent.h"
 
+#include <algorithm>
+
 OvrDirectModeComponent::OvrDirectModeComponent(std::shared_ptr<CD3DRender> pD3DRender, std::shared_ptr<PoseHistory> poseHistory)
 	: m_pD3DRender(pD3DRender)
 	, m_poseHistory(poseHistory)
 	, m_submitLayer(0)
+	, m_targetTimestampNs(0)
+	, m_prevTargetTimestampNs(0)
+	, m_encodedLayerCount(0)
+	, m_lastEncodeUs(0)
 {
 }
 
@@ -11,6 +17,10 @@ void OvrDirectModeComponent::SetEncoder(std::shared_ptr<CEncoder> pEncoder) {
 	m_pEncoder = pEncoder;
 }
 
+void OvrDirectModeComponent::SetListener(std::shared_ptr<ClientConnection> listener) {
+	m_Listener = listener;
+}
+
 /** Specific to Oculus compositor support, textures supplied must be created using this method. */
 void OvrDirectModeComponent::CreateSwapTextureSet(uint32_t unPid, const SwapTextureSetDesc_t *pSwapTextureSetDesc, SwapTextureSet_t *pOutSwapTextureSet)
 {
@@ -50,7 +60,19 @@ void OvrDirectModeComponent::CreateSwapTextureSet(uint32_t unPid, const SwapText
 		hr = pResource->GetSharedHandle(&processResource->sharedHandles[i]);
 		//LogDriver("GetSharedHandle %p res:%d %s", processResource->sharedHandles[i], hr, GetDxErrorStr(hr).c_str());
 
-		m_handleMap.insert(std::make_pair(processResource->sharedHandles[i], std::make_pair(processResource, i)));
+		// Used for every frame the texture is submitted in
+		D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc = {};
+		SRVDesc.Format = SharedTextureDesc.Format;
+		SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		SRVDesc.Texture2D.MostDetailedMip = 0;
+		SRVDesc.Texture2D.MipLevels = 1;
+		hr = m_pD3DRender->GetDevice()->CreateShaderResourceView(processResource->textures[i].Get(), &SRVDesc, &processResource->views[i]);
+		if (FAILED(hr)) {
+			Error("CreateShaderResourceView %p %ls\n", hr, GetErrorStr(hr).c_str());
+		}
+
+		m_swapTextures.push_back({ processResource->sharedHandles[i], processResource,
+			processResource->textures[i].Get(), processResource->views[i].Get() });
 
 		pOutSwapTextureSet->rSharedTextureHandles[i] = (vr::SharedTextureHandle_t)processResource->sharedHandles[i];
 
@@ -66,14 +88,10 @@ void OvrDirectModeComponent::DestroySwapTextureSet(vr::SharedTextureHandle_t sha
 {
 	Debug("DestroySwapTextureSet %p\n", sharedTextureHandle);
 
-	auto it = m_handleMap.find((HANDLE)sharedTextureHandle);
-	if (it != m_handleMap.end()) {
+	const SwapTexture *swapTexture = FindSwapTexture((HANDLE)sharedTextureHandle);
+	if (swapTexture) {
 		// Release all reference (a bit forcible)
-		ProcessResource *p = it->second.first;
-		m_handleMap.erase(p->sharedHandles[0]);
-		m_handleMap.erase(p->sharedHandles[1]);
-		m_handleMap.erase(p->sharedHandles[2]);
-		delete p;
+		DestroySet(swapTexture->set);
 	}
 	else {
 		Debug("Requested to destroy not managing texture. handle:%p\n", sharedTextureHandle);
@@ -85,19 +103,34 @@ void OvrDirectModeComponent::DestroyAllSwapTextureSets(uint32_t unPid)
 {
 	Debug("DestroyAllSwapTextureSets pid=%d\n", unPid);
 
-	for (auto it = m_handleMap.begin(); it != m_handleMap.end();) {
-		if (it->second.first->pid == unPid) {
-			if (it->second.second == 0) {
-				delete it->second.first;
-			}
-			m_handleMap.erase(it++);
+	for (size_t i = 0; i < m_swapTextures.size();) {
+		if (m_swapTextures[i].set->pid == unPid) {
+			// Removes the entries of the set, the next one takes their place
+			DestroySet(m_swapTextures[i].set);
 		}
 		else {
-			++it;
+			i++;
 		}
 	}
 }
 
+void OvrDirectModeComponent::DestroySet(ProcessResource *set)
+{
+	m_swapTextures.erase(std::remove_if(m_swapTextures.begin(), m_swapTextures.end(),
+		[set](const SwapTexture &swapTexture) { return swapTexture.set == set; }), m_swapTextures.end());
+	delete set;
+}
+
+const OvrDirectModeComponent::SwapTexture *OvrDirectModeComponent::FindSwapTexture(HANDLE sharedHandle)
+{
+	for (const SwapTexture &swapTexture : m_swapTextures) {
+		if (swapTexture.sharedHandle == sharedHandle) {
+			return &swapTexture;
+		}
+	}
+	return NULL;
+}
+
 /** After Present returns, calls this to get the next index to use for rendering. */
 void OvrDirectModeComponent::GetNextSwapTextureSetIndex(vr::SharedTextureHandle_t sharedTextureHandles[2], uint32_t(*pIndices)[2])
 {
@@ -172,53 +205,80 @@ void OvrDirectModeComponent::SubmitLayer(const SubmitLayerPerEye_t(&perEye)[2])
 /** Submits queued layers for display. */
 void OvrDirectModeComponent::Present(vr::SharedTextureHandle_t syncTexture)
 {
+	uint64_t presentStartUs = GetTimestampUs();
 	bool useMutex = true;
 	Debug("Present syncTexture=%p (use:%d) m_prevSubmitFrameIndex=%llu m_submitFrameIndex=%llu\n", syncTexture, useMutex, m_prevTargetTimestampNs, m_targetTimestampNs);
 
-	IDXGIKeyedMutex *pKeyedMutex = NULL;
-
 	uint32_t layerCount = m_submitLayer;
 	m_submitLayer = 0;
 
-	if (m_prevTargetTimestampNs == m_targetTimestampNs) {
-		Debug("Discard duplicated frame. FrameIndex=%llu (Ignoring)\n", m_targetTimestampNs);
-		//return;
+	if (IsDuplicateFrame(layerCount)) {
+		// The client keeps reprojecting the frame it already has
+		Debug("Discard duplicated frame. FrameIndex=%llu\n", m_targetTimestampNs);
+		if (m_Listener) {
+			m_Listener->GetStatistics()->DuplicateFrameSkipped();
+		}
+		return;
 	}
 
-	ID3D11Texture2D *pSyncTexture = m_pD3DRender->GetSharedTexture((HANDLE)syncTexture);
-	if (!pSyncTexture)
+	ResolveSyncTexture((HANDLE)syncTexture);
+	if (!m_syncTexture)
 	{
 		Warn("[VDispDvr] SyncTexture is NULL!\n");
 		return;
 	}
 
+	IDXGIKeyedMutex *pKeyedMutex = m_syncMutex.Get();
 	if (useMutex) {
 		// Access to shared texture must be wrapped in AcquireSync/ReleaseSync
 		// to ensure the compositor has finished rendering to it before it gets used.
 		// This enforces scheduling of work on the gpu between processes.
-		if (SUCCEEDED(pSyncTexture->QueryInterface(__uuidof(IDXGIKeyedMutex), (void **)&pKeyedMutex)))
+		if (pKeyedMutex)
 		{
 			Debug("[VDispDvr] Wait for SyncTexture Mutex.\n");
-			// TODO: Reasonable timeout and timeout handling
-			HRESULT hr = pKeyedMutex->AcquireSync(0, 10);
+			// The key only waits for the compositor to have queued its ReleaseSync, the gpu orders
+			// its rendering before our copies. If it is not there yet, keep waiting until the frame
+			// would miss the next vsync anyway.
+			HRESULT hr = pKeyedMutex->AcquireSync(0, 0);
+			bool late = hr == WAIT_TIMEOUT;
+			if (late) {
+				uint64_t elapsedUs = GetTimestampUs() - presentStartUs;
+				uint64_t frameIntervalUs = 1000 * 1000 / Settings::Instance().m_refreshRate;
+				DWORD timeoutMs = elapsedUs < frameIntervalUs ? (DWORD)((frameIntervalUs - elapsedUs) / 1000) : 0;
+				hr = pKeyedMutex->AcquireSync(0, timeoutMs);
+			}
+			if (hr == WAIT_ABANDONED) {
+				// The compositor released its device while holding the key, the content is undefined.
+				pKeyedMutex->ReleaseSync(0);
+			}
 			if (hr != S_OK)
 			{
-				Debug("[VDispDvr] ACQUIRESYNC FAILED!!! hr=%d %p %ls\n", hr, hr, GetErrorStr(hr).c_str());
-				pKeyedMutex->Release();
+				Warn("[VDispDvr] Dropping frame, AcquireSync failed. hr=%d %p %ls\n", hr, hr, GetErrorStr(hr).c_str());
+				if (m_Listener) {
+					m_Listener->GetStatistics()->CompositorFrameDropped();
+				}
 				return;
 			}
+			if (late && m_Listener) {
+				m_Listener->GetStatistics()->CompositorFrameLate();
+			}
 		}
 
 		Debug("[VDispDvr] Mutex Acquired.\n");
 	}
 
 	CopyTexture(layerCount);
+	for (uint32_t i = 0; i < layerCount; i++) {
+		m_encodedLayers[i][0] = m_submitLayers[i][0];
+		m_encodedLayers[i][1] = m_submitLayers[i][1];
+	}
+	m_encodedLayerCount = layerCount;
+	m_lastEncodeUs = GetTimestampUs();
 
 	if (useMutex) {
 		if (pKeyedMutex)
 		{
 			pKeyedMutex->ReleaseSync(0);
-			pKeyedMutex->Release();
 		}
 		Debug("[VDispDvr] Mutex Released.\n");
 	}
@@ -228,44 +288,79 @@ void OvrDirectModeComponent::Present(vr::SharedTextureHandle_t syncTexture)
 	}
 }
 
+void OvrDirectModeComponent::ResolveSyncTexture(HANDLE syncHandle)
+{
+	if (syncHandle == m_syncHandle && m_syncTexture) {
+		return;
+	}
+	m_syncHandle = syncHandle;
+	m_syncMutex.Reset();
+
+	// Opened once by CD3DRender, which keeps it
+	m_syncTexture = m_pD3DRender->GetSharedTexture(syncHandle);
+	if (m_syncTexture) {
+		m_syncTexture->QueryInterface(__uuidof(IDXGIKeyedMutex), (void **)m_syncMutex.GetAddressOf());
+		Debug("Sync texture %p keyed mutex %p\n", syncHandle, m_syncMutex.Get());
+	}
+}
+
+bool OvrDirectModeComponent::IsDuplicateFrame(uint32_t layerCount) {
+	if (!m_pEncoder || m_targetTimestampNs == 0 || m_targetTimestampNs != m_prevTargetTimestampNs
+		|| layerCount != m_encodedLayerCount || layerCount == 0) {
+		return false;
+	}
+	// Recovering from a loss needs a new frame even if the picture did not change
+	if (m_pEncoder->IsRecoveryPending() || GetTimestampUs() - m_lastEncodeUs > DUPLICATE_REFRESH_US) {
+		return false;
+	}
+	for (uint32_t i = 0; i < layerCount; i++) {
+		for (int eye = 0; eye < 2; eye++) {
+			const SubmitLayerPerEye_t &layer = m_submitLayers[i][eye];
+			const SubmitLayerPerEye_t &encoded = m_encodedLayers[i][eye];
+			if (layer.hTexture != encoded.hTexture || memcmp(&layer.bounds, &encoded.bounds, sizeof(layer.bounds)) != 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 void OvrDirectModeComponent::CopyTexture(uint32_t layerCount) {
 
 	uint64_t presentationTime = GetTimestampUs();
 
 	ID3D11Texture2D *pTexture[MAX_LAYERS][2];
-	ComPtr<ID3D11Texture2D> Texture[MAX_LAYERS][2];
+	ID3D11ShaderResourceView *pView[MAX_LAYERS][2] = {};
 	vr::VRTextureBounds_t bounds[MAX_LAYERS][2];
 
 	for (uint32_t i = 0; i < layerCount; i++) {
+		pTexture[i][0] = pTexture[i][1] = NULL;
+
 		// Find left eye texture.
 		HANDLE leftEyeTexture = (HANDLE)m_submitLayers[i][0].hTexture;
-		auto it = m_handleMap.find(leftEyeTexture);
-		if (it == m_handleMap.end()) {
+		const SwapTexture *left = FindSwapTexture(leftEyeTexture);
+		if (!left) {
 			// Ignore this layer.
-			Debug("Submitted texture is not found on HandleMap. eye=right layer=%d/%d Texture Handle=%p\n", i, layerCount, leftEyeTexture);
+			Debug("Submitted texture is not a swap texture. eye=right layer=%d/%d Texture Handle=%p\n", i, layerCount, leftEyeTexture);
 		}
 		else {
-			Texture[i][0] = it->second.first->textures[it->second.second];
-			D3D11_TEXTURE2D_DESC desc;
-			Texture[i][0]->GetDesc(&desc);
-
-			Debug("CopyTexture: layer=%d/%d pid=%d Texture Size=%dx%d Format=%d\n", i, layerCount, it->second.first->pid, desc.Width, desc.Height, desc.Format);
+			Debug("CopyTexture: layer=%d/%d pid=%d\n", i, layerCount, left->set->pid);
 
 			// Find right eye texture.
 			HANDLE rightEyeTexture = (HANDLE)m_submitLayers[i][1].hTexture;
-			it = m_handleMap.find(rightEyeTexture);
-			if (it == m_handleMap.end()) {
+			const SwapTexture *right = FindSwapTexture(rightEyeTexture);
+			if (!right) {
 				// Ignore this layer
-				Debug("Submitted texture is not found on HandleMap. eye=left layer=%d/%d Texture Handle=%p\n", i, layerCount, rightEyeTexture);
-				Texture[i][0].Reset();
+				Debug("Submitted texture is not a swap texture. eye=left layer=%d/%d Texture Handle=%p\n", i, layerCount, rightEyeTexture);
 			}
 			else {
-				Texture[i][1] = it->second.first->textures[it->second.second];
+				pTexture[i][0] = left->texture;
+				pTexture[i][1] = right->texture;
+				pView[i][0] = left->view;
+				pView[i][1] = right->view;
 			}
 		}
 
-		pTexture[i][0] = Texture[i][0].Get();
-		pTexture[i][1] = Texture[i][1].Get();
 		bounds[i][0] = m_submitLayers[i][0].bounds;
 		bounds[i][1] = m_submitLayers[i][1].bounds;
 	}
@@ -274,12 +369,8 @@ void OvrDirectModeComponent::CopyTexture(uint32_t layerCount) {
 	m_pD3DRender->GetContext()->Flush();
 
 	if (m_pEncoder) {
-		Debug("Waiting for finish of previous encode.\n");
-
-		// Wait for the encoder to be ready.  This is important because the encoder thread
-		// blocks on transmit which uses our shared d3d context (which is not thread safe).
-		m_pEncoder->WaitForEncode();
-
+		// The composed frame goes to a free slot of the encoder staging ring, so this only waits
+		// for the previous encode when the d3d context cannot be shared.
 		std::string debugText;
 
 		uint64_t submitFrameIndex = m_targetTimestampNs + Settings::Instance().m_trackingFrameOffset;
@@ -287,7 +378,7 @@ void OvrDirectModeComponent::CopyTexture(uint32_t layerCount) {
 			, m_targetTimestampNs, Settings::Instance().m_trackingFrameOffset, submitFrameIndex);
 
 		// Copy entire texture to staging so we can read the pixels to send to remote device.
-		m_pEncoder->CopyToStaging(pTexture, bounds, layerCount,false, presentationTime, submitFrameIndex,"", debugText);
+		m_pEncoder->CopyToStaging(pTexture, pView, bounds, layerCount,false, presentationTime, submitFrameIndex, m_framePoseRotation, "", debugText);
 
 		m_pD3DRender->GetContext()->Flush();
 	}
@@ -14,6 +14,8 @@ public:
 	OvrDirectModeComponent(std::shared_ptr<CD3DRender> pD3DRender, std::shared_ptr<PoseHistory> poseHistory);
 
 	void SetEncoder(std::shared_ptr<CEncoder> pEncoder);
+	// Receives the dropped and late compositor frame counts
+	void SetListener(std::shared_ptr<ClientConnection> listener);
 
 	/** Specific to Oculus compositor support, textures supplied must be created using this method. */
 	virtual void CreateSwapTextureSet( uint32_t unPid, const SwapTextureSetDesc_t *pSwapTextureSetDesc, SwapTextureSet_t *pOutSwapTextureSet );
@@ -37,6 +39,9 @@ public:
 	void CopyTexture(uint32_t layerCount);
 
 private:
+	// The layers of the present are the ones of the last encoded frame, with the same pose
+	bool IsDuplicateFrame(uint32_t layerCount);
+
 	std::shared_ptr<CD3DRender> m_pD3DRender;
 	std::shared_ptr<CEncoder> m_pEncoder;
 	std::shared_ptr<ClientConnection> m_Listener;
@@ -45,10 +50,32 @@ private:
 	// Resource for each process
 	struct ProcessResource {
 		ComPtr<ID3D11Texture2D> textures[3];
+		// Created with the textures, the composition does not create views per frame
+		ComPtr<ID3D11ShaderResourceView> views[3];
 		HANDLE sharedHandles[3];
 		uint32_t pid;
 	};
-	std::map<HANDLE, std::pair<ProcessResource *, int> > m_handleMap;
+	// Submitted handle resolved to what the composition uses, owned by the ProcessResource
+	struct SwapTexture {
+		HANDLE sharedHandle;
+		ProcessResource *set;
+		ID3D11Texture2D *texture;
+		ID3D11ShaderResourceView *view;
+	};
+	// NULL if the handle is not of a texture set
+	const SwapTexture *FindSwapTexture(HANDLE sharedHandle);
+	// Opens the sync texture of the compositor when its handle changes, m_syncTexture is NULL if
+	// it cannot be opened
+	void ResolveSyncTexture(HANDLE syncHandle);
+	void DestroySet(ProcessResource *set);
+
+	// A few entries for each running application, contiguous to be scanned on every layer
+	std::vector<SwapTexture> m_swapTextures;
+
+	HANDLE m_syncHandle = NULL;
+	ID3D11Texture2D *m_syncTexture = NULL;
+	// NULL if the sync texture has no keyed mutex
+	ComPtr<IDXGIKeyedMutex> m_syncMutex;
 
 	static const int MAX_LAYERS = 10;
 	int m_submitLayer;
@@ -57,4 +84,12 @@ private:
 	vr::HmdQuaternion_t m_framePoseRotation;
 	uint64_t m_targetTimestampNs;
 	uint64_t m_prevTargetTimestampNs;
+
+	// Layers of the last encoded frame
+	SubmitLayerPerEye_t m_encodedLayers[MAX_LAYERS][2];
+	uint32_t m_encodedLayerCount;
+	uint64_t m_lastEncodeUs;
+	// A duplicate is still encoded after this long, so the client and the rate controllers keep
+	// getting frames while the application is stalled
+	static const uint64_t DUPLICATE_REFRESH_US = 1000 * 1000;
 };
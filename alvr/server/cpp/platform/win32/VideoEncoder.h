@@ -3,6 +3,7 @@
 #include <memory>
 #include "shared/d3drender.h"
 #include "alvr_server/ClientConnection.h"
+#include "alvr_server/EncoderRate.h"
 #include "NvEncoderD3D11.h"
 
 class VideoEncoder
@@ -12,4 +13,22 @@ public:
 	virtual void Shutdown() = 0;
 
 	virtual void Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR) = 0;
+
+	// Called between frames when the bitrate changed. The new rate applies from the next frame,
+	// without reinitializing the encoder.
+	virtual void Reconfigure(const EncoderRate &rate) = 0;
+
+	// Called instead of inserting an IDR after packet loss. Returns false if the encoder cannot
+	// refresh the picture gradually, the caller then falls back to an IDR.
+	virtual bool StartIntraRefresh() { return false; }
+
+	// Called before the next frame when the client lost the frames after the one of target
+	// timestamp lastGoodTimestampNs, so that they are not referenced anymore. Returns false if the
+	// encoder cannot do it, the caller then falls back to packet loss recovery.
+	virtual bool InvalidateReferences(uint64_t lastGoodTimestampNs) { return false; }
+
+	// Called before each Transmit with the head orientations the last encoded frame and the next
+	// one were rendered with, zero if unknown. Encoders taking motion estimation hints derive them
+	// from the rotation.
+	virtual void SetHeadRotation(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current) {}
 };
@@ -0,0 +1,66 @@
+#include "VideoEncoderDualStream.h"
+
+VideoEncoderDualStream::VideoEncoderDualStream(std::shared_ptr<VideoEncoder> left, std::shared_ptr<VideoEncoder> right)
+	: m_streams{ left, right }
+{
+}
+
+void VideoEncoderDualStream::Initialize()
+{
+	m_streams[0]->Initialize();
+	try {
+		m_streams[1]->Initialize();
+	}
+	catch (...) {
+		m_streams[0]->Shutdown();
+		throw;
+	}
+}
+
+void VideoEncoderDualStream::Shutdown()
+{
+	for (auto &stream : m_streams) {
+		stream->Shutdown();
+	}
+}
+
+void VideoEncoderDualStream::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR)
+{
+	// The streams reference only their own previous frames, an IDR has to restart both
+	for (auto &stream : m_streams) {
+		stream->Transmit(pTexture, presentationTime, targetTimestampNs, insertIDR);
+	}
+}
+
+void VideoEncoderDualStream::Reconfigure(const EncoderRate &rate)
+{
+	for (auto &stream : m_streams) {
+		stream->Reconfigure(rate);
+	}
+}
+
+bool VideoEncoderDualStream::StartIntraRefresh()
+{
+	// The lost packet may belong to either stream
+	bool started = true;
+	for (auto &stream : m_streams) {
+		started = stream->StartIntraRefresh() && started;
+	}
+	return started;
+}
+
+bool VideoEncoderDualStream::InvalidateReferences(uint64_t lastGoodTimestampNs)
+{
+	bool invalidated = true;
+	for (auto &stream : m_streams) {
+		invalidated = stream->InvalidateReferences(lastGoodTimestampNs) && invalidated;
+	}
+	return invalidated;
+}
+
+void VideoEncoderDualStream::SetHeadRotation(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current)
+{
+	for (auto &stream : m_streams) {
+		stream->SetHeadRotation(reference, current);
+	}
+}
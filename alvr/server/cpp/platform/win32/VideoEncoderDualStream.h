@@ -0,0 +1,24 @@
+#pragma once
+
+#include <memory>
+#include "VideoEncoder.h"
+
+// Encodes each eye with its own encoder session, so that the halves of the frame are encoded in
+// parallel and the client can decode them on two decoders. The encoders are given the whole frame
+// and crop their eye, see the stream parameters of VideoEncoderNVENC.
+class VideoEncoderDualStream : public VideoEncoder
+{
+public:
+	VideoEncoderDualStream(std::shared_ptr<VideoEncoder> left, std::shared_ptr<VideoEncoder> right);
+
+	void Initialize();
+	void Shutdown();
+
+	void Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR);
+	void Reconfigure(const EncoderRate &rate);
+	bool StartIntraRefresh();
+	bool InvalidateReferences(uint64_t lastGoodTimestampNs);
+	void SetHeadRotation(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current);
+private:
+	std::shared_ptr<VideoEncoder> m_streams[2];
+};
@@ -1,8 +1,14 @@
 
 #include "VideoEncoderNVENC.h"
+
+#include <algorithm>
+#include <cstdlib>
+
 #include "NvCodecUtils.h"
 #include "alvr_server/nvencoderclioptions.h"
 
+#include "alvr_server/FoveatedEncoding.h"
+#include "alvr_server/MotionHint.h"
 #include "alvr_server/Statistics.h"
 #include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
@@ -10,16 +16,25 @@
 
 VideoEncoderNVENC::VideoEncoderNVENC(std::shared_ptr<CD3DRender> pD3DRender
 	, std::shared_ptr<ClientConnection> listener
-	, int width, int height)
+	, int width, int height, DXGI_FORMAT format
+	, uint8_t streamIndex, int streamCount)
 	: m_pD3DRender(pD3DRender)
 	, m_nFrame(0)
 	, m_Listener(listener)
+	, m_streamIndex(streamIndex)
+	, m_streamCount(streamCount)
 	, m_codec(Settings::Instance().m_codec)
 	, m_refreshRate(Settings::Instance().m_refreshRate)
-	, m_renderWidth(width)
+	, m_renderWidth(width / streamCount)
 	, m_renderHeight(height)
-	, m_bitrateInMBits(Settings::Instance().mEncodeBitrateMBs)
+	, m_inputFormat(format)
+	, m_bitrateInMBits(Settings::Instance().GetLive().mEncodeBitrateMBs)
+	, m_pipelineDepth(Settings::Instance().m_nvencPipelineDepth)
 {
+	// Transmit would wait for each session in turn otherwise
+	if (m_streamCount > 1 && m_pipelineDepth == 0) {
+		m_pipelineDepth = 1;
+	}
 	
 }
 
@@ -34,28 +49,90 @@ void VideoEncoderNVENC::Initialize()
 
 	NV_ENC_BUFFER_FORMAT format = NV_ENC_BUFFER_FORMAT_ABGR;
 	
-	if (Settings::Instance().m_use10bitEncoder) {
+	if (m_inputFormat == DXGI_FORMAT_P010) {
+		format = NV_ENC_BUFFER_FORMAT_YUV420_10BIT;
+	}
+	else if (Settings::Instance().m_use10bitEncoder) {
 		format = NV_ENC_BUFFER_FORMAT_ABGR10;
 	}
+	else if (m_inputFormat == DXGI_FORMAT_NV12) {
+		format = NV_ENC_BUFFER_FORMAT_NV12;
+	}
+
+	// NV_ENC_CODEC_AV1_GUID (Ada) needs the NVENC API 12, the bundled headers are 8.1
+	if (m_codec == ALVR_CODEC_AV1) {
+		throw MakeException("AV1 is not supported by this NVENC API version");
+	}
 
-	Debug("Initializing CNvEncoder. Width=%d Height=%d Format=%d\n", m_renderWidth, m_renderHeight, format);
+	Debug("Initializing CNvEncoder. Width=%d Height=%d Format=%d Stream=%d/%d\n", m_renderWidth, m_renderHeight, format, m_streamIndex, m_streamCount);
 
 	try {
-		m_NvNecoder = std::make_shared<NvEncoderD3D11>(m_pD3DRender->GetDevice(), m_renderWidth, m_renderHeight, format, 0);
+		// The extra output delay adds the input and output buffers of the frames in flight.
+		uint32_t extraOutputDelay = m_pipelineDepth > 0 ? m_pipelineDepth - 1 : 0;
+		m_NvNecoder = std::make_shared<NvEncoderD3D11>(m_pD3DRender->GetDevice(), m_renderWidth, m_renderHeight, format, extraOutputDelay);
+		m_NvNecoder->SetAsyncOutput(m_pipelineDepth > 0);
 	}
 	catch (NVENCException e) {
 		throw MakeException("NvEnc NvEncoderD3D11 failed. Code=%d %hs\n", e.getErrorCode(), e.what());
 	}
 
+	if (FoveatedEncodingEnabled()) {
+		uint32_t blockSize = m_codec == ALVR_CODEC_H264 ? 16 : 32;
+		if (m_streamCount == 1) {
+			m_qpDeltaMap = BuildFoveationQpMap(m_renderWidth, m_renderHeight, blockSize);
+		}
+		else if (m_renderWidth % blockSize == 0) {
+			// The map of the whole frame, restricted to the columns of blocks of this eye
+			auto frameMap = BuildFoveationQpMap(m_renderWidth * m_streamCount, m_renderHeight, blockSize);
+			uint32_t eyeBlocksX = m_renderWidth / blockSize;
+			uint32_t frameBlocksX = eyeBlocksX * m_streamCount;
+			for (size_t row = 0; row < frameMap.size() / frameBlocksX; row++) {
+				auto begin = frameMap.begin() + row * frameBlocksX + m_streamIndex * eyeBlocksX;
+				m_qpDeltaMap.insert(m_qpDeltaMap.end(), begin, begin + eyeBlocksX);
+			}
+		}
+		else {
+			Warn("VideoEncoderNVENC: The eye width %d is not a multiple of %d, foveated encoding is disabled.\n", m_renderWidth, blockSize);
+		}
+	}
+
+	if (Settings::Instance().m_nvencMotionHints) {
+		// The eyes of a single stream are the halves of the picture, the blocks get a second
+		// candidate in the other eye
+		m_hintsPerBlock = m_streamCount == 1 && Settings::Instance().m_nvencInterEyeHints ? 2 : 1;
+		m_meHints.resize(((m_renderWidth + 15) / 16) * ((m_renderHeight + 15) / 16) * m_hintsPerBlock);
+	}
+
+	GUID encoderGuid = m_codec == ALVR_CODEC_H264 ? NV_ENC_CODEC_H264_GUID : NV_ENC_CODEC_HEVC_GUID;
+	m_sliceOutput = Settings::Instance().m_slicesPerFrame > 1
+		&& m_NvNecoder->GetCapabilityValue(encoderGuid, NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK);
+	Debug("VideoEncoderNVENC: SliceOutput: %d\n", m_sliceOutput);
+
 	NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
 	NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
 	initializeParams.encodeConfig = &encodeConfig;
+	EncoderRate rate = EncoderRate::ForBitrate(m_bitrateInMBits * 1'000'000ull, (float)m_refreshRate);
 
-	FillEncodeConfig(initializeParams, m_refreshRate, m_renderWidth, m_renderHeight, m_bitrateInMBits * 1'000'000);
-	   
+	FillEncodeConfig(initializeParams, m_renderWidth, m_renderHeight, rate);
 
 	try {
-		m_NvNecoder->CreateEncoder(&initializeParams);
+		try {
+			m_NvNecoder->CreateEncoder(&initializeParams);
+		}
+		catch (NVENCException e) {
+			if (m_meHints.empty()) {
+				throw;
+			}
+			// There is no capability for the external hints, older GPUs reject them
+			Warn("VideoEncoderNVENC: Motion hints are not supported. Code=%d\n", e.getErrorCode());
+			m_meHints.clear();
+			m_hintsPerBlock = 0;
+			initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+			encodeConfig = { NV_ENC_CONFIG_VER };
+			initializeParams.encodeConfig = &encodeConfig;
+			FillEncodeConfig(initializeParams, m_renderWidth, m_renderHeight, rate);
+			m_NvNecoder->CreateEncoder(&initializeParams);
+		}
 	}
 	catch (NVENCException e) {
 		if (e.getErrorCode() == NV_ENC_ERR_INVALID_PARAM) {
@@ -64,14 +141,33 @@ void VideoEncoderNVENC::Initialize()
 		throw MakeException("NvEnc CreateEncoder failed. Code=%d %hs", e.getErrorCode(), e.what());
 	}
 
-	Debug("CNvEncoder is successfully initialized.\n");
+	if (m_sliceOutput) {
+		m_NvNecoder->SetSliceOutput([this](uint8_t *slice, uint32_t size, uint32_t sliceIndex, bool last) {
+			SendSlice(slice, size, sliceIndex, last);
+		});
+	}
+	if (m_pipelineDepth > 0) {
+		m_outputThread = new std::thread(&VideoEncoderNVENC::RunOutput, this);
+	}
+
+	Debug("CNvEncoder is successfully initialized. PipelineDepth=%d\n", m_pipelineDepth);
 }
 
 void VideoEncoderNVENC::Shutdown()
 {
+	if (m_outputThread) {
+		m_NvNecoder->StopAsyncOutput();
+		m_outputThread->join();
+		delete m_outputThread;
+		m_outputThread = nullptr;
+	}
+
 	std::vector<std::vector<uint8_t>> vPacket;
-	if(m_NvNecoder)
+	if(m_NvNecoder) {
+		// The frames left are only written to the dump
+		m_NvNecoder->SetSliceOutput(nullptr);
 		m_NvNecoder->EndEncode(vPacket);
+	}
 
 	for (std::vector<uint8_t> &packet : vPacket)
 	{
@@ -93,52 +189,267 @@ void VideoEncoderNVENC::Shutdown()
 
 void VideoEncoderNVENC::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR)
 {
-	if (m_Listener) {
-		if (m_Listener->GetStatistics()->CheckBitrateUpdated()) {
-			m_bitrateInMBits = m_Listener->GetStatistics()->GetBitrate();
-			NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
-			NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
-			initializeParams.encodeConfig = &encodeConfig;
-			FillEncodeConfig(initializeParams, m_refreshRate, m_renderWidth, m_renderHeight, m_bitrateInMBits * 1'000'000);
-			NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
-			reconfigureParams.reInitEncodeParams = initializeParams;
-			m_NvNecoder->Reconfigure(&reconfigureParams);
-		}
-	}
-
 	std::vector<std::vector<uint8_t>> vPacket;
 
-	const NvEncInputFrame* encoderInputFrame = m_NvNecoder->GetNextInputFrame();
+	// Textures of the encoder size and format are encoded in place, others are copied to an input buffer.
+	// In async mode the texture is reused by the caller while it is encoded, so it is always copied.
+	D3D11_TEXTURE2D_DESC desc;
+	pTexture->GetDesc(&desc);
+	// The RGB 10 bit buffers are ABGR10, P010 textures are taken as they are.
+	bool canEncodeInPlace = m_pipelineDepth == 0
+		&& (!Settings::Instance().m_use10bitEncoder || m_inputFormat == DXGI_FORMAT_P010)
+		&& desc.Format == m_inputFormat
+		&& desc.Width == (UINT)m_renderWidth && desc.Height == (UINT)m_renderHeight;
+
+	if (m_pipelineDepth > 0) {
+		std::unique_lock<std::mutex> lock(m_pendingMutex);
+		m_pendingFrames.push_back({ presentationTime, targetTimestampNs });
+	}
 
-	ID3D11Texture2D *pInputTexture = reinterpret_cast<ID3D11Texture2D*>(encoderInputFrame->inputPtr);
-	m_pD3DRender->GetContext()->CopyResource(pInputTexture, pTexture);
+	if (!canEncodeInPlace) {
+		const NvEncInputFrame* encoderInputFrame = m_NvNecoder->GetNextInputFrame();
+
+		ID3D11Texture2D *pInputTexture = reinterpret_cast<ID3D11Texture2D*>(encoderInputFrame->inputPtr);
+		if (m_streamCount > 1) {
+			// Eyes are side by side in the frame
+			D3D11_BOX box = { (UINT)(m_streamIndex * m_renderWidth), 0, 0, (UINT)((m_streamIndex + 1) * m_renderWidth), (UINT)m_renderHeight, 1 };
+			m_pD3DRender->GetContext()->CopySubresourceRegion(pInputTexture, 0, 0, 0, 0, pTexture, 0, &box);
+		}
+		else {
+			m_pD3DRender->GetContext()->CopyResource(pInputTexture, pTexture);
+		}
+	}
 
 	NV_ENC_PIC_PARAMS picParams = {};
 	if (insertIDR) {
 		Debug("Inserting IDR frame.\n");
 		picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR;
+	} else if (mIntraRefreshPending) {
+		Debug("Starting intra refresh wave.\n");
+		if (m_codec == ALVR_CODEC_H264) {
+			picParams.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = mIntraRefreshFrames;
+		} else {
+			picParams.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = mIntraRefreshFrames;
+		}
+	}
+	mIntraRefreshPending = false;
+	picParams.inputTimeStamp = targetTimestampNs;
+	if (!m_qpDeltaMap.empty()) {
+		picParams.qpDeltaMap = m_qpDeltaMap.data();
+		picParams.qpDeltaMapSize = (uint32_t)m_qpDeltaMap.size();
+	}
+	float contentScale = m_Listener ? m_Listener->m_resolutionController.GetFrameScale(targetTimestampNs) / 100.f : 1.f;
+	if (!m_meHints.empty() && !insertIDR) {
+		uint32_t candidates = FillMotionHints(contentScale);
+		if (candidates > 0) {
+			picParams.meHintCountsPerBlock[0].numCandsPerBlk16x16 = candidates;
+			picParams.meExternalHints = m_meHints.data();
+		}
+	}
+	m_encodingTimestampNs = targetTimestampNs;
+	m_submittedTimestamps.push_back(targetTimestampNs);
+	if (m_submittedTimestamps.size() > MAX_INVALIDATION_FRAMES) {
+		m_submittedTimestamps.pop_front();
 	}
-	m_NvNecoder->EncodeFrame(vPacket, &picParams);
+	if (canEncodeInPlace) {
+		m_NvNecoder->EncodeExternalFrame(pTexture, NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, vPacket, &picParams);
+	}
+	else {
+		m_NvNecoder->EncodeFrame(vPacket, &picParams);
+	}
+
+	const std::vector<NvEncFrameStats> &vStats = m_NvNecoder->GetPacketStats();
+	for (size_t i = 0; i < vPacket.size() && i < vStats.size(); i++)
+	{
+		SendPacket(vPacket[i], vStats[i], presentationTime, targetTimestampNs);
+	}
+}
 
+void VideoEncoderNVENC::SendPacket(std::vector<uint8_t> &packet, const NvEncFrameStats &frameStats, uint64_t presentationTime, uint64_t targetTimestampNs)
+{
 	if (m_Listener) {
-		m_Listener->GetStatistics()->EncodeOutput(GetTimestampUs() - presentationTime);
+		EncodeStats stats;
+		stats.latencyUs = GetTimestampUs() - presentationTime;
+		stats.encoderLatencyUs = frameStats.encodeTimeUs;
+		stats.bytes = frameStats.sizeInBytes;
+		stats.averageQp = (float)frameStats.averageQp;
+		stats.pipelineDepth = m_pipelineDepth;
+		switch (frameStats.pictureType) {
+		case NV_ENC_PIC_TYPE_IDR:
+			stats.frameType = EncodeStats::FRAME_IDR;
+			break;
+		case NV_ENC_PIC_TYPE_I:
+		case NV_ENC_PIC_TYPE_INTRA_REFRESH:
+			stats.frameType = EncodeStats::FRAME_I;
+			break;
+		case NV_ENC_PIC_TYPE_P:
+			stats.frameType = EncodeStats::FRAME_P;
+			break;
+		case NV_ENC_PIC_TYPE_B:
+			stats.frameType = EncodeStats::FRAME_B;
+			break;
+		default:
+			break;
+		}
+		m_Listener->GetStatistics()->EncodeOutput(stats);
 	}
 
-	m_nFrame += (int)vPacket.size();
-	for (std::vector<uint8_t> &packet : vPacket)
-	{
-		if (fpOut) {
-			fpOut.write(reinterpret_cast<char*>(packet.data()), packet.size());
+	m_nFrame++;
+	if (fpOut) {
+		fpOut.write(reinterpret_cast<char*>(packet.data()), packet.size());
+	}
+	// The slices of the frame are already out with the sub-frame output
+	if (m_Listener && !m_sliceOutput) {
+		m_Listener->SendVideo(packet.data(), (int)packet.size(), targetTimestampNs, m_streamIndex);
+	}
+}
+
+void VideoEncoderNVENC::SendSlice(uint8_t *slice, uint32_t size, uint32_t sliceIndex, bool last)
+{
+	// Frames are read in submission order, the oldest pending one is being read in async mode
+	uint64_t targetTimestampNs = m_encodingTimestampNs;
+	if (m_pipelineDepth > 0) {
+		std::unique_lock<std::mutex> lock(m_pendingMutex);
+		if (!m_pendingFrames.empty()) {
+			targetTimestampNs = m_pendingFrames.front().targetTimestampNs;
+		}
+	}
+	if (m_Listener) {
+		m_Listener->SendVideoSlice(slice, (int)size, targetTimestampNs, m_streamIndex, (uint8_t)sliceIndex, last);
+	}
+}
+
+void VideoEncoderNVENC::RunOutput()
+{
+	std::vector<uint8_t> packet;
+	NvEncFrameStats stats;
+	while (true) {
+		try {
+			if (!m_NvNecoder->GetNextPacket(packet, &stats)) {
+				break;
+			}
 		}
-		if (m_Listener) {
-			m_Listener->SendVideo(packet.data(), (int)packet.size(), targetTimestampNs);
+		catch (NVENCException e) {
+			Error("NvEnc GetNextPacket failed. Code=%d %hs\n", e.getErrorCode(), e.what());
+			break;
 		}
+
+		PendingFrame frame = {};
+		{
+			std::unique_lock<std::mutex> lock(m_pendingMutex);
+			if (!m_pendingFrames.empty()) {
+				frame = m_pendingFrames.front();
+				m_pendingFrames.pop_front();
+			}
+		}
+		SendPacket(packet, stats, frame.presentationTime, frame.targetTimestampNs);
 	}
 }
 
-void VideoEncoderNVENC::FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializeParams, int refreshRate, int renderWidth, int renderHeight, uint64_t bitrateBits)
+bool VideoEncoderNVENC::StartIntraRefresh()
+{
+	if (mIntraRefreshFrames == 0) {
+		return false;
+	}
+	mIntraRefreshPending = true;
+	return true;
+}
+
+bool VideoEncoderNVENC::InvalidateReferences(uint64_t lastGoodTimestampNs)
+{
+	if (!mSupportsReferenceFrameInvalidation) {
+		return false;
+	}
+	// An older good frame may have left the DPB already, an IDR is safer then
+	auto lastGood = std::find(m_submittedTimestamps.begin(), m_submittedTimestamps.end(), lastGoodTimestampNs);
+	if (lastGood == m_submittedTimestamps.end()) {
+		return false;
+	}
+
+	// Every frame after the good one references a lost frame, directly or not. NVENC predicts the
+	// next frame from the remaining references, or intra codes it if none is left.
+	Debug("Invalidating %d reference frames.\n", (int)(m_submittedTimestamps.end() - lastGood - 1));
+	for (auto it = lastGood + 1; it != m_submittedTimestamps.end(); ++it) {
+		m_NvNecoder->InvalidateRefFrames(*it);
+	}
+	m_submittedTimestamps.erase(lastGood + 1, m_submittedTimestamps.end());
+	return true;
+}
+
+uint32_t VideoEncoderNVENC::FillMotionHints(float contentScale)
+{
+	// Out of the range of the hint the search does better on its own
+	auto inRange = [](const GlobalMotion &motion) {
+		return std::abs(motion.x) < 2048 && std::abs(motion.y) < 512;
+	};
+
+	// The candidates per eye, the head motion first
+	GlobalMotion eyeCandidates[2][2];
+	uint32_t counts[2] = {};
+	int eyes = m_hintsPerBlock > 1 ? 2 : 1;
+	for (int eye = 0; eye < eyes; eye++) {
+		int viewEye = m_streamCount > 1 ? m_streamIndex : eye;
+		GlobalMotion motion;
+		if (EstimateGlobalMotion(m_hintReference, m_hintCurrent, viewEye, contentScale, &motion) && inRange(motion)) {
+			eyeCandidates[eye][counts[eye]++] = motion;
+		}
+		if (m_hintsPerBlock > 1
+			&& EstimateInterEyeMotion(m_hintReference, m_hintCurrent, eye, m_renderWidth / 2, contentScale, &motion)
+			&& inRange(motion)) {
+			eyeCandidates[eye][counts[eye]++] = motion;
+		}
+	}
+	// Every block of a frame has the same number of candidates
+	uint32_t candidates = eyes > 1 ? std::min(counts[0], counts[1]) : counts[0];
+	if (candidates == 0) {
+		return 0;
+	}
+
+	uint32_t blocksX = (m_renderWidth + 15) / 16;
+	uint32_t blocks = (uint32_t)m_meHints.size() / m_hintsPerBlock;
+	for (uint32_t block = 0; block < blocks; block++) {
+		int eye = eyes > 1 && (int)(block % blocksX) * 16 >= m_renderWidth / 2 ? 1 : 0;
+		for (uint32_t i = 0; i < candidates; i++) {
+			auto &hint = m_meHints[block * candidates + i];
+			hint.mvx = eyeCandidates[eye][i].x;
+			hint.mvy = eyeCandidates[eye][i].y;
+			hint.refidx = 0;
+			hint.dir = 0;
+			hint.partType = 0;
+			hint.lastofPart = i == candidates - 1;
+			hint.lastOfMB = i == candidates - 1;
+		}
+	}
+	return candidates;
+}
+
+void VideoEncoderNVENC::SetHeadRotation(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current)
+{
+	m_hintReference = reference;
+	m_hintCurrent = current;
+}
+
+void VideoEncoderNVENC::Reconfigure(const EncoderRate &rate)
+{
+	m_bitrateInMBits = (int)(rate.bitrate / 1'000'000);
+
+	// Only the rate control changes, so no IDR is needed and the frames in flight are kept
+	NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+	NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+	initializeParams.encodeConfig = &encodeConfig;
+	FillEncodeConfig(initializeParams, m_renderWidth, m_renderHeight, rate);
+	NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
+	reconfigureParams.reInitEncodeParams = initializeParams;
+	m_NvNecoder->Reconfigure(&reconfigureParams);
+}
+
+void VideoEncoderNVENC::FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializeParams, int renderWidth, int renderHeight, const EncoderRate &rate)
 {
 	auto &encodeConfig = *initializeParams.encodeConfig;
+	// The streams share the bitrate evenly
+	EncoderRate streamRate = rate;
+	streamRate.bitrate /= m_streamCount;
+	streamRate.vbvSize /= m_streamCount;
 	GUID EncoderGUID = m_codec == ALVR_CODEC_H264 ? NV_ENC_CODEC_H264_GUID : NV_ENC_CODEC_HEVC_GUID;
 
 	// According to the docment, NVIDIA Video Encoder (NVENC) Interface 8.1,
@@ -153,11 +464,21 @@ void VideoEncoderNVENC::FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializePar
 	// 8. Adaptive quantization(AQ) enabled
 
 	m_NvNecoder->CreateDefaultEncoderParams(&initializeParams, EncoderGUID, NV_ENC_PRESET_LOW_LATENCY_HQ_GUID);
+	if (m_sliceOutput) {
+		// The slice offsets, which split the bitstream read back, are only reported in synchronous mode
+		initializeParams.enableEncodeAsync = 0;
+		initializeParams.enableSubFrameWrite = 1;
+		initializeParams.reportSliceOffsets = 1;
+	}
 
 	initializeParams.encodeWidth = initializeParams.darWidth = renderWidth;
 	initializeParams.encodeHeight = initializeParams.darHeight = renderHeight;
-	initializeParams.frameRateNum = refreshRate;
+	initializeParams.frameRateNum = (uint32_t)(rate.fps + 0.5f);
 	initializeParams.frameRateDen = 1;
+	if (!m_meHints.empty()) {
+		initializeParams.enableExternalMEHints = 1;
+		initializeParams.maxMEHintCountsPerBlock[0].numCandsPerBlk16x16 = m_hintsPerBlock;
+	}
 
 	// Use reference frame invalidation to faster recovery from frame loss if supported.
 	mSupportsReferenceFrameInvalidation = m_NvNecoder->GetCapabilityValue(EncoderGUID, NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION);
@@ -165,6 +486,9 @@ void VideoEncoderNVENC::FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializePar
 	Debug("VideoEncoderNVENC: SupportsReferenceFrameInvalidation: %d\n", mSupportsReferenceFrameInvalidation);
 	Debug("VideoEncoderNVENC: SupportsIntraRefresh: %d\n", supportsIntraRefresh);
 
+	// Recover from packet loss with intra refresh waves instead of IDR frames if requested.
+	mIntraRefreshFrames = supportsIntraRefresh ? Settings::Instance().m_intraRefreshFrames : 0;
+
 	// 16 is recommended when using reference frame invalidation. But it has caused bad visual quality.
 	// Now, use 0 (use default).
 	int maxNumRefFrames = 0;
@@ -172,26 +496,35 @@ void VideoEncoderNVENC::FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializePar
 	if (m_codec == ALVR_CODEC_H264) {
 		auto &config = encodeConfig.encodeCodecConfig.h264Config;
 		config.repeatSPSPPS = 1;
-		//if (supportsIntraRefresh) {
-		//	config.enableIntraRefresh = 1;
-		//	// Do intra refresh every 10sec.
-		//	config.intraRefreshPeriod = refreshRate * 10;
-		//	config.intraRefreshCnt = refreshRate;
-		//}
+		if (mIntraRefreshFrames > 0) {
+			config.enableIntraRefresh = 1;
+			// Do intra refresh every 10sec, waves are also forced on packet loss.
+			config.intraRefreshPeriod = m_refreshRate * 10;
+			config.intraRefreshCnt = mIntraRefreshFrames;
+		}
 		config.maxNumRefFrames = maxNumRefFrames;
 		config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+		// sliceMode 3: sliceModeData is the number of slices per picture
+		config.sliceMode = 3;
+		config.sliceModeData = Settings::Instance().m_slicesPerFrame;
 	}
 	else {
 		auto &config = encodeConfig.encodeCodecConfig.hevcConfig;
 		config.repeatSPSPPS = 1;
-		//if (supportsIntraRefresh) {
-		//	config.enableIntraRefresh = 1;
-		//	// Do intra refresh every 10sec.
-		//	config.intraRefreshPeriod = refreshRate * 10;
-		//	config.intraRefreshCnt = refreshRate;
-		//}
+		if (mIntraRefreshFrames > 0) {
+			config.enableIntraRefresh = 1;
+			// Do intra refresh every 10sec, waves are also forced on packet loss.
+			config.intraRefreshPeriod = m_refreshRate * 10;
+			config.intraRefreshCnt = mIntraRefreshFrames;
+		}
 		config.maxNumRefFramesInDPB = maxNumRefFrames;
 		config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+		config.sliceMode = 3;
+		config.sliceModeData = Settings::Instance().m_slicesPerFrame;
+		// The QP map has one value per CTB
+		if (!m_qpDeltaMap.empty()) {
+			config.maxCUSize = NV_ENC_HEVC_CUSIZE_32x32;
+		}
 	}
 
 	// According to the document, NVIDIA Video Encoder Interface 5.0,
@@ -210,14 +543,19 @@ void VideoEncoderNVENC::FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializePar
 	// NV_ENC_PARAMS_RC_CBR_HQ is equivalent to NV_ENC_PARAMS_RC_2_PASS_FRAMESIZE_CAP.
 	//encodeConfig.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;// NV_ENC_PARAMS_RC_CBR_HQ;
 	encodeConfig.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
-	uint32_t maxFrameSize = static_cast<uint32_t>(bitrateBits / refreshRate);
+	uint32_t maxFrameSize = static_cast<uint32_t>(streamRate.vbvSize);
 	Debug("VideoEncoderNVENC: maxFrameSize=%d bits\n", maxFrameSize);
 	encodeConfig.rcParams.vbvBufferSize = maxFrameSize;
 	encodeConfig.rcParams.vbvInitialDelay = maxFrameSize;
-	encodeConfig.rcParams.maxBitRate = static_cast<uint32_t>(bitrateBits);
-	encodeConfig.rcParams.averageBitRate = static_cast<uint32_t>(bitrateBits);
+	encodeConfig.rcParams.maxBitRate = static_cast<uint32_t>(streamRate.bitrate);
+	encodeConfig.rcParams.averageBitRate = static_cast<uint32_t>(streamRate.bitrate);
+	// Offsets on top of the rate control QP, the periphery gives up bits to the foveation center
+	if (!m_qpDeltaMap.empty()) {
+		encodeConfig.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+	}
 
 	if (Settings::Instance().m_use10bitEncoder) {
+		encodeConfig.profileGUID = NV_ENC_HEVC_PROFILE_MAIN10_GUID;
 		encodeConfig.rcParams.enableAQ = 1;
 		encodeConfig.encodeCodecConfig.hevcConfig.pixelBitDepthMinus8 = 2;
 	}
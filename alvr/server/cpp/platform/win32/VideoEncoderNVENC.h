@@ -1,27 +1,49 @@
 #pragma once
 
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <deque>
 #include "shared/d3drender.h"
 #include "alvr_server/ClientConnection.h"
 #include "VideoEncoder.h"
 #include "NvEncoderD3D11.h"
 
 // Video encoder for NVIDIA NvEnc.
+// With streamCount 2 the session encodes one eye of the frame, the stream streamIndex, and gets
+// half of the bitrate. Frames are always submitted asynchronously then, so that the two sessions
+// encode in parallel.
 class VideoEncoderNVENC : public VideoEncoder
 {
 public:
 	VideoEncoderNVENC(std::shared_ptr<CD3DRender> pD3DRender
 		, std::shared_ptr<ClientConnection> listener
-		, int width, int height);
+		, int width, int height, DXGI_FORMAT format
+		, uint8_t streamIndex = 0, int streamCount = 1);
 	~VideoEncoderNVENC();
 
 	void Initialize();
 	void Shutdown();
 
 	void Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR);
+	void Reconfigure(const EncoderRate &rate);
+	bool StartIntraRefresh();
+	bool InvalidateReferences(uint64_t lastGoodTimestampNs);
+	void SetHeadRotation(const vr::HmdQuaternion_t &reference, const vr::HmdQuaternion_t &current);
 private:
-	void FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializeParams, int refreshRate, int renderWidth, int renderHeight, uint64_t bitrateBits);
+	void FillEncodeConfig(NV_ENC_INITIALIZE_PARAMS &initializeParams, int renderWidth, int renderHeight, const EncoderRate &rate);
+	// Fills the hints of the next frame, returns the number of candidates per block
+	uint32_t FillMotionHints(float contentScale);
+	void SendPacket(std::vector<uint8_t> &packet, const NvEncFrameStats &frameStats, uint64_t presentationTime, uint64_t targetTimestampNs);
+	// Sub-frame output, called by the encoder as the slices of the frame being read complete
+	void SendSlice(uint8_t *slice, uint32_t size, uint32_t sliceIndex, bool last);
+	// Output thread of the async mode, sends the packets in submission order.
+	void RunOutput();
 
+	struct PendingFrame {
+		uint64_t presentationTime;
+		uint64_t targetTimestampNs;
+	};
 
 	std::ofstream fpOut;
 	std::shared_ptr<NvEncoder> m_NvNecoder;
@@ -32,10 +54,43 @@ private:
 	std::shared_ptr<ClientConnection> m_Listener;
 
 	bool mSupportsReferenceFrameInvalidation = false;
+	// Target timestamps of the last frames submitted, oldest first, the encoder gets them as
+	// inputTimeStamp so that they identify the references to invalidate
+	static constexpr size_t MAX_INVALIDATION_FRAMES = 16;
+	std::deque<uint64_t> m_submittedTimestamps;
+	// Length of a refresh wave in frames, 0 if intra refresh is unsupported or disabled
+	uint32_t mIntraRefreshFrames = 0;
+	bool mIntraRefreshPending = false;
+	// Foveated encoding QP deltas, per macroblock for H.264 and per 32x32 CTB for HEVC, empty if disabled
+	std::vector<int8_t> m_qpDeltaMap;
+	// External motion estimation hints, 16x16 candidates per block with the global motion of the
+	// head rotation and, in a single stream, the position of the block in the other eye. Empty if
+	// disabled
+	std::vector<NVENC_EXTERNAL_ME_HINT> m_meHints;
+	uint32_t m_hintsPerBlock = 0;
+	vr::HmdQuaternion_t m_hintReference = {};
+	vr::HmdQuaternion_t m_hintCurrent = {};
 
+	uint8_t m_streamIndex;
+	int m_streamCount;
 	int m_codec;
 	int m_refreshRate;
+	// Size of the encoded picture, one eye of the frame in dual stream mode
 	int m_renderWidth;
 	int m_renderHeight;
+	// Format of the textures passed to Transmit, R8G8B8A8_UNORM, NV12 or P010
+	DXGI_FORMAT m_inputFormat;
 	int m_bitrateInMBits;
+
+	// Each slice is sent as soon as the encoder wrote it, if there are several and the GPU can
+	// read them back before the end of the frame. The session is synchronous then.
+	bool m_sliceOutput = false;
+	// Frame submitted by Transmit, the one read back when the pipeline depth is 0
+	uint64_t m_encodingTimestampNs = 0;
+
+	// Frames submitted to NVENC at once in async mode, 0 to retrieve each frame in Transmit
+	uint32_t m_pipelineDepth;
+	std::thread *m_outputThread = nullptr;
+	std::mutex m_pendingMutex;
+	std::deque<PendingFrame> m_pendingFrames;
 };
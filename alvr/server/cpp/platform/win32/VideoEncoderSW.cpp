@@ -2,6 +2,10 @@
 
 #include "VideoEncoderSW.h"
 
+#include <d3d11_4.h>
+
+#include "alvr_server/Av1Obu.h"
+#include "alvr_server/FoveatedEncoding.h"
 #include "alvr_server/Statistics.h"
 #include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
@@ -21,7 +25,7 @@ VideoEncoderSW::VideoEncoderSW(std::shared_ptr<CD3DRender> d3dRender
 	, m_refreshRate(Settings::Instance().m_refreshRate)
 	, m_renderWidth(width)
 	, m_renderHeight(height)
-	, m_bitrateInMBits(Settings::Instance().mEncodeBitrateMBs) {
+	, m_bitrateInMBits(Settings::Instance().GetLive().mEncodeBitrateMBs) {
 #ifdef ALVR_DEBUG_LOG
 	av_log_set_level(AV_LOG_DEBUG);
 	av_log_set_callback(LibVALog);
@@ -46,7 +50,8 @@ void VideoEncoderSW::Initialize() {
 	AVCodecID codecId = ToFFMPEGCodec(m_codec);
 	if(!codecId) throw MakeException("Invalid requested codec %d", m_codec);
 	
-	const AVCodec *codec = avcodec_find_encoder(codecId);
+	// Several AV1 encoders may be built in, SVT-AV1 is the one with a real time mode
+	const AVCodec *codec = codecId == AV_CODEC_ID_AV1 ? avcodec_find_encoder_by_name("libsvtav1") : avcodec_find_encoder(codecId);
 	if(codec == NULL) throw MakeException("Could not find codec id %d", codecId);
 
 	// Initialize CodecContext
@@ -55,25 +60,36 @@ void VideoEncoderSW::Initialize() {
 
 	// Set codec settings
 	AVDictionary* opt = NULL;
-	av_dict_set(&opt, "preset", "ultrafast", 0);
-	av_dict_set(&opt, "tune", "zerolatency", 0);
 	switch (m_codec) {
 		case ALVR_CODEC_H264:
 			m_codecContext->profile = Settings::Instance().m_use10bitEncoder ? FF_PROFILE_H264_HIGH_10 : FF_PROFILE_H264_HIGH;
+			av_dict_set(&opt, "preset", "ultrafast", 0);
+			av_dict_set(&opt, "tune", "zerolatency", 0);
 			break;
 		case ALVR_CODEC_H265:
 			m_codecContext->profile = Settings::Instance().m_use10bitEncoder ? FF_PROFILE_HEVC_MAIN_10 : FF_PROFILE_HEVC_MAIN;
+			av_dict_set(&opt, "preset", "ultrafast", 0);
+			av_dict_set(&opt, "tune", "zerolatency", 0);
+			// libx265 does not read AVCodecContext::slices
+			av_dict_set(&opt, "x265-params", ("slices=" + std::to_string(Settings::Instance().m_slicesPerFrame)).c_str(), 0);
+			break;
+		case ALVR_CODEC_AV1:
+			// Main profile covers 8 and 10 bit. The low delay prediction structure without lookahead
+			// is the real time mode of SVT-AV1.
+			m_codecContext->profile = FF_PROFILE_AV1_MAIN;
+			av_dict_set(&opt, "preset", "12", 0);
+			av_dict_set(&opt, "svtav1-params", "pred-struct=1:lookahead=0", 0);
 			break;
 	}
 
 	m_codecContext->width = Settings::Instance().m_renderWidth;
 	m_codecContext->height = Settings::Instance().m_renderHeight;
 	m_codecContext->time_base = AVRational{1, (int)(1e9)};
-	m_codecContext->framerate = AVRational{Settings::Instance().m_refreshRate, 1};
 	m_codecContext->sample_aspect_ratio = AVRational{1, 1};
 	m_codecContext->pix_fmt = Settings::Instance().m_use10bitEncoder ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P;
 	m_codecContext->max_b_frames = 0;
-	m_codecContext->bit_rate = Settings::Instance().mEncodeBitrateMBs * 1000 * 1000;
+	m_codecContext->slices = Settings::Instance().m_slicesPerFrame;
+	ApplyRate(EncoderRate::ForBitrate(Settings::Instance().GetLive().mEncodeBitrateMBs * 1000 * 1000, (float)Settings::Instance().m_refreshRate));
 	m_codecContext->thread_count = Settings::Instance().m_swThreadCount;
 
 	if((err = avcodec_open2(m_codecContext, codec, &opt))) throw MakeException("Cannot open video encoder codec: %d", err);
@@ -86,6 +102,23 @@ void VideoEncoderSW::Initialize() {
 	m_encoderFrame->height = Settings::Instance().m_renderHeight;
 	m_encoderFrame->format = m_codecContext->pix_fmt;
 	if((err = av_frame_get_buffer(m_encoderFrame, 0))) throw MakeException("Error when allocating encoder frame: %d", err);
+	// Foveated encoding regions, kept by the frame for every encode. libx264 and libx265 scale the
+	// offsets by 25.
+	if (FoveatedEncodingEnabled()) {
+		auto rects = BuildFoveationRects(m_encoderFrame->width, m_encoderFrame->height, 4);
+		AVFrameSideData *sideData = av_frame_new_side_data(m_encoderFrame, AV_FRAME_DATA_REGIONS_OF_INTEREST, rects.size() * sizeof(AVRegionOfInterest));
+		if (!sideData) throw MakeException("Error when allocating the foveation regions");
+		auto regions = (AVRegionOfInterest *)sideData->data;
+		for (size_t i = 0; i < rects.size(); i++) {
+			regions[i] = { sizeof(AVRegionOfInterest), (int)rects[i].top, (int)rects[i].bottom, (int)rects[i].left, (int)rects[i].right, AVRational{ rects[i].qpOffset, 25 } };
+		}
+	}
+
+	// Read back on a worker thread if the immediate context can be used from there
+	ComPtr<ID3D11Multithread> multithread;
+	if(SUCCEEDED(m_d3dRender->GetContext()->QueryInterface(IID_PPV_ARGS(&multithread))) && multithread->GetMultithreadProtected()) {
+		m_thread = new std::thread(&VideoEncoderSW::Run, this);
+	}
 
 	Debug("Successfully initialized VideoEncoderSW");
 }
@@ -93,6 +126,17 @@ void VideoEncoderSW::Initialize() {
 void VideoEncoderSW::Shutdown() {
 	Debug("Shutting down VideoEncoderSW.\n");
 
+	if(m_thread) {
+		{
+			std::unique_lock<std::mutex> lock(m_frameMutex);
+			m_exiting = true;
+		}
+		m_frameCondition.notify_all();
+		m_thread->join();
+		delete m_thread;
+		m_thread = NULL;
+	}
+
 	av_frame_free(&m_transferredFrame);
 	av_frame_free(&m_encoderFrame);
 
@@ -143,15 +187,42 @@ void VideoEncoderSW::filter_NAL(const uint8_t *input, size_t input_size, std::ve
 	}
 }
 
-void VideoEncoderSW::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR) {
-	// Handle bitrate changes
-	if(m_Listener->GetStatistics()->CheckBitrateUpdated()) {
-		//Debug("Bitrate changed");
-		m_codecContext->bit_rate = m_Listener->GetStatistics()->GetBitrate() * 1000000L;
+void VideoEncoderSW::ReadEncodeStats(const AVPacket *packet, EncodeStats &stats)
+{
+	if (packet->flags & AV_PKT_FLAG_KEY)
+		stats.frameType = EncodeStats::FRAME_IDR;
+
+	// libx264 and libx265 attach the quality and picture type of the frame
+#if LIBAVCODEC_VERSION_MAJOR >= 59
+	size_t sideDataSize = 0;
+#else
+	int sideDataSize = 0;
+#endif
+	const uint8_t *qualityStats = av_packet_get_side_data(packet, AV_PKT_DATA_QUALITY_STATS, &sideDataSize);
+	if (qualityStats == nullptr || sideDataSize < 5)
+		return;
+
+	stats.averageQp = (float)AV_RL32(qualityStats) / FF_QP2LAMBDA;
+	if (stats.frameType != EncodeStats::FRAME_UNKNOWN)
+		return;
+	switch (qualityStats[4]) {
+		case AV_PICTURE_TYPE_I:
+		stats.frameType = EncodeStats::FRAME_I;
+		break;
+		case AV_PICTURE_TYPE_P:
+		stats.frameType = EncodeStats::FRAME_P;
+		break;
+		case AV_PICTURE_TYPE_B:
+		stats.frameType = EncodeStats::FRAME_B;
+		break;
+		default:
+		break;
 	}
+}
 
-	// Setup staging texture if not defined yet; we can only define it here as we now have the texture's size
-	if(!stagingTex) {
+void VideoEncoderSW::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR) {
+	// Setup staging textures if not defined yet; we can only define them here as we now have the texture's size
+	if(!m_stagingRing[0].texture) {
 		HRESULT hr = SetupStagingTexture(pTexture);
 		if(FAILED(hr)) {
 			Error("Failed to create staging texture: %p %ls", hr, GetErrorStr(hr).c_str());
@@ -160,25 +231,114 @@ void VideoEncoderSW::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTi
 		Debug("Success in creating staging texture");
 	}
 
-	// Copy texture and map it to memory
+	StagingFrame &frame = m_stagingRing[m_nextFrame];
+	if(m_thread) {
+		// Wait for the worker to be done with this texture
+		std::unique_lock<std::mutex> lock(m_frameMutex);
+		m_frameCondition.wait(lock, [&] {
+			return std::find(m_queuedFrames.begin(), m_queuedFrames.end(), m_nextFrame) == m_queuedFrames.end();
+		});
+	}
+
+	// Copy texture, it is mapped once the copy is complete
 	/// SteamVR crashes if the swapchain textures are set to staging, which is needed to be read by the CPU.
 	/// Unless there's another solution we have to copy the texture every time, which is gonna be another performance hit.
-	HRESULT hr = CopyTexture(pTexture);
+	m_d3dRender->GetContext()->CopyResource(frame.texture.Get(), pTexture);
+	m_d3dRender->GetContext()->End(frame.copied.Get());
+	// The copy is polled without flushing, make sure it is submitted
+	m_d3dRender->GetContext()->Flush();
+
+	frame.presentationTime = presentationTime;
+	frame.targetTimestampNs = targetTimestampNs;
+	frame.insertIDR = insertIDR;
+
+	if(m_thread) {
+		{
+			std::unique_lock<std::mutex> lock(m_frameMutex);
+			m_queuedFrames.push_back(m_nextFrame);
+		}
+		m_frameCondition.notify_all();
+	} else {
+		WaitForCopy(frame);
+		EncodeFrame(frame);
+	}
+	m_nextFrame = (m_nextFrame + 1) % STAGING_RING_SIZE;
+}
+
+void VideoEncoderSW::Run() {
+	Debug("Start VideoEncoderSW thread. Thread Id=%d\n", GetCurrentThreadId());
+
+	while(true) {
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(m_frameMutex);
+			m_frameCondition.wait(lock, [&] { return m_exiting || !m_queuedFrames.empty(); });
+			if(m_exiting) break;
+			index = m_queuedFrames.front();
+		}
+
+		WaitForCopy(m_stagingRing[index]);
+		EncodeFrame(m_stagingRing[index]);
+
+		{
+			std::unique_lock<std::mutex> lock(m_frameMutex);
+			m_queuedFrames.pop_front();
+		}
+		m_frameCondition.notify_all();
+	}
+}
+
+void VideoEncoderSW::WaitForCopy(const StagingFrame &frame) {
+	// GetData returns S_FALSE until the copy is done, and an error if the device is lost
+	while(m_d3dRender->GetContext()->GetData(frame.copied.Get(), NULL, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_FALSE) {
+		std::this_thread::yield();
+	}
+}
+
+void VideoEncoderSW::Reconfigure(const EncoderRate &rate) {
+	std::unique_lock<std::mutex> lock(m_frameMutex);
+	m_bitrateInMBits = (int)(rate.bitrate / 1000000);
+	m_pendingRate = rate;
+	m_ratePending = true;
+}
+
+void VideoEncoderSW::ApplyRate(const EncoderRate &rate) {
+	m_codecContext->bit_rate = rate.bitrate;
+	m_codecContext->rc_max_rate = rate.bitrate;
+	m_codecContext->rc_buffer_size = (int)rate.vbvSize;
+	m_codecContext->rc_initial_buffer_occupancy = (int)rate.vbvSize;
+	m_codecContext->framerate = AVRational{(int)(rate.fps + 0.5f), 1};
+}
+
+void VideoEncoderSW::EncodeFrame(const StagingFrame &frame) {
+	// Handle bitrate changes
+	{
+		std::unique_lock<std::mutex> lock(m_frameMutex);
+		if (m_ratePending) {
+			ApplyRate(m_pendingRate);
+			m_ratePending = false;
+		}
+	}
+
+	D3D11_MAPPED_SUBRESOURCE stagingTexMap;
+	HRESULT hr = m_d3dRender->GetContext()->Map(frame.texture.Get(), 0, D3D11_MAP_READ, 0, &stagingTexMap);
 	if(FAILED(hr)) {
-		Error("Failed to copy texture to staging: %p %ls", hr, GetErrorStr(hr).c_str());
+		Error("Failed to map staging texture: %p %ls", hr, GetErrorStr(hr).c_str());
 		return;
 	}
 	//Debug("Success in mapping staging texture");
 
 	// Setup software scaler if not defined yet; we can only define it here as we now have the texture's size
-	// FIXME: Hardcoded to DirectX's R8G8B8A8, make more robust system if needed
+	// NV12 and P010 frames only need their chroma plane split, R8G8B8A8 frames are converted on the CPU.
+	AVPixelFormat stagingFormat = stagingTexDesc.Format == DXGI_FORMAT_NV12 ? AV_PIX_FMT_NV12
+		: stagingTexDesc.Format == DXGI_FORMAT_P010 ? AV_PIX_FMT_P010LE : AV_PIX_FMT_RGBA;
 	if(!m_scalerContext) {
-		m_scalerContext = sws_getContext(stagingTexDesc.Width, stagingTexDesc.Height, AV_PIX_FMT_RGBA,
+		m_scalerContext = sws_getContext(stagingTexDesc.Width, stagingTexDesc.Height, stagingFormat,
 		m_codecContext->width, m_codecContext->height, m_codecContext->pix_fmt,
 		SWS_BILINEAR, NULL, NULL, NULL);
 		if(!m_scalerContext) {
 			Error("Couldn't initialize SWScaler.");
-			m_d3dRender->GetContext()->Unmap(stagingTex.Get(), 0);
+			m_d3dRender->GetContext()->Unmap(frame.texture.Get(), 0);
 			return;
 		}
 		Debug("Successfully initialized SWScaler.");
@@ -189,26 +349,33 @@ void VideoEncoderSW::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTi
 	m_transferredFrame->height = stagingTexDesc.Height;
 	m_transferredFrame->data[0] = (uint8_t*)stagingTexMap.pData;
 	m_transferredFrame->linesize[0] = stagingTexMap.RowPitch;
-	m_transferredFrame->format = AV_PIX_FMT_RGBA;
-	m_transferredFrame->pts = targetTimestampNs;
+	if(stagingFormat != AV_PIX_FMT_RGBA) {
+		// The chroma plane follows the luma rows in the mapped texture
+		m_transferredFrame->data[1] = (uint8_t*)stagingTexMap.pData + stagingTexMap.RowPitch * stagingTexDesc.Height;
+		m_transferredFrame->linesize[1] = stagingTexMap.RowPitch;
+	}
+	m_transferredFrame->format = stagingFormat;
+	m_transferredFrame->pts = frame.targetTimestampNs;
 
 	// Use SWScaler for scaling
-	if(sws_scale(m_scalerContext, m_transferredFrame->data, m_transferredFrame->linesize,
-				0, m_transferredFrame->height, m_encoderFrame->data, m_encoderFrame->linesize) == 0) {
+	int scaledRows = sws_scale(m_scalerContext, m_transferredFrame->data, m_transferredFrame->linesize,
+				0, m_transferredFrame->height, m_encoderFrame->data, m_encoderFrame->linesize);
+	// The texture is not needed past this point
+	m_d3dRender->GetContext()->Unmap(frame.texture.Get(), 0);
+	if(scaledRows == 0) {
 		Error("SWScale failed.");
-		m_d3dRender->GetContext()->Unmap(stagingTex.Get(), 0);
 		return;
 	}
 	//Debug("SWScale succeeded.");
 
 	// Send frame for encoding
-	m_encoderFrame->pict_type = insertIDR ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
-	m_encoderFrame->pts = targetTimestampNs;
+	m_encoderFrame->pict_type = frame.insertIDR ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+	m_encoderFrame->pts = frame.targetTimestampNs;
 
+	uint64_t encodeStartUs = GetTimestampUs();
 	int err;
 	if((err = avcodec_send_frame(m_codecContext, m_encoderFrame)) < 0) {
 		Error("Encoding frame failed: err code %d", err);
-		m_d3dRender->GetContext()->Unmap(stagingTex.Get(), 0);
 		return;
 	}
 	//Debug("Send frame succeeded.");
@@ -219,11 +386,11 @@ void VideoEncoderSW::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTi
 		if((err = avcodec_receive_packet(m_codecContext, packet))) {
 			if(err == AVERROR(EAGAIN)) {
 				// Output buffer was emptied, move on
+				av_packet_free(&packet);
 				break;
 			} else {
 				Error("Received encoded frame failed: err code %d", err);
 				av_packet_free(&packet);
-				m_d3dRender->GetContext()->Unmap(stagingTex.Get(), 0);
 				return;
 			}
 		}
@@ -231,17 +398,25 @@ void VideoEncoderSW::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTi
 
 		// Send encoded frame to client
 		std::vector<uint8_t> encoded_data;
-		filter_NAL(packet->data, packet->size, encoded_data);
+		if (m_codec == ALVR_CODEC_AV1) {
+			encoded_data.assign(packet->data, packet->data + packet->size);
+			encoded_data.resize(FilterAv1Obus(encoded_data.data(), encoded_data.size()));
+		} else {
+			filter_NAL(packet->data, packet->size, encoded_data);
+		}
+
+		EncodeStats stats;
+		uint64_t now = GetTimestampUs();
+		stats.latencyUs = now - frame.presentationTime;
+		stats.encoderLatencyUs = now - encodeStartUs;
+		stats.bytes = encoded_data.size();
+		ReadEncodeStats(packet, stats);
+		m_Listener->GetStatistics()->EncodeOutput(stats);
+
 		m_Listener->SendVideo(encoded_data.data(), encoded_data.size(), packet->pts);
 		av_packet_free(&packet);
 		//Debug("Sent encoded packet to client");
 	}
-
-	// Send statistics to client
-	m_Listener->GetStatistics()->EncodeOutput(GetTimestampUs() - presentationTime);
-
-	// Unmap the copied texture and delete it
-	m_d3dRender->GetContext()->Unmap(stagingTex.Get(), 0);
 }
 
 HRESULT VideoEncoderSW::SetupStagingTexture(ID3D11Texture2D *pTexture) {
@@ -258,12 +433,14 @@ HRESULT VideoEncoderSW::SetupStagingTexture(ID3D11Texture2D *pTexture) {
 	stagingTexDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
 	stagingTexDesc.MiscFlags = 0;
 
-	return m_d3dRender->GetDevice()->CreateTexture2D(&stagingTexDesc, nullptr, &stagingTex);
-}
-
-HRESULT VideoEncoderSW::CopyTexture(ID3D11Texture2D *pTexture) {
-	m_d3dRender->GetContext()->CopyResource(stagingTex.Get(), pTexture);
-	return m_d3dRender->GetContext()->Map(stagingTex.Get(), 0, D3D11_MAP_READ, 0, &stagingTexMap);
+	D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+	for(auto &frame : m_stagingRing) {
+		HRESULT hr = m_d3dRender->GetDevice()->CreateTexture2D(&stagingTexDesc, nullptr, &frame.texture);
+		if(FAILED(hr)) return hr;
+		hr = m_d3dRender->GetDevice()->CreateQuery(&queryDesc, &frame.copied);
+		if(FAILED(hr)) return hr;
+	}
+	return S_OK;
 }
 
 AVCodecID VideoEncoderSW::ToFFMPEGCodec(ALVR_CODEC codec) {
@@ -272,6 +449,8 @@ AVCodecID VideoEncoderSW::ToFFMPEGCodec(ALVR_CODEC codec) {
 			return AV_CODEC_ID_H264;
 		case ALVR_CODEC_H265:
 			return AV_CODEC_ID_HEVC;
+		case ALVR_CODEC_AV1:
+			return AV_CODEC_ID_AV1;
 		default:
 			return AV_CODEC_ID_NONE;
 	}
@@ -3,14 +3,20 @@
 #pragma once
 
 #include <wrl.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "shared/d3drender.h"
 #include "alvr_server/ClientConnection.h"
 #include "VideoEncoder.h"
+#include "alvr_server/EncodeStats.h"
 
 extern "C" {
 	#include <libavutil/avutil.h>
 	#include <libavcodec/avcodec.h>
+	#include <libavutil/intreadwrite.h>
 	#include <libavformat/avformat.h>
 	#include <libswscale/swscale.h>
 }
@@ -18,6 +24,8 @@ extern "C" {
 using Microsoft::WRL::ComPtr;
 
 // Software video encoder using FFMPEG
+// Frames are copied into a ring of staging textures and read back by a worker thread once the copy
+// has completed on the GPU, so the readback of a frame overlaps the encoding of the previous one.
 class VideoEncoderSW : public VideoEncoder
 {
 public:
@@ -34,13 +42,31 @@ public:
 	bool should_keep_nal_h264(const uint8_t *header_start);
 	bool should_keep_nal_h265(const uint8_t *header_start);
 	void filter_NAL(const uint8_t *input, size_t input_size, std::vector<uint8_t> &out);
+	static void ReadEncodeStats(const AVPacket *packet, EncodeStats &stats);
 
 	AVCodecID ToFFMPEGCodec(ALVR_CODEC codec);
 
 	void Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR);
+	void Reconfigure(const EncoderRate &rate);
 	HRESULT SetupStagingTexture(ID3D11Texture2D *pTexture);
-	HRESULT CopyTexture(ID3D11Texture2D *pTexture);
 private:
+	static const int STAGING_RING_SIZE = 3;
+
+	struct StagingFrame {
+		ComPtr<ID3D11Texture2D> texture;
+		// Signaled once the copy into texture is complete
+		ComPtr<ID3D11Query> copied;
+		uint64_t presentationTime = 0;
+		uint64_t targetTimestampNs = 0;
+		bool insertIDR = false;
+	};
+
+	void Run();
+	void WaitForCopy(const StagingFrame &frame);
+	void EncodeFrame(const StagingFrame &frame);
+	// libx264 reconfigures itself at the next frame when these fields change
+	void ApplyRate(const EncoderRate &rate);
+
     std::shared_ptr<CD3DRender> m_d3dRender;
 	std::shared_ptr<ClientConnection> m_Listener;
 
@@ -48,9 +74,20 @@ private:
 	AVFrame *m_transferredFrame, *m_encoderFrame;
 	SwsContext *m_scalerContext = nullptr;
 
-	ComPtr<ID3D11Texture2D> stagingTex;
+	StagingFrame m_stagingRing[STAGING_RING_SIZE];
 	D3D11_TEXTURE2D_DESC stagingTexDesc;
-	D3D11_MAPPED_SUBRESOURCE stagingTexMap;
+	int m_nextFrame = 0;
+
+	// Without multithread protection of the device, frames are read back on the calling thread.
+	std::thread *m_thread = NULL;
+	std::mutex m_frameMutex;
+	std::condition_variable m_frameCondition;
+	// Ring indices of the frames waiting for the worker, the front one is being encoded
+	std::deque<int> m_queuedFrames;
+	bool m_exiting = false;
+	// Set by Reconfigure, applied by the thread that encodes
+	EncoderRate m_pendingRate;
+	bool m_ratePending = false;
 
     ALVR_CODEC m_codec;
 	int m_refreshRate;
@@ -1,5 +1,8 @@
 #include "VideoEncoderVCE.h"
 
+#include <algorithm>
+
+#include "alvr_server/FoveatedEncoding.h"
 #include "alvr_server/Statistics.h"
 #include "alvr_server/Logger.h"
 #include "alvr_server/Settings.h"
@@ -16,8 +19,12 @@ const wchar_t *VideoEncoderVCE::FRAME_INDEX_PROPERTY = L"FrameIndexProperty";
 
 AMFTextureEncoder::AMFTextureEncoder(const amf::AMFContextPtr &amfContext
 	, int codec, int width, int height, int refreshRate, int bitrateInMbits
-	, amf::AMF_SURFACE_FORMAT inputFormat
-	, AMFTextureReceiver receiver) : m_receiver(receiver)
+	, amf::AMF_SURFACE_FORMAT inputFormat, uint32_t pipelineDepth
+	, AMFTextureReceiver receiver)
+	: m_codec(codec)
+	, m_thread([this] { Run(); })
+	, m_receiver(receiver)
+	, m_inFlight(pipelineDepth, pipelineDepth)
 {
 	const wchar_t *pCodec;
 
@@ -31,6 +38,9 @@ AMFTextureEncoder::AMFTextureEncoder(const amf::AMFContextPtr &amfContext
 	case ALVR_CODEC_H265:
 		pCodec = AMFVideoEncoder_HEVC;
 		break;
+	case ALVR_CODEC_AV1:
+		// AMFVideoEncoder_AV1 (RDNA3) needs AMF 1.4.28, the bundled headers predate it
+		throw MakeException("AV1 is not supported by this AMF version");
 	default:
 		throw MakeException("Unsupported video encoding %d", codec);
 	}
@@ -41,7 +51,6 @@ AMFTextureEncoder::AMFTextureEncoder(const amf::AMFContextPtr &amfContext
 	if (codec == ALVR_CODEC_H264)
 	{
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_USAGE, AMF_VIDEO_ENCODER_USAGE_ULTRA_LOW_LATENCY);
-		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_TARGET_BITRATE, bitRateIn);
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_FRAMESIZE, ::AMFConstructSize(width, height));
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_FRAMERATE, ::AMFConstructRate(frameRateIn, 1));
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_B_PIC_PATTERN, 0);
@@ -59,11 +68,29 @@ AMFTextureEncoder::AMFTextureEncoder(const amf::AMFContextPtr &amfContext
 
 		//Does not seem to make a difference but turned on anyway in case it does on other hardware
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_LOWLATENCY_MODE, true);
+
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_SLICES_PER_FRAME, Settings::Instance().m_slicesPerFrame);
+
+		//Continuously refresh the picture a strip at a time so lost packets heal without IDR frames
+		if (Settings::Instance().m_intraRefreshFrames > 0) {
+			int macroblocks = ((width + 15) / 16) * ((height + 15) / 16);
+			int frames = Settings::Instance().m_intraRefreshFrames;
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_INTRA_REFRESH_NUM_MBS_PER_SLOT, (macroblocks + frames - 1) / frames);
+		}
+
+		if (Settings::Instance().m_referenceFrameInvalidation) {
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_MAX_LTR_FRAMES, VideoEncoderVCE::LTR_SLOTS);
+		}
+
+		// Pre-encode assisted rate control. The pre-analysis module proper only runs with peak
+		// constrained VBR, the low latency usage is CBR.
+		if (Settings::Instance().m_amfPreAnalysis) {
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_PREENCODE_ENABLE, AMF_VIDEO_ENCODER_PREENCODE_ENABLED);
+		}
 	}
 	else
 	{
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_USAGE, AMF_VIDEO_ENCODER_HEVC_USAGE_ULTRA_LOW_LATENCY);
-		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_TARGET_BITRATE, bitRateIn);
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_FRAMESIZE, ::AMFConstructSize(width, height));
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_FRAMERATE, ::AMFConstructRate(frameRateIn, 1));	
 
@@ -78,10 +105,57 @@ AMFTextureEncoder::AMFTextureEncoder(const amf::AMFContextPtr &amfContext
 
 		//Does not seem to make a difference but turned on anyway in case it does on other hardware
 		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_LOWLATENCY_MODE, true);
+
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_SLICES_PER_FRAME, Settings::Instance().m_slicesPerFrame);
+
+		if (inputFormat == amf::AMF_SURFACE_P010) {
+			// AMF_VIDEO_ENCODER_HEVC_PROFILE_MAIN_10 of the newer headers, supported since Polaris
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_PROFILE, (amf_int64)2);
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_COLOR_BIT_DEPTH, AMF_COLOR_BIT_DEPTH_10);
+		}
+
+		if (Settings::Instance().m_referenceFrameInvalidation) {
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_MAX_LTR_FRAMES, VideoEncoderVCE::LTR_SLOTS);
+		}
+
+		if (Settings::Instance().m_amfPreAnalysis) {
+			m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_PREENCODE_ENABLE, true);
+		}
 	}
+	SetRate(EncoderRate::ForBitrate(bitRateIn, (float)frameRateIn));
 	AMF_THROW_IF(m_amfEncoder->Init(inputFormat, width, height));
 
-	Debug("Initialized AMFTextureEncoder.\n");
+	amf::AMFCapsPtr caps;
+	if (m_amfEncoder->GetCaps(&caps) == AMF_OK) {
+		caps->GetProperty(codec == ALVR_CODEC_H264 ? AMF_VIDEO_ENCODER_CAPS_QUERY_TIMEOUT_SUPPORT : AMF_VIDEO_ENCODER_CAPS_HEVC_QUERY_TIMEOUT_SUPPORT, &m_queryTimeout);
+	}
+	if (m_queryTimeout) {
+		m_amfEncoder->SetProperty(codec == ALVR_CODEC_H264 ? AMF_VIDEO_ENCODER_QUERY_TIMEOUT : AMF_VIDEO_ENCODER_HEVC_QUERY_TIMEOUT, QUERY_TIMEOUT_MS);
+	}
+
+	Debug("Initialized AMFTextureEncoder. PipelineDepth=%d QueryTimeout=%d\n", pipelineDepth, m_queryTimeout);
+}
+
+void AMFTextureEncoder::SetRate(const EncoderRate &rate)
+{
+	amf_int64 bitrate = rate.bitrate;
+	amf_int64 vbvSize = rate.vbvSize;
+	// Hard limit on top of the VBV, which IDR frames overshoot
+	amf_int64 maxAUSize = rate.maxFrameSize;
+	if (m_codec == ALVR_CODEC_H264)
+	{
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_TARGET_BITRATE, bitrate);
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_PEAK_BITRATE, bitrate);
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_VBV_BUFFER_SIZE, vbvSize);
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_MAX_AU_SIZE, maxAUSize);
+	}
+	else
+	{
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_TARGET_BITRATE, bitrate);
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_PEAK_BITRATE, bitrate);
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_VBV_BUFFER_SIZE, vbvSize);
+		m_amfEncoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_MAX_AU_SIZE, maxAUSize);
+	}
 }
 
 AMFTextureEncoder::~AMFTextureEncoder()
@@ -90,34 +164,40 @@ AMFTextureEncoder::~AMFTextureEncoder()
 
 void AMFTextureEncoder::Start()
 {
-	m_thread = new std::thread(&AMFTextureEncoder::Run, this);
+	m_thread.Start();
 }
 
 void AMFTextureEncoder::Shutdown()
 {
 	Debug("AMFTextureEncoder::Shutdown() m_amfEncoder->Drain\n");
 	m_amfEncoder->Drain();
-	Debug("AMFTextureEncoder::Shutdown() m_thread->join\n");
-	m_thread->join();
+	Debug("AMFTextureEncoder::Shutdown() m_thread.WaitForStop\n");
+	// The thread returns at AMF_EOF once the drained frames are out
+	m_thread.RequestStop();
+	m_thread.WaitForStop();
 	Debug("AMFTextureEncoder::Shutdown() joined.\n");
-	delete m_thread;
-	m_thread = NULL;
 }
 
 void AMFTextureEncoder::Submit(amf::AMFData *data)
 {
+	Debug("AMFTextureEncoder::Submit.\n");
+	if (!m_inFlight.Lock(SUBMIT_TIMEOUT_MS)) {
+		Warn("AMFTextureEncoder: no output for %d ms, dropping a frame.\n", SUBMIT_TIMEOUT_MS);
+		return;
+	}
 	while (true)
 	{
-		Debug("AMFTextureEncoder::Submit.\n");
 		auto res = m_amfEncoder->SubmitInput(data);
-		if (res == AMF_INPUT_FULL)
-		{
+		if (res == AMF_OK) {
 			return;
 		}
-		else
-		{
-			break;
+		// The queue has room again after the next output
+		if (res == AMF_INPUT_FULL && m_outputEvent.Lock(SUBMIT_TIMEOUT_MS)) {
+			continue;
 		}
+		Warn("AMFTextureEncoder: SubmitInput returns %d, dropping a frame.\n", res);
+		m_inFlight.Unlock();
+		return;
 	}
 }
 
@@ -141,9 +221,12 @@ void AMFTextureEncoder::Run()
 
 		if (data != NULL)
 		{
+			// The next frame can go in while this one is sent
+			m_inFlight.Unlock();
+			m_outputEvent.SetEvent();
 			m_receiver(data);
 		}
-		else
+		else if (!m_queryTimeout)
 		{
 			Sleep(1);
 		}
@@ -157,7 +240,9 @@ void AMFTextureEncoder::Run()
 AMFTextureConverter::AMFTextureConverter(const amf::AMFContextPtr &amfContext
 	, int width, int height
 	, amf::AMF_SURFACE_FORMAT inputFormat, amf::AMF_SURFACE_FORMAT outputFormat
-	, AMFTextureReceiver receiver) : m_receiver(receiver)
+	, AMFTextureReceiver receiver)
+	: m_thread([this] { Run(); })
+	, m_receiver(receiver)
 {
 	AMF_THROW_IF(g_AMFFactory.GetFactory()->CreateComponent(amfContext, AMFVideoConverter, &m_amfConverter));
 
@@ -176,18 +261,18 @@ AMFTextureConverter::~AMFTextureConverter()
 
 void AMFTextureConverter::Start()
 {
-	m_thread = new std::thread(&AMFTextureConverter::Run, this);
+	m_thread.Start();
 }
 
 void AMFTextureConverter::Shutdown()
 {
 	Debug("AMFTextureConverter::Shutdown() m_amfConverter->Drain\n");
 	m_amfConverter->Drain();
-	Debug("AMFTextureConverter::Shutdown() m_thread->join\n");
-	m_thread->join();
+	Debug("AMFTextureConverter::Shutdown() m_thread.WaitForStop\n");
+	// The thread returns at AMF_EOF once the drained frames are out
+	m_thread.RequestStop();
+	m_thread.WaitForStop();
 	Debug("AMFTextureConverter::Shutdown() joined.\n");
-	delete m_thread;
-	m_thread = NULL;
 }
 
 void AMFTextureConverter::Submit(amf::AMFData *data)
@@ -237,15 +322,49 @@ void AMFTextureConverter::Run()
 
 VideoEncoderVCE::VideoEncoderVCE(std::shared_ptr<CD3DRender> d3dRender
 	, std::shared_ptr<ClientConnection> listener
-	, int width, int height)
+	, int width, int height, DXGI_FORMAT format)
 	: m_d3dRender(d3dRender)
 	, m_Listener(listener)
 	, m_codec(Settings::Instance().m_codec)
 	, m_refreshRate(Settings::Instance().m_refreshRate)
 	, m_renderWidth(width)
 	, m_renderHeight(height)
-	, m_bitrateInMBits(Settings::Instance().mEncodeBitrateMBs)
+	, m_bitrateInMBits(Settings::Instance().GetLive().mEncodeBitrateMBs)
+	, m_inputFormat(format)
+	, m_pipelineDepth(Settings::Instance().m_amfPipelineDepth)
+{
+}
+
+bool VideoEncoderVCE::StartIntraRefresh()
 {
+	// The refresh runs continuously, a lost strip is repaired by the next wave. AMF exposes no
+	// intra refresh for HEVC.
+	return m_codec == ALVR_CODEC_H264 && Settings::Instance().m_intraRefreshFrames > 0;
+}
+
+bool VideoEncoderVCE::InvalidateReferences(uint64_t lastGoodTimestampNs)
+{
+	if (!Settings::Instance().m_referenceFrameInvalidation) {
+		return false;
+	}
+	// Newest long term reference the client decoded. The slots marked after it are lost.
+	int slot = -1;
+	for (int i = 0; i < LTR_SLOTS; i++) {
+		if (m_ltrTimestamps[i] != 0 && m_ltrTimestamps[i] <= lastGoodTimestampNs
+			&& (slot < 0 || m_ltrTimestamps[i] > m_ltrTimestamps[slot])) {
+			slot = i;
+		}
+	}
+	if (slot < 0) {
+		return false;
+	}
+	for (int i = 0; i < LTR_SLOTS; i++) {
+		if (m_ltrTimestamps[i] > lastGoodTimestampNs) {
+			m_ltrTimestamps[i] = 0;
+		}
+	}
+	m_forcedLtrSlot = slot;
+	return true;
 }
 
 VideoEncoderVCE::~VideoEncoderVCE()
@@ -261,16 +380,29 @@ void VideoEncoderVCE::Initialize()
 	AMF_THROW_IF(g_AMFFactory.GetFactory()->CreateContext(&m_amfContext));
 	AMF_THROW_IF(m_amfContext->InitDX11(m_d3dRender->GetDevice()));
 
-	m_encoder = std::make_shared<AMFTextureEncoder>(m_amfContext
-		, m_codec, m_renderWidth, m_renderHeight, m_refreshRate, m_bitrateInMBits
-		, ENCODER_INPUT_FORMAT, std::bind(&VideoEncoderVCE::Receive, this, std::placeholders::_1));
-	m_converter = std::make_shared<AMFTextureConverter>(m_amfContext
-		, m_renderWidth, m_renderHeight
-		, CONVERTER_INPUT_FORMAT, ENCODER_INPUT_FORMAT
-		, std::bind(&AMFTextureEncoder::Submit, m_encoder.get(), std::placeholders::_1));
+	if (m_inputFormat == DXGI_FORMAT_NV12 || m_inputFormat == DXGI_FORMAT_P010) {
+		m_encoder = std::make_shared<AMFTextureEncoder>(m_amfContext
+			, m_codec, m_renderWidth, m_renderHeight, m_refreshRate, m_bitrateInMBits
+			, YuvSurfaceFormat(), m_pipelineDepth, std::bind(&VideoEncoderVCE::Receive, this, std::placeholders::_1));
+	}
+	else {
+		m_encoder = std::make_shared<AMFTextureEncoder>(m_amfContext
+			, m_codec, m_renderWidth, m_renderHeight, m_refreshRate, m_bitrateInMBits
+			, ENCODER_INPUT_FORMAT, m_pipelineDepth, std::bind(&VideoEncoderVCE::Receive, this, std::placeholders::_1));
+		m_converter = std::make_shared<AMFTextureConverter>(m_amfContext
+			, m_renderWidth, m_renderHeight
+			, CONVERTER_INPUT_FORMAT, ENCODER_INPUT_FORMAT
+			, std::bind(&AMFTextureEncoder::Submit, m_encoder.get(), std::placeholders::_1));
+	}
+
+	if (FoveatedEncodingEnabled()) {
+		CreateRoiSurface();
+	}
 
 	m_encoder->Start();
-	m_converter->Start();
+	if (m_converter) {
+		m_converter->Start();
+	}
 
 	Debug("Successfully initialized VideoEncoderVCE.\n");
 }
@@ -280,7 +412,9 @@ void VideoEncoderVCE::Shutdown()
 	Debug("Shutting down VideoEncoderVCE.\n");
 
 	m_encoder->Shutdown();
-	m_converter->Shutdown();
+	if (m_converter) {
+		m_converter->Shutdown();
+	}
 
 	amf_restore_timer_precision();
 
@@ -290,37 +424,51 @@ void VideoEncoderVCE::Shutdown()
 	Debug("Successfully shutdown VideoEncoderVCE.\n");
 }
 
+void VideoEncoderVCE::Reconfigure(const EncoderRate &rate)
+{
+	m_bitrateInMBits = (int)(rate.bitrate / 1000000);
+	m_encoder->SetRate(rate);
+}
+
 void VideoEncoderVCE::Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR)
 {
 	amf::AMFSurfacePtr surface;
 	// Surface is cached by AMF.
 
-	if (m_Listener) {
-		if (m_Listener->GetStatistics()->CheckBitrateUpdated()) {
-			m_bitrateInMBits = m_Listener->GetStatistics()->GetBitrate();
-			amf_int64 bitRateIn = m_bitrateInMBits * 1000000L; // in bits
-			if (m_codec == ALVR_CODEC_H264)
-			{
-				m_encoder->Get()->SetProperty(AMF_VIDEO_ENCODER_TARGET_BITRATE, bitRateIn);
-			}
-			else
-			{
-				m_encoder->Get()->SetProperty(AMF_VIDEO_ENCODER_HEVC_TARGET_BITRATE, bitRateIn);
-			}
-		}
+	// Wrap the texture when it already has the input format. The converter reads it on the
+	// immediate context during Submit, so it can be reused once Transmit returns.
+	// NV12 and P010 textures go to the encoder, which may still read them later, so they are always copied.
+	D3D11_TEXTURE2D_DESC desc;
+	pTexture->GetDesc(&desc);
+	if (m_inputFormat == DXGI_FORMAT_NV12 || m_inputFormat == DXGI_FORMAT_P010) {
+		AMF_THROW_IF(m_amfContext->AllocSurface(amf::AMF_MEMORY_DX11, YuvSurfaceFormat(), m_renderWidth, m_renderHeight, &surface));
+		ID3D11Texture2D *textureDX11 = (ID3D11Texture2D*)surface->GetPlaneAt(0)->GetNative(); // no reference counting - do not Release()
+		m_d3dRender->GetContext()->CopyResource(textureDX11, pTexture);
+	}
+	else if (desc.Format != DXGI_FORMAT_R8G8B8A8_UNORM
+		|| m_amfContext->CreateSurfaceFromDX11Native(pTexture, &surface, NULL) != AMF_OK) {
+		AMF_THROW_IF(m_amfContext->AllocSurface(amf::AMF_MEMORY_DX11, CONVERTER_INPUT_FORMAT, m_renderWidth, m_renderHeight, &surface));
+		ID3D11Texture2D *textureDX11 = (ID3D11Texture2D*)surface->GetPlaneAt(0)->GetNative(); // no reference counting - do not Release()
+		m_d3dRender->GetContext()->CopyResource(textureDX11, pTexture);
 	}
-
-	AMF_THROW_IF(m_amfContext->AllocSurface(amf::AMF_MEMORY_DX11, CONVERTER_INPUT_FORMAT, m_renderWidth, m_renderHeight, &surface));
-	ID3D11Texture2D *textureDX11 = (ID3D11Texture2D*)surface->GetPlaneAt(0)->GetNative(); // no reference counting - do not Release()
-	m_d3dRender->GetContext()->CopyResource(textureDX11, pTexture);
 
 	amf_pts start_time = amf_high_precision_clock();
 	surface->SetProperty(START_TIME_PROPERTY, start_time);
 	surface->SetProperty(FRAME_INDEX_PROPERTY, targetTimestampNs);
 
-	ApplyFrameProperties(surface, insertIDR);
+	ApplyFrameProperties(surface, insertIDR, targetTimestampNs);
+
+	if (m_converter) {
+		m_converter->Submit(surface);
+	}
+	else {
+		m_encoder->Submit(surface);
+	}
+}
 
-	m_converter->Submit(surface);
+amf::AMF_SURFACE_FORMAT VideoEncoderVCE::YuvSurfaceFormat() const
+{
+	return m_inputFormat == DXGI_FORMAT_P010 ? amf::AMF_SURFACE_P010 : amf::AMF_SURFACE_NV12;
 }
 
 void VideoEncoderVCE::Receive(amf::AMFData *data)
@@ -333,15 +481,21 @@ void VideoEncoderVCE::Receive(amf::AMFData *data)
 
 	amf::AMFBufferPtr buffer(data); // query for buffer interface
 
-	if (m_Listener) {
-		m_Listener->GetStatistics()->EncodeOutput((current_time - start_time) / MICROSEC_TIME);
-	}
-
 	char *p = reinterpret_cast<char *>(buffer->GetNative());
 	int length = static_cast<int>(buffer->GetSize());
 
 	SkipAUD(&p, &length);
 
+	if (m_Listener) {
+		EncodeStats stats;
+		stats.latencyUs = (current_time - start_time) / MICROSEC_TIME;
+		stats.encoderLatencyUs = stats.latencyUs;
+		stats.bytes = length;
+		stats.pipelineDepth = m_pipelineDepth;
+		ReadFrameStats(data, stats);
+		m_Listener->GetStatistics()->EncodeOutput(stats);
+	}
+
 	if (fpOut) {
 		fpOut.write(p, length);
 	}
@@ -350,21 +504,94 @@ void VideoEncoderVCE::Receive(amf::AMFData *data)
 	}
 }
 
-void VideoEncoderVCE::ApplyFrameProperties(const amf::AMFSurfacePtr &surface, bool insertIDR) {
+void VideoEncoderVCE::ReadFrameStats(amf::AMFData *data, EncodeStats &stats) {
+	amf_int64 dataType = -1;
+	amf_uint32 averageQp = 0;
+	bool hasQp;
+	switch (m_codec) {
+	case ALVR_CODEC_H264:
+		data->GetProperty(AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE, &dataType);
+		hasQp = data->GetProperty(AMF_VIDEO_ENCODER_STATISTIC_AVERAGE_QP, &averageQp) == AMF_OK;
+		break;
+	case ALVR_CODEC_H265:
+		data->GetProperty(AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE, &dataType);
+		hasQp = data->GetProperty(AMF_VIDEO_ENCODER_HEVC_STATISTIC_AVERAGE_QP, &averageQp) == AMF_OK;
+		break;
+	default:
+		return;
+	}
+	if (hasQp) {
+		stats.averageQp = (float)averageQp;
+	}
+
+	// Both codecs number IDR, I, P (and B for H.264) the same way
+	switch (dataType) {
+	case AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_IDR:
+		stats.frameType = EncodeStats::FRAME_IDR;
+		break;
+	case AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_I:
+		stats.frameType = EncodeStats::FRAME_I;
+		break;
+	case AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_P:
+		stats.frameType = EncodeStats::FRAME_P;
+		break;
+	case AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_B:
+		stats.frameType = EncodeStats::FRAME_B;
+		break;
+	}
+}
+
+void VideoEncoderVCE::ApplyFrameProperties(const amf::AMFSurfacePtr &surface, bool insertIDR, uint64_t targetTimestampNs) {
+	// Long term references for InvalidateReferences(), marked in turn every LTR_INTERVAL frames
+	// from the last IDR. A frame that references one is not marked itself.
+	int64_t forceLtrBitfield = 0;
+	int64_t markLtrSlot = -1;
+	if (Settings::Instance().m_referenceFrameInvalidation) {
+		if (insertIDR) {
+			std::fill(std::begin(m_ltrTimestamps), std::end(m_ltrTimestamps), 0);
+			m_ltrFrameCount = 0;
+			m_forcedLtrSlot = -1;
+		}
+		if (m_forcedLtrSlot >= 0) {
+			Debug("Referencing long term reference %d.\n", m_forcedLtrSlot);
+			forceLtrBitfield = 1ll << m_forcedLtrSlot;
+			m_forcedLtrSlot = -1;
+		} else if (m_ltrFrameCount % LTR_INTERVAL == 0) {
+			markLtrSlot = (m_ltrFrameCount / LTR_INTERVAL) % LTR_SLOTS;
+			m_ltrTimestamps[markLtrSlot] = targetTimestampNs;
+		}
+		m_ltrFrameCount++;
+	}
+
 	switch (m_codec) {
 	case ALVR_CODEC_H264:
 		// Disable AUD (NAL Type 9) to produce the same stream format as VideoEncoderNVENC.
 		surface->SetProperty(AMF_VIDEO_ENCODER_INSERT_AUD, false);
+		// Average QP of the frame for the statistics
+		surface->SetProperty(AMF_VIDEO_ENCODER_STATISTICS_FEEDBACK, true);
+		if (m_roiSurface) {
+			surface->SetProperty(AMF_VIDEO_ENCODER_ROI_DATA, m_roiSurface);
+		}
 		if (insertIDR) {
 			Debug("Inserting IDR frame for H.264.\n");
 			surface->SetProperty(AMF_VIDEO_ENCODER_INSERT_SPS, true);
 			surface->SetProperty(AMF_VIDEO_ENCODER_INSERT_PPS, true);
 			surface->SetProperty(AMF_VIDEO_ENCODER_FORCE_PICTURE_TYPE, AMF_VIDEO_ENCODER_PICTURE_TYPE_IDR);
 		}
+		if (forceLtrBitfield != 0) {
+			surface->SetProperty(AMF_VIDEO_ENCODER_FORCE_LTR_REFERENCE_BITFIELD, forceLtrBitfield);
+		}
+		if (markLtrSlot >= 0) {
+			surface->SetProperty(AMF_VIDEO_ENCODER_MARK_CURRENT_WITH_LTR_INDEX, markLtrSlot);
+		}
 		break;
 	case ALVR_CODEC_H265:
 		// This option is ignored. Maybe a bug on AMD driver.
 		surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_INSERT_AUD, false);
+		surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_STATISTICS_FEEDBACK, true);
+		if (m_roiSurface) {
+			surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_ROI_DATA, m_roiSurface);
+		}
 		if (insertIDR) {
 			Debug("Inserting IDR frame for H.265.\n");
 			// Insert VPS,SPS,PPS
@@ -373,10 +600,45 @@ void VideoEncoderVCE::ApplyFrameProperties(const amf::AMFSurfacePtr &surface, bo
 			surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_INSERT_HEADER, true);
 			surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_FORCE_PICTURE_TYPE, AMF_VIDEO_ENCODER_HEVC_PICTURE_TYPE_IDR);
 		}
+		if (forceLtrBitfield != 0) {
+			surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_FORCE_LTR_REFERENCE_BITFIELD, forceLtrBitfield);
+		}
+		if (markLtrSlot >= 0) {
+			surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_MARK_CURRENT_WITH_LTR_INDEX, markLtrSlot);
+		}
 		break;
 	}
 }
 
+void VideoEncoderVCE::CreateRoiSurface() {
+	amf::AMFCapsPtr caps;
+	bool supported = false;
+	if (m_encoder->Get()->GetCaps(&caps) == AMF_OK) {
+		caps->GetProperty(m_codec == ALVR_CODEC_H264 ? AMF_VIDEO_ENCODER_CAP_ROI : AMF_VIDEO_ENCODER_HEVC_CAP_ROI, &supported);
+	}
+	if (!supported) {
+		Info("VideoEncoderVCE: ROI maps are not supported, foveated encoding is disabled\n");
+		return;
+	}
+
+	// One importance value per macroblock for H.264, per 64x64 CTB for HEVC. The importance goes
+	// from 10 in the center down by one per QP of offset, which the encoder turns into QP deltas.
+	int blockSize = m_codec == ALVR_CODEC_H264 ? 16 : 64;
+	int blocksX = (m_renderWidth + blockSize - 1) / blockSize;
+	int blocksY = (m_renderHeight + blockSize - 1) / blockSize;
+	auto qpMap = BuildFoveationQpMap(m_renderWidth, m_renderHeight, blockSize);
+
+	AMF_THROW_IF(m_amfContext->AllocSurface(amf::AMF_MEMORY_HOST, amf::AMF_SURFACE_GRAY32, blocksX, blocksY, &m_roiSurface));
+	amf::AMFPlanePtr plane = m_roiSurface->GetPlaneAt(0);
+	auto *data = (uint8_t *)plane->GetNative();
+	for (int y = 0; y < blocksY; y++) {
+		auto *row = (amf_uint32 *)(data + y * plane->GetHPitch());
+		for (int x = 0; x < blocksX; x++) {
+			row[x] = (amf_uint32)std::max(0, 10 - qpMap[y * blocksX + x]);
+		}
+	}
+}
+
 void VideoEncoderVCE::SkipAUD(char **buffer, int *length) {
 	// H.265 encoder always produces AUD NAL even if AMF_VIDEO_ENCODER_HEVC_INSERT_AUD is set. But it is not needed.
 	static const int AUD_NAL_SIZE = 7;
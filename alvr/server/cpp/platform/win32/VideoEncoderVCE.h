@@ -1,5 +1,6 @@
 #pragma once
 #include "VideoEncoder.h"
+#include "alvr_server/EncodeStats.h"
 
 #include "amf/common/AMFFactory.h"
 #include "amf/include/components/VideoEncoderVCE.h"
@@ -10,22 +11,48 @@
 
 typedef std::function<void (amf::AMFData *)> AMFTextureReceiver;
 
+// Thread draining the outputs of an AMF component while the frames are submitted from another one
+class AMFOutputThread : public amf::AMFThread {
+public:
+	explicit AMFOutputThread(std::function<void()> run) : m_run(run) {}
+	void Run() override { m_run(); }
+private:
+	std::function<void()> m_run;
+};
+
 class AMFTextureEncoder {
 public:
 	AMFTextureEncoder(const amf::AMFContextPtr &amfContext
 		, int codec, int width, int height, int refreshRate, int bitrateInMbits
-		, amf::AMF_SURFACE_FORMAT inputFormat
+		, amf::AMF_SURFACE_FORMAT inputFormat, uint32_t pipelineDepth
 		, AMFTextureReceiver receiver);
 	~AMFTextureEncoder();
 
 	void Start();
 	void Shutdown();
+	// Waits while pipelineDepth frames are in the encoder, so the caller runs at most that many
+	// frames ahead of the output thread.
 	void Submit(amf::AMFData *data);
+	// Target and peak bitrate and VBV size are dynamic properties, they apply from the next frame.
+	// The frame rate can only be set before Init().
+	void SetRate(const EncoderRate &rate);
 	amf::AMFComponentPtr Get();
 private:
+	// A stalled encoder drops frames after this long instead of blocking the caller
+	static constexpr amf_ulong SUBMIT_TIMEOUT_MS = 100;
+	// Wait of QueryOutput for the next output, where the driver supports it
+	static constexpr amf_int64 QUERY_TIMEOUT_MS = 50;
+
 	amf::AMFComponentPtr m_amfEncoder;
-	std::thread *m_thread = NULL;
+	int m_codec;
+	AMFOutputThread m_thread;
 	AMFTextureReceiver m_receiver;
+	// One count per frame between SubmitInput and its output
+	amf::AMFSemaphore m_inFlight;
+	// Set on each output, for a Submit that found the input queue full
+	amf::AMFEvent m_outputEvent;
+	// QueryOutput blocks until an output is ready, otherwise the thread polls every millisecond
+	bool m_queryTimeout = false;
 
 	void Run();
 };
@@ -43,7 +70,7 @@ public:
 	void Submit(amf::AMFData *data);
 private:
 	amf::AMFComponentPtr m_amfConverter;
-	std::thread *m_thread = NULL;
+	AMFOutputThread m_thread;
 	AMFTextureReceiver m_receiver;
 
 	void Run();
@@ -55,14 +82,20 @@ class VideoEncoderVCE : public VideoEncoder
 public:
 	VideoEncoderVCE(std::shared_ptr<CD3DRender> pD3DRender
 		, std::shared_ptr<ClientConnection> listener
-		, int width, int height);
+		, int width, int height, DXGI_FORMAT format);
 	~VideoEncoderVCE();
 
 	void Initialize();
 	void Shutdown();
 
 	void Transmit(ID3D11Texture2D *pTexture, uint64_t presentationTime, uint64_t targetTimestampNs, bool insertIDR);
+	void Reconfigure(const EncoderRate &rate);
+	bool StartIntraRefresh();
+	bool InvalidateReferences(uint64_t lastGoodTimestampNs);
 	void Receive(amf::AMFData *data);
+
+	// Long term references kept to recover from frame loss
+	static const int LTR_SLOTS = 2;
 private:
 	static const amf::AMF_SURFACE_FORMAT CONVERTER_INPUT_FORMAT = amf::AMF_SURFACE_RGBA;
 	static const amf::AMF_SURFACE_FORMAT ENCODER_INPUT_FORMAT = amf::AMF_SURFACE_RGBA;// amf::AMF_SURFACE_NV12;
@@ -70,6 +103,9 @@ private:
 	static const wchar_t *START_TIME_PROPERTY;
 	static const wchar_t *FRAME_INDEX_PROPERTY;
 
+	// Surface of the NV12 or P010 input frames
+	amf::AMF_SURFACE_FORMAT YuvSurfaceFormat() const;
+
 	const uint64_t MILLISEC_TIME = 10000;
 	const uint64_t MICROSEC_TIME = 10;
 
@@ -87,8 +123,23 @@ private:
 	int m_renderWidth;
 	int m_renderHeight;
 	int m_bitrateInMBits;
-
-	void ApplyFrameProperties(const amf::AMFSurfacePtr &surface, bool insertIDR);
+	// NV12 and P010 frames are submitted to the encoder directly, without the converter
+	DXGI_FORMAT m_inputFormat;
+	// Frames in the encoder at a time, AMFTextureEncoder::Submit waits beyond that
+	uint32_t m_pipelineDepth;
+	// Foveated encoding importance map attached to every frame, null if disabled or unsupported
+	amf::AMFSurfacePtr m_roiSurface;
+
+	static const uint32_t LTR_INTERVAL = 8;
+	// Target timestamp of the frame in each long term reference slot, 0 if empty
+	uint64_t m_ltrTimestamps[LTR_SLOTS] = {};
+	uint32_t m_ltrFrameCount = 0;
+	// Slot the next frame references, -1 for none
+	int m_forcedLtrSlot = -1;
+
+	void ReadFrameStats(amf::AMFData *data, EncodeStats &stats);
+	void ApplyFrameProperties(const amf::AMFSurfacePtr &surface, bool insertIDR, uint64_t targetTimestampNs);
+	void CreateRoiSurface();
 	void SkipAUD(char **buffer, int *length);
 };
 
@@ -0,0 +1,128 @@
+#pragma once
+
+// Scheduling of the threads of the streaming pipeline, shared by the driver and the Vulkan layer.
+// With realtime scheduling the threads that pace the frames run before the threads of the game:
+// they are registered with MMCSS on Windows and use SCHED_FIFO on Linux, which needs the rtprio
+// limit or CAP_SYS_NICE (SteamVR asks for it on vrcompositor-launcher). Without it they fall back
+// to a lower nice level, if RLIMIT_NICE allows it. Each role can also be pinned to a set of CPUs.
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <avrt.h>
+#pragma comment(lib, "Avrt.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum ThreadRole {
+	// VsyncEvent of the driver, vsync of the layer
+	THREAD_ROLE_VSYNC,
+	THREAD_ROLE_TRACKING,
+	THREAD_ROLE_ENCODER,
+	// Presents of the Vulkan layer in vrcompositor
+	THREAD_ROLE_PRESENT,
+	// Workers of the async runtime of the server
+	THREAD_ROLE_NETWORK,
+};
+
+struct ThreadPolicyResult {
+	bool prioritized = false;
+	bool pinned = false;
+};
+
+// Applies to the calling thread. cpuMask has a bit per CPU, 0 leaves the affinity alone. What
+// cannot be applied is reported, the thread then keeps its previous scheduling.
+inline ThreadPolicyResult SetCurrentThreadPolicy(ThreadRole role, bool realtime, uint64_t cpuMask) {
+	ThreadPolicyResult result;
+
+#ifdef _WIN32
+	if (realtime) {
+		// Pro Audio has the shortest MMCSS period, Games leaves room for the GPU submissions
+		const wchar_t *task = nullptr;
+		int fallbackPriority = THREAD_PRIORITY_ABOVE_NORMAL;
+		switch (role) {
+		case THREAD_ROLE_VSYNC:
+		case THREAD_ROLE_TRACKING:
+		case THREAD_ROLE_PRESENT:
+			task = L"Pro Audio";
+			fallbackPriority = THREAD_PRIORITY_TIME_CRITICAL;
+			break;
+		case THREAD_ROLE_ENCODER:
+			task = L"Games";
+			fallbackPriority = THREAD_PRIORITY_HIGHEST;
+			break;
+		case THREAD_ROLE_NETWORK:
+			break;
+		}
+
+		DWORD taskIndex = 0;
+		HANDLE mmcss = task ? AvSetMmThreadCharacteristicsW(task, &taskIndex) : nullptr;
+		if (mmcss) {
+			result.prioritized = AvSetMmThreadPriority(mmcss, AVRT_PRIORITY_HIGH) != 0;
+		} else {
+			result.prioritized = SetThreadPriority(GetCurrentThread(), fallbackPriority) != 0;
+		}
+	}
+
+	if (cpuMask != 0) {
+		result.pinned = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)cpuMask) != 0;
+	}
+#else
+	if (realtime) {
+		// Above the default priority 1 of the realtime threads of other processes, the vsync
+		// paces the others
+		int fifoPriority = 0;
+		int nice = -5;
+		switch (role) {
+		case THREAD_ROLE_VSYNC:
+			fifoPriority = 12;
+			nice = -15;
+			break;
+		case THREAD_ROLE_PRESENT:
+			fifoPriority = 11;
+			nice = -15;
+			break;
+		case THREAD_ROLE_TRACKING:
+			fifoPriority = 10;
+			nice = -10;
+			break;
+		case THREAD_ROLE_ENCODER:
+			// The threads of the software encoders and of the async encode inherit the
+			// scheduling, busy SCHED_FIFO threads would starve the game
+			nice = -10;
+			break;
+		case THREAD_ROLE_NETWORK:
+			// Also serves the dashboard, a nice level is enough
+			break;
+		}
+
+		if (fifoPriority != 0) {
+			sched_param param = {};
+			param.sched_priority = fifoPriority;
+			result.prioritized = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+		}
+		if (!result.prioritized) {
+			// The nice level of a thread is set through its thread ID
+			result.prioritized = setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) == 0;
+		}
+	}
+
+	if (cpuMask != 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++) {
+			if (cpuMask & (1ull << cpu)) {
+				CPU_SET(cpu, &cpus);
+			}
+		}
+		result.pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+	}
+#endif
+
+	return result;
+}
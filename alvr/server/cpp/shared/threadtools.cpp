@@ -1,6 +1,20 @@
 //===================== Copyright (c) Valve Corporation. All Rights Reserved. ======================
 #include "threadtools.h"
 
+#include <chrono>
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#pragma comment(lib, "Synchronization.lib")
+#elif defined( __linux__ )
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 //--------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
 CThread::CThread()
@@ -36,43 +50,148 @@ void CThread::Join()
 	}
 }
 
-#ifdef _WIN32
+namespace
+{
+	// Longer than most handoffs, short enough not to matter when the event is late
+	const std::chrono::microseconds SPIN_TIME( 50 );
+
+	inline void CpuRelax()
+	{
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+		_mm_pause();
+#elif defined( __aarch64__ )
+		asm volatile( "yield" );
+#endif
+	}
+}
+
 //--------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
 CThreadEvent::CThreadEvent( bool bManualReset )
+	: m_bManualReset( bManualReset )
+	, m_state( 0 )
+	, m_waiters( 0 )
+{}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+CThreadEvent::~CThreadEvent()
+{}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+bool CThreadEvent::Wait( uint32_t nTimeoutMs )
 {
-	m_hSyncObject = CreateEvent( NULL, bManualReset, FALSE, NULL );
+	auto start = std::chrono::steady_clock::now();
+	while ( !TryAcquire() )
+	{
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		if ( nTimeoutMs != WAIT_INFINITE && elapsed >= std::chrono::milliseconds( nTimeoutMs ) )
+		{
+			return false;
+		}
+		if ( elapsed < SPIN_TIME )
+		{
+			CpuRelax();
+			continue;
+		}
+
+		uint32_t nRemainingMs = WAIT_INFINITE;
+		if ( nTimeoutMs != WAIT_INFINITE )
+		{
+			nRemainingMs = nTimeoutMs - (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>( elapsed ).count();
+		}
+		// Set reads m_waiters after m_state, so either it sees the waiter or the waiter sees the state
+		m_waiters.fetch_add( 1 );
+		if ( m_state.load() == 0 )
+		{
+			Park( nRemainingMs );
+		}
+		m_waiters.fetch_sub( 1 );
+	}
+	return true;
 }
 
 //--------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-CThreadEvent::~CThreadEvent()
+bool CThreadEvent::Set()
 {
-	if ( m_hSyncObject )
+	if ( m_state.exchange( 1 ) == 0 && m_waiters.load() != 0 )
 	{
-		CloseHandle( m_hSyncObject );
+		Wake();
 	}
+	return true;
 }
 
 //--------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-bool CThreadEvent::Wait( uint32_t nTimeoutMs )
+bool CThreadEvent::Reset()
 {
-	return WaitForSingleObject( m_hSyncObject, nTimeoutMs ) == WAIT_OBJECT_0;
+	m_state.store( 0 );
+	return true;
 }
 
 //--------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-bool CThreadEvent::Set()
+bool CThreadEvent::TryAcquire()
 {
-	return SetEvent( m_hSyncObject ) != 0;
+	if ( m_bManualReset )
+	{
+		return m_state.load( std::memory_order_acquire ) != 0;
+	}
+	uint32_t expected = 1;
+	return m_state.compare_exchange_strong( expected, 0, std::memory_order_acquire );
 }
 
 //--------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-bool CThreadEvent::Reset()
+void CThreadEvent::Park( uint32_t nTimeoutMs )
 {
-	return ResetEvent( m_hSyncObject ) != 0;
+#if defined( _WIN32 )
+	uint32_t unsignaled = 0;
+	WaitOnAddress( &m_state, &unsignaled, sizeof( unsignaled ), nTimeoutMs );
+#elif defined( __linux__ )
+	timespec timeout;
+	timeout.tv_sec = nTimeoutMs / 1000;
+	timeout.tv_nsec = ( nTimeoutMs % 1000 ) * 1000000L;
+	// Returns right away if m_state is not 0 anymore
+	syscall( SYS_futex, (uint32_t *)&m_state, FUTEX_WAIT_PRIVATE, 0,
+		nTimeoutMs == WAIT_INFINITE ? nullptr : &timeout, nullptr, 0 );
+#else
+	std::unique_lock<std::mutex> lock( m_mutex );
+	auto signaled = [this] { return m_state.load() != 0; };
+	if ( nTimeoutMs == WAIT_INFINITE )
+	{
+		m_condition.wait( lock, signaled );
+	}
+	else
+	{
+		m_condition.wait_for( lock, std::chrono::milliseconds( nTimeoutMs ), signaled );
+	}
+#endif
 }
 
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+void CThreadEvent::Wake()
+{
+#if defined( _WIN32 )
+	if ( m_bManualReset )
+	{
+		WakeByAddressAll( &m_state );
+	}
+	else
+	{
+		WakeByAddressSingle( &m_state );
+	}
+#elif defined( __linux__ )
+	syscall( SYS_futex, (uint32_t *)&m_state, FUTEX_WAKE_PRIVATE, m_bManualReset ? INT_MAX : 1,
+		nullptr, nullptr, 0 );
+#else
+	{
+		// The waiter checks m_state with the mutex held
+		std::unique_lock<std::mutex> lock( m_mutex );
+	}
+	m_condition.notify_all();
 #endif
+}
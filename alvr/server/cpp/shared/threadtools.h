@@ -5,9 +5,14 @@
 //==================================================================================================
 #pragma once
 
+#include <atomic>
+#include <stdint.h>
 #include <thread>
 #ifdef _WIN32
 #include <windows.h>
+#elif !defined(__linux__)
+#include <condition_variable>
+#include <mutex>
 #endif
 
 #define THREAD_PRIORITY_MOST_URGENT 15
@@ -25,16 +30,33 @@ private:
 	std::thread *m_pThread;
 };
 
-#ifdef _WIN32
+// Event for the handoffs between threads that happen once per frame. The waiter spins for a short
+// while before parking, the other side usually signals within a fraction of a millisecond and the
+// wake-up of a parked thread would add to the latency. Parks on WaitOnAddress on Windows and on a
+// futex on Linux, so Set only makes a system call when a thread is parked.
 class CThreadEvent
 {
 public:
+	static const uint32_t WAIT_INFINITE = 0xFFFFFFFF;
+
 	CThreadEvent( bool bManualReset = false );
 	~CThreadEvent();
-	bool Wait( uint32_t nTimeoutMs = INFINITE );
+	// Returns false on timeout
+	bool Wait( uint32_t nTimeoutMs = WAIT_INFINITE );
 	bool Set();
 	bool Reset();
 private:
-	HANDLE m_hSyncObject;
-};
+	bool TryAcquire();
+	// Returns once m_state may have changed, or on timeout
+	void Park( uint32_t nTimeoutMs );
+	void Wake();
+
+	bool m_bManualReset;
+	// 1 while signaled. 32 bits, the size of a futex.
+	std::atomic<uint32_t> m_state;
+	std::atomic<uint32_t> m_waiters;
+#if !defined(_WIN32) && !defined(__linux__)
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
 #endif
+};
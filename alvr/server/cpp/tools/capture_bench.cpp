@@ -0,0 +1,655 @@
+// End-to-end benchmark of the Linux capture path: a minimal Vulkan application presents frames
+// through the ALVR layer to its headless swapchain and the CEncoder of the driver imports and
+// encodes them with one encoder backend. Measures the time from vkQueuePresentKHR to the encoded
+// frame reaching the send path. Built and run by `cargo xtask bench-capture`, once per backend,
+// not part of the driver.
+//
+// The application runs in a child process with the layer enabled, as vrcompositor does. The layer
+// takes the pose of each frame from the stack of CRenderThread::Update like in SteamVR, so every
+// frame is presented with a rotation of its own, and the same rotations are put in the pose history
+// with the frame number as target timestamp. The pts of the encoded frames tell which present they
+// come from. The layer reads the resolution and the refresh rate from the session, as for SteamVR.
+//
+// Usage: capture_bench [--encoder vulkan|vaapi|nvenc|sw] [--frames N] [--h265] [--bitrate MBPS]
+//                      [--pipeline-depth N] [--shaders DIR]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vulkan/vulkan.h>
+
+#include "alvr_server/ClientConnection.h"
+#include "alvr_server/LatencyHistogram.h"
+#include "alvr_server/PoseHistory.h"
+#include "alvr_server/Settings.h"
+#include "alvr_server/Utils.h"
+#include "alvr_server/bindings.h"
+#include "platform/linux/CEncoder.h"
+#include "platform/linux/EncodePipeline.h"
+#include "platform/linux/present_ring.h"
+
+// Driver globals and Rust callbacks the capture path links against
+const char *g_sessionPath = "";
+const char *g_driverRootDir = "";
+uint64_t g_DriverTestMode = 0;
+
+const unsigned char *FRAME_RENDER_COMP_SPV_PTR = nullptr;
+unsigned int FRAME_RENDER_COMP_SPV_LEN = 0;
+const unsigned char *RGB_TO_YUV_COMP_SPV_PTR = nullptr;
+unsigned int RGB_TO_YUV_COMP_SPV_LEN = 0;
+
+static void FrameSent(const VideoFrame &header, int len);
+
+static void LogStub(const char *) {}
+static void LogErrorStub(const char *message) {
+	fprintf(stderr, "%s", message);
+}
+static void VideoSendStub(VideoFrame header, unsigned char *, int len, bool) {
+	FrameSent(header, len);
+}
+static void VideoConfigSendStub(unsigned char, const unsigned char *, int) {}
+
+static void VideoSendBatchStub(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool, bool) {
+	for (int i = 0; i < count; i++) {
+		FrameSent(headers[i], payloads[i].len);
+	}
+}
+
+void (*LogError)(const char *stringPtr) = LogErrorStub;
+void (*LogWarn)(const char *stringPtr) = LogErrorStub;
+void (*LogInfo)(const char *stringPtr) = LogStub;
+void (*LogDebug)(const char *stringPtr) = LogStub;
+void (*VideoSend)(VideoFrame header, unsigned char *buf, int len, bool idr) = VideoSendStub;
+void (*VideoSendBatch)(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool idr, bool frameEnd) = VideoSendBatchStub;
+void (*VideoConfigSend)(unsigned char streamIndex, const unsigned char *buf, int len) = VideoConfigSendStub;
+void (*TimeSyncSend)(TimeSync packet) = nullptr;
+void (*StatisticsSend)(StatisticsSummary summary) = nullptr;
+void (*GraphStatisticsSend)(GraphStatistics statistics) = nullptr;
+void RequestIDR() {}
+
+namespace {
+	// Frames only in the first part of the run: the layer connects, the images are imported and the
+	// encoder session is created during these.
+	const int WARMUP_FRAMES = 90;
+	// Distinct rotations, frames are numbered modulo this
+	const uint64_t ROTATIONS = 64 * 64;
+	// Poses registered ahead of the application, well within PoseHistory::HISTORY_CAPACITY
+	const uint64_t POSE_LEAD = 32;
+	const int STARTUP_TIMEOUT_MS = 30000;
+
+	struct Options {
+		std::string encoder = "vaapi";
+		int frames = 1800;
+		bool h265 = false;
+		int bitrateMbps = 100;
+		int pipelineDepth = 0;
+		std::string shaders = ".";
+	};
+
+	enum Stage {
+		STAGE_STARTING,
+		// The application found the display of the layer and wrote its mode
+		STAGE_DISPLAY_READY,
+		// The encoder listens for the layer
+		STAGE_ENCODER_READY,
+		STAGE_DONE,
+		STAGE_FAILED,
+	};
+
+	// Shared between the driver side and the application process, mapped before the fork
+	struct SharedState {
+		std::atomic<int> stage;
+		std::atomic<uint32_t> width;
+		std::atomic<uint32_t> height;
+		std::atomic<uint32_t> refreshMilliHz;
+		// Frames whose pose is in the pose history, the application waits for the pose of its frame
+		std::atomic<uint64_t> posesRegistered;
+		std::atomic<uint64_t> framesPresented;
+		// CLOCK_MONOTONIC time of vkQueuePresentKHR per frame
+		std::atomic<uint64_t> presentNs[1];
+	};
+
+	SharedState *g_shared = nullptr;
+
+	// Filled by the encoder thread, read once it is joined
+	LatencyHistogram g_latency;
+	uint64_t g_latencyTotalUs = 0;
+	uint64_t g_latencyMaxUs = 0;
+	uint64_t g_framesSent = 0;
+	uint64_t g_bytesSent = 0;
+	uint64_t g_lastFrame = 0;
+
+	uint64_t NowNs() {
+		return present_ring_now_ns();
+	}
+
+	// Rotation of frame number frame, a grid of yaw and pitch steps well apart after the
+	// quantization of PoseHistory
+	TrackingQuat FrameRotation(uint64_t frame) {
+		uint64_t index = frame % ROTATIONS;
+		float yaw = ((float)(index % 64) - 32.f) * 0.01f;
+		float pitch = ((float)(index / 64) - 32.f) * 0.01f;
+		float cy = cosf(yaw / 2.f), sy = sinf(yaw / 2.f);
+		float cp = cosf(pitch / 2.f), sp = sinf(pitch / 2.f);
+		// yaw around Y, then pitch around X
+		return { cy * sp, sy * cp, -sy * sp, cy * cp };
+	}
+
+	void Check(VkResult result, const char *what) {
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error(std::string(what) + " failed: " + std::to_string(result));
+		}
+	}
+
+	bool ParseOptions(int argc, char **argv, Options &options) {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--encoder" && i + 1 < argc) {
+				options.encoder = argv[++i];
+			} else if (arg == "--frames" && i + 1 < argc) {
+				options.frames = atoi(argv[++i]);
+			} else if (arg == "--h265") {
+				options.h265 = true;
+			} else if (arg == "--bitrate" && i + 1 < argc) {
+				options.bitrateMbps = atoi(argv[++i]);
+			} else if (arg == "--pipeline-depth" && i + 1 < argc) {
+				options.pipelineDepth = atoi(argv[++i]);
+			} else if (arg == "--shaders" && i + 1 < argc) {
+				options.shaders = argv[++i];
+			} else {
+				return false;
+			}
+		}
+		return options.frames > WARMUP_FRAMES && options.bitrateMbps > 0 && options.pipelineDepth >= 0;
+	}
+
+	bool WaitStage(Stage stage, pid_t child) {
+		for (int ms = 0; ms < STARTUP_TIMEOUT_MS; ms++) {
+			int current = g_shared->stage.load();
+			if (current == stage) {
+				return true;
+			}
+			if (current == STAGE_FAILED || waitpid(child, nullptr, WNOHANG) != 0) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return false;
+	}
+
+	std::vector<unsigned char> ReadFile(const std::string &path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("cannot open " + path);
+		}
+		return std::vector<unsigned char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	}
+}
+
+static void FrameSent(const VideoFrame &header, int len) {
+	uint64_t frame = header.trackingFrameIndex - 1;
+	if (frame < (uint64_t)WARMUP_FRAMES) {
+		return;
+	}
+	g_bytesSent += len;
+	// Only the first packet of a frame, when the encoder handed it over
+	if (header.trackingFrameIndex == g_lastFrame) {
+		return;
+	}
+	g_lastFrame = header.trackingFrameIndex;
+	uint64_t presentNs = g_shared->presentNs[frame].load(std::memory_order_relaxed);
+	uint64_t latencyUs = (NowNs() - presentNs) / 1000;
+	g_latency.Add(latencyUs);
+	g_latencyTotalUs += latencyUs;
+	g_latencyMaxUs = std::max(g_latencyMaxUs, latencyUs);
+	g_framesSent++;
+}
+
+// The application side, named after the compositor thread of SteamVR whose stack the layer
+// searches for the pose. Clears each image to a color of its frame number and presents it.
+class CRenderThread {
+public:
+	CRenderThread(int frames) : m_frames(frames) {}
+
+	~CRenderThread() {
+		if (m_device) {
+			vkDeviceWaitIdle(m_device);
+			for (auto semaphore : m_acquired) {
+				vkDestroySemaphore(m_device, semaphore, nullptr);
+			}
+			for (auto semaphore : m_rendered) {
+				vkDestroySemaphore(m_device, semaphore, nullptr);
+			}
+			for (auto fence : m_fences) {
+				vkDestroyFence(m_device, fence, nullptr);
+			}
+			if (m_pool) {
+				vkDestroyCommandPool(m_device, m_pool, nullptr);
+			}
+			if (m_swapchain) {
+				vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+			}
+			vkDestroyDevice(m_device, nullptr);
+		}
+		if (m_surface) {
+			vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+		}
+		if (m_instance) {
+			vkDestroyInstance(m_instance, nullptr);
+		}
+	}
+
+	void Init() {
+		VkApplicationInfo appInfo = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+		appInfo.pApplicationName = "capture_bench";
+		appInfo.apiVersion = VK_API_VERSION_1_1;
+		const char *layers[] = { "VK_LAYER_ALVR_capture" };
+		const char *instanceExtensions[] = { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_DISPLAY_EXTENSION_NAME };
+		VkInstanceCreateInfo instanceInfo = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO };
+		instanceInfo.pApplicationInfo = &appInfo;
+		instanceInfo.enabledLayerCount = 1;
+		instanceInfo.ppEnabledLayerNames = layers;
+		instanceInfo.enabledExtensionCount = 2;
+		instanceInfo.ppEnabledExtensionNames = instanceExtensions;
+		Check(vkCreateInstance(&instanceInfo, nullptr, &m_instance), "vkCreateInstance");
+
+		uint32_t count = 1;
+		VkResult result = vkEnumeratePhysicalDevices(m_instance, &count, &m_physicalDevice);
+		if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || count == 0) {
+			throw std::runtime_error("no Vulkan device");
+		}
+
+		// The layer appends its display to the ones of the driver
+		count = 0;
+		vkGetPhysicalDeviceDisplayPropertiesKHR(m_physicalDevice, &count, nullptr);
+		std::vector<VkDisplayPropertiesKHR> displays(count);
+		vkGetPhysicalDeviceDisplayPropertiesKHR(m_physicalDevice, &count, displays.data());
+		VkDisplayKHR display = VK_NULL_HANDLE;
+		for (auto &properties : displays) {
+			if (properties.displayName && strcmp(properties.displayName, "ALVR display") == 0) {
+				display = properties.display;
+			}
+		}
+		if (!display) {
+			throw std::runtime_error("the ALVR layer is not loaded");
+		}
+		VkDisplayModePropertiesKHR mode;
+		count = 1;
+		Check(vkGetDisplayModePropertiesKHR(m_physicalDevice, display, &count, &mode), "vkGetDisplayModePropertiesKHR");
+		m_extent = mode.parameters.visibleRegion;
+		m_refreshMilliHz = mode.parameters.refreshRate;
+		if (m_extent.width == 0 || m_extent.height == 0 || m_refreshMilliHz == 0) {
+			throw std::runtime_error("the layer has no display mode, is there a session?");
+		}
+
+		g_shared->width = m_extent.width;
+		g_shared->height = m_extent.height;
+		g_shared->refreshMilliHz = m_refreshMilliHz;
+		g_shared->stage = STAGE_DISPLAY_READY;
+
+		VkDisplaySurfaceCreateInfoKHR surfaceInfo = { VK_STRUCTURE_TYPE_DISPLAY_SURFACE_CREATE_INFO_KHR };
+		surfaceInfo.displayMode = mode.displayMode;
+		surfaceInfo.transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+		surfaceInfo.alphaMode = VK_DISPLAY_PLANE_ALPHA_OPAQUE_BIT_KHR;
+		surfaceInfo.imageExtent = m_extent;
+		Check(vkCreateDisplayPlaneSurfaceKHR(m_instance, &surfaceInfo, nullptr, &m_surface), "vkCreateDisplayPlaneSurfaceKHR");
+
+		count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(count);
+		vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &count, families.data());
+		uint32_t family = 0;
+		while (family < count && !(families[family].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+			family++;
+		}
+		if (family == count) {
+			throw std::runtime_error("no graphics queue");
+		}
+
+		float priority = 1.f;
+		VkDeviceQueueCreateInfo queueInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
+		queueInfo.queueFamilyIndex = family;
+		queueInfo.queueCount = 1;
+		queueInfo.pQueuePriorities = &priority;
+		const char *deviceExtensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+		VkDeviceCreateInfo deviceInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
+		deviceInfo.queueCreateInfoCount = 1;
+		deviceInfo.pQueueCreateInfos = &queueInfo;
+		deviceInfo.enabledExtensionCount = 1;
+		deviceInfo.ppEnabledExtensionNames = deviceExtensions;
+		Check(vkCreateDevice(m_physicalDevice, &deviceInfo, nullptr, &m_device), "vkCreateDevice");
+		vkGetDeviceQueue(m_device, family, 0, &m_queue);
+
+		VkSurfaceCapabilitiesKHR capabilities;
+		Check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_physicalDevice, m_surface, &capabilities),
+			"vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+		VkSurfaceFormatKHR format;
+		count = 1;
+		result = vkGetPhysicalDeviceSurfaceFormatsKHR(m_physicalDevice, m_surface, &count, &format);
+		if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || count == 0) {
+			throw std::runtime_error("no surface format");
+		}
+
+		VkSwapchainCreateInfoKHR swapchainInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
+		swapchainInfo.surface = m_surface;
+		swapchainInfo.minImageCount = capabilities.minImageCount;
+		swapchainInfo.imageFormat = format.format;
+		swapchainInfo.imageColorSpace = format.colorSpace;
+		swapchainInfo.imageExtent = m_extent;
+		swapchainInfo.imageArrayLayers = 1;
+		swapchainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		swapchainInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+		swapchainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		swapchainInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+		swapchainInfo.clipped = VK_TRUE;
+		Check(vkCreateSwapchainKHR(m_device, &swapchainInfo, nullptr, &m_swapchain), "vkCreateSwapchainKHR");
+
+		count = 0;
+		vkGetSwapchainImagesKHR(m_device, m_swapchain, &count, nullptr);
+		m_images.resize(count);
+		vkGetSwapchainImagesKHR(m_device, m_swapchain, &count, m_images.data());
+
+		VkCommandPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		poolInfo.queueFamilyIndex = family;
+		Check(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_pool), "vkCreateCommandPool");
+		m_commandBuffers.resize(count);
+		VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		allocateInfo.commandPool = m_pool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = count;
+		Check(vkAllocateCommandBuffers(m_device, &allocateInfo, m_commandBuffers.data()), "vkAllocateCommandBuffers");
+
+		VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+		VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		// One acquire semaphore more than images, the one of a frame is free again once an image
+		// of a later frame was acquired
+		m_acquired.resize(count + 1);
+		for (auto &semaphore : m_acquired) {
+			Check(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &semaphore), "vkCreateSemaphore");
+		}
+		m_rendered.resize(count);
+		m_fences.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			Check(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_rendered[i]), "vkCreateSemaphore");
+			Check(vkCreateFence(m_device, &fenceInfo, nullptr, &m_fences[i]), "vkCreateFence");
+		}
+	}
+
+	void Run() {
+		if (!WaitEncoder()) {
+			throw std::runtime_error("the encoder did not start");
+		}
+
+		uint64_t periodNs = 1000000000000ull / m_refreshMilliHz;
+		uint64_t startNs = NowNs();
+		for (m_frame = 0; m_frame < (uint64_t)m_frames; m_frame++) {
+			uint64_t deadline = startNs + m_frame * periodNs;
+			timespec ts = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) };
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+			Update();
+		}
+		vkDeviceWaitIdle(m_device);
+	}
+
+	// One frame. The pose is a local of this function, where the layer looks for it.
+	__attribute__((noinline)) void Update() {
+		while (g_shared->posesRegistered.load(std::memory_order_acquire) <= m_frame) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+
+		VkSemaphore acquired = m_acquired[m_frame % m_acquired.size()];
+		uint32_t index;
+		Check(vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, acquired, VK_NULL_HANDLE, &index),
+			"vkAcquireNextImageKHR");
+		vkWaitForFences(m_device, 1, &m_fences[index], VK_TRUE, UINT64_MAX);
+		vkResetFences(m_device, 1, &m_fences[index]);
+
+		VkCommandBuffer commandBuffer = m_commandBuffers[index];
+		VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = m_images[index];
+		barrier.subresourceRange = range;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+		VkClearColorValue color = { { (m_frame % 256) / 255.f, (m_frame / 256 % 256) / 255.f, 0.5f, 1.f } };
+		vkCmdClearColorImage(commandBuffer, m_images[index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+		vkEndCommandBuffer(commandBuffer);
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &acquired;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &m_rendered[index];
+		Check(vkQueueSubmit(m_queue, 1, &submitInfo, m_fences[index]), "vkQueueSubmit");
+
+		vr::TrackedDevicePose_t pose = {};
+		TrackingQuat q = FrameRotation(m_frame);
+		HmdMatrix_QuatToMat(q.w, q.x, q.y, q.z, &pose.mDeviceToAbsoluteTracking);
+		pose.eTrackingResult = vr::TrackingResult_Running_OK;
+		pose.bPoseIsValid = true;
+		pose.bDeviceIsConnected = true;
+		// Keep it on the stack
+		asm volatile("" : : "r"(&pose) : "memory");
+
+		VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &m_rendered[index];
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &m_swapchain;
+		presentInfo.pImageIndices = &index;
+		g_shared->presentNs[m_frame].store(NowNs(), std::memory_order_relaxed);
+		Check(vkQueuePresentKHR(m_queue, &presentInfo), "vkQueuePresentKHR");
+		g_shared->framesPresented.store(m_frame + 1, std::memory_order_release);
+
+		asm volatile("" : : "r"(&pose) : "memory");
+	}
+
+private:
+	bool WaitEncoder() {
+		for (int ms = 0; ms < STARTUP_TIMEOUT_MS; ms++) {
+			if (g_shared->stage.load() == STAGE_ENCODER_READY) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return false;
+	}
+
+	int m_frames;
+	uint64_t m_frame = 0;
+	VkExtent2D m_extent = {};
+	uint32_t m_refreshMilliHz = 0;
+
+	VkInstance m_instance = VK_NULL_HANDLE;
+	VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkQueue m_queue = VK_NULL_HANDLE;
+	VkSurfaceKHR m_surface = VK_NULL_HANDLE;
+	VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
+	std::vector<VkImage> m_images;
+	VkCommandPool m_pool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> m_commandBuffers;
+	std::vector<VkSemaphore> m_acquired;
+	std::vector<VkSemaphore> m_rendered;
+	std::vector<VkFence> m_fences;
+};
+
+static int RunApplication(int frames) {
+	try {
+		CRenderThread renderThread(frames);
+		renderThread.Init();
+		renderThread.Run();
+	} catch (std::exception &e) {
+		fprintf(stderr, "Application: %s\n", e.what());
+		g_shared->stage = STAGE_FAILED;
+		return 1;
+	}
+	g_shared->stage = STAGE_DONE;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		fprintf(stderr, "Usage: capture_bench [--encoder vulkan|vaapi|nvenc|sw] [--frames N] [--h265] [--bitrate MBPS] "
+			"[--pipeline-depth N] [--shaders DIR]\n");
+		return 1;
+	}
+
+	std::vector<unsigned char> frameRenderSpv, rgbToYuvSpv;
+	try {
+		frameRenderSpv = ReadFile(options.shaders + "/FrameRender.comp.spv");
+		rgbToYuvSpv = ReadFile(options.shaders + "/RgbToYuv.comp.spv");
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	FRAME_RENDER_COMP_SPV_PTR = frameRenderSpv.data();
+	FRAME_RENDER_COMP_SPV_LEN = (unsigned int)frameRenderSpv.size();
+	RGB_TO_YUV_COMP_SPV_PTR = rgbToYuvSpv.data();
+	RGB_TO_YUV_COMP_SPV_LEN = (unsigned int)rgbToYuvSpv.size();
+
+	// A socket directory of our own, so a running driver is not disturbed
+	char runtimeDir[] = "/tmp/alvr-capture-bench-XXXXXX";
+	if (!mkdtemp(runtimeDir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_RUNTIME_DIR", runtimeDir, 1);
+
+	size_t sharedSize = sizeof(SharedState) + options.frames * sizeof(std::atomic<uint64_t>);
+	void *sharedMap = mmap(nullptr, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sharedMap == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	g_shared = new (sharedMap) SharedState();
+
+	// Before any thread of the driver side exists
+	pid_t child = fork();
+	if (child == -1) {
+		perror("fork");
+		return 1;
+	}
+	if (child == 0) {
+		_exit(RunApplication(options.frames));
+	}
+
+	if (!WaitStage(STAGE_DISPLAY_READY, child)) {
+		fprintf(stderr, "The application could not open the display of the layer\n");
+		kill(child, SIGKILL);
+		waitpid(child, nullptr, 0);
+		rmdir(runtimeDir);
+		return 1;
+	}
+
+	auto &settings = Settings::Instance();
+	settings.m_codec = options.h265 ? ALVR_CODEC_H265 : ALVR_CODEC_H264;
+	settings.m_renderWidth = g_shared->width;
+	settings.m_renderHeight = g_shared->height;
+	settings.m_refreshRate = (g_shared->refreshMilliHz + 500) / 1000;
+	settings.m_encodePipelineDepth = options.pipelineDepth;
+	settings.m_slicesPerFrame = 1;
+	settings.m_videoPacketSize = ALVR_MAX_VIDEO_BUFFER_SIZE;
+	LiveSettings live = settings.GetLive();
+	live.mEncodeBitrateMBs = options.bitrateMbps;
+	live.m_enableFec = true;
+	settings.ApplyLive(live);
+	alvr::EncodePipeline::ForceEncoder(options.encoder);
+
+	auto connection = std::make_shared<ClientConnection>();
+	connection->ApplySettings();
+	auto poseHistory = std::make_shared<PoseHistory>();
+	auto registerPoses = [&](uint64_t until) {
+		for (uint64_t frame = g_shared->posesRegistered.load(); frame < until; frame++) {
+			TrackingInfo info = {};
+			info.HeadPose_Pose_Orientation = FrameRotation(frame);
+			info.targetTimestampNs = frame + 1;
+			poseHistory->OnPoseUpdated(info);
+			g_shared->posesRegistered.store(frame + 1, std::memory_order_release);
+		}
+	};
+	registerPoses(POSE_LEAD);
+
+	auto encoder = std::make_unique<CEncoder>(connection, poseHistory);
+	encoder->Start();
+	encoder->InsertIDR();
+
+	std::string socketPath = std::string(runtimeDir) + "/alvr-ipc";
+	struct stat socketStat;
+	for (int ms = 0; ms < STARTUP_TIMEOUT_MS && stat(socketPath.c_str(), &socketStat) != 0; ms++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	g_shared->stage = STAGE_ENCODER_READY;
+
+	// The tracking thread of the driver, the poses stay POSE_LEAD frames ahead of the presents
+	while (g_shared->stage.load() == STAGE_ENCODER_READY && waitpid(child, nullptr, WNOHANG) == 0) {
+		registerPoses(std::min<uint64_t>(g_shared->framesPresented.load() + POSE_LEAD, options.frames));
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	bool completed = g_shared->stage.load() == STAGE_DONE;
+
+	// The last frames are still in the encoder
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	encoder->Stop();
+	encoder->Join();
+	encoder.reset();
+	waitpid(child, nullptr, 0);
+	rmdir(runtimeDir);
+
+	uint64_t presented = g_shared->framesPresented.load() - std::min<uint64_t>(g_shared->framesPresented.load(), WARMUP_FRAMES);
+	printf("%s, %s, %ux%u at %.1f Hz, %d Mbps, pipeline depth %d\n", options.encoder.c_str(),
+		options.h265 ? "H.265" : "H.264", (unsigned)settings.m_renderWidth, (unsigned)settings.m_renderHeight,
+		g_shared->refreshMilliHz / 1000., options.bitrateMbps, options.pipelineDepth);
+	if (!completed || g_framesSent == 0) {
+		printf("failed, %llu frames encoded\n", (unsigned long long)g_framesSent);
+		return 1;
+	}
+	printf("present to packet  avg %7.1f us  p50 %6llu us  p95 %6llu us  p99 %6llu us  max %6llu us\n",
+		(double)g_latencyTotalUs / g_framesSent,
+		(unsigned long long)g_latency.GetPercentile(50), (unsigned long long)g_latency.GetPercentile(95),
+		(unsigned long long)g_latency.GetPercentile(99), (unsigned long long)g_latencyMaxUs);
+	printf("%llu of %llu frames encoded (%d warmup), %.1f KB average\n", (unsigned long long)g_framesSent,
+		(unsigned long long)presented, WARMUP_FRAMES, g_bytesSent / 1000.0 / std::max<uint64_t>(g_framesSent, 1));
+	return 0;
+}
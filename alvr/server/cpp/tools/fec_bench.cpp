@@ -0,0 +1,302 @@
+// Offline benchmark of the video send path: FEC encoding and packetization of encoded frames, as
+// done by ClientConnection::SendVideo. Frames come from a raw Annex-B bitstream, like the dumps of
+// the NVENC and VCE encoders, or are generated when no file is given. Built and run by
+// `cargo xtask bench-fec`, not part of the driver.
+//
+// Usage: fec_bench [--h265] [--no-fec] [--frames N] [--size BYTES] [--idr-interval N] [dump]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "alvr_server/ClientConnection.h"
+#include "alvr_server/FecEncoder.h"
+#include "alvr_server/LatencyHistogram.h"
+#include "alvr_server/Settings.h"
+#include "alvr_server/bindings.h"
+
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+void *operator new(size_t size) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+void operator delete[](void *ptr) noexcept {
+	free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+void operator delete[](void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+// Driver globals and Rust callbacks the send path links against
+const char *g_sessionPath = "";
+const char *g_driverRootDir = "";
+uint64_t g_DriverTestMode = 0;
+
+static uint64_t g_packetsSent = 0;
+static uint64_t g_bytesSent = 0;
+
+static void LogStub(const char *) {}
+static void VideoSendStub(VideoFrame, unsigned char *, int len, bool) {
+	g_packetsSent++;
+	g_bytesSent += len;
+}
+static void VideoConfigSendStub(unsigned char, const unsigned char *, int) {}
+
+static void VideoSendBatchStub(const VideoFrame *, const VideoPacketPayload *payloads, int count, bool, bool) {
+	for (int i = 0; i < count; i++) {
+		g_bytesSent += payloads[i].len;
+	}
+	g_packetsSent += count;
+}
+
+void (*LogError)(const char *stringPtr) = LogStub;
+void (*LogWarn)(const char *stringPtr) = LogStub;
+void (*LogInfo)(const char *stringPtr) = LogStub;
+void (*LogDebug)(const char *stringPtr) = LogStub;
+void (*VideoSend)(VideoFrame header, unsigned char *buf, int len, bool idr) = VideoSendStub;
+void (*VideoSendBatch)(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool idr, bool frameEnd) = VideoSendBatchStub;
+void (*VideoConfigSend)(unsigned char streamIndex, const unsigned char *buf, int len) = VideoConfigSendStub;
+void (*TimeSyncSend)(TimeSync packet) = nullptr;
+void (*StatisticsSend)(StatisticsSummary summary) = nullptr;
+void (*GraphStatisticsSend)(GraphStatistics statistics) = nullptr;
+void RequestIDR() {}
+
+namespace {
+	// Frames only in the first part of the run, so one time allocations are not counted.
+	const int WARMUP_FRAMES = 30;
+
+	struct Options {
+		bool h265 = false;
+		bool fec = true;
+		int frames = 2000;
+		int size = 60000;
+		int idrInterval = 300;
+		std::string dump;
+	};
+
+	bool IsSlice(const uint8_t *nal, bool h265) {
+		if (h265) {
+			int type = (nal[0] >> 1) & 0x3F;
+			return type < 32;
+		}
+		int type = nal[0] & 0x1F;
+		return type >= 1 && type <= 5;
+	}
+
+	// The first slice of a picture has first_mb_in_slice = 0 (H.264) or
+	// first_slice_segment_in_pic_flag set (H.265), both are the first bit after the NAL header.
+	bool IsFirstSlice(const uint8_t *nal, size_t length, bool h265) {
+		size_t headerSize = h265 ? 2 : 1;
+		return length > headerSize && (nal[headerSize] & 0x80) != 0;
+	}
+
+	// Splits an Annex-B stream into access units, each starting with its start code.
+	std::vector<std::vector<uint8_t>> SplitFrames(const std::vector<uint8_t> &stream, bool h265) {
+		std::vector<size_t> nalStarts;
+		for (size_t i = 0; i + 3 < stream.size(); i++) {
+			if (stream[i] == 0 && stream[i + 1] == 0 && stream[i + 2] == 1) {
+				nalStarts.push_back(i > 0 && stream[i - 1] == 0 ? i - 1 : i);
+				i += 2;
+			}
+		}
+		nalStarts.push_back(stream.size());
+
+		std::vector<std::vector<uint8_t>> frames;
+		size_t frameStart = nalStarts.empty() ? 0 : nalStarts[0];
+		bool frameHasSlice = false;
+		for (size_t n = 0; n + 1 < nalStarts.size(); n++) {
+			size_t start = nalStarts[n];
+			size_t payload = stream[start + 2] == 1 ? start + 3 : start + 4;
+			size_t length = nalStarts[n + 1] - payload;
+			const uint8_t *nal = &stream[payload];
+
+			bool slice = IsSlice(nal, h265);
+			bool newFrame = slice ? IsFirstSlice(nal, length, h265) : true;
+			if (frameHasSlice && newFrame) {
+				frames.emplace_back(stream.begin() + frameStart, stream.begin() + start);
+				frameStart = start;
+				frameHasSlice = false;
+			}
+			frameHasSlice |= slice;
+		}
+		if (frameHasSlice) {
+			frames.emplace_back(stream.begin() + frameStart, stream.end());
+		}
+		return frames;
+	}
+
+	// Random payload behind real NAL headers, so keyframe detection sees IDR and P frames.
+	std::vector<std::vector<uint8_t>> GenerateFrames(const Options &options) {
+		std::mt19937 random(1234);
+		std::vector<std::vector<uint8_t>> frames;
+		for (int i = 0; i < options.frames; i++) {
+			bool idr = i % options.idrInterval == 0;
+			int size = idr ? options.size * 4 : options.size;
+			std::vector<uint8_t> frame(size);
+			for (auto &byte : frame) {
+				byte = (uint8_t)random();
+			}
+			uint8_t header = options.h265 ? (idr ? 19 << 1 : 1 << 1) : (idr ? 0x65 : 0x41);
+			uint8_t nal[] = { 0, 0, 0, 1, header, 1, 0x80 };
+			memcpy(frame.data(), nal, sizeof(nal));
+			frames.push_back(std::move(frame));
+		}
+		return frames;
+	}
+
+	struct Stage {
+		const char *name;
+		LatencyHistogram histogram;
+		uint64_t totalUs = 0;
+		uint64_t maxUs = 0;
+
+		void Add(uint64_t us) {
+			histogram.Add(us);
+			totalUs += us;
+			maxUs = std::max(maxUs, us);
+		}
+
+		void Print() const {
+			uint64_t count = histogram.GetCount();
+			printf("%-8s avg %7.1f us  p50 %6llu us  p95 %6llu us  p99 %6llu us  max %6llu us\n", name,
+				count ? (double)totalUs / count : 0.,
+				(unsigned long long)histogram.GetPercentile(50), (unsigned long long)histogram.GetPercentile(95),
+				(unsigned long long)histogram.GetPercentile(99), (unsigned long long)maxUs);
+		}
+	};
+
+	uint64_t NowUs() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	bool ParseOptions(int argc, char **argv, Options &options) {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--h265") {
+				options.h265 = true;
+			} else if (arg == "--no-fec") {
+				options.fec = false;
+			} else if (arg == "--frames" && i + 1 < argc) {
+				options.frames = atoi(argv[++i]);
+			} else if (arg == "--size" && i + 1 < argc) {
+				options.size = atoi(argv[++i]);
+			} else if (arg == "--idr-interval" && i + 1 < argc) {
+				options.idrInterval = atoi(argv[++i]);
+			} else if (arg[0] != '-') {
+				options.dump = arg;
+			} else {
+				return false;
+			}
+		}
+		return options.frames > 0 && options.size > 16 && options.idrInterval > 0;
+	}
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		fprintf(stderr, "Usage: fec_bench [--h265] [--no-fec] [--frames N] [--size BYTES] [--idr-interval N] [dump]\n");
+		return 1;
+	}
+
+	std::vector<std::vector<uint8_t>> frames;
+	if (options.dump.empty()) {
+		frames = GenerateFrames(options);
+	} else {
+		std::ifstream file(options.dump, std::ios::binary);
+		if (!file) {
+			fprintf(stderr, "Cannot open %s\n", options.dump.c_str());
+			return 1;
+		}
+		std::vector<uint8_t> stream((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		frames = SplitFrames(stream, options.h265);
+	}
+	if (frames.size() <= (size_t)WARMUP_FRAMES) {
+		fprintf(stderr, "Need more than %d frames, got %zu\n", WARMUP_FRAMES, frames.size());
+		return 1;
+	}
+
+	Settings::Instance().m_codec = options.h265 ? ALVR_CODEC_H265 : ALVR_CODEC_H264;
+	LiveSettings live = Settings::Instance().GetLive();
+	live.m_enableFec = options.fec;
+	Settings::Instance().ApplyLive(live);
+
+	ClientConnection connection;
+	FecEncoder fecEncoder;
+
+	Stage fecStage{ "fec", {}, 0, 0 };
+	Stage sendStage{ "send", {}, 0, 0 };
+	uint64_t frameBytes = 0;
+	uint64_t steadyAllocations = 0;
+	uint64_t steadyPackets = 0;
+	uint64_t sendTotalUs = 0;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		auto &frame = frames[i];
+		int len = (int)frame.size();
+		bool measured = i >= (size_t)WARMUP_FRAMES;
+
+		// The Reed-Solomon encode alone, with the shard layout FECSend would pick
+		if (options.fec) {
+			int fecPercentage = connection.m_fecController.GetPercentage(false);
+			int shardPackets = CalculateFECShardPackets(len, fecPercentage);
+			int blockSize = shardPackets * ALVR_MAX_VIDEO_BUFFER_SIZE;
+			int dataShards = (len + blockSize - 1) / blockSize;
+			int parityShards = CalculateParityShards(dataShards, fecPercentage);
+
+			uint64_t start = NowUs();
+			fecEncoder.Encode(frame.data(), len, dataShards, parityShards, blockSize);
+			if (measured) {
+				fecStage.Add(NowUs() - start);
+			}
+		}
+
+		// The whole send path: keyframe detection, FEC, packetization and the batch handoff
+		uint64_t packetsBefore = g_packetsSent;
+		uint64_t allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+		uint64_t start = NowUs();
+		connection.SendVideo(frame.data(), len, (uint64_t)(i + 1) * 11111111);
+		uint64_t elapsed = NowUs() - start;
+		if (measured) {
+			sendStage.Add(elapsed);
+			sendTotalUs += elapsed;
+			frameBytes += len;
+			steadyPackets += g_packetsSent - packetsBefore;
+			steadyAllocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+		}
+	}
+
+	size_t measuredFrames = frames.size() - WARMUP_FRAMES;
+	printf("%zu frames (%d warmup), %s, FEC %s, %.1f KB average\n", frames.size(), WARMUP_FRAMES,
+		options.h265 ? "H.265" : "H.264", options.fec ? "on" : "off", frameBytes / 1000.0 / measuredFrames);
+	if (options.fec) {
+		fecStage.Print();
+	}
+	sendStage.Print();
+	printf("throughput %.1f MB/s, %.0f frames/s of send path time\n",
+		sendTotalUs ? frameBytes / (double)sendTotalUs : 0., sendTotalUs ? measuredFrames * 1e6 / sendTotalUs : 0.);
+	printf("packets/frame %.1f, allocations/frame %.2f\n",
+		steadyPackets / (double)measuredFrames, steadyAllocations / (double)measuredFrames);
+	return 0;
+}
@@ -0,0 +1,409 @@
+// Offline benchmark of the loss recovery of the video stream. Frames are packetized and FEC encoded
+// by ClientConnection::FECSend, go through a simulated link with the same impairment model as the
+// stream socket (Gilbert-Elliott burst loss, delay, jitter, reordering, bandwidth limit, see
+// alvr/sockets/src/stream_socket/impairment.rs) and are reassembled by the FEC decoder of the client.
+// Lost frames make the client request an IDR frame as in the driver, rate limited like the
+// IDRScheduler. Every FEC percentage of the list is run on the same link.
+//
+// The shard layout is fixed at compile time, `cargo xtask bench-loss` builds the benchmark once per
+// ALVR_FEC_SHARDS_MAX and ALVR_MAX_VIDEO_BUFFER_SIZE pair.
+//
+// Usage: loss_bench [--fec 2,5,10,...] [--frames N] [--fps N] [--size BYTES] [--good-to-bad P]
+//   [--bad-to-good P] [--good-loss P] [--bad-loss P] [--delay-ms N] [--jitter-ms N] [--reorder P]
+//   [--reorder-ms N] [--bandwidth-mbs N] [--queue-ms N] [--idr-interval-ms N] [--seed N]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "alvr_server/ClientConnection.h"
+#include "alvr_server/LatencyHistogram.h"
+#include "alvr_server/Settings.h"
+#include "alvr_server/bindings.h"
+#include "loss_bench_client.h"
+
+// Driver globals and Rust callbacks the send path links against
+const char *g_sessionPath = "";
+const char *g_driverRootDir = "";
+uint64_t g_DriverTestMode = 0;
+
+// Packets of the last FECSend(), header followed by the payload
+static std::vector<std::vector<uint8_t>> g_sentPackets;
+
+static void LogStub(const char *) {}
+static void VideoSendStub(VideoFrame, unsigned char *, int, bool) {}
+static void VideoConfigSendStub(unsigned char, const unsigned char *, int) {}
+
+static void VideoSendBatchStub(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool, bool) {
+	for (int i = 0; i < count; i++) {
+		std::vector<uint8_t> packet(sizeof(VideoFrame) + payloads[i].len);
+		memcpy(packet.data(), &headers[i], sizeof(VideoFrame));
+		memcpy(packet.data() + sizeof(VideoFrame), payloads[i].buf, payloads[i].len);
+		g_sentPackets.push_back(std::move(packet));
+	}
+}
+
+void (*LogError)(const char *stringPtr) = LogStub;
+void (*LogWarn)(const char *stringPtr) = LogStub;
+void (*LogInfo)(const char *stringPtr) = LogStub;
+void (*LogDebug)(const char *stringPtr) = LogStub;
+void (*VideoSend)(VideoFrame header, unsigned char *buf, int len, bool idr) = VideoSendStub;
+void (*VideoSendBatch)(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool idr, bool frameEnd) = VideoSendBatchStub;
+void (*VideoConfigSend)(unsigned char streamIndex, const unsigned char *buf, int len) = VideoConfigSendStub;
+void (*TimeSyncSend)(TimeSync packet) = nullptr;
+void (*StatisticsSend)(StatisticsSummary summary) = nullptr;
+void (*GraphStatisticsSend)(GraphStatistics statistics) = nullptr;
+void RequestIDR() {}
+
+namespace {
+	// Stream header (stream ID and packet index), UDP and IPv4 headers
+	const int WIRE_OVERHEAD = 6 + 8 + 20;
+	const int IDR_SIZE_FACTOR = 4;
+
+	struct Options {
+		std::vector<int> fecPercentages = { 2, 5, 10, 15, 20, 25, 35, 50 };
+		double frames = 5400;
+		double fps = 90;
+		double size = 60000;
+		double goodToBad = 0.002;
+		double badToGood = 0.3;
+		double goodLoss = 0.001;
+		double badLoss = 0.5;
+		double delayMs = 2;
+		double jitterMs = 1;
+		double reorder = 0.001;
+		double reorderMs = 2;
+		// 0 is unlimited
+		double bandwidthMbs = 0;
+		double queueMs = 50;
+		double idrIntervalMs = 100;
+		double seed = 1;
+	};
+
+	// Same model as the Impairment of the stream socket, times in microseconds.
+	class Link {
+	public:
+		Link(const Options &options) : m_options(options), m_random((uint64_t)options.seed) {}
+
+		// Returns false if the packet is lost, otherwise arrival is set.
+		bool Send(int size, double now, double &arrival) {
+			double delivery = now;
+
+			if (m_options.bandwidthMbs > 0) {
+				double start = std::max(m_linkFree, now);
+				if (start - now > m_options.queueMs * 1000) {
+					return false;
+				}
+				m_linkFree = start + size * 8 / m_options.bandwidthMbs;
+				delivery = m_linkFree;
+			}
+
+			if (Chance(m_bad ? m_options.badToGood : m_options.goodToBad)) {
+				m_bad = !m_bad;
+			}
+			if (Chance(m_bad ? m_options.badLoss : m_options.goodLoss)) {
+				return false;
+			}
+
+			delivery += m_options.delayMs * 1000 + m_uniform(m_random) * m_options.jitterMs * 1000;
+
+			if (Chance(m_options.reorder)) {
+				arrival = delivery + m_options.reorderMs * 1000;
+				return true;
+			}
+			m_lastDelivery = std::max(delivery, m_lastDelivery);
+			arrival = m_lastDelivery;
+			return true;
+		}
+
+	private:
+		bool Chance(double probability) {
+			return m_uniform(m_random) < probability;
+		}
+
+		const Options &m_options;
+		std::mt19937_64 m_random;
+		std::uniform_real_distribution<double> m_uniform{ 0., 1. };
+		bool m_bad = false;
+		double m_linkFree = 0;
+		double m_lastDelivery = 0;
+	};
+
+	struct InFlightPacket {
+		double arrival;
+		uint64_t order;
+		std::vector<uint8_t> bytes;
+
+		bool operator>(const InFlightPacket &other) const {
+			return arrival != other.arrival ? arrival > other.arrival : order > other.order;
+		}
+	};
+
+	struct FrameInfo {
+		double sendTime;
+		size_t offset;
+		int size;
+		bool idr;
+		bool damaged;
+		bool completed;
+	};
+
+	struct Result {
+		uint64_t packets = 0;
+		uint64_t lostPackets = 0;
+		uint64_t wireBytes = 0;
+		uint64_t damagedFrames = 0;
+		uint64_t recoveredFrames = 0;
+		uint64_t lostFrames = 0;
+		uint64_t corruptFrames = 0;
+		uint64_t requestedIdrs = 0;
+		uint64_t displayedBytes = 0;
+		LatencyHistogram completion;
+	};
+
+	class Simulation {
+	public:
+		Simulation(const Options &options, int fecPercentage, const std::vector<uint8_t> &content)
+			: m_options(options), m_fecPercentage(fecPercentage), m_content(content), m_link(options) {}
+
+		Result Run() {
+			std::mt19937 random((uint32_t)m_options.seed);
+			std::uniform_real_distribution<double> sizeVariation(0.75, 1.25);
+			double frameInterval = 1e6 / m_options.fps;
+			int frameCount = (int)m_options.frames;
+
+			for (int i = 0; i < frameCount; i++) {
+				double now = i * frameInterval;
+				Deliver(now);
+
+				bool idr = i == 0 || (m_idrScheduled && m_idrTime <= now);
+				if (idr) {
+					m_idrScheduled = false;
+					m_lastIdrTime = now;
+				}
+
+				FrameInfo frame = {};
+				frame.sendTime = now;
+				frame.idr = idr;
+				frame.size = (int)(m_options.size * (idr ? IDR_SIZE_FACTOR : sizeVariation(random)));
+				frame.offset = (size_t)random() % (m_content.size() - frame.size);
+				m_frames.push_back(frame);
+
+				uint64_t videoFrameIndex = i + 1;
+				g_sentPackets.clear();
+				m_connection.FECSend(const_cast<uint8_t *>(&m_content[frame.offset]), frame.size,
+					videoFrameIndex, videoFrameIndex, m_fecPercentage, false, 0);
+
+				for (auto &packet : g_sentPackets) {
+					int wireSize = (int)packet.size() + WIRE_OVERHEAD;
+					m_result.packets++;
+					m_result.wireBytes += wireSize;
+
+					double arrival;
+					if (m_link.Send(wireSize, now, arrival)) {
+						m_inFlight.push({ arrival, m_order++, std::move(packet) });
+					} else {
+						m_result.lostPackets++;
+						m_frames.back().damaged = true;
+					}
+				}
+			}
+			Deliver(1e300);
+
+			for (auto &frame : m_frames) {
+				if (frame.damaged) {
+					m_result.damagedFrames++;
+					m_result.recoveredFrames += frame.completed;
+				}
+				m_result.lostFrames += !frame.completed;
+			}
+			return std::move(m_result);
+		}
+
+	private:
+		void Deliver(double until) {
+			while (!m_inFlight.empty() && m_inFlight.top().arrival <= until) {
+				// The top cannot be moved out, only its buffer.
+				double arrival = m_inFlight.top().arrival;
+				std::vector<uint8_t> bytes = std::move(const_cast<InFlightPacket &>(m_inFlight.top()).bytes);
+				m_inFlight.pop();
+
+				if (m_client.AddPacket(bytes.data(), bytes.size())) {
+					OnLoss(arrival);
+				}
+
+				uint64_t videoFrameIndex;
+				const uint8_t *data;
+				int size;
+				while (m_client.PopFrame(videoFrameIndex, data, size)) {
+					OnFrame(arrival, videoFrameIndex, data, size);
+				}
+			}
+		}
+
+		void OnFrame(double time, uint64_t videoFrameIndex, const uint8_t *data, int size) {
+			FrameInfo &frame = m_frames[videoFrameIndex - 1];
+			frame.completed = true;
+			if (size != frame.size || memcmp(data, &m_content[frame.offset], size) != 0) {
+				m_result.corruptFrames++;
+			}
+			m_result.completion.Add((uint64_t)(time - frame.sendTime));
+
+			if (videoFrameIndex != m_nextFrameIndex) {
+				OnLoss(time);
+			}
+			m_nextFrameIndex = videoFrameIndex + 1;
+
+			if (frame.idr) {
+				m_broken = false;
+			}
+			if (!m_broken) {
+				m_result.displayedBytes += size;
+			}
+		}
+
+		// The client waits for an IDR frame when it misses a frame. The request reaches the
+		// server after the link delay.
+		void OnLoss(double time) {
+			m_broken = true;
+			if (m_idrScheduled) {
+				return;
+			}
+			double requestTime = time + m_options.delayMs * 1000;
+			double minInterval = m_options.idrIntervalMs * 1000;
+			m_idrTime = requestTime - m_lastIdrTime > minInterval ? requestTime : m_lastIdrTime + minInterval;
+			m_idrScheduled = true;
+			m_result.requestedIdrs++;
+		}
+
+		const Options &m_options;
+		int m_fecPercentage;
+		const std::vector<uint8_t> &m_content;
+		Link m_link;
+		ClientConnection m_connection;
+		ClientFecQueue m_client;
+
+		std::vector<FrameInfo> m_frames;
+		std::priority_queue<InFlightPacket, std::vector<InFlightPacket>, std::greater<InFlightPacket>> m_inFlight;
+		uint64_t m_order = 0;
+		uint64_t m_nextFrameIndex = 1;
+		bool m_broken = false;
+		bool m_idrScheduled = false;
+		double m_idrTime = 0;
+		double m_lastIdrTime = 0;
+		Result m_result;
+	};
+
+	bool ParseOptions(int argc, char **argv, Options &options) {
+		struct NumberOption {
+			const char *name;
+			double *value;
+		} numberOptions[] = {
+			{ "--frames", &options.frames },
+			{ "--fps", &options.fps },
+			{ "--size", &options.size },
+			{ "--good-to-bad", &options.goodToBad },
+			{ "--bad-to-good", &options.badToGood },
+			{ "--good-loss", &options.goodLoss },
+			{ "--bad-loss", &options.badLoss },
+			{ "--delay-ms", &options.delayMs },
+			{ "--jitter-ms", &options.jitterMs },
+			{ "--reorder", &options.reorder },
+			{ "--reorder-ms", &options.reorderMs },
+			{ "--bandwidth-mbs", &options.bandwidthMbs },
+			{ "--queue-ms", &options.queueMs },
+			{ "--idr-interval-ms", &options.idrIntervalMs },
+			{ "--seed", &options.seed },
+		};
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (i + 1 >= argc) {
+				return false;
+			}
+			if (arg == "--fec") {
+				options.fecPercentages.clear();
+				for (const char *list = argv[++i]; *list != '\0';) {
+					char *end;
+					options.fecPercentages.push_back((int)strtol(list, &end, 10));
+					if (end == list) {
+						return false;
+					}
+					list = *end == ',' ? end + 1 : end;
+				}
+				continue;
+			}
+			auto option = std::find_if(std::begin(numberOptions), std::end(numberOptions),
+				[&](const NumberOption &option) { return arg == option.name; });
+			if (option == std::end(numberOptions)) {
+				return false;
+			}
+			*option->value = atof(argv[++i]);
+		}
+
+		// The Reed-Solomon decoder of the client needs at least one parity shard.
+		for (int percentage : options.fecPercentages) {
+			if (percentage < 1 || percentage > 100) {
+				return false;
+			}
+		}
+		return !options.fecPercentages.empty() && options.frames > 0 && options.fps > 0 && options.size > 16;
+	}
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		fprintf(stderr, "Usage: loss_bench [--fec 2,5,10,...] [--frames N] [--fps N] [--size BYTES] [--good-to-bad P]\n"
+			"  [--bad-to-good P] [--good-loss P] [--bad-loss P] [--delay-ms N] [--jitter-ms N] [--reorder P]\n"
+			"  [--reorder-ms N] [--bandwidth-mbs N] [--queue-ms N] [--idr-interval-ms N] [--seed N]\n");
+		return 1;
+	}
+
+	Settings::Instance().m_codec = ALVR_CODEC_H264;
+	LiveSettings live = Settings::Instance().GetLive();
+	live.m_enableFec = true;
+	Settings::Instance().ApplyLive(live);
+
+	// Frames are random slices of this buffer, so that recovered frames can be checked
+	std::mt19937 random((uint32_t)options.seed);
+	std::vector<uint8_t> content((size_t)(options.size * IDR_SIZE_FACTOR) * 2);
+	for (auto &byte : content) {
+		byte = (uint8_t)random();
+	}
+
+	double badShare = options.goodToBad / (options.goodToBad + options.badToGood);
+	printf("Shards: ALVR_FEC_SHARDS_MAX %d, ALVR_MAX_VIDEO_BUFFER_SIZE %d\n", ALVR_FEC_SHARDS_MAX, ALVR_MAX_VIDEO_BUFFER_SIZE);
+	printf("Link: loss %.3f%% (bursts of %.1f packets), delay %.1f ms, jitter %.1f ms, reorder %.3f%%, bandwidth ",
+		(badShare * options.badLoss + (1 - badShare) * options.goodLoss) * 100, 1 / options.badToGood,
+		options.delayMs, options.jitterMs, options.reorder * 100);
+	if (options.bandwidthMbs > 0) {
+		printf("%.0f Mbps\n", options.bandwidthMbs);
+	} else {
+		printf("unlimited\n");
+	}
+	printf("Video: %.0f frames at %.0f fps, %.1f KB per frame, IDR frames %dx\n\n", options.frames, options.fps,
+		options.size / 1000, IDR_SIZE_FACTOR);
+
+	printf("  FEC  loss%%  damaged  recovered  lost  IDR/min  goodput Mbps  wire Mbps  completion ms p50/p95/p99  corrupt\n");
+	double duration = options.frames / options.fps;
+	for (int fecPercentage : options.fecPercentages) {
+		Simulation simulation(options, fecPercentage, content);
+		Result result = simulation.Run();
+
+		printf("%4d%%  %5.2f  %7llu  %8.1f%%  %4llu  %7.1f  %12.1f  %9.1f  %8.2f / %6.2f / %6.2f  %7llu\n",
+			fecPercentage, result.packets ? result.lostPackets * 100. / result.packets : 0.,
+			(unsigned long long)result.damagedFrames,
+			result.damagedFrames ? result.recoveredFrames * 100. / result.damagedFrames : 100.,
+			(unsigned long long)result.lostFrames, result.requestedIdrs * 60 / duration,
+			result.displayedBytes * 8 / duration / 1e6, result.wireBytes * 8 / duration / 1e6,
+			result.completion.GetPercentile(50) / 1000., result.completion.GetPercentile(95) / 1000.,
+			result.completion.GetPercentile(99) / 1000., (unsigned long long)result.corruptFrames);
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+// Built with the client include paths, see `cargo xtask bench-loss`.
+
+#include "loss_bench_client.h"
+
+#include "fec.h"
+
+struct ClientFecQueue::Impl {
+	FECQueue queue;
+	std::vector<uint8_t> frame;
+};
+
+ClientFecQueue::ClientFecQueue() : m_impl(std::make_unique<Impl>()) {}
+
+ClientFecQueue::~ClientFecQueue() = default;
+
+bool ClientFecQueue::AddPacket(const uint8_t *packet, size_t size) {
+	bool fecFailure = false;
+	m_impl->queue.addVideoPacket(reinterpret_cast<const VideoFrame *>(packet), size, fecFailure);
+	return fecFailure;
+}
+
+bool ClientFecQueue::PopFrame(uint64_t &videoFrameIndex, const uint8_t *&data, int &size) {
+	FECQueue &queue = m_impl->queue;
+	if (!queue.reconstruct()) {
+		return false;
+	}
+
+	videoFrameIndex = queue.getVideoFrameIndex();
+	size = queue.getFrameByteSize();
+	auto buffer = reinterpret_cast<const uint8_t *>(queue.getFrameBuffer());
+	m_impl->frame.assign(buffer, buffer + size);
+	data = m_impl->frame.data();
+
+	queue.popFrame();
+	return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+// The FEC decoder of the client (FECQueue, alvr/client/android/app/src/main/cpp/fec.cpp) for the
+// loss benchmark. It is built against the client headers, so this interface only uses plain types.
+class ClientFecQueue {
+public:
+	ClientFecQueue();
+	~ClientFecQueue();
+
+	// packet is a VideoFrame header followed by the payload. Returns true if frames were given up.
+	bool AddPacket(const uint8_t *packet, size_t size);
+
+	// Releases the oldest frame if it is complete.
+	bool PopFrame(uint64_t &videoFrameIndex, const uint8_t *&data, int &size);
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> m_impl;
+};
@@ -0,0 +1,541 @@
+// Microbenchmarks of the tracking input path of the driver: InputReceive, the controller pose and
+// skeleton update of OvrController and the PoseHistory insertions and lookups, all run for every
+// tracking sample of the headset. Samples are generated hand-tracking and controller motion.
+// SteamVR is replaced by stub interfaces that only count the calls. Built and run by
+// `cargo xtask bench-tracking`, not part of the driver.
+//
+// Usage: tracking_bench [--filter SUBSTRING] [--min-time SECONDS] [--repetitions N]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "alvr_server/ClientConnection.h"
+#include "alvr_server/HandSkeleton.h"
+#include "alvr_server/OvrController.h"
+#include "alvr_server/Paths.h"
+#include "alvr_server/PoseHistory.h"
+#include "alvr_server/Settings.h"
+#include "alvr_server/Statistics.h"
+#include "alvr_server/Utils.h"
+#include "alvr_server/bindings.h"
+
+// Driver globals and Rust callbacks the tracking path links against
+const char *g_sessionPath = "";
+const char *g_driverRootDir = "";
+uint64_t g_DriverTestMode = 0;
+
+static uint64_t g_timeSyncSent = 0;
+
+static void LogStub(const char *) {}
+static void TimeSyncSendStub(TimeSync) {
+	g_timeSyncSent++;
+}
+static unsigned long long PathStringToHashStub(const char *path) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *path; path++) {
+		hash = (hash ^ (uint8_t)*path) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+void (*LogError)(const char *stringPtr) = LogStub;
+void (*LogWarn)(const char *stringPtr) = LogStub;
+void (*LogInfo)(const char *stringPtr) = LogStub;
+void (*LogDebug)(const char *stringPtr) = LogStub;
+void (*VideoSend)(VideoFrame header, unsigned char *buf, int len, bool idr) = nullptr;
+void (*VideoSendBatch)(const VideoFrame *headers, const VideoPacketPayload *payloads, int count, bool idr, bool frameEnd) = nullptr;
+void (*VideoConfigSend)(unsigned char streamIndex, const unsigned char *buf, int len) = nullptr;
+void (*TimeSyncSend)(TimeSync packet) = TimeSyncSendStub;
+void (*StatisticsSend)(StatisticsSummary summary) = nullptr;
+void (*GraphStatisticsSend)(GraphStatistics statistics) = nullptr;
+void RequestIDR() {}
+unsigned long long (*PathStringToHash)(const char *path) = PathStringToHashStub;
+
+namespace {
+	// The SteamVR side of the driver interfaces, as cheap as possible so the driver code dominates.
+	class StubDriverInput : public vr::IVRDriverInput {
+	public:
+		uint64_t updates = 0;
+
+		vr::EVRInputError CreateBooleanComponent(vr::PropertyContainerHandle_t, const char *, vr::VRInputComponentHandle_t *pHandle) override {
+			*pHandle = ++m_lastHandle;
+			return vr::VRInputError_None;
+		}
+		vr::EVRInputError UpdateBooleanComponent(vr::VRInputComponentHandle_t, bool, double) override {
+			updates++;
+			return vr::VRInputError_None;
+		}
+		vr::EVRInputError CreateScalarComponent(vr::PropertyContainerHandle_t, const char *, vr::VRInputComponentHandle_t *pHandle, vr::EVRScalarType, vr::EVRScalarUnits) override {
+			*pHandle = ++m_lastHandle;
+			return vr::VRInputError_None;
+		}
+		vr::EVRInputError UpdateScalarComponent(vr::VRInputComponentHandle_t, float, double) override {
+			updates++;
+			return vr::VRInputError_None;
+		}
+		vr::EVRInputError CreateHapticComponent(vr::PropertyContainerHandle_t, const char *, vr::VRInputComponentHandle_t *pHandle) override {
+			*pHandle = ++m_lastHandle;
+			return vr::VRInputError_None;
+		}
+		vr::EVRInputError CreateSkeletonComponent(vr::PropertyContainerHandle_t, const char *, const char *, const char *, vr::EVRSkeletalTrackingLevel, const vr::VRBoneTransform_t *, uint32_t, vr::VRInputComponentHandle_t *pHandle) override {
+			*pHandle = ++m_lastHandle;
+			return vr::VRInputError_None;
+		}
+		vr::EVRInputError UpdateSkeletonComponent(vr::VRInputComponentHandle_t, vr::EVRSkeletalMotionRange, const vr::VRBoneTransform_t *, uint32_t) override {
+			updates++;
+			return vr::VRInputError_None;
+		}
+
+	private:
+		vr::VRInputComponentHandle_t m_lastHandle = 0;
+	};
+
+	class StubServerDriverHost : public vr::IVRServerDriverHost {
+	public:
+		uint64_t poseUpdates = 0;
+
+		bool TrackedDeviceAdded(const char *, vr::ETrackedDeviceClass, vr::ITrackedDeviceServerDriver *) override { return true; }
+		void TrackedDevicePoseUpdated(uint32_t, const vr::DriverPose_t &, uint32_t) override { poseUpdates++; }
+		void VsyncEvent(double) override {}
+		void VendorSpecificEvent(uint32_t, vr::EVREventType, const vr::VREvent_Data_t &, double) override {}
+		bool IsExiting() override { return false; }
+		bool PollNextEvent(vr::VREvent_t *, uint32_t) override { return false; }
+		void GetRawTrackedDevicePoses(float, vr::TrackedDevicePose_t *, uint32_t) override {}
+		void RequestRestart(const char *, const char *, const char *, const char *) override {}
+		uint32_t GetFrameTimings(vr::Compositor_FrameTiming *, uint32_t) override { return 0; }
+		void SetDisplayEyeToHead(uint32_t, const vr::HmdMatrix34_t &, const vr::HmdMatrix34_t &) override {}
+		void SetDisplayProjectionRaw(uint32_t, const vr::HmdRect2_t &, const vr::HmdRect2_t &) override {}
+		void SetRecommendedRenderTargetSize(uint32_t, uint32_t, uint32_t) override {}
+	};
+
+	class StubProperties : public vr::IVRProperties {
+	public:
+		vr::ETrackedPropertyError ReadPropertyBatch(vr::PropertyContainerHandle_t, vr::PropertyRead_t *batch, uint32_t count) override {
+			for (uint32_t i = 0; i < count; i++) {
+				batch[i].unRequiredBufferSize = 0;
+				batch[i].eError = vr::TrackedProp_ValueNotProvidedByDevice;
+			}
+			return vr::TrackedProp_Success;
+		}
+		vr::ETrackedPropertyError WritePropertyBatch(vr::PropertyContainerHandle_t, vr::PropertyWrite_t *batch, uint32_t count) override {
+			for (uint32_t i = 0; i < count; i++) {
+				batch[i].eError = vr::TrackedProp_Success;
+			}
+			return vr::TrackedProp_Success;
+		}
+		const char *GetPropErrorNameFromEnum(vr::ETrackedPropertyError) override { return "stub"; }
+		vr::PropertyContainerHandle_t TrackedDeviceToPropertyContainer(vr::TrackedDeviceIndex_t device) override {
+			return device + 1;
+		}
+	};
+
+	class StubDriverContext : public vr::IVRDriverContext {
+	public:
+		StubDriverInput input;
+		StubServerDriverHost host;
+		StubProperties properties;
+
+		void *GetGenericInterface(const char *version, vr::EVRInitError *error) override {
+			void *result = nullptr;
+			if (strcmp(version, vr::IVRDriverInput_Version) == 0) {
+				result = &input;
+			} else if (strcmp(version, vr::IVRServerDriverHost_Version) == 0) {
+				result = &host;
+			} else if (strcmp(version, vr::IVRProperties_Version) == 0) {
+				result = &properties;
+			}
+			if (error) {
+				*error = result ? vr::VRInitError_None : vr::VRInitError_Init_InterfaceNotFound;
+			}
+			return result;
+		}
+		vr::DriverHandle_t GetDriverHandle() override { return 1; }
+	};
+
+	template <typename T>
+	inline void DoNotOptimize(const T &value) {
+		asm volatile("" : : "r,m"(value) : "memory");
+	}
+
+	inline void ClobberMemory() {
+		asm volatile("" : : : "memory");
+	}
+
+	// About eleven seconds at the tracking rate, enough to go through every animation state.
+	const int SAMPLE_COUNT = 1024;
+	const uint64_t TRACKING_PERIOD_NS = 1'000'000'000 / 90;
+	const float PI = 3.14159265f;
+
+	TrackingQuat AxisAngle(float x, float y, float z, float angle) {
+		float s = sinf(angle / 2);
+		return TrackingQuat{ x * s, y * s, z * s, cosf(angle / 2) };
+	}
+
+	TrackingQuat Multiply(const TrackingQuat &a, const TrackingQuat &b) {
+		return TrackingQuat{
+			a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+			a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+			a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+			a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+		};
+	}
+
+	void FillHead(TrackingInfo &info, float t) {
+		float yaw = 0.8f * sinf(2 * PI * 0.2f * t);
+		float pitch = 0.25f * sinf(2 * PI * 0.35f * t);
+		info.HeadPose_Pose_Orientation = Multiply(AxisAngle(0, 1, 0, yaw), AxisAngle(1, 0, 0, pitch));
+		info.HeadPose_Pose_Position = TrackingVector3{ 0.05f * sinf(2 * PI * 0.3f * t), 1.6f, 0.03f * cosf(2 * PI * 0.3f * t) };
+		info.mounted = 1;
+	}
+
+	// Fingers curling and opening out of phase, the wrist turning and the hand moving around.
+	void FillHand(TrackingInfo::Controller &c, int hand, float t) {
+		c.enabled = true;
+		c.isHand = true;
+		c.handFingerConfidences = 0x1F;
+
+		float side = hand == 0 ? -1.f : 1.f;
+		for (unsigned int bone = 0; bone < TrackingInfo::BONE_COUNT; bone++) {
+			int finger = bone < alvrHandBone_Thumb0 ? -1 : bone < alvrHandBone_Index1 ? 0 : 1 + (bone - alvrHandBone_Index1) / 3;
+			float curl = finger < 0 ? 0.f : 0.5f + 0.5f * sinf(2 * PI * 0.6f * t + finger * 0.7f + hand);
+			TrackingQuat rotation = AxisAngle(0, 0, 1, curl * 1.4f);
+			if (finger == 0) {
+				rotation = Multiply(rotation, AxisAngle(0, 1, 0, curl * 0.5f));
+			}
+			c.boneRotations[bone] = rotation;
+			c.bonePositionsBase[bone] = TrackingVector3{ side * 0.01f * finger, 0.f, -0.03f * (bone % 3 + 1) };
+		}
+
+		c.boneRootOrientation = Multiply(AxisAngle(0, 0, 1, side * 0.6f * sinf(2 * PI * 0.4f * t)), AxisAngle(1, 0, 0, -0.4f));
+		c.boneRootPosition = TrackingVector3{ side * 0.2f + 0.1f * sinf(2 * PI * 0.5f * t), 1.2f + 0.1f * cosf(2 * PI * 0.5f * t), -0.35f };
+		c.linearVelocity = TrackingVector3{ 0.1f * 2 * PI * 0.5f * cosf(2 * PI * 0.5f * t), -0.1f * 2 * PI * 0.5f * sinf(2 * PI * 0.5f * t), 0.f };
+		c.angularVelocity = TrackingVector3{ 0.f, 0.f, side * 0.6f * 2 * PI * 0.4f * cosf(2 * PI * 0.4f * t) };
+	}
+
+	// Thumb moving between the face buttons and the stick, trigger and grip pulled in cycles.
+	void FillController(TrackingInfo::Controller &c, int hand, float t) {
+		c.enabled = true;
+		c.isHand = false;
+
+		float side = hand == 0 ? -1.f : 1.f;
+		c.orientation = Multiply(AxisAngle(0, 1, 0, side * 0.5f * sinf(2 * PI * 0.3f * t)), AxisAngle(1, 0, 0, -0.3f));
+		c.position = TrackingVector3{ side * 0.2f + 0.15f * sinf(2 * PI * 0.4f * t), 1.1f, -0.3f + 0.1f * cosf(2 * PI * 0.4f * t) };
+		c.linearVelocity = TrackingVector3{ 0.15f * 2 * PI * 0.4f * cosf(2 * PI * 0.4f * t), 0.f, -0.1f * 2 * PI * 0.4f * sinf(2 * PI * 0.4f * t) };
+		c.angularVelocity = TrackingVector3{ 0.f, side * 0.5f * 2 * PI * 0.3f * cosf(2 * PI * 0.3f * t), 0.f };
+
+		int thumbPhase = (int)(t * 2) % 4;
+		uint64_t buttons = 0;
+		if (thumbPhase == 1) {
+			buttons |= ALVR_BUTTON_FLAG(hand == 0 ? ALVR_INPUT_X_TOUCH : ALVR_INPUT_A_TOUCH);
+		} else if (thumbPhase == 2) {
+			buttons |= ALVR_BUTTON_FLAG(hand == 0 ? ALVR_INPUT_Y_TOUCH : ALVR_INPUT_B_TOUCH);
+		} else if (thumbPhase == 3) {
+			buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_JOYSTICK_TOUCH);
+			c.joystickPosition = TrackingVector2{ cosf(2 * PI * t), sinf(2 * PI * t) };
+		}
+
+		float trigger = std::max(0.f, sinf(2 * PI * 0.8f * t));
+		if (trigger > 0 || fmodf(t, 1.f) < 0.3f) {
+			buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_TOUCH);
+		}
+		if (trigger > 0.9f) {
+			buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_TRIGGER_CLICK);
+		}
+		float grip = std::max(0.f, sinf(2 * PI * 0.5f * t + 1.f));
+		if (grip > 0) {
+			buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_GRIP_TOUCH);
+		}
+		if (grip > 0.9f) {
+			buttons |= ALVR_BUTTON_FLAG(ALVR_INPUT_GRIP_CLICK);
+		}
+		c.buttons = buttons;
+		c.triggerValue = trigger;
+		c.gripValue = grip;
+	}
+
+	std::vector<TrackingInfo> GenerateSamples(bool hands) {
+		std::vector<TrackingInfo> samples(SAMPLE_COUNT);
+		for (int i = 0; i < SAMPLE_COUNT; i++) {
+			TrackingInfo &info = samples[i];
+			memset(&info, 0, sizeof(info));
+			float t = i * (TRACKING_PERIOD_NS / 1e9f);
+			FillHead(info, t);
+			for (int hand = 0; hand < 2; hand++) {
+				if (hands) {
+					FillHand(info.controller[hand], hand, t);
+				} else {
+					FillController(info.controller[hand], hand, t);
+				}
+			}
+			info.targetTimestampNs = (i + 1) * TRACKING_PERIOD_NS;
+		}
+		return samples;
+	}
+
+	vr::HmdMatrix34_t RotationMatrix(const TrackingQuat &q) {
+		vr::HmdQuaternion_t quat = HmdQuaternion_Init(q.w, q.x, q.y, q.z);
+		vr::HmdMatrix34_t matrix;
+		HmdMatrix_QuatToMat(quat.w, quat.x, quat.y, quat.z, &matrix);
+		return matrix;
+	}
+
+	struct Fixture {
+		StubDriverContext context;
+		float poseTimeOffset = 0;
+		std::unique_ptr<OvrController> leftController;
+		std::unique_ptr<OvrController> rightController;
+		ClientConnection connection;
+		std::vector<TrackingInfo> handSamples;
+		std::vector<TrackingInfo> controllerSamples;
+		// Timestamps keep increasing across benchmarks, PoseHistory ignores repeated ones.
+		uint64_t nextTimestampNs = 0;
+
+		Fixture() {
+			vr::VRDriverContext() = &context;
+			init_paths();
+			Settings::Instance().m_controllerMode = 7;
+
+			leftController = std::make_unique<OvrController>(LEFT_HAND_PATH, &poseTimeOffset);
+			rightController = std::make_unique<OvrController>(RIGHT_HAND_PATH, &poseTimeOffset);
+			leftController->Activate(1);
+			rightController->Activate(2);
+
+			handSamples = GenerateSamples(true);
+			controllerSamples = GenerateSamples(false);
+		}
+
+		TrackingInfo Sample(const std::vector<TrackingInfo> &samples, uint64_t i) {
+			TrackingInfo info = samples[i % SAMPLE_COUNT];
+			nextTimestampNs += TRACKING_PERIOD_NS;
+			info.targetTimestampNs = nextTimestampNs;
+			return info;
+		}
+
+		// OvrHmd::OnPoseUpdated needs a running SteamVR to be constructed, this is its body
+		void OnPoseUpdated(PoseHistory &poseHistory, const TrackingInfo &info) {
+			poseTimeOffset = Settings::Instance().m_serversidePrediction ? connection.GetPoseTimeOffset() : Settings::Instance().m_controllerPoseOffset;
+			if (info.controller[0].enabled) {
+				leftController->onPoseUpdate(info.controller[0], info.targetTimestampNs);
+			}
+			if (info.controller[1].enabled) {
+				rightController->onPoseUpdate(info.controller[1], info.targetTimestampNs);
+			}
+			poseHistory.OnPoseUpdated(info);
+
+			vr::DriverPose_t pose = {};
+			pose.qRotation = HmdQuaternion_Init(info.HeadPose_Pose_Orientation.w, info.HeadPose_Pose_Orientation.x,
+				info.HeadPose_Pose_Orientation.y, info.HeadPose_Pose_Orientation.z);
+			vr::VRServerDriverHost()->TrackedDevicePoseUpdated(0, pose, sizeof(vr::DriverPose_t));
+		}
+
+		// Same as InputReceive() of alvr_server.cpp followed by TrackingThread::Apply()
+		void InputReceive(PoseHistory &poseHistory, const TrackingInfo &data) {
+			connection.m_Statistics->CountPacket(sizeof(TrackingInfo));
+
+			uint64_t Current = GetTimestampUs();
+			TimeSync sendBuf = {};
+			sendBuf.mode = 3;
+			sendBuf.serverTime = Current - connection.m_clockSync.GetTimeDiff(Current);
+			sendBuf.trackingRecvFrameIndex = data.targetTimestampNs;
+			TimeSyncSend(sendBuf);
+
+			connection.m_frameTrace.Record(data.targetTimestampNs, FrameTrace::TRACKING_RECEIVED, Current);
+
+			OnPoseUpdated(poseHistory, data);
+		}
+	};
+
+	Fixture *g_fixture;
+
+	struct Benchmark {
+		std::string name;
+		std::function<void(uint64_t iterations)> run;
+	};
+
+	std::vector<Benchmark> RegisterBenchmarks() {
+		Fixture &f = *g_fixture;
+		std::vector<Benchmark> benchmarks;
+
+		benchmarks.push_back({ "PoseHistory/OnPoseUpdated", [&f](uint64_t iterations) {
+			PoseHistory history;
+			for (uint64_t i = 0; i < iterations; i++) {
+				history.OnPoseUpdated(f.Sample(f.handSamples, i));
+			}
+			ClobberMemory();
+		} });
+
+		// Lookups run against a full history. GetBestPoseMatch gets the rotation SteamVR hands back,
+		// equal to the stored one up to rounding.
+		auto fillHistory = [&f](PoseHistory &history, std::vector<uint64_t> &timestamps, std::vector<vr::HmdMatrix34_t> &rotations) {
+			for (uint64_t i = 0; i < PoseHistory::HISTORY_CAPACITY; i++) {
+				TrackingInfo info = f.Sample(f.handSamples, i);
+				history.OnPoseUpdated(info);
+				timestamps.push_back(info.targetTimestampNs);
+				vr::HmdMatrix34_t rotation = RotationMatrix(info.HeadPose_Pose_Orientation);
+				for (auto &row : rotation.m) {
+					for (float &value : row) {
+						value = nextafterf(value, 2.f);
+					}
+				}
+				rotations.push_back(rotation);
+			}
+		};
+		benchmarks.push_back({ "PoseHistory/GetBestPoseMatch", [&f, fillHistory](uint64_t iterations) {
+			PoseHistory history;
+			std::vector<uint64_t> timestamps;
+			std::vector<vr::HmdMatrix34_t> rotations;
+			fillHistory(history, timestamps, rotations);
+			for (uint64_t i = 0; i < iterations; i++) {
+				auto match = history.GetBestPoseMatch(rotations[(i * 7) % rotations.size()]);
+				DoNotOptimize(match);
+			}
+		} });
+		benchmarks.push_back({ "PoseHistory/GetPoseAt", [&f, fillHistory](uint64_t iterations) {
+			PoseHistory history;
+			std::vector<uint64_t> timestamps;
+			std::vector<vr::HmdMatrix34_t> rotations;
+			fillHistory(history, timestamps, rotations);
+			for (uint64_t i = 0; i < iterations; i++) {
+				auto pose = history.GetPoseAt(timestamps[(i * 7) % timestamps.size()]);
+				DoNotOptimize(pose);
+			}
+		} });
+
+		// Both controllers, as for one tracking sample
+		benchmarks.push_back({ "OvrController/onPoseUpdate/hand", [&f](uint64_t iterations) {
+			for (uint64_t i = 0; i < iterations; i++) {
+				const TrackingInfo &info = f.handSamples[i % SAMPLE_COUNT];
+				DoNotOptimize(f.leftController->onPoseUpdate(info.controller[0], info.targetTimestampNs));
+				DoNotOptimize(f.rightController->onPoseUpdate(info.controller[1], info.targetTimestampNs));
+			}
+		} });
+		benchmarks.push_back({ "OvrController/onPoseUpdate/controller", [&f](uint64_t iterations) {
+			for (uint64_t i = 0; i < iterations; i++) {
+				const TrackingInfo &info = f.controllerSamples[i % SAMPLE_COUNT];
+				DoNotOptimize(f.leftController->onPoseUpdate(info.controller[0], info.targetTimestampNs));
+				DoNotOptimize(f.rightController->onPoseUpdate(info.controller[1], info.targetTimestampNs));
+			}
+		} });
+
+		for (bool withController : { true, false }) {
+			std::string suffix = withController ? "/controller" : "/no_controller";
+			benchmarks.push_back({ "OvrController/GetBoneTransform" + suffix, [&f, withController](uint64_t iterations) {
+				vr::VRBoneTransform_t bones[31];
+				for (uint64_t i = 0; i < iterations; i++) {
+					const TrackingInfo::Controller &c = f.controllerSamples[i % SAMPLE_COUNT].controller[i & 1];
+					const TrackingInfo::Controller &last = f.controllerSamples[(i + SAMPLE_COUNT - 1) % SAMPLE_COUNT].controller[i & 1];
+					float progress = (i % 15) / 15.f;
+					f.rightController->GetBoneTransform(withController, (i & 1) == 0, progress, progress, last.buttons, c, bones);
+					ClobberMemory();
+				}
+			} });
+			benchmarks.push_back({ "GetThumbBoneTransform" + suffix, [&f, withController](uint64_t iterations) {
+				vr::VRBoneTransform_t bones[31];
+				for (uint64_t i = 0; i < iterations; i++) {
+					GetThumbBoneTransform(withController, (i & 1) == 0, f.controllerSamples[i % SAMPLE_COUNT].controller[i & 1].buttons, bones);
+					ClobberMemory();
+				}
+			} });
+			benchmarks.push_back({ "GetTriggerBoneTransform" + suffix, [&f, withController](uint64_t iterations) {
+				vr::VRBoneTransform_t bones[31];
+				for (uint64_t i = 0; i < iterations; i++) {
+					GetTriggerBoneTransform(withController, (i & 1) == 0, f.controllerSamples[i % SAMPLE_COUNT].controller[i & 1].buttons, bones);
+					ClobberMemory();
+				}
+			} });
+		}
+
+		benchmarks.push_back({ "InputReceive/hand", [&f](uint64_t iterations) {
+			PoseHistory history;
+			for (uint64_t i = 0; i < iterations; i++) {
+				f.InputReceive(history, f.Sample(f.handSamples, i));
+			}
+		} });
+		benchmarks.push_back({ "InputReceive/controller", [&f](uint64_t iterations) {
+			PoseHistory history;
+			for (uint64_t i = 0; i < iterations; i++) {
+				f.InputReceive(history, f.Sample(f.controllerSamples, i));
+			}
+		} });
+
+		return benchmarks;
+	}
+
+	struct Options {
+		std::string filter;
+		double minTime = 0.2;
+		int repetitions = 5;
+	};
+
+	double ElapsedNs(const Benchmark &benchmark, uint64_t iterations) {
+		auto start = std::chrono::steady_clock::now();
+		benchmark.run(iterations);
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Grows the iteration count until a run lasts minTime, then reports ns per iteration of the
+	// fastest and the median repetition.
+	void RunBenchmark(const Benchmark &benchmark, const Options &options) {
+		uint64_t iterations = 1;
+		double elapsed = ElapsedNs(benchmark, iterations);
+		while (elapsed < options.minTime * 1e9 / 10) {
+			iterations *= 10;
+			elapsed = ElapsedNs(benchmark, iterations);
+		}
+		iterations = std::max<uint64_t>(1, (uint64_t)(iterations * options.minTime * 1e9 / elapsed));
+
+		std::vector<double> times;
+		for (int r = 0; r < options.repetitions; r++) {
+			times.push_back(ElapsedNs(benchmark, iterations) / iterations);
+		}
+		std::sort(times.begin(), times.end());
+		printf("%-44s %10.1f ns %10.1f ns %12llu\n", benchmark.name.c_str(), times[times.size() / 2], times[0],
+			(unsigned long long)iterations);
+	}
+
+	bool ParseOptions(int argc, char **argv, Options &options) {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--filter" && i + 1 < argc) {
+				options.filter = argv[++i];
+			} else if (arg == "--min-time" && i + 1 < argc) {
+				options.minTime = atof(argv[++i]);
+			} else if (arg == "--repetitions" && i + 1 < argc) {
+				options.repetitions = atoi(argv[++i]);
+			} else {
+				return false;
+			}
+		}
+		return options.minTime > 0 && options.repetitions > 0;
+	}
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		fprintf(stderr, "Usage: tracking_bench [--filter SUBSTRING] [--min-time SECONDS] [--repetitions N]\n");
+		return 1;
+	}
+
+	Fixture fixture;
+	g_fixture = &fixture;
+
+	printf("%-44s %13s %13s %12s\n", "Benchmark", "Median", "Min", "Iterations");
+	for (const auto &benchmark : RegisterBenchmarks()) {
+		if (benchmark.name.find(options.filter) != std::string::npos) {
+			RunBenchmark(benchmark, options);
+		}
+	}
+	printf("%llu pose updates, %llu input updates, %llu time syncs sent\n",
+		(unsigned long long)fixture.context.host.poseUpdates, (unsigned long long)fixture.context.input.updates,
+		(unsigned long long)g_timeSyncSent);
+	return 0;
+}
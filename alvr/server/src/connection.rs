@@ -1,7 +1,12 @@
 use crate::{
-    connection_utils, ClientListAction, EyeFov, TimeSync, TrackingInfo, TrackingInfo_Controller,
-    TrackingQuat, TrackingVector2, TrackingVector3, CLIENTS_UPDATED_NOTIFIER, HAPTICS_SENDER,
-    RESTART_NOTIFIER, SESSION_MANAGER, TIME_SYNC_SENDER, VIDEO_SENDER,
+    connection_utils,
+    haptics::{HapticsAggregator, HAPTICS_COALESCE_WINDOW},
+    statistics,
+    video_queue::VideoFrameQueue,
+    ClientListAction, EyeFov, TimeSync, TrackingInfo, TrackingInfo_Controller, TrackingQuat,
+    TrackingVector2, TrackingVector3, VideoSender, CLIENTS_UPDATED_NOTIFIER, HAPTICS_SENDER,
+    RESTART_NOTIFIER, SESSION_MANAGER, SETTINGS_UPDATED_NOTIFIER, STATISTICS_SENDER,
+    TIME_SYNC_SENDER, VIDEO_CONFIGS, VIDEO_CONFIG_SENDER, VIDEO_SENDER,
 };
 use alvr_audio::{AudioDevice, AudioDeviceType};
 use alvr_common::{
@@ -12,23 +17,27 @@ use alvr_common::{
     HEAD_ID, LEFT_HAND_ID, RIGHT_HAND_ID,
 };
 use alvr_session::{
-    CodecType, FrameSize, OpenvrConfig, OpenvrPropValue, OpenvrPropertyKey, ServerEvent,
+    FrameSize, OpenvrConfig, OpenvrPropValue, OpenvrPropertyKey, ServerEvent, SessionSettings,
+    SocketProtocol, VideoPacketSize, VideoPacketSizeDefaultVariant,
 };
 use alvr_sockets::{
-    spawn_cancelable, ClientConfigPacket, ClientControlPacket, ControlSocketReceiver,
-    ControlSocketSender, HeadsetInfoPacket, Input, PeerType, ProtoControlSocket,
-    ServerControlPacket, StreamSocketBuilder, AUDIO, HAPTICS, INPUT, VIDEO,
+    negotiate_video_packet_size, spawn_cancelable, ClientConfigPacket, ClientControlPacket,
+    ControlSocketReceiver, ControlSocketSender, HeadsetInfoPacket, Input, PeerType,
+    PrewarmedStreamSocket, ProtoControlSocket, ServerControlPacket, StreamSocketBuilder,
+    TimeSyncPacket, VideoConfigPacket, AUDIO, HAPTICS, INPUT, TIME_SYNC, VIDEO,
 };
 use futures::future::{BoxFuture, Either};
 use settings_schema::Switch;
 use std::{
+    collections::hash_map::RandomState,
     future,
-    net::IpAddr,
+    hash::{BuildHasher, Hasher},
+    net::{IpAddr, SocketAddr},
     process::Command,
     str::FromStr,
     sync::{mpsc as smpsc, Arc},
     thread,
-    time::Duration,
+    time::{Duration, Instant, UNIX_EPOCH},
 };
 use tokio::{
     sync::{mpsc as tmpsc, Mutex},
@@ -38,7 +47,40 @@ use tokio::{
 const CONTROL_CONNECT_RETRY_PAUSE: Duration = Duration::from_millis(500);
 const RETRY_CONNECT_MIN_INTERVAL: Duration = Duration::from_secs(1);
 const NETWORK_KEEPALIVE_INTERVAL: Duration = Duration::from_secs(1);
+const SPECTATOR_REPORT_INTERVAL: Duration = Duration::from_secs(1);
 const CLEANUP_PAUSE: Duration = Duration::from_millis(500);
+// How long after a disconnection the client can resume the stream
+const RESUME_TIMEOUT: Duration = Duration::from_secs(30);
+
+// Last stream, kept to be resumed if the same client reconnects within RESUME_TIMEOUT. The driver
+// keeps the encoder and the ClientConnection state between streams, so resuming only recreates the
+// sockets and sends an IDR frame.
+struct ResumableStream {
+    token: u64,
+    client_ip: IpAddr,
+    // None while streaming
+    disconnect_instant: Option<Instant>,
+}
+
+static RESUMABLE_STREAM: parking_lot::Mutex<Option<ResumableStream>> =
+    parking_lot::const_mutex(None);
+
+fn new_resume_token() -> u64 {
+    // RandomState is randomly seeded. 0 means no token.
+    RandomState::new().build_hasher().finish().max(1)
+}
+
+// IP of the client of the last stream, if it can still be resumed
+fn resumable_client_ip() -> Option<IpAddr> {
+    match &*RESUMABLE_STREAM.lock() {
+        Some(ResumableStream {
+            client_ip,
+            disconnect_instant: Some(instant),
+            ..
+        }) if instant.elapsed() < RESUME_TIMEOUT => Some(*client_ip),
+        _ => None,
+    }
+}
 
 fn align32(value: f32) -> u32 {
     ((value / 32.).floor() * 32.) as u32
@@ -48,12 +90,93 @@ fn mbits_to_bytes(value: u64) -> u32 {
     (value * 1024 * 1024 / 8) as u32
 }
 
+// Comma separated IPs, which receive on the stream port, or socket addresses. Invalid entries are
+// skipped.
+fn parse_spectators(addresses: &str, stream_port: u16) -> Vec<SocketAddr> {
+    addresses
+        .split(',')
+        .map(str::trim)
+        .filter(|address| !address.is_empty())
+        .filter_map(|address| {
+            let res = SocketAddr::from_str(address)
+                .or_else(|_| IpAddr::from_str(address).map(|ip| SocketAddr::new(ip, stream_port)));
+            if res.is_err() {
+                warn!("Invalid spectator address: {address}");
+            }
+            res.ok()
+        })
+        .collect()
+}
+
 #[derive(Clone)]
+// Fields of OpenvrConfig that the driver applies while streaming, with UpdateSettings(). A change
+// of the other fields restarts SteamVR.
+fn set_live_openvr_config(config: &mut OpenvrConfig, session_settings: &SessionSettings) {
+    let adaptive_bitrate = &session_settings.video.adaptive_bitrate;
+    config.encode_bitrate_mbs = session_settings.video.encode_bitrate_mbs;
+    config.enable_adaptive_bitrate = adaptive_bitrate.enabled;
+    config.bitrate_maximum = adaptive_bitrate.content.bitrate_maximum;
+    config.latency_target = adaptive_bitrate.content.latency_target;
+    config.latency_use_frametime = adaptive_bitrate.content.latency_use_frametime.enabled;
+    config.latency_target_maximum = adaptive_bitrate
+        .content
+        .latency_use_frametime
+        .content
+        .latency_target_maximum;
+    config.latency_target_offset = adaptive_bitrate
+        .content
+        .latency_use_frametime
+        .content
+        .latency_target_offset;
+    config.latency_threshold = adaptive_bitrate.content.latency_threshold;
+    config.bitrate_up_rate = adaptive_bitrate.content.bitrate_up_rate;
+    config.bitrate_down_rate = adaptive_bitrate.content.bitrate_down_rate;
+    config.bitrate_light_load_threshold = adaptive_bitrate.content.bitrate_light_load_threshold;
+
+    // A cable does not lose packets, recovering the odd one with an IDR costs less than the FEC
+    let wired_link = &session_settings.connection.wired_link;
+    if wired_link.enabled {
+        config.bitrate_maximum = wired_link.content.bitrate_maximum;
+    }
+    config.enable_fec = session_settings.connection.enable_fec && !wired_link.enabled;
+
+    let color_correction = &session_settings.video.color_correction.content;
+    config.brightness = color_correction.brightness;
+    config.contrast = color_correction.contrast;
+    config.saturation = color_correction.saturation;
+    config.gamma = color_correction.gamma;
+    config.sharpening = color_correction.sharpening;
+}
+
+// Sends the live settings to the driver when the dashboard changes them, for the whole stream
+async fn live_settings_loop() -> StrResult {
+    loop {
+        SETTINGS_UPDATED_NOTIFIER.notified().await;
+
+        let mut session_manager = SESSION_MANAGER.lock();
+        let mut openvr_config = session_manager.get().openvr_config.clone();
+        set_live_openvr_config(&mut openvr_config, &session_manager.get().session_settings);
+
+        if openvr_config != session_manager.get().openvr_config {
+            info!("Applying the settings to the running stream");
+            let openvr_settings = crate::to_cpp_openvr_settings(&openvr_config);
+            session_manager.get_mut().openvr_config = openvr_config;
+            unsafe { crate::UpdateSettings(&openvr_settings) };
+        }
+    }
+}
+
 struct ClientId {
     hostname: String,
     ip: IpAddr,
 }
 
+// The client stamps the microphone audio on its clock
+fn client_clock_offset() -> Option<i64> {
+    let mut time_diff = 0;
+    unsafe { crate::GetClientTimeDiff(&mut time_diff) }.then(|| -time_diff)
+}
+
 async fn client_discovery(auto_trust_clients: bool) -> StrResult<ClientId> {
     let (ip, handshake_packet) =
         connection_utils::search_client_loop(|handshake_packet| async move {
@@ -86,6 +209,11 @@ async fn client_discovery(auto_trust_clients: bool) -> StrResult<ClientId> {
 struct ConnectionInfo {
     client_ip: IpAddr,
     version: Option<Version>,
+    resume_token: u64,
+    resumed: bool,
+    stream_socket: PrewarmedStreamSocket,
+    secondary_client_ip: Option<IpAddr>,
+    video_packet_size: u32,
     control_sender: ControlSocketSender<ServerControlPacket>,
     control_receiver: ControlSocketReceiver<ClientControlPacket>,
 }
@@ -96,13 +224,22 @@ async fn client_handshake(
     let client_ips = if let Some(id) = trusted_discovered_client_id {
         vec![id.ip]
     } else {
-        SESSION_MANAGER.lock().get().client_connections.iter().fold(
+        let mut client_ips = SESSION_MANAGER.lock().get().client_connections.iter().fold(
             Vec::new(),
             |mut clients_info, (_, client)| {
                 clients_info.extend(client.manual_ips.clone());
                 clients_info
             },
-        )
+        );
+
+        // The client of the last stream is reached directly, without waiting for its discovery
+        if let Some(ip) = resumable_client_ip() {
+            if !client_ips.contains(&ip) {
+                client_ips.push(ip);
+            }
+        }
+
+        client_ips
     };
 
     let (mut proto_socket, client_ip) = loop {
@@ -119,6 +256,18 @@ async fn client_handshake(
     let (headset_info, server_ip) =
         trace_err!(proto_socket.recv::<(HeadsetInfoPacket, IpAddr)>().await)?;
 
+    let resumed = headset_info.resume_token != 0
+        && resumable_client_ip() == Some(client_ip)
+        && matches!(
+            &*RESUMABLE_STREAM.lock(),
+            Some(stream) if stream.token == headset_info.resume_token
+        );
+    let resume_token = if resumed {
+        headset_info.resume_token
+    } else {
+        new_resume_token()
+    };
+
     let settings = SESSION_MANAGER.lock().get().to_settings();
 
     let (eye_width, eye_height) = match settings.video.render_resolution {
@@ -193,12 +342,64 @@ async fn client_handshake(
 
     let version = Version::from_str(&headset_info.reserved).ok();
 
+    let video_packet_size = negotiate_video_packet_size(
+        &match &settings.connection.wired_link {
+            Switch::Enabled(wired_link) => VideoPacketSize::Custom(wired_link.video_packet_size),
+            Switch::Disabled => settings.connection.video_packet_size.clone(),
+        },
+        &settings.connection.stream_protocol,
+        client_ip,
+        headset_info.path_mtu,
+    );
+    info!(
+        "Video packet size: {video_packet_size}B, client path MTU: {}B",
+        headset_info.path_mtu
+    );
+
+    // Pairs of addresses of the client and the server on the secondary link
+    let video_multipath = match &settings.connection.video_multipath {
+        Switch::Enabled(desc) => {
+            match (
+                &settings.connection.stream_protocol,
+                IpAddr::from_str(&desc.secondary_client_ip),
+            ) {
+                (SocketProtocol::Udp, Ok(secondary_client_ip)) => {
+                    match alvr_sockets::local_ip_towards(secondary_client_ip) {
+                        Some(ip) if ip != server_ip => Some((secondary_client_ip, ip)),
+                        _ => {
+                            warn!("{secondary_client_ip} is not reached over another link");
+                            None
+                        }
+                    }
+                }
+                (SocketProtocol::Udp, Err(e)) => {
+                    warn!("Invalid secondary client IP: {e}");
+                    None
+                }
+                _ => {
+                    warn!("Video multipath needs the UDP stream protocol");
+                    None
+                }
+            }
+        }
+        Switch::Disabled => None,
+    };
+    if let Some((client_ip, server_ip)) = video_multipath {
+        info!("Video multipath: {client_ip} from {server_ip}");
+    }
+
     let client_config = ClientConfigPacket {
         session_desc: {
             let mut session = SESSION_MANAGER.lock().get().clone();
             if cfg!(target_os = "linux") {
                 session.session_settings.video.foveated_rendering.enabled = false;
             }
+            let packet_size = &mut session.session_settings.connection.video_packet_size;
+            packet_size.variant = VideoPacketSizeDefaultVariant::Custom;
+            packet_size.Custom = video_packet_size;
+            if session.session_settings.connection.wired_link.enabled {
+                session.session_settings.connection.enable_fec = false;
+            }
 
             trace_err!(serde_json::to_string(&session))?
         },
@@ -207,10 +408,24 @@ async fn client_handshake(
         eye_resolution_height: video_eye_height,
         fps,
         game_audio_sample_rate,
+        resume_token,
+        secondary_server_ip: video_multipath.map(|(_, server_ip)| server_ip),
         reserved: "".into(),
         server_version: version.clone(),
     };
-    proto_socket.send(&client_config).await?;
+    // The stream socket is ready by the time the client answers StreamReady
+    let (send_res, stream_socket) = tokio::join!(
+        proto_socket.send(&client_config),
+        PrewarmedStreamSocket::bind(
+            client_ip,
+            settings.connection.stream_port,
+            &settings.connection.stream_protocol,
+            settings.connection.server_send_buffer_bytes,
+            settings.connection.server_recv_buffer_bytes,
+        )
+    );
+    send_res?;
+    let stream_socket = stream_socket?;
 
     let (mut control_sender, control_receiver) = proto_socket.split();
 
@@ -227,7 +442,7 @@ async fn client_handshake(
         Switch::Disabled => 0.,
     };
 
-    let new_openvr_config = OpenvrConfig {
+    let mut new_openvr_config = OpenvrConfig {
         universe_id: settings.headset.universe_id,
         headset_serial_number: settings.headset.serial_number,
         headset_tracking_system_name: settings.headset.tracking_system_name,
@@ -245,63 +460,64 @@ async fn client_handshake(
         tracking_ref_only: settings.headset.tracking_ref_only,
         enable_vive_tracker_proxy: settings.headset.enable_vive_tracker_proxy,
         aggressive_keyframe_resend: settings.connection.aggressive_keyframe_resend,
+        fec_on_gpu: settings.connection.fec_on_gpu,
         adapter_index: settings.video.adapter_index,
-        codec: matches!(settings.video.codec, CodecType::HEVC) as _,
-        refresh_rate: fps as _,
+        encoder_adapter_index: settings.video.encoder_adapter_index,
+        encoder_dedicated_device: settings.video.encoder_dedicated_device,
+        codec: settings.video.codec as _,
+        // SteamVR paces the games at the stream rate, the config packet keeps the display rate
+        refresh_rate: if settings.video.half_rate_streaming {
+            (fps / 2.) as _
+        } else {
+            fps as _
+        },
         use_10bit_encoder: settings.video.use_10bit_encoder,
         sw_thread_count: settings.video.sw_thread_count,
-        encode_bitrate_mbs: settings.video.encode_bitrate_mbs,
-        enable_adaptive_bitrate: session_settings.video.adaptive_bitrate.enabled,
-        bitrate_maximum: session_settings
-            .video
-            .adaptive_bitrate
-            .content
-            .bitrate_maximum,
-        latency_target: session_settings
-            .video
-            .adaptive_bitrate
-            .content
-            .latency_target,
-        latency_use_frametime: session_settings
+        sw_frame_threads: settings.video.sw_frame_threads,
+        sw_intra_refresh: settings.video.sw_intra_refresh,
+        sw_pin_threads: settings.video.sw_pin_threads,
+        sw_hold_frame_deadline: settings.video.sw_hold_frame_deadline,
+        drop_late_frames: settings.video.drop_late_frames,
+        precise_vsync: settings.video.precise_vsync,
+        idle_power_save: settings.video.idle_power_save,
+        thread_realtime_priority: settings.video.thread_policy.realtime_priority,
+        encoder_cpu_mask: settings.video.thread_policy.encoder_cpu_mask,
+        vsync_cpu_mask: settings.video.thread_policy.vsync_cpu_mask,
+        tracking_cpu_mask: settings.video.thread_policy.tracking_cpu_mask,
+        present_cpu_mask: settings.video.thread_policy.present_cpu_mask,
+        frame_capture_history: settings.video.frame_capture_history,
+        enable_encode_arbitration: session_settings.video.encode_arbitration.enabled,
+        encoder_max_sessions: session_settings
             .video
-            .adaptive_bitrate
+            .encode_arbitration
             .content
-            .latency_use_frametime
-            .enabled,
-        latency_target_maximum: session_settings
+            .max_sessions,
+        concurrent_encodes: session_settings
             .video
-            .adaptive_bitrate
+            .encode_arbitration
             .content
-            .latency_use_frametime
-            .content
-            .latency_target_maximum,
-        latency_target_offset: session_settings
-            .video
-            .adaptive_bitrate
-            .content
-            .latency_use_frametime
-            .content
-            .latency_target_offset,
-        latency_threshold: session_settings
-            .video
-            .adaptive_bitrate
-            .content
-            .latency_threshold,
-        bitrate_up_rate: session_settings
-            .video
-            .adaptive_bitrate
-            .content
-            .bitrate_up_rate,
-        bitrate_down_rate: session_settings
-            .video
-            .adaptive_bitrate
-            .content
-            .bitrate_down_rate,
-        bitrate_light_load_threshold: session_settings
+            .concurrent_encodes,
+        enable_vsync_phase_lock: session_settings.video.vsync_phase_lock.enabled,
+        vsync_queue_wait_target: session_settings
             .video
-            .adaptive_bitrate
+            .vsync_phase_lock
             .content
-            .bitrate_light_load_threshold,
+            .queue_wait_target,
+        slices_per_frame: settings.video.slices_per_frame,
+        intra_refresh_frames: settings.video.intra_refresh_frames,
+        reference_frame_invalidation: settings.video.reference_frame_invalidation,
+        dual_stream_encoding: settings.video.dual_stream_encoding,
+        yuv_output: settings.video.yuv_output,
+        linux_swapchain_images: settings.video.linux_swapchain_images,
+        linux_early_present_notify: settings.video.linux_early_present_notify,
+        linux_layer_copy: settings.video.linux_layer_copy,
+        linux_layer_async_copy: settings.video.linux_layer_async_copy,
+        linux_encode_pipeline_depth: settings.video.linux_encode_pipeline_depth,
+        nvenc_pipeline_depth: settings.video.nvenc_pipeline_depth,
+        nvenc_motion_hints: settings.video.nvenc_motion_hints,
+        nvenc_inter_eye_hints: settings.video.nvenc_inter_eye_hints,
+        amf_pipeline_depth: settings.video.amf_pipeline_depth,
+        amf_pre_analysis: settings.video.amf_pre_analysis,
         controllers_tracking_system_name: session_settings
             .headset
             .controllers
@@ -453,33 +669,58 @@ async fn client_handshake(
             .foveated_rendering
             .content
             .edge_ratio_y,
+        foveation_follow_gaze: session_settings
+            .video
+            .foveated_rendering
+            .content
+            .follow_gaze,
+        enable_foveated_encoding: session_settings.video.foveated_encoding.enabled,
+        foveated_encoding_qp_offset: session_settings
+            .video
+            .foveated_encoding
+            .content
+            .periphery_qp_offset,
+        enable_dynamic_resolution: session_settings.video.dynamic_resolution.enabled,
+        dynamic_resolution_minimum_scale: session_settings
+            .video
+            .dynamic_resolution
+            .content
+            .minimum_scale,
         enable_color_correction: session_settings.video.color_correction.enabled,
-        brightness: session_settings.video.color_correction.content.brightness,
-        contrast: session_settings.video.color_correction.content.contrast,
-        saturation: session_settings.video.color_correction.content.saturation,
-        gamma: session_settings.video.color_correction.content.gamma,
-        sharpening: session_settings.video.color_correction.content.sharpening,
-        enable_fec: session_settings.connection.enable_fec,
+        video_packet_size,
         linux_async_reprojection: session_settings.extra.patches.linux_async_reprojection,
+        ..OpenvrConfig::default()
     };
+    set_live_openvr_config(&mut new_openvr_config, &session_settings);
 
-    if SESSION_MANAGER.lock().get().openvr_config != new_openvr_config {
-        SESSION_MANAGER.lock().get_mut().openvr_config = new_openvr_config;
+    let old_openvr_config = SESSION_MANAGER.lock().get().openvr_config.clone();
+    if old_openvr_config != new_openvr_config {
+        SESSION_MANAGER.lock().get_mut().openvr_config = new_openvr_config.clone();
 
-        control_sender
-            .send(&ServerControlPacket::Restarting)
-            .await
-            .ok();
+        // The driver takes the live settings at InitializeStreaming
+        let mut restart_openvr_config = old_openvr_config;
+        set_live_openvr_config(&mut restart_openvr_config, &session_settings);
+        if restart_openvr_config != new_openvr_config {
+            control_sender
+                .send(&ServerControlPacket::Restarting)
+                .await
+                .ok();
 
-        crate::notify_restart_driver();
+            crate::notify_restart_driver();
 
-        // waiting for execution canceling
-        future::pending::<()>().await;
+            // waiting for execution canceling
+            future::pending::<()>().await;
+        }
     }
 
     Ok(ConnectionInfo {
         client_ip,
         version,
+        resume_token,
+        resumed,
+        stream_socket,
+        secondary_client_ip: video_multipath.map(|(client_ip, _)| client_ip),
+        video_packet_size,
         control_sender,
         control_receiver,
     })
@@ -492,6 +733,10 @@ impl Drop for StreamCloseGuard {
     fn drop(&mut self) {
         unsafe { crate::DeinitializeStreaming() };
 
+        if let Some(stream) = &mut *RESUMABLE_STREAM.lock() {
+            stream.disconnect_instant = Some(Instant::now());
+        }
+
         let settings = SESSION_MANAGER.lock().get().to_settings();
 
         let on_disconnect_script = settings.connection.on_disconnect_script;
@@ -568,6 +813,11 @@ async fn connection_pipeline() -> StrResult {
     let ConnectionInfo {
         client_ip,
         version: _,
+        resume_token,
+        resumed,
+        stream_socket,
+        secondary_client_ip,
+        video_packet_size,
         control_sender,
         mut control_receiver,
     } = connection_info;
@@ -591,14 +841,35 @@ async fn connection_pipeline() -> StrResult {
 
     let settings = SESSION_MANAGER.lock().get().to_settings();
 
+    let spectators = match &settings.connection.video_spectators {
+        Switch::Enabled(desc)
+            if matches!(settings.connection.stream_protocol, SocketProtocol::Udp) =>
+        {
+            parse_spectators(&desc.addresses, settings.connection.stream_port)
+        }
+        Switch::Enabled(_) => {
+            warn!("Video spectators need the UDP stream protocol");
+            vec![]
+        }
+        Switch::Disabled => vec![],
+    };
+    if !spectators.is_empty() {
+        info!("Video spectators: {spectators:?}");
+    }
+
     let stream_socket = tokio::select! {
         res = StreamSocketBuilder::connect_to_client(
+            stream_socket,
             client_ip,
+            secondary_client_ip,
             settings.connection.stream_port,
             settings.connection.stream_protocol,
             mbits_to_bytes(settings.video.encode_bitrate_mbs),
-            settings.connection.server_send_buffer_bytes,
-            settings.connection.server_recv_buffer_bytes,
+            video_packet_size,
+            settings.video.preferred_fps,
+            settings.connection.transport_feedback,
+            settings.connection.network_impairment.into_option(),
+            spectators,
         ) => res?,
         _ = time::sleep(Duration::from_secs(5)) => {
             return fmt_e!("Timeout while setting up streams");
@@ -622,9 +893,22 @@ async fn connection_pipeline() -> StrResult {
         }
     }
 
-    unsafe { crate::InitializeStreaming() };
+    let openvr_settings =
+        crate::to_cpp_openvr_settings(&SESSION_MANAGER.lock().get().openvr_config);
+    unsafe { crate::InitializeStreaming(&openvr_settings) };
+    *RESUMABLE_STREAM.lock() = Some(ResumableStream {
+        token: resume_token,
+        client_ip,
+        disconnect_instant: None,
+    });
     let _stream_guard = StreamCloseGuard;
 
+    if resumed {
+        // The client decoder lost its references with the old socket
+        info!("Resuming the stream of {client_ip}");
+        unsafe { crate::RequestIDR() };
+    }
+
     let game_audio_loop: BoxFuture<_> = if let Switch::Enabled(desc) = settings.audio.game_audio {
         let device = AudioDevice::new(
             settings.audio.linux_backend,
@@ -634,22 +918,30 @@ async fn connection_pipeline() -> StrResult {
         let sample_rate = alvr_audio::get_sample_rate(&device)?;
         let sender = stream_socket.request_stream(AUDIO).await?;
         let mute_when_streaming = desc.mute_when_streaming;
+        let codec = desc.config.codec;
 
         Box::pin(async move {
             #[cfg(windows)]
-            unsafe {
+            {
                 let device_id = alvr_audio::get_windows_device_id(&device)?;
-                crate::SetOpenvrProperty(
+                crate::set_openvr_props(
                     *HEAD_ID,
-                    crate::to_cpp_openvr_prop(
+                    [(
                         OpenvrPropertyKey::AudioDefaultPlaybackDeviceId,
                         OpenvrPropValue::String(device_id),
-                    ),
-                )
+                    )],
+                );
             }
 
-            alvr_audio::record_audio_loop(device, 2, sample_rate, mute_when_streaming, sender)
-                .await?;
+            alvr_audio::record_audio_loop(
+                device,
+                2,
+                sample_rate,
+                mute_when_streaming,
+                codec,
+                sender,
+            )
+            .await?;
 
             #[cfg(windows)]
             {
@@ -660,15 +952,13 @@ async fn connection_pipeline() -> StrResult {
                 )?;
                 let default_device_id = alvr_audio::get_windows_device_id(&default_device)?;
 
-                unsafe {
-                    crate::SetOpenvrProperty(
-                        *HEAD_ID,
-                        crate::to_cpp_openvr_prop(
-                            OpenvrPropertyKey::AudioDefaultPlaybackDeviceId,
-                            OpenvrPropValue::String(default_device_id),
-                        ),
-                    )
-                }
+                crate::set_openvr_props(
+                    *HEAD_ID,
+                    [(
+                        OpenvrPropertyKey::AudioDefaultPlaybackDeviceId,
+                        OpenvrPropValue::String(default_device_id),
+                    )],
+                );
             }
 
             Ok(())
@@ -695,15 +985,13 @@ async fn connection_pipeline() -> StrResult {
                 },
             )?;
             let microphone_device_id = alvr_audio::get_windows_device_id(&microphone_device)?;
-            unsafe {
-                crate::SetOpenvrProperty(
-                    *HEAD_ID,
-                    crate::to_cpp_openvr_prop(
-                        OpenvrPropertyKey::AudioDefaultRecordingDeviceId,
-                        OpenvrPropValue::String(microphone_device_id),
-                    ),
-                )
-            }
+            crate::set_openvr_props(
+                *HEAD_ID,
+                [(
+                    OpenvrPropertyKey::AudioDefaultRecordingDeviceId,
+                    OpenvrPropValue::String(microphone_device_id),
+                )],
+            );
         }
 
         Box::pin(alvr_audio::play_audio_loop(
@@ -712,6 +1000,7 @@ async fn connection_pipeline() -> StrResult {
             desc.sample_rate,
             desc.config,
             receiver,
+            client_clock_offset,
         ))
     } else {
         Box::pin(future::pending())
@@ -719,31 +1008,54 @@ async fn connection_pipeline() -> StrResult {
 
     let video_send_loop = {
         let mut socket_sender = stream_socket.request_stream(VIDEO).await?;
+        let queue = Arc::new(match &settings.video.send_queue {
+            Switch::Enabled(config) => VideoFrameQueue::new(
+                Some(config.max_frames),
+                Some(Duration::from_millis(config.frame_deadline_ms)),
+            ),
+            Switch::Disabled => VideoFrameQueue::new(None, None),
+        });
         async move {
-            let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
-            *VIDEO_SENDER.lock() = Some(data_sender);
+            *VIDEO_SENDER.lock() = Some(VideoSender {
+                buffer_factory: socket_sender.buffer_factory(),
+                queue: Arc::clone(&queue),
+            });
 
-            while let Some((header, data)) = data_receiver.recv().await {
-                let mut buffer = socket_sender.new_buffer(&header, data.len())?;
-                buffer.get_mut().extend(data);
-                socket_sender.send_buffer(buffer).await.ok();
+            loop {
+                let buffers = queue.pop().await;
+                socket_sender.send_buffers(buffers).await.ok();
             }
+        }
+    };
 
-            Ok(())
+    // The worst loss among the spectators raises the FEC percentage, see fanout.rs
+    let spectator_loop = {
+        let stream_socket = Arc::clone(&stream_socket);
+        async move {
+            loop {
+                time::sleep(SPECTATOR_REPORT_INTERVAL).await;
+                if let Some(summary) = stream_socket.spectator_summary() {
+                    unsafe {
+                        crate::SpectatorReportReceive(
+                            summary.packets_lost,
+                            summary.packets_received,
+                            summary.request_idr,
+                        )
+                    };
+                }
+            }
         }
     };
 
     let time_sync_send_loop = {
-        let control_sender = Arc::clone(&control_sender);
+        let mut socket_sender = stream_socket.request_stream(TIME_SYNC).await?;
         async move {
             let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
             *TIME_SYNC_SENDER.lock() = Some(data_sender);
 
             while let Some(time_sync) = data_receiver.recv().await {
-                control_sender
-                    .lock()
-                    .await
-                    .send(&ServerControlPacket::TimeSync(time_sync))
+                socket_sender
+                    .send_buffer(socket_sender.new_buffer(&time_sync, 0)?)
                     .await
                     .ok();
             }
@@ -752,6 +1064,77 @@ async fn connection_pipeline() -> StrResult {
         }
     };
 
+    let time_sync_receive_loop = {
+        let mut receiver = stream_socket
+            .subscribe_to_stream::<TimeSyncPacket>(TIME_SYNC)
+            .await?;
+        async move {
+            loop {
+                let packet = receiver.recv().await?;
+                let data = packet.header;
+                // The clock sync uses the time the kernel got the packet, 0 if it is not known
+                let receive_time = packet
+                    .receive_time
+                    .and_then(|time| time.duration_since(UNIX_EPOCH).ok())
+                    .map(|time| time.as_micros() as u64)
+                    .unwrap_or(0);
+
+                let time_sync = TimeSync {
+                    mode: data.mode,
+                    serverTime: data.server_time,
+                    clientTime: data.client_time,
+                    sequence: packet.packet_index as u64,
+                    packetsLostTotal: data.packets_lost_total,
+                    packetsLostInSecond: data.packets_lost_in_second,
+                    averageTotalLatency: 0,
+                    averageSendLatency: data.average_send_latency,
+                    averageTransportLatency: data.average_transport_latency,
+                    averageDecodeLatency: data.average_decode_latency,
+                    idleTime: data.idle_time,
+                    fecFailure: data.fec_failure,
+                    fecFailureInSecond: data.fec_failure_in_second,
+                    fecFailureTotal: data.fec_failure_total,
+                    fps: data.fps,
+                    predictionErrorRotation: data.prediction_error_rotation,
+                    predictionErrorPosition: data.prediction_error_position,
+                    predictionHorizon: data.prediction_horizon,
+                    predictionResidual: data.prediction_residual,
+                    fecRecoveryTime: data.fec_recovery_time,
+                    gpuTimeFfr: data.gpu_time_ffr,
+                    gpuTimeEyes: data.gpu_time_eyes,
+                    traceFrameIndex: data.trace_frame_index,
+                    traceTracking: data.trace_tracking,
+                    traceReceivedFirst: data.trace_received_first,
+                    traceReceivedLast: data.trace_received_last,
+                    traceDecoderInput: data.trace_decoder_input,
+                    traceDecoderOutput: data.trace_decoder_output,
+                    traceRendered: data.trace_rendered,
+                    traceSubmit: data.trace_submit,
+                    arrivalFrameIndex: data.arrival_frame_index,
+                    arrivalFirst: data.arrival_first,
+                    arrivalLast: data.arrival_last,
+                    arrivalPackets: data.arrival_packets,
+                    serverTotalLatency: data.server_total_latency,
+                    trackingRecvFrameIndex: data.tracking_recv_frame_index,
+                    receiveTime: receive_time,
+                };
+
+                unsafe { crate::TimeSyncReceive(time_sync) };
+            }
+        }
+    };
+
+    let statistics_loop = async move {
+        let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
+        *STATISTICS_SENDER.lock() = Some(data_sender);
+
+        while let Some(report) = data_receiver.recv().await {
+            statistics::log_statistics(report);
+        }
+
+        Ok(())
+    };
+
     let haptics_send_loop = {
         let mut socket_sender = stream_socket.request_stream(HAPTICS).await?;
         async move {
@@ -759,8 +1142,18 @@ async fn connection_pipeline() -> StrResult {
             *HAPTICS_SENDER.lock() = Some(data_sender);
 
             while let Some(haptics) = data_receiver.recv().await {
+                let mut aggregator = HapticsAggregator::default();
+                aggregator.push(haptics, Instant::now());
+
+                let deadline = time::Instant::now() + HAPTICS_COALESCE_WINDOW;
+                while let Ok(Some(haptics)) = time::timeout_at(deadline, data_receiver.recv()).await
+                {
+                    aggregator.push(haptics, Instant::now());
+                }
+
+                let batch = aggregator.take(Instant::now());
                 socket_sender
-                    .send_buffer(socket_sender.new_buffer(&haptics, 0)?)
+                    .send_buffer(socket_sender.new_buffer(&batch, 0)?)
                     .await
                     .ok();
             }
@@ -797,7 +1190,10 @@ async fn connection_pipeline() -> StrResult {
         let mut receiver = stream_socket.subscribe_to_stream::<Input>(INPUT).await?;
         async move {
             loop {
-                let input = receiver.recv().await?.header;
+                let packet = receiver.recv().await?;
+                let input = packet.header;
+                // Input has no payload, the buffer can go back to the pool right away
+                receiver.recycle(packet.buffer);
 
                 let head_motion = &input
                     .device_motions
@@ -825,6 +1221,8 @@ async fn connection_pipeline() -> StrResult {
                     HeadPose_Pose_Orientation: to_tracking_quat(head_motion.orientation),
                     HeadPose_Pose_Position: to_tracking_vector3(head_motion.position),
                     mounted: input.legacy.mounted,
+                    eyeGaze: to_tracking_quat(input.eye_gaze.unwrap_or(Quat::IDENTITY)),
+                    eyeGazeValid: input.eye_gaze.is_some(),
                     controller: [
                         TrackingInfo_Controller {
                             enabled: input.legacy.controllers[0].enabled,
@@ -931,7 +1329,7 @@ async fn connection_pipeline() -> StrResult {
                     ],
                 };
 
-                unsafe { crate::InputReceive(tracking_info) };
+                unsafe { crate::InputReceive(tracking_info, packet.size as _) };
             }
         }
     };
@@ -969,6 +1367,42 @@ async fn connection_pipeline() -> StrResult {
         }
     };
 
+    // The parameter sets go over the control socket, which is reliable, so that the client can
+    // configure its decoder while the first keyframe is still on its way. The ones of the last
+    // stream are sent first, a resumed stream keeps its encoder.
+    let video_config_loop = {
+        let control_sender = Arc::clone(&control_sender);
+        async move {
+            let (data_sender, mut data_receiver) = tmpsc::unbounded_channel();
+            {
+                let configs = VIDEO_CONFIGS.lock();
+                for (&stream_index, config) in &*configs {
+                    data_sender
+                        .send(VideoConfigPacket {
+                            stream_index,
+                            config: config.clone(),
+                        })
+                        .ok();
+                }
+                *VIDEO_CONFIG_SENDER.lock() = Some(data_sender);
+            }
+
+            while let Some(packet) = data_receiver.recv().await {
+                control_sender
+                    .lock()
+                    .await
+                    .send(&ServerControlPacket::VideoConfig(packet))
+                    .await
+                    .ok();
+            }
+
+            Ok(())
+        }
+    };
+
+    // The control loop balances the video paths of a multipath socket and matches the transport
+    // feedback with it
+    let report_stream_socket = Arc::clone(&stream_socket);
     let control_loop = async move {
         loop {
             match control_receiver.recv().await {
@@ -978,32 +1412,12 @@ async fn connection_pipeline() -> StrResult {
                     }
                 }
                 Ok(ClientControlPacket::RequestIdr) => unsafe { crate::RequestIDR() },
-                Ok(ClientControlPacket::TimeSync(data)) => {
-                    let time_sync = TimeSync {
-                        mode: data.mode,
-                        serverTime: data.server_time,
-                        clientTime: data.client_time,
-                        sequence: 0,
-                        packetsLostTotal: data.packets_lost_total,
-                        packetsLostInSecond: data.packets_lost_in_second,
-                        averageTotalLatency: 0,
-                        averageSendLatency: data.average_send_latency,
-                        averageTransportLatency: data.average_transport_latency,
-                        averageDecodeLatency: data.average_decode_latency,
-                        idleTime: data.idle_time,
-                        fecFailure: data.fec_failure,
-                        fecFailureInSecond: data.fec_failure_in_second,
-                        fecFailureTotal: data.fec_failure_total,
-                        fps: data.fps,
-                        serverTotalLatency: data.server_total_latency,
-                        trackingRecvFrameIndex: data.tracking_recv_frame_index,
-                    };
-
-                    unsafe { crate::TimeSyncReceive(time_sync) };
-                }
                 Ok(ClientControlPacket::VideoErrorReport) => unsafe {
                     crate::VideoErrorReportReceive()
                 },
+                Ok(ClientControlPacket::VideoFrameLoss(last_good_frame_index)) => unsafe {
+                    crate::VideoFrameLossReceive(last_good_frame_index)
+                },
                 Ok(ClientControlPacket::ViewsConfig(config)) => unsafe {
                     crate::SetViewsConfig(crate::ViewsConfigData {
                         fov: [
@@ -1026,6 +1440,33 @@ async fn connection_pipeline() -> StrResult {
                 Ok(ClientControlPacket::Battery(packet)) => unsafe {
                     crate::SetBattery(packet.device_id, packet.gauge_value, packet.is_plugged);
                 },
+                Ok(ClientControlPacket::PathReception(received)) => {
+                    report_stream_socket.report_path_reception(received)
+                }
+                Ok(ClientControlPacket::TransportFeedback(feedback)) => {
+                    if let Some(summary) = report_stream_socket.report_transport_feedback(&feedback)
+                    {
+                        let groups = summary
+                            .groups
+                            .iter()
+                            .map(|group| crate::TransportPacketGroup {
+                                sendUs: group.last_send_us,
+                                firstArrivalUs: group.first_arrival_us,
+                                lastArrivalUs: group.last_arrival_us,
+                                bytes: group.bytes,
+                            })
+                            .collect::<Vec<_>>();
+
+                        unsafe {
+                            crate::TransportFeedbackReceive(
+                                groups.as_ptr(),
+                                groups.len() as _,
+                                summary.received,
+                                summary.lost,
+                            )
+                        };
+                    }
+                }
                 Ok(_) => (),
                 Err(e) => {
                     alvr_session::log_event(ServerEvent::ClientDisconnected);
@@ -1053,13 +1494,18 @@ async fn connection_pipeline() -> StrResult {
         res = spawn_cancelable(game_audio_loop) => res,
         res = spawn_cancelable(microphone_loop) => res,
         res = spawn_cancelable(video_send_loop) => res,
+        res = spawn_cancelable(spectator_loop) => res,
         res = spawn_cancelable(time_sync_send_loop) => res,
+        res = spawn_cancelable(time_sync_receive_loop) => res,
+        res = spawn_cancelable(statistics_loop) => res,
         res = spawn_cancelable(haptics_send_loop) => res,
         res = spawn_cancelable(input_receive_loop) => res,
 
         // Leave these loops on the current task
         res = keepalive_loop => res,
+        res = video_config_loop => res,
         res = control_loop => res,
+        res = live_settings_loop() => res,
 
         _ = RESTART_NOTIFIER.notified() => {
             control_sender
@@ -0,0 +1,71 @@
+// SteamVR reports vibration patterns as many short haptic events. Sent one packet each, a pattern
+// becomes a burst of packets on the socket of the video. The events of a short window are merged
+// per device instead, and all devices go out together in one packet.
+//
+// Merged events keep the strongest amplitude and end with the one that ends last. The duration is
+// counted from the time of the batch, the part of an event that elapsed while it waited in the
+// window is not played again on the client.
+
+use alvr_sockets::Haptics;
+use std::time::{Duration, Instant};
+
+// Added to the latency of the first event of a batch
+pub const HAPTICS_COALESCE_WINDOW: Duration = Duration::from_millis(2);
+
+struct PendingHaptics {
+    path: u64,
+    end: Instant,
+    frequency: f32,
+    amplitude: f32,
+}
+
+#[derive(Default)]
+pub struct HapticsAggregator {
+    // One per device, in the order the devices first appeared
+    pending: Vec<PendingHaptics>,
+}
+
+impl HapticsAggregator {
+    pub fn push(&mut self, haptics: Haptics, now: Instant) {
+        let end = now + haptics.duration;
+
+        match self
+            .pending
+            .iter_mut()
+            .find(|pending| pending.path == haptics.path)
+        {
+            // An event without amplitude stops the vibration
+            Some(pending) if haptics.amplitude <= 0.0 => {
+                pending.end = end;
+                pending.frequency = haptics.frequency;
+                pending.amplitude = 0.0;
+            }
+            Some(pending) => {
+                pending.end = pending.end.max(end);
+                if haptics.amplitude >= pending.amplitude {
+                    pending.frequency = haptics.frequency;
+                    pending.amplitude = haptics.amplitude;
+                }
+            }
+            None => self.pending.push(PendingHaptics {
+                path: haptics.path,
+                end,
+                frequency: haptics.frequency,
+                amplitude: haptics.amplitude,
+            }),
+        }
+    }
+
+    // Merged events with the duration left at `now`
+    pub fn take(&mut self, now: Instant) -> Vec<Haptics> {
+        self.pending
+            .drain(..)
+            .map(|pending| Haptics {
+                path: pending.path,
+                duration: pending.end.saturating_duration_since(now),
+                frequency: pending.frequency,
+                amplitude: pending.amplitude,
+            })
+            .collect()
+    }
+}
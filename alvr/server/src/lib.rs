@@ -2,7 +2,10 @@ mod connection;
 mod connection_utils;
 mod dashboard;
 mod graphics_info;
+mod haptics;
 mod logging_backend;
+mod statistics;
+mod video_queue;
 mod web_server;
 
 #[allow(
@@ -19,17 +22,21 @@ use bindings::*;
 use alvr_common::{lazy_static, log, prelude::*, ALVR_VERSION};
 use alvr_filesystem::{self as afs, Layout};
 use alvr_session::{
-    ClientConnectionDesc, OpenvrPropValue, OpenvrPropertyKey, ServerEvent, SessionManager,
+    ClientConnectionDesc, OpenvrConfig, OpenvrPropValue, OpenvrPropertyKey, ServerEvent,
+    SessionManager,
+};
+use alvr_sockets::{
+    Haptics, SenderBufferFactory, TimeSyncPacket, VideoConfigPacket, VideoFrameHeaderPacket,
 };
-use alvr_sockets::{Haptics, TimeSyncPacket, VideoFrameHeaderPacket};
 use graphics_info::GpuVendor;
 use parking_lot::Mutex;
+use statistics::StatisticsReport;
 use std::{
-    collections::{hash_map::Entry, HashSet},
+    collections::{hash_map::Entry, HashMap, HashSet},
     ffi::{c_void, CStr, CString},
     net::IpAddr,
     os::raw::c_char,
-    ptr,
+    ptr, slice,
     sync::{
         atomic::{AtomicUsize, Ordering},
         Arc, Once,
@@ -41,6 +48,7 @@ use tokio::{
     runtime::Runtime,
     sync::{broadcast, mpsc, Notify},
 };
+use video_queue::VideoFrameQueue;
 
 lazy_static! {
     // Since ALVR_DIR is needed to initialize logging, if error then just panic
@@ -48,18 +56,26 @@ lazy_static! {
         afs::filesystem_layout_from_openvr_driver_root_dir(&alvr_commands::get_driver_dir().unwrap());
     static ref SESSION_MANAGER: Mutex<SessionManager> =
         Mutex::new(SessionManager::new(&FILESYSTEM_LAYOUT.session()));
-    static ref RUNTIME: Mutex<Option<Runtime>> = Mutex::new(Runtime::new().ok());
+    static ref RUNTIME: Mutex<Option<Runtime>> = Mutex::new(build_runtime());
     static ref MAYBE_WINDOW: Mutex<Option<Arc<alcro::UI>>> = Mutex::new(None);
 
-    static ref VIDEO_SENDER: Mutex<Option<mpsc::UnboundedSender<(VideoFrameHeaderPacket, Vec<u8>)>>> =
-        Mutex::new(None);
+    static ref VIDEO_SENDER: Mutex<Option<VideoSender>> = Mutex::new(None);
     static ref HAPTICS_SENDER: Mutex<Option<mpsc::UnboundedSender<Haptics>>> =
         Mutex::new(None);
     static ref TIME_SYNC_SENDER: Mutex<Option<mpsc::UnboundedSender<TimeSyncPacket>>> =
         Mutex::new(None);
+    // Latest parameter sets of each video stream, kept for the next stream. Locked before
+    // VIDEO_CONFIG_SENDER.
+    static ref VIDEO_CONFIGS: Mutex<HashMap<u8, Vec<u8>>> = Mutex::new(HashMap::new());
+    static ref VIDEO_CONFIG_SENDER: Mutex<Option<mpsc::UnboundedSender<VideoConfigPacket>>> =
+        Mutex::new(None);
+    static ref STATISTICS_SENDER: Mutex<Option<mpsc::UnboundedSender<StatisticsReport>>> =
+        Mutex::new(None);
 
     static ref CLIENTS_UPDATED_NOTIFIER: Notify = Notify::new();
     static ref RESTART_NOTIFIER: Notify = Notify::new();
+    // The dashboard stored new settings
+    static ref SETTINGS_UPDATED_NOTIFIER: Notify = Notify::new();
     static ref SHUTDOWN_NOTIFIER: Notify = Notify::new();
 
     static ref FRAME_RENDER_VS_CSO: Vec<u8> =
@@ -72,6 +88,68 @@ lazy_static! {
         include_bytes!("../cpp/platform/win32/CompressAxisAlignedPixelShader.cso").to_vec();
     static ref COLOR_CORRECTION_CSO: Vec<u8> =
         include_bytes!("../cpp/platform/win32/ColorCorrectionPixelShader.cso").to_vec();
+    static ref COMPOSITION_CS_HLSL: Vec<u8> =
+        include_bytes!("../cpp/alvr_server/shader/CompositionComputeShader.hlsl").to_vec();
+    static ref FOVEATED_RENDERING_HLSLI: Vec<u8> =
+        include_bytes!("../cpp/alvr_server/shader/FoveatedRendering.hlsli").to_vec();
+    static ref RGB_TO_NV12_CS_HLSL: Vec<u8> =
+        include_bytes!("../cpp/alvr_server/shader/RgbToNv12ComputeShader.hlsl").to_vec();
+    static ref CONTENT_SCALE_CS_HLSL: Vec<u8> =
+        include_bytes!("../cpp/alvr_server/shader/ContentScaleComputeShader.hlsl").to_vec();
+    static ref REED_SOLOMON_CS_HLSL: Vec<u8> =
+        include_bytes!("../cpp/alvr_server/shader/ReedSolomonComputeShader.hlsl").to_vec();
+    #[cfg(target_os = "linux")]
+    static ref FRAME_RENDER_COMP_SPV: Vec<u8> =
+        include_bytes!(concat!(env!("OUT_DIR"), "/FrameRender.comp.spv")).to_vec();
+    #[cfg(target_os = "linux")]
+    static ref RGB_TO_YUV_COMP_SPV: Vec<u8> =
+        include_bytes!(concat!(env!("OUT_DIR"), "/RgbToYuv.comp.spv")).to_vec();
+}
+
+// Video packets are serialized straight into socket buffers on the calling (encoder) thread, then
+// video_send_loop only has to stamp the packet index and send them.
+pub struct VideoSender {
+    pub buffer_factory: SenderBufferFactory<VideoFrameHeaderPacket>,
+    pub queue: Arc<VideoFrameQueue>,
+}
+
+// The workers get the network thread policy, the settings are read once like the ones of the driver
+fn build_runtime() -> Option<Runtime> {
+    let thread_policy = SESSION_MANAGER
+        .lock()
+        .get()
+        .to_settings()
+        .video
+        .thread_policy;
+    let realtime_priority = thread_policy.realtime_priority;
+    let cpu_mask = thread_policy.network_cpu_mask;
+
+    tokio::runtime::Builder::new_multi_thread()
+        .enable_all()
+        .on_thread_start(move || {
+            if !unsafe { SetNetworkThreadPolicy(realtime_priority, cpu_mask) } {
+                warn!("Could not apply the thread policy to a runtime worker");
+            }
+        })
+        .build()
+        .ok()
+}
+
+fn to_video_frame_header_packet(header: &VideoFrame) -> VideoFrameHeaderPacket {
+    VideoFrameHeaderPacket {
+        packet_counter: header.packetCounter,
+        tracking_frame_index: header.trackingFrameIndex,
+        video_frame_index: header.videoFrameIndex,
+        sent_time: header.sentTime,
+        frame_byte_size: header.frameByteSize,
+        fec_index: header.fecIndex,
+        fec_percentage: header.fecPercentage,
+        stream_index: header.streamIndex,
+        content_scale: header.contentScale,
+        foveation_center: header.foveationCenter,
+        slice_index: header.sliceIndex,
+        slice_count: header.sliceCount,
+    }
 }
 
 pub fn to_cpp_openvr_prop(key: OpenvrPropertyKey, value: OpenvrPropValue) -> OpenvrProperty {
@@ -115,6 +193,153 @@ pub fn to_cpp_openvr_prop(key: OpenvrPropertyKey, value: OpenvrPropValue) -> Ope
     }
 }
 
+// Truncated to fit, the last byte is always the terminator
+fn to_c_string_array<const N: usize>(value: &str) -> [c_char; N] {
+    let mut array = [0; N];
+    for (dest, byte) in array.iter_mut().zip(value.bytes().take(N - 1)) {
+        *dest = byte as _;
+    }
+
+    array
+}
+
+pub fn to_cpp_openvr_settings(config: &OpenvrConfig) -> OpenvrSettings {
+    OpenvrSettings {
+        universe_id: config.universe_id,
+        headset_serial_number: to_c_string_array(&config.headset_serial_number),
+        headset_tracking_system_name: to_c_string_array(&config.headset_tracking_system_name),
+        headset_model_number: to_c_string_array(&config.headset_model_number),
+        headset_driver_version: to_c_string_array(&config.headset_driver_version),
+        headset_manufacturer_name: to_c_string_array(&config.headset_manufacturer_name),
+        headset_render_model_name: to_c_string_array(&config.headset_render_model_name),
+        headset_registered_device_type: to_c_string_array(&config.headset_registered_device_type),
+        eye_resolution_width: config.eye_resolution_width,
+        eye_resolution_height: config.eye_resolution_height,
+        target_eye_resolution_width: config.target_eye_resolution_width,
+        target_eye_resolution_height: config.target_eye_resolution_height,
+        seconds_from_vsync_to_photons: config.seconds_from_vsync_to_photons,
+        force_3dof: config.force_3dof,
+        tracking_ref_only: config.tracking_ref_only,
+        enable_vive_tracker_proxy: config.enable_vive_tracker_proxy,
+        aggressive_keyframe_resend: config.aggressive_keyframe_resend,
+        adapter_index: config.adapter_index,
+        encoder_adapter_index: config.encoder_adapter_index,
+        encoder_dedicated_device: config.encoder_dedicated_device,
+        codec: config.codec,
+        refresh_rate: config.refresh_rate,
+        use_10bit_encoder: config.use_10bit_encoder,
+        sw_thread_count: config.sw_thread_count,
+        sw_frame_threads: config.sw_frame_threads,
+        sw_intra_refresh: config.sw_intra_refresh,
+        sw_pin_threads: config.sw_pin_threads,
+        sw_hold_frame_deadline: config.sw_hold_frame_deadline,
+        drop_late_frames: config.drop_late_frames,
+        precise_vsync: config.precise_vsync,
+        idle_power_save: config.idle_power_save,
+        thread_realtime_priority: config.thread_realtime_priority,
+        encoder_cpu_mask: config.encoder_cpu_mask,
+        vsync_cpu_mask: config.vsync_cpu_mask,
+        tracking_cpu_mask: config.tracking_cpu_mask,
+        frame_capture_history: config.frame_capture_history,
+        enable_encode_arbitration: config.enable_encode_arbitration,
+        encoder_max_sessions: config.encoder_max_sessions,
+        concurrent_encodes: config.concurrent_encodes,
+        enable_vsync_phase_lock: config.enable_vsync_phase_lock,
+        vsync_queue_wait_target: config.vsync_queue_wait_target,
+        slices_per_frame: config.slices_per_frame,
+        intra_refresh_frames: config.intra_refresh_frames,
+        reference_frame_invalidation: config.reference_frame_invalidation,
+        dual_stream_encoding: config.dual_stream_encoding,
+        yuv_output: config.yuv_output,
+        linux_encode_pipeline_depth: config.linux_encode_pipeline_depth,
+        nvenc_pipeline_depth: config.nvenc_pipeline_depth,
+        nvenc_motion_hints: config.nvenc_motion_hints,
+        nvenc_inter_eye_hints: config.nvenc_inter_eye_hints,
+        amf_pipeline_depth: config.amf_pipeline_depth,
+        amf_pre_analysis: config.amf_pre_analysis,
+        encode_bitrate_mbs: config.encode_bitrate_mbs,
+        enable_adaptive_bitrate: config.enable_adaptive_bitrate,
+        bitrate_maximum: config.bitrate_maximum,
+        latency_target: config.latency_target,
+        latency_use_frametime: config.latency_use_frametime,
+        latency_target_maximum: config.latency_target_maximum,
+        latency_target_offset: config.latency_target_offset,
+        latency_threshold: config.latency_threshold,
+        bitrate_up_rate: config.bitrate_up_rate,
+        bitrate_down_rate: config.bitrate_down_rate,
+        bitrate_light_load_threshold: config.bitrate_light_load_threshold,
+        controllers_tracking_system_name: to_c_string_array(
+            &config.controllers_tracking_system_name,
+        ),
+        controllers_manufacturer_name: to_c_string_array(&config.controllers_manufacturer_name),
+        controllers_model_number: to_c_string_array(&config.controllers_model_number),
+        render_model_name_left_controller: to_c_string_array(
+            &config.render_model_name_left_controller,
+        ),
+        render_model_name_right_controller: to_c_string_array(
+            &config.render_model_name_right_controller,
+        ),
+        controllers_serial_number: to_c_string_array(&config.controllers_serial_number),
+        controllers_type_left: to_c_string_array(&config.controllers_type_left),
+        controllers_type_right: to_c_string_array(&config.controllers_type_right),
+        controllers_registered_device_type: to_c_string_array(
+            &config.controllers_registered_device_type,
+        ),
+        controllers_input_profile_path: to_c_string_array(&config.controllers_input_profile_path),
+        controllers_mode_idx: config.controllers_mode_idx,
+        controllers_enabled: config.controllers_enabled,
+        position_offset: config.position_offset,
+        tracking_frame_offset: config.tracking_frame_offset,
+        controller_pose_offset: config.controller_pose_offset,
+        serverside_prediction: config.serverside_prediction,
+        linear_velocity_cutoff: config.linear_velocity_cutoff,
+        angular_velocity_cutoff: config.angular_velocity_cutoff,
+        position_offset_left: config.position_offset_left,
+        rotation_offset_left: config.rotation_offset_left,
+        haptics_intensity: config.haptics_intensity,
+        haptics_amplitude_curve: config.haptics_amplitude_curve,
+        haptics_min_duration: config.haptics_min_duration,
+        haptics_low_duration_amplitude_multiplier: config.haptics_low_duration_amplitude_multiplier,
+        haptics_low_duration_range: config.haptics_low_duration_range,
+        use_headset_tracking_system: config.use_headset_tracking_system,
+        enable_foveated_rendering: config.enable_foveated_rendering,
+        foveation_center_size_x: config.foveation_center_size_x,
+        foveation_center_size_y: config.foveation_center_size_y,
+        foveation_center_shift_x: config.foveation_center_shift_x,
+        foveation_center_shift_y: config.foveation_center_shift_y,
+        foveation_edge_ratio_x: config.foveation_edge_ratio_x,
+        foveation_edge_ratio_y: config.foveation_edge_ratio_y,
+        foveation_follow_gaze: config.foveation_follow_gaze,
+        enable_foveated_encoding: config.enable_foveated_encoding,
+        foveated_encoding_qp_offset: config.foveated_encoding_qp_offset,
+        enable_dynamic_resolution: config.enable_dynamic_resolution,
+        dynamic_resolution_minimum_scale: config.dynamic_resolution_minimum_scale,
+        enable_color_correction: config.enable_color_correction,
+        brightness: config.brightness,
+        contrast: config.contrast,
+        saturation: config.saturation,
+        gamma: config.gamma,
+        sharpening: config.sharpening,
+        enable_fec: config.enable_fec,
+        fec_on_gpu: config.fec_on_gpu,
+        video_packet_size: config.video_packet_size,
+        linux_async_reprojection: config.linux_async_reprojection,
+    }
+}
+
+// The properties of a device are sent in one call and written in one batch
+pub fn set_openvr_props(
+    device_path: u64,
+    props: impl IntoIterator<Item = (OpenvrPropertyKey, OpenvrPropValue)>,
+) {
+    let props = props
+        .into_iter()
+        .map(|(key, value)| to_cpp_openvr_prop(key, value))
+        .collect::<Vec<_>>();
+
+    unsafe { SetOpenvrProperties(device_path, props.as_ptr(), props.len() as _) };
+}
+
 pub fn shutdown_runtime() {
     alvr_session::log_event(ServerEvent::ServerQuitting);
 
@@ -298,6 +523,23 @@ pub unsafe extern "C" fn HmdDriverFactory(
     COMPRESS_AXIS_ALIGNED_CSO_LEN = COMPRESS_AXIS_ALIGNED_CSO.len() as _;
     COLOR_CORRECTION_CSO_PTR = COLOR_CORRECTION_CSO.as_ptr();
     COLOR_CORRECTION_CSO_LEN = COLOR_CORRECTION_CSO.len() as _;
+    COMPOSITION_CS_HLSL_PTR = COMPOSITION_CS_HLSL.as_ptr();
+    COMPOSITION_CS_HLSL_LEN = COMPOSITION_CS_HLSL.len() as _;
+    FOVEATED_RENDERING_HLSLI_PTR = FOVEATED_RENDERING_HLSLI.as_ptr();
+    FOVEATED_RENDERING_HLSLI_LEN = FOVEATED_RENDERING_HLSLI.len() as _;
+    RGB_TO_NV12_CS_HLSL_PTR = RGB_TO_NV12_CS_HLSL.as_ptr();
+    RGB_TO_NV12_CS_HLSL_LEN = RGB_TO_NV12_CS_HLSL.len() as _;
+    CONTENT_SCALE_CS_HLSL_PTR = CONTENT_SCALE_CS_HLSL.as_ptr();
+    CONTENT_SCALE_CS_HLSL_LEN = CONTENT_SCALE_CS_HLSL.len() as _;
+    REED_SOLOMON_CS_HLSL_PTR = REED_SOLOMON_CS_HLSL.as_ptr();
+    REED_SOLOMON_CS_HLSL_LEN = REED_SOLOMON_CS_HLSL.len() as _;
+    #[cfg(target_os = "linux")]
+    {
+        FRAME_RENDER_COMP_SPV_PTR = FRAME_RENDER_COMP_SPV.as_ptr();
+        FRAME_RENDER_COMP_SPV_LEN = FRAME_RENDER_COMP_SPV.len() as _;
+        RGB_TO_YUV_COMP_SPV_PTR = RGB_TO_YUV_COMP_SPV.as_ptr();
+        RGB_TO_YUV_COMP_SPV_LEN = RGB_TO_YUV_COMP_SPV.len() as _;
+    }
 
     unsafe extern "C" fn log_error(string_ptr: *const c_char) {
         alvr_common::show_e(CStr::from_ptr(string_ptr).to_string_lossy());
@@ -319,29 +561,71 @@ pub unsafe extern "C" fn HmdDriverFactory(
         log(log::Level::Debug, string_ptr);
     }
 
-    extern "C" fn video_send(header: VideoFrame, buffer_ptr: *mut u8, len: i32) {
-        if let Some(sender) = &*VIDEO_SENDER.lock() {
-            let header = VideoFrameHeaderPacket {
-                packet_counter: header.packetCounter,
-                tracking_frame_index: header.trackingFrameIndex,
-                video_frame_index: header.videoFrameIndex,
-                sent_time: header.sentTime,
-                frame_byte_size: header.frameByteSize,
-                fec_index: header.fecIndex,
-                fec_percentage: header.fecPercentage,
-            };
+    unsafe extern "C" fn video_send(header: VideoFrame, buffer_ptr: *mut u8, len: i32, idr: bool) {
+        let payload = VideoPacketPayload {
+            buf: buffer_ptr,
+            len,
+            priority: false,
+        };
+        video_send_batch(&header, &payload, 1, idr, true);
+    }
 
-            let mut vec_buffer = vec![0; len as _];
+    // Copy all packets of a frame directly into a single socket allocation. This is the only copy
+    // of the encoded frame on the Rust side.
+    unsafe extern "C" fn video_send_batch(
+        headers: *const VideoFrame,
+        payloads: *const VideoPacketPayload,
+        count: i32,
+        idr: bool,
+        frame_end: bool,
+    ) {
+        if count <= 0 {
+            return;
+        }
 
-            // use copy_nonoverlapping (aka memcpy) to avoid freeing memory allocated by C++
-            unsafe {
-                ptr::copy_nonoverlapping(buffer_ptr, vec_buffer.as_mut_ptr(), len as _);
+        let headers = slice::from_raw_parts(headers, count as _);
+        let payloads = slice::from_raw_parts(payloads, count as _);
+
+        if let Some(video_sender) = &*VIDEO_SENDER.lock() {
+            let packets = headers.iter().map(to_video_frame_header_packet);
+
+            let header_size = bincode::serialized_size(&to_video_frame_header_packet(&headers[0]))
+                .unwrap_or(0) as usize;
+            let capacity = payloads
+                .iter()
+                .map(|payload| 2 + 4 + 2 + header_size + payload.len as usize)
+                .sum();
+
+            let mut batch = video_sender.buffer_factory.new_batch(capacity);
+            for (header, payload) in packets.zip(payloads) {
+                let priority = payload.priority;
+                let payload = slice::from_raw_parts(payload.buf, payload.len as _);
+                if batch.push(&header, payload, priority).is_err() {
+                    return;
+                }
             }
 
-            sender.send((header, vec_buffer)).ok();
+            video_sender
+                .queue
+                .push(batch.into_buffers(), idr, frame_end);
         }
     }
 
+    unsafe extern "C" fn video_config_send(stream_index: u8, buf: *const u8, len: i32) {
+        let config = slice::from_raw_parts(buf, len as _).to_vec();
+
+        let mut configs = VIDEO_CONFIGS.lock();
+        if let Some(sender) = &*VIDEO_CONFIG_SENDER.lock() {
+            sender
+                .send(VideoConfigPacket {
+                    stream_index,
+                    config: config.clone(),
+                })
+                .ok();
+        }
+        configs.insert(stream_index, config);
+    }
+
     extern "C" fn haptics_send(path: u64, duration_s: f32, frequency: f32, amplitude: f32) {
         if let Some(sender) = &*HAPTICS_SENDER.lock() {
             let haptics = Haptics {
@@ -371,6 +655,25 @@ pub unsafe extern "C" fn HmdDriverFactory(
                 fec_failure_in_second: data.fecFailureInSecond,
                 fec_failure_total: data.fecFailureTotal,
                 fps: data.fps,
+                prediction_error_rotation: data.predictionErrorRotation,
+                prediction_error_position: data.predictionErrorPosition,
+                prediction_horizon: data.predictionHorizon,
+                prediction_residual: data.predictionResidual,
+                fec_recovery_time: data.fecRecoveryTime,
+                gpu_time_ffr: data.gpuTimeFfr,
+                gpu_time_eyes: data.gpuTimeEyes,
+                trace_frame_index: data.traceFrameIndex,
+                trace_tracking: data.traceTracking,
+                trace_received_first: data.traceReceivedFirst,
+                trace_received_last: data.traceReceivedLast,
+                trace_decoder_input: data.traceDecoderInput,
+                trace_decoder_output: data.traceDecoderOutput,
+                trace_rendered: data.traceRendered,
+                trace_submit: data.traceSubmit,
+                arrival_frame_index: data.arrivalFrameIndex,
+                arrival_first: data.arrivalFirst,
+                arrival_last: data.arrivalLast,
+                arrival_packets: data.arrivalPackets,
                 server_total_latency: data.serverTotalLatency,
                 tracking_recv_frame_index: data.trackingRecvFrameIndex,
             };
@@ -379,6 +682,18 @@ pub unsafe extern "C" fn HmdDriverFactory(
         }
     }
 
+    extern "C" fn statistics_send(summary: StatisticsSummary) {
+        if let Some(sender) = &*STATISTICS_SENDER.lock() {
+            sender.send(StatisticsReport::Summary(summary)).ok();
+        }
+    }
+
+    extern "C" fn graph_statistics_send(statistics: GraphStatistics) {
+        if let Some(sender) = &*STATISTICS_SENDER.lock() {
+            sender.send(StatisticsReport::Graph(statistics)).ok();
+        }
+    }
+
     pub extern "C" fn driver_ready_idle(set_default_chap: bool) {
         alvr_common::show_err(alvr_commands::apply_driver_paths_backup(
             FILESYSTEM_LAYOUT.openvr_driver_root_dir.clone(),
@@ -413,8 +728,12 @@ pub unsafe extern "C" fn HmdDriverFactory(
     LogDebug = Some(log_debug);
     DriverReadyIdle = Some(driver_ready_idle);
     VideoSend = Some(video_send);
+    VideoSendBatch = Some(video_send_batch);
+    VideoConfigSend = Some(video_config_send);
     HapticsSend = Some(haptics_send);
     TimeSyncSend = Some(time_sync_send);
+    StatisticsSend = Some(statistics_send);
+    GraphStatisticsSend = Some(graph_statistics_send);
     ShutdownRuntime = Some(_shutdown_runtime);
     PathStringToHash = Some(path_string_to_hash);
 
@@ -430,8 +749,9 @@ pub unsafe extern "C" fn HmdDriverFactory(
     thread::spawn(move || {
         NUM_TRIALS.fetch_add(1, Ordering::Relaxed);
         if NUM_TRIALS.load(Ordering::Relaxed) <= 1 {
+            let settings = to_cpp_openvr_settings(&SESSION_MANAGER.lock().get().openvr_config);
             MAYBE_PTR_USIZE.store(
-                CppEntryPoint(interface_name_usize as _, return_code_usize as _) as _,
+                CppEntryPoint(interface_name_usize as _, return_code_usize as _, &settings) as _,
                 Ordering::Relaxed,
             );
         }
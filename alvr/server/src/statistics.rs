@@ -0,0 +1,655 @@
+use crate::{GraphStatistics, LatencyPercentiles, StatisticsSummary};
+use alvr_common::log;
+use std::{
+    fmt::Write,
+    sync::atomic::{self, AtomicU64, Ordering},
+    time::{SystemTime, UNIX_EPOCH},
+};
+
+// Statistics reported by the driver. They are serialized for the dashboard here, on a runtime
+// thread, so the driver never formats them into log lines on its own threads.
+pub enum StatisticsReport {
+    Summary(StatisticsSummary),
+    Graph(GraphStatistics),
+}
+
+fn percentiles_json(name: &str, p: &LatencyPercentiles) -> String {
+    format!(
+        "\"{0}P50\": {1:.3}, \"{0}P95\": {2:.3}, \"{0}P99\": {3:.3}, ",
+        name, p.p50, p.p95, p.p99
+    )
+}
+
+const METRIC_COUNT: usize = 47;
+
+// Name, type and help of the values of the /metrics snapshot, in the order of `metric_values`
+const METRICS: [(&str, &str, &str); METRIC_COUNT] = [
+    (
+        "alvr_statistics_timestamp_seconds",
+        "gauge",
+        "Time of the last statistics report of the driver",
+    ),
+    (
+        "alvr_video_packets_sent_total",
+        "counter",
+        "Video packets sent",
+    ),
+    (
+        "alvr_video_packets_sent_per_second",
+        "gauge",
+        "Video packets sent over the last second",
+    ),
+    (
+        "alvr_video_packets_lost_total",
+        "counter",
+        "Video packets lost, reported by the client",
+    ),
+    (
+        "alvr_video_packets_lost_per_second",
+        "gauge",
+        "Video packets lost over the last second",
+    ),
+    (
+        "alvr_video_sent_bytes_total",
+        "counter",
+        "Video bytes sent, with a resolution of 1 MB",
+    ),
+    (
+        "alvr_video_sent_bits_per_second",
+        "gauge",
+        "Video bitrate on the network",
+    ),
+    (
+        "alvr_target_bitrate_bits_per_second",
+        "gauge",
+        "Bitrate given to the encoder",
+    ),
+    (
+        "alvr_encoder_output_bits_per_second",
+        "gauge",
+        "Bitrate produced by the encoder",
+    ),
+    (
+        "alvr_encoder_bitrate_usage_ratio",
+        "gauge",
+        "Encoder output over the target bitrate",
+    ),
+    (
+        "alvr_encoder_frame_size_bytes",
+        "gauge",
+        "Average size of an encoded frame",
+    ),
+    (
+        "alvr_encoder_intra_frames_per_second",
+        "gauge",
+        "IDR and I frames produced over the last second",
+    ),
+    (
+        "alvr_encoder_qp",
+        "gauge",
+        "Average quantizer of the encoded frames, 0 if the encoder does not report it",
+    ),
+    (
+        "alvr_encoder_latency_seconds",
+        "gauge",
+        "Average time spent in the encoder, 0 if unknown",
+    ),
+    (
+        "alvr_encoder_load_ratio",
+        "gauge",
+        "Encode time over the frame interval times the pipeline depth",
+    ),
+    (
+        "alvr_fec_percentage",
+        "gauge",
+        "Forward error correction overhead in percent",
+    ),
+    (
+        "alvr_fec_failures_total",
+        "counter",
+        "Frames the client could not recover",
+    ),
+    (
+        "alvr_fec_failures_per_second",
+        "gauge",
+        "Frames the client could not recover over the last second",
+    ),
+    (
+        "alvr_fec_recovery_seconds",
+        "gauge",
+        "Time the client spent recovering lost shards over the last second",
+    ),
+    (
+        "alvr_client_gpu_ffr_seconds",
+        "gauge",
+        "GPU time of the foveation decompression pass of the client",
+    ),
+    (
+        "alvr_client_gpu_eyes_seconds",
+        "gauge",
+        "GPU time of the eye render pass of the client",
+    ),
+    (
+        "alvr_ping_seconds",
+        "gauge",
+        "Round trip time to the client",
+    ),
+    (
+        "alvr_total_latency_seconds",
+        "gauge",
+        "Average motion to photon latency",
+    ),
+    (
+        "alvr_encode_latency_seconds",
+        "gauge",
+        "Average latency of the encode stage",
+    ),
+    (
+        "alvr_send_latency_seconds",
+        "gauge",
+        "Average latency of the network transport",
+    ),
+    (
+        "alvr_decode_latency_seconds",
+        "gauge",
+        "Average latency of the decoder of the client",
+    ),
+    (
+        "alvr_present_latency_seconds",
+        "gauge",
+        "Average latency of the presents of the compositor",
+    ),
+    (
+        "alvr_presents_coalesced_per_second",
+        "gauge",
+        "Presents replaced by a newer one before being encoded",
+    ),
+    (
+        "alvr_compositor_frames_dropped_per_second",
+        "gauge",
+        "Frames dropped by the compositor over the last second",
+    ),
+    (
+        "alvr_compositor_frames_late_per_second",
+        "gauge",
+        "Frames presented late by the compositor over the last second",
+    ),
+    (
+        "alvr_duplicate_frames_skipped_per_second",
+        "gauge",
+        "Presents of an already encoded frame that were not encoded again",
+    ),
+    (
+        "alvr_late_frames_dropped_per_second",
+        "gauge",
+        "Frames not encoded as they would reach the client after their display time",
+    ),
+    (
+        "alvr_expired_frames_dropped_per_second",
+        "gauge",
+        "Frames not encoded as their display time had already passed",
+    ),
+    (
+        "alvr_vsync_jitter_seconds",
+        "gauge",
+        "Average distance of the VSync events to their schedule",
+    ),
+    (
+        "alvr_vsync_jitter_max_seconds",
+        "gauge",
+        "Largest distance of a VSync event to its schedule over the last second",
+    ),
+    (
+        "alvr_gpu_queue_wait_seconds",
+        "gauge",
+        "Time the frame work waited in the GPU queue before running",
+    ),
+    (
+        "alvr_gpu_graphics_utilization_ratio",
+        "gauge",
+        "Time the 3D engine of the GPU was busy, NaN if unknown",
+    ),
+    (
+        "alvr_gpu_encoder_utilization_ratio",
+        "gauge",
+        "Time the video encoder engine of the GPU was busy, NaN if unknown",
+    ),
+    (
+        "alvr_gpu_clock_hertz",
+        "gauge",
+        "Clock of the 3D engine of the GPU, NaN if unknown",
+    ),
+    (
+        "alvr_gpu_pcie_tx_bytes_per_second",
+        "gauge",
+        "PCIe traffic from the GPU, NaN if unknown",
+    ),
+    (
+        "alvr_gpu_pcie_rx_bytes_per_second",
+        "gauge",
+        "PCIe traffic to the GPU, NaN if unknown",
+    ),
+    ("alvr_client_fps", "gauge", "Frame rate of the client"),
+    ("alvr_server_fps", "gauge", "Frame rate of the server"),
+    (
+        "alvr_prediction_error_rotation_degrees",
+        "gauge",
+        "Rotation error of the pose prediction",
+    ),
+    (
+        "alvr_prediction_error_position_meters",
+        "gauge",
+        "Position error of the pose prediction",
+    ),
+    (
+        "alvr_prediction_horizon_seconds",
+        "gauge",
+        "Horizon of the pose prediction, measured by the client",
+    ),
+    (
+        "alvr_prediction_residual_seconds",
+        "gauge",
+        "Display time of the frames minus the time they were predicted for",
+    ),
+];
+
+const STAGES: [&str; 9] = [
+    "compose",
+    "encode",
+    "send",
+    "transport",
+    "decode",
+    "render",
+    "layer_render",
+    "layer_handoff",
+    "present_pickup",
+];
+const QUANTILES: [&str; 3] = ["0.5", "0.95", "0.99"];
+const VALUE_COUNT: usize = METRIC_COUNT + STAGES.len() * QUANTILES.len();
+
+// GpuMonitor reports -1 for what the driver does not expose
+fn gpu_value(value: i32, scale: f64) -> f64 {
+    if value < 0 {
+        f64::NAN
+    } else {
+        value as f64 * scale
+    }
+}
+
+fn metric_values(s: &StatisticsSummary) -> [f64; VALUE_COUNT] {
+    let timestamp = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map(|d| d.as_secs_f64())
+        .unwrap_or_default();
+
+    let metrics: [f64; METRIC_COUNT] = [
+        timestamp,
+        s.totalPackets as f64,
+        s.packetRate as f64,
+        s.packetsLostTotal as f64,
+        s.packetsLostPerSecond as f64,
+        s.totalSent as f64 * 1e6,
+        s.sentRate * 1e6,
+        s.bitrate as f64 * 1e6,
+        s.encodedBitrate * 1e6,
+        s.bitrateUsage as f64 / 100.,
+        s.encodedFrameSize * 1e3,
+        s.intraFramesInSecond as f64,
+        s.encodeQp,
+        s.encoderLatency / 1e3,
+        s.encoderLoad as f64 / 100.,
+        s.fecPercentage as f64,
+        s.fecFailureTotal as f64,
+        s.fecFailureInSecond as f64,
+        s.fecRecoveryTime / 1e3,
+        s.clientGpuTimeFfr / 1e3,
+        s.clientGpuTimeEyes / 1e3,
+        s.ping / 1e3,
+        s.totalLatency / 1e3,
+        s.encodeLatency / 1e3,
+        s.sendLatency / 1e3,
+        s.decodeLatency / 1e3,
+        s.presentLatency as f64 / 1e6,
+        s.presentsCoalescedInSecond as f64,
+        s.compositorFramesDroppedInSecond as f64,
+        s.compositorFramesLateInSecond as f64,
+        s.duplicateFramesSkippedInSecond as f64,
+        s.lateFramesDroppedInSecond as f64,
+        s.expiredFramesDroppedInSecond as f64,
+        s.vsyncJitter / 1e3,
+        s.vsyncJitterMax / 1e3,
+        s.gpuQueueWait / 1e3,
+        gpu_value(s.gpuGraphicsLoad, 0.01),
+        gpu_value(s.gpuEncoderLoad, 0.01),
+        gpu_value(s.gpuClock, 1e6),
+        gpu_value(s.pcieTxRate, 1e6),
+        gpu_value(s.pcieRxRate, 1e6),
+        s.clientFPS,
+        s.serverFPS,
+        s.predictionErrorRotation as f64,
+        s.predictionErrorPosition as f64 / 1e3,
+        s.predictionHorizon / 1e3,
+        s.predictionResidual / 1e3,
+    ];
+    let percentiles = [
+        &s.composePercentiles,
+        &s.encodePercentiles,
+        &s.sendPercentiles,
+        &s.transportPercentiles,
+        &s.decodePercentiles,
+        &s.renderPercentiles,
+        &s.layerRenderPercentiles,
+        &s.layerHandoffPercentiles,
+        &s.presentPickupPercentiles,
+    ];
+
+    let mut values = [0.; VALUE_COUNT];
+    values[..METRIC_COUNT].copy_from_slice(&metrics);
+    for (i, p) in percentiles.iter().enumerate() {
+        let offset = METRIC_COUNT + i * QUANTILES.len();
+        values[offset..offset + QUANTILES.len()].copy_from_slice(&[
+            p.p50 / 1e3,
+            p.p95 / 1e3,
+            p.p99 / 1e3,
+        ]);
+    }
+
+    values
+}
+
+// Latest summary for the /metrics endpoint, stored as f64 bits. The statistics loop is the only
+// writer and makes the sequence odd while it updates the values. Readers retry if it was odd or
+// changed during their copy, so scrapes never block the statistics loop and vice versa.
+struct MetricsSnapshot {
+    sequence: AtomicU64,
+    values: [AtomicU64; VALUE_COUNT],
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO: AtomicU64 = AtomicU64::new(0);
+
+static METRICS_SNAPSHOT: MetricsSnapshot = MetricsSnapshot {
+    sequence: AtomicU64::new(0),
+    values: [ZERO; VALUE_COUNT],
+};
+
+fn store_metrics(summary: &StatisticsSummary) {
+    let snapshot = &METRICS_SNAPSHOT;
+    let sequence = snapshot.sequence.load(Ordering::Relaxed);
+
+    snapshot.sequence.store(sequence + 1, Ordering::Relaxed);
+    atomic::fence(Ordering::Release);
+    for (slot, value) in snapshot.values.iter().zip(metric_values(summary)) {
+        slot.store(value.to_bits(), Ordering::Relaxed);
+    }
+    snapshot.sequence.store(sequence + 2, Ordering::Release);
+}
+
+fn load_metrics() -> Option<[f64; VALUE_COUNT]> {
+    let snapshot = &METRICS_SNAPSHOT;
+    loop {
+        let sequence = snapshot.sequence.load(Ordering::Acquire);
+        if sequence == 0 {
+            // No report yet
+            return None;
+        }
+        if sequence % 2 == 1 {
+            std::hint::spin_loop();
+            continue;
+        }
+
+        let mut values = [0.; VALUE_COUNT];
+        for (value, slot) in values.iter_mut().zip(&snapshot.values) {
+            *value = f64::from_bits(slot.load(Ordering::Relaxed));
+        }
+
+        atomic::fence(Ordering::Acquire);
+        if snapshot.sequence.load(Ordering::Relaxed) == sequence {
+            return Some(values);
+        }
+    }
+}
+
+// Prometheus text exposition of the last statistics report. Empty until a client has streamed.
+pub fn metrics_text() -> String {
+    let mut text = String::new();
+    let values = match load_metrics() {
+        Some(values) => values,
+        None => return text,
+    };
+
+    for ((name, kind, help), value) in METRICS.iter().zip(values) {
+        writeln!(text, "# HELP {name} {help}").ok();
+        writeln!(text, "# TYPE {name} {kind}").ok();
+        writeln!(text, "{name} {value}").ok();
+    }
+
+    let name = "alvr_stage_latency_seconds";
+    writeln!(
+        text,
+        "# HELP {name} Latency percentiles of the pipeline stages over the last second"
+    )
+    .ok();
+    writeln!(text, "# TYPE {name} summary").ok();
+    for (i, stage) in STAGES.iter().enumerate() {
+        for (j, quantile) in QUANTILES.iter().enumerate() {
+            let value = values[METRIC_COUNT + i * QUANTILES.len() + j];
+            writeln!(
+                text,
+                "{name}{{stage=\"{stage}\",quantile=\"{quantile}\"}} {value}"
+            )
+            .ok();
+        }
+    }
+
+    append_stream_queue_metrics(&mut text);
+
+    let name = "alvr_video_send_queue_frames";
+    writeln!(text, "# HELP {name} Encoded frames waiting to be sent").ok();
+    writeln!(text, "# TYPE {name} gauge").ok();
+    writeln!(text, "{name} {}", crate::video_queue::queued_frames()).ok();
+
+    let name = "alvr_video_dropped_frames_total";
+    writeln!(
+        text,
+        "# HELP {name} Frames dropped by the send queue, stale or waiting for a recovery IDR"
+    )
+    .ok();
+    writeln!(text, "# TYPE {name} counter").ok();
+    writeln!(text, "{name} {}", crate::video_queue::dropped_frames()).ok();
+
+    text
+}
+
+// Time the packets of each stream waited for the socket behind the other streams
+fn append_stream_queue_metrics(text: &mut String) {
+    let statistics = alvr_sockets::stream_queue_statistics();
+    let stream_name = |stream_id| match stream_id {
+        alvr_sockets::INPUT => "input",
+        alvr_sockets::HAPTICS => "haptics",
+        alvr_sockets::AUDIO => "audio",
+        alvr_sockets::VIDEO => "video",
+        _ => "other",
+    };
+
+    let name = "alvr_stream_queue_delay_seconds";
+    writeln!(
+        text,
+        "# HELP {name} Time the sends of each stream waited for the socket"
+    )
+    .ok();
+    writeln!(text, "# TYPE {name} summary").ok();
+    for s in &statistics {
+        let stream = stream_name(s.stream_id);
+        let sum = s.queue_delay_sum.as_secs_f64();
+        writeln!(text, "{name}_sum{{stream=\"{stream}\"}} {sum}").ok();
+        writeln!(text, "{name}_count{{stream=\"{stream}\"}} {}", s.sends).ok();
+    }
+
+    let name = "alvr_stream_expired_sends_total";
+    writeln!(
+        text,
+        "# HELP {name} Sends dropped because they waited past the deadline of the stream"
+    )
+    .ok();
+    writeln!(text, "# TYPE {name} counter").ok();
+    for s in &statistics {
+        let stream = stream_name(s.stream_id);
+        writeln!(text, "{name}{{stream=\"{stream}\"}} {}", s.dropped_sends).ok();
+    }
+}
+
+fn log_summary(s: StatisticsSummary) {
+    log::info!(
+        concat!(
+            "#{{ \"id\": \"Statistics\", \"data\": {{",
+            "\"totalPackets\": {}, ",
+            "\"packetRate\": {}, ",
+            "\"packetsLostTotal\": {}, ",
+            "\"packetsLostPerSecond\": {}, ",
+            "\"totalSent\": {}, ",
+            "\"sentRate\": {:.3}, ",
+            "\"bitrate\": {}, ",
+            "\"encodedBitrate\": {:.3}, ",
+            "\"bitrateUsage\": {}, ",
+            "\"encodedFrameSize\": {:.1}, ",
+            "\"intraFramesInSecond\": {}, ",
+            "\"encodeQp\": {:.1}, ",
+            "\"encoderLoad\": {}, ",
+            "\"encoderLatency\": {:.3}, ",
+            "\"ping\": {:.3}, ",
+            "\"totalLatency\": {:.3}, ",
+            "\"encodeLatency\": {:.3}, ",
+            "\"sendLatency\": {:.3}, ",
+            "\"decodeLatency\": {:.3}, ",
+            "\"fecPercentage\": {}, ",
+            "\"fecFailureTotal\": {}, ",
+            "\"fecFailureInSecond\": {}, ",
+            "\"fecRecoveryTime\": {:.3}, ",
+            "\"clientGpuTimeFfr\": {:.3}, ",
+            "\"clientGpuTimeEyes\": {:.3}, ",
+            "\"presentsCoalescedInSecond\": {}, ",
+            "\"presentLatency\": {}, ",
+            "\"compositorFramesDroppedInSecond\": {}, ",
+            "\"compositorFramesLateInSecond\": {}, ",
+            "\"duplicateFramesSkippedInSecond\": {}, ",
+            "\"lateFramesDroppedInSecond\": {}, ",
+            "\"expiredFramesDroppedInSecond\": {}, ",
+            "\"vsyncJitter\": {:.3}, ",
+            "\"vsyncJitterMax\": {:.3}, ",
+            "\"gpuQueueWait\": {:.3}, ",
+            "\"gpuGraphicsLoad\": {}, ",
+            "\"gpuEncoderLoad\": {}, ",
+            "\"gpuClock\": {}, ",
+            "\"pcieTxRate\": {}, ",
+            "\"pcieRxRate\": {}, ",
+            "\"clientFPS\": {:.3}, ",
+            "\"serverFPS\": {:.3}, ",
+            "\"predictionErrorRotation\": {:.2}, ",
+            "\"predictionErrorPosition\": {:.2}, ",
+            "\"predictionHorizon\": {:.3}, ",
+            "\"predictionResidual\": {:.3}, ",
+            "{}{}{}{}{}{}{}{}{}",
+            "\"batteryHMD\": {}, ",
+            "\"batteryLeft\": {}, ",
+            "\"batteryRight\": {}",
+            "}} }}#"
+        ),
+        s.totalPackets,
+        s.packetRate,
+        s.packetsLostTotal,
+        s.packetsLostPerSecond,
+        s.totalSent,
+        s.sentRate,
+        s.bitrate,
+        s.encodedBitrate,
+        s.bitrateUsage,
+        s.encodedFrameSize,
+        s.intraFramesInSecond,
+        s.encodeQp,
+        s.encoderLoad,
+        s.encoderLatency,
+        s.ping,
+        s.totalLatency,
+        s.encodeLatency,
+        s.sendLatency,
+        s.decodeLatency,
+        s.fecPercentage,
+        s.fecFailureTotal,
+        s.fecFailureInSecond,
+        s.fecRecoveryTime,
+        s.clientGpuTimeFfr,
+        s.clientGpuTimeEyes,
+        s.presentsCoalescedInSecond,
+        s.presentLatency,
+        s.compositorFramesDroppedInSecond,
+        s.compositorFramesLateInSecond,
+        s.duplicateFramesSkippedInSecond,
+        s.lateFramesDroppedInSecond,
+        s.expiredFramesDroppedInSecond,
+        s.vsyncJitter,
+        s.vsyncJitterMax,
+        s.gpuQueueWait,
+        s.gpuGraphicsLoad,
+        s.gpuEncoderLoad,
+        s.gpuClock,
+        s.pcieTxRate,
+        s.pcieRxRate,
+        s.clientFPS,
+        s.serverFPS,
+        s.predictionErrorRotation,
+        s.predictionErrorPosition,
+        s.predictionHorizon,
+        s.predictionResidual,
+        percentiles_json("composeLatency", &s.composePercentiles),
+        percentiles_json("encodeLatency", &s.encodePercentiles),
+        percentiles_json("sendLatency", &s.sendPercentiles),
+        percentiles_json("transportLatency", &s.transportPercentiles),
+        percentiles_json("decodeLatency", &s.decodePercentiles),
+        percentiles_json("renderLatency", &s.renderPercentiles),
+        percentiles_json("layerRenderLatency", &s.layerRenderPercentiles),
+        percentiles_json("layerHandoffLatency", &s.layerHandoffPercentiles),
+        percentiles_json("presentPickupLatency", &s.presentPickupPercentiles),
+        s.batteryHMD,
+        s.batteryLeft,
+        s.batteryRight,
+    );
+}
+
+pub fn log_statistics(report: StatisticsReport) {
+    match report {
+        StatisticsReport::Summary(s) => {
+            store_metrics(&s);
+            log_summary(s)
+        }
+        StatisticsReport::Graph(g) => log::info!(
+            concat!(
+                "#{{ \"id\": \"GraphStatistics\", \"data\": [",
+                "{},{:.3},{:.3},{:.3},{:.3},{:.3},{:.3},{:.3},",
+                "{:.3},{:.3},{:.3},{:.3},{:.3},{:.3},{:.3},{:.3},",
+                "{:.3},{:.3},{:.3},{:.3}",
+                "] }}#"
+            ),
+            g.time,
+            g.totalLatency,
+            g.receiveLatency,
+            g.renderTime,
+            g.idleTime,
+            g.waitTime,
+            g.encodeLatency,
+            g.sendLatency,
+            g.decodeLatency,
+            g.clientIdleTime,
+            g.clientFPS,
+            g.serverFPS,
+            g.gpuCompositionTime,
+            g.gpuColorCorrectionTime,
+            g.gpuFfrTime,
+            g.gpuEncoderCopyTime,
+            g.layerRenderTime,
+            g.layerHandoffTime,
+            g.presentPickupTime,
+            g.layerCopyTime,
+        ),
+    }
+}
@@ -0,0 +1,218 @@
+// Frames encoded while the network stalls pile up in front of the socket, and without a bound the
+// lag of the stall would stay on every following frame. The queue keeps whole frames. When it is
+// full, or when a frame has waited longer than the deadline, the stale frames are dropped together
+// with the ones that depend on them and the encoder is asked for an IDR. Frames are skipped until
+// that IDR arrives, there is no point in sending frames the decoder cannot use.
+//
+// A frame can come in several parts: the FEC block of each of its slices, and within a slice the
+// data packets and then the parity computed while they were being sent. The parts after the first
+// are queued on their own but share the fate of the first one.
+
+use alvr_sockets::{SenderBuffer, VideoFrameHeaderPacket};
+use parking_lot::Mutex;
+use std::{
+    collections::VecDeque,
+    sync::atomic::{AtomicU64, Ordering},
+    time::{Duration, Instant},
+};
+use tokio::sync::Notify;
+
+// Give up waiting for the IDR if the encoder did not produce one, the client will request it again
+// when it fails to decode
+const RECOVERY_TIMEOUT: Duration = Duration::from_secs(1);
+
+pub type FrameBuffers = Vec<SenderBuffer<VideoFrameHeaderPacket>>;
+
+struct QueuedFrame {
+    buffers: FrameBuffers,
+    idr: bool,
+    queued_time: Instant,
+    id: u64,
+    // Later part of the frame queued before, not a frame of its own
+    continuation: bool,
+}
+
+// Frame whose last part was not pushed yet
+struct PartialFrame {
+    id: u64,
+    dropped: bool,
+}
+
+#[derive(Default)]
+struct QueueState {
+    frames: VecDeque<QueuedFrame>,
+    // Set while skipping frames until the next IDR
+    recovery_start: Option<Instant>,
+    next_id: u64,
+    partial: Option<PartialFrame>,
+}
+
+impl QueueState {
+    // Later parts do not count, they belong to a frame queued or sent before
+    fn whole_frames(&self) -> usize {
+        self.frames
+            .iter()
+            .filter(|frame| !frame.continuation)
+            .count()
+    }
+}
+
+pub struct VideoFrameQueue {
+    state: Mutex<QueueState>,
+    notifier: Notify,
+    max_frames: usize,
+    deadline: Option<Duration>,
+}
+
+static QUEUED_FRAMES: AtomicU64 = AtomicU64::new(0);
+static DROPPED_FRAMES: AtomicU64 = AtomicU64::new(0);
+
+// Frames waiting for the socket
+pub fn queued_frames() -> u64 {
+    QUEUED_FRAMES.load(Ordering::Relaxed)
+}
+
+// Stale frames and frames skipped until a recovery IDR, since the process started
+pub fn dropped_frames() -> u64 {
+    DROPPED_FRAMES.load(Ordering::Relaxed)
+}
+
+impl VideoFrameQueue {
+    // Unbounded and without deadline if `max_frames` is None
+    pub fn new(max_frames: Option<usize>, deadline: Option<Duration>) -> Self {
+        QUEUED_FRAMES.store(0, Ordering::Relaxed);
+
+        Self {
+            state: Mutex::new(QueueState::default()),
+            notifier: Notify::new(),
+            max_frames: max_frames.unwrap_or(usize::MAX).max(1),
+            deadline,
+        }
+    }
+
+    // Called by the encoder thread, never blocks on the network. `frame_end` is false for all but
+    // the last part of a frame, the pushes after the first one continue it.
+    pub fn push(&self, buffers: FrameBuffers, idr: bool, frame_end: bool) {
+        let mut state = self.state.lock();
+
+        if let Some(PartialFrame { id, dropped }) = state.partial {
+            if frame_end {
+                state.partial = None;
+            }
+            if !dropped {
+                let continuation = QueuedFrame {
+                    buffers,
+                    idr: false,
+                    queued_time: Instant::now(),
+                    id,
+                    continuation: true,
+                };
+                state.frames.push_back(continuation);
+                self.notifier.notify_one();
+            }
+            return;
+        }
+
+        let id = state.next_id;
+        state.next_id += 1;
+        if !frame_end {
+            state.partial = Some(PartialFrame { id, dropped: true });
+        }
+
+        if idr {
+            state.recovery_start = None;
+        } else if let Some(start) = state.recovery_start {
+            if start.elapsed() < RECOVERY_TIMEOUT {
+                DROPPED_FRAMES.fetch_add(1, Ordering::Relaxed);
+                return;
+            }
+            state.recovery_start = None;
+        }
+
+        let queued = state.whole_frames();
+        if queued >= self.max_frames {
+            // The new frame depends on the dropped ones unless it is an IDR
+            let dropped = queued as u64 + !idr as u64;
+            state.frames.clear();
+            DROPPED_FRAMES.fetch_add(dropped, Ordering::Relaxed);
+            QUEUED_FRAMES.store(0, Ordering::Relaxed);
+
+            if !idr {
+                start_recovery(&mut state);
+                return;
+            }
+        }
+
+        state.frames.push_back(QueuedFrame {
+            buffers,
+            idr,
+            queued_time: Instant::now(),
+            id,
+            continuation: false,
+        });
+        QUEUED_FRAMES.store(state.whole_frames() as _, Ordering::Relaxed);
+        if let Some(partial) = &mut state.partial {
+            partial.dropped = false;
+        }
+
+        self.notifier.notify_one();
+    }
+
+    pub async fn pop(&self) -> FrameBuffers {
+        loop {
+            {
+                let mut state = self.state.lock();
+
+                let stale = match (state.frames.front(), self.deadline) {
+                    (Some(frame), Some(deadline)) => frame.queued_time.elapsed() > deadline,
+                    _ => false,
+                };
+                if stale {
+                    // Frames up to the next queued IDR cannot be decoded without the stale one
+                    // unless it is a later part of a frame that is already on its way. The rest of
+                    // that frame goes with it, the client recovers what it can of the frame.
+                    let chain = state
+                        .frames
+                        .front()
+                        .map_or(false, |frame| !frame.continuation);
+                    let mut dropped = 0;
+                    let mut last_id = None;
+                    while let Some(frame) = state.frames.front() {
+                        if last_id.map_or(false, |id| id != frame.id) && (frame.idr || !chain) {
+                            break;
+                        }
+                        dropped += !frame.continuation as u64;
+                        last_id = Some(frame.id);
+                        state.frames.pop_front();
+                    }
+                    // The second part of the last dropped frame is still to come
+                    if let Some(partial) = &mut state.partial {
+                        if Some(partial.id) == last_id {
+                            partial.dropped = true;
+                        }
+                    }
+                    DROPPED_FRAMES.fetch_add(dropped, Ordering::Relaxed);
+
+                    if state.frames.is_empty() {
+                        start_recovery(&mut state);
+                    }
+                }
+
+                if let Some(frame) = state.frames.pop_front() {
+                    QUEUED_FRAMES.store(state.whole_frames() as _, Ordering::Relaxed);
+                    return frame.buffers;
+                }
+                QUEUED_FRAMES.store(0, Ordering::Relaxed);
+            }
+
+            self.notifier.notified().await;
+        }
+    }
+}
+
+fn start_recovery(state: &mut QueueState) {
+    if state.recovery_start.is_none() {
+        state.recovery_start = Some(Instant::now());
+        unsafe { crate::RequestIDR() };
+    }
+}
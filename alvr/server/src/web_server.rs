@@ -1,4 +1,7 @@
-use crate::{graphics_info, ClientListAction, FILESYSTEM_LAYOUT, SESSION_MANAGER};
+use crate::{
+    graphics_info, statistics, ClientListAction, FILESYSTEM_LAYOUT, SESSION_MANAGER,
+    SETTINGS_UPDATED_NOTIFIER,
+};
 use alvr_common::{prelude::*, ALVR_VERSION};
 use alvr_session::ServerEvent;
 use bytes::Buf;
@@ -104,6 +107,7 @@ async fn http_api(
                     // HTTP Code: WARNING
                     reply(trace_err!(StatusCode::from_u16(199))?)?
                 } else {
+                    SETTINGS_UPDATED_NOTIFIER.notify_waiters();
                     reply(StatusCode::OK)?
                 }
             } else {
@@ -119,6 +123,7 @@ async fn http_api(
                         // HTTP Code: WARNING
                         reply(trace_err!(StatusCode::from_u16(199))?)?
                     } else {
+                        SETTINGS_UPDATED_NOTIFIER.notify_waiters();
                         reply(StatusCode::OK)?
                     }
                 } else {
@@ -128,6 +133,9 @@ async fn http_api(
                 reply(StatusCode::BAD_REQUEST)?
             }
         }
+        "/metrics" => trace_err!(Response::builder()
+            .header(CONTENT_TYPE, "text/plain; version=0.0.4")
+            .body(statistics::metrics_text().into()))?,
         "/api/log" => text_websocket(request, log_sender).await?,
         "/api/events" => text_websocket(request, events_sender).await?,
         "/api/driver/register" => {
@@ -173,6 +181,31 @@ async fn http_api(
                 .linux_backend,
         )?)?,
         "/api/graphics-devices" => reply_json(&graphics_info::get_gpu_names())?,
+        "/api/frame-trace/write" => {
+            if unsafe { crate::WriteFrameTrace() } {
+                reply(StatusCode::OK)?
+            } else {
+                reply(StatusCode::SERVICE_UNAVAILABLE)?
+            }
+        }
+        "/api/frame-capture/write" => {
+            if unsafe { crate::CaptureFrames() } {
+                reply(StatusCode::OK)?
+            } else {
+                reply(StatusCode::SERVICE_UNAVAILABLE)?
+            }
+        }
+        "/api/recording/start" => {
+            if unsafe { crate::StartRecording() } {
+                reply(StatusCode::OK)?
+            } else {
+                reply(StatusCode::SERVICE_UNAVAILABLE)?
+            }
+        }
+        "/api/recording/stop" => {
+            unsafe { crate::StopRecording() };
+            reply(StatusCode::OK)?
+        }
         "/restart-steamvr" => {
             crate::notify_restart_driver();
             reply(StatusCode::OK)?
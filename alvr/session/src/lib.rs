@@ -59,10 +59,45 @@ pub struct OpenvrConfig {
     pub enable_vive_tracker_proxy: bool,
     pub aggressive_keyframe_resend: bool,
     pub adapter_index: u32,
+    pub encoder_adapter_index: i32,
+    pub encoder_dedicated_device: bool,
     pub codec: u32,
     pub refresh_rate: u32,
     pub use_10bit_encoder: bool,
     pub sw_thread_count: u32,
+    pub sw_frame_threads: bool,
+    pub sw_intra_refresh: bool,
+    pub sw_pin_threads: bool,
+    pub sw_hold_frame_deadline: bool,
+    pub drop_late_frames: bool,
+    pub precise_vsync: bool,
+    pub idle_power_save: bool,
+    pub thread_realtime_priority: bool,
+    pub encoder_cpu_mask: u64,
+    pub vsync_cpu_mask: u64,
+    pub tracking_cpu_mask: u64,
+    pub present_cpu_mask: u64,
+    pub frame_capture_history: u32,
+    pub enable_encode_arbitration: bool,
+    pub encoder_max_sessions: u32,
+    pub concurrent_encodes: u32,
+    pub enable_vsync_phase_lock: bool,
+    pub vsync_queue_wait_target: u64,
+    pub slices_per_frame: u32,
+    pub intra_refresh_frames: u32,
+    pub reference_frame_invalidation: bool,
+    pub dual_stream_encoding: bool,
+    pub yuv_output: bool,
+    pub linux_swapchain_images: u32,
+    pub linux_early_present_notify: bool,
+    pub linux_layer_copy: bool,
+    pub linux_layer_async_copy: bool,
+    pub linux_encode_pipeline_depth: u32,
+    pub nvenc_pipeline_depth: u32,
+    pub nvenc_motion_hints: bool,
+    pub nvenc_inter_eye_hints: bool,
+    pub amf_pipeline_depth: u32,
+    pub amf_pre_analysis: bool,
     pub encode_bitrate_mbs: u64,
     pub enable_adaptive_bitrate: bool,
     pub bitrate_maximum: u64,
@@ -107,6 +142,11 @@ pub struct OpenvrConfig {
     pub foveation_center_shift_y: f32,
     pub foveation_edge_ratio_x: f32,
     pub foveation_edge_ratio_y: f32,
+    pub foveation_follow_gaze: bool,
+    pub enable_foveated_encoding: bool,
+    pub foveated_encoding_qp_offset: u32,
+    pub enable_dynamic_resolution: bool,
+    pub dynamic_resolution_minimum_scale: f32,
     pub enable_color_correction: bool,
     pub brightness: f32,
     pub contrast: f32,
@@ -114,6 +154,9 @@ pub struct OpenvrConfig {
     pub gamma: f32,
     pub sharpening: f32,
     pub enable_fec: bool,
+    pub fec_on_gpu: bool,
+    // Negotiated with the client
+    pub video_packet_size: u32,
     pub linux_async_reprojection: bool,
 }
 
@@ -163,11 +206,17 @@ impl Default for SessionDesc {
                 target_eye_resolution_height: 900,
                 seconds_from_vsync_to_photons: 0.005,
                 adapter_index: 0,
+                encoder_adapter_index: -1,
                 refresh_rate: 60,
                 controllers_enabled: false,
                 enable_foveated_rendering: false,
+                enable_foveated_encoding: false,
+                enable_dynamic_resolution: false,
                 enable_color_correction: false,
+                video_packet_size: 1400,
                 linux_async_reprojection: true,
+                linux_swapchain_images: 3,
+                linux_early_present_notify: true,
                 ..<_>::default()
             },
             client_connections: HashMap::new(),
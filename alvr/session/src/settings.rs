@@ -35,6 +35,17 @@ pub enum FrameSize {
     },
 }
 
+// Which decoded frame the client shows at each refresh
+#[derive(SettingsSchema, Serialize, Deserialize, Clone, Copy)]
+#[serde(rename_all = "camelCase", tag = "type", content = "content")]
+pub enum ClientPresentationMode {
+    // The newest decoded frame, the older ones are dropped
+    LatestWins,
+    // Frames wait in a queue of this many refreshes and are shown one per refresh
+    #[schema(min = 1, max = 3)]
+    TargetDepth(u32),
+}
+
 #[derive(SettingsSchema, Serialize, Deserialize, Clone)]
 pub enum MediacodecDataType {
     Float(f32),
@@ -85,6 +96,52 @@ pub struct AdaptiveBitrateDesc {
     pub bitrate_light_load_threshold: f32,
 }
 
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct VideoSendQueueDesc {
+    // Frames waiting for the socket before the oldest ones are dropped
+    #[schema(min = 1, max = 30, step = 1)]
+    pub max_frames: usize,
+
+    #[schema(min = 5, max = 500, step = 5)]
+    pub frame_deadline_ms: u64,
+}
+
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct VsyncPhaseLockDesc {
+    // Time frames should wait on the client between the decoder and the compositor, in us
+    #[schema(min = 0, max = 10000, step = 100)]
+    pub queue_wait_target: u64,
+}
+
+// Shares the hardware encoder of the GPU with the ALVR servers of the other SteamVR instances of
+// the machine. Windows only.
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct EncodeArbitrationDesc {
+    // Encoder sessions opened at once, the streams above it fail to start
+    #[schema(min = 1, max = 16)]
+    pub max_sessions: u32,
+
+    // Frames encoded at the same time, the earliest deadline first
+    #[schema(min = 1, max = 16)]
+    pub concurrent_encodes: u32,
+}
+
+// CPU masks have a bit per CPU, 0 leaves the threads on all the CPUs
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct ThreadPolicyDesc {
+    pub realtime_priority: bool,
+    pub encoder_cpu_mask: u64,
+    pub vsync_cpu_mask: u64,
+    pub tracking_cpu_mask: u64,
+    // Page flip thread of the Vulkan layer, Linux only
+    pub present_cpu_mask: u64,
+    pub network_cpu_mask: u64,
+}
+
 #[derive(SettingsSchema, Serialize, Deserialize)]
 #[serde(rename_all = "camelCase")]
 pub struct FoveatedRenderingDesc {
@@ -105,6 +162,43 @@ pub struct FoveatedRenderingDesc {
 
     #[schema(min = 1., max = 10., step = 1.)]
     pub edge_ratio_y: f32,
+
+    #[schema(advanced)]
+    pub single_pass_decompression: bool,
+
+    #[schema(advanced)]
+    pub direct_compositor_layer: bool,
+
+    // Moves the center to the eye gaze of each frame, for headsets that send it
+    pub follow_gaze: bool,
+}
+
+// Coarser quantization away from the foveation center of foveated_rendering, without resampling
+// the frame. Works with or without foveated_rendering enabled.
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct FoveatedEncodingDesc {
+    // QP offset at the frame edges, it ramps up from 0 at the foveation center
+    #[schema(min = 1, max = 20)]
+    pub periphery_qp_offset: u32,
+}
+
+// Lowers the resolution of the encoded frames while the encoder is overloaded or the bitrate is
+// well below encode_bitrate_mbs, without resizing the stream
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct DynamicResolutionDesc {
+    #[schema(min = 0.5, max = 0.9, step = 0.1)]
+    pub minimum_scale: f32,
+}
+
+// Upscales the stream to the display resolution on the client with edge adaptive filtering and
+// sharpening, for a server encoding below the display resolution
+#[derive(SettingsSchema, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct ClientUpscalingDesc {
+    #[schema(min = 0., max = 1., step = 0.05)]
+    pub sharpness: f32,
 }
 
 #[derive(SettingsSchema, Clone, Copy, Serialize, Deserialize, Pod, Zeroable)]
@@ -136,6 +230,7 @@ pub struct ColorCorrectionDesc {
 pub enum CodecType {
     H264,
     HEVC,
+    AV1,
 }
 
 #[derive(SettingsSchema, Serialize, Deserialize)]
@@ -144,6 +239,12 @@ pub struct VideoDesc {
     #[schema(advanced)]
     pub adapter_index: u32,
 
+    #[schema(advanced, min = -1, max = 15)]
+    pub encoder_adapter_index: i32,
+
+    #[schema(advanced)]
+    pub encoder_dedicated_device: bool,
+
     // Dropdown with 25%, 50%, 75%, 100%, 125%, 150% etc or custom
     // Should set renderResolution (always in scale mode).
     // When the user sets a resolution not obtainable with the preset scales, set the dropdown to
@@ -162,6 +263,11 @@ pub struct VideoDesc {
     #[schema(advanced)]
     pub preferred_fps: f32,
 
+    // The server renders and encodes every other display frame. The headset shows each frame for
+    // two refreshes, the compositor only corrects the head rotation of the second one.
+    #[schema(advanced)]
+    pub half_rate_streaming: bool,
+
     pub codec: CodecType,
 
     // #[schema(advanced)]
@@ -169,11 +275,87 @@ pub struct VideoDesc {
     #[schema(advanced)]
     pub client_request_realtime_decoder: bool,
 
+    #[schema(advanced)]
+    pub client_native_decoder: bool,
+
+    #[schema(advanced)]
+    pub client_image_reader: bool,
+
+    #[schema(advanced)]
+    pub client_vulkan_stream_pass: bool,
+
+    #[schema(advanced)]
+    pub client_early_decode: bool,
+
+    #[schema(advanced)]
+    pub client_presentation_mode: ClientPresentationMode,
+
     pub use_10bit_encoder: bool,
 
     #[schema(advanced)]
     pub sw_thread_count: u32,
 
+    #[schema(advanced)]
+    pub sw_frame_threads: bool,
+
+    #[schema(advanced)]
+    pub sw_intra_refresh: bool,
+
+    #[schema(advanced)]
+    pub sw_pin_threads: bool,
+
+    #[schema(advanced)]
+    pub sw_hold_frame_deadline: bool,
+
+    // Frames expected on the client after their display time are not encoded
+    #[schema(advanced)]
+    pub drop_late_frames: bool,
+
+    #[schema(advanced, min = 1, max = 16)]
+    pub slices_per_frame: u32,
+
+    #[schema(advanced, min = 0, max = 120)]
+    pub intra_refresh_frames: u32,
+
+    #[schema(advanced)]
+    pub reference_frame_invalidation: bool,
+
+    #[schema(advanced)]
+    pub dual_stream_encoding: bool,
+
+    #[schema(advanced)]
+    pub yuv_output: bool,
+
+    #[schema(advanced, min = 2, max = 4)]
+    pub linux_swapchain_images: u32,
+
+    #[schema(advanced)]
+    pub linux_early_present_notify: bool,
+
+    #[schema(advanced)]
+    pub linux_layer_copy: bool,
+
+    #[schema(advanced)]
+    pub linux_layer_async_copy: bool,
+
+    #[schema(advanced, min = 0, max = 4)]
+    pub linux_encode_pipeline_depth: u32,
+
+    #[schema(advanced, min = 0, max = 4)]
+    pub nvenc_pipeline_depth: u32,
+
+    #[schema(advanced)]
+    pub nvenc_motion_hints: bool,
+
+    #[schema(advanced)]
+    pub nvenc_inter_eye_hints: bool,
+
+    #[schema(advanced, min = 1, max = 4)]
+    pub amf_pipeline_depth: u32,
+
+    #[schema(advanced)]
+    pub amf_pre_analysis: bool,
+
     #[schema(min = 1, max = 500)]
     pub encode_bitrate_mbs: u64,
 
@@ -182,7 +364,32 @@ pub struct VideoDesc {
     #[schema(advanced)]
     pub seconds_from_vsync_to_photons: f32,
 
+    #[schema(advanced)]
+    pub precise_vsync: bool,
+
+    #[schema(advanced)]
+    pub idle_power_save: bool,
+
+    #[schema(advanced)]
+    pub vsync_phase_lock: Switch<VsyncPhaseLockDesc>,
+
+    #[schema(advanced)]
+    pub send_queue: Switch<VideoSendQueueDesc>,
+
+    #[schema(advanced)]
+    pub thread_policy: ThreadPolicyDesc,
+
+    // Frames kept in memory for the capture from the dashboard, Windows only
+    #[schema(advanced, min = 0, max = 300)]
+    pub frame_capture_history: u32,
+
+    #[schema(advanced)]
+    pub encode_arbitration: Switch<EncodeArbitrationDesc>,
+
     pub foveated_rendering: Switch<FoveatedRenderingDesc>,
+    pub foveated_encoding: Switch<FoveatedEncodingDesc>,
+    pub dynamic_resolution: Switch<DynamicResolutionDesc>,
+    pub client_upscaling: Switch<ClientUpscalingDesc>,
     pub color_correction: Switch<ColorCorrectionDesc>,
 }
 
@@ -195,14 +402,34 @@ pub enum AudioDeviceId {
     Index(u64),
 }
 
-#[derive(SettingsSchema, Serialize, Deserialize)]
+// Opus only applies to the sample rates it supports, other streams stay in PCM
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase", tag = "type", content = "content")]
+pub enum AudioCodec {
+    Pcm,
+    Opus {
+        #[schema(min = 10, max = 20, step = 10)]
+        frame_ms: u32,
+        #[schema(min = 16, max = 256)]
+        bitrate_kbps: u32,
+    },
+}
+
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
 #[serde(rename_all = "camelCase")]
 pub struct AudioConfig {
+    // Upper bound of the buffering with adaptive_buffering
     #[schema(min = 0, max = 200)]
     pub average_buffering_ms: u64,
 
+    // Buffer just enough for the jitter of the recent packets
+    pub adaptive_buffering: bool,
+
     #[schema(advanced, min = 1, max = 20)]
     pub batch_ms: u64,
+
+    #[schema(advanced)]
+    pub codec: AudioCodec,
 }
 
 #[derive(SettingsSchema, Serialize, Deserialize)]
@@ -397,6 +624,10 @@ pub struct HeadsetDesc {
     #[schema(advanced)]
     pub tracking_frame_offset: i32,
 
+    // Tracking samples sent per display frame
+    #[schema(advanced, min = 1, max = 8, step = 1)]
+    pub tracking_rate_multiplier: u32,
+
     #[schema(advanced)]
     pub position_offset: [f32; 3],
 
@@ -413,6 +644,31 @@ pub struct HeadsetDesc {
 
     #[schema(advanced)]
     pub extra_latency_mode: bool,
+
+    // Binary trace of the network, decoder and render events of every frame on the headset
+    #[schema(advanced)]
+    pub client_frame_events: bool,
+}
+
+#[derive(SettingsSchema, Serialize, Deserialize, Clone, Copy)]
+#[serde(rename_all = "camelCase", tag = "type", content = "content")]
+pub enum KernelPacing {
+    Disabled,
+    // Departure times on the monotonic clock, for the fq qdisc
+    Fq,
+    // Departure times on the TAI clock, for the etf qdisc
+    Etf,
+}
+
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase")]
+pub struct FramePacingDesc {
+    // The packets of a video frame are spread over this fraction of the frame interval
+    #[schema(min = 0.05, max = 1., step = 0.05)]
+    pub frame_interval_fraction: f32,
+
+    // Linux only, the kernel sends each packet at its departure time (SO_TXTIME)
+    pub kernel_pacing: KernelPacing,
 }
 
 #[derive(SettingsSchema, Serialize, Deserialize, Clone)]
@@ -425,11 +681,88 @@ pub enum SocketProtocol {
     ThrottledUdp {
         #[schema(min = 1.0, step = 0.1, gui = "UpDown")]
         bitrate_multiplier: f32,
+
+        frame_pacing: Switch<FramePacingDesc>,
     },
 
     Tcp,
 }
 
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase")]
+pub struct NetworkBandwidthLimitDesc {
+    #[schema(min = 1, max = 1000, step = 1)]
+    pub bitrate_mbs: u64,
+
+    // Packets that would wait longer than this for the link are dropped
+    #[schema(min = 1, max = 500, step = 1)]
+    pub queue_limit_ms: u64,
+}
+
+// The client is connected with a cable, USB tethering, USB Ethernet or an ADB forward (TCP), which
+// does not lose packets. The video is sent without FEC in large packets, and the adaptive bitrate
+// can go far above what Wi-Fi carries.
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase")]
+pub struct WiredLinkDesc {
+    // Replaces video_packet_size. Over UDP the kernel fragments the larger datagrams.
+    #[schema(min = 1400, max = 65000, step = 100)]
+    pub video_packet_size: u32,
+
+    // Replaces the maximum of the adaptive bitrate
+    #[schema(min = 10, max = 2000, step = 10)]
+    pub bitrate_maximum: u64,
+}
+
+// The video is also sent to a second address of the client, over another link such as USB
+// tethering or a second Wi-Fi band. UDP only.
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase")]
+pub struct VideoMultipathDesc {
+    pub secondary_client_ip: String,
+}
+
+// The video is also sent to spectators, without encoding it again. Addresses are separated by
+// commas, either an IP, which receives on the stream port, or an IP and a port. A multicast group
+// address reaches all the spectators of the LAN with one send. UDP only.
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase")]
+pub struct VideoSpectatorsDesc {
+    pub addresses: String,
+}
+
+// Testing aid, applied to the packets the server sends
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase")]
+pub struct NetworkImpairmentDesc {
+    // Gilbert-Elliott loss model, probabilities are per packet
+    #[schema(min = 0., max = 1., step = 0.001)]
+    pub good_to_bad_probability: f32,
+
+    #[schema(min = 0., max = 1., step = 0.01)]
+    pub bad_to_good_probability: f32,
+
+    #[schema(min = 0., max = 1., step = 0.001)]
+    pub good_loss_probability: f32,
+
+    #[schema(min = 0., max = 1., step = 0.01)]
+    pub bad_loss_probability: f32,
+
+    #[schema(min = 0, max = 500, step = 1)]
+    pub base_delay_ms: u64,
+
+    #[schema(min = 0, max = 100, step = 1)]
+    pub jitter_ms: u64,
+
+    #[schema(min = 0., max = 1., step = 0.001)]
+    pub reorder_probability: f32,
+
+    #[schema(min = 0, max = 100, step = 1)]
+    pub reorder_delay_ms: u64,
+
+    pub bandwidth_limit: Switch<NetworkBandwidthLimitDesc>,
+}
+
 #[derive(SettingsSchema, Serialize, Deserialize, Clone)]
 #[serde(rename_all = "camelCase")]
 pub struct DiscoveryConfig {
@@ -445,6 +778,17 @@ pub enum SocketBufferSize {
     Custom(u32),
 }
 
+// Payload bytes of each video packet. The server resolves it when a client connects, the client
+// receives the value as Custom.
+#[derive(SettingsSchema, Serialize, Deserialize, Clone)]
+#[serde(rename_all = "camelCase", tag = "type", content = "content")]
+pub enum VideoPacketSize {
+    Default,
+    // Largest payload that fits the path MTU reported by the client
+    PathMtu,
+    Custom(u32),
+}
+
 #[derive(SettingsSchema, Serialize, Deserialize, Clone)]
 #[serde(rename_all = "camelCase")]
 pub struct ConnectionDesc {
@@ -467,6 +811,14 @@ pub struct ConnectionDesc {
     #[schema(advanced)]
     pub client_recv_buffer_bytes: SocketBufferSize,
 
+    // Microseconds the client spins on the stream socket before sleeping, 0 to disable
+    #[schema(advanced, min = 0, max = 200, step = 10)]
+    pub client_busy_poll_us: u32,
+
+    // Write the video packets straight into the FEC buffers of the Android client. UDP only.
+    #[schema(advanced)]
+    pub client_zero_copy_receive: bool,
+
     #[schema(advanced)]
     pub stream_port: u16,
 
@@ -481,6 +833,28 @@ pub struct ConnectionDesc {
 
     #[schema(advanced)]
     pub enable_fec: bool,
+
+    #[schema(advanced)]
+    pub fec_on_gpu: bool,
+
+    #[schema(advanced)]
+    pub video_packet_size: VideoPacketSize,
+
+    pub wired_link: Switch<WiredLinkDesc>,
+
+    #[schema(advanced)]
+    pub video_multipath: Switch<VideoMultipathDesc>,
+
+    #[schema(advanced)]
+    pub video_spectators: Switch<VideoSpectatorsDesc>,
+
+    // The client acknowledges every stream packet with its arrival time. The bitrate is then
+    // estimated from the delivery of the packets instead of one report per frame. UDP only.
+    #[schema(advanced)]
+    pub transport_feedback: bool,
+
+    #[schema(advanced)]
+    pub network_impairment: Switch<NetworkImpairmentDesc>,
 }
 
 #[derive(SettingsSchema, Serialize, Deserialize, Clone, Copy, PartialEq, Eq)]
@@ -540,6 +914,8 @@ pub fn session_settings_default() -> SettingsDefault {
     SettingsDefault {
         video: VideoDescDefault {
             adapter_index: 0,
+            encoder_adapter_index: -1,
+            encoder_dedicated_device: false,
             render_resolution: FrameSizeDefault {
                 variant: FrameSizeDefaultVariant::Scale,
                 Scale: 0.75,
@@ -557,6 +933,7 @@ pub fn session_settings_default() -> SettingsDefault {
                 },
             },
             preferred_fps: 72.,
+            half_rate_streaming: false,
             codec: CodecTypeDefault {
                 variant: CodecTypeDefaultVariant::H264,
             },
@@ -587,8 +964,36 @@ pub fn session_settings_default() -> SettingsDefault {
             //     },
             // },
             client_request_realtime_decoder: true,
+            client_native_decoder: false,
+            client_image_reader: false,
+            client_vulkan_stream_pass: false,
+            client_early_decode: false,
+            client_presentation_mode: ClientPresentationModeDefault {
+                variant: ClientPresentationModeDefaultVariant::LatestWins,
+                TargetDepth: 1,
+            },
             use_10bit_encoder: false,
             sw_thread_count: 0,
+            sw_frame_threads: false,
+            sw_intra_refresh: false,
+            sw_pin_threads: false,
+            sw_hold_frame_deadline: false,
+            drop_late_frames: true,
+            slices_per_frame: 1,
+            intra_refresh_frames: 0,
+            reference_frame_invalidation: true,
+            dual_stream_encoding: false,
+            yuv_output: false,
+            linux_swapchain_images: 3,
+            linux_early_present_notify: true,
+            linux_layer_copy: false,
+            linux_layer_async_copy: true,
+            linux_encode_pipeline_depth: 0,
+            nvenc_pipeline_depth: 0,
+            nvenc_motion_hints: true,
+            nvenc_inter_eye_hints: true,
+            amf_pipeline_depth: 2,
+            amf_pre_analysis: false,
             encode_bitrate_mbs: 30,
             adaptive_bitrate: SwitchDefault {
                 enabled: true,
@@ -609,6 +1014,37 @@ pub fn session_settings_default() -> SettingsDefault {
                 },
             },
             seconds_from_vsync_to_photons: 0.005,
+            precise_vsync: true,
+            idle_power_save: false,
+            vsync_phase_lock: SwitchDefault {
+                enabled: true,
+                content: VsyncPhaseLockDescDefault {
+                    queue_wait_target: 2000,
+                },
+            },
+            send_queue: SwitchDefault {
+                enabled: true,
+                content: VideoSendQueueDescDefault {
+                    max_frames: 4,
+                    frame_deadline_ms: 50,
+                },
+            },
+            thread_policy: ThreadPolicyDescDefault {
+                realtime_priority: true,
+                encoder_cpu_mask: 0,
+                vsync_cpu_mask: 0,
+                tracking_cpu_mask: 0,
+                present_cpu_mask: 0,
+                network_cpu_mask: 0,
+            },
+            frame_capture_history: 0,
+            encode_arbitration: SwitchDefault {
+                enabled: false,
+                content: EncodeArbitrationDescDefault {
+                    max_sessions: 3,
+                    concurrent_encodes: 1,
+                },
+            },
             foveated_rendering: SwitchDefault {
                 enabled: !cfg!(target_os = "linux"),
                 content: FoveatedRenderingDescDefault {
@@ -618,8 +1054,25 @@ pub fn session_settings_default() -> SettingsDefault {
                     center_shift_y: 0.1,
                     edge_ratio_x: 4.,
                     edge_ratio_y: 5.,
+                    single_pass_decompression: false,
+                    direct_compositor_layer: false,
+                    follow_gaze: false,
                 },
             },
+            foveated_encoding: SwitchDefault {
+                enabled: false,
+                content: FoveatedEncodingDescDefault {
+                    periphery_qp_offset: 8,
+                },
+            },
+            dynamic_resolution: SwitchDefault {
+                enabled: false,
+                content: DynamicResolutionDescDefault { minimum_scale: 0.6 },
+            },
+            client_upscaling: SwitchDefault {
+                enabled: false,
+                content: ClientUpscalingDescDefault { sharpness: 0.5 },
+            },
             color_correction: SwitchDefault {
                 enabled: true,
                 content: ColorCorrectionDescDefault {
@@ -646,7 +1099,15 @@ pub fn session_settings_default() -> SettingsDefault {
                     mute_when_streaming: true,
                     config: AudioConfigDefault {
                         average_buffering_ms: 50,
+                        adaptive_buffering: true,
                         batch_ms: 10,
+                        codec: AudioCodecDefault {
+                            variant: AudioCodecDefaultVariant::Pcm,
+                            Opus: AudioCodecOpusDefault {
+                                frame_ms: 10,
+                                bitrate_kbps: 128,
+                            },
+                        },
                     },
                 },
             },
@@ -667,7 +1128,15 @@ pub fn session_settings_default() -> SettingsDefault {
                     sample_rate: 44100,
                     config: AudioConfigDefault {
                         average_buffering_ms: 50,
+                        adaptive_buffering: true,
                         batch_ms: 10,
+                        codec: AudioCodecDefault {
+                            variant: AudioCodecDefaultVariant::Pcm,
+                            Opus: AudioCodecOpusDefault {
+                                frame_ms: 10,
+                                bitrate_kbps: 64,
+                            },
+                        },
                     },
                 },
             },
@@ -683,6 +1152,7 @@ pub fn session_settings_default() -> SettingsDefault {
             render_model_name: "generic_hmd".into(),
             registered_device_type: "oculus/1WMGH000XX0000".into(),
             tracking_frame_offset: 0,
+            tracking_rate_multiplier: 4,
             position_offset: [0., 0., 0.],
             force_3dof: false,
             tracking_ref_only: false,
@@ -717,6 +1187,7 @@ pub fn session_settings_default() -> SettingsDefault {
                 },
             },
             extra_latency_mode: false,
+            client_frame_events: false,
         },
         connection: ConnectionDescDefault {
             client_discovery: SwitchDefault {
@@ -734,6 +1205,15 @@ pub fn session_settings_default() -> SettingsDefault {
                 },
                 ThrottledUdp: SocketProtocolThrottledUdpDefault {
                     bitrate_multiplier: 1.5,
+                    frame_pacing: SwitchDefault {
+                        enabled: true,
+                        content: FramePacingDescDefault {
+                            frame_interval_fraction: 0.5,
+                            kernel_pacing: KernelPacingDefault {
+                                variant: KernelPacingDefaultVariant::Disabled,
+                            },
+                        },
+                    },
                 },
             },
             server_send_buffer_bytes: SocketBufferSizeDefault {
@@ -752,11 +1232,58 @@ pub fn session_settings_default() -> SettingsDefault {
                 Custom: 100000,
                 variant: SocketBufferSizeDefaultVariant::Maximum,
             },
+            client_busy_poll_us: 0,
+            client_zero_copy_receive: false,
             stream_port: 9944,
             aggressive_keyframe_resend: false,
             on_connect_script: "".into(),
             on_disconnect_script: "".into(),
             enable_fec: true,
+            fec_on_gpu: false,
+            video_packet_size: VideoPacketSizeDefault {
+                Custom: 1400,
+                variant: VideoPacketSizeDefaultVariant::Default,
+            },
+            wired_link: SwitchDefault {
+                enabled: false,
+                content: WiredLinkDescDefault {
+                    video_packet_size: 16000,
+                    bitrate_maximum: 800,
+                },
+            },
+            video_multipath: SwitchDefault {
+                enabled: false,
+                content: VideoMultipathDescDefault {
+                    secondary_client_ip: "".into(),
+                },
+            },
+            video_spectators: SwitchDefault {
+                enabled: false,
+                content: VideoSpectatorsDescDefault {
+                    addresses: "".into(),
+                },
+            },
+            transport_feedback: false,
+            network_impairment: SwitchDefault {
+                enabled: false,
+                content: NetworkImpairmentDescDefault {
+                    good_to_bad_probability: 0.002,
+                    bad_to_good_probability: 0.3,
+                    good_loss_probability: 0.001,
+                    bad_loss_probability: 0.5,
+                    base_delay_ms: 0,
+                    jitter_ms: 0,
+                    reorder_probability: 0.,
+                    reorder_delay_ms: 2,
+                    bandwidth_limit: SwitchDefault {
+                        enabled: false,
+                        content: NetworkBandwidthLimitDescDefault {
+                            bitrate_mbs: 100,
+                            queue_limit_ms: 50,
+                        },
+                    },
+                },
+            },
         },
         extra: ExtraDescDefault {
             theme: ThemeDefault {
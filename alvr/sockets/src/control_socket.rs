@@ -1,4 +1,7 @@
-use super::{Ldc, CONTROL_PORT, LOCAL_IP};
+use super::{
+    stream_socket::qos::{self, AccessCategory},
+    Ldc, CONTROL_PORT, LOCAL_IP,
+};
 use alvr_common::prelude::*;
 use bytes::Bytes;
 use futures::{
@@ -63,6 +66,8 @@ impl ProtoControlSocket {
         };
 
         trace_err!(socket.set_nodelay(true))?;
+        // Carries the time sync packets
+        qos::set_access_category(&socket2::SockRef::from(&socket), AccessCategory::Voice);
         let peer_ip = trace_err!(socket.peer_addr())?.ip();
         let socket = Framed::new(socket, Ldc::new());
 
@@ -1,17 +1,22 @@
-use std::{collections::HashMap, time::Duration};
+use std::{collections::HashMap, net::IpAddr, time::Duration};
 
-use crate::StreamId;
+use crate::{StreamId, TransportFeedback, PATH_COUNT};
 use alvr_common::{
     glam::{Quat, Vec2, Vec3},
     semver::Version,
 };
 use alvr_session::Fov;
-use serde::{Deserialize, Serialize};
+use serde::{Deserialize, Deserializer, Serialize, Serializer};
 
 pub const INPUT: StreamId = 0; // tracking and buttons
 pub const HAPTICS: StreamId = 1;
 pub const AUDIO: StreamId = 2;
 pub const VIDEO: StreamId = 3;
+// Sent to the server by the spectators of the video, see fanout.rs
+pub const SPECTATOR_REPORT: StreamId = 4;
+// TimeSyncPacket in both directions. The measured round trips take the path of the video instead
+// of waiting behind the retransmissions of the control socket.
+pub const TIME_SYNC: StreamId = 5;
 
 #[derive(Serialize, Deserialize, Clone)]
 pub struct ClientHandshakePacket {
@@ -45,6 +50,11 @@ pub struct HeadsetInfoPacket {
     pub recommended_eye_height: u32,
     pub available_refresh_rates: Vec<f32>,
     pub preferred_refresh_rate: f32,
+    // MTU of the route to the server, 0 if the client only supports the default video packet size
+    pub path_mtu: u32,
+    // Token of the last stream received with ClientConfigPacket, 0 if there is none. The server
+    // resumes that stream if it still holds it.
+    pub resume_token: u64,
 
     // reserved field is used to add features in a minor release that otherwise would break the
     // packets schema
@@ -59,6 +69,10 @@ pub struct ClientConfigPacket {
     pub eye_resolution_height: u32,
     pub fps: f32,
     pub game_audio_sample_rate: u32,
+    // Sent back with HeadsetInfoPacket on reconnection
+    pub resume_token: u64,
+    // Address of the server on the second link of the video, if the stream socket is multipath
+    pub secondary_server_ip: Option<IpAddr>,
     pub reserved: String,
     pub server_version: Option<Version>,
 }
@@ -69,10 +83,20 @@ pub enum ServerControlPacket {
     Restarting,
     KeepAlive,
     TimeSync(TimeSyncPacket), // legacy
+    VideoConfig(VideoConfigPacket),
     Reserved(String),
     ReservedBuffer(Vec<u8>),
 }
 
+// Parameter sets of a video stream with their start codes, sent at stream start and whenever a
+// keyframe brings new ones. The client configures its decoder with them before the first keyframe
+// arrived.
+#[derive(Serialize, Deserialize, Clone)]
+pub struct VideoConfigPacket {
+    pub stream_index: u8,
+    pub config: Vec<u8>,
+}
+
 #[derive(Serialize, Deserialize, Clone)]
 pub struct ViewsConfig {
     // Note: the head-to-eye transform is always a translation along the x axis
@@ -97,12 +121,29 @@ pub enum ClientControlPacket {
     Battery(BatteryPacket),
     TimeSync(TimeSyncPacket), // legacy
     VideoErrorReport,         // legacy
+    // Index of the last video frame decoded correctly, the lost ones come after it
+    VideoFrameLoss(u64),
+    // Datagrams received from each address of the server, sent every second if the stream socket
+    // is multipath
+    PathReception([u64; PATH_COUNT]),
+    // Arrivals of the stream packets, sent every FEEDBACK_INTERVAL if transport feedback is enabled
+    TransportFeedback(TransportFeedback),
     Reserved(String),
     ReservedBuffer(Vec<u8>),
 }
 
+// Sent every second by a spectator on the SPECTATOR_REPORT stream. The counts are of the video
+// packets since the spectator started, its losses are the gaps in their packet indices.
+#[derive(Serialize, Deserialize, Clone, Copy, Default)]
+pub struct SpectatorReport {
+    pub packets_received: u64,
+    pub packets_lost: u64,
+    // The decoder lost its references and waits for a keyframe
+    pub request_idr: bool,
+}
+
 // legacy video packet
-#[derive(Serialize, Deserialize, Clone)]
+#[derive(Serialize, Deserialize, Clone, Default)]
 pub struct VideoFrameHeaderPacket {
     pub packet_counter: u32,
     pub tracking_frame_index: u64,
@@ -111,6 +152,21 @@ pub struct VideoFrameHeaderPacket {
     pub frame_byte_size: u32,
     pub fec_index: u32,
     pub fec_percentage: u16,
+    pub stream_index: u8,
+    pub content_scale: u8,
+    // Foveation center shift of the frame, see VideoFrame in the server bindings.h
+    pub foveation_center: [i8; 4],
+    // Slice of the frame, a FEC block of its own, see VideoFrame in the server bindings.h. The
+    // count is 0 before the last slice.
+    pub slice_index: u8,
+    pub slice_count: u8,
+}
+
+#[derive(Serialize, Deserialize, Clone, Default)]
+pub struct AudioPacketHeader {
+    // Capture time of the first sample of the packet on the sender clock, in us since the epoch
+    // like the TimeSync timestamps
+    pub capture_time_us: u64,
 }
 
 // legacy time sync packet
@@ -129,6 +185,25 @@ pub struct TimeSyncPacket {
     pub fec_failure_in_second: u64,
     pub fec_failure_total: u64,
     pub fps: f32,
+    pub prediction_error_rotation: f32,
+    pub prediction_error_position: f32,
+    pub prediction_horizon: u32,
+    pub prediction_residual: i32,
+    pub fec_recovery_time: u32,
+    pub gpu_time_ffr: u32,
+    pub gpu_time_eyes: u32,
+    pub trace_frame_index: u64,
+    pub trace_tracking: u64,
+    pub trace_received_first: u64,
+    pub trace_received_last: u64,
+    pub trace_decoder_input: u64,
+    pub trace_decoder_output: u64,
+    pub trace_rendered: u64,
+    pub trace_submit: u64,
+    pub arrival_frame_index: u64,
+    pub arrival_first: u64,
+    pub arrival_last: u64,
+    pub arrival_packets: u32,
     pub server_total_latency: u32,
     pub tracking_recv_frame_index: u64,
 }
@@ -141,6 +216,7 @@ pub enum ButtonValue {
 
 #[derive(Serialize, Deserialize, Clone)]
 pub struct MotionData {
+    #[serde(with = "compact_quat")]
     pub orientation: Quat,
     pub position: Vec3,
     pub linear_velocity: Option<Vec3>,
@@ -153,7 +229,8 @@ pub struct HandTrackingInput {
     pub skeleton_motion: Vec<MotionData>,
 }
 
-#[derive(Serialize, Deserialize, Default)]
+// Serialized as CompactController
+#[derive(Default)]
 pub struct LegacyController {
     pub bone_rotations: [Quat; 19],
     pub bone_positions_base: [Vec3; 19],
@@ -167,6 +244,140 @@ pub struct LegacyController {
     pub is_hand: bool,
 }
 
+// Tracking is sent at the tracking rate, so its wire format is compact. A controller that is off
+// only costs its presence tag and the skeleton is only sent for hands. Quaternions are quantized
+// with the smallest three encoding: the largest component is dropped, it is recovered from the unit
+// norm, and the other three lie in [-1/sqrt(2), 1/sqrt(2)].
+
+// Largest component index in the top bits, then the other three components
+fn pack_quat(quat: Quat, bits: u32) -> u64 {
+    let components = quat.to_array();
+    let largest = (0..4)
+        .max_by(|&a, &b| components[a].abs().total_cmp(&components[b].abs()))
+        .unwrap();
+    let sign = if components[largest] < 0. { -1. } else { 1. };
+    let max = ((1_u64 << bits) - 1) as f32;
+
+    let mut packed = largest as u64;
+    for (index, component) in components.iter().enumerate() {
+        if index != largest {
+            let normalized =
+                (component * sign * std::f32::consts::FRAC_1_SQRT_2 + 0.5).clamp(0., 1.);
+            packed = (packed << bits) | (normalized * max).round() as u64;
+        }
+    }
+
+    packed
+}
+
+fn unpack_quat(packed: u64, bits: u32) -> Quat {
+    let mask = (1_u64 << bits) - 1;
+    let largest = ((packed >> (3 * bits)) & 3) as usize;
+
+    let mut components = [0_f32; 4];
+    let mut shift = 3 * bits;
+    let mut sum_squares = 0.;
+    for (index, component) in components.iter_mut().enumerate() {
+        if index != largest {
+            shift -= bits;
+            let normalized = ((packed >> shift) & mask) as f32 / mask as f32;
+            *component = (normalized - 0.5) * std::f32::consts::SQRT_2;
+            sum_squares += *component * *component;
+        }
+    }
+    components[largest] = (1. - sum_squares).max(0.).sqrt();
+
+    Quat::from_array(components).normalize()
+}
+
+// At most 4e-6 rad of error, below the noise of the tracking
+mod compact_quat {
+    use super::*;
+
+    const BITS: u32 = 20;
+
+    pub fn serialize<S: Serializer>(quat: &Quat, serializer: S) -> Result<S::Ok, S::Error> {
+        pack_quat(*quat, BITS).serialize(serializer)
+    }
+
+    pub fn deserialize<'de, D: Deserializer<'de>>(deserializer: D) -> Result<Quat, D::Error> {
+        Ok(unpack_quat(u64::deserialize(deserializer)?, BITS))
+    }
+}
+
+// At most 4e-3 rad of error, finger bones do not need more
+const BONE_QUAT_BITS: u32 = 10;
+
+#[derive(Serialize, Deserialize)]
+struct CompactHand {
+    bone_rotations: [u32; 19],
+    bone_positions_base: [Vec3; 19],
+    hand_finger_confience: u32,
+}
+
+#[derive(Serialize, Deserialize)]
+struct CompactControllerState {
+    joystick_position: Vec2,
+    trackpad_position: Vec2,
+    buttons: u64,
+    trigger_value: f32,
+    grip_value: f32,
+    hand: Option<CompactHand>,
+}
+
+// None when the controller is disabled
+type CompactController = Option<CompactControllerState>;
+
+impl Serialize for LegacyController {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let compact: CompactController = self.enabled.then(|| CompactControllerState {
+            joystick_position: self.joystick_position,
+            trackpad_position: self.trackpad_position,
+            buttons: self.buttons,
+            trigger_value: self.trigger_value,
+            grip_value: self.grip_value,
+            hand: self.is_hand.then(|| CompactHand {
+                bone_rotations: self
+                    .bone_rotations
+                    .map(|quat| pack_quat(quat, BONE_QUAT_BITS) as u32),
+                bone_positions_base: self.bone_positions_base,
+                hand_finger_confience: self.hand_finger_confience,
+            }),
+        });
+
+        compact.serialize(serializer)
+    }
+}
+
+impl<'de> Deserialize<'de> for LegacyController {
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+        let state = match CompactController::deserialize(deserializer)? {
+            Some(state) => state,
+            None => return Ok(Self::default()),
+        };
+
+        let mut controller = LegacyController {
+            joystick_position: state.joystick_position,
+            trackpad_position: state.trackpad_position,
+            buttons: state.buttons,
+            trigger_value: state.trigger_value,
+            grip_value: state.grip_value,
+            enabled: true,
+            ..Default::default()
+        };
+        if let Some(hand) = state.hand {
+            controller.bone_rotations = hand
+                .bone_rotations
+                .map(|packed| unpack_quat(packed as u64, BONE_QUAT_BITS));
+            controller.bone_positions_base = hand.bone_positions_base;
+            controller.hand_finger_confience = hand.hand_finger_confience;
+            controller.is_hand = true;
+        }
+
+        Ok(controller)
+    }
+}
+
 #[derive(Serialize, Deserialize, Default)]
 pub struct LegacyInput {
     pub controllers: [LegacyController; 2],
@@ -178,6 +389,8 @@ pub struct Input {
     pub legacy: LegacyInput,
     pub device_motions: Vec<(u64, MotionData)>,
     pub target_timestamp: Duration,
+    // Gaze of the eyes relative to the head, -Z forward, from headsets with eye tracking
+    pub eye_gaze: Option<Quat>,
     // pub left_hand_tracking: Option<HandTrackingInput>, // unused for now
     // pub right_hand_tracking: Option<HandTrackingInput>, // unused for now
     // pub button_values: HashMap<u64, ButtonValue>,      // unused for now
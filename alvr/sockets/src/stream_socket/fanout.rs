@@ -0,0 +1,156 @@
+// The video of the client is also sent to spectators, encoded and packetized once: the datagrams
+// of each frame, FEC parity included, go to the client and then to every spectator address from the
+// same batch. The address of a multicast group serves any number of spectators on the LAN with one
+// send, the default multicast TTL of 1 keeps it there. Only the UDP socket supports it.
+//
+// Spectators send a SpectatorReport to the stream port every second, framed like a packet of the
+// SPECTATOR_REPORT stream. The worst loss among them raises the FEC percentage like the loss of the
+// client does, and their keyframe requests are forwarded. Reports are accepted from the configured
+// unicast spectators and, if there is a multicast group, from up to MAX_REPORTERS of its members.
+
+use crate::{SpectatorReport, SPECTATOR_REPORT};
+use bytes::Buf;
+use std::{
+    collections::HashMap,
+    net::SocketAddr,
+    sync::Mutex,
+    time::{Duration, Instant},
+};
+
+const MAX_REPORTERS: usize = 32;
+// A spectator that stopped reporting no longer counts
+const REPORTER_TIMEOUT: Duration = Duration::from_secs(5);
+// Loss ratios measured on fewer packets are not significant
+const MIN_REPORT_PACKETS: u64 = 50;
+
+// Aggregate of the reports since the last summary, the counts are the ones of the spectator that
+// lost the largest share of its packets
+#[derive(Clone, Copy, Default)]
+pub struct SpectatorSummary {
+    pub spectators: usize,
+    pub packets_received: u64,
+    pub packets_lost: u64,
+    pub request_idr: bool,
+}
+
+struct Reporter {
+    last_report: SpectatorReport,
+    last_time: Instant,
+    // Since the last summary
+    received: u64,
+    lost: u64,
+}
+
+#[derive(Default)]
+struct FanOutState {
+    reporters: HashMap<SocketAddr, Reporter>,
+    request_idr: bool,
+}
+
+pub struct FanOut {
+    pub addresses: Vec<SocketAddr>,
+    state: Mutex<FanOutState>,
+}
+
+impl FanOut {
+    pub fn new(addresses: Vec<SocketAddr>) -> Self {
+        Self {
+            addresses,
+            state: Mutex::new(FanOutState::default()),
+        }
+    }
+
+    // Datagram that did not come from the client, with its LengthDelimitedCodec prefix removed.
+    // Anything but a report of a spectator is ignored.
+    pub fn receive(&self, address: SocketAddr, mut packet_bytes: &[u8]) {
+        let known = self
+            .addresses
+            .iter()
+            .any(|spectator| spectator.ip() == address.ip());
+        let multicast = self
+            .addresses
+            .iter()
+            .any(|spectator| spectator.ip().is_multicast());
+        if !known && !multicast {
+            return;
+        }
+
+        // Stream ID, packet index and transport sequence number
+        if packet_bytes.len() < 8 || packet_bytes.get_u16() != SPECTATOR_REPORT {
+            return;
+        }
+        packet_bytes.advance(6);
+        let report = match bincode::deserialize::<SpectatorReport>(packet_bytes) {
+            Ok(report) => report,
+            Err(_) => return,
+        };
+
+        let mut state = self.state.lock().unwrap();
+        let now = Instant::now();
+
+        state
+            .reporters
+            .retain(|_, reporter| now - reporter.last_time < REPORTER_TIMEOUT);
+        if !known
+            && !state.reporters.contains_key(&address)
+            && state.reporters.len() >= MAX_REPORTERS
+        {
+            return;
+        }
+
+        let reporter = state.reporters.entry(address).or_insert(Reporter {
+            last_report: SpectatorReport::default(),
+            last_time: now,
+            received: 0,
+            lost: 0,
+        });
+        // The counts restart with the spectator
+        if report.packets_received < reporter.last_report.packets_received {
+            reporter.last_report = SpectatorReport::default();
+        }
+        reporter.received += report.packets_received - reporter.last_report.packets_received;
+        reporter.lost += report
+            .packets_lost
+            .saturating_sub(reporter.last_report.packets_lost);
+        reporter.last_report = report;
+        reporter.last_time = now;
+
+        state.request_idr |= report.request_idr;
+    }
+
+    // Reports received since the last call, None if no spectator reported
+    pub fn take_summary(&self) -> Option<SpectatorSummary> {
+        let mut state = self.state.lock().unwrap();
+
+        let now = Instant::now();
+        state
+            .reporters
+            .retain(|_, reporter| now - reporter.last_time < REPORTER_TIMEOUT);
+        if state.reporters.is_empty() {
+            return None;
+        }
+
+        let mut summary = SpectatorSummary {
+            spectators: state.reporters.len(),
+            request_idr: state.request_idr,
+            ..Default::default()
+        };
+        let mut worst_loss = 0.;
+        for reporter in state.reporters.values_mut() {
+            let total = reporter.received + reporter.lost;
+            if total >= MIN_REPORT_PACKETS {
+                let loss = reporter.lost as f32 / total as f32;
+                if loss >= worst_loss {
+                    worst_loss = loss;
+                    summary.packets_received = reporter.received;
+                    summary.packets_lost = reporter.lost;
+                }
+            }
+            reporter.received = 0;
+            reporter.lost = 0;
+        }
+        state.request_idr = false;
+
+        Some(summary)
+    }
+}
@@ -0,0 +1,222 @@
+// Per-packet delivery feedback of the UDP socket, after the transport-wide congestion control
+// feedback of WebRTC. Every packet carries a sequence number shared by all the streams of the
+// socket. The client logs the arrival time of each packet and reports the log every
+// FEEDBACK_INTERVAL. The server matches the reports with the send times it logged: the packets are
+// grouped by send burst for the delay gradient of the bitrate controller, and the ones that are
+// never acknowledged are counted as lost.
+//
+// The clocks of the server and the client are never compared, only deltas on the same side.
+
+use bytes::Bytes;
+use serde::{Deserialize, Serialize};
+use std::{
+    mem,
+    sync::Mutex,
+    time::{Duration, Instant},
+};
+
+pub const FEEDBACK_INTERVAL: Duration = Duration::from_millis(50);
+
+const SEQUENCE_COUNT: usize = 1 << 16;
+// Offset of the sequence number in a packet, after the stream ID and the packet index
+const SEQUENCE_OFFSET: usize = 2 + 4;
+// Packets sent within this time form a group, like the ones of a chunk of a video frame
+const BURST_TIME_US: u64 = 5000;
+// A packet is lost if a packet sent this much later was acknowledged first. Covers the reordering
+// between the paths of a multipath socket.
+const REORDER_TIME_US: u64 = 100_000;
+// Arrivals kept by the client when no report is taken
+const MAX_LOGGED_ARRIVALS: usize = 8192;
+
+// Sent by the client
+#[derive(Serialize, Deserialize, Clone, Debug, Default)]
+pub struct TransportFeedback {
+    // Arrival time of the first packet of the report, in us on the clock of the client
+    pub base_arrival_us: u64,
+    // Sequence number and arrival time after base_arrival_us of each packet, in arrival order
+    pub arrivals: Vec<(u16, u32)>,
+}
+
+// `packet` starts with the stream ID
+pub fn packet_sequence(packet: &[u8]) -> Option<u16> {
+    let bytes = packet.get(SEQUENCE_OFFSET..SEQUENCE_OFFSET + 2)?;
+    Some(u16::from_be_bytes([bytes[0], bytes[1]]))
+}
+
+// Receiving side
+pub struct ArrivalLog {
+    epoch: Instant,
+    arrivals: Mutex<Vec<(u16, u64)>>,
+}
+
+impl ArrivalLog {
+    pub fn new() -> Self {
+        Self {
+            epoch: Instant::now(),
+            arrivals: Mutex::new(vec![]),
+        }
+    }
+
+    // `packet` starts with the stream ID
+    pub fn record(&self, packet: &[u8], arrival: Instant) {
+        if let Some(sequence) = packet_sequence(packet) {
+            let mut arrivals = self.arrivals.lock().unwrap();
+            if arrivals.len() < MAX_LOGGED_ARRIVALS {
+                arrivals.push((sequence, (arrival - self.epoch).as_micros() as u64));
+            }
+        }
+    }
+
+    // Takes the arrivals logged since the last report
+    pub fn take_report(&self) -> Option<TransportFeedback> {
+        let arrivals = mem::take(&mut *self.arrivals.lock().unwrap());
+        let base_arrival_us = arrivals.first()?.1;
+
+        Some(TransportFeedback {
+            base_arrival_us,
+            arrivals: arrivals
+                .into_iter()
+                .map(|(sequence, arrival_us)| (sequence, (arrival_us - base_arrival_us) as u32))
+                .collect(),
+        })
+    }
+}
+
+#[derive(Clone, Copy)]
+struct SentPacket {
+    send_us: u64,
+    size: u32,
+}
+
+// Packets acknowledged by the client that were sent in one burst
+#[derive(Clone, Copy, Debug)]
+pub struct PacketGroup {
+    pub first_send_us: u64,
+    // Server clock
+    pub last_send_us: u64,
+    // Client clock
+    pub first_arrival_us: u64,
+    pub last_arrival_us: u64,
+    pub bytes: u64,
+}
+
+pub struct FeedbackSummary {
+    // Complete groups, in send order
+    pub groups: Vec<PacketGroup>,
+    pub received: u32,
+    pub lost: u32,
+}
+
+struct SendLogState {
+    // Indexed by sequence number. Cleared once the packet is acknowledged or lost.
+    packets: Vec<Option<SentPacket>>,
+    next_unresolved: u16,
+    // The last group of a report can continue in the next one
+    pending_group: Option<PacketGroup>,
+}
+
+// Sending side. Only the server asks for feedback.
+pub struct SendLog {
+    epoch: Instant,
+    state: Mutex<SendLogState>,
+}
+
+impl SendLog {
+    pub fn new() -> Self {
+        Self {
+            epoch: Instant::now(),
+            state: Mutex::new(SendLogState {
+                packets: vec![None; SEQUENCE_COUNT],
+                next_unresolved: 0,
+                pending_group: None,
+            }),
+        }
+    }
+
+    // Called once the packets have been handed to the kernel
+    pub fn record(&self, packets: &[Bytes]) {
+        let send_us = self.epoch.elapsed().as_micros() as u64;
+
+        let mut state = self.state.lock().unwrap();
+        for packet in packets {
+            if let Some(sequence) = packet_sequence(packet) {
+                state.packets[sequence as usize] = Some(SentPacket {
+                    send_us,
+                    size: packet.len() as u32,
+                });
+            }
+        }
+    }
+
+    pub fn process(&self, feedback: &TransportFeedback) -> FeedbackSummary {
+        let mut state = self.state.lock().unwrap();
+
+        let mut acked = vec![];
+        // Furthest acknowledged sequence number from the first unresolved one
+        let mut newest = None;
+        for &(sequence, arrival_delta_us) in &feedback.arrivals {
+            if let Some(packet) = state.packets[sequence as usize].take() {
+                acked.push((packet, feedback.base_arrival_us + arrival_delta_us as u64));
+
+                let distance = sequence.wrapping_sub(state.next_unresolved);
+                if distance < u16::MAX / 2
+                    && newest.map_or(true, |(newest_distance, _)| distance > newest_distance)
+                {
+                    newest = Some((distance, packet.send_us));
+                }
+            }
+        }
+
+        let mut lost = 0;
+        if let Some((distance, newest_send_us)) = newest {
+            for _ in 0..=distance {
+                let index = state.next_unresolved as usize;
+                match state.packets[index] {
+                    // Still in flight, it can arrive after the newer packets
+                    Some(packet) if packet.send_us + REORDER_TIME_US > newest_send_us => break,
+                    Some(_) => {
+                        state.packets[index] = None;
+                        lost += 1;
+                    }
+                    // Acknowledged, or never sent because its deadline expired
+                    None => (),
+                }
+                state.next_unresolved = state.next_unresolved.wrapping_add(1);
+            }
+        }
+
+        acked.sort_by_key(|(packet, _)| packet.send_us);
+
+        let mut groups = vec![];
+        let mut group = state.pending_group.take();
+        for &(packet, arrival_us) in &acked {
+            match &mut group {
+                // Late packets of a group that was already reported only count as received
+                Some(group) if packet.send_us < group.first_send_us => (),
+                Some(group) if packet.send_us - group.first_send_us <= BURST_TIME_US => {
+                    group.last_send_us = packet.send_us;
+                    group.first_arrival_us = group.first_arrival_us.min(arrival_us);
+                    group.last_arrival_us = group.last_arrival_us.max(arrival_us);
+                    group.bytes += packet.size as u64;
+                }
+                _ => {
+                    groups.extend(group.take());
+                    group = Some(PacketGroup {
+                        first_send_us: packet.send_us,
+                        last_send_us: packet.send_us,
+                        first_arrival_us: arrival_us,
+                        last_arrival_us: arrival_us,
+                        bytes: packet.size as u64,
+                    });
+                }
+            }
+        }
+        state.pending_group = group;
+
+        FeedbackSummary {
+            groups,
+            received: acked.len() as u32,
+            lost,
+        }
+    }
+}
@@ -0,0 +1,179 @@
+// Emulation of a bad network link on the sending side of a stream socket, used to test how the
+// stream copes with loss without a bad access point at hand. Losses follow the Gilbert-Elliott
+// model: the link is either in the good or in the bad state, each with its own loss probability,
+// and switches state with the given per-packet probabilities, which gives loss bursts.
+
+use super::StreamSendSocket;
+use alvr_common::prelude::*;
+use alvr_session::NetworkImpairmentDesc;
+use bytes::Bytes;
+use rand::{rngs::StdRng, Rng, SeedableRng};
+use settings_schema::Switch;
+use std::{
+    sync::Mutex,
+    time::{Duration, Instant},
+};
+use tokio::{sync::mpsc, time};
+
+enum Verdict {
+    Drop,
+    Send(Instant),
+    // Held back, to be overtaken by the following packets
+    Reorder(Instant),
+}
+
+struct LinkState {
+    rng: StdRng,
+    bad: bool,
+    // When the bottleneck finishes sending the packets queued so far
+    link_free_time: Instant,
+    // Delivery time of the last packet that kept its order
+    last_delivery_time: Instant,
+    packets: u64,
+    lost_packets: u64,
+    queue_dropped_packets: u64,
+}
+
+pub struct Impairment {
+    config: NetworkImpairmentDesc,
+    state: Mutex<LinkState>,
+    // Delayed packets in delivery order
+    delivery_queue: mpsc::UnboundedSender<(Instant, Bytes)>,
+    socket: StreamSendSocket,
+}
+
+impl Impairment {
+    pub fn new(config: NetworkImpairmentDesc, socket: StreamSendSocket) -> Self {
+        info!(
+            "Network impairment enabled: loss {} -> {}, delay {}ms, jitter {}ms, reorder {}",
+            config.good_loss_probability,
+            config.bad_loss_probability,
+            config.base_delay_ms,
+            config.jitter_ms,
+            config.reorder_probability
+        );
+
+        let (delivery_queue, mut delivery_dequeuer) = mpsc::unbounded_channel();
+        tokio::spawn({
+            let socket = socket.clone();
+            async move {
+                while let Some((delivery_time, packet)) = delivery_dequeuer.recv().await {
+                    time::sleep_until(delivery_time.into()).await;
+                    socket.send(packet).await.ok();
+                }
+            }
+        });
+
+        let now = Instant::now();
+        Self {
+            config,
+            state: Mutex::new(LinkState {
+                rng: StdRng::from_entropy(),
+                bad: false,
+                link_free_time: now,
+                last_delivery_time: now,
+                packets: 0,
+                lost_packets: 0,
+                queue_dropped_packets: 0,
+            }),
+            delivery_queue,
+            socket,
+        }
+    }
+
+    fn process(&self, state: &mut LinkState, packet_len: usize, now: Instant) -> Verdict {
+        let config = &self.config;
+        state.packets += 1;
+
+        let mut delivery_time = now;
+
+        // The bottleneck goes first: packets lost later on still took their share of the link.
+        if let Switch::Enabled(limit) = &config.bandwidth_limit {
+            let start_time = state.link_free_time.max(now);
+            if start_time - now > Duration::from_millis(limit.queue_limit_ms) {
+                state.queue_dropped_packets += 1;
+                return Verdict::Drop;
+            }
+            state.link_free_time = start_time
+                + Duration::from_secs_f64(
+                    packet_len as f64 * 8. / (limit.bitrate_mbs as f64 * 1e6),
+                );
+            delivery_time = state.link_free_time;
+        }
+
+        let transition_probability = if state.bad {
+            config.bad_to_good_probability
+        } else {
+            config.good_to_bad_probability
+        };
+        if state.rng.gen::<f32>() < transition_probability {
+            state.bad = !state.bad;
+        }
+        let loss_probability = if state.bad {
+            config.bad_loss_probability
+        } else {
+            config.good_loss_probability
+        };
+        if state.rng.gen::<f32>() < loss_probability {
+            state.lost_packets += 1;
+            return Verdict::Drop;
+        }
+
+        delivery_time += Duration::from_millis(config.base_delay_ms);
+        if config.jitter_ms > 0 {
+            delivery_time +=
+                Duration::from_micros(state.rng.gen_range(0..=config.jitter_ms * 1000));
+        }
+
+        // Jitter alone does not reorder packets, like on a real link.
+        if state.rng.gen::<f32>() < config.reorder_probability {
+            return Verdict::Reorder(
+                delivery_time + Duration::from_millis(config.reorder_delay_ms),
+            );
+        }
+        delivery_time = delivery_time.max(state.last_delivery_time);
+        state.last_delivery_time = delivery_time;
+
+        Verdict::Send(delivery_time)
+    }
+
+    // Returns the packets that go out right away, in order. Delayed packets are sent later by the
+    // delivery task, dropped ones are discarded.
+    pub fn apply(&self, packets: Vec<Bytes>) -> Vec<Bytes> {
+        let now = Instant::now();
+        let mut state = self.state.lock().unwrap();
+
+        let mut immediate_packets = Vec::with_capacity(packets.len());
+        for packet in packets {
+            match self.process(&mut state, packet.len(), now) {
+                Verdict::Drop => (),
+                Verdict::Send(delivery_time) if delivery_time <= now => {
+                    immediate_packets.push(packet)
+                }
+                Verdict::Send(delivery_time) => {
+                    self.delivery_queue.send((delivery_time, packet)).ok();
+                }
+                Verdict::Reorder(delivery_time) => {
+                    // It has its own timer to not hold back the queue.
+                    let socket = self.socket.clone();
+                    tokio::spawn(async move {
+                        time::sleep_until(delivery_time.into()).await;
+                        socket.send(packet).await.ok();
+                    });
+                }
+            }
+        }
+
+        immediate_packets
+    }
+}
+
+impl Drop for Impairment {
+    fn drop(&mut self) {
+        let state = self.state.lock().unwrap();
+        info!(
+            "Network impairment: {} packets, {} lost, {} dropped by the bandwidth limit",
+            state.packets, state.lost_packets, state.queue_dropped_packets
+        );
+    }
+}
@@ -0,0 +1,196 @@
+// Blocking receive loop that writes the payload of one stream straight into buffers provided by
+// the caller. The video stream uses it to fill the FEC queue without copying the packets: the
+// prefix and header of each datagram are peeked first to ask where the payload goes, then the
+// datagram is read with its payload scattered to that buffer. Packets of the other streams are
+// dispatched to their queues as usual.
+
+use super::{
+    feedback::ArrivalLog,
+    multipath::{self, PathReception},
+    PacketEnqueuers, StreamId,
+};
+use alvr_common::prelude::*;
+use bytes::{Buf, BytesMut};
+use socket2::SockAddr;
+use std::{
+    io, mem,
+    net::SocketAddr,
+    os::unix::io::{AsRawFd, RawFd},
+    sync::Arc,
+    time::{Duration, Instant},
+};
+use tokio::net::UdpSocket;
+
+// Longest time the receiver is not polled while no packet arrives
+const POLL_TIMEOUT: Duration = Duration::from_millis(10);
+
+pub trait InPlaceReceiver {
+    // Buffer for the payload of the packet with this serialized header, None drops the packet
+    fn reserve(&mut self, header: &[u8]) -> Option<&mut [u8]>;
+    // The payload of the last reserved packet was written
+    fn commit(&mut self, header: &[u8], payload_size: usize);
+    // Called between packets, and at least every POLL_TIMEOUT. Returning false stops the loop.
+    fn poll(&mut self) -> bool;
+}
+
+pub struct InPlaceReceiveLoop {
+    pub(super) socket: Arc<UdpSocket>,
+    // Set for Udp, whose datagrams are length delimited and come from any peer
+    pub(super) peer_addr: Option<SocketAddr>,
+    pub(super) paths: Option<Arc<PathReception>>,
+    pub(super) arrival_log: Option<Arc<ArrivalLog>>,
+    pub(super) stream_id: StreamId,
+    pub(super) header_size: usize,
+    pub(super) packet_enqueuers: PacketEnqueuers,
+}
+
+struct Message {
+    // Real size of the datagram, even if it was truncated
+    size: usize,
+    truncated: bool,
+    address: Option<SocketAddr>,
+}
+
+// Returns None if no datagram is queued
+fn recv_message(
+    fd: RawFd,
+    iovecs: &mut [libc::iovec],
+    flags: libc::c_int,
+) -> io::Result<Option<Message>> {
+    let mut address = unsafe { mem::zeroed::<libc::sockaddr_storage>() };
+    let mut header = unsafe { mem::zeroed::<libc::msghdr>() };
+    header.msg_name = &mut address as *mut _ as *mut libc::c_void;
+    header.msg_namelen = mem::size_of::<libc::sockaddr_storage>() as libc::socklen_t;
+    header.msg_iov = iovecs.as_mut_ptr();
+    header.msg_iovlen = iovecs.len() as _;
+
+    // MSG_TRUNC makes recvmsg() return the size of the whole datagram
+    let res = unsafe {
+        libc::recvmsg(
+            fd,
+            &mut header,
+            flags | libc::MSG_DONTWAIT | libc::MSG_TRUNC,
+        )
+    };
+    if res < 0 {
+        let error = io::Error::last_os_error();
+        return match error.kind() {
+            io::ErrorKind::WouldBlock | io::ErrorKind::Interrupted => Ok(None),
+            _ => Err(error),
+        };
+    }
+
+    let address = unsafe { SockAddr::new(address, header.msg_namelen) };
+    Ok(Some(Message {
+        size: res as usize,
+        truncated: header.msg_flags & libc::MSG_TRUNC != 0,
+        address: address.as_socket(),
+    }))
+}
+
+fn iovec(buffer: &mut [u8]) -> libc::iovec {
+    libc::iovec {
+        iov_base: buffer.as_mut_ptr() as *mut libc::c_void,
+        iov_len: buffer.len(),
+    }
+}
+
+fn wait_readable(fd: RawFd) -> io::Result<()> {
+    let mut poll_fd = libc::pollfd {
+        fd,
+        events: libc::POLLIN,
+        revents: 0,
+    };
+    let res = unsafe { libc::poll(&mut poll_fd, 1, POLL_TIMEOUT.as_millis() as _) };
+    if res < 0 {
+        let error = io::Error::last_os_error();
+        if error.kind() != io::ErrorKind::Interrupted {
+            return Err(error);
+        }
+    }
+
+    Ok(())
+}
+
+impl InPlaceReceiveLoop {
+    // Must run on a thread that can block, until the receiver stops it or the socket fails
+    pub fn run(self, receiver: &mut impl InPlaceReceiver) -> StrResult {
+        let fd = self.socket.as_raw_fd();
+
+        let length_size = if self.peer_addr.is_some() { 4 } else { 0 };
+        // length, stream ID, packet index, sequence number, header
+        let prefix_size = length_size + 2 + 4 + 2 + self.header_size;
+        let mut prefix = vec![0_u8; prefix_size];
+        let mut discarded = [0_u8; 1];
+
+        while receiver.poll() {
+            let peeked =
+                match trace_err!(recv_message(fd, &mut [iovec(&mut prefix)], libc::MSG_PEEK))? {
+                    Some(message) => message,
+                    None => {
+                        trace_err!(wait_readable(fd))?;
+                        continue;
+                    }
+                };
+
+            let valid_source = match (self.peer_addr, peeked.address) {
+                (None, _) => true,
+                (Some(peer_addr), Some(address)) => {
+                    multipath::accept_source(peer_addr, self.paths.as_deref(), address)
+                }
+                _ => false,
+            };
+            let valid_length = length_size == 0
+                || (peeked.size >= length_size
+                    && (&prefix[..]).get_u32() as usize + length_size == peeked.size);
+            if !valid_source || !valid_length || peeked.size < length_size + 2 {
+                trace_err!(recv_message(fd, &mut [iovec(&mut discarded)], 0))?;
+                continue;
+            }
+
+            if let Some(arrival_log) = &self.arrival_log {
+                let peeked_prefix = &prefix[..peeked.size.min(prefix_size)];
+                arrival_log.record(&peeked_prefix[length_size..], Instant::now());
+            }
+
+            let stream_id = (&prefix[length_size..]).get_u16();
+            if stream_id == self.stream_id && peeked.size >= prefix_size {
+                let header = &prefix[length_size + 8..];
+                let payload_size = peeked.size - prefix_size;
+                let payload = match receiver.reserve(header) {
+                    Some(payload) if payload.len() >= payload_size => iovec(payload),
+                    _ => {
+                        trace_err!(recv_message(fd, &mut [iovec(&mut discarded)], 0))?;
+                        continue;
+                    }
+                };
+
+                // The prefix is read again, the header is only used once the datagram is consumed
+                let mut iovecs = [iovec(&mut prefix), payload];
+                match trace_err!(recv_message(fd, &mut iovecs, 0))? {
+                    Some(message) if !message.truncated && message.size == peeked.size => {
+                        receiver.commit(&prefix[length_size + 8..], payload_size)
+                    }
+                    _ => (),
+                }
+            } else {
+                let queues = self.packet_enqueuers.blocking_lock();
+                let mut buffer = match queues.get(&stream_id) {
+                    Some(queue) => queue.pool.take(peeked.size),
+                    None => BytesMut::with_capacity(peeked.size),
+                };
+                buffer.resize(peeked.size, 0);
+                let read = trace_err!(recv_message(fd, &mut [iovec(&mut buffer)], 0))?;
+                if matches!(read, Some(message) if message.size == peeked.size) {
+                    buffer.advance(length_size + 2);
+
+                    if let Some(queue) = queues.get(&stream_id) {
+                        queue.enqueue(buffer, None)?;
+                    }
+                }
+            }
+        }
+
+        Ok(())
+    }
+}
@@ -0,0 +1,356 @@
+// Batched UDP I/O. sendmmsg() pushes many datagrams to the kernel with a single syscall, which
+// matters for video frames that are split into hundreds of MTU-sized packets. recvmmsg() does the
+// same on the receiving side, and also returns the receive timestamps of the kernel if the socket
+// was configured with set_receive_timestamps().
+
+use bytes::{BufMut, BytesMut};
+use socket2::SockAddr;
+use std::{
+    io, mem,
+    net::SocketAddr,
+    os::unix::io::AsRawFd,
+    ptr,
+    time::{Duration, SystemTime, UNIX_EPOCH},
+};
+use tokio::{io::Interest, net::UdpSocket};
+
+#[cfg(target_os = "linux")]
+use bytes::Bytes;
+#[cfg(target_os = "linux")]
+use libc::{mmsghdr, recvmmsg};
+
+// Linux caps the message vector of a single sendmmsg() call at UIO_MAXIOV
+#[cfg(target_os = "linux")]
+const MAX_MESSAGES_PER_CALL: usize = 1024;
+
+// Most datagrams read by a single recvmmsg() call
+pub const RECV_BATCH_SIZE: usize = 64;
+// Memory of the receive slots of a batch. Fewer slots are used for large datagrams.
+const RECV_BATCH_BYTES: usize = RECV_BATCH_SIZE * 2048;
+// Slots hold at least this much, most packets of the other streams are small
+const MIN_SLOT_SIZE: usize = 2048;
+// Largest UDP datagram
+const MAX_DATAGRAM_SIZE: usize = 65_535;
+
+// Bionic has recvmmsg() since API 21, but the libc crate does not bind it
+#[cfg(target_os = "android")]
+#[allow(non_camel_case_types)]
+#[repr(C)]
+struct mmsghdr {
+    msg_hdr: libc::msghdr,
+    msg_len: libc::c_uint,
+}
+
+#[cfg(target_os = "android")]
+extern "C" {
+    fn recvmmsg(
+        sockfd: libc::c_int,
+        msgvec: *mut mmsghdr,
+        vlen: libc::c_uint,
+        flags: libc::c_int,
+        timeout: *const libc::timespec,
+    ) -> libc::c_int;
+}
+
+// Send every packet in order, one datagram each. `peer_addr` must be None if the socket is
+// connected. If `length_delimited` is set, each datagram is prefixed with its big endian u32
+// length, matching the framing of LengthDelimitedCodec. `txtimes` are the departure times of the
+// packets in nanoseconds on the clock the socket was configured with by SO_TXTIME.
+#[cfg(target_os = "linux")]
+pub async fn send_all(
+    socket: &UdpSocket,
+    peer_addr: Option<SocketAddr>,
+    packets: &[Bytes],
+    length_delimited: bool,
+    txtimes: Option<&[u64]>,
+) -> io::Result<()> {
+    let peer_addr = peer_addr.map(SockAddr::from);
+    let fd = socket.as_raw_fd();
+
+    let prefixes = if length_delimited {
+        packets
+            .iter()
+            .map(|packet| (packet.len() as u32).to_be_bytes())
+            .collect::<Vec<_>>()
+    } else {
+        vec![]
+    };
+    let iovecs_per_message = if length_delimited { 2 } else { 1 };
+    // One SCM_TXTIME message per datagram, in u64 units to keep the cmsghdr alignment
+    let control_words =
+        unsafe { libc::CMSG_SPACE(mem::size_of::<u64>() as _) } as usize / mem::size_of::<u64>();
+
+    let mut sent = 0;
+    while sent < packets.len() {
+        let end = packets.len().min(sent + MAX_MESSAGES_PER_CALL);
+
+        // The message headers hold raw pointers and are rebuilt inside the closure so that they
+        // are never kept across an await point (the returned future must stay Send).
+        sent += socket
+            .async_io(Interest::WRITABLE, || {
+                let mut iovecs = Vec::with_capacity((end - sent) * iovecs_per_message);
+                for index in sent..end {
+                    if length_delimited {
+                        iovecs.push(libc::iovec {
+                            iov_base: prefixes[index].as_ptr() as *mut libc::c_void,
+                            iov_len: prefixes[index].len(),
+                        });
+                    }
+                    iovecs.push(libc::iovec {
+                        iov_base: packets[index].as_ptr() as *mut libc::c_void,
+                        iov_len: packets[index].len(),
+                    });
+                }
+
+                let mut control = if txtimes.is_some() {
+                    vec![0_u64; (end - sent) * control_words]
+                } else {
+                    vec![]
+                };
+
+                let mut headers = iovecs
+                    .chunks_mut(iovecs_per_message)
+                    .enumerate()
+                    .map(|(message, message_iovecs)| {
+                        let mut header = unsafe { mem::zeroed::<libc::mmsghdr>() };
+                        header.msg_hdr.msg_iov = message_iovecs.as_mut_ptr();
+                        header.msg_hdr.msg_iovlen = iovecs_per_message as _;
+                        if let Some(addr) = &peer_addr {
+                            header.msg_hdr.msg_name = addr.as_ptr() as *mut libc::c_void;
+                            header.msg_hdr.msg_namelen = addr.len();
+                        }
+                        if let Some(txtimes) = txtimes {
+                            header.msg_hdr.msg_control =
+                                control[message * control_words..].as_mut_ptr() as _;
+                            header.msg_hdr.msg_controllen =
+                                (control_words * mem::size_of::<u64>()) as _;
+                            unsafe {
+                                let cmsg = libc::CMSG_FIRSTHDR(&header.msg_hdr);
+                                (*cmsg).cmsg_level = libc::SOL_SOCKET;
+                                (*cmsg).cmsg_type = libc::SCM_TXTIME;
+                                (*cmsg).cmsg_len = libc::CMSG_LEN(mem::size_of::<u64>() as _) as _;
+                                (libc::CMSG_DATA(cmsg) as *mut u64)
+                                    .write_unaligned(txtimes[sent + message]);
+                            }
+                        }
+                        header
+                    })
+                    .collect::<Vec<_>>();
+
+                let res = unsafe {
+                    libc::sendmmsg(fd, headers.as_mut_ptr(), headers.len() as libc::c_uint, 0)
+                };
+                if res < 0 {
+                    // WouldBlock makes async_io wait for the socket to become writable again
+                    Err(io::Error::last_os_error())
+                } else {
+                    Ok(res as usize)
+                }
+            })
+            .await?;
+    }
+
+    Ok(())
+}
+
+// Receive buffers reused across recv_batch() calls. Each slot is an empty view with room for one
+// datagram, carved out of a shared allocation. Received packets keep their slot, the allocation
+// is recycled by BytesMut once all of them have been dropped.
+pub struct RecvBatch {
+    slots: Vec<BytesMut>,
+    slot_count: usize,
+    slot_size: usize,
+    storage: BytesMut,
+    // The rest of the datagrams larger than a slot, one region per slot. They are rare, only these
+    // are copied. The pages are not touched until then.
+    overflow: Vec<u8>,
+    addresses: Vec<libc::sockaddr_storage>,
+    // One SCM_TIMESTAMPING message per slot, in u64 units to keep the cmsghdr alignment
+    control: Vec<u64>,
+    control_words: usize,
+}
+
+impl RecvBatch {
+    // Slots are sized for `datagram_size`, larger datagrams are still received
+    pub fn new(datagram_size: usize) -> Self {
+        let slot_size = datagram_size.clamp(MIN_SLOT_SIZE, MAX_DATAGRAM_SIZE);
+        let slot_count = (RECV_BATCH_BYTES / slot_size).clamp(1, RECV_BATCH_SIZE);
+        let control_space =
+            unsafe { libc::CMSG_SPACE(mem::size_of::<[libc::timespec; 3]>() as _) } as usize;
+        let control_words = (control_space + mem::size_of::<u64>() - 1) / mem::size_of::<u64>();
+        let mut batch = Self {
+            slots: Vec::with_capacity(slot_count),
+            slot_count,
+            slot_size,
+            storage: BytesMut::new(),
+            overflow: vec![0; slot_count * (MAX_DATAGRAM_SIZE - slot_size).max(1)],
+            addresses: vec![unsafe { mem::zeroed() }; slot_count],
+            control: vec![0; slot_count * control_words],
+            control_words,
+        };
+        batch.refill();
+
+        batch
+    }
+
+    fn refill(&mut self) {
+        while self.slots.len() < self.slot_count {
+            if self.storage.capacity() < self.slot_size {
+                self.storage
+                    .reserve((self.slot_count - self.slots.len()) * self.slot_size);
+            }
+            let rest = self.storage.split_off(self.slot_size);
+            self.slots.push(mem::replace(&mut self.storage, rest));
+        }
+    }
+}
+
+// Ask the kernel to timestamp the datagrams when they reach the socket, before any queueing in
+// user space. Hardware timestamps would be on the clock of the NIC, the software ones are on the
+// system clock like the other timestamps of the streams.
+pub fn set_receive_timestamps(socket: &socket2::Socket) -> io::Result<()> {
+    let flags =
+        (libc::SOF_TIMESTAMPING_RX_SOFTWARE | libc::SOF_TIMESTAMPING_SOFTWARE) as libc::c_int;
+    let res = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_TIMESTAMPING,
+            &flags as *const _ as *const libc::c_void,
+            mem::size_of_val(&flags) as libc::socklen_t,
+        )
+    };
+    if res == 0 {
+        Ok(())
+    } else {
+        Err(io::Error::last_os_error())
+    }
+}
+
+// Software receive timestamp of a received message, if any
+fn receive_timestamp(header: &libc::msghdr) -> Option<SystemTime> {
+    unsafe {
+        let mut cmsg = libc::CMSG_FIRSTHDR(header);
+        while !cmsg.is_null() {
+            if (*cmsg).cmsg_level == libc::SOL_SOCKET && (*cmsg).cmsg_type == libc::SCM_TIMESTAMPING
+            {
+                // Software, deprecated, raw hardware
+                let stamps = (libc::CMSG_DATA(cmsg) as *const [libc::timespec; 3]).read_unaligned();
+                let stamp = stamps[0];
+                return (stamp.tv_sec != 0 || stamp.tv_nsec != 0).then(|| {
+                    UNIX_EPOCH + Duration::new(stamp.tv_sec as u64, stamp.tv_nsec as u32)
+                });
+            }
+            cmsg = libc::CMSG_NXTHDR(header, cmsg);
+        }
+    }
+
+    None
+}
+
+// Wait for the socket to be readable, then read all queued datagrams up to RECV_BATCH_SIZE with a
+// single syscall. Returns the datagrams with their source address and receive timestamp, in order.
+pub async fn recv_batch(
+    socket: &UdpSocket,
+    batch: &mut RecvBatch,
+) -> io::Result<Vec<(BytesMut, SocketAddr, Option<SystemTime>)>> {
+    let fd = socket.as_raw_fd();
+
+    let overflow_size = MAX_DATAGRAM_SIZE - batch.slot_size;
+
+    // As for send_all(), the headers are rebuilt inside the closure to keep the future Send
+    let messages = socket
+        .async_io(Interest::READABLE, || {
+            let mut iovecs = batch
+                .slots
+                .iter_mut()
+                .zip(batch.overflow.chunks_exact_mut(overflow_size.max(1)))
+                .map(|(slot, overflow)| {
+                    let chunk = slot.chunk_mut();
+                    [
+                        libc::iovec {
+                            iov_base: chunk.as_mut_ptr() as *mut libc::c_void,
+                            iov_len: batch.slot_size,
+                        },
+                        libc::iovec {
+                            iov_base: overflow.as_mut_ptr() as *mut libc::c_void,
+                            iov_len: overflow_size,
+                        },
+                    ]
+                })
+                .collect::<Vec<_>>();
+
+            let mut headers = iovecs
+                .iter_mut()
+                .zip(batch.addresses.iter_mut())
+                .zip(batch.control.chunks_exact_mut(batch.control_words))
+                .map(|((iovecs, address), control)| {
+                    let mut header = unsafe { mem::zeroed::<mmsghdr>() };
+                    header.msg_hdr.msg_iov = iovecs.as_mut_ptr();
+                    header.msg_hdr.msg_iovlen = if overflow_size > 0 { 2 } else { 1 };
+                    header.msg_hdr.msg_name = address as *mut _ as *mut libc::c_void;
+                    header.msg_hdr.msg_namelen =
+                        mem::size_of::<libc::sockaddr_storage>() as libc::socklen_t;
+                    header.msg_hdr.msg_control = control.as_mut_ptr() as *mut libc::c_void;
+                    header.msg_hdr.msg_controllen = (control.len() * mem::size_of::<u64>()) as _;
+                    header
+                })
+                .collect::<Vec<_>>();
+
+            let res = unsafe {
+                recvmmsg(
+                    fd,
+                    headers.as_mut_ptr(),
+                    headers.len() as _,
+                    libc::MSG_DONTWAIT,
+                    ptr::null_mut(),
+                )
+            };
+            if res < 0 {
+                // WouldBlock makes async_io wait for the socket to become readable again
+                Err(io::Error::last_os_error())
+            } else {
+                Ok(headers[..res as usize]
+                    .iter()
+                    .map(|header| {
+                        (
+                            header.msg_len as usize,
+                            header.msg_hdr.msg_namelen,
+                            header.msg_hdr.msg_flags & libc::MSG_TRUNC != 0,
+                            receive_timestamp(&header.msg_hdr),
+                        )
+                    })
+                    .collect::<Vec<_>>())
+            }
+        })
+        .await?;
+
+    let mut packets = Vec::with_capacity(messages.len());
+    for (index, (mut slot, (length, address_length, truncated, timestamp))) in batch
+        .slots
+        .drain(..messages.len())
+        .zip(messages)
+        .enumerate()
+    {
+        if truncated {
+            continue;
+        }
+        let address = unsafe { SockAddr::new(batch.addresses[index], address_length) };
+        if let Some(address) = address.as_socket() {
+            if length <= batch.slot_size {
+                unsafe { slot.advance_mut(length) };
+                packets.push((slot, address, timestamp));
+            } else {
+                unsafe { slot.advance_mut(batch.slot_size) };
+                let mut packet = BytesMut::with_capacity(length);
+                packet.extend_from_slice(&slot);
+                let overflow = &batch.overflow[index * overflow_size..];
+                packet.extend_from_slice(&overflow[..length - batch.slot_size]);
+                packets.push((packet, address, timestamp));
+            }
+        }
+    }
+    batch.refill();
+
+    Ok(packets)
+}
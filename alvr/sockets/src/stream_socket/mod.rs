@@ -4,21 +4,44 @@
 // StreamSender and StreamReceiver endpoints allow for convenient conversion of the header to/from
 // bytes while still handling the additional byte buffer with zero copies and extra allocations.
 
+mod fanout;
+mod feedback;
+mod impairment;
+#[cfg(any(target_os = "linux", target_os = "android"))]
+mod in_place;
+#[cfg(any(target_os = "linux", target_os = "android"))]
+mod mmsg;
+mod multipath;
+mod packet_size;
+mod pool;
+pub(crate) mod qos;
+mod scheduler;
 mod tcp;
 mod throttled_udp;
 mod udp;
 
 use alvr_common::prelude::*;
-use alvr_session::{SocketBufferSize, SocketProtocol};
-use bytes::{Buf, BufMut, BytesMut};
+use alvr_session::{NetworkImpairmentDesc, SocketBufferSize, SocketProtocol};
+use bytes::{Buf, BufMut, Bytes, BytesMut};
+use fanout::FanOut;
+use feedback::{ArrivalLog, SendLog};
 use futures::SinkExt;
+use impairment::Impairment;
+use multipath::{PathReception, PathScheduler, PATH_COUNT};
+use pool::ReceiveBufferPool;
+use qos::AccessCategory;
+use scheduler::{SendGate, StreamClass, PREEMPTION_CHUNK_PACKETS};
 use serde::{de::DeserializeOwned, Serialize};
 use std::{
     collections::HashMap,
     marker::PhantomData,
-    net::IpAddr,
+    net::{IpAddr, SocketAddr},
     ops::{Deref, DerefMut},
-    sync::Arc,
+    sync::{
+        atomic::{AtomicU16, Ordering},
+        Arc,
+    },
+    time::{Instant, SystemTime},
 };
 use tcp::{TcpStreamReceiveSocket, TcpStreamSendSocket};
 use throttled_udp::{ThrottledUdpStreamReceiveSocket, ThrottledUdpStreamSendSocket};
@@ -26,9 +49,44 @@ use tokio::net;
 use tokio::sync::{mpsc, Mutex};
 use udp::{UdpStreamReceiveSocket, UdpStreamSendSocket};
 
+pub use fanout::SpectatorSummary;
+pub use feedback::{FeedbackSummary, PacketGroup, TransportFeedback, FEEDBACK_INTERVAL};
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub use in_place::{InPlaceReceiveLoop, InPlaceReceiver};
+pub use multipath::{local_ip_towards, PATH_COUNT};
+pub use packet_size::*;
+pub use scheduler::{stream_queue_statistics, StreamQueueStatistics};
+
 // todo: when const_generics reaches stable, convert this to an enum
 pub type StreamId = u16;
 
+// Queue of a subscribed stream. Packets are queued with the time the kernel received them, on
+// the sockets that report it.
+struct StreamQueue {
+    sender: mpsc::UnboundedSender<(BytesMut, Option<SystemTime>)>,
+    pool: ReceiveBufferPool,
+}
+
+impl StreamQueue {
+    fn enqueue(&self, packet: BytesMut, receive_time: Option<SystemTime>) -> StrResult {
+        trace_err!(self.sender.send((packet, receive_time)))
+    }
+
+    // For packets read into a buffer that the socket reuses. The copy goes into a buffer of the
+    // pool of the stream instead of a new allocation.
+    fn enqueue_copy(&self, packet: &[u8], receive_time: Option<SystemTime>) -> StrResult {
+        let mut buffer = self.pool.take(packet.len());
+        buffer.extend_from_slice(packet);
+
+        self.enqueue(buffer, receive_time)
+    }
+}
+
+type PacketEnqueuers = Arc<Mutex<HashMap<StreamId, StreamQueue>>>;
+
+// The server only receives small packets from the client
+const SERVER_DATAGRAM_SIZE: usize = 2048;
+
 pub fn set_socket_buffers(
     socket: &socket2::Socket,
     send_buffer_bytes: SocketBufferSize,
@@ -88,6 +146,44 @@ enum StreamSendSocket {
     Tcp(TcpStreamSendSocket),
 }
 
+impl StreamSendSocket {
+    async fn send(&self, packet: Bytes) -> StrResult {
+        match self {
+            StreamSendSocket::Udp(socket) => trace_err!(socket.send(packet).await),
+            StreamSendSocket::Tcp(socket) => trace_err!(socket.lock().await.send(packet).await),
+            StreamSendSocket::ThrottledUdp(socket) => trace_err!(socket.send(packet).await),
+        }
+    }
+
+    // `spread` lets a multipath socket spread the packets over its paths, `fan_out` sends them to
+    // the spectators too
+    async fn send_batch(&self, packets: Vec<Bytes>, spread: bool, fan_out: bool) -> StrResult {
+        match self {
+            StreamSendSocket::Udp(socket) => {
+                trace_err!(socket.send_batch(packets, spread, fan_out).await)
+            }
+            StreamSendSocket::Tcp(socket) => {
+                let mut socket = socket.lock().await;
+                for packet in packets {
+                    trace_err!(socket.feed(packet).await)?;
+                }
+                trace_err!(socket.flush().await)
+            }
+            StreamSendSocket::ThrottledUdp(socket) => trace_err!(socket.send_batch(&packets).await),
+        }
+    }
+
+    // Must be called with the SendGate held
+    fn mark(&self, category: AccessCategory) {
+        match self {
+            StreamSendSocket::Udp(socket) => socket.marking.apply(&socket.socket, category),
+            StreamSendSocket::ThrottledUdp(socket) => socket.mark(category),
+            // The segments mix the streams, they keep the marking of the latency critical ones
+            StreamSendSocket::Tcp(_) => (),
+        }
+    }
+}
+
 enum StreamReceiveSocket {
     Udp(UdpStreamReceiveSocket),
     ThrottledUdp(ThrottledUdpStreamReceiveSocket),
@@ -122,6 +218,8 @@ impl Drop for SendBufferLock<'_> {
 pub struct SenderBuffer<T> {
     inner: BytesMut,
     offset: usize,
+    // Not to be delayed by the frame pacer
+    priority: bool,
     _phantom: PhantomData<T>,
 }
 
@@ -141,72 +239,247 @@ impl<T> SenderBuffer<T> {
 pub struct StreamSender<T> {
     stream_id: StreamId,
     socket: StreamSendSocket,
+    // shared by all streams of the socket
+    gate: Arc<SendGate>,
+    class: StreamClass,
+    impairment: Option<Arc<Impairment>>,
     // if the packet index overflows the worst that happens is a false positive packet loss
     next_packet_index: u32,
+    // Transport sequence number, shared by all streams of the socket
+    next_sequence: Arc<AtomicU16>,
     _phantom: PhantomData<T>,
 }
 
 impl<T> StreamSender<T> {
+    fn write_indices(&mut self, packet: &mut BytesMut) {
+        packet[2..6].copy_from_slice(&self.next_packet_index.to_be_bytes());
+        self.next_packet_index += 1;
+
+        let sequence = self.next_sequence.fetch_add(1, Ordering::Relaxed);
+        packet[6..8].copy_from_slice(&sequence.to_be_bytes());
+    }
+
     // The buffer is moved into the method. There is no way of reusing the same buffer twice without
     // extra copies/allocations
     pub async fn send_buffer(&mut self, mut buffer: SenderBuffer<T>) -> StrResult {
-        buffer.inner[2..6].copy_from_slice(&self.next_packet_index.to_be_bytes());
-        self.next_packet_index += 1;
+        self.write_indices(&mut buffer.inner);
 
-        match &self.socket {
-            StreamSendSocket::Udp(socket) => trace_err!(
-                socket
-                    .inner
-                    .lock()
-                    .await
-                    .send((buffer.inner.freeze(), socket.peer_addr))
-                    .await
-            ),
-            StreamSendSocket::Tcp(socket) => {
-                trace_err!(socket.lock().await.send(buffer.inner.freeze()).await)
+        self.send_packets(vec![buffer.inner.freeze()], vec![]).await
+    }
+
+    // Send many buffers back to back, for example all packets of a video frame. On Linux the UDP
+    // sockets hand the whole batch to the kernel with sendmmsg() instead of one send() per packet.
+    pub async fn send_buffers(&mut self, buffers: Vec<SenderBuffer<T>>) -> StrResult {
+        let priorities = buffers
+            .iter()
+            .map(|buffer| buffer.priority)
+            .collect::<Vec<_>>();
+        let mut packets = buffers
+            .into_iter()
+            .map(|mut buffer| {
+                self.write_indices(&mut buffer.inner);
+
+                buffer.inner.freeze()
+            })
+            .collect::<Vec<_>>();
+
+        self.send_packets(packets, priorities).await
+    }
+
+    // Wait for the socket behind the more urgent streams, then send in chunks so that they can
+    // preempt a long batch. `priorities` can be empty, only the frame pacer uses them.
+    async fn send_packets(
+        &mut self,
+        mut packets: Vec<Bytes>,
+        mut priorities: Vec<bool>,
+    ) -> StrResult {
+        let queued_time = Instant::now();
+
+        if let Some(impairment) = &self.impairment {
+            packets = impairment.apply(packets);
+            if packets.is_empty() {
+                return Ok(());
+            }
+            // Dropped packets break the correspondence
+            priorities.clear();
+        }
+
+        let permit = self.gate.acquire(self.class.priority).await;
+
+        let expired = self
+            .class
+            .deadline
+            .map_or(false, |deadline| queued_time.elapsed() > deadline);
+        scheduler::record_send(self.stream_id, queued_time, expired);
+        if expired {
+            return Ok(());
+        }
+
+        if let StreamSendSocket::ThrottledUdp(socket) = &self.socket {
+            if socket.paces_frames() {
+                drop(permit);
+                return trace_err!(
+                    socket
+                        .send_paced(
+                            &packets,
+                            &priorities,
+                            &self.gate,
+                            self.class.priority,
+                            self.class.access_category,
+                        )
+                        .await
+                );
             }
-            StreamSendSocket::ThrottledUdp(socket) => {
-                trace_err!(socket.send(buffer.inner.freeze()).await)
+        }
+
+        let mut permit = Some(permit);
+        for chunk in packets.chunks(PREEMPTION_CHUNK_PACKETS) {
+            let _permit = match permit.take() {
+                Some(permit) => permit,
+                None => self.gate.acquire(self.class.priority).await,
+            };
+            self.socket.mark(self.class.access_category);
+
+            match chunk {
+                [packet] if !self.class.multipath && !self.class.fan_out => {
+                    self.socket.send(packet.clone()).await?
+                }
+                _ => {
+                    self.socket
+                        .send_batch(chunk.to_vec(), self.class.multipath, self.class.fan_out)
+                        .await?
+                }
             }
         }
+
+        Ok(())
     }
 }
 
+// Write stream ID, packet index and sequence number placeholders and header. Returns the offset of
+// the payload.
+fn put_packet_header<T: Serialize>(
+    buffer: &mut BytesMut,
+    stream_id: StreamId,
+    header: &T,
+) -> StrResult<usize> {
+    let start = buffer.len();
+
+    // the first two bytes are for the stream ID
+    buffer.put_u16(stream_id);
+
+    // make space for the packet index and the transport sequence number
+    buffer.put_u32(0);
+    buffer.put_u16(0);
+
+    let mut buffer_writer = buffer.writer();
+    trace_err!(bincode::serialize_into(&mut buffer_writer, header))?;
+
+    Ok(buffer_writer.into_inner().len() - start)
+}
+
 impl<T: Serialize> StreamSender<T> {
     pub fn new_buffer(
         &self,
         header: &T,
         preferred_max_buffer_size: usize,
     ) -> StrResult<SenderBuffer<T>> {
-        let header_size = trace_err!(bincode::serialized_size(header))?;
-        // the first two bytes are for the stream ID
-        let offset = 2 + 4 + header_size as usize;
+        self.buffer_factory()
+            .new_buffer(header, preferred_max_buffer_size)
+    }
+
+    pub async fn send(&mut self, packet: &T) -> StrResult {
+        self.send_buffer(self.new_buffer(packet, 0)?).await
+    }
+}
+
+impl<T> StreamSender<T> {
+    // Get a handle that can create buffers for this stream from any thread, without borrowing the
+    // sender
+    pub fn buffer_factory(&self) -> SenderBufferFactory<T> {
+        SenderBufferFactory {
+            stream_id: self.stream_id,
+            _phantom: PhantomData,
+        }
+    }
+}
 
-        let mut buffer = BytesMut::with_capacity(offset + preferred_max_buffer_size);
+pub struct SenderBufferFactory<T> {
+    stream_id: StreamId,
+    _phantom: PhantomData<T>,
+}
 
-        buffer.put_u16(self.stream_id);
+impl<T> Clone for SenderBufferFactory<T> {
+    fn clone(&self) -> Self {
+        Self {
+            stream_id: self.stream_id,
+            _phantom: PhantomData,
+        }
+    }
+}
 
-        // make space for the packet index
-        buffer.put_u32(0);
+impl<T: Serialize> SenderBufferFactory<T> {
+    pub fn new_buffer(
+        &self,
+        header: &T,
+        preferred_max_buffer_size: usize,
+    ) -> StrResult<SenderBuffer<T>> {
+        let header_size = trace_err!(bincode::serialized_size(header))?;
+        let mut buffer =
+            BytesMut::with_capacity(2 + 4 + 2 + header_size as usize + preferred_max_buffer_size);
 
-        let mut buffer_writer = buffer.writer();
-        trace_err!(bincode::serialize_into(&mut buffer_writer, header))?;
-        let buffer = buffer_writer.into_inner();
+        let offset = put_packet_header(&mut buffer, self.stream_id, header)?;
 
         Ok(SenderBuffer {
             inner: buffer,
             offset,
+            priority: false,
             _phantom: PhantomData,
         })
     }
 
-    pub async fn send(&mut self, packet: &T) -> StrResult {
-        self.send_buffer(self.new_buffer(packet, 0)?).await
+    // Serialize many packets into a single allocation. `capacity` should cover all headers and
+    // payloads, otherwise the storage is grown as needed.
+    pub fn new_batch(&self, capacity: usize) -> SenderBatch<T> {
+        SenderBatch {
+            stream_id: self.stream_id,
+            storage: BytesMut::with_capacity(capacity),
+            buffers: vec![],
+        }
+    }
+}
+
+// Packets of a batch share the same storage. Each buffer is a refcounted view into it and can be
+// sent independently with StreamSender::send_buffer().
+pub struct SenderBatch<T> {
+    stream_id: StreamId,
+    storage: BytesMut,
+    buffers: Vec<SenderBuffer<T>>,
+}
+
+impl<T: Serialize> SenderBatch<T> {
+    // Priority packets are sent without waiting for the frame pacer
+    pub fn push(&mut self, header: &T, payload: &[u8], priority: bool) -> StrResult {
+        let offset = put_packet_header(&mut self.storage, self.stream_id, header)?;
+        self.storage.extend_from_slice(payload);
+
+        self.buffers.push(SenderBuffer {
+            inner: self.storage.split(),
+            offset,
+            priority,
+            _phantom: PhantomData,
+        });
+
+        Ok(())
+    }
+
+    pub fn into_buffers(self) -> Vec<SenderBuffer<T>> {
+        self.buffers
     }
 }
 
 enum StreamReceiverType {
-    Queue(mpsc::UnboundedReceiver<BytesMut>),
+    Queue(mpsc::UnboundedReceiver<(BytesMut, Option<SystemTime>)>),
     // QuicReliable(...)
 }
 
@@ -214,25 +487,61 @@ pub struct ReceivedPacket<T> {
     pub header: T,
     pub buffer: BytesMut,
     pub had_packet_loss: bool,
+    // Index of the packet in the stream, the first packet is 0
+    pub packet_index: u32,
+    // Bytes of the packet after the stream ID
+    pub size: usize,
+    // Time at which the kernel received the datagram, on Linux and Android UDP sockets
+    pub receive_time: Option<SystemTime>,
 }
 
 pub struct StreamReceiver<T> {
     stream_id: StreamId,
     receiver: StreamReceiverType,
+    pool: ReceiveBufferPool,
     next_packet_index: u32,
     _phantom: PhantomData<T>,
 }
 
 impl<T: DeserializeOwned> StreamReceiver<T> {
     pub async fn recv(&mut self) -> StrResult<ReceivedPacket<T>> {
-        let mut bytes = match &mut self.receiver {
+        let (bytes, receive_time) = match &mut self.receiver {
             StreamReceiverType::Queue(receiver) => trace_none!(receiver.recv().await)?,
         };
 
+        self.parse(bytes, receive_time)
+    }
+
+    // Packet already queued, if any. Used to drain the packets that arrived with the one returned
+    // by recv().
+    pub fn try_recv(&mut self) -> Option<StrResult<ReceivedPacket<T>>> {
+        let (bytes, receive_time) = match &mut self.receiver {
+            StreamReceiverType::Queue(receiver) => receiver.try_recv().ok()?,
+        };
+
+        Some(self.parse(bytes, receive_time))
+    }
+
+    // Returns the buffer of a received packet to the pool of the stream once its payload has been
+    // processed, so that the receive loop can reuse it
+    pub fn recycle(&self, buffer: BytesMut) {
+        self.pool.recycle(buffer);
+    }
+
+    fn parse(
+        &mut self,
+        mut bytes: BytesMut,
+        receive_time: Option<SystemTime>,
+    ) -> StrResult<ReceivedPacket<T>> {
+        let size = bytes.len();
+
         let packet_index = bytes.get_u32();
         let had_packet_loss = packet_index != self.next_packet_index;
         self.next_packet_index = packet_index + 1;
 
+        // The transport sequence number is only used by the socket
+        bytes.advance(2);
+
         let mut bytes_reader = bytes.reader();
         let header = trace_err!(bincode::deserialize_from(&mut bytes_reader))?;
         let buffer = bytes_reader.into_inner();
@@ -242,6 +551,41 @@ impl<T: DeserializeOwned> StreamReceiver<T> {
             header,
             buffer,
             had_packet_loss,
+            packet_index,
+            size,
+            receive_time,
+        })
+    }
+}
+
+// Socket of the server, bound and sized during the handshake so that connect_to_client() only has
+// to reach the client. TCP connects to the listener of the client, so only its socket is created.
+pub enum PrewarmedStreamSocket {
+    Tcp(net::TcpSocket),
+    Udp(net::UdpSocket),
+    ThrottledUdp(net::UdpSocket),
+}
+
+impl PrewarmedStreamSocket {
+    pub async fn bind(
+        client_ip: IpAddr,
+        port: u16,
+        protocol: &SocketProtocol,
+        send_buffer_bytes: SocketBufferSize,
+        recv_buffer_bytes: SocketBufferSize,
+    ) -> StrResult<Self> {
+        Ok(match protocol {
+            SocketProtocol::Udp => {
+                Self::Udp(udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?)
+            }
+            SocketProtocol::Tcp => Self::Tcp(tcp::prepare_connection(
+                client_ip,
+                send_buffer_bytes,
+                recv_buffer_bytes,
+            )?),
+            SocketProtocol::ThrottledUdp { .. } => {
+                Self::ThrottledUdp(udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?)
+            }
         })
     }
 }
@@ -253,29 +597,61 @@ pub enum StreamSocketBuilder {
 }
 
 impl StreamSocketBuilder {
+    // busy_poll_us is the SO_BUSY_POLL time of UDP sockets, 0 to disable
     pub async fn listen_for_server(
         port: u16,
         stream_socket_config: SocketProtocol,
         send_buffer_bytes: SocketBufferSize,
         recv_buffer_bytes: SocketBufferSize,
+        busy_poll_us: u32,
     ) -> StrResult<Self> {
+        let with_busy_poll = |socket: net::UdpSocket| {
+            if busy_poll_us > 0 {
+                udp::set_busy_poll(&socket, busy_poll_us);
+            }
+            socket
+        };
+
         Ok(match stream_socket_config {
-            SocketProtocol::Udp => StreamSocketBuilder::Udp(
+            SocketProtocol::Udp => StreamSocketBuilder::Udp(with_busy_poll(
                 udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?,
-            ),
+            )),
             SocketProtocol::Tcp => StreamSocketBuilder::Tcp(
                 tcp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?,
             ),
             SocketProtocol::ThrottledUdp { .. } => StreamSocketBuilder::ThrottledUdp(
-                udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?,
+                with_busy_poll(udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?),
             ),
         })
     }
 
-    pub async fn accept_from_server(self, server_ip: IpAddr, port: u16) -> StrResult<StreamSocket> {
+    // The receive buffers are sized for datagrams of `datagram_size` bytes, usually the ones of
+    // video_datagram_size(). Larger datagrams are copied. `secondary_server_ip` is the address of
+    // the server on the second link of a multipath socket. With `transport_feedback` the arrivals
+    // are logged for transport_feedback(). Only UDP supports the last two.
+    pub async fn accept_from_server(
+        self,
+        server_ip: IpAddr,
+        secondary_server_ip: Option<IpAddr>,
+        port: u16,
+        datagram_size: usize,
+        transport_feedback: bool,
+    ) -> StrResult<StreamSocket> {
+        let arrival_log = (transport_feedback && matches!(self, StreamSocketBuilder::Udp(_)))
+            .then(|| Arc::new(ArrivalLog::new()));
+
         let (send_socket, receive_socket) = match self {
             StreamSocketBuilder::Udp(socket) => {
-                let (send_socket, receive_socket) = udp::connect(socket, server_ip, port).await?;
+                let (send_socket, receive_socket) = udp::connect(
+                    socket,
+                    server_ip,
+                    port,
+                    secondary_server_ip,
+                    None,
+                    arrival_log.clone(),
+                    None,
+                )
+                .await?;
                 (
                     StreamSendSocket::Udp(send_socket),
                     StreamReceiveSocket::Udp(receive_socket),
@@ -300,47 +676,86 @@ impl StreamSocketBuilder {
         };
 
         Ok(StreamSocket {
+            paths: multipath_paths(&send_socket, &receive_socket),
             send_socket,
+            send_gate: Arc::new(SendGate::default()),
             receive_socket: Arc::new(Mutex::new(Some(receive_socket))),
+            datagram_size,
             packet_queues: Arc::new(Mutex::new(HashMap::new())),
+            impairment: None,
+            next_sequence: Arc::new(AtomicU16::new(0)),
+            send_log: None,
+            arrival_log,
+            fan_out: None,
         })
     }
 
+    // `socket` must have been bound for `protocol`. If the protocol is UDP, the video is also sent
+    // to `secondary_client_ip` over another link if it is set and to the `spectators`, and with
+    // `transport_feedback` the sends are logged for report_transport_feedback(). impairment
+    // emulates a bad link on the packets sent to the client, for testing. `video_packet_size` is the
+    // negotiated one.
+    #[allow(clippy::too_many_arguments)]
     pub async fn connect_to_client(
+        socket: PrewarmedStreamSocket,
         client_ip: IpAddr,
+        secondary_client_ip: Option<IpAddr>,
         port: u16,
         protocol: SocketProtocol,
         video_byterate: u32,
-        send_buffer_bytes: SocketBufferSize,
-        recv_buffer_bytes: SocketBufferSize,
+        video_packet_size: u32,
+        fps: f32,
+        transport_feedback: bool,
+        impairment: Option<NetworkImpairmentDesc>,
+        spectators: Vec<SocketAddr>,
     ) -> StrResult<StreamSocket> {
-        let (send_socket, receive_socket) = match protocol {
-            SocketProtocol::Udp => {
-                let socket = udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?;
-                let (send_socket, receive_socket) = udp::connect(socket, client_ip, port).await?;
+        let send_log = (transport_feedback && matches!(protocol, SocketProtocol::Udp))
+            .then(|| Arc::new(SendLog::new()));
+        let fan_out = (!spectators.is_empty() && matches!(protocol, SocketProtocol::Udp))
+            .then(|| Arc::new(FanOut::new(spectators)));
+        let video_datagram_size = video_datagram_size(&protocol, video_packet_size);
+
+        let (send_socket, receive_socket) = match (socket, protocol) {
+            (PrewarmedStreamSocket::Udp(socket), SocketProtocol::Udp) => {
+                let (send_socket, receive_socket) = udp::connect(
+                    socket,
+                    client_ip,
+                    port,
+                    secondary_client_ip,
+                    send_log.clone(),
+                    None,
+                    fan_out.clone(),
+                )
+                .await?;
                 (
                     StreamSendSocket::Udp(send_socket),
                     StreamReceiveSocket::Udp(receive_socket),
                 )
             }
-            SocketProtocol::Tcp => {
+            (PrewarmedStreamSocket::Tcp(socket), SocketProtocol::Tcp) => {
                 let (send_socket, receive_socket) =
-                    tcp::connect_to_client(client_ip, port, send_buffer_bytes, recv_buffer_bytes)
-                        .await?;
+                    tcp::connect_to_client(socket, client_ip, port).await?;
                 (
                     StreamSendSocket::Tcp(send_socket),
                     StreamReceiveSocket::Tcp(receive_socket),
                 )
             }
-            SocketProtocol::ThrottledUdp { bitrate_multiplier } => {
-                let socket = udp::bind(port, send_buffer_bytes, recv_buffer_bytes).await?;
-
+            (
+                PrewarmedStreamSocket::ThrottledUdp(socket),
+                SocketProtocol::ThrottledUdp {
+                    bitrate_multiplier,
+                    frame_pacing,
+                },
+            ) => {
                 let (send_socket, receive_socket) = throttled_udp::connect_to_client(
                     socket,
                     client_ip,
                     port,
                     video_byterate,
+                    video_datagram_size,
                     bitrate_multiplier,
+                    frame_pacing.into_option(),
+                    fps,
                 )
                 .await?;
                 (
@@ -348,28 +763,99 @@ impl StreamSocketBuilder {
                     StreamReceiveSocket::ThrottledUdp(receive_socket),
                 )
             }
+            _ => return fmt_e!("The stream socket was not bound for this protocol"),
         };
 
+        let impairment =
+            impairment.map(|config| Arc::new(Impairment::new(config, send_socket.clone())));
+
         Ok(StreamSocket {
+            paths: multipath_paths(&send_socket, &receive_socket),
             send_socket,
+            send_gate: Arc::new(SendGate::default()),
             receive_socket: Arc::new(Mutex::new(Some(receive_socket))),
+            datagram_size: SERVER_DATAGRAM_SIZE,
             packet_queues: Arc::new(Mutex::new(HashMap::new())),
+            impairment,
+            next_sequence: Arc::new(AtomicU16::new(0)),
+            send_log,
+            arrival_log: None,
+            fan_out,
         })
     }
 }
 
+fn multipath_paths(
+    send_socket: &StreamSendSocket,
+    receive_socket: &StreamReceiveSocket,
+) -> Option<(Arc<PathScheduler>, Arc<PathReception>)> {
+    match (send_socket, receive_socket) {
+        (StreamSendSocket::Udp(send_socket), StreamReceiveSocket::Udp(receive_socket)) => {
+            send_socket.paths.clone().zip(receive_socket.paths.clone())
+        }
+        _ => None,
+    }
+}
+
 pub struct StreamSocket {
     send_socket: StreamSendSocket,
+    send_gate: Arc<SendGate>,
     receive_socket: Arc<Mutex<Option<StreamReceiveSocket>>>,
-    packet_queues: Arc<Mutex<HashMap<StreamId, mpsc::UnboundedSender<BytesMut>>>>,
+    datagram_size: usize,
+    packet_queues: PacketEnqueuers,
+    impairment: Option<Arc<Impairment>>,
+    // Set if the socket is multipath
+    paths: Option<(Arc<PathScheduler>, Arc<PathReception>)>,
+    next_sequence: Arc<AtomicU16>,
+    // Set on the side that asks for transport feedback and on the one that reports it
+    send_log: Option<Arc<SendLog>>,
+    arrival_log: Option<Arc<ArrivalLog>>,
+    // Set on the server if there are spectators
+    fan_out: Option<Arc<FanOut>>,
 }
 
 impl StreamSocket {
+    // Datagrams received from each address of the peer since the start, to be reported to it
+    pub fn path_reception(&self) -> Option<[u64; PATH_COUNT]> {
+        self.paths
+            .as_ref()
+            .map(|(_, reception)| reception.received.load())
+    }
+
+    // Balances the paths with the counts reported by path_reception() on the peer
+    pub fn report_path_reception(&self, received: [u64; PATH_COUNT]) {
+        if let Some((scheduler, _)) = &self.paths {
+            scheduler.report_reception(received);
+        }
+    }
+
+    // Arrivals logged since the last call, to be reported to the peer every FEEDBACK_INTERVAL
+    pub fn transport_feedback(&self) -> Option<TransportFeedback> {
+        self.arrival_log.as_ref()?.take_report()
+    }
+
+    // Matches a report of transport_feedback() on the peer with the logged sends
+    pub fn report_transport_feedback(
+        &self,
+        feedback: &TransportFeedback,
+    ) -> Option<FeedbackSummary> {
+        Some(self.send_log.as_ref()?.process(feedback))
+    }
+
+    // Reports of the spectators since the last call, to be taken every second
+    pub fn spectator_summary(&self) -> Option<SpectatorSummary> {
+        self.fan_out.as_ref()?.take_summary()
+    }
+
     pub async fn request_stream<T>(&self, stream_id: StreamId) -> StrResult<StreamSender<T>> {
         Ok(StreamSender {
             stream_id,
             socket: self.send_socket.clone(),
+            gate: Arc::clone(&self.send_gate),
+            class: scheduler::stream_class(stream_id),
+            impairment: self.impairment.clone(),
             next_packet_index: 0,
+            next_sequence: Arc::clone(&self.next_sequence),
             _phantom: PhantomData,
         })
     }
@@ -378,12 +864,20 @@ impl StreamSocket {
         &self,
         stream_id: StreamId,
     ) -> StrResult<StreamReceiver<T>> {
-        let (enqueuer, dequeuer) = mpsc::unbounded_channel();
-        self.packet_queues.lock().await.insert(stream_id, enqueuer);
+        let (sender, dequeuer) = mpsc::unbounded_channel();
+        let pool = ReceiveBufferPool::new(self.datagram_size);
+        self.packet_queues.lock().await.insert(
+            stream_id,
+            StreamQueue {
+                sender,
+                pool: pool.clone(),
+            },
+        );
 
         Ok(StreamReceiver {
             stream_id,
             receiver: StreamReceiverType::Queue(dequeuer),
+            pool,
             next_packet_index: 0,
             _phantom: PhantomData,
         })
@@ -392,14 +886,50 @@ impl StreamSocket {
     pub async fn receive_loop(&self) -> StrResult {
         match self.receive_socket.lock().await.take().unwrap() {
             StreamReceiveSocket::Udp(socket) => {
-                udp::receive_loop(socket, Arc::clone(&self.packet_queues)).await
+                udp::receive_loop(socket, self.datagram_size, Arc::clone(&self.packet_queues)).await
             }
             StreamReceiveSocket::Tcp(socket) => {
                 tcp::receive_loop(socket, Arc::clone(&self.packet_queues)).await
             }
             StreamReceiveSocket::ThrottledUdp(socket) => {
-                throttled_udp::receive_loop(socket, Arc::clone(&self.packet_queues)).await
+                throttled_udp::receive_loop(
+                    socket,
+                    self.datagram_size,
+                    Arc::clone(&self.packet_queues),
+                )
+                .await
             }
         }
     }
+
+    // Replaces receive_loop(): the payload of `stream_id` is received in place, `header_size` is
+    // the serialized size of its header, which must be fixed. Only UDP sockets support it.
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    pub async fn in_place_receive_loop(
+        &self,
+        stream_id: StreamId,
+        header_size: usize,
+    ) -> StrResult<InPlaceReceiveLoop> {
+        let (socket, peer_addr, paths, arrival_log) =
+            match self.receive_socket.lock().await.take().unwrap() {
+                StreamReceiveSocket::Udp(socket) => (
+                    socket.socket,
+                    Some(socket.peer_addr),
+                    socket.paths,
+                    socket.arrival_log,
+                ),
+                StreamReceiveSocket::ThrottledUdp(socket) => (socket.inner, None, None, None),
+                StreamReceiveSocket::Tcp(_) => return fmt_e!("TCP cannot receive in place"),
+            };
+
+        Ok(InPlaceReceiveLoop {
+            socket,
+            peer_addr,
+            paths,
+            arrival_log,
+            stream_id,
+            header_size,
+            packet_enqueuers: Arc::clone(&self.packet_queues),
+        })
+    }
 }
@@ -0,0 +1,163 @@
+// Video sent over two links to the client at once, for example 5 GHz Wi-Fi and USB tethering, for
+// more throughput and to ride out the fades of a single link. Only the UDP socket supports it: its
+// datagrams are addressed one by one, so the ones sent to the secondary address of the client are
+// routed by the kernel through the other link, with the address of the server on that link as
+// source.
+//
+// The video packets, FEC parity included, are spread over the paths in proportion to a share. The
+// client counts the datagrams received from each address of the server and reports the counts
+// every second, the share moves away from the path that loses more.
+
+use bytes::Bytes;
+use std::{
+    net::{IpAddr, SocketAddr, UdpSocket},
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Mutex,
+    },
+};
+
+pub const PRIMARY_PATH: usize = 0;
+pub const SECONDARY_PATH: usize = 1;
+pub const PATH_COUNT: usize = 2;
+
+// Each path keeps at least this share, so that its loss is still measured
+const MIN_SHARE: f32 = 0.1;
+const INITIAL_SECONDARY_SHARE: f32 = 0.5;
+// Share moved for each unit of difference between the loss ratios of the paths
+const LOSS_GAIN: f32 = 1.;
+// Loss ratios measured on fewer packets are not significant
+const MIN_REPORT_PACKETS: u64 = 50;
+
+#[derive(Default)]
+pub struct PathCounters([AtomicU64; PATH_COUNT]);
+
+impl PathCounters {
+    pub fn add(&self, path: usize, count: usize) {
+        self.0[path].fetch_add(count as u64, Ordering::Relaxed);
+    }
+
+    pub fn load(&self) -> [u64; PATH_COUNT] {
+        [
+            self.0[PRIMARY_PATH].load(Ordering::Relaxed),
+            self.0[SECONDARY_PATH].load(Ordering::Relaxed),
+        ]
+    }
+}
+
+struct SchedulerState {
+    secondary_share: f32,
+    // A packet goes to the secondary path each time the credit reaches 1
+    credit: f32,
+    last_sent: [u64; PATH_COUNT],
+    last_received: Option<[u64; PATH_COUNT]>,
+}
+
+// Sending side. Only the server spreads packets.
+pub struct PathScheduler {
+    pub secondary_addr: SocketAddr,
+    // Datagrams of all the streams, the other streams only use the primary path
+    pub sent: PathCounters,
+    state: Mutex<SchedulerState>,
+}
+
+impl PathScheduler {
+    pub fn new(secondary_addr: SocketAddr) -> Self {
+        Self {
+            secondary_addr,
+            sent: PathCounters::default(),
+            state: Mutex::new(SchedulerState {
+                secondary_share: INITIAL_SECONDARY_SHARE,
+                credit: 0.,
+                last_sent: [0; PATH_COUNT],
+                last_received: None,
+            }),
+        }
+    }
+
+    // Returns the packets of each path, in their original order
+    pub fn split(&self, packets: Vec<Bytes>) -> [Vec<Bytes>; PATH_COUNT] {
+        let mut state = self.state.lock().unwrap();
+
+        let mut paths = [vec![], vec![]];
+        for packet in packets {
+            state.credit += state.secondary_share;
+            if state.credit >= 1. {
+                state.credit -= 1.;
+                paths[SECONDARY_PATH].push(packet);
+            } else {
+                paths[PRIMARY_PATH].push(packet);
+            }
+        }
+
+        paths
+    }
+
+    // `received` are the counts of datagrams the client received on each path since the start
+    pub fn report_reception(&self, received: [u64; PATH_COUNT]) {
+        let sent = self.sent.load();
+        let mut state = self.state.lock().unwrap();
+
+        if let Some(last_received) = state.last_received {
+            let mut loss = [None; PATH_COUNT];
+            for path in 0..PATH_COUNT {
+                let sent_count = sent[path].saturating_sub(state.last_sent[path]);
+                let received_count = received[path].saturating_sub(last_received[path]);
+                if sent_count >= MIN_REPORT_PACKETS {
+                    loss[path] = Some(1. - (received_count as f32 / sent_count as f32).min(1.));
+                }
+            }
+
+            if let [Some(primary_loss), Some(secondary_loss)] = loss {
+                state.secondary_share = (state.secondary_share
+                    + LOSS_GAIN * (primary_loss - secondary_loss))
+                    .clamp(MIN_SHARE, 1. - MIN_SHARE);
+            }
+        }
+
+        state.last_sent = sent;
+        state.last_received = Some(received);
+    }
+}
+
+// Receiving side
+pub struct PathReception {
+    pub secondary_addr: SocketAddr,
+    pub received: PathCounters,
+}
+
+// Checks that a datagram comes from the server and counts it for its path
+pub fn accept_source(
+    peer_addr: SocketAddr,
+    paths: Option<&PathReception>,
+    address: SocketAddr,
+) -> bool {
+    match paths {
+        None => address == peer_addr,
+        Some(paths) => {
+            let path = if address == peer_addr {
+                PRIMARY_PATH
+            } else if address == paths.secondary_addr {
+                SECONDARY_PATH
+            } else {
+                return false;
+            };
+            paths.received.add(path, 1);
+
+            true
+        }
+    }
+}
+
+// Address of this machine on the route to `peer_ip`, the source of the datagrams sent to it
+pub fn local_ip_towards(peer_ip: IpAddr) -> Option<IpAddr> {
+    let socket = match peer_ip {
+        IpAddr::V4(_) => UdpSocket::bind((crate::LOCAL_IP, 0)),
+        IpAddr::V6(_) => UdpSocket::bind(("::", 0)),
+    }
+    .ok()?;
+    // Only selects the route, nothing is sent
+    socket.connect((peer_ip, 9)).ok()?;
+
+    Some(socket.local_addr().ok()?.ip())
+}
@@ -0,0 +1,104 @@
+// Payload size of the video packets, negotiated for each session. The default one leaves room for
+// the headers below the 1500 bytes MTU of Ethernet and Wi-Fi. Wired links with jumbo frames can
+// carry larger payloads, which cuts the number of packets, and of syscalls, per frame.
+
+use crate::VideoFrameHeaderPacket;
+use alvr_session::{SocketProtocol, VideoPacketSize};
+use std::net::IpAddr;
+
+// ALVR_MAX_VIDEO_BUFFER_SIZE, the only size supported by clients that report no path MTU
+pub const DEFAULT_VIDEO_PACKET_SIZE: u32 = 1400;
+const MIN_VIDEO_PACKET_SIZE: u32 = 512;
+// Leaves room for the headers in the largest UDP datagram
+const MAX_VIDEO_PACKET_SIZE: u32 = 65_000;
+
+const IPV4_HEADER_SIZE: u32 = 20;
+const IPV6_HEADER_SIZE: u32 = 40;
+const UDP_HEADER_SIZE: u32 = 8;
+
+// Length prefix (UDP only), stream ID, packet index, sequence number and header of a video packet
+fn stream_overhead(protocol: &SocketProtocol) -> u32 {
+    let length_prefix = if matches!(protocol, SocketProtocol::Udp) {
+        4
+    } else {
+        0
+    };
+    let header_size = bincode::serialized_size(&VideoFrameHeaderPacket::default()).unwrap_or(0);
+
+    length_prefix + 2 + 4 + 2 + header_size as u32
+}
+
+// Size of the datagrams carrying video packets of `packet_size` payload bytes
+pub fn video_datagram_size(protocol: &SocketProtocol, packet_size: u32) -> usize {
+    (stream_overhead(protocol) + packet_size) as usize
+}
+
+// Run by the server when a client connects. `path_mtu` is reported by the client, 0 if it only
+// supports the default size.
+pub fn negotiate_video_packet_size(
+    setting: &VideoPacketSize,
+    protocol: &SocketProtocol,
+    client_ip: IpAddr,
+    path_mtu: u32,
+) -> u32 {
+    if path_mtu == 0 {
+        return DEFAULT_VIDEO_PACKET_SIZE;
+    }
+
+    let size = match setting {
+        VideoPacketSize::Default => DEFAULT_VIDEO_PACKET_SIZE,
+        // TCP segments the stream on its own
+        VideoPacketSize::PathMtu if matches!(protocol, SocketProtocol::Tcp) => {
+            DEFAULT_VIDEO_PACKET_SIZE
+        }
+        VideoPacketSize::PathMtu => {
+            let ip_header_size = if client_ip.is_ipv4() {
+                IPV4_HEADER_SIZE
+            } else {
+                IPV6_HEADER_SIZE
+            };
+            path_mtu.saturating_sub(ip_header_size + UDP_HEADER_SIZE + stream_overhead(protocol))
+        }
+        VideoPacketSize::Custom(size) => *size,
+    };
+
+    size.clamp(MIN_VIDEO_PACKET_SIZE, MAX_VIDEO_PACKET_SIZE)
+}
+
+// MTU of the route to the peer as known by the kernel: the MTU of the interface, or less if a
+// smaller path MTU was learned on the way. No probe is sent.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn path_mtu(peer_ip: IpAddr, port: u16) -> Option<u32> {
+    use std::{mem, net::UdpSocket, os::unix::io::AsRawFd};
+
+    let socket = match peer_ip {
+        IpAddr::V4(_) => UdpSocket::bind((crate::LOCAL_IP, 0)),
+        IpAddr::V6(_) => UdpSocket::bind(("::", 0)),
+    }
+    .ok()?;
+    // Only selects the route, nothing is sent
+    socket.connect((peer_ip, port)).ok()?;
+
+    let (level, name) = match peer_ip {
+        IpAddr::V4(_) => (libc::IPPROTO_IP, libc::IP_MTU),
+        IpAddr::V6(_) => (libc::IPPROTO_IPV6, libc::IPV6_MTU),
+    };
+    let mut mtu: libc::c_int = 0;
+    let mut length = mem::size_of_val(&mtu) as libc::socklen_t;
+    let res = unsafe {
+        libc::getsockopt(
+            socket.as_raw_fd(),
+            level,
+            name,
+            &mut mtu as *mut _ as *mut libc::c_void,
+            &mut length,
+        )
+    };
+
+    (res == 0 && mtu > 0).then(|| mtu as u32)
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn path_mtu(_: IpAddr, _: u16) -> Option<u32> {
+    None
+}
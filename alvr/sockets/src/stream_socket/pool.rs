@@ -0,0 +1,52 @@
+// Receive buffers of a stream. The receive loops copy the packets they cannot hand over as they
+// are, the ones read into a buffer of the socket, into a buffer taken from the pool of the stream.
+// The consumer returns the buffer with StreamReceiver::recycle() once it processed the packet, so
+// that at a steady packet rate the same buffers go around and nothing is allocated. Packets that
+// are not recycled are simply freed. The other packets, views into the storage of a receive batch,
+// are recycled by the batch and never enter the pool.
+
+use bytes::BytesMut;
+use std::sync::{Arc, Mutex};
+
+// Buffers kept by a pool, more than the packets of a stream usually waiting to be processed
+const MAX_POOLED_BUFFERS: usize = 64;
+
+#[derive(Clone)]
+pub struct ReceiveBufferPool {
+    buffers: Arc<Mutex<Vec<BytesMut>>>,
+    buffer_size: usize,
+}
+
+impl ReceiveBufferPool {
+    pub fn new(buffer_size: usize) -> Self {
+        Self {
+            buffers: Arc::new(Mutex::new(Vec::with_capacity(MAX_POOLED_BUFFERS))),
+            buffer_size,
+        }
+    }
+
+    // Empty buffer with room for `size` bytes. Larger packets than the buffers of the pool get a
+    // buffer of their own.
+    pub fn take(&self, size: usize) -> BytesMut {
+        if size <= self.buffer_size {
+            if let Some(buffer) = self.buffers.lock().unwrap().pop() {
+                return buffer;
+            }
+        }
+
+        BytesMut::with_capacity(size.max(self.buffer_size))
+    }
+
+    pub fn recycle(&self, mut buffer: BytesMut) {
+        buffer.clear();
+
+        // Reclaiming also moves the view back to the start of the allocation, after the packet
+        // header was consumed. It fails if the buffer is still shared.
+        if buffer.try_reclaim(self.buffer_size) && buffer.capacity() == self.buffer_size {
+            let mut buffers = self.buffers.lock().unwrap();
+            if buffers.len() < MAX_POOLED_BUFFERS {
+                buffers.push(buffer);
+            }
+        }
+    }
+}
@@ -0,0 +1,81 @@
+// Wi-Fi multimedia (WMM) marking of the packets. Access points queue the frames of each access
+// category separately and give the voice and video queues shorter contention windows, but they
+// only know the category of a packet from the DSCP in its IP header. The local Wi-Fi driver picks
+// the queue of an outgoing packet from the socket priority instead.
+//
+// The streams share one socket, so the marking is changed when a packet of another category is
+// sent. This happens while the SendGate is held, no packet of another stream is sent in between.
+
+use std::sync::atomic::{AtomicU8, Ordering};
+use tokio::net::UdpSocket;
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+#[repr(u8)]
+pub enum AccessCategory {
+    BestEffort,
+    Video,
+    Voice,
+}
+
+impl AccessCategory {
+    // TOS byte with the DSCP recommended by RFC 8325 for the category: CS0, AF41 and EF
+    fn tos(self) -> u32 {
+        match self {
+            AccessCategory::BestEffort => 0,
+            AccessCategory::Video => 34 << 2,
+            AccessCategory::Voice => 46 << 2,
+        }
+    }
+
+    // 802.1d user priority. Values above 6 need CAP_NET_ADMIN.
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    fn priority(self) -> libc::c_int {
+        match self {
+            AccessCategory::BestEffort => 0,
+            AccessCategory::Video => 5,
+            AccessCategory::Voice => 6,
+        }
+    }
+}
+
+// Failing is not fatal, the packets are sent unmarked
+pub fn set_access_category(socket: &socket2::Socket, category: AccessCategory) {
+    socket.set_tos(category.tos()).ok();
+
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    {
+        use std::os::unix::io::AsRawFd;
+
+        let value = category.priority();
+        unsafe {
+            libc::setsockopt(
+                socket.as_raw_fd(),
+                libc::SOL_SOCKET,
+                libc::SO_PRIORITY,
+                &value as *const _ as *const libc::c_void,
+                std::mem::size_of_val(&value) as libc::socklen_t,
+            )
+        };
+    }
+}
+
+// Marking of a UDP socket shared by streams of different categories
+pub struct DatagramMarking {
+    current: AtomicU8,
+}
+
+impl DatagramMarking {
+    // The socket must have been marked with `category` already
+    pub fn new(category: AccessCategory) -> Self {
+        Self {
+            current: AtomicU8::new(category as u8),
+        }
+    }
+
+    // Must be called with the SendGate held
+    pub fn apply(&self, socket: &UdpSocket, category: AccessCategory) {
+        if self.current.swap(category as u8, Ordering::Relaxed) != category as u8 {
+            set_access_category(&socket2::SockRef::from(socket), category);
+        }
+    }
+}
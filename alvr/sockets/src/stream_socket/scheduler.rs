@@ -0,0 +1,217 @@
+// The streams of a connection share one socket. Without arbitration a haptics or tracking packet
+// waits behind the whole video frame that is being sent, which takes milliseconds once the frame is
+// paced. SendGate hands the socket to one send at a time, the most urgent stream first: video is
+// sent in chunks and a latency critical packet that is waiting goes out between two of them.
+//
+// Each stream also has a deadline: when a packet waited longer than that for the socket it is
+// dropped instead, a newer one supersedes it anyway. The queueing delays are accumulated per stream
+// and exported with stream_queue_statistics().
+
+use super::{qos::AccessCategory, StreamId};
+use crate::{AUDIO, HAPTICS, INPUT, TIME_SYNC, VIDEO};
+use std::{
+    collections::VecDeque,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Mutex,
+    },
+    time::{Duration, Instant},
+};
+use tokio::sync::oneshot;
+
+// Packets of a video frame sent while holding the gate, about 20KB, 0.2ms at 1Gbps
+pub const PREEMPTION_CHUNK_PACKETS: usize = 16;
+
+const PRIORITY_COUNT: usize = 3;
+
+#[derive(Clone, Copy)]
+pub struct StreamClass {
+    // 0 is the most urgent
+    pub priority: usize,
+    pub deadline: Option<Duration>,
+    pub access_category: AccessCategory,
+    // Spread over the paths of a multipath socket
+    pub multipath: bool,
+    // Also sent to the spectators
+    pub fan_out: bool,
+}
+
+pub fn stream_class(stream_id: StreamId) -> StreamClass {
+    match stream_id {
+        // A newer pose supersedes a stale one
+        INPUT => StreamClass {
+            priority: 0,
+            deadline: Some(Duration::from_millis(20)),
+            access_category: AccessCategory::Voice,
+            multipath: false,
+            fan_out: false,
+        },
+        HAPTICS => StreamClass {
+            priority: 0,
+            deadline: None,
+            access_category: AccessCategory::Voice,
+            multipath: false,
+            fan_out: false,
+        },
+        // Queueing would show up in the round trip
+        TIME_SYNC => StreamClass {
+            priority: 0,
+            deadline: None,
+            access_category: AccessCategory::Voice,
+            multipath: false,
+            fan_out: false,
+        },
+        AUDIO => StreamClass {
+            priority: 1,
+            deadline: None,
+            access_category: AccessCategory::Voice,
+            multipath: false,
+            fan_out: false,
+        },
+        // A late frame is still needed by the decoder, the reference chain would break otherwise
+        VIDEO => StreamClass {
+            priority: 2,
+            deadline: None,
+            access_category: AccessCategory::Video,
+            multipath: true,
+            fan_out: true,
+        },
+        _ => StreamClass {
+            priority: 1,
+            deadline: None,
+            access_category: AccessCategory::BestEffort,
+            multipath: false,
+            fan_out: false,
+        },
+    }
+}
+
+#[derive(Default)]
+struct GateState {
+    busy: bool,
+    waiters: [VecDeque<oneshot::Sender<()>>; PRIORITY_COUNT],
+}
+
+#[derive(Default)]
+pub struct SendGate {
+    state: Mutex<GateState>,
+}
+
+pub struct SendPermit<'a> {
+    gate: &'a SendGate,
+}
+
+impl Drop for SendPermit<'_> {
+    fn drop(&mut self) {
+        self.gate.release();
+    }
+}
+
+// Gives the permit back if the acquiring future is dropped after the gate was handed over to it
+struct Waiter<'a> {
+    gate: &'a SendGate,
+    receiver: oneshot::Receiver<()>,
+    granted: bool,
+}
+
+impl Drop for Waiter<'_> {
+    fn drop(&mut self) {
+        if !self.granted {
+            self.receiver.close();
+            if self.receiver.try_recv().is_ok() {
+                self.gate.release();
+            }
+        }
+    }
+}
+
+impl SendGate {
+    pub async fn acquire(&self, priority: usize) -> SendPermit<'_> {
+        let receiver = {
+            let mut state = self.state.lock().unwrap();
+            if !state.busy {
+                state.busy = true;
+                return SendPermit { gate: self };
+            }
+
+            let (sender, receiver) = oneshot::channel();
+            state.waiters[priority.min(PRIORITY_COUNT - 1)].push_back(sender);
+            receiver
+        };
+
+        let mut waiter = Waiter {
+            gate: self,
+            receiver,
+            granted: false,
+        };
+        // The sender is only dropped without sending when the receiver is closed
+        (&mut waiter.receiver).await.ok();
+        waiter.granted = true;
+
+        SendPermit { gate: self }
+    }
+
+    // Hand the gate to the most urgent waiter, it stays busy
+    fn release(&self) {
+        let mut state = self.state.lock().unwrap();
+        for queue in &mut state.waiters {
+            while let Some(sender) = queue.pop_front() {
+                if sender.send(()).is_ok() {
+                    return;
+                }
+            }
+        }
+        state.busy = false;
+    }
+}
+
+pub struct StreamQueueStatistics {
+    pub stream_id: StreamId,
+    pub sends: u64,
+    pub dropped_sends: u64,
+    pub queue_delay_sum: Duration,
+}
+
+struct QueueCounters {
+    sends: AtomicU64,
+    dropped_sends: AtomicU64,
+    queue_delay_sum_ns: AtomicU64,
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO_COUNTERS: QueueCounters = QueueCounters {
+    sends: AtomicU64::new(0),
+    dropped_sends: AtomicU64::new(0),
+    queue_delay_sum_ns: AtomicU64::new(0),
+};
+
+// Indexed by stream ID, other streams are not accounted
+static QUEUE_COUNTERS: [QueueCounters; 4] = [ZERO_COUNTERS; 4];
+
+pub fn record_send(stream_id: StreamId, queued_time: Instant, dropped: bool) {
+    if let Some(counters) = QUEUE_COUNTERS.get(stream_id as usize) {
+        counters.sends.fetch_add(1, Ordering::Relaxed);
+        if dropped {
+            counters.dropped_sends.fetch_add(1, Ordering::Relaxed);
+        }
+        counters
+            .queue_delay_sum_ns
+            .fetch_add(queued_time.elapsed().as_nanos() as u64, Ordering::Relaxed);
+    }
+}
+
+// Totals since the process started. Sends of the packets of a video frame count as one.
+pub fn stream_queue_statistics() -> Vec<StreamQueueStatistics> {
+    QUEUE_COUNTERS
+        .iter()
+        .enumerate()
+        .map(|(stream_id, counters)| StreamQueueStatistics {
+            stream_id: stream_id as StreamId,
+            sends: counters.sends.load(Ordering::Relaxed),
+            dropped_sends: counters.dropped_sends.load(Ordering::Relaxed),
+            queue_delay_sum: Duration::from_nanos(
+                counters.queue_delay_sum_ns.load(Ordering::Relaxed),
+            ),
+        })
+        .collect()
+}
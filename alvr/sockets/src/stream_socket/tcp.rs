@@ -1,24 +1,25 @@
-use super::StreamId;
+use super::{
+    qos::{self, AccessCategory},
+    PacketEnqueuers,
+};
 use crate::{Ldc, LOCAL_IP};
 use alvr_common::prelude::*;
 use alvr_session::SocketBufferSize;
-use bytes::{Buf, Bytes, BytesMut};
+use bytes::{Buf, Bytes};
 use futures::{
     stream::{SplitSink, SplitStream},
     StreamExt,
 };
-use std::{collections::HashMap, net::IpAddr, sync::Arc};
+use std::{net::IpAddr, sync::Arc};
 use tokio::{
-    net::{TcpListener, TcpStream},
-    sync::{mpsc, Mutex},
+    net::{TcpListener, TcpSocket, TcpStream},
+    sync::Mutex,
 };
 use tokio_util::codec::Framed;
 
 pub type TcpStreamSendSocket = Arc<Mutex<SplitSink<Framed<TcpStream, Ldc>, Bytes>>>;
 pub type TcpStreamReceiveSocket = SplitStream<Framed<TcpStream, Ldc>>;
 
-const IPTOS_DSCP_EF: u32 = 0xb8;
-
 pub async fn bind(
     port: u16,
     send_buffer_bytes: SocketBufferSize,
@@ -30,7 +31,7 @@ pub async fn bind(
     super::set_socket_buffers(&socket, send_buffer_bytes, recv_buffer_bytes).ok();
 
     socket.set_nodelay(true).ok();
-    socket.set_tos(IPTOS_DSCP_EF).ok();
+    qos::set_access_category(&socket, AccessCategory::Voice);
 
     TcpListener::from_std(socket.into()).map_err(err!())
 }
@@ -52,23 +53,40 @@ pub async fn accept_from_server(
     Ok((Arc::new(Mutex::new(send_socket)), receive_socket))
 }
 
-pub async fn connect_to_client(
+// The buffers are sized before connecting, so the window scale is negotiated for them
+pub fn prepare_connection(
     client_ip: IpAddr,
-    port: u16,
     send_buffer_bytes: SocketBufferSize,
     recv_buffer_bytes: SocketBufferSize,
-) -> StrResult<(TcpStreamSendSocket, TcpStreamReceiveSocket)> {
-    let socket = TcpStream::connect((client_ip, port))
-        .await
-        .map_err(err!())?;
-    let socket = socket2::Socket::from(socket.into_std().map_err(err!())?);
+) -> StrResult<TcpSocket> {
+    let socket = if client_ip.is_ipv4() {
+        TcpSocket::new_v4()
+    } else {
+        TcpSocket::new_v6()
+    }
+    .map_err(err!())?;
 
-    super::set_socket_buffers(&socket, send_buffer_bytes, recv_buffer_bytes).ok();
+    {
+        let socket = socket2::SockRef::from(&socket);
 
-    socket.set_nodelay(true).ok();
-    socket.set_tos(IPTOS_DSCP_EF).ok();
+        super::set_socket_buffers(&socket, send_buffer_bytes, recv_buffer_bytes).ok();
 
-    let socket = TcpStream::from_std(socket.into()).map_err(err!())?;
+        socket.set_nodelay(true).ok();
+        qos::set_access_category(&socket, AccessCategory::Voice);
+    }
+
+    Ok(socket)
+}
+
+pub async fn connect_to_client(
+    socket: TcpSocket,
+    client_ip: IpAddr,
+    port: u16,
+) -> StrResult<(TcpStreamSendSocket, TcpStreamReceiveSocket)> {
+    let socket = socket
+        .connect((client_ip, port).into())
+        .await
+        .map_err(err!())?;
     let socket = Framed::new(socket, Ldc::new());
     let (send_socket, receive_socket) = socket.split();
 
@@ -77,14 +95,15 @@ pub async fn connect_to_client(
 
 pub async fn receive_loop(
     mut socket: TcpStreamReceiveSocket,
-    packet_enqueuers: Arc<Mutex<HashMap<StreamId, mpsc::UnboundedSender<BytesMut>>>>,
+    packet_enqueuers: PacketEnqueuers,
 ) -> StrResult {
     while let Some(maybe_packet) = socket.next().await {
         let mut packet = trace_err!(maybe_packet)?;
 
+        // The packet is copied so that the read buffer of the codec is unique again and reused
         let stream_id = packet.get_u16();
-        if let Some(enqueuer) = packet_enqueuers.lock().await.get_mut(&stream_id) {
-            trace_err!(enqueuer.send(packet))?;
+        if let Some(queue) = packet_enqueuers.lock().await.get(&stream_id) {
+            queue.enqueue_copy(&packet, None)?;
         }
     }
 
@@ -1,7 +1,11 @@
-use super::StreamId;
+use super::{
+    qos::{AccessCategory, DatagramMarking},
+    scheduler::SendGate,
+    PacketEnqueuers,
+};
 use alvr_common::prelude::*;
-use bytes::{Buf, BufMut, Bytes, BytesMut};
-use futures::{Stream, StreamExt};
+use alvr_session::FramePacingDesc;
+use bytes::{Buf, Bytes};
 use governor::{
     clock,
     state::{InMemoryState, NotKeyed},
@@ -9,39 +13,177 @@ use governor::{
 };
 use nonzero_ext::NonZero;
 use std::{
-    collections::HashMap,
     io,
-    mem::MaybeUninit,
     net::{IpAddr, SocketAddr},
-    pin::Pin,
     sync::Arc,
-    task::{Context, Poll},
-};
-use tokio::{
-    io::ReadBuf,
-    net::UdpSocket,
-    sync::{mpsc, Mutex},
+    time::{Duration, Instant},
 };
+use tokio::{net::UdpSocket, time};
 
-const INITIAL_RD_CAPACITY: usize = 64 * 1024;
+// Largest UDP datagram
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+const MAX_DATAGRAM_SIZE: usize = 65_535;
 
 // Don't go below this rate, limiting then is unneeded anyway.
 const MINIMUM_BYTERATE: u32 = 30 * 1024 * 1024 * 3 / 2 / 8;
 // Reserve includes audio along with other small fluctuations.
 const RESERVE_BYTERATE: u32 = 5_000_000 / 8;
 
+// Timers are not finer than this, paced packets due within the same slot go out together
+const PACING_SLOT: Duration = Duration::from_millis(1);
+const FRAME_INTERVAL_SMOOTHING: f32 = 0.1;
+// etf drops the packets whose departure time has passed when they reach the qdisc
+#[cfg(target_os = "linux")]
+const TXTIME_LEAD: Duration = Duration::from_micros(200);
+
+struct PacerState {
+    // Estimated from the time between frames, the encoder does not always keep up with the
+    // refresh rate
+    frame_interval: Duration,
+    last_frame_time: Option<Instant>,
+}
+
+// Spreads the packets of each video frame over a fraction of the frame interval. Wi-Fi access
+// points drop the tail of line rate bursts, which costs more FEC than the loss of single packets.
+// Priority packets (the first slice and the FEC parity) are not spaced out: the first slice
+// reaches the decoder as early as possible, and the parity follows the last data packet instead of
+// being pushed towards the next frame.
+struct FramePacer {
+    interval_fraction: f32,
+    // Frames that need more time than the window at this byterate are stretched
+    byterate: f32,
+    // Set if the kernel sends the packets at their departure time (SO_TXTIME)
+    #[cfg(target_os = "linux")]
+    txtime_clock: Option<libc::clockid_t>,
+    state: std::sync::Mutex<PacerState>,
+}
+
+impl FramePacer {
+    fn new(socket: &UdpSocket, config: FramePacingDesc, byterate: u32, fps: f32) -> Self {
+        #[cfg(target_os = "linux")]
+        let txtime_clock = {
+            use alvr_session::KernelPacing;
+
+            match config.kernel_pacing {
+                KernelPacing::Disabled => None,
+                KernelPacing::Fq => enable_txtime(socket, libc::CLOCK_MONOTONIC),
+                KernelPacing::Etf => enable_txtime(socket, libc::CLOCK_TAI),
+            }
+        };
+        #[cfg(not(target_os = "linux"))]
+        let _ = socket;
+
+        Self {
+            interval_fraction: config.frame_interval_fraction,
+            byterate: byterate as f32,
+            #[cfg(target_os = "linux")]
+            txtime_clock,
+            state: std::sync::Mutex::new(PacerState {
+                frame_interval: Duration::from_secs_f32(1. / fps.max(1.)),
+                last_frame_time: None,
+            }),
+        }
+    }
+
+    // Departure time of each packet of a frame, relative to `now`
+    fn schedule(&self, now: Instant, packets: &[Bytes], priorities: &[bool]) -> Vec<Duration> {
+        let frame_interval = {
+            let mut state = self.state.lock().unwrap();
+            if let Some(last_frame_time) = state.last_frame_time {
+                // A pause in the stream only nudges the estimate
+                let interval = (now - last_frame_time).min(state.frame_interval * 2);
+                state.frame_interval = state.frame_interval.mul_f32(1. - FRAME_INTERVAL_SMOOTHING)
+                    + interval.mul_f32(FRAME_INTERVAL_SMOOTHING);
+            }
+            state.last_frame_time = Some(now);
+
+            state.frame_interval
+        };
+
+        let is_priority = |index: usize| priorities.get(index).copied().unwrap_or(false);
+        let paced_bytes = packets
+            .iter()
+            .enumerate()
+            .filter(|(index, _)| !is_priority(*index))
+            .map(|(_, packet)| packet.len())
+            .sum::<usize>() as f32;
+        let window = f32::max(
+            frame_interval.as_secs_f32() * self.interval_fraction,
+            paced_bytes / self.byterate,
+        );
+
+        let mut departure = 0.;
+        packets
+            .iter()
+            .enumerate()
+            .map(|(index, packet)| {
+                let packet_departure = Duration::from_secs_f32(departure);
+                if !is_priority(index) {
+                    departure += window * packet.len() as f32 / paced_bytes;
+                }
+                packet_departure
+            })
+            .collect()
+    }
+}
+
+#[cfg(target_os = "linux")]
+fn enable_txtime(socket: &UdpSocket, clockid: libc::clockid_t) -> Option<libc::clockid_t> {
+    use std::os::unix::io::AsRawFd;
+
+    let config = libc::sock_txtime { clockid, flags: 0 };
+    let res = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_TXTIME,
+            &config as *const _ as *const libc::c_void,
+            std::mem::size_of_val(&config) as libc::socklen_t,
+        )
+    };
+    if res == 0 {
+        info!("Video frames are paced by the kernel");
+        Some(clockid)
+    } else {
+        warn!(
+            "SO_TXTIME is not available, pacing video frames with timers: {}",
+            io::Error::last_os_error()
+        );
+        None
+    }
+}
+
+#[cfg(target_os = "linux")]
+fn clock_now_ns(clockid: libc::clockid_t) -> u64 {
+    let mut time = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe { libc::clock_gettime(clockid, &mut time) };
+
+    time.tv_sec as u64 * 1_000_000_000 + time.tv_nsec as u64
+}
+
 #[allow(clippy::type_complexity)]
 #[derive(Clone)]
 pub struct ThrottledUdpStreamSendSocket {
     inner: Arc<UdpSocket>,
     limiter: Arc<Option<RateLimiter<NotKeyed, InMemoryState, clock::DefaultClock>>>,
+    // Largest amount of bytes the limiter can grant at once
+    burst: u32,
+    // Video frames go through the pacer instead of the limiter, which is left to the other streams
+    pacer: Option<Arc<FramePacer>>,
+    marking: Arc<DatagramMarking>,
 }
 
 impl ThrottledUdpStreamSendSocket {
     pub async fn send(&self, data: Bytes) -> io::Result<()> {
         if let Some(ref limiter) = *self.limiter {
             if let Some(len) = NonZero::new(data.len() as u32) {
-                limiter.until_n_ready(len).await.ok();
+                limiter
+                    .until_n_ready(len)
+                    .await
+                    .map_err(|_| self.over_burst())?;
             }
         }
         match self.inner.send(&data).await {
@@ -49,46 +191,142 @@ impl ThrottledUdpStreamSendSocket {
             Err(e) => Err(e),
         }
     }
-}
 
-pub struct ThrottledUdpStreamReceiveSocket {
-    pub inner: Arc<UdpSocket>,
-    buffer: BytesMut,
-}
+    // The limiter cannot grant a packet larger than the burst, it would otherwise go out
+    // unthrottled
+    fn over_burst(&self) -> io::Error {
+        io::Error::new(
+            io::ErrorKind::InvalidInput,
+            format!("Packet larger than the limiter burst of {}B", self.burst),
+        )
+    }
 
-// Code taken from https://github.com/tokio-rs/tokio/blob/master/tokio-util/src/udp/frame.rs
-impl Stream for ThrottledUdpStreamReceiveSocket {
-    type Item = io::Result<(BytesMut, SocketAddr)>;
+    pub fn paces_frames(&self) -> bool {
+        self.pacer.is_some()
+    }
 
-    fn poll_next(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<Self::Item>> {
-        let pin = self.get_mut();
+    // Must be called with the SendGate held
+    pub fn mark(&self, category: AccessCategory) {
+        self.marking.apply(&self.inner, category);
+    }
 
-        pin.buffer.reserve(INITIAL_RD_CAPACITY);
+    // Send all packets of a batch. Packets are grouped into chunks that fit the limiter burst, so
+    // the pacing is the same as sending them one by one but with one syscall per chunk.
+    pub async fn send_batch(&self, packets: &[Bytes]) -> io::Result<()> {
+        if let Some(ref limiter) = *self.limiter {
+            let mut chunk_start = 0;
+            let mut chunk_bytes = 0;
+            for (index, packet) in packets.iter().enumerate() {
+                let len = packet.len() as u32;
+                if index > chunk_start && chunk_bytes + len > self.burst {
+                    limiter
+                        .until_n_ready(NonZero::new(chunk_bytes).unwrap())
+                        .await
+                        .map_err(|_| self.over_burst())?;
+                    self.send_chunk(&packets[chunk_start..index]).await?;
 
-        let addr = unsafe {
-            let buf = &mut *(pin.buffer.chunk_mut() as *mut _ as *mut [MaybeUninit<u8>]);
-            let mut read = ReadBuf::uninit(buf);
-            let ptr = read.filled().as_ptr();
-            let res = match Pin::new(&mut pin.inner).poll_recv_from(cx, &mut read) {
-                Poll::Ready(res) => res,
-                Poll::Pending => return Poll::Pending,
-            };
+                    chunk_start = index;
+                    chunk_bytes = 0;
+                }
+                chunk_bytes += len;
+            }
 
-            assert_eq!(ptr, read.filled().as_ptr());
-            let addr = res?;
-            pin.buffer.advance_mut(read.filled().len());
-            addr
+            if let Some(len) = NonZero::new(chunk_bytes) {
+                limiter
+                    .until_n_ready(len)
+                    .await
+                    .map_err(|_| self.over_burst())?;
+            }
+            self.send_chunk(&packets[chunk_start..]).await
+        } else {
+            self.send_chunk(packets).await
+        }
+    }
+
+    // Spread a video frame with the frame pacer. `priorities` flags the packets the pacer must not
+    // delay, it can be empty. The gate is held only while a slot is sent, other streams can send
+    // between slots.
+    pub async fn send_paced(
+        &self,
+        packets: &[Bytes],
+        priorities: &[bool],
+        gate: &SendGate,
+        priority: usize,
+        category: AccessCategory,
+    ) -> io::Result<()> {
+        let pacer = match &self.pacer {
+            Some(pacer) => pacer,
+            None => return self.send_batch(packets).await,
         };
-        Poll::Ready(Some(Ok((pin.buffer.split_to(pin.buffer.len()), addr))))
+
+        let start = Instant::now();
+        let departures = pacer.schedule(start, packets, priorities);
+
+        #[cfg(target_os = "linux")]
+        if let Some(clockid) = pacer.txtime_clock {
+            let base = clock_now_ns(clockid) + TXTIME_LEAD.as_nanos() as u64;
+            let txtimes = departures
+                .iter()
+                .map(|departure| base + departure.as_nanos() as u64)
+                .collect::<Vec<_>>();
+
+            // The kernel spreads the frame, packets of the other streams wait behind it in the
+            // qdisc
+            let _permit = gate.acquire(priority).await;
+            self.mark(category);
+            return super::mmsg::send_all(&self.inner, None, packets, false, Some(&txtimes)).await;
+        }
+
+        let mut chunk_start = 0;
+        while chunk_start < packets.len() {
+            let slot_end = departures[chunk_start] + PACING_SLOT;
+            let chunk_end = departures[chunk_start..]
+                .iter()
+                .position(|departure| *departure >= slot_end)
+                .map_or(packets.len(), |offset| chunk_start + offset);
+
+            let departure_time = start + departures[chunk_start];
+            if departure_time > Instant::now() {
+                time::sleep_until(departure_time.into()).await;
+            }
+            let _permit = gate.acquire(priority).await;
+            self.mark(category);
+            self.send_chunk(&packets[chunk_start..chunk_end]).await?;
+
+            chunk_start = chunk_end;
+        }
+
+        Ok(())
+    }
+
+    #[cfg(target_os = "linux")]
+    async fn send_chunk(&self, packets: &[Bytes]) -> io::Result<()> {
+        super::mmsg::send_all(&self.inner, None, packets, false, None).await
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    async fn send_chunk(&self, packets: &[Bytes]) -> io::Result<()> {
+        for packet in packets {
+            self.inner.send(packet).await?;
+        }
+        Ok(())
     }
 }
 
+pub struct ThrottledUdpStreamReceiveSocket {
+    pub inner: Arc<UdpSocket>,
+}
+
+#[allow(clippy::too_many_arguments)]
 pub async fn connect_to_client(
     socket: UdpSocket,
     client_ip: IpAddr,
     port: u16,
     video_byterate: u32,
+    max_packet_size: usize,
     bitrate_multiplier: f32,
+    frame_pacing: Option<FramePacingDesc>,
+    fps: f32,
 ) -> StrResult<(
     ThrottledUdpStreamSendSocket,
     ThrottledUdpStreamReceiveSocket,
@@ -99,26 +337,27 @@ pub async fn connect_to_client(
     let rx = Arc::new(socket);
     let tx = Arc::clone(&rx);
 
-    let limiter = {
-        // The byterate and burst amount computation here is based
-        // on the previous C++ implementation.
-        let byterate = (video_byterate as f32 * bitrate_multiplier) as u32 + RESERVE_BYTERATE;
-        let byterate = std::cmp::max(MINIMUM_BYTERATE, byterate);
-        let burst = byterate / 1000;
-        let quota = Quota::per_second(NonZero::new(byterate).unwrap())
-            .allow_burst(NonZero::new(burst).unwrap());
-        Some(RateLimiter::direct(quota))
-    };
+    // The byterate and burst amount computation here is based
+    // on the previous C++ implementation.
+    let byterate = (video_byterate as f32 * bitrate_multiplier) as u32 + RESERVE_BYTERATE;
+    let byterate = std::cmp::max(MINIMUM_BYTERATE, byterate);
+    // The burst must hold the largest packet, like the 16000 B ones of the wired link
+    let burst = std::cmp::max(byterate / 1000, max_packet_size as u32);
+    let quota = Quota::per_second(NonZero::new(byterate).unwrap())
+        .allow_burst(NonZero::new(burst).unwrap());
+
+    let pacer = frame_pacing.map(|config| Arc::new(FramePacer::new(&tx, config, byterate, fps)));
 
     Ok((
         ThrottledUdpStreamSendSocket {
             inner: tx,
-            limiter: Arc::new(limiter),
-        },
-        ThrottledUdpStreamReceiveSocket {
-            inner: rx,
-            buffer: BytesMut::new(),
+            limiter: Arc::new(Some(RateLimiter::direct(quota))),
+            burst,
+            pacer,
+            // Set by udp::bind()
+            marking: Arc::new(DatagramMarking::new(AccessCategory::Voice)),
         },
+        ThrottledUdpStreamReceiveSocket { inner: rx },
     ))
 }
 
@@ -140,26 +379,58 @@ pub async fn accept_from_server(
         ThrottledUdpStreamSendSocket {
             inner: tx,
             limiter: Arc::new(None),
+            burst: u32::MAX,
+            pacer: None,
+            marking: Arc::new(DatagramMarking::new(AccessCategory::Voice)),
         },
-        ThrottledUdpStreamReceiveSocket {
-            inner: rx,
-            buffer: BytesMut::new(),
-        },
+        ThrottledUdpStreamReceiveSocket { inner: rx },
     ))
 }
 
+// The socket is connected, the kernel already drops datagrams from other peers.
+#[cfg(any(target_os = "linux", target_os = "android"))]
 pub async fn receive_loop(
-    mut socket: ThrottledUdpStreamReceiveSocket,
-    packet_enqueuers: Arc<Mutex<HashMap<StreamId, mpsc::UnboundedSender<BytesMut>>>>,
+    socket: ThrottledUdpStreamReceiveSocket,
+    datagram_size: usize,
+    packet_enqueuers: PacketEnqueuers,
 ) -> StrResult {
-    while let Some(maybe_packet) = socket.next().await {
-        let (mut packet_bytes, _) = trace_err!(maybe_packet)?;
+    let mut batch = super::mmsg::RecvBatch::new(datagram_size);
+    loop {
+        let packets = trace_err!(super::mmsg::recv_batch(&socket.inner, &mut batch).await)?;
 
-        let stream_id = packet_bytes.get_u16();
-        if let Some(enqueuer) = packet_enqueuers.lock().await.get_mut(&stream_id) {
-            trace_err!(enqueuer.send(packet_bytes))?;
+        let mut enqueuers = packet_enqueuers.lock().await;
+        for (mut packet_bytes, _, timestamp) in packets {
+            if packet_bytes.len() < 2 {
+                continue;
+            }
+
+            let stream_id = packet_bytes.get_u16();
+            if let Some(queue) = enqueuers.get(&stream_id) {
+                queue.enqueue(packet_bytes, timestamp)?;
+            }
         }
     }
+}
 
-    Ok(())
+// Datagrams are read into one buffer and copied to the pools of the streams, so that receiving
+// does not allocate.
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub async fn receive_loop(
+    socket: ThrottledUdpStreamReceiveSocket,
+    _: usize,
+    packet_enqueuers: PacketEnqueuers,
+) -> StrResult {
+    let mut buffer = vec![0; MAX_DATAGRAM_SIZE];
+    loop {
+        let size = trace_err!(socket.inner.recv(&mut buffer).await)?;
+        let mut packet_bytes = &buffer[..size];
+        if packet_bytes.len() < 2 {
+            continue;
+        }
+
+        let stream_id = packet_bytes.get_u16();
+        if let Some(queue) = packet_enqueuers.lock().await.get(&stream_id) {
+            queue.enqueue_copy(packet_bytes, None)?;
+        }
+    }
 }
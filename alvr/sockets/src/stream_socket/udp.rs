@@ -1,37 +1,147 @@
-use super::StreamId;
+use super::{
+    fanout::FanOut,
+    feedback::{ArrivalLog, SendLog},
+    multipath::{self, PathReception, PathScheduler, PRIMARY_PATH, SECONDARY_PATH},
+    qos::{self, AccessCategory, DatagramMarking},
+    PacketEnqueuers,
+};
 use crate::{Ldc, LOCAL_IP};
 use alvr_common::prelude::*;
 use alvr_session::SocketBufferSize;
-use bytes::{Buf, Bytes, BytesMut};
+use bytes::{Buf, Bytes};
 use futures::{
     stream::{SplitSink, SplitStream},
-    StreamExt,
+    SinkExt, StreamExt,
 };
 use std::{
-    collections::HashMap,
+    io,
     net::{IpAddr, SocketAddr},
     sync::Arc,
+    time::Instant,
 };
-use tokio::{
-    net::UdpSocket,
-    sync::{mpsc, Mutex},
-};
+use tokio::{net::UdpSocket, sync::Mutex};
 use tokio_util::udp::UdpFramed;
 
-const IPTOS_DSCP_EF: u32 = 0xb8;
+// Largest UDP datagram
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+const MAX_DATAGRAM_SIZE: usize = 65_535;
+
+type UdpSink = SplitSink<UdpFramed<Ldc, Arc<UdpSocket>>, (Bytes, SocketAddr)>;
 
-#[allow(clippy::type_complexity)]
 #[derive(Clone)]
 pub struct UdpStreamSendSocket {
     pub peer_addr: SocketAddr,
-    pub inner: Arc<Mutex<SplitSink<UdpFramed<Ldc>, (Bytes, SocketAddr)>>>,
+    pub inner: Arc<Mutex<UdpSink>>,
+    // Same socket as the one wrapped by `inner`, used for batched sends that bypass the codec
+    pub socket: Arc<UdpSocket>,
+    pub marking: Arc<DatagramMarking>,
+    pub paths: Option<Arc<PathScheduler>>,
+    pub send_log: Option<Arc<SendLog>>,
+    pub fan_out: Option<Arc<FanOut>>,
+}
+
+impl UdpStreamSendSocket {
+    pub async fn send(&self, packet: Bytes) -> io::Result<()> {
+        self.inner
+            .lock()
+            .await
+            .send((packet.clone(), self.peer_addr))
+            .await?;
+        if let Some(paths) = &self.paths {
+            paths.sent.add(PRIMARY_PATH, 1);
+        }
+        if let Some(send_log) = &self.send_log {
+            send_log.record(&[packet]);
+        }
+
+        Ok(())
+    }
+
+    // Send all packets of a batch back to back. The sink lock is held for the whole batch so
+    // packets of other streams cannot interleave. With `spread` the packets are spread over the
+    // paths of a multipath socket, with `fan_out` they are also sent to the spectators.
+    pub async fn send_batch(
+        &self,
+        packets: Vec<Bytes>,
+        spread: bool,
+        fan_out: bool,
+    ) -> io::Result<()> {
+        let mut sink = self.inner.lock().await;
+
+        let spectators = self.fan_out.as_ref().filter(|_| fan_out);
+        let spectator_packets = spectators.map(|_| packets.clone());
+
+        match &self.paths {
+            Some(paths) if spread => {
+                let [primary, secondary] = paths.split(packets);
+                send_to(&mut sink, &self.socket, self.peer_addr, &primary).await?;
+                paths.sent.add(PRIMARY_PATH, primary.len());
+                send_to(&mut sink, &self.socket, paths.secondary_addr, &secondary).await?;
+                paths.sent.add(SECONDARY_PATH, secondary.len());
+
+                if let Some(send_log) = &self.send_log {
+                    send_log.record(&primary);
+                    send_log.record(&secondary);
+                }
+            }
+            _ => {
+                send_to(&mut sink, &self.socket, self.peer_addr, &packets).await?;
+                if let Some(paths) = &self.paths {
+                    paths.sent.add(PRIMARY_PATH, packets.len());
+                }
+                if let Some(send_log) = &self.send_log {
+                    send_log.record(&packets);
+                }
+            }
+        }
+
+        if let (Some(spectators), Some(packets)) = (spectators, spectator_packets) {
+            for &address in &spectators.addresses {
+                // A spectator that went away must not interrupt the stream of the client
+                send_to(&mut sink, &self.socket, address, &packets)
+                    .await
+                    .ok();
+            }
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(target_os = "linux")]
+async fn send_to(
+    _: &mut UdpSink,
+    socket: &UdpSocket,
+    address: SocketAddr,
+    packets: &[Bytes],
+) -> io::Result<()> {
+    super::mmsg::send_all(socket, Some(address), packets, true, None).await
+}
+
+#[cfg(not(target_os = "linux"))]
+async fn send_to(
+    sink: &mut UdpSink,
+    _: &UdpSocket,
+    address: SocketAddr,
+    packets: &[Bytes],
+) -> io::Result<()> {
+    for packet in packets {
+        sink.feed((packet.clone(), address)).await?;
+    }
+    sink.flush().await
 }
 
 // peer_addr is needed to check that the packet comes from the desired device. Connecting directly
 // to the peer is not supported by UdpFramed.
 pub struct UdpStreamReceiveSocket {
     pub peer_addr: SocketAddr,
-    pub inner: SplitStream<UdpFramed<Ldc>>,
+    pub inner: SplitStream<UdpFramed<Ldc, Arc<UdpSocket>>>,
+    // Same socket as the one wrapped by `inner`, used for batched receives that bypass the codec
+    pub socket: Arc<UdpSocket>,
+    pub paths: Option<Arc<PathReception>>,
+    pub arrival_log: Option<Arc<ArrivalLog>>,
+    // Receives the reports of the spectators
+    pub fan_out: Option<Arc<FanOut>>,
 }
 
 // Create tokio socket, convert to socket2, apply settings, convert back to tokio. This is done to
@@ -46,48 +156,166 @@ pub async fn bind(
 
     super::set_socket_buffers(&socket, send_buffer_bytes, recv_buffer_bytes).ok();
 
-    socket.set_tos(IPTOS_DSCP_EF).ok();
+    qos::set_access_category(&socket, AccessCategory::Voice);
+
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    if let Err(e) = super::mmsg::set_receive_timestamps(&socket) {
+        warn!("SO_TIMESTAMPING is not available: {e}");
+    }
 
     UdpSocket::from_std(socket.into()).map_err(err!())
 }
 
+// Let reads spin on the device queue for up to `microseconds` before sleeping. Raising it above
+// the net.core.busy_read sysctl needs CAP_NET_ADMIN, failing is not fatal.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn set_busy_poll(socket: &UdpSocket, microseconds: u32) {
+    use std::os::unix::io::AsRawFd;
+
+    let value = microseconds as libc::c_int;
+    let res = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_BUSY_POLL,
+            &value as *const _ as *const libc::c_void,
+            std::mem::size_of_val(&value) as libc::socklen_t,
+        )
+    };
+    if res == 0 {
+        info!("Stream socket busy polls for {microseconds}us");
+    } else {
+        warn!(
+            "SO_BUSY_POLL is not available: {}",
+            io::Error::last_os_error()
+        );
+    }
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn set_busy_poll(_: &UdpSocket, _: u32) {}
+
+// With `secondary_peer_ip` the socket is multipath, see multipath.rs. The logs are set on the
+// sides of the transport feedback, see feedback.rs. With `fan_out` the video is also sent to
+// spectators, see fanout.rs.
 pub async fn connect(
     socket: UdpSocket,
     peer_ip: IpAddr,
     port: u16,
+    secondary_peer_ip: Option<IpAddr>,
+    send_log: Option<Arc<SendLog>>,
+    arrival_log: Option<Arc<ArrivalLog>>,
+    fan_out: Option<Arc<FanOut>>,
 ) -> StrResult<(UdpStreamSendSocket, UdpStreamReceiveSocket)> {
     let peer_addr = (peer_ip, port).into();
-    let socket = UdpFramed::new(socket, Ldc::new());
-    let (send_socket, receive_socket) = socket.split();
+    let secondary_addr = secondary_peer_ip.map(|ip| SocketAddr::from((ip, port)));
+    let socket = Arc::new(socket);
+    let (send_socket, receive_socket) = UdpFramed::new(Arc::clone(&socket), Ldc::new()).split();
 
     Ok((
         UdpStreamSendSocket {
             peer_addr,
             inner: Arc::new(Mutex::new(send_socket)),
+            socket: Arc::clone(&socket),
+            // Set by bind()
+            marking: Arc::new(DatagramMarking::new(AccessCategory::Voice)),
+            paths: secondary_addr.map(|address| Arc::new(PathScheduler::new(address))),
+            send_log,
+            fan_out: fan_out.clone(),
         },
         UdpStreamReceiveSocket {
             peer_addr,
             inner: receive_socket,
+            socket,
+            paths: secondary_addr.map(|secondary_addr| {
+                Arc::new(PathReception {
+                    secondary_addr,
+                    received: Default::default(),
+                })
+            }),
+            arrival_log,
+            fan_out,
         },
     ))
 }
 
+// Read all the datagrams queued on each wakeup with one syscall, and dispatch them with one lock of
+// the stream queues.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub async fn receive_loop(
+    socket: UdpStreamReceiveSocket,
+    datagram_size: usize,
+    packet_enqueuers: PacketEnqueuers,
+) -> StrResult {
+    let mut batch = super::mmsg::RecvBatch::new(datagram_size);
+    loop {
+        let packets = trace_err!(super::mmsg::recv_batch(&socket.socket, &mut batch).await)?;
+        let arrival = Instant::now();
+
+        let mut enqueuers = packet_enqueuers.lock().await;
+        for (mut packet_bytes, address, timestamp) in packets {
+            // Datagrams hold a single LengthDelimitedCodec frame
+            if packet_bytes.len() < 6 || packet_bytes.get_u32() as usize != packet_bytes.len() {
+                continue;
+            }
+            if !multipath::accept_source(socket.peer_addr, socket.paths.as_deref(), address) {
+                if let Some(fan_out) = &socket.fan_out {
+                    fan_out.receive(address, &packet_bytes);
+                }
+                continue;
+            }
+
+            if let Some(arrival_log) = &socket.arrival_log {
+                arrival_log.record(&packet_bytes, arrival);
+            }
+
+            let stream_id = packet_bytes.get_u16();
+            if let Some(queue) = enqueuers.get(&stream_id) {
+                queue.enqueue(packet_bytes, timestamp)?;
+            }
+        }
+    }
+}
+
+// Datagrams are read into one buffer and copied to the pools of the streams, so that receiving
+// does not allocate.
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
 pub async fn receive_loop(
-    mut socket: UdpStreamReceiveSocket,
-    packet_enqueuers: Arc<Mutex<HashMap<StreamId, mpsc::UnboundedSender<BytesMut>>>>,
+    socket: UdpStreamReceiveSocket,
+    _: usize,
+    packet_enqueuers: PacketEnqueuers,
 ) -> StrResult {
-    while let Some(maybe_packet) = socket.inner.next().await {
-        let (mut packet_bytes, address) = trace_err!(maybe_packet)?;
+    let mut buffer = vec![0; MAX_DATAGRAM_SIZE];
+    loop {
+        let (size, address) = match socket.socket.recv_from(&mut buffer).await {
+            // Windows reports the ICMP port unreachable of a previous send to a spectator on the
+            // next receive
+            Err(e) if socket.fan_out.is_some() && e.kind() == io::ErrorKind::ConnectionReset => {
+                continue
+            }
+            res => trace_err!(res)?,
+        };
 
-        if address != socket.peer_addr {
+        // Datagrams hold a single LengthDelimitedCodec frame
+        let mut packet_bytes = &buffer[..size];
+        if packet_bytes.len() < 6 || packet_bytes.get_u32() as usize != packet_bytes.len() {
             continue;
         }
 
+        if !multipath::accept_source(socket.peer_addr, socket.paths.as_deref(), address) {
+            if let Some(fan_out) = &socket.fan_out {
+                fan_out.receive(address, packet_bytes);
+            }
+            continue;
+        }
+
+        if let Some(arrival_log) = &socket.arrival_log {
+            arrival_log.record(packet_bytes, Instant::now());
+        }
+
         let stream_id = packet_bytes.get_u16();
-        if let Some(enqueuer) = packet_enqueuers.lock().await.get_mut(&stream_id) {
-            trace_err!(enqueuer.send(packet_bytes))?;
+        if let Some(queue) = packet_enqueuers.lock().await.get(&stream_id) {
+            queue.enqueue_copy(packet_bytes, None)?;
         }
     }
-
-    Ok(())
 }
@@ -22,11 +22,13 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 
 #include <vulkan/vk_layer.h>
 
@@ -37,6 +39,7 @@
 #include "swapchain_api.hpp"
 #include "util/custom_allocator.hpp"
 #include "util/extension_list.hpp"
+#include "util/logger.h"
 #include "wsi/wsi_factory.hpp"
 #include "layer.h"
 
@@ -116,6 +119,24 @@ VKAPI_ATTR VkLayerDeviceCreateInfo *get_chain_info(const VkDeviceCreateInfo *pCr
     return chain_info;
 }
 
+/* Queue family for the copies of the layer: a transfer only family, which usually runs on a copy
+ * engine of its own, else an async compute family. VK_QUEUE_FAMILY_IGNORED if there is neither. */
+static uint32_t find_copy_queue_family(const std::vector<VkQueueFamilyProperties> &families) {
+    uint32_t compute_family = VK_QUEUE_FAMILY_IGNORED;
+    for (uint32_t i = 0; i < families.size(); ++i) {
+        VkQueueFlags flags = families[i].queueFlags;
+        if (flags & VK_QUEUE_GRAPHICS_BIT)
+            continue;
+        if (flags & VK_QUEUE_COMPUTE_BIT) {
+            if (compute_family == VK_QUEUE_FAMILY_IGNORED)
+                compute_family = i;
+        } else if (flags & VK_QUEUE_TRANSFER_BIT) {
+            return i;
+        }
+    }
+    return compute_family;
+}
+
 /* This is where the layer is initialised and the instance dispatch table is constructed. */
 VKAPI_ATTR VkResult create_instance(const VkInstanceCreateInfo *pCreateInfo,
                                     const VkAllocationCallbacks *pAllocator,
@@ -248,6 +269,99 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice,
         return result;
     }
 
+    /* Swapchain images are handed to the encoder with timeline semaphores when the device
+     * supports them, which lets presents reach the encoder before rendering is done. If the
+     * application already chains the feature struct we keep its choice, declaring it twice is
+     * invalid. */
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    bool timeline_semaphores = false;
+    bool timeline_chained = false;
+    for (auto *in = reinterpret_cast<const VkBaseInStructure *>(pCreateInfo->pNext); in != nullptr;
+         in = in->pNext) {
+        if (in->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR) {
+            timeline_chained = true;
+            timeline_semaphores =
+                reinterpret_cast<const VkPhysicalDeviceTimelineSemaphoreFeaturesKHR *>(in)
+                    ->timelineSemaphore;
+        } else if (in->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES) {
+            timeline_chained = true;
+            timeline_semaphores =
+                reinterpret_cast<const VkPhysicalDeviceVulkan12Features *>(in)->timelineSemaphore;
+        }
+    }
+    util::extension_list device_extensions{allocator};
+    result = device_extensions.add(physicalDevice);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    if (Settings::Instance().m_earlyPresentNotify &&
+        device_extensions.contains(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+        if (!timeline_chained && inst_data.disp.GetPhysicalDeviceFeatures2 != nullptr) {
+            VkPhysicalDeviceFeatures2 features = {};
+            features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features.pNext = &timeline_features;
+            inst_data.disp.GetPhysicalDeviceFeatures2(physicalDevice, &features);
+            timeline_semaphores = timeline_features.timelineSemaphore;
+        }
+        if (timeline_semaphores) {
+            result = enabled_extensions.add(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+        }
+    } else {
+        timeline_semaphores = false;
+    }
+
+    /* Swapchain images are shared as dma-bufs when the device can export them with an explicit
+     * modifier, VAAPI then imports them as surfaces. The NVIDIA encoder goes through CUDA, which
+     * only imports opaque fds. */
+    const char *dma_buf_extensions[] = {VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME,
+                                        VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME,
+                                        VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME};
+    VkPhysicalDeviceProperties device_properties;
+    inst_data.disp.GetPhysicalDeviceProperties(physicalDevice, &device_properties);
+    constexpr uint32_t VENDOR_ID_NVIDIA = 0x10de;
+    bool dma_buf_export = device_properties.vendorID != VENDOR_ID_NVIDIA &&
+                          inst_data.disp.GetPhysicalDeviceFormatProperties2 != nullptr &&
+                          inst_data.disp.GetPhysicalDeviceImageFormatProperties2 != nullptr;
+    for (const char *extension : dma_buf_extensions) {
+        dma_buf_export = dma_buf_export && device_extensions.contains(extension);
+    }
+    if (dma_buf_export) {
+        result = enabled_extensions.add(dma_buf_extensions, std::size(dma_buf_extensions));
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    /* The vsync thread signals the display event fence from the host when the fence can import a
+     * sync fd, instead of submitting to a queue of the device. */
+    const char *fence_fd_extensions[] = {VK_KHR_EXTERNAL_FENCE_EXTENSION_NAME,
+                                         VK_KHR_EXTERNAL_FENCE_FD_EXTENSION_NAME};
+    bool host_fence_signal = inst_data.disp.GetPhysicalDeviceExternalFenceProperties != nullptr;
+    for (const char *extension : fence_fd_extensions) {
+        host_fence_signal = host_fence_signal && device_extensions.contains(extension);
+    }
+    if (host_fence_signal) {
+        VkPhysicalDeviceExternalFenceInfo fence_info = {};
+        fence_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_FENCE_INFO;
+        fence_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+        VkExternalFenceProperties fence_properties = {};
+        fence_properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_FENCE_PROPERTIES;
+        inst_data.disp.GetPhysicalDeviceExternalFenceProperties(physicalDevice, &fence_info,
+                                                               &fence_properties);
+        host_fence_signal = fence_properties.externalFenceFeatures &
+                            VK_EXTERNAL_FENCE_FEATURE_IMPORTABLE_BIT;
+    }
+    if (host_fence_signal) {
+        result = enabled_extensions.add(fence_fd_extensions, std::size(fence_fd_extensions));
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
     util::vector<const char *> modified_enabled_extensions{allocator};
     if (!enabled_extensions.get_extension_strings(modified_enabled_extensions)) {
         return VK_ERROR_OUT_OF_HOST_MEMORY;
@@ -257,8 +371,14 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice,
     VkDeviceCreateInfo modified_info = *pCreateInfo;
     modified_info.ppEnabledExtensionNames = modified_enabled_extensions.data();
     modified_info.enabledExtensionCount = modified_enabled_extensions.size();
+    if (timeline_semaphores && !timeline_chained) {
+        timeline_features.pNext = const_cast<void *>(modified_info.pNext);
+        timeline_features.timelineSemaphore = VK_TRUE;
+        modified_info.pNext = &timeline_features;
+    }
 
-    // Add one queue to safely submit vsync from our thread
+    // Add one queue to safely submit vsync from our thread when the fence cannot be signaled from
+    // the host
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfo(pCreateInfo->pQueueCreateInfos, pCreateInfo->pQueueCreateInfos + pCreateInfo->queueCreateInfoCount);
     assert(queueCreateInfo.size() > 0);
     std::vector<VkQueueFamilyProperties> props(queueCreateInfo.size());
@@ -276,7 +396,47 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice,
       queueCreateInfo[display_queue].pQueuePriorities = queuePriorities.data();
       break;
     }
+
+    // With the layer copy, one more queue copies the presented images next to the rendering of the
+    // application, see wsi::headless::swapchain
+    std::vector<float> copyQueuePriorities;
+    uint32_t copy_queue_family = VK_QUEUE_FAMILY_IGNORED;
+    uint32_t copy_queue_index = 0;
+    if (Settings::Instance().m_layerCopy && Settings::Instance().m_layerAsyncCopy && timeline_semaphores) {
+        uint32_t family_count = 0;
+        inst_data.disp.GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> families(family_count);
+        inst_data.disp.GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &family_count,
+                                                               families.data());
+        copy_queue_family = find_copy_queue_family(families);
+        auto info = std::find_if(queueCreateInfo.begin(), queueCreateInfo.end(),
+                                 [&](const VkDeviceQueueCreateInfo &info) {
+                                     return info.queueFamilyIndex == copy_queue_family;
+                                 });
+        if (copy_queue_family == VK_QUEUE_FAMILY_IGNORED) {
+            Info("no transfer or async compute queue, the layer copies on the present queue\n");
+        } else if (info == queueCreateInfo.end()) {
+            VkDeviceQueueCreateInfo copy_info = {};
+            copy_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            copy_info.queueFamilyIndex = copy_queue_family;
+            copy_info.queueCount = 1;
+            copyQueuePriorities.push_back(1);
+            copy_info.pQueuePriorities = copyQueuePriorities.data();
+            queueCreateInfo.push_back(copy_info);
+        } else if (info->queueCount < families[copy_queue_family].queueCount) {
+            copyQueuePriorities.assign(info->pQueuePriorities, info->pQueuePriorities + info->queueCount);
+            copyQueuePriorities.push_back(1);
+            copy_queue_index = info->queueCount;
+            info->queueCount += 1;
+            info->pQueuePriorities = copyQueuePriorities.data();
+        } else {
+            Info("all the queues of family %u are used, the layer copies on the present queue\n",
+                 copy_queue_family);
+            copy_queue_family = VK_QUEUE_FAMILY_IGNORED;
+        }
+    }
     modified_info.pQueueCreateInfos = queueCreateInfo.data();
+    modified_info.queueCreateInfoCount = queueCreateInfo.size();
 
     result = fpCreateDevice(physicalDevice, &modified_info, pAllocator, pDevice);
     if (result != VK_SUCCESS) {
@@ -291,6 +451,15 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice,
 
     std::unique_ptr<device_private_data> device{
         new device_private_data{inst_data, physicalDevice, *pDevice, table, loader_callback}};
+    device->timeline_semaphores = timeline_semaphores && table.WaitSemaphoresKHR != nullptr &&
+                                  table.GetSemaphoreCounterValueKHR != nullptr;
+    device->dma_buf_export =
+        dma_buf_export && table.GetImageDrmFormatModifierPropertiesEXT != nullptr;
+    device->host_fence_signal = host_fence_signal && table.ImportFenceFdKHR != nullptr;
+    if (device->timeline_semaphores) {
+        device->copy_queue_family = copy_queue_family;
+        device->copy_queue_index = copy_queue_index;
+    }
     device->display = std::make_unique<wsi::display>(*device, queueCreateInfo[display_queue].queueFamilyIndex, queueCreateInfo[display_queue].queueCount - 1);
     device_private_data::set(*pDevice, std::move(device));
     return VK_SUCCESS;
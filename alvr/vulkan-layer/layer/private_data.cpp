@@ -26,13 +26,97 @@
 
 #include "wsi/wsi_factory.hpp"
 
+#include <atomic>
+#include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 namespace layer {
 
+/**
+ * @brief Map from the dispatch key of a dispatchable object to the private data of the layer.
+ *
+ * Every intercepted call looks its private data up, from any thread of the application, while
+ * instances and devices are only created and destroyed a few times. The owning map is only changed
+ * with g_data_lock held, and each change publishes an open-addressed copy of it that lookups probe
+ * without locking. Replaced copies are kept until the process exits, a lookup may still be probing
+ * them.
+ */
+template <typename data_type> class dispatch_key_map {
+  public:
+    /* Must be called with g_data_lock held */
+    void set(void *key, std::unique_ptr<data_type> data) {
+        owned[key] = std::move(data);
+        publish();
+    }
+
+    /* Must be called with g_data_lock held */
+    void erase(void *key) {
+        owned.erase(key);
+        publish();
+    }
+
+    data_type *find(void *key) const {
+        const table *current = published.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            return nullptr;
+        }
+
+        for (size_t index = hash(key) & current->mask;; index = (index + 1) & current->mask) {
+            const slot &entry = current->slots[index];
+            if (entry.key == key || entry.key == nullptr) {
+                return entry.data;
+            }
+        }
+    }
+
+  private:
+    struct slot {
+        void *key = nullptr;
+        data_type *data = nullptr;
+    };
+
+    struct table {
+        size_t mask;
+        std::vector<slot> slots;
+    };
+
+    static size_t hash(void *key) {
+        /* The keys are pointers to dispatch tables, their low bits are always the same */
+        uint64_t value = reinterpret_cast<uintptr_t>(key) >> 4;
+        return static_cast<size_t>((value * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    void publish() {
+        /* At most half full, so that probes stay short and always end on an empty slot */
+        size_t capacity = 8;
+        while (capacity < owned.size() * 2) {
+            capacity *= 2;
+        }
+
+        auto next = std::make_unique<table>();
+        next->mask = capacity - 1;
+        next->slots.resize(capacity);
+        for (auto &entry : owned) {
+            size_t index = hash(entry.first) & next->mask;
+            while (next->slots[index].key != nullptr) {
+                index = (index + 1) & next->mask;
+            }
+            next->slots[index] = {entry.first, entry.second.get()};
+        }
+
+        published.store(next.get(), std::memory_order_release);
+        tables.push_back(std::move(next));
+    }
+
+    std::unordered_map<void *, std::unique_ptr<data_type>> owned;
+    std::vector<std::unique_ptr<table>> tables;
+    std::atomic<const table *> published{nullptr};
+};
+
 static std::mutex g_data_lock;
-static std::unordered_map<void *, std::unique_ptr<instance_private_data>> g_instance_data;
-static std::unordered_map<void *, std::unique_ptr<device_private_data>> g_device_data;
+static dispatch_key_map<instance_private_data> g_instance_data;
+static dispatch_key_map<device_private_data> g_device_data;
 
 template <typename object_type, typename get_proc_type>
 static PFN_vkVoidFunction get_proc_helper(object_type obj, get_proc_type get_proc,
@@ -82,13 +166,14 @@ static inline void *get_key(dispatchable_type dispatchable_object) {
 
 void instance_private_data::set(VkInstance inst, std::unique_ptr<instance_private_data> inst_data) {
     scoped_mutex lock(g_data_lock);
-    g_instance_data[get_key(inst)] = std::move(inst_data);
+    g_instance_data.set(get_key(inst), std::move(inst_data));
 }
 
 template <typename dispatchable_type>
 static instance_private_data &get_instance_private_data(dispatchable_type dispatchable_object) {
-    scoped_mutex lock(g_data_lock);
-    return *g_instance_data[get_key(dispatchable_object)];
+    instance_private_data *data = g_instance_data.find(get_key(dispatchable_object));
+    assert(data != nullptr);
+    return *data;
 }
 
 instance_private_data &instance_private_data::get(VkInstance instance) {
@@ -140,13 +225,14 @@ device_private_data::device_private_data(instance_private_data &inst_data,
 
 void device_private_data::set(VkDevice dev, std::unique_ptr<device_private_data> dev_data) {
     scoped_mutex lock(g_data_lock);
-    g_device_data[get_key(dev)] = std::move(dev_data);
+    g_device_data.set(get_key(dev), std::move(dev_data));
 }
 
 template <typename dispatchable_type>
 static device_private_data &get_device_private_data(dispatchable_type dispatchable_object) {
-    scoped_mutex lock(g_data_lock);
-    return *g_device_data[get_key(dispatchable_object)];
+    device_private_data *data = g_device_data.find(get_key(dispatchable_object));
+    assert(data != nullptr);
+    return *data;
 }
 
 device_private_data &device_private_data::get(VkDevice device) {
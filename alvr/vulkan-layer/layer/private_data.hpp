@@ -67,6 +67,10 @@ namespace layer {
     OPTIONAL(CreateHeadlessSurfaceEXT)                                                             \
     OPTIONAL(GetPhysicalDeviceQueueFamilyProperties)                                               \
     OPTIONAL(CreateDisplayModeKHR)                                                                 \
+    OPTIONAL(GetPhysicalDeviceFeatures2)                                                           \
+    OPTIONAL(GetPhysicalDeviceFormatProperties2)                                                   \
+    OPTIONAL(GetPhysicalDeviceImageFormatProperties2)                                              \
+    OPTIONAL(GetPhysicalDeviceExternalFenceProperties)                                              \
 
 struct instance_dispatch_table {
     VkResult populate(VkInstance instance, PFN_vkGetInstanceProcAddr get_proc);
@@ -101,6 +105,7 @@ struct instance_dispatch_table {
     REQUIRED(CreateImage)                                                                          \
     REQUIRED(DestroyImage)                                                                         \
     REQUIRED(GetImageMemoryRequirements)                                                           \
+    REQUIRED(GetImageSubresourceLayout)                                                            \
     REQUIRED(BindImageMemory)                                                                      \
     REQUIRED(AllocateMemory)                                                                       \
     REQUIRED(FreeMemory)                                                                           \
@@ -108,6 +113,13 @@ struct instance_dispatch_table {
     REQUIRED(DestroyFence)                                                                         \
     REQUIRED(ResetFences)                                                                          \
     REQUIRED(WaitForFences)                                                                        \
+    REQUIRED(CmdPipelineBarrier)                                                                   \
+    REQUIRED(CmdCopyImage)                                                                         \
+    REQUIRED(CmdWriteTimestamp)                                                                    \
+    REQUIRED(CmdResetQueryPool)                                                                    \
+    REQUIRED(CreateQueryPool)                                                                      \
+    REQUIRED(DestroyQueryPool)                                                                     \
+    REQUIRED(GetQueryPoolResults)                                                                  \
     OPTIONAL(CreateSwapchainKHR)                                                                   \
     OPTIONAL(DestroySwapchainKHR)                                                                  \
     OPTIONAL(GetSwapchainImagesKHR)                                                                \
@@ -118,7 +130,12 @@ struct instance_dispatch_table {
     OPTIONAL(GetFenceStatus)                                                                       \
     OPTIONAL(GetMemoryFdKHR)                                                                       \
     OPTIONAL(CreateSemaphore)                                                                      \
-    OPTIONAL(GetSemaphoreFdKHR)
+    OPTIONAL(DestroySemaphore)                                                                     \
+    OPTIONAL(GetSemaphoreFdKHR)                                                                    \
+    OPTIONAL(WaitSemaphoresKHR)                                                                    \
+    OPTIONAL(GetSemaphoreCounterValueKHR)                                                          \
+    OPTIONAL(GetImageDrmFormatModifierPropertiesEXT)                                               \
+    OPTIONAL(ImportFenceFdKHR)
 
 struct device_dispatch_table {
     VkResult populate(VkDevice dev, PFN_vkGetDeviceProcAddr get_proc);
@@ -257,6 +274,38 @@ class device_private_data {
     const VkDevice device;
 
     std::unique_ptr<wsi::display> display;
+
+    /**
+     * @brief Whether VK_KHR_timeline_semaphore and its feature are enabled on the device, the
+     * swapchain images then hand off to the encoder through timeline semaphores instead of
+     * present fences.
+     */
+    bool timeline_semaphores = false;
+
+    /**
+     * @brief Whether VK_EXT_external_memory_dma_buf and VK_EXT_image_drm_format_modifier are
+     * enabled, the swapchain images are then shared as dma-bufs with an explicit modifier.
+     */
+    bool dma_buf_export = false;
+
+    /**
+     * @brief Whether VK_KHR_external_fence_fd is enabled with importable sync fds, the vsync fence
+     * is then signaled from the host by importing an already signaled sync fd.
+     */
+    bool host_fence_signal = false;
+
+    /**
+     * @brief Queue of the layer copies, on a transfer or async compute family, when the layer copy
+     * is set to copy on a queue of its own. VK_QUEUE_FAMILY_IGNORED otherwise. Needs timeline
+     * semaphores, the copies wait for the rendering on the GPU.
+     */
+    uint32_t copy_queue_family = VK_QUEUE_FAMILY_IGNORED;
+    uint32_t copy_queue_index = 0;
+    /**
+     * @brief Held while submitting to the copy queue, the swapchains of the device share it.
+     */
+    std::mutex copy_queue_lock;
+
   private:
     std::unordered_set<VkSwapchainKHR> swapchains;
     mutable std::mutex swapchains_lock;
@@ -1,6 +1,8 @@
 #include "settings.h"
+#include "platform/linux/protocol.h"
 #define PICOJSON_USE_INT64
 #include "alvr_server/include/picojson.h"
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <streambuf>
@@ -48,10 +50,22 @@ void Settings::Load()
 		m_renderHeight = config.get("eye_resolution_height").get<int64_t>();
 
 		m_refreshRate = (int)config.get("refresh_rate").get<int64_t>();
+
+		m_swapchainImages = std::clamp<uint32_t>(config.get("linux_swapchain_images").get<int64_t>(), 2, MAX_SWAPCHAIN_IMAGES);
+		m_earlyPresentNotify = config.get("linux_early_present_notify").get<bool>();
+		m_layerCopy = config.get("linux_layer_copy").get<bool>();
+		m_layerAsyncCopy = config.get("linux_layer_async_copy").get<bool>();
+		m_threadRealtimePriority = config.get("thread_realtime_priority").get<bool>();
+		m_vsyncCpuMask = config.get("vsync_cpu_mask").get<int64_t>();
+		m_presentCpuMask = config.get("present_cpu_mask").get<int64_t>();
 		
 		Debug("Config JSON: %hs\n", json.c_str());
 		Info("Render Target: %d %d\n", m_renderWidth, m_renderHeight);
 		Info("Refresh Rate: %d\n", m_refreshRate);
+		Info("Swapchain Images: %u\n", m_swapchainImages);
+		Info("Early Present Notify: %d\n", m_earlyPresentNotify);
+		Info("Layer Copy: %d\n", m_layerCopy);
+		Info("Layer Async Copy: %d\n", m_layerAsyncCopy);
 		m_loaded = true;
 	}
 	catch (std::exception &e)
@@ -59,3 +73,17 @@ void Settings::Load()
 		Error("Exception on parsing json: %hs\n", e.what());
 	}
 }
+
+void Settings::ApplyThreadPolicy(ThreadRole role, const char *name)
+{
+	uint64_t cpuMask = role == THREAD_ROLE_VSYNC ? m_vsyncCpuMask : m_presentCpuMask;
+	auto result = SetCurrentThreadPolicy(role, m_threadRealtimePriority, cpuMask);
+	if (m_threadRealtimePriority && !result.prioritized)
+	{
+		Info("%s: realtime priority not available, check the rtprio limit.\n", name);
+	}
+	if (cpuMask != 0 && !result.pinned)
+	{
+		Warn("%s: could not pin the thread to the CPUs %llx.\n", name, (unsigned long long)cpuMask);
+	}
+}
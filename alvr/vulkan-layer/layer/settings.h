@@ -2,6 +2,8 @@
 
 #include <string>
 
+#include "shared/threadpolicy.h"
+
 class Settings
 {
 	static Settings m_Instance;
@@ -20,7 +22,20 @@ public:
 		return m_loaded;
 	}
 
+	// Applies the thread policy of the settings to the calling thread, name is for the log
+	void ApplyThreadPolicy(ThreadRole role, const char *name);
+
 	int m_refreshRate;
 	uint32_t m_renderWidth;
 	uint32_t m_renderHeight;
+	uint32_t m_swapchainImages = 3;
+	bool m_earlyPresentNotify = true;
+	// Copy the swapchain images into images of the layer shared with the encoder
+	bool m_layerCopy = false;
+	// With the layer copy, copy on a queue of the layer instead of the one of the application
+	bool m_layerAsyncCopy = true;
+	bool m_threadRealtimePriority = false;
+	// Bit per CPU, 0 if not pinned
+	uint64_t m_vsyncCpuMask = 0;
+	uint64_t m_presentCpuMask = 0;
 };
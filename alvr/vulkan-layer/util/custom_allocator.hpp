@@ -251,4 +251,100 @@ template <typename T> class vector : public std::vector<T, custom_allocator<T>>
     }
 };
 
+/**
+ * @brief Fixed capacity pool of objects of the same type, backed by a single allocation.
+ *
+ * Meant for the bookkeeping objects that come in a known number, like one per swapchain image:
+ * they then cost one call to the allocation callbacks for the whole set, and the block is released
+ * in bulk when the pool is destroyed. The pool is not thread safe.
+ *
+ * @note The class only needs T to be complete where its methods are called, so it can be a member
+ *   of a class that only forward declares T.
+ */
+template <typename T> class object_pool {
+  public:
+    explicit object_pool(const allocator &alloc) : m_alloc(alloc) {}
+    ~object_pool() { release(); }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    /**
+     * @brief Allocate the storage of capacity objects, replacing the one of an earlier call.
+     * @return @c false iff the allocation failed.
+     * @note All the objects of an earlier call must have been destroyed.
+     */
+    bool init(size_t capacity) noexcept {
+        release();
+        if (capacity == 0) {
+            return true;
+        }
+        auto &cb = m_alloc.m_callbacks;
+        m_block = cb.pfnAllocation(cb.pUserData, capacity * slot_size(), slot_align(),
+                                   m_alloc.m_scope);
+        if (m_block == nullptr) {
+            return false;
+        }
+        for (size_t i = capacity; i > 0; i--) {
+            void *slot = static_cast<char *>(m_block) + (i - 1) * slot_size();
+            *static_cast<void **>(slot) = m_free;
+            m_free = slot;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Construct an object in a free slot.
+     * @return Pointer to the new object or @c nullptr if the pool is full or the constructor threw.
+     */
+    template <typename... arg_types> T *create(arg_types &&...args) noexcept {
+        if (m_free == nullptr) {
+            return nullptr;
+        }
+        void *slot = m_free;
+        m_free = *static_cast<void **>(slot);
+        try {
+            return new (slot) T(std::forward<arg_types>(args)...);
+        } catch (...) {
+            *static_cast<void **>(slot) = m_free;
+            m_free = slot;
+            return nullptr;
+        }
+    }
+
+    /**
+     * @brief Destroy an object of create() and return its slot to the pool.
+     */
+    void destroy(T *obj) noexcept {
+        if (obj == nullptr) {
+            return;
+        }
+        obj->~T();
+        *reinterpret_cast<void **>(obj) = m_free;
+        m_free = obj;
+    }
+
+  private:
+    /* Free slots hold the pointer to the next free slot. */
+    static constexpr size_t slot_align() {
+        return alignof(T) > alignof(void *) ? alignof(T) : alignof(void *);
+    }
+    static constexpr size_t slot_size() {
+        size_t size = sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *);
+        return (size + slot_align() - 1) / slot_align() * slot_align();
+    }
+
+    void release() noexcept {
+        if (m_block != nullptr) {
+            m_alloc.m_callbacks.pfnFree(m_alloc.m_callbacks.pUserData, m_block);
+        }
+        m_block = nullptr;
+        m_free = nullptr;
+    }
+
+    const allocator m_alloc;
+    void *m_block = nullptr;
+    void *m_free = nullptr;
+};
+
 } /* namespace util */
@@ -1,6 +1,7 @@
 #include "pose.hpp"
 
 #include <cmath>
+#include <cstdint>
 #include <string.h>
 
 #define UNW_LOCAL_ONLY
@@ -56,8 +57,6 @@ bool check_pose(const TrackedDevicePose_t & p)
   return true;
 }
 
-}
-
 // For a smooth experience, the correct pose for a frame must be known.
 // Of course this is not part of vulkan parameters, so we must inspect
 // the stack.
@@ -66,12 +65,8 @@ bool check_pose(const TrackedDevicePose_t & p)
 // Such a variable is a TrackedDevicePose_t, with both booleans to true,
 // which we compare to 1 to avoid false positives, a tracking result of
 // 200, and a rotation matrix (A*transpose(A)) close to identity.
-const TrackedDevicePose_t & find_pose_in_call_stack()
+TrackedDevicePose_t * scan_call_stack()
 {
-  static TrackedDevicePose_t * res;
-  if (res != nullptr)
-    return *res;
-  static TrackedDevicePose_t notfound;
   unw_context_t ctx;
   unw_getcontext(&ctx);
   unw_cursor_t cursor;
@@ -91,13 +86,38 @@ const TrackedDevicePose_t & find_pose_in_call_stack()
       {
         TrackedDevicePose_t * p = (TrackedDevicePose_t *) addr;
         if (check_pose(*p))
-        {
-          res = p;
-          return *p;
-        }
+          return p;
       }
-      return notfound;
+      return nullptr;
     }
   }
-  return notfound;
+  return nullptr;
+}
+
+}
+
+// The pose lives in the frame of CRenderThread::UpdateAsync, which runs for the whole life of the
+// render thread, so its address is kept per thread once found and only checked again on the next
+// presents. Presents from another thread or a change of the render loop search the stack again.
+const TrackedDevicePose_t * find_pose_in_call_stack()
+{
+  // While no pose passes the check (tracking lost), only retry the walk every so often
+  constexpr uint32_t RETRY_INTERVAL = 64;
+  static thread_local TrackedDevicePose_t * slot;
+  static thread_local uint32_t misses;
+  if (slot != nullptr and check_pose(*slot))
+  {
+    misses = 0;
+    return slot;
+  }
+  if (misses++ % RETRY_INTERVAL != 0)
+    return nullptr;
+
+  TrackedDevicePose_t * found = scan_call_stack();
+  if (found != nullptr)
+  {
+    slot = found;
+    misses = 0;
+  }
+  return found;
 }
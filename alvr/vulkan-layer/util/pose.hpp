@@ -23,4 +23,5 @@ struct TrackedDevicePose_t
   char bDeviceIsConnected;
 };
 
-const TrackedDevicePose_t & find_pose_in_call_stack();
+// Pose vrcompositor renders the current frame with, nullptr if it could not be found
+const TrackedDevicePose_t * find_pose_in_call_stack();
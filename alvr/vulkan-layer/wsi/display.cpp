@@ -3,13 +3,68 @@
 
 #include"layer/settings.h"
 
-#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
 
 wsi::display::display(layer::device_private_data& device_data, uint32_t queue_family_index, uint32_t queue_index):
   m_queue_family_index(queue_family_index),
   m_queue_index(queue_index),
   m_device_data(device_data)
 {
+  m_local_clock.epoch_ns = present_ring_now_ns();
+  m_local_clock.interval_ns = uint64_t(1e9 / Settings::Instance().m_refreshRate);
+  m_local_clock.divider = 1;
+}
+
+void wsi::display::use_clock(vsync_clock *clock)
+{
+  std::unique_lock<std::mutex> lock(m_clock_mutex);
+  clock->interval_ns = m_clock->interval_ns.load();
+  clock->epoch_ns = m_clock->epoch_ns.load();
+  m_clock = clock;
+}
+
+void wsi::display::release_clock(vsync_clock *clock)
+{
+  std::unique_lock<std::mutex> lock(m_clock_mutex);
+  if (m_clock != clock)
+    return;
+  m_local_clock.interval_ns = clock->interval_ns.load();
+  m_local_clock.epoch_ns = clock->epoch_ns.load();
+  m_clock = &m_local_clock;
+}
+
+uint64_t wsi::display::next_vsync(uint64_t last_vsync_ns)
+{
+  std::unique_lock<std::mutex> lock(m_clock_mutex);
+  // Half an interval at least between vsyncs, in case the phase moved earlier
+  return vsync_clock_next(*m_clock, last_vsync_ns + m_clock->interval_ns / 2);
+}
+
+uint32_t wsi::display::vsync_divider()
+{
+  std::unique_lock<std::mutex> lock(m_clock_mutex);
+  return std::max(m_clock->divider.load(std::memory_order_relaxed), 1u);
+}
+
+void wsi::display::signal_vsync_fence(VkQueue queue)
+{
+  if (m_device_data.host_fence_signal)
+  {
+    // -1 is a sync fd that already signaled, the payload is temporary and the next ResetFences
+    // of vrcompositor makes the fence unsignaled again
+    VkImportFenceFdInfoKHR import_info = {VK_STRUCTURE_TYPE_IMPORT_FENCE_FD_INFO_KHR};
+    import_info.fence = vsync_fence;
+    import_info.flags = VK_FENCE_IMPORT_TEMPORARY_BIT;
+    import_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+    import_info.fd = -1;
+    if (m_device_data.disp.ImportFenceFdKHR(m_device_data.device, &import_info) == VK_SUCCESS)
+      return;
+    m_device_data.host_fence_signal = false;
+  }
+  m_device_data.disp.QueueSubmit(queue, 0, nullptr, vsync_fence);
+  m_device_data.disp.QueueWaitIdle(queue);
 }
 
 VkFence wsi::display::get_vsync_fence()
@@ -23,18 +78,20 @@ VkFence wsi::display::get_vsync_fence()
   m_device_data.SetDeviceLoaderData(m_device_data.device, queue);
   m_vsync_thread = std::thread([this, queue]()
       {
-      auto refresh = Settings::Instance().m_refreshRate;
-      auto next_frame = std::chrono::steady_clock::now();
-      auto frame_time = std::chrono::duration_cast<decltype(next_frame)::duration>(std::chrono::duration<double>(1. / refresh));
+      Settings::Instance().ApplyThreadPolicy(THREAD_ROLE_VSYNC, "layer vsync");
+      uint64_t vsync_ns = present_ring_now_ns();
       while (not m_exiting) {
-        if (m_device_data.disp.GetFenceStatus(m_device_data.device, vsync_fence) == VK_NOT_READY)
+        vsync_ns = next_vsync(vsync_ns);
+        timespec ts{time_t(vsync_ns / 1000000000), long(vsync_ns % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+        // While idle vrcompositor only gets every divider-th vsync, the next one after the
+        // encoder resumes is signaled again
+        if ((m_vsync_count + 1) % vsync_divider() == 0 and
+            m_device_data.disp.GetFenceStatus(m_device_data.device, vsync_fence) == VK_NOT_READY)
         {
-          m_device_data.disp.QueueSubmit(queue, 0, nullptr, vsync_fence);
+          signal_vsync_fence(queue);
         }
-        m_device_data.disp.QueueWaitIdle(queue);
-        std::this_thread::sleep_until(next_frame);
         m_vsync_count += 1;
-        next_frame += frame_time;
       }
       m_device_data.disp.DestroyFence(m_device_data.device, vsync_fence, nullptr);
       });
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+#include <mutex>
 #include <vulkan/vulkan.h>
 #include <thread>
 
+#include "platform/linux/present_ring.h"
+
 namespace layer
 {
 class device_private_data;
@@ -18,10 +22,20 @@ class display {
 
     VkFence get_vsync_fence();
     VkFence peek_vsync_fence() { return vsync_fence;};
+    // Vsyncs follow clock, which starts at the phase of the display, until release_clock(). The
+    // display then keeps the last phase of clock on its own. A new swapchain takes the clock
+    // before the one it replaces is destroyed, releasing another clock than the current one does
+    // nothing.
+    void use_clock(vsync_clock *clock);
+    void release_clock(vsync_clock *clock);
 
     std::atomic<uint64_t> m_vsync_count{0};
 
   private:
+    uint64_t next_vsync(uint64_t last_vsync_ns);
+    uint32_t vsync_divider();
+    void signal_vsync_fence(VkQueue queue);
+
     std::atomic_bool m_thread_running{false};
     std::atomic_bool m_exiting{false};
     std::thread m_vsync_thread;
@@ -29,6 +43,11 @@ class display {
     uint32_t m_queue_family_index;
     uint32_t m_queue_index;
     layer::device_private_data& m_device_data;
+
+    // Guards m_clock, the present ring that holds it is unmapped with the swapchain
+    std::mutex m_clock_mutex;
+    vsync_clock m_local_clock;
+    vsync_clock *m_clock = &m_local_clock;
 };
 
 } // namespace wsi
@@ -51,10 +51,10 @@ VkResult
 surface_properties::get_surface_capabilities(VkPhysicalDevice physical_device, VkSurfaceKHR surface,
                                              VkSurfaceCapabilitiesKHR *surface_capabilities) {
     UNUSED(surface);
-    /* Image count limits */
-    surface_capabilities->minImageCount = 1;
-    /* There is no maximum theoretically speaking */
-    surface_capabilities->maxImageCount = UINT32_MAX;
+    /* Image count limits, every image is shared with the encoder so the count is fixed by the
+     * settings */
+    surface_capabilities->minImageCount = Settings::Instance().m_swapchainImages;
+    surface_capabilities->maxImageCount = Settings::Instance().m_swapchainImages;
 
     /* Surface extents */
     surface_capabilities->currentExtent = surface_capabilities->maxImageExtent =
@@ -144,8 +144,9 @@ VkResult surface_properties::get_surface_present_modes(VkPhysicalDevice physical
     UNUSED(surface);
 
     VkResult res = VK_SUCCESS;
-    static const std::array<VkPresentModeKHR, 2> modes = {VK_PRESENT_MODE_FIFO_KHR,
-                                                          VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+    static const std::array<VkPresentModeKHR, 3> modes = {VK_PRESENT_MODE_FIFO_KHR,
+                                                          VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+                                                          VK_PRESENT_MODE_MAILBOX_KHR};
 
     assert(present_mode_count != nullptr);
 
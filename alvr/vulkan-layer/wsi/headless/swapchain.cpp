@@ -28,6 +28,7 @@
  * @brief Contains the implementation for a headless swapchain.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <errno.h>
@@ -35,14 +36,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <vulkan/vulkan.h>
 #include <sys/mman.h>
+#include <mutex>
 
 #include <util/timed_semaphore.hpp>
 
+#include "layer/settings.h"
 #include "util/logger.h"
 #include "platform/linux/protocol.h"
 #include "swapchain.hpp"
@@ -54,48 +58,246 @@ namespace headless {
 struct image_data {
     /* Device memory backing the image. */
     VkDeviceMemory memory;
+    /* With the layer copy, the image shared with the encoder and its memory. */
+    VkImage shared_image;
+    VkDeviceMemory shared_memory;
+    /* Copy into shared_image, recorded once, and its two timestamps. */
+    VkCommandBuffer copy_commands;
+    VkQueryPool copy_queries;
+    bool copy_submitted;
+    /* With the copy queue, the semaphore the encoder waits on instead of the one of the image,
+     * and the value the image semaphore reaches once the last present is copied. */
+    VkSemaphore shared_semaphore;
+    uint64_t copied_value;
 };
 
 swapchain::swapchain(layer::device_private_data &dev_data, const VkAllocationCallbacks *pAllocator)
-    : wsi::swapchain_base(dev_data, pAllocator), m_display(*dev_data.display) {}
+    : wsi::swapchain_base(dev_data, pAllocator), m_display(*dev_data.display),
+      m_image_data_pool(m_allocator) {}
 
 swapchain::~swapchain() {
     /* Call the base's teardown */
     close(m_socket);
+    if (m_ring != nullptr) {
+        m_display.release_clock(&m_ring->vsync);
+        munmap(m_ring, sizeof(present_ring));
+    }
+    if (m_ring_fd != -1)
+        close(m_ring_fd);
+    if (m_doorbell != -1)
+        close(m_doorbell);
     teardown();
+    if (m_command_pool != VK_NULL_HANDLE)
+        m_device_data.disp.DestroyCommandPool(m_device, m_command_pool, nullptr);
+}
+
+namespace {
+// Usage of the shared images, the encoder side converts and copies them
+constexpr VkImageUsageFlags SHARED_IMAGE_USAGE = VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+  | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+  | VK_IMAGE_USAGE_SAMPLED_BIT
+  | VK_IMAGE_USAGE_STORAGE_BIT;
+
+VkFormatFeatureFlags features_for_usage(VkImageUsageFlags usage) {
+    VkFormatFeatureFlags features = 0;
+    if (usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+        features |= VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+    if (usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+        features |= VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    if (usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+        features |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+    if (usage & VK_IMAGE_USAGE_STORAGE_BIT)
+        features |= VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+    if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+        features |= VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+    return features;
+}
+
+uint32_t first_memory_type(uint32_t memory_type_bits) {
+    uint32_t mem_type_idx = 0;
+    for (; mem_type_idx < 8 * sizeof(memory_type_bits); ++mem_type_idx) {
+        if (memory_type_bits & (1u << mem_type_idx)) {
+            break;
+        }
+    }
+    assert(mem_type_idx <= 8 * sizeof(memory_type_bits) - 1);
+    return mem_type_idx;
+}
+} // namespace
+
+VkResult swapchain::init_platform(VkDevice device,
+                                  const VkSwapchainCreateInfoKHR *pSwapchainCreateInfo) {
+    if (!m_image_data_pool.init(m_swapchain_images.size())) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    m_layer_copy = Settings::Instance().m_layerCopy;
+    if (m_layer_copy) {
+        // The copies go to the copy queue of the device when it has one. Otherwise they are
+        // submitted with the presents, like the acquires this expects the application to present
+        // on queue family 0
+        VkResult res;
+        if (m_device_data.copy_queue_family != VK_QUEUE_FAMILY_IGNORED) {
+            m_copy_family = m_device_data.copy_queue_family;
+            m_device_data.disp.GetDeviceQueue(device, m_copy_family,
+                                              m_device_data.copy_queue_index, &m_copy_queue);
+            res = m_device_data.SetDeviceLoaderData(device, m_copy_queue);
+            if (res != VK_SUCCESS)
+                return res;
+        }
+        VkCommandPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.queueFamilyIndex = m_copy_family;
+        res = m_device_data.disp.CreateCommandPool(device, &pool_info, nullptr, &m_command_pool);
+        if (res != VK_SUCCESS)
+            return res;
+
+        auto &inst_disp = m_device_data.instance_data.disp;
+        uint32_t family_count = 0;
+        inst_disp.GetPhysicalDeviceQueueFamilyProperties(m_device_data.physical_device,
+                                                         &family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> family_props(family_count);
+        inst_disp.GetPhysicalDeviceQueueFamilyProperties(m_device_data.physical_device,
+                                                         &family_count, family_props.data());
+        VkPhysicalDeviceProperties props;
+        inst_disp.GetPhysicalDeviceProperties(m_device_data.physical_device, &props);
+        if (m_copy_family < family_count && family_props[m_copy_family].timestampValidBits != 0)
+            m_timestamp_period = props.limits.timestampPeriod;
+    }
+
+    VkImageUsageFlags shared_usage =
+        m_layer_copy ? SHARED_IMAGE_USAGE : pSwapchainCreateInfo->imageUsage | SHARED_IMAGE_USAGE;
+    if (m_device_data.dma_buf_export) {
+        m_drm_modifiers = find_drm_modifiers(pSwapchainCreateInfo->imageFormat, shared_usage);
+        if (m_drm_modifiers.empty())
+            Info("no DRM format modifier can export the swapchain images, using opaque fds\n");
+    }
+    return VK_SUCCESS;
+}
+
+std::vector<uint64_t> swapchain::find_drm_modifiers(VkFormat format, VkImageUsageFlags usage) {
+    auto &inst_disp = m_device_data.instance_data.disp;
+    VkPhysicalDevice physical_device = m_device_data.physical_device;
+
+    VkDrmFormatModifierPropertiesListEXT modifier_list = {};
+    modifier_list.sType = VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT;
+    VkFormatProperties2 format_props = {};
+    format_props.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
+    format_props.pNext = &modifier_list;
+    inst_disp.GetPhysicalDeviceFormatProperties2(physical_device, format, &format_props);
+    std::vector<VkDrmFormatModifierPropertiesEXT> modifier_props(modifier_list.drmFormatModifierCount);
+    modifier_list.pDrmFormatModifierProperties = modifier_props.data();
+    inst_disp.GetPhysicalDeviceFormatProperties2(physical_device, format, &format_props);
+
+    // VAAPI imports a single plane, modifiers with metadata planes (compression) are left out
+    VkFormatFeatureFlags features = features_for_usage(usage);
+    std::vector<uint64_t> modifiers;
+    for (const auto &props : modifier_props) {
+        if (props.drmFormatModifierPlaneCount != 1 ||
+            (props.drmFormatModifierTilingFeatures & features) != features)
+            continue;
+
+        VkPhysicalDeviceImageDrmFormatModifierInfoEXT modifier_info = {};
+        modifier_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT;
+        modifier_info.drmFormatModifier = props.drmFormatModifier;
+        modifier_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkPhysicalDeviceExternalImageFormatInfo external_info = {};
+        external_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO;
+        external_info.pNext = &modifier_info;
+        external_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+        VkPhysicalDeviceImageFormatInfo2 image_info = {};
+        image_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+        image_info.pNext = &external_info;
+        image_info.format = format;
+        image_info.type = VK_IMAGE_TYPE_2D;
+        image_info.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+        image_info.usage = usage;
+        image_info.flags = VK_IMAGE_CREATE_ALIAS_BIT;
+
+        VkExternalImageFormatProperties external_props = {};
+        external_props.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES;
+        VkImageFormatProperties2 image_props = {};
+        image_props.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+        image_props.pNext = &external_props;
+        if (inst_disp.GetPhysicalDeviceImageFormatProperties2(physical_device, &image_info,
+                                                              &image_props) != VK_SUCCESS)
+            continue;
+        if (!(external_props.externalMemoryProperties.externalMemoryFeatures &
+              VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT))
+            continue;
+        modifiers.push_back(props.drmFormatModifier);
+    }
+    return modifiers;
 }
 
 VkResult swapchain::create_image(const VkImageCreateInfo &image_create,
                                  wsi::swapchain_image &image) {
     VkResult res = VK_SUCCESS;
+    const bool dma_buf = !m_drm_modifiers.empty();
+    const VkExternalMemoryHandleTypeFlagBits handle_type =
+        dma_buf ? VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT
+                : VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+    VkImageDrmFormatModifierListCreateInfoEXT modifier_info = {};
+    modifier_info.sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_LIST_CREATE_INFO_EXT;
+    modifier_info.drmFormatModifierCount = m_drm_modifiers.size();
+    modifier_info.pDrmFormatModifiers = m_drm_modifiers.data();
+    VkExternalMemoryImageCreateInfo ext_info = {};
+    ext_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    ext_info.handleTypes = handle_type;
+    if (dma_buf)
+        ext_info.pNext = &modifier_info;
+
+    /* Create image_data */
+    image_data *data = m_image_data_pool.create();
+    if (data == nullptr) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    image.data = reinterpret_cast<void *>(data);
+    image.status = wsi::swapchain_image::FREE;
+
+    // The image the encoder reads, the one of the application unless the layer copies it
+    VkImage *shared_image = &image.image;
+    VkDeviceMemory *shared_memory = &data->memory;
     m_create_info = image_create;
-    m_create_info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT
-      | VK_IMAGE_USAGE_TRANSFER_DST_BIT
-      | VK_IMAGE_USAGE_SAMPLED_BIT
-      | VK_IMAGE_USAGE_STORAGE_BIT;
-    res = m_device_data.disp.CreateImage(m_device, &m_create_info, nullptr, &image.image);
+    m_create_info.usage |= SHARED_IMAGE_USAGE;
+    if (m_layer_copy) {
+        res = create_copied_image(image_create, image, *data);
+        if (res != VK_SUCCESS) {
+            destroy_image(image);
+            return res;
+        }
+        shared_image = &data->shared_image;
+        shared_memory = &data->shared_memory;
+        m_create_info.usage = SHARED_IMAGE_USAGE;
+        m_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        m_create_info.queueFamilyIndexCount = 0;
+    }
+    m_create_info.pNext = &ext_info;
+    if (dma_buf)
+        m_create_info.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+    res = m_device_data.disp.CreateImage(m_device, &m_create_info, nullptr, shared_image);
     if (res != VK_SUCCESS) {
+        destroy_image(image);
         return res;
     }
     m_create_info.pNext = nullptr;
     m_create_info.pQueueFamilyIndices = nullptr;
 
     VkMemoryRequirements memory_requirements;
-    m_device_data.disp.GetImageMemoryRequirements(m_device, image.image, &memory_requirements);
+    m_device_data.disp.GetImageMemoryRequirements(m_device, *shared_image, &memory_requirements);
 
     /* Find a memory type */
-    size_t mem_type_idx = 0;
-    for (; mem_type_idx < 8 * sizeof(memory_requirements.memoryTypeBits); ++mem_type_idx) {
-        if (memory_requirements.memoryTypeBits & (1u << mem_type_idx)) {
-            break;
-        }
-    }
+    uint32_t mem_type_idx = first_memory_type(memory_requirements.memoryTypeBits);
 
-    assert(mem_type_idx <= 8 * sizeof(memory_requirements.memoryTypeBits) - 1);
+    VkExportMemoryAllocateInfo export_info = {};
+    export_info.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+    export_info.handleTypes = handle_type;
 
     VkMemoryDedicatedAllocateInfo ded_info = {};
     ded_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
-    ded_info.image = image.image;
+    ded_info.pNext = &export_info;
+    ded_info.image = *shared_image;
 
     VkMemoryAllocateInfo mem_info = {};
     mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
@@ -103,31 +305,55 @@ VkResult swapchain::create_image(const VkImageCreateInfo &image_create,
     mem_info.memoryTypeIndex = mem_type_idx;
     mem_info.pNext = &ded_info;
     m_mem_index = mem_type_idx;
-    image_data *data = nullptr;
-
-    /* Create image_data */
-    data = m_allocator.create<image_data>(1);
-    if (data == nullptr) {
-        m_device_data.disp.DestroyImage(m_device, image.image, get_allocation_callbacks());
-        return VK_ERROR_OUT_OF_HOST_MEMORY;
-    }
-    image.data = reinterpret_cast<void *>(data);
-    image.status = wsi::swapchain_image::FREE;
 
-    res = m_device_data.disp.AllocateMemory(m_device, &mem_info, nullptr, &data->memory);
+    res = m_device_data.disp.AllocateMemory(m_device, &mem_info, nullptr, shared_memory);
     assert(VK_SUCCESS == res);
     if (res != VK_SUCCESS) {
         destroy_image(image);
         return res;
     }
 
-    res = m_device_data.disp.BindImageMemory(m_device, image.image, data->memory, 0);
+    res = m_device_data.disp.BindImageMemory(m_device, *shared_image, *shared_memory, 0);
     assert(VK_SUCCESS == res);
     if (res != VK_SUCCESS) {
         destroy_image(image);
         return res;
     }
 
+    if (dma_buf) {
+        VkImageDrmFormatModifierPropertiesEXT modifier_props = {};
+        modifier_props.sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_PROPERTIES_EXT;
+        res = m_device_data.disp.GetImageDrmFormatModifierPropertiesEXT(m_device, *shared_image,
+                                                                         &modifier_props);
+        if (res != VK_SUCCESS) {
+            destroy_image(image);
+            return res;
+        }
+        VkImageSubresource plane = {VK_IMAGE_ASPECT_MEMORY_PLANE_0_BIT_EXT, 0, 0};
+        VkSubresourceLayout layout;
+        m_device_data.disp.GetImageSubresourceLayout(m_device, *shared_image, &plane, &layout);
+
+        // The encoder creates all its images from one description
+        if (m_fds.empty()) {
+            m_drm_modifier = modifier_props.drmFormatModifier;
+            m_plane_layout = layout;
+        } else if (m_drm_modifier != modifier_props.drmFormatModifier ||
+                   m_plane_layout.offset != layout.offset ||
+                   m_plane_layout.rowPitch != layout.rowPitch) {
+            Error("swapchain images got different DRM format modifiers or layouts\n");
+            destroy_image(image);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    if (m_layer_copy) {
+        res = record_copy(image, *data);
+        if (res != VK_SUCCESS) {
+            destroy_image(image);
+            return res;
+        }
+    }
+
     /* Initialize presentation fence. */
     VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
     res = m_device_data.disp.CreateFence(m_device, &fence_info, nullptr, &image.present_fence);
@@ -140,8 +366,8 @@ VkResult swapchain::create_image(const VkImageCreateInfo &image_create,
     VkMemoryGetFdInfoKHR fd_info = {};
     fd_info.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
     fd_info.pNext = NULL;
-    fd_info.memory = data->memory;
-    fd_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+    fd_info.memory = *shared_memory;
+    fd_info.handleType = handle_type;
 
     int fd;
     res = m_device_data.disp.GetMemoryFdKHR(m_device, &fd_info, &fd);
@@ -157,6 +383,14 @@ VkResult swapchain::create_image(const VkImageCreateInfo &image_create,
     exp_info.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
     exp_info.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
 
+    // With timeline semaphores the value tells rendered presents apart, see present_packet
+    VkSemaphoreTypeCreateInfoKHR type_info = {};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    type_info.initialValue = 0;
+    if (m_device_data.timeline_semaphores)
+        exp_info.pNext = &type_info;
+
     VkSemaphoreCreateInfo sem_info = {};
     sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
     sem_info.pNext = &exp_info;
@@ -167,16 +401,31 @@ VkResult swapchain::create_image(const VkImageCreateInfo &image_create,
         destroy_image(image);
         return res;
     }
+    // With the copy queue the encoder and the application no longer take turns on the image, the
+    // encoder gets a semaphore of its own
+    VkSemaphore *shared_semaphore = &image.semaphore;
+    if (m_copy_queue != VK_NULL_HANDLE) {
+        res = m_device_data.disp.CreateSemaphore(m_device, &sem_info, nullptr,
+                                                 &data->shared_semaphore);
+        if (res != VK_SUCCESS) {
+            Error("CreateSemaphore failed\n");
+            destroy_image(image);
+            return res;
+        }
+        shared_semaphore = &data->shared_semaphore;
+    }
 
-    VkSubmitInfo submit = {};
-    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = &image.semaphore;
-    m_device_data.disp.QueueSubmit(m_queue, 1, &submit, VK_NULL_HANDLE);
+    if (!m_device_data.timeline_semaphores) {
+        VkSubmitInfo submit = {};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &image.semaphore;
+        m_device_data.disp.QueueSubmit(m_queue, 1, &submit, VK_NULL_HANDLE);
+    }
 
     VkSemaphoreGetFdInfoKHR sem_fd_info = {};
     sem_fd_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
-    sem_fd_info.semaphore = image.semaphore;
+    sem_fd_info.semaphore = *shared_semaphore;
     sem_fd_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
 
     res = m_device_data.disp.GetSemaphoreFdKHR(m_device, &sem_fd_info, &fd);
@@ -191,27 +440,173 @@ VkResult swapchain::create_image(const VkImageCreateInfo &image_create,
     return res;
 }
 
+VkResult swapchain::create_copied_image(const VkImageCreateInfo &image_create,
+                                        wsi::swapchain_image &image, image_data &data) {
+    // Only the usage of the application and the source of the copy, nothing is exported
+    VkImageCreateInfo create_info = image_create;
+    create_info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    // Shared with the copy queue, so that its family needs no ownership transfers
+    std::vector<uint32_t> families;
+    if (m_copy_queue != VK_NULL_HANDLE) {
+        if (create_info.sharingMode == VK_SHARING_MODE_CONCURRENT)
+            families.assign(create_info.pQueueFamilyIndices,
+                            create_info.pQueueFamilyIndices + create_info.queueFamilyIndexCount);
+        else
+            families.push_back(0);
+        if (std::find(families.begin(), families.end(), m_copy_family) == families.end())
+            families.push_back(m_copy_family);
+        create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        create_info.queueFamilyIndexCount = families.size();
+        create_info.pQueueFamilyIndices = families.data();
+    }
+    VkResult res = m_device_data.disp.CreateImage(m_device, &create_info, nullptr, &image.image);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    m_device_data.disp.GetImageMemoryRequirements(m_device, image.image, &memory_requirements);
+
+    VkMemoryDedicatedAllocateInfo ded_info = {};
+    ded_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    ded_info.image = image.image;
+
+    VkMemoryAllocateInfo mem_info = {};
+    mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    mem_info.pNext = &ded_info;
+    mem_info.allocationSize = memory_requirements.size;
+    mem_info.memoryTypeIndex = first_memory_type(memory_requirements.memoryTypeBits);
+    res = m_device_data.disp.AllocateMemory(m_device, &mem_info, nullptr, &data.memory);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+    return m_device_data.disp.BindImageMemory(m_device, image.image, data.memory, 0);
+}
+
+VkResult swapchain::record_copy(wsi::swapchain_image &image, image_data &data) {
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = m_command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    VkResult res =
+        m_device_data.disp.AllocateCommandBuffers(m_device, &alloc_info, &data.copy_commands);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+    // Command buffers are dispatchable, the loader has to know them
+    res = m_device_data.SetDeviceLoaderData(m_device, data.copy_commands);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+
+    if (m_timestamp_period != 0) {
+        VkQueryPoolCreateInfo query_info = {};
+        query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_info.queryCount = 2;
+        res = m_device_data.disp.CreateQueryPool(m_device, &query_info, nullptr,
+                                                 &data.copy_queries);
+        if (res != VK_SUCCESS) {
+            return res;
+        }
+    }
+
+    // A present can be submitted while the previous copy of the image is still pending, the
+    // application only waits for it on the GPU
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    res = m_device_data.disp.BeginCommandBuffer(data.copy_commands, &begin_info);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+    auto &disp = m_device_data.disp;
+    VkCommandBuffer commands = data.copy_commands;
+    const VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0,
+                                           m_create_info.arrayLayers};
+
+    // The presents wait for the rendering at every stage, the barriers only change the layouts.
+    // The encoder still owns the last copy, the shared image is given back after it is done.
+    VkImageMemoryBarrier barriers[2] = {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = image.image;
+    barriers[0].subresourceRange = range;
+    barriers[1] = barriers[0];
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].image = data.shared_image;
+
+    if (data.copy_queries != VK_NULL_HANDLE)
+        disp.CmdResetQueryPool(commands, data.copy_queries, 0, 2);
+    disp.CmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+    if (data.copy_queries != VK_NULL_HANDLE)
+        disp.CmdWriteTimestamp(commands, VK_PIPELINE_STAGE_TRANSFER_BIT, data.copy_queries, 0);
+
+    VkImageCopy region = {};
+    region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, m_create_info.arrayLayers};
+    region.dstSubresource = region.srcSubresource;
+    region.extent = m_create_info.extent;
+    disp.CmdCopyImage(commands, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                      data.shared_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    if (data.copy_queries != VK_NULL_HANDLE)
+        disp.CmdWriteTimestamp(commands, VK_PIPELINE_STAGE_TRANSFER_BIT, data.copy_queries, 1);
+
+    // The application image goes back to the layout it was presented in, the shared one to the
+    // layout the encoder keeps its images in
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].dstAccessMask = 0;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = 0;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    disp.CmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 2,
+                            barriers);
+
+    return disp.EndCommandBuffer(commands);
+}
+
 int swapchain::send_fds() {
     // This function does the arcane magic for sending
     // file descriptors over unix domain sockets
     // Stolen from https://gist.github.com/kokjo/75cec0f466fc34fa2922
     //
-    // There will always be 6 fds (for the 3 images and sempahores created in the swapchain) so we can avoid
-    // dynamic length. Initially, I tried to send the length in the normal data field (msg.msg_iov /
+    // The fds are the image and semaphore of every swapchain image, then the present ring and
+    // its doorbell. The receiver knows how many to expect from init_packet.num_images, which is
+    // sent first. Initially, I tried to send the length in the normal data field (msg.msg_iov /
     // data) but for some reason it was emptied on arrival, no matter what I did.
     //
     struct msghdr msg;
     struct iovec iov[1];
     struct cmsghdr *cmsg = NULL;
-    assert(m_fds.size() == 6);
-    int fds[6];
+    assert(m_fds.size() == 2 * m_swapchain_images.size());
+    if (m_swapchain_images.size() > MAX_SWAPCHAIN_IMAGES) {
+        Error("swapchain has %zu images, at most %u can be shared\n", m_swapchain_images.size(),
+              MAX_SWAPCHAIN_IMAGES);
+        return -1;
+    }
+    int fds[IPC_FDS_MAX];
+    size_t fds_size = (m_fds.size() + 2) * sizeof(int);
     char ctrl_buf[CMSG_SPACE(sizeof(fds))];
     char data[1];
 
     std::copy(m_fds.begin(), m_fds.end(), fds);
+    fds[m_fds.size()] = m_ring_fd;
+    fds[m_fds.size() + 1] = m_doorbell;
 
     memset(&msg, 0, sizeof(struct msghdr));
-    memset(ctrl_buf, 0, CMSG_SPACE(sizeof(fds)));
+    memset(ctrl_buf, 0, sizeof(ctrl_buf));
 
     iov[0].iov_base = data;
     iov[0].iov_len = sizeof(data);
@@ -220,24 +615,54 @@ int swapchain::send_fds() {
     msg.msg_namelen = 0;
     msg.msg_iov = iov;
     msg.msg_iovlen = 1;
-    msg.msg_controllen = CMSG_SPACE(sizeof(fds));
+    msg.msg_controllen = CMSG_SPACE(fds_size);
     msg.msg_control = ctrl_buf;
 
     cmsg = CMSG_FIRSTHDR(&msg);
     cmsg->cmsg_level = SOL_SOCKET;
     cmsg->cmsg_type = SCM_RIGHTS;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    cmsg->cmsg_len = CMSG_LEN(fds_size);
 
-    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, fds_size);
 
     int ret = sendmsg(m_socket, &msg, 0);
 
     for (auto fd: m_fds)
       close(fd);
+    m_fds.clear();
+    // the mapping stays valid, only the doorbell is needed from now on
+    close(m_ring_fd);
+    m_ring_fd = -1;
 
     return ret;
 }
 
+bool swapchain::create_present_ring() {
+    m_ring_fd = memfd_create("alvr-present-ring", MFD_CLOEXEC);
+    if (m_ring_fd == -1) {
+        perror("memfd_create");
+        return false;
+    }
+    if (ftruncate(m_ring_fd, sizeof(present_ring)) == -1) {
+        perror("ftruncate");
+        return false;
+    }
+    void *ring = mmap(NULL, sizeof(present_ring), PROT_READ | PROT_WRITE, MAP_SHARED, m_ring_fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    // the memfd is zero filled, which is the initial state of the ring
+    m_ring = reinterpret_cast<present_ring *>(ring);
+
+    m_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_doorbell == -1) {
+        perror("eventfd");
+        return false;
+    }
+    return true;
+}
+
 bool swapchain::try_connect() {
     Debug("swapchain::try_connect\n");
     m_socketPath = getenv("XDG_RUNTIME_DIR");
@@ -270,7 +695,12 @@ bool swapchain::try_connect() {
       .device_name = {},
       .image_create_info = m_create_info,
       .mem_index = m_mem_index,
-      .source_pid = getpid()};
+      .source_pid = getpid(),
+      .timeline_semaphores = m_device_data.timeline_semaphores,
+      .dma_buf = !m_drm_modifiers.empty(),
+      .drm_modifier = m_drm_modifier,
+      .plane_offset = m_plane_layout.offset,
+      .plane_pitch = m_plane_layout.rowPitch};
     memcpy(init.device_name.data(), prop.deviceName, sizeof(prop.deviceName));
     ret = write(m_socket, &init, sizeof(init));
     if (ret == -1) {
@@ -278,6 +708,11 @@ bool swapchain::try_connect() {
         exit(1);
     }
 
+    if (!create_present_ring()) {
+        exit(1);
+    }
+    m_display.use_clock(&m_ring->vsync);
+
     ret = send_fds();
     if (ret == -1) {
         perror("sendmsg");
@@ -291,32 +726,171 @@ bool swapchain::try_connect() {
 void swapchain::present_image(uint32_t pending_index) {
     const auto & pose = m_swapchain_images[pending_index].pose.mDeviceToAbsoluteTracking.m;
 
-    if (in_flight_index != UINT32_MAX)
-        unpresent_image(in_flight_index);
-    in_flight_index = pending_index;
     if (!m_connected) {
         m_connected = try_connect();
     }
-    if (m_connected) {
-        int ret;
-        present_packet packet;
-        packet.image = pending_index;
-        packet.frame = m_display.m_vsync_count;
-        memcpy(&packet.pose, pose, sizeof(packet.pose));
-        ret = write(m_socket, &packet, sizeof(packet));
-        if (ret == -1) {
-            //FIXME: try to reconnect?
-        }
+    present_packet packet;
+    packet.image = pending_index;
+    packet.frame = m_display.m_vsync_count;
+    packet.semaphore_value = m_swapchain_images[pending_index].present_value;
+    packet.pose_found = m_swapchain_images[pending_index].pose_found;
+    packet.present_ns = m_swapchain_images[pending_index].present_ns;
+    packet.rendered_ns = m_swapchain_images[pending_index].rendered_ns;
+    packet.copy_ns = m_copy_ns.load(std::memory_order_relaxed);
+    memcpy(&packet.pose, pose, sizeof(packet.pose));
+
+    if (m_copy_queue != VK_NULL_HANDLE) {
+        // The application gets the image back right away, its next acquire waits for the copy on
+        // the GPU
+        bool copied = m_connected && submit_copy(pending_index, &packet.semaphore_value);
+        unpresent_image(pending_index);
+        if (!copied)
+            return;
+    } else {
+        if (in_flight_index != UINT32_MAX)
+            unpresent_image(in_flight_index);
+        in_flight_index = pending_index;
+        if (!m_connected)
+            return;
+    }
+
+    if (m_device_data.timeline_semaphores)
+        present_ring_offer(*m_ring, pending_index, packet.semaphore_value);
+    if (present_ring_publish(*m_ring, packet)) {
+        uint64_t one = 1;
+        write(m_doorbell, &one, sizeof(one));
+    }
+}
+
+uint64_t swapchain::reclaim_image(uint32_t image_index) {
+    const auto &image = m_swapchain_images[image_index];
+    if (m_copy_queue != VK_NULL_HANDLE) {
+        auto *data = reinterpret_cast<image_data *>(image.data);
+        return std::max(image.present_value, data->copied_value);
+    }
+    if (!m_connected)
+        return image.present_value;
+
+    uint64_t claimed = present_ring_revoke(*m_ring, image_index);
+    if (claimed != 0)
+        wait_for_encoder(image.semaphore, claimed, image_index);
+    return image.present_value;
+}
+
+void swapchain::wait_for_encoder(VkSemaphore semaphore, uint64_t claimed, uint32_t image_index) {
+    // The encoder is still reading the image or about to, this is the only wait left on the CPU.
+    // It is bounded so that a stuck encoder cannot block the application, the frame would then
+    // only tear.
+    uint64_t encoded = claimed + 1;
+    VkSemaphoreWaitInfoKHR wait_info = {};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &semaphore;
+    wait_info.pValues = &encoded;
+    constexpr uint64_t ENCODE_TIMEOUT_NS = 100000000;
+    if (m_device_data.disp.WaitSemaphoresKHR(m_device, &wait_info, ENCODE_TIMEOUT_NS) != VK_SUCCESS)
+        Error("timed out waiting for the encoder to release image %u\n", image_index);
+}
+
+bool swapchain::submit_copy(uint32_t image_index, uint64_t *shared_value) {
+    auto &image = m_swapchain_images[image_index];
+    auto *data = reinterpret_cast<image_data *>(image.data);
+
+    // The shared image is overwritten, the encoder must be done with its previous copy. The wait
+    // is on the page flip thread, the application only waits for it once it runs out of images.
+    uint64_t claimed = present_ring_revoke(*m_ring, image_index);
+    if (claimed != 0)
+        wait_for_encoder(data->shared_semaphore, claimed, image_index);
+
+    // The copy waits for the rendering on the GPU. The image semaphore then tells the application
+    // that the copy is done, the shared one tells the encoder, both take the value after the
+    // present value: the present values leave room for it.
+    uint64_t copied = image.present_value + 1;
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSemaphore signal_semaphores[] = {image.semaphore, data->shared_semaphore};
+    uint64_t signal_values[] = {copied, copied};
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timeline_info.waitSemaphoreValueCount = 1;
+    timeline_info.pWaitSemaphoreValues = &image.present_value;
+    timeline_info.signalSemaphoreValueCount = 2;
+    timeline_info.pSignalSemaphoreValues = signal_values;
+
+    VkCommandBuffer commands = copy_commands(image_index);
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.pNext = &timeline_info;
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = &image.semaphore;
+    submit.pWaitDstStageMask = &wait_stage;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &commands;
+    submit.signalSemaphoreCount = 2;
+    submit.pSignalSemaphores = signal_semaphores;
+
+    VkResult res;
+    {
+        std::lock_guard<std::mutex> lock(m_device_data.copy_queue_lock);
+        res = m_device_data.disp.QueueSubmit(m_copy_queue, 1, &submit, VK_NULL_HANDLE);
     }
+    if (res != VK_SUCCESS) {
+        Error("failed to submit the copy of image %u: %d\n", image_index, res);
+        return false;
+    }
+    data->copied_value = copied;
+    *shared_value = copied;
+    return true;
+}
+
+VkCommandBuffer swapchain::present_commands(uint32_t image_index) {
+    if (m_copy_queue != VK_NULL_HANDLE)
+        return VK_NULL_HANDLE;
+    return copy_commands(image_index);
+}
+
+VkCommandBuffer swapchain::copy_commands(uint32_t image_index) {
+    auto *data = reinterpret_cast<image_data *>(m_swapchain_images[image_index].data);
+    if (data == nullptr || data->copy_commands == VK_NULL_HANDLE)
+        return VK_NULL_HANDLE;
+
+    // The timestamps of the previous copy of the image, it is usually long done. They are not
+    // waited for, the copy then resets them.
+    if (data->copy_queries != VK_NULL_HANDLE && data->copy_submitted) {
+        uint64_t results[4];
+        VkResult res = m_device_data.disp.GetQueryPoolResults(
+            m_device, data->copy_queries, 0, 2, sizeof(results), results, 2 * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (res == VK_SUCCESS && results[1] != 0 && results[3] != 0 && results[2] >= results[0])
+            m_copy_ns.store(uint64_t((results[2] - results[0]) * m_timestamp_period),
+                            std::memory_order_relaxed);
+    }
+    data->copy_submitted = true;
+    return data->copy_commands;
 }
 
 void swapchain::destroy_image(wsi::swapchain_image &image) {
+    // The image is given back before its copy is done, which may still read it
+    auto *copied = reinterpret_cast<image_data *>(image.data);
+    if (copied != nullptr && copied->copied_value != 0 && image.semaphore != VK_NULL_HANDLE) {
+        VkSemaphoreWaitInfoKHR wait_info = {};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &image.semaphore;
+        wait_info.pValues = &copied->copied_value;
+        m_device_data.disp.WaitSemaphoresKHR(m_device, &wait_info, UINT64_MAX);
+    }
+
     if (image.status != wsi::swapchain_image::INVALID) {
         if (image.present_fence != VK_NULL_HANDLE) {
             m_device_data.disp.DestroyFence(m_device, image.present_fence, nullptr);
             image.present_fence = VK_NULL_HANDLE;
         }
 
+        if (image.semaphore != VK_NULL_HANDLE) {
+            m_device_data.disp.DestroySemaphore(m_device, image.semaphore, nullptr);
+            image.semaphore = VK_NULL_HANDLE;
+        }
+
         if (image.image != VK_NULL_HANDLE) {
             m_device_data.disp.DestroyImage(m_device, image.image, get_allocation_callbacks());
             image.image = VK_NULL_HANDLE;
@@ -329,7 +903,28 @@ void swapchain::destroy_image(wsi::swapchain_image &image) {
             m_device_data.disp.FreeMemory(m_device, data->memory, nullptr);
             data->memory = VK_NULL_HANDLE;
         }
-        m_allocator.destroy(1, data);
+        if (data->copy_commands != VK_NULL_HANDLE) {
+            m_device_data.disp.FreeCommandBuffers(m_device, m_command_pool, 1,
+                                                  &data->copy_commands);
+            data->copy_commands = VK_NULL_HANDLE;
+        }
+        if (data->copy_queries != VK_NULL_HANDLE) {
+            m_device_data.disp.DestroyQueryPool(m_device, data->copy_queries, nullptr);
+            data->copy_queries = VK_NULL_HANDLE;
+        }
+        if (data->shared_semaphore != VK_NULL_HANDLE) {
+            m_device_data.disp.DestroySemaphore(m_device, data->shared_semaphore, nullptr);
+            data->shared_semaphore = VK_NULL_HANDLE;
+        }
+        if (data->shared_image != VK_NULL_HANDLE) {
+            m_device_data.disp.DestroyImage(m_device, data->shared_image, nullptr);
+            data->shared_image = VK_NULL_HANDLE;
+        }
+        if (data->shared_memory != VK_NULL_HANDLE) {
+            m_device_data.disp.FreeMemory(m_device, data->shared_memory, nullptr);
+            data->shared_memory = VK_NULL_HANDLE;
+        }
+        m_image_data_pool.destroy(data);
         image.data = nullptr;
     }
 
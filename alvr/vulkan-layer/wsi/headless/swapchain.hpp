@@ -30,17 +30,21 @@
 
 #pragma once
 
+#include <atomic>
 #include <vector>
 
 #include <vulkan/vk_icd.h>
 #include <vulkan/vulkan.h>
 #include <wsi/swapchain_base.hpp>
 
+#include "platform/linux/present_ring.h"
 #include "platform/linux/protocol.h"
 
 namespace wsi {
 namespace headless {
 
+struct image_data;
+
 /**
  * @brief Headless swapchain class.
  *
@@ -56,11 +60,9 @@ class swapchain : public wsi::swapchain_base {
 
   protected:
     /**
-     * @brief Platform specific init
+     * @brief Platform specific init, selects the DRM format modifiers of the dma-buf export
      */
-    VkResult init_platform(VkDevice device, const VkSwapchainCreateInfoKHR *pSwapchainCreateInfo) {
-        return VK_SUCCESS;
-    };
+    VkResult init_platform(VkDevice device, const VkSwapchainCreateInfoKHR *pSwapchainCreateInfo);
 
     /**
      * @brief Creates a new swapchain image.
@@ -90,17 +92,68 @@ class swapchain : public wsi::swapchain_base {
      */
     void destroy_image(wsi::swapchain_image &image);
 
+    /**
+     * @brief Revokes the image from the encoder, waiting for it to be done if it took it. With
+     * the copy queue the encoder never reads the image, the acquire only waits for its copy.
+     *
+     * @param image_index Index of the acquired image.
+     */
+    uint64_t reclaim_image(uint32_t image_index);
+
+    /**
+     * @brief With the layer copy on the queue of the application, the commands copying the image
+     * into the one of the encoder.
+     *
+     * @param image_index Index of the presented image.
+     */
+    VkCommandBuffer present_commands(uint32_t image_index);
+
   private:
     bool try_connect();
+    bool create_present_ring();
+    std::vector<uint64_t> find_drm_modifiers(VkFormat format, VkImageUsageFlags usage);
+    VkResult create_copied_image(const VkImageCreateInfo &image_create,
+                                 wsi::swapchain_image &image, image_data &data);
+    VkResult record_copy(wsi::swapchain_image &image, image_data &data);
+    VkCommandBuffer copy_commands(uint32_t image_index);
+    // Queues the copy of a present on the copy queue, *shared_value is then the value its
+    // shared semaphore reaches once the copy is done
+    bool submit_copy(uint32_t image_index, uint64_t *shared_value);
+    // Waits, bounded, until the encoder is done with the claimed value of semaphore
+    void wait_for_encoder(VkSemaphore semaphore, uint64_t claimed, uint32_t image_index);
     int send_fds();
     int m_socket = -1;
+    // Shared with CEncoder, presents go through the ring once connected
+    present_ring *m_ring = nullptr;
+    int m_ring_fd = -1;
+    int m_doorbell = -1;
     std::string m_socketPath;
     bool m_connected = false;
     std::vector<int> m_fds;
     VkImageCreateInfo m_create_info;
     size_t m_mem_index;
+    // Modifiers the images may be created with, empty if they are exported as opaque fds
+    std::vector<uint64_t> m_drm_modifiers;
+    // Modifier and layout the driver picked, the same for every image
+    uint64_t m_drm_modifier = 0;
+    VkSubresourceLayout m_plane_layout = {};
     display &m_display;
+    // The application renders into images of its own usage and every present copies them into
+    // the images shared with the encoder, so that the driver can keep them compressed
+    bool m_layer_copy = false;
+    // Queue of the copies when the device has one, see layer::device_private_data. The copies
+    // then leave the queue of the application and the encoder waits for them on semaphores of
+    // the shared images, the image of the application is given back once it is copied.
+    VkQueue m_copy_queue = VK_NULL_HANDLE;
+    uint32_t m_copy_family = 0;
+    VkCommandPool m_command_pool = VK_NULL_HANDLE;
+    // ns per timestamp tick, 0 if the queue has no timestamps
+    double m_timestamp_period = 0;
+    // GPU time of the latest copy that finished, sent with the presents
+    std::atomic<uint64_t> m_copy_ns{0};
     uint32_t in_flight_index = UINT32_MAX;
+    // image_data of every swapchain image, sized in init_platform()
+    util::object_pool<image_data> m_image_data_pool;
 };
 
 } /* namespace headless */
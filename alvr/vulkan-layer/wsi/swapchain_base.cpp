@@ -36,12 +36,15 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
+#include <vector>
 
 #include <unistd.h>
 #include <vulkan/vulkan.h>
 
 #include "display.hpp"
 #include "swapchain_base.hpp"
+#include "layer/settings.h"
 
 #if VULKAN_WSI_DEBUG > 0
 #define WSI_PRINT_ERROR(...) fprintf(stderr, ##__VA_ARGS__)
@@ -51,12 +54,21 @@
 
 namespace wsi {
 
+/* CLOCK_MONOTONIC, like the timestamps of the present ring, so the encoder can compare them. */
+static uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
 void swapchain_base::page_flip_thread() {
     auto &sc_images = m_swapchain_images;
     VkResult vk_res = VK_SUCCESS;
     uint64_t timeout = UINT64_MAX;
     constexpr uint64_t SEMAPHORE_TIMEOUT = 250000000; /* 250 ms. */
 
+    Settings::Instance().ApplyThreadPolicy(THREAD_ROLE_PRESENT, "page flip");
+
     /* No mutex is needed for the accesses to m_page_flip_thread_run variable as after the variable
      * is initialized it is only ever changed to false. The while loop will make the thread read the
      * value repeatedly, and the combination of semaphores and thread joins will force any changes
@@ -76,23 +88,49 @@ void swapchain_base::page_flip_thread() {
         uint32_t pending_index = m_pending_buffer_pool.ring[m_pending_buffer_pool.head];
         m_pending_buffer_pool.head = (m_pending_buffer_pool.head + 1) % m_pending_buffer_pool.size;
 
-        /* We wait for the fence of the oldest pending image to be signalled. */
-        vk_res = m_device_data.disp.WaitForFences(
-            m_device, 1, &sc_images[pending_index].present_fence, VK_TRUE, timeout);
-        if (vk_res != VK_SUCCESS) {
-            m_is_valid = false;
-            m_free_image_semaphore.post();
-            continue;
+        /* We wait for the fence of the oldest pending image to be signalled. With timeline
+         * semaphores the image goes out right away, the consumer waits for the present value on
+         * the GPU. */
+        if (!m_device_data.timeline_semaphores) {
+            vk_res = m_device_data.disp.WaitForFences(
+                m_device, 1, &sc_images[pending_index].present_fence, VK_TRUE, timeout);
+            if (vk_res != VK_SUCCESS) {
+                m_is_valid = false;
+                m_free_image_semaphore.post();
+                continue;
+            }
+            sc_images[pending_index].rendered_ns = monotonic_ns();
+        } else {
+            sc_images[pending_index].rendered_ns = 0;
         }
 
         /* If the descendant has started presenting the queue_present operation has marked the image
          * as FREE so we simply release it and continue. */
         if (sc_images[pending_index].status == swapchain_image::FREE) {
+            if (m_device_data.timeline_semaphores) {
+                VkSemaphoreWaitInfoKHR wait_info = {};
+                wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+                wait_info.semaphoreCount = 1;
+                wait_info.pSemaphores = &sc_images[pending_index].semaphore;
+                wait_info.pValues = &sc_images[pending_index].present_value;
+                m_device_data.disp.WaitSemaphoresKHR(m_device, &wait_info, timeout);
+            }
             destroy_image(sc_images[pending_index]);
             m_free_image_semaphore.post();
             continue;
         }
 
+        /* In mailbox mode a newer present replaces the queued one: the image goes back to the
+         * application without reaching the encoder, which only ever wants the latest frame. The
+         * application then gets free images while the encoder is slower than it. With timeline
+         * semaphores the next acquire still waits on the GPU for the rendering of the image. */
+        if (m_present_mode == VK_PRESENT_MODE_MAILBOX_KHR &&
+            m_page_flip_semaphore.wait(0) == VK_SUCCESS) {
+            m_page_flip_semaphore.post();
+            unpresent_image(pending_index);
+            continue;
+        }
+
         /* First present of the swapchain. If it has an ancestor, wait until all the pending buffers
          * from the ancestor have finished page flipping before we set mode. */
         if (m_first_present) {
@@ -147,8 +185,9 @@ VkResult swapchain_base::init(VkDevice device,
 
     /* Check presentMode has a compatible value with swapchain - everything else should be taken
      * care at image creation.*/
-    static const std::array<VkPresentModeKHR, 2> present_modes = {VK_PRESENT_MODE_FIFO_KHR,
-                                                                  VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+    static const std::array<VkPresentModeKHR, 3> present_modes = {VK_PRESENT_MODE_FIFO_KHR,
+                                                                  VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+                                                                  VK_PRESENT_MODE_MAILBOX_KHR};
     bool present_mode_found = false;
     for (uint32_t i = 0; i < present_modes.size() && !present_mode_found; i++) {
         if (swapchain_create_info->presentMode == present_modes[i]) {
@@ -159,6 +198,7 @@ VkResult swapchain_base::init(VkDevice device,
     if (!present_mode_found) {
         return VK_ERROR_INITIALIZATION_FAILED;
     }
+    m_present_mode = swapchain_create_info->presentMode;
 
     /* Init image to invalid values. */
     if (!m_swapchain_images.try_resize(swapchain_create_info->minImageCount))
@@ -354,6 +394,11 @@ VkResult swapchain_base::acquire_next_image(uint64_t timeout, VkSemaphore semaph
 
     assert(i < m_swapchain_images.size());
 
+    uint64_t wait_value = 0;
+    if (m_device_data.timeline_semaphores) {
+        wait_value = reclaim_image(*image_index);
+    }
+
     if (VK_NULL_HANDLE != semaphore || VK_NULL_HANDLE != fence) {
         VkSubmitInfo submit = {};
         submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -363,6 +408,23 @@ VkResult swapchain_base::acquire_next_image(uint64_t timeout, VkSemaphore semaph
             submit.pSignalSemaphores = &semaphore;
         }
 
+        /* Without the present fence the previous rendering of the image may still be running, the
+         * application is only released once its semaphore reached the reclaimed value. */
+        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        uint64_t signal_value = 0;
+        VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+        if (m_device_data.timeline_semaphores) {
+            timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timeline_info.waitSemaphoreValueCount = 1;
+            timeline_info.pWaitSemaphoreValues = &wait_value;
+            timeline_info.signalSemaphoreValueCount = submit.signalSemaphoreCount;
+            timeline_info.pSignalSemaphoreValues = &signal_value;
+            submit.pNext = &timeline_info;
+            submit.waitSemaphoreCount = 1;
+            submit.pWaitSemaphores = &m_swapchain_images[*image_index].semaphore;
+            submit.pWaitDstStageMask = &wait_stage;
+        }
+
         submit.commandBufferCount = 0;
         submit.pCommandBuffers = nullptr;
         retval = m_device_data.disp.QueueSubmit(m_queue, 1, &submit, fence);
@@ -411,8 +473,9 @@ VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *pr
                                        const uint32_t image_index) {
     VkResult result;
     bool descendent_started_presenting = false;
+    uint64_t present_ns = monotonic_ns();
 
-    const auto & pose = find_pose_in_call_stack();
+    const TrackedDevicePose_t *pose = find_pose_in_call_stack();
 
     if (m_descendant != VK_NULL_HANDLE) {
         auto *desc = reinterpret_cast<swapchain_base *>(m_descendant);
@@ -427,31 +490,54 @@ VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *pr
 
     /* When the semaphore that comes in is signalled, we know that all work is done. So, we do not
      * want to block any future Vulkan queue work on it. So, we pass in BOTTOM_OF_PIPE bit as the
-     * wait flag.
+     * wait flag. The present commands of the implementation run after the rendering though.
      */
-    VkPipelineStageFlags pipeline_stage_flags = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    VkCommandBuffer commands = present_commands(image_index);
+    std::vector<VkPipelineStageFlags> pipeline_stage_flags(
+        present_info->waitSemaphoreCount, commands != VK_NULL_HANDLE
+                                              ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+                                              : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
     VkSubmitInfo submit_info = {VK_STRUCTURE_TYPE_SUBMIT_INFO,
                                 NULL,
                                 present_info->waitSemaphoreCount,
                                 present_info->pWaitSemaphores,
-                                &pipeline_stage_flags,
-                                0,
-                                NULL,
+                                pipeline_stage_flags.data(),
+                                commands != VK_NULL_HANDLE ? 1u : 0u,
+                                &commands,
                                 0,
                                 NULL};
 
     assert(m_swapchain_images[image_index].status == swapchain_image::ACQUIRED);
-    result =
-        m_device_data.disp.ResetFences(m_device, 1, &m_swapchain_images[image_index].present_fence);
-    if (result != VK_SUCCESS) {
-        return result;
-    }
+    if (m_device_data.timeline_semaphores) {
+        /* The image semaphore reaches the present value once rendering is done, the consumer
+         * waits for it on the GPU. */
+        uint64_t present_value = ++m_present_count * PRESENT_VALUE_STRIDE;
+        VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timeline_info.signalSemaphoreValueCount = 1;
+        timeline_info.pSignalSemaphoreValues = &present_value;
+        submit_info.pNext = &timeline_info;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &m_swapchain_images[image_index].semaphore;
+
+        result = m_device_data.disp.QueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+        m_swapchain_images[image_index].present_value = present_value;
+    } else {
+        result = m_device_data.disp.ResetFences(m_device, 1,
+                                                &m_swapchain_images[image_index].present_fence);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
 
-    result = m_device_data.disp.QueueSubmit(queue, 1, &submit_info,
-                                            m_swapchain_images[image_index].present_fence);
-    if (result != VK_SUCCESS) {
-        return result;
+        result = m_device_data.disp.QueueSubmit(queue, 1, &submit_info,
+                                                m_swapchain_images[image_index].present_fence);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
     }
 
     /* If the descendant has started presenting, we should release the image
@@ -469,7 +555,10 @@ VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *pr
     }
 
     m_swapchain_images[image_index].status = swapchain_image::PENDING;
-    m_swapchain_images[image_index].pose = pose;
+    m_swapchain_images[image_index].present_ns = present_ns;
+    m_swapchain_images[image_index].pose_found = pose != nullptr;
+    if (pose != nullptr)
+        m_swapchain_images[image_index].pose = *pose;
 
     m_pending_buffer_pool.ring[m_pending_buffer_pool.tail] = image_index;
     m_pending_buffer_pool.tail = (m_pending_buffer_pool.tail + 1) % m_pending_buffer_pool.size;
@@ -58,8 +58,19 @@ struct swapchain_image {
 
     VkFence present_fence{VK_NULL_HANDLE};
     VkSemaphore semaphore{VK_NULL_HANDLE};
+    /* With timeline semaphores, the value signaled once the image of the last present is
+     * rendered. */
+    uint64_t present_value{0};
 
     TrackedDevicePose_t pose;
+    /* Whether pose is the one of the last present, or left from an earlier one. */
+    bool pose_found{false};
+
+    /* CLOCK_MONOTONIC timestamps of the last present, in nanoseconds: the QueuePresent call and
+     * the present fence signaling in the page flip thread. rendered_ns is 0 with timeline
+     * semaphores, the page flip thread does not wait for the rendering then. */
+    uint64_t present_ns{0};
+    uint64_t rendered_ns{0};
 };
 
 /**
@@ -342,6 +353,39 @@ class swapchain_base {
      */
     virtual VkResult get_free_buffer(uint64_t *timeout) { return VK_SUCCESS; }
 
+    /**
+     * @brief Hook called with timeline semaphores before an image is handed back to the
+     * application.
+     *
+     * The implementation makes sure whoever consumed the last present of the image is done reading
+     * it, and returns the value the image semaphore must reach before the application writes to
+     * it again.
+     *
+     * @param image_index Index of the acquired image.
+     */
+    virtual uint64_t reclaim_image(uint32_t image_index) {
+        return m_swapchain_images[image_index].present_value;
+    }
+
+    /**
+     * @brief Hook for commands to run on a present, once the rendering of the image is done.
+     *
+     * They go into the submit of queue_present, before the image semaphore or present fence is
+     * signaled. Returns VK_NULL_HANDLE when there is nothing to run.
+     *
+     * @param image_index Index of the presented image.
+     */
+    virtual VkCommandBuffer present_commands(uint32_t image_index) { return VK_NULL_HANDLE; }
+
+    /**
+     * @brief Timeline values given to the presents.
+     *
+     * Consecutive presents are PRESENT_VALUE_STRIDE apart, leaving the consumer room to signal
+     * its own progress on the image semaphore in between.
+     */
+    static constexpr uint64_t PRESENT_VALUE_STRIDE = 16;
+    uint64_t m_present_count = 0;
+
   private:
     /**
      * @brief Wait for a buffer to become free.
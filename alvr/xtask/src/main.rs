@@ -44,6 +44,10 @@ SUBCOMMANDS:
     bump-alxr-versions  Bump alxr-client package versions
     clippy              Show warnings for selected clippy lints
     prettier            Format JS and CSS files with prettier; Requires Node.js and NPM.
+    bench-fec           Build and run the offline FEC/packetization benchmark of the server (Linux and macOS)
+    bench-loss          Build and run the offline loss recovery benchmark of the video stream (Linux and macOS)
+    bench-tracking      Build and run the microbenchmarks of the tracking input path of the server (Linux and macOS)
+    bench-capture       Build and run the end-to-end benchmark of the capture path, per encoder (Linux)
 
 FLAGS:
     --reproducible      Force cargo to build reproducibly. Used only for build subcommands
@@ -1006,6 +1010,269 @@ fn clippy() {
     .unwrap();
 }
 
+// Send path of the driver, relative to alvr/server/cpp
+const BENCH_SERVER_SOURCES: &[&str] = &[
+    "alvr_server/Av1Obu.cpp",
+    "alvr_server/BitrateController.cpp",
+    "alvr_server/ClientConnection.cpp",
+    "alvr_server/ClockSync.cpp",
+    "alvr_server/FecController.cpp",
+    "alvr_server/FecEncoder.cpp",
+    "alvr_server/FoveationController.cpp",
+    "alvr_server/FoveationVars.cpp",
+    "alvr_server/FrameTrace.cpp",
+    "alvr_server/GpuMonitor.cpp",
+    "alvr_server/IdleController.cpp",
+    "alvr_server/Logger.cpp",
+    "alvr_server/ResolutionController.cpp",
+    "alvr_server/Settings.cpp",
+    "alvr_server/VSyncScheduler.cpp",
+    "alvr_server/VideoRecorder.cpp",
+    "alvr_server/driverlog.cpp",
+    "ALVR-common/exception.cpp",
+    "ALVR-common/reedsolomon/rs.c",
+];
+
+// The benchmark links the send path of the driver with stubbed Rust callbacks, see
+// alvr/server/cpp/tools/fec_bench.cpp. Extra arguments are passed through BENCH_ARGS.
+fn bench_fec() {
+    let cpp_dir = afs::workspace_dir().join("alvr/server/cpp");
+    let bench_path = afs::build_dir().join("fec_bench");
+    fs::create_dir_all(afs::build_dir()).unwrap();
+
+    let sources = BENCH_SERVER_SOURCES.join(" ");
+    let cxx = env::var("CXX").unwrap_or_else(|_| "c++".to_owned());
+
+    command::run_in(
+        &cpp_dir,
+        &format!(
+            "{cxx} -O2 -std=c++17 -I. -Iopenvr/headers tools/fec_bench.cpp {sources} -o {} -lpthread -ldl",
+            bench_path.to_string_lossy()
+        ),
+    )
+    .unwrap();
+
+    let bench_args = env::var("BENCH_ARGS").unwrap_or_default();
+    command::run(&format!("{} {bench_args}", bench_path.to_string_lossy())).unwrap();
+}
+
+// The server send path and the client FEC decoder in one binary, see
+// alvr/server/cpp/tools/loss_bench.cpp. It is built once per shard layout of BENCH_SHARDS, a list
+// of ALVR_FEC_SHARDS_MAX:ALVR_MAX_VIDEO_BUFFER_SIZE pairs. The client has its own Reed-Solomon
+// library with the same symbol names, it is renamed. Extra arguments are passed through BENCH_ARGS.
+fn bench_loss() {
+    let workspace_dir = afs::workspace_dir();
+    let server_dir = workspace_dir.join("alvr/server/cpp");
+    let client_dir = workspace_dir.join("alvr/client/android");
+    let build_dir = afs::build_dir().join("loss_bench");
+    fs::create_dir_all(&build_dir).unwrap();
+
+    let cc = env::var("CC").unwrap_or_else(|_| "cc".to_owned());
+    let cxx = env::var("CXX").unwrap_or_else(|_| "c++".to_owned());
+    let rs_renames = [
+        "reed_solomon_init",
+        "reed_solomon_new",
+        "reed_solomon_release",
+        "reed_solomon_encode",
+        "reed_solomon_reconstruct",
+    ]
+    .iter()
+    .map(|name| format!("-D{name}=client_{name}"))
+    .collect::<Vec<_>>()
+    .join(" ");
+    let client_includes = format!(
+        "-I{} -I{}",
+        client_dir.join("ALVR-common").to_string_lossy(),
+        client_dir.join("app/src/main/cpp").to_string_lossy()
+    );
+    let server_sources = BENCH_SERVER_SOURCES.join(" ");
+    let bench_args = env::var("BENCH_ARGS").unwrap_or_default();
+    let shard_layouts =
+        env::var("BENCH_SHARDS").unwrap_or_else(|_| "64:1400 20:1400 128:1400 64:1200".to_owned());
+
+    for layout in shard_layouts.split_whitespace() {
+        let (shards_max, buffer_size) = layout
+            .split_once(':')
+            .expect("BENCH_SHARDS entries must be <shards max>:<video buffer size>");
+        let defines = format!(
+            "-DALVR_BENCH_FEC_SHARDS_MAX={shards_max} -DALVR_BENCH_MAX_VIDEO_BUFFER_SIZE={buffer_size}"
+        );
+        let layout_dir = build_dir.join(format!("{shards_max}_{buffer_size}"));
+        fs::create_dir_all(&layout_dir).unwrap();
+        let object = |name: &str| layout_dir.join(name).to_string_lossy().into_owned();
+
+        command::run_in(
+            &client_dir,
+            &format!(
+                "{cc} -O2 {defines} {rs_renames} -c ALVR-common/reedsolomon/rs.c -o {}",
+                object("client_rs.o")
+            ),
+        )
+        .unwrap();
+        command::run_in(
+            &client_dir,
+            &format!(
+                "{cxx} -O2 -std=c++20 -DALXR_CLIENT {defines} {rs_renames} {client_includes} \
+                 -c app/src/main/cpp/fec.cpp -o {}",
+                object("fec.o")
+            ),
+        )
+        .unwrap();
+        command::run_in(
+            &server_dir,
+            &format!(
+                "{cxx} -O2 -std=c++20 -DALXR_CLIENT {defines} {rs_renames} {client_includes} \
+                 -c tools/loss_bench_client.cpp -o {}",
+                object("loss_bench_client.o")
+            ),
+        )
+        .unwrap();
+        command::run_in(
+            &server_dir,
+            &format!(
+                "{cxx} -O2 -std=c++17 {defines} -I. -Iopenvr/headers tools/loss_bench.cpp \
+                 {server_sources} {} {} {} -o {} -lpthread -ldl",
+                object("client_rs.o"),
+                object("fec.o"),
+                object("loss_bench_client.o"),
+                object("loss_bench")
+            ),
+        )
+        .unwrap();
+
+        command::run(&format!("{} {bench_args}", object("loss_bench"))).unwrap();
+        println!();
+    }
+}
+
+// The tracking path links against stub SteamVR interfaces, see
+// alvr/server/cpp/tools/tracking_bench.cpp. Extra arguments are passed through BENCH_ARGS.
+fn bench_tracking() {
+    let cpp_dir = afs::workspace_dir().join("alvr/server/cpp");
+    let bench_path = afs::build_dir().join("tracking_bench");
+    fs::create_dir_all(afs::build_dir()).unwrap();
+
+    let sources = BENCH_SERVER_SOURCES
+        .iter()
+        .chain(&[
+            "alvr_server/HandSkeleton.cpp",
+            "alvr_server/OvrController.cpp",
+            "alvr_server/Paths.cpp",
+            "alvr_server/PoseHistory.cpp",
+            "alvr_server/PosePredictor.cpp",
+            "alvr_server/TrackedDevice.cpp",
+        ])
+        .copied()
+        .collect::<Vec<_>>()
+        .join(" ");
+    let cxx = env::var("CXX").unwrap_or_else(|_| "c++".to_owned());
+
+    command::run_in(
+        &cpp_dir,
+        &format!(
+            "{cxx} -O2 -std=c++17 -I. -Iopenvr/headers tools/tracking_bench.cpp {sources} -o {} -lpthread -ldl",
+            bench_path.to_string_lossy()
+        ),
+    )
+    .unwrap();
+
+    let bench_args = env::var("BENCH_ARGS").unwrap_or_default();
+    command::run(&format!("{} {bench_args}", bench_path.to_string_lossy())).unwrap();
+}
+
+// A Vulkan application presenting through the layer and the capture and encode path of the
+// driver, see alvr/server/cpp/tools/capture_bench.cpp. It runs once per encoder of BENCH_ENCODERS,
+// encoders that cannot be created on this machine fail and are skipped. Extra arguments are passed
+// through BENCH_ARGS.
+fn bench_capture() {
+    let workspace_dir = afs::workspace_dir();
+    let cpp_dir = workspace_dir.join("alvr/server/cpp");
+    let build_dir = afs::build_dir().join("capture_bench");
+    let layer_manifest_dir = build_dir.join("explicit_layer.d");
+    fs::create_dir_all(&layer_manifest_dir).unwrap();
+
+    command::run_in(
+        &workspace_dir.join("alvr/vulkan-layer"),
+        "cargo build --release",
+    )
+    .unwrap();
+    let layer_path = afs::target_dir()
+        .join("release")
+        .join(afs::dynlib_fname("alvr_vulkan_layer"));
+    let manifest =
+        fs::read_to_string(workspace_dir.join("alvr/vulkan-layer/layer/alvr_x86_64.json"))
+            .unwrap()
+            .replace(
+                "../../../lib64/libalvr_vulkan_layer.so",
+                &layer_path.to_string_lossy(),
+            );
+    fs::write(layer_manifest_dir.join("alvr_x86_64.json"), manifest).unwrap();
+
+    for shader in ["FrameRender.comp", "RgbToYuv.comp"] {
+        command::run_in(
+            &cpp_dir,
+            &format!(
+                "glslangValidator -V --target-env vulkan1.1 -o {} platform/linux/shader/{shader}",
+                build_dir.join(format!("{shader}.spv")).to_string_lossy()
+            ),
+        )
+        .unwrap();
+    }
+
+    let mut platform_sources = vec![];
+    for dir in ["platform/linux", "platform/linux/generated"] {
+        for entry in fs::read_dir(cpp_dir.join(dir)).unwrap() {
+            let name = entry.unwrap().file_name().to_string_lossy().into_owned();
+            if name.ends_with(".cpp") {
+                platform_sources.push(format!("{dir}/{name}"));
+            }
+        }
+    }
+    let sources = BENCH_SERVER_SOURCES
+        .iter()
+        .copied()
+        .chain([
+            "alvr_server/EncoderCache.cpp",
+            "alvr_server/FoveatedEncoding.cpp",
+            "alvr_server/IDRScheduler.cpp",
+            "alvr_server/PoseHistory.cpp",
+            "alvr_server/ThreadPolicy.cpp",
+            "shared/threadtools.cpp",
+        ])
+        .chain(platform_sources.iter().map(|source| source.as_str()))
+        .collect::<Vec<_>>()
+        .join(" ");
+    let bench_path = build_dir.join("capture_bench");
+    let cxx = env::var("CXX").unwrap_or_else(|_| "c++".to_owned());
+
+    command::run_in(
+        &cpp_dir,
+        &format!(
+            "{cxx} -O2 -std=c++17 -I. -Iopenvr/headers tools/capture_bench.cpp {sources} -o {} \
+             $(pkg-config --cflags --libs vulkan libva libavutil libavcodec libavfilter libswscale) \
+             -lpthread -ldl",
+            bench_path.to_string_lossy()
+        ),
+    )
+    .unwrap();
+
+    let bench_args = env::var("BENCH_ARGS").unwrap_or_default();
+    let encoders =
+        env::var("BENCH_ENCODERS").unwrap_or_else(|_| "vulkan vaapi nvenc sw".to_owned());
+    for encoder in encoders.split_whitespace() {
+        let result = command::run(&format!(
+            "VK_LAYER_PATH={} {} --encoder {encoder} --shaders {} {bench_args}",
+            layer_manifest_dir.to_string_lossy(),
+            bench_path.to_string_lossy(),
+            build_dir.to_string_lossy()
+        ));
+        if result.is_err() {
+            println!("{encoder} encoder unavailable or failed");
+        }
+        println!();
+    }
+}
+
 fn prettier() {
     command::run("npx -p prettier@2.2.1 prettier --config alvr/xtask/.prettierrc --write '**/*[!.min].{css,js}'").unwrap();
 }
@@ -1206,6 +1473,10 @@ fn main() {
                 "bump-alxr-versions" => version::bump_alxr_version(version, is_nightly),
                 "clippy" => clippy(),
                 "prettier" => prettier(),
+                "bench-fec" => bench_fec(),
+                "bench-loss" => bench_loss(),
+                "bench-tracking" => bench_tracking(),
+                "bench-capture" => bench_capture(),
                 _ => {
                     println!("\nUnrecognized subcommand.");
                     println!("{HELP_STR}");
@@ -3,7 +3,7 @@
 with pkgs;
 mkShell {
   stdenv = pkgs.clangStdenv;
-  nativeBuildInputs = [ cmake pkg-config ];
+  nativeBuildInputs = [ cmake glslang pkg-config ];
   buildInputs = [
     binutils-unwrapped
     alsaLib